@@ -15,6 +15,17 @@
 #define CHAR_WIDTH  9
 #define CHAR_HEIGHT 16
 
+// Glyph cache: cells drawn once per character and color, in an atlas as
+// wide as the window, and copied out after
+#define GLYPH_ROWS  8
+#define GLYPH_SLOTS (GLYPH_ROWS * TERM_WIDTH)
+#define FB_WIDTH    (TERM_WIDTH * CHAR_WIDTH)
+
+typedef struct {
+    uint32_t pixels[GLYPH_ROWS * CHAR_HEIGHT][FB_WIDTH];
+    uint16_t keys[GLYPH_SLOTS];     // Character and color plus one, 0 for unused
+} glyph_cache_t;
+
 typedef struct {
     prism_surface_t* surface;
     char buffer[TERM_HEIGHT][TERM_WIDTH];
@@ -23,6 +34,14 @@ typedef struct {
     uint32_t cursor_y;
     bool cursor_visible;
     
+    // What has changed since the window was last drawn: cells, lines
+    // scrolled off the top, and the cursor as it was drawn
+    bool dirty[TERM_HEIGHT][TERM_WIDTH];
+    uint32_t scrolled;
+    uint32_t drawn_cursor_x;
+    uint32_t drawn_cursor_y;
+    bool drawn_cursor;
+    
     // Shell process
     pid_t shell_pid;
     int master_fd;
@@ -30,6 +49,7 @@ typedef struct {
 } terminal_t;
 
 static terminal_t* g_terminal;
+static glyph_cache_t* g_glyphs;
 
 // =============================================================================
 // Terminal Operations
@@ -37,6 +57,7 @@ static terminal_t* g_terminal;
 
 void terminal_init(void) {
     g_terminal = calloc(1, sizeof(terminal_t));
+    g_glyphs = calloc(1, sizeof(glyph_cache_t));
     
     // Create window
     g_terminal->surface = prism_create_window(TERM_WIDTH * CHAR_WIDTH,
@@ -84,6 +105,7 @@ void terminal_init(void) {
 void terminal_clear(void) {
     memset(g_terminal->buffer, ' ', sizeof(g_terminal->buffer));
     memset(g_terminal->colors, 0x07, sizeof(g_terminal->colors));
+    memset(g_terminal->dirty, true, sizeof(g_terminal->dirty));
     g_terminal->cursor_x = 0;
     g_terminal->cursor_y = 0;
     terminal_redraw();
@@ -104,6 +126,7 @@ void terminal_putchar(char c) {
             if (g_terminal->cursor_x > 0) {
                 g_terminal->cursor_x--;
                 g_terminal->buffer[g_terminal->cursor_y][g_terminal->cursor_x] = ' ';
+                g_terminal->dirty[g_terminal->cursor_y][g_terminal->cursor_x] = true;
             }
             break;
             
@@ -114,6 +137,7 @@ void terminal_putchar(char c) {
         default:
             if (c >= 32 && c < 127) {
                 g_terminal->buffer[g_terminal->cursor_y][g_terminal->cursor_x] = c;
+                g_terminal->dirty[g_terminal->cursor_y][g_terminal->cursor_x] = true;
                 g_terminal->cursor_x++;
             }
             break;
@@ -134,60 +158,120 @@ void terminal_putchar(char c) {
     terminal_redraw();
 }
 
+// The window's pixels move up with the lines at the next redraw, so only
+// the new line is drawn
 void terminal_scroll(void) {
     // Move lines up
     memmove(g_terminal->buffer[0], g_terminal->buffer[1],
            (TERM_HEIGHT - 1) * TERM_WIDTH);
     memmove(g_terminal->colors[0], g_terminal->colors[1],
            (TERM_HEIGHT - 1) * TERM_WIDTH);
+    memmove(g_terminal->dirty[0], g_terminal->dirty[1],
+           (TERM_HEIGHT - 1) * TERM_WIDTH);
     
     // Clear last line
     memset(g_terminal->buffer[TERM_HEIGHT - 1], ' ', TERM_WIDTH);
     memset(g_terminal->colors[TERM_HEIGHT - 1], 0x07, TERM_WIDTH);
+    memset(g_terminal->dirty[TERM_HEIGHT - 1], true, TERM_WIDTH);
+    g_terminal->scrolled++;
 }
 
 // =============================================================================
 // Rendering
 // =============================================================================
 
+// Copy the cell for c in color to x, y, drawing it into the cache first
+// if it isn't there
+static void terminal_draw_cell(uint32_t* framebuffer, int x, int y, char c, uint8_t color) {
+    uint16_t key = (uint16_t)(((uint8_t)c << 8) | color) + 1;
+    uint32_t slot = (key * 2654435761u >> 16) % GLYPH_SLOTS;
+    int gx = (slot % TERM_WIDTH) * CHAR_WIDTH;
+    int gy = (slot / TERM_WIDTH) * CHAR_HEIGHT;
+    
+    if (g_glyphs->keys[slot] != key) {
+        uint32_t fg = terminal_get_color(color & 0x0F);
+        uint32_t bg = terminal_get_color((color >> 4) & 0x0F);
+        terminal_draw_char(&g_glyphs->pixels[0][0], gx, gy, c, fg, bg);
+        g_glyphs->keys[slot] = key;
+    }
+    
+    for (int i = 0; i < CHAR_HEIGHT; i++) {
+        memcpy(&framebuffer[(y + i) * FB_WIDTH + x], &g_glyphs->pixels[gy + i][gx],
+               CHAR_WIDTH * sizeof(uint32_t));
+    }
+}
+
+// Draw only what changed: scrolled lines move as pixels, and cells redraw
+// from the glyph cache. The damage is the rows' changed spans, or all of it
+// after a scroll.
 void terminal_redraw(void) {
     uint32_t* framebuffer = prism_surface_get_buffer(g_terminal->surface);
     if (!framebuffer) {
         return;
     }
     
-    // Clear background
-    for (int y = 0; y < TERM_HEIGHT * CHAR_HEIGHT; y++) {
-        for (int x = 0; x < TERM_WIDTH * CHAR_WIDTH; x++) {
-            framebuffer[y * TERM_WIDTH * CHAR_WIDTH + x] = 0xFF000000;
-        }
+    uint32_t scrolled = g_terminal->scrolled;
+    if (scrolled >= TERM_HEIGHT) {
+        memset(g_terminal->dirty, true, sizeof(g_terminal->dirty));
+    } else if (scrolled > 0) {
+        memmove(framebuffer, &framebuffer[scrolled * CHAR_HEIGHT * FB_WIDTH],
+                (TERM_HEIGHT - scrolled) * CHAR_HEIGHT * FB_WIDTH * sizeof(uint32_t));
+    }
+    g_terminal->scrolled = 0;
+    
+    // The cursor was drawn over a cell, wherever that's got to
+    if (g_terminal->drawn_cursor && g_terminal->drawn_cursor_y >= scrolled) {
+        g_terminal->dirty[g_terminal->drawn_cursor_y - scrolled][g_terminal->drawn_cursor_x] = true;
+    }
+    if (g_terminal->cursor_visible) {
+        g_terminal->dirty[g_terminal->cursor_y][g_terminal->cursor_x] = true;
     }
     
     // Draw characters
     for (int row = 0; row < TERM_HEIGHT; row++) {
+        int first = -1;
+        int last = -1;
         for (int col = 0; col < TERM_WIDTH; col++) {
-            char c = g_terminal->buffer[row][col];
-            uint8_t color = g_terminal->colors[row][col];
+            if (!g_terminal->dirty[row][col]) {
+                continue;
+            }
+            g_terminal->dirty[row][col] = false;
             
-            uint32_t fg = terminal_get_color(color & 0x0F);
-            uint32_t bg = terminal_get_color((color >> 4) & 0x0F);
+            terminal_draw_cell(framebuffer, col * CHAR_WIDTH, row * CHAR_HEIGHT,
+                               g_terminal->buffer[row][col], g_terminal->colors[row][col]);
+            if (first < 0) {
+                first = col;
+            }
+            last = col;
+        }
             
-            terminal_draw_char(framebuffer, col * CHAR_WIDTH, row * CHAR_HEIGHT,
-                             c, fg, bg);
+        if (first >= 0 && !scrolled) {
+            prism_rect_t damage = {
+                .x = first * CHAR_WIDTH,
+                .y = row * CHAR_HEIGHT,
+                .width = (last - first + 1) * CHAR_WIDTH,
+                .height = CHAR_HEIGHT
+            };
+            prism_surface_damage(g_terminal->surface, &damage);
         }
     }
     
     // Draw cursor
+    g_terminal->drawn_cursor = g_terminal->cursor_visible;
     if (g_terminal->cursor_visible) {
         int x = g_terminal->cursor_x * CHAR_WIDTH;
         int y = g_terminal->cursor_y * CHAR_HEIGHT;
         
         for (int i = 0; i < CHAR_HEIGHT; i++) {
-            framebuffer[(y + i) * TERM_WIDTH * CHAR_WIDTH + x] = 0xFFFFFFFF;
+            framebuffer[(y + i) * FB_WIDTH + x] = 0xFFFFFFFF;
         }
+        g_terminal->drawn_cursor_x = g_terminal->cursor_x;
+        g_terminal->drawn_cursor_y = g_terminal->cursor_y;
     }
     
-    prism_surface_damage_all(g_terminal->surface);
+    if (scrolled) {
+        prism_surface_damage_all(g_terminal->surface);
+    }
     prism_surface_commit(g_terminal->surface);
 }
 
@@ -7,6 +7,7 @@
 #include "continuum_core.h"
 #include "flux_memory.h"
 #include "temporal_scheduler.h"
+#include "continuum_trace.h"
 
 // =============================================================================
 // Global IPC State
@@ -14,34 +15,69 @@
 
 static conduit_registry_t g_conduit_registry = {
     .initialized = false,
-    .conduit_count = 0,
-    .message_count = 0,
-    .total_bytes = 0
+    .conduit_count = 0
 };
 
 static conduit_t* g_conduits[MAX_CONDUITS];
 static spinlock_t g_conduit_lock = SPINLOCK_INIT;
 
-// Name hash table for fast lookup
-#define NAME_HASH_SIZE 256
-static struct {
-    char name[CONDUIT_NAME_MAX];
-    conduit_t* conduit;
-} g_name_table[NAME_HASH_SIZE];
+// Open-addressed name table, linear probing. Slots hold the conduit itself;
+// removed entries leave a tombstone so probe chains stay intact for readers.
+#define NAME_TABLE_SIZE    (MAX_CONDUITS * 2)
+#define NAME_TOMBSTONE     ((conduit_t*)1)
+
+typedef struct {
+    uint32_t mask;
+    uint32_t used;
+    uint32_t tombstones;
+    conduit_t* slots[];
+} name_table_t;
+
+static name_table_t* g_name_table;
+
+// Byte trie over conduit names for prefix broadcast. Children hang off a
+// singly linked sibling list; nodes are only unlinked by writers and freed
+// after a registry grace period.
+typedef struct topic_node {
+    struct topic_node* parent;
+    struct topic_node* child;
+    struct topic_node* sibling;
+    struct topic_node* retired;   // Free list once unlinked
+    conduit_t* conduit;           // Conduit named by the path to this node
+    char ch;
+} topic_node_t;
+
+static topic_node_t g_topic_root;
+
+// Registry lookups run in read sections; writers hold g_conduit_lock and
+// wait them out before freeing what they unlinked
+static continuum_reader_t g_registry_readers[MAX_CPU_CORES];
 
 // =============================================================================
 // Hash Function
 // =============================================================================
 
+// Hashes the name as stored, i.e. truncated to CONDUIT_NAME_MAX - 1
 static uint32_t hash_name(const char* name) {
     uint32_t hash = 5381;
-    int c;
     
-    while ((c = *name++)) {
-        hash = ((hash << 5) + hash) + c;
+    for (size_t i = 0; i < CONDUIT_NAME_MAX - 1 && name[i]; i++) {
+        hash = ((hash << 5) + hash) + (uint8_t)name[i];
     }
     
-    return hash % NAME_HASH_SIZE;
+    return hash;
+}
+
+static bool name_matches(const char* stored, const char* name) {
+    for (size_t i = 0; i < CONDUIT_NAME_MAX - 1; i++) {
+        if (stored[i] != name[i]) {
+            return false;
+        }
+        if (!name[i]) {
+            return true;
+        }
+    }
+    return true;
 }
 
 // =============================================================================
@@ -64,6 +100,23 @@ static void ringbuf_destroy(ring_buffer_t* rb) {
     }
 }
 
+static void ringbuf_copy_in(ring_buffer_t* rb, const void* data, size_t len) {
+    // Write in up to two chunks (wrap around)
+    size_t first_chunk = rb->size - rb->tail;
+    if (first_chunk > len) {
+        first_chunk = len;
+    }
+    
+    memcpy((uint8_t*)rb->buffer + rb->tail, data, first_chunk);
+    
+    if (len > first_chunk) {
+        memcpy(rb->buffer, (uint8_t*)data + first_chunk, len - first_chunk);
+    }
+    
+    rb->tail = (rb->tail + len) % rb->size;
+    rb->used += len;
+}
+
 static size_t ringbuf_write(ring_buffer_t* rb, const void* data, size_t len) {
     spinlock_acquire(&rb->lock);
     
@@ -77,20 +130,24 @@ static size_t ringbuf_write(ring_buffer_t* rb, const void* data, size_t len) {
         return 0;
     }
     
-    // Write in up to two chunks (wrap around)
-    size_t first_chunk = rb->size - rb->tail;
-    if (first_chunk > len) {
-        first_chunk = len;
-    }
+    ringbuf_copy_in(rb, data, len);
     
-    memcpy((uint8_t*)rb->buffer + rb->tail, data, first_chunk);
+    spinlock_release(&rb->lock);
+    return len;
+}
+
+// Header and payload under one lock hold; all or nothing
+static size_t ringbuf_write_message(ring_buffer_t* rb, const conduit_message_t* header,
+                                    const void* data, size_t len) {
+    spinlock_acquire(&rb->lock);
     
-    if (len > first_chunk) {
-        memcpy(rb->buffer, (uint8_t*)data + first_chunk, len - first_chunk);
+    if (sizeof(*header) + len > rb->size - rb->used) {
+        spinlock_release(&rb->lock);
+        return 0;
     }
     
-    rb->tail = (rb->tail + len) % rb->size;
-    rb->used += len;
+    ringbuf_copy_in(rb, header, sizeof(*header));
+    ringbuf_copy_in(rb, data, len);
     
     spinlock_release(&rb->lock);
     return len;
@@ -155,6 +212,256 @@ static size_t ringbuf_peek(ring_buffer_t* rb, void* data, size_t len) {
     return len;
 }
 
+static void ringbuf_discard(ring_buffer_t* rb, size_t len) {
+    spinlock_acquire(&rb->lock);
+    
+    if (len > rb->used) {
+        len = rb->used;
+    }
+    rb->head = (rb->head + len) % rb->size;
+    rb->used -= len;
+    
+    spinlock_release(&rb->lock);
+}
+
+// =============================================================================
+// Lock-Free Rings
+// =============================================================================
+
+#define FAST_RECORD_ALIGN   8
+#define FAST_RING_MIN_SIZE  4096
+
+static inline uint64_t fast_record_size(size_t payload) {
+    return (sizeof(conduit_record_t) + payload + FAST_RECORD_ALIGN - 1) &
+           ~(uint64_t)(FAST_RECORD_ALIGN - 1);
+}
+
+static conduit_fast_ring_t* fast_ring_create(size_t size, conduit_ring_mode_t mode) {
+    uint64_t ring_size = FAST_RING_MIN_SIZE;
+    while (ring_size < size) {
+        ring_size <<= 1;
+    }
+    
+    // Slab objects aren't line aligned, so over-allocate and align here
+    void* allocation = flux_allocate(NULL, sizeof(conduit_fast_ring_t) + CONDUIT_CACHE_LINE,
+                                     FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!allocation) {
+        return NULL;
+    }
+    
+    conduit_fast_ring_t* ring = (conduit_fast_ring_t*)
+        (((uintptr_t)allocation + CONDUIT_CACHE_LINE - 1) & ~(uintptr_t)(CONDUIT_CACHE_LINE - 1));
+    ring->buffer = flux_allocate(NULL, ring_size, FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!ring->buffer) {
+        flux_free(allocation);
+        return NULL;
+    }
+    
+    ring->size = ring_size;
+    ring->mask = ring_size - 1;
+    ring->mode = mode;
+    ring->allocation = allocation;
+    return ring;
+}
+
+static void fast_ring_destroy(conduit_fast_ring_t* ring) {
+    flux_free(ring->buffer);
+    flux_free(ring->allocation);
+}
+
+static inline uint64_t fast_ring_used(conduit_fast_ring_t* ring) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&ring->publish, __ATOMIC_ACQUIRE) - head;
+}
+
+// Lay out records of sizes[0..count) from claim, skipping to the start of
+// the buffer wherever one wouldn't fit before the end. Stops before the
+// first record that would pass limit and stores how many fit.
+static uint64_t fast_ring_layout(conduit_fast_ring_t* ring, uint64_t claim, uint64_t limit,
+                                 const size_t* sizes, size_t count, size_t* fit) {
+    size_t n;
+    for (n = 0; n < count; n++) {
+        uint64_t len = fast_record_size(sizes[n]);
+        uint64_t at = claim;
+        uint64_t room = ring->size - (at & ring->mask);
+        if (room < len) {
+            at += room;
+        }
+        if (at + len > limit) {
+            break;
+        }
+        claim = at + len;
+    }
+    *fit = n;
+    return claim;
+}
+
+// Claim room for as many of the records as fit with one reservation:
+// a plain store for SPSC, one CAS for MPSC. Returns how many were
+// claimed (0 if the ring is full) and the claim in [*start, *end).
+static size_t fast_ring_reserve(conduit_fast_ring_t* ring, const size_t* sizes, size_t count,
+                                uint64_t* start, uint64_t* end) {
+    uint64_t claim = __atomic_load_n(&ring->reserve, __ATOMIC_RELAXED);
+    
+    while (1) {
+        size_t fit;
+        // Acquire/release on the cached copy too: another producer may
+        // have read the head that freed this space
+        uint64_t head = __atomic_load_n(&ring->cached_head, __ATOMIC_ACQUIRE);
+        uint64_t next = fast_ring_layout(ring, claim, head + ring->size, sizes, count, &fit);
+        
+        if (fit < count) {
+            // Only look at the consumer's line when the cached copy is short
+            head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            __atomic_store_n(&ring->cached_head, head, __ATOMIC_RELEASE);
+            next = fast_ring_layout(ring, claim, head + ring->size, sizes, count, &fit);
+            if (fit == 0) {
+                return 0;
+            }
+        }
+        
+        if (ring->mode == CONDUIT_RING_SPSC) {
+            ring->reserve = next;
+        } else if (!__atomic_compare_exchange_n(&ring->reserve, &claim, next, false,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        
+        *start = claim;
+        *end = next;
+        return fit;
+    }
+}
+
+// Fill a claim laid out by fast_ring_layout
+static void fast_ring_write(conduit_fast_ring_t* ring, uint64_t pos,
+                            const void* const* messages, const size_t* sizes, size_t count,
+                            uint32_t flags, quantum_id_t sender, uint64_t timestamp) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t len = fast_record_size(sizes[i]);
+        uint64_t room = ring->size - (pos & ring->mask);
+        
+        if (room < len) {
+            // Too little room for a pad header means the reader skips anyway
+            if (room >= sizeof(conduit_record_t)) {
+                conduit_record_t* pad = (conduit_record_t*)(ring->buffer + (pos & ring->mask));
+                pad->size = 0;
+                pad->flags = CONDUIT_MSG_PAD;
+            }
+            pos += room;
+        }
+        
+        conduit_record_t* record = (conduit_record_t*)(ring->buffer + (pos & ring->mask));
+        record->size = sizes[i];
+        record->flags = flags & ~(CONDUIT_MSG_PAGES | CONDUIT_MSG_PAD);
+        record->sender_qid = sender;
+        record->timestamp = timestamp;
+        memcpy(record + 1, messages[i], sizes[i]);
+        pos += len;
+    }
+}
+
+// Make a filled claim visible to the consumer. MPSC claims are published
+// in the order they were made, so each producer waits for the one before.
+static void fast_ring_publish(conduit_fast_ring_t* ring, uint64_t start, uint64_t end) {
+    if (ring->mode == CONDUIT_RING_MPSC) {
+        while (__atomic_load_n(&ring->publish, __ATOMIC_ACQUIRE) != start) {
+            __asm__ __volatile__("pause");
+        }
+    }
+    __atomic_store_n(&ring->publish, end, __ATOMIC_RELEASE);
+}
+
+// Oldest published record, skipping wrap padding; NULL if the ring is empty.
+// Consumer side only.
+static conduit_record_t* fast_ring_front(conduit_fast_ring_t* ring) {
+    uint64_t head = ring->head;
+    
+    while (1) {
+        if (head == ring->cached_publish) {
+            ring->cached_publish = __atomic_load_n(&ring->publish, __ATOMIC_ACQUIRE);
+            if (head == ring->cached_publish) {
+                return NULL;
+            }
+        }
+        
+        uint64_t room = ring->size - (head & ring->mask);
+        conduit_record_t* record = (conduit_record_t*)(ring->buffer + (head & ring->mask));
+        if (room >= sizeof(conduit_record_t) && !(record->flags & CONDUIT_MSG_PAD)) {
+            return record;
+        }
+        
+        head += room;
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    }
+}
+
+static inline void fast_ring_pop(conduit_fast_ring_t* ring, conduit_record_t* record) {
+    __atomic_store_n(&ring->head, ring->head + fast_record_size(record->size),
+                     __ATOMIC_RELEASE);
+}
+
+// =============================================================================
+// Page Lists
+// =============================================================================
+
+static conduit_page_list_t* page_list_alloc(size_t size) {
+    uint32_t count = (size + FLUX_PAGE_SIZE - 1) / FLUX_PAGE_SIZE;
+    conduit_page_list_t* list = flux_allocate(NULL,
+        sizeof(conduit_page_list_t) + count * sizeof(uint64_t), FLUX_ALLOC_KERNEL);
+    if (list) {
+        list->size = size;
+        list->page_count = count;
+        list->flags = 0;
+    }
+    return list;
+}
+
+// Drop the list's frame references along with the list
+static void page_list_free(conduit_page_list_t* list) {
+    flux_put_pages(list->frames, list->page_count);
+    flux_free(list);
+}
+
+// Copy a page message out for receivers that didn't ask for the pages
+static size_t page_list_copy(conduit_page_list_t* list, void* buffer) {
+    size_t copied = 0;
+    for (uint32_t i = 0; i < list->page_count && copied < list->size; i++) {
+        size_t chunk = list->size - copied;
+        if (chunk > FLUX_PAGE_SIZE) {
+            chunk = FLUX_PAGE_SIZE;
+        }
+        memcpy((uint8_t*)buffer + copied, (void*)list->frames[i], chunk);
+        copied += chunk;
+    }
+    return copied;
+}
+
+// Peek the page list behind a CONDUIT_MSG_PAGES header at the ring head
+static conduit_page_list_t* page_list_peek(ring_buffer_t* rb) {
+    uint8_t raw[sizeof(conduit_message_t) + sizeof(conduit_page_list_t*)];
+    conduit_page_list_t* list;
+    
+    ringbuf_peek(rb, raw, sizeof(raw));
+    memcpy(&list, raw + sizeof(conduit_message_t), sizeof(list));
+    return list;
+}
+
+// Pending page messages own frame references; release them with the ring
+static void conduit_drain_pages(conduit_t* conduit) {
+    conduit_message_t header;
+    
+    while (ringbuf_read(&conduit->messages, &header, sizeof(header)) == sizeof(header)) {
+        if (header.flags & CONDUIT_MSG_PAGES) {
+            conduit_page_list_t* list;
+            ringbuf_read(&conduit->messages, &list, sizeof(list));
+            page_list_free(list);
+        } else {
+            ringbuf_discard(&conduit->messages, header.size);
+        }
+    }
+}
+
 // =============================================================================
 // Wait Queue Operations
 // =============================================================================
@@ -166,17 +473,17 @@ static void waitqueue_init(wait_queue_t* wq) {
     spinlock_init(&wq->lock);
 }
 
-static void waitqueue_add(wait_queue_t* wq, quantum_context_t* quantum) {
-    spinlock_acquire(&wq->lock);
-    
+// Caller holds wq->lock
+static bool waitqueue_push(wait_queue_t* wq, quantum_context_t* quantum,
+                           conduit_handoff_t* handoff) {
     wait_node_t* node = flux_allocate(NULL, sizeof(wait_node_t), 
                                       FLUX_ALLOC_KERNEL);
     if (!node) {
-        spinlock_release(&wq->lock);
-        return;
+        return false;
     }
     
     node->quantum = quantum;
+    node->handoff = handoff;
     node->next = NULL;
     
     if (wq->tail) {
@@ -186,6 +493,32 @@ static void waitqueue_add(wait_queue_t* wq, quantum_context_t* quantum) {
     }
     wq->tail = node;
     wq->count++;
+    return true;
+}
+
+// Unlink and free node, found after prev (NULL for the head). Caller
+// holds wq->lock.
+static void waitqueue_unlink(wait_queue_t* wq, wait_node_t* prev, wait_node_t* node) {
+    if (prev) {
+        prev->next = node->next;
+    } else {
+        wq->head = node->next;
+    }
+    if (wq->tail == node) {
+        wq->tail = prev;
+    }
+    wq->count--;
+    
+    flux_free(node);
+}
+
+static void waitqueue_add(wait_queue_t* wq, quantum_context_t* quantum) {
+    spinlock_acquire(&wq->lock);
+    
+    if (!waitqueue_push(wq, quantum, NULL)) {
+        spinlock_release(&wq->lock);
+        return;
+    }
     
     // Block the quantum
     temporal_block(quantum, BLOCK_CONDUIT);
@@ -193,24 +526,31 @@ static void waitqueue_add(wait_queue_t* wq, quantum_context_t* quantum) {
     spinlock_release(&wq->lock);
 }
 
-static quantum_context_t* waitqueue_remove(wait_queue_t* wq) {
+// Drop a receiver's node if nobody took it
+static void waitqueue_cancel(wait_queue_t* wq, conduit_handoff_t* handoff) {
     spinlock_acquire(&wq->lock);
     
-    if (!wq->head) {
-        spinlock_release(&wq->lock);
-        return NULL;
+    wait_node_t* prev = NULL;
+    for (wait_node_t* node = wq->head; node; prev = node, node = node->next) {
+        if (node->handoff == handoff) {
+            waitqueue_unlink(wq, prev, node);
+            break;
+        }
     }
     
-    wait_node_t* node = wq->head;
-    quantum_context_t* quantum = node->quantum;
+    spinlock_release(&wq->lock);
+}
+
+static quantum_context_t* waitqueue_remove(wait_queue_t* wq) {
+    spinlock_acquire(&wq->lock);
     
-    wq->head = node->next;
     if (!wq->head) {
-        wq->tail = NULL;
+        spinlock_release(&wq->lock);
+        return NULL;
     }
-    wq->count--;
     
-    flux_free(node);
+    quantum_context_t* quantum = wq->head->quantum;
+    waitqueue_unlink(wq, NULL, wq->head);
     
     // Unblock the quantum
     temporal_unblock(quantum);
@@ -226,117 +566,541 @@ static void waitqueue_wake_all(wait_queue_t* wq) {
 }
 
 // =============================================================================
-// Conduit Management
+// Readiness Notification
 // =============================================================================
 
-void conduit_init(void) {
-    spinlock_acquire(&g_conduit_lock);
+#define POLL_READY_SHIFT 16  // CONDUIT_SELECT_READ -> CONDUIT_SELECT_READ_READY
+
+// Current *_READY bits of a conduit
+static uint32_t conduit_readiness(conduit_t* conduit) {
+    uint32_t ready = 0;
     
-    // Clear conduit array
-    for (int i = 0; i < MAX_CONDUITS; i++) {
-        g_conduits[i] = NULL;
+    if (conduit->state != CONDUIT_STATE_OPEN) {
+        ready |= CONDUIT_SELECT_ERROR_READY;
     }
     
-    // Clear name table
-    for (int i = 0; i < NAME_HASH_SIZE; i++) {
-        g_name_table[i].name[0] = '\0';
-        g_name_table[i].conduit = NULL;
+    size_t used = conduit->ring ? fast_ring_used(conduit->ring) : conduit->messages.used;
+    if (conduit->ring ? used > 0 : used >= sizeof(conduit_message_t)) {
+        ready |= CONDUIT_SELECT_READ_READY;
+    }
+    if (used < conduit->buffer_size / 2) {
+        ready |= CONDUIT_SELECT_WRITE_READY;
     }
     
-    g_conduit_registry.initialized = true;
-    
-    spinlock_release(&g_conduit_lock);
+    return ready;
 }
 
-conduit_t* conduit_create(const char* name, size_t buffer_size) {
-    if (!name || buffer_size == 0) {
-        return NULL;
+// Errors are always reported, like a closed conduit to a reader
+static inline uint32_t poll_interest(conduit_poll_entry_t* entry) {
+    return ((entry->events & (CONDUIT_SELECT_READ | CONDUIT_SELECT_WRITE)) << POLL_READY_SHIFT) |
+           CONDUIT_SELECT_ERROR_READY;
+}
+
+// An entry hangs off its conduit's watcher list or its source's, under
+// that one's lock
+static inline spinlock_t* poll_watch_lock(conduit_poll_entry_t* entry) {
+    return entry->source ? &entry->source->lock : &entry->conduit->lock;
+}
+
+static inline conduit_poll_entry_t** poll_watchers(conduit_poll_entry_t* entry) {
+    return entry->source ? &entry->source->watchers : &entry->conduit->watchers;
+}
+
+static inline uint32_t poll_readiness(conduit_poll_entry_t* entry) {
+    return entry->source ? entry->source->readiness(entry->source)
+                         : conduit_readiness(entry->conduit);
+}
+
+static void poll_ready_push(conduit_poll_t* poll, conduit_poll_entry_t* entry) {
+    if (entry->queued) {
+        return;
     }
     
-    spinlock_acquire(&g_conduit_lock);
-    
-    // Check if name already exists
-    uint32_t hash = hash_name(name);
-    if (g_name_table[hash].conduit != NULL) {
-        spinlock_release(&g_conduit_lock);
-        return NULL;  // Name already in use
+    entry->queued = true;
+    entry->next_ready = NULL;
+    entry->prev_ready = poll->ready_tail;
+    if (poll->ready_tail) {
+        poll->ready_tail->next_ready = entry;
+    } else {
+        poll->ready_head = entry;
     }
-    
-    // Find free conduit slot
-    int conduit_id = -1;
-    for (int i = 0; i < MAX_CONDUITS; i++) {
-        if (!g_conduits[i]) {
-            conduit_id = i;
-            break;
-        }
+    poll->ready_tail = entry;
+    poll->ready_count++;
+}
+
+static void poll_ready_unlink(conduit_poll_t* poll, conduit_poll_entry_t* entry) {
+    if (!entry->queued) {
+        return;
     }
     
-    if (conduit_id == -1) {
-        spinlock_release(&g_conduit_lock);
-        return NULL;  // No free slots
+    if (entry->prev_ready) {
+        entry->prev_ready->next_ready = entry->next_ready;
+    } else {
+        poll->ready_head = entry->next_ready;
     }
-    
-    // Allocate conduit structure
-    conduit_t* conduit = flux_allocate(NULL, sizeof(conduit_t), 
-                                       FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
-    if (!conduit) {
-        spinlock_release(&g_conduit_lock);
-        return NULL;
+    if (entry->next_ready) {
+        entry->next_ready->prev_ready = entry->prev_ready;
+    } else {
+        poll->ready_tail = entry->prev_ready;
     }
+    entry->queued = false;
+    poll->ready_count--;
+}
+
+// Queue an entry with new ready bits and hand back the poll set's
+// waiter, if any, for the caller to wake. Caller holds poll->lock.
+static quantum_context_t* poll_post(conduit_poll_entry_t* entry, uint32_t ready) {
+    conduit_poll_t* poll = entry->poll;
     
-    // Initialize conduit
-    conduit->id = conduit_id;
-    strncpy(conduit->name, name, CONDUIT_NAME_MAX - 1);
-    conduit->state = CONDUIT_STATE_OPEN;
-    conduit->buffer_size = buffer_size;
-    conduit->max_message_size = buffer_size / 4;  // Default max message size
-    conduit->owner_qid = continuum_get_current_quantum()->qid;
-    conduit->ref_count = 1;
-    
-    // Initialize ring buffer
-    ringbuf_init(&conduit->messages, buffer_size);
-    
-    // Initialize wait queues
-    waitqueue_init(&conduit->readers);
-    waitqueue_init(&conduit->writers);
-    
-    // Initialize statistics
-    conduit->stats.messages_sent = 0;
-    conduit->stats.messages_received = 0;
-    conduit->stats.bytes_sent = 0;
-    conduit->stats.bytes_received = 0;
-    
-    spinlock_init(&conduit->lock);
-    
-    // Add to registry
-    g_conduits[conduit_id] = conduit;
-    g_name_table[hash].conduit = conduit;
-    strncpy(g_name_table[hash].name, name, CONDUIT_NAME_MAX - 1);
-    g_conduit_registry.conduit_count++;
+    entry->pending |= ready;
+    poll_ready_push(poll, entry);
     
-    spinlock_release(&g_conduit_lock);
-    return conduit;
+    quantum_context_t* waiter = poll->waiter;
+    __atomic_store_n(&poll->waiter, NULL, __ATOMIC_RELEASE);
+    return waiter;
 }
 
-conduit_t* conduit_open(const char* name) {
-    if (!name) {
-        return NULL;
+// Post ready bits to every poll set on a watcher list. The caller holds
+// the list's lock, which nests outside each poll lock.
+static void poll_notify(conduit_poll_entry_t* watchers, uint32_t ready) {
+    if (!ready) {
+        return;
     }
     
-    spinlock_acquire(&g_conduit_lock);
-    
-    // Look up by name
+    for (conduit_poll_entry_t* entry = watchers; entry; entry = entry->next_watch) {
+        uint32_t hit = ready & poll_interest(entry);
+        if (!hit) {
+            continue;
+        }
+        
+        spinlock_acquire(&entry->poll->lock);
+        quantum_context_t* waiter = poll_post(entry, hit);
+        spinlock_release(&entry->poll->lock);
+        
+        if (waiter) {
+            temporal_unblock(waiter);
+        }
+    }
+}
+
+// Only the conduit's own watchers are visited. Caller holds
+// conduit->lock.
+static void conduit_notify(conduit_t* conduit, uint32_t ready) {
+    if (conduit->watchers) {
+        poll_notify(conduit->watchers, ready);
+    }
+}
+
+// Report an error once to every entry on a watcher list and leave them
+// registered but detached from what they watched; the list's lock is
+// held
+static void poll_detach(conduit_poll_entry_t** watchers) {
+    conduit_poll_entry_t* entry = *watchers;
+    *watchers = NULL;
+    
+    while (entry) {
+        conduit_poll_entry_t* next = entry->next_watch;
+        
+        spinlock_acquire(&entry->poll->lock);
+        entry->detached = true;
+        entry->next_watch = NULL;
+        quantum_context_t* waiter = poll_post(entry, CONDUIT_SELECT_ERROR_READY);
+        spinlock_release(&entry->poll->lock);
+        
+        if (waiter) {
+            temporal_unblock(waiter);
+        }
+        entry = next;
+    }
+}
+
+// The conduit is going away
+static void conduit_detach_watchers(conduit_t* conduit) {
+    spinlock_acquire(&conduit->lock);
+    poll_detach(&conduit->watchers);
+    spinlock_release(&conduit->lock);
+}
+
+// =============================================================================
+// Name Registry
+// =============================================================================
+
+static name_table_t* name_table_alloc(void) {
+    name_table_t* table = flux_allocate(NULL, sizeof(name_table_t) +
+                                        NAME_TABLE_SIZE * sizeof(conduit_t*),
+                                        FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (table) {
+        table->mask = NAME_TABLE_SIZE - 1;
+    }
+    return table;
+}
+
+// Safe from a read section or with g_conduit_lock held
+static conduit_t* name_table_lookup(name_table_t* table, const char* name, uint32_t hash) {
+    if (!table) {
+        return NULL;
+    }
+    
+    for (uint32_t probe = 0; probe <= table->mask; probe++) {
+        conduit_t* conduit = __atomic_load_n(&table->slots[(hash + probe) & table->mask],
+                                             __ATOMIC_ACQUIRE);
+        if (!conduit) {
+            return NULL;
+        }
+        if (conduit != NAME_TOMBSTONE && conduit->name_hash == hash &&
+            name_matches(conduit->name, name)) {
+            return conduit;
+        }
+    }
+    return NULL;
+}
+
+// Caller holds g_conduit_lock and has checked the name is not present
+static void name_table_insert(name_table_t* table, conduit_t* conduit) {
+    uint32_t slot = conduit->name_hash & table->mask;
+    
+    while (table->slots[slot] && table->slots[slot] != NAME_TOMBSTONE) {
+        slot = (slot + 1) & table->mask;
+    }
+    
+    if (table->slots[slot] == NAME_TOMBSTONE) {
+        table->tombstones--;
+    }
+    table->used++;
+    __atomic_store_n(&table->slots[slot], conduit, __ATOMIC_RELEASE);
+}
+
+// Make room for one more name, rebuilding the table once tombstones push
+// it past three quarters full. Caller holds g_conduit_lock.
+static int name_table_reserve(void) {
+    name_table_t* table = g_name_table;
+    uint32_t size = table->mask + 1;
+    
+    if ((table->used + table->tombstones + 1) * 4 <= size * 3) {
+        return 0;
+    }
+    
+    name_table_t* fresh = name_table_alloc();
+    if (!fresh) {
+        // Probing needs at least one empty slot to terminate
+        return (table->used + table->tombstones + 1 < size) ? 0 : -ENOMEM;
+    }
+    
+    for (uint32_t i = 0; i < size; i++) {
+        conduit_t* conduit = table->slots[i];
+        if (conduit && conduit != NAME_TOMBSTONE) {
+            name_table_insert(fresh, conduit);
+        }
+    }
+    
+    __atomic_store_n(&g_name_table, fresh, __ATOMIC_RELEASE);
+    continuum_synchronize(g_registry_readers);
+    flux_free(table);
+    return 0;
+}
+
+// Caller holds g_conduit_lock
+static void name_table_remove(name_table_t* table, conduit_t* conduit) {
+    uint32_t slot = conduit->name_hash & table->mask;
+    
+    while (table->slots[slot] != conduit) {
+        if (!table->slots[slot]) {
+            return;
+        }
+        slot = (slot + 1) & table->mask;
+    }
+    
+    table->used--;
+    if (table->slots[(slot + 1) & table->mask]) {
+        __atomic_store_n(&table->slots[slot], NAME_TOMBSTONE, __ATOMIC_RELEASE);
+        table->tombstones++;
+        return;
+    }
+    
+    // End of a probe chain: clear it and any tombstones leading up to it
+    __atomic_store_n(&table->slots[slot], NULL, __ATOMIC_RELEASE);
+    slot = (slot - 1) & table->mask;
+    while (table->slots[slot] == NAME_TOMBSTONE) {
+        __atomic_store_n(&table->slots[slot], NULL, __ATOMIC_RELEASE);
+        table->tombstones--;
+        slot = (slot - 1) & table->mask;
+    }
+}
+
+static topic_node_t* topic_child(topic_node_t* node, char ch) {
+    topic_node_t* child = __atomic_load_n(&node->child, __ATOMIC_ACQUIRE);
+    
+    while (child && child->ch != ch) {
+        child = __atomic_load_n(&child->sibling, __ATOMIC_ACQUIRE);
+    }
+    return child;
+}
+
+// Node reached by following prefix from the root, or NULL
+static topic_node_t* topic_find(const char* prefix) {
+    topic_node_t* node = &g_topic_root;
+    
+    for (size_t i = 0; node && i < CONDUIT_NAME_MAX - 1 && prefix[i]; i++) {
+        node = topic_child(node, prefix[i]);
+    }
+    return node;
+}
+
+// Missing tail of a name's trie path, built privately so a failed
+// allocation never leaves half a path visible to readers
+typedef struct {
+    topic_node_t* attach;       // Deepest existing node on the path
+    topic_node_t* chain;        // First new node, to hang off attach
+    topic_node_t* leaf;
+} topic_path_t;
+
+static void topic_free_chain(topic_node_t* chain) {
+    while (chain) {
+        topic_node_t* next = chain->child;
+        flux_free(chain);
+        chain = next;
+    }
+}
+
+// Caller holds g_conduit_lock
+static int topic_prepare(const char* name, topic_path_t* path) {
+    topic_node_t* node = &g_topic_root;
+    size_t i = 0;
+    
+    for (; name[i]; i++) {
+        topic_node_t* child = topic_child(node, name[i]);
+        if (!child) {
+            break;
+        }
+        node = child;
+    }
+    
+    path->attach = node;
+    path->chain = NULL;
+    path->leaf = node;
+    
+    for (; name[i]; i++) {
+        topic_node_t* fresh = flux_allocate(NULL, sizeof(topic_node_t),
+                                            FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+        if (!fresh) {
+            topic_free_chain(path->chain);
+            return -ENOMEM;
+        }
+        
+        fresh->ch = name[i];
+        fresh->parent = path->leaf;
+        if (path->chain) {
+            path->leaf->child = fresh;
+        } else {
+            path->chain = fresh;
+        }
+        path->leaf = fresh;
+    }
+    return 0;
+}
+
+static void topic_publish(topic_path_t* path, conduit_t* conduit) {
+    __atomic_store_n(&path->leaf->conduit, conduit, __ATOMIC_RELEASE);
+    
+    if (path->chain) {
+        path->chain->sibling = path->attach->child;
+        __atomic_store_n(&path->attach->child, path->chain, __ATOMIC_RELEASE);
+    }
+}
+
+// Unlink the conduit and prune nodes left without a conduit or children.
+// Returns the pruned nodes, to be freed after continuum_synchronize().
+// Caller holds g_conduit_lock.
+static topic_node_t* topic_remove(conduit_t* conduit) {
+    topic_node_t* node = topic_find(conduit->name);
+    topic_node_t* retired = NULL;
+    
+    if (!node || node->conduit != conduit) {
+        return NULL;
+    }
+    
+    __atomic_store_n(&node->conduit, NULL, __ATOMIC_RELEASE);
+    
+    while (node != &g_topic_root && !node->conduit && !node->child) {
+        topic_node_t* parent = node->parent;
+        
+        if (parent->child == node) {
+            __atomic_store_n(&parent->child, node->sibling, __ATOMIC_RELEASE);
+        } else {
+            topic_node_t* prev = parent->child;
+            while (prev->sibling != node) {
+                prev = prev->sibling;
+            }
+            __atomic_store_n(&prev->sibling, node->sibling, __ATOMIC_RELEASE);
+        }
+        
+        node->retired = retired;
+        retired = node;
+        node = parent;
+    }
+    return retired;
+}
+
+// Take a reference unless the last one is already gone and the conduit is
+// waiting out a grace period to be freed. Call from a read section.
+static bool conduit_get(conduit_t* conduit) {
+    uint32_t refs = __atomic_load_n(&conduit->ref_count, __ATOMIC_RELAXED);
+    
+    while (refs != 0) {
+        if (__atomic_compare_exchange_n(&conduit->ref_count, &refs, refs + 1, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// =============================================================================
+// Conduit Management
+// =============================================================================
+
+void conduit_init(void) {
+    spinlock_acquire(&g_conduit_lock);
+    
+    // Clear conduit array
+    for (int i = 0; i < MAX_CONDUITS; i++) {
+        g_conduits[i] = NULL;
+    }
+    
+    // Name table and broadcast trie
+    if (!g_name_table) {
+        g_name_table = name_table_alloc();
+    }
+    g_topic_root.child = NULL;
+    g_topic_root.conduit = NULL;
+    
+    g_conduit_registry.initialized = true;
+    
+    spinlock_release(&g_conduit_lock);
+}
+
+conduit_t* conduit_create(const char* name, size_t buffer_size) {
+    return conduit_create_ring(name, buffer_size, CONDUIT_RING_LOCKED);
+}
+
+// Create a conduit on a lock-free ring. SPSC and MPSC conduits serve a
+// single receiving quantum and carry no zero-copy page messages.
+conduit_t* conduit_create_ring(const char* name, size_t buffer_size,
+                               conduit_ring_mode_t mode) {
+    if (!name || buffer_size == 0 || mode > CONDUIT_RING_MPSC) {
+        return NULL;
+    }
+    
+    spinlock_acquire(&g_conduit_lock);
+    
+    // Check if name already exists
     uint32_t hash = hash_name(name);
-    conduit_t* conduit = g_name_table[hash].conduit;
+    if (!g_name_table || name_table_lookup(g_name_table, name, hash) ||
+        name_table_reserve() != 0) {
+        spinlock_release(&g_conduit_lock);
+        return NULL;  // Name in use, or no room to add it
+    }
+    
+    // Find free conduit slot
+    int conduit_id = -1;
+    for (int i = 0; i < MAX_CONDUITS; i++) {
+        if (!g_conduits[i]) {
+            conduit_id = i;
+            break;
+        }
+    }
+    
+    if (conduit_id == -1) {
+        spinlock_release(&g_conduit_lock);
+        return NULL;  // No free slots
+    }
+    
+    // Allocate conduit structure
+    conduit_t* conduit = flux_allocate(NULL, sizeof(conduit_t), 
+                                       FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!conduit) {
+        spinlock_release(&g_conduit_lock);
+        return NULL;
+    }
+    
+    // Initialize conduit
+    conduit->id = conduit_id;
+    strncpy(conduit->name, name, CONDUIT_NAME_MAX);
+    conduit->name_hash = hash;
+    conduit->state = CONDUIT_STATE_OPEN;
+    conduit->buffer_size = buffer_size;
+    conduit->max_message_size = buffer_size / 4;  // Default max message size
+    conduit->owner_qid = continuum_get_current_quantum()->qid;
+    conduit->ref_count = 1;
+    
+    // Initialize message ring
+    conduit->ring_mode = mode;
+    if (mode == CONDUIT_RING_LOCKED) {
+        ringbuf_init(&conduit->messages, buffer_size);
+    } else {
+        conduit->ring = fast_ring_create(buffer_size, mode);
+        if (!conduit->ring) {
+            flux_free(conduit);
+            spinlock_release(&g_conduit_lock);
+            return NULL;
+        }
+        conduit->buffer_size = conduit->ring->size;
+        conduit->max_message_size = conduit->buffer_size / 4;
+    }
     
-    if (conduit && conduit->state == CONDUIT_STATE_OPEN) {
-        conduit->ref_count++;
+    topic_path_t path;
+    if (topic_prepare(conduit->name, &path) != 0) {
+        if (conduit->ring) {
+            fast_ring_destroy(conduit->ring);
+        } else {
+            ringbuf_destroy(&conduit->messages);
+        }
+        flux_free(conduit);
         spinlock_release(&g_conduit_lock);
-        return conduit;
+        return NULL;
     }
     
+    // Initialize wait queues
+    waitqueue_init(&conduit->readers);
+    waitqueue_init(&conduit->writers);
+    conduit->watchers = NULL;
+    
+    // Initialize statistics
+    conduit->stats.messages_sent = 0;
+    conduit->stats.messages_received = 0;
+    conduit->stats.bytes_sent = 0;
+    conduit->stats.bytes_received = 0;
+    
+    spinlock_init(&conduit->lock);
+    
+    // Add to registry; lock-free readers can find it from here on
+    g_conduits[conduit_id] = conduit;
+    topic_publish(&path, conduit);
+    name_table_insert(g_name_table, conduit);
+    g_conduit_registry.conduit_count++;
+    
     spinlock_release(&g_conduit_lock);
-    return NULL;
+    return conduit;
+}
+
+conduit_t* conduit_open(const char* name) {
+    if (!name) {
+        return NULL;
+    }
+    
+    // Look up by name without touching g_conduit_lock
+    uint32_t hash = hash_name(name);
+    uint32_t cpu;
+    uint64_t flags = continuum_read_lock(g_registry_readers, &cpu);
+    
+    name_table_t* table = __atomic_load_n(&g_name_table, __ATOMIC_ACQUIRE);
+    conduit_t* conduit = name_table_lookup(table, name, hash);
+    if (conduit && !conduit_get(conduit)) {
+        conduit = NULL;
+    }
+    
+    continuum_read_unlock(g_registry_readers, cpu, flags);
+    return conduit;
 }
 
 void conduit_close(conduit_t* conduit) {
@@ -344,276 +1108,1177 @@ void conduit_close(conduit_t* conduit) {
         return;
     }
     
+    if (__atomic_sub_fetch(&conduit->ref_count, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    
     spinlock_acquire(&g_conduit_lock);
     
-    conduit->ref_count--;
+    // Mark as closing
+    conduit->state = CONDUIT_STATE_CLOSING;
     
-    if (conduit->ref_count == 0) {
-        // Mark as closing
-        conduit->state = CONDUIT_STATE_CLOSING;
-        
-        // Wake all waiting quanta
-        waitqueue_wake_all(&conduit->readers);
-        waitqueue_wake_all(&conduit->writers);
-        
-        // Remove from name table
-        uint32_t hash = hash_name(conduit->name);
-        if (g_name_table[hash].conduit == conduit) {
-            g_name_table[hash].name[0] = '\0';
-            g_name_table[hash].conduit = NULL;
-        }
-        
-        // Free resources
+    // Wake all waiting quanta
+    waitqueue_wake_all(&conduit->readers);
+    waitqueue_wake_all(&conduit->writers);
+    conduit_detach_watchers(conduit);
+    
+    // Remove from name table and broadcast trie
+    name_table_remove(g_name_table, conduit);
+    topic_node_t* retired = topic_remove(conduit);
+    
+    // Remove from registry
+    g_conduits[conduit->id] = NULL;
+    g_conduit_registry.conduit_count--;
+    
+    spinlock_release(&g_conduit_lock);
+    
+    // Lock-free lookups may still hold the pointer until they leave
+    continuum_synchronize(g_registry_readers);
+    
+    while (retired) {
+        topic_node_t* next = retired->retired;
+        flux_free(retired);
+        retired = next;
+    }
+    
+    // Free resources
+    if (conduit->ring) {
+        fast_ring_destroy(conduit->ring);
+    } else {
+        conduit_drain_pages(conduit);
         ringbuf_destroy(&conduit->messages);
-        
-        // Remove from registry
-        g_conduits[conduit->id] = NULL;
-        g_conduit_registry.conduit_count--;
-        
-        // Free conduit structure
-        flux_free(conduit);
     }
     
-    spinlock_release(&g_conduit_lock);
+    // Free conduit structure
+    flux_free(conduit);
+}
+
+// =============================================================================
+// Message Operations
+// =============================================================================
+
+// Synchronous fast path: with the ring empty and a receiver blocked on the
+// conduit, copy the message straight into the receiver's buffer and take
+// it off the wait queue. Returns the receiver to switch to, or NULL to
+// queue the message as usual. Caller holds conduit->lock.
+static quantum_context_t* conduit_handoff(conduit_t* conduit, const void* message,
+                                          size_t size) {
+    wait_queue_t* wq = &conduit->readers;
+    spinlock_acquire(&wq->lock);
+    
+    wait_node_t* node = wq->head;
+    if (!node || !node->handoff || size > node->handoff->max_size) {
+        spinlock_release(&wq->lock);
+        return NULL;
+    }
+    
+    quantum_context_t* receiver = node->quantum;
+    conduit_handoff_t* handoff = node->handoff;
+    quantum_context_t* current = continuum_get_current_quantum();
+    
+    // A receiver in another domain is written through its page tables
+    memory_domain_t* domain = receiver->memory_domain;
+    if (domain && domain != current->memory_domain) {
+        if (flux_copy_to_domain(domain, (uint64_t)handoff->buffer, message, size) < 0) {
+            spinlock_release(&wq->lock);
+            return NULL;
+        }
+    } else {
+        memcpy(handoff->buffer, message, size);
+    }
+    
+    waitqueue_unlink(wq, NULL, node);
+    handoff->size = size;
+    __atomic_store_n(&handoff->done, true, __ATOMIC_RELEASE);
+    
+    spinlock_release(&wq->lock);
+    
+    // Update statistics
+    conduit->stats.messages_sent++;
+    conduit->stats.bytes_sent += size;
+    conduit->stats.messages_received++;
+    conduit->stats.bytes_received += size;
+    conduit->stats.handoffs++;
+    continuum_counter_inc(COUNTER_CONDUIT_MESSAGES);
+    continuum_counter_add(COUNTER_CONDUIT_BYTES, size);
+    
+    return receiver;
+}
+
+// Lock-free conduits only take the conduit lock to sleep or to wake a
+// sleeper. A sleeper bumps ring_waiters and then checks the ring again; a
+// sender or receiver publishes and then checks ring_waiters. With a full
+// fence on each side, one of them always sees the other.
+static void fast_wake(conduit_t* conduit, wait_queue_t* wq, uint32_t ready) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&conduit->ring_waiters, __ATOMIC_RELAXED) == 0 &&
+        __atomic_load_n(&conduit->watchers, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    
+    spinlock_acquire(&conduit->lock);
+    waitqueue_remove(wq);
+    conduit_notify(conduit, conduit_readiness(conduit) & ready);
+    spinlock_release(&conduit->lock);
+}
+
+static void fast_sleep(conduit_t* conduit, wait_queue_t* wq, quantum_context_t* current) {
+    waitqueue_add(wq, current);
+    spinlock_release(&conduit->lock);
+    
+    // Will be woken when the other side moves
+    temporal_yield(current);
+    __atomic_fetch_sub(&conduit->ring_waiters, 1, __ATOMIC_RELAXED);
+}
+
+static int64_t fast_send(conduit_t* conduit, const void* const* messages,
+                         const size_t* sizes, size_t count, uint32_t flags) {
+    conduit_fast_ring_t* ring = conduit->ring;
+    quantum_context_t* current = continuum_get_current_quantum();
+    
+    while (1) {
+        // An MPSC producer holds up later claims until it publishes, so
+        // it can't be preempted in between
+        uint64_t irq = cpu_irq_save();
+        uint64_t start, end;
+        size_t sent = fast_ring_reserve(ring, sizes, count, &start, &end);
+        if (sent > 0) {
+            fast_ring_write(ring, start, messages, sizes, sent, flags,
+                            current->qid, continuum_get_time());
+            fast_ring_publish(ring, start, end);
+        }
+        cpu_irq_restore(irq);
+        
+        if (sent > 0) {
+            uint64_t bytes = 0;
+            for (size_t i = 0; i < sent; i++) {
+                bytes += sizes[i];
+            }
+            
+            // Update statistics
+            if (ring->mode == CONDUIT_RING_MPSC) {
+                __atomic_fetch_add(&conduit->stats.messages_sent, sent, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&conduit->stats.bytes_sent, bytes, __ATOMIC_RELAXED);
+            } else {
+                conduit->stats.messages_sent += sent;
+                conduit->stats.bytes_sent += bytes;
+            }
+            continuum_counter_add(COUNTER_CONDUIT_MESSAGES, sent);
+            continuum_counter_add(COUNTER_CONDUIT_BYTES, bytes);
+            
+            fast_wake(conduit, &conduit->readers, CONDUIT_SELECT_READ_READY);
+            return sent;
+        }
+        
+        if (flags & CONDUIT_FLAG_NONBLOCK) {
+            return -EAGAIN;
+        }
+        
+        // Full: sleep unless the reader moved since the reservation looked
+        spinlock_acquire(&conduit->lock);
+        __atomic_fetch_add(&conduit->ring_waiters, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) !=
+            __atomic_load_n(&ring->cached_head, __ATOMIC_RELAXED)) {
+            __atomic_fetch_sub(&conduit->ring_waiters, 1, __ATOMIC_RELAXED);
+            spinlock_release(&conduit->lock);
+            continue;
+        }
+        fast_sleep(conduit, &conduit->writers, current);
+        
+        if (conduit->state != CONDUIT_STATE_OPEN) {
+            return -EPIPE;
+        }
+        
+        // Retry once after waking, like the locked ring
+        flags |= CONDUIT_FLAG_NONBLOCK;
+    }
+}
+
+static int64_t fast_receive(conduit_t* conduit, void* buffer, size_t max_size,
+                            uint32_t flags, bool peek) {
+    conduit_fast_ring_t* ring = conduit->ring;
+    
+    while (1) {
+        conduit_record_t* record = fast_ring_front(ring);
+        if (record) {
+            size_t size = record->size;
+            if (size > max_size) {
+                return -EMSGSIZE;
+            }
+            
+            memcpy(buffer, record + 1, size);
+            if (!peek) {
+                fast_ring_pop(ring, record);
+                
+                // Update statistics
+                conduit->stats.messages_received++;
+                conduit->stats.bytes_received += size;
+                
+                fast_wake(conduit, &conduit->writers, CONDUIT_SELECT_WRITE_READY);
+            }
+            return size;
+        }
+        
+        if (peek) {
+            return 0;
+        }
+        if (flags & CONDUIT_FLAG_NONBLOCK) {
+            return -EAGAIN;
+        }
+        
+        // Empty: sleep unless something was published since the check
+        spinlock_acquire(&conduit->lock);
+        __atomic_fetch_add(&conduit->ring_waiters, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->publish, __ATOMIC_SEQ_CST) != ring->head) {
+            __atomic_fetch_sub(&conduit->ring_waiters, 1, __ATOMIC_RELAXED);
+            spinlock_release(&conduit->lock);
+            continue;
+        }
+        fast_sleep(conduit, &conduit->readers, continuum_get_current_quantum());
+        
+        if (conduit->state != CONDUIT_STATE_OPEN) {
+            return -EPIPE;
+        }
+        
+        // Retry once after waking, like the locked ring
+        flags |= CONDUIT_FLAG_NONBLOCK;
+    }
+}
+
+static int64_t send_message(conduit_t* conduit, const void* message,
+                            size_t size, uint32_t flags) {
+    if (!conduit || !message || size == 0) {
+        return -EINVAL;
+    }
+    
+    if (conduit->state != CONDUIT_STATE_OPEN) {
+        return -EPIPE;
+    }
+    
+    if (size > conduit->max_message_size) {
+        return -EMSGSIZE;
+    }
+    
+    if (conduit->ring) {
+        int64_t result = fast_send(conduit, &message, &size, 1, flags);
+        return result < 0 ? result : (int64_t)size;
+    }
+    
+    spinlock_acquire(&conduit->lock);
+    
+    // A waiting receiver gets the message and the rest of our slice
+    if (conduit->messages.used == 0) {
+        quantum_context_t* receiver = conduit_handoff(conduit, message, size);
+        if (receiver) {
+            spinlock_release(&conduit->lock);
+            if (!temporal_handoff(receiver)) {
+                temporal_unblock(receiver);
+            }
+            return size;
+        }
+    }
+    
+    // Check if there's space
+    size_t header_size = sizeof(conduit_message_t);
+    size_t total_size = header_size + size;
+    
+    if (conduit->messages.used + total_size > conduit->buffer_size) {
+        if (flags & CONDUIT_FLAG_NONBLOCK) {
+            spinlock_release(&conduit->lock);
+            return -EAGAIN;
+        }
+        
+        // Block until space available
+        quantum_context_t* current = continuum_get_current_quantum();
+        waitqueue_add(&conduit->writers, current);
+        spinlock_release(&conduit->lock);
+        
+        // Will be woken when space is available
+        temporal_yield(current);
+        
+        // Retry after waking
+        return send_message(conduit, message, size, flags | CONDUIT_FLAG_NONBLOCK);
+    }
+    
+    // Create message header
+    conduit_message_t header = {
+        .sender_qid = continuum_get_current_quantum()->qid,
+        .size = size,
+        .timestamp = continuum_get_time(),
+        .flags = flags
+    };
+    
+    // Write header and message
+    ringbuf_write_message(&conduit->messages, &header, message, size);
+    
+    // Update statistics
+    conduit->stats.messages_sent++;
+    conduit->stats.bytes_sent += size;
+    continuum_counter_inc(COUNTER_CONDUIT_MESSAGES);
+    continuum_counter_add(COUNTER_CONDUIT_BYTES, size);
+    
+    // Wake a reader if any
+    waitqueue_remove(&conduit->readers);
+    conduit_notify(conduit, CONDUIT_SELECT_READ_READY);
+    
+    spinlock_release(&conduit->lock);
+    return size;
+}
+
+int64_t conduit_send(conduit_t* conduit, const void* message, 
+                    size_t size, uint32_t flags) {
+    uint64_t start = trace_begin(TRACE_CONDUIT_SEND);
+    int64_t result = send_message(conduit, message, size, flags);
+    TRACE(TRACE_CONDUIT_SEND, conduit ? conduit->id : 0, result, trace_elapsed(start));
+    return result;
+}
+
+static int64_t receive_message(conduit_t* conduit, void* buffer,
+                               size_t max_size, uint32_t flags) {
+    if (!conduit || !buffer || max_size == 0) {
+        return -EINVAL;
+    }
+    
+    if (conduit->state != CONDUIT_STATE_OPEN) {
+        return -EPIPE;
+    }
+    
+    if (conduit->ring) {
+        return fast_receive(conduit, buffer, max_size, flags, false);
+    }
+    
+    spinlock_acquire(&conduit->lock);
+    
+    // Check if there's a message
+    if (conduit->messages.used < sizeof(conduit_message_t)) {
+        if (flags & CONDUIT_FLAG_NONBLOCK) {
+            spinlock_release(&conduit->lock);
+            return -EAGAIN;
+        }
+        
+        // Block until message available. A sender that finds us waiting
+        // copies straight into buffer and switches to us.
+        quantum_context_t* current = continuum_get_current_quantum();
+        conduit_handoff_t handoff = {
+            .buffer = buffer,
+            .max_size = max_size,
+            .size = 0,
+            .done = false
+        };
+        
+        // With interrupts off a sender on this CPU can't get in before
+        // the quantum is marked blocked. One on another CPU can, once the
+        // node is published; its wakeup stays pending and temporal_block
+        // returns at once.
+        uint64_t irq = cpu_irq_save();
+        spinlock_acquire(&conduit->readers.lock);
+        bool queued = waitqueue_push(&conduit->readers, current, &handoff);
+        spinlock_release(&conduit->readers.lock);
+        spinlock_release(&conduit->lock);
+        if (queued) {
+            temporal_block(current, BLOCK_CONDUIT);
+        }
+        cpu_irq_restore(irq);
+        
+        if (!__atomic_load_n(&handoff.done, __ATOMIC_ACQUIRE)) {
+            // Woken some other way; the node points into this frame
+            spinlock_acquire(&conduit->lock);
+            waitqueue_cancel(&conduit->readers, &handoff);
+            spinlock_release(&conduit->lock);
+        }
+        if (__atomic_load_n(&handoff.done, __ATOMIC_ACQUIRE)) {
+            return handoff.size;
+        }
+        
+        if (!queued) {
+            temporal_yield(current);
+        }
+        
+        // Retry after waking
+        return receive_message(conduit, buffer, max_size,
+                               flags | CONDUIT_FLAG_NONBLOCK);
+    }
+    
+    // Peek at message header
+    conduit_message_t header;
+    ringbuf_peek(&conduit->messages, &header, sizeof(header));
+    
+    size_t bytes_read;
+    if (header.flags & CONDUIT_MSG_PAGES) {
+        // Zero-copy message read by a copying receiver
+        conduit_page_list_t* list = page_list_peek(&conduit->messages);
+        if (list->size > max_size) {
+            spinlock_release(&conduit->lock);
+            return -EMSGSIZE;
+        }
+        
+        ringbuf_discard(&conduit->messages, sizeof(header) + sizeof(list));
+        bytes_read = page_list_copy(list, buffer);
+        page_list_free(list);
+    } else {
+        if (header.size > max_size) {
+            spinlock_release(&conduit->lock);
+            return -EMSGSIZE;
+        }
+        
+        // Read header and message
+        ringbuf_read(&conduit->messages, &header, sizeof(header));
+        bytes_read = ringbuf_read(&conduit->messages, buffer, header.size);
+    }
+    
+    // Update statistics
+    conduit->stats.messages_received++;
+    conduit->stats.bytes_received += bytes_read;
+    
+    // Wake a writer if any
+    waitqueue_remove(&conduit->writers);
+    conduit_notify(conduit, conduit_readiness(conduit) & CONDUIT_SELECT_WRITE_READY);
+    
+    spinlock_release(&conduit->lock);
+    return bytes_read;
+}
+
+int64_t conduit_receive(conduit_t* conduit, void* buffer, 
+                       size_t max_size, uint32_t flags) {
+    uint64_t start = trace_begin(TRACE_CONDUIT_RECEIVE);
+    int64_t result = receive_message(conduit, buffer, max_size, flags);
+    TRACE(TRACE_CONDUIT_RECEIVE, conduit ? conduit->id : 0, result, trace_elapsed(start));
+    return result;
+}
+
+int64_t conduit_peek(conduit_t* conduit, void* buffer, size_t max_size) {
+    if (!conduit || !buffer || max_size == 0) {
+        return -EINVAL;
+    }
+    
+    if (conduit->ring) {
+        return fast_receive(conduit, buffer, max_size, CONDUIT_FLAG_NONBLOCK, true);
+    }
+    
+    spinlock_acquire(&conduit->lock);
+    
+    if (conduit->messages.used < sizeof(conduit_message_t)) {
+        spinlock_release(&conduit->lock);
+        return 0;
+    }
+    
+    // Peek at message header
+    conduit_message_t header;
+    size_t offset = 0;
+    
+    // Peek header
+    ringbuf_peek(&conduit->messages, &header, sizeof(header));
+    
+    if (header.flags & CONDUIT_MSG_PAGES) {
+        conduit_page_list_t* list = page_list_peek(&conduit->messages);
+        int64_t result = list->size > max_size ? -EMSGSIZE :
+                         (int64_t)page_list_copy(list, buffer);
+        spinlock_release(&conduit->lock);
+        return result;
+    }
+    
+    if (header.size > max_size) {
+        spinlock_release(&conduit->lock);
+        return -EMSGSIZE;
+    }
+    
+    // Peek message data (skip header)
+    uint8_t temp_buffer[sizeof(header) + header.size];
+    ringbuf_peek(&conduit->messages, temp_buffer, sizeof(header) + header.size);
+    memcpy(buffer, temp_buffer + sizeof(header), header.size);
+    
+    spinlock_release(&conduit->lock);
+    return header.size;
+}
+
+// Queue several messages at once. A lock-free ring takes them with one
+// reservation and one publish. Blocks like conduit_send until at least one
+// message is queued and returns how many were.
+int64_t conduit_send_batch(conduit_t* conduit, const void* const* messages,
+                           const size_t* sizes, size_t count, uint32_t flags) {
+    if (!conduit || !messages || !sizes || count == 0) {
+        return -EINVAL;
+    }
+    
+    if (conduit->state != CONDUIT_STATE_OPEN) {
+        return -EPIPE;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        if (!messages[i] || sizes[i] == 0) {
+            return -EINVAL;
+        }
+        if (sizes[i] > conduit->max_message_size) {
+            return -EMSGSIZE;
+        }
+    }
+    
+    if (conduit->ring) {
+        return fast_send(conduit, messages, sizes, count, flags);
+    }
+    
+    // Locked ring: one at a time, only the first may block
+    size_t sent;
+    for (sent = 0; sent < count; sent++) {
+        int64_t result = conduit_send(conduit, messages[sent], sizes[sent],
+                                      sent ? flags | CONDUIT_FLAG_NONBLOCK : flags);
+        if (result < 0) {
+            return sent ? (int64_t)sent : result;
+        }
+    }
+    return sent;
+}
+
+// =============================================================================
+// Zero-Copy Messages
+// =============================================================================
+
+// Send a page-aligned buffer of private memory by reference: only a page
+// list goes through the ring. By default the pages become copy-on-write
+// in both domains; with CONDUIT_FLAG_TRANSFER they leave the sender.
+int64_t conduit_send_pages(conduit_t* conduit, void* buffer,
+                           size_t size, uint32_t flags) {
+    if (!conduit || !buffer || size == 0 ||
+        ((uint64_t)buffer & (FLUX_PAGE_SIZE - 1))) {
+        return -EINVAL;
+    }
+    
+    if (conduit->state != CONDUIT_STATE_OPEN) {
+        return -EPIPE;
+    }
+    
+    if (size > MAX_PAGE_MESSAGE_SIZE) {
+        return -EMSGSIZE;
+    }
+    
+    if (conduit->ring) {
+        return -EINVAL;  // Nothing would drop the pages' references on close
+    }
+    
+    quantum_context_t* current = continuum_get_current_quantum();
+    if (!current->memory_domain) {
+        return -EFAULT;
+    }
+    
+    spinlock_acquire(&conduit->lock);
+    
+    // Check if there's space for the header and list pointer
+    size_t total_size = sizeof(conduit_message_t) + sizeof(conduit_page_list_t*);
+    
+    if (conduit->messages.used + total_size > conduit->buffer_size) {
+        if (flags & CONDUIT_FLAG_NONBLOCK) {
+            spinlock_release(&conduit->lock);
+            return -EAGAIN;
+        }
+        
+        // Block until space available
+        waitqueue_add(&conduit->writers, current);
+        spinlock_release(&conduit->lock);
+        
+        // Will be woken when space is available
+        temporal_yield(current);
+        
+        // Retry after waking
+        return conduit_send_pages(conduit, buffer, size, flags | CONDUIT_FLAG_NONBLOCK);
+    }
+    
+    conduit_page_list_t* list = page_list_alloc(size);
+    if (!list) {
+        spinlock_release(&conduit->lock);
+        return -ENOMEM;
+    }
+    
+    bool move = (flags & CONDUIT_FLAG_TRANSFER) != 0;
+    int result = flux_grab_pages(current->memory_domain, (uint64_t)buffer, size,
+                                 list->frames, move);
+    if (result < 0) {
+        spinlock_release(&conduit->lock);
+        flux_free(list);
+        return result;
+    }
+    list->flags = flags & CONDUIT_FLAG_TRANSFER;
+    
+    conduit_message_t header = {
+        .sender_qid = current->qid,
+        .size = sizeof(list),
+        .timestamp = continuum_get_time(),
+        .flags = flags | CONDUIT_MSG_PAGES
+    };
+    
+    ringbuf_write(&conduit->messages, &header, sizeof(header));
+    ringbuf_write(&conduit->messages, &list, sizeof(list));
+    
+    // Update statistics
+    conduit->stats.messages_sent++;
+    conduit->stats.bytes_sent += size;
+    conduit->stats.page_messages++;
+    conduit->stats.pages_sent += list->page_count;
+    continuum_counter_inc(COUNTER_CONDUIT_MESSAGES);
+    continuum_counter_add(COUNTER_CONDUIT_BYTES, size);
+    
+    // Wake a reader if any
+    waitqueue_remove(&conduit->readers);
+    conduit_notify(conduit, CONDUIT_SELECT_READ_READY);
+    
+    spinlock_release(&conduit->lock);
+    return size;
+}
+
+// Receive a zero-copy message by mapping its pages into the caller's
+// domain. Returns the message size and stores the mapping's address in
+// *buffer; unmap it with conduit_release_pages. Copied messages at the
+// head of the conduit fail with -EINVAL and are left for conduit_receive.
+int64_t conduit_receive_pages(conduit_t* conduit, void** buffer, uint32_t flags) {
+    if (!conduit || !buffer || conduit->ring) {
+        return -EINVAL;
+    }
+    
+    if (conduit->state != CONDUIT_STATE_OPEN) {
+        return -EPIPE;
+    }
+    
+    quantum_context_t* current = continuum_get_current_quantum();
+    if (!current->memory_domain) {
+        return -EFAULT;
+    }
+    
+    spinlock_acquire(&conduit->lock);
+    
+    // Check if there's a message
+    if (conduit->messages.used < sizeof(conduit_message_t)) {
+        if (flags & CONDUIT_FLAG_NONBLOCK) {
+            spinlock_release(&conduit->lock);
+            return -EAGAIN;
+        }
+        
+        // Block until message available
+        waitqueue_add(&conduit->readers, current);
+        spinlock_release(&conduit->lock);
+        
+        // Will be woken when message arrives
+        temporal_yield(current);
+        
+        // Retry after waking
+        return conduit_receive_pages(conduit, buffer, flags | CONDUIT_FLAG_NONBLOCK);
+    }
+    
+    conduit_message_t header;
+    ringbuf_peek(&conduit->messages, &header, sizeof(header));
+    if (!(header.flags & CONDUIT_MSG_PAGES)) {
+        spinlock_release(&conduit->lock);
+        return -EINVAL;
+    }
+    
+    // Moved pages come back writable; shared ones copy on first write
+    conduit_page_list_t* list = page_list_peek(&conduit->messages);
+    uint32_t map_flags = FLUX_MAP_READ | FLUX_MAP_USER |
+        ((list->flags & CONDUIT_FLAG_TRANSFER) ? FLUX_MAP_WRITE : FLUX_MAP_COW);
+    
+    uint64_t addr = flux_place_pages(current->memory_domain, list->frames,
+                                     list->page_count, map_flags);
+    if (!addr) {
+        spinlock_release(&conduit->lock);
+        return -ENOMEM;  // The message stays queued
+    }
+    
+    // The mapping owns the frame references now
+    ringbuf_discard(&conduit->messages, sizeof(header) + sizeof(list));
+    size_t size = list->size;
+    flux_free(list);
+    
+    // Update statistics
+    conduit->stats.messages_received++;
+    conduit->stats.bytes_received += size;
+    
+    // Wake a writer if any
+    waitqueue_remove(&conduit->writers);
+    conduit_notify(conduit, conduit_readiness(conduit) & CONDUIT_SELECT_WRITE_READY);
+    
+    spinlock_release(&conduit->lock);
+    
+    *buffer = (void*)addr;
+    return size;
+}
+
+void conduit_release_pages(void* buffer, size_t size) {
+    quantum_context_t* current = continuum_get_current_quantum();
+    if (buffer && current && current->memory_domain) {
+        flux_unmap_region(current->memory_domain, (uint64_t)buffer, size);
+    }
+}
+
+// =============================================================================
+// Broadcast and Multicast
+// =============================================================================
+
+int64_t conduit_broadcast(const char* pattern, const void* message, 
+                         size_t size, uint32_t flags) {
+    if (!pattern) {
+        return -EINVAL;
+    }
+    
+    conduit_t** targets = flux_allocate(NULL, MAX_CONDUITS * sizeof(conduit_t*),
+                                        FLUX_ALLOC_KERNEL);
+    if (!targets) {
+        return -ENOMEM;
+    }
+    
+    // Collect references to the subtree under the pattern, then send
+    // outside the read section since a send may switch quanta
+    size_t count = 0;
+    uint32_t cpu;
+    uint64_t irq = continuum_read_lock(g_registry_readers, &cpu);
+    
+    topic_node_t* root = topic_find(pattern);
+    topic_node_t* node = root;
+    while (node) {
+        conduit_t* conduit = __atomic_load_n(&node->conduit, __ATOMIC_ACQUIRE);
+        if (conduit && count < MAX_CONDUITS && conduit_get(conduit)) {
+            targets[count++] = conduit;
+        }
+        
+        // Pre-order walk: first child, else the next sibling up the path
+        topic_node_t* next = __atomic_load_n(&node->child, __ATOMIC_ACQUIRE);
+        while (!next && node != root) {
+            next = __atomic_load_n(&node->sibling, __ATOMIC_ACQUIRE);
+            node = node->parent;
+        }
+        node = next;
+    }
+    
+    continuum_read_unlock(g_registry_readers, cpu, irq);
+    
+    int64_t sent_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (targets[i]->state == CONDUIT_STATE_OPEN &&
+            conduit_send(targets[i], message, size, flags | CONDUIT_FLAG_NONBLOCK) > 0) {
+            sent_count++;
+        }
+        conduit_close(targets[i]);
+    }
+    
+    flux_free(targets);
+    return sent_count;
+}
+
+// =============================================================================
+// Poll Sets
+// =============================================================================
+
+static void conduit_poll_init(conduit_poll_t* poll) {
+    poll->entries = NULL;
+    poll->ready_head = NULL;
+    poll->ready_tail = NULL;
+    poll->ready_count = 0;
+    poll->count = 0;
+    poll->waiter = NULL;
+    spinlock_init(&poll->lock);
+}
+
+conduit_poll_t* conduit_poll_create(void) {
+    conduit_poll_t* poll = flux_allocate(NULL, sizeof(conduit_poll_t), FLUX_ALLOC_KERNEL);
+    if (poll) {
+        conduit_poll_init(poll);
+    }
+    return poll;
+}
+
+// Unlink an entry from what it watches (unless that already dropped it
+// on close) and from the poll set, then free it
+static void poll_unregister(conduit_poll_t* poll, conduit_poll_entry_t* entry) {
+    spinlock_acquire(&poll->lock);
+    bool detached = entry->detached;
+    spinlock_release(&poll->lock);
+    
+    if (!detached) {
+        spinlock_t* lock = poll_watch_lock(entry);
+        spinlock_acquire(lock);
+        conduit_poll_entry_t** link = poll_watchers(entry);
+        while (*link && *link != entry) {
+            link = &(*link)->next_watch;
+        }
+        if (*link) {
+            *link = entry->next_watch;
+        }
+        spinlock_release(lock);
+    }
+    
+    spinlock_acquire(&poll->lock);
+    conduit_poll_entry_t** link = &poll->entries;
+    while (*link && *link != entry) {
+        link = &(*link)->next_entry;
+    }
+    if (*link) {
+        *link = entry->next_entry;
+        poll->count--;
+    }
+    poll_ready_unlink(poll, entry);
+    spinlock_release(&poll->lock);
+    
+    flux_free(entry);
+}
+
+static void conduit_poll_clear(conduit_poll_t* poll) {
+    while (poll->entries) {
+        poll_unregister(poll, poll->entries);
+    }
+}
+
+void conduit_poll_destroy(conduit_poll_t* poll) {
+    if (!poll) {
+        return;
+    }
+    
+    conduit_poll_clear(poll);
+    flux_free(poll);
+}
+
+static conduit_poll_entry_t* poll_entry_create(conduit_poll_t* poll, uint32_t events,
+                                               void* data) {
+    conduit_poll_entry_t* entry = flux_allocate(NULL, sizeof(conduit_poll_entry_t),
+                                                FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (entry) {
+        entry->poll = poll;
+        entry->events = events;
+        entry->data = data;
+    }
+    return entry;
+}
+
+// Link a new entry on its watcher list and into the poll set, unless the
+// poll set already watches the same thing. The watcher lock is held; a
+// waiter to wake for something already ready is handed back in *waiter.
+static int poll_register(conduit_poll_entry_t* entry, quantum_context_t** waiter) {
+    conduit_poll_t* poll = entry->poll;
+    conduit_poll_entry_t** watchers = poll_watchers(entry);
+    
+    for (conduit_poll_entry_t* e = *watchers; e; e = e->next_watch) {
+        if (e->poll == poll) {
+            return -EINVAL;  // Already registered
+        }
+    }
+    
+    entry->next_watch = *watchers;
+    *watchers = entry;
+    
+    // Already-ready ones go straight onto the ready list
+    uint32_t ready = poll_readiness(entry) & poll_interest(entry);
+    *waiter = NULL;
+    
+    spinlock_acquire(&poll->lock);
+    entry->next_entry = poll->entries;
+    poll->entries = entry;
+    poll->count++;
+    if (ready) {
+        *waiter = poll_post(entry, ready);
+    }
+    spinlock_release(&poll->lock);
+    
+    return 0;
 }
 
-// =============================================================================
-// Message Operations
-// =============================================================================
+static inline bool poll_events_valid(uint32_t events) {
+    return (events & (CONDUIT_SELECT_READ | CONDUIT_SELECT_WRITE | CONDUIT_SELECT_ERROR)) != 0;
+}
 
-int64_t conduit_send(conduit_t* conduit, const void* message, 
-                    size_t size, uint32_t flags) {
-    if (!conduit || !message || size == 0) {
+// Watch a conduit for the CONDUIT_SELECT_* events in events. Level
+// triggered by default: a conduit is reported by every wait while it
+// stays ready. With CONDUIT_SELECT_EDGE it is reported once per post.
+int conduit_poll_add(conduit_poll_t* poll, conduit_t* conduit,
+                     uint32_t events, void* data) {
+    if (!poll || !conduit || !poll_events_valid(events)) {
         return -EINVAL;
     }
     
-    if (conduit->state != CONDUIT_STATE_OPEN) {
-        return -EPIPE;
-    }
-    
-    if (size > conduit->max_message_size) {
-        return -EMSGSIZE;
+    conduit_poll_entry_t* entry = poll_entry_create(poll, events, data);
+    if (!entry) {
+        return -ENOMEM;
     }
+    entry->conduit = conduit;
     
     spinlock_acquire(&conduit->lock);
     
-    // Check if there's space
-    size_t header_size = sizeof(conduit_message_t);
-    size_t total_size = header_size + size;
-    
-    if (conduit->messages.used + total_size > conduit->buffer_size) {
-        if (flags & CONDUIT_FLAG_NONBLOCK) {
-            spinlock_release(&conduit->lock);
-            return -EAGAIN;
-        }
-        
-        // Block until space available
-        quantum_context_t* current = continuum_get_current_quantum();
-        waitqueue_add(&conduit->writers, current);
-        spinlock_release(&conduit->lock);
-        
-        // Will be woken when space is available
-        temporal_yield(current);
-        
-        // Retry after waking
-        return conduit_send(conduit, message, size, flags | CONDUIT_FLAG_NONBLOCK);
+    int result = conduit->state == CONDUIT_STATE_OPEN ? 0 : -EPIPE;
+    quantum_context_t* waiter = NULL;
+    if (result == 0) {
+        result = poll_register(entry, &waiter);
     }
     
-    // Create message header
-    conduit_message_t header = {
-        .sender_qid = continuum_get_current_quantum()->qid,
-        .size = size,
-        .timestamp = continuum_get_time(),
-        .flags = flags
-    };
-    
-    // Write header and message
-    ringbuf_write(&conduit->messages, &header, sizeof(header));
-    ringbuf_write(&conduit->messages, message, size);
+    spinlock_release(&conduit->lock);
     
-    // Update statistics
-    conduit->stats.messages_sent++;
-    conduit->stats.bytes_sent += size;
-    g_conduit_registry.message_count++;
-    g_conduit_registry.total_bytes += size;
+    if (result != 0) {
+        flux_free(entry);
+        return result;
+    }
+    if (waiter) {
+        temporal_unblock(waiter);
+    }
+    return 0;
+}
+
+static int poll_remove_entry(conduit_poll_t* poll, conduit_t* conduit,
+                             conduit_poll_source_t* source) {
+    spinlock_acquire(&poll->lock);
+    conduit_poll_entry_t* entry = poll->entries;
+    while (entry && (entry->conduit != conduit || entry->source != source)) {
+        entry = entry->next_entry;
+    }
+    spinlock_release(&poll->lock);
     
-    // Wake a reader if any
-    waitqueue_remove(&conduit->readers);
+    if (!entry) {
+        return -EINVAL;
+    }
     
-    spinlock_release(&conduit->lock);
-    return size;
+    poll_unregister(poll, entry);
+    return 0;
 }
 
-int64_t conduit_receive(conduit_t* conduit, void* buffer, 
-                       size_t max_size, uint32_t flags) {
-    if (!conduit || !buffer || max_size == 0) {
+// The caller's reference to the conduit keeps it alive here; a conduit
+// that has since been closed only needs its detached entry dropped
+int conduit_poll_remove(conduit_poll_t* poll, conduit_t* conduit) {
+    if (!poll || !conduit) {
         return -EINVAL;
     }
     
-    if (conduit->state != CONDUIT_STATE_OPEN) {
-        return -EPIPE;
+    return poll_remove_entry(poll, conduit, NULL);
+}
+
+// Move up to max ready entries into events. Each entry is looked at once
+// per call. Level-triggered entries are checked again against the conduit
+// and go back on the tail while still ready. Caller holds poll->lock.
+static size_t poll_harvest(conduit_poll_t* poll, conduit_poll_event_t* events,
+                           size_t max) {
+    size_t count = 0;
+    uint32_t budget = poll->ready_count;
+    
+    while (count < max && budget-- > 0 && poll->ready_head) {
+        conduit_poll_entry_t* entry = poll->ready_head;
+        poll_ready_unlink(poll, entry);
+        
+        uint32_t ready = entry->pending;
+        entry->pending = 0;
+        
+        bool level = !entry->detached && !(entry->events & CONDUIT_SELECT_EDGE);
+        if (level) {
+            ready = poll_readiness(entry) & poll_interest(entry);
+        }
+        
+        if (ready) {
+            events[count].conduit = entry->conduit;
+            events[count].source = entry->source;
+            events[count].events = ready;
+            events[count].data = entry->data;
+            count++;
+            
+            if (level) {
+                poll_ready_push(poll, entry);
+            }
+        }
     }
     
-    spinlock_acquire(&conduit->lock);
+    return count;
+}
+
+static void poll_timer_fire(temporal_timer_t* timer, void* arg) {
+    (void)timer;
+    temporal_unblock((quantum_context_t*)arg);
+}
+
+// Block until the poll set has ready entries or the TSC passes deadline
+// (0 waits forever). Only one quantum may wait on a poll set at a time.
+static int poll_wait_until(conduit_poll_t* poll, conduit_poll_event_t* events,
+                           size_t max, uint64_t deadline) {
+    quantum_context_t* current = continuum_get_current_quantum();
     
-    // Check if there's a message
-    if (conduit->messages.used < sizeof(conduit_message_t)) {
-        if (flags & CONDUIT_FLAG_NONBLOCK) {
-            spinlock_release(&conduit->lock);
-            return -EAGAIN;
+    while (1) {
+        // With interrupts off the timeout timer, which lives on this CPU,
+        // can't fire before the quantum is marked blocked
+        uint64_t flags = cpu_irq_save();
+        
+        spinlock_acquire(&poll->lock);
+        size_t count = poll_harvest(poll, events, max);
+        if (count > 0 || (deadline && continuum_get_time() >= deadline)) {
+            spinlock_release(&poll->lock);
+            cpu_irq_restore(flags);
+            return (int)count;
         }
+        poll->waiter = current;
+        spinlock_release(&poll->lock);
         
-        // Block until message available
-        quantum_context_t* current = continuum_get_current_quantum();
-        waitqueue_add(&conduit->readers, current);
-        spinlock_release(&conduit->lock);
+        temporal_timer_t timer;
+        bool armed = false;
+        if (deadline) {
+            temporal_timer_init(&timer, poll_timer_fire, current);
+            armed = temporal_timer_start(&timer, deadline) == 0;
+        }
         
-        // Will be woken when message arrives
-        temporal_yield(current);
+        // A post since the harvest has already taken the waiter back. One
+        // from another CPU that takes it after this check leaves its
+        // wakeup pending, and temporal_block returns at once.
+        bool sleep = current && (armed || !deadline) &&
+                     __atomic_load_n(&poll->waiter, __ATOMIC_ACQUIRE) == current;
+        if (sleep) {
+            temporal_block(current, BLOCK_CONDUIT);
+        }
+        cpu_irq_restore(flags);
         
-        // Retry after waking
-        return conduit_receive(conduit, buffer, max_size, 
-                             flags | CONDUIT_FLAG_NONBLOCK);
+        if (armed) {
+            temporal_timer_cancel(&timer);
+        }
+        
+        spinlock_acquire(&poll->lock);
+        if (poll->waiter == current) {
+            poll->waiter = NULL;
+        }
+        spinlock_release(&poll->lock);
+        
+        // No quantum to block, or this CPU's timer heap is full
+        if (!sleep) {
+            if (current) {
+                temporal_yield(current);
+            } else {
+                __asm__ __volatile__("pause");
+            }
+        }
     }
-    
-    // Peek at message header
-    conduit_message_t header;
-    ringbuf_peek(&conduit->messages, &header, sizeof(header));
-    
-    if (header.size > max_size) {
-        spinlock_release(&conduit->lock);
-        return -EMSGSIZE;
+}
+
+// Wait up to timeout_us microseconds (0 waits forever) for ready conduits.
+// Returns the number of events stored, 0 on timeout. The cost depends
+// on how many conduits are ready, not on how many are registered.
+int conduit_poll_wait(conduit_poll_t* poll, conduit_poll_event_t* events,
+                      size_t max_events, uint64_t timeout_us) {
+    if (!poll || !events || max_events == 0) {
+        return -EINVAL;
     }
     
-    // Read header and message
-    ringbuf_read(&conduit->messages, &header, sizeof(header));
-    size_t bytes_read = ringbuf_read(&conduit->messages, buffer, header.size);
-    
-    // Update statistics
-    conduit->stats.messages_received++;
-    conduit->stats.bytes_received += bytes_read;
-    
-    // Wake a writer if any
-    waitqueue_remove(&conduit->writers);
-    
-    spinlock_release(&conduit->lock);
-    return bytes_read;
+    uint64_t deadline = timeout_us ? continuum_get_time() + continuum_usec_to_tsc(timeout_us) : 0;
+    return poll_wait_until(poll, events, max_events, deadline);
 }
 
-int64_t conduit_peek(conduit_t* conduit, void* buffer, size_t max_size) {
-    if (!conduit || !buffer || max_size == 0) {
+// =============================================================================
+// Poll Sources
+// =============================================================================
+
+void conduit_source_init(conduit_poll_source_t* source,
+                         uint32_t (*readiness)(conduit_poll_source_t* source)) {
+    source->readiness = readiness;
+    source->watchers = NULL;
+    spinlock_init(&source->lock);
+}
+
+// As conduit_poll_add, for a source
+int conduit_poll_add_source(conduit_poll_t* poll, conduit_poll_source_t* source,
+                            uint32_t events, void* data) {
+    if (!poll || !source || !source->readiness || !poll_events_valid(events)) {
         return -EINVAL;
     }
     
-    spinlock_acquire(&conduit->lock);
-    
-    if (conduit->messages.used < sizeof(conduit_message_t)) {
-        spinlock_release(&conduit->lock);
-        return 0;
+    conduit_poll_entry_t* entry = poll_entry_create(poll, events, data);
+    if (!entry) {
+        return -ENOMEM;
     }
+    entry->source = source;
     
-    // Peek at message header
-    conduit_message_t header;
-    size_t offset = 0;
+    quantum_context_t* waiter = NULL;
+    spinlock_acquire(&source->lock);
+    int result = poll_register(entry, &waiter);
+    spinlock_release(&source->lock);
     
-    // Peek header
-    ringbuf_peek(&conduit->messages, &header, sizeof(header));
+    if (result != 0) {
+        flux_free(entry);
+        return result;
+    }
+    if (waiter) {
+        temporal_unblock(waiter);
+    }
+    return 0;
+}
+
+int conduit_poll_remove_source(conduit_poll_t* poll, conduit_poll_source_t* source) {
+    if (!poll || !source) {
+        return -EINVAL;
+    }
     
-    if (header.size > max_size) {
-        spinlock_release(&conduit->lock);
-        return -EMSGSIZE;
+    return poll_remove_entry(poll, NULL, source);
+}
+
+// Post a change in the source's *_READY bits to the poll sets watching
+// it. With nobody watching this is one load.
+void conduit_source_notify(conduit_poll_source_t* source, uint32_t ready) {
+    if (!__atomic_load_n(&source->watchers, __ATOMIC_RELAXED)) {
+        return;
     }
     
-    // Peek message data (skip header)
-    uint8_t temp_buffer[sizeof(header) + header.size];
-    ringbuf_peek(&conduit->messages, temp_buffer, sizeof(header) + header.size);
-    memcpy(buffer, temp_buffer + sizeof(header), header.size);
+    spinlock_acquire(&source->lock);
+    poll_notify(source->watchers, ready);
+    spinlock_release(&source->lock);
+}
+
+// The source is going away; its entries stay in their poll sets,
+// reporting an error, until removed
+void conduit_source_detach(conduit_poll_source_t* source) {
+    if (!__atomic_load_n(&source->watchers, __ATOMIC_RELAXED)) {
+        return;
+    }
     
-    spinlock_release(&conduit->lock);
-    return header.size;
+    spinlock_acquire(&source->lock);
+    poll_detach(&source->watchers);
+    spinlock_release(&source->lock);
 }
 
 // =============================================================================
-// Broadcast and Multicast
+// Conduit Selection
 // =============================================================================
 
-int64_t conduit_broadcast(const char* pattern, const void* message, 
-                         size_t size, uint32_t flags) {
-    int64_t sent_count = 0;
-    
-    spinlock_acquire(&g_conduit_lock);
+static int select_scan(conduit_t** conduits, size_t count, conduit_select_op_t* ops) {
+    int ready_count = 0;
     
-    // Send to all matching conduits
-    for (int i = 0; i < MAX_CONDUITS; i++) {
-        if (g_conduits[i] && g_conduits[i]->state == CONDUIT_STATE_OPEN) {
-            // Simple pattern matching (could be more sophisticated)
-            if (strstr(g_conduits[i]->name, pattern)) {
-                spinlock_release(&g_conduit_lock);
-                
-                if (conduit_send(g_conduits[i], message, size, 
-                               flags | CONDUIT_FLAG_NONBLOCK) > 0) {
-                    sent_count++;
-                }
-                
-                spinlock_acquire(&g_conduit_lock);
-            }
+    for (size_t i = 0; i < count; i++) {
+        if (!conduits[i]) continue;
+        
+        uint32_t want = (ops[i] & (CONDUIT_SELECT_READ | CONDUIT_SELECT_WRITE |
+                                   CONDUIT_SELECT_ERROR)) << POLL_READY_SHIFT;
+        uint32_t ready = conduit_readiness(conduits[i]) & want;
+        if (ready) {
+            ops[i] |= ready;
+            ready_count++;
         }
     }
     
-    spinlock_release(&g_conduit_lock);
-    return sent_count;
+    return ready_count;
 }
 
-// =============================================================================
-// Conduit Selection
-// =============================================================================
-
+// One-shot select on top of a temporary poll set. timeout is in TSC
+// ticks, 0 waits forever.
 int conduit_select(conduit_t** conduits, size_t count, 
                   conduit_select_op_t* ops, uint64_t timeout) {
-    uint64_t start_time = continuum_get_time();
-    int ready_count = 0;
+    uint64_t deadline = timeout ? continuum_get_time() + timeout : 0;
     
-    while (1) {
-        // Check each conduit
-        for (size_t i = 0; i < count; i++) {
-            if (!conduits[i]) continue;
-            
-            bool ready = false;
-            
-            if (ops[i] & CONDUIT_SELECT_READ) {
-                if (conduits[i]->messages.used >= sizeof(conduit_message_t)) {
-                    ready = true;
-                    ops[i] |= CONDUIT_SELECT_READ_READY;
-                }
-            }
-            
-            if (ops[i] & CONDUIT_SELECT_WRITE) {
-                if (conduits[i]->messages.used < conduits[i]->buffer_size / 2) {
-                    ready = true;
-                    ops[i] |= CONDUIT_SELECT_WRITE_READY;
-                }
-            }
-            
-            if (ready) {
-                ready_count++;
-            }
-        }
-        
-        if (ready_count > 0) {
-            return ready_count;
-        }
-        
-        // Check timeout
-        if (timeout > 0) {
-            uint64_t elapsed = continuum_get_time() - start_time;
-            if (elapsed >= timeout) {
-                return 0;  // Timeout
-            }
+    int ready_count = select_scan(conduits, count, ops);
+    if (ready_count > 0) {
+        return ready_count;
+    }
+    
+    conduit_poll_t poll;
+    conduit_poll_init(&poll);
+    
+    bool closed = false;
+    for (size_t i = 0; i < count; i++) {
+        if (conduits[i] &&
+            conduit_poll_add(&poll, conduits[i], ops[i] & (CONDUIT_SELECT_READ |
+                             CONDUIT_SELECT_WRITE | CONDUIT_SELECT_ERROR), NULL) == -EPIPE) {
+            closed = true;  // Closed since the scan; nothing left to wait for
         }
-        
-        // Yield to scheduler
-        temporal_yield(NULL);
     }
+    
+    if (!closed && (poll.count > 0 || deadline)) {
+        conduit_poll_event_t event;
+        poll_wait_until(&poll, &event, 1, deadline);
+    }
+    conduit_poll_clear(&poll);
+    
+    return select_scan(conduits, count, ops);
 }
 
 // =============================================================================
@@ -638,8 +2303,8 @@ void conduit_get_global_stats(conduit_global_stats_t* stats) {
     spinlock_acquire(&g_conduit_lock);
     
     stats->total_conduits = g_conduit_registry.conduit_count;
-    stats->total_messages = g_conduit_registry.message_count;
-    stats->total_bytes = g_conduit_registry.total_bytes;
+    stats->total_messages = continuum_counter_read(COUNTER_CONDUIT_MESSAGES);
+    stats->total_bytes = continuum_counter_read(COUNTER_CONDUIT_BYTES);
     
     // Calculate active conduits
     stats->active_conduits = 0;
@@ -652,6 +2317,159 @@ void conduit_get_global_stats(conduit_global_stats_t* stats) {
     spinlock_release(&g_conduit_lock);
 }
 
+// =============================================================================
+// IPC Benchmark
+// =============================================================================
+
+#define CONDUIT_BENCH_MESSAGES  4096
+#define CONDUIT_BENCH_SIZE      64
+#define CONDUIT_BENCH_BATCH     16
+#define CONDUIT_BENCH_RING      65536
+
+static uint64_t bench_p99(uint64_t* samples, size_t count) {
+    // Shell sort; runs once per result
+    for (size_t gap = count / 2; gap > 0; gap /= 2) {
+        for (size_t i = gap; i < count; i++) {
+            uint64_t sample = samples[i];
+            size_t j = i;
+            while (j >= gap && samples[j - gap] > sample) {
+                samples[j] = samples[j - gap];
+                j -= gap;
+            }
+            samples[j] = sample;
+        }
+    }
+    return samples[(count - 1) * 99 / 100];
+}
+
+static void bench_finish(conduit_bench_t* r, uint64_t* samples, uint64_t tsc_hz) {
+    r->messages_per_sec = r->cycles ? r->messages * tsc_hz / r->cycles : 0;
+    r->p99_cycles = bench_p99(samples, r->messages);
+    r->p99_ns = tsc_hz ? r->p99_cycles * 1000000000ULL / tsc_hz : 0;
+}
+
+// A request on one conduit answered on another, timed per round trip.
+// Both ends run in the calling quantum, so this measures the ring paths
+// without a context switch.
+static bool bench_ping_pong(conduit_ring_mode_t mode, conduit_bench_t* r,
+                            uint64_t* samples, uint64_t tsc_hz) {
+    conduit_t* ping = conduit_create_ring("bench.ping", CONDUIT_BENCH_RING, mode);
+    conduit_t* pong = conduit_create_ring("bench.pong", CONDUIT_BENCH_RING, mode);
+    if (!ping || !pong) {
+        conduit_close(ping);
+        conduit_close(pong);
+        return false;
+    }
+    
+    uint8_t request[CONDUIT_BENCH_SIZE] = {0};
+    uint8_t reply[CONDUIT_BENCH_SIZE];
+    
+    uint64_t start = continuum_get_time();
+    for (size_t i = 0; i < CONDUIT_BENCH_MESSAGES; i++) {
+        uint64_t sent = continuum_get_time();
+        conduit_send(ping, request, sizeof(request), CONDUIT_FLAG_NONBLOCK);
+        conduit_receive(ping, reply, sizeof(reply), CONDUIT_FLAG_NONBLOCK);
+        conduit_send(pong, reply, sizeof(reply), CONDUIT_FLAG_NONBLOCK);
+        conduit_receive(pong, request, sizeof(request), CONDUIT_FLAG_NONBLOCK);
+        samples[i] = continuum_get_time() - sent;
+    }
+    
+    r->mode = mode;
+    r->streaming = false;
+    r->message_size = CONDUIT_BENCH_SIZE;
+    r->messages = CONDUIT_BENCH_MESSAGES;
+    r->cycles = continuum_get_time() - start;
+    bench_finish(r, samples, tsc_hz);
+    
+    conduit_close(ping);
+    conduit_close(pong);
+    return true;
+}
+
+// One-way stream in batches, each message stamped with its send time
+static bool bench_stream(conduit_ring_mode_t mode, conduit_bench_t* r,
+                         uint64_t* samples, uint64_t tsc_hz) {
+    conduit_t* stream = conduit_create_ring("bench.stream", CONDUIT_BENCH_RING, mode);
+    if (!stream) {
+        return false;
+    }
+    
+    uint64_t batch[CONDUIT_BENCH_BATCH][CONDUIT_BENCH_SIZE / sizeof(uint64_t)];
+    const void* messages[CONDUIT_BENCH_BATCH];
+    size_t sizes[CONDUIT_BENCH_BATCH];
+    for (size_t i = 0; i < CONDUIT_BENCH_BATCH; i++) {
+        messages[i] = batch[i];
+        sizes[i] = CONDUIT_BENCH_SIZE;
+    }
+    
+    uint64_t received[CONDUIT_BENCH_SIZE / sizeof(uint64_t)];
+    size_t count = 0;
+    
+    uint64_t start = continuum_get_time();
+    while (count < CONDUIT_BENCH_MESSAGES) {
+        uint64_t now = continuum_get_time();
+        for (size_t i = 0; i < CONDUIT_BENCH_BATCH; i++) {
+            batch[i][0] = now;
+        }
+        
+        int64_t queued = conduit_send_batch(stream, messages, sizes, CONDUIT_BENCH_BATCH,
+                                            CONDUIT_FLAG_NONBLOCK);
+        for (int64_t i = 0; i < queued && count < CONDUIT_BENCH_MESSAGES; i++) {
+            if (conduit_receive(stream, received, sizeof(received), CONDUIT_FLAG_NONBLOCK) > 0) {
+                samples[count++] = continuum_get_time() - received[0];
+            }
+        }
+        if (queued <= 0) {
+            break;
+        }
+    }
+    
+    r->mode = mode;
+    r->streaming = true;
+    r->message_size = CONDUIT_BENCH_SIZE;
+    r->messages = count;
+    r->cycles = continuum_get_time() - start;
+    if (count > 0) {
+        bench_finish(r, samples, tsc_hz);
+    }
+    
+    conduit_close(stream);
+    return count > 0;
+}
+
+// Ping-pong and streaming results for each ring mode
+size_t conduit_benchmark(conduit_bench_t* results, size_t max_results,
+                         uint64_t tsc_hz) {
+    static const conduit_ring_mode_t modes[] = {
+        CONDUIT_RING_LOCKED, CONDUIT_RING_SPSC, CONDUIT_RING_MPSC
+    };
+    
+    if (!results || max_results == 0) {
+        return 0;
+    }
+    
+    uint64_t* samples = flux_allocate(NULL, CONDUIT_BENCH_MESSAGES * sizeof(uint64_t),
+                                      FLUX_ALLOC_KERNEL);
+    if (!samples) {
+        return 0;
+    }
+    
+    size_t count = 0;
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        if (count < max_results &&
+            bench_ping_pong(modes[m], &results[count], samples, tsc_hz)) {
+            count++;
+        }
+        if (count < max_results &&
+            bench_stream(modes[m], &results[count], samples, tsc_hz)) {
+            count++;
+        }
+    }
+    
+    flux_free(samples);
+    return count;
+}
+
 // =============================================================================
 // Helper Functions
 // =============================================================================
@@ -19,6 +19,8 @@
 #define CONDUIT_NAME_MAX       64
 #define DEFAULT_BUFFER_SIZE    65536  // 64KB
 #define MAX_MESSAGE_SIZE       16384  // 16KB
+#define MAX_PAGE_MESSAGE_SIZE  (4 * 1024 * 1024)  // Zero-copy messages
+#define CONDUIT_CACHE_LINE     64
 
 // Conduit flags
 #define CONDUIT_FLAG_NONBLOCK      (1 << 0)
@@ -26,11 +28,17 @@
 #define CONDUIT_FLAG_PRIORITY      (1 << 2)
 #define CONDUIT_FLAG_COMPRESSED    (1 << 3)
 #define CONDUIT_FLAG_ENCRYPTED     (1 << 4)
+#define CONDUIT_FLAG_TRANSFER      (1 << 5)   // Move pages instead of sharing CoW
+
+// Message header flags set by the conduit itself
+#define CONDUIT_MSG_PAGES          (1U << 31) // Payload is a conduit_page_list_t*
+#define CONDUIT_MSG_PAD            (1U << 30) // Lock-free ring: skip to the wrap
 
 // Select operations
 #define CONDUIT_SELECT_READ        (1 << 0)
 #define CONDUIT_SELECT_WRITE       (1 << 1)
 #define CONDUIT_SELECT_ERROR       (1 << 2)
+#define CONDUIT_SELECT_EDGE        (1 << 3)   // Poll sets: report transitions only
 #define CONDUIT_SELECT_READ_READY  (1 << 16)
 #define CONDUIT_SELECT_WRITE_READY (1 << 17)
 #define CONDUIT_SELECT_ERROR_READY (1 << 18)
@@ -46,6 +54,13 @@
 
 typedef uint32_t conduit_select_op_t;
 
+// Message ring implementations
+typedef enum {
+    CONDUIT_RING_LOCKED = 0,    // Spinlocked byte ring, any readers and writers
+    CONDUIT_RING_SPSC,          // Lock-free, one producer and one consumer
+    CONDUIT_RING_MPSC           // Lock-free, many producers and one consumer
+} conduit_ring_mode_t;
+
 // Conduit states
 typedef enum {
     CONDUIT_STATE_CLOSED = 0,
@@ -62,6 +77,15 @@ typedef struct {
     uint32_t flags;
 } conduit_message_t;
 
+// Frames carried by a zero-copy message; the list holds one reference to
+// each frame until the receiver maps or copies them
+typedef struct {
+    size_t size;
+    uint32_t page_count;
+    uint32_t flags;             // CONDUIT_FLAG_TRANSFER if pages were moved
+    uint64_t frames[];
+} conduit_page_list_t;
+
 // Ring buffer for messages
 typedef struct {
     void* buffer;
@@ -72,9 +96,51 @@ typedef struct {
     spinlock_t lock;
 } ring_buffer_t;
 
+// Record header in a lock-free ring. Records are 8-byte aligned and
+// never straddle the end of the buffer.
+typedef struct {
+    uint32_t size;
+    uint32_t flags;
+    quantum_id_t sender_qid;
+    uint64_t timestamp;
+} conduit_record_t;
+
+// Lock-free message ring. Positions count bytes from creation and are
+// masked into the buffer. Each side's index has its own cache line, and
+// each side caches the other's so a transfer rarely misses on it.
+typedef struct {
+    // Producers: next byte to claim
+    uint64_t reserve __attribute__((aligned(CONDUIT_CACHE_LINE)));
+    uint64_t cached_head;
+    
+    // End of the records visible to the consumer
+    uint64_t publish __attribute__((aligned(CONDUIT_CACHE_LINE)));
+    
+    // Consumer: next byte to read
+    uint64_t head __attribute__((aligned(CONDUIT_CACHE_LINE)));
+    uint64_t cached_publish;
+    
+    // Fixed at creation
+    uint8_t* buffer __attribute__((aligned(CONDUIT_CACHE_LINE)));
+    uint64_t size;
+    uint64_t mask;
+    conduit_ring_mode_t mode;
+    void* allocation;
+} conduit_fast_ring_t;
+
+// Buffer of a receiver blocked on a conduit, for a sender to deliver
+// into directly
+typedef struct {
+    void* buffer;
+    size_t max_size;
+    size_t size;
+    bool done;
+} conduit_handoff_t;
+
 // Wait queue node
 typedef struct wait_node {
     quantum_context_t* quantum;
+    conduit_handoff_t* handoff; // Receivers only; NULL otherwise
     struct wait_node* next;
 } wait_node_t;
 
@@ -86,6 +152,57 @@ typedef struct {
     spinlock_t lock;
 } wait_queue_t;
 
+struct conduit;
+struct conduit_poll;
+struct conduit_poll_entry;
+
+// Something besides a conduit that poll sets can watch, such as a
+// network socket. Its owner embeds one, posts changes with
+// conduit_source_notify and calls conduit_source_detach before it goes.
+// readiness reports the *_READY bits as they stand; it is called under
+// poll set locks, so it must not take the source's lock.
+typedef struct conduit_poll_source {
+    uint32_t (*readiness)(struct conduit_poll_source* source);
+    struct conduit_poll_entry* watchers;
+    spinlock_t lock;
+} conduit_poll_source_t;
+
+// Registration of one conduit or source in a poll set. Linked on its
+// watcher list so sends and receives can post readiness directly.
+typedef struct conduit_poll_entry {
+    struct conduit* conduit;
+    conduit_poll_source_t* source;  // Instead of the conduit; NULL for one
+    struct conduit_poll* poll;
+    uint32_t events;            // CONDUIT_SELECT_* interest
+    uint32_t pending;           // *_READY bits posted since the last wait
+    void* data;
+    bool queued;
+    bool detached;              // Conduit closed; pointer is stale
+    struct conduit_poll_entry* next_watch;
+    struct conduit_poll_entry* next_entry;
+    struct conduit_poll_entry* next_ready;
+    struct conduit_poll_entry* prev_ready;
+} conduit_poll_entry_t;
+
+// Poll set: conduits post to the ready list, one waiter drains it
+typedef struct conduit_poll {
+    conduit_poll_entry_t* entries;
+    conduit_poll_entry_t* ready_head;
+    conduit_poll_entry_t* ready_tail;
+    uint32_t ready_count;
+    uint32_t count;
+    quantum_context_t* waiter;
+    spinlock_t lock;
+} conduit_poll_t;
+
+// Event returned by conduit_poll_wait
+typedef struct {
+    struct conduit* conduit;    // NULL for a source
+    conduit_poll_source_t* source;
+    uint32_t events;            // *_READY bits
+    void* data;
+} conduit_poll_event_t;
+
 // Conduit statistics
 typedef struct {
     uint64_t messages_sent;
@@ -94,16 +211,23 @@ typedef struct {
     uint64_t bytes_received;
     uint64_t dropped_messages;
     uint64_t peak_usage;
+    uint64_t page_messages;     // Zero-copy sends
+    uint64_t pages_sent;
+    uint64_t handoffs;          // Messages delivered straight to a blocked receiver
 } conduit_stats_t;
 
 // Conduit structure
 typedef struct conduit {
     uint32_t id;
     char name[CONDUIT_NAME_MAX];
+    uint32_t name_hash;
     conduit_state_t state;
     
     // Buffer management
     ring_buffer_t messages;
+    conduit_fast_ring_t* ring;  // Replaces messages unless CONDUIT_RING_LOCKED
+    conduit_ring_mode_t ring_mode;
+    uint32_t ring_waiters;      // Quanta asleep on a lock-free ring
     size_t buffer_size;
     size_t max_message_size;
     
@@ -115,6 +239,7 @@ typedef struct conduit {
     // Wait queues
     wait_queue_t readers;
     wait_queue_t writers;
+    conduit_poll_entry_t* watchers;
     
     // Statistics
     conduit_stats_t stats;
@@ -131,12 +256,22 @@ typedef struct {
     uint64_t total_bytes;
 } conduit_global_stats_t;
 
+// IPC benchmark result (one per ring mode and pattern)
+typedef struct {
+    conduit_ring_mode_t mode;
+    bool streaming;             // Batched one-way stream, else ping-pong
+    size_t message_size;
+    uint64_t messages;
+    uint64_t cycles;
+    uint64_t messages_per_sec;
+    uint64_t p99_cycles;        // Round trip for ping-pong, send to receive for streams
+    uint64_t p99_ns;
+} conduit_bench_t;
+
 // Conduit registry
 typedef struct {
     bool initialized;
     uint32_t conduit_count;
-    uint64_t message_count;
-    uint64_t total_bytes;
 } conduit_registry_t;
 
 // =============================================================================
@@ -148,6 +283,8 @@ void conduit_init(void);
 
 // Conduit management
 conduit_t* conduit_create(const char* name, size_t buffer_size);
+conduit_t* conduit_create_ring(const char* name, size_t buffer_size,
+                               conduit_ring_mode_t mode);
 conduit_t* conduit_open(const char* name);
 void conduit_close(conduit_t* conduit);
 void conduit_destroy(conduit_t* conduit);
@@ -158,13 +295,41 @@ int64_t conduit_send(conduit_t* conduit, const void* message,
 int64_t conduit_receive(conduit_t* conduit, void* buffer, 
                        size_t max_size, uint32_t flags);
 int64_t conduit_peek(conduit_t* conduit, void* buffer, size_t max_size);
+int64_t conduit_send_batch(conduit_t* conduit, const void* const* messages,
+                           const size_t* sizes, size_t count, uint32_t flags);
+
+// Zero-copy message operations
+int64_t conduit_send_pages(conduit_t* conduit, void* buffer,
+                           size_t size, uint32_t flags);
+int64_t conduit_receive_pages(conduit_t* conduit, void** buffer,
+                              uint32_t flags);
+void conduit_release_pages(void* buffer, size_t size);
 
-// Advanced operations
+// Advanced operations; broadcast reaches every open conduit whose name
+// starts with pattern ("net." matches "net.rx" and "net.tx")
 int64_t conduit_broadcast(const char* pattern, const void* message, 
                          size_t size, uint32_t flags);
 int conduit_select(conduit_t** conduits, size_t count, 
                   conduit_select_op_t* ops, uint64_t timeout);
 
+// Poll sets
+conduit_poll_t* conduit_poll_create(void);
+void conduit_poll_destroy(conduit_poll_t* poll);
+int conduit_poll_add(conduit_poll_t* poll, conduit_t* conduit,
+                     uint32_t events, void* data);
+int conduit_poll_remove(conduit_poll_t* poll, conduit_t* conduit);
+int conduit_poll_wait(conduit_poll_t* poll, conduit_poll_event_t* events,
+                      size_t max_events, uint64_t timeout_us);
+
+// Poll sources
+void conduit_source_init(conduit_poll_source_t* source,
+                         uint32_t (*readiness)(conduit_poll_source_t* source));
+int conduit_poll_add_source(conduit_poll_t* poll, conduit_poll_source_t* source,
+                            uint32_t events, void* data);
+int conduit_poll_remove_source(conduit_poll_t* poll, conduit_poll_source_t* source);
+void conduit_source_notify(conduit_poll_source_t* source, uint32_t ready);
+void conduit_source_detach(conduit_poll_source_t* source);
+
 // Buffer management
 size_t conduit_get_buffer_size(conduit_t* conduit);
 size_t conduit_get_used_space(conduit_t* conduit);
@@ -174,6 +339,8 @@ int conduit_resize_buffer(conduit_t* conduit, size_t new_size);
 // Statistics
 void conduit_get_stats(conduit_t* conduit, conduit_stats_t* stats);
 void conduit_get_global_stats(conduit_global_stats_t* stats);
+size_t conduit_benchmark(conduit_bench_t* results, size_t max_results,
+                         uint64_t tsc_hz);
 
 // Helper functions (minimal string operations)
 int strncpy(char* dest, const char* src, size_t n);
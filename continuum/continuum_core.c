@@ -10,6 +10,8 @@
 #include "temporal_scheduler.h"
 #include "flux_memory.h"
 #include "conduit_ipc.h"
+#include "continuum_trace.h"
+#include "drivers/resonance.h"
 
 // =============================================================================
 // Global Kernel State
@@ -28,10 +30,14 @@ static genesis_boot_context_t* g_boot_context = NULL;
 static quantum_registry_t g_quantum_registry;
 static cpu_core_t g_cpu_cores[MAX_CPU_CORES];
 static uint32_t g_num_cores = 0;
+static uint64_t g_cpu_features = 0;     // Genesis's, as far as CPUID agrees
 
 // Kernel panic buffer
 static char g_panic_buffer[4096];
 
+// Per-CPU statistics, summed by continuum_counter_read
+percpu_counters_t g_percpu_counters[MAX_CPU_CORES];
+
 // =============================================================================
 // Early Boot Functions
 // =============================================================================
@@ -107,39 +113,615 @@ static void init_cpu_cores(void) {
     }
 }
 
+// The CPU_FEATURE_* bits Genesis reported, less any this CPU's own CPUID
+// doesn't show: code paths are picked from these, and one the CPU lacks
+// faults at boot
+static uint64_t verify_cpu_features(uint64_t reported) {
+    uint32_t eax, ebx, ecx, edx;
+    uint64_t present = 0;
+    
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0));
+    uint32_t max_leaf = eax;
+    
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if ((edx >> 25) & 1) present |= CPU_FEATURE_SSE;
+    if ((edx >> 26) & 1) present |= CPU_FEATURE_SSE2;
+    if (ecx & 1) present |= CPU_FEATURE_SSE3;
+    if ((ecx >> 9) & 1) present |= CPU_FEATURE_SSSE3;
+    if ((ecx >> 19) & 1) present |= CPU_FEATURE_SSE41;
+    if ((ecx >> 20) & 1) present |= CPU_FEATURE_SSE42;
+    if ((ecx >> 28) & 1) present |= CPU_FEATURE_AVX;
+    if ((ecx >> 27) & 1) present |= CPU_FEATURE_OSXSAVE;
+    if ((ecx >> 17) & 1) present |= CPU_FEATURE_PCID;
+    if ((ecx >> 24) & 1) present |= CPU_FEATURE_TSC_DEADLINE;
+    
+    if (max_leaf >= 7) {
+        __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                             : "a"(7), "c"(0));
+        if ((ebx >> 5) & 1) present |= CPU_FEATURE_AVX2;
+        if ((ebx >> 9) & 1) present |= CPU_FEATURE_ERMS;
+        if ((ebx >> 10) & 1) present |= CPU_FEATURE_INVPCID;
+        if ((ebx >> 16) & 1) present |= CPU_FEATURE_AVX512;
+        if ((edx >> 4) & 1) present |= CPU_FEATURE_FSRM;
+    }
+    
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                         : "a"(0x80000000));
+    if (eax >= 0x80000001) {
+        __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                             : "a"(0x80000001));
+        if ((edx >> 26) & 1) present |= CPU_FEATURE_PDPE1GB;
+    }
+    
+    return reported & present;
+}
+
 // =============================================================================
 // Interrupt Handling
 // =============================================================================
 
-static void init_interrupts(void) {
-    early_print("Initializing interrupt handlers...\n");
+// One 16-byte entry stub per vector. Each pushes a zero error code where
+// the CPU does not push one, then the vector number, and joins the common
+// path that saves the general registers and calls the dispatcher.
+__asm__(
+    ".text\n"
+    ".balign 16\n"
+    ".global interrupt_stub_table\n"
+    "interrupt_stub_table:\n"
+    ".set vec, 0\n"
+    ".rept 256\n"
+    "  .balign 16\n"
+    "  .if !(vec == 8 || (vec >= 10 && vec <= 14) || vec == 17 || vec == 21 || vec == 29 || vec == 30)\n"
+    "  pushq $0\n"
+    "  .endif\n"
+    "  pushq $vec\n"
+    "  jmp interrupt_common\n"
+    "  .set vec, vec + 1\n"
+    ".endr\n"
+    "interrupt_common:\n"
+    "  pushq %rax\n"
+    "  pushq %rbx\n"
+    "  pushq %rcx\n"
+    "  pushq %rdx\n"
+    "  pushq %rsi\n"
+    "  pushq %rdi\n"
+    "  pushq %rbp\n"
+    "  pushq %r8\n"
+    "  pushq %r9\n"
+    "  pushq %r10\n"
+    "  pushq %r11\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  cld\n"
+    "  movq %rsp, %rdi\n"     // The frame; the stack is 16-byte aligned here
+    "  call continuum_dispatch_interrupt\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %r11\n"
+    "  popq %r10\n"
+    "  popq %r9\n"
+    "  popq %r8\n"
+    "  popq %rbp\n"
+    "  popq %rdi\n"
+    "  popq %rsi\n"
+    "  popq %rdx\n"
+    "  popq %rcx\n"
+    "  popq %rbx\n"
+    "  popq %rax\n"
+    "  addq $16, %rsp\n"      // Vector and error code
+    "  iretq\n"
+);
+
+extern char interrupt_stub_table[];
+
+#define INTERRUPT_STUB_SIZE     16
+#define IDT_GATE_INTERRUPT      0x8E    // Present, DPL 0, 64-bit interrupt gate
+#define RFLAGS_IF               (1 << 9)
+
+typedef struct {
+    interrupt_handler_t handler;
+    void* context;
+    interrupt_steer_t steer;    // Affinity changes for the vector's source
+    void* source;
+    bool eoi;
+    bool allocated;             // Device vector handed out by continuum_alloc_vector
+    uint32_t active;            // Handlers running now, for continuum_sync_interrupt
+    uint64_t count;
+} interrupt_slot_t;
+
+static idt_entry_t g_idt[INTERRUPT_VECTORS] __attribute__((aligned(16)));
+static idt_ptr_t g_idt_ptr;
+static interrupt_slot_t g_interrupt_slots[INTERRUPT_VECTORS];
+static spinlock_t g_interrupt_lock = SPINLOCK_INIT;
+
+static void idt_set_gate(uint8_t vector, uint64_t handler, uint16_t selector) {
+    idt_entry_t* gate = &g_idt[vector];
     
-    // Disable interrupts during setup
-    __asm__ __volatile__("cli");
+    gate->offset_low = handler & 0xFFFF;
+    gate->selector = selector;
+    gate->ist = 0;
+    gate->type_attr = IDT_GATE_INTERRUPT;
+    gate->offset_mid = (handler >> 16) & 0xFFFF;
+    gate->offset_high = handler >> 32;
+    gate->zero = 0;
+}
+
+// Point every gate at its stub and load the table on this CPU
+static void idt_load(void) {
+    uint16_t selector;
+    __asm__ __volatile__("movw %%cs, %0" : "=r"(selector));
+    
+    for (int vector = 0; vector < INTERRUPT_VECTORS; vector++) {
+        idt_set_gate(vector, (uint64_t)interrupt_stub_table + vector * INTERRUPT_STUB_SIZE,
+                     selector);
+    }
+    
+    g_idt_ptr.limit = sizeof(g_idt) - 1;
+    g_idt_ptr.base = (uint64_t)&g_idt;
+    __asm__ __volatile__("lidt %0" : : "m"(g_idt_ptr));
+}
+
+// Called from interrupt_common with interrupts masked
+void continuum_dispatch_interrupt(interrupt_frame_t* frame) {
+    uint8_t vector = (uint8_t)frame->vector;
+    interrupt_slot_t* slot = &g_interrupt_slots[vector];
+    
+    __atomic_fetch_add(&slot->count, 1, __ATOMIC_RELAXED);
+    
+    // Counted as active before the handler is read, so a racing
+    // unregister either sees us or we see its NULL
+    __atomic_fetch_add(&slot->active, 1, __ATOMIC_SEQ_CST);
+    interrupt_handler_t handler = __atomic_load_n(&slot->handler, __ATOMIC_SEQ_CST);
+    bool eoi = vector >= INTERRUPT_EXCEPTIONS && vector != INTERRUPT_SPURIOUS;
+    
+    if (handler) {
+        eoi = slot->eoi;
+        handler(frame, slot->context);
+    } else if (vector < INTERRUPT_EXCEPTIONS) {
+        continuum_panic("Unhandled CPU exception");
+    }
+    __atomic_fetch_sub(&slot->active, 1, __ATOMIC_RELEASE);
+    
+    if (eoi) {
+        continuum_apic_eoi();
+    }
+}
+
+int continuum_register_interrupt(uint8_t vector, interrupt_handler_t handler,
+                                 void* context, bool eoi) {
+    if (!handler) {
+        return -EINVAL;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&g_interrupt_lock);
+    
+    interrupt_slot_t* slot = &g_interrupt_slots[vector];
+    if (slot->handler) {
+        spinlock_release(&g_interrupt_lock);
+        cpu_irq_restore(flags);
+        return -EBUSY;
+    }
+    
+    slot->context = context;
+    slot->eoi = eoi;
+    __atomic_store_n(&slot->handler, handler, __ATOMIC_RELEASE);
+    
+    spinlock_release(&g_interrupt_lock);
+    cpu_irq_restore(flags);
+    return 0;
+}
+
+// The source should already be masked; waits out handlers still running
+void continuum_unregister_interrupt(uint8_t vector) {
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&g_interrupt_lock);
+    
+    interrupt_slot_t* slot = &g_interrupt_slots[vector];
+    __atomic_store_n(&slot->handler, NULL, __ATOMIC_SEQ_CST);
+    slot->steer = NULL;
+    slot->source = NULL;
+    
+    spinlock_release(&g_interrupt_lock);
+    cpu_irq_restore(flags);
+    
+    continuum_sync_interrupt(vector);
+    slot->context = NULL;
+}
+
+void continuum_sync_interrupt(uint8_t vector) {
+    while (__atomic_load_n(&g_interrupt_slots[vector].active, __ATOMIC_ACQUIRE)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+// Hand out a free device vector, or -ENOSPC
+int continuum_alloc_vector(void) {
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&g_interrupt_lock);
+    
+    int found = -ENOSPC;
+    for (int vector = INTERRUPT_DEVICE_FIRST; vector <= INTERRUPT_DEVICE_LAST; vector++) {
+        interrupt_slot_t* slot = &g_interrupt_slots[vector];
+        if (!slot->allocated && !slot->handler) {
+            slot->allocated = true;
+            slot->count = 0;
+            found = vector;
+            break;
+        }
+    }
+    
+    spinlock_release(&g_interrupt_lock);
+    cpu_irq_restore(flags);
+    return found;
+}
+
+void continuum_free_vector(uint8_t vector) {
+    if (vector < INTERRUPT_DEVICE_FIRST || vector > INTERRUPT_DEVICE_LAST) {
+        return;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&g_interrupt_lock);
+    g_interrupt_slots[vector].allocated = false;
+    spinlock_release(&g_interrupt_lock);
+    cpu_irq_restore(flags);
+}
+
+void continuum_set_interrupt_source(uint8_t vector, interrupt_steer_t steer, void* source) {
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&g_interrupt_lock);
+    g_interrupt_slots[vector].steer = steer;
+    g_interrupt_slots[vector].source = source;
+    spinlock_release(&g_interrupt_lock);
+    cpu_irq_restore(flags);
+}
+
+// Deliver the vector to cpu from now on; its source must support steering
+int continuum_set_irq_affinity(uint8_t vector, uint32_t cpu) {
+    if (cpu >= g_num_cores) {
+        return -EINVAL;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&g_interrupt_lock);
+    
+    interrupt_slot_t* slot = &g_interrupt_slots[vector];
+    int result = -ENOSYS;
+    if (slot->steer) {
+        slot->steer(vector, cpu, slot->source);
+        result = 0;
+    }
+    
+    spinlock_release(&g_interrupt_lock);
+    cpu_irq_restore(flags);
+    return result;
+}
+
+uint64_t continuum_interrupt_count(uint8_t vector) {
+    return __atomic_load_n(&g_interrupt_slots[vector].count, __ATOMIC_RELAXED);
+}
+
+uint32_t continuum_get_cpu_count(void) {
+    return g_num_cores;
+}
+
+uint64_t continuum_get_cpu_features(void) {
+    return g_cpu_features;
+}
+
+// =============================================================================
+// Inter-Processor Interrupts
+// =============================================================================
+
+#define IA32_APIC_BASE_MSR      0x1B
+#define IA32_TSC_DEADLINE_MSR   0x6E0
+#define APIC_REG_TPR            0x080
+#define APIC_REG_EOI            0x0B0
+#define APIC_REG_SVR            0x0F0
+#define APIC_REG_ICR_LOW        0x300
+#define APIC_REG_ICR_HIGH       0x310
+#define APIC_REG_LVT_TIMER      0x320
+#define APIC_REG_TIMER_INIT     0x380
+#define APIC_REG_TIMER_CURRENT  0x390
+#define APIC_REG_TIMER_DIVIDE   0x3E0
+#define APIC_BASE_ENABLE        (1ULL << 11)
+#define APIC_SVR_ENABLE         (1U << 8)
+#define APIC_ICR_PENDING        (1U << 12)
+#define APIC_LVT_MASKED         (1U << 16)
+#define APIC_TIMER_TSC_DEADLINE (2U << 17)
+#define APIC_TIMER_DIVIDE_16    0x3
+
+static inline uint64_t read_msr(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ __volatile__("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void write_msr(uint32_t msr, uint64_t value) {
+    __asm__ __volatile__("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                         "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline uint8_t port_inb(uint16_t port) {
+    uint8_t value;
+    __asm__ __volatile__("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline void port_outb(uint16_t port, uint8_t value) {
+    __asm__ __volatile__("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static uint64_t g_lapic_base = 0;      // Same physical page on every CPU
+
+static volatile uint32_t* apic_reg(uint32_t offset) {
+    if (!g_lapic_base) {
+        g_lapic_base = read_msr(IA32_APIC_BASE_MSR) & ~0xFFFULL;
+    }
+    return (volatile uint32_t*)(g_lapic_base + offset);
+}
+
+// Software-enable this CPU's local APIC with spurious interrupts on
+// INTERRUPT_SPURIOUS and accept every priority
+void continuum_lapic_init(void) {
+    write_msr(IA32_APIC_BASE_MSR, read_msr(IA32_APIC_BASE_MSR) | APIC_BASE_ENABLE);
+    *apic_reg(APIC_REG_TPR) = 0;
+    *apic_reg(APIC_REG_SVR) = APIC_SVR_ENABLE | INTERRUPT_SPURIOUS;
+}
+
+uint32_t continuum_cpu_apic_id(uint32_t cpu) {
+    return cpu < g_num_cores ? g_cpu_cores[cpu].core_id : 0;
+}
+
+// Fixed-delivery IPI to one core's local APIC (xAPIC mode, APIC ID taken
+// to be the core index)
+void continuum_send_ipi(uint32_t cpu, uint8_t vector) {
+    if (cpu >= g_num_cores) {
+        return;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    
+    while (*apic_reg(APIC_REG_ICR_LOW) & APIC_ICR_PENDING) {
+        __asm__ __volatile__("pause");
+    }
+    *apic_reg(APIC_REG_ICR_HIGH) = continuum_cpu_apic_id(cpu) << 24;
+    *apic_reg(APIC_REG_ICR_LOW) = vector;  // Writing the low half sends it
+    
+    cpu_irq_restore(flags);
+}
+
+void continuum_apic_eoi(void) {
+    *apic_reg(APIC_REG_EOI) = 0;
+}
+
+// =============================================================================
+// Local APIC Timer
+// =============================================================================
+
+static bool g_timer_tsc_deadline = false;
+static uint64_t g_apic_timer_khz = 0;   // One-shot mode count rate
+
+// Program this CPU's timer for one-shot interrupts on vector. Called on
+// each CPU; the one-shot rate is measured once against the TSC.
+void continuum_timer_init(uint64_t cpu_features, uint8_t vector) {
+    g_timer_tsc_deadline = (cpu_features & CPU_FEATURE_TSC_DEADLINE) != 0;
+    
+    if (g_timer_tsc_deadline) {
+        *apic_reg(APIC_REG_LVT_TIMER) = vector | APIC_TIMER_TSC_DEADLINE;
+        return;
+    }
+    
+    *apic_reg(APIC_REG_TIMER_DIVIDE) = APIC_TIMER_DIVIDE_16;
+    
+    if (!g_apic_timer_khz) {
+        *apic_reg(APIC_REG_LVT_TIMER) = vector | APIC_LVT_MASKED;
+        *apic_reg(APIC_REG_TIMER_INIT) = 0xFFFFFFFF;
+        uint64_t end = continuum_get_time() + g_kernel_state.tsc_khz;  // 1ms
+        while (continuum_get_time() < end) {
+            __asm__ __volatile__("pause");
+        }
+        g_apic_timer_khz = 0xFFFFFFFFULL - *apic_reg(APIC_REG_TIMER_CURRENT);
+        *apic_reg(APIC_REG_TIMER_INIT) = 0;
+    }
+    
+    *apic_reg(APIC_REG_LVT_TIMER) = vector;  // One-shot
+}
+
+// Fire the timer interrupt at TSC value deadline; 0 disarms
+void continuum_timer_arm(uint64_t deadline) {
+    if (g_timer_tsc_deadline) {
+        write_msr(IA32_TSC_DEADLINE_MSR, deadline);
+        return;
+    }
+    
+    if (!deadline) {
+        *apic_reg(APIC_REG_TIMER_INIT) = 0;
+        return;
+    }
+    
+    // An early interrupt is harmless: the handler re-arms for what's left
+    uint64_t now = continuum_get_time();
+    uint64_t delta = deadline > now ? deadline - now : 1;
+    uint64_t count = g_kernel_state.tsc_khz ?
+                     delta * g_apic_timer_khz / g_kernel_state.tsc_khz : delta;
+    if (count == 0) count = 1;
+    if (count > 0xFFFFFFFFULL) count = 0xFFFFFFFFULL;
+    *apic_reg(APIC_REG_TIMER_INIT) = (uint32_t)count;
+}
+
+// =============================================================================
+// I/O APIC
+// =============================================================================
+
+#define IOAPIC_BASE             0xFEC00000ULL   // Default; no MADT parsing yet
+#define IOAPIC_REG_SELECT       0x00
+#define IOAPIC_REG_WINDOW       0x10
+#define IOAPIC_REG_VERSION      0x01
+#define IOAPIC_REG_REDIRECT     0x10
+#define IOAPIC_MAX_PINS         240
+#define IOAPIC_RTE_LEVEL        (1U << 15)
+#define IOAPIC_RTE_ACTIVE_LOW   (1U << 13)
+#define IOAPIC_RTE_MASKED       (1U << 16)
+
+static spinlock_t g_ioapic_lock = SPINLOCK_INIT;
+static uint32_t g_ioapic_pins = 0;
+
+static uint32_t ioapic_read(uint32_t reg) {
+    volatile uint32_t* ioapic = (volatile uint32_t*)IOAPIC_BASE;
+    ioapic[IOAPIC_REG_SELECT / 4] = reg;
+    return ioapic[IOAPIC_REG_WINDOW / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value) {
+    volatile uint32_t* ioapic = (volatile uint32_t*)IOAPIC_BASE;
+    ioapic[IOAPIC_REG_SELECT / 4] = reg;
+    ioapic[IOAPIC_REG_WINDOW / 4] = value;
+}
+
+// Mask every pin and the legacy 8259 pair, which stays out of the picture
+static void ioapic_init(void) {
+    port_outb(0x21, 0xFF);
+    port_outb(0xA1, 0xFF);
+    
+    g_ioapic_pins = ((ioapic_read(IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+    if (g_ioapic_pins > IOAPIC_MAX_PINS) {
+        g_ioapic_pins = IOAPIC_MAX_PINS;
+    }
     
-    // Set up IDT (Interrupt Descriptor Table)
-    // This is simplified - real implementation would be more complex
-    static idt_entry_t idt[256];
-    static idt_ptr_t idt_ptr;
+    for (uint32_t pin = 0; pin < g_ioapic_pins; pin++) {
+        ioapic_write(IOAPIC_REG_REDIRECT + pin * 2, IOAPIC_RTE_MASKED);
+        ioapic_write(IOAPIC_REG_REDIRECT + pin * 2 + 1, 0);
+    }
+}
+
+static void ioapic_steer(uint8_t vector, uint32_t cpu, void* source) {
+    (void)vector;
+    uint32_t gsi = (uint32_t)(uint64_t)source;
+    
+    spinlock_acquire(&g_ioapic_lock);
+    ioapic_write(IOAPIC_REG_REDIRECT + gsi * 2 + 1, continuum_cpu_apic_id(cpu) << 24);
+    spinlock_release(&g_ioapic_lock);
+}
+
+// Route gsi to vector on cpu (fixed delivery, physical destination) and
+// unmask it. IOAPIC_FLAG_* select trigger mode and polarity.
+int continuum_ioapic_route(uint32_t gsi, uint8_t vector, uint32_t cpu, uint32_t flags) {
+    if (gsi >= g_ioapic_pins || cpu >= g_num_cores || vector < INTERRUPT_EXCEPTIONS) {
+        return -EINVAL;
+    }
     
-    // Clear IDT
-    for (int i = 0; i < 256; i++) {
-        idt[i].offset_low = 0;
-        idt[i].selector = 0;
-        idt[i].ist = 0;
-        idt[i].type_attr = 0;
-        idt[i].offset_mid = 0;
-        idt[i].offset_high = 0;
-        idt[i].zero = 0;
+    uint32_t low = vector;
+    if (flags & IOAPIC_FLAG_LEVEL) {
+        low |= IOAPIC_RTE_LEVEL;
+    }
+    if (flags & IOAPIC_FLAG_ACTIVE_LOW) {
+        low |= IOAPIC_RTE_ACTIVE_LOW;
     }
     
-    // Install handlers (simplified)
-    // In reality, each would point to actual handler functions
+    uint64_t irq = cpu_irq_save();
+    spinlock_acquire(&g_ioapic_lock);
     
-    idt_ptr.limit = sizeof(idt) - 1;
-    idt_ptr.base = (uint64_t)&idt;
+    // Destination first so the pin never fires at a stale CPU
+    ioapic_write(IOAPIC_REG_REDIRECT + gsi * 2, IOAPIC_RTE_MASKED);
+    ioapic_write(IOAPIC_REG_REDIRECT + gsi * 2 + 1, continuum_cpu_apic_id(cpu) << 24);
+    ioapic_write(IOAPIC_REG_REDIRECT + gsi * 2, low);
     
-    __asm__ __volatile__("lidt %0" : : "m"(idt_ptr));
+    spinlock_release(&g_ioapic_lock);
+    cpu_irq_restore(irq);
+    
+    continuum_set_interrupt_source(vector, ioapic_steer, (void*)(uint64_t)gsi);
+    return 0;
+}
+
+void continuum_ioapic_mask(uint32_t gsi) {
+    if (gsi >= g_ioapic_pins) {
+        return;
+    }
+    
+    uint64_t irq = cpu_irq_save();
+    spinlock_acquire(&g_ioapic_lock);
+    ioapic_write(IOAPIC_REG_REDIRECT + gsi * 2,
+                 ioapic_read(IOAPIC_REG_REDIRECT + gsi * 2) | IOAPIC_RTE_MASKED);
+    spinlock_release(&g_ioapic_lock);
+    cpu_irq_restore(irq);
+}
+
+// =============================================================================
+// Interrupt Setup
+// =============================================================================
+
+static void timer_interrupt(interrupt_frame_t* frame, void* context) {
+    (void)frame;
+    (void)context;
+    temporal_timer_interrupt();
+}
+
+static void resched_interrupt(interrupt_frame_t* frame, void* context) {
+    (void)frame;
+    (void)context;
+    continuum_apic_eoi();   // Before the switch, which may not come back soon
+    temporal_schedule();
+}
+
+static void tlb_shootdown_interrupt(interrupt_frame_t* frame, void* context) {
+    (void)frame;
+    (void)context;
+    flux_tlb_shootdown_ipi();
+}
+
+static void fpu_unavailable_exception(interrupt_frame_t* frame, void* context) {
+    (void)frame;
+    (void)context;
+    temporal_fpu_fault();
+}
+
+static void page_fault_exception(interrupt_frame_t* frame, void* context) {
+    (void)context;
+    uint64_t fault_addr;
+    __asm__ __volatile__("movq %%cr2, %0" : "=r"(fault_addr));
+    
+    // The gate entered with interrupts off, but resolving the fault can
+    // wait on a domain lock whose holder is waiting in turn for this CPU
+    // to answer a TLB shootdown. Take interrupts again if the faulting
+    // code had them, now that CR2 is read.
+    bool interrupts = (frame->rflags & RFLAGS_IF) != 0;
+    if (interrupts) {
+        __asm__ __volatile__("sti");
+    }
+    
+    int result = flux_handle_page_fault(flux_get_current_domain(), fault_addr,
+                                        frame->error_code);
+    
+    if (interrupts) {
+        __asm__ __volatile__("cli");
+    }
+    if (result != 0) {
+        continuum_panic("Unresolved page fault");
+    }
+}
+
+static void init_interrupts(void) {
+    early_print("Initializing interrupt handlers...\n");
+    
+    // Disable interrupts during setup
+    __asm__ __volatile__("cli");
+    
+    idt_load();
+    continuum_lapic_init();
+    ioapic_init();
+    
+    // System vectors acknowledge themselves
+    continuum_register_interrupt(TEMPORAL_FPU_VECTOR, fpu_unavailable_exception, NULL, false);
+    continuum_register_interrupt(14, page_fault_exception, NULL, false);
+    continuum_register_interrupt(TEMPORAL_TIMER_VECTOR, timer_interrupt, NULL, false);
+    continuum_register_interrupt(TEMPORAL_RESCHED_VECTOR, resched_interrupt, NULL, false);
+    continuum_register_interrupt(FLUX_TLB_SHOOTDOWN_VECTOR, tlb_shootdown_interrupt, NULL, false);
     
     // Enable interrupts
     __asm__ __volatile__("sti");
@@ -182,6 +764,12 @@ quantum_id_t continuum_create_quantum(abi_mode_t abi_mode, void* entry_point,
     quantum->scheduling.priority = PRIORITY_NORMAL;
     quantum->scheduling.time_slice = DEFAULT_TIME_SLICE;
     quantum->scheduling.cpu_affinity = CPU_AFFINITY_ANY;
+    quantum->scheduling.cpu_mask = 0;
+    quantum->scheduling.last_cpu = temporal_get_current_cpu();
+    quantum->scheduling.rq_cpu = -1;
+    quantum->scheduling.wake_pending = false;
+    quantum->next_ready = NULL;
+    quantum->prev_ready = NULL;
     
     // Initialize statistics
     quantum->stats.creation_time = continuum_get_time();
@@ -191,6 +779,12 @@ quantum_id_t continuum_create_quantum(abi_mode_t abi_mode, void* entry_point,
     
     // Initialize capability set
     quantum->capabilities = capability_create_default();
+    quantum->request_mask = 0;
+    quantum->request_mask_gen = 0;
+    quantum->submit_ring = NULL;
+    
+    // Vector state area; loaded only once the quantum uses it
+    quantum->fpu_state = temporal_fpu_alloc();
     
     // Add to registry
     g_quantum_registry.quanta[g_quantum_registry.count++] = quantum;
@@ -213,7 +807,10 @@ int continuum_terminate_quantum(quantum_id_t qid) {
     // Mark as terminating
     quantum->state = QUANTUM_STATE_TERMINATED;
     
-    // Clean up resources
+    // Clean up resources; the shared ring half goes with the domain
+    flux_free(quantum->submit_ring);
+    flux_free(quantum->capabilities);
+    temporal_fpu_release(quantum);
     if (quantum->memory_domain) {
         flux_destroy_domain(quantum->memory_domain);
     }
@@ -245,10 +842,294 @@ quantum_context_t* continuum_get_quantum(quantum_id_t qid) {
     return NULL;
 }
 
+// =============================================================================
+// Capability Management
+// =============================================================================
+
+// Capability each native request needs; slot 0 stands for ABI-private IDs
+static const uint8_t g_request_caps[SYSREQ_COUNT] = {
+    [0]                         = CAPABILITY_ABI,
+    [SYSREQ_MEMORY_ALLOCATE]    = CAPABILITY_MEMORY,
+    [SYSREQ_MEMORY_FREE]        = CAPABILITY_MEMORY,
+    [SYSREQ_MEMORY_MAP]         = CAPABILITY_MEMORY,
+    [SYSREQ_MEMORY_PROTECT]     = CAPABILITY_MEMORY,
+    [SYSREQ_CONDUIT_CREATE]     = CAPABILITY_CONDUIT,
+    [SYSREQ_CONDUIT_SEND]       = CAPABILITY_CONDUIT,
+    [SYSREQ_CONDUIT_RECEIVE]    = CAPABILITY_CONDUIT,
+    [SYSREQ_QUANTUM_SPAWN]      = CAPABILITY_QUANTUM,
+    [SYSREQ_QUANTUM_TERMINATE]  = CAPABILITY_QUANTUM,
+    [SYSREQ_QUANTUM_YIELD]      = CAPABILITY_NONE,
+    [SYSREQ_QUANTUM_SLEEP]      = CAPABILITY_NONE,
+    [SYSREQ_TIME_GET]           = CAPABILITY_NONE,
+    [SYSREQ_CAPABILITY_REQUEST] = CAPABILITY_CAPABILITY,
+    [SYSREQ_CAPABILITY_DROP]    = CAPABILITY_NONE,
+    [SYSREQ_RING_SETUP]         = CAPABILITY_NONE,
+    [SYSREQ_RING_ENTER]         = CAPABILITY_NONE,  // Entries are checked one by one
+};
+
+_Static_assert(SYSREQ_COUNT <= 64, "request_mask holds one bit per request ID");
+_Static_assert(CAPABILITY_COUNT <= MAX_CAPABILITIES, "capability bitmap too small");
+
+// Per-CPU so the request path never bounces a shared line
+typedef struct {
+    request_check_stats_t requests[SYSREQ_COUNT];
+} __attribute__((aligned(64))) request_counters_t;
+
+static request_counters_t g_request_counters[MAX_CPU_CORES];
+
+capability_set_t* capability_create_default(void) {
+    capability_set_t* caps = flux_allocate(NULL, sizeof(capability_set_t),
+                                           FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!caps) {
+        return NULL;
+    }
+    
+    caps->generation = 1;  // Quanta start at 0, so the first check compiles
+    capability_grant(caps, CAPABILITY_MEMORY);
+    capability_grant(caps, CAPABILITY_CONDUIT);
+    capability_grant(caps, CAPABILITY_QUANTUM);
+    capability_grant(caps, CAPABILITY_ABI);
+    return caps;
+}
+
+bool capability_check(capability_set_t* caps, uint64_t capability) {
+    if (capability == CAPABILITY_NONE) {
+        return true;
+    }
+    if (!caps || capability >= MAX_CAPABILITIES) {
+        return false;
+    }
+    return (caps->bitmap[capability / 64] >> (capability % 64)) & 1;
+}
+
+void capability_grant(capability_set_t* caps, uint64_t capability) {
+    if (!caps || capability == CAPABILITY_NONE || capability >= MAX_CAPABILITIES) {
+        return;
+    }
+    
+    uint64_t bit = 1ULL << (capability % 64);
+    if (!(caps->bitmap[capability / 64] & bit)) {
+        caps->bitmap[capability / 64] |= bit;
+        caps->count++;
+    }
+    __atomic_add_fetch(&caps->generation, 1, __ATOMIC_RELEASE);
+}
+
+void capability_revoke(capability_set_t* caps, uint64_t capability) {
+    if (!caps || capability == CAPABILITY_NONE || capability >= MAX_CAPABILITIES) {
+        return;
+    }
+    
+    uint64_t bit = 1ULL << (capability % 64);
+    if (caps->bitmap[capability / 64] & bit) {
+        caps->bitmap[capability / 64] &= ~bit;
+        caps->count--;
+    }
+    __atomic_add_fetch(&caps->generation, 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t compile_request_mask(capability_set_t* caps) {
+    uint64_t mask = 0;
+    
+    for (uint32_t id = 0; id < SYSREQ_COUNT; id++) {
+        if (capability_check(caps, g_request_caps[id])) {
+            mask |= 1ULL << id;
+        }
+    }
+    return mask;
+}
+
+// Single bit test against the quantum's compiled mask, recompiled only
+// after a grant or revoke on its capability set
+bool continuum_request_allowed(quantum_context_t* quantum, uint64_t request_id) {
+    capability_set_t* caps = quantum->capabilities;
+    uint32_t index = request_id < SYSREQ_COUNT ? (uint32_t)request_id : 0;
+    
+    uint32_t generation = caps ? __atomic_load_n(&caps->generation, __ATOMIC_ACQUIRE) : 0;
+    if (!caps || quantum->request_mask_gen != generation) {
+        quantum->request_mask = compile_request_mask(caps);
+        quantum->request_mask_gen = generation;
+    }
+    
+    bool allowed = (quantum->request_mask >> index) & 1;
+    
+    request_check_stats_t* counter =
+        &g_request_counters[temporal_get_current_cpu()].requests[index];
+    __atomic_fetch_add(allowed ? &counter->allowed : &counter->denied, 1, __ATOMIC_RELAXED);
+    return allowed;
+}
+
+// Sum the per-CPU counters for request IDs below count
+void continuum_get_request_stats(request_check_stats_t* stats, size_t count) {
+    if (!stats) {
+        return;
+    }
+    if (count > SYSREQ_COUNT) {
+        count = SYSREQ_COUNT;
+    }
+    
+    for (size_t id = 0; id < count; id++) {
+        stats[id].allowed = 0;
+        stats[id].denied = 0;
+        for (uint32_t cpu = 0; cpu < MAX_CPU_CORES; cpu++) {
+            stats[id].allowed += __atomic_load_n(&g_request_counters[cpu].requests[id].allowed,
+                                                 __ATOMIC_RELAXED);
+            stats[id].denied += __atomic_load_n(&g_request_counters[cpu].requests[id].denied,
+                                                __ATOMIC_RELAXED);
+        }
+    }
+}
+
 // =============================================================================
 // System Request Handling
 // =============================================================================
 
+typedef int64_t (*abi_handler_t)(quantum_context_t* quantum, system_request_t* request);
+
+// Indexed by abi_mode_t
+static const abi_handler_t g_abi_handlers[] = {
+    [ABI_MODE_NATIVE] = handle_native_request,
+    [ABI_MODE_AXON]   = handle_axon_request,    // Windows ABI
+    [ABI_MODE_VORTEX] = handle_vortex_request,  // Linux ABI
+    [ABI_MODE_CIPHER] = handle_cipher_request   // macOS ABI
+};
+
+static abi_handler_t abi_handler_for(quantum_context_t* quantum) {
+    if ((uint32_t)quantum->abi_mode >= sizeof(g_abi_handlers) / sizeof(g_abi_handlers[0])) {
+        return NULL;
+    }
+    return g_abi_handlers[quantum->abi_mode];
+}
+
+// Kernel-private view of a quantum's submission ring. Masks, array bases
+// and our own cursors live here so nothing the quantum can scribble on
+// steers kernel writes.
+typedef struct submit_ring_ctx {
+    submit_ring_t* shared;
+    submit_entry_t* sqes;
+    completion_entry_t* cqes;
+    uint32_t entries;
+    uint32_t sq_head;
+    uint32_t cq_tail;
+} submit_ring_ctx_t;
+
+static int64_t dispatch_request(quantum_context_t* quantum, abi_handler_t handler,
+                                system_request_t* request, bool from_ring);
+
+static int64_t ring_setup(quantum_context_t* quantum, uint64_t entries) {
+    if (quantum->submit_ring) {
+        return -EBUSY;
+    }
+    if (entries == 0 || entries > SUBMIT_RING_MAX_ENTRIES) {
+        return -EINVAL;
+    }
+    
+    uint32_t count = 1;
+    while (count < entries) {
+        count <<= 1;
+    }
+    
+    submit_ring_ctx_t* ctx = flux_allocate(NULL, sizeof(submit_ring_ctx_t),
+                                           FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!ctx) {
+        return -ENOMEM;
+    }
+    
+    // Lives in the quantum's domain and goes with it
+    size_t size = sizeof(submit_ring_t) + count * sizeof(submit_entry_t) +
+                  2 * count * sizeof(completion_entry_t);
+    submit_ring_t* ring = flux_allocate(quantum->memory_domain, size,
+                                        FLUX_ALLOC_USER | FLUX_ALLOC_WRITE |
+                                        FLUX_ALLOC_ZERO | FLUX_ALLOC_LARGE);
+    if (!ring) {
+        flux_free(ctx);
+        return -ENOMEM;
+    }
+    
+    ring->entries = count;
+    ring->sq_mask = count - 1;
+    ring->cq_mask = 2 * count - 1;
+    ring->sqes = (submit_entry_t*)(ring + 1);
+    ring->cqes = (completion_entry_t*)(ring->sqes + count);
+    
+    ctx->shared = ring;
+    ctx->sqes = ring->sqes;
+    ctx->cqes = ring->cqes;
+    ctx->entries = count;
+    quantum->submit_ring = ctx;
+    return (int64_t)ring;
+}
+
+// Run up to to_submit pending entries with one trap. Stops early when the
+// completion queue is full; whatever is left stays queued for the next
+// enter. Returns the number of entries consumed.
+static int64_t ring_enter(quantum_context_t* quantum, uint64_t to_submit) {
+    submit_ring_ctx_t* ctx = quantum->submit_ring;
+    if (!ctx) {
+        return -EINVAL;
+    }
+    
+    submit_ring_t* ring = ctx->shared;
+    uint32_t sq_mask = ctx->entries - 1;
+    uint32_t cq_mask = 2 * ctx->entries - 1;
+    
+    uint32_t pending = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE) - ctx->sq_head;
+    if (pending > ctx->entries) {
+        return -EINVAL;  // Tail moved past entries never handed back
+    }
+    if (to_submit < pending) {
+        pending = (uint32_t)to_submit;
+    }
+    
+    abi_handler_t handler = abi_handler_for(quantum);
+    uint32_t done = 0;
+    uint64_t calls = 0;
+    
+    while (done < pending) {
+        uint32_t cq_head = __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE);
+        if (ctx->cq_tail - cq_head > cq_mask) {
+            ring->cq_overflow++;
+            break;
+        }
+        
+        // Copy out first: the quantum may rewrite the slot while it runs
+        submit_entry_t entry = ctx->sqes[ctx->sq_head & sq_mask];
+        int64_t result = -EPERM;
+        if (continuum_request_allowed(quantum, entry.request.request_id)) {
+            result = dispatch_request(quantum, handler, &entry.request, true);
+            calls++;
+        }
+        
+        completion_entry_t* cqe = &ctx->cqes[ctx->cq_tail & cq_mask];
+        cqe->user_data = entry.user_data;
+        cqe->result = result;
+        
+        ctx->sq_head++;
+        ctx->cq_tail++;
+        done++;
+        __atomic_store_n(&ring->cq_tail, ctx->cq_tail, __ATOMIC_RELEASE);
+    }
+    
+    __atomic_store_n(&ring->sq_head, ctx->sq_head, __ATOMIC_RELEASE);
+    quantum->stats.system_calls += calls;
+    return done;
+}
+
+// Route a request that has passed its capability check
+static int64_t dispatch_request(quantum_context_t* quantum, abi_handler_t handler,
+                                system_request_t* request, bool from_ring) {
+    switch (request->request_id) {
+        case SYSREQ_RING_SETUP:
+            return from_ring ? -EINVAL : ring_setup(quantum, request->params[0]);
+            
+        case SYSREQ_RING_ENTER:
+            return from_ring ? -EINVAL : ring_enter(quantum, request->params[0]);
+            
+        default:
+            return handler ? handler(quantum, request) : -ENOSYS;
+    }
+}
+
 int64_t continuum_handle_request(quantum_context_t* quantum, 
                                  system_request_t* request) {
     if (!quantum || !request) {
@@ -256,7 +1137,7 @@ int64_t continuum_handle_request(quantum_context_t* quantum,
     }
     
     // Check capabilities
-    if (!capability_check(quantum->capabilities, request->request_id)) {
+    if (!continuum_request_allowed(quantum, request->request_id)) {
         return -EPERM;
     }
     
@@ -264,22 +1145,31 @@ int64_t continuum_handle_request(quantum_context_t* quantum,
     quantum->stats.system_calls++;
     
     // Route based on ABI mode
-    switch (quantum->abi_mode) {
-        case ABI_MODE_NATIVE:
-            return handle_native_request(quantum, request);
-            
-        case ABI_MODE_AXON:  // Windows ABI
-            return handle_axon_request(quantum, request);
-            
-        case ABI_MODE_VORTEX:  // Linux ABI
-            return handle_vortex_request(quantum, request);
-            
-        case ABI_MODE_CIPHER:  // macOS ABI
-            return handle_cipher_request(quantum, request);
-            
-        default:
-            return -ENOSYS;
+    return dispatch_request(quantum, abi_handler_for(quantum), request, false);
+}
+
+// Vectored form for in-kernel callers: one handler lookup and one stats
+// update for the whole array. Returns the number of results written.
+size_t continuum_handle_batch(quantum_context_t* quantum, system_request_t* requests,
+                              int64_t* results, size_t count) {
+    if (!quantum || !requests || !results) {
+        return 0;
+    }
+    
+    abi_handler_t handler = abi_handler_for(quantum);
+    uint64_t calls = 0;
+    
+    for (size_t i = 0; i < count; i++) {
+        if (!continuum_request_allowed(quantum, requests[i].request_id)) {
+            results[i] = -EPERM;
+            continue;
+        }
+        results[i] = dispatch_request(quantum, handler, &requests[i], false);
+        calls++;
     }
+    
+    quantum->stats.system_calls += calls;
+    return count;
 }
 
 // Native request handler
@@ -311,6 +1201,14 @@ int64_t handle_native_request(quantum_context_t* quantum,
                 request->params[3]                // flags
             );
             
+        case SYSREQ_CONDUIT_RECEIVE:
+            return conduit_receive(
+                (conduit_t*)request->params[0],   // conduit
+                (void*)request->params[1],        // buffer
+                request->params[2],               // max_size
+                request->params[3]                // flags
+            );
+            
         case SYSREQ_QUANTUM_SPAWN:
             return continuum_create_quantum(
                 request->params[0],                // abi_mode
@@ -322,11 +1220,30 @@ int64_t handle_native_request(quantum_context_t* quantum,
             temporal_yield(quantum);
             return 0;
             
+        case SYSREQ_TIME_GET:
+            return (int64_t)continuum_get_time();
+            
         default:
             return -ENOSYS;
     }
 }
 
+// =============================================================================
+// Statistics Counters
+// =============================================================================
+
+uint64_t continuum_counter_read(continuum_counter_t counter) {
+    if (counter >= COUNTER_COUNT) {
+        return 0;
+    }
+    
+    uint64_t total = 0;
+    for (uint32_t cpu = 0; cpu < g_num_cores; cpu++) {
+        total += __atomic_load_n(&g_percpu_counters[cpu].value[counter], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
 // =============================================================================
 // Time Management
 // =============================================================================
@@ -342,6 +1259,191 @@ uint64_t continuum_get_uptime(void) {
     return continuum_get_time() - g_kernel_state.boot_time;
 }
 
+#define PIT_HZ                  1193182
+#define PIT_CALIBRATE_MS        10
+
+// Count TSC cycles across a PIT channel 2 one-shot of PIT_CALIBRATE_MS
+static void calibrate_tsc(void) {
+    uint16_t count = PIT_HZ * PIT_CALIBRATE_MS / 1000;
+    
+    // Gate channel 2 on, speaker off
+    port_outb(0x61, (port_inb(0x61) & ~0x02) | 0x01);
+    port_outb(0x43, 0xB0);  // Channel 2, lobyte/hibyte, mode 0
+    port_outb(0x42, count & 0xFF);
+    port_outb(0x42, count >> 8);
+    
+    uint64_t start = continuum_get_time();
+    while (!(port_inb(0x61) & 0x20)) {  // OUT2 goes high at terminal count
+        __asm__ __volatile__("pause");
+    }
+    uint64_t cycles = continuum_get_time() - start;
+    
+    g_kernel_state.tsc_khz = cycles / PIT_CALIBRATE_MS;
+    if (!g_kernel_state.tsc_khz) {
+        g_kernel_state.tsc_khz = 1000000;  // Assume 1GHz rather than divide by zero
+    }
+}
+
+uint64_t continuum_get_tsc_khz(void) {
+    return g_kernel_state.tsc_khz;
+}
+
+uint64_t continuum_usec_to_tsc(uint64_t usec) {
+    return usec * g_kernel_state.tsc_khz / 1000;
+}
+
+// A Genesis older than the stamps handed over a context without them
+static bool boot_stages_present(void) {
+    return g_boot_context && g_boot_context->version >= GENESIS_VERSION_BOOT_STAGES &&
+           g_boot_context->size >= sizeof(genesis_boot_context_t);
+}
+
+static void boot_stage(uint32_t stage) {
+    if (boot_stages_present() && stage < BOOT_STAGE_COUNT) {
+        g_boot_context->boot_stages[stage] = continuum_get_time();
+    }
+}
+
+uint64_t continuum_get_boot_stage(uint32_t stage) {
+    if (!boot_stages_present() || stage >= BOOT_STAGE_COUNT) {
+        return 0;
+    }
+    return g_boot_context->boot_stages[stage];
+}
+
+// =============================================================================
+// Deferred Initialization
+// =============================================================================
+
+#define DEFERRED_WORKERS        4       // Quanta running steps, one per CPU up to this many
+#define DEFERRED_IDLE           1000    // A worker's sleep waiting on a step (microseconds)
+
+#define DEFERRED_PENDING        0
+#define DEFERRED_RUNNING        1
+#define DEFERRED_DONE           2
+
+// Linked in only when the image carries them
+int harmony_init(void) __attribute__((weak));
+int prism_init(void) __attribute__((weak));
+
+static int deferred_devices(void) {
+    resonance_init();
+    return 0;
+}
+
+// What nothing before the scheduler needs. A step starts once the one
+// it's after is done: the network stack and the compositor wait for the
+// drivers their devices come from, then run side by side.
+static struct {
+    const char* name;
+    int (*init)(void);
+    int32_t after;                  // Step index, or -1
+    uint32_t state;
+    uint64_t cycles;
+} g_deferred[] = {
+    { "devices", deferred_devices, -1, DEFERRED_PENDING, 0 },
+    { "harmony", harmony_init, 0, DEFERRED_PENDING, 0 },
+    { "prism", prism_init, 0, DEFERRED_PENDING, 0 }
+};
+
+#define DEFERRED_STEPS          (sizeof(g_deferred) / sizeof(g_deferred[0]))
+
+static uint32_t g_deferred_left = DEFERRED_STEPS;
+
+// A step whose dependency is done, taken; -1 if none can run yet
+static int32_t deferred_take(void) {
+    for (uint32_t i = 0; i < DEFERRED_STEPS; i++) {
+        int32_t after = g_deferred[i].after;
+        if (after >= 0 &&
+            __atomic_load_n(&g_deferred[after].state, __ATOMIC_ACQUIRE) != DEFERRED_DONE) {
+            continue;
+        }
+        
+        uint32_t expected = DEFERRED_PENDING;
+        if (__atomic_compare_exchange_n(&g_deferred[i].state, &expected, DEFERRED_RUNNING,
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Run one step here; false if none could run
+static bool deferred_run_one(void) {
+    int32_t step = deferred_take();
+    if (step < 0) {
+        return false;
+    }
+    
+    uint64_t start = continuum_get_time();
+    if (g_deferred[step].init && g_deferred[step].init() != 0) {
+        early_print("Deferred init failed: ");
+        early_print(g_deferred[step].name);
+        early_print("\n");
+    }
+    g_deferred[step].cycles = continuum_get_time() - start;
+    __atomic_store_n(&g_deferred[step].state, DEFERRED_DONE, __ATOMIC_RELEASE);
+    
+    if (__atomic_sub_fetch(&g_deferred_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        boot_stage(BOOT_STAGE_DEFERRED_DONE);
+    }
+    return true;
+}
+
+static void deferred_worker_main(void) {
+    while (__atomic_load_n(&g_deferred_left, __ATOMIC_ACQUIRE) > 0) {
+        if (!deferred_run_one()) {
+            temporal_sleep(DEFERRED_IDLE);
+        }
+    }
+    
+    // Nothing wakes a finished worker
+    while (1) {
+        temporal_block(temporal_get_current(), BLOCK_WAIT);
+    }
+}
+
+// Queued before the scheduler starts, so they run as it does
+static void deferred_start_workers(void) {
+    uint32_t workers = g_num_cores < DEFERRED_WORKERS ? g_num_cores : DEFERRED_WORKERS;
+    if (workers > DEFERRED_STEPS) {
+        workers = DEFERRED_STEPS;
+    }
+    
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < workers; i++) {
+        quantum_id_t qid = continuum_create_quantum(ABI_MODE_NATIVE, (void*)deferred_worker_main,
+                                                    "kinit");
+        quantum_context_t* quantum = continuum_get_quantum(qid);
+        if (!quantum) {
+            break;
+        }
+        temporal_enqueue(quantum);
+        started++;
+    }
+    
+    // Without a worker, the steps run here before anything else does
+    if (started == 0) {
+        while (deferred_run_one()) {
+        }
+    }
+}
+
+void continuum_wait_deferred_init(void) {
+    while (__atomic_load_n(&g_deferred_left, __ATOMIC_ACQUIRE) > 0) {
+        if (deferred_run_one()) {
+            continue;
+        }
+        
+        quantum_context_t* current = temporal_get_current();
+        if (current) {
+            temporal_yield(current);
+        } else {
+            __asm__ __volatile__("pause");
+        }
+    }
+}
+
 // =============================================================================
 // Main Kernel Entry
 // =============================================================================
@@ -350,6 +1452,7 @@ void continuum_main(genesis_boot_context_t* boot_context) {
     // Save boot context
     g_boot_context = boot_context;
     g_kernel_state.boot_time = continuum_get_time();
+    calibrate_tsc();
     
     // Clear screen
     for (int i = 0; i < 80 * 25; i++) {
@@ -364,6 +1467,7 @@ void continuum_main(genesis_boot_context_t* boot_context) {
     if (boot_context->magic != 0x4C314D31544C4535ULL) {
         continuum_panic("Invalid boot context magic!");
     }
+    g_cpu_features = verify_cpu_features(boot_context->cpu.features);
     
     early_print("Boot mode: ");
     early_print_hex(boot_context->boot_mode);
@@ -379,9 +1483,15 @@ void continuum_main(genesis_boot_context_t* boot_context) {
     // Initialize CPU cores
     init_cpu_cores();
     
+    // Enable FPU/SIMD state, then pick memcpy/memset before anything
+    // bulk-copies
+    temporal_fpu_init();
+    flux_memops_init(g_cpu_features);
+    
     // Initialize memory manager
     early_print("Initializing Flux memory manager...\n");
     flux_init(&boot_context->memory_map);
+    flux_tlb_init(g_cpu_features);
     
     // Initialize scheduler
     early_print("Initializing Temporal scheduler...\n");
@@ -391,8 +1501,20 @@ void continuum_main(genesis_boot_context_t* boot_context) {
     early_print("Initializing Conduit IPC system...\n");
     conduit_init();
     
+    // Trace rings; every tracepoint stays off until trace_enable()
+    trace_init();
+    
     // Initialize interrupts
     init_interrupts();
+    continuum_timer_init(g_cpu_features, TEMPORAL_TIMER_VECTOR);
+    
+    // Start the background page compactor
+    flux_compactor_start();
+    boot_stage(BOOT_STAGE_KERNEL_CORE);
+    
+    // Devices, network and compositor come up on workers once the
+    // scheduler runs, rather than hold it up
+    deferred_start_workers();
     
     // Create init quantum
     early_print("\nCreating init quantum...\n");
@@ -413,6 +1535,7 @@ void continuum_main(genesis_boot_context_t* boot_context) {
     early_print("Entering scheduler loop...\n\n");
     
     // Enter scheduler - never returns
+    boot_stage(BOOT_STAGE_SCHEDULER);
     temporal_start();
     
     // Should never reach here
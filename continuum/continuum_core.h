@@ -27,6 +27,54 @@
 #define EPERM                  1
 #define ENOSYS                 38
 #define ENOMEM                 12
+#define EFAULT                 14
+#define ENOSPC                 28
+#define EBUSY                  16
+
+// CPU feature bits (mirror Genesis cpu_info_t.features)
+#define CPU_FEATURE_SSE        (1ULL << 0)
+#define CPU_FEATURE_SSE2       (1ULL << 1)
+#define CPU_FEATURE_SSE3       (1ULL << 2)
+#define CPU_FEATURE_SSSE3      (1ULL << 3)
+#define CPU_FEATURE_SSE41      (1ULL << 4)
+#define CPU_FEATURE_SSE42      (1ULL << 5)
+#define CPU_FEATURE_AVX        (1ULL << 6)
+#define CPU_FEATURE_AVX2       (1ULL << 7)
+#define CPU_FEATURE_AVX512     (1ULL << 8)
+#define CPU_FEATURE_ERMS       (1ULL << 9)
+#define CPU_FEATURE_FSRM       (1ULL << 10)
+#define CPU_FEATURE_OSXSAVE    (1ULL << 11)
+#define CPU_FEATURE_PCID       (1ULL << 12)
+#define CPU_FEATURE_INVPCID    (1ULL << 13)
+#define CPU_FEATURE_TSC_DEADLINE (1ULL << 14)
+#define CPU_FEATURE_PDPE1GB    (1ULL << 15)
+
+// Boot stages timestamped in genesis_boot_context_t.boot_stages (mirror
+// Genesis BOOT_STAGE_*); the kernel stamps its own from KERNEL_CORE on
+#define BOOT_STAGE_GENESIS_ENTRY    0
+#define BOOT_STAGE_CPU_DETECTED     1
+#define BOOT_STAGE_MEMORY_MAP       2
+#define BOOT_STAGE_ACPI             3
+#define BOOT_STAGE_KERNEL_LOADED    4
+#define BOOT_STAGE_PAGE_TABLES      5
+#define BOOT_STAGE_KERNEL_ENTRY     6
+#define BOOT_STAGE_KERNEL_CORE      7   // Memory, scheduler and interrupts up
+#define BOOT_STAGE_SCHEDULER        8   // Scheduler started
+#define BOOT_STAGE_DEFERRED_DONE    9   // Deferred subsystems initialized
+#define BOOT_STAGE_COUNT            16
+
+// Interrupt vectors; fixed system vectors live above the device range
+// (TEMPORAL_TIMER_VECTOR 0xEF, TEMPORAL_RESCHED_VECTOR 0xFC,
+// FLUX_TLB_SHOOTDOWN_VECTOR 0xFD)
+#define INTERRUPT_VECTORS       256
+#define INTERRUPT_EXCEPTIONS    32
+#define INTERRUPT_DEVICE_FIRST  0x30
+#define INTERRUPT_DEVICE_LAST   0xEE
+#define INTERRUPT_SPURIOUS      0xFF
+
+// I/O APIC redirection flags
+#define IOAPIC_FLAG_LEVEL       (1U << 0)   // Level triggered (PCI INTx)
+#define IOAPIC_FLAG_ACTIVE_LOW  (1U << 1)
 
 // =============================================================================
 // Type Definitions
@@ -116,15 +164,65 @@ enum {
     SYSREQ_QUANTUM_SLEEP,
     SYSREQ_TIME_GET,
     SYSREQ_CAPABILITY_REQUEST,
-    SYSREQ_CAPABILITY_DROP
+    SYSREQ_CAPABILITY_DROP,
+    SYSREQ_RING_SETUP,          // params[0] = entries; returns submit_ring_t*
+    SYSREQ_RING_ENTER,          // params[0] = entries to consume; returns count
+    SYSREQ_COUNT                // IDs from here on are ABI-private
+};
+
+// Submission/completion ring shared between a quantum and the kernel. The
+// quantum fills sqes[sq_tail & sq_mask] and advances sq_tail; one
+// SYSREQ_RING_ENTER runs every pending entry and posts a completion to
+// cqes[cq_tail & cq_mask], which the quantum reaps by advancing cq_head.
+#define SUBMIT_RING_MAX_ENTRIES 4096
+
+typedef struct {
+    system_request_t request;
+    uint64_t user_data;         // Echoed in the completion
+} submit_entry_t;
+
+typedef struct {
+    uint64_t user_data;
+    int64_t result;
+} completion_entry_t;
+
+typedef struct submit_ring {
+    uint32_t sq_tail __attribute__((aligned(64)));  // Written by the quantum
+    uint32_t cq_head;
+    uint32_t sq_head __attribute__((aligned(64)));  // Written by the kernel
+    uint32_t cq_tail;
+    uint32_t entries __attribute__((aligned(64)));
+    uint32_t sq_mask;
+    uint32_t cq_mask;           // Completion queue holds twice the entries
+    uint32_t cq_overflow;       // Enters cut short by a full completion queue
+    submit_entry_t* sqes;
+    completion_entry_t* cqes;
+} submit_ring_t;
+
+// Capabilities held in a capability_set_t
+enum {
+    CAPABILITY_NONE = 0,        // Request needs no capability
+    CAPABILITY_MEMORY,
+    CAPABILITY_CONDUIT,
+    CAPABILITY_QUANTUM,
+    CAPABILITY_CAPABILITY,      // Request further capabilities
+    CAPABILITY_ABI,             // ABI-private request IDs (>= SYSREQ_COUNT)
+    CAPABILITY_COUNT
 };
 
 // Capability set
 typedef struct {
     uint64_t bitmap[MAX_CAPABILITIES / 64];
     uint32_t count;
+    uint32_t generation;        // Bumped by grant/revoke; stales request masks
 } capability_set_t;
 
+// Per-request-type capability check counters; index 0 covers ABI-private IDs
+typedef struct {
+    uint64_t allowed;
+    uint64_t denied;
+} request_check_stats_t;
+
 // Scheduling information
 typedef struct {
     priority_t priority;
@@ -133,6 +231,11 @@ typedef struct {
     cpu_affinity_t cpu_affinity;
     uint64_t cpu_mask;
     float ai_weight;  // Nexus Core optimization hint
+    uint32_t last_cpu;  // CPU it last ran on
+    int32_t rq_cpu;     // Run queue holding it, -1 if not queued
+    uint32_t block_reason;  // block_reason_t
+    uint64_t block_time;
+    bool wake_pending;      // Woken before it blocked; see temporal_unblock
 } scheduling_info_t;
 
 // Quantum statistics
@@ -144,6 +247,7 @@ typedef struct {
     uint64_t page_faults;
     uint64_t system_calls;
     uint64_t conduit_messages;
+    uint64_t deadline_misses;
 } quantum_stats_t;
 
 // Register state (simplified)
@@ -154,7 +258,6 @@ typedef struct {
     uint64_t r12, r13, r14, r15;
     uint64_t rip, rflags;
     uint64_t cr3;  // Page table base
-    // FPU/SSE state would go here
 } register_state_t;
 
 // Quantum context - The fundamental execution unit
@@ -168,6 +271,7 @@ typedef struct quantum_context {
     // Execution
     void* entry_point;
     register_state_t* register_state;
+    void* fpu_state;            // XSAVE/FXSAVE area, loaded on first use per slice
     memory_domain_t* memory_domain;
     
     // Hierarchy
@@ -182,6 +286,8 @@ typedef struct quantum_context {
     
     // Security
     capability_set_t* capabilities;
+    uint64_t request_mask;      // Bit n: request n allowed, compiled from capabilities
+    uint32_t request_mask_gen;  // capabilities->generation it was compiled at
     uint32_t security_level;
     
     // Statistics
@@ -189,6 +295,7 @@ typedef struct quantum_context {
     
     // ABI-specific data
     void* abi_context;
+    struct submit_ring_ctx* submit_ring;  // Kernel side of SYSREQ_RING_SETUP
 } quantum_context_t;
 
 // CPU core structure
@@ -216,18 +323,110 @@ typedef struct {
     uint64_t boot_time;
     uint64_t quantum_count;
     uint64_t next_qid;
+    uint64_t tsc_khz;       // Calibrated against the PIT at boot
 } continuum_state_t;
 
-// Boot context from Genesis
+// Boot context from Genesis, field for field as genesis_boot.c lays it
+// out; the two change together
+#define GENESIS_MAX_CMDLINE_LEN     4096
+#define GENESIS_MAX_MEMORY_REGIONS  128
+#define GENESIS_MAX_BOOT_MODULES    32
+#define GENESIS_VERSION_BOOT_STAGES 0x01010000  // First context with boot_stages
+
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t attributes;
+} genesis_memory_region_t;
+
+typedef struct {
+    uint32_t region_count;
+    uint64_t total_memory;
+    uint64_t usable_memory;
+    genesis_memory_region_t regions[GENESIS_MAX_MEMORY_REGIONS];
+} genesis_memory_map_t;
+
+typedef struct {
+    uint64_t base;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    uint32_t bpp;
+    uint32_t red_mask;
+    uint32_t green_mask;
+    uint32_t blue_mask;
+    uint32_t reserved_mask;
+} genesis_framebuffer_t;
+
+typedef struct {
+    uint32_t vendor[4];
+    uint32_t family;
+    uint32_t model;
+    uint32_t stepping;
+    uint64_t features;      // CPU_FEATURE_* from detect_cpu_features
+    uint32_t cores;
+    uint32_t threads;
+    uint64_t frequency;
+    bool has_64bit;
+    bool has_nx;
+    bool has_pae;
+    bool has_sse;
+    bool has_sse2;
+    bool has_sse3;
+    bool has_ssse3;
+    bool has_sse41;
+    bool has_sse42;
+    bool has_avx;
+    bool has_avx2;
+    bool has_avx512;
+    bool has_erms;
+    bool has_fsrm;
+    bool has_pcid;
+    bool has_invpcid;
+    bool has_tsc_deadline;
+    bool has_1gb_pages;
+} genesis_cpu_info_t;
+
+typedef struct {
+    uint64_t rsdp_addr;
+    uint64_t rsdt_addr;
+    uint64_t xsdt_addr;
+    uint32_t revision;
+    bool use_xsdt;
+} genesis_acpi_info_t;
+
+typedef struct {
+    char name[64];
+    uint64_t base;
+    uint64_t size;
+    uint32_t type;
+    uint32_t flags;
+} genesis_module_t;
+
 typedef struct genesis_boot_context {
     uint64_t magic;
     uint32_t version;
+    uint32_t size;
     uint32_t boot_mode;
-    struct {
-        uint64_t total_memory;
-        uint64_t usable_memory;
-    } memory_map;
-    // Simplified for header
+    char bootloader_name[32];
+    char command_line[GENESIS_MAX_CMDLINE_LEN];
+    genesis_memory_map_t memory_map;
+    uint64_t kernel_start;
+    uint64_t kernel_end;
+    uint64_t initrd_start;
+    uint64_t initrd_end;
+    uint64_t boot_heap_start;
+    uint64_t boot_heap_end;
+    uint32_t display_mode;
+    genesis_framebuffer_t framebuffer;
+    genesis_cpu_info_t cpu;
+    genesis_acpi_info_t acpi;
+    uint32_t module_count;
+    genesis_module_t modules[GENESIS_MAX_BOOT_MODULES];
+    void* platform_data;
+    uint32_t platform_data_size;
+    uint64_t boot_stages[BOOT_STAGE_COUNT];  // TSC at each BOOT_STAGE_*, 0 if not reached
 } genesis_boot_context_t;
 
 // IDT structures for interrupt handling
@@ -246,6 +445,140 @@ typedef struct {
     uint64_t base;
 } __attribute__((packed)) idt_ptr_t;
 
+// Register state saved by the interrupt entry stubs, lowest address first
+typedef struct {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t vector;
+    uint64_t error_code;    // Zero for vectors the CPU pushes none for
+    uint64_t rip, cs, rflags, rsp, ss;
+} interrupt_frame_t;
+
+typedef void (*interrupt_handler_t)(interrupt_frame_t* frame, void* context);
+
+// Re-points an interrupt source at another CPU; source is whatever the
+// owner passed to continuum_set_interrupt_source()
+typedef void (*interrupt_steer_t)(uint8_t vector, uint32_t cpu, void* source);
+
+// Per-CPU statistics counters. Each CPU adds to its own cache line and
+// readers sum every CPU's copy, so hot paths never share a written line.
+typedef enum {
+    // Temporal
+    COUNTER_SCHED_SWITCHES = 0,
+    COUNTER_SCHED_TICKS,
+    COUNTER_SCHED_QUANTA,       // Gauge: enqueues less removals
+    // Conduit
+    COUNTER_CONDUIT_MESSAGES,
+    COUNTER_CONDUIT_BYTES,
+    // Flux
+    COUNTER_PAGE_FAULTS,
+    COUNTER_COW_FAULTS,
+    COUNTER_HUGE_MAPPINGS,
+    COUNTER_HUGE_SPLITS,
+    COUNTER_HUGE_COLLAPSES,
+    COUNTER_TLB_SHOOTDOWNS,
+    COUNTER_TLB_IPIS,
+    COUNTER_TLB_SHOOTDOWN_CYCLES,
+    COUNTER_TLB_FULL_FLUSHES,
+    COUNTER_TLB_PCID_HITS,
+    // Harmony
+    COUNTER_NET_RX_PACKETS,
+    COUNTER_NET_RX_BYTES,
+    COUNTER_NET_TX_PACKETS,
+    COUNTER_NET_TX_BYTES,
+    COUNTER_NET_ERRORS,
+    COUNTER_COUNT
+} continuum_counter_t;
+
+typedef struct {
+    uint64_t value[COUNTER_COUNT];
+} __attribute__((aligned(64))) percpu_counters_t;
+
+// =============================================================================
+// CPU-Local Helpers
+// =============================================================================
+
+extern percpu_counters_t g_percpu_counters[MAX_CPU_CORES];
+uint32_t temporal_get_current_cpu(void);
+
+// One add instruction: an interrupt on this CPU can't split it and no other
+// CPU writes the line, so it needs no lock prefix. A quantum migrating
+// between the CPU lookup and the add may lose that one event.
+static inline void continuum_counter_add(continuum_counter_t counter, uint64_t n) {
+    __asm__ __volatile__("addq %1, %0"
+                         : "+m"(g_percpu_counters[temporal_get_current_cpu()].value[counter])
+                         : "er"(n));
+}
+
+static inline void continuum_counter_inc(continuum_counter_t counter) {
+    continuum_counter_add(counter, 1);
+}
+
+
+// Masking local interrupts also keeps the current quantum on this CPU: the
+// scheduler only preempts from the timer interrupt, so these bracket per-CPU
+// critical sections.
+static inline uint64_t cpu_irq_save(void) {
+    uint64_t flags;
+    __asm__ __volatile__("pushfq\n"
+                         "popq %0\n"
+                         "cli"
+                         : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void cpu_irq_restore(uint64_t flags) {
+    if (flags & (1ULL << 9)) {  // RFLAGS.IF
+        __asm__ __volatile__("sti" : : : "memory");
+    }
+}
+
+// Read sections for structures walked without locks. Readers run with
+// interrupts off and move their CPU's sequence to odd on entry and back to
+// even on exit; a writer that unlinked something waits out every odd
+// sequence before freeing it. Each structure keeps its own MAX_CPU_CORES
+// readers.
+typedef struct {
+    uint64_t seq;
+} __attribute__((aligned(64))) continuum_reader_t;
+
+static inline uint64_t continuum_read_lock(continuum_reader_t* readers, uint32_t* cpu) {
+    uint64_t flags = cpu_irq_save();
+    *cpu = temporal_get_current_cpu();
+    continuum_reader_t* reader = &readers[*cpu];
+    
+    __atomic_store_n(&reader->seq, reader->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return flags;
+}
+
+static inline void continuum_read_unlock(continuum_reader_t* readers, uint32_t cpu,
+                                         uint64_t flags) {
+    continuum_reader_t* reader = &readers[cpu];
+    
+    __atomic_store_n(&reader->seq, reader->seq + 1, __ATOMIC_RELEASE);
+    cpu_irq_restore(flags);
+}
+
+// Wait until every reader that could have seen an unlinked entry has left
+static inline void continuum_synchronize(continuum_reader_t* readers) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    uint32_t self = temporal_get_current_cpu();
+    for (uint32_t cpu = 0; cpu < MAX_CPU_CORES; cpu++) {
+        if (cpu == self) {
+            continue;
+        }
+        
+        uint64_t seq = __atomic_load_n(&readers[cpu].seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            while (__atomic_load_n(&readers[cpu].seq, __ATOMIC_ACQUIRE) == seq) {
+                __asm__ __volatile__("pause");
+            }
+        }
+    }
+}
+
 // =============================================================================
 // Function Prototypes
 // =============================================================================
@@ -263,10 +596,52 @@ quantum_context_t* continuum_get_current_quantum(void);
 // System request handling
 int64_t continuum_handle_request(quantum_context_t* quantum,
                                  system_request_t* request);
+size_t continuum_handle_batch(quantum_context_t* quantum, system_request_t* requests,
+                              int64_t* results, size_t count);
 
 // Time management
 uint64_t continuum_get_time(void);
 uint64_t continuum_get_uptime(void);
+uint64_t continuum_get_tsc_khz(void);
+uint64_t continuum_usec_to_tsc(uint64_t usec);
+uint64_t continuum_get_boot_stage(uint32_t stage);
+
+// Subsystems initialized after the scheduler starts: device probing, then
+// the network stack and compositor where the image has them. Waiters run
+// until every one has.
+void continuum_wait_deferred_init(void);
+
+// Local APIC timer (one-shot, TSC-deadline where supported)
+void continuum_timer_init(uint64_t cpu_features, uint8_t vector);
+void continuum_timer_arm(uint64_t deadline);
+
+// Inter-processor interrupts
+void continuum_send_ipi(uint32_t cpu, uint8_t vector);
+void continuum_apic_eoi(void);
+void continuum_lapic_init(void);
+uint32_t continuum_cpu_apic_id(uint32_t cpu);
+uint32_t continuum_get_cpu_count(void);
+uint64_t continuum_get_cpu_features(void);
+
+// Interrupt routing. Device vectors are sent their EOI by the dispatcher;
+// system vectors registered with eoi = false acknowledge themselves.
+void continuum_dispatch_interrupt(interrupt_frame_t* frame);
+int continuum_register_interrupt(uint8_t vector, interrupt_handler_t handler,
+                                 void* context, bool eoi);
+void continuum_unregister_interrupt(uint8_t vector);
+void continuum_sync_interrupt(uint8_t vector);
+int continuum_alloc_vector(void);
+void continuum_free_vector(uint8_t vector);
+void continuum_set_interrupt_source(uint8_t vector, interrupt_steer_t steer, void* source);
+int continuum_set_irq_affinity(uint8_t vector, uint32_t cpu);
+uint64_t continuum_interrupt_count(uint8_t vector);
+
+// I/O APIC (GSIs map one to one onto pins of the first I/O APIC)
+int continuum_ioapic_route(uint32_t gsi, uint8_t vector, uint32_t cpu, uint32_t flags);
+void continuum_ioapic_mask(uint32_t gsi);
+
+// Statistics counters (sums over every CPU, not a consistent snapshot)
+uint64_t continuum_counter_read(continuum_counter_t counter);
 
 // Panic handler
 void continuum_panic(const char* message) __attribute__((noreturn));
@@ -276,6 +651,8 @@ capability_set_t* capability_create_default(void);
 bool capability_check(capability_set_t* caps, uint64_t capability);
 void capability_grant(capability_set_t* caps, uint64_t capability);
 void capability_revoke(capability_set_t* caps, uint64_t capability);
+bool continuum_request_allowed(quantum_context_t* quantum, uint64_t request_id);
+void continuum_get_request_stats(request_check_stats_t* stats, size_t count);
 
 // ABI-specific handlers (implemented in respective modules)
 int64_t handle_native_request(quantum_context_t* quantum, system_request_t* request);
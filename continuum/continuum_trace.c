@@ -0,0 +1,252 @@
+/*
+ * Continuum Tracing
+ * Lock-free per-CPU trace rings, drained by a single consumer
+ */
+
+#include "continuum_trace.h"
+#include "continuum_core.h"
+#include "flux_memory.h"
+#include "temporal_scheduler.h"
+#include "conduit_ipc.h"
+
+// =============================================================================
+// Trace State
+// =============================================================================
+
+#define TRACE_RING_MASK         (TRACE_RING_RECORDS - 1)
+
+_Static_assert((TRACE_RING_RECORDS & TRACE_RING_MASK) == 0,
+               "TRACE_RING_RECORDS must be a power of two");
+
+// Only the owning CPU writes head and the records; the consumer side sits
+// on its own line
+typedef struct {
+    uint64_t head;              // Records ever written, published with release
+    uint8_t pad0[56];
+    uint64_t tail;              // Next record the consumer reads
+    uint64_t lost;              // Overwritten before the consumer got to them
+    uint8_t pad1[48];
+    trace_record_t records[TRACE_RING_RECORDS];
+} trace_ring_t;
+
+uint32_t g_trace_mask __attribute__((aligned(64))) = 0;
+
+static trace_ring_t* g_trace_rings[MAX_CPU_CORES];
+static uint32_t g_trace_cpus = 0;
+
+// Serializes consumers: trace_read and the stream pump
+static spinlock_t g_trace_lock = SPINLOCK_INIT;
+static conduit_t* g_trace_stream = NULL;
+static uint64_t g_trace_streamed = 0;
+
+// =============================================================================
+// Initialization and Control
+// =============================================================================
+
+int trace_init(void) {
+    uint32_t cpus = continuum_get_cpu_count();
+    if (cpus == 0 || cpus > MAX_CPU_CORES) {
+        cpus = 1;
+    }
+    
+    for (uint32_t cpu = 0; cpu < cpus; cpu++) {
+        trace_ring_t* ring = flux_allocate(NULL, sizeof(trace_ring_t),
+                                           FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO |
+                                           FLUX_ALLOC_LARGE);
+        if (!ring) {
+            return -ENOMEM;     // CPUs without a ring just drop their events
+        }
+        g_trace_rings[cpu] = ring;
+        g_trace_cpus = cpu + 1;
+    }
+    return 0;
+}
+
+void trace_enable(uint32_t categories) {
+    __atomic_fetch_or(&g_trace_mask, categories & TRACE_CAT_ALL, __ATOMIC_RELAXED);
+}
+
+void trace_disable(uint32_t categories) {
+    __atomic_fetch_and(&g_trace_mask, ~categories, __ATOMIC_RELAXED);
+}
+
+void trace_get_stats(trace_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    
+    stats->enabled = __atomic_load_n(&g_trace_mask, __ATOMIC_RELAXED);
+    stats->records = 0;
+    stats->lost = 0;
+    for (uint32_t cpu = 0; cpu < g_trace_cpus; cpu++) {
+        stats->records += __atomic_load_n(&g_trace_rings[cpu]->head, __ATOMIC_RELAXED);
+        stats->lost += g_trace_rings[cpu]->lost;
+    }
+    stats->streamed = g_trace_streamed;
+}
+
+// =============================================================================
+// Recording
+// =============================================================================
+
+// Tracepoints in interrupt handlers share the ring, so the slot is filled
+// with interrupts masked; no lock and no atomic read-modify-write
+void trace_emit(uint16_t event, uint32_t arg0, uint64_t arg1, uint64_t arg2) {
+    uint32_t cpu = temporal_get_current_cpu();
+    if (cpu >= g_trace_cpus) {
+        return;
+    }
+    trace_ring_t* ring = g_trace_rings[cpu];
+    
+    uint64_t flags = cpu_irq_save();
+    uint64_t head = ring->head;
+    trace_record_t* record = &ring->records[head & TRACE_RING_MASK];
+    record->timestamp = continuum_get_time();
+    record->event = event;
+    record->cpu = (uint16_t)cpu;
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+    record->arg2 = arg2;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    cpu_irq_restore(flags);
+}
+
+// =============================================================================
+// Consuming
+// =============================================================================
+
+// Copy out up to max_records of the oldest unread records. The writer never
+// waits for the consumer; records it laps are counted in *lost. Caller
+// holds g_trace_lock.
+static size_t ring_read(trace_ring_t* ring, trace_record_t* records,
+                        size_t max_records, uint64_t* lost) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    uint64_t dropped = 0;
+    
+    if (head - tail > TRACE_RING_RECORDS) {
+        dropped = head - tail - TRACE_RING_RECORDS;
+        tail = head - TRACE_RING_RECORDS;
+    }
+    
+    size_t count = head - tail < max_records ? (size_t)(head - tail) : max_records;
+    for (size_t i = 0; i < count; i++) {
+        records[i] = ring->records[(tail + i) & TRACE_RING_MASK];
+    }
+    
+    // Anything the writer reached while we copied is torn. It may be filling
+    // slot head right now, which is record head - TRACE_RING_RECORDS.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    if (head + 1 > TRACE_RING_RECORDS) {
+        uint64_t oldest = head + 1 - TRACE_RING_RECORDS;
+        if (tail < oldest) {
+            size_t skip = oldest - tail < count ? (size_t)(oldest - tail) : count;
+            memmove(records, records + skip, (count - skip) * sizeof(trace_record_t));
+            count -= skip;
+            dropped += oldest - tail;
+            tail = oldest;
+        }
+    }
+    
+    ring->tail = tail + count;
+    ring->lost += dropped;
+    if (lost) {
+        *lost = dropped;
+    }
+    return count;
+}
+
+size_t trace_read(uint32_t cpu, trace_record_t* records, size_t max_records,
+                  uint64_t* lost) {
+    if (cpu >= g_trace_cpus || !records || max_records == 0) {
+        return 0;
+    }
+    
+    spinlock_acquire(&g_trace_lock);
+    size_t count = ring_read(g_trace_rings[cpu], records, max_records, lost);
+    spinlock_release(&g_trace_lock);
+    return count;
+}
+
+// =============================================================================
+// Streaming
+// =============================================================================
+
+typedef struct {
+    trace_stream_header_t header;
+    trace_record_t records[TRACE_STREAM_BATCH];
+} trace_stream_msg_t;
+
+// Create the stream conduit; a host-side analyzer (or harmony's exporter)
+// opens it by name and receives trace_stream_msg_t messages
+conduit_t* trace_stream_start(const char* name) {
+    spinlock_acquire(&g_trace_lock);
+    if (!g_trace_stream) {
+        g_trace_stream = conduit_create(name, TRACE_STREAM_BUFFER);
+    }
+    conduit_t* stream = g_trace_stream;
+    spinlock_release(&g_trace_lock);
+    return stream;
+}
+
+void trace_stream_stop(void) {
+    spinlock_acquire(&g_trace_lock);
+    conduit_t* stream = g_trace_stream;
+    g_trace_stream = NULL;
+    spinlock_release(&g_trace_lock);
+    
+    if (stream) {
+        conduit_close(stream);
+    }
+}
+
+// Move everything recorded so far into the stream conduit, one message per
+// CPU batch. Never blocks: once the conduit is full the drained batch is
+// counted as lost and the rest waits for the next pump. Returns the number
+// of records sent, or -EPIPE without a stream.
+int64_t trace_stream_pump(void) {
+    trace_stream_msg_t msg;
+    int64_t sent = 0;
+    
+    spinlock_acquire(&g_trace_lock);
+    if (!g_trace_stream) {
+        spinlock_release(&g_trace_lock);
+        return -EPIPE;
+    }
+    
+    for (uint32_t cpu = 0; cpu < g_trace_cpus; cpu++) {
+        trace_ring_t* ring = g_trace_rings[cpu];
+        
+        // Stop at what's there now; sending to the conduit records events too
+        uint64_t end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (ring->tail < end) {
+            uint64_t lost = 0;
+            size_t want = end - ring->tail < TRACE_STREAM_BATCH ?
+                (size_t)(end - ring->tail) : TRACE_STREAM_BATCH;
+            size_t count = ring_read(ring, msg.records, want, &lost);
+            if (count == 0 && lost == 0) {
+                break;
+            }
+            
+            msg.header.magic = TRACE_STREAM_MAGIC;
+            msg.header.version = TRACE_STREAM_VERSION;
+            msg.header.cpu = (uint16_t)cpu;
+            msg.header.count = (uint32_t)count;
+            msg.header.lost = lost > UINT32_MAX ? UINT32_MAX : (uint32_t)lost;
+            msg.header.tsc_khz = continuum_get_tsc_khz();
+            
+            size_t size = sizeof(msg.header) + count * sizeof(trace_record_t);
+            if (conduit_send(g_trace_stream, &msg, size, CONDUIT_FLAG_NONBLOCK) < 0) {
+                ring->lost += count;
+                spinlock_release(&g_trace_lock);
+                return sent;
+            }
+            sent += count;
+            g_trace_streamed += count;
+        }
+    }
+    
+    spinlock_release(&g_trace_lock);
+    return sent;
+}
@@ -0,0 +1,130 @@
+/*
+ * Continuum Tracing
+ * Per-CPU trace rings and static tracepoints
+ */
+
+#ifndef CONTINUUM_TRACE_H
+#define CONTINUUM_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "continuum_core.h"
+
+// =============================================================================
+// Constants
+// =============================================================================
+
+#define TRACE_RING_RECORDS      4096    // Per CPU, power of two
+#define TRACE_STREAM_BATCH      40      // Records per stream message (fits a UDP datagram)
+#define TRACE_STREAM_BUFFER     (64 * 1024)
+#define TRACE_STREAM_MAGIC      0x43545243  // "CTRC"
+#define TRACE_STREAM_VERSION    1
+
+// Categories, enabled independently
+#define TRACE_CAT_SCHED         0
+#define TRACE_CAT_IPC           1
+#define TRACE_CAT_MEMORY        2
+#define TRACE_CAT_STORAGE       3
+#define TRACE_CAT_NET           4
+#define TRACE_CAT_DISPLAY       5
+#define TRACE_CAT_DEVICE        6
+#define TRACE_CAT_COUNT         7
+#define TRACE_CAT_ALL           ((1U << TRACE_CAT_COUNT) - 1)
+
+// Event IDs carry their category in the high byte
+#define TRACE_EVENT(cat, n)     (uint16_t)(((cat) << 8) | (n))
+#define TRACE_EVENT_CAT(event)  ((event) >> 8)
+
+// Arguments are (arg0, arg1, arg2); "cycles" is the TSC time the traced
+// operation took
+#define TRACE_SCHED_SWITCH      TRACE_EVENT(TRACE_CAT_SCHED, 1)    // prev state, prev qid, next qid
+#define TRACE_CONDUIT_SEND      TRACE_EVENT(TRACE_CAT_IPC, 1)      // conduit id, result, cycles
+#define TRACE_CONDUIT_RECEIVE   TRACE_EVENT(TRACE_CAT_IPC, 2)      // conduit id, result, cycles
+#define TRACE_FLUX_COW_FAULT    TRACE_EVENT(TRACE_CAT_MEMORY, 1)   // owner qid, address, cycles
+#define TRACE_NVME_SUBMIT       TRACE_EVENT(TRACE_CAT_STORAGE, 1)  // qid << 16 | slot, opcode, command id
+#define TRACE_ETH_INPUT         TRACE_EVENT(TRACE_CAT_NET, 1)      // ethertype, length, cycles
+#define TRACE_PRISM_REPAINT     TRACE_EVENT(TRACE_CAT_DISPLAY, 1)  // output id, surfaces, cycles
+#define TRACE_RESONANCE_PROBE   TRACE_EVENT(TRACE_CAT_DEVICE, 1)   // node id, driver id, cycles
+
+// =============================================================================
+// Data Structures
+// =============================================================================
+
+typedef struct {
+    uint64_t timestamp;         // TSC when the record was written
+    uint16_t event;
+    uint16_t cpu;
+    uint32_t arg0;
+    uint64_t arg1;
+    uint64_t arg2;
+} trace_record_t;
+
+// Each stream message is one header and count records from a single CPU
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t cpu;
+    uint32_t count;
+    uint32_t lost;              // Records overwritten since the previous message
+    uint64_t tsc_khz;           // For converting timestamps on the host
+} trace_stream_header_t;
+
+typedef struct {
+    uint32_t enabled;           // TRACE_CAT_* bit mask
+    uint64_t records;
+    uint64_t lost;
+    uint64_t streamed;
+} trace_stats_t;
+
+// =============================================================================
+// Tracepoints
+// =============================================================================
+
+// Read on every tracepoint; written only by trace_enable/trace_disable
+extern uint32_t g_trace_mask;
+
+static inline bool trace_enabled(uint16_t event) {
+    return __builtin_expect(
+        (__atomic_load_n(&g_trace_mask, __ATOMIC_RELAXED) >> TRACE_EVENT_CAT(event)) & 1, 0);
+}
+
+void trace_emit(uint16_t event, uint32_t arg0, uint64_t arg1, uint64_t arg2);
+
+// A disabled tracepoint is one load and a not-taken branch; arguments are
+// only evaluated once it's enabled
+#define TRACE(event, arg0, arg1, arg2)                                          \
+    do {                                                                        \
+        if (trace_enabled(event)) {                                             \
+            trace_emit((event), (uint32_t)(arg0), (uint64_t)(arg1),             \
+                       (uint64_t)(arg2));                                       \
+        }                                                                       \
+    } while (0)
+
+// Start timestamp for a traced operation, 0 while its event is off
+static inline uint64_t trace_begin(uint16_t event) {
+    return trace_enabled(event) ? continuum_get_time() : 0;
+}
+
+static inline uint64_t trace_elapsed(uint64_t start) {
+    return start ? continuum_get_time() - start : 0;
+}
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// Control; categories is a mask of 1 << TRACE_CAT_*
+int trace_init(void);
+void trace_enable(uint32_t categories);
+void trace_disable(uint32_t categories);
+void trace_get_stats(trace_stats_t* stats);
+
+// Consumers
+size_t trace_read(uint32_t cpu, trace_record_t* records, size_t max_records,
+                  uint64_t* lost);
+struct conduit* trace_stream_start(const char* name);
+void trace_stream_stop(void);
+int64_t trace_stream_pump(void);
+
+#endif /* CONTINUUM_TRACE_H */
@@ -7,6 +7,8 @@
 #include "../resonance.h"
 #include "../../flux_memory.h"
 
+#define AC97_BDL_MASK           (AC97_BDL_ENTRIES - 1)
+
 // =============================================================================
 // Global AC'97 State
 // =============================================================================
@@ -14,6 +16,7 @@
 static ac97_controller_t* g_ac97_controllers[MAX_AC97_CONTROLLERS];
 static uint32_t g_ac97_count = 0;
 static spinlock_t g_ac97_lock = SPINLOCK_INIT;
+static uint32_t g_ac97_stream_id = 0;
 
 // =============================================================================
 // Codec Access
@@ -49,8 +52,8 @@ static void ac97_codec_write(ac97_controller_t* ac97, uint8_t reg, uint16_t valu
 // Buffer Descriptor List Management
 // =============================================================================
 
-static int ac97_setup_bdl(ac97_controller_t* ac97, ac97_channel_t* channel,
-                         void* buffer, size_t size) {
+// The channel's BDL, and an audio buffer of at least size bytes
+static int ac97_alloc_channel(ac97_channel_t* channel, size_t size) {
     // Allocate BDL if not already allocated
     if (!channel->bdl_dma) {
         channel->bdl_dma = resonance_alloc_dma(sizeof(ac97_bdl_entry_t) * AC97_BDL_ENTRIES,
@@ -75,6 +78,15 @@ static int ac97_setup_bdl(ac97_controller_t* ac97, ac97_channel_t* channel,
         channel->buffer_size = size;
     }
     
+    return 0;
+}
+
+static int ac97_setup_bdl(ac97_controller_t* ac97, ac97_channel_t* channel,
+                         void* buffer, size_t size) {
+    if (ac97_alloc_channel(channel, size) != 0) {
+        return -1;
+    }
+    
     // Copy audio data
     memcpy(channel->buffer, buffer, size);
     
@@ -117,6 +129,37 @@ static int ac97_setup_bdl(ac97_controller_t* ac97, ac97_channel_t* channel,
 // Playback Control
 // =============================================================================
 
+static void ac97_reset_channel(ac97_channel_t* channel) {
+    // Stop DMA
+    outb(channel->base + AC97_CR, 0);
+    
+    // Reset channel
+    outb(channel->base + AC97_CR, AC97_CR_RR);
+    
+    // Wait for reset to complete
+    uint64_t timeout = continuum_get_time() + 100000;
+    while (continuum_get_time() < timeout) {
+        if (!(inb(channel->base + AC97_CR) & AC97_CR_RR)) {
+            break;
+        }
+        io_wait();
+    }
+}
+
+// Stop pcm_out, whether playing a buffer or mixing. Called with ac97->lock
+// held; the mixer's lock keeps the interrupt off the channel meanwhile.
+static void ac97_halt_output(ac97_controller_t* ac97) {
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&ac97->mixer.lock);
+    
+    ac97->mixer.running = false;
+    ac97_reset_channel(&ac97->pcm_out);
+    ac97->pcm_out.playing = false;
+    
+    spinlock_release(&ac97->mixer.lock);
+    cpu_irq_restore(flags);
+}
+
 int ac97_play(ac97_controller_t* ac97, void* buffer, size_t size,
              uint32_t sample_rate, uint8_t channels, uint8_t bits) {
     if (!ac97 || !buffer || size == 0) {
@@ -128,7 +171,7 @@ int ac97_play(ac97_controller_t* ac97, void* buffer, size_t size,
     ac97_channel_t* channel = &ac97->pcm_out;
     
     // Stop current playback
-    ac97_stop(ac97);
+    ac97_halt_output(ac97);
     
     // Configure channel
     channel->sample_rate = sample_rate;
@@ -164,26 +207,7 @@ void ac97_stop(ac97_controller_t* ac97) {
     }
     
     spinlock_acquire(&ac97->lock);
-    
-    ac97_channel_t* channel = &ac97->pcm_out;
-    
-    // Stop DMA
-    outb(channel->base + AC97_CR, 0);
-    
-    // Reset channel
-    outb(channel->base + AC97_CR, AC97_CR_RR);
-    
-    // Wait for reset to complete
-    uint64_t timeout = continuum_get_time() + 100000;
-    while (continuum_get_time() < timeout) {
-        if (!(inb(channel->base + AC97_CR) & AC97_CR_RR)) {
-            break;
-        }
-        io_wait();
-    }
-    
-    channel->playing = false;
-    
+    ac97_halt_output(ac97);
     spinlock_release(&ac97->lock);
 }
 
@@ -225,6 +249,336 @@ void ac97_resume(ac97_controller_t* ac97) {
     spinlock_release(&ac97->lock);
 }
 
+// =============================================================================
+// Streaming Mixer
+// =============================================================================
+
+static inline int16_t ac97_saturate(int32_t sample) {
+    if (sample > 32767) {
+        return 32767;
+    }
+    if (sample < -32768) {
+        return -32768;
+    }
+    return (int16_t)sample;
+}
+
+// Add frames output frames of stream into mix, resampled and scaled,
+// stopping short where its ring runs dry
+static void ac97_mix_stream(ac97_stream_t* stream, int32_t* mix, uint32_t frames) {
+    ac97_stream_ring_t* ring = stream->ring;
+    uint32_t read = ring->read;
+    uint32_t avail = __atomic_load_n(&ring->write, __ATOMIC_ACQUIRE) - read;
+    uint32_t mask = stream->frames - 1;
+    
+    // The client owns write; past a full ring it's lying
+    if (avail > stream->frames) {
+        avail = stream->frames;
+    }
+    
+    uint32_t i;
+    for (i = 0; i < frames; i++) {
+        while (stream->phase >= 0x10000 && avail > 0) {
+            const int16_t* frame = &ring->data[(read & mask) * stream->channels];
+            stream->prev[0] = stream->next[0];
+            stream->prev[1] = stream->next[1];
+            stream->next[0] = frame[0];
+            stream->next[1] = frame[stream->channels - 1];
+            stream->phase -= 0x10000;
+            read++;
+            avail--;
+        }
+        
+        if (stream->phase >= 0x10000) {
+            // Count running dry once, not every period it stays dry
+            if (!stream->dry) {
+                ring->underruns++;
+                stream->dry = true;
+            }
+            break;
+        }
+        stream->dry = false;
+        
+        // Linear interpolation on 15 bits of phase, so the product fits
+        int32_t frac = (int32_t)(stream->phase >> 1);
+        int32_t left = stream->prev[0] + (((stream->next[0] - stream->prev[0]) * frac) >> 15);
+        int32_t right = stream->prev[1] + (((stream->next[1] - stream->prev[1]) * frac) >> 15);
+        
+        mix[i * 2] += (left * stream->gain_left) >> 15;
+        mix[i * 2 + 1] += (right * stream->gain_right) >> 15;
+        stream->phase += stream->step;
+    }
+    
+    stream->frames_mixed += i;
+    __atomic_store_n(&ring->read, read, __ATOMIC_RELEASE);
+}
+
+// Mix one period into descriptor index's slice of the ring
+static void ac97_mixer_fill(ac97_controller_t* ac97, uint8_t index) {
+    ac97_mixer_t* mixer = &ac97->mixer;
+    uint32_t samples = mixer->period_frames * 2;
+    
+    memset(mixer->mix, 0, samples * sizeof(int32_t));
+    for (uint32_t i = 0; i < AC97_MAX_STREAMS; i++) {
+        if (mixer->streams[i].open) {
+            ac97_mix_stream(&mixer->streams[i], mixer->mix, mixer->period_frames);
+        }
+    }
+    
+    int16_t* out = (int16_t*)ac97->pcm_out.buffer + (size_t)index * samples;
+    for (uint32_t i = 0; i < samples; i++) {
+        out[i] = ac97_saturate(mixer->mix[i]);
+    }
+    
+    mixer->periods_mixed++;
+}
+
+// Mix until periods descriptors are queued from from, the one the DMA is
+// on or goes to next, and make the last of them the last valid. Called
+// with mixer->lock held.
+static void ac97_mixer_refill(ac97_controller_t* ac97, uint8_t from) {
+    ac97_mixer_t* mixer = &ac97->mixer;
+    
+    while (((mixer->fill_index - from) & AC97_BDL_MASK) < mixer->periods) {
+        ac97_mixer_fill(ac97, mixer->fill_index);
+        mixer->fill_index = (mixer->fill_index + 1) & AC97_BDL_MASK;
+    }
+    
+    outb(ac97->pcm_out.base + AC97_LVI, (mixer->fill_index - 1) & AC97_BDL_MASK);
+}
+
+// BCIS: a period played, mix its replacement. LVBCI: the DMA played all
+// that was mixed and halted on the last; a new LVI restarts it past that.
+// FIFO errors are the caller's, as for a fixed buffer.
+static void ac97_mixer_interrupt(ac97_controller_t* ac97, uint16_t sr) {
+    ac97_mixer_t* mixer = &ac97->mixer;
+    ac97_channel_t* channel = &ac97->pcm_out;
+    
+    spinlock_acquire(&mixer->lock);
+    
+    outw(channel->base + AC97_SR, sr & (AC97_SR_BCIS | AC97_SR_LVBCI));
+    
+    if (mixer->running) {
+        uint8_t civ = inb(channel->base + AC97_CIV) & AC97_BDL_MASK;
+        if (sr & AC97_SR_LVBCI) {
+            mixer->underruns++;
+            civ = (civ + 1) & AC97_BDL_MASK;
+        }
+        ac97_mixer_refill(ac97, civ);
+        channel->interrupts++;
+    }
+    
+    spinlock_release(&mixer->lock);
+}
+
+int ac97_mixer_start(ac97_controller_t* ac97, uint32_t period_frames, uint32_t periods) {
+    if (!ac97 || period_frames < AC97_PERIOD_MIN || period_frames > AC97_PERIOD_MAX ||
+        periods < 2 || periods >= AC97_BDL_ENTRIES) {
+        return -1;
+    }
+    
+    ac97_mixer_t* mixer = &ac97->mixer;
+    ac97_channel_t* channel = &ac97->pcm_out;
+    
+    spinlock_acquire(&ac97->lock);
+    
+    ac97_halt_output(ac97);
+    
+    // Every descriptor a period of 16-bit stereo, back to back
+    size_t period_bytes = period_frames * 2 * sizeof(int16_t);
+    if (ac97_alloc_channel(channel, period_bytes * AC97_BDL_ENTRIES) != 0) {
+        spinlock_release(&ac97->lock);
+        return -1;
+    }
+    if (!mixer->mix) {
+        mixer->mix = flux_allocate(NULL, AC97_PERIOD_MAX * 2 * sizeof(int32_t), FLUX_ALLOC_KERNEL);
+        if (!mixer->mix) {
+            spinlock_release(&ac97->lock);
+            return -1;
+        }
+    }
+    
+    for (uint32_t i = 0; i < AC97_BDL_ENTRIES; i++) {
+        channel->bdl[i].address = channel->buffer_dma->physical_addr + i * period_bytes;
+        channel->bdl[i].samples = period_frames * 2;
+        channel->bdl[i].flags = AC97_BDL_FLAG_IOC;
+    }
+    channel->bdl_entries = AC97_BDL_ENTRIES;
+    channel->sample_rate = AC97_MIXER_RATE;
+    channel->channels = 2;
+    channel->bits_per_sample = 16;
+    channel->loop = false;
+    
+    if (ac97->capabilities & AC97_CAP_VARIABLE_RATE) {
+        ac97_codec_write(ac97, AC97_PCM_FRONT_RATE, AC97_MIXER_RATE);
+    }
+    outl(channel->base + AC97_BDBAR, channel->bdl_dma->physical_addr);
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&mixer->lock);
+    
+    // The reset put the DMA on descriptor 0
+    mixer->period_frames = period_frames;
+    mixer->periods = periods;
+    mixer->fill_index = 0;
+    mixer->running = true;
+    ac97_mixer_refill(ac97, 0);
+    
+    outw(channel->base + AC97_SR, AC97_SR_FIFOE | AC97_SR_BCIS | AC97_SR_LVBCI);
+    outb(channel->base + AC97_CR, AC97_CR_RPBM | AC97_CR_IOCE | AC97_CR_LVBIE | AC97_CR_FEIE);
+    channel->playing = true;
+    
+    spinlock_release(&mixer->lock);
+    cpu_irq_restore(flags);
+    
+    spinlock_release(&ac97->lock);
+    return 0;
+}
+
+void ac97_mixer_stop(ac97_controller_t* ac97) {
+    ac97_stop(ac97);
+}
+
+void ac97_mixer_get_stats(ac97_controller_t* ac97, ac97_mixer_stats_t* stats) {
+    ac97_mixer_t* mixer = &ac97->mixer;
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&mixer->lock);
+    
+    stats->period_frames = mixer->period_frames;
+    stats->periods = mixer->periods;
+    stats->streams = 0;
+    stats->periods_mixed = mixer->periods_mixed;
+    stats->underruns = mixer->underruns;
+    stats->stream_underruns = 0;
+    for (uint32_t i = 0; i < AC97_MAX_STREAMS; i++) {
+        if (mixer->streams[i].open) {
+            stats->streams++;
+            stats->stream_underruns += mixer->streams[i].ring->underruns;
+        }
+    }
+    
+    spinlock_release(&mixer->lock);
+    cpu_irq_restore(flags);
+}
+
+// =============================================================================
+// Streams
+// =============================================================================
+
+ac97_stream_t* ac97_stream_open(ac97_controller_t* ac97, uint32_t sample_rate,
+                                uint8_t channels) {
+    if (!ac97 || sample_rate == 0 || sample_rate > AC97_MIXER_RATE * 4 ||
+        (channels != 1 && channels != 2)) {
+        return NULL;
+    }
+    
+    ac97_stream_t stream = {
+        .frames = AC97_STREAM_FRAMES,
+        .channels = channels,
+        .dry = true,
+        .step = (uint32_t)(((uint64_t)sample_rate << 16) / AC97_MIXER_RATE),
+        .phase = 0x10000,       // Take the first frame before mixing
+        .gain_left = 32768,
+        .gain_right = 32768
+    };
+    snprintf(stream.name, sizeof(stream.name), "ac97-stream-%u",
+             __atomic_fetch_add(&g_ac97_stream_id, 1, __ATOMIC_RELAXED));
+    
+    size_t size = sizeof(ac97_stream_ring_t) + AC97_STREAM_FRAMES * channels * sizeof(int16_t);
+    stream.ring = flux_create_shared(size, stream.name);
+    if (!stream.ring) {
+        return NULL;
+    }
+    stream.ring->write = 0;
+    stream.ring->read = 0;
+    stream.ring->frames = AC97_STREAM_FRAMES;
+    stream.ring->channels = channels;
+    stream.ring->sample_rate = sample_rate;
+    stream.ring->underruns = 0;
+    
+    ac97_mixer_t* mixer = &ac97->mixer;
+    ac97_stream_t* slot = NULL;
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&mixer->lock);
+    
+    for (uint32_t i = 0; i < AC97_MAX_STREAMS; i++) {
+        if (!mixer->streams[i].open) {
+            slot = &mixer->streams[i];
+            *slot = stream;
+            slot->open = true;
+            break;
+        }
+    }
+    
+    spinlock_release(&mixer->lock);
+    cpu_irq_restore(flags);
+    
+    if (!slot) {
+        flux_detach_shared(stream.ring);
+    }
+    return slot;
+}
+
+void ac97_stream_close(ac97_controller_t* ac97, ac97_stream_t* stream) {
+    if (!ac97 || !stream || !stream->open) {
+        return;
+    }
+    
+    // Once the mixer's lock is dropped it's done with the ring
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&ac97->mixer.lock);
+    
+    ac97_stream_ring_t* ring = stream->ring;
+    stream->open = false;
+    stream->ring = NULL;
+    
+    spinlock_release(&ac97->mixer.lock);
+    cpu_irq_restore(flags);
+    
+    flux_detach_shared(ring);
+}
+
+uint32_t ac97_stream_space(const ac97_stream_t* stream) {
+    const ac97_stream_ring_t* ring = stream->ring;
+    return stream->frames - (ring->write - __atomic_load_n(&ring->read, __ATOMIC_ACQUIRE));
+}
+
+// Never blocks: takes what fits, and says how many frames that was
+uint32_t ac97_stream_write(ac97_stream_t* stream, const int16_t* samples, uint32_t frames) {
+    ac97_stream_ring_t* ring = stream->ring;
+    uint32_t space = ac97_stream_space(stream);
+    if (frames > space) {
+        frames = space;
+    }
+    
+    // The ring wraps at most once
+    uint32_t start = ring->write & (stream->frames - 1);
+    uint32_t first = stream->frames - start;
+    if (first > frames) {
+        first = frames;
+    }
+    size_t frame_bytes = stream->channels * sizeof(int16_t);
+    memcpy(&ring->data[start * stream->channels], samples, first * frame_bytes);
+    memcpy(ring->data, samples + first * stream->channels, (frames - first) * frame_bytes);
+    
+    __atomic_store_n(&ring->write, ring->write + frames, __ATOMIC_RELEASE);
+    return frames;
+}
+
+// 0-100 per side, applied in the mix
+void ac97_stream_set_volume(ac97_stream_t* stream, uint8_t left, uint8_t right) {
+    if (!stream) {
+        return;
+    }
+    
+    left = left > 100 ? 100 : left;
+    right = right > 100 ? 100 : right;
+    stream->gain_left = left * 32768 / 100;
+    stream->gain_right = right * 32768 / 100;
+}
+
 // =============================================================================
 // Volume Control
 // =============================================================================
@@ -297,7 +651,9 @@ static void ac97_interrupt(interrupt_frame_t* frame) {
             ac97_channel_t* channel = &ac97->pcm_out;
             uint16_t sr = inw(channel->base + AC97_SR);
             
-            if (sr & AC97_SR_BCIS) {
+            if (ac97->mixer.running) {
+                ac97_mixer_interrupt(ac97, sr);
+            } else if (sr & AC97_SR_BCIS) {
                 // Buffer completion
                 channel->interrupts++;
                 
@@ -19,6 +19,15 @@
 #define AC97_BDL_ENTRIES       32
 #define AC97_BDL_BUFFER_SIZE   65536  // 64KB per buffer
 
+// Streaming mixer
+#define AC97_MAX_STREAMS        16
+#define AC97_PERIOD_MIN         32      // Frames per descriptor
+#define AC97_PERIOD_MAX         4096
+#define AC97_PERIOD_DEFAULT     256     // 5.3ms at 48kHz
+#define AC97_PERIODS_DEFAULT    2       // Mixed ahead of the DMA, the one playing included
+#define AC97_STREAM_FRAMES      8192    // Per stream ring, a power of two
+#define AC97_MIXER_RATE         48000   // Every codec's fixed rate
+
 // AC'97 Codec Registers (NAM - Native Audio Mixer)
 #define AC97_RESET              0x00
 #define AC97_MASTER_VOLUME      0x02
@@ -171,6 +180,71 @@ typedef struct {
     uint64_t errors;
 } ac97_channel_t;
 
+// A client stream's ring, in shared memory: the client writes frames
+// and advances write, the mixer takes them and advances read. Both count
+// up forever. 16-bit signed samples, interleaved when stereo.
+typedef struct {
+    uint32_t write;
+    uint32_t read;
+    uint32_t frames;            // Ring size, a power of two
+    uint32_t channels;          // 1 or 2
+    uint32_t sample_rate;
+    uint32_t underruns;         // Times the mixer found it empty mid-play
+    int16_t data[];
+} ac97_stream_ring_t;
+
+// Client stream
+typedef struct {
+    ac97_stream_ring_t* ring;
+    char name[24];              // What a client attaches the ring by
+    bool open;
+    
+    // The ring's geometry as opened; the client can't change these
+    uint32_t frames;
+    uint8_t channels;
+    bool dry;                   // Ran out last period
+    
+    // Resampling to the output rate: next is the frame after prev, phase
+    // how far between them the next output frame falls
+    uint32_t step;              // Input frames per output frame, 16.16
+    uint32_t phase;
+    int32_t prev[2];
+    int32_t next[2];
+    
+    // Q15, 32768 unity
+    int32_t gain_left;
+    int32_t gain_right;
+    
+    uint64_t frames_mixed;
+} ac97_stream_t;
+
+// Streaming engine: every descriptor is one period of a ring in one DMA
+// buffer, and the interrupt mixes streams into each as it's freed
+typedef struct {
+    ac97_stream_t streams[AC97_MAX_STREAMS];
+    int32_t* mix;               // One period's accumulator
+    uint32_t period_frames;
+    uint32_t periods;
+    uint8_t fill_index;         // Next descriptor to mix into
+    bool running;
+    
+    // Statistics
+    uint64_t periods_mixed;
+    uint64_t underruns;         // DMA caught up with the mixer
+    
+    spinlock_t lock;            // Streams, against the interrupt
+} ac97_mixer_t;
+
+// Mixer statistics
+typedef struct {
+    uint32_t period_frames;
+    uint32_t periods;
+    uint32_t streams;
+    uint64_t periods_mixed;
+    uint64_t underruns;
+    uint64_t stream_underruns;
+} ac97_mixer_stats_t;
+
 // Controller State
 typedef enum {
     AC97_STATE_DISABLED = 0,
@@ -201,6 +275,8 @@ typedef struct {
     uint8_t pcm_volume;
     uint8_t mic_volume;
     
+    ac97_mixer_t mixer;
+    
     spinlock_t lock;
 } ac97_controller_t;
 
@@ -226,6 +302,23 @@ void ac97_stop(ac97_controller_t* ac97);
 void ac97_pause(ac97_controller_t* ac97);
 void ac97_resume(ac97_controller_t* ac97);
 
+// Streaming: mix open streams into pcm_out in period_frames periods,
+// periods of them ahead of the DMA. Starting again reconfigures; a fixed
+// ac97_play stops the mixer.
+int ac97_mixer_start(ac97_controller_t* ac97, uint32_t period_frames, uint32_t periods);
+void ac97_mixer_stop(ac97_controller_t* ac97);
+void ac97_mixer_get_stats(ac97_controller_t* ac97, ac97_mixer_stats_t* stats);
+
+// Streams, resampled from sample_rate to the output's. A client in another
+// domain attaches stream->name with flux_attach_shared and writes the ring;
+// ac97_stream_write is the same for kernel clients.
+ac97_stream_t* ac97_stream_open(ac97_controller_t* ac97, uint32_t sample_rate,
+                                uint8_t channels);
+void ac97_stream_close(ac97_controller_t* ac97, ac97_stream_t* stream);
+uint32_t ac97_stream_write(ac97_stream_t* stream, const int16_t* samples, uint32_t frames);
+uint32_t ac97_stream_space(const ac97_stream_t* stream);
+void ac97_stream_set_volume(ac97_stream_t* stream, uint8_t left, uint8_t right);
+
 // Recording control
 int ac97_record(ac97_controller_t* ac97, void* buffer, size_t size,
                uint32_t sample_rate, uint8_t channels, uint8_t bits);
@@ -5,6 +5,7 @@
 
 #include "ext4.h"
 #include "../resonance.h"
+#include "../storage/page_cache.h"
 #include "../../flux_memory.h"
 
 // =============================================================================
@@ -15,15 +16,22 @@ static ext4_filesystem_t* g_ext4_filesystems[MAX_EXT4_FILESYSTEMS];
 static uint32_t g_ext4_fs_count = 0;
 static spinlock_t g_ext4_lock = SPINLOCK_INIT;
 
+// Device reads behind one page cache page (the smallest block is 1 KiB)
+#define EXT4_PAGE_BIOS          (PAGE_CACHE_PAGE_SIZE / 1024)
+
 // =============================================================================
 // Block I/O Operations
 // =============================================================================
 
+// Metadata goes through the device's page cache mapping; file data has
+// mappings of its own
+static uint64_t ext4_block_offset(ext4_filesystem_t* fs, uint64_t block_num) {
+    return fs->partition_start * BLOCK_SECTOR_SIZE + block_num * fs->block_size;
+}
+
 static int ext4_read_block(ext4_filesystem_t* fs, uint64_t block_num, void* buffer) {
-    uint64_t lba = fs->partition_start + (block_num * fs->block_size / 512);
-    uint32_t sectors = fs->block_size / 512;
-    
-    return fs->block_device->read(fs->block_device, lba, sectors, buffer);
+    return page_cache_read(fs->device_cache, ext4_block_offset(fs, block_num), buffer,
+                           fs->block_size);
 }
 
 static int ext4_write_block(ext4_filesystem_t* fs, uint64_t block_num, void* buffer) {
@@ -31,10 +39,8 @@ static int ext4_write_block(ext4_filesystem_t* fs, uint64_t block_num, void* buf
         return -1;
     }
     
-    uint64_t lba = fs->partition_start + (block_num * fs->block_size / 512);
-    uint32_t sectors = fs->block_size / 512;
-    
-    return fs->block_device->write(fs->block_device, lba, sectors, buffer);
+    return page_cache_write(fs->device_cache, ext4_block_offset(fs, block_num), buffer,
+                            fs->block_size);
 }
 
 // =============================================================================
@@ -83,6 +89,10 @@ static int ext4_read_superblock(ext4_filesystem_t* fs) {
         fs->has_huge_files = true;
     }
     
+    if (sb->s_feature_compat & EXT4_FEATURE_COMPAT_DIR_INDEX) {
+        fs->has_dir_index = true;
+    }
+    
     return 0;
 }
 
@@ -146,130 +156,750 @@ static int ext4_read_inode(ext4_filesystem_t* fs, uint32_t inode_num, ext4_inode
     uint32_t block_offset = (index * fs->inode_size) / fs->block_size;
     uint32_t block_index = (index * fs->inode_size) % fs->block_size;
     
-    // Read inode block
-    uint8_t* buffer = flux_allocate(NULL, fs->block_size, FLUX_ALLOC_KERNEL);
-    if (!buffer) {
+    // Only the inode itself is copied out of the cached table block
+    return page_cache_read(fs->device_cache,
+                           ext4_block_offset(fs, inode_table + block_offset) + block_index,
+                           inode, sizeof(ext4_inode_t));
+}
+
+// =============================================================================
+// Extent Status Cache
+// =============================================================================
+
+// Runs found by earlier tree walks, mapped or holes, so a file's extents
+// are looked up once rather than on every block. Entries never overlap.
+// Everything here is under fs->lock.
+
+static inline int32_t ext4_es_height(ext4_extent_status_t* node) {
+    return node ? node->height : 0;
+}
+
+static void ext4_es_update(ext4_extent_status_t* node) {
+    int32_t lh = ext4_es_height(node->left);
+    int32_t rh = ext4_es_height(node->right);
+    node->height = 1 + (lh > rh ? lh : rh);
+}
+
+static ext4_extent_status_t* ext4_es_rotate_right(ext4_extent_status_t* node) {
+    ext4_extent_status_t* pivot = node->left;
+    node->left = pivot->right;
+    pivot->right = node;
+    ext4_es_update(node);
+    ext4_es_update(pivot);
+    return pivot;
+}
+
+static ext4_extent_status_t* ext4_es_rotate_left(ext4_extent_status_t* node) {
+    ext4_extent_status_t* pivot = node->right;
+    node->right = pivot->left;
+    pivot->left = node;
+    ext4_es_update(node);
+    ext4_es_update(pivot);
+    return pivot;
+}
+
+static ext4_extent_status_t* ext4_es_rebalance(ext4_extent_status_t* node) {
+    ext4_es_update(node);
+    int32_t balance = ext4_es_height(node->left) - ext4_es_height(node->right);
+    
+    if (balance > 1) {
+        if (ext4_es_height(node->left->left) < ext4_es_height(node->left->right)) {
+            node->left = ext4_es_rotate_left(node->left);
+        }
+        return ext4_es_rotate_right(node);
+    }
+    if (balance < -1) {
+        if (ext4_es_height(node->right->right) < ext4_es_height(node->right->left)) {
+            node->right = ext4_es_rotate_right(node->right);
+        }
+        return ext4_es_rotate_left(node);
+    }
+    return node;
+}
+
+static ext4_extent_status_t* ext4_es_insert_node(ext4_extent_status_t* root,
+                                                 ext4_extent_status_t* node) {
+    if (!root) {
+        node->left = NULL;
+        node->right = NULL;
+        node->height = 1;
+        return node;
+    }
+    
+    if (node->lblk < root->lblk) {
+        root->left = ext4_es_insert_node(root->left, node);
+    } else {
+        root->right = ext4_es_insert_node(root->right, node);
+    }
+    return ext4_es_rebalance(root);
+}
+
+static inline bool ext4_es_covers(const ext4_extent_status_t* es, uint64_t lblk) {
+    return lblk >= es->lblk && lblk - es->lblk < es->len;
+}
+
+static ext4_extent_status_t* ext4_es_find(ext4_extent_status_t* node, uint32_t lblk) {
+    while (node) {
+        if (lblk < node->lblk) {
+            node = node->left;
+        } else if (!ext4_es_covers(node, lblk)) {
+            node = node->right;
+        } else {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+// Lowest entry starting after lblk
+static ext4_extent_status_t* ext4_es_next(ext4_extent_status_t* node, uint32_t lblk) {
+    ext4_extent_status_t* next = NULL;
+    while (node) {
+        if (node->lblk > lblk) {
+            next = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return next;
+}
+
+static void ext4_es_free(ext4_extent_status_t* node) {
+    if (!node) {
+        return;
+    }
+    ext4_es_free(node->left);
+    ext4_es_free(node->right);
+    flux_free(node);
+}
+
+// Unhook every inode's entries, returned as a list to free outside the lock
+static ext4_inode_info_t* ext4_es_detach(ext4_filesystem_t* fs) {
+    ext4_inode_info_t* list = NULL;
+    for (uint32_t i = 0; i < EXT4_INODE_BUCKETS; i++) {
+        while (fs->inodes[i]) {
+            ext4_inode_info_t* info = fs->inodes[i];
+            fs->inodes[i] = info->next;
+            info->next = list;
+            list = info;
+        }
+    }
+    fs->es_count = 0;
+    return list;
+}
+
+static void ext4_es_free_list(ext4_inode_info_t* list) {
+    while (list) {
+        ext4_inode_info_t* next = list->next;
+        ext4_es_free(list->es_root);
+        flux_free(list);
+        list = next;
+    }
+}
+
+static ext4_inode_info_t* ext4_es_inode(ext4_filesystem_t* fs, uint32_t ino) {
+    ext4_inode_info_t* info = fs->inodes[ino % EXT4_INODE_BUCKETS];
+    while (info && info->ino != ino) {
+        info = info->next;
+    }
+    return info;
+}
+
+static bool ext4_es_lookup(ext4_filesystem_t* fs, uint32_t ino, uint32_t lblk,
+                           ext4_extent_status_t* map) {
+    spinlock_acquire(&fs->lock);
+    ext4_inode_info_t* info = ext4_es_inode(fs, ino);
+    ext4_extent_status_t* es = info ? ext4_es_find(info->es_root, lblk) : NULL;
+    if (es) {
+        map->lblk = es->lblk;
+        map->len = es->len;
+        map->pblk = es->pblk;
+    }
+    spinlock_release(&fs->lock);
+    return es != NULL;
+}
+
+// Remember map for inode ino. Past EXT4_ES_MAX_CACHED entries the whole
+// cache starts over; anything dropped is found again by walking the tree.
+static void ext4_es_insert(ext4_filesystem_t* fs, uint32_t ino, const ext4_extent_status_t* map) {
+    ext4_extent_status_t* node = flux_allocate(NULL, sizeof(ext4_extent_status_t),
+                                               FLUX_ALLOC_KERNEL);
+    ext4_inode_info_t* fresh = flux_allocate(NULL, sizeof(ext4_inode_info_t),
+                                             FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    ext4_inode_info_t* dropped = NULL;
+    if (!node || !fresh) {
+        goto out;
+    }
+    node->lblk = map->lblk;
+    node->len = map->len;
+    node->pblk = map->pblk;
+    
+    spinlock_acquire(&fs->lock);
+    if (fs->es_count >= EXT4_ES_MAX_CACHED) {
+        dropped = ext4_es_detach(fs);
+    }
+    
+    ext4_inode_info_t* info = ext4_es_inode(fs, ino);
+    if (!info) {
+        info = fresh;
+        fresh = NULL;
+        info->ino = ino;
+        info->next = fs->inodes[ino % EXT4_INODE_BUCKETS];
+        fs->inodes[ino % EXT4_INODE_BUCKETS] = info;
+    }
+    
+    // Another reader may have got here first; a hole may also have been
+    // cached from its far side, so stop short of whatever follows
+    if (!ext4_es_find(info->es_root, node->lblk)) {
+        ext4_extent_status_t* next = ext4_es_next(info->es_root, node->lblk);
+        if (next && next->lblk - node->lblk < node->len) {
+            node->len = next->lblk - node->lblk;
+        }
+        info->es_root = ext4_es_insert_node(info->es_root, node);
+        fs->es_count++;
+        node = NULL;
+    }
+    spinlock_release(&fs->lock);
+    
+out:
+    if (node) {
+        flux_free(node);
+    }
+    if (fresh) {
+        flux_free(fresh);
+    }
+    ext4_es_free_list(dropped);
+}
+
+// =============================================================================
+// Extent Tree Operations
+// =============================================================================
+
+// Last entry of a node starting at or before lblk, -1 if lblk comes before
+// all of them. Index and leaf entries are both 12 bytes and lead with
+// their first logical block, so one search serves both.
+static int32_t ext4_ext_search(ext4_extent_header_t* header, uint32_t lblk) {
+    ext4_extent_idx_t* entries = (ext4_extent_idx_t*)(header + 1);
+    int32_t low = 0;
+    int32_t high = (int32_t)header->eh_entries - 1;
+    int32_t found = -1;
+    
+    while (low <= high) {
+        int32_t mid = low + (high - low) / 2;
+        if (entries[mid].ei_block <= lblk) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+// Walk inode's extent tree down to the run containing lblk. On the way the
+// subtree chosen at each level narrows [low, high), which is as far as a
+// hole around lblk can reach.
+static int ext4_ext_find(ext4_filesystem_t* fs, ext4_inode_t* inode, uint32_t lblk,
+                         ext4_extent_status_t* map) {
+    ext4_extent_header_t* header = (ext4_extent_header_t*)inode->i_block;
+    uint32_t capacity = sizeof(inode->i_block);
+    uint32_t depth = header->eh_depth;
+    uint8_t* buffer = NULL;
+    uint64_t low = 0;
+    uint64_t high = (uint64_t)UINT32_MAX + 1;
+    int result = -1;
+    
+    if (depth > EXT4_EXT_MAX_DEPTH) {
         return -1;
     }
     
-    if (ext4_read_block(fs, inode_table + block_offset, buffer) != 0) {
+    for (uint32_t level = 0; level < depth; level++) {
+        if (header->eh_magic != EXT4_EXTENT_MAGIC || header->eh_depth != depth - level ||
+            sizeof(*header) + header->eh_entries * sizeof(ext4_extent_idx_t) > capacity) {
+            goto out;
+        }
+        
+        ext4_extent_idx_t* idx = (ext4_extent_idx_t*)(header + 1);
+        int32_t i = ext4_ext_search(header, lblk);
+        if (i + 1 < header->eh_entries && idx[i + 1].ei_block < high) {
+            high = idx[i + 1].ei_block;
+        }
+        if (i < 0) {
+            goto hole;
+        }
+        if (idx[i].ei_block > low) {
+            low = idx[i].ei_block;
+        }
+        
+        uint64_t child = ((uint64_t)idx[i].ei_leaf_hi << 32) | idx[i].ei_leaf_lo;
+        if (!buffer) {
+            buffer = flux_allocate(NULL, fs->block_size, FLUX_ALLOC_KERNEL);
+            if (!buffer) {
+                goto out;
+            }
+        }
+        if (child == 0 || ext4_read_block(fs, child, buffer) != 0) {
+            goto out;
+        }
+        header = (ext4_extent_header_t*)buffer;
+        capacity = fs->block_size;
+    }
+    
+    if (header->eh_magic != EXT4_EXTENT_MAGIC || header->eh_depth != 0 ||
+        sizeof(*header) + header->eh_entries * sizeof(ext4_extent_t) > capacity) {
+        goto out;
+    }
+    
+    ext4_extent_t* extent = (ext4_extent_t*)(header + 1);
+    int32_t i = ext4_ext_search(header, lblk);
+    if (i + 1 < header->eh_entries && extent[i + 1].ee_block < high) {
+        high = extent[i + 1].ee_block;
+    }
+    if (i >= 0) {
+        uint32_t len = extent[i].ee_len;
+        bool unwritten = len > EXT4_EXT_INIT_MAX_LEN;
+        if (unwritten) {
+            len -= EXT4_EXT_INIT_MAX_LEN;
+        }
+        
+        uint64_t end = (uint64_t)extent[i].ee_block + len;
+        if (lblk < end) {
+            map->lblk = extent[i].ee_block;
+            map->len = len;
+            map->pblk = unwritten ? 0 :
+                ((uint64_t)extent[i].ee_start_hi << 32) | extent[i].ee_start_lo;
+            result = 0;
+            goto out;
+        }
+        low = end;
+    }
+    
+hole:
+    map->lblk = (uint32_t)low;
+    map->len = high - low > UINT32_MAX ? UINT32_MAX : (uint32_t)(high - low);
+    map->pblk = 0;
+    result = 0;
+    
+out:
+    if (buffer) {
         flux_free(buffer);
-        return -1;
+    }
+    return result;
+}
+
+// Map lblk of inode ino to the run containing it
+static int ext4_map_blocks(ext4_filesystem_t* fs, uint32_t ino, ext4_inode_t* inode,
+                           uint32_t lblk, ext4_extent_status_t* map) {
+    if (!fs->has_extents || !(inode->i_flags & EXT4_EXTENTS_FL)) {
+        // Traditional block mapping; indirect blocks - simplified
+        map->lblk = lblk;
+        map->len = 1;
+        map->pblk = lblk < 12 ? inode->i_block[lblk] : 0;
+        return 0;
     }
     
-    memcpy(inode, buffer + block_index, sizeof(ext4_inode_t));
-    flux_free(buffer);
+    if (ext4_es_lookup(fs, ino, lblk, map)) {
+        return 0;
+    }
     
+    if (ext4_ext_find(fs, inode, lblk, map) != 0) {
+        return -1;
+    }
+    ext4_es_insert(fs, ino, map);
     return 0;
 }
 
 // =============================================================================
-// Extent Tree Operations
+// Directory Operations
 // =============================================================================
 
-static uint64_t ext4_extent_to_block(ext4_filesystem_t* fs, ext4_extent_t* extent,
-                                     uint32_t logical_block) {
-    if (logical_block < extent->ee_block ||
-        logical_block >= extent->ee_block + extent->ee_len) {
+// Physical block behind a logical block of inode ino, 0 for a hole or a
+// mapping we can't follow
+static uint64_t ext4_map_block(ext4_filesystem_t* fs, uint32_t ino, ext4_inode_t* inode,
+                               uint32_t logical_block) {
+    ext4_extent_status_t map;
+    if (ext4_map_blocks(fs, ino, inode, logical_block, &map) != 0 || map.pblk == 0) {
         return 0;
     }
-    
-    uint64_t physical = ((uint64_t)extent->ee_start_hi << 32) | extent->ee_start_lo;
-    return physical + (logical_block - extent->ee_block);
+    return map.pblk + (logical_block - map.lblk);
 }
 
-static uint64_t ext4_get_block_from_extent(ext4_filesystem_t* fs, ext4_inode_t* inode,
-                                          uint32_t logical_block) {
-    ext4_extent_header_t* header = (ext4_extent_header_t*)inode->i_block;
+// A directory block, read in place from the device's cache page when it
+// fits in one, otherwise copied into a buffer
+typedef struct {
+    page_cache_page_t* page;
+    uint8_t* buffer;
+    uint8_t* data;
+} ext4_block_ref_t;
+
+static int ext4_get_dir_block(ext4_filesystem_t* fs, uint32_t ino, ext4_inode_t* dir_inode,
+                              uint32_t block_num, ext4_block_ref_t* ref) {
+    ref->page = NULL;
+    ref->buffer = NULL;
     
-    if (header->eh_magic != EXT4_EXTENT_MAGIC) {
-        return 0;
+    uint64_t physical_block = ext4_map_block(fs, ino, dir_inode, block_num);
+    if (physical_block == 0) {
+        return -1;
     }
     
-    if (header->eh_depth == 0) {
-        // Leaf node
-        ext4_extent_t* extent = (ext4_extent_t*)(header + 1);
-        for (int i = 0; i < header->eh_entries; i++) {
-            if (logical_block >= extent[i].ee_block &&
-                logical_block < extent[i].ee_block + extent[i].ee_len) {
-                return ext4_extent_to_block(fs, &extent[i], logical_block);
-            }
+    uint64_t offset = ext4_block_offset(fs, physical_block);
+    if (offset % PAGE_CACHE_PAGE_SIZE + fs->block_size <= PAGE_CACHE_PAGE_SIZE) {
+        ref->page = page_cache_get(fs->device_cache, offset / PAGE_CACHE_PAGE_SIZE);
+        if (!ref->page) {
+            return -1;
         }
-    } else {
-        // Index node - need to traverse tree
-        // Simplified - full implementation would traverse index nodes
+        ref->data = (uint8_t*)ref->page->data + offset % PAGE_CACHE_PAGE_SIZE;
+        return 0;
     }
     
+    ref->buffer = flux_allocate(NULL, fs->block_size, FLUX_ALLOC_KERNEL);
+    if (!ref->buffer || ext4_read_block(fs, physical_block, ref->buffer) != 0) {
+        if (ref->buffer) {
+            flux_free(ref->buffer);
+            ref->buffer = NULL;
+        }
+        return -1;
+    }
+    ref->data = ref->buffer;
     return 0;
 }
 
+static void ext4_put_dir_block(ext4_block_ref_t* ref) {
+    page_cache_put(ref->page);
+    if (ref->buffer) {
+        flux_free(ref->buffer);
+    }
+    ref->page = NULL;
+    ref->buffer = NULL;
+}
+
+// Entry called name in one directory block, NULL if there's none. Stops at
+// the first malformed record.
+static ext4_dir_entry_t* ext4_search_dir_block(ext4_filesystem_t* fs, uint8_t* block,
+                                               const char* name, size_t name_len) {
+    uint32_t offset = 0;
+    while (offset + sizeof(ext4_dir_entry_t) <= fs->block_size) {
+        ext4_dir_entry_t* entry = (ext4_dir_entry_t*)(block + offset);
+        if (entry->rec_len < sizeof(ext4_dir_entry_t) ||
+            entry->rec_len > fs->block_size - offset) {
+            break;
+        }
+        
+        if (entry->inode != 0 && entry->name_len == name_len &&
+            entry->name_len <= entry->rec_len - sizeof(ext4_dir_entry_t) &&
+            memcmp(entry->name, name, name_len) == 0) {
+            return entry;
+        }
+        
+        offset += entry->rec_len;
+    }
+    return NULL;
+}
+
 // =============================================================================
-// Directory Operations
+// Directory Hashing
 // =============================================================================
 
-static int ext4_read_dir_block(ext4_filesystem_t* fs, ext4_inode_t* dir_inode,
-                              uint32_t block_num, void* buffer) {
-    uint64_t physical_block;
+// The name hashes htree directories are sorted by, as ext4 defines them
+
+#define EXT4_DX_HASH_EOF        0x7FFFFFFFU
+
+static uint32_t ext4_dx_hack_hash(const char* name, size_t len, bool is_unsigned) {
+    uint32_t hash0 = 0x12A3FE2D;
+    uint32_t hash1 = 0x37ABE8F9;
+    
+    for (size_t i = 0; i < len; i++) {
+        int c = is_unsigned ? (int)(unsigned char)name[i] : (int)(signed char)name[i];
+        uint32_t hash = hash1 + (hash0 ^ (uint32_t)(c * 7152373));
+        if (hash & 0x80000000) {
+            hash -= 0x7FFFFFFF;
+        }
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+// Pack up to num words of name into buf, padded with its length
+static void ext4_dx_str2hashbuf(const char* name, size_t len, uint32_t* buf, int num,
+                                bool is_unsigned) {
+    uint32_t pad = (uint32_t)len | ((uint32_t)len << 8);
+    pad |= pad << 16;
+    
+    uint32_t val = pad;
+    if (len > (size_t)num * 4) {
+        len = (size_t)num * 4;
+    }
+    for (size_t i = 0; i < len; i++) {
+        int c = is_unsigned ? (int)(unsigned char)name[i] : (int)(signed char)name[i];
+        val = (uint32_t)c + (val << 8);
+        if (i % 4 == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+    if (--num >= 0) {
+        *buf++ = val;
+    }
+    while (--num >= 0) {
+        *buf++ = pad;
+    }
+}
+
+static void ext4_dx_tea_transform(uint32_t buf[4], const uint32_t in[4]) {
+    uint32_t sum = 0;
+    uint32_t b0 = buf[0];
+    uint32_t b1 = buf[1];
+    
+    for (int n = 0; n < 16; n++) {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+        b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+#define EXT4_MD4_F(x, y, z)     ((z) ^ ((x) & ((y) ^ (z))))
+#define EXT4_MD4_G(x, y, z)     (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define EXT4_MD4_H(x, y, z)     ((x) ^ (y) ^ (z))
+#define EXT4_MD4_ROUND(f, a, b, c, d, x, s) \
+    ((a) += f((b), (c), (d)) + (x), (a) = ((a) << (s)) | ((a) >> (32 - (s))))
+#define EXT4_MD4_K2             013240474631U
+#define EXT4_MD4_K3             015666365641U
+
+static void ext4_dx_half_md4_transform(uint32_t buf[4], const uint32_t in[8]) {
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+    
+    EXT4_MD4_ROUND(EXT4_MD4_F, a, b, c, d, in[0], 3);
+    EXT4_MD4_ROUND(EXT4_MD4_F, d, a, b, c, in[1], 7);
+    EXT4_MD4_ROUND(EXT4_MD4_F, c, d, a, b, in[2], 11);
+    EXT4_MD4_ROUND(EXT4_MD4_F, b, c, d, a, in[3], 19);
+    EXT4_MD4_ROUND(EXT4_MD4_F, a, b, c, d, in[4], 3);
+    EXT4_MD4_ROUND(EXT4_MD4_F, d, a, b, c, in[5], 7);
+    EXT4_MD4_ROUND(EXT4_MD4_F, c, d, a, b, in[6], 11);
+    EXT4_MD4_ROUND(EXT4_MD4_F, b, c, d, a, in[7], 19);
+    
+    EXT4_MD4_ROUND(EXT4_MD4_G, a, b, c, d, in[1] + EXT4_MD4_K2, 3);
+    EXT4_MD4_ROUND(EXT4_MD4_G, d, a, b, c, in[3] + EXT4_MD4_K2, 5);
+    EXT4_MD4_ROUND(EXT4_MD4_G, c, d, a, b, in[5] + EXT4_MD4_K2, 9);
+    EXT4_MD4_ROUND(EXT4_MD4_G, b, c, d, a, in[7] + EXT4_MD4_K2, 13);
+    EXT4_MD4_ROUND(EXT4_MD4_G, a, b, c, d, in[0] + EXT4_MD4_K2, 3);
+    EXT4_MD4_ROUND(EXT4_MD4_G, d, a, b, c, in[2] + EXT4_MD4_K2, 5);
+    EXT4_MD4_ROUND(EXT4_MD4_G, c, d, a, b, in[4] + EXT4_MD4_K2, 9);
+    EXT4_MD4_ROUND(EXT4_MD4_G, b, c, d, a, in[6] + EXT4_MD4_K2, 13);
+    
+    EXT4_MD4_ROUND(EXT4_MD4_H, a, b, c, d, in[3] + EXT4_MD4_K3, 3);
+    EXT4_MD4_ROUND(EXT4_MD4_H, d, a, b, c, in[7] + EXT4_MD4_K3, 9);
+    EXT4_MD4_ROUND(EXT4_MD4_H, c, d, a, b, in[2] + EXT4_MD4_K3, 11);
+    EXT4_MD4_ROUND(EXT4_MD4_H, b, c, d, a, in[6] + EXT4_MD4_K3, 15);
+    EXT4_MD4_ROUND(EXT4_MD4_H, a, b, c, d, in[1] + EXT4_MD4_K3, 3);
+    EXT4_MD4_ROUND(EXT4_MD4_H, d, a, b, c, in[5] + EXT4_MD4_K3, 9);
+    EXT4_MD4_ROUND(EXT4_MD4_H, c, d, a, b, in[0] + EXT4_MD4_K3, 11);
+    EXT4_MD4_ROUND(EXT4_MD4_H, b, c, d, a, in[4] + EXT4_MD4_K3, 15);
+    
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+// Major hash of name with version, seeded from the superblock. Returns -1
+// for a version we don't know.
+static int ext4_dx_hash(ext4_filesystem_t* fs, uint32_t version, const char* name,
+                        size_t len, uint32_t* result) {
+    uint32_t buf[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+    uint32_t seed[4];
+    memcpy(seed, fs->superblock.s_hash_seed, sizeof(seed));
+    if (seed[0] || seed[1] || seed[2] || seed[3]) {
+        memcpy(buf, seed, sizeof(buf));
+    }
     
-    if (fs->has_extents && (dir_inode->i_flags & EXT4_EXTENTS_FL)) {
-        physical_block = ext4_get_block_from_extent(fs, dir_inode, block_num);
-    } else {
-        // Traditional block mapping
-        if (block_num < 12) {
-            physical_block = dir_inode->i_block[block_num];
-        } else {
-            // Indirect blocks - simplified
+    bool is_unsigned = version >= EXT4_DX_HASH_LEGACY_UNSIGNED;
+    uint32_t in[8];
+    uint32_t hash;
+    
+    switch (version) {
+        case EXT4_DX_HASH_LEGACY:
+        case EXT4_DX_HASH_LEGACY_UNSIGNED:
+            hash = ext4_dx_hack_hash(name, len, is_unsigned);
+            break;
+        
+        case EXT4_DX_HASH_HALF_MD4:
+        case EXT4_DX_HASH_HALF_MD4_UNSIGNED:
+            for (size_t done = 0; done < len; done += 32) {
+                ext4_dx_str2hashbuf(name + done, len - done, in, 8, is_unsigned);
+                ext4_dx_half_md4_transform(buf, in);
+            }
+            hash = buf[1];
+            break;
+        
+        case EXT4_DX_HASH_TEA:
+        case EXT4_DX_HASH_TEA_UNSIGNED:
+            for (size_t done = 0; done < len; done += 16) {
+                ext4_dx_str2hashbuf(name + done, len - done, in, 4, is_unsigned);
+                ext4_dx_tea_transform(buf, in);
+            }
+            hash = buf[0];
+            break;
+        
+        default:
             return -1;
+    }
+    
+    // The low bit marks hash collisions in index entries
+    hash &= ~1U;
+    if (hash == EXT4_DX_HASH_EOF << 1) {
+        hash = (EXT4_DX_HASH_EOF - 1) << 1;
+    }
+    *result = hash;
+    return 0;
+}
+
+// =============================================================================
+// Directory Lookup
+// =============================================================================
+
+// Last index entry whose hash is at or below hash; entry 0 covers
+// everything below entry 1
+static ext4_dx_entry_t* ext4_dx_search(ext4_dx_entry_t* entries, uint32_t count, uint32_t hash) {
+    ext4_dx_entry_t* low = entries + 1;
+    ext4_dx_entry_t* high = entries + count - 1;
+    while (low <= high) {
+        ext4_dx_entry_t* mid = low + (high - low) / 2;
+        if (mid->hash > hash) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
         }
     }
+    return low - 1;
+}
+
+// Look name up through the directory's hash index: descend from the root
+// to the leaf the name hashes into and search only that, plus any leaves
+// after it that the same hash continues into. Returns 1 with the entry and
+// its block held in ref, 0 if the name isn't there, or -1 if the index
+// can't answer and the directory has to be scanned.
+static int ext4_dx_find_entry(ext4_filesystem_t* fs, uint32_t ino, ext4_inode_t* dir_inode,
+                              const char* name, size_t name_len, ext4_block_ref_t* ref,
+                              ext4_dir_entry_t** found) {
+    if (ext4_get_dir_block(fs, ino, dir_inode, 0, ref) != 0) {
+        return -1;
+    }
     
-    if (physical_block == 0) {
+    // Past the "." entry and the head of ".."
+    ext4_dx_root_info_t* info = (ext4_dx_root_info_t*)(ref->data + 24);
+    uint32_t version = info->hash_version;
+    if (version <= EXT4_DX_HASH_TEA && (fs->superblock.s_flags & EXT4_FLAGS_UNSIGNED_HASH)) {
+        version += EXT4_DX_HASH_LEGACY_UNSIGNED;
+    }
+    
+    uint32_t hash;
+    uint32_t levels = info->indirect_levels;
+    if (info->reserved_zero != 0 || levels >= EXT4_DX_MAX_LEVELS ||
+        24 + info->info_length + sizeof(ext4_dx_entry_t) > fs->block_size ||
+        ext4_dx_hash(fs, version, name, name_len, &hash) != 0) {
+        ext4_put_dir_block(ref);
         return -1;
     }
     
-    return ext4_read_block(fs, physical_block, buffer);
+    ext4_dx_entry_t* entries = (ext4_dx_entry_t*)((uint8_t*)info + info->info_length);
+    uint32_t space = fs->block_size - (uint32_t)((uint8_t*)entries - ref->data);
+    bool has_next = false;      // Where the subtree after this one starts
+    uint32_t next_hash = 0;
+    
+    for (uint32_t level = 0; ; level++) {
+        ext4_dx_countlimit_t* countlimit = (ext4_dx_countlimit_t*)entries;
+        uint32_t count = countlimit->count;
+        if (count == 0 || count > countlimit->limit ||
+            count * sizeof(ext4_dx_entry_t) > space) {
+            ext4_put_dir_block(ref);
+            return -1;
+        }
+        
+        ext4_dx_entry_t* at = ext4_dx_search(entries, count, hash);
+        ext4_dx_entry_t* end = entries + count;
+        
+        if (level < levels) {
+            if (at + 1 < end) {
+                has_next = true;
+                next_hash = at[1].hash;
+            }
+            
+            // Index nodes open with one empty entry covering the block
+            uint32_t block = at->block & 0x0FFFFFFF;
+            ext4_put_dir_block(ref);
+            if (ext4_get_dir_block(fs, ino, dir_inode, block, ref) != 0) {
+                return -1;
+            }
+            entries = (ext4_dx_entry_t*)(ref->data + 8);
+            space = fs->block_size - 8;
+            continue;
+        }
+        
+        // Collect the leaves before letting go of the index block
+        uint32_t leaves[EXT4_DX_MAX_CHAIN];
+        uint32_t leaf_count = 0;
+        ext4_dx_entry_t* entry = at;
+        do {
+            leaves[leaf_count++] = entry->block & 0x0FFFFFFF;
+            entry++;
+        } while (entry < end && leaf_count < EXT4_DX_MAX_CHAIN &&
+                 (entry->hash & ~1U) == hash);
+        bool beyond = entry < end ? (entry->hash & ~1U) == hash :
+                                    has_next && (next_hash & ~1U) == hash;
+        ext4_put_dir_block(ref);
+        
+        for (uint32_t i = 0; i < leaf_count; i++) {
+            if (ext4_get_dir_block(fs, ino, dir_inode, leaves[i], ref) != 0) {
+                return -1;
+            }
+            *found = ext4_search_dir_block(fs, ref->data, name, name_len);
+            if (*found) {
+                return 1;
+            }
+            ext4_put_dir_block(ref);
+        }
+        
+        // Rare: the hash runs on past what we collected
+        return beyond ? -1 : 0;
+    }
 }
 
-static ext4_dir_entry_t* ext4_find_dir_entry(ext4_filesystem_t* fs, ext4_inode_t* dir_inode,
-                                            const char* name) {
-    uint8_t* buffer = flux_allocate(NULL, fs->block_size, FLUX_ALLOC_KERNEL);
-    if (!buffer) {
-        return NULL;
+// Entry called name (name_len bytes, not terminated) in the directory,
+// pointing into its block, which is held in ref until ext4_put_dir_block.
+// Indexed directories are looked up by hash; the rest, and any index we
+// can't follow, are scanned.
+static ext4_dir_entry_t* ext4_find_dir_entry(ext4_filesystem_t* fs, uint32_t ino,
+                                            ext4_inode_t* dir_inode, const char* name,
+                                            size_t name_len, ext4_block_ref_t* ref) {
+    ext4_dir_entry_t* entry = NULL;
+    
+    if (fs->has_dir_index && (dir_inode->i_flags & EXT4_INDEX_FL)) {
+        int result = ext4_dx_find_entry(fs, ino, dir_inode, name, name_len, ref, &entry);
+        if (result >= 0) {
+            return entry;
+        }
     }
     
     uint32_t size = dir_inode->i_size_lo;
     uint32_t blocks = (size + fs->block_size - 1) / fs->block_size;
     
     for (uint32_t i = 0; i < blocks; i++) {
-        if (ext4_read_dir_block(fs, dir_inode, i, buffer) != 0) {
+        if (ext4_get_dir_block(fs, ino, dir_inode, i, ref) != 0) {
             continue;
         }
         
-        uint32_t offset = 0;
-        while (offset < fs->block_size) {
-            ext4_dir_entry_t* entry = (ext4_dir_entry_t*)(buffer + offset);
-            
-            if (entry->rec_len == 0) {
-                break;
-            }
-            
-            if (entry->name_len == strlen(name) &&
-                memcmp(entry->name, name, entry->name_len) == 0) {
-                // Found entry - allocate and return copy
-                ext4_dir_entry_t* result = flux_allocate(NULL, entry->rec_len,
-                                                        FLUX_ALLOC_KERNEL);
-                if (result) {
-                    memcpy(result, entry, entry->rec_len);
-                }
-                flux_free(buffer);
-                return result;
-            }
-            
-            offset += entry->rec_len;
+        entry = ext4_search_dir_block(fs, ref->data, name, name_len);
+        if (entry) {
+            return entry;
         }
+        ext4_put_dir_block(ref);
     }
     
-    flux_free(buffer);
     return NULL;
 }
 
@@ -282,48 +912,47 @@ static uint32_t ext4_path_to_inode(ext4_filesystem_t* fs, const char* path) {
         return 0;
     }
     
+    // One component at a time, in place. Callers going through manifold
+    // only get here for what its dentry cache couldn't answer.
     uint32_t current_inode = EXT4_ROOT_INO;
+    size_t pos = 0;
     
-    if (path[1] == '\0') {
-        return current_inode;  // Root directory
-    }
-    
-    char* path_copy = flux_allocate(NULL, strlen(path) + 1, FLUX_ALLOC_KERNEL);
-    if (!path_copy) {
-        return 0;
-    }
-    strcpy(path_copy, path);
-    
-    char* token = strtok(path_copy + 1, "/");
-    
-    while (token) {
+    while (path[pos] != '\0') {
+        if (path[pos] == '/') {
+            pos++;
+            continue;
+        }
+        
+        const char* name = path + pos;
+        size_t name_len = 0;
+        while (name[name_len] != '\0' && name[name_len] != '/') {
+            name_len++;
+        }
+        pos += name_len;
+        
         // Read current inode
         ext4_inode_t inode;
         if (ext4_read_inode(fs, current_inode, &inode) != 0) {
-            flux_free(path_copy);
             return 0;
         }
         
         // Check if directory
         if ((inode.i_mode & EXT4_S_IFMT) != EXT4_S_IFDIR) {
-            flux_free(path_copy);
             return 0;
         }
         
         // Find entry in directory
-        ext4_dir_entry_t* entry = ext4_find_dir_entry(fs, &inode, token);
+        ext4_block_ref_t ref;
+        ext4_dir_entry_t* entry = ext4_find_dir_entry(fs, current_inode, &inode, name, name_len,
+                                                      &ref);
         if (!entry) {
-            flux_free(path_copy);
             return 0;
         }
         
         current_inode = entry->inode;
-        flux_free(entry);
-        
-        token = strtok(NULL, "/");
+        ext4_put_dir_block(&ref);
     }
     
-    flux_free(path_copy);
     return current_inode;
 }
 
@@ -331,8 +960,223 @@ static uint32_t ext4_path_to_inode(ext4_filesystem_t* fs, const char* path) {
 // File Operations
 // =============================================================================
 
-int ext4_read_file(ext4_filesystem_t* fs, const char* path, void* buffer, 
-                  size_t offset, size_t length) {
+uint64_t ext4_file_size(ext4_filesystem_t* fs, ext4_inode_t* inode) {
+    uint64_t file_size = inode->i_size_lo;
+    if (fs->has_huge_files) {
+        file_size |= ((uint64_t)inode->i_size_high << 32);
+    }
+    return file_size;
+}
+
+// Lay out page index of inode ino: zero holes and anything past end of
+// file, and describe the device reads for the rest as bios, one per run of
+// contiguous blocks (so at most EXT4_PAGE_BIOS). map carries the last run
+// from one page to the next; its len is 0 to start. A block larger than a
+// page is only partly read. Returns the bio count, or -1 if the extent tree
+// couldn't be read.
+static int ext4_map_page(ext4_filesystem_t* fs, uint32_t ino, ext4_inode_t* inode,
+                         uint64_t index, void* data, block_bio_t* bios,
+                         ext4_extent_status_t* map) {
+    uint64_t start = index * PAGE_CACHE_PAGE_SIZE;
+    uint64_t file_size = ext4_file_size(fs, inode);
+    uint64_t end = start + PAGE_CACHE_PAGE_SIZE;
+    if (end > file_size) {
+        memset(data, 0, PAGE_CACHE_PAGE_SIZE);
+        end = file_size > start ? file_size : start;
+    }
+    
+    int count = 0;
+    uint8_t* dest = (uint8_t*)data;
+    for (uint64_t pos = start; pos < end; ) {
+        uint64_t block = pos / fs->block_size;
+        if (!ext4_es_covers(map, block) &&
+            ext4_map_blocks(fs, ino, inode, (uint32_t)block, map) != 0) {
+            return -1;
+        }
+        
+        // As much of the run as the page holds
+        uint64_t run_end = ((uint64_t)map->lblk + map->len) * fs->block_size;
+        uint64_t bytes = (run_end < end ? run_end : end) - pos;
+        uint8_t* out = dest + (pos - start);
+        if (map->pblk == 0) {
+            memset(out, 0, bytes);
+        } else {
+            uint64_t physical_block = map->pblk + (block - map->lblk);
+            bios[count++] = (block_bio_t){
+                .sector = fs->partition_start +
+                    (physical_block * fs->block_size + pos % fs->block_size) / BLOCK_SECTOR_SIZE,
+                // Whole sectors, even for a tail that stops mid-sector
+                .count = (uint32_t)((bytes + BLOCK_SECTOR_SIZE - 1) / BLOCK_SECTOR_SIZE),
+                .write = false,
+                .buffer = out
+            };
+        }
+        
+        pos += bytes;
+    }
+    return count;
+}
+
+// Fill page index of the file whose inode number is the mapping key. On a
+// block layer device its blocks go out as bios under one plug, straight
+// into the page.
+static int ext4_read_page(page_cache_mapping_t* mapping, uint64_t index, void* data) {
+    ext4_filesystem_t* fs = (ext4_filesystem_t*)mapping->private_data;
+    
+    ext4_inode_t inode;
+    if (ext4_read_inode(fs, (uint32_t)mapping->key, &inode) != 0) {
+        return -1;
+    }
+    
+    block_bio_t bios[EXT4_PAGE_BIOS];
+    ext4_extent_status_t map = { 0 };
+    int count = ext4_map_page(fs, (uint32_t)mapping->key, &inode, index, data, bios, &map);
+    if (count < 0) {
+        return -1;
+    }
+    
+    block_queue_t* queue = fs->block_device->queue;
+    if (!queue) {
+        for (int i = 0; i < count; i++) {
+            if (fs->block_device->read(fs->block_device, bios[i].sector, bios[i].count,
+                                       bios[i].buffer) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    
+    block_plug_t plug;
+    block_wait_t wait;
+    block_start_plug(&plug, queue);
+    block_wait_init(&wait);
+    for (int i = 0; i < count; i++) {
+        block_wait_add(&wait, &bios[i]);
+        block_submit(queue, &bios[i], &plug);
+    }
+    block_finish_plug(&plug);
+    return block_wait(queue, &wait);
+}
+
+// Readahead: every page of the batch goes out under one plug and is ended
+// from its last bio's completion; whoever ends the last page frees the batch
+typedef struct ext4_readahead ext4_readahead_t;
+
+typedef struct {
+    ext4_readahead_t* batch;
+    page_cache_page_t* page;
+    uint32_t pending;           // Bios in flight, plus one while submitting
+    int status;
+    block_bio_t bios[EXT4_PAGE_BIOS];
+} ext4_readahead_page_t;
+
+struct ext4_readahead {
+    uint32_t pages_left;
+    ext4_readahead_page_t pages[];
+};
+
+static void ext4_readahead_put(ext4_readahead_page_t* slot) {
+    if (__atomic_sub_fetch(&slot->pending, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    
+    ext4_readahead_t* batch = slot->batch;
+    page_cache_end_read(slot->page, slot->status);
+    if (__atomic_sub_fetch(&batch->pages_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        flux_free(batch);
+    }
+}
+
+static void ext4_readahead_end_io(block_bio_t* bio, int status) {
+    ext4_readahead_page_t* slot = (ext4_readahead_page_t*)bio->private_data;
+    if (status != 0) {
+        slot->status = -1;
+    }
+    ext4_readahead_put(slot);
+}
+
+static int ext4_read_pages(page_cache_mapping_t* mapping, page_cache_page_t** pages,
+                           uint32_t count) {
+    ext4_filesystem_t* fs = (ext4_filesystem_t*)mapping->private_data;
+    block_queue_t* queue = fs->block_device->queue;
+    
+    // Without a block layer queue there's nothing to overlap with; read
+    // the batch now
+    if (!queue) {
+        for (uint32_t i = 0; i < count; i++) {
+            page_cache_end_read(pages[i], ext4_read_page(mapping, pages[i]->index,
+                                                         pages[i]->data));
+        }
+        return 0;
+    }
+    
+    ext4_inode_t inode;
+    if (ext4_read_inode(fs, (uint32_t)mapping->key, &inode) != 0) {
+        return -1;
+    }
+    
+    ext4_readahead_t* batch = flux_allocate(NULL, sizeof(ext4_readahead_t) +
+                                            count * sizeof(ext4_readahead_page_t),
+                                            FLUX_ALLOC_KERNEL);
+    if (!batch) {
+        return -1;
+    }
+    batch->pages_left = count;
+    
+    // One run carries over from page to page, so a contiguous file costs
+    // one extent lookup per run and its bios merge into large requests
+    ext4_extent_status_t map = { 0 };
+    block_plug_t plug;
+    block_start_plug(&plug, queue);
+    for (uint32_t i = 0; i < count; i++) {
+        ext4_readahead_page_t* slot = &batch->pages[i];
+        slot->batch = batch;
+        slot->page = pages[i];
+        slot->pending = 1;
+        slot->status = 0;
+        
+        int bios = ext4_map_page(fs, (uint32_t)mapping->key, &inode, pages[i]->index,
+                                 pages[i]->data, slot->bios, &map);
+        if (bios < 0) {
+            slot->status = -1;
+        }
+        for (int b = 0; b < bios; b++) {
+            slot->bios[b].end_io = ext4_readahead_end_io;
+            slot->bios[b].private_data = slot;
+            __atomic_add_fetch(&slot->pending, 1, __ATOMIC_RELAXED);
+            block_submit(queue, &slot->bios[b], &plug);
+        }
+        
+        // The batch may be gone once the last page is put
+        ext4_readahead_put(slot);
+    }
+    block_finish_plug(&plug);
+    return 0;
+}
+
+static const page_cache_ops_t g_ext4_file_ops = {
+    .read_page = ext4_read_page,
+    .write_page = NULL,         // Read-only for now
+    .read_pages = ext4_read_pages
+};
+
+// The page cache mapping behind a regular file's data, sized from its inode
+page_cache_mapping_t* ext4_file_cache(ext4_filesystem_t* fs, uint32_t ino, ext4_inode_t* inode) {
+    page_cache_mapping_t* mapping = page_cache_get_mapping(fs, ino, &g_ext4_file_ops, fs);
+    if (mapping) {
+        mapping->size = ext4_file_size(fs, inode);
+    }
+    return mapping;
+}
+
+// Read into several buffers in turn, resolving the path and sizing the file
+// once for all of them. ra is the reader's readahead state, NULL to share
+// the file's.
+int ext4_readv(ext4_filesystem_t* fs, const char* path, const page_cache_iovec_t* iov,
+               uint32_t count, size_t offset, page_cache_ra_t* ra) {
+    page_cache_iter_t iter;
+    size_t length = page_cache_iter_init(&iter, iov, count);
+    
     // Get inode number
     uint32_t inode_num = ext4_path_to_inode(fs, path);
     if (inode_num == 0) {
@@ -350,12 +1194,7 @@ int ext4_read_file(ext4_filesystem_t* fs, const char* path, void* buffer,
         return -1;
     }
     
-    // Get file size
-    uint64_t file_size = inode.i_size_lo;
-    if (fs->has_huge_files) {
-        file_size |= ((uint64_t)inode.i_size_high << 32);
-    }
-    
+    uint64_t file_size = ext4_file_size(fs, &inode);
     if (offset >= file_size) {
         return 0;
     }
@@ -364,58 +1203,58 @@ int ext4_read_file(ext4_filesystem_t* fs, const char* path, void* buffer,
         length = file_size - offset;
     }
     
-    // Read data blocks
-    uint32_t start_block = offset / fs->block_size;
-    uint32_t end_block = (offset + length - 1) / fs->block_size;
-    uint32_t block_offset = offset % fs->block_size;
-    
-    uint8_t* block_buffer = flux_allocate(NULL, fs->block_size, FLUX_ALLOC_KERNEL);
-    if (!block_buffer) {
+    // File data is cached per inode, so repeated reads stay in memory, and
+    // sequential readers find the next pages already on their way
+    page_cache_mapping_t* mapping = ext4_file_cache(fs, inode_num, &inode);
+    if (!mapping) {
+        return -1;
+    }
+    if (page_cache_readv(mapping, ra, offset, &iter, length) != 0) {
         return -1;
     }
     
-    size_t bytes_read = 0;
-    uint8_t* dest = (uint8_t*)buffer;
+    return (int)length;
+}
+
+int ext4_read_file(ext4_filesystem_t* fs, const char* path, void* buffer, 
+                  size_t offset, size_t length) {
+    page_cache_iovec_t iov = { buffer, length };
+    return ext4_readv(fs, path, &iov, 1, offset, NULL);
+}
+
+// Map part of a file into a domain straight from its cached pages. The
+// file has no write_page yet, so only read-only and private mappings work.
+// Unmap before unmounting.
+page_cache_vma_t* ext4_mmap(ext4_filesystem_t* fs, const char* path,
+                            struct memory_domain* domain, uint64_t vaddr, uint64_t offset,
+                            size_t length, uint32_t flags) {
+    uint32_t inode_num = ext4_path_to_inode(fs, path);
+    if (inode_num == 0) {
+        return NULL;
+    }
+    
+    ext4_inode_t inode;
+    if (ext4_read_inode(fs, inode_num, &inode) != 0) {
+        return NULL;
+    }
+    if ((inode.i_mode & EXT4_S_IFMT) != EXT4_S_IFREG) {
+        return NULL;
+    }
     
-    for (uint32_t block = start_block; block <= end_block; block++) {
-        uint64_t physical_block;
-        
-        if (fs->has_extents && (inode.i_flags & EXT4_EXTENTS_FL)) {
-            physical_block = ext4_get_block_from_extent(fs, &inode, block);
-        } else {
-            if (block < 12) {
-                physical_block = inode.i_block[block];
-            } else {
-                // Indirect blocks - simplified
-                flux_free(block_buffer);
-                return bytes_read;
-            }
-        }
-        
-        if (physical_block == 0) {
-            // Sparse file
-            memset(block_buffer, 0, fs->block_size);
-        } else {
-            if (ext4_read_block(fs, physical_block, block_buffer) != 0) {
-                flux_free(block_buffer);
-                return -1;
-            }
-        }
-        
-        // Copy data
-        size_t copy_offset = (block == start_block) ? block_offset : 0;
-        size_t copy_size = fs->block_size - copy_offset;
-        
-        if (bytes_read + copy_size > length) {
-            copy_size = length - bytes_read;
-        }
-        
-        memcpy(dest + bytes_read, block_buffer + copy_offset, copy_size);
-        bytes_read += copy_size;
+    page_cache_mapping_t* mapping = ext4_file_cache(fs, inode_num, &inode);
+    if (!mapping) {
+        return NULL;
     }
     
-    flux_free(block_buffer);
-    return bytes_read;
+    return page_cache_mmap(mapping, domain, vaddr, offset, length, flags);
+}
+
+uint32_t ext4_get_file_info(ext4_filesystem_t* fs, const char* path, ext4_inode_t* inode) {
+    uint32_t inode_num = ext4_path_to_inode(fs, path);
+    if (inode_num == 0 || ext4_read_inode(fs, inode_num, inode) != 0) {
+        return 0;
+    }
+    return inode_num;
 }
 
 // =============================================================================
@@ -440,19 +1279,16 @@ int ext4_list_directory(ext4_filesystem_t* fs, const char* path,
         return -1;
     }
     
-    uint8_t* buffer = flux_allocate(NULL, fs->block_size, FLUX_ALLOC_KERNEL);
-    if (!buffer) {
-        return -1;
-    }
-    
     uint32_t size = inode.i_size_lo;
     uint32_t blocks = (size + fs->block_size - 1) / fs->block_size;
     size_t entry_count = 0;
     
     for (uint32_t i = 0; i < blocks && entry_count < max_entries; i++) {
-        if (ext4_read_dir_block(fs, &inode, i, buffer) != 0) {
+        ext4_block_ref_t ref;
+        if (ext4_get_dir_block(fs, inode_num, &inode, i, &ref) != 0) {
             continue;
         }
+        uint8_t* buffer = ref.data;
         
         uint32_t offset = 0;
         while (offset < fs->block_size && entry_count < max_entries) {
@@ -474,9 +1310,9 @@ int ext4_list_directory(ext4_filesystem_t* fs, const char* path,
             
             offset += entry->rec_len;
         }
+        ext4_put_dir_block(&ref);
     }
     
-    flux_free(buffer);
     return entry_count;
 }
 
@@ -493,10 +1329,16 @@ ext4_filesystem_t* ext4_mount(block_device_t* device, uint64_t partition_start,
     }
     
     fs->block_device = device;
+    fs->device_cache = page_cache_device(device);
     fs->partition_start = partition_start;
     fs->readonly = readonly;
     spinlock_init(&fs->lock);
     
+    if (!fs->device_cache) {
+        flux_free(fs);
+        return NULL;
+    }
+    
     // Read superblock
     if (ext4_read_superblock(fs) != 0) {
         flux_free(fs);
@@ -532,6 +1374,11 @@ void ext4_unmount(ext4_filesystem_t* fs) {
     }
     spinlock_release(&g_ext4_lock);
     
+    // Drop this filesystem's file pages and flush its metadata
+    page_cache_drop_owner(fs);
+    page_cache_sync(fs->device_cache);
+    ext4_es_free_list(ext4_es_detach(fs));
+    
     // Free resources
     if (fs->group_descs) {
         flux_free(fs->group_descs);
@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "../resonance.h"
+#include "../storage/block.h"
 
 // =============================================================================
 // EXT4 Constants
@@ -20,7 +21,25 @@
 #define EXT4_ROOT_INO          2
 #define EXT4_EXTENT_MAGIC      0xF30A
 
+// Extent trees
+#define EXT4_EXT_MAX_DEPTH     5
+#define EXT4_EXT_INIT_MAX_LEN  32768   // Longer ee_len values are unwritten extents
+#define EXT4_INODE_BUCKETS     64      // Extent status cache, per filesystem
+#define EXT4_ES_MAX_CACHED     8192    // Extent status entries before the cache is reset
+
+// Hashed directory indexes
+#define EXT4_DX_MAX_LEVELS     3       // Index levels below the root, with largedir
+#define EXT4_DX_MAX_CHAIN      4       // Leaves one hash is followed across
+#define EXT4_DX_HASH_LEGACY             0
+#define EXT4_DX_HASH_HALF_MD4           1
+#define EXT4_DX_HASH_TEA                2
+#define EXT4_DX_HASH_LEGACY_UNSIGNED    3
+#define EXT4_DX_HASH_HALF_MD4_UNSIGNED  4
+#define EXT4_DX_HASH_TEA_UNSIGNED       5
+
 // Filesystem Features
+#define EXT4_FEATURE_COMPAT_DIR_INDEX       0x0020
+
 #define EXT4_FEATURE_INCOMPAT_COMPRESSION   0x0001
 #define EXT4_FEATURE_INCOMPAT_FILETYPE      0x0002
 #define EXT4_FEATURE_INCOMPAT_RECOVER       0x0004
@@ -50,6 +69,10 @@
 #define EXT4_FEATURE_RO_COMPAT_READONLY     0x1000
 #define EXT4_FEATURE_RO_COMPAT_PROJECT      0x2000
 
+// Superblock Flags
+#define EXT4_FLAGS_SIGNED_HASH     0x0001
+#define EXT4_FLAGS_UNSIGNED_HASH   0x0002
+
 // File Types
 #define EXT4_FT_UNKNOWN        0
 #define EXT4_FT_REG_FILE       1
@@ -287,12 +310,47 @@ typedef struct __attribute__((packed)) {
     uint16_t ei_unused;
 } ext4_extent_idx_t;
 
-// Block Device Interface
-typedef struct {
-    int (*read)(void* device, uint64_t lba, uint32_t sectors, void* buffer);
-    int (*write)(void* device, uint64_t lba, uint32_t sectors, void* buffer);
-    void* device_data;
-} block_device_t;
+// Hashed directory index (htree). Block 0 of an indexed directory opens
+// with "." and ".." entries, the second spanning the rest of the block;
+// the root info and first index level sit inside it. Lower index nodes are
+// blocks holding one empty entry that covers them.
+typedef struct __attribute__((packed)) {
+    uint32_t reserved_zero;
+    uint8_t  hash_version;
+    uint8_t  info_length;      // 8
+    uint8_t  indirect_levels;
+    uint8_t  unused_flags;
+} ext4_dx_root_info_t;
+
+// Index entry; in the first one of each node, limit and count take the
+// place of hash
+typedef struct __attribute__((packed)) {
+    uint32_t hash;
+    uint32_t block;
+} ext4_dx_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t limit;
+    uint16_t count;
+} ext4_dx_countlimit_t;
+
+// Extent status: a run of logical blocks and where it lives, cached per
+// inode in an AVL tree keyed by lblk. pblk is 0 for a hole or an unwritten
+// extent, both of which read as zeroes.
+typedef struct ext4_extent_status {
+    uint32_t lblk;
+    uint32_t len;
+    uint64_t pblk;
+    struct ext4_extent_status* left;
+    struct ext4_extent_status* right;
+    int32_t height;
+} ext4_extent_status_t;
+
+typedef struct ext4_inode_info {
+    uint32_t ino;
+    ext4_extent_status_t* es_root;
+    struct ext4_inode_info* next;
+} ext4_inode_info_t;
 
 // Directory List Entry
 typedef struct {
@@ -305,6 +363,7 @@ typedef struct {
 // EXT4 Filesystem
 typedef struct {
     block_device_t* block_device;
+    struct page_cache_mapping* device_cache;    // Metadata blocks
     uint64_t partition_start;
     bool readonly;
     
@@ -322,11 +381,15 @@ typedef struct {
     bool has_64bit;
     bool has_extents;
     bool has_huge_files;
+    bool has_dir_index;
     
     // Group descriptors
     ext4_group_desc_t* group_descs;
     
-    // Cache (simplified)
+    // Extent status cache; under lock
+    ext4_inode_info_t* inodes[EXT4_INODE_BUCKETS];
+    uint32_t es_count;
+    
     spinlock_t lock;
 } ext4_filesystem_t;
 
@@ -334,14 +397,28 @@ typedef struct {
 // Function Prototypes
 // =============================================================================
 
+struct page_cache_iovec;
+struct page_cache_ra;
+struct page_cache_mapping;
+struct page_cache_vma;
+struct memory_domain;
+
 ext4_filesystem_t* ext4_mount(block_device_t* device, uint64_t partition_start,
                               bool readonly);
 void ext4_unmount(ext4_filesystem_t* fs);
 
 int ext4_read_file(ext4_filesystem_t* fs, const char* path, void* buffer,
                   size_t offset, size_t length);
+int ext4_readv(ext4_filesystem_t* fs, const char* path, const struct page_cache_iovec* iov,
+               uint32_t count, size_t offset, struct page_cache_ra* ra);
 int ext4_write_file(ext4_filesystem_t* fs, const char* path, void* buffer,
                    size_t offset, size_t length);
+struct page_cache_vma* ext4_mmap(ext4_filesystem_t* fs, const char* path,
+                                 struct memory_domain* domain, uint64_t vaddr,
+                                 uint64_t offset, size_t length, uint32_t flags);
+struct page_cache_mapping* ext4_file_cache(ext4_filesystem_t* fs, uint32_t ino,
+                                           ext4_inode_t* inode);
+uint64_t ext4_file_size(ext4_filesystem_t* fs, ext4_inode_t* inode);
 
 int ext4_list_directory(ext4_filesystem_t* fs, const char* path,
                        ext4_dir_list_t* list, size_t max_entries);
@@ -350,7 +427,8 @@ int ext4_create_directory(ext4_filesystem_t* fs, const char* path);
 int ext4_delete_file(ext4_filesystem_t* fs, const char* path);
 int ext4_rename(ext4_filesystem_t* fs, const char* old_path, const char* new_path);
 
-int ext4_get_file_info(ext4_filesystem_t* fs, const char* path, ext4_inode_t* inode);
+// Read path's inode into inode; returns its number, 0 if there's none
+uint32_t ext4_get_file_info(ext4_filesystem_t* fs, const char* path, ext4_inode_t* inode);
 int ext4_set_file_attributes(ext4_filesystem_t* fs, const char* path, uint32_t flags);
 
 // Helper functions
@@ -5,6 +5,7 @@
 
 #include "fat32.h"
 #include "../resonance.h"
+#include "../storage/page_cache.h"
 #include "../../flux_memory.h"
 
 // =============================================================================
@@ -19,82 +20,388 @@ static spinlock_t g_fat32_lock = SPINLOCK_INIT;
 // Cluster Operations
 // =============================================================================
 
-static uint32_t fat32_get_next_cluster(fat32_filesystem_t* fs, uint32_t cluster) {
-    uint32_t fat_offset = cluster * 4;
-    uint32_t fat_sector = fs->fat_start_lba + (fat_offset / fs->bytes_per_sector);
-    uint32_t fat_entry_offset = fat_offset % fs->bytes_per_sector;
-    
-    uint8_t* buffer = flux_allocate(NULL, fs->bytes_per_sector, FLUX_ALLOC_KERNEL);
-    if (!buffer) {
-        return 0;
+// Byte position of cluster's FAT entry on the device. The FAT, like
+// everything else here, is read through the device's page cache mapping:
+// it's paged in as it's used and dirty sectors go back through writeback.
+static uint64_t fat32_entry_offset(fat32_filesystem_t* fs, uint32_t cluster) {
+    uint64_t fat_offset = (uint64_t)cluster * 4;
+    uint64_t fat_sector = fs->fat_start_lba + (fat_offset / fs->bytes_per_sector);
+    return fat_sector * BLOCK_SECTOR_SIZE + fat_offset % fs->bytes_per_sector;
+}
+
+static inline bool fat32_cluster_valid(fat32_filesystem_t* fs, uint32_t cluster) {
+    return cluster >= 2 && cluster < fs->total_clusters + 2;
+}
+
+// Holds the cached FAT page last looked at, so walking a chain or scanning
+// the table costs one lookup per page rather than one copy per entry
+typedef struct {
+    page_cache_page_t* page;
+} fat32_fat_cursor_t;
+
+static int fat32_fat_entry(fat32_filesystem_t* fs, fat32_fat_cursor_t* cursor,
+                           uint32_t cluster, uint32_t* entry) {
+    uint64_t offset = fat32_entry_offset(fs, cluster);
+    uint64_t index = offset / PAGE_CACHE_PAGE_SIZE;
+    
+    if (!cursor->page || cursor->page->index != index) {
+        page_cache_put(cursor->page);
+        cursor->page = page_cache_get(fs->device_cache, index);
+        if (!cursor->page) {
+            return -1;
+        }
     }
     
-    if (fs->block_device->read(fs->block_device, fat_sector, 1, buffer) != 0) {
-        flux_free(buffer);
-        return 0;
+    // Entries are 4-byte aligned, so never straddle a page
+    uint32_t* slot = (uint32_t*)((uint8_t*)cursor->page->data + offset % PAGE_CACHE_PAGE_SIZE);
+    *entry = __atomic_load_n(slot, __ATOMIC_RELAXED) & 0x0FFFFFFF;
+    return 0;
+}
+
+static void fat32_fat_release(fat32_fat_cursor_t* cursor) {
+    page_cache_put(cursor->page);
+    cursor->page = NULL;
+}
+
+static uint32_t fat32_get_next_cluster(fat32_filesystem_t* fs, uint32_t cluster) {
+    fat32_fat_cursor_t cursor = { NULL };
+    uint32_t entry;
+    if (fat32_fat_entry(fs, &cursor, cluster, &entry) != 0) {
+        entry = 0;
+    }
+    fat32_fat_release(&cursor);
+    return entry;
+}
+
+// =============================================================================
+// Free-Cluster Bitmap
+// =============================================================================
+
+static void fat32_drop_run_maps(fat32_filesystem_t* fs);
+
+// Bits for cluster numbers 0 through total_clusters + 1; 0 and 1 are
+// reserved and always set
+static uint32_t fat32_cluster_map_words(fat32_filesystem_t* fs) {
+    return (fs->total_clusters + 2 + 63) / 64;
+}
+
+// One pass over the FAT, the only full scan the filesystem ever does
+static bool fat32_build_cluster_map(fat32_filesystem_t* fs) {
+    uint32_t words = fat32_cluster_map_words(fs);
+    uint64_t* map = flux_allocate(NULL, (size_t)words * sizeof(uint64_t),
+                                  FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!map) {
+        return false;
+    }
+    
+    fat32_fat_cursor_t cursor = { NULL };
+    uint32_t free_clusters = 0;
+    map[0] = 0x3;
+    for (uint32_t cluster = 2; cluster < fs->total_clusters + 2; cluster++) {
+        uint32_t entry;
+        if (fat32_fat_entry(fs, &cursor, cluster, &entry) != 0) {
+            fat32_fat_release(&cursor);
+            flux_free(map);
+            return false;
+        }
+        
+        if (entry == FAT32_CLUSTER_FREE) {
+            free_clusters++;
+        } else {
+            map[cluster / 64] |= 1ULL << (cluster % 64);
+        }
     }
+    fat32_fat_release(&cursor);
     
-    uint32_t next_cluster = *(uint32_t*)(buffer + fat_entry_offset) & 0x0FFFFFFF;
-    flux_free(buffer);
+    spinlock_acquire(&fs->lock);
+    if (!fs->cluster_map) {
+        fs->cluster_map = map;
+        fs->free_clusters = free_clusters;
+        fs->free_hint = 0;
+        map = NULL;
+    }
+    spinlock_release(&fs->lock);
     
-    return next_cluster;
+    if (map) {
+        flux_free(map);
+    }
+    return true;
+}
+
+// Keep the bitmap in step with a FAT entry just written
+static void fat32_note_cluster(fat32_filesystem_t* fs, uint32_t cluster, bool used) {
+    spinlock_acquire(&fs->lock);
+    if (fs->cluster_map) {
+        uint64_t bit = 1ULL << (cluster % 64);
+        uint64_t* word = &fs->cluster_map[cluster / 64];
+        if (used && !(*word & bit)) {
+            *word |= bit;
+            fs->free_clusters--;
+        } else if (!used && (*word & bit)) {
+            *word &= ~bit;
+            fs->free_clusters++;
+            if (cluster / 64 < fs->free_hint) {
+                fs->free_hint = cluster / 64;
+            }
+        }
+    }
+    spinlock_release(&fs->lock);
 }
 
 static int fat32_set_next_cluster(fat32_filesystem_t* fs, uint32_t cluster,
                                   uint32_t next_cluster) {
-    if (fs->readonly) {
+    if (fs->readonly || !fat32_cluster_valid(fs, cluster)) {
         return -1;
     }
     
-    uint32_t fat_offset = cluster * 4;
-    uint32_t fat_sector = fs->fat_start_lba + (fat_offset / fs->bytes_per_sector);
-    uint32_t fat_entry_offset = fat_offset % fs->bytes_per_sector;
-    
-    uint8_t* buffer = flux_allocate(NULL, fs->bytes_per_sector, FLUX_ALLOC_KERNEL);
-    if (!buffer) {
+    uint64_t offset = fat32_entry_offset(fs, cluster);
+    uint32_t entry;
+    if (page_cache_read(fs->device_cache, offset, &entry, sizeof(entry)) != 0) {
         return -1;
     }
     
-    if (fs->block_device->read(fs->block_device, fat_sector, 1, buffer) != 0) {
-        flux_free(buffer);
+    entry = (entry & 0xF0000000) | (next_cluster & 0x0FFFFFFF);
+    if (page_cache_write(fs->device_cache, offset, &entry, sizeof(entry)) != 0) {
         return -1;
     }
     
-    uint32_t* entry = (uint32_t*)(buffer + fat_entry_offset);
-    *entry = (*entry & 0xF0000000) | (next_cluster & 0x0FFFFFFF);
-    
-    int result = fs->block_device->write(fs->block_device, fat_sector, 1, buffer);
-    flux_free(buffer);
-    
-    return result;
+    // Chains changed under any cached runs
+    fat32_note_cluster(fs, cluster, next_cluster != FAT32_CLUSTER_FREE);
+    fat32_drop_run_maps(fs);
+    return 0;
 }
 
+// A free cluster, 0 if there are none. Words are searched from where the
+// last search succeeded, so allocation doesn't rescan the full front of
+// the volume each time.
 static uint32_t fat32_find_free_cluster(fat32_filesystem_t* fs) {
-    uint8_t* buffer = flux_allocate(NULL, fs->bytes_per_sector, FLUX_ALLOC_KERNEL);
-    if (!buffer) {
+    if (!fs->cluster_map && !fat32_build_cluster_map(fs)) {
         return 0;
     }
     
-    uint32_t total_clusters = fs->total_clusters;
+    uint32_t limit = fs->total_clusters + 2;
+    uint32_t words = fat32_cluster_map_words(fs);
+    uint32_t cluster = 0;
     
-    for (uint32_t cluster = 2; cluster < total_clusters; cluster++) {
-        uint32_t fat_offset = cluster * 4;
-        uint32_t fat_sector = fs->fat_start_lba + (fat_offset / fs->bytes_per_sector);
-        uint32_t fat_entry_offset = fat_offset % fs->bytes_per_sector;
-        
-        if (fs->block_device->read(fs->block_device, fat_sector, 1, buffer) != 0) {
-            continue;
+    spinlock_acquire(&fs->lock);
+    for (uint32_t n = 0; n < words && fs->free_clusters; n++) {
+        uint32_t w = (fs->free_hint + n) % words;
+        uint64_t used = fs->cluster_map[w];
+        if (w == words - 1 && limit % 64) {
+            used |= ~0ULL << (limit % 64);
         }
         
-        uint32_t entry = *(uint32_t*)(buffer + fat_entry_offset) & 0x0FFFFFFF;
-        if (entry == 0) {
-            flux_free(buffer);
-            return cluster;
+        if (~used) {
+            fs->free_hint = w;
+            cluster = w * 64 + __builtin_ctzll(~used);
+            break;
         }
     }
+    spinlock_release(&fs->lock);
     
-    flux_free(buffer);
-    return 0;
+    return cluster;
+}
+
+uint32_t fat32_get_free_space(fat32_filesystem_t* fs) {
+    if (!fs || (!fs->cluster_map && !fat32_build_cluster_map(fs))) {
+        return 0;
+    }
+    return fs->free_clusters;
+}
+
+// =============================================================================
+// Cluster Run Maps
+// =============================================================================
+
+// A file's chain is walked once into runs of consecutive clusters and kept
+// here, so later reads find any offset by binary search and read each run
+// as one range.
+
+static void fat32_free_run_map(fat32_run_map_t* map) {
+    if (map->runs) {
+        flux_free(map->runs);
+    }
+    flux_free(map);
+}
+
+static bool fat32_add_cluster(fat32_run_map_t* map, uint32_t cluster) {
+    fat32_run_t* last = map->run_count ? &map->runs[map->run_count - 1] : NULL;
+    if (last && last->cluster + last->count == cluster) {
+        last->count++;
+        map->clusters++;
+        return true;
+    }
+    
+    if (map->run_count == map->run_capacity) {
+        uint32_t capacity = map->run_capacity ? map->run_capacity * 2 : 8;
+        fat32_run_t* runs = flux_allocate(NULL, capacity * sizeof(fat32_run_t),
+                                          FLUX_ALLOC_KERNEL);
+        if (!runs) {
+            return false;
+        }
+        if (map->runs) {
+            memcpy(runs, map->runs, map->run_count * sizeof(fat32_run_t));
+            flux_free(map->runs);
+        }
+        map->runs = runs;
+        map->run_capacity = capacity;
+    }
+    
+    map->runs[map->run_count++] = (fat32_run_t){
+        .file_cluster = map->clusters,
+        .cluster = cluster,
+        .count = 1
+    };
+    map->clusters++;
+    return true;
+}
+
+// Walk the chain from first_cluster for up to needed clusters; a chain
+// longer than the volume can only be a loop, and stops there
+static fat32_run_map_t* fat32_build_run_map(fat32_filesystem_t* fs, uint32_t first_cluster,
+                                            uint32_t needed) {
+    fat32_run_map_t* map = flux_allocate(NULL, sizeof(fat32_run_map_t),
+                                         FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!map) {
+        return NULL;
+    }
+    map->first_cluster = first_cluster;
+    
+    fat32_fat_cursor_t cursor = { NULL };
+    uint32_t cluster = first_cluster;
+    while (map->clusters < needed && map->clusters < fs->total_clusters) {
+        if (!fat32_cluster_valid(fs, cluster)) {
+            map->whole = true;
+            break;
+        }
+        if (!fat32_add_cluster(map, cluster) ||
+            fat32_fat_entry(fs, &cursor, cluster, &cluster) != 0) {
+            fat32_fat_release(&cursor);
+            fat32_free_run_map(map);
+            return NULL;
+        }
+    }
+    fat32_fat_release(&cursor);
+    return map;
+}
+
+// Unhook a cached map; caller holds fs->lock. Returns it if nobody is
+// reading it and it can be freed now.
+static fat32_run_map_t* fat32_unhook_run_map(fat32_filesystem_t* fs, fat32_run_map_t** link) {
+    fat32_run_map_t* map = *link;
+    *link = map->next;
+    fs->run_map_count--;
+    
+    if (map->refs) {
+        map->stale = true;
+        return NULL;
+    }
+    return map;
+}
+
+static void fat32_free_run_maps(fat32_run_map_t* list) {
+    while (list) {
+        fat32_run_map_t* next = list->next;
+        fat32_free_run_map(list);
+        list = next;
+    }
+}
+
+static fat32_run_map_t* fat32_unhook_all(fat32_filesystem_t* fs) {
+    fat32_run_map_t* list = NULL;
+    for (uint32_t i = 0; i < FAT32_RUN_BUCKETS; i++) {
+        while (fs->run_maps[i]) {
+            fat32_run_map_t* map = fat32_unhook_run_map(fs, &fs->run_maps[i]);
+            if (map) {
+                map->next = list;
+                list = map;
+            }
+        }
+    }
+    return list;
+}
+
+static void fat32_drop_run_maps(fat32_filesystem_t* fs) {
+    spinlock_acquire(&fs->lock);
+    fat32_run_map_t* list = fs->run_map_count ? fat32_unhook_all(fs) : NULL;
+    spinlock_release(&fs->lock);
+    fat32_free_run_maps(list);
+}
+
+// Runs covering at least the first needed clusters of the file at
+// first_cluster, held until fat32_put_run_map
+static fat32_run_map_t* fat32_get_run_map(fat32_filesystem_t* fs, uint32_t first_cluster,
+                                          uint32_t needed) {
+    fat32_run_map_t** bucket = &fs->run_maps[first_cluster % FAT32_RUN_BUCKETS];
+    
+    spinlock_acquire(&fs->lock);
+    for (fat32_run_map_t* map = *bucket; map; map = map->next) {
+        if (map->first_cluster == first_cluster && (map->clusters >= needed || map->whole)) {
+            map->refs++;
+            spinlock_release(&fs->lock);
+            return map;
+        }
+    }
+    spinlock_release(&fs->lock);
+    
+    fat32_run_map_t* fresh = fat32_build_run_map(fs, first_cluster, needed);
+    if (!fresh) {
+        return NULL;
+    }
+    fresh->refs = 1;
+    
+    // Replace a shorter map of the same file; past FAT32_RUN_MAPS_MAX
+    // start the cache over
+    fat32_run_map_t* dropped = NULL;
+    spinlock_acquire(&fs->lock);
+    if (fs->run_map_count >= FAT32_RUN_MAPS_MAX) {
+        dropped = fat32_unhook_all(fs);
+    }
+    for (fat32_run_map_t** link = bucket; *link; link = &(*link)->next) {
+        if ((*link)->first_cluster == first_cluster) {
+            fat32_run_map_t* old = fat32_unhook_run_map(fs, link);
+            if (old) {
+                old->next = dropped;
+                dropped = old;
+            }
+            break;
+        }
+    }
+    fresh->next = *bucket;
+    *bucket = fresh;
+    fs->run_map_count++;
+    spinlock_release(&fs->lock);
+    
+    fat32_free_run_maps(dropped);
+    return fresh;
+}
+
+static void fat32_put_run_map(fat32_filesystem_t* fs, fat32_run_map_t* map) {
+    spinlock_acquire(&fs->lock);
+    bool free_now = --map->refs == 0 && map->stale;
+    spinlock_release(&fs->lock);
+    
+    if (free_now) {
+        fat32_free_run_map(map);
+    }
+}
+
+// Run holding the file's cluster index, run_count if it's past the map
+static uint32_t fat32_find_run(fat32_run_map_t* map, uint32_t file_cluster) {
+    uint32_t low = 0;
+    uint32_t high = map->run_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        fat32_run_t* run = &map->runs[mid];
+        if (file_cluster < run->file_cluster) {
+            high = mid;
+        } else if (file_cluster - run->file_cluster >= run->count) {
+            low = mid + 1;
+        } else {
+            return mid;
+        }
+    }
+    return map->run_count;
 }
 
 // =============================================================================
@@ -102,7 +409,7 @@ static uint32_t fat32_find_free_cluster(fat32_filesystem_t* fs) {
 // =============================================================================
 
 static uint64_t fat32_cluster_to_lba(fat32_filesystem_t* fs, uint32_t cluster) {
-    return fs->data_start_lba + ((cluster - 2) * fs->sectors_per_cluster);
+    return fs->data_start_lba + (uint64_t)(cluster - 2) * fs->sectors_per_cluster;
 }
 
 static int fat32_read_cluster(fat32_filesystem_t* fs, uint32_t cluster, void* buffer) {
@@ -111,7 +418,8 @@ static int fat32_read_cluster(fat32_filesystem_t* fs, uint32_t cluster, void* bu
     }
     
     uint64_t lba = fat32_cluster_to_lba(fs, cluster);
-    return fs->block_device->read(fs->block_device, lba, fs->sectors_per_cluster, buffer);
+    return page_cache_read(fs->device_cache, lba * BLOCK_SECTOR_SIZE, buffer,
+                           fs->sectors_per_cluster * fs->bytes_per_sector);
 }
 
 static int fat32_write_cluster(fat32_filesystem_t* fs, uint32_t cluster, void* buffer) {
@@ -124,7 +432,8 @@ static int fat32_write_cluster(fat32_filesystem_t* fs, uint32_t cluster, void* b
     }
     
     uint64_t lba = fat32_cluster_to_lba(fs, cluster);
-    return fs->block_device->write(fs->block_device, lba, fs->sectors_per_cluster, buffer);
+    return page_cache_write(fs->device_cache, lba * BLOCK_SECTOR_SIZE, buffer,
+                            fs->sectors_per_cluster * fs->bytes_per_sector);
 }
 
 // =============================================================================
@@ -172,7 +481,8 @@ static void fat32_get_short_name(const char* long_name, char* short_name) {
     }
 }
 
-static bool fat32_compare_filename(fat32_dir_entry_t* entry, const char* name) {
+// name is len bytes, not necessarily terminated
+static bool fat32_compare_filename(fat32_dir_entry_t* entry, const char* name, size_t len) {
     char filename[13];
     int i, j;
     
@@ -191,7 +501,7 @@ static bool fat32_compare_filename(fat32_dir_entry_t* entry, const char* name) {
     filename[j] = '\0';
     
     // Case-insensitive comparison
-    for (i = 0; filename[i] && name[i]; i++) {
+    for (i = 0; filename[i] && (size_t)i < len; i++) {
         char c1 = filename[i];
         char c2 = name[i];
         
@@ -203,7 +513,7 @@ static bool fat32_compare_filename(fat32_dir_entry_t* entry, const char* name) {
         }
     }
     
-    return filename[i] == '\0' && name[i] == '\0';
+    return filename[i] == '\0' && (size_t)i == len;
 }
 
 // =============================================================================
@@ -212,7 +522,7 @@ static bool fat32_compare_filename(fat32_dir_entry_t* entry, const char* name) {
 
 static fat32_dir_entry_t* fat32_find_entry_in_directory(fat32_filesystem_t* fs,
                                                         uint32_t dir_cluster,
-                                                        const char* name) {
+                                                        const char* name, size_t len) {
     uint32_t cluster_size = fs->sectors_per_cluster * fs->bytes_per_sector;
     uint8_t* buffer = flux_allocate(NULL, cluster_size, FLUX_ALLOC_KERNEL);
     if (!buffer) {
@@ -247,7 +557,7 @@ static fat32_dir_entry_t* fat32_find_entry_in_directory(fat32_filesystem_t* fs,
                 continue;
             }
             
-            if (fat32_compare_filename(&entries[i], name)) {
+            if (fat32_compare_filename(&entries[i], name, len)) {
                 // Found entry - allocate and return copy
                 fat32_dir_entry_t* result = flux_allocate(NULL, sizeof(fat32_dir_entry_t),
                                                          FLUX_ALLOC_KERNEL);
@@ -275,41 +585,39 @@ static uint32_t fat32_path_to_cluster(fat32_filesystem_t* fs, const char* path)
         return 0;
     }
     
+    // Component by component, in place. Callers going through manifold
+    // only get here for what its dentry cache couldn't answer.
     uint32_t current_cluster = fs->root_cluster;
+    size_t pos = 0;
     
-    if (path[1] == '\0') {
-        return current_cluster;  // Root directory
-    }
-    
-    char* path_copy = flux_allocate(NULL, strlen(path) + 1, FLUX_ALLOC_KERNEL);
-    if (!path_copy) {
-        return 0;
-    }
-    strcpy(path_copy, path);
-    
-    char* token = strtok(path_copy + 1, "/");
-    
-    while (token) {
-        fat32_dir_entry_t* entry = fat32_find_entry_in_directory(fs, current_cluster, token);
+    while (path[pos] != '\0') {
+        if (path[pos] == '/') {
+            pos++;
+            continue;
+        }
+        
+        const char* name = path + pos;
+        size_t len = 0;
+        while (name[len] != '\0' && name[len] != '/') {
+            len++;
+        }
+        pos += len;
+        
+        fat32_dir_entry_t* entry = fat32_find_entry_in_directory(fs, current_cluster, name, len);
         if (!entry) {
-            flux_free(path_copy);
             return 0;
         }
         
         if (!(entry->attr & FAT32_ATTR_DIRECTORY)) {
             // Not a directory
             flux_free(entry);
-            flux_free(path_copy);
             return 0;
         }
         
         current_cluster = ((uint32_t)entry->cluster_high << 16) | entry->cluster_low;
         flux_free(entry);
-        
-        token = strtok(NULL, "/");
     }
     
-    flux_free(path_copy);
     return current_cluster;
 }
 
@@ -317,8 +625,9 @@ static uint32_t fat32_path_to_cluster(fat32_filesystem_t* fs, const char* path)
 // File Operations
 // =============================================================================
 
-int fat32_read_file(fat32_filesystem_t* fs, const char* path, void* buffer,
-                   size_t offset, size_t length) {
+// Copy the directory entry for path into out; returns 0, or -1 if there's
+// none
+static int fat32_find_file(fat32_filesystem_t* fs, const char* path, fat32_dir_entry_t* out) {
     // Extract directory and filename
     char* path_copy = flux_allocate(NULL, strlen(path) + 1, FLUX_ALLOC_KERNEL);
     if (!path_copy) {
@@ -336,7 +645,10 @@ int fat32_read_file(fat32_filesystem_t* fs, const char* path, void* buffer,
     uint32_t dir_cluster;
     char* filename;
     
-    if (last_slash) {
+    if (last_slash == path_copy) {
+        dir_cluster = fs->root_cluster;
+        filename = last_slash + 1;
+    } else if (last_slash) {
         *last_slash = '\0';
         dir_cluster = fat32_path_to_cluster(fs, path_copy);
         filename = last_slash + 1;
@@ -345,27 +657,44 @@ int fat32_read_file(fat32_filesystem_t* fs, const char* path, void* buffer,
         return -1;
     }
     
-    if (dir_cluster == 0) {
+    size_t filename_len = strlen(filename);
+    if (dir_cluster == 0 || filename_len == 0) {
         flux_free(path_copy);
         return -1;
     }
     
-    // Find file entry
-    fat32_dir_entry_t* entry = fat32_find_entry_in_directory(fs, dir_cluster, filename);
+    fat32_dir_entry_t* entry = fat32_find_entry_in_directory(fs, dir_cluster, filename,
+                                                            filename_len);
     flux_free(path_copy);
     
     if (!entry) {
         return -1;
     }
     
-    if (entry->attr & FAT32_ATTR_DIRECTORY) {
-        flux_free(entry);
+    *out = *entry;
+    flux_free(entry);
+    return 0;
+}
+
+int fat32_get_file_info(fat32_filesystem_t* fs, const char* path, fat32_dir_entry_t* entry) {
+    return fat32_find_file(fs, path, entry);
+}
+
+// Read into several buffers in turn, finding the file and its runs once
+// for all of them. ra is the reader's readahead state; without one each
+// run starts afresh.
+int fat32_readv(fat32_filesystem_t* fs, const char* path, const page_cache_iovec_t* iov,
+                uint32_t count, size_t offset, page_cache_ra_t* ra) {
+    page_cache_iter_t iter;
+    size_t length = page_cache_iter_init(&iter, iov, count);
+    
+    fat32_dir_entry_t entry;
+    if (fat32_find_file(fs, path, &entry) != 0 || (entry.attr & FAT32_ATTR_DIRECTORY)) {
         return -1;
     }
     
-    uint32_t file_size = entry->file_size;
-    uint32_t first_cluster = ((uint32_t)entry->cluster_high << 16) | entry->cluster_low;
-    flux_free(entry);
+    uint32_t file_size = entry.file_size;
+    uint32_t first_cluster = ((uint32_t)entry.cluster_high << 16) | entry.cluster_low;
     
     if (offset >= file_size) {
         return 0;
@@ -375,48 +704,46 @@ int fat32_read_file(fat32_filesystem_t* fs, const char* path, void* buffer,
         length = file_size - offset;
     }
     
-    // Read file data
+    // Read file data run by run, straight from the cache into the caller's
+    // buffer. Each run is contiguous on disk, so whatever isn't cached yet
+    // goes to the device as one batch.
     uint32_t cluster_size = fs->sectors_per_cluster * fs->bytes_per_sector;
-    uint8_t* cluster_buffer = flux_allocate(NULL, cluster_size, FLUX_ALLOC_KERNEL);
-    if (!cluster_buffer) {
+    uint32_t needed = (uint32_t)(((uint64_t)file_size + cluster_size - 1) / cluster_size);
+    fat32_run_map_t* map = fat32_get_run_map(fs, first_cluster, needed);
+    if (!map) {
         return -1;
     }
     
-    uint32_t current_cluster = first_cluster;
-    uint32_t cluster_offset = offset / cluster_size;
-    uint32_t byte_offset = offset % cluster_size;
     size_t bytes_read = 0;
-    uint8_t* dest = (uint8_t*)buffer;
     
-    // Skip to starting cluster
-    for (uint32_t i = 0; i < cluster_offset && current_cluster < 0x0FFFFFF7; i++) {
-        current_cluster = fat32_get_next_cluster(fs, current_cluster);
-    }
-    
-    // Read data
-    while (bytes_read < length && current_cluster >= 2 && current_cluster < 0x0FFFFFF7) {
-        if (fat32_read_cluster(fs, current_cluster, cluster_buffer) != 0) {
-            flux_free(cluster_buffer);
-            return bytes_read;
+    for (uint32_t r = fat32_find_run(map, offset / cluster_size);
+         r < map->run_count && bytes_read < length; r++) {
+        fat32_run_t* run = &map->runs[r];
+        uint64_t in_run = offset + bytes_read - (uint64_t)run->file_cluster * cluster_size;
+        uint64_t chunk = (uint64_t)run->count * cluster_size - in_run;
+        if (chunk > length - bytes_read) {
+            chunk = length - bytes_read;
         }
         
-        size_t copy_offset = (bytes_read == 0) ? byte_offset : 0;
-        size_t copy_size = cluster_size - copy_offset;
-        
-        if (bytes_read + copy_size > length) {
-            copy_size = length - bytes_read;
+        page_cache_ra_t run_ra = { 0 };
+        uint64_t position = fat32_cluster_to_lba(fs, run->cluster) * BLOCK_SECTOR_SIZE;
+        if (page_cache_readv(fs->device_cache, ra ? ra : &run_ra, position + in_run, &iter,
+                             chunk) != 0) {
+            break;
         }
-        
-        memcpy(dest + bytes_read, cluster_buffer + copy_offset, copy_size);
-        bytes_read += copy_size;
-        
-        current_cluster = fat32_get_next_cluster(fs, current_cluster);
+        bytes_read += chunk;
     }
     
-    flux_free(cluster_buffer);
+    fat32_put_run_map(fs, map);
     return bytes_read;
 }
 
+int fat32_read_file(fat32_filesystem_t* fs, const char* path, void* buffer,
+                   size_t offset, size_t length) {
+    page_cache_iovec_t iov = { buffer, length };
+    return fat32_readv(fs, path, &iov, 1, offset, NULL);
+}
+
 // =============================================================================
 // Boot Sector Operations
 // =============================================================================
@@ -476,10 +803,16 @@ fat32_filesystem_t* fat32_mount(block_device_t* device, uint64_t partition_start
     }
     
     fs->block_device = device;
+    fs->device_cache = page_cache_device(device);
     fs->partition_start = partition_start;
     fs->readonly = readonly;
     spinlock_init(&fs->lock);
     
+    if (!fs->device_cache) {
+        flux_free(fs);
+        return NULL;
+    }
+    
     // Read boot sector
     if (fat32_read_boot_sector(fs) != 0) {
         flux_free(fs);
@@ -516,5 +849,12 @@ void fat32_unmount(fat32_filesystem_t* fs) {
     }
     spinlock_release(&g_fat32_lock);
     
+    // FAT and directory updates are still in the cache
+    page_cache_sync(fs->device_cache);
+    
+    fat32_free_run_maps(fat32_unhook_all(fs));
+    if (fs->cluster_map) {
+        flux_free(fs->cluster_map);
+    }
     flux_free(fs);
 }
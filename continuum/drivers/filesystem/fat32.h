@@ -10,12 +10,15 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "../resonance.h"
+#include "../storage/block.h"
 
 // =============================================================================
 // FAT32 Constants
 // =============================================================================
 
 #define MAX_FAT32_FILESYSTEMS   16
+#define FAT32_RUN_BUCKETS       32
+#define FAT32_RUN_MAPS_MAX      64      // Cached per filesystem before they're all dropped
 
 // FAT32 Cluster Values
 #define FAT32_CLUSTER_FREE      0x00000000
@@ -129,16 +132,30 @@ typedef struct {
     uint16_t year   : 7;      // 0-127 (1980-2107)
 } fat32_date_t;
 
-// Block Device Interface
+// A stretch of a file in consecutive clusters
 typedef struct {
-    int (*read)(void* device, uint64_t lba, uint32_t sectors, void* buffer);
-    int (*write)(void* device, uint64_t lba, uint32_t sectors, void* buffer);
-    void* device_data;
-} block_device_t;
+    uint32_t file_cluster;      // Index within the file
+    uint32_t cluster;           // First one on disk
+    uint32_t count;
+} fat32_run_t;
+
+// Where a file's clusters are, as runs, keyed by its first cluster
+typedef struct fat32_run_map {
+    uint32_t first_cluster;
+    uint32_t clusters;          // Mapped so far
+    bool whole;                 // The chain ended; there's nothing more to map
+    uint32_t run_count;
+    uint32_t run_capacity;
+    fat32_run_t* runs;
+    uint32_t refs;              // Readers using it
+    bool stale;                 // Dropped from the cache, freed by the last reader
+    struct fat32_run_map* next;
+} fat32_run_map_t;
 
 // FAT32 Filesystem
 typedef struct {
     block_device_t* block_device;
+    struct page_cache_mapping* device_cache;
     uint64_t partition_start;
     bool readonly;
     
@@ -161,6 +178,16 @@ typedef struct {
     uint32_t free_clusters;
     uint32_t next_free_cluster;
     
+    // Free-cluster bitmap, a bit per cluster number set while it's in use;
+    // built from the FAT on first use
+    uint64_t* cluster_map;
+    uint32_t free_hint;         // Word the next search starts at
+    
+    // Cluster-chain run maps
+    fat32_run_map_t* run_maps[FAT32_RUN_BUCKETS];
+    uint32_t run_map_count;
+    
+    // Guards the bitmap and the run maps
     spinlock_t lock;
 } fat32_filesystem_t;
 
@@ -180,12 +207,17 @@ typedef struct {
 // Function Prototypes
 // =============================================================================
 
+struct page_cache_iovec;
+struct page_cache_ra;
+
 fat32_filesystem_t* fat32_mount(block_device_t* device, uint64_t partition_start,
                                 bool readonly);
 void fat32_unmount(fat32_filesystem_t* fs);
 
 int fat32_read_file(fat32_filesystem_t* fs, const char* path, void* buffer,
                    size_t offset, size_t length);
+int fat32_readv(fat32_filesystem_t* fs, const char* path, const struct page_cache_iovec* iov,
+                uint32_t count, size_t offset, struct page_cache_ra* ra);
 int fat32_write_file(fat32_filesystem_t* fs, const char* path, void* buffer,
                     size_t offset, size_t length);
 
@@ -200,7 +232,7 @@ int fat32_get_file_info(fat32_filesystem_t* fs, const char* path,
                        fat32_dir_entry_t* entry);
 int fat32_set_file_attributes(fat32_filesystem_t* fs, const char* path, uint8_t attr);
 
-uint32_t fat32_get_free_space(fat32_filesystem_t* fs);
+uint32_t fat32_get_free_space(fat32_filesystem_t* fs);  // In clusters
 int fat32_format(block_device_t* device, uint64_t partition_start,
                 uint64_t partition_size, const char* label);
 
@@ -6,6 +6,7 @@
 #include "vesa.h"
 #include "../resonance.h"
 #include "../../flux_memory.h"
+#include "../../continuum_core.h"
 
 // =============================================================================
 // Global VESA State
@@ -18,6 +19,25 @@ static uint32_t* g_backbuffer;
 static spinlock_t g_vesa_lock = SPINLOCK_INIT;
 static bool g_vesa_initialized = false;
 
+// Page flipping: the framebuffer holds g_flip_pages screens, of which
+// g_scan_page is shown and g_draw_page is drawn into next
+static uint32_t g_flip_pages;
+static uint32_t g_scan_page;
+static uint32_t g_draw_page;
+
+// Vertical retrace, as far as the VGA status register reports it
+static uint32_t g_vblank_timeouts;
+
+// Where drawing goes: the page to be flipped to, the back buffer, or the
+// screen itself
+static inline uint32_t* vesa_target(void) {
+    if (g_flip_pages) {
+        return g_framebuffer + (size_t)g_draw_page * g_current_mode.pitch_pixels *
+                               g_current_mode.height;
+    }
+    return g_backbuffer ? g_backbuffer : g_framebuffer;
+}
+
 // =============================================================================
 // Pixel Operations
 // =============================================================================
@@ -27,7 +47,7 @@ void vesa_put_pixel(uint32_t x, uint32_t y, uint32_t color) {
         return;
     }
     
-    uint32_t* fb = g_backbuffer ? g_backbuffer : g_framebuffer;
+    uint32_t* fb = vesa_target();
     fb[y * g_current_mode.pitch_pixels + x] = color;
 }
 
@@ -36,7 +56,7 @@ uint32_t vesa_get_pixel(uint32_t x, uint32_t y) {
         return 0;
     }
     
-    uint32_t* fb = g_backbuffer ? g_backbuffer : g_framebuffer;
+    uint32_t* fb = vesa_target();
     return fb[y * g_current_mode.pitch_pixels + x];
 }
 
@@ -66,7 +86,7 @@ void vesa_fill_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
         height = g_current_mode.height - y;
     }
     
-    uint32_t* fb = g_backbuffer ? g_backbuffer : g_framebuffer;
+    uint32_t* fb = vesa_target();
     
     for (uint32_t row = 0; row < height; row++) {
         uint32_t* line = &fb[(y + row) * g_current_mode.pitch_pixels + x];
@@ -169,7 +189,7 @@ void vesa_blit(uint32_t dx, uint32_t dy, uint32_t width, uint32_t height,
         height = g_current_mode.height - dy;
     }
     
-    uint32_t* fb = g_backbuffer ? g_backbuffer : g_framebuffer;
+    uint32_t* fb = vesa_target();
     
     for (uint32_t y = 0; y < height; y++) {
         uint32_t* dst_line = &fb[(dy + y) * g_current_mode.pitch_pixels + dx];
@@ -187,7 +207,7 @@ void vesa_scroll(int32_t dx, int32_t dy) {
     
     spinlock_acquire(&g_vesa_lock);
     
-    uint32_t* fb = g_backbuffer ? g_backbuffer : g_framebuffer;
+    uint32_t* fb = vesa_target();
     uint32_t pitch = g_current_mode.pitch_pixels;
     uint32_t width = g_current_mode.width;
     uint32_t height = g_current_mode.height;
@@ -223,7 +243,7 @@ void vesa_scroll(int32_t dx, int32_t dy) {
 // =============================================================================
 
 int vesa_enable_double_buffer(void) {
-    if (!g_vesa_initialized || g_backbuffer) {
+    if (!g_vesa_initialized || g_backbuffer || g_flip_pages) {
         return -1;
     }
     
@@ -251,6 +271,149 @@ void vesa_swap_buffers(void) {
     spinlock_release(&g_vesa_lock);
 }
 
+// Copy just one rect of the back buffer to the screen
+void vesa_swap_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if (!g_vesa_initialized || !g_backbuffer ||
+        x >= g_current_mode.width || y >= g_current_mode.height) {
+        return;
+    }
+    
+    if (x + width > g_current_mode.width) {
+        width = g_current_mode.width - x;
+    }
+    if (y + height > g_current_mode.height) {
+        height = g_current_mode.height - y;
+    }
+    
+    spinlock_acquire(&g_vesa_lock);
+    
+    uint32_t pitch = g_current_mode.pitch_pixels;
+    for (uint32_t row = y; row < y + height; row++) {
+        memcpy(&g_framebuffer[row * pitch + x], &g_backbuffer[row * pitch + x],
+               width * sizeof(uint32_t));
+    }
+    
+    spinlock_release(&g_vesa_lock);
+}
+
+// =============================================================================
+// Page Flipping
+// =============================================================================
+
+// The Bochs/QEMU display interface: a framebuffer taller than the screen,
+// scanned out from a Y offset, so a flip is one register write
+#define VBE_DISPI_IOPORT_INDEX      0x01CE
+#define VBE_DISPI_IOPORT_DATA       0x01CF
+#define VBE_DISPI_INDEX_ID          0x0
+#define VBE_DISPI_INDEX_VIRT_HEIGHT 0x7
+#define VBE_DISPI_INDEX_Y_OFFSET    0x9
+#define VBE_DISPI_ID2               0xB0C2  // First with a virtual height
+#define VBE_DISPI_ID5               0xB0C5
+
+static uint16_t vesa_dispi_read(uint16_t index) {
+    outw(VBE_DISPI_IOPORT_INDEX, index);
+    return inw(VBE_DISPI_IOPORT_DATA);
+}
+
+static void vesa_dispi_write(uint16_t index, uint16_t value) {
+    outw(VBE_DISPI_IOPORT_INDEX, index);
+    outw(VBE_DISPI_IOPORT_DATA, value);
+}
+
+// Triple buffer in video memory where the adapter can scan out of any
+// page: with one page shown and one flipped to, there's always a third
+// to draw into without waiting. Returns the pages got (2 if there's only
+// room for that), or -1 where flipping isn't supported.
+int vesa_enable_page_flip(void) {
+    if (!g_vesa_initialized || g_backbuffer || g_flip_pages) {
+        return -1;
+    }
+    
+    uint16_t id = vesa_dispi_read(VBE_DISPI_INDEX_ID);
+    if (id < VBE_DISPI_ID2 || id > VBE_DISPI_ID5) {
+        return -1;
+    }
+    
+    // The adapter won't take a virtual height its memory can't hold
+    for (uint32_t pages = VESA_FLIP_PAGES; pages >= 2; pages--) {
+        uint32_t height = g_current_mode.height * pages;
+        if (height > 0xFFFF) {
+            continue;
+        }
+        vesa_dispi_write(VBE_DISPI_INDEX_VIRT_HEIGHT, (uint16_t)height);
+        if (vesa_dispi_read(VBE_DISPI_INDEX_VIRT_HEIGHT) == height) {
+            spinlock_acquire(&g_vesa_lock);
+            vesa_dispi_write(VBE_DISPI_INDEX_Y_OFFSET, 0);
+            g_scan_page = 0;
+            g_draw_page = 1;
+            g_flip_pages = pages;
+            spinlock_release(&g_vesa_lock);
+            return (int)pages;
+        }
+    }
+    
+    return -1;
+}
+
+uint32_t vesa_get_flip_pages(void) {
+    return g_flip_pages;
+}
+
+// Show the page drawn into, and move drawing on to the next
+void vesa_flip(void) {
+    if (!g_flip_pages) {
+        return;
+    }
+    
+    spinlock_acquire(&g_vesa_lock);
+    vesa_dispi_write(VBE_DISPI_INDEX_Y_OFFSET, (uint16_t)(g_draw_page * g_current_mode.height));
+    g_scan_page = g_draw_page;
+    g_draw_page = (g_draw_page + 1) % g_flip_pages;
+    spinlock_release(&g_vesa_lock);
+}
+
+// =============================================================================
+// Display Timing
+// =============================================================================
+
+#define VGA_INPUT_STATUS_1      0x3DA
+#define VGA_STATUS_RETRACE      0x08
+#define VESA_VBLANK_GIVE_UP     3       // Timeouts in a row before it's not there
+
+bool vesa_has_vblank(void) {
+    return g_vesa_initialized && g_vblank_timeouts < VESA_VBLANK_GIVE_UP;
+}
+
+// Wait for the next vertical retrace to start, for at most timeout_usec.
+// Returns whether one did; adapters that never report one stop being
+// asked, and callers pace themselves by timer instead.
+bool vesa_wait_vblank(uint64_t timeout_usec) {
+    if (!vesa_has_vblank()) {
+        return false;
+    }
+    
+    uint64_t deadline = continuum_get_time() + continuum_usec_to_tsc(timeout_usec);
+    
+    // Let a retrace under way finish, so the one seen is just starting
+    while (inb(VGA_INPUT_STATUS_1) & VGA_STATUS_RETRACE) {
+        if (continuum_get_time() >= deadline) {
+            g_vblank_timeouts++;
+            return false;
+        }
+        __asm__ __volatile__("pause");
+    }
+    while (!(inb(VGA_INPUT_STATUS_1) & VGA_STATUS_RETRACE)) {
+        if (continuum_get_time() >= deadline) {
+            g_vblank_timeouts++;
+            return false;
+        }
+        __asm__ __volatile__("pause");
+    }
+    
+    g_vblank_timeouts = 0;
+    return true;
+}
+
 // =============================================================================
 // Text Rendering (Simple 8x16 Font)
 // =============================================================================
@@ -266,20 +429,98 @@ static const uint8_t font_8x16[][16] = {
     // ... more characters ...
 };
 
+#define VESA_FONT_GLYPHS        (sizeof(font_8x16) / sizeof(font_8x16[0]))
+#define VESA_FONT_WIDTH         8
+#define VESA_FONT_HEIGHT        16
+#define VESA_GLYPH_CACHE        128     // Glyphs kept drawn, in some colors each
+
+// Glyphs drawn once in the colors asked for and copied out after, a row a
+// memcpy. A slot is one glyph in one fg/bg pair; a miss redraws it from
+// the font a byte at a time, through the pixel masks for each byte.
+typedef struct {
+    uint32_t fg;
+    uint32_t bg;
+    uint8_t glyph;              // Index into the font plus one, 0 for unused
+    uint32_t pixels[VESA_FONT_HEIGHT][VESA_FONT_WIDTH];
+} vesa_glyph_t;
+
+static vesa_glyph_t g_glyph_cache[VESA_GLYPH_CACHE];
+static uint64_t g_glyph_masks[256][VESA_FONT_WIDTH / 2];    // Pixel pairs set in each font byte
+static bool g_glyph_masks_ready;
+
+static void vesa_glyph_masks_init(void) {
+    for (uint32_t bits = 0; bits < 256; bits++) {
+        for (uint32_t pair = 0; pair < VESA_FONT_WIDTH / 2; pair++) {
+            uint64_t mask = 0;
+            if (bits & (0x80 >> (pair * 2))) {
+                mask |= 0x00000000FFFFFFFFULL;
+            }
+            if (bits & (0x40 >> (pair * 2))) {
+                mask |= 0xFFFFFFFF00000000ULL;
+            }
+            g_glyph_masks[bits][pair] = mask;
+        }
+    }
+    g_glyph_masks_ready = true;
+}
+
+// The glyph at index in fg on bg, drawn into its slot if it isn't already
+// there; caller holds g_vesa_lock
+static const vesa_glyph_t* vesa_glyph_get(uint8_t index, uint32_t fg, uint32_t bg) {
+    uint32_t slot = (index * 31u + fg * 7u + bg) % VESA_GLYPH_CACHE;
+    vesa_glyph_t* glyph = &g_glyph_cache[slot];
+    if (glyph->glyph == index + 1 && glyph->fg == fg && glyph->bg == bg) {
+        return glyph;
+    }
+    
+    if (!g_glyph_masks_ready) {
+        vesa_glyph_masks_init();
+    }
+    
+    uint64_t fg2 = ((uint64_t)fg << 32) | fg;
+    uint64_t bg2 = ((uint64_t)bg << 32) | bg;
+    for (uint32_t row = 0; row < VESA_FONT_HEIGHT; row++) {
+        const uint64_t* masks = g_glyph_masks[font_8x16[index][row]];
+        uint64_t* out = (uint64_t*)glyph->pixels[row];
+        for (uint32_t pair = 0; pair < VESA_FONT_WIDTH / 2; pair++) {
+            out[pair] = (fg2 & masks[pair]) | (bg2 & ~masks[pair]);
+        }
+    }
+    glyph->glyph = index + 1;
+    glyph->fg = fg;
+    glyph->bg = bg;
+    return glyph;
+}
+
+// Glyphs the font doesn't have are drawn as a space
 void vesa_draw_char(uint32_t x, uint32_t y, char c, uint32_t fg_color, uint32_t bg_color) {
     if (!g_vesa_initialized || c < 32 || c > 126) {
         return;
     }
+    if (x >= g_current_mode.width || y >= g_current_mode.height) {
+        return;
+    }
+    
+    uint32_t index = (uint32_t)(c - 32);
+    if (index >= VESA_FONT_GLYPHS) {
+        index = 0;
+    }
     
-    const uint8_t* glyph = font_8x16[c - 32];
+    uint32_t width = g_current_mode.width - x < VESA_FONT_WIDTH ?
+                     g_current_mode.width - x : VESA_FONT_WIDTH;
+    uint32_t height = g_current_mode.height - y < VESA_FONT_HEIGHT ?
+                      g_current_mode.height - y : VESA_FONT_HEIGHT;
     
-    for (uint32_t row = 0; row < 16; row++) {
-        uint8_t line = glyph[row];
-        for (uint32_t col = 0; col < 8; col++) {
-            uint32_t color = (line & (0x80 >> col)) ? fg_color : bg_color;
-            vesa_put_pixel(x + col, y + row, color);
-        }
+    spinlock_acquire(&g_vesa_lock);
+    
+    const vesa_glyph_t* glyph = vesa_glyph_get((uint8_t)index, fg_color, bg_color);
+    uint32_t* fb = vesa_target();
+    for (uint32_t row = 0; row < height; row++) {
+        memcpy(&fb[(y + row) * g_current_mode.pitch_pixels + x], glyph->pixels[row],
+               width * sizeof(uint32_t));
     }
+    
+    spinlock_release(&g_vesa_lock);
 }
 
 void vesa_draw_string(uint32_t x, uint32_t y, const char* str,
@@ -392,6 +633,10 @@ static int vesa_attach(device_handle_t* handle) {
 }
 
 static void vesa_detach(device_handle_t* handle) {
+    if (g_flip_pages) {
+        vesa_dispi_write(VBE_DISPI_INDEX_Y_OFFSET, 0);
+        g_flip_pages = 0;
+    }
     if (g_backbuffer) {
         flux_free(g_backbuffer);
         g_backbuffer = NULL;
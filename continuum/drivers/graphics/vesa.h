@@ -57,6 +57,9 @@
 #define VESA_MODEL_DIRECT_COLOR 0x06
 #define VESA_MODEL_YUV          0x07
 
+// Pages of video memory page flipping uses, at most
+#define VESA_FLIP_PAGES         3
+
 // Color formats
 #define VESA_RGB888             0x00
 #define VESA_BGR888             0x01
@@ -201,6 +204,18 @@ void vesa_draw_string(uint32_t x, uint32_t y, const char* str,
 int vesa_enable_double_buffer(void);
 void vesa_disable_double_buffer(void);
 void vesa_swap_buffers(void);
+void vesa_swap_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+// Page flipping. Drawing goes to the page to be shown next, which
+// vesa_flip shows; the page drawn into after it was last shown
+// vesa_get_flip_pages() frames ago.
+int vesa_enable_page_flip(void);
+uint32_t vesa_get_flip_pages(void);
+void vesa_flip(void);
+
+// Display timing
+bool vesa_has_vblank(void);
+bool vesa_wait_vblank(uint64_t timeout_usec);
 
 // Color conversion
 static inline uint32_t vesa_rgb(uint8_t r, uint8_t g, uint8_t b) {
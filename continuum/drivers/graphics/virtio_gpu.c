@@ -0,0 +1,608 @@
+/*
+ * VirtIO GPU Driver for Continuum Kernel
+ * 2D virtual GPU: resources drawn in guest memory, copied to and shown by the host
+ */
+
+#include "virtio_gpu.h"
+#include "../resonance.h"
+#include "../../flux_memory.h"
+#include "../../continuum_core.h"
+
+// =============================================================================
+// Global VirtIO GPU State
+// =============================================================================
+
+static virtio_gpu_device_t* g_virtio_gpu_devices[MAX_VIRTIO_GPU_DEVICES];
+static uint32_t g_virtio_gpu_count = 0;
+static spinlock_t g_virtio_gpu_lock = SPINLOCK_INIT;
+
+#define VIRTQ_DESC_F_NEXT       1
+#define VIRTQ_DESC_F_WRITE      2
+
+// =============================================================================
+// Configuration Space Access
+// =============================================================================
+
+static inline uint8_t cfg_read8(volatile uint8_t* base, uint32_t offset) {
+    return *(volatile uint8_t*)(base + offset);
+}
+
+static inline uint16_t cfg_read16(volatile uint8_t* base, uint32_t offset) {
+    return *(volatile uint16_t*)(base + offset);
+}
+
+static inline uint32_t cfg_read32(volatile uint8_t* base, uint32_t offset) {
+    return *(volatile uint32_t*)(base + offset);
+}
+
+static inline void cfg_write8(volatile uint8_t* base, uint32_t offset, uint8_t value) {
+    *(volatile uint8_t*)(base + offset) = value;
+}
+
+static inline void cfg_write16(volatile uint8_t* base, uint32_t offset, uint16_t value) {
+    *(volatile uint16_t*)(base + offset) = value;
+}
+
+static inline void cfg_write32(volatile uint8_t* base, uint32_t offset, uint32_t value) {
+    *(volatile uint32_t*)(base + offset) = value;
+}
+
+// Low half first, as the transport allows for 64-bit fields
+static inline void cfg_write64(volatile uint8_t* base, uint32_t offset, uint64_t value) {
+    cfg_write32(base, offset, (uint32_t)value);
+    cfg_write32(base, offset + 4, (uint32_t)(value >> 32));
+}
+
+static uint8_t pci_read8(pci_device_info_t* pci, uint8_t offset) {
+    uint32_t value = pci_config_read(pci->bus, pci->device, pci->function, offset & ~3);
+    return (value >> ((offset & 3) * 8)) & 0xFF;
+}
+
+static uint32_t pci_read32(pci_device_info_t* pci, uint8_t offset) {
+    return pci_config_read(pci->bus, pci->device, pci->function, offset);
+}
+
+static volatile uint8_t* virtio_gpu_bar(pci_device_info_t* pci, uint8_t bar) {
+    if (bar >= 6 || (pci->bars[bar] & 0x01)) {
+        return NULL;
+    }
+    
+    uint64_t addr = pci->bars[bar] & ~0x0FULL;
+    if ((pci->bars[bar] & 0x06) == 0x04 && bar < 5) {
+        addr |= (uint64_t)pci->bars[bar + 1] << 32;
+    }
+    return (volatile uint8_t*)(uintptr_t)addr;
+}
+
+// The modern transport's structures are found through vendor capabilities,
+// each naming a BAR and an offset into it
+static int virtio_gpu_find_caps(virtio_gpu_device_t* dev, pci_device_info_t* pci) {
+    uint16_t status = pci_read32(pci, 0x04) >> 16;
+    if (!(status & 0x10)) {
+        return -1;
+    }
+    
+    uint8_t cap = pci_read8(pci, 0x34) & ~3;
+    for (uint32_t guard = 0; cap && guard < 48; guard++) {
+        if (pci_read8(pci, cap) == VIRTIO_PCI_CAP_VENDOR) {
+            uint8_t type = pci_read8(pci, cap + 3);
+            volatile uint8_t* base = virtio_gpu_bar(pci, pci_read8(pci, cap + 4));
+            uint32_t offset = pci_read32(pci, cap + 8);
+            
+            if (base) {
+                switch (type) {
+                    case VIRTIO_PCI_CAP_COMMON_CFG:
+                        dev->common_cfg = base + offset;
+                        break;
+                    case VIRTIO_PCI_CAP_NOTIFY_CFG:
+                        dev->notify_base = base + offset;
+                        dev->notify_multiplier = pci_read32(pci, cap + 16);
+                        break;
+                    case VIRTIO_PCI_CAP_DEVICE_CFG:
+                        dev->device_cfg = base + offset;
+                        break;
+                }
+            }
+        }
+        cap = pci_read8(pci, cap + 1) & ~3;
+    }
+    
+    return dev->common_cfg && dev->notify_base && dev->device_cfg ? 0 : -1;
+}
+
+// =============================================================================
+// Control Queue
+// =============================================================================
+
+static void virtio_gpu_destroy_queue(virtio_gpu_queue_t* q) {
+    if (q->ring_dma) {
+        resonance_free_dma(q->ring_dma);
+        q->ring_dma = NULL;
+    }
+    if (q->slot_dma) {
+        resonance_free_dma(q->slot_dma);
+        q->slot_dma = NULL;
+    }
+}
+
+static int virtio_gpu_setup_queue(virtio_gpu_device_t* dev) {
+    virtio_gpu_queue_t* q = &dev->control;
+    volatile uint8_t* common = dev->common_cfg;
+    
+    cfg_write16(common, VIRTIO_COMMON_Q_SELECT, 0);
+    uint16_t size = cfg_read16(common, VIRTIO_COMMON_Q_SIZE);
+    if (size < 2) {
+        return -1;
+    }
+    if (size > VIRTIO_GPU_QUEUE_SIZE) {
+        size = VIRTIO_GPU_QUEUE_SIZE;
+        cfg_write16(common, VIRTIO_COMMON_Q_SIZE, size);
+    }
+    
+    // Descriptors, the available ring, then the used ring 4-aligned
+    size_t desc_size = size * sizeof(virtio_gpu_desc_t);
+    size_t avail_size = (3 + size) * sizeof(uint16_t);
+    size_t used_offset = (desc_size + avail_size + 3) & ~(size_t)3;
+    size_t used_size = 3 * sizeof(uint16_t) + size * 2 * sizeof(uint32_t);
+    
+    q->ring_dma = resonance_alloc_dma(used_offset + used_size, DMA_FLAG_COHERENT);
+    q->slot_dma = resonance_alloc_dma(VIRTIO_GPU_SLOTS * VIRTIO_GPU_SLOT_SIZE,
+                                      DMA_FLAG_COHERENT);
+    if (!q->ring_dma || !q->slot_dma) {
+        virtio_gpu_destroy_queue(q);
+        return -1;
+    }
+    memset(q->ring_dma->virtual_addr, 0, used_offset + used_size);
+    
+    q->size = size;
+    q->slots = size / 2 < VIRTIO_GPU_SLOTS ? size / 2 : VIRTIO_GPU_SLOTS;
+    q->avail_idx = 0;
+    q->desc = (volatile virtio_gpu_desc_t*)q->ring_dma->virtual_addr;
+    q->avail = (volatile uint16_t*)((uint8_t*)q->ring_dma->virtual_addr + desc_size);
+    q->used = (volatile uint8_t*)q->ring_dma->virtual_addr + used_offset;
+    
+    // Each slot's pair of descriptors is fixed: command, then response
+    for (uint16_t slot = 0; slot < q->slots; slot++) {
+        uint64_t phys = q->slot_dma->physical_addr + (uint64_t)slot * VIRTIO_GPU_SLOT_SIZE;
+        q->desc[slot * 2].addr = phys;
+        q->desc[slot * 2].flags = VIRTQ_DESC_F_NEXT;
+        q->desc[slot * 2].next = slot * 2 + 1;
+        q->desc[slot * 2 + 1].addr = phys + VIRTIO_GPU_SLOT_SIZE / 2;
+        q->desc[slot * 2 + 1].flags = VIRTQ_DESC_F_WRITE;
+    }
+    
+    uint64_t phys = q->ring_dma->physical_addr;
+    cfg_write64(common, VIRTIO_COMMON_Q_DESC, phys);
+    cfg_write64(common, VIRTIO_COMMON_Q_AVAIL, phys + desc_size);
+    cfg_write64(common, VIRTIO_COMMON_Q_USED, phys + used_offset);
+    cfg_write16(common, VIRTIO_COMMON_Q_MSIX, 0xFFFF);
+    
+    uint16_t notify_off = cfg_read16(common, VIRTIO_COMMON_Q_NOFF);
+    q->notify = (volatile uint16_t*)(dev->notify_base + notify_off * dev->notify_multiplier);
+    
+    cfg_write16(common, VIRTIO_COMMON_Q_ENABLE, 1);
+    return 0;
+}
+
+static inline uint8_t* virtio_gpu_slot(virtio_gpu_device_t* dev, uint32_t slot) {
+    return (uint8_t*)dev->control.slot_dma->virtual_addr + slot * VIRTIO_GPU_SLOT_SIZE;
+}
+
+static inline virtio_gpu_ctrl_hdr_t* virtio_gpu_response(virtio_gpu_device_t* dev,
+                                                         uint32_t slot) {
+    return (virtio_gpu_ctrl_hdr_t*)(virtio_gpu_slot(dev, slot) + VIRTIO_GPU_SLOT_SIZE / 2);
+}
+
+// Put slot's command on the ring, cmd_len bytes of it with resp_len back;
+// caller holds dev->lock
+static void virtio_gpu_post(virtio_gpu_device_t* dev, uint32_t slot, uint32_t cmd_len,
+                            uint32_t resp_len) {
+    virtio_gpu_queue_t* q = &dev->control;
+    
+    virtio_gpu_response(dev, slot)->type = 0;
+    q->desc[slot * 2].len = cmd_len;
+    q->desc[slot * 2 + 1].len = resp_len;
+    
+    q->avail[2 + q->avail_idx % q->size] = slot * 2;
+    __sync_synchronize();  // Descriptors before the index
+    q->avail_idx++;
+    q->avail[1] = q->avail_idx;
+    dev->commands++;
+}
+
+// Tell the device what's been posted and wait for all of it. A device that
+// doesn't answer is given up on, since it may still write the slots.
+static int virtio_gpu_complete(virtio_gpu_device_t* dev) {
+    virtio_gpu_queue_t* q = &dev->control;
+    volatile uint16_t* used_idx = (volatile uint16_t*)(q->used + sizeof(uint16_t));
+    
+    __sync_synchronize();
+    *q->notify = 0;
+    
+    uint64_t deadline = continuum_get_time() + continuum_usec_to_tsc(VIRTIO_GPU_CMD_TIMEOUT);
+    while (*used_idx != q->avail_idx) {
+        if (continuum_get_time() >= deadline) {
+            dev->ready = false;
+            dev->errors++;
+            return -1;
+        }
+        __asm__ __volatile__("pause");
+    }
+    __sync_synchronize();  // Responses after the index
+    
+    return 0;
+}
+
+// Check the responses of the first count slots
+static int virtio_gpu_check(virtio_gpu_device_t* dev, uint32_t count) {
+    int result = 0;
+    for (uint32_t slot = 0; slot < count; slot++) {
+        uint32_t type = virtio_gpu_response(dev, slot)->type;
+        if (type < VIRTIO_GPU_RESP_OK_NODATA || type >= 0x1200) {
+            dev->errors++;
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// One command, waited for; resp_len bytes of the response go to resp
+static int virtio_gpu_command(virtio_gpu_device_t* dev, const void* cmd, uint32_t cmd_len,
+                              void* resp, uint32_t resp_len) {
+    if (cmd_len > VIRTIO_GPU_SLOT_SIZE / 2 || resp_len > VIRTIO_GPU_SLOT_SIZE / 2) {
+        return -1;
+    }
+    
+    spinlock_acquire(&dev->lock);
+    
+    if (!dev->ready) {
+        spinlock_release(&dev->lock);
+        return -1;
+    }
+    
+    memcpy(virtio_gpu_slot(dev, 0), cmd, cmd_len);
+    virtio_gpu_post(dev, 0, cmd_len, resp_len ? resp_len : sizeof(virtio_gpu_ctrl_hdr_t));
+    int result = virtio_gpu_complete(dev);
+    if (result == 0) {
+        result = virtio_gpu_check(dev, 1);
+    }
+    if (result == 0 && resp) {
+        memcpy(resp, virtio_gpu_response(dev, 0), resp_len);
+    }
+    
+    spinlock_release(&dev->lock);
+    return result;
+}
+
+// =============================================================================
+// Display and Resources
+// =============================================================================
+
+int virtio_gpu_get_display(virtio_gpu_device_t* dev, uint32_t scanout,
+                           uint32_t* width, uint32_t* height) {
+    if (!dev || scanout >= dev->num_scanouts || scanout >= VIRTIO_GPU_MAX_SCANOUTS) {
+        return -1;
+    }
+    
+    virtio_gpu_ctrl_hdr_t cmd = { .type = VIRTIO_GPU_CMD_GET_DISPLAY_INFO };
+    virtio_gpu_resp_display_info_t info;
+    if (virtio_gpu_command(dev, &cmd, sizeof(cmd), &info, sizeof(info)) != 0 ||
+        info.hdr.type != VIRTIO_GPU_RESP_OK_DISPLAY_INFO || !info.pmodes[scanout].enabled) {
+        return -1;
+    }
+    
+    *width = info.pmodes[scanout].r.width;
+    *height = info.pmodes[scanout].r.height;
+    return 0;
+}
+
+// Pixels are as the compositor keeps them, 0xAARRGGBB in memory order
+// B, G, R, A; the host ignores alpha
+virtio_gpu_resource_t* virtio_gpu_create_resource(virtio_gpu_device_t* dev, uint32_t width,
+                                                  uint32_t height) {
+    if (!dev || !dev->ready || width == 0 || height == 0) {
+        return NULL;
+    }
+    
+    virtio_gpu_resource_t* resource = flux_allocate(NULL, sizeof(virtio_gpu_resource_t),
+                                                    FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!resource) {
+        return NULL;
+    }
+    
+    size_t size = (size_t)width * height * sizeof(uint32_t);
+    resource->backing = resonance_alloc_dma(size, DMA_FLAG_COHERENT);
+    if (!resource->backing) {
+        flux_free(resource);
+        return NULL;
+    }
+    memset(resource->backing->virtual_addr, 0, size);
+    
+    resource->id = __atomic_add_fetch(&dev->next_resource_id, 1, __ATOMIC_RELAXED);
+    resource->width = width;
+    resource->height = height;
+    resource->pixels = resource->backing->virtual_addr;
+    
+    virtio_gpu_resource_create_2d_t create = {
+        .hdr.type = VIRTIO_GPU_CMD_RESOURCE_CREATE_2D,
+        .resource_id = resource->id,
+        .format = VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM,
+        .width = width,
+        .height = height
+    };
+    if (virtio_gpu_command(dev, &create, sizeof(create), NULL, 0) != 0) {
+        resonance_free_dma(resource->backing);
+        flux_free(resource);
+        return NULL;
+    }
+    
+    virtio_gpu_resource_attach_backing_t attach = {
+        .hdr.type = VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING,
+        .resource_id = resource->id,
+        .nr_entries = 1,
+        .addr = resource->backing->physical_addr,
+        .length = (uint32_t)size
+    };
+    if (virtio_gpu_command(dev, &attach, sizeof(attach), NULL, 0) != 0) {
+        virtio_gpu_resource_unref_t unref = {
+            .hdr.type = VIRTIO_GPU_CMD_RESOURCE_UNREF,
+            .resource_id = resource->id
+        };
+        virtio_gpu_command(dev, &unref, sizeof(unref), NULL, 0);
+        resonance_free_dma(resource->backing);
+        flux_free(resource);
+        return NULL;
+    }
+    
+    return resource;
+}
+
+void virtio_gpu_destroy_resource(virtio_gpu_device_t* dev, virtio_gpu_resource_t* resource) {
+    if (!dev || !resource) {
+        return;
+    }
+    
+    // The host lets go of the backing before it's freed
+    virtio_gpu_resource_unref_t detach = {
+        .hdr.type = VIRTIO_GPU_CMD_RESOURCE_DETACH_BACKING,
+        .resource_id = resource->id
+    };
+    virtio_gpu_resource_unref_t unref = {
+        .hdr.type = VIRTIO_GPU_CMD_RESOURCE_UNREF,
+        .resource_id = resource->id
+    };
+    bool released = virtio_gpu_command(dev, &detach, sizeof(detach), NULL, 0) == 0;
+    virtio_gpu_command(dev, &unref, sizeof(unref), NULL, 0);
+    
+    // A device that didn't answer may still read it; leak it rather than that
+    if (released) {
+        resonance_free_dma(resource->backing);
+    }
+    flux_free(resource);
+}
+
+// Show resource on scanout, or nothing for NULL
+int virtio_gpu_set_scanout(virtio_gpu_device_t* dev, uint32_t scanout,
+                           virtio_gpu_resource_t* resource) {
+    if (!dev || scanout >= dev->num_scanouts) {
+        return -1;
+    }
+    
+    virtio_gpu_set_scanout_t cmd = {
+        .hdr.type = VIRTIO_GPU_CMD_SET_SCANOUT,
+        .scanout_id = scanout
+    };
+    if (resource) {
+        cmd.r.width = resource->width;
+        cmd.r.height = resource->height;
+        cmd.resource_id = resource->id;
+    }
+    return virtio_gpu_command(dev, &cmd, sizeof(cmd), NULL, 0);
+}
+
+// Copy rects of the resource to the host, as many a notification as the
+// queue has slots, and flush what they bound to the display. Returns once
+// the host has it all, so the pixels can be drawn into again.
+int virtio_gpu_present(virtio_gpu_device_t* dev, virtio_gpu_resource_t* resource,
+                       const virtio_gpu_rect_t* rects, uint32_t count) {
+    if (!dev || !resource || count == 0) {
+        return -1;
+    }
+    
+    spinlock_acquire(&dev->lock);
+    
+    if (!dev->ready) {
+        spinlock_release(&dev->lock);
+        return -1;
+    }
+    
+    int result = 0;
+    uint32_t slot = 0;
+    uint32_t x0 = resource->width, y0 = resource->height, x1 = 0, y1 = 0;
+    
+    for (uint32_t i = 0; i < count && result == 0; i++) {
+        virtio_gpu_rect_t r = rects[i];
+        if (r.x >= resource->width || r.y >= resource->height || !r.width || !r.height) {
+            continue;
+        }
+        if (r.width > resource->width - r.x) {
+            r.width = resource->width - r.x;
+        }
+        if (r.height > resource->height - r.y) {
+            r.height = resource->height - r.y;
+        }
+        
+        virtio_gpu_transfer_to_host_2d_t* transfer =
+            (virtio_gpu_transfer_to_host_2d_t*)virtio_gpu_slot(dev, slot);
+        memset(transfer, 0, sizeof(*transfer));
+        transfer->hdr.type = VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D;
+        transfer->r = r;
+        transfer->offset = ((uint64_t)r.y * resource->width + r.x) * sizeof(uint32_t);
+        transfer->resource_id = resource->id;
+        virtio_gpu_post(dev, slot++, sizeof(*transfer), sizeof(virtio_gpu_ctrl_hdr_t));
+        dev->bytes_transferred += (uint64_t)r.width * r.height * sizeof(uint32_t);
+        
+        x0 = r.x < x0 ? r.x : x0;
+        y0 = r.y < y0 ? r.y : y0;
+        x1 = r.x + r.width > x1 ? r.x + r.width : x1;
+        y1 = r.y + r.height > y1 ? r.y + r.height : y1;
+        
+        // Leave one slot for the flush
+        if (slot == (uint32_t)dev->control.slots - 1) {
+            result = virtio_gpu_complete(dev);
+            if (result == 0) {
+                result = virtio_gpu_check(dev, slot);
+            }
+            slot = 0;
+        }
+    }
+    
+    if (result == 0 && x1 > x0) {
+        virtio_gpu_resource_flush_t* flush = (virtio_gpu_resource_flush_t*)virtio_gpu_slot(dev, slot);
+        memset(flush, 0, sizeof(*flush));
+        flush->hdr.type = VIRTIO_GPU_CMD_RESOURCE_FLUSH;
+        flush->r = (virtio_gpu_rect_t){ x0, y0, x1 - x0, y1 - y0 };
+        flush->resource_id = resource->id;
+        virtio_gpu_post(dev, slot++, sizeof(*flush), sizeof(virtio_gpu_ctrl_hdr_t));
+    }
+    if (result == 0 && slot > 0) {
+        result = virtio_gpu_complete(dev);
+        if (result == 0) {
+            result = virtio_gpu_check(dev, slot);
+        }
+    }
+    
+    spinlock_release(&dev->lock);
+    return result;
+}
+
+// =============================================================================
+// Device Management
+// =============================================================================
+
+virtio_gpu_device_t* virtio_gpu_get_device(uint32_t index) {
+    spinlock_acquire(&g_virtio_gpu_lock);
+    virtio_gpu_device_t* dev = index < g_virtio_gpu_count ? g_virtio_gpu_devices[index] : NULL;
+    spinlock_release(&g_virtio_gpu_lock);
+    
+    return dev && dev->ready ? dev : NULL;
+}
+
+uint32_t virtio_gpu_get_device_count(void) {
+    return g_virtio_gpu_count;
+}
+
+// =============================================================================
+// VirtIO GPU Device Initialization
+// =============================================================================
+
+static int virtio_gpu_init_device(virtio_gpu_device_t* dev) {
+    volatile uint8_t* common = dev->common_cfg;
+    
+    // Reset device
+    cfg_write8(common, VIRTIO_COMMON_STATUS, 0);
+    cfg_write8(common, VIRTIO_COMMON_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    cfg_write8(common, VIRTIO_COMMON_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    
+    // Only VERSION_1: no 3D, no EDID, no events wanted
+    cfg_write32(common, VIRTIO_COMMON_DFSELECT, 1);
+    if (!(cfg_read32(common, VIRTIO_COMMON_DF) & (uint32_t)(VIRTIO_F_VERSION_1 >> 32))) {
+        return -1;
+    }
+    cfg_write32(common, VIRTIO_COMMON_GFSELECT, 0);
+    cfg_write32(common, VIRTIO_COMMON_GF, 0);
+    cfg_write32(common, VIRTIO_COMMON_GFSELECT, 1);
+    cfg_write32(common, VIRTIO_COMMON_GF, (uint32_t)(VIRTIO_F_VERSION_1 >> 32));
+    
+    cfg_write8(common, VIRTIO_COMMON_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER |
+                                             VIRTIO_STATUS_FEATURES_OK);
+    if (!(cfg_read8(common, VIRTIO_COMMON_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+        return -1;
+    }
+    
+    dev->num_scanouts = cfg_read32(dev->device_cfg, VIRTIO_GPU_CFG_NUM_SCANOUTS);
+    if (dev->num_scanouts == 0) {
+        return -1;
+    }
+    
+    if (virtio_gpu_setup_queue(dev) != 0) {
+        return -1;
+    }
+    
+    cfg_write8(common, VIRTIO_COMMON_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER |
+                                             VIRTIO_STATUS_FEATURES_OK |
+                                             VIRTIO_STATUS_DRIVER_OK);
+    return 0;
+}
+
+// =============================================================================
+// Driver Interface
+// =============================================================================
+
+static void* virtio_gpu_probe(device_node_t* node) {
+    // Modern-only VirtIO GPU (device ID 0x1040 + 16)
+    if (node->vendor_id != 0x1AF4 || node->device_id != 0x1050) {
+        return NULL;
+    }
+    if (g_virtio_gpu_count >= MAX_VIRTIO_GPU_DEVICES) {
+        return NULL;
+    }
+    
+    virtio_gpu_device_t* dev = flux_allocate(NULL, sizeof(virtio_gpu_device_t),
+                                            FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!dev) {
+        return NULL;
+    }
+    spinlock_init(&dev->lock);
+    
+    pci_device_info_t* pci_info = (pci_device_info_t*)node->bus_specific_data;
+    if (virtio_gpu_find_caps(dev, pci_info) != 0 || virtio_gpu_init_device(dev) != 0) {
+        if (dev->common_cfg) {
+            cfg_write8(dev->common_cfg, VIRTIO_COMMON_STATUS, VIRTIO_STATUS_FAILED);
+        }
+        virtio_gpu_destroy_queue(&dev->control);
+        flux_free(dev);
+        return NULL;
+    }
+    
+    // Add to global list
+    spinlock_acquire(&g_virtio_gpu_lock);
+    g_virtio_gpu_devices[g_virtio_gpu_count++] = dev;
+    spinlock_release(&g_virtio_gpu_lock);
+    
+    return dev;
+}
+
+static int virtio_gpu_attach(device_handle_t* handle) {
+    virtio_gpu_device_t* dev = (virtio_gpu_device_t*)handle->driver_data;
+    
+    // Commands are polled; display change events aren't taken
+    dev->ready = true;
+    return 0;
+}
+
+static void virtio_gpu_detach(device_handle_t* handle) {
+    virtio_gpu_device_t* dev = (virtio_gpu_device_t*)handle->driver_data;
+    
+    spinlock_acquire(&dev->lock);
+    dev->ready = false;
+    spinlock_release(&dev->lock);
+    
+    // Reset device
+    cfg_write8(dev->common_cfg, VIRTIO_COMMON_STATUS, 0);
+    virtio_gpu_destroy_queue(&dev->control);
+}
+
+// Driver registration
+static resonance_driver_t virtio_gpu_driver = {
+    .name = "virtio-gpu",
+    .vendor_ids = {0x1AF4, 0},
+    .device_ids = {0x1050, 0},  // VirtIO GPU device
+    .probe = virtio_gpu_probe,
+    .attach = virtio_gpu_attach,
+    .detach = virtio_gpu_detach
+};
+
+void virtio_gpu_init(void) {
+    resonance_register_driver(&virtio_gpu_driver);
+}
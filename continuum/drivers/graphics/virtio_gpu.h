@@ -0,0 +1,236 @@
+/*
+ * VirtIO GPU Driver Header
+ * Virtual GPU definitions: 2D resources in guest memory, shown by the host
+ */
+
+#ifndef VIRTIO_GPU_H
+#define VIRTIO_GPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../resonance.h"
+
+// =============================================================================
+// VirtIO GPU Constants
+// =============================================================================
+
+#define MAX_VIRTIO_GPU_DEVICES  4
+#define VIRTIO_GPU_QUEUE_SIZE   64      // Control queue entries, at most
+#define VIRTIO_GPU_SLOTS        32      // Commands in flight, two descriptors each
+#define VIRTIO_GPU_SLOT_SIZE    1024    // Command, then response at half way
+#define VIRTIO_GPU_MAX_SCANOUTS 16
+
+// Timeouts (microseconds)
+#define VIRTIO_GPU_CMD_TIMEOUT  1000000
+
+// PCI capabilities (modern transport; the GPU has no legacy one)
+#define VIRTIO_PCI_CAP_VENDOR       0x09
+#define VIRTIO_PCI_CAP_COMMON_CFG   1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG   2
+#define VIRTIO_PCI_CAP_ISR_CFG      3
+#define VIRTIO_PCI_CAP_DEVICE_CFG   4
+
+// Common configuration offsets
+#define VIRTIO_COMMON_DFSELECT      0x00
+#define VIRTIO_COMMON_DF            0x04
+#define VIRTIO_COMMON_GFSELECT      0x08
+#define VIRTIO_COMMON_GF            0x0C
+#define VIRTIO_COMMON_MSIX          0x10
+#define VIRTIO_COMMON_NUMQ          0x12
+#define VIRTIO_COMMON_STATUS        0x14
+#define VIRTIO_COMMON_Q_SELECT      0x16
+#define VIRTIO_COMMON_Q_SIZE        0x18
+#define VIRTIO_COMMON_Q_MSIX        0x1A
+#define VIRTIO_COMMON_Q_ENABLE      0x1C
+#define VIRTIO_COMMON_Q_NOFF        0x1E
+#define VIRTIO_COMMON_Q_DESC        0x20
+#define VIRTIO_COMMON_Q_AVAIL       0x28
+#define VIRTIO_COMMON_Q_USED        0x30
+
+#define VIRTIO_F_VERSION_1          (1ULL << 32)
+
+// VirtIO status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FEATURES_OK   0x08
+#define VIRTIO_STATUS_FAILED        0x80
+
+// VirtIO GPU device configuration offsets
+#define VIRTIO_GPU_CFG_EVENTS_READ  0x00
+#define VIRTIO_GPU_CFG_EVENTS_CLEAR 0x04
+#define VIRTIO_GPU_CFG_NUM_SCANOUTS 0x08
+
+// Control commands
+#define VIRTIO_GPU_CMD_GET_DISPLAY_INFO         0x0100
+#define VIRTIO_GPU_CMD_RESOURCE_CREATE_2D       0x0101
+#define VIRTIO_GPU_CMD_RESOURCE_UNREF           0x0102
+#define VIRTIO_GPU_CMD_SET_SCANOUT              0x0103
+#define VIRTIO_GPU_CMD_RESOURCE_FLUSH           0x0104
+#define VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D      0x0105
+#define VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING  0x0106
+#define VIRTIO_GPU_CMD_RESOURCE_DETACH_BACKING  0x0107
+
+// Responses
+#define VIRTIO_GPU_RESP_OK_NODATA               0x1100
+#define VIRTIO_GPU_RESP_OK_DISPLAY_INFO         0x1101
+
+// Formats, named by byte order in memory: B8G8R8X8 is a little-endian
+// 0xXXRRGGBB pixel
+#define VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM        1
+#define VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM        2
+
+// =============================================================================
+// VirtIO GPU Structures
+// =============================================================================
+
+typedef struct __attribute__((packed)) {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t fence_id;
+    uint32_t ctx_id;
+    uint8_t ring_idx;
+    uint8_t padding[3];
+} virtio_gpu_ctrl_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} virtio_gpu_rect_t;
+
+typedef struct __attribute__((packed)) {
+    virtio_gpu_ctrl_hdr_t hdr;
+    struct __attribute__((packed)) {
+        virtio_gpu_rect_t r;
+        uint32_t enabled;
+        uint32_t flags;
+    } pmodes[VIRTIO_GPU_MAX_SCANOUTS];
+} virtio_gpu_resp_display_info_t;
+
+typedef struct __attribute__((packed)) {
+    virtio_gpu_ctrl_hdr_t hdr;
+    uint32_t resource_id;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+} virtio_gpu_resource_create_2d_t;
+
+typedef struct __attribute__((packed)) {
+    virtio_gpu_ctrl_hdr_t hdr;
+    uint32_t resource_id;
+    uint32_t padding;
+} virtio_gpu_resource_unref_t;
+
+typedef struct __attribute__((packed)) {
+    virtio_gpu_ctrl_hdr_t hdr;
+    virtio_gpu_rect_t r;
+    uint32_t scanout_id;
+    uint32_t resource_id;
+} virtio_gpu_set_scanout_t;
+
+typedef struct __attribute__((packed)) {
+    virtio_gpu_ctrl_hdr_t hdr;
+    virtio_gpu_rect_t r;
+    uint32_t resource_id;
+    uint32_t padding;
+} virtio_gpu_resource_flush_t;
+
+typedef struct __attribute__((packed)) {
+    virtio_gpu_ctrl_hdr_t hdr;
+    virtio_gpu_rect_t r;
+    uint64_t offset;
+    uint32_t resource_id;
+    uint32_t padding;
+} virtio_gpu_transfer_to_host_2d_t;
+
+// Backing in one contiguous entry; resources are allocated that way
+typedef struct __attribute__((packed)) {
+    virtio_gpu_ctrl_hdr_t hdr;
+    uint32_t resource_id;
+    uint32_t nr_entries;
+    uint64_t addr;
+    uint32_t length;
+    uint32_t padding;
+} virtio_gpu_resource_attach_backing_t;
+
+// A resource the host can show, with its pixels in guest memory
+typedef struct {
+    uint32_t id;
+    uint32_t width;
+    uint32_t height;
+    uint32_t* pixels;           // width * height, no padding between rows
+    dma_region_t* backing;
+} virtio_gpu_resource_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} virtio_gpu_desc_t;
+
+// Split ring for the control queue, polled: commands are short and their
+// submitters wait for them. Slot i is descriptors 2i (command) and 2i + 1
+// (response), so nothing needs a free list.
+typedef struct {
+    uint16_t size;
+    uint16_t slots;
+    uint16_t avail_idx;
+    
+    volatile virtio_gpu_desc_t* desc;
+    volatile uint16_t* avail;       // flags, idx, ring[]
+    volatile uint8_t* used;         // flags, idx, ring[] of id and len
+    volatile uint16_t* notify;
+    
+    dma_region_t* ring_dma;
+    dma_region_t* slot_dma;         // VIRTIO_GPU_SLOTS command slots
+} virtio_gpu_queue_t;
+
+// VirtIO GPU device
+typedef struct virtio_gpu_device {
+    // Device access
+    volatile uint8_t* common_cfg;
+    volatile uint8_t* device_cfg;
+    volatile uint8_t* notify_base;
+    uint32_t notify_multiplier;
+    
+    bool ready;
+    uint32_t num_scanouts;
+    virtio_gpu_queue_t control;
+    uint32_t next_resource_id;
+    
+    spinlock_t lock;                // Control queue and commands
+    
+    // Statistics
+    uint64_t commands;
+    uint64_t errors;                // Failed or timed out
+    uint64_t bytes_transferred;
+} virtio_gpu_device_t;
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// Initialization
+void virtio_gpu_init(void);
+
+// Device management
+virtio_gpu_device_t* virtio_gpu_get_device(uint32_t index);
+uint32_t virtio_gpu_get_device_count(void);
+int virtio_gpu_get_display(virtio_gpu_device_t* dev, uint32_t scanout,
+                           uint32_t* width, uint32_t* height);
+
+// Resources. A scanout shows a resource; present copies rects of it from
+// guest memory to the host and has them shown, waiting until they have been.
+virtio_gpu_resource_t* virtio_gpu_create_resource(virtio_gpu_device_t* dev, uint32_t width,
+                                                  uint32_t height);
+void virtio_gpu_destroy_resource(virtio_gpu_device_t* dev, virtio_gpu_resource_t* resource);
+int virtio_gpu_set_scanout(virtio_gpu_device_t* dev, uint32_t scanout,
+                           virtio_gpu_resource_t* resource);
+int virtio_gpu_present(virtio_gpu_device_t* dev, virtio_gpu_resource_t* resource,
+                       const virtio_gpu_rect_t* rects, uint32_t count);
+
+#endif /* VIRTIO_GPU_H */
@@ -0,0 +1,143 @@
+/*
+ * Input Event Queue for Continuum Kernel
+ * Every input driver's reports, in order, in one lock-free ring
+ */
+
+#include "input_event.h"
+#include "../../continuum_core.h"
+#include "../../temporal_scheduler.h"
+
+#define INPUT_QUEUE_MASK        (INPUT_QUEUE_SIZE - 1)
+
+// =============================================================================
+// Global Queue State
+// =============================================================================
+
+// Positions count up forever; a slot's stamp says where it is in the lap
+// of the position that uses it: 2 * lap free for writing, 2 * lap + 1
+// written. Zeroed, every slot is free for lap 0, so the queue needs no
+// initialising before the first interrupt.
+typedef struct {
+    uint32_t stamp;
+    input_event_t event;
+} input_slot_t;
+
+static struct {
+    input_slot_t slots[INPUT_QUEUE_SIZE];
+    uint64_t head;                  // Next position producers reserve
+    uint64_t tail;                  // Next position the reader takes
+    quantum_context_t* reader;      // Waiting in input_event_wait
+    input_stats_t stats;
+} g_input;
+
+static inline uint32_t input_stamp(uint64_t pos) {
+    return (uint32_t)(pos / INPUT_QUEUE_SIZE) * 2;
+}
+
+// =============================================================================
+// Producers
+// =============================================================================
+
+bool input_event_report(const input_event_t* events, uint32_t count) {
+    if (count >= INPUT_MAX_REPORT) {
+        return false;
+    }
+    
+    // Reserve the whole report at once. The reader frees slots in order,
+    // so if the last is free for this lap all before it are too.
+    uint32_t total = count + 1;
+    uint64_t pos = __atomic_load_n(&g_input.head, __ATOMIC_RELAXED);
+    for (;;) {
+        uint64_t last = pos + total - 1;
+        uint32_t stamp = __atomic_load_n(&g_input.slots[last & INPUT_QUEUE_MASK].stamp,
+                                         __ATOMIC_ACQUIRE);
+        int32_t lag = (int32_t)(stamp - input_stamp(last));
+        
+        if (lag == 0) {
+            if (__atomic_compare_exchange_n(&g_input.head, &pos, pos + total, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (lag < 0) {
+            // Not yet read from the last lap: full
+            __atomic_fetch_add(&g_input.stats.dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        } else {
+            pos = __atomic_load_n(&g_input.head, __ATOMIC_RELAXED);
+        }
+    }
+    
+    uint64_t now = continuum_get_time();
+    for (uint32_t i = 0; i < total; i++) {
+        input_slot_t* slot = &g_input.slots[(pos + i) & INPUT_QUEUE_MASK];
+        if (i < count) {
+            slot->event = events[i];
+        } else {
+            slot->event = (input_event_t){ .type = INPUT_EV_SYN, .code = INPUT_SYN_REPORT };
+        }
+        slot->event.timestamp = now;
+        __atomic_store_n(&slot->stamp, input_stamp(pos + i) + 1, __ATOMIC_RELEASE);
+    }
+    
+    __atomic_fetch_add(&g_input.stats.events, total, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_input.stats.reports, 1, __ATOMIC_RELAXED);
+    
+    // Either the reader sees these events or this sees the reader
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    quantum_context_t* reader = __atomic_load_n(&g_input.reader, __ATOMIC_RELAXED);
+    if (reader) {
+        temporal_unblock(reader);
+    }
+    return true;
+}
+
+// =============================================================================
+// Reader
+// =============================================================================
+
+static inline bool input_event_pending(void) {
+    uint64_t tail = g_input.tail;
+    return __atomic_load_n(&g_input.slots[tail & INPUT_QUEUE_MASK].stamp, __ATOMIC_ACQUIRE) ==
+           input_stamp(tail) + 1;
+}
+
+// Stops at a report still being written, which the next read picks up
+uint32_t input_event_read(input_event_t* events, uint32_t max) {
+    uint32_t count = 0;
+    
+    while (count < max) {
+        uint64_t tail = g_input.tail;
+        input_slot_t* slot = &g_input.slots[tail & INPUT_QUEUE_MASK];
+        if (__atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE) != input_stamp(tail) + 1) {
+            break;
+        }
+        
+        events[count++] = slot->event;
+        __atomic_store_n(&slot->stamp, input_stamp(tail) + 2, __ATOMIC_RELEASE);
+        g_input.tail = tail + 1;
+    }
+    
+    return count;
+}
+
+// A report landing between the check and the sleep on another CPU can't
+// cut the sleep short; the timeout bounds what that costs
+bool input_event_wait(uint64_t timeout_usec) {
+    if (input_event_pending()) {
+        return true;
+    }
+    
+    __atomic_store_n(&g_input.reader, temporal_get_current(), __ATOMIC_SEQ_CST);
+    if (!input_event_pending()) {
+        temporal_sleep(timeout_usec);
+    }
+    __atomic_store_n(&g_input.reader, NULL, __ATOMIC_RELEASE);
+    
+    return input_event_pending();
+}
+
+void input_event_get_stats(input_stats_t* stats) {
+    stats->events = __atomic_load_n(&g_input.stats.events, __ATOMIC_RELAXED);
+    stats->reports = __atomic_load_n(&g_input.stats.reports, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&g_input.stats.dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,87 @@
+/*
+ * Input Event Queue Header
+ * One timestamped event stream from every input driver, evdev style
+ */
+
+#ifndef INPUT_EVENT_H
+#define INPUT_EVENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// =============================================================================
+// Input Event Constants
+// =============================================================================
+
+#define INPUT_QUEUE_SIZE        1024    // Events, a power of two
+#define INPUT_MAX_REPORT        32      // Events in one report, with its SYN
+
+// Event types
+#define INPUT_EV_SYN            0x00    // End of a report
+#define INPUT_EV_KEY            0x01    // Key or button
+#define INPUT_EV_REL            0x02    // Relative axis
+#define INPUT_EV_ABS            0x03    // Absolute axis
+
+// INPUT_EV_SYN codes
+#define INPUT_SYN_REPORT        0x00
+
+// INPUT_EV_REL codes. Y grows downwards, as on screen.
+#define INPUT_REL_X             0x00
+#define INPUT_REL_Y             0x01
+#define INPUT_REL_HWHEEL        0x06
+#define INPUT_REL_WHEEL         0x08    // Positive away from the user
+
+// INPUT_EV_ABS codes
+#define INPUT_ABS_X             0x00
+#define INPUT_ABS_Y             0x01
+
+// INPUT_EV_KEY codes: keys are the keyboard drivers' key values (ASCII
+// before shift, or KEY_* from ps2_keyboard.h), buttons start here. Values
+// are 1 pressed, 2 repeated and 0 released.
+#define INPUT_KEY_CTRL          0x80    // KEY_CTRL, KEY_SHIFT and KEY_ALT
+#define INPUT_KEY_SHIFT         0x81
+#define INPUT_KEY_ALT           0x82
+#define INPUT_KEY_GUI           0xA0
+
+#define INPUT_BTN_LEFT          0x110
+#define INPUT_BTN_RIGHT         0x111
+#define INPUT_BTN_MIDDLE        0x112
+#define INPUT_BTN_SIDE          0x113
+#define INPUT_BTN_EXTRA         0x114
+
+// =============================================================================
+// Data Structures
+// =============================================================================
+
+typedef struct {
+    uint64_t timestamp;         // TSC when the driver saw it
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+} input_event_t;
+
+// Queue statistics
+typedef struct {
+    uint64_t events;
+    uint64_t reports;
+    uint64_t dropped;           // Reports lost to a full queue
+} input_stats_t;
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// Drivers, from interrupt handlers or callbacks on any CPU: queue count
+// events and a SYN_REPORT after them as one report, never interleaved with
+// another's, and wake the reader. False if the queue had no room for it.
+bool input_event_report(const input_event_t* events, uint32_t count);
+
+// The one reader: take up to max events, or wait up to timeout_usec for
+// some to arrive (true if there are)
+uint32_t input_event_read(input_event_t* events, uint32_t max);
+bool input_event_wait(uint64_t timeout_usec);
+
+void input_event_get_stats(input_stats_t* stats);
+
+#endif /* INPUT_EVENT_H */
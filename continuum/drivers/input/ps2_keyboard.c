@@ -4,6 +4,7 @@
  */
 
 #include "ps2_keyboard.h"
+#include "input_event.h"
 #include "../resonance.h"
 #include "../../flux_memory.h"
 #include "../../conduit_ipc.h"
@@ -109,6 +110,66 @@ static void ps2_keyboard_set_typematic(uint8_t rate) {
 // Scan Code Processing
 // =============================================================================
 
+// The key a scan code stands for whatever the modifiers, as the input
+// queue reports it; 0 for those it doesn't
+static uint8_t ps2_keyboard_event_key(uint8_t scancode, bool extended) {
+    if (extended) {
+        switch (scancode) {
+            case 0x1D: return KEY_CTRL;
+            case 0x38: return KEY_ALT;
+            case 0x48: return KEY_UP;
+            case 0x50: return KEY_DOWN;
+            case 0x4B: return KEY_LEFT;
+            case 0x4D: return KEY_RIGHT;
+            case 0x47: return KEY_HOME;
+            case 0x4F: return KEY_END;
+            case 0x49: return KEY_PAGEUP;
+            case 0x51: return KEY_PAGEDOWN;
+            case 0x53: return KEY_DELETE;
+            case 0x52: return KEY_INSERT;
+            case 0x1C: return '\n';
+            default: return 0;
+        }
+    }
+    
+    switch (scancode) {
+        case 0x2A:
+        case 0x36: return KEY_SHIFT;
+        case 0x1D: return KEY_CTRL;
+        case 0x38: return KEY_ALT;
+        case 0x3A: return KEY_CAPSLOCK;
+        case 0x45: return KEY_NUMLOCK;
+        case 0x46: return KEY_SCROLLLOCK;
+        case 0x57: return KEY_F11;
+        case 0x58: return KEY_F12;
+    }
+    if (scancode >= 0x3B && scancode <= 0x44) {
+        return KEY_F1 + (scancode - 0x3B);
+    }
+    return scancode_to_ascii[scancode];
+}
+
+// Queue a key as pressed, repeated or released; g_kbd_lock is held
+static void ps2_keyboard_report(uint8_t key, bool release) {
+    if (key == 0) {
+        return;
+    }
+    
+    uint32_t bit = 1u << (key & 31);
+    uint32_t* down = &g_keyboard.keys_down[key >> 5];
+    input_event_t event = {
+        .type = INPUT_EV_KEY,
+        .code = key,
+        .value = release ? 0 : (*down & bit) ? 2 : 1
+    };
+    if (release) {
+        *down &= ~bit;
+    } else {
+        *down |= bit;
+    }
+    input_event_report(&event, 1);
+}
+
 static void ps2_keyboard_process_scancode(uint8_t scancode) {
     spinlock_acquire(&g_kbd_lock);
     
@@ -122,6 +183,8 @@ static void ps2_keyboard_process_scancode(uint8_t scancode) {
     bool key_release = (scancode & 0x80) != 0;
     scancode &= 0x7F;
     
+    ps2_keyboard_report(ps2_keyboard_event_key(scancode, g_keyboard.extended), key_release);
+    
     if (g_keyboard.extended) {
         // Handle extended keys
         g_keyboard.extended = false;
@@ -152,6 +152,9 @@ typedef struct {
     // Extended scan code flag
     bool extended;
     
+    // Keys held, by key value, to tell repeats from presses
+    uint32_t keys_down[8];
+    
     // Keyboard buffer
     uint8_t buffer[KBD_BUFFER_SIZE];
     uint32_t buffer_read;
@@ -4,6 +4,7 @@
  */
 
 #include "ps2_mouse.h"
+#include "input_event.h"
 #include "../resonance.h"
 #include "../../flux_memory.h"
 #include "../../conduit_ipc.h"
@@ -137,6 +138,38 @@ static void ps2_mouse_process_packet(void) {
     g_mouse.right_button = (status & MOUSE_PACKET_RIGHT_BTN) != 0;
     g_mouse.middle_button = (status & MOUSE_PACKET_MIDDLE_BTN) != 0;
     
+    // The whole packet as one report to the input queue
+    input_event_t report[5];
+    uint32_t count = 0;
+    if (x_movement != 0) {
+        report[count++] = (input_event_t){ .type = INPUT_EV_REL, .code = INPUT_REL_X,
+                                           .value = x_movement };
+    }
+    if (y_movement != 0) {
+        report[count++] = (input_event_t){ .type = INPUT_EV_REL, .code = INPUT_REL_Y,
+                                           .value = -y_movement };
+    }
+    if (g_mouse.left_button != left_prev) {
+        report[count++] = (input_event_t){ .type = INPUT_EV_KEY, .code = INPUT_BTN_LEFT,
+                                           .value = g_mouse.left_button };
+    }
+    if (g_mouse.right_button != right_prev) {
+        report[count++] = (input_event_t){ .type = INPUT_EV_KEY, .code = INPUT_BTN_RIGHT,
+                                           .value = g_mouse.right_button };
+    }
+    if (g_mouse.middle_button != middle_prev) {
+        report[count++] = (input_event_t){ .type = INPUT_EV_KEY, .code = INPUT_BTN_MIDDLE,
+                                           .value = g_mouse.middle_button };
+    }
+    if (z_movement != 0) {
+        // Positive is towards the user here
+        report[count++] = (input_event_t){ .type = INPUT_EV_REL, .code = INPUT_REL_WHEEL,
+                                           .value = -z_movement };
+    }
+    if (count > 0) {
+        input_event_report(report, count);
+    }
+    
     // Generate events
     mouse_event_t event = {0};
     event.x = g_mouse.x;
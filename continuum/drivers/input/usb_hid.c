@@ -4,6 +4,7 @@
  */
 
 #include "usb_hid.h"
+#include "input_event.h"
 #include "../resonance.h"
 #include "../../flux_memory.h"
 #include "../../conduit_ipc.h"
@@ -121,13 +122,29 @@ static int hid_parse_report_descriptor(usb_hid_device_t* hid, uint8_t* descripto
 static void hid_process_keyboard_report(usb_hid_device_t* hid, uint8_t* report) {
     hid_keyboard_t* kbd = &hid->keyboard;
     
+    // The report's changes, as one report to the input queue
+    input_event_t events[4 + 6 + 6];  // Modifiers, presses, releases
+    uint32_t count = 0;
+    
     // Check modifier keys
     uint8_t modifiers = report[0];
+    bool held[4] = { kbd->ctrl_pressed, kbd->shift_pressed, kbd->alt_pressed, kbd->gui_pressed };
     kbd->ctrl_pressed = (modifiers & 0x11) != 0;  // Left or right ctrl
     kbd->shift_pressed = (modifiers & 0x22) != 0; // Left or right shift
     kbd->alt_pressed = (modifiers & 0x44) != 0;   // Left or right alt
     kbd->gui_pressed = (modifiers & 0x88) != 0;   // Left or right GUI
     
+    static const uint16_t modifier_keys[4] = {
+        INPUT_KEY_CTRL, INPUT_KEY_SHIFT, INPUT_KEY_ALT, INPUT_KEY_GUI
+    };
+    for (int i = 0; i < 4; i++) {
+        bool pressed = (modifiers & (0x11 << i)) != 0;
+        if (pressed != held[i]) {
+            events[count++] = (input_event_t){ .type = INPUT_EV_KEY, .code = modifier_keys[i],
+                                               .value = pressed };
+        }
+    }
+    
     // Process key codes (up to 6 simultaneous keys)
     for (int i = 2; i < 8; i++) {
         uint8_t key = report[i];
@@ -155,6 +172,11 @@ static void hid_process_keyboard_report(usb_hid_device_t* hid, uint8_t* report)
             // New key press
             uint8_t ascii = 0;
             
+            if (hid_to_ascii[key] != 0) {
+                events[count++] = (input_event_t){ .type = INPUT_EV_KEY,
+                                                   .code = hid_to_ascii[key], .value = 1 };
+            }
+            
             if (key < 256) {
                 ascii = hid_to_ascii[key];
                 
@@ -179,11 +201,15 @@ static void hid_process_keyboard_report(usb_hid_device_t* hid, uint8_t* report)
     
     // Check for released keys
     for (int i = 0; i < 6; i++) {
-        if (kbd->prev_keys[i] != 0) {
-            // Key was released
-            // Could generate key-up event here
+        if (kbd->prev_keys[i] > 0x01 && hid_to_ascii[kbd->prev_keys[i]] != 0) {
+            events[count++] = (input_event_t){ .type = INPUT_EV_KEY,
+                                               .code = hid_to_ascii[kbd->prev_keys[i]],
+                                               .value = 0 };
         }
     }
+    if (count > 0) {
+        input_event_report(events, count);
+    }
     
     // Save current keys as previous
     memcpy(kbd->prev_keys, &report[2], 6);
@@ -224,6 +250,37 @@ static void hid_process_mouse_report(usb_hid_device_t* hid, uint8_t* report) {
     mouse->right_button = (buttons & 0x02) != 0;
     mouse->middle_button = (buttons & 0x04) != 0;
     
+    // The whole report as one report to the input queue
+    input_event_t events[5];
+    uint32_t count = 0;
+    if (x_movement != 0) {
+        events[count++] = (input_event_t){ .type = INPUT_EV_REL, .code = INPUT_REL_X,
+                                           .value = x_movement };
+    }
+    if (y_movement != 0) {
+        events[count++] = (input_event_t){ .type = INPUT_EV_REL, .code = INPUT_REL_Y,
+                                           .value = y_movement };
+    }
+    if (mouse->left_button != left_prev) {
+        events[count++] = (input_event_t){ .type = INPUT_EV_KEY, .code = INPUT_BTN_LEFT,
+                                           .value = mouse->left_button };
+    }
+    if (mouse->right_button != right_prev) {
+        events[count++] = (input_event_t){ .type = INPUT_EV_KEY, .code = INPUT_BTN_RIGHT,
+                                           .value = mouse->right_button };
+    }
+    if (mouse->middle_button != middle_prev) {
+        events[count++] = (input_event_t){ .type = INPUT_EV_KEY, .code = INPUT_BTN_MIDDLE,
+                                           .value = mouse->middle_button };
+    }
+    if (wheel != 0) {
+        events[count++] = (input_event_t){ .type = INPUT_EV_REL, .code = INPUT_REL_WHEEL,
+                                           .value = wheel };
+    }
+    if (count > 0) {
+        input_event_report(events, count);
+    }
+    
     // Generate events
     mouse_event_t event = {0};
     event.x = mouse->x;
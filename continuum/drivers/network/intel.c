@@ -6,6 +6,7 @@
 #include "intel.h"
 #include "../resonance.h"
 #include "../../flux_memory.h"
+#include "../../temporal_scheduler.h"
 
 // =============================================================================
 // Global Intel NIC State
@@ -107,43 +108,107 @@ static void intel_read_mac_address(intel_nic_t* nic) {
 }
 
 // =============================================================================
-// Receive Descriptor Ring
+// Receive Descriptor Rings
 // =============================================================================
 
-static int intel_init_rx_ring(intel_nic_t* nic) {
+static void intel_free_rx_queue(intel_rx_queue_t* rxq) {
+    for (int i = 0; i < INTEL_RX_DESC_COUNT; i++) {
+        net_buffer_put(rxq->buffers[i]);
+        rxq->buffers[i] = NULL;
+    }
+    if (rxq->ring_dma) {
+        resonance_free_dma(rxq->ring_dma);
+        rxq->ring_dma = NULL;
+    }
+}
+
+static int intel_init_rx_queue(intel_nic_t* nic, uint32_t q) {
+    intel_rx_queue_t* rxq = &nic->rx_queues[q];
+    rxq->nic = nic;
+    rxq->index = q;
+    spinlock_init(&rxq->lock);
+    
     // Allocate descriptor ring
     size_t ring_size = INTEL_RX_DESC_COUNT * sizeof(intel_rx_desc_t);
-    nic->rx_ring_dma = resonance_alloc_dma(ring_size, DMA_FLAG_COHERENT);
-    if (!nic->rx_ring_dma) {
+    rxq->ring_dma = resonance_alloc_dma(ring_size, DMA_FLAG_COHERENT);
+    if (!rxq->ring_dma) {
         return -1;
     }
     
-    nic->rx_ring = (intel_rx_desc_t*)nic->rx_ring_dma->virtual_addr;
-    memset(nic->rx_ring, 0, ring_size);
+    rxq->ring = (intel_rx_desc_t*)rxq->ring_dma->virtual_addr;
+    memset(rxq->ring, 0, ring_size);
     
     // Allocate receive buffers
     for (int i = 0; i < INTEL_RX_DESC_COUNT; i++) {
-        nic->rx_buffers[i] = resonance_alloc_dma(INTEL_RX_BUFFER_SIZE,
-                                                 DMA_FLAG_COHERENT);
-        if (!nic->rx_buffers[i]) {
-            // Clean up
-            for (int j = 0; j < i; j++) {
-                resonance_free_dma(nic->rx_buffers[j]);
-            }
-            resonance_free_dma(nic->rx_ring_dma);
+        rxq->buffers[i] = net_buffer_alloc();
+        if (!rxq->buffers[i]) {
+            intel_free_rx_queue(rxq);
             return -1;
         }
         
-        nic->rx_ring[i].addr = nic->rx_buffers[i]->physical_addr;
-        nic->rx_ring[i].status = 0;
+        rxq->ring[i].addr = net_buffer_dma(rxq->buffers[i]);
+        rxq->ring[i].status = 0;
     }
     
     // Configure receive registers
-    intel_write32(nic, INTEL_REG_RDBAL, nic->rx_ring_dma->physical_addr & 0xFFFFFFFF);
-    intel_write32(nic, INTEL_REG_RDBAH, nic->rx_ring_dma->physical_addr >> 32);
-    intel_write32(nic, INTEL_REG_RDLEN, ring_size);
-    intel_write32(nic, INTEL_REG_RDH, 0);
-    intel_write32(nic, INTEL_REG_RDT, INTEL_RX_DESC_COUNT - 1);
+    intel_write32(nic, INTEL_REG_RDBAL_Q(q), rxq->ring_dma->physical_addr & 0xFFFFFFFF);
+    intel_write32(nic, INTEL_REG_RDBAH_Q(q), rxq->ring_dma->physical_addr >> 32);
+    intel_write32(nic, INTEL_REG_RDLEN_Q(q), ring_size);
+    if (nic->multi_queue) {
+        intel_write32(nic, INTEL_REG_SRRCTL(q), INTEL_SRRCTL_BSIZE_2K | INTEL_SRRCTL_DROP_EN);
+        intel_write32(nic, INTEL_REG_RXDCTL(q),
+                      intel_read32(nic, INTEL_REG_RXDCTL(q)) | INTEL_RXDCTL_ENABLE);
+    }
+    intel_write32(nic, INTEL_REG_RDH_Q(q), 0);
+    intel_write32(nic, INTEL_REG_RDT_Q(q), INTEL_RX_DESC_COUNT - 1);
+    
+    rxq->cur = 0;
+    
+    return 0;
+}
+
+// Spread flows over the queues: the redirection table deals its entries
+// out round-robin, hashing addresses and TCP/UDP ports with the usual key
+static void intel_setup_rss(intel_nic_t* nic) {
+    static const uint32_t key[INTEL_RSSRK_WORDS] = {
+        0xDA565A6D, 0xC20E5B25, 0x3D256741, 0xB08FA343, 0xCB2BCAD0,
+        0xB4307BAE, 0xA32DCB77, 0x0CF23080, 0x3BB7426A, 0xFA01ACBE
+    };
+    for (int i = 0; i < INTEL_RSSRK_WORDS; i++) {
+        intel_write32(nic, INTEL_REG_RSSRK(i), key[i]);
+    }
+    
+    for (uint32_t i = 0; i < INTEL_RETA_ENTRIES; i += 4) {
+        uint32_t reta = 0;
+        for (uint32_t j = 0; j < 4; j++) {
+            reta |= ((i + j) % nic->num_queues) << (j * 8);
+        }
+        intel_write32(nic, INTEL_REG_RETA(i / 4), reta);
+    }
+    
+    intel_write32(nic, INTEL_REG_MRQC, INTEL_MRQC_RSS |
+                                       INTEL_MRQC_IPV4 | INTEL_MRQC_TCP_IPV4 |
+                                       INTEL_MRQC_UDP_IPV4 | INTEL_MRQC_IPV6 |
+                                       INTEL_MRQC_TCP_IPV6 | INTEL_MRQC_UDP_IPV6);
+}
+
+static int intel_init_rx(intel_nic_t* nic) {
+    for (uint32_t q = 0; q < nic->num_queues; q++) {
+        if (intel_init_rx_queue(nic, q) != 0) {
+            while (q-- > 0) {
+                intel_free_rx_queue(&nic->rx_queues[q]);
+            }
+            return -1;
+        }
+    }
+    
+    if (nic->num_queues > 1) {
+        intel_setup_rss(nic);
+    }
+    
+    // Check IPv4, TCP and UDP checksums on the way in
+    intel_write32(nic, INTEL_REG_RXCSUM, intel_read32(nic, INTEL_REG_RXCSUM) |
+                  INTEL_RXCSUM_IPOFL | INTEL_RXCSUM_TUOFL);
     
     // Configure receive control
     uint32_t rctl = INTEL_RCTL_EN |        // Enable receiver
@@ -157,47 +222,66 @@ static int intel_init_rx_ring(intel_nic_t* nic) {
     
     intel_write32(nic, INTEL_REG_RCTL, rctl);
     
-    nic->rx_cur = 0;
-    
     return 0;
 }
 
 // =============================================================================
-// Transmit Descriptor Ring
+// Transmit Descriptor Rings
 // =============================================================================
 
-static int intel_init_tx_ring(intel_nic_t* nic) {
+static void intel_free_tx_queue(intel_tx_queue_t* txq) {
+    for (int i = 0; i < INTEL_TX_DESC_COUNT; i++) {
+        net_buffer_put(txq->buffers[i]);
+        txq->buffers[i] = NULL;
+    }
+    if (txq->ring_dma) {
+        resonance_free_dma(txq->ring_dma);
+        txq->ring_dma = NULL;
+    }
+}
+
+static int intel_init_tx_queue(intel_nic_t* nic, uint32_t q) {
+    intel_tx_queue_t* txq = &nic->tx_queues[q];
+    spinlock_init(&txq->lock);
+    
     // Allocate descriptor ring
     size_t ring_size = INTEL_TX_DESC_COUNT * sizeof(intel_tx_desc_t);
-    nic->tx_ring_dma = resonance_alloc_dma(ring_size, DMA_FLAG_COHERENT);
-    if (!nic->tx_ring_dma) {
+    txq->ring_dma = resonance_alloc_dma(ring_size, DMA_FLAG_COHERENT);
+    if (!txq->ring_dma) {
         return -1;
     }
     
-    nic->tx_ring = (intel_tx_desc_t*)nic->tx_ring_dma->virtual_addr;
-    memset(nic->tx_ring, 0, ring_size);
+    txq->ring = (intel_tx_desc_t*)txq->ring_dma->virtual_addr;
+    memset(txq->ring, 0, ring_size);
     
-    // Allocate transmit buffers
-    for (int i = 0; i < INTEL_TX_DESC_COUNT; i++) {
-        nic->tx_buffers[i] = resonance_alloc_dma(INTEL_TX_BUFFER_SIZE,
-                                                 DMA_FLAG_COHERENT);
-        if (!nic->tx_buffers[i]) {
-            // Clean up
-            for (int j = 0; j < i; j++) {
-                resonance_free_dma(nic->tx_buffers[j]);
+    // Configure transmit registers
+    intel_write32(nic, INTEL_REG_TDBAL_Q(q), txq->ring_dma->physical_addr & 0xFFFFFFFF);
+    intel_write32(nic, INTEL_REG_TDBAH_Q(q), txq->ring_dma->physical_addr >> 32);
+    intel_write32(nic, INTEL_REG_TDLEN_Q(q), ring_size);
+    intel_write32(nic, INTEL_REG_TDH_Q(q), 0);
+    intel_write32(nic, INTEL_REG_TDT_Q(q), 0);
+    if (nic->multi_queue) {
+        intel_write32(nic, INTEL_REG_TXDCTL(q),
+                      intel_read32(nic, INTEL_REG_TXDCTL(q)) | INTEL_TXDCTL_ENABLE);
+    }
+    
+    txq->cur = 0;
+    txq->clean = 0;
+    
+    return 0;
+}
+
+static int intel_init_tx(intel_nic_t* nic) {
+    for (uint32_t q = 0; q < nic->num_queues; q++) {
+        if (intel_init_tx_queue(nic, q) != 0) {
+            intel_free_tx_queue(&nic->tx_queues[q]);
+            while (q-- > 0) {
+                intel_free_tx_queue(&nic->tx_queues[q]);
             }
-            resonance_free_dma(nic->tx_ring_dma);
             return -1;
         }
     }
     
-    // Configure transmit registers
-    intel_write32(nic, INTEL_REG_TDBAL, nic->tx_ring_dma->physical_addr & 0xFFFFFFFF);
-    intel_write32(nic, INTEL_REG_TDBAH, nic->tx_ring_dma->physical_addr >> 32);
-    intel_write32(nic, INTEL_REG_TDLEN, ring_size);
-    intel_write32(nic, INTEL_REG_TDH, 0);
-    intel_write32(nic, INTEL_REG_TDT, 0);
-    
     // Configure transmit control
     uint32_t tctl = INTEL_TCTL_EN |        // Enable transmitter
                     INTEL_TCTL_PSP |       // Pad short packets
@@ -209,8 +293,6 @@ static int intel_init_tx_ring(intel_nic_t* nic) {
     // Configure transmit IPG
     intel_write32(nic, INTEL_REG_TIPG, 0x0060200A);
     
-    nic->tx_cur = 0;
-    
     return 0;
 }
 
@@ -218,101 +300,279 @@ static int intel_init_tx_ring(intel_nic_t* nic) {
 // Packet Transmission
 // =============================================================================
 
-int intel_send_packet(intel_nic_t* nic, void* data, size_t length) {
-    if (!nic || !data || length > INTEL_TX_BUFFER_SIZE) {
-        return -1;
+// Release the buffers of every descriptor the hardware has finished
+// with, oldest first; called with the queue lock held
+static void intel_reclaim_tx(intel_tx_queue_t* txq) {
+    while (txq->clean != txq->cur && (txq->ring[txq->clean].status & INTEL_TX_STATUS_DD)) {
+        net_buffer_put(txq->buffers[txq->clean]);
+        txq->buffers[txq->clean] = NULL;
+        txq->clean = (txq->clean + 1) % INTEL_TX_DESC_COUNT;
+    }
+}
+
+// Queue a TSO frame: a context descriptor for the hardware to cut it by,
+// then one data descriptor per buffer. The frame is held by the last of
+// them, so it outlives every descriptor that points into it.
+static void intel_queue_tso(intel_tx_queue_t* txq, net_buffer_t* buffer) {
+    uint32_t tcp_start = buffer->csum_start - net_buffer_headroom(buffer);
+    uint32_t ip_start = 14;
+    uint32_t hdr_len = tcp_start + (buffer->data[tcp_start + 12] >> 4) * 4;
+    
+    // The hardware fills in each segment's IP length and checksum
+    uint8_t* ip_hdr = buffer->data + ip_start;
+    memset(ip_hdr + 2, 0, 2);
+    memset(ip_hdr + 10, 0, 2);
+    
+    intel_tx_context_desc_t* ctx = (intel_tx_context_desc_t*)&txq->ring[txq->cur];
+    ctx->ipcss = ip_start;
+    ctx->ipcso = ip_start + 10;
+    ctx->ipcse = tcp_start - 1;
+    ctx->tucss = tcp_start;
+    ctx->tucso = tcp_start + buffer->csum_offset;
+    ctx->tucse = 0;
+    ctx->cmd_and_length = (net_buffer_frame_len(buffer) - hdr_len) |
+                          ((uint32_t)(INTEL_TX_CMD_DEXT | INTEL_TX_CMD_RS | INTEL_TX_CMD_TSE |
+                                      INTEL_TX_TUCMD_IP | INTEL_TX_TUCMD_TCP) << 24);
+    ctx->status = 0;
+    ctx->hdr_len = hdr_len;
+    ctx->mss = buffer->gso_size;
+    txq->cur = (txq->cur + 1) % INTEL_TX_DESC_COUNT;
+    
+    for (net_buffer_t* part = buffer; part; part = part->frag) {
+        uint32_t dcmd = INTEL_TX_CMD_DEXT | INTEL_TX_CMD_TSE | INTEL_TX_CMD_IFCS | INTEL_TX_CMD_RS;
+        if (!part->frag) {
+            dcmd |= INTEL_TX_CMD_EOP;
+            txq->buffers[txq->cur] = buffer;
+        }
+        
+        intel_tx_data_desc_t* desc = (intel_tx_data_desc_t*)&txq->ring[txq->cur];
+        desc->addr = net_buffer_dma(part);
+        desc->cmd_and_length = part->len | INTEL_TX_DTYP_DATA | (dcmd << 24);
+        desc->status = 0;
+        desc->popts = INTEL_TX_POPTS_IXSM | INTEL_TX_POPTS_TXSM;
+        desc->special = 0;
+        txq->cur = (txq->cur + 1) % INTEL_TX_DESC_COUNT;
+    }
+}
+
+// Each CPU sends on its own queue, so senders on different CPUs don't
+// share a ring lock. Completed descriptors are only reclaimed once the
+// ring is running short, a whole run at a time.
+int intel_send_buffers(intel_nic_t* nic, net_buffer_t** buffers, uint32_t count) {
+    if (!nic) {
+        for (uint32_t i = 0; i < count; i++) {
+            net_buffer_put(buffers[i]);
+        }
+        return 0;
     }
     
-    spinlock_acquire(&nic->tx_lock);
-    
-    uint32_t tail = nic->tx_cur;
-    intel_tx_desc_t* desc = &nic->tx_ring[tail];
+    uint32_t q = temporal_get_current_cpu() % nic->num_queues;
+    intel_tx_queue_t* txq = &nic->tx_queues[q];
+    spinlock_acquire(&txq->lock);
     
-    // Check if descriptor is still in use
-    if (!(desc->status & INTEL_TX_STATUS_DD)) {
-        spinlock_release(&nic->tx_lock);
-        return -1;  // Ring full
+    // One slot stays empty so a full ring isn't mistaken for an empty one
+    uint32_t used = (txq->cur + INTEL_TX_DESC_COUNT - txq->clean) % INTEL_TX_DESC_COUNT;
+    if (used + count >= INTEL_TX_DESC_COUNT - INTEL_TX_RECLAIM) {
+        intel_reclaim_tx(txq);
+        used = (txq->cur + INTEL_TX_DESC_COUNT - txq->clean) % INTEL_TX_DESC_COUNT;
     }
+    uint32_t room = INTEL_TX_DESC_COUNT - 1 - used;
+    
+    uint32_t queued = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        net_buffer_t* buffer = buffers[i];
+        uint32_t length = net_buffer_frame_len(buffer);
+        bool tso = buffer->gso_size && !nic->multi_queue;
+        uint32_t needed = tso ? 1 + net_buffer_frag_count(buffer) : 1;
+        bool fits = tso ? length <= INTEL_TSO_MAX_SIZE :
+                          !buffer->frag && length <= INTEL_TX_BUFFER_SIZE;
+        if (needed > room || !fits) {
+            txq->stats.tx_dropped++;
+            net_buffer_put(buffer);
+            continue;
+        }
+        room -= needed;
+        
+        if (tso) {
+            intel_queue_tso(txq, buffer);
+        } else {
+            uint32_t tail = txq->cur;
+            intel_tx_desc_t* desc = &txq->ring[tail];
+            txq->buffers[tail] = buffer;
+    
+            // Setup descriptor; a partial checksum is summed from CSS and
+            // stored at CSO
+            desc->addr = net_buffer_dma(buffer);
+            desc->length = buffer->len;
+            desc->cso = 0;
+            desc->cmd = INTEL_TX_CMD_EOP | INTEL_TX_CMD_IFCS | INTEL_TX_CMD_RS;
+            desc->status = 0;
+            desc->css = 0;
+            desc->special = 0;
+            if (buffer->flags & NET_BUFFER_CSUM_PARTIAL) {
+                desc->css = buffer->csum_start - net_buffer_headroom(buffer);
+                desc->cso = desc->css + buffer->csum_offset;
+                desc->cmd |= INTEL_TX_CMD_IC;
+            }
     
-    // Copy packet to DMA buffer
-    memcpy(nic->tx_buffers[tail]->virtual_addr, data, length);
+            txq->cur = (tail + 1) % INTEL_TX_DESC_COUNT;
+        }
+        
+        txq->stats.tx_packets++;
+        txq->stats.tx_bytes += length;
+        queued++;
+    }
     
-    // Setup descriptor
-    desc->addr = nic->tx_buffers[tail]->physical_addr;
-    desc->length = length;
-    desc->cso = 0;
-    desc->cmd = INTEL_TX_CMD_EOP | INTEL_TX_CMD_IFCS | INTEL_TX_CMD_RS;
-    desc->status = 0;
-    desc->css = 0;
-    desc->special = 0;
+    // Update tail pointer, once for the batch
+    if (queued > 0) {
+        intel_write32(nic, INTEL_REG_TDT_Q(q), txq->cur);
+    }
     
-    // Update tail pointer
-    nic->tx_cur = (tail + 1) % INTEL_TX_DESC_COUNT;
-    intel_write32(nic, INTEL_REG_TDT, nic->tx_cur);
+    spinlock_release(&txq->lock);
     
-    nic->stats.tx_packets++;
-    nic->stats.tx_bytes += length;
+    return queued;
+}
+
+int intel_send_buffer(intel_nic_t* nic, net_buffer_t* buffer) {
+    if (!buffer) {
+        return -1;
+    }
+    return intel_send_buffers(nic, &buffer, 1) == 1 ? 0 : -1;
+}
+
+int intel_send_packet(intel_nic_t* nic, void* data, size_t length) {
+    if (!nic || !data || length > INTEL_TX_BUFFER_SIZE) {
+        return -1;
+    }
     
-    spinlock_release(&nic->tx_lock);
+    net_buffer_t* buffer = net_buffer_alloc();
+    if (!buffer) {
+        return -1;
+    }
     
-    return 0;
+    memcpy(net_buffer_append(buffer, length), data, length);
+    return intel_send_buffer(nic, buffer);
 }
 
 // =============================================================================
 // Packet Reception
 // =============================================================================
 
-int intel_receive_packet(intel_nic_t* nic, void* buffer, size_t max_len) {
-    if (!nic || !buffer) {
-        return -1;
+// Errored frames, and frames there's no fresh buffer to replace, are
+// dropped and their buffer goes straight back to the hardware
+net_buffer_t* intel_receive_buffer(intel_nic_t* nic, uint32_t queue) {
+    if (!nic || queue >= nic->num_queues) {
+        return NULL;
     }
     
-    spinlock_acquire(&nic->rx_lock);
+    intel_rx_queue_t* rxq = &nic->rx_queues[queue];
+    spinlock_acquire(&rxq->lock);
     
-    uint32_t cur = nic->rx_cur;
-    intel_rx_desc_t* desc = &nic->rx_ring[cur];
+    net_buffer_t* buffer = NULL;
+    while (!buffer) {
+        uint32_t cur = rxq->cur;
+        intel_rx_desc_t* desc = &rxq->ring[cur];
     
-    // Check if packet available
-    if (!(desc->status & INTEL_RX_STATUS_DD)) {
-        spinlock_release(&nic->rx_lock);
-        return 0;  // No packet
-    }
+        // Check if packet available
+        if (!(desc->status & INTEL_RX_STATUS_DD)) {
+            break;
+        }
     
-    // Check for errors
-    if (desc->errors) {
-        // Handle error
+        net_buffer_t* fresh = desc->errors ? NULL : net_buffer_alloc_from(rxq->pool);
+        if (desc->errors) {
+            rxq->stats.rx_errors++;
+        } else if (!fresh) {
+            rxq->stats.rx_dropped++;
+        } else {
+            buffer = rxq->buffers[cur];
+            buffer->len = desc->length;
+            rxq->buffers[cur] = fresh;
+            desc->addr = net_buffer_dma(fresh);
+            
+            // Both checksums checked; a bad one would have set an error
+            uint8_t checked = INTEL_RX_STATUS_IPCS | INTEL_RX_STATUS_TCPCS;
+            if (!(desc->status & INTEL_RX_STATUS_IXSM) && (desc->status & checked) == checked) {
+                buffer->flags |= NET_BUFFER_CSUM_VALID;
+            }
+            
+            rxq->stats.rx_packets++;
+            rxq->stats.rx_bytes += buffer->len;
+        }
+    
+        // Reset descriptor
         desc->status = 0;
-        nic->rx_cur = (cur + 1) % INTEL_RX_DESC_COUNT;
-        intel_write32(nic, INTEL_REG_RDT, cur);
-        nic->stats.rx_errors++;
-        spinlock_release(&nic->rx_lock);
-        return -1;
-    }
     
-    // Get packet length
-    uint16_t length = desc->length;
-    if (length > max_len) {
-        length = max_len;
+        // Update tail pointer
+        rxq->cur = (cur + 1) % INTEL_RX_DESC_COUNT;
+        intel_write32(nic, INTEL_REG_RDT_Q(queue), cur);
     }
     
-    // Copy packet data
-    memcpy(buffer, nic->rx_buffers[cur]->virtual_addr, length);
-    
-    // Reset descriptor
-    desc->status = 0;
+    spinlock_release(&rxq->lock);
     
-    // Update tail pointer
-    nic->rx_cur = (cur + 1) % INTEL_RX_DESC_COUNT;
-    intel_write32(nic, INTEL_REG_RDT, cur);
+    return buffer;
+}
+
+// Frames from whichever queue has one
+int intel_receive_packet(intel_nic_t* nic, void* buffer, size_t max_len) {
+    if (!nic || !buffer) {
+        return -1;
+    }
     
-    nic->stats.rx_packets++;
-    nic->stats.rx_bytes += length;
+    net_buffer_t* frame = NULL;
+    for (uint32_t q = 0; q < nic->num_queues && !frame; q++) {
+        frame = intel_receive_buffer(nic, q);
+    }
+    if (!frame) {
+        return 0;  // No packet
+    }
     
-    spinlock_release(&nic->rx_lock);
+    size_t length = frame->len < max_len ? frame->len : max_len;
+    memcpy(buffer, frame->data, length);
+    net_buffer_put(frame);
     
     return length;
 }
 
+uint32_t intel_get_offloads(intel_nic_t* nic) {
+    uint32_t offloads = NET_OFFLOAD_TX_CSUM | NET_OFFLOAD_RX_CSUM;
+    if (!nic->multi_queue) {
+        offloads |= NET_OFFLOAD_TSO4;
+    }
+    return offloads;
+}
+
+uint32_t intel_rx_queue_count(intel_nic_t* nic) {
+    return nic->num_queues;
+}
+
+int intel_set_rx_pool(intel_nic_t* nic, uint32_t queue, net_buffer_pool_t* pool) {
+    if (!nic || queue >= nic->num_queues) {
+        return -1;
+    }
+    
+    intel_rx_queue_t* rxq = &nic->rx_queues[queue];
+    spinlock_acquire(&rxq->lock);
+    rxq->pool = pool;
+    spinlock_release(&rxq->lock);
+    return 0;
+}
+
+void intel_get_stats(intel_nic_t* nic, net_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (uint32_t q = 0; q < nic->num_queues; q++) {
+        intel_rx_queue_t* rxq = &nic->rx_queues[q];
+        intel_tx_queue_t* txq = &nic->tx_queues[q];
+        stats->rx_packets += rxq->stats.rx_packets;
+        stats->rx_bytes += rxq->stats.rx_bytes;
+        stats->rx_errors += rxq->stats.rx_errors;
+        stats->rx_dropped += rxq->stats.rx_dropped;
+        stats->tx_packets += txq->stats.tx_packets;
+        stats->tx_bytes += txq->stats.tx_bytes;
+        stats->tx_errors += txq->stats.tx_errors;
+        stats->tx_dropped += txq->stats.tx_dropped;
+    }
+}
+
 // =============================================================================
 // Link Management
 // =============================================================================
@@ -342,6 +602,160 @@ static void intel_check_link(intel_nic_t* nic) {
     }
 }
 
+// =============================================================================
+// Interrupts
+// =============================================================================
+
+static void intel_notify_queue(intel_rx_queue_t* rxq) {
+    void (*notify)(void*) = __atomic_load_n(&rxq->notify, __ATOMIC_ACQUIRE);
+    if (notify) {
+        notify(rxq->context);
+    }
+}
+
+// The one shared interrupt. Reading ICR acknowledges every cause; receive
+// causes are masked before the notifiers run, so a burst costs one
+// interrupt however long the rings take to drain. With more than one
+// queue they share the mask.
+static void intel_interrupt(void* context) {
+    intel_nic_t* nic = (intel_nic_t*)context;
+    
+    uint32_t icr = intel_read32(nic, INTEL_REG_ICR);
+    if (icr & INTEL_INT_LSC) {
+        intel_check_link(nic);
+    }
+    
+    if ((icr & INTEL_INT_RX) && __atomic_load_n(&nic->rx_queues[0].notify, __ATOMIC_ACQUIRE)) {
+        intel_write32(nic, INTEL_REG_IMC, INTEL_INT_RX);
+        for (uint32_t q = 0; q < nic->num_queues; q++) {
+            intel_notify_queue(&nic->rx_queues[q]);
+        }
+    }
+}
+
+// A queue's own MSI-X vector; EIAC has already cleared its cause
+static void intel_queue_interrupt(void* context) {
+    intel_rx_queue_t* rxq = (intel_rx_queue_t*)context;
+    if (__atomic_load_n(&rxq->notify, __ATOMIC_ACQUIRE)) {
+        intel_write32(rxq->nic, INTEL_REG_EIMC, 1U << rxq->index);
+        intel_notify_queue(rxq);
+    }
+}
+
+// The MSI-X vector after the queues' takes everything else
+static void intel_other_interrupt(void* context) {
+    intel_nic_t* nic = (intel_nic_t*)context;
+    
+    uint32_t icr = intel_read32(nic, INTEL_REG_ICR);
+    if (icr & INTEL_INT_LSC) {
+        intel_check_link(nic);
+    }
+    intel_write32(nic, INTEL_REG_EIMS, 1U << nic->num_queues);
+}
+
+void intel_set_rx_notify(intel_nic_t* nic, uint32_t queue, void (*notify)(void* context),
+                         void* context) {
+    if (queue >= nic->num_queues) {
+        return;
+    }
+    
+    intel_rx_queue_t* rxq = &nic->rx_queues[queue];
+    rxq->context = context;
+    __atomic_store_n(&rxq->notify, notify, __ATOMIC_RELEASE);
+}
+
+// Unmasking returns whether a frame is already waiting, since one that
+// landed while they were masked won't raise an interrupt of its own
+bool intel_set_rx_interrupts(intel_nic_t* nic, uint32_t queue, bool enable) {
+    if (queue >= nic->num_queues) {
+        return false;
+    }
+    
+    intel_rx_queue_t* rxq = &nic->rx_queues[queue];
+    if (!enable) {
+        if (rxq->irq) {
+            intel_write32(nic, INTEL_REG_EIMC, 1U << queue);
+        } else {
+            intel_write32(nic, INTEL_REG_IMC, INTEL_INT_RX);
+        }
+        return false;
+    }
+    
+    if (rxq->irq) {
+        intel_write32(nic, INTEL_REG_EIMS, 1U << queue);
+    } else {
+        intel_write32(nic, INTEL_REG_IMS, INTEL_INT_RX);
+    }
+    intel_write_flush(nic);
+    
+    volatile intel_rx_desc_t* desc = &rxq->ring[rxq->cur];
+    return (desc->status & INTEL_RX_STATUS_DD) != 0;
+}
+
+static void intel_release_irqs(intel_nic_t* nic) {
+    if (nic->msix) {
+        for (uint32_t q = 0; q <= nic->num_queues; q++) {
+            if (q == nic->num_queues || nic->rx_queues[q].irq) {
+                resonance_unregister_irq(nic->handle, RESONANCE_IRQ_QUEUE(q));
+            }
+        }
+        intel_write32(nic, INTEL_REG_GPIE, 0);
+    } else if (nic->irq_enabled) {
+        resonance_unregister_irq(nic->handle, nic->irq);
+    }
+    
+    for (uint32_t q = 0; q < nic->num_queues; q++) {
+        nic->rx_queues[q].irq = false;
+    }
+    nic->msix = false;
+    nic->irq_enabled = false;
+}
+
+// Vector q for queue q, on CPU q, then one for link changes. Every vector
+// has to register or the queues share the one interrupt instead.
+static bool intel_setup_msix(intel_nic_t* nic) {
+    nic->msix = true;
+    
+    for (uint32_t q = 0; q < nic->num_queues; q++) {
+        intel_rx_queue_t* rxq = &nic->rx_queues[q];
+        if (resonance_register_irq(nic->handle, RESONANCE_IRQ_QUEUE(q),
+                                   intel_queue_interrupt, rxq) != 0) {
+            intel_release_irqs(nic);
+            return false;
+        }
+        rxq->irq = true;
+        resonance_set_irq_affinity(nic->handle, RESONANCE_IRQ_QUEUE(q), q);
+    }
+    if (resonance_register_irq(nic->handle, RESONANCE_IRQ_QUEUE(nic->num_queues),
+                               intel_other_interrupt, nic) != 0) {
+        nic->msix = false;
+        for (uint32_t q = 0; q < nic->num_queues; q++) {
+            resonance_unregister_irq(nic->handle, RESONANCE_IRQ_QUEUE(q));
+            nic->rx_queues[q].irq = false;
+        }
+        return false;
+    }
+    
+    intel_write32(nic, INTEL_REG_GPIE, INTEL_GPIE_MSIX_MODE | INTEL_GPIE_EIAME |
+                                       INTEL_GPIE_PBA | INTEL_GPIE_NSICR);
+    
+    // Receive queue q's byte of IVAR[q / 2]; transmit completions need none
+    for (uint32_t q = 0; q < nic->num_queues; q++) {
+        uint32_t shift = (q & 1) * 16;
+        uint32_t ivar = intel_read32(nic, INTEL_REG_IVAR(q / 2));
+        ivar &= ~(0xFFU << shift);
+        ivar |= (q | INTEL_IVAR_VALID) << shift;
+        intel_write32(nic, INTEL_REG_IVAR(q / 2), ivar);
+    }
+    intel_write32(nic, INTEL_REG_IVAR_MISC, (nic->num_queues | INTEL_IVAR_VALID) << 8);
+    
+    uint32_t vectors = (1U << (nic->num_queues + 1)) - 1;
+    intel_write32(nic, INTEL_REG_EIAC, vectors);
+    intel_write32(nic, INTEL_REG_EIMS, vectors);
+    intel_write32(nic, INTEL_REG_IMC, INTEL_INT_RX);
+    return true;
+}
+
 // =============================================================================
 // Device Initialization
 // =============================================================================
@@ -366,18 +780,15 @@ static int intel_init_device(intel_nic_t* nic) {
     intel_read_mac_address(nic);
     
     // Initialize descriptor rings
-    if (intel_init_rx_ring(nic) != 0) {
+    if (intel_init_rx(nic) != 0) {
         return -1;
     }
     
-    if (intel_init_tx_ring(nic) != 0) {
-        // Clean up RX ring
-        for (int i = 0; i < INTEL_RX_DESC_COUNT; i++) {
-            if (nic->rx_buffers[i]) {
-                resonance_free_dma(nic->rx_buffers[i]);
-            }
+    if (intel_init_tx(nic) != 0) {
+        // Clean up RX rings
+        for (uint32_t q = 0; q < nic->num_queues; q++) {
+            intel_free_rx_queue(&nic->rx_queues[q]);
         }
-        resonance_free_dma(nic->rx_ring_dma);
         return -1;
     }
     
@@ -389,8 +800,7 @@ static int intel_init_device(intel_nic_t* nic) {
     intel_write32(nic, INTEL_REG_CTRL, ctrl);
     
     // Enable interrupts
-    intel_write32(nic, INTEL_REG_IMS, INTEL_INT_RXT0 | INTEL_INT_RXDMT0 |
-                                      INTEL_INT_RXO | INTEL_INT_LSC);
+    intel_write32(nic, INTEL_REG_IMS, INTEL_INT_RX | INTEL_INT_LSC);
     
     // Check link status
     intel_check_link(nic);
@@ -432,8 +842,16 @@ static void* intel_probe(device_node_t* node) {
     // Map MMIO registers (BAR0)
     nic->mmio_base = (void*)(uintptr_t)(pci_info->bars[0] & ~0x0F);
     
-    spinlock_init(&nic->rx_lock);
-    spinlock_init(&nic->tx_lock);
+    // The I210 and I211 have queues enough for a few CPUs; the rest one
+    nic->num_queues = 1;
+    if (node->device_id == 0x1533 || node->device_id == 0x1539) {
+        uint32_t cpus = continuum_get_cpu_count();
+        nic->multi_queue = true;
+        nic->num_queues = node->device_id == 0x1533 ? INTEL_MAX_QUEUES : 2;
+        if (cpus > 0 && cpus < nic->num_queues) {
+            nic->num_queues = cpus;
+        }
+    }
     
     // Initialize device
     if (intel_init_device(nic) != 0) {
@@ -451,6 +869,22 @@ static void* intel_probe(device_node_t* node) {
 
 static int intel_attach(device_handle_t* handle) {
     intel_nic_t* nic = (intel_nic_t*)handle->driver_data;
+    
+    // A vector per queue where there are queues, else MSI or the legacy
+    // line for everything; without any, receivers poll
+    nic->handle = handle;
+    if (nic->multi_queue && intel_setup_msix(nic)) {
+        nic->irq_enabled = true;
+    } else {
+        nic->irq = RESONANCE_IRQ_QUEUE(0);
+        nic->irq_enabled = resonance_register_irq(handle, nic->irq, intel_interrupt, nic) == 0;
+        if (!nic->irq_enabled) {
+            nic->irq = RESONANCE_IRQ_INTX;
+            nic->irq_enabled = resonance_register_irq(handle, nic->irq, intel_interrupt,
+                                                      nic) == 0;
+        }
+    }
+    
     nic->state = INTEL_STATE_UP;
     return 0;
 }
@@ -462,6 +896,10 @@ static void intel_detach(device_handle_t* handle) {
     intel_write32(nic, INTEL_REG_RCTL, 0);
     intel_write32(nic, INTEL_REG_TCTL, 0);
     intel_write32(nic, INTEL_REG_IMC, 0xFFFFFFFF);
+    if (nic->multi_queue) {
+        intel_write32(nic, INTEL_REG_EIMC, 0xFFFFFFFF);
+    }
+    intel_release_irqs(nic);
     
     nic->state = INTEL_STATE_DOWN;
 }
@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "../resonance.h"
+#include "net_buffer.h"
 
 // =============================================================================
 // Constants
@@ -20,6 +21,9 @@
 #define INTEL_TX_DESC_COUNT     256
 #define INTEL_RX_BUFFER_SIZE    2048
 #define INTEL_TX_BUFFER_SIZE    2048
+#define INTEL_TX_RECLAIM        32      // Free descriptors below which a send reclaims
+#define INTEL_TSO_MAX_SIZE      65535   // A TSO frame, headers and payload
+#define INTEL_MAX_QUEUES        4       // I210; the I211 has 2, the e1000s 1
 
 // Intel Registers
 #define INTEL_REG_CTRL          0x0000  // Device Control
@@ -41,6 +45,7 @@
 #define INTEL_REG_RDT           0x2818  // Receive Descriptor Tail
 #define INTEL_REG_RDTR          0x2820  // Receive Delay Timer
 #define INTEL_REG_RADV          0x282C  // Receive Absolute Delay Timer
+#define INTEL_REG_RXCSUM        0x5000  // Receive Checksum Control
 
 // Transmit Registers
 #define INTEL_REG_TCTL          0x0400  // Transmit Control
@@ -52,6 +57,36 @@
 #define INTEL_REG_TDT           0x3818  // Transmit Descriptor Tail
 #define INTEL_REG_TIDV          0x3820  // Transmit Interrupt Delay
 
+// Per-queue ring registers (82575 and later); queue 0's are the legacy ones
+#define INTEL_REG_RDBAL_Q(n)    ((n) ? 0xC000 + (n) * 0x40 : INTEL_REG_RDBAL)
+#define INTEL_REG_RDBAH_Q(n)    ((n) ? 0xC004 + (n) * 0x40 : INTEL_REG_RDBAH)
+#define INTEL_REG_RDLEN_Q(n)    ((n) ? 0xC008 + (n) * 0x40 : INTEL_REG_RDLEN)
+#define INTEL_REG_SRRCTL(n)     (0xC00C + (n) * 0x40)   // Split and Replication Receive Control
+#define INTEL_REG_RDH_Q(n)      ((n) ? 0xC010 + (n) * 0x40 : INTEL_REG_RDH)
+#define INTEL_REG_RDT_Q(n)      ((n) ? 0xC018 + (n) * 0x40 : INTEL_REG_RDT)
+#define INTEL_REG_RXDCTL(n)     (0xC028 + (n) * 0x40)   // Receive Descriptor Control
+#define INTEL_REG_TDBAL_Q(n)    ((n) ? 0xE000 + (n) * 0x40 : INTEL_REG_TDBAL)
+#define INTEL_REG_TDBAH_Q(n)    ((n) ? 0xE004 + (n) * 0x40 : INTEL_REG_TDBAH)
+#define INTEL_REG_TDLEN_Q(n)    ((n) ? 0xE008 + (n) * 0x40 : INTEL_REG_TDLEN)
+#define INTEL_REG_TDH_Q(n)      ((n) ? 0xE010 + (n) * 0x40 : INTEL_REG_TDH)
+#define INTEL_REG_TDT_Q(n)      ((n) ? 0xE018 + (n) * 0x40 : INTEL_REG_TDT)
+#define INTEL_REG_TXDCTL(n)     (0xE028 + (n) * 0x40)   // Transmit Descriptor Control
+
+// Receive Side Scaling
+#define INTEL_REG_MRQC          0x5818  // Multiple Receive Queues Command
+#define INTEL_REG_RETA(n)       (0x5C00 + (n) * 4)  // Redirection Table
+#define INTEL_REG_RSSRK(n)      (0x5C80 + (n) * 4)  // RSS Random Key
+#define INTEL_RETA_ENTRIES      128     // One byte each, four to a register
+#define INTEL_RSSRK_WORDS       10
+
+// MSI-X
+#define INTEL_REG_GPIE          0x1514  // General Purpose Interrupt Enable
+#define INTEL_REG_EIMS          0x1524  // Extended Interrupt Mask Set
+#define INTEL_REG_EIMC          0x1528  // Extended Interrupt Mask Clear
+#define INTEL_REG_EIAC          0x152C  // Extended Interrupt Auto Clear
+#define INTEL_REG_IVAR(n)       (0x1700 + (n) * 4)  // Queue to vector, two queues each
+#define INTEL_REG_IVAR_MISC     0x1740  // Other causes to vector
+
 // MAC Address Registers
 #define INTEL_REG_RAL(n)        (0x5400 + (n) * 8)  // Receive Address Low
 #define INTEL_REG_RAH(n)        (0x5404 + (n) * 8)  // Receive Address High
@@ -96,6 +131,32 @@
 #define INTEL_TCTL_CT_SHIFT     4           // Collision Threshold
 #define INTEL_TCTL_COLD_SHIFT   12          // Collision Distance
 
+// Receive Checksum Control
+#define INTEL_RXCSUM_IPOFL      (1 << 8)   // IPv4 header checksum offload
+#define INTEL_RXCSUM_TUOFL      (1 << 9)   // TCP and UDP checksum offload
+
+// Queue Control
+#define INTEL_SRRCTL_BSIZE_2K   2           // Packet buffer, in KiB
+#define INTEL_SRRCTL_DROP_EN    (1U << 31)  // A full queue drops rather than stalls the rest
+#define INTEL_RXDCTL_ENABLE     (1 << 25)
+#define INTEL_TXDCTL_ENABLE     (1 << 25)
+
+// MRQC: RSS alone, hashing these fields
+#define INTEL_MRQC_RSS          0x2
+#define INTEL_MRQC_TCP_IPV4     (1 << 16)
+#define INTEL_MRQC_IPV4         (1 << 17)
+#define INTEL_MRQC_IPV6         (1 << 20)
+#define INTEL_MRQC_TCP_IPV6     (1 << 21)
+#define INTEL_MRQC_UDP_IPV4     (1 << 22)
+#define INTEL_MRQC_UDP_IPV6     (1 << 23)
+
+// GPIE
+#define INTEL_GPIE_NSICR        (1 << 0)    // Reading ICR doesn't clear the extended causes
+#define INTEL_GPIE_MSIX_MODE    (1 << 4)
+#define INTEL_GPIE_EIAME        (1 << 30)
+#define INTEL_GPIE_PBA          (1U << 31)
+#define INTEL_IVAR_VALID        0x80
+
 // RAH Register
 #define INTEL_RAH_AV            (1 << 31)  // Address Valid
 
@@ -107,16 +168,30 @@
 #define INTEL_INT_RXDMT0        (1 << 4)   // Receive Descriptor Min Threshold
 #define INTEL_INT_RXO           (1 << 6)   // Receiver Overrun
 #define INTEL_INT_RXT0          (1 << 7)   // Receiver Timer Interrupt
+#define INTEL_INT_RX            (INTEL_INT_RXT0 | INTEL_INT_RXDMT0 | INTEL_INT_RXO)
 
 // Descriptor Status
 #define INTEL_RX_STATUS_DD      (1 << 0)   // Descriptor Done
 #define INTEL_RX_STATUS_EOP     (1 << 1)   // End of Packet
+#define INTEL_RX_STATUS_IXSM    (1 << 2)   // Ignore the checksum bits
+#define INTEL_RX_STATUS_TCPCS   (1 << 5)   // TCP or UDP checksum checked
+#define INTEL_RX_STATUS_IPCS    (1 << 6)   // IPv4 checksum checked
 #define INTEL_TX_STATUS_DD      (1 << 0)   // Descriptor Done
 
 // Transmit Command
 #define INTEL_TX_CMD_EOP        (1 << 0)   // End of Packet
 #define INTEL_TX_CMD_IFCS       (1 << 1)   // Insert FCS
+#define INTEL_TX_CMD_IC         (1 << 2)   // Insert Checksum, per CSO and CSS
 #define INTEL_TX_CMD_RS         (1 << 3)   // Report Status
+#define INTEL_TX_CMD_TSE        (1 << 2)   // TCP Segmentation Enable, extended descriptors
+#define INTEL_TX_CMD_DEXT       (1 << 5)   // Extended descriptor
+
+// Extended transmit descriptors: type, context command, data options
+#define INTEL_TX_DTYP_DATA      (1 << 20)
+#define INTEL_TX_TUCMD_TCP      (1 << 0)
+#define INTEL_TX_TUCMD_IP       (1 << 1)   // IPv4
+#define INTEL_TX_POPTS_IXSM     (1 << 0)   // Insert the IPv4 checksum
+#define INTEL_TX_POPTS_TXSM     (1 << 1)   // Insert the TCP checksum
 
 // =============================================================================
 // Data Structures
@@ -143,6 +218,30 @@ typedef struct __attribute__((packed)) {
     uint16_t special;      // Special
 } intel_tx_desc_t;
 
+// Transmit context descriptor: the offsets and sizes a TSO frame's data
+// descriptors after it are segmented by; a slot of the same ring
+typedef struct __attribute__((packed)) {
+    uint8_t ipcss;          // IP header start
+    uint8_t ipcso;          // IP checksum offset
+    uint16_t ipcse;         // IP header end, inclusive
+    uint8_t tucss;          // TCP header start
+    uint8_t tucso;          // TCP checksum offset
+    uint16_t tucse;         // Checksum end; 0 for the end of the frame
+    uint32_t cmd_and_length;    // Payload length, type 0, TUCMD in the top byte
+    uint8_t status;
+    uint8_t hdr_len;        // Ethernet, IP and TCP headers, repeated in every segment
+    uint16_t mss;
+} intel_tx_context_desc_t;
+
+// Transmit data descriptor, following a context descriptor
+typedef struct __attribute__((packed)) {
+    uint64_t addr;
+    uint32_t cmd_and_length;    // Length, INTEL_TX_DTYP_DATA, DCMD in the top byte
+    uint8_t status;
+    uint8_t popts;
+    uint16_t special;
+} intel_tx_data_desc_t;
+
 // Device State
 typedef enum {
     INTEL_STATE_DOWN = 0,
@@ -163,35 +262,62 @@ typedef struct {
     uint64_t tx_dropped;
 } net_stats_t;
 
-// Intel NIC Structure
+struct intel_nic;
+
+// Receive queue. With MSI-X it has a vector of its own on its own CPU;
+// with a notifier set, its receive interrupts stay masked after each one
+// until intel_set_rx_interrupts unmasks them.
 typedef struct {
+    struct intel_nic* nic;
+    uint32_t index;
+    intel_rx_desc_t* ring;
+    dma_region_t* ring_dma;
+    net_buffer_t* buffers[INTEL_RX_DESC_COUNT];
+    net_buffer_pool_t* pool;    // Refills come from here; NULL for the shared pool
+    uint32_t cur;
+    spinlock_t lock;
+    bool irq;
+    void (*notify)(void* context);
+    void* context;
+    net_stats_t stats;
+} intel_rx_queue_t;
+
+// Transmit queue, picked by the sending CPU
+typedef struct {
+    intel_tx_desc_t* ring;
+    dma_region_t* ring_dma;
+    net_buffer_t* buffers[INTEL_TX_DESC_COUNT];     // Held until sent
+    uint32_t cur;
+    uint32_t clean;         // Oldest descriptor not yet reclaimed
+    spinlock_t lock;
+    net_stats_t stats;
+} intel_tx_queue_t;
+
+// Intel NIC Structure
+typedef struct intel_nic {
     void* mmio_base;
     intel_state_t state;
     
     // MAC address
     uint8_t mac_addr[6];
     
-    // Receive ring
-    intel_rx_desc_t* rx_ring;
-    dma_region_t* rx_ring_dma;
-    dma_region_t* rx_buffers[INTEL_RX_DESC_COUNT];
-    uint32_t rx_cur;
-    spinlock_t rx_lock;
-    
-    // Transmit ring
-    intel_tx_desc_t* tx_ring;
-    dma_region_t* tx_ring_dma;
-    dma_region_t* tx_buffers[INTEL_TX_DESC_COUNT];
-    uint32_t tx_cur;
-    spinlock_t tx_lock;
+    // Queue pairs; RSS spreads received flows over them
+    intel_rx_queue_t rx_queues[INTEL_MAX_QUEUES];
+    intel_tx_queue_t tx_queues[INTEL_MAX_QUEUES];
+    uint32_t num_queues;
+    bool multi_queue;       // Per-queue registers, RSS and MSI-X exist
     
     // Link status
     bool link_up;
     uint32_t link_speed;  // Mbps
     bool full_duplex;
     
-    // Statistics
-    net_stats_t stats;
+    // Interrupts: a vector per queue plus one for link changes, or one
+    // shared by everything
+    device_handle_t* handle;
+    uint32_t irq;
+    bool irq_enabled;
+    bool msix;
 } intel_nic_t;
 
 // =============================================================================
@@ -201,6 +327,32 @@ typedef struct {
 void intel_nic_init(void);
 int intel_send_packet(intel_nic_t* nic, void* data, size_t length);
 int intel_receive_packet(intel_nic_t* nic, void* buffer, size_t max_len);
+
+// Zero-copy: send_buffer takes the caller's reference whether or not it
+// succeeds; receive_buffer hands over the ring's buffer and puts a fresh
+// one in its place, returning NULL once the ring is empty
+int intel_send_buffer(intel_nic_t* nic, net_buffer_t* buffer);
+net_buffer_t* intel_receive_buffer(intel_nic_t* nic, uint32_t queue);
+
+// Receive queues, each polled on its own
+uint32_t intel_rx_queue_count(intel_nic_t* nic);
+void intel_set_rx_notify(intel_nic_t* nic, uint32_t queue, void (*notify)(void* context),
+                         void* context);
+bool intel_set_rx_interrupts(intel_nic_t* nic, uint32_t queue, bool enable);
+
+// Refill a receive queue from pool (NULL for the shared one) from now on.
+// Buffers already on the ring stay there until frames land in them.
+int intel_set_rx_pool(intel_nic_t* nic, uint32_t queue, net_buffer_pool_t* pool);
+
+// Batched send: queues as many of the frames as the ring has room for
+// and writes the tail once. Takes every reference, dropping frames that
+// didn't fit, and returns how many were queued.
+int intel_send_buffers(intel_nic_t* nic, net_buffer_t** buffers, uint32_t count);
+
+// NET_OFFLOAD_*: checksums both ways, and TSO through context
+// descriptors where there's a single queue (the I210 and I211 would need
+// advanced descriptors for it)
+uint32_t intel_get_offloads(intel_nic_t* nic);
 void intel_get_mac_address(intel_nic_t* nic, uint8_t* mac);
 bool intel_is_link_up(intel_nic_t* nic);
 void intel_get_stats(intel_nic_t* nic, net_stats_t* stats);
@@ -0,0 +1,267 @@
+/*
+ * Network Buffers for Continuum Kernel
+ * Per-CPU caches in front of a shared pool of DMA-mapped frame buffers
+ */
+
+#include "net_buffer.h"
+#include "../resonance.h"
+#include "../../flux_memory.h"
+#include "../../temporal_scheduler.h"
+
+// =============================================================================
+// Global Network Buffer State
+// =============================================================================
+
+// Free buffers a CPU keeps, touched only by that CPU with interrupts off
+typedef struct {
+    net_buffer_t* free;
+    uint32_t count;
+} __attribute__((aligned(64))) net_buffer_cpu_t;
+
+static net_buffer_cpu_t g_net_buffer_cpus[MAX_CPU_CORES];
+
+// The shared pool. It only grows: every chunk stays carved up for as long
+// as the kernel runs, so a buffer's memory never moves under a ring.
+static net_buffer_t* g_net_buffer_free = NULL;
+static spinlock_t g_net_buffer_lock = SPINLOCK_INIT;
+static net_buffer_stats_t g_net_buffer_stats;
+
+#define net_buffer_stat(field, n) \
+    __atomic_fetch_add(&g_net_buffer_stats.field, (n), __ATOMIC_RELAXED)
+
+// =============================================================================
+// Shared Pool
+// =============================================================================
+
+// Carve another DMA region into NET_BUFFER_CHUNK buffers
+static bool net_buffer_grow(void) {
+    if (__atomic_load_n(&g_net_buffer_stats.buffers, __ATOMIC_RELAXED) >= NET_BUFFER_MAX) {
+        return false;
+    }
+    
+    dma_region_t* region = resonance_alloc_dma(NET_BUFFER_CHUNK * NET_BUFFER_STRIDE,
+                                               DMA_FLAG_COHERENT);
+    if (!region) {
+        return false;
+    }
+    
+    net_buffer_t* buffers = flux_allocate(NULL, NET_BUFFER_CHUNK * sizeof(net_buffer_t),
+                                          FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!buffers) {
+        resonance_free_dma(region);
+        return false;
+    }
+    
+    for (uint32_t i = 0; i < NET_BUFFER_CHUNK; i++) {
+        buffers[i].head = (uint8_t*)region->virtual_addr + i * NET_BUFFER_STRIDE;
+        buffers[i].physical_addr = region->physical_addr + i * NET_BUFFER_STRIDE;
+        buffers[i].next = i + 1 < NET_BUFFER_CHUNK ? &buffers[i + 1] : NULL;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&g_net_buffer_lock);
+    buffers[NET_BUFFER_CHUNK - 1].next = g_net_buffer_free;
+    g_net_buffer_free = buffers;
+    g_net_buffer_stats.free += NET_BUFFER_CHUNK;
+    g_net_buffer_stats.buffers += NET_BUFFER_CHUNK;
+    spinlock_release(&g_net_buffer_lock);
+    cpu_irq_restore(flags);
+    
+    return true;
+}
+
+// Move up to a batch from the shared pool to cpu; interrupts are off
+static bool net_buffer_refill(net_buffer_cpu_t* cpu) {
+    spinlock_acquire(&g_net_buffer_lock);
+    uint32_t moved = 0;
+    while (g_net_buffer_free && moved < NET_BUFFER_BATCH) {
+        net_buffer_t* buffer = g_net_buffer_free;
+        g_net_buffer_free = buffer->next;
+        buffer->next = cpu->free;
+        cpu->free = buffer;
+        moved++;
+    }
+    g_net_buffer_stats.free -= moved;
+    spinlock_release(&g_net_buffer_lock);
+    
+    if (moved == 0) {
+        return false;
+    }
+    
+    cpu->count += moved;
+    net_buffer_stat(refills, 1);
+    return true;
+}
+
+// Give a batch back once cpu holds more than its share; interrupts are off
+static void net_buffer_spill(net_buffer_cpu_t* cpu) {
+    net_buffer_t* first = cpu->free;
+    net_buffer_t* last = first;
+    for (uint32_t i = 1; i < NET_BUFFER_BATCH; i++) {
+        last = last->next;
+    }
+    cpu->free = last->next;
+    cpu->count -= NET_BUFFER_BATCH;
+    
+    spinlock_acquire(&g_net_buffer_lock);
+    last->next = g_net_buffer_free;
+    g_net_buffer_free = first;
+    g_net_buffer_stats.free += NET_BUFFER_BATCH;
+    spinlock_release(&g_net_buffer_lock);
+    
+    net_buffer_stat(spills, 1);
+}
+
+// =============================================================================
+// Buffers
+// =============================================================================
+
+static net_buffer_t* net_buffer_take(void) {
+    uint64_t flags = cpu_irq_save();
+    net_buffer_cpu_t* cpu = &g_net_buffer_cpus[temporal_get_current_cpu()];
+    
+    net_buffer_t* buffer = NULL;
+    if (cpu->free || net_buffer_refill(cpu)) {
+        buffer = cpu->free;
+        cpu->free = buffer->next;
+        cpu->count--;
+    }
+    
+    cpu_irq_restore(flags);
+    return buffer;
+}
+
+void net_buffer_reset(net_buffer_t* buffer) {
+    buffer->data = buffer->head + NET_BUFFER_HEADROOM;
+    buffer->len = 0;
+    buffer->refs = 1;
+    buffer->next = NULL;
+    buffer->frag = NULL;
+    buffer->flags = 0;
+    buffer->csum_start = 0;
+    buffer->csum_offset = 0;
+    buffer->gso_size = 0;
+}
+
+net_buffer_t* net_buffer_alloc(void) {
+    net_buffer_t* buffer = net_buffer_take();
+    while (!buffer) {
+        if (!net_buffer_grow()) {
+            net_buffer_stat(alloc_failures, 1);
+            return NULL;
+        }
+        buffer = net_buffer_take();
+    }
+    
+    net_buffer_reset(buffer);
+    net_buffer_stat(allocs, 1);
+    return buffer;
+}
+
+net_buffer_t* net_buffer_alloc_from(net_buffer_pool_t* pool) {
+    if (!pool) {
+        return net_buffer_alloc();
+    }
+    
+    net_buffer_t* buffer = pool->alloc(pool);
+    if (buffer) {
+        buffer->pool = pool;
+        net_buffer_reset(buffer);
+    }
+    return buffer;
+}
+
+void net_buffer_get(net_buffer_t* buffer) {
+    __atomic_fetch_add(&buffer->refs, 1, __ATOMIC_RELAXED);
+}
+
+// The last reference to a frame's first buffer releases the frags too
+void net_buffer_put(net_buffer_t* buffer) {
+    while (buffer && __atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        net_buffer_t* frag = buffer->frag;
+        if (buffer->pool) {
+            buffer->pool->release(buffer->pool, buffer);
+            buffer = frag;
+            continue;
+        }
+    
+        uint64_t flags = cpu_irq_save();
+        net_buffer_cpu_t* cpu = &g_net_buffer_cpus[temporal_get_current_cpu()];
+        buffer->next = cpu->free;
+        cpu->free = buffer;
+        if (++cpu->count > NET_BUFFER_CPU_CACHE) {
+            net_buffer_spill(cpu);
+        }
+        cpu_irq_restore(flags);
+        
+        buffer = frag;
+    }
+}
+
+void* net_buffer_push(net_buffer_t* buffer, uint32_t len) {
+    if (len > net_buffer_headroom(buffer)) {
+        return NULL;
+    }
+    
+    buffer->data -= len;
+    buffer->len += len;
+    return buffer->data;
+}
+
+void* net_buffer_pull(net_buffer_t* buffer, uint32_t len) {
+    if (len > buffer->len) {
+        return NULL;
+    }
+    
+    buffer->data += len;
+    buffer->len -= len;
+    return buffer->data;
+}
+
+void* net_buffer_append(net_buffer_t* buffer, uint32_t len) {
+    if (len > net_buffer_tailroom(buffer)) {
+        return NULL;
+    }
+    
+    void* tail = buffer->data + buffer->len;
+    buffer->len += len;
+    return tail;
+}
+
+uint32_t net_buffer_copy(const net_buffer_t* buffer, uint32_t offset, void* dest, uint32_t len) {
+    uint32_t copied = 0;
+    for (; buffer && copied < len; buffer = buffer->frag) {
+        if (offset >= buffer->len) {
+            offset -= buffer->len;
+            continue;
+        }
+        
+        uint32_t chunk = buffer->len - offset;
+        if (chunk > len - copied) {
+            chunk = len - copied;
+        }
+        memcpy((uint8_t*)dest + copied, buffer->data + offset, chunk);
+        copied += chunk;
+        offset = 0;
+    }
+    
+    return copied;
+}
+
+// =============================================================================
+// Statistics
+// =============================================================================
+
+void net_buffer_get_stats(net_buffer_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    
+    stats->buffers = __atomic_load_n(&g_net_buffer_stats.buffers, __ATOMIC_RELAXED);
+    stats->free = __atomic_load_n(&g_net_buffer_stats.free, __ATOMIC_RELAXED);
+    stats->allocs = __atomic_load_n(&g_net_buffer_stats.allocs, __ATOMIC_RELAXED);
+    stats->alloc_failures = __atomic_load_n(&g_net_buffer_stats.alloc_failures,
+                                            __ATOMIC_RELAXED);
+    stats->refills = __atomic_load_n(&g_net_buffer_stats.refills, __ATOMIC_RELAXED);
+    stats->spills = __atomic_load_n(&g_net_buffer_stats.spills, __ATOMIC_RELAXED);
+}
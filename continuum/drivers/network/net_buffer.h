@@ -0,0 +1,149 @@
+/*
+ * Network Buffers for Continuum Kernel
+ * Refcounted, DMA-mapped frame buffers shared by the NIC drivers and the
+ * networking stack, so a frame moves between ring and stack without a copy
+ */
+
+#ifndef NET_BUFFER_H
+#define NET_BUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// =============================================================================
+// Network Buffer Constants
+// =============================================================================
+
+#define NET_BUFFER_HEADROOM     128     // Reserved ahead of the data for pushed headers
+#define NET_BUFFER_DATA_SIZE    2048    // What a receive ring may fill
+#define NET_BUFFER_STRIDE       (NET_BUFFER_HEADROOM + NET_BUFFER_DATA_SIZE)
+
+// Pools
+#define NET_BUFFER_CHUNK        32      // Buffers carved from one DMA region
+#define NET_BUFFER_MAX          16384   // Most the pools grow to
+#define NET_BUFFER_CPU_CACHE    64      // Free buffers a CPU keeps to itself
+#define NET_BUFFER_BATCH        32      // Moved between a CPU and the shared pool at once
+
+// Offloads, as a driver advertises them to the stack
+#define NET_OFFLOAD_TX_CSUM     (1 << 0)    // Fills in a NET_BUFFER_CSUM_PARTIAL checksum
+#define NET_OFFLOAD_RX_CSUM     (1 << 1)    // Checks received IPv4, TCP and UDP checksums
+#define NET_OFFLOAD_TSO4        (1 << 2)    // Cuts IPv4 TCP frames into gso_size segments
+
+// Buffer flags
+#define NET_BUFFER_CSUM_PARTIAL (1 << 0)    // Transmit: checksum still to be filled in
+#define NET_BUFFER_CSUM_VALID   (1 << 1)    // Receive: the hardware checked the checksums
+
+// =============================================================================
+// Network Buffer Structures
+// =============================================================================
+
+// One frame. data..data+len is the frame; the headroom in front of it
+// takes headers pushed on the way down, the tailroom after it padding.
+//
+// A frame too big for one buffer (a TSO frame, say) carries the rest of
+// its bytes in frag and the buffers chained from it, which go with the
+// first buffer's last reference. With NET_BUFFER_CSUM_PARTIAL, whoever
+// sends the frame sums it from csum_start to the end and stores the
+// checksum csum_offset bytes past csum_start, the field holding the
+// pseudo-header sum until then; csum_start counts from head, so pushing
+// headers doesn't move it.
+//
+// A buffer from a net_buffer_pool (a socket's UMEM, say) goes back to
+// that pool rather than the shared one with its last reference.
+typedef struct net_buffer {
+    uint8_t* head;              // Start of the DMA buffer
+    uint8_t* data;
+    uint32_t len;
+    uint32_t refs;
+    uint64_t physical_addr;     // Of head
+    struct net_buffer* next;    // Free lists; whoever holds the buffer otherwise
+    struct net_buffer* frag;
+    uint16_t flags;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+    uint16_t gso_size;          // TCP payload per segment; 0 if the frame isn't cut
+    struct net_buffer_pool* pool;   // NULL for the shared pool
+} net_buffer_t;
+
+// Buffers someone else owns, laid out as the shared pool's are, with
+// NET_BUFFER_STRIDE bytes behind each head. alloc hands one out (NULL if
+// it has none to spare, which may be in an interrupt handler) and release
+// takes it back; both may run on any CPU.
+typedef struct net_buffer_pool {
+    net_buffer_t* (*alloc)(struct net_buffer_pool* pool);
+    void (*release)(struct net_buffer_pool* pool, net_buffer_t* buffer);
+} net_buffer_pool_t;
+
+typedef struct {
+    uint64_t buffers;           // Carved so far
+    uint64_t free;              // In the shared pool
+    uint64_t allocs;
+    uint64_t alloc_failures;
+    uint64_t refills;           // Batches a CPU took from the shared pool
+    uint64_t spills;            // Batches a CPU gave back
+} net_buffer_stats_t;
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// A buffer with one reference, empty, its data NET_BUFFER_HEADROOM in.
+// Not for interrupt handlers, since an empty pool grows; dropping the last
+// reference is fine anywhere.
+net_buffer_t* net_buffer_alloc(void);
+
+// The same from pool, or the shared pool if that's NULL
+net_buffer_t* net_buffer_alloc_from(net_buffer_pool_t* pool);
+
+// Make a buffer empty with one reference, as allocation does; for a pool
+// handing out one of its own buffers some other way
+void net_buffer_reset(net_buffer_t* buffer);
+void net_buffer_get(net_buffer_t* buffer);
+void net_buffer_put(net_buffer_t* buffer);
+
+// Grow the data at the front into the headroom, or shrink it from there;
+// NULL if there isn't room
+void* net_buffer_push(net_buffer_t* buffer, uint32_t len);
+void* net_buffer_pull(net_buffer_t* buffer, uint32_t len);
+
+// Grow the data at the tail, returning where the new bytes go
+void* net_buffer_append(net_buffer_t* buffer, uint32_t len);
+
+// len bytes of the frame from offset, across its frags, into dest;
+// returns how many there were
+uint32_t net_buffer_copy(const net_buffer_t* buffer, uint32_t offset, void* dest, uint32_t len);
+
+static inline uint32_t net_buffer_headroom(const net_buffer_t* buffer) {
+    return (uint32_t)(buffer->data - buffer->head);
+}
+
+static inline uint32_t net_buffer_tailroom(const net_buffer_t* buffer) {
+    return NET_BUFFER_STRIDE - net_buffer_headroom(buffer) - buffer->len;
+}
+
+// Bus address of the first data byte
+static inline uint64_t net_buffer_dma(const net_buffer_t* buffer) {
+    return buffer->physical_addr + net_buffer_headroom(buffer);
+}
+
+// The whole frame's length, frags included
+static inline uint32_t net_buffer_frame_len(const net_buffer_t* buffer) {
+    uint32_t len = 0;
+    for (; buffer; buffer = buffer->frag) {
+        len += buffer->len;
+    }
+    return len;
+}
+
+static inline uint32_t net_buffer_frag_count(const net_buffer_t* buffer) {
+    uint32_t count = 0;
+    for (; buffer; buffer = buffer->frag) {
+        count++;
+    }
+    return count;
+}
+
+void net_buffer_get_stats(net_buffer_stats_t* stats);
+
+#endif /* NET_BUFFER_H */
@@ -6,6 +6,7 @@
 #include "virtio_net.h"
 #include "../resonance.h"
 #include "../../flux_memory.h"
+#include "../../temporal_scheduler.h"
 
 // =============================================================================
 // Global VirtIO Net State
@@ -109,26 +110,12 @@ static virtio_net_queue_t* virtqueue_create_net(virtio_net_device_t* dev,
     
     // Initialize free descriptor list
     vq->free_head = 0;
+    vq->num_free = queue_size;
     for (uint16_t i = 0; i < queue_size - 1; i++) {
         vq->desc[i].next = i + 1;
     }
     vq->desc[queue_size - 1].next = 0xFFFF;
     
-    // Allocate buffers for this queue
-    for (int i = 0; i < queue_size; i++) {
-        vq->buffers[i] = resonance_alloc_dma(VIRTIO_NET_BUFFER_SIZE,
-                                            DMA_FLAG_COHERENT);
-        if (!vq->buffers[i]) {
-            // Clean up
-            for (int j = 0; j < i; j++) {
-                resonance_free_dma(vq->buffers[j]);
-            }
-            resonance_free_dma(vq->queue_dma);
-            flux_free(vq);
-            return NULL;
-        }
-    }
-    
     spinlock_init(&vq->lock);
     
     return vq;
@@ -140,9 +127,7 @@ static void virtqueue_destroy_net(virtio_net_queue_t* vq) {
     }
     
     for (int i = 0; i < vq->queue_size; i++) {
-        if (vq->buffers[i]) {
-            resonance_free_dma(vq->buffers[i]);
-        }
+        net_buffer_put(vq->buffers[i]);
     }
     
     if (vq->queue_dma) {
@@ -152,122 +137,421 @@ static void virtqueue_destroy_net(virtio_net_queue_t* vq) {
     flux_free(vq);
 }
 
+static void virtqueue_notify_net(virtio_net_queue_t* vq) {
+    virtio_net_device_t* dev = vq->device;
+    if (dev->common_cfg) {
+        mmio_write16(dev->common_cfg + VIRTIO_PCI_QUEUE_NOTIFY, vq->queue_idx);
+    } else {
+        outw(dev->io_base + VIRTIO_PCI_QUEUE_NOTIFY, vq->queue_idx);
+    }
+}
+
+// Hand descriptor desc_idx's buffer to the device to receive into. The
+// net header lands in the headroom, so the frame starts at the data.
+static void virtqueue_post_rx(virtio_net_queue_t* vq, uint16_t desc_idx) {
+    net_buffer_t* buffer = vq->buffers[desc_idx];
+    vq->desc[desc_idx].addr = net_buffer_dma(buffer) - sizeof(virtio_net_hdr_t);
+    vq->desc[desc_idx].len = sizeof(virtio_net_hdr_t) + NET_BUFFER_DATA_SIZE;
+    vq->desc[desc_idx].flags = VIRTQ_DESC_F_WRITE;  // Device writes to buffer
+    vq->desc[desc_idx].next = 0;
+    
+    uint16_t avail_idx = vq->avail->idx % vq->queue_size;
+    vq->avail->ring[avail_idx] = desc_idx;
+    __sync_synchronize();
+    vq->avail->idx++;
+}
+
+// Sent frames' descriptor chains back on the free list, their buffers
+// released
+static void virtqueue_reclaim_tx(virtio_net_queue_t* vq) {
+    while (vq->last_used_idx != __atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE)) {
+        uint16_t used_idx = vq->last_used_idx % vq->queue_size;
+        uint16_t desc_idx = vq->used->ring[used_idx].id;
+        
+        net_buffer_put(vq->buffers[desc_idx]);
+        vq->buffers[desc_idx] = NULL;
+        
+        uint16_t last = desc_idx;
+        vq->num_free++;
+        while (vq->desc[last].flags & VIRTQ_DESC_F_NEXT) {
+            last = vq->desc[last].next;
+            vq->num_free++;
+        }
+        vq->desc[last].next = vq->free_head;
+        vq->free_head = desc_idx;
+        vq->last_used_idx++;
+    }
+}
+
 // =============================================================================
 // Packet Transmission
 // =============================================================================
 
-int virtio_net_send_packet(virtio_net_device_t* dev, void* data, size_t length) {
-    if (!dev || !data || length > VIRTIO_NET_MAX_PACKET_SIZE) {
-        return -1;
+// Each CPU sends on its own pair's queue, so senders on different CPUs
+// don't share a ring lock. Sent descriptors are reclaimed once per batch,
+// and the device isn't notified while it says it's still working through
+// the ring.
+int virtio_net_send_buffers(virtio_net_device_t* dev, net_buffer_t** buffers, uint32_t count) {
+    if (!dev) {
+        for (uint32_t i = 0; i < count; i++) {
+            net_buffer_put(buffers[i]);
+        }
+        return 0;
     }
     
-    virtio_net_queue_t* vq = dev->tx_queue;
+    virtio_net_queue_t* vq = dev->tx_queues[temporal_get_current_cpu() % dev->num_queue_pairs];
     spinlock_acquire(&vq->lock);
     
-    // Allocate descriptor
-    if (vq->free_head == 0xFFFF) {
-        spinlock_release(&vq->lock);
-        return -1;
-    }
-    
-    uint16_t desc_idx = vq->free_head;
-    vq->free_head = vq->desc[desc_idx].next;
-    
-    // Setup packet with net header
-    virtio_net_hdr_t* hdr = (virtio_net_hdr_t*)vq->buffers[desc_idx]->virtual_addr;
-    hdr->flags = 0;
-    hdr->gso_type = VIRTIO_NET_HDR_GSO_NONE;
-    hdr->hdr_len = sizeof(virtio_net_hdr_t);
-    hdr->gso_size = 0;
-    hdr->csum_start = 0;
-    hdr->csum_offset = 0;
+    virtqueue_reclaim_tx(vq);
+    
+    uint16_t avail = vq->avail->idx;
+    uint32_t queued = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        net_buffer_t* buffer = buffers[i];
+        uint32_t length = net_buffer_frame_len(buffer);
+        uint32_t needed = net_buffer_frag_count(buffer);
+        uint32_t csum_start = buffer->csum_start - net_buffer_headroom(buffer);
+        bool tso = buffer->gso_size && (dev->driver_features & VIRTIO_NET_F_HOST_TSO4);
+    
+        // Setup packet with net header
+        bool fits = tso ? length <= VIRTIO_NET_MAX_TSO_SIZE :
+                          !buffer->frag && length <= VIRTIO_NET_MAX_PACKET_SIZE;
+        virtio_net_hdr_t* hdr = fits ? net_buffer_push(buffer, sizeof(virtio_net_hdr_t)) : NULL;
+        if (!hdr || vq->num_free < needed) {
+            vq->stats.tx_dropped++;
+            net_buffer_put(buffer);
+            continue;
+        }
+        hdr->flags = 0;
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_NONE;
+        hdr->hdr_len = sizeof(virtio_net_hdr_t);
+        hdr->gso_size = 0;
+        hdr->csum_start = 0;
+        hdr->csum_offset = 0;
+    
+        // Offloads: csum_start is where the TCP header begins in a TSO frame
+        if (buffer->flags & NET_BUFFER_CSUM_PARTIAL) {
+            hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+            hdr->csum_start = csum_start;
+            hdr->csum_offset = buffer->csum_offset;
+        }
+        if (tso) {
+            uint8_t tcp_offset = buffer->data[sizeof(virtio_net_hdr_t) + csum_start + 12];
+            hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+            hdr->gso_size = buffer->gso_size;
+            hdr->hdr_len = csum_start + (tcp_offset >> 4) * 4;
+        }
+        
+        // Allocate descriptors, one per buffer of the frame, chained
+        uint16_t head = vq->free_head;
+        for (net_buffer_t* part = buffer; part; part = part->frag) {
+            uint16_t desc_idx = vq->free_head;
+            vq->free_head = vq->desc[desc_idx].next;
+            vq->num_free--;
+    
+            vq->desc[desc_idx].addr = net_buffer_dma(part);
+            vq->desc[desc_idx].len = part->len;
+            vq->desc[desc_idx].flags = part->frag ? VIRTQ_DESC_F_NEXT : 0;
+            if (part->frag) {
+                vq->desc[desc_idx].next = vq->free_head;
+            }
+        }
+        vq->buffers[head] = buffer;
     
-    // Copy packet data after header
-    memcpy((uint8_t*)hdr + sizeof(virtio_net_hdr_t), data, length);
+        // Add to available ring; the device sees it once idx moves
+        vq->avail->ring[avail % vq->queue_size] = head;
+        avail++;
     
-    // Setup descriptor
-    vq->desc[desc_idx].addr = vq->buffers[desc_idx]->physical_addr;
-    vq->desc[desc_idx].len = sizeof(virtio_net_hdr_t) + length;
-    vq->desc[desc_idx].flags = 0;
-    vq->desc[desc_idx].next = 0;
+        vq->stats.tx_packets++;
+        vq->stats.tx_bytes += length;
+        queued++;
+    }
     
-    // Add to available ring
-    uint16_t avail_idx = vq->avail->idx % vq->queue_size;
-    vq->avail->ring[avail_idx] = desc_idx;
-    __sync_synchronize();
-    vq->avail->idx++;
+    bool notify = false;
+    if (queued > 0) {
+        __sync_synchronize();
+        vq->avail->idx = avail;
+        __sync_synchronize();
+        notify = !(__atomic_load_n(&vq->used->flags, __ATOMIC_ACQUIRE) & VIRTQ_USED_F_NO_NOTIFY);
+    }
     
     spinlock_release(&vq->lock);
     
     // Notify device
-    if (dev->common_cfg) {
-        mmio_write16(dev->common_cfg + VIRTIO_PCI_QUEUE_NOTIFY, vq->queue_idx);
-    } else {
-        outw(dev->io_base + VIRTIO_PCI_QUEUE_NOTIFY, vq->queue_idx);
+    if (notify) {
+        virtqueue_notify_net(vq);
     }
     
-    dev->stats.tx_packets++;
-    dev->stats.tx_bytes += length;
+    return queued;
+}
+
+int virtio_net_send_buffer(virtio_net_device_t* dev, net_buffer_t* buffer) {
+    if (!buffer) {
+        return -1;
+    }
+    return virtio_net_send_buffers(dev, &buffer, 1) == 1 ? 0 : -1;
+}
+
+int virtio_net_send_packet(virtio_net_device_t* dev, void* data, size_t length) {
+    if (!dev || !data || length > VIRTIO_NET_MAX_PACKET_SIZE) {
+        return -1;
+    }
     
-    return 0;
+    net_buffer_t* buffer = net_buffer_alloc();
+    if (!buffer) {
+        return -1;
+    }
+    
+    memcpy(net_buffer_append(buffer, length), data, length);
+    return virtio_net_send_buffer(dev, buffer);
 }
 
 // =============================================================================
 // Packet Reception
 // =============================================================================
 
+// Runt frames, and frames there's no fresh buffer to replace, are dropped
+// and their buffer goes straight back to the device
+net_buffer_t* virtio_net_receive_buffer(virtio_net_device_t* dev, uint32_t queue) {
+    if (!dev || queue >= dev->num_queue_pairs) {
+        return NULL;
+    }
+    
+    virtio_net_queue_t* vq = dev->rx_queues[queue];
+    spinlock_acquire(&vq->lock);
+    
+    net_buffer_t* buffer = NULL;
+    bool posted = false;
+    while (!buffer && vq->last_used_idx != __atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE)) {
+        // Get completed descriptor
+        uint16_t used_idx = vq->last_used_idx % vq->queue_size;
+        uint16_t desc_idx = vq->used->ring[used_idx].id;
+        uint32_t len = vq->used->ring[used_idx].len;
+        
+        net_buffer_t* fresh = len > sizeof(virtio_net_hdr_t) ? net_buffer_alloc_from(vq->pool) :
+                                                               NULL;
+        if (len <= sizeof(virtio_net_hdr_t)) {
+            vq->stats.rx_errors++;
+        } else if (!fresh) {
+            vq->stats.rx_dropped++;
+        } else {
+            buffer = vq->buffers[desc_idx];
+            buffer->len = len - sizeof(virtio_net_hdr_t);
+            vq->buffers[desc_idx] = fresh;
+            
+            // A frame the device checked, or one from the host itself that
+            // was never checksummed at all
+            virtio_net_hdr_t* hdr = (virtio_net_hdr_t*)(buffer->data - sizeof(virtio_net_hdr_t));
+            if ((dev->driver_features & VIRTIO_NET_F_GUEST_CSUM) &&
+                (hdr->flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM))) {
+                buffer->flags |= NET_BUFFER_CSUM_VALID;
+            }
+            
+            vq->stats.rx_packets++;
+            vq->stats.rx_bytes += buffer->len;
+        }
+        
+        // Re-add descriptor to receive queue
+        virtqueue_post_rx(vq, desc_idx);
+        vq->last_used_idx++;
+        posted = true;
+    }
+    
+    spinlock_release(&vq->lock);
+    
+    if (posted) {
+        virtqueue_notify_net(vq);
+    }
+    
+    return buffer;
+}
+
+// Frames from whichever queue has one
 int virtio_net_receive_packet(virtio_net_device_t* dev, void* buffer, size_t max_len) {
     if (!dev || !buffer) {
         return -1;
     }
     
-    virtio_net_queue_t* vq = dev->rx_queue;
-    spinlock_acquire(&vq->lock);
-    
-    // Check for completed buffers
-    if (vq->last_used_idx == vq->used->idx) {
-        spinlock_release(&vq->lock);
+    net_buffer_t* frame = NULL;
+    for (uint32_t q = 0; q < dev->num_queue_pairs && !frame; q++) {
+        frame = virtio_net_receive_buffer(dev, q);
+    }
+    if (!frame) {
         return 0;  // No packets
     }
     
-    // Get completed descriptor
-    uint16_t used_idx = vq->last_used_idx % vq->queue_size;
-    uint32_t desc_idx = vq->used->ring[used_idx].id;
-    uint32_t len = vq->used->ring[used_idx].len;
+    size_t length = frame->len < max_len ? frame->len : max_len;
+    memcpy(buffer, frame->data, length);
+    net_buffer_put(frame);
     
-    // Skip virtio net header
-    if (len > sizeof(virtio_net_hdr_t)) {
-        len -= sizeof(virtio_net_hdr_t);
-        if (len > max_len) {
-            len = max_len;
-        }
-        
-        uint8_t* packet_data = (uint8_t*)vq->buffers[desc_idx]->virtual_addr +
-                              sizeof(virtio_net_hdr_t);
-        memcpy(buffer, packet_data, len);
-    } else {
-        len = 0;
+    return length;
+}
+
+uint32_t virtio_net_get_offloads(virtio_net_device_t* dev) {
+    uint32_t offloads = 0;
+    if (dev->driver_features & VIRTIO_NET_F_CSUM) {
+        offloads |= NET_OFFLOAD_TX_CSUM;
+    }
+    if (dev->driver_features & VIRTIO_NET_F_GUEST_CSUM) {
+        offloads |= NET_OFFLOAD_RX_CSUM;
+    }
+    if (dev->driver_features & VIRTIO_NET_F_HOST_TSO4) {
+        offloads |= NET_OFFLOAD_TSO4;
+    }
+    return offloads;
+}
+
+uint32_t virtio_net_rx_queue_count(virtio_net_device_t* dev) {
+    return dev->num_queue_pairs;
+}
+
+int virtio_net_set_rx_pool(virtio_net_device_t* dev, uint32_t queue, net_buffer_pool_t* pool) {
+    if (!dev || queue >= dev->num_queue_pairs) {
+        return -1;
     }
     
-    // Re-add descriptor to receive queue
-    vq->desc[desc_idx].addr = vq->buffers[desc_idx]->physical_addr;
-    vq->desc[desc_idx].len = VIRTIO_NET_BUFFER_SIZE;
-    vq->desc[desc_idx].flags = VIRTQ_DESC_F_WRITE;  // Device writes to buffer
-    vq->desc[desc_idx].next = 0;
+    virtio_net_queue_t* vq = dev->rx_queues[queue];
+    spinlock_acquire(&vq->lock);
+    vq->pool = pool;
+    spinlock_release(&vq->lock);
+    return 0;
+}
+
+void virtio_net_get_mac_address(virtio_net_device_t* dev, uint8_t* mac) {
+    memcpy(mac, dev->mac_addr, 6);
+}
+
+bool virtio_net_is_link_up(virtio_net_device_t* dev) {
+    return dev->link_up;
+}
+
+void virtio_net_get_stats(virtio_net_device_t* dev, virtio_net_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (uint16_t i = 0; i < dev->num_queue_pairs; i++) {
+        virtio_net_queue_t* rxq = dev->rx_queues[i];
+        virtio_net_queue_t* txq = dev->tx_queues[i];
+        stats->rx_packets += rxq->stats.rx_packets;
+        stats->rx_bytes += rxq->stats.rx_bytes;
+        stats->rx_errors += rxq->stats.rx_errors;
+        stats->rx_dropped += rxq->stats.rx_dropped;
+        stats->tx_packets += txq->stats.tx_packets;
+        stats->tx_bytes += txq->stats.tx_bytes;
+        stats->tx_errors += txq->stats.tx_errors;
+        stats->tx_dropped += txq->stats.tx_dropped;
+    }
+}
+
+// =============================================================================
+// Interrupts
+// =============================================================================
+
+// Receive interrupts are suppressed before the notifier runs, so a burst
+// costs one interrupt however long the ring takes to drain
+static void virtio_net_rx_interrupt(virtio_net_queue_t* vq) {
+    void (*notify)(void*) = __atomic_load_n(&vq->notify, __ATOMIC_ACQUIRE);
+    if (!notify || vq->last_used_idx == __atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE)) {
+        return;  // Nobody listening, or transmit completions only
+    }
     
-    uint16_t avail_idx = vq->avail->idx % vq->queue_size;
-    vq->avail->ring[avail_idx] = desc_idx;
-    __sync_synchronize();
-    vq->avail->idx++;
+    vq->avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+    notify(vq->context);
+}
+
+static void virtio_net_queue_interrupt(void* context) {
+    virtio_net_rx_interrupt((virtio_net_queue_t*)context);
+}
+
+// The shared line covers every queue; reading the ISR acknowledges it
+static void virtio_net_interrupt(void* context) {
+    virtio_net_device_t* dev = (virtio_net_device_t*)context;
+    
+    uint8_t isr = virtio_read8(dev, VIRTIO_PCI_ISR);
+    if (isr & 0x01) {
+        for (uint16_t i = 0; i < dev->num_queue_pairs; i++) {
+            virtio_net_rx_interrupt(dev->rx_queues[i]);
+        }
+    }
+}
+
+void virtio_net_set_rx_notify(virtio_net_device_t* dev, uint32_t queue,
+                              void (*notify)(void* context), void* context) {
+    if (queue >= dev->num_queue_pairs) {
+        return;
+    }
     
-    vq->last_used_idx++;
+    virtio_net_queue_t* vq = dev->rx_queues[queue];
+    vq->context = context;
+    __atomic_store_n(&vq->notify, notify, __ATOMIC_RELEASE);
+}
+
+// Turning them on returns whether a buffer was used while they were off,
+// since the device won't interrupt for it now
+bool virtio_net_set_rx_interrupts(virtio_net_device_t* dev, uint32_t queue, bool enable) {
+    if (queue >= dev->num_queue_pairs) {
+        return false;
+    }
     
-    dev->stats.rx_packets++;
-    dev->stats.rx_bytes += len;
+    virtio_net_queue_t* vq = dev->rx_queues[queue];
+    if (!enable) {
+        vq->avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+        return false;
+    }
     
-    spinlock_release(&vq->lock);
+    vq->avail->flags &= ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+    __sync_synchronize();
+    return vq->last_used_idx != __atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE);
+}
+
+static void virtio_net_release_irqs(virtio_net_device_t* dev) {
+    if (dev->msix) {
+        for (uint16_t i = 0; i < dev->num_queue_pairs; i++) {
+            virtio_net_queue_t* vq = dev->rx_queues[i];
+            if (vq->irq) {
+                virtio_write16(dev, VIRTIO_PCI_QUEUE_SEL, vq->queue_idx);
+                virtio_write16(dev, VIRTIO_PCI_MSI_QUEUE_VECTOR, VIRTIO_MSI_NO_VECTOR);
+                resonance_unregister_irq(dev->handle, RESONANCE_IRQ_QUEUE(i));
+            }
+        }
+    } else if (dev->intx) {
+        resonance_unregister_irq(dev->handle, RESONANCE_IRQ_INTX);
+    }
     
-    return len;
+    for (uint16_t i = 0; i < dev->num_queue_pairs; i++) {
+        dev->rx_queues[i]->irq = false;
+    }
+    dev->msix = false;
+    dev->intx = false;
+}
+
+// Vector n for receive queue n, taken on CPU n. Transmit completions are
+// reclaimed by the next send and need no vector; the device must accept
+// every receive queue's or they share INTx instead.
+static bool virtio_net_setup_msix(virtio_net_device_t* dev) {
+    dev->msix = true;
+    virtio_write16(dev, VIRTIO_PCI_MSI_CONFIG_VECTOR, VIRTIO_MSI_NO_VECTOR);
+    
+    for (uint16_t i = 0; i < dev->num_queue_pairs; i++) {
+        virtio_net_queue_t* vq = dev->rx_queues[i];
+        if (resonance_register_irq(dev->handle, RESONANCE_IRQ_QUEUE(i),
+                                   virtio_net_queue_interrupt, vq) != 0) {
+            virtio_net_release_irqs(dev);
+            return false;
+        }
+        vq->irq = true;
+        resonance_set_irq_affinity(dev->handle, RESONANCE_IRQ_QUEUE(i), i);
+        
+        virtio_write16(dev, VIRTIO_PCI_QUEUE_SEL, vq->queue_idx);
+        virtio_write16(dev, VIRTIO_PCI_MSI_QUEUE_VECTOR, i);
+        if (virtio_read16(dev, VIRTIO_PCI_MSI_QUEUE_VECTOR) != i) {
+            virtio_net_release_irqs(dev);
+            return false;
+        }
+        
+        virtio_write16(dev, VIRTIO_PCI_QUEUE_SEL, dev->tx_queues[i]->queue_idx);
+        virtio_write16(dev, VIRTIO_PCI_MSI_QUEUE_VECTOR, VIRTIO_MSI_NO_VECTOR);
+    }
+    
+    return true;
 }
 
 // =============================================================================
@@ -294,6 +578,20 @@ static int virtio_net_negotiate_features(virtio_net_device_t* dev) {
         dev->driver_features |= VIRTIO_NET_F_CSUM;
         dev->has_csum = true;
     }
+    if (dev->device_features & VIRTIO_NET_F_GUEST_CSUM) {
+        dev->driver_features |= VIRTIO_NET_F_GUEST_CSUM;
+    }
+    
+    // TSO leaves the checksums to the device as well
+    if (dev->has_csum && (dev->device_features & VIRTIO_NET_F_HOST_TSO4)) {
+        dev->driver_features |= VIRTIO_NET_F_HOST_TSO4;
+    }
+    
+    // Multiple queues are switched on through the control queue
+    if ((dev->device_features & VIRTIO_NET_F_CTRL_VQ) &&
+        (dev->device_features & VIRTIO_NET_F_MQ)) {
+        dev->driver_features |= VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ;
+    }
     
     // Write accepted features
     virtio_write32(dev, VIRTIO_PCI_DRIVER_FEATURES, dev->driver_features);
@@ -305,11 +603,13 @@ static int virtio_net_negotiate_features(virtio_net_device_t* dev) {
 // Device Configuration
 // =============================================================================
 
+// Device configuration follows the legacy header; read before MSI-X is
+// enabled, which would move it to VIRTIO_PCI_CONFIG_MSI
 static int virtio_net_read_config(virtio_net_device_t* dev) {
     // Read MAC address if provided
     if (dev->driver_features & VIRTIO_NET_F_MAC) {
         for (int i = 0; i < 6; i++) {
-            dev->mac_addr[i] = virtio_read8(dev, VIRTIO_NET_CFG_MAC + i);
+            dev->mac_addr[i] = virtio_read8(dev, VIRTIO_PCI_CONFIG + VIRTIO_NET_CFG_MAC + i);
         }
     } else {
         // Generate random MAC with locally administered bit set
@@ -323,7 +623,7 @@ static int virtio_net_read_config(virtio_net_device_t* dev) {
     
     // Read status if supported
     if (dev->driver_features & VIRTIO_NET_F_STATUS) {
-        dev->status = virtio_read16(dev, VIRTIO_NET_CFG_STATUS);
+        dev->status = virtio_read16(dev, VIRTIO_PCI_CONFIG + VIRTIO_NET_CFG_STATUS);
         dev->link_up = (dev->status & VIRTIO_NET_S_LINK_UP) ? true : false;
     } else {
         dev->link_up = true;  // Assume link is up
@@ -331,18 +631,147 @@ static int virtio_net_read_config(virtio_net_device_t* dev) {
     
     // Read max virtqueue pairs if supported
     if (dev->driver_features & VIRTIO_NET_F_MQ) {
-        dev->max_queue_pairs = virtio_read16(dev, VIRTIO_NET_CFG_MAX_VQ_PAIRS);
+        dev->max_queue_pairs = virtio_read16(dev, VIRTIO_PCI_CONFIG + VIRTIO_NET_CFG_MAX_VQ_PAIRS);
     } else {
         dev->max_queue_pairs = 1;
     }
     
+    // No more pairs than the driver keeps or there are CPUs to serve them
+    uint32_t cpus = continuum_get_cpu_count();
+    dev->num_queue_pairs = dev->max_queue_pairs;
+    if (dev->num_queue_pairs > VIRTIO_NET_MAX_QUEUE_PAIRS) {
+        dev->num_queue_pairs = VIRTIO_NET_MAX_QUEUE_PAIRS;
+    }
+    if (cpus > 0 && dev->num_queue_pairs > cpus) {
+        dev->num_queue_pairs = cpus;
+    }
+    if (dev->num_queue_pairs == 0) {
+        dev->num_queue_pairs = 1;
+    }
+    
     return 0;
 }
 
+// =============================================================================
+// Control Queue
+// =============================================================================
+
+// One command at a time, waited for by polling: the class and command,
+// len bytes of data, then the byte the device acks with
+static int virtio_net_ctrl_command(virtio_net_device_t* dev, uint8_t class, uint8_t cmd,
+                                   const void* data, uint32_t len) {
+    virtio_net_queue_t* vq = dev->ctrl_queue;
+    if (!vq || !dev->ctrl_dma || len > dev->ctrl_dma->size - 3) {
+        return -1;
+    }
+    
+    uint8_t* header = (uint8_t*)dev->ctrl_dma->virtual_addr;
+    uint8_t* ack = header + 2 + len;
+    header[0] = class;
+    header[1] = cmd;
+    memcpy(header + 2, data, len);
+    *ack = 0xFF;
+    
+    uint64_t phys = dev->ctrl_dma->physical_addr;
+    spinlock_acquire(&vq->lock);
+    
+    vq->desc[0].addr = phys;
+    vq->desc[0].len = 2;
+    vq->desc[0].flags = VIRTQ_DESC_F_NEXT;
+    vq->desc[0].next = 1;
+    vq->desc[1].addr = phys + 2;
+    vq->desc[1].len = len;
+    vq->desc[1].flags = VIRTQ_DESC_F_NEXT;
+    vq->desc[1].next = 2;
+    vq->desc[2].addr = phys + 2 + len;
+    vq->desc[2].len = 1;
+    vq->desc[2].flags = VIRTQ_DESC_F_WRITE;
+    vq->desc[2].next = 0;
+    
+    uint16_t avail_idx = vq->avail->idx % vq->queue_size;
+    vq->avail->ring[avail_idx] = 0;
+    __sync_synchronize();
+    vq->avail->idx++;
+    virtqueue_notify_net(vq);
+    
+    bool done = false;
+    for (uint32_t i = 0; i < VIRTIO_NET_CTRL_TIMEOUT; i++) {
+        if (vq->last_used_idx != __atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE)) {
+            vq->last_used_idx++;
+            done = true;
+            break;
+        }
+        __asm__ __volatile__("pause");
+    }
+    
+    spinlock_release(&vq->lock);
+    
+    return done && __atomic_load_n(ack, __ATOMIC_ACQUIRE) == VIRTIO_NET_OK ? 0 : -1;
+}
+
 // =============================================================================
 // Device Initialization
 // =============================================================================
 
+// Select queue_idx and give it a ring of whatever size the device has
+static virtio_net_queue_t* virtio_net_setup_queue(virtio_net_device_t* dev, uint16_t queue_idx) {
+    virtio_write16(dev, VIRTIO_PCI_QUEUE_SEL, queue_idx);
+    uint16_t queue_size = virtio_read16(dev, VIRTIO_PCI_QUEUE_SIZE);
+    if (queue_size == 0 || queue_size > VIRTIO_NET_QUEUE_SIZE) {
+        return NULL;
+    }
+    
+    virtio_net_queue_t* vq = virtqueue_create_net(dev, queue_idx, queue_size);
+    if (!vq) {
+        return NULL;
+    }
+    
+    virtio_write32(dev, VIRTIO_PCI_QUEUE_PFN, vq->queue_dma->physical_addr >> 12);
+    return vq;
+}
+
+static void virtio_net_free_queues(virtio_net_device_t* dev) {
+    for (uint16_t i = 0; i < VIRTIO_NET_MAX_QUEUE_PAIRS; i++) {
+        virtqueue_destroy_net(dev->rx_queues[i]);
+        virtqueue_destroy_net(dev->tx_queues[i]);
+        dev->rx_queues[i] = NULL;
+        dev->tx_queues[i] = NULL;
+    }
+    virtqueue_destroy_net(dev->ctrl_queue);
+    dev->ctrl_queue = NULL;
+    if (dev->ctrl_dma) {
+        resonance_free_dma(dev->ctrl_dma);
+        dev->ctrl_dma = NULL;
+    }
+}
+
+static int virtio_net_setup_pair(virtio_net_device_t* dev, uint16_t pair) {
+    virtio_net_queue_t* rxq = virtio_net_setup_queue(dev, pair * 2);
+    if (!rxq) {
+        return -1;
+    }
+    rxq->pair = pair;
+    dev->rx_queues[pair] = rxq;
+    
+    // Add receive buffers
+    for (int i = 0; i < rxq->queue_size; i++) {
+        rxq->buffers[i] = net_buffer_alloc();
+        if (!rxq->buffers[i]) {
+            return -1;
+        }
+        virtqueue_post_rx(rxq, i);
+    }
+    
+    virtio_net_queue_t* txq = virtio_net_setup_queue(dev, pair * 2 + 1);
+    if (!txq) {
+        return -1;
+    }
+    txq->pair = pair;
+    dev->tx_queues[pair] = txq;
+    
+    return 0;
+}
+
 static int virtio_net_init_device(virtio_net_device_t* dev) {
     // Reset device
     virtio_write8(dev, VIRTIO_PCI_STATUS, 0);
@@ -370,56 +799,22 @@ static int virtio_net_init_device(virtio_net_device_t* dev) {
         return -1;
     }
     
-    // Setup virtqueues (RX queue = 0, TX queue = 1)
-    
-    // RX queue
-    virtio_write16(dev, VIRTIO_PCI_QUEUE_SEL, 0);
-    uint16_t rx_queue_size = virtio_read16(dev, VIRTIO_PCI_QUEUE_SIZE);
-    if (rx_queue_size == 0) {
-        return -1;
-    }
-    
-    dev->rx_queue = virtqueue_create_net(dev, 0, rx_queue_size);
-    if (!dev->rx_queue) {
+    // Read device configuration
+    if (virtio_net_read_config(dev) != 0) {
         return -1;
     }
     
-    virtio_write32(dev, VIRTIO_PCI_QUEUE_PFN,
-                   dev->rx_queue->queue_dma->physical_addr >> 12);
-    
-    // Add receive buffers
-    for (int i = 0; i < rx_queue_size; i++) {
-        dev->rx_queue->desc[i].addr = dev->rx_queue->buffers[i]->physical_addr;
-        dev->rx_queue->desc[i].len = VIRTIO_NET_BUFFER_SIZE;
-        dev->rx_queue->desc[i].flags = VIRTQ_DESC_F_WRITE;
-        dev->rx_queue->desc[i].next = 0;
-        
-        dev->rx_queue->avail->ring[i] = i;
+    // Setup virtqueues: a receive and a transmit queue per pair
+    for (uint16_t i = 0; i < dev->num_queue_pairs; i++) {
+        if (virtio_net_setup_pair(dev, i) != 0) {
+            virtio_net_free_queues(dev);
+            return -1;
+        }
     }
-    dev->rx_queue->avail->idx = rx_queue_size;
     
-    // TX queue
-    virtio_write16(dev, VIRTIO_PCI_QUEUE_SEL, 1);
-    uint16_t tx_queue_size = virtio_read16(dev, VIRTIO_PCI_QUEUE_SIZE);
-    if (tx_queue_size == 0) {
-        virtqueue_destroy_net(dev->rx_queue);
-        return -1;
-    }
-    
-    dev->tx_queue = virtqueue_create_net(dev, 1, tx_queue_size);
-    if (!dev->tx_queue) {
-        virtqueue_destroy_net(dev->rx_queue);
-        return -1;
-    }
-    
-    virtio_write32(dev, VIRTIO_PCI_QUEUE_PFN,
-                   dev->tx_queue->queue_dma->physical_addr >> 12);
-    
-    // Read device configuration
-    if (virtio_net_read_config(dev) != 0) {
-        virtqueue_destroy_net(dev->rx_queue);
-        virtqueue_destroy_net(dev->tx_queue);
-        return -1;
+    if (dev->driver_features & VIRTIO_NET_F_CTRL_VQ) {
+        dev->ctrl_queue = virtio_net_setup_queue(dev, dev->max_queue_pairs * 2);
+        dev->ctrl_dma = resonance_alloc_dma(64, DMA_FLAG_COHERENT);
     }
     
     // Set DRIVER_OK
@@ -428,6 +823,15 @@ static int virtio_net_init_device(virtio_net_device_t* dev) {
                                           VIRTIO_STATUS_FEATURES_OK |
                                           VIRTIO_STATUS_DRIVER_OK);
     
+    // The device only uses the first pair until told otherwise
+    if (dev->num_queue_pairs > 1) {
+        uint16_t pairs = dev->num_queue_pairs;
+        if (virtio_net_ctrl_command(dev, VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET,
+                                    &pairs, sizeof(pairs)) != 0) {
+            dev->num_queue_pairs = 1;
+        }
+    }
+    
     return 0;
 }
 
@@ -477,6 +881,17 @@ static void* virtio_net_probe(device_node_t* node) {
 
 static int virtio_net_attach(device_handle_t* handle) {
     virtio_net_device_t* dev = (virtio_net_device_t*)handle->driver_data;
+    
+    // Per-queue MSI-X, else the shared line; without either, receivers poll
+    dev->handle = handle;
+    if (!virtio_net_setup_msix(dev)) {
+        dev->intx = resonance_register_irq(handle, RESONANCE_IRQ_INTX,
+                                           virtio_net_interrupt, dev) == 0;
+        for (uint16_t i = 0; i < dev->num_queue_pairs; i++) {
+            dev->rx_queues[i]->irq = dev->intx;
+        }
+    }
+    
     dev->state = VIRTIO_NET_STATE_READY;
     return 0;
 }
@@ -484,16 +899,12 @@ static int virtio_net_attach(device_handle_t* handle) {
 static void virtio_net_detach(device_handle_t* handle) {
     virtio_net_device_t* dev = (virtio_net_device_t*)handle->driver_data;
     
-    // Reset device
+    // Release interrupts, then reset device
+    virtio_net_release_irqs(dev);
     virtio_write8(dev, VIRTIO_PCI_STATUS, 0);
     
     // Free queues
-    if (dev->rx_queue) {
-        virtqueue_destroy_net(dev->rx_queue);
-    }
-    if (dev->tx_queue) {
-        virtqueue_destroy_net(dev->tx_queue);
-    }
+    virtio_net_free_queues(dev);
     
     dev->state = VIRTIO_NET_STATE_DISABLED;
 }
@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "../resonance.h"
+#include "net_buffer.h"
 
 // =============================================================================
 // VirtIO Network Constants
@@ -19,6 +20,8 @@
 #define VIRTIO_NET_QUEUE_SIZE   256
 #define VIRTIO_NET_BUFFER_SIZE  2048
 #define VIRTIO_NET_MAX_PACKET_SIZE 1514
+#define VIRTIO_NET_MAX_TSO_SIZE 65535   // A TSO frame, headers and payload
+#define VIRTIO_NET_MAX_QUEUE_PAIRS 8    // Receive/transmit pairs used, at most one per CPU
 
 // VirtIO PCI registers (legacy)
 #define VIRTIO_PCI_DEVICE_FEATURES  0x00
@@ -30,6 +33,10 @@
 #define VIRTIO_PCI_STATUS           0x12
 #define VIRTIO_PCI_ISR              0x13
 #define VIRTIO_PCI_CONFIG           0x14
+#define VIRTIO_PCI_MSI_CONFIG_VECTOR 0x14   // Only with MSI-X enabled...
+#define VIRTIO_PCI_MSI_QUEUE_VECTOR 0x16
+#define VIRTIO_PCI_CONFIG_MSI       0x18    // ...which moves the device config here
+#define VIRTIO_MSI_NO_VECTOR        0xFFFF
 
 // VirtIO status bits
 #define VIRTIO_STATUS_ACKNOWLEDGE   0x01
@@ -66,6 +73,12 @@
 #define VIRTIO_NET_CFG_STATUS       0x06
 #define VIRTIO_NET_CFG_MAX_VQ_PAIRS 0x08
 
+// Control queue commands
+#define VIRTIO_NET_CTRL_MQ          4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET 0
+#define VIRTIO_NET_OK               0
+#define VIRTIO_NET_CTRL_TIMEOUT     1000000 // Polls before giving up on the device's ack
+
 // VirtIO network status
 #define VIRTIO_NET_S_LINK_UP        1
 #define VIRTIO_NET_S_ANNOUNCE       2
@@ -75,6 +88,16 @@
 #define VIRTQ_DESC_F_WRITE          2
 #define VIRTQ_DESC_F_INDIRECT       4
 
+// VirtQueue available ring flags
+#define VIRTQ_AVAIL_F_NO_INTERRUPT  1
+
+// VirtQueue used ring flags
+#define VIRTQ_USED_F_NO_NOTIFY      1
+
+// Net header flags
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1      // Checksum from csum_start still to be filled in
+#define VIRTIO_NET_HDR_F_DATA_VALID 2      // Receive: the device checked the checksums
+
 // GSO types
 #define VIRTIO_NET_HDR_GSO_NONE     0
 #define VIRTIO_NET_HDR_GSO_TCPV4    1
@@ -124,12 +147,26 @@ typedef struct __attribute__((packed)) {
     uint16_t csum_offset;
 } virtio_net_hdr_t;
 
-// VirtIO network queue
+// Network statistics
+typedef struct {
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t rx_errors;
+    uint64_t rx_dropped;
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_errors;
+    uint64_t tx_dropped;
+} virtio_net_stats_t;
+
+// VirtIO network queue. Queue pair n is receive queue 2n and transmit
+// queue 2n+1; the control queue comes after the last pair.
 typedef struct {
     uint16_t queue_idx;
     uint16_t queue_size;
     uint16_t last_used_idx;
     uint16_t free_head;
+    uint16_t num_free;      // Descriptors on the free list
     
     // Queue components
     virtq_desc_t* desc;
@@ -138,26 +175,25 @@ typedef struct {
     
     // DMA regions
     dma_region_t* queue_dma;
-    dma_region_t* buffers[VIRTIO_NET_QUEUE_SIZE];
+    net_buffer_t* buffers[VIRTIO_NET_QUEUE_SIZE];   // Posted to, or in flight from, each descriptor
+    net_buffer_pool_t* pool;    // Receive refills come from here; NULL for the shared pool
     
     // Device reference
     struct virtio_net_device* device;
+    uint16_t pair;
+    
+    // Receive interrupts: MSI-X entry pair when irq is set. With a notifier
+    // set they stay suppressed after each one until
+    // virtio_net_set_rx_interrupts turns them back on.
+    bool irq;
+    void (*notify)(void* context);
+    void* context;
+    
+    virtio_net_stats_t stats;
     
     spinlock_t lock;
 } virtio_net_queue_t;
 
-// Network statistics
-typedef struct {
-    uint64_t rx_packets;
-    uint64_t rx_bytes;
-    uint64_t rx_errors;
-    uint64_t rx_dropped;
-    uint64_t tx_packets;
-    uint64_t tx_bytes;
-    uint64_t tx_errors;
-    uint64_t tx_dropped;
-} virtio_net_stats_t;
-
 // Device state
 typedef enum {
     VIRTIO_NET_STATE_DISABLED = 0,
@@ -184,13 +220,18 @@ typedef struct virtio_net_device {
     bool link_up;
     bool has_csum;
     
-    // Virtqueues
-    virtio_net_queue_t* rx_queue;
-    virtio_net_queue_t* tx_queue;
+    // Virtqueues; the device spreads received flows over the pairs, and
+    // each CPU sends on its own
+    virtio_net_queue_t* rx_queues[VIRTIO_NET_MAX_QUEUE_PAIRS];
+    virtio_net_queue_t* tx_queues[VIRTIO_NET_MAX_QUEUE_PAIRS];
+    uint16_t num_queue_pairs;
     virtio_net_queue_t* ctrl_queue;  // Optional control queue
+    dma_region_t* ctrl_dma;          // A command's header, data and ack
     
-    // Statistics
-    virtio_net_stats_t stats;
+    // Interrupts
+    device_handle_t* handle;
+    bool msix;              // One vector per receive queue
+    bool intx;
 } virtio_net_device_t;
 
 // =============================================================================
@@ -200,6 +241,33 @@ typedef struct virtio_net_device {
 void virtio_net_init(void);
 int virtio_net_send_packet(virtio_net_device_t* dev, void* data, size_t length);
 int virtio_net_receive_packet(virtio_net_device_t* dev, void* buffer, size_t max_len);
+
+// Zero-copy: send_buffer takes the caller's reference whether or not it
+// succeeds; receive_buffer hands over the ring's buffer and posts a fresh
+// one in its place, returning NULL once the ring is empty
+int virtio_net_send_buffer(virtio_net_device_t* dev, net_buffer_t* buffer);
+net_buffer_t* virtio_net_receive_buffer(virtio_net_device_t* dev, uint32_t queue);
+
+// Batched send: queues as many of the frames as the ring has room for,
+// publishes them together and notifies the device once. Takes every
+// reference, dropping frames that didn't fit, and returns how many were
+// queued.
+int virtio_net_send_buffers(virtio_net_device_t* dev, net_buffer_t** buffers, uint32_t count);
+
+// NET_OFFLOAD_* the device took on in feature negotiation: checksums
+// either way and TSO for IPv4, the frags of a frame chained descriptor to
+// descriptor
+uint32_t virtio_net_get_offloads(virtio_net_device_t* dev);
+
+// Receive queues, each with its own notifier and interrupt mask
+uint32_t virtio_net_rx_queue_count(virtio_net_device_t* dev);
+
+// Refill a receive queue from pool (NULL for the shared one) from now on.
+// Buffers already posted stay there until frames land in them.
+int virtio_net_set_rx_pool(virtio_net_device_t* dev, uint32_t queue, net_buffer_pool_t* pool);
+void virtio_net_set_rx_notify(virtio_net_device_t* dev, uint32_t queue,
+                              void (*notify)(void* context), void* context);
+bool virtio_net_set_rx_interrupts(virtio_net_device_t* dev, uint32_t queue, bool enable);
 void virtio_net_get_mac_address(virtio_net_device_t* dev, uint8_t* mac);
 bool virtio_net_is_link_up(virtio_net_device_t* dev);
 void virtio_net_get_stats(virtio_net_device_t* dev, virtio_net_stats_t* stats);
@@ -7,6 +7,8 @@
 #include "../continuum_core.h"
 #include "../flux_memory.h"
 #include "../conduit_ipc.h"
+#include "../temporal_scheduler.h"
+#include "../continuum_trace.h"
 
 // =============================================================================
 // Global Driver Registry
@@ -51,22 +53,22 @@ static void bus_manager_init(bus_type_t bus_type) {
             manager->scan = pci_bus_scan;
             manager->configure = pci_bus_configure;
             break;
-            
+        
         case BUS_TYPE_USB:
             manager->scan = usb_bus_scan;
             manager->configure = usb_bus_configure;
             break;
-            
+        
         case BUS_TYPE_VIRTIO:
             manager->scan = virtio_bus_scan;
             manager->configure = virtio_bus_configure;
             break;
-            
+        
         case BUS_TYPE_THUNDERBOLT:
             manager->scan = thunderbolt_bus_scan;
             manager->configure = thunderbolt_bus_configure;
             break;
-            
+        
         default:
             manager->scan = NULL;
             manager->configure = NULL;
@@ -110,7 +112,7 @@ static int pci_bus_scan(bus_manager_t* manager) {
                 
                 // Store PCI location
                 pci_device_info_t* pci_info = flux_allocate(NULL, 
-                    sizeof(pci_device_info_t), FLUX_ALLOC_KERNEL);
+                    sizeof(pci_device_info_t), FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
                 pci_info->bus = bus;
                 pci_info->device = device;
                 pci_info->function = function;
@@ -245,6 +247,237 @@ static int thunderbolt_bus_configure(bus_manager_t* manager) {
     return 0;
 }
 
+// =============================================================================
+// I/O Completion
+// =============================================================================
+
+// One per CPU. Packets completed inside a device interrupt wait here until
+// the outermost handler returns, so completions never run under a
+// driver's locks; those with a conduit go on to the CPU's kiod, since
+// sending may switch to the receiver.
+typedef struct {
+    spinlock_t lock;
+    io_packet_t* head;
+    io_packet_t* tail;
+    io_packet_t* conduit_head;
+    io_packet_t* conduit_tail;
+    uint32_t depth;             // Device interrupts running on this CPU
+    quantum_context_t* kiod;
+    io_completion_stats_t stats;
+} __attribute__((aligned(64))) io_cpu_t;
+
+static io_cpu_t g_io_cpus[MAX_CPU_CORES];
+static uint32_t g_kiod_count;
+
+// A CPU that has no kiod of its own hands conduit messages to one that does
+static io_cpu_t* io_kiod_queue(uint32_t cpu) {
+    return &g_io_cpus[cpu % g_kiod_count];
+}
+
+static void io_queue_append(io_packet_t** head, io_packet_t** tail, io_packet_t* packet) {
+    packet->next = NULL;
+    if (*tail) {
+        (*tail)->next = packet;
+    } else {
+        *head = packet;
+    }
+    *tail = packet;
+}
+
+static void io_send_completion(io_cpu_t* io, io_packet_t* packet) {
+    io_completion_msg_t msg = {
+        .packet = packet,
+        .context = packet->context,
+        .status = packet->status
+    };
+    bool sent = conduit_send(packet->conduit, &msg, sizeof(msg), CONDUIT_FLAG_NONBLOCK) >= 0;
+    __atomic_fetch_add(sent ? &io->stats.conduit_sent : &io->stats.conduit_dropped, 1,
+                       __ATOMIC_RELAXED);
+}
+
+// The status goes in last for packets nobody is called back about, since
+// a waiter may reuse them as soon as it sees it
+static void io_deliver(io_cpu_t* io, io_packet_t* packet, io_result_t status) {
+    __atomic_fetch_add(&io->stats.completed, 1, __ATOMIC_RELAXED);
+    if (packet->completion) {
+        packet->status = status;
+        packet->completion(packet);
+    } else if (packet->conduit) {
+        packet->status = status;
+        io_send_completion(io, packet);
+    } else {
+        __atomic_store_n(&packet->status, status, __ATOMIC_RELEASE);
+    }
+}
+
+void resonance_io_complete(io_packet_t* packet, io_result_t status) {
+    uint64_t flags = cpu_irq_save();
+    uint32_t cpu = temporal_get_current_cpu();
+    io_cpu_t* io = &g_io_cpus[cpu];
+    
+    // Holding back packets with nothing to run would only delay their waiters
+    if (io->depth == 0 || (!packet->completion && !packet->conduit)) {
+        cpu_irq_restore(flags);
+        io_deliver(io, packet, status);
+        return;
+    }
+    
+    // Without any kiod, conduit messages go out at interrupt exit too
+    packet->status = status;
+    io->stats.deferred++;
+    if (packet->completion || g_kiod_count == 0) {
+        spinlock_acquire(&io->lock);
+        io_queue_append(&io->head, &io->tail, packet);
+        spinlock_release(&io->lock);
+    } else {
+        io_cpu_t* daemon = io_kiod_queue(cpu);
+        spinlock_acquire(&daemon->lock);
+        io_queue_append(&daemon->conduit_head, &daemon->conduit_tail, packet);
+        spinlock_release(&daemon->lock);
+        temporal_unblock(daemon->kiod);
+    }
+    cpu_irq_restore(flags);
+}
+
+// Bracket a device interrupt handler; interrupts are off throughout
+static io_cpu_t* io_irq_enter(void) {
+    io_cpu_t* io = &g_io_cpus[temporal_get_current_cpu()];
+    io->depth++;
+    return io;
+}
+
+static void io_irq_exit(io_cpu_t* io) {
+    if (--io->depth > 0) {
+        return;
+    }
+    
+    // Completions may complete or submit more, which now run directly
+    while (__atomic_load_n(&io->head, __ATOMIC_RELAXED)) {
+        spinlock_acquire(&io->lock);
+        io_packet_t* packet = io->head;
+        io->head = NULL;
+        io->tail = NULL;
+        spinlock_release(&io->lock);
+        
+        while (packet) {
+            io_packet_t* next = packet->next;
+            __atomic_fetch_add(&io->stats.completed, 1, __ATOMIC_RELAXED);
+            if (packet->completion) {
+                packet->completion(packet);
+            } else {
+                io_send_completion(io, packet);
+            }
+            packet = next;
+        }
+    }
+}
+
+// kiod: send the conduit messages its CPU's interrupts left behind. The
+// queue is checked with interrupts off, so a wakeup from this CPU can't
+// slip in between the check and the sleep.
+static void io_kiod_main(void) {
+    io_cpu_t* io = &g_io_cpus[temporal_get_current_cpu()];
+    
+    while (1) {
+        uint64_t flags = cpu_irq_save();
+        spinlock_acquire(&io->lock);
+        io_packet_t* packet = io->conduit_head;
+        io->conduit_head = NULL;
+        io->conduit_tail = NULL;
+        spinlock_release(&io->lock);
+        
+        if (!packet) {
+            temporal_sleep(RESONANCE_KIOD_IDLE);
+            cpu_irq_restore(flags);
+            continue;
+        }
+        cpu_irq_restore(flags);
+        
+        while (packet) {
+            io_packet_t* next = packet->next;
+            __atomic_fetch_add(&io->stats.completed, 1, __ATOMIC_RELAXED);
+            io_send_completion(io, packet);
+            packet = next;
+        }
+    }
+}
+
+// One kiod per CPU, pinned to it, as far as the affinity mask reaches
+static void io_start_daemons(void) {
+    uint32_t cpus = continuum_get_cpu_count();
+    if (cpus == 0 || cpus > MAX_CPU_CORES) {
+        cpus = 1;
+    }
+    if (cpus > RESONANCE_KIOD_MAX) {
+        cpus = RESONANCE_KIOD_MAX;
+    }
+    
+    for (uint32_t cpu = 0; cpu < MAX_CPU_CORES; cpu++) {
+        spinlock_init(&g_io_cpus[cpu].lock);
+    }
+    
+    for (uint32_t cpu = 0; cpu < cpus; cpu++) {
+        quantum_id_t qid = continuum_create_quantum(ABI_MODE_NATIVE, (void*)io_kiod_main,
+                                                    "kiod");
+        quantum_context_t* quantum = continuum_get_quantum(qid);
+        if (!quantum) {
+            break;
+        }
+        
+        quantum->scheduling.priority = PRIORITY_HIGH;
+        quantum->scheduling.cpu_affinity = CPU_AFFINITY_SINGLE;
+        quantum->scheduling.cpu_mask = 1ULL << cpu;
+        g_io_cpus[cpu].kiod = quantum;
+        g_kiod_count++;
+        temporal_enqueue(quantum);
+    }
+}
+
+io_result_t resonance_io_wait(io_packet_t* const* packets, uint32_t count, uint64_t timeout) {
+    uint64_t start = continuum_get_time();
+    uint64_t spin_until = start + continuum_usec_to_tsc(RESONANCE_IO_POLL_SPIN);
+    uint64_t deadline = start + continuum_usec_to_tsc(timeout);
+    
+    while (1) {
+        bool pending = false;
+        bool failed = false;
+        for (uint32_t i = 0; i < count; i++) {
+            io_result_t status = __atomic_load_n(&packets[i]->status, __ATOMIC_ACQUIRE);
+            if (status == IO_PENDING) {
+                pending = true;
+                break;
+            }
+            failed |= status != IO_SUCCESS;
+        }
+        if (!pending) {
+            return failed ? IO_ERROR : IO_SUCCESS;
+        }
+        
+        uint64_t now = continuum_get_time();
+        if (timeout && now >= deadline) {
+            return IO_TIMEOUT;
+        }
+        
+        quantum_context_t* current = temporal_get_current();
+        if (now >= spin_until && current) {
+            temporal_yield(current);
+        } else {
+            __asm__ __volatile__("pause");
+        }
+    }
+}
+
+void resonance_io_get_stats(io_completion_stats_t* stats) {
+    memset(stats, 0, sizeof(io_completion_stats_t));
+    for (uint32_t cpu = 0; cpu < MAX_CPU_CORES; cpu++) {
+        io_completion_stats_t* io = &g_io_cpus[cpu].stats;
+        stats->completed += __atomic_load_n(&io->completed, __ATOMIC_RELAXED);
+        stats->deferred += __atomic_load_n(&io->deferred, __ATOMIC_RELAXED);
+        stats->conduit_sent += __atomic_load_n(&io->conduit_sent, __ATOMIC_RELAXED);
+        stats->conduit_dropped += __atomic_load_n(&io->conduit_dropped, __ATOMIC_RELAXED);
+    }
+}
+
 // =============================================================================
 // Core Driver Framework
 // =============================================================================
@@ -274,6 +507,8 @@ void resonance_init(void) {
     
     spinlock_release(&g_driver_lock);
     
+    io_start_daemons();
+    
     // Perform initial bus scans
     resonance_scan_all_buses();
 }
@@ -446,6 +681,217 @@ static bool driver_matches_device(resonance_driver_t* driver, device_node_t* nod
     return false;
 }
 
+// =============================================================================
+// Device Probing
+// =============================================================================
+
+// Probes waiting for a worker, oldest first. A node is its own queue
+// entry; probe_driver marks it taken until its probe and attach are done.
+static struct {
+    spinlock_t lock;
+    device_node_t* head;
+    device_node_t* tail;
+    uint32_t pending[BUS_TYPE_MAX];     // Queued or running, by bus
+    uint32_t total;
+    quantum_context_t* workers[RESONANCE_PROBE_WORKERS];
+    uint32_t worker_count;
+    bool started;
+    resonance_probe_record_t records[RESONANCE_PROBE_RECORDS];
+    uint32_t record_count;
+} g_probe = { .lock = SPINLOCK_INIT };
+
+// Buses whose devices hang off controllers found on another bus scan only
+// once that bus's probes have finished
+static const int8_t g_bus_depends[BUS_TYPE_MAX] = {
+    [BUS_TYPE_PCI] = -1,
+    [BUS_TYPE_USB] = BUS_TYPE_PCI,
+    [BUS_TYPE_VIRTIO] = BUS_TYPE_PCI,
+    [BUS_TYPE_THUNDERBOLT] = BUS_TYPE_PCI,
+    [BUS_TYPE_I2C] = -1,
+    [BUS_TYPE_SPI] = -1,
+    [BUS_TYPE_PLATFORM] = -1,
+    [BUS_TYPE_CUSTOM] = -1
+};
+
+// The first queued node whose parent isn't itself still being probed;
+// caller holds g_probe.lock
+static device_node_t* probe_take(void) {
+    device_node_t* prev = NULL;
+    for (device_node_t* node = g_probe.head; node; prev = node, node = node->probe_next) {
+        if (node->parent && __atomic_load_n(&node->parent->probe_driver, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        
+        if (prev) {
+            prev->probe_next = node->probe_next;
+        } else {
+            g_probe.head = node->probe_next;
+        }
+        if (g_probe.tail == node) {
+            g_probe.tail = prev;
+        }
+        node->probe_next = NULL;
+        return node;
+    }
+    return NULL;
+}
+
+static void probe_run(device_node_t* node) {
+    resonance_driver_t* driver = node->probe_driver;
+    resonance_probe_record_t record = {
+        .driver = driver->name,
+        .device = node->id,
+        .bus = node->probe_bus,
+        .cpu = temporal_get_current_cpu()
+    };
+    
+    uint64_t start = continuum_get_time();
+    record.wait_cycles = start - node->probe_queued;
+    
+    void* handle = driver->probe ? driver->probe(node) : NULL;
+    uint64_t probed = continuum_get_time();
+    record.probe_cycles = probed - start;
+    
+    if (handle) {
+        node->driver = driver;
+        node->handle = handle;
+        node->state = DEVICE_STATE_CONFIGURED;
+        record.bound = true;
+        
+        // Attach driver
+        if (driver->attach) {
+            record.attach_result = driver->attach(handle);
+        }
+        record.attach_cycles = continuum_get_time() - probed;
+    }
+    TRACE(TRACE_RESONANCE_PROBE, node->id, driver->id, continuum_get_time() - start);
+    
+    spinlock_acquire(&g_probe.lock);
+    if (g_probe.record_count < RESONANCE_PROBE_RECORDS) {
+        g_probe.records[g_probe.record_count++] = record;
+    }
+    g_probe.pending[node->probe_bus]--;
+    g_probe.total--;
+    __atomic_store_n(&node->probe_driver, NULL, __ATOMIC_RELEASE);
+    spinlock_release(&g_probe.lock);
+    
+    // Children held back behind this one may be runnable now
+    for (uint32_t i = 0; i < g_probe.worker_count; i++) {
+        temporal_unblock(g_probe.workers[i]);
+    }
+}
+
+// Run one queued probe here; false if none could run
+static bool probe_run_one(void) {
+    spinlock_acquire(&g_probe.lock);
+    device_node_t* node = probe_take();
+    spinlock_release(&g_probe.lock);
+    
+    if (!node) {
+        return false;
+    }
+    probe_run(node);
+    return true;
+}
+
+static void probe_worker_main(void) {
+    while (1) {
+        if (!probe_run_one()) {
+            temporal_sleep(RESONANCE_PROBE_IDLE);
+        }
+    }
+}
+
+// Started on the first probe, some of them likely before the scheduler runs;
+// until it does, waiters run the probes themselves
+static void probe_start_workers(void) {
+    uint32_t cpus = continuum_get_cpu_count();
+    if (cpus == 0 || cpus > MAX_CPU_CORES) {
+        cpus = 1;
+    }
+    if (cpus > RESONANCE_PROBE_WORKERS) {
+        cpus = RESONANCE_PROBE_WORKERS;
+    }
+    
+    for (uint32_t i = 0; i < cpus; i++) {
+        quantum_id_t qid = continuum_create_quantum(ABI_MODE_NATIVE, (void*)probe_worker_main,
+                                                    "kprobe");
+        quantum_context_t* quantum = continuum_get_quantum(qid);
+        if (!quantum) {
+            break;
+        }
+        
+        g_probe.workers[g_probe.worker_count++] = quantum;
+        temporal_enqueue(quantum);
+    }
+}
+
+// Queue a probe of node by driver, unless one is already in flight
+static void probe_queue(device_node_t* node, resonance_driver_t* driver) {
+    bool start_workers = false;
+    
+    spinlock_acquire(&g_probe.lock);
+    if (node->probe_driver || node->driver) {
+        spinlock_release(&g_probe.lock);
+        return;
+    }
+    
+    node->probe_driver = driver;
+    node->probe_bus = node->bus_type;
+    node->probe_queued = continuum_get_time();
+    node->probe_next = NULL;
+    if (g_probe.tail) {
+        g_probe.tail->probe_next = node;
+    } else {
+        g_probe.head = node;
+    }
+    g_probe.tail = node;
+    g_probe.pending[node->probe_bus]++;
+    g_probe.total++;
+    
+    if (!g_probe.started) {
+        g_probe.started = true;
+        start_workers = true;
+    }
+    spinlock_release(&g_probe.lock);
+    
+    if (start_workers) {
+        probe_start_workers();
+    }
+    for (uint32_t i = 0; i < g_probe.worker_count; i++) {
+        temporal_unblock(g_probe.workers[i]);
+    }
+}
+
+// Wait for the probes on one bus, or all of them; the waiter runs queued
+// probes itself rather than idle
+static void probe_wait(const uint32_t* pending) {
+    while (__atomic_load_n(pending, __ATOMIC_ACQUIRE) > 0) {
+        if (probe_run_one()) {
+            continue;
+        }
+        
+        quantum_context_t* current = temporal_get_current();
+        if (current) {
+            temporal_yield(current);
+        } else {
+            __asm__ __volatile__("pause");
+        }
+    }
+}
+
+void resonance_probe_wait(void) {
+    probe_wait(&g_probe.total);
+}
+
+size_t resonance_get_probe_trace(resonance_probe_record_t* records, size_t max_records) {
+    spinlock_acquire(&g_probe.lock);
+    size_t count = g_probe.record_count < max_records ? g_probe.record_count : max_records;
+    memcpy(records, g_probe.records, count * sizeof(resonance_probe_record_t));
+    spinlock_release(&g_probe.lock);
+    return count;
+}
+
 void resonance_match_driver(device_node_t* node) {
     if (!node) {
         return;
@@ -456,28 +902,12 @@ void resonance_match_driver(device_node_t* node) {
     // Find matching driver
     for (int i = 0; i < MAX_DRIVERS; i++) {
         resonance_driver_t* driver = g_drivers[i];
-        if (driver && driver->state == DRIVER_STATE_REGISTERED) {
-            if (driver_matches_device(driver, node)) {
-                // Found a match, try to probe
-                spinlock_release(&g_driver_lock);
-                
-                if (driver->probe) {
-                    void* handle = driver->probe(node);
-                    if (handle) {
-                        // Successful probe
-                        node->driver = driver;
-                        node->handle = handle;
-                        node->state = DEVICE_STATE_CONFIGURED;
-                        
-                        // Attach driver
-                        if (driver->attach) {
-                            driver->attach(handle);
-                        }
-                    }
-                }
-                
-                return;
-            }
+        if (driver && driver->state == DRIVER_STATE_REGISTERED &&
+            driver_matches_device(driver, node)) {
+            // Found a match, queue the probe
+            spinlock_release(&g_driver_lock);
+            probe_queue(node, driver);
+            return;
         }
     }
     
@@ -492,34 +922,30 @@ void resonance_probe_devices(resonance_driver_t* driver) {
     // Try to match with all unbound devices
     for (uint32_t i = 0; i < g_device_tree.node_count; i++) {
         device_node_t* node = g_devices[i];
-        if (node && !node->driver) {
-            if (driver_matches_device(driver, node)) {
-                if (driver->probe) {
-                    void* handle = driver->probe(node);
-                    if (handle) {
-                        node->driver = driver;
-                        node->handle = handle;
-                        node->state = DEVICE_STATE_CONFIGURED;
-                        
-                        if (driver->attach) {
-                            driver->attach(handle);
-                        }
-                    }
-                }
-            }
+        if (node && !node->driver && driver_matches_device(driver, node)) {
+            probe_queue(node, driver);
         }
     }
+    
+    resonance_probe_wait();
 }
 
 // =============================================================================
 // Bus Scanning
 // =============================================================================
 
+// Scans run in bus order with their probes running in parallel behind
+// them; a bus whose devices sit behind another bus's controllers waits for
+// that bus's probes first. Returns with every probe done.
 void resonance_scan_all_buses(void) {
     // Scan each bus type
     for (int i = 0; i < BUS_TYPE_MAX; i++) {
         bus_manager_t* manager = &g_bus_managers[i];
         if (manager->scan) {
+            if (g_bus_depends[i] >= 0) {
+                probe_wait(&g_probe.pending[g_bus_depends[i]]);
+            }
+            
             int count = manager->scan(manager);
             manager->initialized = true;
             
@@ -529,26 +955,359 @@ void resonance_scan_all_buses(void) {
             }
         }
     }
+    
+    resonance_probe_wait();
 }
 
 // =============================================================================
 // Interrupt Handling
 // =============================================================================
 
+#define PCI_CAP_MSI             0x05
+#define PCI_CAP_MSIX            0x11
+#define PCI_STATUS_CAP_LIST     (1U << 20)   // In the command/status dword
+#define PCI_COMMAND_INTX_OFF    (1U << 10)
+#define MSI_ADDRESS_BASE        0xFEE00000U
+#define MSI_CONTROL_ENABLE      (1U << 16)   // Message control, upper half of the cap dword
+#define MSI_CONTROL_64BIT       (1U << 23)
+#define MSIX_CONTROL_ENABLE     (1U << 31)
+#define MSIX_CONTROL_MASK_ALL   (1U << 30)
+#define MSIX_ENTRY_WORDS        4            // Address low, address high, data, control
+#define MSIX_ENTRY_MASKED       (1U << 0)
+
+// A handler bound to one vector; legacy lines chain several
+typedef struct irq_action {
+    irq_handler_t handler;
+    void* context;
+    device_handle_t* handle;
+    uint32_t index;             // MSI-X table entry
+    struct irq_action* next;
+} irq_action_t;
+
+// Legacy lines get one vector each, shared by every handler on the line
+typedef struct {
+    irq_action_t* actions;
+    uint8_t vector;
+} legacy_line_t;
+
+static legacy_line_t g_legacy_lines[RESONANCE_LEGACY_LINES];
+static irq_action_t g_msi_actions[INTERRUPT_VECTORS];
+static spinlock_t g_irq_lock = SPINLOCK_INIT;
+
+static pci_device_info_t* handle_pci(device_handle_t* handle) {
+    device_node_t* node = handle->device_node;
+    if (!node || (node->bus_type != BUS_TYPE_PCI && node->bus_type != BUS_TYPE_VIRTIO)) {
+        return NULL;
+    }
+    return (pci_device_info_t*)node->bus_specific_data;
+}
+
+static uint8_t pci_find_capability(pci_device_info_t* pci, uint8_t id) {
+    if (!(pci_config_read(pci->bus, pci->device, pci->function, 0x04) & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+    
+    uint8_t offset = pci_config_read(pci->bus, pci->device, pci->function, 0x34) & 0xFC;
+    for (int guard = 0; offset && guard < 48; guard++) {
+        uint32_t header = pci_config_read(pci->bus, pci->device, pci->function, offset);
+        if ((header & 0xFF) == id) {
+            return offset;
+        }
+        offset = (header >> 8) & 0xFC;
+    }
+    return 0;
+}
+
+// Locate the MSI and MSI-X capabilities and map the MSI-X table
+static void pci_probe_msi(pci_device_info_t* pci) {
+    if (pci->msi_probed) {
+        return;
+    }
+    pci->msi_probed = true;
+    pci->msi_cap = pci_find_capability(pci, PCI_CAP_MSI);
+    pci->msix_cap = pci_find_capability(pci, PCI_CAP_MSIX);
+    
+    if (!pci->msix_cap) {
+        return;
+    }
+    
+    uint32_t control = pci_config_read(pci->bus, pci->device, pci->function, pci->msix_cap);
+    uint32_t table = pci_config_read(pci->bus, pci->device, pci->function, pci->msix_cap + 4);
+    uint8_t bir = table & 0x7;
+    uint32_t bar = bir < 6 ? pci_config_read(pci->bus, pci->device, pci->function,
+                                             0x10 + bir * 4) : 1;
+    
+    if (bar & 1) {
+        pci->msix_cap = 0;  // The table must sit in memory space
+        return;
+    }
+    
+    uint64_t base = bar & ~0xFULL;
+    if (((bar >> 1) & 0x3) == 0x2 && bir < 5) {
+        base |= (uint64_t)pci_config_read(pci->bus, pci->device, pci->function,
+                                          0x10 + bir * 4 + 4) << 32;
+    }
+    
+    pci->msix_size = ((control >> 16) & 0x7FF) + 1;
+    pci->msix_table = (volatile uint32_t*)(base + (table & ~0x7U));
+}
+
+static void pci_disable_intx(pci_device_info_t* pci) {
+    uint32_t command = pci_config_read(pci->bus, pci->device, pci->function, 0x04);
+    pci_config_write(pci->bus, pci->device, pci->function, 0x04,
+                     (command & 0xFFFF) | PCI_COMMAND_INTX_OFF);
+}
+
+static void msix_write_entry(pci_device_info_t* pci, uint32_t index, uint8_t vector,
+                             uint32_t cpu) {
+    volatile uint32_t* entry = pci->msix_table + index * MSIX_ENTRY_WORDS;
+    
+    entry[3] |= MSIX_ENTRY_MASKED;
+    entry[0] = MSI_ADDRESS_BASE | (continuum_cpu_apic_id(cpu) << 12);
+    entry[1] = 0;
+    entry[2] = vector;  // Edge triggered, fixed delivery
+    entry[3] &= ~MSIX_ENTRY_MASKED;
+}
+
+static void msix_mask_entry(pci_device_info_t* pci, uint32_t index) {
+    pci->msix_table[index * MSIX_ENTRY_WORDS + 3] |= MSIX_ENTRY_MASKED;
+}
+
+static void msi_write(pci_device_info_t* pci, uint8_t vector, uint32_t cpu, bool enable) {
+    uint8_t cap = pci->msi_cap;
+    uint32_t control = pci_config_read(pci->bus, pci->device, pci->function, cap);
+    uint8_t data = (control & MSI_CONTROL_64BIT) ? cap + 12 : cap + 8;
+    
+    // Single message: multiple message enable stays zero
+    control &= ~(MSI_CONTROL_ENABLE | (0x7U << 20));
+    pci_config_write(pci->bus, pci->device, pci->function, cap, control);
+    if (!enable) {
+        return;
+    }
+    
+    pci_config_write(pci->bus, pci->device, pci->function, cap + 4,
+                     MSI_ADDRESS_BASE | (continuum_cpu_apic_id(cpu) << 12));
+    if (control & MSI_CONTROL_64BIT) {
+        pci_config_write(pci->bus, pci->device, pci->function, cap + 8, 0);
+    }
+    pci_config_write(pci->bus, pci->device, pci->function, data, vector);
+    pci_config_write(pci->bus, pci->device, pci->function, cap, control | MSI_CONTROL_ENABLE);
+}
+
+static void msi_interrupt(interrupt_frame_t* frame, void* context) {
+    (void)frame;
+    irq_action_t* action = context;
+    io_cpu_t* io = io_irq_enter();
+    action->handler(action->context);
+    io_irq_exit(io);
+}
+
+static void legacy_interrupt(interrupt_frame_t* frame, void* context) {
+    (void)frame;
+    legacy_line_t* line = context;
+    io_cpu_t* io = io_irq_enter();
+    
+    for (irq_action_t* action = __atomic_load_n(&line->actions, __ATOMIC_ACQUIRE);
+         action; action = action->next) {
+        action->handler(action->context);
+    }
+    io_irq_exit(io);
+}
+
+static void msi_steer(uint8_t vector, uint32_t cpu, void* source) {
+    irq_action_t* action = source;
+    pci_device_info_t* pci = handle_pci(action->handle);
+    
+    if (pci->msix_cap) {
+        msix_write_entry(pci, action->index, vector, cpu);
+    } else {
+        msi_write(pci, vector, cpu, true);
+    }
+}
+
+static uint32_t default_irq_cpu(uint32_t irq) {
+    uint32_t cpus = continuum_get_cpu_count();
+    return cpus ? RESONANCE_IRQ_INDEX(irq) % cpus : 0;
+}
+
+// Allocate a vector and point MSI-X entry (or the single MSI message) at it
+static int msi_attach(device_handle_t* handle, interrupt_vector_t* entry) {
+    pci_device_info_t* pci = handle_pci(handle);
+    if (!pci) {
+        return -1;
+    }
+    
+    pci_probe_msi(pci);
+    uint32_t index = RESONANCE_IRQ_INDEX(entry->irq);
+    if (pci->msix_cap ? index >= pci->msix_size : (!pci->msi_cap || index != 0)) {
+        return -1;
+    }
+    
+    int vector = continuum_alloc_vector();
+    if (vector < 0) {
+        return -1;
+    }
+    
+    irq_action_t* action = &g_msi_actions[vector];
+    action->handler = entry->handler;
+    action->context = entry->context;
+    action->handle = handle;
+    action->index = index;
+    action->next = NULL;
+    
+    if (continuum_register_interrupt(vector, msi_interrupt, action, true) != 0) {
+        continuum_free_vector(vector);
+        return -1;
+    }
+    
+    entry->vector = vector;
+    entry->cpu = default_irq_cpu(entry->irq);
+    
+    if (pci->msix_cap) {
+        msix_write_entry(pci, index, vector, entry->cpu);
+        if (!pci->msix_enabled) {
+            uint32_t control = pci_config_read(pci->bus, pci->device, pci->function,
+                                               pci->msix_cap);
+            control = (control | MSIX_CONTROL_ENABLE) & ~MSIX_CONTROL_MASK_ALL;
+            pci_config_write(pci->bus, pci->device, pci->function, pci->msix_cap, control);
+            pci->msix_enabled = true;
+        }
+    } else {
+        msi_write(pci, vector, entry->cpu, true);
+    }
+    pci_disable_intx(pci);
+    
+    continuum_set_interrupt_source(vector, msi_steer, action);
+    return vector;
+}
+
+static void msi_detach(device_handle_t* handle, interrupt_vector_t* entry) {
+    pci_device_info_t* pci = handle_pci(handle);
+    
+    if (pci->msix_cap) {
+        msix_mask_entry(pci, RESONANCE_IRQ_INDEX(entry->irq));
+    } else {
+        msi_write(pci, entry->vector, entry->cpu, false);
+    }
+    
+    continuum_unregister_interrupt(entry->vector);
+    continuum_free_vector(entry->vector);
+}
+
+// Chain the handler onto its line, routing the line through the I/O APIC
+// on first use. PCI INTx lines are level triggered and active low.
+static int legacy_attach(device_handle_t* handle, interrupt_vector_t* entry) {
+    pci_device_info_t* pci = handle_pci(handle);
+    uint32_t gsi = RESONANCE_IRQ_INDEX(entry->irq);
+    
+    if (entry->irq & RESONANCE_IRQ_INTX) {
+        if (!pci || pci->irq_line == 0xFF) {
+            return -1;
+        }
+        gsi = pci->irq_line;
+    }
+    if (gsi >= RESONANCE_LEGACY_LINES) {
+        return -1;
+    }
+    
+    irq_action_t* action = flux_allocate(NULL, sizeof(irq_action_t),
+                                         FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!action) {
+        return -1;
+    }
+    action->handler = entry->handler;
+    action->context = entry->context;
+    action->handle = handle;
+    
+    legacy_line_t* line = &g_legacy_lines[gsi];
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&g_irq_lock);
+    
+    if (!line->actions) {
+        int vector = continuum_alloc_vector();
+        if (vector < 0 ||
+            continuum_register_interrupt(vector, legacy_interrupt, line, true) != 0) {
+            if (vector >= 0) {
+                continuum_free_vector(vector);
+            }
+            spinlock_release(&g_irq_lock);
+            cpu_irq_restore(flags);
+            flux_free(action);
+            return -1;
+        }
+        line->vector = vector;
+    }
+    
+    action->next = line->actions;
+    __atomic_store_n(&line->actions, action, __ATOMIC_RELEASE);
+    
+    // Re-routing a shared line moves it for every handler on it
+    entry->vector = line->vector;
+    entry->cpu = 0;
+    continuum_ioapic_route(gsi, line->vector, entry->cpu,
+                           pci ? IOAPIC_FLAG_LEVEL | IOAPIC_FLAG_ACTIVE_LOW : 0);
+    
+    spinlock_release(&g_irq_lock);
+    cpu_irq_restore(flags);
+    return line->vector;
+}
+
+static void legacy_detach(device_handle_t* handle, interrupt_vector_t* entry) {
+    pci_device_info_t* pci = handle_pci(handle);
+    uint32_t gsi = (entry->irq & RESONANCE_IRQ_INTX) ? pci->irq_line
+                                                     : RESONANCE_IRQ_INDEX(entry->irq);
+    legacy_line_t* line = &g_legacy_lines[gsi];
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&g_irq_lock);
+    
+    irq_action_t** link = &line->actions;
+    while (*link && !((*link)->handle == handle && (*link)->handler == entry->handler &&
+                      (*link)->context == entry->context)) {
+        link = &(*link)->next;
+    }
+    irq_action_t* action = *link;
+    if (action) {
+        __atomic_store_n(link, action->next, __ATOMIC_RELEASE);
+    }
+    
+    bool last = !line->actions;
+    if (last) {
+        continuum_ioapic_mask(gsi);
+    }
+    
+    spinlock_release(&g_irq_lock);
+    cpu_irq_restore(flags);
+    
+    // A handler running elsewhere may still be walking past the action
+    if (last) {
+        continuum_unregister_interrupt(line->vector);
+        continuum_free_vector(line->vector);
+    } else {
+        continuum_sync_interrupt(line->vector);
+    }
+    flux_free(action);
+}
+
 int resonance_register_irq(device_handle_t* handle, uint32_t irq,
                           irq_handler_t handler, void* context) {
-    if (!handle || !handler) {
+    if (!handle || !handler || handle->irq_count >= MAX_IRQ_VECTORS) {
         return -1;
     }
     
-    // Register IRQ handler with interrupt controller
-    // This would integrate with the kernel's interrupt management
+    interrupt_vector_t* entry = &handle->irq_vectors[handle->irq_count];
+    entry->irq = irq;
+    entry->handler = handler;
+    entry->context = context;
     
-    handle->irq_vectors[handle->irq_count].irq = irq;
-    handle->irq_vectors[handle->irq_count].handler = handler;
-    handle->irq_vectors[handle->irq_count].context = context;
-    handle->irq_count++;
+    // Wire the handler to a CPU vector through MSI-X, MSI or the I/O APIC
+    int vector = (irq & RESONANCE_IRQ_MSI) ? msi_attach(handle, entry)
+                                           : legacy_attach(handle, entry);
+    if (vector < 0) {
+        return -1;
+    }
     
+    handle->irq_count++;
     return 0;
 }
 
@@ -560,6 +1319,12 @@ void resonance_unregister_irq(device_handle_t* handle, uint32_t irq) {
     // Remove IRQ handler
     for (uint32_t i = 0; i < handle->irq_count; i++) {
         if (handle->irq_vectors[i].irq == irq) {
+            if (irq & RESONANCE_IRQ_MSI) {
+                msi_detach(handle, &handle->irq_vectors[i]);
+            } else {
+                legacy_detach(handle, &handle->irq_vectors[i]);
+            }
+            
             // Shift remaining entries
             for (uint32_t j = i; j < handle->irq_count - 1; j++) {
                 handle->irq_vectors[j] = handle->irq_vectors[j + 1];
@@ -570,6 +1335,25 @@ void resonance_unregister_irq(device_handle_t* handle, uint32_t irq) {
     }
 }
 
+// Steer an interrupt to cpu, e.g. the CPU that owns the queue it signals
+int resonance_set_irq_affinity(device_handle_t* handle, uint32_t irq, uint32_t cpu) {
+    if (!handle) {
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < handle->irq_count; i++) {
+        interrupt_vector_t* entry = &handle->irq_vectors[i];
+        if (entry->irq == irq) {
+            if (continuum_set_irq_affinity(entry->vector, cpu) != 0) {
+                return -1;
+            }
+            entry->cpu = cpu;
+            return 0;
+        }
+    }
+    return -1;
+}
+
 // =============================================================================
 // DMA Operations
 // =============================================================================
@@ -621,11 +1405,21 @@ io_result_t resonance_io_request(device_handle_t* handle, io_packet_t* packet) {
     
     // Dispatch to driver's I/O handler
     device_node_t* node = handle->device_node;
-    if (node && node->driver && node->driver->io_request) {
-        return node->driver->io_request(handle, packet);
+    if (!node || !node->driver || !node->driver->io_request) {
+        return IO_ERROR;
     }
     
-    return IO_ERROR;
+    // A packet the driver finishes or refuses without completing it still
+    // leaves IO_PENDING, for anyone waiting on it
+    bool async = resonance_io_async(packet);
+    if (async) {
+        packet->status = IO_PENDING;
+    }
+    io_result_t result = node->driver->io_request(handle, packet);
+    if (async && result != IO_PENDING) {
+        __atomic_store_n(&packet->status, result, __ATOMIC_RELEASE);
+    }
+    return result;
 }
 
 // =============================================================================
@@ -22,10 +22,30 @@
 #define MAX_VENDOR_IDS          16
 #define MAX_DEVICE_IDS          16
 
+// I/O completion
+#define RESONANCE_IO_POLL_SPIN  20      // resonance_io_wait spins, then yields (microseconds)
+#define RESONANCE_KIOD_MAX      64      // Completion daemons, one per CPU up to this many
+#define RESONANCE_KIOD_IDLE     10000   // Longest a daemon sleeps unwoken (microseconds)
+
+// Device probing
+#define RESONANCE_PROBE_WORKERS 8       // Quanta running probes, one per CPU up to this many
+#define RESONANCE_PROBE_IDLE    10000   // Longest an idle worker sleeps unwoken (microseconds)
+#define RESONANCE_PROBE_RECORDS 256     // Probe trace entries kept
+
 // I/O Ports
 #define PCI_CONFIG_ADDRESS      0xCF8
 #define PCI_CONFIG_DATA         0xCFC
 
+// resonance_register_irq() irq argument: a legacy GSI by default, the
+// device's own INTx line, or a message-signalled interrupt. With MSI-X the
+// index picks the table entry, so drivers ask for one per queue; queue n
+// starts out on CPU n modulo the CPU count.
+#define RESONANCE_IRQ_MSI       (1U << 31)
+#define RESONANCE_IRQ_INTX      (1U << 30)
+#define RESONANCE_IRQ_QUEUE(n)  (RESONANCE_IRQ_MSI | (n))
+#define RESONANCE_IRQ_INDEX(irq) ((irq) & 0xFFFF)
+#define RESONANCE_LEGACY_LINES  64
+
 // =============================================================================
 // Type Definitions
 // =============================================================================
@@ -86,6 +106,8 @@ typedef struct {
     uint32_t irq;
     void (*handler)(void* context);
     void* context;
+    uint8_t vector;         // CPU vector it arrives on
+    uint32_t cpu;           // CPU it is steered to
 } interrupt_vector_t;
 
 // DMA region
@@ -96,15 +118,68 @@ typedef struct {
     uint32_t flags;
 } dma_region_t;
 
-// I/O packet
-typedef struct {
-    uint32_t operation;     // Read, Write, Control
-    uint64_t offset;
+// I/O packet operations
+#define IO_OP_READ              0
+#define IO_OP_WRITE             1
+#define IO_OP_CONTROL           2
+#define IO_OP_FLUSH             3
+
+// I/O packet flags
+#define IO_FLAG_ASYNC           (1 << 0)    // Asynchronous without a completion or conduit
+
+typedef struct io_packet io_packet_t;
+struct conduit;
+
+// Runs once an asynchronous packet finishes, possibly in interrupt context
+// (at the end of the device interrupt, once the driver's handler has
+// returned); packet->status holds the outcome
+typedef void (*io_completion_t)(io_packet_t* packet);
+
+// I/O packet. Without a completion, conduit or IO_FLAG_ASYNC the request is
+// synchronous; otherwise the driver may return IO_PENDING and finish it
+// later with resonance_io_complete. Any other result means it finished or
+// refused the packet without completing it.
+struct io_packet {
+    uint32_t operation;     // IO_OP_*
+    uint32_t unit;          // Driver defined target (e.g. NVMe namespace), 0 for the first
+    uint64_t offset;        // Bytes
     void* buffer;
     size_t size;
-    uint32_t flags;
-    void* completion;       // Completion callback
-} io_packet_t;
+    memory_domain_t* domain;  // Owner of buffer, NULL for kernel memory
+    uint32_t flags;         // IO_FLAG_*
+    io_completion_t completion;
+    struct conduit* conduit;  // Without a completion, sent an io_completion_msg_t
+    void* context;          // Caller's, untouched by the driver
+    io_result_t status;     // IO_PENDING until the packet completes
+    io_packet_t* next;      // Completion queue link
+};
+
+// One probe from the boot-time trace; times are TSC cycles
+typedef struct {
+    const char* driver;
+    uint32_t device;            // Node ID
+    bus_type_t bus;
+    uint32_t cpu;
+    uint64_t wait_cycles;       // Queued, for a worker or the parent's own probe
+    uint64_t probe_cycles;
+    uint64_t attach_cycles;
+    bool bound;                 // The driver took the device
+    int attach_result;
+} resonance_probe_record_t;
+
+// What a packet's conduit receives when it completes
+typedef struct {
+    io_packet_t* packet;
+    void* context;
+    io_result_t status;
+} io_completion_msg_t;
+
+typedef struct {
+    uint64_t completed;
+    uint64_t deferred;          // Queued behind a device interrupt
+    uint64_t conduit_sent;
+    uint64_t conduit_dropped;   // Receiver's conduit full or closed
+} io_completion_stats_t;
 
 // PCI device info
 typedef struct {
@@ -115,6 +190,14 @@ typedef struct {
     uint8_t bar_count;
     uint8_t irq_line;
     uint8_t irq_pin;
+    
+    // Message-signalled interrupts, found on first use
+    bool msi_probed;
+    uint8_t msi_cap;        // Config offsets, 0 if absent
+    uint8_t msix_cap;
+    uint16_t msix_size;     // Table entries
+    bool msix_enabled;
+    volatile uint32_t* msix_table;
 } pci_device_info_t;
 
 // USB device info
@@ -127,6 +210,11 @@ typedef struct {
     uint8_t device_class;
     uint8_t device_subclass;
     uint8_t device_protocol;
+    
+    // Where the device sits, once a host controller has enumerated it
+    void* host;                 // xhci_controller_t, NULL before
+    uint8_t slot_id;
+    uint8_t speed;              // USB_SPEED_*
 } usb_device_info_t;
 
 // Device node
@@ -159,6 +247,12 @@ struct device_node {
     device_node_t* children;
     device_node_t* sibling;
     
+    // Probe in flight: queued or running on a worker
+    resonance_driver_t* probe_driver;
+    bus_type_t probe_bus;
+    uint64_t probe_queued;      // TSC
+    device_node_t* probe_next;
+    
     // Synchronization
     spinlock_t lock;
 };
@@ -257,9 +351,14 @@ int resonance_add_device(device_node_t* node);
 void resonance_remove_device(device_node_t* node);
 device_node_t* resonance_find_device(uint16_t vendor_id, uint16_t device_id);
 
-// Driver matching
+// Driver matching. Probes run on worker quanta across the CPUs, a device's
+// only once its parent's has finished: resonance_match_driver returns with
+// the probe queued, resonance_probe_devices once the driver's probes are
+// done.
 void resonance_match_driver(device_node_t* node);
 void resonance_probe_devices(resonance_driver_t* driver);
+void resonance_probe_wait(void);
+size_t resonance_get_probe_trace(resonance_probe_record_t* records, size_t max_records);
 
 // Bus operations
 void resonance_scan_all_buses(void);
@@ -269,6 +368,7 @@ int resonance_scan_bus(bus_type_t bus_type);
 int resonance_register_irq(device_handle_t* handle, uint32_t irq,
                           irq_handler_t handler, void* context);
 void resonance_unregister_irq(device_handle_t* handle, uint32_t irq);
+int resonance_set_irq_affinity(device_handle_t* handle, uint32_t irq, uint32_t cpu);
 
 // DMA operations
 dma_region_t* resonance_alloc_dma(size_t size, uint32_t flags);
@@ -279,6 +379,21 @@ void resonance_dma_unmap(uint64_t physical_addr, size_t size);
 // I/O operations
 io_result_t resonance_io_request(device_handle_t* handle, io_packet_t* packet);
 
+// Asynchronous I/O. Drivers finish packets with resonance_io_complete;
+// inside a device interrupt the packet goes on this CPU's completion queue,
+// run once the handler returns (conduit messages by the CPU's kiod), and
+// otherwise it completes at once. resonance_io_wait waits for every packet
+// to leave IO_PENDING, or timeout microseconds (0 for no limit): it returns
+// IO_SUCCESS, IO_ERROR if any failed or IO_TIMEOUT. Waited-on packets'
+// completions mustn't free them.
+void resonance_io_complete(io_packet_t* packet, io_result_t status);
+io_result_t resonance_io_wait(io_packet_t* const* packets, uint32_t count, uint64_t timeout);
+void resonance_io_get_stats(io_completion_stats_t* stats);
+
+static inline bool resonance_io_async(const io_packet_t* packet) {
+    return packet->completion || packet->conduit || (packet->flags & IO_FLAG_ASYNC);
+}
+
 // Bus-specific operations
 int pci_bus_scan(bus_manager_t* manager);
 int pci_bus_configure(bus_manager_t* manager);
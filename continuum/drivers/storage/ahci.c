@@ -4,8 +4,10 @@
  */
 
 #include "ahci.h"
+#include "block.h"
 #include "../resonance.h"
 #include "../../flux_memory.h"
+#include "../../temporal_scheduler.h"
 
 // =============================================================================
 // Global AHCI State
@@ -14,6 +16,7 @@
 static ahci_controller_t* g_ahci_controllers[MAX_AHCI_CONTROLLERS];
 static uint32_t g_ahci_count = 0;
 static spinlock_t g_ahci_lock = SPINLOCK_INIT;
+static uint32_t g_ahci_disk_count = 0;     // Names block queues sda, sdb, ...
 
 // =============================================================================
 // AHCI Port Operations
@@ -72,7 +75,7 @@ static int ahci_port_rebase(ahci_port_t* port, uint32_t port_num) {
     
     // Allocate command tables (8KB per command)
     for (int i = 0; i < 32; i++) {
-        port->ctba_dma[i] = resonance_alloc_dma(8192, DMA_FLAG_COHERENT);
+        port->ctba_dma[i] = resonance_alloc_dma(AHCI_CMD_TABLE_SIZE, DMA_FLAG_COHERENT);
         if (!port->ctba_dma[i]) {
             // Clean up allocated tables
             for (int j = 0; j < i; j++) {
@@ -83,7 +86,7 @@ static int ahci_port_rebase(ahci_port_t* port, uint32_t port_num) {
             return -1;
         }
         port->ctba[i] = (ahci_hba_cmd_tbl_t*)port->ctba_dma[i]->virtual_addr;
-        memset(port->ctba[i], 0, 8192);
+        memset(port->ctba[i], 0, AHCI_CMD_TABLE_SIZE);
         
         // Setup command header
         port->clb[i].prdtl = 8;  // 8 PRD entries
@@ -113,50 +116,65 @@ static int ahci_port_rebase(ahci_port_t* port, uint32_t port_num) {
 // AHCI Command Execution
 // =============================================================================
 
-static int ahci_find_cmdslot(ahci_port_t* port) {
-    uint32_t slots = port->regs->sact | port->regs->ci;
-    for (int i = 0; i < 32; i++) {
-        if ((slots & (1 << i)) == 0) {
+// Caller holds port->lock. Queued commands use tags below the device's
+// NCQ depth and can't be mixed with non-queued ones on the port.
+static int ahci_find_cmdslot(ahci_port_t* port, bool queued) {
+    if (queued ? (port->issued & ~port->queued) != 0 : port->queued != 0) {
+        return -1;
+    }
+    
+    uint32_t limit = queued ? port->ncq_depth : port->controller->num_cmd_slots;
+    uint32_t slots = port->issued | port->regs->sact | port->regs->ci;
+    for (uint32_t i = 0; i < limit; i++) {
+        if ((slots & (1U << i)) == 0) {
             return i;
         }
     }
     return -1;
 }
 
-static int ahci_send_command(ahci_port_t* port, ahci_command_t* cmd) {
+// Build cmd in a free slot and issue it. track says how completion is
+// reported. Returns the slot, or -1 when none is free right now.
+static int ahci_issue_command(ahci_port_t* port, ahci_command_t* cmd,
+                              const ahci_slot_t* track) {
+    uint64_t flags = cpu_irq_save();
     spinlock_acquire(&port->lock);
     
     // Find free command slot
-    int slot = ahci_find_cmdslot(port);
+    int slot = ahci_find_cmdslot(port, cmd->queued);
     if (slot == -1) {
         spinlock_release(&port->lock);
+        cpu_irq_restore(flags);
         return -1;
     }
     
     ahci_hba_cmd_header_t* cmdheader = &port->clb[slot];
     cmdheader->cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);  // Command FIS size
     cmdheader->w = cmd->write ? 1 : 0;  // Read/Write
-    cmdheader->prdtl = (uint16_t)((cmd->count - 1) >> 4) + 1;  // PRDT entries
+    cmdheader->prdtl = cmd->buf_phys ? (uint16_t)((cmd->count - 1) >> 4) + 1 : 0;  // PRDT entries
+    cmdheader->prdbc = 0;
     
     ahci_hba_cmd_tbl_t* cmdtbl = port->ctba[slot];
     memset(cmdtbl, 0, sizeof(ahci_hba_cmd_tbl_t) + 
-           (cmdheader->prdtl - 1) * sizeof(ahci_hba_prdt_entry_t));
+           cmdheader->prdtl * sizeof(ahci_hba_prdt_entry_t));
     
     // Setup PRDT entries
-    int i;
-    for (i = 0; i < cmdheader->prdtl - 1; i++) {
-        cmdtbl->prdt_entry[i].dba = cmd->buf_phys + (i * 8192);
-        cmdtbl->prdt_entry[i].dbau = 0;
-        cmdtbl->prdt_entry[i].dbc = 8191;  // 8KB - 1
+    if (cmdheader->prdtl) {
+        int i;
+        for (i = 0; i < cmdheader->prdtl - 1; i++) {
+            cmdtbl->prdt_entry[i].dba = (cmd->buf_phys + (i * 8192)) & 0xFFFFFFFF;
+            cmdtbl->prdt_entry[i].dbau = (cmd->buf_phys + (i * 8192)) >> 32;
+            cmdtbl->prdt_entry[i].dbc = 8191;  // 8KB - 1
+            cmdtbl->prdt_entry[i].i = 0;
+        }
+        
+        // Last entry
+        cmdtbl->prdt_entry[i].dba = (cmd->buf_phys + (i * 8192)) & 0xFFFFFFFF;
+        cmdtbl->prdt_entry[i].dbau = (cmd->buf_phys + (i * 8192)) >> 32;
+        cmdtbl->prdt_entry[i].dbc = ((cmd->count << 9) - 1) % 8192;  // Remaining bytes
         cmdtbl->prdt_entry[i].i = 0;
     }
     
-    // Last entry
-    cmdtbl->prdt_entry[i].dba = cmd->buf_phys + (i * 8192);
-    cmdtbl->prdt_entry[i].dbau = 0;
-    cmdtbl->prdt_entry[i].dbc = ((cmd->count << 9) - 1) % 8192;  // Remaining bytes
-    cmdtbl->prdt_entry[i].i = 0;
-    
     // Setup command FIS
     fis_reg_h2d_t* cmdfis = (fis_reg_h2d_t*)&cmdtbl->cfis;
     memset(cmdfis, 0, sizeof(fis_reg_h2d_t));
@@ -174,98 +192,300 @@ static int ahci_send_command(ahci_port_t* port, ahci_command_t* cmd) {
     cmdfis->lba4 = (uint8_t)(cmd->lba >> 32);
     cmdfis->lba5 = (uint8_t)(cmd->lba >> 40);
     
-    cmdfis->countl = cmd->count & 0xFF;
-    cmdfis->counth = (cmd->count >> 8) & 0xFF;
+    if (cmd->queued) {
+        // FPDMA QUEUED: sector count moves to the features field and the
+        // count field carries the tag
+        cmdfis->featurel = cmd->count & 0xFF;
+        cmdfis->featureh = (cmd->count >> 8) & 0xFF;
+        cmdfis->countl = (uint8_t)(slot << 3);
+    } else {
+        cmdfis->countl = cmd->count & 0xFF;
+        cmdfis->counth = (cmd->count >> 8) & 0xFF;
+    }
+    
+    port->slots[slot] = *track;
+    port->slots[slot].submit_time = continuum_get_time();
+    port->issued |= 1U << slot;
+    port->commands_issued++;
     
-    // Issue command
-    port->regs->ci = 1 << slot;
+    // Issue command; a queued one is marked active first
+    if (cmd->queued) {
+        port->queued |= 1U << slot;
+        port->regs->sact = 1U << slot;
+    }
+    port->regs->ci = 1U << slot;
     
-    // Wait for completion
-    uint64_t timeout = continuum_get_time() + 5000000;  // 5 seconds
-    while ((port->regs->ci & (1 << slot)) && continuum_get_time() < timeout) {
-        if (port->regs->is & AHCI_PORT_IS_TFES) {
-            // Task file error
-            spinlock_release(&port->lock);
-            return -1;
+    spinlock_release(&port->lock);
+    cpu_irq_restore(flags);
+    return slot;
+}
+
+// Stop and restart the command engine after an error or a stuck command.
+// The HBA drops every issued command, so the caller fails them all.
+// Caller holds port->lock.
+static void ahci_port_recover(ahci_port_t* port) {
+    ahci_stop_port(port);
+    port->regs->serr = 0xFFFFFFFF;
+    port->regs->is = 0xFFFFFFFF;
+    ahci_start_port(port);
+    port->abort = false;
+    port->controller->total_errors++;
+}
+
+// Copy a read out of its bounce buffer and hand the result to the
+// submitter. Runs without the port lock so the callback can resubmit.
+static void ahci_finish_io(ahci_slot_t* slot, int status) {
+    if (slot->dma) {
+        if (status == 0 && slot->buffer) {
+            memcpy(slot->buffer, slot->dma->virtual_addr, slot->length);
         }
+        resonance_free_dma(slot->dma);
     }
     
-    if (port->regs->ci & (1 << slot)) {
-        // Timeout
-        spinlock_release(&port->lock);
-        return -1;
+    slot->callback(slot->callback_context, status);
+}
+
+// Reap finished commands. A slot is done once the HBA has cleared it from
+// both CI and SActive (the device's Set Device Bits FIS clears SActive for
+// NCQ). Called from the controller interrupt and from waiters, so the lock
+// is taken with interrupts masked.
+static bool ahci_port_process(ahci_port_t* port) {
+    ahci_slot_t done[32];
+    int done_status[32];
+    uint32_t count = 0;
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&port->lock);
+    
+    uint32_t is = port->regs->is;
+    port->regs->is = is;
+    
+    uint32_t failed = 0;
+    if ((is & AHCI_PORT_IS_ERRORS) || port->abort) {
+        failed = port->issued;
+        ahci_port_recover(port);
     }
     
-    // Check for errors
-    if (port->regs->is & AHCI_PORT_IS_TFES) {
-        spinlock_release(&port->lock);
-        return -1;
+    uint32_t finished = (port->issued & ~(port->regs->sact | port->regs->ci)) | failed;
+    for (uint32_t i = 0; i < 32; i++) {
+        uint32_t bit = 1U << i;
+        if (!(finished & bit)) {
+            continue;
+        }
+        
+        ahci_slot_t* slot = &port->slots[i];
+        int status = (failed & bit) ? -1 : 0;
+        if (slot->wait) {
+            slot->wait->status = status;
+            __atomic_store_n(&slot->wait->done, true, __ATOMIC_RELEASE);
+        }
+        if (slot->callback) {
+            done[count] = *slot;
+            done_status[count] = status;
+            count++;
+        }
+        
+        *slot = (ahci_slot_t){0};
+        port->issued &= ~bit;
+        port->queued &= ~bit;
     }
     
     spinlock_release(&port->lock);
-    return 0;
+    cpu_irq_restore(flags);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        ahci_finish_io(&done[i], done_status[i]);
+    }
+    
+    return finished != 0;
+}
+
+static void ahci_interrupt(void* context) {
+    ahci_controller_t* ctrl = (ahci_controller_t*)context;
+    
+    uint32_t is = ctrl->abar->is;
+    for (int i = 0; i < 32; i++) {
+        if ((is & (1U << i)) && ctrl->ports[i]) {
+            ahci_port_process(ctrl->ports[i]);
+        }
+    }
+    ctrl->abar->is = is;
+}
+
+// Issue cmd and wait for it. The waiter polls for AHCI_POLL_SPIN
+// microseconds; after that, with the controller interrupt wired, the CPU
+// is yielded between checks. A command that times out is aborted along
+// with everything else outstanding on the port.
+static int ahci_send_command(ahci_port_t* port, ahci_command_t* cmd) {
+    ahci_wait_t wait = { .done = false, .status = 0 };
+    ahci_slot_t track = { .wait = &wait };
+    
+    uint64_t start = continuum_get_time();
+    uint64_t spin_until = start + continuum_usec_to_tsc(AHCI_POLL_SPIN);
+    uint64_t timeout = start + continuum_usec_to_tsc(AHCI_IO_TIMEOUT);
+    
+    // Wait for a slot (queued and non-queued commands don't mix)
+    while (ahci_issue_command(port, cmd, &track) < 0) {
+        if (!ahci_port_process(port) && continuum_get_time() >= timeout) {
+            return -1;
+        }
+    }
+    
+    while (!__atomic_load_n(&wait.done, __ATOMIC_ACQUIRE)) {
+        if (ahci_port_process(port)) {
+            continue;
+        }
+        
+        uint64_t now = continuum_get_time();
+        if (now >= timeout) {
+            uint64_t flags = cpu_irq_save();
+            spinlock_acquire(&port->lock);
+            port->abort = true;
+            spinlock_release(&port->lock);
+            cpu_irq_restore(flags);
+        } else if (port->controller->irq_enabled && now >= spin_until) {
+            quantum_context_t* current = temporal_get_current();
+            if (current) {
+                temporal_yield(current);
+            }
+        }
+    }
+    
+    return wait.status;
 }
 
 // =============================================================================
 // AHCI Read/Write Operations
 // =============================================================================
 
-int ahci_read(ahci_port_t* port, uint64_t lba, uint32_t count, void* buffer) {
-    if (!port || !buffer || count == 0) {
-        return -1;
+static void ahci_build_rw(ahci_port_t* port, ahci_command_t* cmd, uint64_t lba,
+                          uint32_t count, uint64_t buf_phys, bool is_write) {
+    cmd->queued = port->ncq_depth > 0;
+    if (cmd->queued) {
+        cmd->ata_cmd = is_write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+    } else {
+        cmd->ata_cmd = is_write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX;
     }
-    
-    // Allocate DMA buffer
-    size_t size = count * 512;  // Assuming 512 byte sectors
-    dma_region_t* dma = resonance_alloc_dma(size, DMA_FLAG_COHERENT);
-    if (!dma) {
+    cmd->lba = lba;
+    cmd->count = count;
+    cmd->buf_phys = buf_phys;
+    cmd->write = is_write;
+}
+
+static int ahci_read_write(ahci_port_t* port, uint64_t lba, uint32_t count,
+                           void* buffer, bool is_write) {
+    if (!port || !buffer || count == 0) {
         return -1;
     }
     
-    ahci_command_t cmd = {
-        .ata_cmd = ATA_CMD_READ_DMA_EX,
-        .lba = lba,
-        .count = count,
-        .buf_phys = dma->physical_addr,
-        .write = false
-    };
-    
-    int result = ahci_send_command(port, &cmd);
-    
-    if (result == 0) {
-        memcpy(buffer, dma->virtual_addr, size);
+    // Split at what one command table can describe
+    while (count > 0) {
+        uint32_t sectors = count < AHCI_MAX_SECTORS ? count : AHCI_MAX_SECTORS;
+        size_t size = (size_t)sectors * AHCI_SECTOR_SIZE;
+        
+        // Allocate DMA buffer
+        dma_region_t* dma = resonance_alloc_dma(size, DMA_FLAG_COHERENT);
+        if (!dma) {
+            return -1;
+        }
+        
+        if (is_write) {
+            memcpy(dma->virtual_addr, buffer, size);
+        }
+        
+        ahci_command_t cmd;
+        ahci_build_rw(port, &cmd, lba, sectors, dma->physical_addr, is_write);
+        
+        int result = ahci_send_command(port, &cmd);
+        
+        if (result == 0 && !is_write) {
+            memcpy(buffer, dma->virtual_addr, size);
+        }
+        
+        resonance_free_dma(dma);
+        if (result != 0) {
+            return result;
+        }
+        
+        lba += sectors;
+        count -= sectors;
+        buffer = (uint8_t*)buffer + size;
     }
     
-    resonance_free_dma(dma);
-    return result;
+    return 0;
+}
+
+int ahci_read(ahci_port_t* port, uint64_t lba, uint32_t count, void* buffer) {
+    return ahci_read_write(port, lba, count, buffer, false);
 }
 
 int ahci_write(ahci_port_t* port, uint64_t lba, uint32_t count, void* buffer) {
-    if (!port || !buffer || count == 0) {
-        return -1;
+    return ahci_read_write(port, lba, count, buffer, true);
+}
+
+// Issue a transfer and return without waiting. With NCQ up to ncq_depth
+// of these are outstanding and the drive orders them; callback runs from
+// the completion path, usually the controller interrupt. IO_BUSY means
+// every tag is in use right now.
+static io_result_t ahci_submit_io(ahci_port_t* port, uint64_t lba, uint32_t count,
+                                  void* buffer, bool is_write,
+                                  ahci_io_callback_t callback, void* context) {
+    if (!port || !buffer || !callback || count == 0 || count > AHCI_MAX_SECTORS) {
+        return IO_ERROR;
     }
     
-    // Allocate DMA buffer
-    size_t size = count * 512;
+    size_t size = (size_t)count * AHCI_SECTOR_SIZE;
     dma_region_t* dma = resonance_alloc_dma(size, DMA_FLAG_COHERENT);
     if (!dma) {
-        return -1;
+        return IO_ERROR;
     }
     
-    memcpy(dma->virtual_addr, buffer, size);
+    if (is_write) {
+        memcpy(dma->virtual_addr, buffer, size);
+    }
     
-    ahci_command_t cmd = {
-        .ata_cmd = ATA_CMD_WRITE_DMA_EX,
-        .lba = lba,
-        .count = count,
-        .buf_phys = dma->physical_addr,
-        .write = true
+    ahci_command_t cmd;
+    ahci_build_rw(port, &cmd, lba, count, dma->physical_addr, is_write);
+    
+    ahci_slot_t track = {
+        .callback = callback,
+        .callback_context = context,
+        .dma = dma,
+        .buffer = is_write ? NULL : buffer,
+        .length = size
     };
+    if (ahci_issue_command(port, &cmd, &track) < 0) {
+        resonance_free_dma(dma);
+        return IO_BUSY;
+    }
     
-    int result = ahci_send_command(port, &cmd);
+    return IO_PENDING;
+}
+
+io_result_t ahci_read_async(ahci_port_t* port, uint64_t lba, uint32_t count, void* buffer,
+                            ahci_io_callback_t callback, void* context) {
+    return ahci_submit_io(port, lba, count, buffer, false, callback, context);
+}
+
+io_result_t ahci_write_async(ahci_port_t* port, uint64_t lba, uint32_t count, void* buffer,
+                             ahci_io_callback_t callback, void* context) {
+    return ahci_submit_io(port, lba, count, buffer, true, callback, context);
+}
+
+int ahci_flush(ahci_port_t* port) {
+    if (!port) {
+        return -1;
+    }
     
-    resonance_free_dma(dma);
-    return result;
+    ahci_command_t cmd = {
+        .ata_cmd = ATA_CMD_FLUSH_EX,
+        .lba = 0,
+        .count = 0,
+        .buf_phys = 0,  // No data phase
+        .write = false,
+        .queued = false
+    };
+    return ahci_send_command(port, &cmd);
 }
 
 // =============================================================================
@@ -316,6 +536,16 @@ static int ahci_identify_device(ahci_port_t* port) {
         port->sectors = ((uint32_t)identify[61] << 16) | identify[60];
     }
     
+    // NCQ needs both the HBA and the drive; tags are then command slots
+    port->ncq_depth = 0;
+    if (port->controller->supports_ncq &&
+        (identify[ATA_ID_SATA_CAP] & ATA_ID_SATA_CAP_NCQ)) {
+        port->ncq_depth = (identify[ATA_ID_QUEUE_DEPTH] & 0x1F) + 1;
+        if (port->ncq_depth > port->controller->num_cmd_slots) {
+            port->ncq_depth = port->controller->num_cmd_slots;
+        }
+    }
+    
     resonance_free_dma(dma);
     return 0;
 }
@@ -342,6 +572,7 @@ static int ahci_init_controller(ahci_controller_t* ctrl) {
     ctrl->num_ports = ((ctrl->cap >> 0) & 0x1F) + 1;
     ctrl->num_cmd_slots = ((ctrl->cap >> 8) & 0x1F) + 1;
     ctrl->supports_64bit = (ctrl->cap >> 31) & 0x01;
+    ctrl->supports_ncq = (ctrl->cap & AHCI_CAP_SNCQ) != 0;
     
     // Enable interrupts
     ctrl->abar->ghc |= AHCI_GHC_IE;
@@ -446,7 +677,39 @@ static void* ahci_probe(device_node_t* node) {
 
 static int ahci_attach(device_handle_t* handle) {
     ahci_controller_t* ctrl = (ahci_controller_t*)handle->driver_data;
+    
+    // One interrupt covers every port; without one, waiters poll
+    ctrl->handle = handle;
+    ctrl->irq = RESONANCE_IRQ_QUEUE(0);
+    ctrl->irq_enabled = resonance_register_irq(handle, ctrl->irq, ahci_interrupt, ctrl) == 0;
+    if (!ctrl->irq_enabled) {
+        ctrl->irq = RESONANCE_IRQ_INTX;
+        ctrl->irq_enabled = resonance_register_irq(handle, ctrl->irq, ahci_interrupt, ctrl) == 0;
+    }
+    
     ctrl->state = AHCI_STATE_READY;
+    
+    // A block queue per disk, deadline-scheduled since seeks still cost
+    uint32_t unit = 0;
+    for (int i = 0; i < 32; i++) {
+        ahci_port_t* port = ctrl->ports[i];
+        if (!port || port->device_type != AHCI_DEV_SATA) {
+            continue;
+        }
+        
+        spinlock_acquire(&g_ahci_lock);
+        char name[BLOCK_NAME_LENGTH];
+        snprintf(name, sizeof(name), "sd%c", 'a' + (int)(g_ahci_disk_count++ % 26));
+        spinlock_release(&g_ahci_lock);
+        
+        block_limits_t limits = {
+            .logical_block = AHCI_SECTOR_SIZE,
+            .max_sectors = AHCI_MAX_SECTORS,
+            .depth = port->ncq_depth ? port->ncq_depth : 1,
+            .capacity = port->sectors
+        };
+        port->block = block_register(handle, unit++, name, BLOCK_SCHED_DEADLINE, &limits);
+    }
     return 0;
 }
 
@@ -457,15 +720,81 @@ static void ahci_detach(device_handle_t* handle) {
     for (int i = 0; i < 32; i++) {
         if (ctrl->ports[i]) {
             ahci_stop_port(ctrl->ports[i]);
+            if (ctrl->ports[i]->block) {
+                block_unregister(ctrl->ports[i]->block);
+                ctrl->ports[i]->block = NULL;
+            }
         }
     }
     
     // Disable interrupts
     ctrl->abar->ghc &= ~AHCI_GHC_IE;
+    if (ctrl->irq_enabled) {
+        resonance_unregister_irq(handle, ctrl->irq);
+        ctrl->irq_enabled = false;
+    }
     
     ctrl->state = AHCI_STATE_DISABLED;
 }
 
+static void ahci_packet_complete(void* context, int status) {
+    io_packet_t* packet = (io_packet_t*)context;
+    resonance_io_complete(packet, status == 0 ? IO_SUCCESS : IO_ERROR);
+}
+
+// packet->unit counts the controller's SATA disks in port order, 0 for
+// the first; offset and size are in bytes and must be whole sectors
+static io_result_t ahci_io_request(device_handle_t* handle, io_packet_t* packet) {
+    ahci_controller_t* ctrl = (ahci_controller_t*)handle->driver_data;
+    if (!ctrl || ctrl->state != AHCI_STATE_READY) {
+        return IO_NO_DEVICE;
+    }
+    
+    ahci_port_t* port = NULL;
+    uint32_t unit = packet->unit;
+    for (int i = 0; i < 32 && !port; i++) {
+        if (ctrl->ports[i] && ctrl->ports[i]->device_type == AHCI_DEV_SATA && unit-- == 0) {
+            port = ctrl->ports[i];
+        }
+    }
+    if (!port) {
+        return IO_NO_DEVICE;
+    }
+    
+    switch (packet->operation) {
+        case IO_OP_READ:
+        case IO_OP_WRITE: {
+            bool is_write = packet->operation == IO_OP_WRITE;
+            if (packet->size == 0 || packet->offset % AHCI_SECTOR_SIZE ||
+                packet->size % AHCI_SECTOR_SIZE) {
+                return IO_ERROR;
+            }
+            uint64_t lba = packet->offset / AHCI_SECTOR_SIZE;
+            uint32_t count = packet->size / AHCI_SECTOR_SIZE;
+            
+            if (!resonance_io_async(packet)) {
+                return ahci_read_write(port, lba, count, packet->buffer, is_write) == 0 ?
+                    IO_SUCCESS : IO_ERROR;
+            }
+            
+            packet->status = IO_PENDING;
+            return ahci_submit_io(port, lba, count, packet->buffer, is_write,
+                                  ahci_packet_complete, packet);
+        }
+        
+        case IO_OP_FLUSH:
+            packet->status = ahci_flush(port) == 0 ? IO_SUCCESS : IO_ERROR;
+            if (resonance_io_async(packet)) {
+                resonance_io_complete(packet, packet->status);
+                return IO_PENDING;
+            }
+            return packet->status;
+        
+        default:
+            return IO_ERROR;
+    }
+}
+
 // Driver registration
 static resonance_driver_t ahci_driver = {
     .name = "ahci",
@@ -475,7 +804,8 @@ static resonance_driver_t ahci_driver = {
     .subclass_code = 0x06,  // AHCI
     .probe = ahci_probe,
     .attach = ahci_attach,
-    .detach = ahci_detach
+    .detach = ahci_detach,
+    .io_request = ahci_io_request
 };
 
 void ahci_init(void) {
@@ -37,6 +37,16 @@
 #define ATA_CMD_PACKET         0xA0
 #define ATA_CMD_FLUSH          0xE7
 #define ATA_CMD_FLUSH_EX       0xEA
+#define ATA_CMD_READ_FPDMA     0x60   // READ FPDMA QUEUED (NCQ)
+#define ATA_CMD_WRITE_FPDMA    0x61   // WRITE FPDMA QUEUED (NCQ)
+
+// IDENTIFY DEVICE words
+#define ATA_ID_QUEUE_DEPTH     75     // Bits 4:0, depth - 1
+#define ATA_ID_SATA_CAP        76
+#define ATA_ID_SATA_CAP_NCQ    (1 << 8)
+
+// AHCI CAP bits
+#define AHCI_CAP_SNCQ          (1 << 30)  // Native Command Queuing
 
 // AHCI GHC bits
 #define AHCI_GHC_HR            (1 << 0)   // HBA Reset
@@ -50,14 +60,29 @@
 #define AHCI_PORT_CMD_CR       (1 << 15)  // Command List Running
 
 // Port Interrupt bits
+#define AHCI_PORT_IS_DHRS      (1 << 0)   // Device to Host Register FIS
+#define AHCI_PORT_IS_SDBS      (1 << 3)   // Set Device Bits (NCQ completion)
 #define AHCI_PORT_IS_TFES      (1 << 30)  // Task File Error Status
 #define AHCI_PORT_IS_HBFS      (1 << 29)  // Host Bus Fatal Error
 #define AHCI_PORT_IS_HBDS      (1 << 28)  // Host Bus Data Error
 #define AHCI_PORT_IS_IFS       (1 << 27)  // Interface Fatal Error
+#define AHCI_PORT_IS_ERRORS    (AHCI_PORT_IS_TFES | AHCI_PORT_IS_HBFS | \
+                                AHCI_PORT_IS_HBDS | AHCI_PORT_IS_IFS)
 
 // Default port interrupts to enable
 #define AHCI_PORT_IE_DEFAULT   0x7DC0007F
 
+// Command tables are 8KB: 128 bytes of FIS, the rest PRD entries of up
+// to 8KB each
+#define AHCI_CMD_TABLE_SIZE    8192
+#define AHCI_PRDT_ENTRIES      ((AHCI_CMD_TABLE_SIZE - 128) / sizeof(ahci_hba_prdt_entry_t))
+#define AHCI_SECTOR_SIZE       512
+#define AHCI_MAX_SECTORS       (AHCI_PRDT_ENTRIES * 16)
+
+// Timeouts (microseconds)
+#define AHCI_IO_TIMEOUT        5000000
+#define AHCI_POLL_SPIN         20     // Waiters poll this long before yielding to the IRQ
+
 // Port detection
 #define HBA_PORT_DET_PRESENT   3
 #define HBA_PORT_IPM_ACTIVE    1
@@ -233,6 +258,26 @@ typedef enum {
     AHCI_DEV_PM
 } ahci_device_type_t;
 
+// Asynchronous I/O completion; status is 0, or -1 on a device error
+typedef void (*ahci_io_callback_t)(void* context, int status);
+
+// Synchronous submitter's view of one command, filled in on completion
+typedef struct {
+    bool done;
+    int status;
+} ahci_wait_t;
+
+// Command slot tracking (indexed by slot, which is also the NCQ tag)
+typedef struct {
+    ahci_wait_t* wait;
+    ahci_io_callback_t callback;
+    void* callback_context;
+    dma_region_t* dma;      // Bounce buffer, released on completion
+    void* buffer;           // Where a read is copied out to
+    size_t length;
+    uint64_t submit_time;
+} ahci_slot_t;
+
 // Port structure
 typedef struct {
     struct ahci_controller* controller;
@@ -250,10 +295,19 @@ typedef struct {
     dma_region_t* fb_dma;
     dma_region_t* ctba_dma[32];
     
+    // Outstanding commands. Queued (NCQ) and non-queued commands can't
+    // share the port, so each kind waits for the other to drain.
+    ahci_slot_t slots[32];
+    uint32_t issued;        // Slots with a command in flight
+    uint32_t queued;        // Subset of issued that are NCQ
+    bool abort;             // Fail everything outstanding and restart the port
+    
     // Device info
     char serial[21];
     char model[41];
     uint64_t sectors;
+    uint32_t ncq_depth;     // Tags in use for NCQ, 0 without NCQ
+    struct block_queue* block;  // SATA disks, once attached
     
     // Statistics
     uint64_t commands_issued;
@@ -281,6 +335,12 @@ typedef struct ahci_controller {
     uint32_t num_ports;
     uint32_t num_cmd_slots;
     bool supports_64bit;
+    bool supports_ncq;
+    
+    // Interrupt: MSI when the HBA has it, else its INTx line, else polled
+    device_handle_t* handle;
+    uint32_t irq;
+    bool irq_enabled;
     
     // Ports
     ahci_port_t* ports[32];
@@ -298,6 +358,7 @@ typedef struct {
     uint16_t count;
     uint64_t buf_phys;
     bool write;
+    bool queued;            // Issue as FPDMA QUEUED with the slot as tag
 } ahci_command_t;
 
 // =============================================================================
@@ -311,6 +372,10 @@ void ahci_init(void);
 int ahci_read(ahci_port_t* port, uint64_t lba, uint32_t count, void* buffer);
 int ahci_write(ahci_port_t* port, uint64_t lba, uint32_t count, void* buffer);
 int ahci_flush(ahci_port_t* port);
+io_result_t ahci_read_async(ahci_port_t* port, uint64_t lba, uint32_t count, void* buffer,
+                            ahci_io_callback_t callback, void* context);
+io_result_t ahci_write_async(ahci_port_t* port, uint64_t lba, uint32_t count, void* buffer,
+                             ahci_io_callback_t callback, void* context);
 
 // Controller management
 ahci_controller_t* ahci_get_controller(uint32_t index);
@@ -0,0 +1,962 @@
+/*
+ * Block Layer for Continuum Kernel
+ * Per-CPU software queues, plugging with adjacent-request merging, and
+ * pluggable schedulers in front of the storage drivers
+ */
+
+#include "block.h"
+#include "page_cache.h"
+#include "../resonance.h"
+#include "../../flux_memory.h"
+#include "../../temporal_scheduler.h"
+
+// =============================================================================
+// Global Block Layer State
+// =============================================================================
+
+static block_queue_t* g_block_queues[MAX_BLOCK_QUEUES];
+static uint32_t g_block_count = 0;
+static spinlock_t g_block_lock = SPINLOCK_INIT;
+
+// Bios per round of a synchronous transfer
+#define BLOCK_SYNC_BIOS         16
+
+#define block_stat(queue, field, n) \
+    __atomic_fetch_add(&(queue)->stats.field, (n), __ATOMIC_RELAXED)
+
+static uint64_t block_current_owner(void) {
+    quantum_context_t* current = temporal_get_current();
+    return current ? current->qid : 0;
+}
+
+// =============================================================================
+// Request Pool
+// =============================================================================
+
+// Requests are returned from completions, so the pool lock masks interrupts
+static block_request_t* block_alloc_request(block_queue_t* queue) {
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&queue->pool_lock);
+    block_request_t* req = queue->free_requests;
+    if (req) {
+        queue->free_requests = req->next;
+    }
+    spinlock_release(&queue->pool_lock);
+    cpu_irq_restore(flags);
+    return req;
+}
+
+static void block_free_request(block_queue_t* queue, block_request_t* req) {
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&queue->pool_lock);
+    req->next = queue->free_requests;
+    queue->free_requests = req;
+    spinlock_release(&queue->pool_lock);
+    cpu_irq_restore(flags);
+}
+
+static void block_init_request(block_request_t* req, block_queue_t* queue, block_bio_t* bio) {
+    req->queue = queue;
+    req->sector = bio->sector;
+    req->count = bio->count;
+    req->write = bio->write;
+    req->buffer = bio->buffer;
+    req->domain = bio->domain;
+    req->staging = NULL;
+    req->owner = block_current_owner();
+    req->deadline = continuum_get_time() +
+        continuum_usec_to_tsc(bio->write ? BLOCK_WRITE_EXPIRE : BLOCK_READ_EXPIRE);
+    req->bios = bio;
+    req->bios_tail = bio;
+    req->next = NULL;
+    req->sort_next = NULL;
+    bio->next = NULL;
+}
+
+// =============================================================================
+// Merging
+// =============================================================================
+
+// Fold src into req when their sectors are adjacent. If their buffers are
+// adjacent too the request just grows; otherwise, for kernel buffers on a
+// scheduled queue, req is assembled in a staging buffer (copied in at
+// dispatch for writes, scattered back at completion for reads). src is left
+// for the caller to release.
+static bool block_merge(block_queue_t* queue, block_request_t* req, block_request_t* src) {
+    if (req->write != src->write || req->domain != src->domain || req->owner != src->owner ||
+        req->count + src->count > queue->limits.max_sectors) {
+        return false;
+    }
+    
+    bool back = req->sector + req->count == src->sector;
+    if (!back && src->sector + src->count != req->sector) {
+        return false;
+    }
+    
+    block_request_t* first = back ? req : src;
+    block_request_t* second = back ? src : req;
+    bool contiguous = !req->staging && !src->staging &&
+        (uint8_t*)first->buffer + (size_t)first->count * BLOCK_SECTOR_SIZE == second->buffer;
+    
+    if (!contiguous) {
+        size_t bytes = (size_t)(req->count + src->count) * BLOCK_SECTOR_SIZE;
+        if (queue->sched == BLOCK_SCHED_NONE || req->domain || bytes > BLOCK_MERGE_COPY_MAX) {
+            return false;
+        }
+        if (!req->staging) {
+            req->staging = src->staging ? src->staging :
+                flux_allocate(NULL, BLOCK_MERGE_COPY_MAX, FLUX_ALLOC_KERNEL);
+            if (!req->staging) {
+                return false;
+            }
+        } else if (src->staging) {
+            flux_free(src->staging);
+        }
+        src->staging = NULL;
+        block_stat(queue, copy_merges, 1);
+    }
+    
+    // Keep the bios in sector order
+    if (back) {
+        req->bios_tail->next = src->bios;
+        req->bios_tail = src->bios_tail;
+    } else {
+        src->bios_tail->next = req->bios;
+        req->bios = src->bios;
+        req->sector = src->sector;
+        req->buffer = src->buffer;
+    }
+    req->count += src->count;
+    if (req->staging) {
+        req->buffer = req->staging;
+    }
+    if (src->deadline < req->deadline) {
+        req->deadline = src->deadline;
+    }
+    
+    block_stat(queue, merges, 1);
+    return true;
+}
+
+// =============================================================================
+// Schedulers
+// =============================================================================
+
+// All scheduler state is under queue->lock
+
+static void block_fifo_remove(block_queue_t* queue, uint32_t dir, block_request_t* req) {
+    block_request_t** link = &queue->fifo_head[dir];
+    block_request_t* prev = NULL;
+    while (*link && *link != req) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = req->next;
+        if (queue->fifo_tail[dir] == req) {
+            queue->fifo_tail[dir] = prev;
+        }
+    }
+    req->next = NULL;
+}
+
+static void block_sorted_remove(block_queue_t* queue, uint32_t dir, block_request_t* req) {
+    block_request_t** link = &queue->sorted[dir];
+    while (*link && *link != req) {
+        link = &(*link)->sort_next;
+    }
+    if (*link) {
+        *link = req->sort_next;
+    }
+    req->sort_next = NULL;
+}
+
+static void block_deadline_insert(block_queue_t* queue, block_request_t* req, bool front) {
+    uint32_t dir = req->write;
+    
+    block_request_t** link = &queue->sorted[dir];
+    while (*link && (*link)->sector < req->sector) {
+        link = &(*link)->sort_next;
+    }
+    req->sort_next = *link;
+    *link = req;
+    
+    if (front) {
+        req->next = queue->fifo_head[dir];
+        queue->fifo_head[dir] = req;
+        if (!queue->fifo_tail[dir]) {
+            queue->fifo_tail[dir] = req;
+        }
+    } else {
+        req->next = NULL;
+        if (queue->fifo_tail[dir]) {
+            queue->fifo_tail[dir]->next = req;
+        } else {
+            queue->fifo_head[dir] = req;
+        }
+        queue->fifo_tail[dir] = req;
+    }
+}
+
+// The first request at or after sector in dir's sorted list
+static block_request_t* block_sorted_from(block_queue_t* queue, uint32_t dir, uint64_t sector) {
+    block_request_t* req = queue->sorted[dir];
+    while (req && req->sector < sector) {
+        req = req->sort_next;
+    }
+    return req;
+}
+
+// mq-deadline: sweep upward in sector order in batches, prefer reads, but
+// never let writes sit through more than BLOCK_WRITES_STARVED read batches,
+// and jump to the oldest request of a direction once it has expired
+static block_request_t* block_deadline_next(block_queue_t* queue) {
+    block_request_t* req = NULL;
+    uint32_t dir = queue->batch_dir;
+    
+    if (queue->batching < BLOCK_FIFO_BATCH) {
+        req = block_sorted_from(queue, dir, queue->next_sector[dir]);
+    }
+    
+    if (!req) {
+        bool reads = queue->sorted[0] != NULL;
+        bool writes = queue->sorted[1] != NULL;
+        if (reads && (!writes || queue->starved < BLOCK_WRITES_STARVED)) {
+            dir = 0;
+            if (writes) {
+                queue->starved++;
+            }
+        } else if (writes) {
+            dir = 1;
+            queue->starved = 0;
+        } else {
+            return NULL;
+        }
+        
+        req = queue->fifo_head[dir];
+        if (req->deadline > continuum_get_time()) {
+            req = block_sorted_from(queue, dir, queue->next_sector[dir]);
+            if (!req) {
+                req = queue->sorted[dir];   // Wrap the elevator
+            }
+        }
+        queue->batch_dir = dir;
+        queue->batching = 0;
+    }
+    
+    block_sorted_remove(queue, dir, req);
+    block_fifo_remove(queue, dir, req);
+    queue->next_sector[dir] = req->sector + req->count;
+    queue->batching++;
+    return req;
+}
+
+static uint32_t block_budget_slot(uint64_t owner) {
+    return (uint32_t)((owner * 0x9E3779B97F4A7C15ULL) >> 60) % BLOCK_BUDGET_OWNERS;
+}
+
+// Budget-fair: each submitter (hashed) gets a FIFO and BLOCK_BUDGET_SECTORS
+// per turn, so one streaming reader can't starve everyone else
+static block_request_t* block_budget_next(block_queue_t* queue) {
+    for (uint32_t tries = 0; tries <= BLOCK_BUDGET_OWNERS; tries++) {
+        uint32_t slot = queue->active_owner;
+        block_request_t* req = queue->owners[slot].head;
+        if (req && queue->budget_left > 0) {
+            queue->owners[slot].head = req->next;
+            if (!req->next) {
+                queue->owners[slot].tail = NULL;
+            }
+            req->next = NULL;
+            queue->budget_left -= req->count < queue->budget_left ? req->count :
+                                                                    queue->budget_left;
+            return req;
+        }
+        
+        queue->active_owner = (slot + 1) % BLOCK_BUDGET_OWNERS;
+        queue->budget_left = BLOCK_BUDGET_SECTORS;
+    }
+    return NULL;
+}
+
+// Queue req for dispatch, merging it into a pending neighbour if it can.
+// Returns false when it was merged and should be released.
+static bool block_sched_insert(block_queue_t* queue, block_request_t* req) {
+    switch (queue->sched) {
+        case BLOCK_SCHED_DEADLINE:
+            for (block_request_t* r = queue->sorted[req->write]; r; r = r->sort_next) {
+                if (block_merge(queue, r, req)) {
+                    return false;
+                }
+            }
+            block_deadline_insert(queue, req, false);
+            return true;
+        
+        case BLOCK_SCHED_BUDGET: {
+            uint32_t slot = block_budget_slot(req->owner);
+            block_request_t* tail = queue->owners[slot].tail;
+            if (tail && block_merge(queue, tail, req)) {
+                return false;
+            }
+            req->next = NULL;
+            if (tail) {
+                tail->next = req;
+            } else {
+                queue->owners[slot].head = req;
+            }
+            queue->owners[slot].tail = req;
+            queue->owners[slot].owner = req->owner;
+            return true;
+        }
+        
+        default:
+            req->next = NULL;
+            if (queue->fifo_tail[0]) {
+                queue->fifo_tail[0]->next = req;
+            } else {
+                queue->fifo_head[0] = req;
+            }
+            queue->fifo_tail[0] = req;
+            return true;
+    }
+}
+
+// Put back a request the driver had no room for, first in line
+static void block_sched_requeue(block_queue_t* queue, block_request_t* req) {
+    switch (queue->sched) {
+        case BLOCK_SCHED_DEADLINE:
+            block_deadline_insert(queue, req, true);
+            break;
+        
+        case BLOCK_SCHED_BUDGET: {
+            uint32_t slot = block_budget_slot(req->owner);
+            req->next = queue->owners[slot].head;
+            queue->owners[slot].head = req;
+            if (!queue->owners[slot].tail) {
+                queue->owners[slot].tail = req;
+            }
+            if (slot == queue->active_owner) {
+                queue->budget_left += req->count;
+            }
+            break;
+        }
+        
+        default:
+            req->next = queue->fifo_head[0];
+            queue->fifo_head[0] = req;
+            if (!queue->fifo_tail[0]) {
+                queue->fifo_tail[0] = req;
+            }
+            break;
+    }
+}
+
+static block_request_t* block_sched_next(block_queue_t* queue) {
+    switch (queue->sched) {
+        case BLOCK_SCHED_DEADLINE:
+            return block_deadline_next(queue);
+        
+        case BLOCK_SCHED_BUDGET:
+            return block_budget_next(queue);
+        
+        default: {
+            block_request_t* req = queue->fifo_head[0];
+            if (req) {
+                queue->fifo_head[0] = req->next;
+                if (!req->next) {
+                    queue->fifo_tail[0] = NULL;
+                }
+                req->next = NULL;
+            }
+            return req;
+        }
+    }
+}
+
+// =============================================================================
+// Dispatch and Completion
+// =============================================================================
+
+static void block_complete(block_request_t* req, int status) {
+    block_queue_t* queue = req->queue;
+    
+    if (status == 0) {
+        block_stat(queue, sectors_read, req->write ? 0 : req->count);
+        block_stat(queue, sectors_written, req->write ? req->count : 0);
+    } else {
+        block_stat(queue, errors, 1);
+    }
+    
+    // Scatter a staged read back, then end each bio; end_io may free it
+    block_bio_t* bio = req->bios;
+    while (bio) {
+        block_bio_t* next = bio->next;
+        if (req->staging && !req->write && status == 0) {
+            memcpy(bio->buffer,
+                   (uint8_t*)req->staging + (bio->sector - req->sector) * BLOCK_SECTOR_SIZE,
+                   (size_t)bio->count * BLOCK_SECTOR_SIZE);
+        }
+        bio->end_io(bio, status);
+        bio = next;
+    }
+    
+    if (req->staging) {
+        flux_free(req->staging);
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&queue->lock);
+    queue->in_flight--;
+    if (queue->depth < queue->limits.depth && ++queue->regrow >= BLOCK_DEPTH_REGROW) {
+        queue->depth++;
+        queue->regrow = 0;
+    }
+    spinlock_release(&queue->lock);
+    cpu_irq_restore(flags);
+    
+    block_free_request(queue, req);
+    block_run_queue(queue);
+}
+
+static void block_packet_complete(io_packet_t* packet) {
+    block_request_t* req = (block_request_t*)packet->context;
+    block_complete(req, packet->status == IO_SUCCESS ? 0 : -1);
+}
+
+// Hand req to the driver. Anything but IO_PENDING or IO_BUSY means the
+// driver finished (or refused) it without running the completion.
+static io_result_t block_issue(block_queue_t* queue, block_request_t* req) {
+    if (req->staging && req->write) {
+        for (block_bio_t* bio = req->bios; bio; bio = bio->next) {
+            memcpy((uint8_t*)req->staging + (bio->sector - req->sector) * BLOCK_SECTOR_SIZE,
+                   bio->buffer, (size_t)bio->count * BLOCK_SECTOR_SIZE);
+        }
+    }
+    
+    req->packet = (io_packet_t){
+        .operation = req->write ? IO_OP_WRITE : IO_OP_READ,
+        .unit = queue->unit,
+        .offset = req->sector * BLOCK_SECTOR_SIZE,
+        .buffer = req->buffer,
+        .size = (size_t)req->count * BLOCK_SECTOR_SIZE,
+        .domain = req->domain,
+        .completion = queue->limits.sync_only ? NULL : block_packet_complete,
+        .context = req,
+        .status = IO_PENDING
+    };
+    
+    io_result_t result = resonance_io_request(queue->handle, &req->packet);
+    if (result != IO_PENDING && result != IO_BUSY) {
+        block_complete(req, result == IO_SUCCESS ? 0 : -1);
+    }
+    return result;
+}
+
+// Move every CPU's software queue into the scheduler; caller holds
+// queue->lock
+static void block_drain_software_queues(block_queue_t* queue) {
+    for (uint32_t i = 0; i < queue->sw_count; i++) {
+        block_sw_queue_t* sw = &queue->sw[i];
+        if (!__atomic_load_n(&sw->head, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        
+        spinlock_acquire(&sw->lock);
+        block_request_t* req = sw->head;
+        sw->head = NULL;
+        sw->tail = NULL;
+        spinlock_release(&sw->lock);
+        
+        while (req) {
+            block_request_t* next = req->next;
+            if (!block_sched_insert(queue, req)) {
+                block_free_request(queue, req);
+            }
+            req = next;
+        }
+    }
+}
+
+// Feed the driver up to the queue depth. One context dispatches at a time;
+// others (including completions from interrupt handlers) just flag more
+// work, which the dispatcher picks up before it stops. A driver that
+// pushes back shrinks the depth to what it took; completions regrow it.
+void block_run_queue(block_queue_t* queue) {
+    if (!queue) {
+        return;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&queue->lock);
+    if (queue->dispatching) {
+        queue->rerun = true;
+        spinlock_release(&queue->lock);
+        cpu_irq_restore(flags);
+        return;
+    }
+    queue->dispatching = true;
+    
+    do {
+        queue->rerun = false;
+        block_drain_software_queues(queue);
+        
+        while (queue->in_flight < queue->depth) {
+            block_request_t* req = block_sched_next(queue);
+            if (!req) {
+                break;
+            }
+            queue->in_flight++;
+            spinlock_release(&queue->lock);
+            cpu_irq_restore(flags);
+            
+            block_stat(queue, requests, 1);
+            io_result_t result = block_issue(queue, req);
+            
+            flags = cpu_irq_save();
+            spinlock_acquire(&queue->lock);
+            if (result == IO_BUSY) {
+                queue->in_flight--;
+                block_sched_requeue(queue, req);
+                queue->depth = queue->in_flight > 0 ? queue->in_flight : 1;
+                queue->regrow = 0;
+                block_stat(queue, busy, 1);
+                break;
+            }
+        }
+    } while (queue->rerun);
+    
+    queue->dispatching = false;
+    spinlock_release(&queue->lock);
+    cpu_irq_restore(flags);
+}
+
+// =============================================================================
+// Submission and Plugging
+// =============================================================================
+
+static void block_software_insert(block_queue_t* queue, block_request_t* head,
+                                  block_request_t* tail) {
+    uint32_t cpu = temporal_get_current_cpu();
+    block_sw_queue_t* sw = &queue->sw[cpu % queue->sw_count];
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&sw->lock);
+    if (sw->tail) {
+        sw->tail->next = head;
+    } else {
+        sw->head = head;
+    }
+    sw->tail = tail;
+    spinlock_release(&sw->lock);
+    cpu_irq_restore(flags);
+}
+
+static void block_flush_plug(block_plug_t* plug) {
+    if (plug->head) {
+        block_software_insert(plug->queue, plug->head, plug->tail);
+        plug->head = NULL;
+        plug->tail = NULL;
+        plug->count = 0;
+    }
+    block_run_queue(plug->queue);
+}
+
+void block_start_plug(block_plug_t* plug, block_queue_t* queue) {
+    plug->queue = queue;
+    plug->head = NULL;
+    plug->tail = NULL;
+    plug->count = 0;
+}
+
+void block_finish_plug(block_plug_t* plug) {
+    if (plug && plug->queue) {
+        block_flush_plug(plug);
+    }
+}
+
+// Polls for BLOCK_POLL_SPIN microseconds, then yields between checks
+static void block_backoff(uint64_t* spin_until) {
+    uint64_t now = continuum_get_time();
+    if (*spin_until == 0) {
+        *spin_until = now + continuum_usec_to_tsc(BLOCK_POLL_SPIN);
+    } else if (now >= *spin_until) {
+        quantum_context_t* current = temporal_get_current();
+        if (current) {
+            temporal_yield(current);
+        }
+    }
+}
+
+// Queue bio. With a plug it's held (and merged with what's already plugged)
+// until the plug fills or is finished; without one it's dispatched now.
+// A bio that can't be queued is ended with an error, so waiters always see
+// it finish. Not for interrupt context: it may wait for a free request.
+int block_submit(block_queue_t* queue, block_bio_t* bio, block_plug_t* plug) {
+    if (!queue || !bio || !bio->end_io) {
+        return -1;
+    }
+    
+    uint32_t block_sectors = queue->limits.logical_block / BLOCK_SECTOR_SIZE;
+    if (!bio->buffer || bio->count == 0 || bio->count > queue->limits.max_sectors ||
+        bio->sector % block_sectors || bio->count % block_sectors ||
+        bio->sector + bio->count > queue->limits.capacity || (plug && plug->queue != queue)) {
+        bio->end_io(bio, -1);
+        return -1;
+    }
+    block_stat(queue, bios, 1);
+    
+    block_request_t incoming;
+    block_init_request(&incoming, queue, bio);
+    if (plug) {
+        for (block_request_t* req = plug->head; req; req = req->next) {
+            if (block_merge(queue, req, &incoming)) {
+                return 0;
+            }
+        }
+    }
+    
+    block_request_t* req;
+    uint64_t spin_until = 0;
+    while (!(req = block_alloc_request(queue))) {
+        // Requests held in our own plug must not wait on themselves
+        if (plug && plug->head) {
+            block_flush_plug(plug);
+        } else {
+            block_run_queue(queue);
+        }
+        block_backoff(&spin_until);
+    }
+    *req = incoming;
+    
+    if (plug) {
+        if (plug->tail) {
+            plug->tail->next = req;
+        } else {
+            plug->head = req;
+        }
+        plug->tail = req;
+        if (++plug->count >= BLOCK_PLUG_MAX) {
+            block_flush_plug(plug);
+        }
+        return 0;
+    }
+    
+    block_software_insert(queue, req, req);
+    block_run_queue(queue);
+    return 0;
+}
+
+// =============================================================================
+// Waiting and Synchronous I/O
+// =============================================================================
+
+static void block_wait_end(block_bio_t* bio, int status) {
+    block_wait_t* wait = (block_wait_t*)bio->private_data;
+    if (status != 0) {
+        wait->status = status;
+    }
+    __atomic_fetch_sub(&wait->pending, 1, __ATOMIC_RELEASE);
+}
+
+void block_wait_init(block_wait_t* wait) {
+    wait->pending = 0;
+    wait->status = 0;
+}
+
+void block_wait_add(block_wait_t* wait, block_bio_t* bio) {
+    bio->end_io = block_wait_end;
+    bio->private_data = wait;
+    __atomic_fetch_add(&wait->pending, 1, __ATOMIC_RELAXED);
+}
+
+// Wait for every bio added to wait; a driver that pushed back gets the
+// queue rerun from here once the spin is over
+int block_wait(block_queue_t* queue, block_wait_t* wait) {
+    uint64_t spin_until = 0;
+    while (__atomic_load_n(&wait->pending, __ATOMIC_ACQUIRE) != 0) {
+        block_backoff(&spin_until);
+        if (continuum_get_time() >= spin_until) {
+            block_run_queue(queue);
+        }
+    }
+    return wait->status;
+}
+
+static int block_sync_io(block_queue_t* queue, uint64_t sector, uint32_t count,
+                         void* buffer, bool write) {
+    if (!queue || !buffer || count == 0) {
+        return -1;
+    }
+    
+    block_bio_t bios[BLOCK_SYNC_BIOS];
+    while (count > 0) {
+        block_wait_t wait;
+        block_plug_t plug;
+        block_wait_init(&wait);
+        block_start_plug(&plug, queue);
+        
+        for (uint32_t i = 0; i < BLOCK_SYNC_BIOS && count > 0; i++) {
+            uint32_t sectors = count < queue->limits.max_sectors ? count :
+                                                                   queue->limits.max_sectors;
+            bios[i] = (block_bio_t){
+                .sector = sector,
+                .count = sectors,
+                .write = write,
+                .buffer = buffer
+            };
+            block_wait_add(&wait, &bios[i]);
+            block_submit(queue, &bios[i], &plug);
+            
+            sector += sectors;
+            count -= sectors;
+            buffer = (uint8_t*)buffer + (size_t)sectors * BLOCK_SECTOR_SIZE;
+        }
+        
+        block_finish_plug(&plug);
+        if (block_wait(queue, &wait) != 0) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+int block_read(block_queue_t* queue, uint64_t sector, uint32_t count, void* buffer) {
+    return block_sync_io(queue, sector, count, buffer, false);
+}
+
+int block_write(block_queue_t* queue, uint64_t sector, uint32_t count, void* buffer) {
+    return block_sync_io(queue, sector, count, buffer, true);
+}
+
+// Flushes go straight to the driver; they cover writes that have completed
+int block_flush(block_queue_t* queue) {
+    if (!queue) {
+        return -1;
+    }
+    
+    io_packet_t packet = {
+        .operation = IO_OP_FLUSH,
+        .unit = queue->unit
+    };
+    return resonance_io_request(queue->handle, &packet) == IO_SUCCESS ? 0 : -1;
+}
+
+// =============================================================================
+// Filesystem Interface
+// =============================================================================
+
+static int block_device_read(void* device, uint64_t lba, uint32_t sectors, void* buffer) {
+    return block_read(((block_device_t*)device)->queue, lba, sectors, buffer);
+}
+
+static int block_device_write(void* device, uint64_t lba, uint32_t sectors, void* buffer) {
+    return block_write(((block_device_t*)device)->queue, lba, sectors, buffer);
+}
+
+block_device_t* block_get_device(block_queue_t* queue) {
+    return queue ? &queue->device : NULL;
+}
+
+// =============================================================================
+// Registration and Tuning
+// =============================================================================
+
+static void block_destroy_queue(block_queue_t* queue) {
+    if (queue->sw) {
+        flux_free(queue->sw);
+    }
+    if (queue->pool) {
+        flux_free(queue->pool);
+    }
+    flux_free(queue);
+}
+
+// Put a driver unit behind a request queue. unit is passed through in
+// every io_packet_t; limits describe what one request may carry.
+block_queue_t* block_register(device_handle_t* handle, uint32_t unit, const char* name,
+                              block_sched_t sched, const block_limits_t* limits) {
+    if (!handle || !name || !limits || limits->max_sectors == 0 || limits->depth == 0 ||
+        limits->logical_block % BLOCK_SECTOR_SIZE) {
+        return NULL;
+    }
+    
+    block_queue_t* queue = flux_allocate(NULL, sizeof(block_queue_t),
+                                         FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!queue) {
+        return NULL;
+    }
+    
+    queue->sw_count = continuum_get_cpu_count();
+    if (queue->sw_count == 0 || queue->sw_count > MAX_CPU_CORES) {
+        queue->sw_count = 1;
+    }
+    queue->sw = flux_allocate(NULL, queue->sw_count * sizeof(block_sw_queue_t),
+                              FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    queue->pool = flux_allocate(NULL, BLOCK_REQUEST_POOL * sizeof(block_request_t),
+                                FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!queue->sw || !queue->pool) {
+        block_destroy_queue(queue);
+        return NULL;
+    }
+    
+    strncpy(queue->name, name, BLOCK_NAME_LENGTH);
+    queue->handle = handle;
+    queue->unit = unit;
+    queue->sched = sched;
+    queue->limits = *limits;
+    if (queue->limits.logical_block == 0) {
+        queue->limits.logical_block = BLOCK_SECTOR_SIZE;
+    }
+    
+    // Requests stay whole logical blocks
+    uint32_t block_sectors = queue->limits.logical_block / BLOCK_SECTOR_SIZE;
+    queue->limits.max_sectors -= queue->limits.max_sectors % block_sectors;
+    if (queue->limits.max_sectors == 0) {
+        block_destroy_queue(queue);
+        return NULL;
+    }
+    queue->depth = queue->limits.depth;
+    queue->budget_left = BLOCK_BUDGET_SECTORS;
+    
+    spinlock_init(&queue->lock);
+    spinlock_init(&queue->pool_lock);
+    for (uint32_t i = 0; i < queue->sw_count; i++) {
+        spinlock_init(&queue->sw[i].lock);
+    }
+    for (int i = BLOCK_REQUEST_POOL - 1; i >= 0; i--) {
+        queue->pool[i].next = queue->free_requests;
+        queue->free_requests = &queue->pool[i];
+    }
+    
+    queue->device.read = block_device_read;
+    queue->device.write = block_device_write;
+    queue->device.device_data = queue;
+    queue->device.queue = queue;
+    
+    spinlock_acquire(&g_block_lock);
+    if (g_block_count >= MAX_BLOCK_QUEUES) {
+        spinlock_release(&g_block_lock);
+        block_destroy_queue(queue);
+        return NULL;
+    }
+    g_block_queues[g_block_count++] = queue;
+    spinlock_release(&g_block_lock);
+    
+    return queue;
+}
+
+// The driver has stopped issuing completions for this queue
+void block_unregister(block_queue_t* queue) {
+    if (!queue) {
+        return;
+    }
+    
+    spinlock_acquire(&g_block_lock);
+    for (uint32_t i = 0; i < g_block_count; i++) {
+        if (g_block_queues[i] == queue) {
+            g_block_queues[i] = g_block_queues[--g_block_count];
+            g_block_queues[g_block_count] = NULL;
+            break;
+        }
+    }
+    spinlock_release(&g_block_lock);
+    
+    // Cached blocks are written back while the driver is still there
+    page_cache_drop_owner(&queue->device);
+    block_destroy_queue(queue);
+}
+
+block_queue_t* block_get_queue(uint32_t index) {
+    spinlock_acquire(&g_block_lock);
+    block_queue_t* queue = index < g_block_count ? g_block_queues[index] : NULL;
+    spinlock_release(&g_block_lock);
+    return queue;
+}
+
+block_queue_t* block_find_queue(const char* name) {
+    block_queue_t* found = NULL;
+    
+    spinlock_acquire(&g_block_lock);
+    for (uint32_t i = 0; i < g_block_count && !found; i++) {
+        const char* a = g_block_queues[i]->name;
+        const char* b = name;
+        while (*a && *a == *b) {
+            a++;
+            b++;
+        }
+        if (*a == *b) {
+            found = g_block_queues[i];
+        }
+    }
+    spinlock_release(&g_block_lock);
+    return found;
+}
+
+uint32_t block_get_queue_count(void) {
+    return g_block_count;
+}
+
+// Pending requests move to the new scheduler in the order the old one
+// would have dispatched them
+int block_set_scheduler(block_queue_t* queue, block_sched_t sched) {
+    if (!queue || sched > BLOCK_SCHED_BUDGET) {
+        return -1;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&queue->lock);
+    
+    block_request_t* head = NULL;
+    block_request_t* tail = NULL;
+    block_request_t* req;
+    while ((req = block_sched_next(queue)) != NULL) {
+        if (tail) {
+            tail->next = req;
+        } else {
+            head = req;
+        }
+        tail = req;
+    }
+    
+    queue->sched = sched;
+    queue->batching = 0;
+    queue->starved = 0;
+    queue->next_sector[0] = 0;
+    queue->next_sector[1] = 0;
+    queue->budget_left = BLOCK_BUDGET_SECTORS;
+    
+    while (head) {
+        req = head;
+        head = req->next;
+        if (!block_sched_insert(queue, req)) {
+            block_free_request(queue, req);
+        }
+    }
+    
+    spinlock_release(&queue->lock);
+    cpu_irq_restore(flags);
+    return 0;
+}
+
+int block_set_depth(block_queue_t* queue, uint32_t depth) {
+    if (!queue || depth == 0) {
+        return -1;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&queue->lock);
+    queue->limits.depth = depth;
+    queue->depth = depth;
+    queue->regrow = 0;
+    spinlock_release(&queue->lock);
+    cpu_irq_restore(flags);
+    
+    block_run_queue(queue);
+    return 0;
+}
+
+void block_get_stats(block_queue_t* queue, block_stats_t* stats) {
+    if (queue && stats) {
+        *stats = queue->stats;
+    }
+}
@@ -0,0 +1,221 @@
+/*
+ * Block Layer for Continuum Kernel
+ * Request queues, merging and I/O scheduling between filesystems and
+ * storage drivers
+ */
+
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../resonance.h"
+
+// =============================================================================
+// Block Layer Constants
+// =============================================================================
+
+#define MAX_BLOCK_QUEUES        32
+#define BLOCK_SECTOR_SIZE       512     // Units of every sector number here
+#define BLOCK_NAME_LENGTH       16
+#define BLOCK_REQUEST_POOL      128     // Requests per queue
+#define BLOCK_PLUG_MAX          32      // A plug flushes itself past this many requests
+#define BLOCK_MERGE_COPY_MAX    (64 * 1024)  // Largest request assembled in a staging buffer
+
+// mq-deadline (microseconds)
+#define BLOCK_READ_EXPIRE       500000
+#define BLOCK_WRITE_EXPIRE      5000000
+#define BLOCK_FIFO_BATCH        16      // Sequential dispatches before rechecking deadlines
+#define BLOCK_WRITES_STARVED    2       // Read batches allowed while writes wait
+
+// Budget-fair
+#define BLOCK_BUDGET_OWNERS     16      // Submitters are hashed onto this many queues
+#define BLOCK_BUDGET_SECTORS    2048    // Per turn (1 MiB)
+
+// Waiters poll this long before yielding (microseconds)
+#define BLOCK_POLL_SPIN         20
+
+// A queue that hit IO_BUSY regrows its depth by one after this many completions
+#define BLOCK_DEPTH_REGROW      32
+
+// =============================================================================
+// Block Layer Structures
+// =============================================================================
+
+typedef enum {
+    BLOCK_SCHED_NONE = 0,   // FIFO straight to the device (NVMe, virtio)
+    BLOCK_SCHED_DEADLINE,   // Sector-sorted with read/write expiry (SATA, USB)
+    BLOCK_SCHED_BUDGET      // Sector budget per submitter, round robin
+} block_sched_t;
+
+struct block_queue;
+typedef struct block_bio block_bio_t;
+
+// Runs once the bio's sectors are done, possibly in interrupt context;
+// status is 0 or -1
+typedef void (*block_end_io_t)(block_bio_t* bio, int status);
+
+// One caller transfer. Several adjacent bios may be merged into a single
+// device request.
+struct block_bio {
+    uint64_t sector;
+    uint32_t count;             // Sectors
+    bool write;
+    void* buffer;
+    memory_domain_t* domain;    // Owner of buffer, NULL for kernel memory
+    block_end_io_t end_io;
+    void* private_data;         // Caller's, untouched by the block layer
+    block_bio_t* next;          // Within a request, in sector order
+};
+
+// Counts outstanding bios for a caller waiting on a batch of them
+typedef struct {
+    uint32_t pending;
+    int status;
+} block_wait_t;
+
+// A device request: one or more merged bios
+typedef struct block_request {
+    struct block_queue* queue;
+    uint64_t sector;
+    uint32_t count;
+    bool write;
+    void* buffer;               // Contiguous data for the whole request
+    memory_domain_t* domain;
+    void* staging;              // Set when bios were copied together into buffer
+    uint64_t owner;             // Submitting quantum, for BLOCK_SCHED_BUDGET
+    uint64_t deadline;          // TSC, for BLOCK_SCHED_DEADLINE
+    block_bio_t* bios;
+    block_bio_t* bios_tail;
+    struct block_request* next;       // Plug, software queue, FIFO or free list
+    struct block_request* sort_next;  // Deadline sector order
+    io_packet_t packet;
+} block_request_t;
+
+// Requests batched by one submitter; merged and released together
+typedef struct {
+    struct block_queue* queue;
+    block_request_t* head;
+    block_request_t* tail;
+    uint32_t count;
+} block_plug_t;
+
+// Per-CPU software queue: submitters only touch their own CPU's
+typedef struct {
+    spinlock_t lock;
+    block_request_t* head;
+    block_request_t* tail;
+} __attribute__((aligned(64))) block_sw_queue_t;
+
+// What the driver behind a queue can take
+typedef struct {
+    uint32_t logical_block;     // Bytes; every transfer is a multiple of this
+    uint32_t max_sectors;       // Per request
+    uint32_t depth;             // Requests in flight
+    uint64_t capacity;          // Sectors
+    bool sync_only;             // Driver completes io_request before returning
+} block_limits_t;
+
+typedef struct {
+    uint64_t bios;
+    uint64_t requests;          // Dispatched to the driver
+    uint64_t merges;            // Bios that joined an existing request
+    uint64_t copy_merges;       // ...through a staging buffer
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+    uint64_t errors;
+    uint64_t busy;              // Times the driver pushed back
+} block_stats_t;
+
+// Filesystem-facing interface. Sector numbers are in 512-byte units; queue
+// is set when the device is backed by the block layer, which lets callers
+// plug and submit asynchronously.
+typedef struct {
+    int (*read)(void* device, uint64_t lba, uint32_t sectors, void* buffer);
+    int (*write)(void* device, uint64_t lba, uint32_t sectors, void* buffer);
+    void* device_data;
+    struct block_queue* queue;
+} block_device_t;
+
+typedef struct block_queue {
+    char name[BLOCK_NAME_LENGTH];
+    device_handle_t* handle;
+    uint32_t unit;              // io_packet_t unit for the driver
+    block_limits_t limits;
+    block_device_t device;
+    
+    // Software queues, indexed by CPU
+    block_sw_queue_t* sw;
+    uint32_t sw_count;
+    
+    // Scheduler state and dispatch; everything below is under lock
+    spinlock_t lock;
+    block_sched_t sched;
+    bool dispatching;           // One context feeds the driver at a time
+    bool rerun;                 // New work arrived while it was
+    uint32_t in_flight;
+    uint32_t depth;             // Current limit, shrinks on IO_BUSY
+    uint32_t regrow;
+    
+    // BLOCK_SCHED_NONE: one FIFO; DEADLINE: FIFO and sorted list per direction
+    block_request_t* fifo_head[2];
+    block_request_t* fifo_tail[2];
+    block_request_t* sorted[2];
+    uint64_t next_sector[2];    // Where the elevator continues
+    uint32_t batch_dir;
+    uint32_t batching;
+    uint32_t starved;
+    
+    // BLOCK_SCHED_BUDGET
+    struct {
+        uint64_t owner;
+        block_request_t* head;
+        block_request_t* tail;
+    } owners[BLOCK_BUDGET_OWNERS];
+    uint32_t active_owner;
+    uint32_t budget_left;
+    
+    // Request pool
+    spinlock_t pool_lock;
+    block_request_t* free_requests;
+    block_request_t* pool;
+    
+    block_stats_t stats;
+} block_queue_t;
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// Registration (drivers call this from attach)
+block_queue_t* block_register(device_handle_t* handle, uint32_t unit, const char* name,
+                              block_sched_t sched, const block_limits_t* limits);
+void block_unregister(block_queue_t* queue);
+block_queue_t* block_get_queue(uint32_t index);
+block_queue_t* block_find_queue(const char* name);
+uint32_t block_get_queue_count(void);
+block_device_t* block_get_device(block_queue_t* queue);
+
+// Tuning
+int block_set_scheduler(block_queue_t* queue, block_sched_t sched);
+int block_set_depth(block_queue_t* queue, uint32_t depth);
+void block_get_stats(block_queue_t* queue, block_stats_t* stats);
+
+// Asynchronous I/O
+void block_start_plug(block_plug_t* plug, block_queue_t* queue);
+void block_finish_plug(block_plug_t* plug);
+int block_submit(block_queue_t* queue, block_bio_t* bio, block_plug_t* plug);
+void block_run_queue(block_queue_t* queue);
+
+// Waiting on a batch: block_wait_add before each block_submit
+void block_wait_init(block_wait_t* wait);
+void block_wait_add(block_wait_t* wait, block_bio_t* bio);
+int block_wait(block_queue_t* queue, block_wait_t* wait);
+
+// Synchronous I/O
+int block_read(block_queue_t* queue, uint64_t sector, uint32_t count, void* buffer);
+int block_write(block_queue_t* queue, uint64_t sector, uint32_t count, void* buffer);
+int block_flush(block_queue_t* queue);
+
+#endif /* BLOCK_H */
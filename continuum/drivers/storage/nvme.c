@@ -4,9 +4,12 @@
  */
 
 #include "nvme.h"
+#include "block.h"
 #include "../resonance.h"
 #include "../../flux_memory.h"
 #include "../../conduit_ipc.h"
+#include "../../continuum_trace.h"
+#include "../../temporal_scheduler.h"
 
 // =============================================================================
 // NVMe Controller State
@@ -20,6 +23,27 @@ static spinlock_t g_nvme_lock = SPINLOCK_INIT;
 // NVMe Queue Management
 // =============================================================================
 
+static void nvme_destroy_queue(nvme_queue_t* queue) {
+    if (!queue) {
+        return;
+    }
+    
+    if (queue->sq_dma) {
+        resonance_free_dma(queue->sq_dma);
+    }
+    if (queue->cq_dma) {
+        resonance_free_dma(queue->cq_dma);
+    }
+    if (queue->commands) {
+        flux_free(queue->commands);
+    }
+    if (queue->prp_dma) {
+        resonance_free_dma(queue->prp_dma);
+    }
+    
+    flux_free(queue);
+}
+
 static nvme_queue_t* nvme_create_queue(nvme_controller_t* ctrl, 
                                        uint16_t qid, uint16_t size) {
     nvme_queue_t* queue = flux_allocate(NULL, sizeof(nvme_queue_t),
@@ -31,6 +55,7 @@ static nvme_queue_t* nvme_create_queue(nvme_controller_t* ctrl,
     queue->qid = qid;
     queue->size = size;
     queue->sq_tail = 0;
+    queue->sq_head = 0;
     queue->cq_head = 0;
     queue->cq_phase = 1;
     
@@ -58,50 +83,93 @@ static nvme_queue_t* nvme_create_queue(nvme_controller_t* ctrl,
                                     FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
     spinlock_init(&queue->lock);
     
+    // PRP/SGL list pages for I/O queues
+    if (qid != 0) {
+        queue->prp_dma = resonance_alloc_dma(NVME_PRP_POOL * NVME_PAGE_SIZE,
+                                             DMA_FLAG_COHERENT);
+        if (!queue->prp_dma) {
+            nvme_destroy_queue(queue);
+            return NULL;
+        }
+        for (uint16_t i = 0; i < NVME_PRP_POOL; i++) {
+            queue->prp_free[i] = NVME_PRP_POOL - 1 - i;
+        }
+        queue->prp_free_count = NVME_PRP_POOL;
+    }
+    
     return queue;
 }
 
-static void nvme_destroy_queue(nvme_queue_t* queue) {
-    if (!queue) {
-        return;
-    }
+// Per-queue pool of list pages for PRP lists and SGL segments, so mapping
+// a transfer never allocates
+static void* nvme_prp_page(nvme_queue_t* queue, uint16_t index) {
+    return (uint8_t*)queue->prp_dma->virtual_addr + (size_t)index * NVME_PAGE_SIZE;
+}
+
+static uint64_t nvme_prp_page_phys(nvme_queue_t* queue, uint16_t index) {
+    return queue->prp_dma->physical_addr + (uint64_t)index * NVME_PAGE_SIZE;
+}
+
+static bool nvme_prp_get(nvme_queue_t* queue, uint16_t* index) {
+    bool ok = false;
     
-    if (queue->sq_dma) {
-        resonance_free_dma(queue->sq_dma);
-    }
-    if (queue->cq_dma) {
-        resonance_free_dma(queue->cq_dma);
-    }
-    if (queue->commands) {
-        flux_free(queue->commands);
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&queue->lock);
+    if (queue->prp_free_count > 0) {
+        *index = queue->prp_free[--queue->prp_free_count];
+        ok = true;
     }
+    spinlock_release(&queue->lock);
+    cpu_irq_restore(flags);
     
-    flux_free(queue);
+    return ok;
+}
+
+// Caller holds queue->lock
+static void nvme_prp_put_locked(nvme_queue_t* queue, uint16_t index) {
+    queue->prp_free[queue->prp_free_count++] = index;
+}
+
+static void nvme_prp_put(nvme_queue_t* queue, uint16_t index) {
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&queue->lock);
+    nvme_prp_put_locked(queue, index);
+    spinlock_release(&queue->lock);
+    cpu_irq_restore(flags);
 }
 
 // =============================================================================
 // NVMe Command Submission
 // =============================================================================
 
-static uint16_t nvme_submit_command(nvme_queue_t* queue, nvme_command_t* cmd,
-                                    void* completion_context) {
+// The command ID is the SQ slot, so a slot is free again once its
+// command has completed (the controller fetched it before completing it).
+// One slot always stays empty: tail == head means an empty queue, so a
+// tail catching up with the controller's head would read as one too.
+// track carries what completion needs; submitted and submit_time are set
+// here.
+static uint16_t nvme_queue_command(nvme_queue_t* queue, nvme_command_t* cmd,
+                                   const nvme_cmd_info_t* track) {
+    uint64_t flags = cpu_irq_save();
     spinlock_acquire(&queue->lock);
     
     uint16_t tail = queue->sq_tail;
     uint16_t next_tail = (tail + 1) % queue->size;
     
-    if (next_tail == queue->cq_head) {
+    if (next_tail == queue->sq_head || queue->commands[tail].submitted) {
         // Queue full
         spinlock_release(&queue->lock);
+        cpu_irq_restore(flags);
         return 0xFFFF;
     }
     
     // Copy command to submission queue
+    cmd->command_id = tail;
     queue->sq[tail] = *cmd;
     
     // Track command info
+    queue->commands[tail] = *track;
     queue->commands[tail].submitted = true;
-    queue->commands[tail].completion_context = completion_context;
     queue->commands[tail].submit_time = continuum_get_time();
     
     // Update tail pointer
@@ -119,63 +187,179 @@ static uint16_t nvme_submit_command(nvme_queue_t* queue, nvme_command_t* cmd,
     }
     
     spinlock_release(&queue->lock);
+    cpu_irq_restore(flags);
     
+    TRACE(TRACE_NVME_SUBMIT, ((uint32_t)queue->qid << 16) | tail, cmd->opcode, cmd->command_id);
     return tail;
 }
 
+// Copy a read out of its bounce buffer and hand the result to the
+// submitter. Runs without the queue lock so the callback can resubmit.
+static void nvme_finish_io(nvme_cmd_info_t* info, uint16_t status) {
+    if (info->dma) {
+        if (status == 0 && info->buffer) {
+            memcpy(info->buffer, info->dma->virtual_addr, info->length);
+        }
+        resonance_free_dma(info->dma);
+    }
+    
+    info->callback(info->callback_context, status ? -1 : 0);
+}
+
+// Called from the queue's interrupt and from waiters on the same CPU, so
+// the lock is always taken with interrupts masked. Asynchronous commands
+// are reaped in batches under the lock and finished after it's dropped.
 static bool nvme_process_completion(nvme_queue_t* queue) {
+    nvme_cmd_info_t done[NVME_COMPLETION_BATCH];
+    uint16_t done_status[NVME_COMPLETION_BATCH];
     bool processed = false;
+    uint32_t count;
     
-    spinlock_acquire(&queue->lock);
-    
-    while (1) {
-        nvme_completion_t* cqe = &queue->cq[queue->cq_head];
+    do {
+        bool reaped = false;
+        count = 0;
         
-        // Check phase bit
-        if ((cqe->status & 0x01) != queue->cq_phase) {
-            break;
-        }
+        uint64_t flags = cpu_irq_save();
+        spinlock_acquire(&queue->lock);
         
-        // Process completion
-        uint16_t sqid = cqe->sq_id;
-        uint16_t sq_head = cqe->sq_head;
-        
-        if (queue->commands[sqid].submitted) {
-            queue->commands[sqid].submitted = false;
+        while (count < NVME_COMPLETION_BATCH) {
+            nvme_completion_t* cqe = &queue->cq[queue->cq_head];
+            
+            // Check phase bit
+            if ((cqe->status & 0x01) != queue->cq_phase) {
+                break;
+            }
+            
+            // Process completion; the controller has fetched everything
+            // before the SQ head it reports
+            queue->sq_head = cqe->sq_head % queue->size;
+            uint16_t cid = cqe->command_id;
+            nvme_cmd_info_t* info = cid < queue->size ? &queue->commands[cid] : NULL;
+            
+            if (info && info->submitted) {
+                if (info->wait) {
+                    info->wait->status = cqe->status >> 1;
+                    info->wait->result = cqe->result;
+                    __atomic_store_n(&info->wait->done, true, __ATOMIC_RELEASE);
+                    info->wait = NULL;
+                }
+                
+                // Call completion handler if registered
+                if (info->completion_context) {
+                    nvme_completion_handler_t handler = 
+                        (nvme_completion_handler_t)info->completion_context;
+                    handler(cqe);
+                }
+                
+                if (info->prp_list) {
+                    nvme_prp_put_locked(queue, info->prp_list - 1);
+                    info->prp_list = 0;
+                }
+                
+                if (info->callback) {
+                    done[count] = *info;
+                    done_status[count] = cqe->status >> 1;
+                    count++;
+                    info->callback = NULL;
+                    info->dma = NULL;
+                }
+                
+                __atomic_store_n(&info->submitted, false, __ATOMIC_RELEASE);
+            }
             
-            // Call completion handler if registered
-            if (queue->commands[sqid].completion_context) {
-                nvme_completion_handler_t handler = 
-                    (nvme_completion_handler_t)queue->commands[sqid].completion_context;
-                handler(cqe);
+            // Advance completion queue head
+            queue->cq_head = (queue->cq_head + 1) % queue->size;
+            if (queue->cq_head == 0) {
+                queue->cq_phase = !queue->cq_phase;
             }
+            
+            reaped = true;
         }
         
-        // Advance completion queue head
-        queue->cq_head = (queue->cq_head + 1) % queue->size;
-        if (queue->cq_head == 0) {
-            queue->cq_phase = !queue->cq_phase;
+        if (reaped) {
+            // Write completion queue head doorbell
+            nvme_controller_t* ctrl = queue->controller;
+            if (queue->qid == 0) {
+                // Admin queue
+                mmio_write32(ctrl->bar0 + NVME_REG_ACQ_HEAD, queue->cq_head);
+            } else {
+                // I/O queue
+                uint32_t doorbell_offset = 0x1000 + ((2 * queue->qid + 1) * ctrl->doorbell_stride);
+                mmio_write32(ctrl->bar0 + doorbell_offset, queue->cq_head);
+            }
+            processed = true;
         }
         
-        processed = true;
-    }
+        spinlock_release(&queue->lock);
+        cpu_irq_restore(flags);
+        
+        for (uint32_t i = 0; i < count; i++) {
+            nvme_finish_io(&done[i], done_status[i]);
+        }
+    } while (count == NVME_COMPLETION_BATCH);
     
-    if (processed) {
-        // Write completion queue head doorbell
-        nvme_controller_t* ctrl = queue->controller;
-        if (queue->qid == 0) {
-            // Admin queue
-            mmio_write32(ctrl->bar0 + NVME_REG_ACQ_HEAD, queue->cq_head);
-        } else {
-            // I/O queue
-            uint32_t doorbell_offset = 0x1000 + ((2 * queue->qid + 1) * ctrl->doorbell_stride);
-            mmio_write32(ctrl->bar0 + doorbell_offset, queue->cq_head);
+    return processed;
+}
+
+// Wait for the command in slot, tracked by wait, to complete. The waiter
+// polls for NVME_POLL_SPIN microseconds; after that an interrupt-driven
+// queue's completion arrives through its handler, so the CPU is yielded
+// between checks. Returns 0 on success, -1 on an error status or timeout
+// (wait->done tells them apart); *result gets completion dword 0.
+static int nvme_wait_slot(nvme_queue_t* queue, uint16_t slot, nvme_wait_t* wait,
+                          uint64_t timeout_us, uint32_t* result) {
+    uint64_t start = continuum_get_time();
+    uint64_t spin_until = start + continuum_usec_to_tsc(NVME_POLL_SPIN);
+    uint64_t timeout = start + continuum_usec_to_tsc(timeout_us);
+    while (!__atomic_load_n(&wait->done, __ATOMIC_ACQUIRE)) {
+        if (nvme_process_completion(queue)) {
+            continue;
+        }
+        
+        uint64_t now = continuum_get_time();
+        if (now >= timeout) {
+            // Keep a late completion off the waiter's stack frame
+            uint64_t flags = cpu_irq_save();
+            spinlock_acquire(&queue->lock);
+            bool done = __atomic_load_n(&wait->done, __ATOMIC_ACQUIRE);
+            if (!done) {
+                queue->commands[slot].wait = NULL;
+            }
+            spinlock_release(&queue->lock);
+            cpu_irq_restore(flags);
+            if (!done) {
+                return -1;
+            }
+        } else if (queue->irq && now >= spin_until) {
+            quantum_context_t* current = temporal_get_current();
+            if (current) {
+                temporal_yield(current);
+            }
         }
     }
     
-    spinlock_release(&queue->lock);
+    if (result) {
+        *result = wait->result;
+    }
+    return wait->status ? -1 : 0;
+}
+
+// Submit cmd and wait for it to complete
+static int nvme_wait_command(nvme_queue_t* queue, nvme_command_t* cmd,
+                             uint64_t timeout_us, uint32_t* result) {
+    nvme_wait_t wait = { .done = false, .status = 0, .result = 0 };
+    nvme_cmd_info_t track = { .wait = &wait };
     
-    return processed;
+    uint16_t slot = nvme_queue_command(queue, cmd, &track);
+    if (slot == 0xFFFF) {
+        return -1;
+    }
+    
+    return nvme_wait_slot(queue, slot, &wait, timeout_us, result);
+}
+
+static void nvme_queue_interrupt(void* context) {
+    nvme_process_completion((nvme_queue_t*)context);
 }
 
 // =============================================================================
@@ -196,15 +380,9 @@ static int nvme_identify_controller(nvme_controller_t* ctrl) {
     cmd.prp1 = identify_dma->physical_addr;
     cmd.cdw10 = 0x01;  // Controller identify
     
-    // Submit command
-    nvme_submit_command(ctrl->admin_queue, &cmd, NULL);
-    
-    // Wait for completion (simplified - should use interrupts)
-    uint64_t timeout = continuum_get_time() + 1000000;  // 1 second
-    while (continuum_get_time() < timeout) {
-        if (nvme_process_completion(ctrl->admin_queue)) {
-            break;
-        }
+    if (nvme_wait_command(ctrl->admin_queue, &cmd, NVME_ADMIN_TIMEOUT, NULL) != 0) {
+        resonance_free_dma(identify_dma);
+        return -1;
     }
     
     // Parse identify data
@@ -217,48 +395,142 @@ static int nvme_identify_controller(nvme_controller_t* ctrl) {
     memcpy(ctrl->model_number, identify->mn, 40);
     memcpy(ctrl->firmware_rev, identify->fr, 8);
     
-    ctrl->max_queue_entries = identify->mqes + 1;
     ctrl->num_namespaces = identify->nn;
     
+    // MDTS is a power of two in minimum pages (4KB); 0 means no limit
+    ctrl->max_transfer = NVME_MAX_TRANSFER;
+    if (identify->mdts && identify->mdts < 20 &&
+        ((uint32_t)NVME_PAGE_SIZE << identify->mdts) < ctrl->max_transfer) {
+        ctrl->max_transfer = NVME_PAGE_SIZE << identify->mdts;
+    }
+    ctrl->sgl = (identify->sgls & 0x3) != 0;
+    
     resonance_free_dma(identify_dma);
     
     return 0;
 }
 
+int nvme_set_features(nvme_controller_t* ctrl, uint8_t fid, uint32_t value) {
+    nvme_command_t cmd = {0};
+    cmd.opcode = NVME_ADMIN_SET_FEATURES;
+    cmd.cdw10 = fid;
+    cmd.cdw11 = value;
+    
+    return nvme_wait_command(ctrl->admin_queue, &cmd, NVME_ADMIN_TIMEOUT, NULL);
+}
+
+// Ask for count I/O queue pairs; returns how many the controller granted
+static uint16_t nvme_request_queues(nvme_controller_t* ctrl, uint16_t count) {
+    nvme_command_t cmd = {0};
+    cmd.opcode = NVME_ADMIN_SET_FEATURES;
+    cmd.cdw10 = NVME_FEAT_NUM_QUEUES;
+    cmd.cdw11 = ((uint32_t)(count - 1) << 16) | (count - 1);  // Zero-based
+    
+    uint32_t granted;
+    if (nvme_wait_command(ctrl->admin_queue, &cmd, NVME_ADMIN_TIMEOUT, &granted) != 0) {
+        return 1;   // Every controller has at least one pair
+    }
+    
+    uint16_t sqs = (granted & 0xFFFF) + 1;
+    uint16_t cqs = (granted >> 16) + 1;
+    uint16_t pairs = sqs < cqs ? sqs : cqs;
+    return pairs < count ? pairs : count;
+}
+
 static int nvme_create_io_queue(nvme_controller_t* ctrl, uint16_t qid) {
-    // Create completion queue first
+    nvme_queue_t* queue = ctrl->io_queues[qid - 1];
+    
+    // Create completion queue first, signalling the queue's MSI-X entry
     nvme_command_t cmd = {0};
     cmd.opcode = NVME_ADMIN_CREATE_CQ;
-    cmd.prp1 = ctrl->io_queues[qid - 1]->cq_dma->physical_addr;
-    cmd.cdw10 = ((ctrl->queue_size - 1) << 16) | qid;
-    cmd.cdw11 = 0x01;  // Physically contiguous, interrupts enabled
-    
-    nvme_submit_command(ctrl->admin_queue, &cmd, NULL);
+    cmd.prp1 = queue->cq_dma->physical_addr;
+    cmd.cdw10 = ((uint32_t)(queue->size - 1) << 16) | qid;
+    cmd.cdw11 = NVME_QUEUE_PHYS_CONTIG;
+    if (queue->irq) {
+        cmd.cdw11 |= ((uint32_t)queue->msix_index << 16) | NVME_CQ_IRQ_ENABLED;
+    }
     
-    // Wait for completion
-    uint64_t timeout = continuum_get_time() + 1000000;
-    while (continuum_get_time() < timeout) {
-        if (nvme_process_completion(ctrl->admin_queue)) {
-            break;
-        }
+    if (nvme_wait_command(ctrl->admin_queue, &cmd, NVME_ADMIN_TIMEOUT, NULL) != 0) {
+        return -1;
     }
     
     // Create submission queue
+    cmd = (nvme_command_t){0};
     cmd.opcode = NVME_ADMIN_CREATE_SQ;
-    cmd.prp1 = ctrl->io_queues[qid - 1]->sq_dma->physical_addr;
-    cmd.cdw10 = ((ctrl->queue_size - 1) << 16) | qid;
-    cmd.cdw11 = (qid << 16) | 0x01;  // CQ ID and priorities
+    cmd.prp1 = queue->sq_dma->physical_addr;
+    cmd.cdw10 = ((uint32_t)(queue->size - 1) << 16) | qid;
+    cmd.cdw11 = ((uint32_t)qid << 16) | NVME_QUEUE_PHYS_CONTIG;  // CQ ID, medium priority
     
-    nvme_submit_command(ctrl->admin_queue, &cmd, NULL);
+    return nvme_wait_command(ctrl->admin_queue, &cmd, NVME_ADMIN_TIMEOUT, NULL);
+}
+
+// One queue pair per CPU up to what the controller grants and the device
+// has MSI-X entries for (entry 0 stays with the admin queue). Each CQ
+// interrupts the CPU that submits to it; CPUs beyond the queue count share
+// round robin.
+static int nvme_setup_io_queues(nvme_controller_t* ctrl, device_handle_t* handle) {
+    uint32_t cpus = continuum_get_cpu_count();
+    if (cpus == 0 || cpus > MAX_CPU_CORES) {
+        cpus = 1;
+    }
     
-    // Wait for completion
-    timeout = continuum_get_time() + 1000000;
-    while (continuum_get_time() < timeout) {
-        if (nvme_process_completion(ctrl->admin_queue)) {
+    uint16_t wanted = cpus;
+    if (wanted > MAX_NVME_QUEUES) {
+        wanted = MAX_NVME_QUEUES;
+    }
+    if (wanted > MAX_IRQ_VECTORS) {
+        wanted = MAX_IRQ_VECTORS;
+    }
+    wanted = nvme_request_queues(ctrl, wanted);
+    
+    ctrl->queue_size = NVME_QUEUE_SIZE;
+    if (ctrl->queue_size > ctrl->max_queue_entries) {
+        ctrl->queue_size = ctrl->max_queue_entries;
+    }
+    
+    ctrl->num_io_queues = 0;
+    for (uint16_t i = 0; i < wanted; i++) {
+        uint16_t qid = i + 1;
+        nvme_queue_t* queue = nvme_create_queue(ctrl, qid, ctrl->queue_size);
+        if (!queue) {
             break;
         }
+        queue->controller = ctrl;
+        queue->msix_index = qid;
+        queue->cpu = i;
+        
+        // Without a vector of its own the first queue still works polled;
+        // later ones just aren't created
+        queue->irq = handle &&
+            resonance_register_irq(handle, RESONANCE_IRQ_QUEUE(qid),
+                                   nvme_queue_interrupt, queue) == 0;
+        if (!queue->irq && i > 0) {
+            nvme_destroy_queue(queue);
+            break;
+        }
+        if (queue->irq) {
+            resonance_set_irq_affinity(handle, RESONANCE_IRQ_QUEUE(qid), queue->cpu);
+        }
+        
+        ctrl->io_queues[i] = queue;
+        if (nvme_create_io_queue(ctrl, qid) != 0) {
+            if (queue->irq) {
+                resonance_unregister_irq(handle, RESONANCE_IRQ_QUEUE(qid));
+            }
+            nvme_destroy_queue(queue);
+            ctrl->io_queues[i] = NULL;
+            break;
+        }
+        ctrl->num_io_queues++;
     }
     
+    if (ctrl->num_io_queues == 0) {
+        return -1;
+    }
+    
+    for (uint32_t cpu = 0; cpu < MAX_CPU_CORES; cpu++) {
+        ctrl->cpu_queues[cpu] = ctrl->io_queues[cpu % ctrl->num_io_queues];
+    }
     return 0;
 }
 
@@ -266,52 +538,247 @@ static int nvme_create_io_queue(nvme_controller_t* ctrl, uint16_t qid) {
 // NVMe I/O Commands
 // =============================================================================
 
-static int nvme_read_write(nvme_namespace_t* ns, uint64_t lba, uint32_t count,
-                          void* buffer, bool is_write) {
-    nvme_controller_t* ctrl = ns->controller;
-    nvme_queue_t* queue = ctrl->io_queues[0];  // Use first I/O queue
+// Outcomes of nvme_map_buffer
+#define NVME_MAP_DIRECT         0   // Data pointer built from buffer's own pages
+#define NVME_MAP_BOUNCE         1   // Some page can't take DMA; copy through a bounce buffer
+#define NVME_MAP_BUSY           2   // List pool empty, retry after completions
+
+// A run of physically contiguous bytes collapses into one SGL data block.
+// Returns NVME_MAP_BOUNCE when runs outgrow a segment page so PRPs can be
+// tried instead.
+static int nvme_map_sgl(nvme_queue_t* queue, nvme_command_t* cmd, nvme_cmd_info_t* track,
+                        memory_domain_t* domain, uint64_t va, size_t size,
+                        bool device_writes) {
+    nvme_sgl_desc_t run = { .address = 0, .length = 0, .type = NVME_SGL_DATA_BLOCK };
+    nvme_sgl_desc_t* list = NULL;
+    uint16_t index = 0;
+    size_t runs = 0;
     
-    // Allocate DMA buffer
-    size_t size = count * ns->block_size;
-    dma_region_t* dma = resonance_alloc_dma(size, DMA_FLAG_COHERENT);
-    if (!dma) {
-        return -1;
+    for (size_t done = 0; done < size; ) {
+        size_t chunk = NVME_PAGE_SIZE - ((va + done) & (NVME_PAGE_SIZE - 1));
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        uint64_t phys = flux_dma_address(domain, va + done, device_writes);
+        if (!phys) {
+            runs = 0;
+            break;
+        }
+        
+        if (run.length && run.address + run.length == phys) {
+            run.length += chunk;
+        } else {
+            if (run.length) {
+                if (runs == NVME_SGL_ENTRIES) {
+                    runs = 0;
+                    break;
+                }
+                if (!list) {
+                    if (!nvme_prp_get(queue, &index)) {
+                        return NVME_MAP_BUSY;
+                    }
+                    list = nvme_prp_page(queue, index);
+                }
+                list[runs - 1] = run;
+            }
+            run.address = phys;
+            run.length = chunk;
+            runs++;
+        }
+        done += chunk;
     }
     
-    if (is_write) {
-        memcpy(dma->virtual_addr, buffer, size);
+    if (runs == 0) {
+        if (list) {
+            nvme_prp_put(queue, index);
+        }
+        return NVME_MAP_BOUNCE;
     }
     
-    // Build I/O command
-    nvme_command_t cmd = {0};
-    cmd.opcode = is_write ? NVME_IO_WRITE : NVME_IO_READ;
-    cmd.nsid = ns->nsid;
-    cmd.prp1 = dma->physical_addr;
-    if (size > 4096) {
-        // Need PRP list for larger transfers
-        // Simplified - would need proper PRP list setup
-        cmd.prp2 = dma->physical_addr + 4096;
+    // The data pointer holds one descriptor: address, then length and type
+    if (runs > 1) {
+        list[runs - 1] = run;
+        run.address = nvme_prp_page_phys(queue, index);
+        run.length = runs * sizeof(nvme_sgl_desc_t);
+        run.type = NVME_SGL_LAST_SEGMENT;
+        track->prp_list = index + 1;
+    }
+    cmd->flags |= NVME_CMD_SGL;
+    cmd->prp1 = run.address;
+    cmd->prp2 = run.length | ((uint64_t)run.type << 56);
+    return NVME_MAP_DIRECT;
+}
+
+// Point cmd's data pointer straight at buffer's physical pages: one or two
+// PRP entries inline, a pool page of them beyond that, or an SGL when the
+// controller takes one for I/O
+static int nvme_map_buffer(nvme_queue_t* queue, nvme_command_t* cmd, nvme_cmd_info_t* track,
+                           memory_domain_t* domain, void* buffer, size_t size,
+                           bool device_writes) {
+    uint64_t va = (uint64_t)buffer;
+    if (va & 3) {
+        return NVME_MAP_BOUNCE;     // Data pointers must be dword aligned
     }
-    cmd.cdw10 = lba & 0xFFFFFFFF;
-    cmd.cdw11 = lba >> 32;
-    cmd.cdw12 = (count - 1) & 0xFFFF;
     
-    // Submit command
-    nvme_submit_command(queue, &cmd, NULL);
+    if (queue->controller->sgl) {
+        int result = nvme_map_sgl(queue, cmd, track, domain, va, size, device_writes);
+        if (result != NVME_MAP_BOUNCE) {
+            return result;
+        }
+    }
     
-    // Wait for completion
-    uint64_t timeout = continuum_get_time() + 5000000;  // 5 seconds
-    while (continuum_get_time() < timeout) {
-        if (nvme_process_completion(queue)) {
-            break;
+    uint64_t first = flux_dma_address(domain, va, device_writes);
+    if (!first) {
+        return NVME_MAP_BOUNCE;
+    }
+    
+    size_t first_len = NVME_PAGE_SIZE - (va & (NVME_PAGE_SIZE - 1));
+    size_t pages = 1;
+    if (size > first_len) {
+        pages += (size - first_len + NVME_PAGE_SIZE - 1) / NVME_PAGE_SIZE;
+    }
+    uint64_t page_va = (va & ~(uint64_t)(NVME_PAGE_SIZE - 1)) + NVME_PAGE_SIZE;
+    
+    cmd->prp1 = first;
+    cmd->prp2 = 0;
+    if (pages == 2) {
+        cmd->prp2 = flux_dma_address(domain, page_va, device_writes);
+        if (!cmd->prp2) {
+            return NVME_MAP_BOUNCE;
+        }
+    } else if (pages > 2) {
+        uint16_t index;
+        if (pages - 1 > NVME_PRP_ENTRIES) {
+            return NVME_MAP_BOUNCE;
+        }
+        if (!nvme_prp_get(queue, &index)) {
+            return NVME_MAP_BUSY;
+        }
+        
+        uint64_t* list = nvme_prp_page(queue, index);
+        for (size_t i = 0; i < pages - 1; i++, page_va += NVME_PAGE_SIZE) {
+            list[i] = flux_dma_address(domain, page_va, device_writes);
+            if (!list[i]) {
+                nvme_prp_put(queue, index);
+                return NVME_MAP_BOUNCE;
+            }
         }
+        cmd->prp2 = nvme_prp_page_phys(queue, index);
+        track->prp_list = index + 1;
+    }
+    return NVME_MAP_DIRECT;
+}
+
+static void nvme_build_rw(nvme_namespace_t* ns, nvme_command_t* cmd, uint64_t lba,
+                          uint32_t count, bool is_write) {
+    *cmd = (nvme_command_t){0};
+    cmd->opcode = is_write ? NVME_IO_WRITE : NVME_IO_READ;
+    cmd->nsid = ns->nsid;
+    cmd->cdw10 = lba & 0xFFFFFFFF;
+    cmd->cdw11 = lba >> 32;
+    cmd->cdw12 = (count - 1) & 0xFFFF;
+}
+
+// Map the transfer zero-copy when every page can take DMA, else through
+// a bounce buffer (returned in track->dma). Returns -1 if nothing could
+// be mapped, or NVME_MAP_BUSY while the list pool is drained.
+static int nvme_prepare_rw(nvme_queue_t* queue, nvme_command_t* cmd, nvme_cmd_info_t* track,
+                           memory_domain_t* domain, void* buffer, size_t size,
+                           bool is_write) {
+    int map = nvme_map_buffer(queue, cmd, track, domain, buffer, size, !is_write);
+    if (map != NVME_MAP_BOUNCE) {
+        return map;
     }
     
-    if (!is_write) {
-        memcpy(buffer, dma->virtual_addr, size);
+    dma_region_t* dma = resonance_alloc_dma(size, DMA_FLAG_COHERENT);
+    if (!dma) {
+        return -1;
     }
     
-    resonance_free_dma(dma);
+    map = nvme_map_buffer(queue, cmd, track, NULL, dma->virtual_addr, size, !is_write);
+    if (map != NVME_MAP_DIRECT) {
+        resonance_free_dma(dma);
+        return map == NVME_MAP_BUSY ? map : -1;
+    }
+    
+    if (is_write) {
+        memcpy(dma->virtual_addr, buffer, size);
+    }
+    track->dma = dma;
+    track->buffer = is_write ? NULL : buffer;
+    track->length = size;
+    return NVME_MAP_DIRECT;
+}
+
+// Undo nvme_prepare_rw for a command that never made it onto the queue
+static void nvme_unprepare_rw(nvme_queue_t* queue, nvme_cmd_info_t* track) {
+    if (track->prp_list) {
+        nvme_prp_put(queue, track->prp_list - 1);
+    }
+    if (track->dma) {
+        resonance_free_dma(track->dma);
+    }
+}
+
+static int nvme_read_write(nvme_namespace_t* ns, uint64_t lba, uint32_t count,
+                          void* buffer, bool is_write) {
+    nvme_controller_t* ctrl = ns->controller;
+    nvme_queue_t* queue = ctrl->cpu_queues[temporal_get_current_cpu()];
+    if (!queue || count == 0) {
+        return -1;
+    }
+    
+    // Split at what one command can carry
+    uint32_t max_blocks = ctrl->max_transfer / ns->block_size;
+    if (max_blocks == 0) {
+        return -1;
+    }
+    while (count > 0) {
+        uint32_t blocks = count < max_blocks ? count : max_blocks;
+        size_t size = (size_t)blocks * ns->block_size;
+        
+        // Build I/O command
+        nvme_command_t cmd;
+        nvme_build_rw(ns, &cmd, lba, blocks, is_write);
+        
+        nvme_wait_t wait = { .done = false, .status = 0, .result = 0 };
+        nvme_cmd_info_t track = { .wait = &wait };
+        int map;
+        while ((map = nvme_prepare_rw(queue, &cmd, &track, NULL, buffer, size,
+                                      is_write)) == NVME_MAP_BUSY) {
+            nvme_process_completion(queue);
+        }
+        if (map != NVME_MAP_DIRECT) {
+            return -1;
+        }
+        
+        // Submit command
+        uint16_t slot = nvme_queue_command(queue, &cmd, &track);
+        if (slot == 0xFFFF) {
+            nvme_unprepare_rw(queue, &track);
+            return -1;
+        }
+        
+        if (nvme_wait_slot(queue, slot, &wait, NVME_IO_TIMEOUT, NULL) != 0) {
+            // A timed-out transfer may still land in the bounce buffer, so
+            // it stays allocated
+            if (wait.done && track.dma) {
+                resonance_free_dma(track.dma);
+            }
+            return -1;
+        }
+        
+        if (track.dma) {
+            if (!is_write) {
+                memcpy(buffer, track.dma->virtual_addr, size);
+            }
+            resonance_free_dma(track.dma);
+        }
+        
+        lba += blocks;
+        count -= blocks;
+        buffer = (uint8_t*)buffer + size;
+    }
     
     return 0;
 }
@@ -324,6 +791,77 @@ int nvme_write(nvme_namespace_t* ns, uint64_t lba, uint32_t count, void* buffer)
     return nvme_read_write(ns, lba, count, buffer, true);
 }
 
+// Queue a transfer on this CPU's queue and return without waiting; as many
+// can be outstanding as the queue has slots. buffer belongs to domain
+// (NULL for kernel memory) and is used in place when its pages allow.
+// callback runs from the completion path, usually the queue's interrupt.
+// IO_BUSY means the queue or its list pool is full right now.
+static io_result_t nvme_submit_io(nvme_namespace_t* ns, uint64_t lba, uint32_t count,
+                                  memory_domain_t* domain, void* buffer, bool is_write,
+                                  nvme_io_callback_t callback, void* context) {
+    nvme_controller_t* ctrl = ns->controller;
+    nvme_queue_t* queue = ctrl->cpu_queues[temporal_get_current_cpu()];
+    if (!queue) {
+        return IO_NO_DEVICE;
+    }
+    
+    size_t size = (size_t)count * ns->block_size;
+    if (!callback || count == 0 || size > ctrl->max_transfer) {
+        return IO_ERROR;
+    }
+    
+    nvme_command_t cmd;
+    nvme_build_rw(ns, &cmd, lba, count, is_write);
+    
+    nvme_cmd_info_t track = {
+        .callback = callback,
+        .callback_context = context
+    };
+    int map = nvme_prepare_rw(queue, &cmd, &track, domain, buffer, size, is_write);
+    if (map != NVME_MAP_DIRECT) {
+        return map == NVME_MAP_BUSY ? IO_BUSY : IO_ERROR;
+    }
+    
+    if (nvme_queue_command(queue, &cmd, &track) == 0xFFFF) {
+        nvme_unprepare_rw(queue, &track);
+        return IO_BUSY;
+    }
+    
+    return IO_PENDING;
+}
+
+io_result_t nvme_read_async(nvme_namespace_t* ns, uint64_t lba, uint32_t count, void* buffer,
+                            nvme_io_callback_t callback, void* context) {
+    return nvme_submit_io(ns, lba, count, NULL, buffer, false, callback, context);
+}
+
+io_result_t nvme_write_async(nvme_namespace_t* ns, uint64_t lba, uint32_t count, void* buffer,
+                             nvme_io_callback_t callback, void* context) {
+    return nvme_submit_io(ns, lba, count, NULL, buffer, true, callback, context);
+}
+
+int nvme_flush(nvme_namespace_t* ns) {
+    nvme_queue_t* queue = ns->controller->cpu_queues[temporal_get_current_cpu()];
+    if (!queue) {
+        return -1;
+    }
+    
+    nvme_command_t cmd = {0};
+    cmd.opcode = NVME_IO_FLUSH;
+    cmd.nsid = ns->nsid;
+    
+    return nvme_wait_command(queue, &cmd, NVME_IO_TIMEOUT, NULL);
+}
+
+nvme_namespace_t* nvme_get_namespace(nvme_controller_t* ctrl, uint32_t nsid) {
+    for (uint32_t i = 0; i < MAX_NVME_NAMESPACES; i++) {
+        if (ctrl->namespaces[i] && ctrl->namespaces[i]->nsid == nsid) {
+            return ctrl->namespaces[i];
+        }
+    }
+    return NULL;
+}
+
 // =============================================================================
 // NVMe Controller Initialization
 // =============================================================================
@@ -389,21 +927,7 @@ static int nvme_init_controller(nvme_controller_t* ctrl) {
         return -1;
     }
     
-    // Create I/O queues
-    ctrl->queue_size = 256;  // Default I/O queue size
-    ctrl->num_io_queues = 1;  // Start with one I/O queue
-    
-    for (uint16_t i = 0; i < ctrl->num_io_queues; i++) {
-        ctrl->io_queues[i] = nvme_create_queue(ctrl, i + 1, ctrl->queue_size);
-        if (!ctrl->io_queues[i]) {
-            return -1;
-        }
-        ctrl->io_queues[i]->controller = ctrl;
-        
-        if (nvme_create_io_queue(ctrl, i + 1) != 0) {
-            return -1;
-        }
-    }
+    // I/O queues come up in nvme_attach, once interrupts can be wired
     
     // Identify namespaces
     for (uint32_t nsid = 1; nsid <= ctrl->num_namespaces; nsid++) {
@@ -425,14 +949,10 @@ static int nvme_init_controller(nvme_controller_t* ctrl) {
             cmd.prp1 = identify_dma->physical_addr;
             cmd.cdw10 = 0x00;  // Namespace identify
             
-            nvme_submit_command(ctrl->admin_queue, &cmd, NULL);
-            
-            // Wait for completion
-            timeout = continuum_get_time() + 1000000;
-            while (continuum_get_time() < timeout) {
-                if (nvme_process_completion(ctrl->admin_queue)) {
-                    break;
-                }
+            if (nvme_wait_command(ctrl->admin_queue, &cmd, NVME_ADMIN_TIMEOUT, NULL) != 0) {
+                resonance_free_dma(identify_dma);
+                flux_free(ns);
+                continue;
             }
             
             nvme_identify_namespace_t* id_ns = 
@@ -492,7 +1012,40 @@ static void* nvme_probe(device_node_t* node) {
 
 static int nvme_attach(device_handle_t* handle) {
     nvme_controller_t* ctrl = (nvme_controller_t*)handle->driver_data;
+    
+    ctrl->handle = handle;
+    if (nvme_setup_io_queues(ctrl, handle) != 0) {
+        ctrl->state = NVME_STATE_ERROR;
+        return -1;
+    }
+    
     ctrl->state = NVME_STATE_READY;
+    
+    // Each namespace gets a block queue; the controller orders nothing, so
+    // requests go straight through as deep as the submission queues allow
+    uint32_t index = 0;
+    spinlock_acquire(&g_nvme_lock);
+    while (index < g_nvme_count && g_nvme_controllers[index] != ctrl) {
+        index++;
+    }
+    spinlock_release(&g_nvme_lock);
+    
+    for (uint32_t i = 0; i < MAX_NVME_NAMESPACES; i++) {
+        nvme_namespace_t* ns = ctrl->namespaces[i];
+        if (!ns || ns->block_size == 0) {
+            continue;
+        }
+        
+        char name[BLOCK_NAME_LENGTH];
+        snprintf(name, sizeof(name), "nvme%un%u", index, ns->nsid);
+        block_limits_t limits = {
+            .logical_block = ns->block_size,
+            .max_sectors = ctrl->max_transfer / BLOCK_SECTOR_SIZE,
+            .depth = ctrl->num_io_queues * (ctrl->queue_size - 1),
+            .capacity = ns->size * (ns->block_size / BLOCK_SECTOR_SIZE)
+        };
+        ns->block = block_register(handle, ns->nsid, name, BLOCK_SCHED_NONE, &limits);
+    }
     return 0;
 }
 
@@ -500,19 +1053,78 @@ static void nvme_detach(device_handle_t* handle) {
     nvme_controller_t* ctrl = (nvme_controller_t*)handle->driver_data;
     ctrl->state = NVME_STATE_DISABLED;
     
+    for (uint32_t i = 0; i < MAX_NVME_NAMESPACES; i++) {
+        if (ctrl->namespaces[i] && ctrl->namespaces[i]->block) {
+            block_unregister(ctrl->namespaces[i]->block);
+            ctrl->namespaces[i]->block = NULL;
+        }
+    }
+    
+    for (uint16_t i = 0; i < ctrl->num_io_queues; i++) {
+        if (ctrl->io_queues[i]->irq) {
+            resonance_unregister_irq(handle, RESONANCE_IRQ_QUEUE(ctrl->io_queues[i]->qid));
+        }
+    }
+    
     // Disable controller
     uint32_t cc = mmio_read32(ctrl->bar0 + NVME_REG_CC);
     cc &= ~NVME_CC_ENABLE;
     mmio_write32(ctrl->bar0 + NVME_REG_CC, cc);
 }
 
+static void nvme_packet_complete(void* context, int status) {
+    io_packet_t* packet = (io_packet_t*)context;
+    resonance_io_complete(packet, status == 0 ? IO_SUCCESS : IO_ERROR);
+}
+
+// packet->unit is the namespace ID (0 for the first namespace); offset
+// and size are in bytes and must be whole blocks
 static io_result_t nvme_io_request(device_handle_t* handle, io_packet_t* packet) {
     nvme_controller_t* ctrl = (nvme_controller_t*)handle->driver_data;
+    if (!ctrl || ctrl->state != NVME_STATE_READY) {
+        return IO_NO_DEVICE;
+    }
     
-    // Dispatch based on operation
-    // Simplified - would handle various I/O operations
+    nvme_namespace_t* ns = packet->unit ? nvme_get_namespace(ctrl, packet->unit) :
+                                          ctrl->namespaces[0];
+    if (!ns) {
+        return IO_NO_DEVICE;
+    }
     
-    return IO_SUCCESS;
+    // Dispatch based on operation
+    switch (packet->operation) {
+        case IO_OP_READ:
+        case IO_OP_WRITE: {
+            bool is_write = packet->operation == IO_OP_WRITE;
+            if (packet->size == 0 || packet->offset % ns->block_size ||
+                packet->size % ns->block_size) {
+                return IO_ERROR;
+            }
+            uint64_t lba = packet->offset / ns->block_size;
+            uint32_t count = packet->size / ns->block_size;
+            
+            if (!resonance_io_async(packet)) {
+                return nvme_read_write(ns, lba, count, packet->buffer, is_write) == 0 ?
+                    IO_SUCCESS : IO_ERROR;
+            }
+            
+            packet->status = IO_PENDING;
+            return nvme_submit_io(ns, lba, count, packet->domain, packet->buffer,
+                                  is_write, nvme_packet_complete, packet);
+        }
+        
+        case IO_OP_FLUSH:
+            // Flushes are rare enough to stay synchronous
+            packet->status = nvme_flush(ns) == 0 ? IO_SUCCESS : IO_ERROR;
+            if (resonance_io_async(packet)) {
+                resonance_io_complete(packet, packet->status);
+                return IO_PENDING;
+            }
+            return packet->status;
+        
+        default:
+            return IO_ERROR;
+    }
 }
 
 // Driver registration
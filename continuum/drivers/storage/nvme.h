@@ -73,6 +73,32 @@
 #define NVME_IO_DSM             0x09
 #define NVME_IO_RESERVATION     0x0D
 
+// Features
+#define NVME_FEAT_NUM_QUEUES    0x07
+
+// Create I/O CQ/SQ cdw11 bits
+#define NVME_QUEUE_PHYS_CONTIG  (1 << 0)
+#define NVME_CQ_IRQ_ENABLED     (1 << 1)
+
+// Timeouts (microseconds)
+#define NVME_ADMIN_TIMEOUT      1000000
+#define NVME_IO_TIMEOUT         5000000
+#define NVME_POLL_SPIN          20      // Waiters poll this long before yielding to the IRQ
+
+// Completions reaped per pass before their callbacks run
+#define NVME_COMPLETION_BATCH   16
+
+// Data pointers. One PRP list page covers a whole transfer, which caps it
+// at NVME_MAX_TRANSFER; each I/O queue keeps NVME_PRP_POOL list pages.
+#define NVME_PAGE_SIZE          4096
+#define NVME_PRP_ENTRIES        (NVME_PAGE_SIZE / sizeof(uint64_t))
+#define NVME_PRP_POOL           32
+#define NVME_MAX_TRANSFER       (NVME_PRP_ENTRIES * NVME_PAGE_SIZE)
+#define NVME_CMD_SGL            (1 << 6)    // PSDT: SGL for data
+#define NVME_SGL_DATA_BLOCK     0x00
+#define NVME_SGL_LAST_SEGMENT   0x30
+#define NVME_SGL_ENTRIES        (NVME_PAGE_SIZE / sizeof(nvme_sgl_desc_t))
+
 // DMA Flags
 #define DMA_FLAG_COHERENT       (1 << 0)
 #define DMA_FLAG_STREAMING      (1 << 1)
@@ -99,6 +125,14 @@ typedef struct __attribute__((packed)) {
     uint32_t cdw15;
 } nvme_command_t;
 
+// SGL descriptor, also the layout of the command's data pointer in SGL mode
+typedef struct __attribute__((packed)) {
+    uint64_t address;
+    uint32_t length;
+    uint8_t reserved[3];
+    uint8_t type;           // NVME_SGL_*
+} nvme_sgl_desc_t;
+
 // NVMe Completion
 typedef struct __attribute__((packed)) {
     uint32_t result;
@@ -141,7 +175,7 @@ typedef struct __attribute__((packed)) {
     uint16_t mtfa;         // Maximum Time for Firmware Activation
     uint32_t hmpre;        // Host Memory Buffer Preferred Size
     uint32_t hmmin;        // Host Memory Buffer Minimum Size
-    uint8_t reserved2[230];
+    uint8_t reserved2[232];
     uint8_t sqes;          // Submission Queue Entry Size
     uint8_t cqes;          // Completion Queue Entry Size
     uint16_t maxcmd;       // Maximum Outstanding Commands
@@ -165,6 +199,9 @@ typedef struct __attribute__((packed)) {
     uint8_t vendor_specific[1024];
 } nvme_identify_controller_t;
 
+_Static_assert(sizeof(nvme_identify_controller_t) == 4096,
+               "identify controller data is one page");
+
 // Identify Namespace Data
 typedef struct __attribute__((packed)) {
     uint64_t nsze;         // Namespace Size
@@ -200,10 +237,27 @@ typedef struct __attribute__((packed)) {
     uint8_t vendor_specific[3712];
 } nvme_identify_namespace_t;
 
-// Command tracking info
+// Synchronous submitter's view of one command, filled in on completion
+typedef struct nvme_wait {
+    bool done;
+    uint16_t status;        // Status field without the phase bit; 0 is success
+    uint32_t result;        // Completion dword 0
+} nvme_wait_t;
+
+// Asynchronous I/O completion; status is 0, or -1 on a device error
+typedef void (*nvme_io_callback_t)(void* context, int status);
+
+// Command tracking info (indexed by command ID, which is the SQ slot)
 typedef struct {
     bool submitted;
     void* completion_context;
+    nvme_wait_t* wait;
+    nvme_io_callback_t callback;
+    void* callback_context;
+    dma_region_t* dma;      // Bounce buffer, released on completion
+    void* buffer;           // Where a read is copied out to
+    size_t length;
+    uint16_t prp_list;      // PRP/SGL list pool page + 1, 0 for none
     uint64_t submit_time;
 } nvme_cmd_info_t;
 
@@ -212,8 +266,12 @@ typedef struct nvme_queue {
     uint16_t qid;
     uint16_t size;
     uint16_t sq_tail;
+    uint16_t sq_head;       // Controller's SQ head, from the last completion
     uint16_t cq_head;
     uint8_t cq_phase;
+    uint16_t msix_index;    // MSI-X entry that signals this CQ
+    uint32_t cpu;           // CPU that submits here and takes its interrupts
+    bool irq;               // Completions interrupt (else polled only)
     
     nvme_command_t* sq;
     nvme_completion_t* cq;
@@ -222,6 +280,11 @@ typedef struct nvme_queue {
     
     nvme_cmd_info_t* commands;
     struct nvme_controller* controller;
+    
+    // PRP/SGL list pages, taken and returned under lock
+    dma_region_t* prp_dma;
+    uint16_t prp_free[NVME_PRP_POOL];
+    uint16_t prp_free_count;
     spinlock_t lock;
 } nvme_queue_t;
 
@@ -234,6 +297,7 @@ typedef struct nvme_namespace {
     uint64_t utilization;   // Utilization in blocks
     uint32_t block_size;    // Block size in bytes
     uint8_t features;
+    struct block_queue* block;  // Set once the controller is attached
 } nvme_namespace_t;
 
 // NVMe Controller State
@@ -260,12 +324,17 @@ typedef struct nvme_controller {
     uint32_t max_queue_entries;
     uint32_t doorbell_stride;
     uint32_t num_namespaces;
+    uint32_t max_transfer;  // Bytes per command
+    bool sgl;               // SGLs supported for I/O commands
     
-    // Queues
+    // Queues: one I/O pair per CPU, or shared round the CPUs when the
+    // controller grants fewer
     nvme_queue_t* admin_queue;
     nvme_queue_t* io_queues[MAX_NVME_QUEUES];
+    nvme_queue_t* cpu_queues[MAX_CPU_CORES];
     uint16_t num_io_queues;
     uint16_t queue_size;
+    device_handle_t* handle;
     
     // Namespaces
     nvme_namespace_t* namespaces[MAX_NVME_NAMESPACES];
@@ -290,6 +359,10 @@ void nvme_init(void);
 // I/O operations
 int nvme_read(nvme_namespace_t* ns, uint64_t lba, uint32_t count, void* buffer);
 int nvme_write(nvme_namespace_t* ns, uint64_t lba, uint32_t count, void* buffer);
+io_result_t nvme_read_async(nvme_namespace_t* ns, uint64_t lba, uint32_t count, void* buffer,
+                            nvme_io_callback_t callback, void* context);
+io_result_t nvme_write_async(nvme_namespace_t* ns, uint64_t lba, uint32_t count, void* buffer,
+                             nvme_io_callback_t callback, void* context);
 int nvme_flush(nvme_namespace_t* ns);
 int nvme_trim(nvme_namespace_t* ns, uint64_t lba, uint32_t count);
 
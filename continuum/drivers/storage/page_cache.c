@@ -0,0 +1,1409 @@
+/*
+ * Page Cache for Continuum Kernel
+ * One cache for device blocks (keyed by device and offset) and file data
+ * (keyed by filesystem, inode and offset). Replacement follows CLOCK-Pro:
+ * new pages start cold, cold pages reused before the hand comes round turn
+ * hot, and evicted pages are remembered for a while so a quick refault
+ * comes back hot and grows the cold share. Dirty pages are written back by
+ * kflushd; clean ones are handed back to flux under memory pressure.
+ */
+
+#include "page_cache.h"
+#include "../../continuum_core.h"
+#include "../../flux_memory.h"
+#include "../../temporal_scheduler.h"
+
+// =============================================================================
+// Global Page Cache State
+// =============================================================================
+
+#define PAGE_CACHE_SECTORS      (PAGE_CACHE_PAGE_SIZE / BLOCK_SECTOR_SIZE)
+
+// Waiters on a page being read poll this long before yielding (microseconds)
+#define PAGE_CACHE_POLL_SPIN    20
+
+// Everything below is under g_page_cache_lock. Each clock is a circular
+// list whose head is the hand; moving the hand on means moving the head.
+static struct {
+    bool initialized;
+    page_cache_page_t** buckets;
+    page_cache_mapping_t** mappings;
+    uint64_t* ghosts;           // Signatures of evicted pages, 0 when free
+    uint64_t ghost_mask;
+    
+    page_cache_page_t* cold;
+    page_cache_page_t* hot;
+    uint64_t cold_count;
+    uint64_t hot_count;
+    uint64_t cold_target;       // Adapted on ghost hits and expiries
+    uint64_t max_pages;
+    
+    page_cache_page_t* dirty_head;
+    page_cache_page_t* dirty_tail;
+    uint64_t dirty_count;
+    bool flush_wanted;          // Dirty pages are holding up eviction
+    
+    page_cache_stats_t stats;
+} g_page_cache;
+
+static spinlock_t g_page_cache_lock = SPINLOCK_INIT;
+static spinlock_t g_page_cache_init_lock = SPINLOCK_INIT;
+
+static const page_cache_ops_t g_page_cache_device_ops;
+
+// Readahead completions can run in interrupt handlers
+static inline uint64_t page_cache_lock(void) {
+    uint64_t irq = cpu_irq_save();
+    spinlock_acquire(&g_page_cache_lock);
+    return irq;
+}
+
+static inline void page_cache_unlock(uint64_t irq) {
+    spinlock_release(&g_page_cache_lock);
+    cpu_irq_restore(irq);
+}
+
+// =============================================================================
+// Hashing
+// =============================================================================
+
+static inline uint64_t page_cache_mix(uint64_t a, uint64_t b) {
+    uint64_t h = (a ^ (b * 0x9E3779B97F4A7C15ULL)) * 0xFF51AFD7ED558CCDULL;
+    return h ^ (h >> 32);
+}
+
+static inline uint32_t page_cache_bucket(page_cache_mapping_t* mapping, uint64_t index) {
+    return (uint32_t)page_cache_mix((uint64_t)(uintptr_t)mapping, index) &
+           (PAGE_CACHE_BUCKETS - 1);
+}
+
+static inline uint32_t page_cache_map_bucket(void* owner, uint64_t key) {
+    return (uint32_t)page_cache_mix((uint64_t)(uintptr_t)owner, key) &
+           (PAGE_CACHE_MAP_BUCKETS - 1);
+}
+
+static page_cache_page_t* page_cache_lookup(page_cache_mapping_t* mapping, uint64_t index) {
+    page_cache_page_t* page = g_page_cache.buckets[page_cache_bucket(mapping, index)];
+    while (page && (page->mapping != mapping || page->index != index)) {
+        page = page->hash_next;
+    }
+    return page;
+}
+
+static void page_cache_hash_remove(page_cache_page_t* page) {
+    page_cache_page_t** link = &g_page_cache.buckets[page_cache_bucket(page->mapping,
+                                                                       page->index)];
+    while (*link && *link != page) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = page->hash_next;
+    }
+    page->hash_next = NULL;
+}
+
+// =============================================================================
+// Clocks and Ghosts
+// =============================================================================
+
+// Just behind the hand, so it's the last page the hand reaches
+static void page_cache_clock_insert(page_cache_page_t** hand, page_cache_page_t* page) {
+    if (!*hand) {
+        page->prev = page;
+        page->next = page;
+        *hand = page;
+        return;
+    }
+    page->next = *hand;
+    page->prev = (*hand)->prev;
+    (*hand)->prev->next = page;
+    (*hand)->prev = page;
+}
+
+static void page_cache_clock_remove(page_cache_page_t** hand, page_cache_page_t* page) {
+    if (page->next == page) {
+        *hand = NULL;
+    } else {
+        page->prev->next = page->next;
+        page->next->prev = page->prev;
+        if (*hand == page) {
+            *hand = page->next;
+        }
+    }
+    page->prev = NULL;
+    page->next = NULL;
+}
+
+static inline uint64_t page_cache_signature(page_cache_mapping_t* mapping, uint64_t index) {
+    return page_cache_mix((uint64_t)(uintptr_t)mapping ^ 0x5851F42D4C957F2DULL, index) | 1;
+}
+
+static inline uint64_t* page_cache_ghost_slot(uint64_t signature) {
+    return &g_page_cache.ghosts[(signature >> 24) & g_page_cache.ghost_mask];
+}
+
+// Start an evicted page's test period. Displacing another ghost ends that
+// one's without a refault, which argues for fewer cold pages.
+static void page_cache_remember(page_cache_page_t* page) {
+    uint64_t signature = page_cache_signature(page->mapping, page->index);
+    uint64_t* slot = page_cache_ghost_slot(signature);
+    if (*slot && *slot != signature && g_page_cache.cold_target > PAGE_CACHE_MIN_COLD) {
+        g_page_cache.cold_target--;
+    }
+    *slot = signature;
+}
+
+// A refault within the test period: the page was evicted too early, so it
+// comes back hot and the cold share grows
+static bool page_cache_recall(page_cache_mapping_t* mapping, uint64_t index) {
+    uint64_t signature = page_cache_signature(mapping, index);
+    uint64_t* slot = page_cache_ghost_slot(signature);
+    if (*slot != signature) {
+        return false;
+    }
+    
+    *slot = 0;
+    if (g_page_cache.cold_target + PAGE_CACHE_MIN_COLD < g_page_cache.max_pages) {
+        g_page_cache.cold_target++;
+    }
+    g_page_cache.stats.ghost_hits++;
+    return true;
+}
+
+// =============================================================================
+// Dirty List
+// =============================================================================
+
+static void page_cache_dirty_insert(page_cache_page_t* page) {
+    page->flags |= PAGE_CACHE_DIRTY;
+    page->dirtied = continuum_get_time();
+    page->dirty_next = NULL;
+    page->dirty_prev = g_page_cache.dirty_tail;
+    if (g_page_cache.dirty_tail) {
+        g_page_cache.dirty_tail->dirty_next = page;
+    } else {
+        g_page_cache.dirty_head = page;
+    }
+    g_page_cache.dirty_tail = page;
+    page->mapping->dirty++;
+    g_page_cache.dirty_count++;
+    
+    uint64_t resident = g_page_cache.cold_count + g_page_cache.hot_count;
+    if (g_page_cache.dirty_count * 100 > resident * PAGE_CACHE_DIRTY_PCT) {
+        g_page_cache.flush_wanted = true;
+    }
+}
+
+static void page_cache_dirty_remove(page_cache_page_t* page) {
+    if (page->dirty_prev) {
+        page->dirty_prev->dirty_next = page->dirty_next;
+    } else {
+        g_page_cache.dirty_head = page->dirty_next;
+    }
+    if (page->dirty_next) {
+        page->dirty_next->dirty_prev = page->dirty_prev;
+    } else {
+        g_page_cache.dirty_tail = page->dirty_prev;
+    }
+    page->dirty_prev = NULL;
+    page->dirty_next = NULL;
+    page->flags &= ~PAGE_CACHE_DIRTY;
+    page->mapping->dirty--;
+    g_page_cache.dirty_count--;
+}
+
+// =============================================================================
+// Replacement
+// =============================================================================
+
+// Run the hands until count clean, unused pages are off the clocks or a
+// full sweep turned up nothing. Victims come back chained through
+// hash_next for the caller to free once the lock is dropped.
+static page_cache_page_t* page_cache_evict(uint64_t count) {
+    page_cache_page_t* victims = NULL;
+    uint64_t found = 0;
+    uint64_t steps = 2 * (g_page_cache.cold_count + g_page_cache.hot_count) + 1;
+    
+    while (found < count && steps-- > 0) {
+        // Hot hand: demote unreferenced hot pages until the hot share fits
+        // beside the cold target
+        page_cache_page_t* page = g_page_cache.hot;
+        if (page && (!g_page_cache.cold ||
+                     g_page_cache.hot_count + g_page_cache.cold_target > g_page_cache.max_pages)) {
+            if (page->flags & PAGE_CACHE_REFERENCED) {
+                page->flags &= ~PAGE_CACHE_REFERENCED;
+                g_page_cache.hot = page->next;
+            } else {
+                page_cache_clock_remove(&g_page_cache.hot, page);
+                g_page_cache.hot_count--;
+                page->flags &= ~PAGE_CACHE_HOT;
+                page_cache_clock_insert(&g_page_cache.cold, page);
+                g_page_cache.cold_count++;
+            }
+            continue;
+        }
+        
+        // Cold hand
+        page = g_page_cache.cold;
+        if (!page) {
+            break;
+        }
+        if (page->refs || (page->flags & (PAGE_CACHE_IO | PAGE_CACHE_WRITEBACK |
+                                          PAGE_CACHE_DIRTY))) {
+            if (page->flags & PAGE_CACHE_DIRTY) {
+                g_page_cache.flush_wanted = true;
+            }
+            g_page_cache.cold = page->next;
+            continue;
+        }
+        if (page->flags & PAGE_CACHE_REFERENCED) {
+            // Reused while cold: promote
+            page->flags = (page->flags & ~PAGE_CACHE_REFERENCED) | PAGE_CACHE_HOT;
+            page_cache_clock_remove(&g_page_cache.cold, page);
+            g_page_cache.cold_count--;
+            page_cache_clock_insert(&g_page_cache.hot, page);
+            g_page_cache.hot_count++;
+            continue;
+        }
+        
+        page_cache_clock_remove(&g_page_cache.cold, page);
+        g_page_cache.cold_count--;
+        page_cache_hash_remove(page);
+        page->mapping->pages--;
+        page_cache_remember(page);
+        page->hash_next = victims;
+        victims = page;
+        found++;
+    }
+    
+    g_page_cache.stats.evictions += found;
+    return victims;
+}
+
+// Keep the cache within max_pages, and stop it growing at all while flux
+// is short of memory
+static page_cache_page_t* page_cache_trim(void) {
+    uint64_t resident = g_page_cache.cold_count + g_page_cache.hot_count;
+    if (resident > g_page_cache.max_pages) {
+        return page_cache_evict(resident - g_page_cache.max_pages);
+    }
+    if (resident > PAGE_CACHE_MIN_PAGES && flux_memory_low()) {
+        return page_cache_evict(1);
+    }
+    return NULL;
+}
+
+static page_cache_page_t* page_cache_alloc_page(void) {
+    page_cache_page_t* page = flux_allocate(NULL, sizeof(page_cache_page_t),
+                                            FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!page) {
+        return NULL;
+    }
+    
+    // A whole frame of its own, so it can be mapped into a domain
+    page->data = flux_allocate(NULL, PAGE_CACHE_PAGE_SIZE, FLUX_ALLOC_KERNEL | FLUX_ALLOC_LARGE);
+    if (!page->data) {
+        flux_free(page);
+        return NULL;
+    }
+    return page;
+}
+
+// Free a chain of evicted pages; returns how many there were
+static size_t page_cache_free_pages(page_cache_page_t* page) {
+    size_t count = 0;
+    while (page) {
+        page_cache_page_t* next = page->hash_next;
+        flux_free(page->data);
+        flux_free(page);
+        page = next;
+        count++;
+    }
+    return count;
+}
+
+// flux shrinker: give back clean pages when memory runs low
+static size_t page_cache_shrink(size_t pages, void* context) {
+    (void)context;
+    
+    uint64_t irq = page_cache_lock();
+    page_cache_page_t* victims = page_cache_evict(pages);
+    page_cache_unlock(irq);
+    
+    size_t freed = page_cache_free_pages(victims);
+    __atomic_fetch_add(&g_page_cache.stats.reclaimed, freed, __ATOMIC_RELAXED);
+    return freed;
+}
+
+// =============================================================================
+// Writeback
+// =============================================================================
+
+// Write back the dirty pages of mapping (of every mapping when NULL) that
+// were dirtied at or before the TSC time before, oldest first. A page that
+// fails goes back on the dirty list as if newly dirtied, and ends the pass.
+static int page_cache_writeback(page_cache_mapping_t* mapping, uint64_t before) {
+    int result = 0;
+    
+    while (result == 0) {
+        page_cache_page_t* batch[PAGE_CACHE_FLUSH_BATCH];
+        int status[PAGE_CACHE_FLUSH_BATCH];
+        uint32_t count = 0;
+        
+        uint64_t irq = page_cache_lock();
+        page_cache_page_t* page = g_page_cache.dirty_head;
+        while (page && page->dirtied <= before && count < PAGE_CACHE_FLUSH_BATCH) {
+            page_cache_page_t* next = page->dirty_next;
+            if ((!mapping || page->mapping == mapping) &&
+                !(page->flags & PAGE_CACHE_WRITEBACK)) {
+                page_cache_dirty_remove(page);
+                page->flags |= PAGE_CACHE_WRITEBACK;
+                page->refs++;
+                batch[count++] = page;
+            }
+            page = next;
+        }
+        page_cache_unlock(irq);
+        
+        if (count == 0) {
+            break;
+        }
+        
+        // Writers may keep changing a page while it's written; they just
+        // make it dirty again
+        for (uint32_t i = 0; i < count; i++) {
+            page_cache_mapping_t* owner = batch[i]->mapping;
+            status[i] = owner->ops->write_page(owner, batch[i]->index, batch[i]->data);
+        }
+        
+        irq = page_cache_lock();
+        for (uint32_t i = 0; i < count; i++) {
+            page = batch[i];
+            page->flags &= ~PAGE_CACHE_WRITEBACK;
+            page->refs--;
+            if (status[i] == 0) {
+                g_page_cache.stats.writebacks++;
+            } else {
+                g_page_cache.stats.write_errors++;
+                if (!(page->flags & PAGE_CACHE_DIRTY)) {
+                    page_cache_dirty_insert(page);
+                }
+                result = -1;
+            }
+        }
+        page_cache_unlock(irq);
+    }
+    
+    return result;
+}
+
+int page_cache_sync(page_cache_mapping_t* mapping) {
+    if (!__atomic_load_n(&g_page_cache.initialized, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    return page_cache_writeback(mapping, continuum_get_time());
+}
+
+// kflushd: write back pages once they've been dirty for a while, and
+// everything at once when dirty pages start holding up eviction
+static void page_cache_flush_main(void) {
+    uint64_t period = continuum_usec_to_tsc(PAGE_CACHE_FLUSH_PERIOD);
+    uint64_t expire = continuum_usec_to_tsc(PAGE_CACHE_DIRTY_EXPIRE);
+    uint64_t last_pass = 0;
+    
+    while (1) {
+        uint64_t now = continuum_get_time();
+        if (__atomic_exchange_n(&g_page_cache.flush_wanted, false, __ATOMIC_RELAXED)) {
+            page_cache_writeback(NULL, now);
+            last_pass = now;
+        } else if (now - last_pass >= period) {
+            last_pass = now;
+            if (now > expire) {
+                page_cache_writeback(NULL, now - expire);
+            }
+        }
+        temporal_yield(temporal_get_current());
+    }
+}
+
+static void page_cache_start_flusher(void) {
+    quantum_id_t qid = continuum_create_quantum(ABI_MODE_NATIVE,
+                                                (void*)page_cache_flush_main,
+                                                "kflushd");
+    quantum_context_t* quantum = continuum_get_quantum(qid);
+    if (!quantum) {
+        return;
+    }
+    
+    quantum->scheduling.priority = PRIORITY_LOW;
+    temporal_enqueue(quantum);
+}
+
+// =============================================================================
+// Initialization
+// =============================================================================
+
+// Done on first use, once a filesystem or driver asks for a mapping
+static bool page_cache_init(void) {
+    if (__atomic_load_n(&g_page_cache.initialized, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+    
+    spinlock_acquire(&g_page_cache_init_lock);
+    if (!g_page_cache.initialized) {
+        flux_stats_t memory;
+        flux_get_stats(&memory);
+        g_page_cache.max_pages = memory.total_memory / PAGE_CACHE_PAGE_SIZE *
+                                 PAGE_CACHE_MAX_PCT / 100;
+        if (g_page_cache.max_pages < PAGE_CACHE_MIN_PAGES) {
+            g_page_cache.max_pages = PAGE_CACHE_MIN_PAGES;
+        }
+        g_page_cache.cold_target = g_page_cache.max_pages / 2;
+        
+        uint64_t ghosts = PAGE_CACHE_GHOSTS_MIN;
+        while (ghosts < g_page_cache.max_pages && ghosts < PAGE_CACHE_GHOSTS_MAX) {
+            ghosts <<= 1;
+        }
+        g_page_cache.ghost_mask = ghosts - 1;
+        
+        g_page_cache.buckets = flux_allocate(NULL, PAGE_CACHE_BUCKETS * sizeof(page_cache_page_t*),
+                                             FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+        g_page_cache.mappings = flux_allocate(NULL,
+                                              PAGE_CACHE_MAP_BUCKETS * sizeof(page_cache_mapping_t*),
+                                              FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+        g_page_cache.ghosts = flux_allocate(NULL, ghosts * sizeof(uint64_t),
+                                            FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO |
+                                            FLUX_ALLOC_LARGE);
+        if (!g_page_cache.buckets || !g_page_cache.mappings || !g_page_cache.ghosts) {
+            flux_free(g_page_cache.buckets);
+            flux_free(g_page_cache.mappings);
+            flux_free(g_page_cache.ghosts);
+            spinlock_release(&g_page_cache_init_lock);
+            return false;
+        }
+        
+        flux_register_shrinker(page_cache_shrink, NULL);
+        page_cache_start_flusher();
+        __atomic_store_n(&g_page_cache.initialized, true, __ATOMIC_RELEASE);
+    }
+    spinlock_release(&g_page_cache_init_lock);
+    return true;
+}
+
+// =============================================================================
+// Mappings
+// =============================================================================
+
+static page_cache_mapping_t* page_cache_find_mapping(void* owner, uint64_t key) {
+    page_cache_mapping_t* mapping = g_page_cache.mappings[page_cache_map_bucket(owner, key)];
+    while (mapping && (mapping->owner != owner || mapping->key != key)) {
+        mapping = mapping->hash_next;
+    }
+    return mapping;
+}
+
+// The mapping for (owner, key), created on first use. It stays until
+// page_cache_drop_owner.
+page_cache_mapping_t* page_cache_get_mapping(void* owner, uint64_t key,
+                                             const page_cache_ops_t* ops,
+                                             void* private_data) {
+    if (!owner || !ops || !ops->read_page || !page_cache_init()) {
+        return NULL;
+    }
+    
+    uint64_t irq = page_cache_lock();
+    page_cache_mapping_t* mapping = page_cache_find_mapping(owner, key);
+    page_cache_unlock(irq);
+    if (mapping) {
+        return mapping;
+    }
+    
+    page_cache_mapping_t* fresh = flux_allocate(NULL, sizeof(page_cache_mapping_t),
+                                                FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!fresh) {
+        return NULL;
+    }
+    fresh->owner = owner;
+    fresh->key = key;
+    fresh->ops = ops;
+    fresh->private_data = private_data;
+    
+    irq = page_cache_lock();
+    mapping = page_cache_find_mapping(owner, key);
+    if (!mapping) {
+        uint32_t bucket = page_cache_map_bucket(owner, key);
+        fresh->hash_next = g_page_cache.mappings[bucket];
+        g_page_cache.mappings[bucket] = fresh;
+        mapping = fresh;
+        fresh = NULL;
+    }
+    page_cache_unlock(irq);
+    
+    if (fresh) {
+        flux_free(fresh);
+    }
+    return mapping;
+}
+
+page_cache_mapping_t* page_cache_device(block_device_t* device) {
+    if (!device) {
+        return NULL;
+    }
+    return page_cache_get_mapping(device, PAGE_CACHE_DEVICE_KEY, &g_page_cache_device_ops,
+                                  device);
+}
+
+// Take every page of owner's mappings off a clock, chaining them onto victims
+static page_cache_page_t* page_cache_strip(page_cache_page_t** hand, uint64_t* count,
+                                           void* owner, page_cache_page_t* victims) {
+    page_cache_page_t* page = *hand;
+    for (uint64_t n = *count; n > 0; n--) {
+        page_cache_page_t* next = page->next;
+        if (page->mapping->owner == owner) {
+            page_cache_clock_remove(hand, page);
+            (*count)--;
+            page_cache_hash_remove(page);
+            if (page->flags & PAGE_CACHE_DIRTY) {
+                page_cache_dirty_remove(page);
+            }
+            page->hash_next = victims;
+            victims = page;
+        }
+        page = next;
+    }
+    return victims;
+}
+
+// Write back and forget everything cached for owner: a filesystem being
+// unmounted, or a block device going away. Nobody may still hold its pages.
+void page_cache_drop_owner(void* owner) {
+    if (!owner || !__atomic_load_n(&g_page_cache.initialized, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    
+    // Unhash the mappings first so no new pages come in under them
+    page_cache_mapping_t* dropped = NULL;
+    uint64_t irq = page_cache_lock();
+    for (uint32_t i = 0; i < PAGE_CACHE_MAP_BUCKETS; i++) {
+        page_cache_mapping_t** link = &g_page_cache.mappings[i];
+        while (*link) {
+            page_cache_mapping_t* mapping = *link;
+            if (mapping->owner == owner) {
+                *link = mapping->hash_next;
+                mapping->hash_next = dropped;
+                dropped = mapping;
+            } else {
+                link = &mapping->hash_next;
+            }
+        }
+    }
+    page_cache_unlock(irq);
+    
+    for (page_cache_mapping_t* mapping = dropped; mapping; mapping = mapping->hash_next) {
+        if (mapping->dirty) {
+            page_cache_writeback(mapping, UINT64_MAX);
+        }
+    }
+    
+    irq = page_cache_lock();
+    page_cache_page_t* victims = page_cache_strip(&g_page_cache.cold, &g_page_cache.cold_count,
+                                                  owner, NULL);
+    victims = page_cache_strip(&g_page_cache.hot, &g_page_cache.hot_count, owner, victims);
+    page_cache_unlock(irq);
+    
+    page_cache_free_pages(victims);
+    while (dropped) {
+        page_cache_mapping_t* next = dropped->hash_next;
+        flux_free(dropped);
+        dropped = next;
+    }
+}
+
+// =============================================================================
+// Pages
+// =============================================================================
+
+// Polls for PAGE_CACHE_POLL_SPIN microseconds, then yields between checks
+static void page_cache_wait_io(page_cache_page_t* page) {
+    uint64_t spin_until = continuum_get_time() + continuum_usec_to_tsc(PAGE_CACHE_POLL_SPIN);
+    while (__atomic_load_n(&page->flags, __ATOMIC_ACQUIRE) & PAGE_CACHE_IO) {
+        if (continuum_get_time() >= spin_until) {
+            quantum_context_t* current = temporal_get_current();
+            if (current) {
+                temporal_yield(current);
+            }
+        } else {
+            __asm__ __volatile__("pause");
+        }
+    }
+}
+
+// Hash a new page and put it on a clock, being read in (IO set). A
+// refault of a recently evicted page goes straight to the hot clock.
+// Returns whatever had to be evicted to make room; caller holds the lock.
+static page_cache_page_t* page_cache_insert(page_cache_page_t* page,
+                                            page_cache_mapping_t* mapping, uint64_t index,
+                                            uint32_t flags) {
+    page->mapping = mapping;
+    page->index = index;
+    page->flags = PAGE_CACHE_IO | flags;
+    
+    uint32_t bucket = page_cache_bucket(mapping, index);
+    page->hash_next = g_page_cache.buckets[bucket];
+    g_page_cache.buckets[bucket] = page;
+    if (page_cache_recall(mapping, index)) {
+        page->flags |= PAGE_CACHE_HOT;
+        page_cache_clock_insert(&g_page_cache.hot, page);
+        g_page_cache.hot_count++;
+    } else {
+        page_cache_clock_insert(&g_page_cache.cold, page);
+        g_page_cache.cold_count++;
+    }
+    mapping->pages++;
+    
+    return page_cache_trim();
+}
+
+page_cache_page_t* page_cache_get(page_cache_mapping_t* mapping, uint64_t index) {
+    if (!mapping) {
+        return NULL;
+    }
+    
+    page_cache_page_t* fresh = NULL;
+    page_cache_page_t* victims = NULL;
+    bool fill = false;
+    
+    uint64_t irq = page_cache_lock();
+    page_cache_page_t* page = page_cache_lookup(mapping, index);
+    if (!page) {
+        page_cache_unlock(irq);
+        fresh = page_cache_alloc_page();
+        if (!fresh) {
+            return NULL;
+        }
+        irq = page_cache_lock();
+        page = page_cache_lookup(mapping, index);   // Raced in meanwhile?
+    }
+    
+    if (page) {
+        page->refs++;
+        page->flags |= PAGE_CACHE_REFERENCED;
+        g_page_cache.stats.hits++;
+        
+        // An earlier read of it failed; this caller retries
+        if (!(page->flags & (PAGE_CACHE_UPTODATE | PAGE_CACHE_IO))) {
+            page->flags |= PAGE_CACHE_IO;
+            fill = true;
+        }
+    } else {
+        page = fresh;
+        fresh = NULL;
+        page->refs = 1;
+        victims = page_cache_insert(page, mapping, index, 0);
+        g_page_cache.stats.misses++;
+        fill = true;
+    }
+    page_cache_unlock(irq);
+    
+    page_cache_free_pages(victims);
+    if (fresh) {
+        fresh->hash_next = NULL;
+        page_cache_free_pages(fresh);
+    }
+    
+    if (fill) {
+        page_cache_end_read(page, mapping->ops->read_page(mapping, index, page->data));
+    } else {
+        page_cache_wait_io(page);
+    }
+    
+    if (!(__atomic_load_n(&page->flags, __ATOMIC_ACQUIRE) & PAGE_CACHE_UPTODATE)) {
+        page_cache_put(page);
+        return NULL;
+    }
+    return page;
+}
+
+void page_cache_put(page_cache_page_t* page) {
+    if (!page) {
+        return;
+    }
+    
+    uint64_t irq = page_cache_lock();
+    page->refs--;
+    page_cache_unlock(irq);
+}
+
+void page_cache_mark_dirty(page_cache_page_t* page) {
+    if (!page || !page->mapping->ops->write_page) {
+        return;
+    }
+    
+    uint64_t irq = page_cache_lock();
+    if (!(page->flags & PAGE_CACHE_DIRTY)) {
+        page_cache_dirty_insert(page);
+    }
+    page_cache_unlock(irq);
+}
+
+// Finish reading a page in: wakes everyone waiting on it. A failed page
+// stays cached but not up to date, and the next lookup retries it.
+void page_cache_end_read(page_cache_page_t* page, int status) {
+    uint64_t irq = page_cache_lock();
+    if (status == 0) {
+        page->flags |= PAGE_CACHE_UPTODATE;
+    } else {
+        g_page_cache.stats.read_errors++;
+    }
+    __atomic_and_fetch(&page->flags, ~PAGE_CACHE_IO, __ATOMIC_RELEASE);
+    page_cache_unlock(irq);
+}
+
+// =============================================================================
+// Byte Ranges
+// =============================================================================
+
+int page_cache_read(page_cache_mapping_t* mapping, uint64_t offset, void* buffer,
+                    size_t length) {
+    uint8_t* dest = (uint8_t*)buffer;
+    
+    while (length > 0) {
+        size_t in_page = offset % PAGE_CACHE_PAGE_SIZE;
+        size_t chunk = PAGE_CACHE_PAGE_SIZE - in_page;
+        if (chunk > length) {
+            chunk = length;
+        }
+        
+        page_cache_page_t* page = page_cache_get(mapping, offset / PAGE_CACHE_PAGE_SIZE);
+        if (!page) {
+            return -1;
+        }
+        memcpy(dest, (uint8_t*)page->data + in_page, chunk);
+        page_cache_put(page);
+        
+        dest += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+// =============================================================================
+// Vectors
+// =============================================================================
+
+// Returns the bytes the vector holds
+size_t page_cache_iter_init(page_cache_iter_t* iter, const page_cache_iovec_t* iov,
+                            uint32_t count) {
+    iter->iov = iov;
+    iter->count = count;
+    iter->skip = 0;
+    
+    size_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        total += iov[i].length;
+    }
+    return total;
+}
+
+// Copy length bytes between data and the vector, advancing it; false if it
+// ran out first
+static bool page_cache_iter_copy(page_cache_iter_t* iter, void* data, size_t length,
+                                 bool to_iter) {
+    uint8_t* bytes = (uint8_t*)data;
+    
+    while (length > 0) {
+        if (iter->count == 0) {
+            return false;
+        }
+        
+        size_t chunk = iter->iov->length - iter->skip;
+        if (chunk > length) {
+            chunk = length;
+        }
+        uint8_t* segment = (uint8_t*)iter->iov->base + iter->skip;
+        if (to_iter) {
+            memcpy(segment, bytes, chunk);
+        } else {
+            memcpy(bytes, segment, chunk);
+        }
+        bytes += chunk;
+        length -= chunk;
+        
+        iter->skip += chunk;
+        if (iter->skip == iter->iov->length) {
+            iter->iov++;
+            iter->count--;
+            iter->skip = 0;
+        }
+    }
+    return true;
+}
+
+// Writes land in the cache and reach the device through writeback (or
+// page_cache_sync)
+int page_cache_writev(page_cache_mapping_t* mapping, uint64_t offset, page_cache_iter_t* iter,
+                      size_t length) {
+    if (!mapping || !iter || !mapping->ops->write_page) {
+        return -1;
+    }
+    
+    while (length > 0) {
+        size_t in_page = offset % PAGE_CACHE_PAGE_SIZE;
+        size_t chunk = PAGE_CACHE_PAGE_SIZE - in_page;
+        if (chunk > length) {
+            chunk = length;
+        }
+        
+        page_cache_page_t* page = page_cache_get(mapping, offset / PAGE_CACHE_PAGE_SIZE);
+        if (!page) {
+            return -1;
+        }
+        bool copied = page_cache_iter_copy(iter, (uint8_t*)page->data + in_page, chunk, false);
+        if (copied) {
+            page_cache_mark_dirty(page);
+        }
+        page_cache_put(page);
+        if (!copied) {
+            return -1;
+        }
+        
+        offset += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+int page_cache_write(page_cache_mapping_t* mapping, uint64_t offset, const void* buffer,
+                     size_t length) {
+    page_cache_iovec_t iov = { (void*)buffer, length };
+    page_cache_iter_t iter;
+    page_cache_iter_init(&iter, &iov, 1);
+    return page_cache_writev(mapping, offset, &iter, length);
+}
+
+// =============================================================================
+// Readahead
+// =============================================================================
+
+// First window for a reader that wants request pages: a few times the
+// request while it's small, never past PAGE_CACHE_RA_MAX
+static uint32_t page_cache_ra_initial(uint32_t request) {
+    uint32_t size = 1;
+    while (size < request && size < PAGE_CACHE_RA_MAX) {
+        size <<= 1;
+    }
+    
+    if (size <= PAGE_CACHE_RA_MAX / 32) {
+        size *= 4;
+    } else if (size <= PAGE_CACHE_RA_MAX / 4) {
+        size *= 2;
+    } else {
+        size = PAGE_CACHE_RA_MAX;
+    }
+    return size < PAGE_CACHE_RA_MIN ? PAGE_CACHE_RA_MIN : size;
+}
+
+static uint32_t page_cache_ra_next(uint32_t size) {
+    size = size < PAGE_CACHE_RA_MAX / 16 ? size * 4 : size * 2;
+    return size > PAGE_CACHE_RA_MAX ? PAGE_CACHE_RA_MAX : size;
+}
+
+// Start reading whichever pages of [start, start + count) aren't cached,
+// all in one read_pages call. The page at marker is flagged so the reader
+// reaching it opens the next window.
+static void page_cache_read_window(page_cache_mapping_t* mapping, uint64_t start,
+                                   uint32_t count, uint64_t marker) {
+    if (mapping->size) {
+        uint64_t end = (mapping->size + PAGE_CACHE_PAGE_SIZE - 1) / PAGE_CACHE_PAGE_SIZE;
+        if (start >= end) {
+            return;
+        }
+        if (start + count > end) {
+            count = (uint32_t)(end - start);
+        }
+    }
+    if (count > PAGE_CACHE_RA_MAX) {
+        count = PAGE_CACHE_RA_MAX;
+    }
+    
+    page_cache_page_t* batch[PAGE_CACHE_RA_MAX];
+    uint32_t batched = 0;
+    
+    for (uint64_t index = start; index < start + count; index++) {
+        uint32_t flags = index == marker ? PAGE_CACHE_READAHEAD : 0;
+        
+        uint64_t irq = page_cache_lock();
+        page_cache_page_t* page = page_cache_lookup(mapping, index);
+        if (page) {
+            page->flags |= flags;
+            page_cache_unlock(irq);
+            continue;
+        }
+        page_cache_unlock(irq);
+        
+        page_cache_page_t* fresh = page_cache_alloc_page();
+        if (!fresh) {
+            break;
+        }
+        
+        page_cache_page_t* victims = NULL;
+        irq = page_cache_lock();
+        page = page_cache_lookup(mapping, index);
+        if (page) {
+            page->flags |= flags;
+        } else {
+            victims = page_cache_insert(fresh, mapping, index, flags);
+            batch[batched++] = fresh;
+            fresh = NULL;
+        }
+        page_cache_unlock(irq);
+        
+        page_cache_free_pages(victims);
+        if (fresh) {
+            page_cache_free_pages(fresh);
+        }
+    }
+    
+    if (batched == 0) {
+        return;
+    }
+    
+    uint64_t irq = page_cache_lock();
+    g_page_cache.stats.readahead_windows++;
+    g_page_cache.stats.readahead_pages += batched;
+    page_cache_unlock(irq);
+    
+    if (mapping->ops->read_pages(mapping, batch, batched) != 0) {
+        for (uint32_t i = 0; i < batched; i++) {
+            page_cache_end_read(batch[i], -1);
+        }
+    }
+}
+
+// Called before page index is read, with remaining pages still to come in
+// this request. A miss that continues a sequential run opens a window
+// (bigger each time) around it; hitting the marker page opens the next
+// window asynchronously, so the reader never waits on a sequential stream
+// once it's going. Random multi-page reads just get batched.
+static void page_cache_ondemand(page_cache_mapping_t* mapping, page_cache_ra_t* ra,
+                                uint64_t index, uint32_t remaining) {
+    if (!mapping->ops->read_pages || flux_memory_low()) {
+        return;
+    }
+    
+    uint64_t irq = page_cache_lock();
+    page_cache_page_t* page = page_cache_lookup(mapping, index);
+    bool trigger = page && (page->flags & PAGE_CACHE_READAHEAD);
+    if (trigger) {
+        page->flags &= ~PAGE_CACHE_READAHEAD;
+    }
+    page_cache_unlock(irq);
+    
+    bool first = ra->next_index == 0;
+    bool sequential = !first && (index == ra->next_index || index + 1 == ra->next_index);
+    ra->next_index = index + 1;
+    
+    if (trigger) {
+        // Carry on where the current window ends, unless the reader jumped
+        // onto a marker some other stream left
+        uint64_t expected = ra->start + ra->size - ra->async_size;
+        ra->start = index == expected ? ra->start + ra->size : index + 1;
+        ra->size = page_cache_ra_next(ra->size);
+        ra->async_size = ra->size;
+        page_cache_read_window(mapping, ra->start, ra->size, ra->start);
+    } else if (!page) {
+        if (sequential || (first && index == 0)) {
+            ra->size = sequential && ra->size ? page_cache_ra_next(ra->size) :
+                                                page_cache_ra_initial(remaining);
+            ra->start = index;
+            ra->async_size = ra->size > remaining ? ra->size - remaining : 0;
+            page_cache_read_window(mapping, ra->start, ra->size,
+                                   ra->async_size ? ra->start + ra->size - ra->async_size :
+                                                    UINT64_MAX);
+        } else if (remaining > 1) {
+            ra->size = 0;
+            page_cache_read_window(mapping, index, remaining, UINT64_MAX);
+        }
+    }
+}
+
+int page_cache_readv(page_cache_mapping_t* mapping, page_cache_ra_t* ra, uint64_t offset,
+                     page_cache_iter_t* iter, size_t length) {
+    if (!mapping || !iter) {
+        return -1;
+    }
+    if (!ra) {
+        ra = &mapping->ra;
+    }
+    
+    uint64_t last = length ? (offset + length - 1) / PAGE_CACHE_PAGE_SIZE : 0;
+    
+    while (length > 0) {
+        uint64_t index = offset / PAGE_CACHE_PAGE_SIZE;
+        size_t in_page = offset % PAGE_CACHE_PAGE_SIZE;
+        size_t chunk = PAGE_CACHE_PAGE_SIZE - in_page;
+        if (chunk > length) {
+            chunk = length;
+        }
+        
+        uint64_t remaining = last - index + 1;
+        page_cache_ondemand(mapping, ra, index,
+                            remaining > UINT32_MAX ? UINT32_MAX : (uint32_t)remaining);
+        
+        page_cache_page_t* page = page_cache_get(mapping, index);
+        if (!page) {
+            return -1;
+        }
+        bool copied = page_cache_iter_copy(iter, (uint8_t*)page->data + in_page, chunk, true);
+        page_cache_put(page);
+        if (!copied) {
+            return -1;
+        }
+        
+        offset += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+int page_cache_read_ahead(page_cache_mapping_t* mapping, page_cache_ra_t* ra, uint64_t offset,
+                          void* buffer, size_t length) {
+    page_cache_iovec_t iov = { buffer, length };
+    page_cache_iter_t iter;
+    page_cache_iter_init(&iter, &iov, 1);
+    return page_cache_readv(mapping, ra, offset, &iter, length);
+}
+
+// =============================================================================
+// Memory Mappings
+// =============================================================================
+
+// Fault-around for a mapping touched out of order: the pages just after
+// the faulting one come in with it
+#define PAGE_CACHE_FAULT_AROUND PAGE_CACHE_RA_MIN
+
+struct page_cache_vma {
+    page_cache_mapping_t* mapping;
+    struct memory_domain* domain;
+    uint64_t vaddr;
+    uint64_t first;             // Page index mapped at vaddr
+    uint64_t count;
+    uint32_t flags;             // FLUX_MAP_*
+    page_cache_ra_t ra;         // Faults count as reads for readahead
+    
+    spinlock_t lock;            // pages and written
+    page_cache_page_t** pages;  // Held while mapped, NULL until first faulted
+    uint64_t* written;          // Bitmap of pages stored to; shared writable only
+};
+
+static inline bool page_cache_vma_shared_write(page_cache_vma_t* vma) {
+    return (vma->flags & FLUX_MAP_SHARED) && (vma->flags & FLUX_MAP_WRITE);
+}
+
+// flux fault hook: hold the page for the life of the mapping and hand flux
+// its frame. Private mappings get it copy-on-write; shared ones get it
+// read-only until the first store, which is what marks it dirty.
+static int page_cache_vma_fault(void* private_data, uint64_t vaddr, bool write,
+                                uint64_t* paddr, uint32_t* flags) {
+    page_cache_vma_t* vma = private_data;
+    page_cache_mapping_t* mapping = vma->mapping;
+    uint64_t slot = (vaddr - vma->vaddr) / PAGE_CACHE_PAGE_SIZE;
+    uint64_t index = vma->first + slot;
+    
+    if (mapping->size && index * PAGE_CACHE_PAGE_SIZE >= mapping->size) {
+        return -EFAULT;     // Past the end of the file
+    }
+    
+    spinlock_acquire(&vma->lock);
+    page_cache_page_t* page = vma->pages[slot];
+    spinlock_release(&vma->lock);
+    
+    if (!page) {
+        uint64_t left = vma->count - slot;
+        page_cache_ondemand(mapping, &vma->ra, index,
+                            left < PAGE_CACHE_FAULT_AROUND ? (uint32_t)left :
+                                                             PAGE_CACHE_FAULT_AROUND);
+        page_cache_page_t* fresh = page_cache_get(mapping, index);
+        if (!fresh) {
+            return -EFAULT;
+        }
+        
+        // Another CPU may have faulted the same page in meanwhile
+        spinlock_acquire(&vma->lock);
+        page = vma->pages[slot];
+        if (!page) {
+            vma->pages[slot] = page = fresh;
+            fresh = NULL;
+        }
+        spinlock_release(&vma->lock);
+        page_cache_put(fresh);
+        
+        uint64_t irq = page_cache_lock();
+        g_page_cache.stats.map_faults++;
+        page_cache_unlock(irq);
+    }
+    
+    *flags = vma->flags & (FLUX_MAP_READ | FLUX_MAP_EXEC | FLUX_MAP_USER | FLUX_MAP_SHARED);
+    if (page_cache_vma_shared_write(vma)) {
+        if (write) {
+            spinlock_acquire(&vma->lock);
+            vma->written[slot / 64] |= 1ULL << (slot % 64);
+            spinlock_release(&vma->lock);
+            page_cache_mark_dirty(page);
+            *flags |= FLUX_MAP_WRITE;
+        }
+    } else if (vma->flags & FLUX_MAP_WRITE) {
+        *flags |= FLUX_MAP_COW;
+    }
+    
+    // Kernel memory is identity-mapped
+    *paddr = (uint64_t)(uintptr_t)page->data;
+    return 0;
+}
+
+static const flux_region_ops_t g_page_cache_vma_ops = {
+    .fault = page_cache_vma_fault
+};
+
+page_cache_vma_t* page_cache_mmap(page_cache_mapping_t* mapping, struct memory_domain* domain,
+                                  uint64_t vaddr, uint64_t offset, size_t length,
+                                  uint32_t flags) {
+    if (!mapping || !domain || length == 0 ||
+        (vaddr | offset) % PAGE_CACHE_PAGE_SIZE != 0) {
+        return NULL;
+    }
+    if ((flags & FLUX_MAP_SHARED) && (flags & FLUX_MAP_WRITE) && !mapping->ops->write_page) {
+        return NULL;
+    }
+    
+    page_cache_vma_t* vma = flux_allocate(NULL, sizeof(page_cache_vma_t),
+                                          FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!vma) {
+        return NULL;
+    }
+    vma->mapping = mapping;
+    vma->domain = domain;
+    vma->vaddr = vaddr;
+    vma->first = offset / PAGE_CACHE_PAGE_SIZE;
+    vma->count = (length + PAGE_CACHE_PAGE_SIZE - 1) / PAGE_CACHE_PAGE_SIZE;
+    vma->flags = (flags & ~(FLUX_MAP_COW | FLUX_MAP_PRIVATE | FLUX_MAP_HUGE)) | FLUX_MAP_NOHUGE;
+    spinlock_init(&vma->lock);
+    
+    vma->pages = flux_allocate(NULL, vma->count * sizeof(page_cache_page_t*),
+                               FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (page_cache_vma_shared_write(vma)) {
+        vma->written = flux_allocate(NULL, (vma->count + 63) / 64 * sizeof(uint64_t),
+                                     FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    }
+    if (!vma->pages || (page_cache_vma_shared_write(vma) && !vma->written) ||
+        !flux_map_lazy(domain, vaddr, vma->count * PAGE_CACHE_PAGE_SIZE, vma->flags,
+                       &g_page_cache_vma_ops, vma)) {
+        flux_free(vma->pages);
+        flux_free(vma->written);
+        flux_free(vma);
+        return NULL;
+    }
+    return vma;
+}
+
+// Dirty every page stored to since the last call. A page kflushd wrote
+// back while the mapping could still change it gets written again.
+static void page_cache_vma_redirty(page_cache_vma_t* vma) {
+    spinlock_acquire(&vma->lock);
+    for (uint64_t word = 0; word < (vma->count + 63) / 64; word++) {
+        uint64_t bits = vma->written[word];
+        vma->written[word] = 0;
+        while (bits) {
+            uint64_t slot = word * 64 + (uint64_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+            page_cache_mark_dirty(vma->pages[slot]);
+        }
+    }
+    spinlock_release(&vma->lock);
+}
+
+// Write a shared mapping's changes back. Its pages go read-only first, so
+// stores from here on fault and dirty them again.
+int page_cache_msync(page_cache_vma_t* vma) {
+    if (!vma) {
+        return -1;
+    }
+    if (!page_cache_vma_shared_write(vma)) {
+        return 0;
+    }
+    
+    flux_write_protect(vma->domain, vma->vaddr, vma->count * PAGE_CACHE_PAGE_SIZE);
+    page_cache_vma_redirty(vma);
+    return page_cache_sync(vma->mapping);
+}
+
+// Changes to a shared mapping are left dirty for kflushd
+void page_cache_munmap(page_cache_vma_t* vma) {
+    if (!vma) {
+        return;
+    }
+    
+    flux_unmap_region(vma->domain, vma->vaddr, vma->count * PAGE_CACHE_PAGE_SIZE);
+    if (page_cache_vma_shared_write(vma)) {
+        page_cache_vma_redirty(vma);
+    }
+    
+    for (uint64_t slot = 0; slot < vma->count; slot++) {
+        page_cache_put(vma->pages[slot]);
+    }
+    flux_free(vma->pages);
+    flux_free(vma->written);
+    flux_free(vma);
+}
+
+// =============================================================================
+// Block Device Mappings
+// =============================================================================
+
+// Page index counts PAGE_CACHE_PAGE_SIZE bytes from the start of the
+// device. The last page of a device may run past its end; the rest of it
+// reads as zeroes and is never written.
+static int page_cache_device_io(page_cache_mapping_t* mapping, uint64_t index, void* data,
+                                bool write) {
+    block_device_t* device = (block_device_t*)mapping->private_data;
+    uint64_t sector = index * PAGE_CACHE_SECTORS;
+    uint32_t count = PAGE_CACHE_SECTORS;
+    
+    if (device->queue) {
+        uint64_t capacity = device->queue->limits.capacity;
+        if (sector >= capacity) {
+            return -1;
+        }
+        if (sector + count > capacity) {
+            count = (uint32_t)(capacity - sector);
+            if (!write) {
+                memset((uint8_t*)data + (size_t)count * BLOCK_SECTOR_SIZE, 0,
+                       (size_t)(PAGE_CACHE_SECTORS - count) * BLOCK_SECTOR_SIZE);
+            }
+        }
+    }
+    
+    return write ? device->write(device, sector, count, data) :
+                   device->read(device, sector, count, data);
+}
+
+static int page_cache_device_read(page_cache_mapping_t* mapping, uint64_t index, void* data) {
+    return page_cache_device_io(mapping, index, data, false);
+}
+
+static int page_cache_device_write(page_cache_mapping_t* mapping, uint64_t index,
+                                   const void* data) {
+    return page_cache_device_io(mapping, index, (void*)data, true);
+}
+
+// Readahead on a block layer device: a bio per page, all under one plug
+// so runs of pages merge into large requests. Each page is ended from its
+// own bio; whoever ends the last one frees the batch.
+typedef struct page_cache_device_batch page_cache_device_batch_t;
+
+typedef struct {
+    page_cache_device_batch_t* batch;
+    page_cache_page_t* page;
+    block_bio_t bio;
+} page_cache_device_slot_t;
+
+struct page_cache_device_batch {
+    uint32_t pages_left;        // Plus one while submitting
+    page_cache_device_slot_t slots[];
+};
+
+static void page_cache_device_put(page_cache_device_batch_t* batch) {
+    if (__atomic_sub_fetch(&batch->pages_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        flux_free(batch);
+    }
+}
+
+static void page_cache_device_end_io(block_bio_t* bio, int status) {
+    page_cache_device_slot_t* slot = (page_cache_device_slot_t*)bio->private_data;
+    page_cache_device_batch_t* batch = slot->batch;
+    page_cache_end_read(slot->page, status);
+    page_cache_device_put(batch);
+}
+
+static int page_cache_device_read_pages(page_cache_mapping_t* mapping, page_cache_page_t** pages,
+                                        uint32_t count) {
+    block_device_t* device = (block_device_t*)mapping->private_data;
+    block_queue_t* queue = device->queue;
+    if (!queue) {
+        for (uint32_t i = 0; i < count; i++) {
+            page_cache_end_read(pages[i], page_cache_device_io(mapping, pages[i]->index,
+                                                               pages[i]->data, false));
+        }
+        return 0;
+    }
+    
+    page_cache_device_batch_t* batch = flux_allocate(NULL, sizeof(page_cache_device_batch_t) +
+                                                     count * sizeof(page_cache_device_slot_t),
+                                                     FLUX_ALLOC_KERNEL);
+    if (!batch) {
+        return -1;
+    }
+    batch->pages_left = count + 1;
+    
+    uint64_t capacity = queue->limits.capacity;
+    block_plug_t plug;
+    block_start_plug(&plug, queue);
+    for (uint32_t i = 0; i < count; i++) {
+        page_cache_device_slot_t* slot = &batch->slots[i];
+        slot->batch = batch;
+        slot->page = pages[i];
+        
+        uint64_t sector = pages[i]->index * PAGE_CACHE_SECTORS;
+        if (sector >= capacity) {
+            page_cache_end_read(pages[i], -1);
+            page_cache_device_put(batch);
+            continue;
+        }
+        
+        uint32_t sectors = PAGE_CACHE_SECTORS;
+        if (sector + sectors > capacity) {
+            sectors = (uint32_t)(capacity - sector);
+            memset((uint8_t*)pages[i]->data + (size_t)sectors * BLOCK_SECTOR_SIZE, 0,
+                   (size_t)(PAGE_CACHE_SECTORS - sectors) * BLOCK_SECTOR_SIZE);
+        }
+        
+        slot->bio = (block_bio_t){
+            .sector = sector,
+            .count = sectors,
+            .write = false,
+            .buffer = pages[i]->data,
+            .end_io = page_cache_device_end_io,
+            .private_data = slot
+        };
+        block_submit(queue, &slot->bio, &plug);
+    }
+    block_finish_plug(&plug);
+    page_cache_device_put(batch);
+    return 0;
+}
+
+static const page_cache_ops_t g_page_cache_device_ops = {
+    .read_page = page_cache_device_read,
+    .write_page = page_cache_device_write,
+    .read_pages = page_cache_device_read_pages
+};
+
+// =============================================================================
+// Statistics
+// =============================================================================
+
+void page_cache_get_stats(page_cache_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    
+    uint64_t irq = page_cache_lock();
+    *stats = g_page_cache.stats;
+    stats->pages = g_page_cache.cold_count + g_page_cache.hot_count;
+    stats->hot_pages = g_page_cache.hot_count;
+    stats->dirty_pages = g_page_cache.dirty_count;
+    stats->max_pages = g_page_cache.max_pages;
+    stats->cold_target = g_page_cache.cold_target;
+    page_cache_unlock(irq);
+}
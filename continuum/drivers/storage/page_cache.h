@@ -0,0 +1,194 @@
+/*
+ * Page Cache for Continuum Kernel
+ * Unified cache of device blocks and file pages with CLOCK-Pro style
+ * replacement and background writeback
+ */
+
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "block.h"
+
+// =============================================================================
+// Page Cache Constants
+// =============================================================================
+
+#define PAGE_CACHE_PAGE_SIZE    4096
+#define PAGE_CACHE_BUCKETS      4096    // Page hash, power of two
+#define PAGE_CACHE_MAP_BUCKETS  256     // Mapping hash, power of two
+#define PAGE_CACHE_GHOSTS_MIN   4096    // Evicted pages remembered: about as many as
+#define PAGE_CACHE_GHOSTS_MAX   (1 << 20)   // fit in the cache, within these bounds
+#define PAGE_CACHE_MAX_PCT      50      // Largest share of memory the cache grows to
+#define PAGE_CACHE_MIN_PAGES    256
+#define PAGE_CACHE_MIN_COLD     16      // Cold pages the hot hand always leaves
+
+// Writeback (microseconds)
+#define PAGE_CACHE_DIRTY_EXPIRE 5000000 // Age at which kflushd writes a page back
+#define PAGE_CACHE_FLUSH_PERIOD 1000000 // Between kflushd passes
+#define PAGE_CACHE_DIRTY_PCT    20      // Past this share of the cache, write back early
+#define PAGE_CACHE_FLUSH_BATCH  32      // Pages written per round
+
+// Readahead windows (pages)
+#define PAGE_CACHE_RA_MIN       4
+#define PAGE_CACHE_RA_MAX       128     // 512 KiB
+
+// A block device's own mapping, keyed by byte offset on the device
+#define PAGE_CACHE_DEVICE_KEY   UINT64_MAX
+
+// Page flags
+#define PAGE_CACHE_UPTODATE     (1 << 0)
+#define PAGE_CACHE_DIRTY        (1 << 1)
+#define PAGE_CACHE_REFERENCED   (1 << 2)    // Touched since the clock hand last passed
+#define PAGE_CACHE_HOT          (1 << 3)
+#define PAGE_CACHE_IO           (1 << 4)    // Being read in
+#define PAGE_CACHE_WRITEBACK    (1 << 5)
+#define PAGE_CACHE_READAHEAD    (1 << 6)    // Reaching it starts the next window
+
+// =============================================================================
+// Page Cache Structures
+// =============================================================================
+
+typedef struct page_cache_mapping page_cache_mapping_t;
+typedef struct page_cache_page page_cache_page_t;
+typedef struct page_cache_vma page_cache_vma_t;
+struct memory_domain;
+
+// How a mapping fills and writes back one PAGE_CACHE_PAGE_SIZE page at
+// index; both return 0 or -1. read_pages is optional and asynchronous: it
+// starts reads for count pages in index order and ends each one with
+// page_cache_end_read, possibly from an interrupt handler. If it returns -1
+// nothing was started.
+typedef struct {
+    int (*read_page)(page_cache_mapping_t* mapping, uint64_t index, void* data);
+    int (*write_page)(page_cache_mapping_t* mapping, uint64_t index, const void* data);
+    int (*read_pages)(page_cache_mapping_t* mapping, page_cache_page_t** pages, uint32_t count);
+} page_cache_ops_t;
+
+// A caller's buffers, taken in order as one range of bytes
+typedef struct page_cache_iovec {
+    void* base;
+    size_t length;
+} page_cache_iovec_t;
+
+// Position within a vector; it advances as bytes are copied, so a transfer
+// can be split over several calls
+typedef struct {
+    const page_cache_iovec_t* iov;
+    uint32_t count;             // Segments left, the first partly used
+    size_t skip;                // Bytes of it already used
+} page_cache_iter_t;
+
+// Sequential-read detection for one reader (an open file, say); zeroed to
+// start
+typedef struct page_cache_ra {
+    uint64_t start;             // First page of the current window
+    uint32_t size;              // Pages in it
+    uint32_t async_size;        // Trailing pages; the first of them is the trigger
+    uint64_t next_index;        // Page after the last one read, 0 before any
+} page_cache_ra_t;
+
+// One cached object: a whole block device, or a file on a filesystem
+struct page_cache_mapping {
+    void* owner;                // Filesystem, or the block_device_t itself
+    uint64_t key;               // Inode number, or PAGE_CACHE_DEVICE_KEY
+    const page_cache_ops_t* ops;
+    void* private_data;
+    uint64_t size;              // Bytes, bounds readahead; 0 if unknown
+    page_cache_ra_t ra;         // For readers without state of their own
+    uint64_t pages;             // Resident
+    uint64_t dirty;
+    struct page_cache_mapping* hash_next;
+};
+
+struct page_cache_page {
+    page_cache_mapping_t* mapping;
+    uint64_t index;
+    void* data;
+    uint32_t refs;              // Callers holding it; never evicted while set
+    uint32_t flags;
+    uint64_t dirtied;           // TSC when it became dirty
+    struct page_cache_page* hash_next;
+    struct page_cache_page* prev;       // Hot or cold clock
+    struct page_cache_page* next;
+    struct page_cache_page* dirty_prev; // Dirty list, oldest first
+    struct page_cache_page* dirty_next;
+};
+
+typedef struct {
+    uint64_t pages;
+    uint64_t hot_pages;
+    uint64_t dirty_pages;
+    uint64_t max_pages;
+    uint64_t cold_target;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t ghost_hits;        // Misses on recently evicted pages
+    uint64_t readahead_pages;
+    uint64_t readahead_windows;
+    uint64_t map_faults;        // Pages handed to memory mappings
+    uint64_t evictions;
+    uint64_t reclaimed;         // Given back to flux under memory pressure
+    uint64_t writebacks;
+    uint64_t read_errors;
+    uint64_t write_errors;
+} page_cache_stats_t;
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// Mappings
+page_cache_mapping_t* page_cache_get_mapping(void* owner, uint64_t key,
+                                             const page_cache_ops_t* ops,
+                                             void* private_data);
+page_cache_mapping_t* page_cache_device(block_device_t* device);
+void page_cache_drop_owner(void* owner);
+
+// Pages: page_cache_get returns an up-to-date page held until page_cache_put
+page_cache_page_t* page_cache_get(page_cache_mapping_t* mapping, uint64_t index);
+void page_cache_put(page_cache_page_t* page);
+void page_cache_mark_dirty(page_cache_page_t* page);
+void page_cache_end_read(page_cache_page_t* page, int status);
+
+// Byte ranges
+int page_cache_read(page_cache_mapping_t* mapping, uint64_t offset, void* buffer,
+                    size_t length);
+int page_cache_write(page_cache_mapping_t* mapping, uint64_t offset, const void* buffer,
+                     size_t length);
+
+// Streaming reads: detects sequential access through ra (the mapping's own
+// state when NULL) and reads ahead asynchronously with read_pages
+int page_cache_read_ahead(page_cache_mapping_t* mapping, page_cache_ra_t* ra, uint64_t offset,
+                          void* buffer, size_t length);
+
+// Vectored: length bytes at offset into or out of iter, which must hold at
+// least that many. Each page is looked up once however many segments it
+// spans, and the whole range counts as one read for readahead.
+size_t page_cache_iter_init(page_cache_iter_t* iter, const page_cache_iovec_t* iov,
+                            uint32_t count);
+int page_cache_readv(page_cache_mapping_t* mapping, page_cache_ra_t* ra, uint64_t offset,
+                     page_cache_iter_t* iter, size_t length);
+int page_cache_writev(page_cache_mapping_t* mapping, uint64_t offset, page_cache_iter_t* iter,
+                      size_t length);
+
+// Writeback; a NULL mapping syncs everything
+int page_cache_sync(page_cache_mapping_t* mapping);
+
+// Memory mappings: length bytes of mapping from offset, mapped at vaddr in
+// domain with FLUX_MAP_* flags, the cached pages themselves faulted in on
+// first touch. With FLUX_MAP_SHARED, writes go to the cache and are
+// written back (the mapping must have write_page); without it, written
+// pages are copied and the copies stay private. vaddr and offset are
+// page-aligned.
+page_cache_vma_t* page_cache_mmap(page_cache_mapping_t* mapping, struct memory_domain* domain,
+                                  uint64_t vaddr, uint64_t offset, size_t length,
+                                  uint32_t flags);
+int page_cache_msync(page_cache_vma_t* vma);
+void page_cache_munmap(page_cache_vma_t* vma);
+
+void page_cache_get_stats(page_cache_stats_t* stats);
+
+#endif /* PAGE_CACHE_H */
@@ -1,11 +1,13 @@
 /*
  * USB Mass Storage Driver for Continuum Kernel
- * Bulk-Only Transport (BOT) implementation for USB storage devices
+ * Bulk-Only Transport (BOT) and USB Attached SCSI (UAS) for USB storage devices
  */
 
 #include "usb_mass.h"
+#include "block.h"
 #include "../resonance.h"
 #include "../../flux_memory.h"
+#include "../../temporal_scheduler.h"
 
 // =============================================================================
 // Global USB Mass Storage State
@@ -16,7 +18,7 @@ static uint32_t g_usb_mass_count = 0;
 static spinlock_t g_usb_mass_lock = SPINLOCK_INIT;
 
 // =============================================================================
-// USB Control Transfer
+// USB Transfers
 // =============================================================================
 
 static int usb_control_transfer(usb_mass_device_t* dev, usb_setup_packet_t* setup,
@@ -26,93 +28,358 @@ static int usb_control_transfer(usb_mass_device_t* dev, usb_setup_packet_t* setu
     return 0;
 }
 
-static int usb_bulk_transfer(usb_mass_device_t* dev, uint8_t endpoint,
-                            void* data, uint32_t length, uint32_t* transferred) {
-    // This would interface with the USB host controller driver
-    // Simplified implementation
-    *transferred = length;
+static void usb_mass_urb_complete(xhci_transfer_t* transfer, int status) {
+    usb_mass_urb_t* urb = (usb_mass_urb_t*)transfer;
+    
+    if (urb->dma) {
+        resonance_dma_unmap(urb->dma, urb->length);
+        urb->dma = 0;
+    }
+    urb->status = status;
+    urb->transferred = transfer->length;
+    urb->done(urb);
+}
+
+// Start a bulk transfer on endpoint (and stream, for UAS); urb->done runs
+// once it's over, possibly from the controller interrupt
+static int usb_bulk_submit(usb_mass_device_t* dev, uint8_t endpoint, uint16_t stream,
+                           void* data, uint32_t length, usb_mass_urb_t* urb, uint32_t flags) {
+    urb->transfer.done = usb_mass_urb_complete;
+    urb->length = length;
+    urb->transferred = 0;
+    urb->status = 0;
+    urb->dma = 0;
+    
+    if (!dev->host) {
+        // Not enumerated through a host controller driver yet
+        // Simplified implementation
+        urb->transfer.length = length;
+        usb_mass_urb_complete(&urb->transfer, 0);
+        return 0;
+    }
+    
+    uint64_t address = 0;
+    if (length > 0) {
+        address = urb->dma = resonance_dma_map(data, length);
+    }
+    if (xhci_queue_transfer(dev->host, dev->slot_id, XHCI_EP_INDEX(endpoint), stream,
+                            address, length, &urb->transfer, flags) != 0) {
+        if (urb->dma) {
+            resonance_dma_unmap(urb->dma, length);
+            urb->dma = 0;
+        }
+        // Whatever was deferred ahead of this still has to run
+        xhci_ring_doorbell(dev->host, dev->slot_id, XHCI_EP_INDEX(endpoint), stream);
+        return -1;
+    }
     return 0;
 }
 
+// =============================================================================
+// USB Mass Storage Reset Recovery
+// =============================================================================
+
+static int usb_mass_reset(usb_mass_device_t* dev) {
+    // Bulk-Only Mass Storage Reset
+    usb_setup_packet_t setup = {
+        .request_type = 0x21,  // Class, Interface, Host to Device
+        .request = USB_MASS_REQUEST_RESET,
+        .value = 0,
+        .index = dev->interface_num,
+        .length = 0
+    };
+    
+    return usb_control_transfer(dev, &setup, NULL, 0);
+}
+
+static int usb_mass_clear_halt(usb_mass_device_t* dev, uint8_t endpoint) {
+    // Clear Feature HALT
+    usb_setup_packet_t setup = {
+        .request_type = 0x02,  // Standard, Endpoint, Host to Device
+        .request = USB_REQUEST_CLEAR_FEATURE,
+        .value = USB_FEATURE_ENDPOINT_HALT,
+        .index = endpoint,
+        .length = 0
+    };
+    
+    return usb_control_transfer(dev, &setup, NULL, 0);
+}
+
+// Bulk-Only Mass Storage Reset, then clear both halts. Transfers the
+// device never finished are abandoned.
+static void usb_mass_reset_recovery(usb_mass_device_t* dev) {
+    usb_mass_reset(dev);
+    usb_mass_clear_halt(dev, dev->bulk_in_ep);
+    usb_mass_clear_halt(dev, dev->bulk_out_ep);
+}
+
 // =============================================================================
 // SCSI Command Execution
 // =============================================================================
 
-static int usb_mass_send_cbw(usb_mass_device_t* dev, cbw_t* cbw) {
-    uint32_t transferred;
-    return usb_bulk_transfer(dev, dev->bulk_out_ep, cbw, sizeof(cbw_t), &transferred);
+// READ(10)/WRITE(10) while the LBA and count fit, (16) past that. Returns
+// the CDB length.
+static uint8_t usb_mass_build_rw(uint8_t* cdb, uint64_t lba, uint32_t count, bool is_write) {
+    if (lba + count <= 0x100000000ULL && count <= 0xFFFF) {
+        uint8_t rw10[10] = {
+            is_write ? SCSI_CMD_WRITE_10 : SCSI_CMD_READ_10,
+            0,  // Flags
+            (lba >> 24) & 0xFF,
+            (lba >> 16) & 0xFF,
+            (lba >> 8) & 0xFF,
+            lba & 0xFF,
+            0,  // Group number
+            (count >> 8) & 0xFF,
+            count & 0xFF,
+            0   // Control
+        };
+        memcpy(cdb, rw10, sizeof(rw10));
+        return 10;
+    }
+    
+    cdb[0] = is_write ? SCSI_CMD_WRITE_16 : SCSI_CMD_READ_16;
+    cdb[1] = 0;
+    for (int i = 0; i < 8; i++) {
+        cdb[2 + i] = (lba >> (56 - 8 * i)) & 0xFF;
+    }
+    for (int i = 0; i < 4; i++) {
+        cdb[10 + i] = (count >> (24 - 8 * i)) & 0xFF;
+    }
+    cdb[14] = 0;    // Group number
+    cdb[15] = 0;    // Control
+    return 16;
 }
 
-static int usb_mass_recv_csw(usb_mass_device_t* dev, csw_t* csw) {
-    uint32_t transferred;
-    int result = usb_bulk_transfer(dev, dev->bulk_in_ep, csw, sizeof(csw_t), &transferred);
+static void usb_mass_command_finish(usb_mass_command_t* cmd) {
+    usb_mass_device_t* dev = cmd->dev;
+    int status = cmd->status;
+    
+    if (status == 0 && dev->uas) {
+        uas_sense_iu_t* sense = (uas_sense_iu_t*)((uint8_t*)cmd->iu->virtual_addr + USB_MASS_IU_STATUS);
+        if (sense->iu_id != UAS_IU_SENSE || __builtin_bswap16(sense->tag) != cmd->tag) {
+            status = -1;
+        } else {
+            status = sense->status;
+        }
+    } else if (status == 0) {
+        cbw_t* cbw = (cbw_t*)cmd->iu->virtual_addr;
+        csw_t* csw = (csw_t*)((uint8_t*)cmd->iu->virtual_addr + USB_MASS_IU_STATUS);
+        if (csw->signature != CSW_SIGNATURE || csw->tag != cbw->tag) {
+            status = -1;    // Protocol error
+        } else {
+            status = csw->status;
+        }
+    }
     
-    if (result != 0 || transferred != sizeof(csw_t)) {
-        return -1;
+    __atomic_fetch_add(&dev->commands_sent, 1, __ATOMIC_RELAXED);
+    if (status != 0) {
+        __atomic_fetch_add(&dev->errors, 1, __ATOMIC_RELAXED);
     }
+    cmd->status = status;
     
-    // Validate CSW
-    if (csw->signature != CSW_SIGNATURE) {
-        return -1;
+    io_packet_t* packet = cmd->packet;
+    if (!packet) {
+        __atomic_store_n(&cmd->done, true, __ATOMIC_RELEASE);
+        return;
     }
     
-    return csw->status;
+    // The tag is free again before the caller hears back
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&dev->lock);
+    dev->tags_free |= 1U << (cmd->tag - 1);
+    spinlock_release(&dev->lock);
+    cpu_irq_restore(flags);
+    
+    resonance_io_complete(packet, status == 0 ? IO_SUCCESS : IO_ERROR);
 }
 
-static int usb_mass_execute_scsi(usb_mass_device_t* dev, uint8_t* cdb,
-                                uint8_t cdb_len, void* data, uint32_t data_len,
-                                bool is_write) {
-    spinlock_acquire(&dev->lock);
+static void usb_mass_command_urb_done(usb_mass_urb_t* urb) {
+    usb_mass_command_t* cmd = (usb_mass_command_t*)urb->context;
     
-    // Build CBW
-    cbw_t cbw = {0};
-    cbw.signature = CBW_SIGNATURE;
-    cbw.tag = dev->tag_counter++;
-    cbw.data_transfer_length = data_len;
-    cbw.flags = is_write ? 0x00 : 0x80;  // Direction: 0x80 = IN, 0x00 = OUT
-    cbw.lun = dev->lun;
-    cbw.cb_length = cdb_len;
-    memcpy(cbw.cb, cdb, cdb_len);
-    
-    // Send CBW
-    if (usb_mass_send_cbw(dev, &cbw) != 0) {
-        spinlock_release(&dev->lock);
-        return -1;
+    if (urb->status != 0) {
+        __atomic_store_n(&cmd->status, -1, __ATOMIC_RELAXED);
+    }
+    if (__atomic_sub_fetch(&cmd->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        usb_mass_command_finish(cmd);
+    }
+}
+
+// A transfer that can't be queued fails at once. flags are
+// xhci_queue_transfer's.
+static void usb_mass_queue(usb_mass_device_t* dev, uint8_t endpoint, uint16_t stream,
+                           void* data, uint32_t length, usb_mass_urb_t* urb, uint32_t flags) {
+    if (usb_bulk_submit(dev, endpoint, stream, data, length, urb, flags) != 0) {
+        urb->status = -1;
+        urb->done(urb);
+    }
+}
+
+// Queue a command's transfers in the order the device consumes them, so
+// none waits on another's completion: data then status behind the CBW for
+// BOT, status and data ahead of the command IU for UAS
+static void usb_mass_start(usb_mass_command_t* cmd, const uint8_t* cdb, uint8_t cdb_len,
+                          void* data, uint32_t data_len, bool is_write) {
+    usb_mass_device_t* dev = cmd->dev;
+    uint8_t* iu = (uint8_t*)cmd->iu->virtual_addr;
+    uint8_t data_ep = is_write ? dev->bulk_out_ep : dev->bulk_in_ep;
+    
+    cmd->status = 0;
+    cmd->done = false;
+    cmd->pending = data_len > 0 ? 3 : 2;
+    for (int i = 0; i < 3; i++) {
+        cmd->urbs[i].done = usb_mass_command_urb_done;
+        cmd->urbs[i].context = cmd;
     }
     
-    // Transfer data if needed
-    if (data_len > 0) {
-        uint32_t transferred;
-        uint8_t endpoint = is_write ? dev->bulk_out_ep : dev->bulk_in_ep;
+    if (dev->uas) {
+        uas_command_iu_t* command = (uas_command_iu_t*)iu;
+        memset(command, 0, sizeof(uas_command_iu_t));
+        command->iu_id = UAS_IU_COMMAND;
+        command->tag = __builtin_bswap16(cmd->tag);
+        command->lun[1] = dev->lun;
+        memcpy(command->cdb, cdb, cdb_len);
         
-        if (usb_bulk_transfer(dev, endpoint, data, data_len, &transferred) != 0) {
-            spinlock_release(&dev->lock);
-            return -1;
+        // Each tag owns its stream on the status and data pipes, and the
+        // rings are sized for one command per tag, so these always fit
+        usb_mass_queue(dev, dev->status_ep, cmd->tag, iu + USB_MASS_IU_STATUS,
+                       USB_MASS_UAS_STATUS_SIZE, &cmd->urbs[2], 0);
+        if (data_len > 0) {
+            usb_mass_queue(dev, data_ep, cmd->tag, data, data_len, &cmd->urbs[1], 0);
         }
+        usb_mass_queue(dev, dev->command_ep, 0, command, sizeof(uas_command_iu_t),
+                       &cmd->urbs[0], 0);
+    } else {
+        cbw_t* cbw = (cbw_t*)iu;
+        memset(cbw, 0, sizeof(cbw_t));
+        cbw->signature = CBW_SIGNATURE;
+        cbw->tag = dev->tag_counter++;
+        cbw->data_transfer_length = data_len;
+        cbw->flags = is_write ? 0x00 : 0x80;  // Direction: 0x80 = IN, 0x00 = OUT
+        cbw->lun = dev->lun;
+        cbw->cb_length = cdb_len;
+        memcpy(cbw->cb, cdb, cdb_len);
         
-        if (transferred != data_len) {
-            // Handle short transfer
-            // May need to recover with Reset Recovery
+        // A read's data and CSW share the bulk-in ring and one doorbell
+        usb_mass_queue(dev, dev->bulk_out_ep, 0, cbw, sizeof(cbw_t), &cmd->urbs[0], 0);
+        if (data_len > 0) {
+            usb_mass_queue(dev, data_ep, 0, data, data_len, &cmd->urbs[1],
+                           data_ep == dev->bulk_in_ep ? XHCI_QUEUE_DEFER : 0);
         }
+        usb_mass_queue(dev, dev->bulk_in_ep, 0, iu + USB_MASS_IU_STATUS, sizeof(csw_t),
+                       &cmd->urbs[2], 0);
     }
+}
+
+// Wait for a synchronous command, up to USB_MASS_TIMEOUT. The waiter
+// polls the controller's events for USB_MASS_POLL_SPIN microseconds, then,
+// with the controller interrupt wired, yields between checks.
+static int usb_mass_wait(usb_mass_device_t* dev, usb_mass_command_t* cmd) {
+    uint64_t start = continuum_get_time();
+    uint64_t spin_until = start + continuum_usec_to_tsc(USB_MASS_POLL_SPIN);
+    uint64_t timeout = start + continuum_usec_to_tsc(USB_MASS_TIMEOUT);
+    
+    while (!__atomic_load_n(&cmd->done, __ATOMIC_ACQUIRE)) {
+        if (dev->host) {
+            xhci_handle_events(dev->host);
+        }
+        
+        uint64_t now = continuum_get_time();
+        if (now >= timeout) {
+            return -1;
+        }
+        if (dev->host && dev->host->irq_enabled && now >= spin_until) {
+            quantum_context_t* current = temporal_get_current();
+            if (current) {
+                temporal_yield(current);
+            }
+        }
+    }
+    return cmd->status;
+}
+
+// Claim a UAS tag; -1 if all are in flight
+static int usb_mass_alloc_tag(usb_mass_device_t* dev) {
+    int tag = -1;
     
-    // Receive CSW
-    csw_t csw;
-    int status = usb_mass_recv_csw(dev, &csw);
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&dev->lock);
+    if (dev->tags_free) {
+        int bit = __builtin_ctz(dev->tags_free);
+        dev->tags_free &= ~(1U << bit);
+        tag = bit + 1;
+    }
+    spinlock_release(&dev->lock);
+    cpu_irq_restore(flags);
     
-    if (csw.tag != cbw.tag) {
-        // Tag mismatch - protocol error
-        spinlock_release(&dev->lock);
-        return -1;
+    return tag;
+}
+
+static void usb_mass_free_tag(usb_mass_device_t* dev, int tag) {
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&dev->lock);
+    dev->tags_free |= 1U << (tag - 1);
+    spinlock_release(&dev->lock);
+    cpu_irq_restore(flags);
+}
+
+// Start a UAS command for packet and return; IO_BUSY while every tag is
+// taken
+static io_result_t usb_mass_submit(usb_mass_device_t* dev, const uint8_t* cdb, uint8_t cdb_len,
+                                   void* data, uint32_t data_len, bool is_write,
+                                   io_packet_t* packet) {
+    int tag = usb_mass_alloc_tag(dev);
+    if (tag < 0) {
+        return IO_BUSY;
     }
     
-    if (csw.data_residue > 0) {
-        // Not all data transferred
-        // Handle residue
+    usb_mass_command_t* cmd = &dev->commands[tag - 1];
+    cmd->packet = packet;
+    packet->status = IO_PENDING;
+    usb_mass_start(cmd, cdb, cdb_len, data, data_len, is_write);
+    return IO_PENDING;
+}
+
+static int usb_mass_execute_scsi(usb_mass_device_t* dev, uint8_t* cdb,
+                                uint8_t cdb_len, void* data, uint32_t data_len,
+                                bool is_write) {
+    usb_mass_command_t* cmd;
+    int tag = 0;
+    
+    if (dev->uas) {
+        while ((tag = usb_mass_alloc_tag(dev)) < 0) {
+            if (dev->host) {
+                xhci_handle_events(dev->host);
+            }
+        }
+        cmd = &dev->commands[tag - 1];
+    } else {
+        // Bulk-only runs one command at a time
+        while (__atomic_exchange_n(&dev->bot_busy, true, __ATOMIC_ACQUIRE)) {
+            quantum_context_t* current = temporal_get_current();
+            if (current) {
+                temporal_yield(current);
+            }
+        }
+        cmd = &dev->bot;
     }
     
-    spinlock_release(&dev->lock);
+    cmd->packet = NULL;
+    usb_mass_start(cmd, cdb, cdb_len, data, data_len, is_write);
+    int status = usb_mass_wait(dev, cmd);
+    bool done = __atomic_load_n(&cmd->done, __ATOMIC_ACQUIRE);
     
+    if (dev->uas) {
+        // A tag whose transfers are still queued stays taken
+        if (done) {
+            usb_mass_free_tag(dev, tag);
+        }
+    } else {
+        if (!done) {
+            // A stalled pipe holds back everything queued behind it
+            usb_mass_reset_recovery(dev);
+        }
+        __atomic_store_n(&dev->bot_busy, false, __ATOMIC_RELEASE);
+    }
     return status;
 }
 
@@ -150,7 +417,7 @@ static int usb_mass_inquiry(usb_mass_device_t* dev) {
     return result;
 }
 
-static int usb_mass_test_unit_ready(usb_mass_device_t* dev) {
+int usb_mass_test_unit_ready(usb_mass_device_t* dev) {
     uint8_t cdb[6] = {
         SCSI_CMD_TEST_UNIT_READY,
         0, 0, 0, 0, 0
@@ -159,7 +426,7 @@ static int usb_mass_test_unit_ready(usb_mass_device_t* dev) {
     return usb_mass_execute_scsi(dev, cdb, 6, NULL, 0, false);
 }
 
-static int usb_mass_request_sense(usb_mass_device_t* dev) {
+int usb_mass_request_sense(usb_mass_device_t* dev) {
     uint8_t cdb[6] = {
         SCSI_CMD_REQUEST_SENSE,
         0,  // Descriptor format
@@ -182,128 +449,180 @@ static int usb_mass_read_capacity(usb_mass_device_t* dev) {
     scsi_read_capacity_data_t capacity_data;
     int result = usb_mass_execute_scsi(dev, cdb, 10, &capacity_data, 8, false);
     
-    if (result == 0) {
-        dev->last_lba = __builtin_bswap32(capacity_data.last_lba);
-        dev->block_size = __builtin_bswap32(capacity_data.block_size);
-        dev->capacity = ((uint64_t)dev->last_lba + 1) * dev->block_size;
+    if (result != 0) {
+        return result;
+    }
+    dev->last_lba = __builtin_bswap32(capacity_data.last_lba);
+    dev->block_size = __builtin_bswap32(capacity_data.block_size);
+    
+    // Past 2 TiB of 512-byte blocks READ CAPACITY(10) saturates
+    if (dev->last_lba == 0xFFFFFFFF) {
+        uint8_t cdb16[16] = {
+            SCSI_CMD_SERVICE_ACTION_IN_16,
+            SCSI_SAI_READ_CAPACITY_16,
+            0, 0, 0, 0, 0, 0, 0, 0,     // LBA
+            0, 0, 0, 32,                // Allocation length
+            0, 0
+        };
+        
+        scsi_read_capacity_16_data_t capacity_16;
+        result = usb_mass_execute_scsi(dev, cdb16, 16, &capacity_16, 32, false);
+        if (result != 0) {
+            return result;
+        }
+        dev->last_lba = __builtin_bswap64(capacity_16.last_lba);
+        dev->block_size = __builtin_bswap32(capacity_16.block_size);
     }
     
-    return result;
+    dev->capacity = (dev->last_lba + 1) * dev->block_size;
+    return 0;
 }
 
 // =============================================================================
 // Read/Write Operations
 // =============================================================================
 
-int usb_mass_read(usb_mass_device_t* dev, uint64_t lba, uint32_t count, void* buffer) {
+// Split at what one command may carry
+static int usb_mass_read_write(usb_mass_device_t* dev, uint64_t lba, uint32_t count,
+                               void* buffer, bool is_write) {
     if (!dev || !buffer || count == 0) {
         return -1;
     }
     
-    // Use READ(10) command for simplicity
-    uint8_t cdb[10] = {
-        SCSI_CMD_READ_10,
-        0,  // Flags
-        (lba >> 24) & 0xFF,
-        (lba >> 16) & 0xFF,
-        (lba >> 8) & 0xFF,
-        lba & 0xFF,
-        0,  // Group number
-        (count >> 8) & 0xFF,
-        count & 0xFF,
-        0   // Control
-    };
-    
-    uint32_t data_len = count * dev->block_size;
-    return usb_mass_execute_scsi(dev, cdb, 10, buffer, data_len, false);
-}
-
-int usb_mass_write(usb_mass_device_t* dev, uint64_t lba, uint32_t count, void* buffer) {
-    if (!dev || !buffer || count == 0) {
+    if (is_write && dev->write_protected) {
         return -1;
     }
     
-    if (dev->write_protected) {
-        return -1;
+    uint32_t max_blocks = dev->max_transfer / dev->block_size;
+    while (count > 0) {
+        uint32_t blocks = count < max_blocks ? count : max_blocks;
+        uint32_t data_len = blocks * dev->block_size;
+        
+        uint8_t cdb[16];
+        uint8_t cdb_len = usb_mass_build_rw(cdb, lba, blocks, is_write);
+        if (usb_mass_execute_scsi(dev, cdb, cdb_len, buffer, data_len, is_write) != 0) {
+            return -1;
+        }
+        
+        if (is_write) {
+            __atomic_fetch_add(&dev->bytes_written, data_len, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_add(&dev->bytes_read, data_len, __ATOMIC_RELAXED);
+        }
+        lba += blocks;
+        count -= blocks;
+        buffer = (uint8_t*)buffer + data_len;
     }
     
-    // Use WRITE(10) command
-    uint8_t cdb[10] = {
-        SCSI_CMD_WRITE_10,
-        0,  // Flags
-        (lba >> 24) & 0xFF,
-        (lba >> 16) & 0xFF,
-        (lba >> 8) & 0xFF,
-        lba & 0xFF,
-        0,  // Group number
-        (count >> 8) & 0xFF,
-        count & 0xFF,
-        0   // Control
-    };
-    
-    uint32_t data_len = count * dev->block_size;
-    return usb_mass_execute_scsi(dev, cdb, 10, buffer, data_len, true);
+    return 0;
 }
 
-// =============================================================================
-// USB Mass Storage Reset Recovery
-// =============================================================================
-
-static int usb_mass_reset(usb_mass_device_t* dev) {
-    // Bulk-Only Mass Storage Reset
-    usb_setup_packet_t setup = {
-        .request_type = 0x21,  // Class, Interface, Host to Device
-        .request = USB_MASS_REQUEST_RESET,
-        .value = 0,
-        .index = dev->interface_num,
-        .length = 0
-    };
-    
-    return usb_control_transfer(dev, &setup, NULL, 0);
+int usb_mass_read(usb_mass_device_t* dev, uint64_t lba, uint32_t count, void* buffer) {
+    return usb_mass_read_write(dev, lba, count, buffer, false);
 }
 
-static int usb_mass_clear_halt(usb_mass_device_t* dev, uint8_t endpoint) {
-    // Clear Feature HALT
-    usb_setup_packet_t setup = {
-        .request_type = 0x02,  // Standard, Endpoint, Host to Device
-        .request = USB_REQUEST_CLEAR_FEATURE,
-        .value = USB_FEATURE_ENDPOINT_HALT,
-        .index = endpoint,
-        .length = 0
-    };
-    
-    return usb_control_transfer(dev, &setup, NULL, 0);
+int usb_mass_write(usb_mass_device_t* dev, uint64_t lba, uint32_t count, void* buffer) {
+    return usb_mass_read_write(dev, lba, count, buffer, true);
 }
 
 // =============================================================================
 // Device Initialization
 // =============================================================================
 
-static int usb_mass_init_device(usb_mass_device_t* dev) {
-    // Get max LUN
-    usb_setup_packet_t setup = {
-        .request_type = 0xA1,  // Class, Interface, Device to Host
-        .request = USB_MASS_REQUEST_GET_MAX_LUN,
-        .value = 0,
-        .index = dev->interface_num,
-        .length = 1
-    };
+static void usb_mass_free_transport(usb_mass_device_t* dev) {
+    if (dev->bot.iu) {
+        resonance_free_dma(dev->bot.iu);
+    }
+    if (dev->commands) {
+        for (uint32_t i = 0; i < dev->tags; i++) {
+            if (dev->commands[i].iu) {
+                resonance_free_dma(dev->commands[i].iu);
+            }
+        }
+        flux_free(dev->commands);
+    }
+}
+
+// Command state: BOT's single command, or under UAS one per tag, each tag
+// with its own stream on the status and data pipes
+static int usb_mass_init_transport(usb_mass_device_t* dev) {
+    dev->bot.dev = dev;
+    dev->bot.iu = resonance_alloc_dma(USB_MASS_IU_SIZE, DMA_FLAG_COHERENT);
+    if (!dev->bot.iu) {
+        return -1;
+    }
+    if (!dev->uas) {
+        return 0;
+    }
     
-    uint8_t max_lun = 0;
-    if (usb_control_transfer(dev, &setup, &max_lun, 1) == 0) {
-        dev->max_lun = max_lun;
-    } else {
-        dev->max_lun = 0;  // Assume single LUN
+    // Stream 0 is reserved, so the array is the next power of two up
+    uint32_t streams = 2;
+    while (streams < USB_MASS_UAS_TAGS + 1) {
+        streams <<= 1;
+    }
+    if (dev->host) {
+        if (streams > xhci_max_streams(dev->host)) {
+            streams = xhci_max_streams(dev->host);
+        }
+        uint8_t pipes[3] = { dev->status_ep, dev->bulk_in_ep, dev->bulk_out_ep };
+        for (int i = 0; i < 3; i++) {
+            if (xhci_alloc_streams(dev->host, dev->slot_id, XHCI_EP_INDEX(pipes[i]),
+                                   streams) != 0) {
+                return -1;
+            }
+        }
     }
     
-    // Reset device
-    if (usb_mass_reset(dev) != 0) {
+    dev->tags = streams - 1 < USB_MASS_UAS_TAGS ? streams - 1 : USB_MASS_UAS_TAGS;
+    dev->commands = flux_allocate(NULL, dev->tags * sizeof(usb_mass_command_t),
+                                  FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!dev->commands) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < dev->tags; i++) {
+        dev->commands[i].dev = dev;
+        dev->commands[i].tag = (uint16_t)(i + 1);
+        dev->commands[i].iu = resonance_alloc_dma(USB_MASS_IU_SIZE, DMA_FLAG_COHERENT);
+        if (!dev->commands[i].iu) {
+            return -1;
+        }
+    }
+    dev->tags_free = dev->tags == 32 ? 0xFFFFFFFF : (1U << dev->tags) - 1;
+    return 0;
+}
+
+static int usb_mass_init_device(usb_mass_device_t* dev) {
+    if (usb_mass_init_transport(dev) != 0) {
         return -1;
     }
     
-    // Clear any stalls
-    usb_mass_clear_halt(dev, dev->bulk_in_ep);
-    usb_mass_clear_halt(dev, dev->bulk_out_ep);
+    // UAS devices have no class requests; they report one LUN here
+    if (!dev->uas) {
+        // Get max LUN
+        usb_setup_packet_t setup = {
+            .request_type = 0xA1,  // Class, Interface, Device to Host
+            .request = USB_MASS_REQUEST_GET_MAX_LUN,
+            .value = 0,
+            .index = dev->interface_num,
+            .length = 1
+        };
+        
+        uint8_t max_lun = 0;
+        if (usb_control_transfer(dev, &setup, &max_lun, 1) == 0) {
+            dev->max_lun = max_lun;
+        } else {
+            dev->max_lun = 0;  // Assume single LUN
+        }
+        
+        // Reset device
+        if (usb_mass_reset(dev) != 0) {
+            return -1;
+        }
+        
+        // Clear any stalls
+        usb_mass_clear_halt(dev, dev->bulk_in_ep);
+        usb_mass_clear_halt(dev, dev->bulk_out_ep);
+    }
     
     // Test unit ready (may fail initially)
     for (int i = 0; i < 5; i++) {
@@ -338,8 +657,9 @@ static void* usb_mass_probe(device_node_t* node) {
         return NULL;
     }
     
-    // Check for Bulk-Only Transport
-    if (usb_info->device_protocol != USB_MASS_PROTOCOL_BBB) {
+    // Bulk-Only Transport or USB Attached SCSI
+    if (usb_info->device_protocol != USB_MASS_PROTOCOL_BBB &&
+        usb_info->device_protocol != USB_MASS_PROTOCOL_UAS) {
         return NULL;
     }
     
@@ -350,13 +670,26 @@ static void* usb_mass_probe(device_node_t* node) {
     }
     
     dev->usb_device = node;
+    dev->host = (xhci_controller_t*)usb_info->host;
+    dev->slot_id = usb_info->slot_id;
+    dev->speed = usb_info->speed;
     dev->interface_num = usb_info->interface;
     dev->bulk_in_ep = 0x81;   // Typical IN endpoint
     dev->bulk_out_ep = 0x02;  // Typical OUT endpoint
     spinlock_init(&dev->lock);
     
+    // Pipe usage descriptors aren't parsed yet; this is the usual UAS layout
+    dev->uas = usb_info->device_protocol == USB_MASS_PROTOCOL_UAS;
+    if (dev->uas) {
+        dev->status_ep = 0x83;
+        dev->command_ep = 0x04;
+    }
+    dev->max_transfer = dev->speed >= USB_SPEED_SUPER ? USB_MASS_MAX_TRANSFER_SS :
+                                                        USB_MASS_MAX_TRANSFER;
+    
     // Initialize device
     if (usb_mass_init_device(dev) != 0) {
+        usb_mass_free_transport(dev);
         flux_free(dev);
         return NULL;
     }
@@ -372,12 +705,90 @@ static void* usb_mass_probe(device_node_t* node) {
 static int usb_mass_attach(device_handle_t* handle) {
     usb_mass_device_t* dev = (usb_mass_device_t*)handle->driver_data;
     dev->state = USB_MASS_STATE_READY;
+    
+    // Bulk-only transport runs one command at a time, synchronously; UAS
+    // keeps a command in flight per tag
+    uint32_t index = 0;
+    spinlock_acquire(&g_usb_mass_lock);
+    while (index < g_usb_mass_count && g_usb_mass_devices[index] != dev) {
+        index++;
+    }
+    spinlock_release(&g_usb_mass_lock);
+    
+    char name[BLOCK_NAME_LENGTH];
+    snprintf(name, sizeof(name), "usb%u", index);
+    block_limits_t limits = {
+        .logical_block = dev->block_size,
+        .max_sectors = dev->max_transfer / BLOCK_SECTOR_SIZE,
+        .depth = dev->uas ? dev->tags : 1,
+        .capacity = dev->capacity / BLOCK_SECTOR_SIZE,
+        .sync_only = !dev->uas
+    };
+    dev->block = block_register(handle, 0, name, BLOCK_SCHED_DEADLINE, &limits);
     return 0;
 }
 
 static void usb_mass_detach(device_handle_t* handle) {
     usb_mass_device_t* dev = (usb_mass_device_t*)handle->driver_data;
     dev->state = USB_MASS_STATE_DISCONNECTED;
+    
+    if (dev->block) {
+        block_unregister(dev->block);
+        dev->block = NULL;
+    }
+}
+
+// Synchronous under BOT: the completion, if any, runs before returning.
+// UAS reads and writes with a completion are queued and return IO_PENDING,
+// or IO_BUSY while every tag is taken. offset and size are in bytes and
+// must be whole device blocks.
+static io_result_t usb_mass_io_request(device_handle_t* handle, io_packet_t* packet) {
+    usb_mass_device_t* dev = (usb_mass_device_t*)handle->driver_data;
+    if (!dev || dev->state != USB_MASS_STATE_READY || packet->unit != 0) {
+        return IO_NO_DEVICE;
+    }
+    
+    switch (packet->operation) {
+        case IO_OP_READ:
+        case IO_OP_WRITE: {
+            bool is_write = packet->operation == IO_OP_WRITE;
+            if (packet->size == 0 || packet->size > dev->max_transfer ||
+                packet->offset % dev->block_size || packet->size % dev->block_size) {
+                return IO_ERROR;
+            }
+            uint64_t lba = packet->offset / dev->block_size;
+            uint32_t count = packet->size / dev->block_size;
+            
+            if (resonance_io_async(packet) && dev->uas) {
+                if (is_write && dev->write_protected) {
+                    return IO_ERROR;
+                }
+                uint8_t cdb[16];
+                uint8_t cdb_len = usb_mass_build_rw(cdb, lba, count, is_write);
+                return usb_mass_submit(dev, cdb, cdb_len, packet->buffer,
+                                       (uint32_t)packet->size, is_write, packet);
+            }
+            
+            int result = is_write ?
+                usb_mass_write(dev, lba, count, packet->buffer) :
+                usb_mass_read(dev, lba, count, packet->buffer);
+            packet->status = result == 0 ? IO_SUCCESS : IO_ERROR;
+            break;
+        }
+        
+        case IO_OP_FLUSH:
+            packet->status = IO_SUCCESS;    // Devices report writes once stable
+            break;
+        
+        default:
+            return IO_ERROR;
+    }
+    
+    if (resonance_io_async(packet)) {
+        resonance_io_complete(packet, packet->status);
+        return IO_PENDING;
+    }
+    return packet->status;
 }
 
 // Driver registration
@@ -387,7 +798,8 @@ static resonance_driver_t usb_mass_driver = {
     .subclass_code = 0xFF,  // Any subclass
     .probe = usb_mass_probe,
     .attach = usb_mass_attach,
-    .detach = usb_mass_detach
+    .detach = usb_mass_detach,
+    .io_request = usb_mass_io_request
 };
 
 void usb_mass_init(void) {
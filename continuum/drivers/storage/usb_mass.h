@@ -1,6 +1,6 @@
 /*
  * USB Mass Storage Driver Header
- * Bulk-Only Transport definitions
+ * Bulk-Only Transport and USB Attached SCSI definitions
  */
 
 #ifndef USB_MASS_H
@@ -10,12 +10,21 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "../resonance.h"
+#include "../usb/xhci.h"
 
 // =============================================================================
 // USB Constants
 // =============================================================================
 
 #define MAX_USB_MASS_DEVICES    32
+#define USB_MASS_MAX_TRANSFER   (128 * 1024)    // Bytes per command at high speed
+#define USB_MASS_MAX_TRANSFER_SS (1024 * 1024)  // ...at SuperSpeed
+#define USB_MASS_UAS_TAGS       32              // Commands in flight on a UAS device, at most 32
+#define USB_MASS_UAS_STATUS_SIZE 64             // Sense IU with fixed-format sense data
+#define USB_MASS_POLL_SPIN      20              // Waiters poll this long before yielding (microseconds)
+#define USB_MASS_TIMEOUT        5000000         // Before reset recovery (microseconds)
+#define USB_MASS_IU_SIZE        128             // A command's CBW or command IU, then...
+#define USB_MASS_IU_STATUS      64              // ...its CSW or sense IU at this offset
 
 // USB Classes
 #define USB_CLASS_MASS_STORAGE  0x08
@@ -27,6 +36,7 @@
 #define USB_MASS_PROTOCOL_CBI   0x00  // Control/Bulk/Interrupt
 #define USB_MASS_PROTOCOL_CB    0x01  // Control/Bulk
 #define USB_MASS_PROTOCOL_BBB   0x50  // Bulk-Only Transport
+#define USB_MASS_PROTOCOL_UAS   0x62  // USB Attached SCSI
 
 // USB Requests
 #define USB_REQUEST_CLEAR_FEATURE   0x01
@@ -36,6 +46,11 @@
 #define USB_MASS_REQUEST_RESET      0xFF
 #define USB_MASS_REQUEST_GET_MAX_LUN 0xFE
 
+// UAS Information Unit IDs
+#define UAS_IU_COMMAND              0x01
+#define UAS_IU_SENSE                0x03
+#define UAS_IU_RESPONSE             0x04
+
 // CBW/CSW Signatures
 #define CBW_SIGNATURE   0x43425355  // "USBC"
 #define CSW_SIGNATURE   0x53425355  // "USBS"
@@ -58,6 +73,8 @@
 #define SCSI_CMD_WRITE_12            0xAA
 #define SCSI_CMD_READ_16             0x88
 #define SCSI_CMD_WRITE_16            0x8A
+#define SCSI_CMD_SERVICE_ACTION_IN_16 0x9E
+#define SCSI_SAI_READ_CAPACITY_16    0x10
 
 // SCSI Status
 #define SCSI_STATUS_GOOD             0x00
@@ -98,6 +115,31 @@ typedef struct __attribute__((packed)) {
     uint8_t status;            // Command status
 } csw_t;
 
+// UAS Command IU, for CDBs of up to 16 bytes
+typedef struct __attribute__((packed)) {
+    uint8_t iu_id;              // UAS_IU_COMMAND
+    uint8_t reserved;
+    uint16_t tag;               // Big-endian; also the stream ID
+    uint8_t prio_attr;          // Task attribute, 0 = simple
+    uint8_t reserved2;
+    uint8_t add_cdb_length;
+    uint8_t reserved3;
+    uint8_t lun[8];
+    uint8_t cdb[16];
+} uas_command_iu_t;
+
+// UAS Sense IU, ending every command
+typedef struct __attribute__((packed)) {
+    uint8_t iu_id;              // UAS_IU_SENSE
+    uint8_t reserved;
+    uint16_t tag;
+    uint16_t status_qualifier;
+    uint8_t status;             // SCSI status
+    uint8_t reserved2[7];
+    uint16_t sense_length;      // Big-endian
+    uint8_t sense[];
+} uas_sense_iu_t;
+
 // =============================================================================
 // SCSI Structures
 // =============================================================================
@@ -126,6 +168,13 @@ typedef struct __attribute__((packed)) {
     uint32_t block_size;        // Big-endian
 } scsi_read_capacity_data_t;
 
+// SCSI READ CAPACITY(16) data
+typedef struct __attribute__((packed)) {
+    uint64_t last_lba;          // Big-endian
+    uint32_t block_size;        // Big-endian
+    uint8_t reserved[20];
+} scsi_read_capacity_16_data_t;
+
 // SCSI REQUEST SENSE data
 typedef struct __attribute__((packed)) {
     uint8_t error_code : 7;
@@ -149,17 +198,32 @@ typedef struct __attribute__((packed)) {
 // Driver Structures
 // =============================================================================
 
-// USB device info (from USB enumeration)
+struct usb_mass_device;
+
+// A bulk transfer; transfer must stay first
+typedef struct usb_mass_urb usb_mass_urb_t;
+struct usb_mass_urb {
+    xhci_transfer_t transfer;
+    void (*done)(usb_mass_urb_t* urb);
+    void* context;
+    uint64_t dma;               // Mapping of the buffer, 0 if none
+    uint32_t length;
+    uint32_t transferred;
+    int status;
+};
+
+// One SCSI command in flight: the device's only one under BOT, one per
+// tag under UAS
 typedef struct {
-    uint8_t address;
-    uint8_t configuration;
-    uint8_t interface;
-    uint16_t vendor_id;
-    uint16_t product_id;
-    uint8_t device_class;
-    uint8_t device_subclass;
-    uint8_t device_protocol;
-} usb_device_info_t;
+    struct usb_mass_device* dev;
+    uint16_t tag;
+    io_packet_t* packet;        // Asynchronous callers', else NULL
+    uint32_t pending;           // Transfers still outstanding
+    int status;
+    bool done;
+    usb_mass_urb_t urbs[3];     // Command, data, status
+    dma_region_t* iu;           // CBW and CSW, or command and sense IUs
+} usb_mass_command_t;
 
 // Device state
 typedef enum {
@@ -171,14 +235,30 @@ typedef enum {
 } usb_mass_state_t;
 
 // USB Mass Storage device
-typedef struct {
+typedef struct usb_mass_device {
     device_node_t* usb_device;
     usb_mass_state_t state;
     
-    // USB endpoints
+    // Host controller, NULL until the device is enumerated through one
+    xhci_controller_t* host;
+    uint8_t slot_id;
+    uint8_t speed;
+    
+    // USB endpoints; UAS moves data over the bulk pair by stream
     uint8_t bulk_in_ep;
     uint8_t bulk_out_ep;
     uint8_t interface_num;
+    uint8_t command_ep;         // UAS command and status pipes
+    uint8_t status_ep;
+    
+    // Transport
+    bool uas;
+    uint32_t max_transfer;      // Bytes per command
+    usb_mass_command_t bot;     // BOT's one command, claimed through bot_busy
+    bool bot_busy;
+    usb_mass_command_t* commands;   // UAS, by tag - 1
+    uint32_t tags;
+    uint32_t tags_free;         // Bitmap, under lock
     
     // Device properties
     uint8_t lun;                // Current LUN
@@ -194,10 +274,13 @@ typedef struct {
     bool write_protected;
     
     // Storage capacity
-    uint32_t last_lba;
+    uint64_t last_lba;
     uint32_t block_size;
     uint64_t capacity;
     
+    // Block layer queue, set once attached
+    struct block_queue* block;
+    
     // Statistics
     uint64_t commands_sent;
     uint64_t bytes_read;
@@ -4,8 +4,10 @@
  */
 
 #include "virtio_block.h"
+#include "block.h"
 #include "../resonance.h"
 #include "../../flux_memory.h"
+#include "../../temporal_scheduler.h"
 
 // =============================================================================
 // Global VirtIO Block State
@@ -71,6 +73,42 @@ static void virtio_write32(virtio_blk_device_t* dev, uint32_t offset, uint32_t v
 // VirtQueue Management
 // =============================================================================
 
+// The driver's used_event trails the available ring, the device's
+// avail_event trails the used ring
+static inline volatile uint16_t* virtqueue_used_event(virtqueue_t* vq) {
+    return (volatile uint16_t*)((uint8_t*)vq->avail + sizeof(virtq_avail_t) +
+                                vq->queue_size * sizeof(uint16_t));
+}
+
+static inline volatile uint16_t* virtqueue_avail_event(virtqueue_t* vq) {
+    return (volatile uint16_t*)((uint8_t*)vq->used + sizeof(virtq_used_t) +
+                                vq->queue_size * sizeof(virtq_used_elem_t));
+}
+
+// True once new_idx has moved past the index the other side asked to hear
+// about, given it was old_idx at the last notification
+static inline bool vring_need_event(uint16_t event, uint16_t new_idx, uint16_t old_idx) {
+    return (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old_idx);
+}
+
+static void virtqueue_destroy(virtqueue_t* vq) {
+    if (!vq) {
+        return;
+    }
+    
+    if (vq->queue_dma) {
+        resonance_free_dma(vq->queue_dma);
+    }
+    if (vq->pool_dma) {
+        resonance_free_dma(vq->pool_dma);
+    }
+    if (vq->requests) {
+        flux_free(vq->requests);
+    }
+    
+    flux_free(vq);
+}
+
 static virtqueue_t* virtqueue_create(virtio_blk_device_t* dev, uint16_t queue_idx,
                                      uint16_t queue_size) {
     virtqueue_t* vq = flux_allocate(NULL, sizeof(virtqueue_t),
@@ -85,28 +123,33 @@ static virtqueue_t* virtqueue_create(virtio_blk_device_t* dev, uint16_t queue_id
     vq->last_avail_idx = 0;
     vq->device = dev;
     
-    // Calculate memory requirements
+    // Legacy layout: descriptors and the available ring (with used_event),
+    // then the used ring (with avail_event) on the next aligned page
     size_t desc_size = queue_size * sizeof(virtq_desc_t);
-    size_t avail_size = sizeof(virtq_avail_t) + queue_size * sizeof(uint16_t);
-    size_t used_size = sizeof(virtq_used_t) + queue_size * sizeof(virtq_used_elem_t);
-    size_t total_size = desc_size + avail_size + used_size;
+    size_t avail_size = sizeof(virtq_avail_t) + (queue_size + 1) * sizeof(uint16_t);
+    size_t used_size = sizeof(virtq_used_t) + queue_size * sizeof(virtq_used_elem_t) +
+                       sizeof(uint16_t);
+    size_t used_offset = (desc_size + avail_size + VIRTIO_VRING_ALIGN - 1) &
+                         ~(size_t)(VIRTIO_VRING_ALIGN - 1);
+    size_t total_size = used_offset + ((used_size + VIRTIO_VRING_ALIGN - 1) &
+                                       ~(size_t)(VIRTIO_VRING_ALIGN - 1));
     
     // Allocate queue memory (must be physically contiguous)
     vq->queue_dma = resonance_alloc_dma(total_size, DMA_FLAG_COHERENT);
-    if (!vq->queue_dma) {
-        flux_free(vq);
+    vq->pool_dma = resonance_alloc_dma(VIRTIO_BLK_POOL_SIZE * sizeof(virtio_blk_req_dma_t),
+                                       DMA_FLAG_COHERENT);
+    vq->requests = flux_allocate(NULL, queue_size * sizeof(virtio_blk_request_t*),
+                                 FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!vq->queue_dma || !vq->pool_dma || !vq->requests) {
+        virtqueue_destroy(vq);
         return NULL;
     }
     
     // Setup queue pointers
+    memset(vq->queue_dma->virtual_addr, 0, total_size);
     vq->desc = (virtq_desc_t*)vq->queue_dma->virtual_addr;
     vq->avail = (virtq_avail_t*)((uint8_t*)vq->desc + desc_size);
-    vq->used = (virtq_used_t*)((uint8_t*)vq->avail + avail_size);
-    
-    // Clear queue memory
-    memset(vq->desc, 0, desc_size);
-    memset(vq->avail, 0, avail_size);
-    memset(vq->used, 0, used_size);
+    vq->used = (virtq_used_t*)((uint8_t*)vq->desc + used_offset);
     
     // Initialize free descriptor list
     vq->free_head = 0;
@@ -114,227 +157,500 @@ static virtqueue_t* virtqueue_create(virtio_blk_device_t* dev, uint16_t queue_id
         vq->desc[i].next = i + 1;
     }
     vq->desc[queue_size - 1].next = 0xFFFF;  // End marker
+    vq->num_free = queue_size;
+    
+    // Every request owns a slice of the pool region for its indirect
+    // table, header and status, so submitting allocates nothing
+    virtio_blk_req_dma_t* slices = (virtio_blk_req_dma_t*)vq->pool_dma->virtual_addr;
+    vq->free_requests = NULL;
+    for (int i = VIRTIO_BLK_POOL_SIZE - 1; i >= 0; i--) {
+        virtio_blk_request_t* req = &vq->pool[i];
+        req->dma = &slices[i];
+        req->dma_phys = vq->pool_dma->physical_addr + i * sizeof(virtio_blk_req_dma_t);
+        req->next_free = vq->free_requests;
+        vq->free_requests = req;
+    }
+    
+    // Interrupts stay on: without EVENT_IDX the device raises one per
+    // used buffer, with it used_event is kept at the next one we want
+    *virtqueue_used_event(vq) = 0;
     
     spinlock_init(&vq->lock);
     
     return vq;
 }
 
-static void virtqueue_destroy(virtqueue_t* vq) {
-    if (!vq) {
-        return;
-    }
-    
-    if (vq->queue_dma) {
-        resonance_free_dma(vq->queue_dma);
+// Caller holds vq->lock for the request pool and descriptor helpers
+static virtio_blk_request_t* virtqueue_get_request(virtqueue_t* vq) {
+    virtio_blk_request_t* req = vq->free_requests;
+    if (req) {
+        vq->free_requests = req->next_free;
     }
-    
-    flux_free(vq);
+    return req;
 }
 
-static uint16_t virtqueue_alloc_desc(virtqueue_t* vq) {
-    if (vq->free_head == 0xFFFF) {
-        return 0xFFFF;  // No free descriptors
-    }
-    
-    uint16_t desc_idx = vq->free_head;
-    vq->free_head = vq->desc[desc_idx].next;
-    return desc_idx;
+static void virtqueue_put_request(virtqueue_t* vq, virtio_blk_request_t* req) {
+    req->wait = NULL;
+    req->callback = NULL;
+    req->context = NULL;
+    req->bounce = NULL;
+    req->buffer = NULL;
+    req->next_free = vq->free_requests;
+    vq->free_requests = req;
 }
 
-static void virtqueue_free_desc(virtqueue_t* vq, uint16_t desc_idx) {
-    vq->desc[desc_idx].next = vq->free_head;
-    vq->free_head = desc_idx;
+static void virtqueue_free_chain(virtqueue_t* vq, uint16_t head) {
+    uint16_t current = head;
+    while (current != 0xFFFF) {
+        uint16_t next = (vq->desc[current].flags & VIRTQ_DESC_F_NEXT) ?
+                       vq->desc[current].next : 0xFFFF;
+        vq->desc[current].next = vq->free_head;
+        vq->free_head = current;
+        vq->num_free++;
+        current = next;
+    }
 }
 
-static int virtqueue_add_buffer(virtqueue_t* vq, virtio_blk_request_t* req) {
-    spinlock_acquire(&vq->lock);
-    
-    // Allocate descriptors for request header, data, and status
-    uint16_t head_desc = virtqueue_alloc_desc(vq);
-    uint16_t data_desc = virtqueue_alloc_desc(vq);
-    uint16_t status_desc = virtqueue_alloc_desc(vq);
-    
-    if (head_desc == 0xFFFF || data_desc == 0xFFFF || status_desc == 0xFFFF) {
-        // Free any allocated descriptors
-        if (head_desc != 0xFFFF) virtqueue_free_desc(vq, head_desc);
-        if (data_desc != 0xFFFF) virtqueue_free_desc(vq, data_desc);
-        if (status_desc != 0xFFFF) virtqueue_free_desc(vq, status_desc);
-        spinlock_release(&vq->lock);
+// Put req's descriptor table (count entries) on the ring: as one indirect
+// descriptor when negotiated, else copied into a chain of ring
+// descriptors. Returns whether the device wants a notification, or -1 when
+// the ring is full.
+static int virtqueue_post(virtqueue_t* vq, virtio_blk_request_t* req, uint16_t count) {
+    virtq_desc_t* table = req->dma->indirect;
+    uint16_t needed = vq->device->indirect ? 1 : count;
+    if (vq->num_free < needed) {
         return -1;
     }
     
-    // Setup request header descriptor
-    vq->desc[head_desc].addr = req->header_phys;
-    vq->desc[head_desc].len = sizeof(virtio_blk_req_header_t);
-    vq->desc[head_desc].flags = VIRTQ_DESC_F_NEXT;
-    vq->desc[head_desc].next = data_desc;
-    
-    // Setup data descriptor
-    vq->desc[data_desc].addr = req->data_phys;
-    vq->desc[data_desc].len = req->data_len;
-    vq->desc[data_desc].flags = VIRTQ_DESC_F_NEXT;
-    if (req->header->type == VIRTIO_BLK_T_IN) {
-        vq->desc[data_desc].flags |= VIRTQ_DESC_F_WRITE;  // Device writes to buffer
+    uint16_t head = vq->free_head;
+    if (vq->device->indirect) {
+        vq->free_head = vq->desc[head].next;
+        vq->desc[head].addr = req->dma_phys + offsetof(virtio_blk_req_dma_t, indirect);
+        vq->desc[head].len = count * sizeof(virtq_desc_t);
+        vq->desc[head].flags = VIRTQ_DESC_F_INDIRECT;
+    } else {
+        uint16_t current = head;
+        for (uint16_t i = 0; i < count; i++) {
+            uint16_t next = vq->desc[current].next;
+            vq->desc[current].addr = table[i].addr;
+            vq->desc[current].len = table[i].len;
+            vq->desc[current].flags = table[i].flags;
+            current = next;
+        }
+        vq->free_head = current;
     }
-    vq->desc[data_desc].next = status_desc;
+    vq->num_free -= needed;
     
-    // Setup status descriptor
-    vq->desc[status_desc].addr = req->status_phys;
-    vq->desc[status_desc].len = 1;
-    vq->desc[status_desc].flags = VIRTQ_DESC_F_WRITE;  // Device writes status
+    req->head = head;
+    req->descs = needed;
+    vq->requests[head] = req;
     
     // Add to available ring
-    uint16_t avail_idx = vq->avail->idx % vq->queue_size;
-    vq->avail->ring[avail_idx] = head_desc;
-    __sync_synchronize();  // Memory barrier
-    vq->avail->idx++;
-    
-    // Store request for completion handling
-    vq->requests[head_desc] = req;
+    uint16_t old_idx = vq->avail->idx;
+    vq->avail->ring[old_idx % vq->queue_size] = head;
+    __sync_synchronize();  // Descriptors before the index
+    vq->avail->idx = old_idx + 1;
+    vq->last_avail_idx = old_idx + 1;
+    __sync_synchronize();  // Index before reading the device's suppression state
+    
+    if (vq->device->event_idx) {
+        return vring_need_event(*virtqueue_avail_event(vq), old_idx + 1, old_idx);
+    }
+    return !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+}
+
+static void virtqueue_notify(virtqueue_t* vq) {
+    virtio_write16(vq->device, VIRTIO_PCI_QUEUE_NOTIFY, vq->queue_idx);
+}
+
+// =============================================================================
+// Request Submission and Completion
+// =============================================================================
+
+// A request the completion path has taken off the ring, finished after
+// the queue lock is dropped
+typedef struct {
+    virtio_blk_wait_t* wait;
+    virtio_blk_callback_t callback;
+    void* context;
+    dma_region_t* bounce;
+    void* buffer;
+    size_t length;
+    int status;
+} virtio_blk_done_t;
+
+// Copy a bounced read out, then wake the waiter or run the callback. Runs
+// without the queue lock so the callback can resubmit.
+static void virtio_blk_finish(virtio_blk_done_t* done) {
+    if (done->bounce) {
+        if (done->status == 0 && done->buffer) {
+            memcpy(done->buffer, done->bounce->virtual_addr, done->length);
+        }
+        resonance_free_dma(done->bounce);
+    }
     
-    spinlock_release(&vq->lock);
+    if (done->wait) {
+        done->wait->status = done->status;
+        __atomic_store_n(&done->wait->done, true, __ATOMIC_RELEASE);
+    }
+    if (done->callback) {
+        done->callback(done->context, done->status);
+    }
+}
+
+// Reap the used ring VIRTIO_BLK_COMPLETION_BATCH entries at a time.
+// Called from the queue interrupt and from waiters, so the lock is taken
+// with interrupts masked. Returns whether anything completed.
+static bool virtqueue_process(virtqueue_t* vq) {
+    virtio_blk_done_t done[VIRTIO_BLK_COMPLETION_BATCH];
+    bool reaped = false;
+    bool more = true;
+    
+    while (more) {
+        uint32_t count = 0;
+        
+        uint64_t flags = cpu_irq_save();
+        spinlock_acquire(&vq->lock);
+        
+        while (count < VIRTIO_BLK_COMPLETION_BATCH &&
+               vq->last_used_idx != *(volatile uint16_t*)&vq->used->idx) {
+            __sync_synchronize();  // Index before the element it covers
+            virtq_used_elem_t* elem = &vq->used->ring[vq->last_used_idx % vq->queue_size];
+            vq->last_used_idx++;
+            
+            uint16_t head = (uint16_t)elem->id;
+            virtio_blk_request_t* req = head < vq->queue_size ? vq->requests[head] : NULL;
+            if (!req) {
+                continue;
+            }
+            vq->requests[head] = NULL;
+            virtqueue_free_chain(vq, head);
+            
+            done[count++] = (virtio_blk_done_t){
+                .wait = req->wait,
+                .callback = req->callback,
+                .context = req->context,
+                .bounce = req->bounce,
+                .buffer = req->buffer,
+                .length = req->length,
+                .status = req->dma->status == VIRTIO_BLK_S_OK ? 0 : -1
+            };
+            virtqueue_put_request(vq, req);
+        }
+        
+        // Ask for an interrupt on the next completion, then look again in
+        // case it landed before the device saw the update
+        if (vq->device->event_idx) {
+            *virtqueue_used_event(vq) = vq->last_used_idx;
+            __sync_synchronize();
+        }
+        more = vq->last_used_idx != *(volatile uint16_t*)&vq->used->idx;
+        
+        spinlock_release(&vq->lock);
+        cpu_irq_restore(flags);
+        
+        for (uint32_t i = 0; i < count; i++) {
+            virtio_blk_finish(&done[i]);
+        }
+        reaped |= count > 0;
+    }
     
-    // Notify device
-    if (vq->device->common_cfg) {
-        mmio_write16(vq->device->common_cfg + VIRTIO_PCI_QUEUE_NOTIFY, vq->queue_idx);
-    } else {
-        outw(vq->device->io_base + VIRTIO_PCI_QUEUE_NOTIFY, vq->queue_idx);
+    return reaped;
+}
+
+// Describe size bytes at va as data segments in segs, coalescing
+// physically contiguous pages up to size_max. Returns the segment count,
+// or 0 when a page can't take DMA or more than seg_max are needed.
+static uint16_t virtio_blk_map(virtio_blk_device_t* dev, virtq_desc_t* segs,
+                               memory_domain_t* domain, uint64_t va, size_t size,
+                               bool device_writes) {
+    uint16_t count = 0;
+    uint16_t flags = VIRTQ_DESC_F_NEXT | (device_writes ? VIRTQ_DESC_F_WRITE : 0);
+    
+    for (size_t done = 0; done < size; ) {
+        size_t chunk = FLUX_PAGE_SIZE - ((va + done) & (FLUX_PAGE_SIZE - 1));
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        uint64_t phys = flux_dma_address(domain, va + done, device_writes);
+        if (!phys) {
+            return 0;
+        }
+        
+        virtq_desc_t* last = count ? &segs[count - 1] : NULL;
+        if (last && last->addr + last->len == phys && last->len + chunk <= dev->size_max) {
+            last->len += chunk;
+        } else {
+            if (count == dev->seg_max) {
+                return 0;
+            }
+            segs[count].addr = phys;
+            segs[count].len = chunk;
+            segs[count].flags = flags;
+            segs[count].next = count + 2;
+            count++;
+        }
+        done += chunk;
     }
     
-    return 0;
+    return count;
 }
 
-static virtio_blk_request_t* virtqueue_get_completed(virtqueue_t* vq) {
+// Build a request from the queue's pool and post it. Data comes straight
+// from the caller's pages when they can take DMA, else through a bounce
+// buffer. IO_BUSY means the pool or ring is full until completions are
+// reaped.
+static io_result_t virtqueue_submit(virtqueue_t* vq, uint32_t type, uint64_t sector,
+                                    memory_domain_t* domain, void* buffer, size_t size,
+                                    virtio_blk_wait_t* wait, virtio_blk_callback_t callback,
+                                    void* context, virtio_blk_request_t** submitted) {
+    virtio_blk_device_t* dev = vq->device;
+    bool device_writes = type == VIRTIO_BLK_T_IN;
+    
+    uint64_t flags = cpu_irq_save();
     spinlock_acquire(&vq->lock);
-    
-    if (vq->last_used_idx == vq->used->idx) {
-        spinlock_release(&vq->lock);
-        return NULL;  // No completed requests
+    virtio_blk_request_t* req = virtqueue_get_request(vq);
+    spinlock_release(&vq->lock);
+    cpu_irq_restore(flags);
+    if (!req) {
+        return IO_BUSY;
     }
     
-    // Get completed descriptor
-    uint16_t used_idx = vq->last_used_idx % vq->queue_size;
-    uint32_t desc_idx = vq->used->ring[used_idx].id;
+    // The pool slot is ours now; fill it in without the lock
+    virtio_blk_req_dma_t* dma = req->dma;
+    dma->header.type = type;
+    dma->header.reserved = 0;
+    dma->header.sector = sector;
+    dma->status = 0xFF;
+    
+    uint16_t segs = 0;
+    dma_region_t* bounce = NULL;
+    if (size) {
+        segs = virtio_blk_map(dev, &dma->indirect[1], domain, (uint64_t)buffer, size,
+                              device_writes);
+        if (!segs) {
+            bounce = resonance_alloc_dma(size, DMA_FLAG_COHERENT);
+            if (bounce) {
+                segs = virtio_blk_map(dev, &dma->indirect[1], NULL,
+                                      (uint64_t)bounce->virtual_addr, size, device_writes);
+            }
+            if (!segs) {
+                if (bounce) {
+                    resonance_free_dma(bounce);
+                }
+                flags = cpu_irq_save();
+                spinlock_acquire(&vq->lock);
+                virtqueue_put_request(vq, req);
+                spinlock_release(&vq->lock);
+                cpu_irq_restore(flags);
+                return IO_ERROR;
+            }
+            if (!device_writes) {
+                memcpy(bounce->virtual_addr, buffer, size);
+            }
+        }
+    }
     
-    // Get request
-    virtio_blk_request_t* req = vq->requests[desc_idx];
-    vq->requests[desc_idx] = NULL;
+    // Header, data segments, status; next links index the table itself
+    uint16_t count = segs + 2;
+    dma->indirect[0].addr = req->dma_phys + offsetof(virtio_blk_req_dma_t, header);
+    dma->indirect[0].len = sizeof(virtio_blk_req_header_t);
+    dma->indirect[0].flags = VIRTQ_DESC_F_NEXT;
+    dma->indirect[0].next = 1;
+    dma->indirect[count - 1].addr = req->dma_phys + offsetof(virtio_blk_req_dma_t, status);
+    dma->indirect[count - 1].len = 1;
+    dma->indirect[count - 1].flags = VIRTQ_DESC_F_WRITE;
+    dma->indirect[count - 1].next = 0;
+    
+    req->wait = wait;
+    req->callback = callback;
+    req->context = context;
+    req->bounce = bounce;
+    req->buffer = device_writes ? buffer : NULL;
+    req->length = size;
+    
+    flags = cpu_irq_save();
+    spinlock_acquire(&vq->lock);
+    int notify = virtqueue_post(vq, req, count);
+    if (notify < 0) {
+        virtqueue_put_request(vq, req);
+    }
+    spinlock_release(&vq->lock);
+    cpu_irq_restore(flags);
     
-    // Free descriptor chain
-    uint16_t current = desc_idx;
-    while (current != 0xFFFF) {
-        uint16_t next = (vq->desc[current].flags & VIRTQ_DESC_F_NEXT) ?
-                       vq->desc[current].next : 0xFFFF;
-        virtqueue_free_desc(vq, current);
-        current = next;
+    if (notify < 0) {
+        if (bounce) {
+            resonance_free_dma(bounce);
+        }
+        return IO_BUSY;
+    }
+    if (notify) {
+        virtqueue_notify(vq);
     }
     
-    vq->last_used_idx++;
+    if (type == VIRTIO_BLK_T_IN) {
+        __atomic_fetch_add(&dev->reads, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&dev->bytes_read, size, __ATOMIC_RELAXED);
+    } else if (type == VIRTIO_BLK_T_OUT) {
+        __atomic_fetch_add(&dev->writes, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&dev->bytes_written, size, __ATOMIC_RELAXED);
+    }
     
-    spinlock_release(&vq->lock);
+    if (submitted) {
+        *submitted = req;
+    }
+    return IO_PENDING;
+}
+
+// Wait for a synchronous request. The waiter polls for
+// VIRTIO_BLK_POLL_SPIN microseconds; after that, with the queue interrupt
+// wired, the CPU is yielded between checks. Legacy virtio can't abort a
+// request, so on timeout it's left to complete on its own with nobody
+// waiting (a bounce buffer is freed then; the caller's own pages may
+// still be written).
+static int virtqueue_wait(virtqueue_t* vq, virtio_blk_request_t* req,
+                          virtio_blk_wait_t* wait, uint64_t timeout) {
+    uint64_t spin_until = continuum_get_time() + continuum_usec_to_tsc(VIRTIO_BLK_POLL_SPIN);
+    
+    while (!__atomic_load_n(&wait->done, __ATOMIC_ACQUIRE)) {
+        if (virtqueue_process(vq)) {
+            continue;
+        }
+        
+        uint64_t now = continuum_get_time();
+        if (now >= timeout) {
+            uint64_t flags = cpu_irq_save();
+            spinlock_acquire(&vq->lock);
+            bool abandoned = req->wait == wait;
+            if (abandoned) {
+                req->wait = NULL;
+                req->buffer = NULL;
+            }
+            spinlock_release(&vq->lock);
+            cpu_irq_restore(flags);
+            
+            // Otherwise the completion path has it and is about to finish
+            if (abandoned) {
+                return -1;
+            }
+        } else if (vq->irq && now >= spin_until) {
+            quantum_context_t* current = temporal_get_current();
+            if (current) {
+                temporal_yield(current);
+            }
+        }
+    }
     
-    return req;
+    return wait->status;
+}
+
+// The submitting CPU's queue
+static virtqueue_t* virtio_blk_queue(virtio_blk_device_t* dev) {
+    uint32_t cpu = temporal_get_current_cpu();
+    return dev->cpu_queues[cpu < MAX_CPU_CORES ? cpu : 0];
 }
 
 // =============================================================================
 // VirtIO Block Operations
 // =============================================================================
 
-static int virtio_blk_do_request(virtio_blk_device_t* dev, uint32_t type,
-                                 uint64_t sector, void* buffer, size_t size) {
-    // Allocate request structure
-    virtio_blk_request_t* req = flux_allocate(NULL, sizeof(virtio_blk_request_t),
-                                              FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
-    if (!req) {
-        return -1;
-    }
-    
-    // Allocate DMA regions
-    req->header_dma = resonance_alloc_dma(sizeof(virtio_blk_req_header_t),
-                                          DMA_FLAG_COHERENT);
-    req->data_dma = resonance_alloc_dma(size, DMA_FLAG_COHERENT);
-    req->status_dma = resonance_alloc_dma(1, DMA_FLAG_COHERENT);
-    
-    if (!req->header_dma || !req->data_dma || !req->status_dma) {
-        if (req->header_dma) resonance_free_dma(req->header_dma);
-        if (req->data_dma) resonance_free_dma(req->data_dma);
-        if (req->status_dma) resonance_free_dma(req->status_dma);
-        flux_free(req);
+static int virtio_blk_do_request(virtio_blk_device_t* dev, uint32_t type, uint64_t sector,
+                                 memory_domain_t* domain, void* buffer, size_t size) {
+    if (!dev || dev->num_queues == 0 || (size && !buffer)) {
         return -1;
     }
-    
-    // Setup request header
-    req->header = (virtio_blk_req_header_t*)req->header_dma->virtual_addr;
-    req->header->type = type;
-    req->header->reserved = 0;
-    req->header->sector = sector;
-    req->header_phys = req->header_dma->physical_addr;
-    
-    // Setup data buffer
-    req->data = req->data_dma->virtual_addr;
-    req->data_phys = req->data_dma->physical_addr;
-    req->data_len = size;
-    
-    if (type == VIRTIO_BLK_T_OUT) {
-        memcpy(req->data, buffer, size);
-    }
-    
-    // Setup status
-    req->status = (uint8_t*)req->status_dma->virtual_addr;
-    req->status_phys = req->status_dma->physical_addr;
-    *req->status = 0xFF;  // Initial status
-    
-    // Submit request
-    if (virtqueue_add_buffer(dev->vq, req) != 0) {
-        resonance_free_dma(req->header_dma);
-        resonance_free_dma(req->data_dma);
-        resonance_free_dma(req->status_dma);
-        flux_free(req);
+    if (type == VIRTIO_BLK_T_OUT && dev->readonly) {
         return -1;
     }
     
-    // Wait for completion (simplified - should use interrupts)
-    uint64_t timeout = continuum_get_time() + 5000000;  // 5 seconds
-    while (continuum_get_time() < timeout) {
-        virtio_blk_request_t* completed = virtqueue_get_completed(dev->vq);
-        if (completed == req) {
-            // Check status
-            uint8_t status = *req->status;
-            
-            // Copy data if read
-            if (type == VIRTIO_BLK_T_IN && status == VIRTIO_BLK_S_OK) {
-                memcpy(buffer, req->data, size);
+    virtqueue_t* vq = virtio_blk_queue(dev);
+    
+    // Split at what one request can describe
+    do {
+        size_t chunk = size < dev->max_transfer ? size : dev->max_transfer;
+        virtio_blk_wait_t wait = { .done = false, .status = 0 };
+        virtio_blk_request_t* req = NULL;
+        uint64_t timeout = continuum_get_time() + continuum_usec_to_tsc(VIRTIO_BLK_IO_TIMEOUT);
+        
+        io_result_t result;
+        while ((result = virtqueue_submit(vq, type, sector, domain, buffer, chunk,
+                                          &wait, NULL, NULL, &req)) == IO_BUSY) {
+            if (!virtqueue_process(vq) && continuum_get_time() >= timeout) {
+                return -1;
             }
-            
-            // Free resources
-            resonance_free_dma(req->header_dma);
-            resonance_free_dma(req->data_dma);
-            resonance_free_dma(req->status_dma);
-            flux_free(req);
-            
-            return (status == VIRTIO_BLK_S_OK) ? 0 : -1;
         }
-    }
+        if (result != IO_PENDING) {
+            return -1;
+        }
+        
+        int status = virtqueue_wait(vq, req, &wait, timeout);
+        if (status != 0) {
+            return status;
+        }
+        
+        sector += chunk / VIRTIO_BLK_SECTOR_SIZE;
+        buffer = (uint8_t*)buffer + chunk;
+        size -= chunk;
+    } while (size > 0);
     
-    // Timeout
-    return -1;
+    return 0;
 }
 
 int virtio_blk_read(virtio_blk_device_t* dev, uint64_t sector,
                    uint32_t count, void* buffer) {
-    return virtio_blk_do_request(dev, VIRTIO_BLK_T_IN, sector,
-                                 buffer, count * 512);
+    if (count == 0) {
+        return -1;
+    }
+    return virtio_blk_do_request(dev, VIRTIO_BLK_T_IN, sector, NULL,
+                                 buffer, (size_t)count * VIRTIO_BLK_SECTOR_SIZE);
 }
 
 int virtio_blk_write(virtio_blk_device_t* dev, uint64_t sector,
                     uint32_t count, void* buffer) {
-    return virtio_blk_do_request(dev, VIRTIO_BLK_T_OUT, sector,
-                                 buffer, count * 512);
+    if (count == 0) {
+        return -1;
+    }
+    return virtio_blk_do_request(dev, VIRTIO_BLK_T_OUT, sector, NULL,
+                                 buffer, (size_t)count * VIRTIO_BLK_SECTOR_SIZE);
 }
 
 int virtio_blk_flush(virtio_blk_device_t* dev) {
-    return virtio_blk_do_request(dev, VIRTIO_BLK_T_FLUSH, 0, NULL, 0);
+    // Without VIRTIO_BLK_F_FLUSH the device has no volatile cache
+    if (dev && !(dev->driver_features & VIRTIO_BLK_F_FLUSH)) {
+        return 0;
+    }
+    return virtio_blk_do_request(dev, VIRTIO_BLK_T_FLUSH, 0, NULL, NULL, 0);
+}
+
+// Post a transfer and return without waiting; callback runs from the
+// completion path, usually the queue interrupt. IO_BUSY means the
+// submitting CPU's queue is full right now.
+static io_result_t virtio_blk_submit_io(virtio_blk_device_t* dev, uint32_t type,
+                                        uint64_t sector, memory_domain_t* domain,
+                                        void* buffer, size_t size,
+                                        virtio_blk_callback_t callback, void* context) {
+    if (!dev || dev->num_queues == 0 || !buffer || !callback || size == 0 ||
+        size > dev->max_transfer) {
+        return IO_ERROR;
+    }
+    if (type == VIRTIO_BLK_T_OUT && dev->readonly) {
+        return IO_ERROR;
+    }
+    
+    return virtqueue_submit(virtio_blk_queue(dev), type, sector, domain, buffer, size,
+                            NULL, callback, context, NULL);
+}
+
+io_result_t virtio_blk_read_async(virtio_blk_device_t* dev, uint64_t sector, uint32_t count,
+                                  void* buffer, virtio_blk_callback_t callback, void* context) {
+    return virtio_blk_submit_io(dev, VIRTIO_BLK_T_IN, sector, NULL, buffer,
+                                (size_t)count * VIRTIO_BLK_SECTOR_SIZE, callback, context);
+}
+
+io_result_t virtio_blk_write_async(virtio_blk_device_t* dev, uint64_t sector, uint32_t count,
+                                   void* buffer, virtio_blk_callback_t callback, void* context) {
+    return virtio_blk_submit_io(dev, VIRTIO_BLK_T_OUT, sector, NULL, buffer,
+                                (size_t)count * VIRTIO_BLK_SECTOR_SIZE, callback, context);
 }
 
 // =============================================================================
@@ -367,6 +683,17 @@ static int virtio_blk_negotiate_features(virtio_blk_device_t* dev) {
     if (dev->device_features & VIRTIO_BLK_F_FLUSH) {
         dev->driver_features |= VIRTIO_BLK_F_FLUSH;
     }
+    if (dev->device_features & VIRTIO_BLK_F_MQ) {
+        dev->driver_features |= VIRTIO_BLK_F_MQ;
+    }
+    if (dev->device_features & VIRTIO_RING_F_INDIRECT_DESC) {
+        dev->driver_features |= VIRTIO_RING_F_INDIRECT_DESC;
+        dev->indirect = true;
+    }
+    if (dev->device_features & VIRTIO_RING_F_EVENT_IDX) {
+        dev->driver_features |= VIRTIO_RING_F_EVENT_IDX;
+        dev->event_idx = true;
+    }
     
     // Write accepted features
     virtio_write32(dev, VIRTIO_PCI_DRIVER_FEATURES, dev->driver_features);
@@ -374,28 +701,117 @@ static int virtio_blk_negotiate_features(virtio_blk_device_t* dev) {
     return 0;
 }
 
+// Device configuration follows the legacy header; read before MSI-X is
+// enabled, which would move it to VIRTIO_PCI_CONFIG_MSI
 static int virtio_blk_read_config(virtio_blk_device_t* dev) {
     // Read capacity (in 512-byte sectors)
-    dev->capacity = ((uint64_t)virtio_read32(dev, VIRTIO_BLK_CFG_CAPACITY + 4) << 32) |
-                    virtio_read32(dev, VIRTIO_BLK_CFG_CAPACITY);
+    dev->capacity =
+        ((uint64_t)virtio_read32(dev, VIRTIO_PCI_CONFIG + VIRTIO_BLK_CFG_CAPACITY + 4) << 32) |
+        virtio_read32(dev, VIRTIO_PCI_CONFIG + VIRTIO_BLK_CFG_CAPACITY);
     
     // Read block size if supported
     if (dev->driver_features & VIRTIO_BLK_F_BLK_SIZE) {
-        dev->block_size = virtio_read32(dev, VIRTIO_BLK_CFG_BLK_SIZE);
+        dev->block_size = virtio_read32(dev, VIRTIO_PCI_CONFIG + VIRTIO_BLK_CFG_BLK_SIZE);
     } else {
         dev->block_size = 512;  // Default
     }
     
     // Read geometry if supported
     if (dev->driver_features & VIRTIO_BLK_F_GEOMETRY) {
-        dev->geometry.cylinders = virtio_read16(dev, VIRTIO_BLK_CFG_GEOMETRY);
-        dev->geometry.heads = virtio_read8(dev, VIRTIO_BLK_CFG_GEOMETRY + 2);
-        dev->geometry.sectors = virtio_read8(dev, VIRTIO_BLK_CFG_GEOMETRY + 3);
+        dev->geometry.cylinders = virtio_read16(dev, VIRTIO_PCI_CONFIG + VIRTIO_BLK_CFG_GEOMETRY);
+        dev->geometry.heads = virtio_read8(dev, VIRTIO_PCI_CONFIG + VIRTIO_BLK_CFG_GEOMETRY + 2);
+        dev->geometry.sectors = virtio_read8(dev, VIRTIO_PCI_CONFIG + VIRTIO_BLK_CFG_GEOMETRY + 3);
+    }
+    
+    // Segment limits; a segment never needs to cover less than a page
+    dev->seg_max = VIRTIO_BLK_MAX_SEGS;
+    if (dev->driver_features & VIRTIO_BLK_F_SEG_MAX) {
+        uint32_t seg_max = virtio_read32(dev, VIRTIO_PCI_CONFIG + VIRTIO_BLK_CFG_SEG_MAX);
+        if (seg_max && seg_max < dev->seg_max) {
+            dev->seg_max = seg_max;
+        }
+    }
+    dev->size_max = VIRTIO_BLK_MAX_TRANSFER;
+    if (dev->driver_features & VIRTIO_BLK_F_SIZE_MAX) {
+        uint32_t size_max = virtio_read32(dev, VIRTIO_PCI_CONFIG + VIRTIO_BLK_CFG_SIZE_MAX);
+        dev->size_max = size_max < FLUX_PAGE_SIZE ? FLUX_PAGE_SIZE : size_max;
+    }
+    
+    // One request queue per CPU when the device has enough
+    dev->num_queues = 1;
+    if (dev->driver_features & VIRTIO_BLK_F_MQ) {
+        uint16_t queues = virtio_read16(dev, VIRTIO_PCI_CONFIG + VIRTIO_BLK_CFG_NUM_QUEUES);
+        uint32_t cpus = continuum_get_cpu_count();
+        if (queues > cpus) {
+            queues = cpus;
+        }
+        if (queues > VIRTIO_BLK_MAX_QUEUES) {
+            queues = VIRTIO_BLK_MAX_QUEUES;
+        }
+        if (queues > 1) {
+            dev->num_queues = queues;
+        }
     }
     
     return 0;
 }
 
+static void virtio_blk_destroy_queues(virtio_blk_device_t* dev) {
+    for (uint16_t i = 0; i < VIRTIO_BLK_MAX_QUEUES; i++) {
+        if (dev->vqs[i]) {
+            virtqueue_destroy(dev->vqs[i]);
+            dev->vqs[i] = NULL;
+        }
+    }
+    dev->num_queues = 0;
+}
+
+static int virtio_blk_setup_queues(virtio_blk_device_t* dev) {
+    uint16_t wanted = dev->num_queues;
+    dev->num_queues = 0;
+    
+    for (uint16_t i = 0; i < wanted; i++) {
+        virtio_write16(dev, VIRTIO_PCI_QUEUE_SEL, i);
+        uint16_t queue_size = virtio_read16(dev, VIRTIO_PCI_QUEUE_SIZE);
+        if (queue_size == 0) {
+            break;
+        }
+        
+        virtqueue_t* vq = virtqueue_create(dev, i, queue_size);
+        if (!vq) {
+            break;
+        }
+        dev->vqs[i] = vq;
+        dev->num_queues++;
+        
+        virtio_write32(dev, VIRTIO_PCI_QUEUE_PFN, vq->queue_dma->physical_addr >> 12);
+        
+        // A direct chain has to fit the ring alongside the header and status
+        if (!dev->indirect && dev->seg_max > (uint32_t)queue_size - 2) {
+            dev->seg_max = queue_size > 2 ? queue_size - 2 : 0;
+        }
+    }
+    
+    if (dev->num_queues == 0 || dev->seg_max == 0) {
+        virtio_blk_destroy_queues(dev);
+        return -1;
+    }
+    
+    // CPUs beyond the queue count share
+    for (uint32_t cpu = 0; cpu < MAX_CPU_CORES; cpu++) {
+        dev->cpu_queues[cpu] = dev->vqs[cpu % dev->num_queues];
+    }
+    
+    // A contiguous bounce buffer must always fit in one request
+    uint64_t max_transfer = (uint64_t)dev->seg_max * dev->size_max;
+    if (max_transfer > VIRTIO_BLK_MAX_TRANSFER) {
+        max_transfer = VIRTIO_BLK_MAX_TRANSFER;
+    }
+    dev->max_transfer = max_transfer & ~(uint64_t)(VIRTIO_BLK_SECTOR_SIZE - 1);
+    
+    return 0;
+}
+
 static int virtio_blk_init_device(virtio_blk_device_t* dev) {
     // Reset device
     virtio_write8(dev, VIRTIO_PCI_STATUS, 0);
@@ -423,26 +839,13 @@ static int virtio_blk_init_device(virtio_blk_device_t* dev) {
         return -1;  // Device doesn't support our features
     }
     
-    // Setup virtqueue
-    uint16_t queue_size = virtio_read16(dev, VIRTIO_PCI_QUEUE_SIZE);
-    if (queue_size == 0) {
+    // Read device configuration (queue count and segment limits)
+    if (virtio_blk_read_config(dev) != 0) {
         return -1;
     }
     
-    dev->vq = virtqueue_create(dev, 0, queue_size);
-    if (!dev->vq) {
-        return -1;
-    }
-    
-    // Configure queue
-    virtio_write16(dev, VIRTIO_PCI_QUEUE_SEL, 0);
-    virtio_write16(dev, VIRTIO_PCI_QUEUE_SIZE, queue_size);
-    virtio_write32(dev, VIRTIO_PCI_QUEUE_PFN,
-                   dev->vq->queue_dma->physical_addr >> 12);
-    
-    // Read device configuration
-    if (virtio_blk_read_config(dev) != 0) {
-        virtqueue_destroy(dev->vq);
+    // Setup virtqueues
+    if (virtio_blk_setup_queues(dev) != 0) {
         return -1;
     }
     
@@ -455,6 +858,74 @@ static int virtio_blk_init_device(virtio_blk_device_t* dev) {
     return 0;
 }
 
+// =============================================================================
+// Interrupts
+// =============================================================================
+
+static void virtio_blk_queue_interrupt(void* context) {
+    virtqueue_process((virtqueue_t*)context);
+}
+
+// The shared line covers every queue; reading the ISR acknowledges it
+static void virtio_blk_interrupt(void* context) {
+    virtio_blk_device_t* dev = (virtio_blk_device_t*)context;
+    
+    uint8_t isr = virtio_read8(dev, VIRTIO_PCI_ISR);
+    if (isr & 0x01) {
+        for (uint16_t i = 0; i < dev->num_queues; i++) {
+            virtqueue_process(dev->vqs[i]);
+        }
+    }
+}
+
+static void virtio_blk_release_irqs(virtio_blk_device_t* dev) {
+    if (dev->msix) {
+        for (uint16_t i = 0; i < dev->num_queues; i++) {
+            if (dev->vqs[i]->irq) {
+                virtio_write16(dev, VIRTIO_PCI_QUEUE_SEL, i);
+                virtio_write16(dev, VIRTIO_PCI_MSI_QUEUE_VECTOR, VIRTIO_MSI_NO_VECTOR);
+                resonance_unregister_irq(dev->handle, RESONANCE_IRQ_QUEUE(i));
+            }
+        }
+    } else if (dev->intx) {
+        resonance_unregister_irq(dev->handle, RESONANCE_IRQ_INTX);
+    }
+    
+    for (uint16_t i = 0; i < dev->num_queues; i++) {
+        dev->vqs[i]->irq = false;
+    }
+    dev->msix = false;
+    dev->intx = false;
+}
+
+// One MSI-X vector per queue, taken on the CPUs that submit to it; the
+// device must accept every queue's vector or it falls back to INTx
+static bool virtio_blk_setup_msix(virtio_blk_device_t* dev) {
+    dev->msix = true;
+    
+    for (uint16_t i = 0; i < dev->num_queues; i++) {
+        virtqueue_t* vq = dev->vqs[i];
+        if (resonance_register_irq(dev->handle, RESONANCE_IRQ_QUEUE(i),
+                                   virtio_blk_queue_interrupt, vq) != 0) {
+            virtio_blk_release_irqs(dev);
+            return false;
+        }
+        vq->irq = true;
+        
+        if (i == 0) {
+            virtio_write16(dev, VIRTIO_PCI_MSI_CONFIG_VECTOR, VIRTIO_MSI_NO_VECTOR);
+        }
+        virtio_write16(dev, VIRTIO_PCI_QUEUE_SEL, i);
+        virtio_write16(dev, VIRTIO_PCI_MSI_QUEUE_VECTOR, i);
+        if (virtio_read16(dev, VIRTIO_PCI_MSI_QUEUE_VECTOR) != i) {
+            virtio_blk_release_irqs(dev);
+            return false;
+        }
+    }
+    
+    return true;
+}
+
 // =============================================================================
 // Driver Interface
 // =============================================================================
@@ -501,22 +972,102 @@ static void* virtio_blk_probe(device_node_t* node) {
 
 static int virtio_blk_attach(device_handle_t* handle) {
     virtio_blk_device_t* dev = (virtio_blk_device_t*)handle->driver_data;
+    
+    // Per-queue MSI-X, else the shared line; without either, waiters poll
+    dev->handle = handle;
+    if (!virtio_blk_setup_msix(dev)) {
+        dev->intx = resonance_register_irq(handle, RESONANCE_IRQ_INTX,
+                                           virtio_blk_interrupt, dev) == 0;
+        for (uint16_t i = 0; i < dev->num_queues; i++) {
+            dev->vqs[i]->irq = dev->intx;
+        }
+    }
+    
     dev->state = VIRTIO_BLK_STATE_READY;
+    
+    // The host does its own scheduling; keep every queue's pool busy
+    uint32_t index = 0;
+    spinlock_acquire(&g_virtio_blk_lock);
+    while (index < g_virtio_blk_count && g_virtio_blk_devices[index] != dev) {
+        index++;
+    }
+    spinlock_release(&g_virtio_blk_lock);
+    
+    char name[BLOCK_NAME_LENGTH];
+    snprintf(name, sizeof(name), "vd%c", 'a' + (int)(index % 26));
+    block_limits_t limits = {
+        .logical_block = VIRTIO_BLK_SECTOR_SIZE,
+        .max_sectors = dev->max_transfer / VIRTIO_BLK_SECTOR_SIZE,
+        .depth = dev->num_queues * VIRTIO_BLK_POOL_SIZE,
+        .capacity = dev->capacity
+    };
+    dev->block = block_register(handle, 0, name, BLOCK_SCHED_NONE, &limits);
     return 0;
 }
 
 static void virtio_blk_detach(device_handle_t* handle) {
     virtio_blk_device_t* dev = (virtio_blk_device_t*)handle->driver_data;
     
+    dev->state = VIRTIO_BLK_STATE_DISABLED;
+    if (dev->block) {
+        block_unregister(dev->block);
+        dev->block = NULL;
+    }
+    virtio_blk_release_irqs(dev);
+    
     // Reset device
     virtio_write8(dev, VIRTIO_PCI_STATUS, 0);
     
-    // Free virtqueue
-    if (dev->vq) {
-        virtqueue_destroy(dev->vq);
+    // Free virtqueues
+    virtio_blk_destroy_queues(dev);
+}
+
+static void virtio_blk_packet_complete(void* context, int status) {
+    io_packet_t* packet = (io_packet_t*)context;
+    resonance_io_complete(packet, status == 0 ? IO_SUCCESS : IO_ERROR);
+}
+
+// One disk per device, so packet->unit must be 0; offset and size are in
+// bytes and must be whole sectors
+static io_result_t virtio_blk_io_request(device_handle_t* handle, io_packet_t* packet) {
+    virtio_blk_device_t* dev = (virtio_blk_device_t*)handle->driver_data;
+    if (!dev || dev->state != VIRTIO_BLK_STATE_READY || packet->unit != 0) {
+        return IO_NO_DEVICE;
     }
     
-    dev->state = VIRTIO_BLK_STATE_DISABLED;
+    switch (packet->operation) {
+        case IO_OP_READ:
+        case IO_OP_WRITE: {
+            uint32_t type = packet->operation == IO_OP_WRITE ? VIRTIO_BLK_T_OUT :
+                                                               VIRTIO_BLK_T_IN;
+            if (packet->size == 0 || packet->offset % VIRTIO_BLK_SECTOR_SIZE ||
+                packet->size % VIRTIO_BLK_SECTOR_SIZE) {
+                return IO_ERROR;
+            }
+            uint64_t sector = packet->offset / VIRTIO_BLK_SECTOR_SIZE;
+            
+            if (!resonance_io_async(packet)) {
+                return virtio_blk_do_request(dev, type, sector, packet->domain,
+                                             packet->buffer, packet->size) == 0 ?
+                    IO_SUCCESS : IO_ERROR;
+            }
+            
+            packet->status = IO_PENDING;
+            return virtio_blk_submit_io(dev, type, sector, packet->domain, packet->buffer,
+                                        packet->size, virtio_blk_packet_complete, packet);
+        }
+        
+        case IO_OP_FLUSH:
+            packet->status = virtio_blk_flush(dev) == 0 ? IO_SUCCESS : IO_ERROR;
+            if (resonance_io_async(packet)) {
+                resonance_io_complete(packet, packet->status);
+                return IO_PENDING;
+            }
+            return packet->status;
+        
+        default:
+            return IO_ERROR;
+    }
 }
 
 // Driver registration
@@ -526,7 +1077,8 @@ static resonance_driver_t virtio_blk_driver = {
     .device_ids = {0x1001, 0},  // VirtIO block device
     .probe = virtio_blk_probe,
     .attach = virtio_blk_attach,
-    .detach = virtio_blk_detach
+    .detach = virtio_blk_detach,
+    .io_request = virtio_blk_io_request
 };
 
 void virtio_blk_init(void) {
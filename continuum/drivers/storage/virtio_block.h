@@ -17,6 +17,17 @@
 
 #define MAX_VIRTIO_BLK_DEVICES  16
 #define VIRTIO_BLK_QUEUE_SIZE   128
+#define VIRTIO_BLK_MAX_QUEUES   16      // Request queues (one per CPU with MQ)
+#define VIRTIO_BLK_POOL_SIZE    64      // Preallocated requests per queue
+#define VIRTIO_BLK_MAX_SEGS     64      // Data segments per request
+#define VIRTIO_BLK_COMPLETION_BATCH 16  // Completions finished per pass outside the lock
+#define VIRTIO_BLK_SECTOR_SIZE  512     // Request sectors, whatever the block size
+#define VIRTIO_BLK_MAX_TRANSFER (128 * 1024)
+#define VIRTIO_VRING_ALIGN      4096    // Legacy layout: used ring on its own page
+
+// Timeouts (microseconds)
+#define VIRTIO_BLK_IO_TIMEOUT   5000000
+#define VIRTIO_BLK_POLL_SPIN    20      // Waiters poll this long before yielding to the IRQ
 
 // VirtIO PCI registers (legacy)
 #define VIRTIO_PCI_DEVICE_FEATURES  0x00
@@ -28,6 +39,10 @@
 #define VIRTIO_PCI_STATUS           0x12
 #define VIRTIO_PCI_ISR              0x13
 #define VIRTIO_PCI_CONFIG           0x14
+#define VIRTIO_PCI_MSI_CONFIG_VECTOR 0x14   // Only with MSI-X enabled...
+#define VIRTIO_PCI_MSI_QUEUE_VECTOR 0x16
+#define VIRTIO_PCI_CONFIG_MSI       0x18    // ...which moves the device config here
+#define VIRTIO_MSI_NO_VECTOR        0xFFFF
 
 // VirtIO status bits
 #define VIRTIO_STATUS_ACKNOWLEDGE   0x01
@@ -47,14 +62,20 @@
 #define VIRTIO_BLK_F_TOPOLOGY       (1 << 10)
 #define VIRTIO_BLK_F_CONFIG_WCE     (1 << 11)
 #define VIRTIO_BLK_F_DISCARD        (1 << 13)
+#define VIRTIO_BLK_F_MQ             (1 << 12)
 #define VIRTIO_BLK_F_WRITE_ZEROES   (1 << 14)
 
+// VirtIO ring features
+#define VIRTIO_RING_F_INDIRECT_DESC (1 << 28)
+#define VIRTIO_RING_F_EVENT_IDX     (1 << 29)
+
 // VirtIO block config offsets
 #define VIRTIO_BLK_CFG_CAPACITY     0x00
 #define VIRTIO_BLK_CFG_SIZE_MAX     0x08
 #define VIRTIO_BLK_CFG_SEG_MAX      0x0C
 #define VIRTIO_BLK_CFG_GEOMETRY     0x10
 #define VIRTIO_BLK_CFG_BLK_SIZE     0x14
+#define VIRTIO_BLK_CFG_NUM_QUEUES   0x22
 
 // VirtIO block request types
 #define VIRTIO_BLK_T_IN             0
@@ -73,6 +94,10 @@
 #define VIRTQ_DESC_F_WRITE          2
 #define VIRTQ_DESC_F_INDIRECT       4
 
+// VirtQueue ring flags (without EVENT_IDX)
+#define VIRTQ_AVAIL_F_NO_INTERRUPT  1
+#define VIRTQ_USED_F_NO_NOTIFY      1
+
 // =============================================================================
 // VirtQueue Structures
 // =============================================================================
@@ -123,29 +148,42 @@ typedef struct {
     uint8_t sectors;
 } virtio_blk_geometry_t;
 
-// Block request structure
+// What the device reads and writes for a request besides the data: the
+// indirect table, header and status. One per pooled request, all in a
+// single DMA region per queue.
+typedef struct __attribute__((packed, aligned(16))) {
+    virtq_desc_t indirect[VIRTIO_BLK_MAX_SEGS + 2];
+    virtio_blk_req_header_t header;
+    uint8_t status;
+    uint8_t pad[15];
+} virtio_blk_req_dma_t;
+
+// Asynchronous I/O completion; status is 0, or -1 on a device error
+typedef void (*virtio_blk_callback_t)(void* context, int status);
+
+// Synchronous submitter's view of one request, filled in on completion
+typedef struct {
+    bool done;
+    int status;
+} virtio_blk_wait_t;
+
+// Block request structure (pooled per virtqueue)
 typedef struct virtio_blk_request {
-    // Request components
-    virtio_blk_req_header_t* header;
-    void* data;
-    uint8_t* status;
-    
-    // Physical addresses
-    uint64_t header_phys;
-    uint64_t data_phys;
-    uint64_t status_phys;
-    
-    // Data length
-    size_t data_len;
+    virtio_blk_req_dma_t* dma;
+    uint64_t dma_phys;
+    struct virtio_blk_request* next_free;
     
-    // DMA regions
-    dma_region_t* header_dma;
-    dma_region_t* data_dma;
-    dma_region_t* status_dma;
+    // Ring descriptors: one with indirect descriptors, else the chain
+    uint16_t head;
+    uint16_t descs;
     
     // Completion
-    bool completed;
+    virtio_blk_wait_t* wait;
+    virtio_blk_callback_t callback;
     void* context;
+    dma_region_t* bounce;   // Only when the caller's pages can't be used
+    void* buffer;           // Where a bounced read is copied out to
+    size_t length;
 } virtio_blk_request_t;
 
 // VirtQueue structure
@@ -155,6 +193,7 @@ typedef struct virtqueue {
     uint16_t last_used_idx;
     uint16_t last_avail_idx;
     uint16_t free_head;
+    uint16_t num_free;
     
     // Queue components
     virtq_desc_t* desc;
@@ -164,8 +203,14 @@ typedef struct virtqueue {
     // DMA region
     dma_region_t* queue_dma;
     
-    // Request tracking
-    virtio_blk_request_t* requests[VIRTIO_BLK_QUEUE_SIZE];
+    // Request tracking (indexed by head descriptor) and the request pool
+    virtio_blk_request_t** requests;
+    virtio_blk_request_t pool[VIRTIO_BLK_POOL_SIZE];
+    virtio_blk_request_t* free_requests;
+    dma_region_t* pool_dma;
+    
+    // Completion interrupt: MSI-X entry queue_idx, else the shared INTx
+    bool irq;
     
     // Device reference
     struct virtio_blk_device* device;
@@ -199,9 +244,22 @@ typedef struct virtio_blk_device {
     uint32_t block_size;     // Block size in bytes
     virtio_blk_geometry_t geometry;
     bool readonly;
+    uint32_t seg_max;        // Data segments per request
+    uint32_t size_max;       // Bytes per segment
+    uint32_t max_transfer;   // Bytes per request
+    bool indirect;
+    bool event_idx;
+    
+    // Virtqueues: one per CPU with MQ, shared round the CPUs otherwise
+    virtqueue_t* vqs[VIRTIO_BLK_MAX_QUEUES];
+    uint16_t num_queues;
+    virtqueue_t* cpu_queues[MAX_CPU_CORES];
     
-    // Virtqueue
-    virtqueue_t* vq;
+    // Interrupts
+    device_handle_t* handle;
+    bool msix;              // One vector per queue
+    bool intx;              // Shared line, acknowledged through the ISR register
+    struct block_queue* block;
     
     // Statistics
     uint64_t reads;
@@ -223,6 +281,10 @@ int virtio_blk_read(virtio_blk_device_t* dev, uint64_t sector,
 int virtio_blk_write(virtio_blk_device_t* dev, uint64_t sector,
                     uint32_t count, void* buffer);
 int virtio_blk_flush(virtio_blk_device_t* dev);
+io_result_t virtio_blk_read_async(virtio_blk_device_t* dev, uint64_t sector, uint32_t count,
+                                  void* buffer, virtio_blk_callback_t callback, void* context);
+io_result_t virtio_blk_write_async(virtio_blk_device_t* dev, uint64_t sector, uint32_t count,
+                                   void* buffer, virtio_blk_callback_t callback, void* context);
 
 // Device management
 virtio_blk_device_t* virtio_blk_get_device(uint32_t index);
@@ -6,6 +6,7 @@
 #include "xhci.h"
 #include "../resonance.h"
 #include "../../flux_memory.h"
+#include "../../temporal_scheduler.h"
 
 // =============================================================================
 // Global xHCI State
@@ -49,6 +50,9 @@ static void xhci_op_write64(xhci_controller_t* xhci, uint32_t offset, uint64_t v
 
 static int xhci_init_event_ring(xhci_controller_t* xhci, uint32_t interrupter) {
     xhci_event_ring_t* er = &xhci->event_rings[interrupter];
+    er->xhci = xhci;
+    er->index = interrupter;
+    spinlock_init(&er->lock);
     
     // Allocate event ring segment table
     er->erst_dma = resonance_alloc_dma(sizeof(xhci_erst_entry_t), DMA_FLAG_COHERENT);
@@ -79,15 +83,46 @@ static int xhci_init_event_ring(xhci_controller_t* xhci, uint32_t interrupter) {
     // Set ERST size
     ir->erstsz = 1;
     
-    // Set ERSTBA (Event Ring Segment Table Base Address)
-    ir->erstba = er->erst_dma->physical_addr;
-    
     // Set ERDP (Event Ring Dequeue Pointer)
     ir->erdp = er->ring_dma->physical_addr;
     
+    // Set ERSTBA (Event Ring Segment Table Base Address), which enables
+    // the ring, so last
+    ir->erstba = er->erst_dma->physical_addr;
+    
     er->dequeue = er->ring;
     er->cycle_state = 1;
     
+    // Interrupts come no closer together than this, however many TDs
+    // complete in between
+    er->moderation = XHCI_IMOD_DEFAULT;
+    ir->imod = XHCI_IMOD_INTERVAL(er->moderation);
+    
+    return 0;
+}
+
+static void xhci_free_event_ring(xhci_controller_t* xhci, uint32_t interrupter) {
+    xhci_event_ring_t* er = &xhci->event_rings[interrupter];
+    xhci_interrupter_t* ir = &xhci->rt_regs->interrupters[interrupter];
+    
+    ir->iman = XHCI_IMAN_IP;
+    ir->erstsz = 0;
+    ir->erstba = 0;
+    ir->erdp = 0;
+    resonance_free_dma(er->ring_dma);
+    resonance_free_dma(er->erst_dma);
+    er->ring_dma = NULL;
+    er->erst_dma = NULL;
+}
+
+int xhci_set_moderation(xhci_controller_t* xhci, uint32_t interrupter, uint32_t usec) {
+    if (!xhci || interrupter >= xhci->num_interrupters || usec > XHCI_IMOD_MAX_USEC) {
+        return -1;
+    }
+    
+    xhci_event_ring_t* er = &xhci->event_rings[interrupter];
+    er->moderation = usec;
+    xhci->rt_regs->interrupters[interrupter].imod = XHCI_IMOD_INTERVAL(usec);
     return 0;
 }
 
@@ -174,10 +209,19 @@ static xhci_transfer_ring_t* xhci_alloc_transfer_ring(uint32_t size) {
     ring->enqueue = ring->ring;
     ring->dequeue = ring->ring;
     ring->cycle_state = 1;
+    spinlock_init(&ring->lock);
     
     return ring;
 }
 
+static void xhci_free_transfer_ring(xhci_transfer_ring_t* ring) {
+    if (!ring) {
+        return;
+    }
+    resonance_free_dma(ring->ring_dma);
+    flux_free(ring);
+}
+
 // =============================================================================
 // Port Management
 // =============================================================================
@@ -224,36 +268,74 @@ static void xhci_handle_port_status(xhci_controller_t* xhci, uint32_t port_id) {
 // Command Submission
 // =============================================================================
 
-static int xhci_submit_command(xhci_controller_t* xhci, xhci_trb_t* trb) {
-    spinlock_acquire(&xhci->cmd_lock);
+// Queue count commands behind one doorbell and wait for the last; the
+// command ring runs them in order, so the rest are done by then. Returns
+// -1 if any failed or the wait timed out. result, if set, gets the last
+// one's completion event.
+static int xhci_submit_commands(xhci_controller_t* xhci, const xhci_trb_t* trbs,
+                                uint32_t count, xhci_trb_t* result) {
+    if (count == 0 || count > XHCI_CMD_RING_SIZE / 2) {
+        return -1;
+    }
     
-    // Copy TRB to command ring
-    *xhci->cmd_enqueue = *trb;
-    xhci->cmd_enqueue->control |= xhci->cmd_cycle;
+    uint32_t slots[XHCI_CMD_RING_SIZE / 2];
     
-    // Advance enqueue pointer
-    xhci->cmd_enqueue++;
-    if (TRB_TYPE_GET(xhci->cmd_enqueue->control) == TRB_LINK) {
-        xhci->cmd_enqueue = xhci->cmd_ring;
-        xhci->cmd_cycle ^= 1;
+    spinlock_acquire(&xhci->cmd_lock);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        // Copy TRB to command ring
+        slots[i] = (uint32_t)(xhci->cmd_enqueue - xhci->cmd_ring);
+        xhci->cmd_events[slots[i]].status = 0;
+        *xhci->cmd_enqueue = trbs[i];
+        xhci->cmd_enqueue->control = (trbs[i].control & ~TRB_C) | xhci->cmd_cycle;
+        
+        // Advance enqueue pointer
+        xhci->cmd_enqueue++;
+        if (TRB_TYPE_GET(xhci->cmd_enqueue->control) == TRB_LINK) {
+            xhci->cmd_enqueue->control = (xhci->cmd_enqueue->control & ~TRB_C) |
+                                         xhci->cmd_cycle;
+            xhci->cmd_enqueue = xhci->cmd_ring;
+            xhci->cmd_cycle ^= 1;
+        }
     }
     
     // Ring doorbell
+    __atomic_thread_fence(__ATOMIC_RELEASE);
     xhci->db_regs[0] = 0;
+    xhci->commands += count;
+    __atomic_fetch_add(&xhci->doorbells, 1, __ATOMIC_RELAXED);
     
     spinlock_release(&xhci->cmd_lock);
     
-    // Wait for completion (simplified - should use events)
-    uint64_t timeout = continuum_get_time() + 1000000;
-    while (continuum_get_time() < timeout) {
-        // Check event ring for command completion
-        // Simplified implementation
-        io_wait();
+    // A completion event fills in the status, never 0, of its command's slot
+    xhci_trb_t* last = &xhci->cmd_events[slots[count - 1]];
+    uint64_t timeout = continuum_get_time() + continuum_usec_to_tsc(XHCI_CMD_TIMEOUT);
+    while (__atomic_load_n(&last->status, __ATOMIC_ACQUIRE) == 0) {
+        if (continuum_get_time() >= timeout) {
+            return -1;
+        }
+        if (xhci->irq_enabled) {
+            io_wait();
+        } else {
+            xhci_handle_events(xhci);
+        }
     }
     
+    if (result) {
+        *result = *last;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (TRB_COMP_CODE(xhci->cmd_events[slots[i]].status) != COMP_SUCCESS) {
+            return -1;
+        }
+    }
     return 0;
 }
 
+static int xhci_submit_command(xhci_controller_t* xhci, xhci_trb_t* trb) {
+    return xhci_submit_commands(xhci, trb, 1, NULL);
+}
+
 // =============================================================================
 // Device Slot Management
 // =============================================================================
@@ -262,12 +344,13 @@ static int xhci_enable_slot(xhci_controller_t* xhci, uint8_t* slot_id) {
     xhci_trb_t trb = {0};
     trb.control = TRB_TYPE(TRB_ENABLE_SLOT);
     
-    if (xhci_submit_command(xhci, &trb) != 0) {
+    xhci_trb_t event;
+    if (xhci_submit_commands(xhci, &trb, 1, &event) != 0) {
         return -1;
     }
     
-    // Get slot ID from completion event (simplified)
-    *slot_id = 1;  // Should get from event
+    // The completion event carries the new slot's ID
+    *slot_id = TRB_SLOT_GET(event.control);
     
     return 0;
 }
@@ -285,6 +368,451 @@ static int xhci_address_device(xhci_controller_t* xhci, uint8_t slot_id,
     return xhci_submit_command(xhci, &trb);
 }
 
+// =============================================================================
+// Streams
+// =============================================================================
+
+uint32_t xhci_max_streams(xhci_controller_t* xhci) {
+    return xhci ? xhci->max_streams : 0;
+}
+
+static void xhci_free_streams(xhci_streams_t* streams) {
+    for (uint32_t i = 1; i < streams->count; i++) {
+        xhci_free_transfer_ring(streams->rings[i]);
+    }
+    if (streams->contexts_dma) {
+        resonance_free_dma(streams->contexts_dma);
+    }
+    flux_free(streams);
+}
+
+// Give an endpoint count primary streams (a power of two, at least 2 and
+// no more than xhci_max_streams), each with its own ring, and tell the
+// controller with Configure Endpoint. The device must be addressed and
+// the endpoint configured already.
+int xhci_alloc_streams(xhci_controller_t* xhci, uint8_t slot_id, uint8_t ep_index,
+                       uint32_t count) {
+    if (!xhci || slot_id == 0 || slot_id > xhci->max_slots || ep_index == 0 ||
+        ep_index >= XHCI_MAX_ENDPOINTS || count < 2 || count > xhci->max_streams ||
+        (count & (count - 1)) || xhci->streams[slot_id][ep_index]) {
+        return -1;
+    }
+    
+    xhci_device_context_t* device = xhci->device_contexts[slot_id];
+    if (!device) {
+        return -1;
+    }
+    
+    xhci_streams_t* streams = flux_allocate(NULL, sizeof(xhci_streams_t) +
+                                            count * sizeof(xhci_transfer_ring_t*),
+                                            FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!streams) {
+        return -1;
+    }
+    streams->count = count;
+    
+    streams->contexts_dma = resonance_alloc_dma(count * sizeof(xhci_stream_context_t),
+                                                DMA_FLAG_COHERENT);
+    if (!streams->contexts_dma) {
+        xhci_free_streams(streams);
+        return -1;
+    }
+    streams->contexts = (xhci_stream_context_t*)streams->contexts_dma->virtual_addr;
+    memset(streams->contexts, 0, count * sizeof(xhci_stream_context_t));
+    
+    // Stream 0 is reserved
+    for (uint32_t i = 1; i < count; i++) {
+        streams->rings[i] = xhci_alloc_transfer_ring(XHCI_STREAM_RING_SIZE);
+        if (!streams->rings[i]) {
+            xhci_free_streams(streams);
+            return -1;
+        }
+        streams->contexts[i].tr_dequeue = streams->rings[i]->ring_dma->physical_addr |
+                                          XHCI_SCT_PRIMARY_RING | 1;
+    }
+    
+    // Point the endpoint at the stream array instead of a single ring
+    dma_region_t* input_dma = resonance_alloc_dma(sizeof(xhci_input_context_t),
+                                                  DMA_FLAG_COHERENT);
+    if (!input_dma) {
+        xhci_free_streams(streams);
+        return -1;
+    }
+    xhci_input_context_t* input = (xhci_input_context_t*)input_dma->virtual_addr;
+    memset(input, 0, sizeof(xhci_input_context_t));
+    input->control.add_context_flags = (1U << ep_index) | 1;
+    input->device.slot = device->slot;
+    
+    xhci_ep_context_t* ep = &input->device.endpoints[ep_index - 1];
+    *ep = device->endpoints[ep_index - 1];
+    ep->max_pstreams = __builtin_ctz(count) - 1;
+    ep->lsa = 1;
+    ep->tr_dequeue_ptr = streams->contexts_dma->physical_addr;
+    
+    xhci_trb_t trb = {0};
+    trb.parameter = input_dma->physical_addr;
+    trb.control = TRB_TYPE(TRB_CONFIG_EP) | TRB_SLOT(slot_id);
+    int result = xhci_submit_command(xhci, &trb);
+    resonance_free_dma(input_dma);
+    
+    if (result != 0) {
+        xhci_free_streams(streams);
+        return -1;
+    }
+    xhci->streams[slot_id][ep_index] = streams;
+    return 0;
+}
+
+// =============================================================================
+// Transfer Submission
+// =============================================================================
+
+static xhci_transfer_ring_t* xhci_find_ring(xhci_controller_t* xhci, uint8_t slot_id,
+                                            uint8_t ep_index, uint16_t stream) {
+    if (slot_id == 0 || slot_id > xhci->max_slots || ep_index == 0 ||
+        ep_index >= XHCI_MAX_ENDPOINTS) {
+        return NULL;
+    }
+    if (stream == 0) {
+        return xhci->transfer_rings[slot_id][ep_index];
+    }
+    
+    xhci_streams_t* streams = xhci->streams[slot_id][ep_index];
+    return streams && stream < streams->count ? streams->rings[stream] : NULL;
+}
+
+// Write a TRB at the enqueue position, following the link TRB at the end
+// of the ring (chained, inside a TD). The first TRB of a TD goes in with
+// the wrong cycle bit, so the controller can't start on half a TD.
+static xhci_trb_t* xhci_ring_put(xhci_transfer_ring_t* ring, uint64_t parameter,
+                                 uint32_t status, uint32_t control, bool first) {
+    xhci_trb_t* trb = ring->enqueue;
+    trb->parameter = parameter;
+    trb->status = status;
+    trb->control = control | (first ? ring->cycle_state ^ 1 : ring->cycle_state);
+    
+    ring->enqueue++;
+    if (TRB_TYPE_GET(ring->enqueue->control) == TRB_LINK) {
+        xhci_trb_t* link = ring->enqueue;
+        link->control = (link->control & ~(TRB_C | TRB_CH)) | (control & TRB_CH) |
+                        ring->cycle_state;
+        ring->enqueue = ring->ring;
+        ring->cycle_state ^= 1;
+    }
+    return trb;
+}
+
+// TRBs a segment takes: one per piece up to each 64 KiB boundary
+static uint32_t xhci_segment_trbs(const xhci_segment_t* segment) {
+    if (segment->length == 0) {
+        return 1;
+    }
+    return (uint32_t)((segment->address + segment->length - 1) / XHCI_TRB_MAX_LENGTH -
+                      segment->address / XHCI_TRB_MAX_LENGTH) + 1;
+}
+
+// Queue one TD: Normal TRBs for the segments in order, chained to an Event
+// Data TRB. Its event hands transfer back with the bytes moved, so
+// completions need no lookup, and it goes to the submitting CPU's
+// interrupter.
+int xhci_queue_transfer_sg(xhci_controller_t* xhci, uint8_t slot_id, uint8_t ep_index,
+                           uint16_t stream, const xhci_segment_t* segments, uint32_t count,
+                           xhci_transfer_t* transfer, uint32_t flags) {
+    if (!xhci || !transfer || !transfer->done || !segments || count == 0) {
+        return -1;
+    }
+    xhci_transfer_ring_t* ring = xhci_find_ring(xhci, slot_id, ep_index, stream);
+    if (!ring) {
+        return -1;
+    }
+    
+    uint32_t trbs = 1;
+    for (uint32_t i = 0; i < count; i++) {
+        trbs += xhci_segment_trbs(&segments[i]);
+    }
+    
+    xhci_event_ring_t* er = xhci->cpu_interrupters[temporal_get_current_cpu()];
+    uint32_t target = TRB_INTR_TARGET(er ? er->index : 0);
+    
+    uint64_t irq_flags = cpu_irq_save();
+    spinlock_acquire(&ring->lock);
+    
+    // One slot stays empty so a full ring never looks like an empty one
+    if (ring->used + trbs >= ring->size - 1) {
+        spinlock_release(&ring->lock);
+        cpu_irq_restore(irq_flags);
+        __atomic_fetch_add(&xhci->ring_full, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    
+    xhci_trb_t* first = NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t at = segments[i].address;
+        uint32_t left = segments[i].length;
+        uint32_t pieces = xhci_segment_trbs(&segments[i]);
+        for (uint32_t n = 0; n < pieces; n++) {
+            uint32_t chunk = XHCI_TRB_MAX_LENGTH - (uint32_t)(at % XHCI_TRB_MAX_LENGTH);
+            if (chunk > left) {
+                chunk = left;
+            }
+            xhci_trb_t* trb = xhci_ring_put(ring, at, chunk | target,
+                                            TRB_TYPE(TRB_NORMAL) | TRB_CH, first == NULL);
+            if (!first) {
+                first = trb;
+            }
+            at += chunk;
+            left -= chunk;
+        }
+    }
+    xhci_ring_put(ring, (uint64_t)(uintptr_t)transfer, target,
+                  TRB_TYPE(TRB_EVENT_DATA) | TRB_IOC, false);
+    
+    transfer->ring = ring;
+    transfer->end = ring->enqueue;
+    transfer->trbs = trbs;
+    transfer->length = 0;
+    transfer->completion_code = 0;
+    ring->used += trbs;
+    
+    // Hand the TD over in one go
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    first->control ^= TRB_C;
+    
+    spinlock_release(&ring->lock);
+    cpu_irq_restore(irq_flags);
+    
+    __atomic_fetch_add(&xhci->tds, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&xhci->trbs, trbs, __ATOMIC_RELAXED);
+    if (!(flags & XHCI_QUEUE_DEFER)) {
+        xhci_ring_doorbell(xhci, slot_id, ep_index, stream);
+    }
+    return 0;
+}
+
+int xhci_queue_transfer(xhci_controller_t* xhci, uint8_t slot_id, uint8_t ep_index,
+                        uint16_t stream, uint64_t address, uint32_t length,
+                        xhci_transfer_t* transfer, uint32_t flags) {
+    xhci_segment_t segment = { .address = address, .length = length };
+    return xhci_queue_transfer_sg(xhci, slot_id, ep_index, stream, &segment, 1, transfer,
+                                  flags);
+}
+
+// Start the controller on whatever the ring holds, however many TDs that is
+void xhci_ring_doorbell(xhci_controller_t* xhci, uint8_t slot_id, uint8_t ep_index,
+                        uint16_t stream) {
+    if (!xhci || slot_id == 0 || slot_id > xhci->max_slots) {
+        return;
+    }
+    xhci->db_regs[slot_id] = XHCI_DB_TARGET(ep_index, stream);
+    __atomic_fetch_add(&xhci->doorbells, 1, __ATOMIC_RELAXED);
+}
+
+// =============================================================================
+// Event Handling
+// =============================================================================
+
+// The transfer a transfer event belongs to. Event Data events carry it;
+// an error ends a TD early at one of its Normal TRBs, so the ring is
+// searched from there for the Event Data TRB closing the TD. The endpoint
+// is then halted until the class driver recovers it.
+static xhci_transfer_t* xhci_event_transfer(xhci_controller_t* xhci, const xhci_trb_t* event) {
+    if (event->control & TRB_EVENT_ED) {
+        return (xhci_transfer_t*)(uintptr_t)event->parameter;
+    }
+    
+    uint8_t slot_id = TRB_SLOT_GET(event->control);
+    uint8_t ep_index = TRB_EP_GET(event->control);
+    if (slot_id == 0 || slot_id > xhci->max_slots || ep_index == 0 ||
+        ep_index >= XHCI_MAX_ENDPOINTS) {
+        return NULL;
+    }
+    
+    xhci_streams_t* streams = xhci->streams[slot_id][ep_index];
+    uint32_t count = streams ? streams->count : 1;
+    for (uint32_t s = 0; s < count; s++) {
+        xhci_transfer_ring_t* ring = streams ? streams->rings[s] :
+                                               xhci->transfer_rings[slot_id][ep_index];
+        if (!ring) {
+            continue;
+        }
+        
+        uint64_t base = ring->ring_dma->physical_addr;
+        if (event->parameter < base ||
+            event->parameter >= base + ring->size * sizeof(xhci_trb_t)) {
+            continue;
+        }
+        
+        xhci_trb_t* trb = &ring->ring[(event->parameter - base) / sizeof(xhci_trb_t)];
+        for (uint32_t n = 0; n < ring->size; n++) {
+            if (TRB_TYPE_GET(trb->control) == TRB_EVENT_DATA) {
+                return (xhci_transfer_t*)(uintptr_t)trb->parameter;
+            }
+            trb = TRB_TYPE_GET(trb->control) == TRB_LINK ? ring->ring : trb + 1;
+        }
+        return NULL;
+    }
+    return NULL;
+}
+
+static void xhci_complete_transfer(xhci_transfer_t* transfer, uint32_t code, uint32_t length) {
+    xhci_transfer_ring_t* ring = transfer->ring;
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&ring->lock);
+    ring->dequeue = transfer->end;
+    ring->used -= transfer->trbs;
+    spinlock_release(&ring->lock);
+    cpu_irq_restore(flags);
+    
+    transfer->length = length;
+    transfer->completion_code = code;
+    transfer->done(transfer, code == COMP_SUCCESS || code == COMP_SHORT_PACKET ? 0 : -1);
+}
+
+// Drain one interrupter's event ring; completions run without its lock
+// held. Command completions land in cmd_events for their waiters.
+static uint32_t xhci_drain_events(xhci_controller_t* xhci, xhci_event_ring_t* er) {
+    uint32_t handled = 0;
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&er->lock);
+    
+    while ((er->dequeue->control & TRB_C) == er->cycle_state) {
+        xhci_trb_t event = *er->dequeue;
+        er->dequeue++;
+        if (er->dequeue == er->ring + XHCI_EVENT_RING_SIZE) {
+            er->dequeue = er->ring;
+            er->cycle_state ^= 1;
+        }
+        handled++;
+        
+        switch (TRB_TYPE_GET(event.control)) {
+            case TRB_TRANSFER: {
+                er->stats.transfer_events++;
+                uint32_t code = TRB_COMP_CODE(event.status);
+                bool event_data = (event.control & TRB_EVENT_ED) != 0;
+                if (!event_data && (code == COMP_SUCCESS || code == COMP_SHORT_PACKET)) {
+                    break;      // The TD's Event Data TRB reports it
+                }
+                
+                xhci_transfer_t* transfer = xhci_event_transfer(xhci, &event);
+                if (transfer) {
+                    spinlock_release(&er->lock);
+                    xhci_complete_transfer(transfer, code,
+                                           event_data ? TRB_EVENT_LENGTH(event.status) : 0);
+                    spinlock_acquire(&er->lock);
+                }
+                break;
+            }
+            
+            case TRB_COMMAND_COMPLETE: {
+                er->stats.command_events++;
+                uint64_t base = xhci->cmd_ring_dma->physical_addr;
+                if (event.parameter >= base &&
+                    event.parameter < base + XHCI_CMD_RING_SIZE * sizeof(xhci_trb_t)) {
+                    xhci_trb_t* slot = &xhci->cmd_events[(event.parameter - base) /
+                                                         sizeof(xhci_trb_t)];
+                    slot->parameter = event.parameter;
+                    slot->control = event.control;
+                    __atomic_store_n(&slot->status, event.status,
+                                     __ATOMIC_RELEASE);
+                }
+                break;
+            }
+            
+            case TRB_PORT_STATUS_CHANGE:
+                er->stats.port_events++;
+                xhci_handle_port_status(xhci, TRB_PORT_ID(event.parameter));
+                break;
+            
+            default:
+                break;
+        }
+    }
+    
+    er->stats.passes++;
+    er->stats.events += handled;
+    if (handled > er->stats.max_batch) {
+        er->stats.max_batch = handled;
+    }
+    
+    // One dequeue pointer write per pass, which also clears Event Handler Busy
+    if (handled > 0) {
+        xhci_interrupter_t* ir = &xhci->rt_regs->interrupters[er->index];
+        ir->erdp = (er->ring_dma->physical_addr +
+                    (uint64_t)(er->dequeue - er->ring) * sizeof(xhci_trb_t)) | XHCI_ERDP_EHB;
+    }
+    
+    spinlock_release(&er->lock);
+    cpu_irq_restore(flags);
+    return handled;
+}
+
+// Drain every interrupter, for anyone polling for a transfer or command
+void xhci_handle_events(xhci_controller_t* xhci) {
+    uint32_t count = xhci->num_interrupters ? xhci->num_interrupters : 1;
+    for (uint32_t i = 0; i < count; i++) {
+        xhci_drain_events(xhci, &xhci->event_rings[i]);
+    }
+}
+
+static void xhci_interrupt(void* context) {
+    xhci_event_ring_t* er = (xhci_event_ring_t*)context;
+    xhci_controller_t* xhci = er->xhci;
+    xhci_interrupter_t* ir = &xhci->rt_regs->interrupters[er->index];
+    
+    ir->iman = ir->iman | XHCI_IMAN_IP;
+    xhci_op_write32(xhci, XHCI_OP_USBSTS, XHCI_STS_EINT);
+    
+    __atomic_fetch_add(&er->stats.interrupts, 1, __ATOMIC_RELAXED);
+    if (xhci_drain_events(xhci, er) == 0) {
+        __atomic_fetch_add(&er->stats.spurious, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// =============================================================================
+// Statistics
+// =============================================================================
+
+int xhci_get_interrupter_stats(xhci_controller_t* xhci, uint32_t interrupter,
+                               xhci_event_stats_t* stats) {
+    if (!xhci || !stats || interrupter >= xhci->num_interrupters) {
+        return -1;
+    }
+    
+    xhci_event_ring_t* er = &xhci->event_rings[interrupter];
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&er->lock);
+    *stats = er->stats;
+    spinlock_release(&er->lock);
+    cpu_irq_restore(flags);
+    return 0;
+}
+
+void xhci_get_stats(xhci_controller_t* xhci, xhci_stats_t* stats) {
+    memset(stats, 0, sizeof(xhci_stats_t));
+    stats->tds = __atomic_load_n(&xhci->tds, __ATOMIC_RELAXED);
+    stats->trbs = __atomic_load_n(&xhci->trbs, __ATOMIC_RELAXED);
+    stats->doorbells = __atomic_load_n(&xhci->doorbells, __ATOMIC_RELAXED);
+    stats->commands = __atomic_load_n(&xhci->commands, __ATOMIC_RELAXED);
+    stats->ring_full = __atomic_load_n(&xhci->ring_full, __ATOMIC_RELAXED);
+    
+    for (uint32_t i = 0; i < xhci->num_interrupters; i++) {
+        xhci_event_stats_t er;
+        xhci_get_interrupter_stats(xhci, i, &er);
+        stats->events.interrupts += er.interrupts;
+        stats->events.spurious += er.spurious;
+        stats->events.passes += er.passes;
+        stats->events.events += er.events;
+        stats->events.transfer_events += er.transfer_events;
+        stats->events.command_events += er.command_events;
+        stats->events.port_events += er.port_events;
+        if (er.max_batch > stats->events.max_batch) {
+            stats->events.max_batch = er.max_batch;
+        }
+    }
+}
+
 // =============================================================================
 // Controller Reset and Initialization
 // =============================================================================
@@ -340,6 +868,12 @@ static int xhci_init_controller(xhci_controller_t* xhci) {
     xhci->max_intrs = XHCI_HCS1_MAX_INTRS(hcsparams1);
     xhci->num_ports = XHCI_HCS1_MAX_PORTS(hcsparams1);
     
+    uint32_t max_psa = XHCI_HCC1_MAX_PSA(hccparams1);
+    xhci->max_streams = max_psa ? 1U << (max_psa + 1) : 0;
+    if (xhci->max_streams > XHCI_MAX_STREAMS) {
+        xhci->max_streams = XHCI_MAX_STREAMS;
+    }
+    
     // Get operational register offset
     uint8_t caplength = mmio_read8(xhci->cap_regs + XHCI_CAP_CAPLENGTH);
     xhci->op_regs = (xhci_op_regs_t*)(xhci->cap_regs + caplength);
@@ -370,10 +904,14 @@ static int xhci_init_controller(xhci_controller_t* xhci) {
         return -1;
     }
     
-    // Initialize event ring
+    // Initialize event ring; attach adds the other interrupters
     if (xhci_init_event_ring(xhci, 0) != 0) {
         return -1;
     }
+    xhci->num_interrupters = 1;
+    for (uint32_t cpu = 0; cpu < MAX_CPU_CORES; cpu++) {
+        xhci->cpu_interrupters[cpu] = &xhci->event_rings[0];
+    }
     
     // Enable interrupts
     xhci_op_write32(xhci, XHCI_OP_USBCMD,
@@ -419,7 +957,6 @@ static void* xhci_probe(device_node_t* node) {
     xhci->cap_regs = (uint8_t*)(uintptr_t)(pci_info->bars[0] & ~0x0F);
     
     spinlock_init(&xhci->cmd_lock);
-    spinlock_init(&xhci->event_lock);
     
     // Initialize controller
     if (xhci_init_controller(xhci) != 0) {
@@ -435,8 +972,73 @@ static void* xhci_probe(device_node_t* node) {
     return xhci;
 }
 
+// An interrupter per CPU up to what the controller has and the device
+// has MSI-X entries for, each on its own vector aimed at its CPU, so a
+// transfer completes where it was submitted. CPUs beyond the count share
+// round robin. Without MSI-X, interrupter 0 alone takes the INTx line.
+static void xhci_setup_interrupters(xhci_controller_t* xhci, device_handle_t* handle) {
+    uint32_t cpus = continuum_get_cpu_count();
+    if (cpus == 0 || cpus > MAX_CPU_CORES) {
+        cpus = 1;
+    }
+    
+    uint32_t wanted = cpus;
+    if (wanted > xhci->max_intrs) {
+        wanted = xhci->max_intrs;
+    }
+    if (wanted > XHCI_MAX_INTERRUPTERS) {
+        wanted = XHCI_MAX_INTERRUPTERS;
+    }
+    if (wanted > MAX_IRQ_VECTORS) {
+        wanted = MAX_IRQ_VECTORS;
+    }
+    
+    xhci_event_ring_t* primary = &xhci->event_rings[0];
+    primary->irq = RESONANCE_IRQ_QUEUE(0);
+    primary->irq_enabled = resonance_register_irq(handle, primary->irq, xhci_interrupt,
+                                                  primary) == 0;
+    if (!primary->irq_enabled) {
+        primary->irq = RESONANCE_IRQ_INTX;
+        primary->irq_enabled = resonance_register_irq(handle, primary->irq, xhci_interrupt,
+                                                      primary) == 0;
+        wanted = 1;
+    }
+    if (!primary->irq_enabled) {
+        return;
+    }
+    resonance_set_irq_affinity(handle, primary->irq, 0);
+    xhci->irq_enabled = true;
+    
+    for (uint32_t i = 1; i < wanted; i++) {
+        if (xhci_init_event_ring(xhci, i) != 0) {
+            break;
+        }
+        xhci_event_ring_t* er = &xhci->event_rings[i];
+        er->irq = RESONANCE_IRQ_QUEUE(i);
+        er->irq_enabled = resonance_register_irq(handle, er->irq, xhci_interrupt, er) == 0;
+        if (!er->irq_enabled) {
+            xhci_free_event_ring(xhci, i);
+            break;
+        }
+        resonance_set_irq_affinity(handle, er->irq, i);
+        xhci->num_interrupters++;
+    }
+    
+    for (uint32_t i = 0; i < xhci->num_interrupters; i++) {
+        xhci->rt_regs->interrupters[i].iman = XHCI_IMAN_IP | XHCI_IMAN_IE;
+    }
+    for (uint32_t cpu = 0; cpu < MAX_CPU_CORES; cpu++) {
+        xhci->cpu_interrupters[cpu] = &xhci->event_rings[cpu % xhci->num_interrupters];
+    }
+}
+
 static int xhci_attach(device_handle_t* handle) {
     xhci_controller_t* xhci = (xhci_controller_t*)handle->driver_data;
+    
+    // Without an interrupt, waiters poll
+    xhci->handle = handle;
+    xhci_setup_interrupters(xhci, handle);
+    
     xhci->state = XHCI_STATE_RUNNING;
     return 0;
 }
@@ -449,6 +1051,14 @@ static void xhci_detach(device_handle_t* handle) {
     cmd &= ~XHCI_CMD_RUN;
     xhci_op_write32(xhci, XHCI_OP_USBCMD, cmd);
     
+    for (uint32_t i = 0; i < xhci->num_interrupters; i++) {
+        if (xhci->event_rings[i].irq_enabled) {
+            resonance_unregister_irq(handle, xhci->event_rings[i].irq);
+            xhci->event_rings[i].irq_enabled = false;
+        }
+    }
+    xhci->irq_enabled = false;
+    
     xhci->state = XHCI_STATE_HALTED;
 }
 
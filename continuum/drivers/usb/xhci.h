@@ -22,6 +22,15 @@
 #define XHCI_EVENT_RING_SIZE   256
 #define XHCI_CMD_RING_SIZE     64
 #define XHCI_TRANSFER_RING_SIZE 256
+#define XHCI_STREAM_RING_SIZE  64         // Per stream; a stream carries one TD at a time
+#define XHCI_MAX_STREAMS       256        // Primary stream array entries per endpoint
+#define XHCI_TRB_MAX_LENGTH    (64 * 1024)  // Nor may one TRB's buffer cross a 64 KiB boundary
+#define XHCI_MAX_INTERRUPTERS  8          // Event rings, one per CPU up to this many
+#define XHCI_IMOD_DEFAULT      40         // Interrupt moderation interval (microseconds)
+#define XHCI_CMD_TIMEOUT       1000000    // Command completion wait (microseconds)
+
+// xhci_queue_transfer flags
+#define XHCI_QUEUE_DEFER       (1 << 0)   // Leave the doorbell to xhci_ring_doorbell
 
 // Capability Registers
 #define XHCI_CAP_CAPLENGTH     0x00
@@ -39,6 +48,9 @@
 #define XHCI_HCS1_MAX_INTRS(x)  (((x) >> 8) & 0x7FF)
 #define XHCI_HCS1_MAX_PORTS(x)  (((x) >> 24) & 0xFF)
 
+// HCCPARAMS1 fields
+#define XHCI_HCC1_MAX_PSA(x)    (((x) >> 12) & 0xF)   // Stream array of 2^(n+1), 0 for none
+
 // Operational Registers
 #define XHCI_OP_USBCMD         0x00
 #define XHCI_OP_USBSTS         0x04
@@ -76,6 +88,22 @@
 #define XHCI_CRCR_CA           (1 << 2)
 #define XHCI_CRCR_CRR          (1 << 3)
 
+// Interrupter registers
+#define XHCI_IMAN_IP           (1 << 0)   // Interrupt Pending, write 1 to clear
+#define XHCI_IMAN_IE           (1 << 1)
+#define XHCI_ERDP_EHB          (1 << 3)   // Event Handler Busy, write 1 to clear
+#define XHCI_IMOD_INTERVAL(us) ((us) * 4)  // IMODI counts 250 ns
+#define XHCI_IMOD_MAX_USEC     16383
+
+// Doorbell target for an endpoint's device context index, and stream
+#define XHCI_DB_TARGET(ep, stream) ((uint32_t)(ep) | ((uint32_t)(stream) << 16))
+
+// Device context index of an endpoint address
+#define XHCI_EP_INDEX(address) (((address) & 0x0F) * 2 + (((address) & 0x80) ? 1 : 0))
+
+// Stream context type: a primary transfer ring
+#define XHCI_SCT_PRIMARY_RING  (1 << 1)
+
 // Port Status and Control Register
 #define XHCI_PORTSC_CCS        (1 << 0)   // Current Connect Status
 #define XHCI_PORTSC_PED        (1 << 1)   // Port Enabled/Disabled
@@ -142,6 +170,7 @@
 #define TRB_IOC                (1 << 5)   // Interrupt On Completion
 #define TRB_IDT                (1 << 6)   // Immediate Data
 #define TRB_BSR                (1 << 9)   // Block Set Address Request
+#define TRB_EVENT_ED           (1 << 2)   // Transfer event for an Event Data TRB
 
 // TRB Macros
 #define TRB_TYPE(x)            ((x) << 10)
@@ -150,6 +179,10 @@
 #define TRB_SLOT_GET(x)        (((x) >> 24) & 0xFF)
 #define TRB_EP(x)              ((x) << 16)
 #define TRB_EP_GET(x)          (((x) >> 16) & 0x1F)
+#define TRB_COMP_CODE(x)       (((x) >> 24) & 0xFF)       // Event status field
+#define TRB_EVENT_LENGTH(x)    ((x) & 0xFFFFFF)           // Event Data: bytes in the TD
+#define TRB_PORT_ID(x)         (((x) >> 24) & 0xFF)       // Port status event parameter
+#define TRB_INTR_TARGET(x)     ((uint32_t)(x) << 22)      // Transfer TRB status field
 
 // Completion Codes
 #define COMP_SUCCESS           1
@@ -246,6 +279,13 @@ typedef struct __attribute__((packed)) {
     uint32_t reserved4[3];
 } xhci_ep_context_t;
 
+// Stream Context
+typedef struct __attribute__((packed)) {
+    uint64_t tr_dequeue;        // Ring address, SCT and dequeue cycle state
+    uint32_t stopped_edtla;
+    uint32_t reserved;
+} xhci_stream_context_t;
+
 // Device Context
 typedef struct __attribute__((packed)) {
     xhci_slot_context_t slot;
@@ -306,14 +346,35 @@ typedef struct __attribute__((packed)) {
     xhci_interrupter_t interrupters[1024];
 } xhci_rt_regs_t;
 
-// Event Ring
+// Event counters, per interrupter, for tuning moderation against load
 typedef struct {
+    uint64_t interrupts;
+    uint64_t spurious;          // Interrupts that found no events
+    uint64_t passes;            // Times the ring was drained, interrupt or poll
+    uint64_t events;
+    uint64_t transfer_events;
+    uint64_t command_events;
+    uint64_t port_events;
+    uint64_t max_batch;         // Most events handled in one pass
+} xhci_event_stats_t;
+
+struct xhci_controller;
+
+// Event Ring, with its interrupter
+typedef struct {
+    struct xhci_controller* xhci;
+    uint32_t index;
     xhci_trb_t* ring;
     xhci_erst_entry_t* erst;
     dma_region_t* ring_dma;
     dma_region_t* erst_dma;
     xhci_trb_t* dequeue;
     uint32_t cycle_state;
+    uint32_t irq;
+    bool irq_enabled;
+    uint32_t moderation;        // Microseconds
+    xhci_event_stats_t stats;
+    spinlock_t lock;
 } xhci_event_ring_t;
 
 // Transfer Ring
@@ -324,8 +385,51 @@ typedef struct {
     xhci_trb_t* enqueue;
     xhci_trb_t* dequeue;
     uint32_t cycle_state;
+    uint32_t used;              // TRBs queued and not yet completed
+    spinlock_t lock;
 } xhci_transfer_ring_t;
 
+typedef struct xhci_transfer xhci_transfer_t;
+
+// Runs once a transfer is done, from event processing (possibly the
+// controller interrupt); status is 0 or -1
+typedef void (*xhci_transfer_done_t)(xhci_transfer_t* transfer, int status);
+
+// One queued TD, the caller's until done runs
+struct xhci_transfer {
+    xhci_transfer_done_t done;
+    void* private_data;         // Caller's, untouched by the driver
+    uint32_t length;            // Bytes moved, set before done runs
+    uint32_t completion_code;
+    xhci_transfer_ring_t* ring;
+    xhci_trb_t* end;            // Enqueue position just past the TD
+    uint32_t trbs;
+};
+
+// One piece of a scatter-gather transfer; address is physical
+typedef struct {
+    uint64_t address;
+    uint32_t length;
+} xhci_segment_t;
+
+// Controller-wide submission counters, beside the interrupters' own
+typedef struct {
+    uint64_t tds;
+    uint64_t trbs;
+    uint64_t doorbells;
+    uint64_t commands;
+    uint64_t ring_full;         // Submissions refused for want of ring space
+    xhci_event_stats_t events;  // Summed over the interrupters
+} xhci_stats_t;
+
+// An endpoint's primary streams, each with a ring of its own
+typedef struct {
+    xhci_stream_context_t* contexts;
+    dma_region_t* contexts_dma;
+    uint32_t count;                 // Array entries; stream IDs 1 to count - 1
+    xhci_transfer_ring_t* rings[];  // By stream ID, 0 unused
+} xhci_streams_t;
+
 // Port State
 typedef struct {
     bool connected;
@@ -342,7 +446,7 @@ typedef enum {
 } xhci_state_t;
 
 // xHCI Controller
-typedef struct {
+typedef struct xhci_controller {
     uint8_t* cap_regs;
     xhci_op_regs_t* op_regs;
     xhci_rt_regs_t* rt_regs;
@@ -354,6 +458,11 @@ typedef struct {
     uint32_t max_slots;
     uint32_t max_intrs;
     uint32_t num_ports;
+    uint32_t max_streams;       // Primary stream array entries, 0 without streams
+    
+    // Event interrupts; without one, waiters poll
+    device_handle_t* handle;
+    bool irq_enabled;           // Interrupter 0 has one
     
     // Device Context Base Address Array
     uint64_t* dcbaa;
@@ -365,10 +474,20 @@ typedef struct {
     xhci_trb_t* cmd_enqueue;
     uint32_t cmd_cycle;
     spinlock_t cmd_lock;
+    xhci_trb_t cmd_events[XHCI_CMD_RING_SIZE];  // Completion by command TRB
     
-    // Event rings
-    xhci_event_ring_t event_rings[1024];
-    spinlock_t event_lock;
+    // Event rings. Commands and port changes report on interrupter 0;
+    // transfers on the submitting CPU's.
+    xhci_event_ring_t event_rings[XHCI_MAX_INTERRUPTERS];
+    uint32_t num_interrupters;
+    xhci_event_ring_t* cpu_interrupters[MAX_CPU_CORES];
+    
+    // Submission counters
+    uint64_t tds;
+    uint64_t trbs;
+    uint64_t doorbells;
+    uint64_t commands;
+    uint64_t ring_full;
     
     // Port status
     xhci_port_t ports[XHCI_MAX_PORTS];
@@ -376,6 +495,7 @@ typedef struct {
     // Device contexts
     xhci_device_context_t* device_contexts[XHCI_MAX_SLOTS];
     xhci_transfer_ring_t* transfer_rings[XHCI_MAX_SLOTS][XHCI_MAX_ENDPOINTS];
+    xhci_streams_t* streams[XHCI_MAX_SLOTS][XHCI_MAX_ENDPOINTS];
 } xhci_controller_t;
 
 // =============================================================================
@@ -389,4 +509,29 @@ int xhci_configure_endpoint(xhci_controller_t* xhci, uint8_t slot_id, uint8_t ep
 int xhci_transfer(xhci_controller_t* xhci, uint8_t slot_id, uint8_t ep_num,
                   void* buffer, size_t length, bool is_input);
 
+// Asynchronous transfers. ep_index is the endpoint's device context index
+// (XHCI_EP_INDEX) and stream its stream ID, 0 on endpoints without
+// streams. address is physical. Returns -1 if the ring is full. With
+// XHCI_QUEUE_DEFER the TD waits for xhci_ring_doorbell, so a batch of
+// them on one ring costs one doorbell write.
+uint32_t xhci_max_streams(xhci_controller_t* xhci);
+int xhci_alloc_streams(xhci_controller_t* xhci, uint8_t slot_id, uint8_t ep_index,
+                       uint32_t count);
+int xhci_queue_transfer(xhci_controller_t* xhci, uint8_t slot_id, uint8_t ep_index,
+                        uint16_t stream, uint64_t address, uint32_t length,
+                        xhci_transfer_t* transfer, uint32_t flags);
+int xhci_queue_transfer_sg(xhci_controller_t* xhci, uint8_t slot_id, uint8_t ep_index,
+                           uint16_t stream, const xhci_segment_t* segments, uint32_t count,
+                           xhci_transfer_t* transfer, uint32_t flags);
+void xhci_ring_doorbell(xhci_controller_t* xhci, uint8_t slot_id, uint8_t ep_index,
+                        uint16_t stream);
+void xhci_handle_events(xhci_controller_t* xhci);
+
+// Interrupt moderation: at most one interrupt per usec microseconds from
+// an interrupter, 0 for none
+int xhci_set_moderation(xhci_controller_t* xhci, uint32_t interrupter, uint32_t usec);
+void xhci_get_stats(xhci_controller_t* xhci, xhci_stats_t* stats);
+int xhci_get_interrupter_stats(xhci_controller_t* xhci, uint32_t interrupter,
+                               xhci_event_stats_t* stats);
+
 #endif /* XHCI_H */
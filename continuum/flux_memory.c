@@ -5,6 +5,8 @@
 
 #include "flux_memory.h"
 #include "continuum_core.h"
+#include "temporal_scheduler.h"
+#include "continuum_trace.h"
 
 // =============================================================================
 // Constants and Macros
@@ -17,6 +19,16 @@
 #define BUDDY_MAX_ORDER         11  // Up to 8MB blocks
 #define COMPRESSION_THRESHOLD   (PAGE_SIZE / 2)
 
+// Physical allocator
+#define PHYS_INDEX_LEVELS       3   // Summary levels: 64^4 pages (64GB) per top word
+#define PHYS_MAGAZINE_SIZE      64  // Frames cached per CPU
+#define PHYS_MAGAZINE_BATCH     32  // Frames moved per refill/drain
+#define PHYS_RUN_PROBES         64  // Partial words tried before whole-word runs
+
+// Slab magazines
+#define SLAB_MAGAZINE_ROUNDS    14  // Objects per magazine (128-byte magazine)
+#define SLAB_MAGAZINE_CACHE     2   // g_slab_caches index magazines come from
+
 // Page flags
 #define PAGE_PRESENT            (1ULL << 0)
 #define PAGE_WRITABLE          (1ULL << 1)
@@ -31,6 +43,57 @@
 #define PAGE_COMPRESSED        (1ULL << 10)
 #define PAGE_ENCRYPTED         (1ULL << 11)
 #define PAGE_NX                (1ULL << 63)
+#define PAGE_PRIVATE           (1ULL << 52)  // Software bit: anonymous, compressible
+#define PTE_ADDR_MASK          0x000FFFFFFFFFF000ULL
+#define PTE_PROT_FLAGS         (PAGE_WRITABLE | PAGE_USER | PAGE_NX)
+
+// Compressed (not-present) PTE: zspage frame in the address bits, object
+// index above it, protection bits carried over from the original mapping
+#define ZPTE_INDEX_SHIFT       52
+#define ZPTE_INDEX_MASK        0x3FFULL
+#define ZPTE_KEEP_FLAGS        PTE_PROT_FLAGS
+
+// Page fault error code bits
+#define PF_PRESENT             (1ULL << 0)
+#define PF_WRITE               (1ULL << 1)
+
+#define FLUX_USER_TOP          0x0000800000000000ULL  // End of the lower half
+#define FLUX_SHARE_BASE        0x0000700000000000ULL  // Where transferred pages land
+
+// Compressed page pool
+#define ZPOOL_CLASS_STEP        32
+#define ZPOOL_CLASS_COUNT       (COMPRESSION_THRESHOLD / ZPOOL_CLASS_STEP)
+#define ZPOOL_MAX_PAGES         4   // Frames per zspage at most
+#define ZPOOL_MAX_OBJECTS       (ZPOOL_MAX_PAGES * PAGE_SIZE / ZPOOL_CLASS_STEP)
+#define ZPOOL_MAP_WORDS         (ZPOOL_MAX_OBJECTS / 64)
+#define ZPOOL_MAX_PAYLOAD       (COMPRESSION_THRESHOLD - sizeof(uint16_t))
+#define ZPOOL_MAGIC             0x5A535047  // "ZSPG"
+
+// LZ4 block format
+#define LZ4_MIN_MATCH           4
+#define LZ4_HASH_BITS           12
+#define LZ4_MFLIMIT             12  // Last match starts at least this far from the end
+#define LZ4_LAST_LITERALS       5   // Final bytes are always literals
+#define LZ4_WORKSPACE_PAGES     3   // Hash table (2 pages) + output buffer
+
+// Background compactor
+#define COMPACT_SCAN_BUDGET     512             // PTEs aged per domain per pass
+#define COMPACT_PRESSURE_PCT    25              // Run while free memory is below this
+#define COMPACT_INTERVAL        1000000000ULL   // TSC cycles between passes
+#define COLLAPSE_SCAN_BUDGET    8               // Page tables tried per domain per pass
+#define COMPACT_BATCH           16              // Pages unmapped per shootdown
+#define COMPACT_RECLAIM_PAGES   1024            // Asked of the shrinkers per pass
+
+// TLB maintenance
+#define TLB_FULL_FLUSH_PAGES    33      // Above this, reloading CR3 beats invlpg
+#define TLB_PCID_SLOTS          6       // Address spaces kept tagged per CPU
+#define CR3_NOFLUSH             (1ULL << 63)
+#define CR4_PCIDE               (1ULL << 17)
+#define PT_RELEASE_BATCH        64      // Entries released per shootdown
+
+// Unaligned, alias-safe scalar access
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_u64_t;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_u32_t;
 
 // =============================================================================
 // Global Memory State
@@ -45,9 +108,35 @@ static flux_memory_state_t g_memory_state = {
     .domain_count = 0
 };
 
-// Physical memory bitmap
+// Physical memory bitmap (1 bit per page, set = in use)
 static uint64_t* g_phys_bitmap = NULL;
 static uint64_t g_phys_pages = 0;
+static uint64_t g_phys_words = 0;
+static spinlock_t g_phys_lock = SPINLOCK_INIT;
+
+// Hierarchical summaries over bitmap words. Level 0 has one bit per bitmap
+// word, each higher level one bit per non-zero word below, so any search
+// descends PHYS_INDEX_LEVELS words instead of scanning the bitmap.
+typedef struct {
+    uint64_t* levels[PHYS_INDEX_LEVELS];
+    uint64_t words[PHYS_INDEX_LEVELS];
+} phys_index_t;
+
+static phys_index_t g_phys_avail;   // Bitmap word has at least one free page
+static phys_index_t g_phys_empty;   // Bitmap word is entirely free (64-page run)
+static uint64_t g_phys_run_rotor = 0;
+
+// Per-CPU frame magazines in front of the bitmap
+typedef struct {
+    uint64_t frames[PHYS_MAGAZINE_SIZE];
+    uint32_t count;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refills;
+    uint64_t drains;
+} __attribute__((aligned(64))) phys_magazine_t;
+
+static phys_magazine_t g_phys_magazines[MAX_CPU_CORES];
 
 // Buddy allocator for physical pages
 static struct buddy_block {
@@ -63,57 +152,428 @@ static const size_t g_slab_sizes[] = {
     32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536
 };
 
+// Magazine layer in front of the slab caches (Bonwick, "Magazines and
+// Vmem", 2001): each CPU keeps a loaded and a previous magazine and only
+// trades whole magazines with the locked depot
+typedef struct slab_magazine {
+    struct slab_magazine* next;
+    uint32_t rounds;
+    void* objects[SLAB_MAGAZINE_ROUNDS];
+} slab_magazine_t;
+
+typedef struct slab_cpu_cache {
+    slab_magazine_t* loaded;
+    slab_magazine_t* previous;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t depot_exchanges;
+    uint64_t remote_frees;
+} __attribute__((aligned(64))) slab_cpu_cache_t;
+
+static slab_cpu_cache_t g_slab_cpu_caches[SLAB_SIZES_COUNT][MAX_CPU_CORES];
+
 // Memory domains
 static memory_domain_t* g_domains[MAX_DOMAINS];
 static spinlock_t g_memory_lock = SPINLOCK_INIT;
 
+// Compressed page pool. Each zspage is 1-4 contiguous frames holding objects
+// of a single size class, with this header and a slot bitmap at the front.
+typedef struct zspage {
+    struct zspage* next;
+    struct zspage* prev;
+    uint32_t magic;
+    uint16_t class_idx;
+    uint16_t used;
+    uint64_t used_map[ZPOOL_MAP_WORDS];
+} zspage_t;
+
+#define ZSPAGE_HEADER \
+    ((sizeof(zspage_t) + ZPOOL_CLASS_STEP - 1) & ~(ZPOOL_CLASS_STEP - 1))
+
+typedef struct {
+    uint32_t size;
+    uint16_t pages;         // Frames per zspage
+    uint16_t objects;       // Objects per zspage
+    zspage_t* partial;      // At least one free slot
+    zspage_t* full;
+} zpool_class_t;
+
 // Compression engine
 static struct {
     void* workspace;
     size_t workspace_size;
     uint64_t compressed_pages;
     uint64_t compression_ratio;
+    
+    spinlock_t lock;        // Workspace and pool
+    zpool_class_t classes[ZPOOL_CLASS_COUNT];
+    uint64_t pool_pages;
+    uint64_t stored_bytes;
+    uint64_t rejects;
+    uint64_t decompressions;
+    uint64_t decompress_cycles;
+    uint64_t decompress_cycles_max;
 } g_compression;
 
+// Background compactor
+static struct {
+    uint64_t last_pass;
+    uint64_t passes;
+    uint64_t compressed;
+} g_compactor;
+
+// Caches that give memory back before the compactor starts compressing
+static struct {
+    flux_shrinker_t shrinker;
+    void* context;
+} g_shrinkers[FLUX_MAX_SHRINKERS];
+static spinlock_t g_shrinker_lock = SPINLOCK_INIT;
+
+// Extra references per frame beyond the mapping that owns it; frames
+// shared between domains are only freed when this drops back to zero
+static uint16_t* g_frame_refs = NULL;
+
+// Per-CPU TLB state
+typedef struct {
+    memory_domain_t* active;    // Domain whose tables are in CR3
+    struct {
+        memory_domain_t* domain;
+        uint64_t gen;           // domain->tlb_gen when this PCID was last valid
+    } slots[TLB_PCID_SLOTS];
+    uint32_t next_victim;
+} __attribute__((aligned(64))) tlb_cpu_state_t;
+
+static tlb_cpu_state_t g_tlb_cpu[MAX_CPU_CORES];
+
+// TLB shootdown
+static struct {
+    bool pcid;
+    uint64_t next_gen;
+    
+    spinlock_t lock;        // One remote request at a time
+    memory_domain_t* req_domain;
+    uint64_t req_addr;
+    size_t req_size;
+    uint32_t pending;       // Targets yet to acknowledge
+    
+    uint64_t cycles_max;
+} g_tlb;
+
 // =============================================================================
 // Physical Memory Management
 // =============================================================================
 
+static void phys_index_set(phys_index_t* index, uint64_t bit) {
+    for (int level = 0; level < PHYS_INDEX_LEVELS; level++) {
+        uint64_t* word = &index->levels[level][bit / 64];
+        bool was_empty = (*word == 0);
+        *word |= 1ULL << (bit % 64);
+        if (!was_empty) {
+            break;  // Parents already record this word as non-empty
+        }
+        bit /= 64;
+    }
+}
+
+static void phys_index_clear(phys_index_t* index, uint64_t bit) {
+    for (int level = 0; level < PHYS_INDEX_LEVELS; level++) {
+        uint64_t* word = &index->levels[level][bit / 64];
+        *word &= ~(1ULL << (bit % 64));
+        if (*word != 0) {
+            break;
+        }
+        bit /= 64;
+    }
+}
+
+// First set leaf bit >= bit, or -1
+static int64_t phys_index_next(phys_index_t* index, uint64_t bit) {
+    int level = 0;
+    uint64_t pos = bit;
+    
+    // Climb until some word has a set bit at or after pos
+    while (level < PHYS_INDEX_LEVELS) {
+        uint64_t w = pos / 64;
+        if (w >= index->words[level]) {
+            return -1;
+        }
+        uint64_t masked = index->levels[level][w] & (~0ULL << (pos % 64));
+        
+        // Nothing summarises the top level, so walk along it; past 64^4
+        // pages it has more than one word
+        while (!masked && level == PHYS_INDEX_LEVELS - 1 && ++w < index->words[level]) {
+            masked = index->levels[level][w];
+        }
+        if (masked) {
+            pos = w * 64 + __builtin_ctzll(masked);
+            break;
+        }
+        pos = w + 1;
+        level++;
+    }
+    
+    if (level == PHYS_INDEX_LEVELS) {
+        return -1;
+    }
+    
+    // Descend along first set bits; a set parent bit implies a non-zero word
+    while (level > 0) {
+        level--;
+        pos = pos * 64 + __builtin_ctzll(index->levels[level][pos]);
+    }
+    
+    return (int64_t)pos;
+}
+
+// Re-derive both summaries for one bitmap word after it changed
+static void phys_word_changed(uint64_t word_idx, uint64_t old_value) {
+    uint64_t value = g_phys_bitmap[word_idx];
+    
+    if ((old_value == ~0ULL) != (value == ~0ULL)) {
+        if (value == ~0ULL) {
+            phys_index_clear(&g_phys_avail, word_idx);
+        } else {
+            phys_index_set(&g_phys_avail, word_idx);
+        }
+    }
+    
+    if ((old_value == 0) != (value == 0)) {
+        if (value == 0) {
+            phys_index_set(&g_phys_empty, word_idx);
+        } else {
+            phys_index_clear(&g_phys_empty, word_idx);
+        }
+    }
+}
+
+// Mark [first, first + count) used or free. Caller holds g_phys_lock.
+static void phys_set_range(uint64_t first, uint64_t count, bool used) {
+    while (count > 0) {
+        uint64_t word_idx = first / 64;
+        uint64_t bit = first % 64;
+        uint64_t n = 64 - bit;
+        if (n > count) {
+            n = count;
+        }
+        uint64_t mask = (n == 64) ? ~0ULL : (((1ULL << n) - 1) << bit);
+        
+        uint64_t old_value = g_phys_bitmap[word_idx];
+        if (used) {
+            g_phys_bitmap[word_idx] |= mask;
+        } else {
+            g_phys_bitmap[word_idx] &= ~mask;
+        }
+        phys_word_changed(word_idx, old_value);
+        
+        uint64_t changed = __builtin_popcountll(old_value ^ g_phys_bitmap[word_idx]);
+        if (used) {
+            g_memory_state.used_memory += changed * PAGE_SIZE;
+            g_memory_state.free_memory -= changed * PAGE_SIZE;
+        } else {
+            g_memory_state.used_memory -= changed * PAGE_SIZE;
+            g_memory_state.free_memory += changed * PAGE_SIZE;
+        }
+        
+        first += n;
+        count -= n;
+    }
+}
+
+// Pull up to max free frames out of the bitmap. Caller holds g_phys_lock.
+static uint32_t phys_take_frames(uint64_t* frames, uint32_t max) {
+    uint32_t taken = 0;
+    
+    while (taken < max) {
+        int64_t word_idx = phys_index_next(&g_phys_avail, 0);
+        if (word_idx < 0) {
+            break;
+        }
+        
+        uint64_t old_value = g_phys_bitmap[word_idx];
+        uint64_t free_bits = ~old_value;
+        while (free_bits && taken < max) {
+            uint64_t bit = __builtin_ctzll(free_bits);
+            free_bits &= free_bits - 1;
+            g_phys_bitmap[word_idx] |= 1ULL << bit;
+            frames[taken++] = ((uint64_t)word_idx * 64 + bit) * PAGE_SIZE;
+        }
+        
+        phys_word_changed(word_idx, old_value);
+        uint64_t changed = __builtin_popcountll(old_value ^ g_phys_bitmap[word_idx]);
+        g_memory_state.used_memory += changed * PAGE_SIZE;
+        g_memory_state.free_memory -= changed * PAGE_SIZE;
+    }
+    
+    return taken;
+}
+
+static void phys_magazine_refill(phys_magazine_t* mag) {
+    spinlock_acquire(&g_phys_lock);
+    mag->count += phys_take_frames(&mag->frames[mag->count], PHYS_MAGAZINE_BATCH);
+    mag->refills++;
+    spinlock_release(&g_phys_lock);
+}
+
+static void phys_magazine_drain(phys_magazine_t* mag, uint32_t count) {
+    spinlock_acquire(&g_phys_lock);
+    while (count-- > 0 && mag->count > 0) {
+        phys_set_range(mag->frames[--mag->count] / PAGE_SIZE, 1, false);
+    }
+    mag->drains++;
+    spinlock_release(&g_phys_lock);
+}
+
 static uint64_t phys_alloc_page(void) {
-    spinlock_acquire(&g_memory_lock);
+    uint64_t flags = cpu_irq_save();
+    phys_magazine_t* mag = &g_phys_magazines[temporal_get_current_cpu()];
     
-    // Find first free page in bitmap
-    for (uint64_t i = 0; i < g_phys_pages / 64; i++) {
-        if (g_phys_bitmap[i] != 0xFFFFFFFFFFFFFFFFULL) {
-            // Found a free page
-            uint64_t bit = __builtin_ctzll(~g_phys_bitmap[i]);
-            g_phys_bitmap[i] |= (1ULL << bit);
-            
-            uint64_t page_addr = (i * 64 + bit) * PAGE_SIZE;
-            g_memory_state.used_memory += PAGE_SIZE;
-            g_memory_state.free_memory -= PAGE_SIZE;
+    if (mag->count > 0) {
+        mag->hits++;
+    } else {
+        mag->misses++;
+        phys_magazine_refill(mag);
+    }
+    
+    uint64_t page_addr = 0;  // 0 = out of memory
+    if (mag->count > 0) {
+        page_addr = mag->frames[--mag->count];
+    }
+    
+    cpu_irq_restore(flags);
+    return page_addr;
+}
+
+static void phys_free_page(uint64_t addr) {
+    uint64_t flags = cpu_irq_save();
+    phys_magazine_t* mag = &g_phys_magazines[temporal_get_current_cpu()];
+    
+    if (mag->count == PHYS_MAGAZINE_SIZE) {
+        phys_magazine_drain(mag, PHYS_MAGAZINE_BATCH);
+    }
+    mag->frames[mag->count++] = addr;
+    
+    cpu_irq_restore(flags);
+}
+
+// Search for count contiguous free pages. Caller holds g_phys_lock.
+static int64_t phys_find_run(uint64_t count) {
+    if (count <= 64) {
+        // Prefer a hole in a partially used word so whole-free words stay
+        // available for large runs; give up after a bounded number of words
+        uint64_t word_idx = g_phys_run_rotor;
+        for (int probes = 0; probes < PHYS_RUN_PROBES; probes++) {
+            int64_t next = phys_index_next(&g_phys_avail, word_idx);
+            if (next < 0) {
+                if (word_idx == 0) {
+                    break;
+                }
+                word_idx = 0;  // Wrap once
+                continue;
+            }
             
-            spinlock_release(&g_memory_lock);
-            return page_addr;
+            uint64_t used = g_phys_bitmap[next];
+            if (used != 0) {
+                // Positions where count consecutive free bits start
+                uint64_t starts = ~used;
+                for (uint64_t i = 1; i < count && starts; i++) {
+                    starts &= ~used >> i;
+                }
+                if (starts) {
+                    g_phys_run_rotor = next;
+                    return next * 64 + __builtin_ctzll(starts);
+                }
+            }
+            word_idx = next + 1;
         }
     }
     
-    spinlock_release(&g_memory_lock);
-    return 0;  // Out of memory
+    // Runs of whole free words via the empty-word summary
+    uint64_t words_needed = (count + 63) / 64;
+    uint64_t from = 0;
+    while (1) {
+        int64_t first = phys_index_next(&g_phys_empty, from);
+        if (first < 0 || (uint64_t)first + words_needed > g_phys_words) {
+            return -1;
+        }
+        
+        uint64_t w = 1;
+        while (w < words_needed && g_phys_bitmap[first + w] == 0) {
+            w++;
+        }
+        if (w == words_needed) {
+            return first * 64;
+        }
+        from = first + w + 1;
+    }
 }
 
-static void phys_free_page(uint64_t addr) {
-    uint64_t page_num = addr / PAGE_SIZE;
-    uint64_t bitmap_idx = page_num / 64;
-    uint64_t bit_idx = page_num % 64;
+static uint64_t phys_alloc_pages(uint64_t count) {
+    if (count == 1) {
+        return phys_alloc_page();
+    }
     
-    spinlock_acquire(&g_memory_lock);
+    spinlock_acquire(&g_phys_lock);
     
-    g_phys_bitmap[bitmap_idx] &= ~(1ULL << bit_idx);
-    g_memory_state.used_memory -= PAGE_SIZE;
-    g_memory_state.free_memory += PAGE_SIZE;
+    int64_t first = phys_find_run(count);
+    if (first < 0) {
+        spinlock_release(&g_phys_lock);
+        return 0;
+    }
+    phys_set_range((uint64_t)first, count, true);
     
-    spinlock_release(&g_memory_lock);
+    spinlock_release(&g_phys_lock);
+    return (uint64_t)first * PAGE_SIZE;
+}
+
+static void phys_free_pages(uint64_t addr, uint64_t count) {
+    spinlock_acquire(&g_phys_lock);
+    phys_set_range(addr / PAGE_SIZE, count, false);
+    spinlock_release(&g_phys_lock);
+}
+
+// 512 contiguous frames on a 2MB boundary, 0 if no such run is free
+static uint64_t phys_alloc_huge(void) {
+    const uint64_t words = HUGE_PAGE_SIZE / PAGE_SIZE / 64;
+    
+    spinlock_acquire(&g_phys_lock);
+    
+    uint64_t from = 0;
+    while (1) {
+        int64_t next = phys_index_next(&g_phys_empty, from);
+        if (next < 0) {
+            break;
+        }
+        
+        uint64_t first = ((uint64_t)next + words - 1) & ~(words - 1);
+        if (first + words > g_phys_words) {
+            break;
+        }
+        
+        uint64_t w = 0;
+        while (w < words && g_phys_bitmap[first + w] == 0) {
+            w++;
+        }
+        if (w == words) {
+            phys_set_range(first * 64, words * 64, true);
+            spinlock_release(&g_phys_lock);
+            return first * 64 * PAGE_SIZE;
+        }
+        from = first + w + 1;
+    }
+    
+    spinlock_release(&g_phys_lock);
+    return 0;
+}
+
+static void phys_index_init(phys_index_t* index, uint64_t** storage) {
+    uint64_t bits = g_phys_words;
+    for (int level = 0; level < PHYS_INDEX_LEVELS; level++) {
+        index->words[level] = (bits + 63) / 64;
+        index->levels[level] = *storage;
+        memset(index->levels[level], 0, index->words[level] * sizeof(uint64_t));
+        *storage += index->words[level];
+        bits = index->words[level];
+    }
 }
 
 // =============================================================================
@@ -166,8 +626,8 @@ static void* buddy_alloc(size_t size) {
     
     spinlock_release(&g_memory_lock);
     
-    // Allocate new pages from physical memory
-    uint64_t phys_addr = phys_alloc_page();
+    // Allocate a fresh contiguous run from physical memory
+    uint64_t phys_addr = phys_alloc_pages(1ULL << order);
     if (phys_addr) {
         return (void*)phys_addr;  // Simplified - would need virtual mapping
     }
@@ -233,7 +693,8 @@ static void buddy_free(void* ptr, size_t size) {
 // Slab Allocator
 // =============================================================================
 
-static void slab_init_cache(slab_cache_t* cache, size_t object_size) {
+static void slab_init_cache(slab_cache_t* cache, size_t object_size,
+                            slab_cpu_cache_t* cpu_caches) {
     cache->object_size = object_size;
     cache->objects_per_slab = (PAGE_SIZE - sizeof(slab_t)) / object_size;
     cache->full_slabs = NULL;
@@ -242,6 +703,13 @@ static void slab_init_cache(slab_cache_t* cache, size_t object_size) {
     cache->total_objects = 0;
     cache->free_objects = 0;
     spinlock_init(&cache->lock);
+    
+    cache->cpu_caches = cpu_caches;
+    cache->depot_full = NULL;
+    cache->depot_empty = NULL;
+    cache->depot_full_count = 0;
+    cache->depot_empty_count = 0;
+    spinlock_init(&cache->depot_lock);
 }
 
 static slab_t* slab_create(slab_cache_t* cache) {
@@ -253,6 +721,7 @@ static slab_t* slab_create(slab_cache_t* cache) {
     
     slab_t* slab = (slab_t*)page;
     slab->cache = cache;
+    slab->owner_cpu = temporal_get_current_cpu();
     slab->free_count = cache->objects_per_slab;
     slab->next = NULL;
     slab->prev = NULL;
@@ -386,371 +855,2520 @@ static void slab_free(void* obj, slab_cache_t* cache) {
 }
 
 // =============================================================================
-// Memory Domain Management
+// Slab Magazine Layer
 // =============================================================================
 
-memory_domain_t* flux_create_domain(quantum_id_t owner) {
-    spinlock_acquire(&g_memory_lock);
+static slab_magazine_t* depot_pop(slab_magazine_t** list, uint32_t* count) {
+    slab_magazine_t* mag = *list;
+    if (mag) {
+        *list = mag->next;
+        (*count)--;
+    }
+    return mag;
+}
+
+static void depot_push(slab_magazine_t** list, uint32_t* count,
+                       slab_magazine_t* mag) {
+    mag->next = *list;
+    *list = mag;
+    (*count)++;
+}
+
+static slab_magazine_t* slab_depot_get_full(slab_cache_t* cache) {
+    spinlock_acquire(&cache->depot_lock);
+    slab_magazine_t* mag = depot_pop(&cache->depot_full, &cache->depot_full_count);
+    spinlock_release(&cache->depot_lock);
+    return mag;
+}
+
+static slab_magazine_t* slab_depot_get_empty(slab_cache_t* cache) {
+    spinlock_acquire(&cache->depot_lock);
+    slab_magazine_t* mag = depot_pop(&cache->depot_empty, &cache->depot_empty_count);
+    spinlock_release(&cache->depot_lock);
     
-    // Find free domain slot
-    int domain_id = -1;
-    for (int i = 0; i < MAX_DOMAINS; i++) {
-        if (!g_domains[i]) {
-            domain_id = i;
-            break;
+    if (!mag) {
+        // Magazines come straight from the slab layer so that allocating
+        // one never recurses into a magazine exchange
+        mag = slab_alloc(&g_slab_caches[SLAB_MAGAZINE_CACHE]);
+        if (mag) {
+            mag->rounds = 0;
+            mag->next = NULL;
         }
     }
-    
-    if (domain_id == -1) {
-        spinlock_release(&g_memory_lock);
-        return NULL;
+    return mag;
+}
+
+static void slab_depot_put(slab_cache_t* cache, slab_magazine_t* mag) {
+    spinlock_acquire(&cache->depot_lock);
+    if (mag->rounds > 0) {
+        depot_push(&cache->depot_full, &cache->depot_full_count, mag);
+    } else {
+        depot_push(&cache->depot_empty, &cache->depot_empty_count, mag);
     }
+    spinlock_release(&cache->depot_lock);
+}
+
+static void* slab_cache_alloc(slab_cache_t* cache) {
+    uint64_t flags = cpu_irq_save();
+    slab_cpu_cache_t* cc = &cache->cpu_caches[temporal_get_current_cpu()];
+    void* obj = NULL;
     
-    memory_domain_t* domain = slab_alloc(&g_slab_caches[8]);  // 256 bytes
-    if (!domain) {
-        spinlock_release(&g_memory_lock);
-        return NULL;
+    while (1) {
+        if (cc->loaded && cc->loaded->rounds > 0) {
+            obj = cc->loaded->objects[--cc->loaded->rounds];
+            break;
+        }
+        
+        // Loaded is empty; a full previous magazine just swaps in
+        if (cc->previous && cc->previous->rounds > 0) {
+            slab_magazine_t* tmp = cc->loaded;
+            cc->loaded = cc->previous;
+            cc->previous = tmp;
+            continue;
+        }
+        
+        // Both empty: hand one back and take a full one from the depot
+        slab_magazine_t* full = slab_depot_get_full(cache);
+        if (!full) {
+            break;
+        }
+        if (cc->previous) {
+            slab_depot_put(cache, cc->previous);
+        }
+        cc->previous = cc->loaded;
+        cc->loaded = full;
+        cc->depot_exchanges++;
     }
     
-    domain->domain_id = domain_id;
-    domain->owner_qid = owner;
-    domain->page_table_base = phys_alloc_page();
-    domain->region_count = 0;
-    domain->total_size = 0;
-    domain->flags = 0;
-    spinlock_init(&domain->lock);
-    
-    // Clear page table
-    memset((void*)domain->page_table_base, 0, PAGE_SIZE);
-    
-    g_domains[domain_id] = domain;
-    g_memory_state.domain_count++;
+    if (!obj) {
+        obj = slab_alloc(cache);
+    }
+    if (obj) {
+        cc->allocs++;
+    }
     
-    spinlock_release(&g_memory_lock);
-    return domain;
+    cpu_irq_restore(flags);
+    return obj;
 }
 
-void flux_destroy_domain(memory_domain_t* domain) {
-    if (!domain) {
-        return;
+static void slab_cache_free(slab_cache_t* cache, void* obj) {
+    uint64_t flags = cpu_irq_save();
+    uint32_t cpu = temporal_get_current_cpu();
+    slab_cpu_cache_t* cc = &cache->cpu_caches[cpu];
+    slab_t* slab = (slab_t*)((uint64_t)obj & ~(PAGE_SIZE - 1));
+    
+    cc->frees++;
+    if (slab->owner_cpu != cpu) {
+        cc->remote_frees++;
     }
     
-    spinlock_acquire(&g_memory_lock);
+    while (1) {
+        if (cc->loaded && cc->loaded->rounds < SLAB_MAGAZINE_ROUNDS) {
+            cc->loaded->objects[cc->loaded->rounds++] = obj;
+            break;
+        }
+        
+        // Loaded is full; an empty previous magazine just swaps in
+        if (cc->previous && cc->previous->rounds == 0) {
+            slab_magazine_t* tmp = cc->loaded;
+            cc->loaded = cc->previous;
+            cc->previous = tmp;
+            continue;
+        }
+        
+        // Park the full one in the depot and load an empty magazine
+        slab_magazine_t* empty = slab_depot_get_empty(cache);
+        if (!empty) {
+            slab_free(obj, cache);  // No magazine memory: bypass the layer
+            break;
+        }
+        if (cc->previous) {
+            slab_depot_put(cache, cc->previous);
+        }
+        cc->previous = cc->loaded;
+        cc->loaded = empty;
+        cc->depot_exchanges++;
+    }
     
-    // Free all regions
-    for (uint32_t i = 0; i < domain->region_count; i++) {
-        memory_region_t* region = &domain->regions[i];
-        if (region->flags & REGION_FLAG_ALLOCATED) {
-            // Free physical pages
-            for (size_t offset = 0; offset < region->size; offset += PAGE_SIZE) {
-                uint64_t vaddr = region->base_addr + offset;
-                uint64_t paddr = flux_translate_address(domain, vaddr);
-                if (paddr) {
-                    phys_free_page(paddr);
-                }
+    cpu_irq_restore(flags);
+}
+
+// Return every depot-held object to its slab and release spare magazines
+void flux_slab_reap(void) {
+    for (int i = 0; i < SLAB_SIZES_COUNT; i++) {
+        slab_cache_t* cache = &g_slab_caches[i];
+        
+        spinlock_acquire(&cache->depot_lock);
+        slab_magazine_t* full = cache->depot_full;
+        slab_magazine_t* empty = cache->depot_empty;
+        cache->depot_full = NULL;
+        cache->depot_empty = NULL;
+        cache->depot_full_count = 0;
+        cache->depot_empty_count = 0;
+        spinlock_release(&cache->depot_lock);
+        
+        while (full) {
+            slab_magazine_t* next = full->next;
+            while (full->rounds > 0) {
+                slab_free(full->objects[--full->rounds], cache);
             }
+            slab_free(full, &g_slab_caches[SLAB_MAGAZINE_CACHE]);
+            full = next;
+        }
+        while (empty) {
+            slab_magazine_t* next = empty->next;
+            slab_free(empty, &g_slab_caches[SLAB_MAGAZINE_CACHE]);
+            empty = next;
         }
     }
-    
-    // Free page table
-    if (domain->page_table_base) {
-        phys_free_page(domain->page_table_base);
+}
+
+size_t flux_get_slab_stats(flux_slab_stats_t* stats, size_t max_caches) {
+    if (!stats) {
+        return 0;
     }
     
-    g_domains[domain->domain_id] = NULL;
-    g_memory_state.domain_count--;
-    
-    slab_free(domain, &g_slab_caches[8]);
+    size_t count = 0;
+    for (int i = 0; i < SLAB_SIZES_COUNT && count < max_caches; i++) {
+        slab_cache_t* cache = &g_slab_caches[i];
+        flux_slab_stats_t* out = &stats[count++];
+        
+        out->object_size = cache->object_size;
+        out->total_objects = cache->total_objects;
+        out->free_objects = cache->free_objects;
+        out->magazine_objects = 0;
+        out->allocs = 0;
+        out->frees = 0;
+        out->depot_exchanges = 0;
+        out->remote_frees = 0;
+        
+        for (uint32_t cpu = 0; cpu < MAX_CPU_CORES; cpu++) {
+            slab_cpu_cache_t* cc = &cache->cpu_caches[cpu];
+            out->allocs += cc->allocs;
+            out->frees += cc->frees;
+            out->depot_exchanges += cc->depot_exchanges;
+            out->remote_frees += cc->remote_frees;
+            if (cc->loaded) {
+                out->magazine_objects += cc->loaded->rounds;
+            }
+            if (cc->previous) {
+                out->magazine_objects += cc->previous->rounds;
+            }
+        }
+        
+        spinlock_acquire(&cache->depot_lock);
+        for (slab_magazine_t* mag = cache->depot_full; mag; mag = mag->next) {
+            out->magazine_objects += mag->rounds;
+        }
+        spinlock_release(&cache->depot_lock);
+    }
     
-    spinlock_release(&g_memory_lock);
+    return count;
 }
 
 // =============================================================================
-// Virtual Memory Operations
+// Region Tree
 // =============================================================================
 
-void* flux_allocate(memory_domain_t* domain, size_t size, uint32_t flags) {
-    if (size == 0) {
-        return NULL;
-    }
-    
-    // Use kernel domain if not specified
-    if (!domain) {
-        domain = g_domains[0];  // Kernel domain
+// Regions live in an AVL tree keyed by base address, each node augmented
+// with the highest end address in its subtree so overlap queries descend a
+// single path. Nodes come from the slab cache that fits memory_region_t.
+
+static slab_cache_t* slab_cache_for(size_t size) {
+    for (int i = 0; i < SLAB_SIZES_COUNT; i++) {
+        if (size <= g_slab_sizes[i]) {
+            return &g_slab_caches[i];
+        }
     }
+    return NULL;
+}
+
+static inline int32_t region_height(memory_region_t* node) {
+    return node ? node->height : 0;
+}
+
+static void region_update(memory_region_t* node) {
+    int32_t lh = region_height(node->left);
+    int32_t rh = region_height(node->right);
+    node->height = 1 + (lh > rh ? lh : rh);
     
-    // Use slab allocator for small sizes
-    if (!(flags & FLUX_ALLOC_LARGE) && size <= 65536) {
-        for (int i = 0; i < SLAB_SIZES_COUNT; i++) {
-            if (size <= g_slab_sizes[i]) {
-                void* obj = slab_alloc(&g_slab_caches[i]);
-                if (obj && (flags & FLUX_ALLOC_ZERO)) {
-                    memset(obj, 0, g_slab_sizes[i]);
-                }
-                return obj;
-            }
+    node->subtree_end = node->base_addr + node->size;
+    if (node->left && node->left->subtree_end > node->subtree_end) {
+        node->subtree_end = node->left->subtree_end;
+    }
+    if (node->right && node->right->subtree_end > node->subtree_end) {
+        node->subtree_end = node->right->subtree_end;
+    }
+}
+
+static memory_region_t* region_rotate_right(memory_region_t* node) {
+    memory_region_t* pivot = node->left;
+    node->left = pivot->right;
+    pivot->right = node;
+    region_update(node);
+    region_update(pivot);
+    return pivot;
+}
+
+static memory_region_t* region_rotate_left(memory_region_t* node) {
+    memory_region_t* pivot = node->right;
+    node->right = pivot->left;
+    pivot->left = node;
+    region_update(node);
+    region_update(pivot);
+    return pivot;
+}
+
+static memory_region_t* region_rebalance(memory_region_t* node) {
+    region_update(node);
+    int32_t balance = region_height(node->left) - region_height(node->right);
+    
+    if (balance > 1) {
+        if (region_height(node->left->left) < region_height(node->left->right)) {
+            node->left = region_rotate_left(node->left);
+        }
+        return region_rotate_right(node);
+    }
+    if (balance < -1) {
+        if (region_height(node->right->right) < region_height(node->right->left)) {
+            node->right = region_rotate_right(node->right);
         }
+        return region_rotate_left(node);
+    }
+    return node;
+}
+
+static memory_region_t* region_insert_node(memory_region_t* root, memory_region_t* node) {
+    if (!root) {
+        node->left = NULL;
+        node->right = NULL;
+        region_update(node);
+        return node;
     }
     
-    // Use buddy allocator for larger sizes
-    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);  // Round up to page
-    void* ptr = buddy_alloc(size);
+    if (node->base_addr < root->base_addr) {
+        root->left = region_insert_node(root->left, node);
+    } else {
+        root->right = region_insert_node(root->right, node);
+    }
+    return region_rebalance(root);
+}
+
+static memory_region_t* region_remove_min(memory_region_t* root, memory_region_t** min) {
+    if (!root->left) {
+        *min = root;
+        return root->right;
+    }
+    root->left = region_remove_min(root->left, min);
+    return region_rebalance(root);
+}
+
+static memory_region_t* region_remove_node(memory_region_t* root, memory_region_t* node) {
+    if (!root) {
+        return NULL;
+    }
     
-    if (ptr && (flags & FLUX_ALLOC_ZERO)) {
-        memset(ptr, 0, size);
+    if (root == node) {
+        if (!root->right) {
+            return root->left;
+        }
+        memory_region_t* min;
+        memory_region_t* right = region_remove_min(root->right, &min);
+        min->left = root->left;
+        min->right = right;
+        return region_rebalance(min);
     }
     
-    // Update domain tracking
-    if (ptr && domain) {
-        spinlock_acquire(&domain->lock);
-        
-        if (domain->region_count < MAX_REGIONS_PER_DOMAIN) {
-            memory_region_t* region = &domain->regions[domain->region_count++];
-            region->base_addr = (uint64_t)ptr;
-            region->size = size;
-            region->flags = REGION_FLAG_ALLOCATED;
-            if (flags & FLUX_ALLOC_EXEC) {
-                region->flags |= REGION_FLAG_EXECUTABLE;
-            }
-            if (!(flags & FLUX_ALLOC_WRITE)) {
-                region->flags |= REGION_FLAG_READONLY;
-            }
-            domain->total_size += size;
+    if (node->base_addr < root->base_addr) {
+        root->left = region_remove_node(root->left, node);
+    } else {
+        root->right = region_remove_node(root->right, node);
+    }
+    return region_rebalance(root);
+}
+
+// Region containing addr. Caller holds domain->lock.
+static memory_region_t* region_lookup(memory_domain_t* domain, uint64_t addr) {
+    memory_region_t* node = domain->region_root;
+    
+    while (node) {
+        if (addr < node->base_addr) {
+            node = node->left;
+        } else if (addr >= node->base_addr + node->size) {
+            node = node->right;
+        } else {
+            return node;
         }
-        
-        spinlock_release(&domain->lock);
+    }
+    return NULL;
+}
+
+// Lowest region overlapping [start, end). Caller holds domain->lock.
+static memory_region_t* region_first_overlap(memory_domain_t* domain,
+                                             uint64_t start, uint64_t end) {
+    memory_region_t* node = domain->region_root;
+    
+    while (node) {
+        if (node->left && node->left->subtree_end > start) {
+            // Anything lower that reaches past start is on the left; if
+            // it begins at or after end, nothing further right overlaps
+            node = node->left;
+        } else if (node->base_addr >= end) {
+            return NULL;
+        } else if (node->base_addr + node->size > start) {
+            return node;
+        } else {
+            node = node->right;
+        }
+    }
+    return NULL;
+}
+
+static void region_insert(memory_domain_t* domain, memory_region_t* region) {
+    domain->region_root = region_insert_node(domain->region_root, region);
+    domain->region_count++;
+    domain->total_size += region->size;
+}
+
+static void region_remove(memory_domain_t* domain, memory_region_t* region) {
+    domain->region_root = region_remove_node(domain->region_root, region);
+    domain->region_count--;
+    domain->total_size -= region->size;
+}
+
+static memory_region_t* region_create(uint64_t base, size_t size, uint32_t flags,
+                                      uint32_t protection, uint64_t paddr) {
+    memory_region_t* region = slab_cache_alloc(slab_cache_for(sizeof(memory_region_t)));
+    if (!region) {
+        return NULL;
     }
     
-    return ptr;
+    region->base_addr = base;
+    region->size = size;
+    region->flags = flags;
+    region->protection = protection;
+    region->physical_addr = paddr;
+    region->ops = NULL;
+    region->private_data = NULL;
+    region->left = NULL;
+    region->right = NULL;
+    region->subtree_end = base + size;
+    region->height = 1;
+    return region;
 }
 
-void flux_free(void* ptr) {
-    if (!ptr) {
-        return;
+static void region_destroy(memory_region_t* region) {
+    slab_cache_free(slab_cache_for(sizeof(memory_region_t)), region);
+}
+
+// Make addr a region boundary by splitting the region that spans it.
+// Caller holds domain->lock.
+static int region_split_at(memory_domain_t* domain, uint64_t addr) {
+    memory_region_t* region = region_lookup(domain, addr);
+    if (!region || region->base_addr == addr) {
+        return 0;
     }
     
-    // Check if it's a slab allocation
-    uint64_t addr = (uint64_t)ptr;
-    slab_t* slab = (slab_t*)(addr & ~(PAGE_SIZE - 1));
+    uint64_t offset = addr - region->base_addr;
+    memory_region_t* tail = region_create(addr, region->size - offset, region->flags,
+                                          region->protection,
+                                          region->physical_addr ?
+                                          region->physical_addr + offset : 0);
+    if (!tail) {
+        return -ENOMEM;
+    }
+    tail->ops = region->ops;
+    tail->private_data = region->private_data;
     
-    // Simple check for slab magic (would be more robust in production)
-    if (slab->cache && slab->cache->object_size > 0) {
-        slab_free(ptr, slab->cache);
-    } else {
-        // Assume buddy allocation
-        // Size would need to be tracked properly
-        buddy_free(ptr, PAGE_SIZE);  // Simplified
+    // Shrinking changes the node's end, so take it out and put it back to
+    // keep the subtree ends exact
+    region_remove(domain, region);
+    region->size = offset;
+    region_insert(domain, region);
+    region_insert(domain, tail);
+    return 0;
+}
+
+// Drop all regions inside [start, end), splitting ones that straddle it.
+// Caller holds domain->lock.
+static int region_clear_range(memory_domain_t* domain, uint64_t start, uint64_t end) {
+    if (region_split_at(domain, start) < 0 || region_split_at(domain, end) < 0) {
+        return -ENOMEM;
+    }
+    
+    memory_region_t* region;
+    while ((region = region_first_overlap(domain, start, end)) != NULL) {
+        region_remove(domain, region);
+        region_destroy(region);
     }
+    return 0;
 }
 
-void* flux_map_region(memory_domain_t* domain, uint64_t vaddr, 
-                     uint64_t paddr, size_t size, uint32_t flags) {
-    if (!domain || !size) {
+static uint32_t region_flags_for_map(uint32_t flags) {
+    uint32_t region_flags = REGION_FLAG_MAPPED;
+    if (flags & FLUX_MAP_SHARED) region_flags |= REGION_FLAG_SHARED;
+    if (flags & FLUX_MAP_COW) region_flags |= REGION_FLAG_COW;
+    if (flags & FLUX_MAP_EXEC) region_flags |= REGION_FLAG_EXECUTABLE;
+    if (!(flags & FLUX_MAP_WRITE)) region_flags |= REGION_FLAG_READONLY;
+    return region_flags;
+}
+
+memory_region_t* flux_find_region(memory_domain_t* domain, uint64_t addr) {
+    if (!domain) {
         return NULL;
     }
     
     spinlock_acquire(&domain->lock);
+    memory_region_t* region = region_lookup(domain, addr);
+    spinlock_release(&domain->lock);
     
-    // Get page table base
-    uint64_t* pml4 = (uint64_t*)domain->page_table_base;
+    return region;
+}
+
+// =============================================================================
+// Frame Sharing
+// =============================================================================
+
+static inline uint16_t* frame_refs(uint64_t paddr) {
+    uint64_t pfn = paddr / PAGE_SIZE;
+    return (g_frame_refs && pfn < g_phys_pages) ? &g_frame_refs[pfn] : NULL;
+}
+
+static inline bool frame_is_shared(uint64_t paddr) {
+    uint16_t* refs = frame_refs(paddr);
+    return refs && __atomic_load_n(refs, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Take another reference to a private frame for a second mapping. A
+// saturated count pins the frame for good rather than wrapping.
+void flux_ref_page(uint64_t paddr) {
+    uint16_t* refs = frame_refs(paddr);
+    if (!refs) {
+        return;
+    }
     
-    // Map each page
-    for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
-        uint64_t va = vaddr + offset;
-        uint64_t pa = paddr + offset;
-        
-        // Calculate indices
-        uint64_t pml4_idx = (va >> 39) & 0x1FF;
-        uint64_t pdpt_idx = (va >> 30) & 0x1FF;
-        uint64_t pd_idx = (va >> 21) & 0x1FF;
-        uint64_t pt_idx = (va >> 12) & 0x1FF;
-        
-        // Get or create PDPT
-        if (!(pml4[pml4_idx] & PAGE_PRESENT)) {
-            uint64_t pdpt_page = phys_alloc_page();
-            if (!pdpt_page) {
-                spinlock_release(&domain->lock);
-                return NULL;
+    uint16_t old = __atomic_load_n(refs, __ATOMIC_RELAXED);
+    do {
+        if (old == UINT16_MAX) {
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(refs, &old, old + 1, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+}
+
+// Drop one mapping's reference; the last one frees the frame
+void flux_unref_page(uint64_t paddr) {
+    uint16_t* refs = frame_refs(paddr);
+    if (refs) {
+        uint16_t old = __atomic_load_n(refs, __ATOMIC_RELAXED);
+        while (old != 0) {
+            if (old == UINT16_MAX) {
+                return;
+            }
+            if (__atomic_compare_exchange_n(refs, &old, old - 1, true,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                return;
+            }
+        }
+    }
+    phys_free_page(paddr & PTE_ADDR_MASK);
+}
+
+// =============================================================================
+// TLB Shootdown
+// =============================================================================
+
+static inline uint64_t read_cr3(void) {
+    uint64_t cr3;
+    __asm__ __volatile__("movq %%cr3, %0" : "=r"(cr3));
+    return cr3;
+}
+
+static inline void write_cr3(uint64_t cr3) {
+    __asm__ __volatile__("movq %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+void flux_tlb_init(uint64_t cpu_features) {
+    spinlock_init(&g_tlb.lock);
+    g_tlb.next_gen = 1;
+    g_tlb.pcid = false;
+    
+    // CR4.PCIDE may only be set while CR3's PCID field is zero, as it is
+    // straight out of Genesis
+    if ((cpu_features & CPU_FEATURE_PCID) && (read_cr3() & 0xFFF) == 0) {
+        uint64_t cr4;
+        __asm__ __volatile__("movq %%cr4, %0" : "=r"(cr4));
+        __asm__ __volatile__("movq %0, %%cr4" : : "r"(cr4 | CR4_PCIDE) : "memory");
+        g_tlb.pcid = true;
+    }
+}
+
+// Fresh generation from the global sequence, so a domain reusing a freed
+// domain's address never matches a generation cached in a PCID slot
+static uint64_t tlb_next_gen(void) {
+    return __atomic_fetch_add(&g_tlb.next_gen, 1, __ATOMIC_SEQ_CST);
+}
+
+// Choose the CR3 value for switching this CPU to domain's page tables.
+// Up to TLB_PCID_SLOTS address spaces stay tagged per CPU, so switching
+// back to one whose generation hasn't moved keeps its TLB entries.
+uint64_t flux_tlb_switch(memory_domain_t* domain, uint64_t cr3) {
+    uint32_t cpu = temporal_get_current_cpu();
+    tlb_cpu_state_t* state = &g_tlb_cpu[cpu];
+    uint64_t base = cr3 & PTE_ADDR_MASK;
+    uint64_t cpu_bit = 1ULL << (cpu % 64);
+    
+    memory_domain_t* prev = state->active;
+    if (prev && prev != domain) {
+        __atomic_fetch_and(&prev->tlb_cpus[cpu / 64], ~cpu_bit, __ATOMIC_SEQ_CST);
+    }
+    if (!domain) {
+        __atomic_store_n(&state->active, NULL, __ATOMIC_SEQ_CST);
+        return base;
+    }
+    
+    // Publish that we run the domain before sampling its generation: a
+    // concurrent shootdown either sees us and sends an IPI, or bumped the
+    // generation before we read it and we flush below
+    __atomic_fetch_or(&domain->tlb_cpus[cpu / 64], cpu_bit, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&state->active, domain, __ATOMIC_SEQ_CST);
+    uint64_t gen = __atomic_load_n(&domain->tlb_gen, __ATOMIC_SEQ_CST);
+    
+    if (!g_tlb.pcid) {
+        return base;
+    }
+    
+    uint32_t slot;
+    for (slot = 0; slot < TLB_PCID_SLOTS; slot++) {
+        if (state->slots[slot].domain == domain) {
+            break;
+        }
+    }
+    if (slot == TLB_PCID_SLOTS) {
+        slot = state->next_victim;
+        state->next_victim = (slot + 1) % TLB_PCID_SLOTS;
+        state->slots[slot].domain = domain;
+        state->slots[slot].gen = 0;
+    }
+    
+    uint64_t pcid = slot + 1;  // PCID 0 stays with untracked address spaces
+    if (state->slots[slot].gen == gen) {
+        continuum_counter_inc(COUNTER_TLB_PCID_HITS);
+        return base | pcid | CR3_NOFLUSH;
+    }
+    
+    state->slots[slot].gen = gen;
+    return base | pcid;
+}
+
+void flux_tlb_shootdown(memory_domain_t* domain, uint64_t addr, size_t size) {
+    if (!domain) {
+        flux_flush_tlb(addr, size);
+        return;
+    }
+    
+    uint64_t start = continuum_get_time();
+    uint32_t self = temporal_get_current_cpu();
+    
+    // CPUs not running the domain right now see the new generation when
+    // they switch back and flush then, so they need no IPI
+    __atomic_store_n(&domain->tlb_gen, tlb_next_gen(), __ATOMIC_SEQ_CST);
+    
+    if (__atomic_load_n(&g_tlb_cpu[self].active, __ATOMIC_SEQ_CST) == domain) {
+        flux_flush_tlb(addr, size);
+    }
+    
+    uint64_t targets[FLUX_CPU_MASK_WORDS];
+    uint32_t count = 0;
+    for (uint32_t w = 0; w < FLUX_CPU_MASK_WORDS; w++) {
+        targets[w] = 0;
+        uint64_t bits = __atomic_load_n(&domain->tlb_cpus[w], __ATOMIC_SEQ_CST);
+        while (bits) {
+            uint32_t cpu = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (cpu != self &&
+                __atomic_load_n(&g_tlb_cpu[cpu].active, __ATOMIC_SEQ_CST) == domain) {
+                targets[w] |= 1ULL << (cpu % 64);
+                count++;
             }
-            memset((void*)pdpt_page, 0, PAGE_SIZE);
-            pml4[pml4_idx] = pdpt_page | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
         }
-        uint64_t* pdpt = (uint64_t*)(pml4[pml4_idx] & ~0xFFF);
+    }
+    
+    if (count) {
+        // One request in flight at a time; interrupts stay enabled while
+        // waiting so a CPU spinning here can still answer someone else
+        spinlock_acquire(&g_tlb.lock);
         
-        // Get or create PD
-        if (!(pdpt[pdpt_idx] & PAGE_PRESENT)) {
-            uint64_t pd_page = phys_alloc_page();
-            if (!pd_page) {
-                spinlock_release(&domain->lock);
-                return NULL;
+        g_tlb.req_domain = domain;
+        g_tlb.req_addr = addr;
+        g_tlb.req_size = size;
+        __atomic_store_n(&g_tlb.pending, count, __ATOMIC_SEQ_CST);
+        
+        for (uint32_t w = 0; w < FLUX_CPU_MASK_WORDS; w++) {
+            uint64_t bits = targets[w];
+            while (bits) {
+                continuum_send_ipi(w * 64 + __builtin_ctzll(bits), FLUX_TLB_SHOOTDOWN_VECTOR);
+                bits &= bits - 1;
             }
-            memset((void*)pd_page, 0, PAGE_SIZE);
-            pdpt[pdpt_idx] = pd_page | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
         }
-        uint64_t* pd = (uint64_t*)(pdpt[pdpt_idx] & ~0xFFF);
+        while (__atomic_load_n(&g_tlb.pending, __ATOMIC_ACQUIRE) != 0) {
+            __asm__ __volatile__("pause");
+        }
         
-        // Use huge pages if aligned and requested
-        if ((flags & FLUX_MAP_HUGE) && 
-            (va & (HUGE_PAGE_SIZE - 1)) == 0 &&
-            (pa & (HUGE_PAGE_SIZE - 1)) == 0 &&
-            size - offset >= HUGE_PAGE_SIZE) {
-            
-            // Map 2MB huge page
-            uint64_t page_flags = PAGE_PRESENT | PAGE_HUGE;
-            if (flags & FLUX_MAP_WRITE) page_flags |= PAGE_WRITABLE;
-            if (flags & FLUX_MAP_USER) page_flags |= PAGE_USER;
-            if (!(flags & FLUX_MAP_EXEC)) page_flags |= PAGE_NX;
-            
-            pd[pd_idx] = pa | page_flags;
-            offset += HUGE_PAGE_SIZE - PAGE_SIZE;  // Skip ahead
+        spinlock_release(&g_tlb.lock);
+    }
+    
+    uint64_t cycles = continuum_get_time() - start;
+    continuum_counter_inc(COUNTER_TLB_SHOOTDOWNS);
+    continuum_counter_add(COUNTER_TLB_IPIS, count);
+    continuum_counter_add(COUNTER_TLB_SHOOTDOWN_CYCLES, cycles);
+    if (cycles > g_tlb.cycles_max) {
+        g_tlb.cycles_max = cycles;  // Racy maximum is fine for tuning
+    }
+}
+
+// FLUX_TLB_SHOOTDOWN_VECTOR handler, called from the vector's entry stub
+void flux_tlb_shootdown_ipi(void) {
+    uint32_t cpu = temporal_get_current_cpu();
+    
+    // A CPU that switched away meanwhile flushes on its way back instead
+    if (__atomic_load_n(&g_tlb_cpu[cpu].active, __ATOMIC_SEQ_CST) == g_tlb.req_domain) {
+        flux_flush_tlb(g_tlb.req_addr, g_tlb.req_size);
+    }
+    __atomic_fetch_sub(&g_tlb.pending, 1, __ATOMIC_RELEASE);
+    continuum_apic_eoi();
+}
+
+void flux_tlb_batch_init(flux_tlb_batch_t* batch, memory_domain_t* domain) {
+    batch->domain = domain;
+    batch->start = UINT64_MAX;
+    batch->end = 0;
+}
+
+void flux_tlb_batch_add(flux_tlb_batch_t* batch, uint64_t addr, size_t size) {
+    uint64_t start = addr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = addr + size;
+    if (start < batch->start) batch->start = start;
+    if (end > batch->end) batch->end = end;
+}
+
+void flux_tlb_batch_flush(flux_tlb_batch_t* batch) {
+    if (batch->end > batch->start) {
+        flux_tlb_shootdown(batch->domain, batch->start, batch->end - batch->start);
+    }
+    batch->start = UINT64_MAX;
+    batch->end = 0;
+}
+
+// =============================================================================
+// Memory Domain Management
+// =============================================================================
+
+static void compression_release_pte(uint64_t zpte);
+static void pt_release_tables(memory_domain_t* domain);
+
+memory_domain_t* flux_create_domain(quantum_id_t owner) {
+    spinlock_acquire(&g_memory_lock);
+    
+    // Find free domain slot
+    int domain_id = -1;
+    for (int i = 0; i < MAX_DOMAINS; i++) {
+        if (!g_domains[i]) {
+            domain_id = i;
+            break;
+        }
+    }
+    
+    if (domain_id == -1) {
+        spinlock_release(&g_memory_lock);
+        return NULL;
+    }
+    
+    memory_domain_t* domain = slab_cache_alloc(slab_cache_for(sizeof(memory_domain_t)));
+    if (!domain) {
+        spinlock_release(&g_memory_lock);
+        return NULL;
+    }
+    
+    domain->domain_id = domain_id;
+    domain->owner_qid = owner;
+    domain->page_table_base = phys_alloc_page();
+    domain->region_root = NULL;
+    domain->region_count = 0;
+    domain->total_size = 0;
+    domain->flags = 0;
+    domain->compact_cursor = 0;
+    domain->collapse_cursor = 0;
+    domain->tlb_gen = tlb_next_gen();
+    memset(domain->tlb_cpus, 0, sizeof(domain->tlb_cpus));
+    spinlock_init(&domain->lock);
+    
+    // Clear page table
+    memset((void*)domain->page_table_base, 0, PAGE_SIZE);
+    
+    g_domains[domain_id] = domain;
+    g_memory_state.domain_count++;
+    
+    spinlock_release(&g_memory_lock);
+    return domain;
+}
+
+void flux_destroy_domain(memory_domain_t* domain) {
+    if (!domain) {
+        return;
+    }
+    
+    spinlock_acquire(&g_memory_lock);
+    
+    // Free all regions, lowest first
+    memory_region_t* region;
+    while ((region = region_first_overlap(domain, 0, UINT64_MAX)) != NULL) {
+        if (region->flags & REGION_FLAG_ALLOCATED) {
+            // Free physical pages
+            for (size_t offset = 0; offset < region->size; offset += PAGE_SIZE) {
+                uint64_t vaddr = region->base_addr + offset;
+                uint64_t paddr = flux_translate_address(domain, vaddr);
+                if (paddr) {
+                    phys_free_page(paddr);
+                }
+            }
+        }
+        region_remove(domain, region);
+        region_destroy(region);
+    }
+    
+    // Free page table
+    if (domain->page_table_base) {
+        pt_release_tables(domain);
+        phys_free_page(domain->page_table_base);
+    }
+    
+    g_domains[domain->domain_id] = NULL;
+    g_memory_state.domain_count--;
+    
+    slab_cache_free(slab_cache_for(sizeof(memory_domain_t)), domain);
+    
+    spinlock_release(&g_memory_lock);
+}
+
+// =============================================================================
+// Virtual Memory Operations
+// =============================================================================
+
+void* flux_allocate(memory_domain_t* domain, size_t size, uint32_t flags) {
+    if (size == 0) {
+        return NULL;
+    }
+    
+    // Use kernel domain if not specified
+    if (!domain) {
+        domain = g_domains[0];  // Kernel domain
+    }
+    
+    // Use slab allocator for small sizes
+    if (!(flags & FLUX_ALLOC_LARGE) && size <= 65536) {
+        for (int i = 0; i < SLAB_SIZES_COUNT; i++) {
+            if (size <= g_slab_sizes[i]) {
+                void* obj = slab_cache_alloc(&g_slab_caches[i]);
+                if (obj && (flags & FLUX_ALLOC_ZERO)) {
+                    memset(obj, 0, g_slab_sizes[i]);
+                }
+                return obj;
+            }
+        }
+    }
+    
+    // Use buddy allocator for larger sizes
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);  // Round up to page
+    void* ptr = buddy_alloc(size);
+    
+    if (ptr && (flags & FLUX_ALLOC_ZERO)) {
+        memset(ptr, 0, size);
+    }
+    
+    // Update domain tracking
+    if (ptr && domain) {
+        spinlock_acquire(&domain->lock);
+        
+        uint32_t region_flags = REGION_FLAG_ALLOCATED;
+        if (flags & FLUX_ALLOC_EXEC) {
+            region_flags |= REGION_FLAG_EXECUTABLE;
+        }
+        if (!(flags & FLUX_ALLOC_WRITE)) {
+            region_flags |= REGION_FLAG_READONLY;
+        }
+        
+        // Blocks are not untracked on free, so drop any stale record of
+        // this range before adding the new one
+        memory_region_t* region = NULL;
+        if (region_clear_range(domain, (uint64_t)ptr, (uint64_t)ptr + size) == 0) {
+            region = region_create((uint64_t)ptr, size, region_flags, 0, (uint64_t)ptr);
+        }
+        if (region) {
+            region_insert(domain, region);
+        }
+        
+        spinlock_release(&domain->lock);
+    }
+    
+    return ptr;
+}
+
+void flux_free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    
+    // Check if it's a slab allocation
+    uint64_t addr = (uint64_t)ptr;
+    slab_t* slab = (slab_t*)(addr & ~(PAGE_SIZE - 1));
+    
+    // Simple check for slab magic (would be more robust in production)
+    if (slab->cache && slab->cache->object_size > 0) {
+        slab_cache_free(slab->cache, ptr);
+    } else {
+        // Assume buddy allocation
+        // Size would need to be tracked properly
+        buddy_free(ptr, PAGE_SIZE);  // Simplified
+    }
+}
+
+// =============================================================================
+// Page Table Walking
+// =============================================================================
+
+static inline bool zpte_is_compressed(uint64_t pte) {
+    return !(pte & PAGE_PRESENT) && (pte & PAGE_COMPRESSED);
+}
+
+// Return the entry slot for vaddr in the table level whose entries map
+// 1 << level_shift bytes (12 = PTE, 21 = PDE), optionally creating missing
+// tables. Returns NULL if a level is missing (and create is false) or a
+// huge mapping sits above that level. Caller holds domain->lock.
+static uint64_t* flux_walk_level(memory_domain_t* domain, uint64_t vaddr,
+                                 int level_shift, bool create) {
+    uint64_t* table = (uint64_t*)domain->page_table_base;
+    
+    for (int shift = 39; shift > level_shift; shift -= 9) {
+        uint64_t* entry = &table[(vaddr >> shift) & 0x1FF];
+        
+        if (!(*entry & PAGE_PRESENT)) {
+            if (!create) {
+                return NULL;
+            }
+            uint64_t page = phys_alloc_page();
+            if (!page) {
+                return NULL;
+            }
+            memset((void*)page, 0, PAGE_SIZE);
+            *entry = page | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+        } else if (*entry & PAGE_HUGE) {
+            return NULL;
+        }
+        table = (uint64_t*)(*entry & PTE_ADDR_MASK);
+    }
+    
+    return &table[(vaddr >> level_shift) & 0x1FF];
+}
+
+static uint64_t* flux_walk(memory_domain_t* domain, uint64_t vaddr, bool create) {
+    return flux_walk_level(domain, vaddr, 12, create);
+}
+
+// Find the first slot at level_shift at or above *vaddr in the user half,
+// skipping unpopulated tables and huge mappings above that level. Updates
+// *vaddr to the slot's address; returns NULL once the user half is
+// exhausted. Caller holds domain->lock.
+static uint64_t* pt_next_slot(memory_domain_t* domain, uint64_t* vaddr, int level_shift) {
+    uint64_t va = *vaddr;
+    
+    while (va < FLUX_USER_TOP) {
+        uint64_t* table = (uint64_t*)domain->page_table_base;
+        int shift;
+        for (shift = 39; shift > level_shift; shift -= 9) {
+            uint64_t entry = table[(va >> shift) & 0x1FF];
+            if (!(entry & PAGE_PRESENT) || (entry & PAGE_HUGE)) {
+                break;
+            }
+            table = (uint64_t*)(entry & PTE_ADDR_MASK);
+        }
+        
+        if (shift == level_shift) {
+            *vaddr = va;
+            return &table[(va >> shift) & 0x1FF];
+        }
+        va = (va | ((1ULL << shift) - 1)) + 1;
+    }
+    
+    *vaddr = va;
+    return NULL;
+}
+
+// Leaf entry (4K PTE or 2MB PDE) mapping vaddr, 0 if none
+static uint64_t pt_leaf_entry(memory_domain_t* domain, uint64_t vaddr) {
+    uint64_t* pde = flux_walk_level(domain, vaddr, 21, false);
+    if (!pde) {
+        return 0;
+    }
+    if (*pde & PAGE_HUGE) {
+        return *pde;
+    }
+    uint64_t* pte = flux_walk(domain, vaddr, false);
+    return pte ? *pte : 0;
+}
+
+// Replace a 2MB mapping with a page table of 512 equivalent 4K entries.
+// The stale 2MB TLB entry translates the same way until batch is flushed.
+static bool split_huge_pde(uint64_t* pde, uint64_t vaddr, flux_tlb_batch_t* batch) {
+    uint64_t pt_page = phys_alloc_page();
+    if (!pt_page) {
+        return false;
+    }
+    
+    uint64_t entry = *pde;
+    uint64_t base = entry & PTE_ADDR_MASK & ~(uint64_t)(HUGE_PAGE_SIZE - 1);
+    uint64_t flags = entry & ~PTE_ADDR_MASK & ~PAGE_HUGE;
+    uint64_t* pt = (uint64_t*)pt_page;
+    for (int i = 0; i < 512; i++) {
+        pt[i] = (base + (uint64_t)i * PAGE_SIZE) | flags;
+    }
+    
+    *pde = pt_page | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+    flux_tlb_batch_add(batch, vaddr, PAGE_SIZE);  // invlpg drops the whole 2MB entry
+    
+    continuum_counter_inc(COUNTER_HUGE_SPLITS);
+    return true;
+}
+
+// Drop whatever a leaf entry owns: pool objects behind compressed entries
+// and frames behind private mappings
+static void pt_release_entry(uint64_t entry, bool huge) {
+    if (!huge && zpte_is_compressed(entry)) {
+        compression_release_pte(entry);
+    } else if ((entry & PAGE_PRESENT) && (entry & PAGE_PRIVATE)) {
+        if (huge) {
+            phys_free_pages(entry & PTE_ADDR_MASK & ~(uint64_t)(HUGE_PAGE_SIZE - 1),
+                            HUGE_PAGE_SIZE / PAGE_SIZE);
+        } else {
+            flux_unref_page(entry & PTE_ADDR_MASK);
+        }
+    }
+}
+
+// Entries whose frames and pool objects may only be freed once no TLB
+// still points at them
+typedef struct {
+    flux_tlb_batch_t tlb;
+    uint64_t entries[PT_RELEASE_BATCH];
+    bool huge[PT_RELEASE_BATCH];
+    uint32_t count;
+} pt_release_batch_t;
+
+static void pt_release_flush(pt_release_batch_t* batch) {
+    flux_tlb_batch_flush(&batch->tlb);
+    for (uint32_t i = 0; i < batch->count; i++) {
+        pt_release_entry(batch->entries[i], batch->huge[i]);
+    }
+    batch->count = 0;
+}
+
+static void pt_release_defer(pt_release_batch_t* batch, uint64_t entry, bool huge) {
+    bool owned = (!huge && zpte_is_compressed(entry)) ||
+                 ((entry & PAGE_PRESENT) && (entry & PAGE_PRIVATE));
+    if (!owned) {
+        return;
+    }
+    if (batch->count == PT_RELEASE_BATCH) {
+        pt_release_flush(batch);
+    }
+    batch->entries[batch->count] = entry;
+    batch->huge[batch->count] = huge;
+    batch->count++;
+}
+
+// A page table frame can be walked through the paging-structure caches
+// until the flush, so it is released like a private 4K page
+static void pt_release_table(pt_release_batch_t* batch, uint64_t* pt) {
+    pt_release_defer(batch, (uint64_t)pt | PAGE_PRESENT | PAGE_PRIVATE, false);
+}
+
+// Whether a present leaf entry points into [pa, pa + size)
+static inline bool pt_maps_range(uint64_t entry, uint64_t pa, uint64_t size) {
+    uint64_t frame = entry & PTE_ADDR_MASK;
+    return (entry & PAGE_PRESENT) && frame >= pa && frame < pa + size;
+}
+
+// Free every user-half mapping and table of a domain, leaving the PML4
+static void pt_release_tables(memory_domain_t* domain) {
+    uint64_t* pml4 = (uint64_t*)domain->page_table_base;
+    
+    for (int i = 0; i < 256; i++) {
+        if (!(pml4[i] & PAGE_PRESENT)) {
+            continue;
+        }
+        uint64_t* pdpt = (uint64_t*)(pml4[i] & PTE_ADDR_MASK);
+        
+        for (int j = 0; j < 512; j++) {
+            if (!(pdpt[j] & PAGE_PRESENT) || (pdpt[j] & PAGE_HUGE)) {
+                continue;
+            }
+            uint64_t* pd = (uint64_t*)(pdpt[j] & PTE_ADDR_MASK);
+            
+            for (int k = 0; k < 512; k++) {
+                if (!(pd[k] & PAGE_PRESENT)) {
+                    continue;
+                }
+                if (pd[k] & PAGE_HUGE) {
+                    pt_release_entry(pd[k], true);
+                    continue;
+                }
+                uint64_t* pt = (uint64_t*)(pd[k] & PTE_ADDR_MASK);
+                for (int l = 0; l < 512; l++) {
+                    pt_release_entry(pt[l], false);
+                }
+                phys_free_page((uint64_t)pt);
+            }
+            phys_free_page((uint64_t)pd);
+        }
+        phys_free_page((uint64_t)pdpt);
+        pml4[i] = 0;
+    }
+}
+
+// =============================================================================
+// Memory Mapping
+// =============================================================================
+
+static uint64_t flux_map_flags_to_pte(uint32_t flags) {
+    uint64_t page_flags = PAGE_PRESENT;
+    if (flags & FLUX_MAP_WRITE) page_flags |= PAGE_WRITABLE;
+    if (flags & FLUX_MAP_USER) page_flags |= PAGE_USER;
+    if (!(flags & FLUX_MAP_EXEC)) page_flags |= PAGE_NX;
+    if (flags & FLUX_MAP_COW) page_flags |= PAGE_COW;
+    if (flags & FLUX_MAP_PRIVATE) page_flags |= PAGE_PRIVATE;
+    if (flags & FLUX_MAP_NOCACHE) page_flags |= PAGE_CACHE_DISABLE;
+    return page_flags;
+}
+
+void* flux_map_region(memory_domain_t* domain, uint64_t vaddr, 
+                     uint64_t paddr, size_t size, uint32_t flags) {
+    if (!domain || !size) {
+        return NULL;
+    }
+    
+    spinlock_acquire(&domain->lock);
+    
+    uint64_t page_flags = flux_map_flags_to_pte(flags);
+    pt_release_batch_t release;
+    flux_tlb_batch_init(&release.tlb, domain);
+    release.count = 0;
+    
+    for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
+        uint64_t va = vaddr + offset;
+        uint64_t pa = paddr + offset;
+        
+        // Use a 2MB page wherever both addresses are aligned and the rest
+        // of the range covers it
+        if (!(flags & FLUX_MAP_NOHUGE) &&
+            (va & (HUGE_PAGE_SIZE - 1)) == 0 &&
+            (pa & (HUGE_PAGE_SIZE - 1)) == 0 &&
+            size - offset >= HUGE_PAGE_SIZE) {
+            
+            uint64_t* pde = flux_walk_level(domain, va, 21, true);
+            if (!pde) {
+                pt_release_flush(&release);
+                spinlock_release(&domain->lock);
+                return NULL;
+            }
+            
+            // Replace whatever was mapped here before, keeping frames the
+            // new mapping covers
+            if ((*pde & PAGE_PRESENT) && !(*pde & PAGE_HUGE)) {
+                uint64_t* pt = (uint64_t*)(*pde & PTE_ADDR_MASK);
+                for (int i = 0; i < 512; i++) {
+                    if (!pt_maps_range(pt[i], pa, HUGE_PAGE_SIZE)) {
+                        pt_release_defer(&release, pt[i], false);
+                    }
+                }
+                pt_release_table(&release, pt);
+            } else if ((*pde & PAGE_PRESENT) && !pt_maps_range(*pde, pa, HUGE_PAGE_SIZE)) {
+                pt_release_defer(&release, *pde, true);
+            }
+            
+            *pde = pa | page_flags | PAGE_HUGE;
+            flux_tlb_batch_add(&release.tlb, va, HUGE_PAGE_SIZE);
+            continuum_counter_inc(COUNTER_HUGE_MAPPINGS);
+            offset += HUGE_PAGE_SIZE - PAGE_SIZE;  // Skip ahead
+            continue;
+        }
+        
+        // A 4K mapping inside an existing 2MB one splits it first
+        uint64_t* pde = flux_walk_level(domain, va, 21, true);
+        if (!pde || ((*pde & PAGE_HUGE) && !split_huge_pde(pde, va, &release.tlb))) {
+            pt_release_flush(&release);
+            spinlock_release(&domain->lock);
+            return NULL;
+        }
+        
+        uint64_t* pte = flux_walk(domain, va, true);
+        if (!pte) {
+            pt_release_flush(&release);
+            spinlock_release(&domain->lock);
+            return NULL;
+        }
+        if (!pt_maps_range(*pte, pa, PAGE_SIZE)) {
+            pt_release_defer(&release, *pte, false);
+        }
+        if (*pte & PAGE_PRESENT) {
+            flux_tlb_batch_add(&release.tlb, va, PAGE_SIZE);
+        }
+        *pte = pa | page_flags;
+    }
+    
+    pt_release_flush(&release);
+    
+    // Record the mapping, replacing whatever regions it overlays
+    uint64_t end = vaddr + ((size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1));
+    memory_region_t* region = NULL;
+    if (region_clear_range(domain, vaddr, end) == 0) {
+        region = region_create(vaddr, end - vaddr, region_flags_for_map(flags),
+                               flags, paddr);
+    }
+    if (region) {
+        region_insert(domain, region);
+    }
+    
+    spinlock_release(&domain->lock);
+    return (void*)vaddr;
+}
+
+// Reserve a range that flux_region_ops_t fills page by page as it's
+// touched. The range must not overlap anything already mapped.
+void* flux_map_lazy(memory_domain_t* domain, uint64_t vaddr, size_t size, uint32_t flags,
+                    const flux_region_ops_t* ops, void* private_data) {
+    if (!domain || !size || !ops || !ops->fault || (vaddr & (PAGE_SIZE - 1))) {
+        return NULL;
+    }
+    
+    uint64_t end = vaddr + ((size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1));
+    
+    spinlock_acquire(&domain->lock);
+    if (region_first_overlap(domain, vaddr, end)) {
+        spinlock_release(&domain->lock);
+        return NULL;
+    }
+    
+    memory_region_t* region = region_create(vaddr, end - vaddr, region_flags_for_map(flags),
+                                            flags, 0);
+    if (!region) {
+        spinlock_release(&domain->lock);
+        return NULL;
+    }
+    region->ops = ops;
+    region->private_data = private_data;
+    region_insert(domain, region);
+    
+    spinlock_release(&domain->lock);
+    return (void*)vaddr;
+}
+
+void flux_unmap_region(memory_domain_t* domain, uint64_t vaddr, size_t size) {
+    if (!domain || !size) {
+        return;
+    }
+    
+    uint64_t start = vaddr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = (vaddr + size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    
+    spinlock_acquire(&domain->lock);
+    
+    pt_release_batch_t release;
+    flux_tlb_batch_init(&release.tlb, domain);
+    release.count = 0;
+    
+    uint64_t va = start;
+    while (va < end) {
+        uint64_t* pde = flux_walk_level(domain, va, 21, false);
+        if (!pde || !(*pde & PAGE_PRESENT)) {
+            va = (va | (HUGE_PAGE_SIZE - 1)) + 1;
+            continue;
+        }
+        
+        if (*pde & PAGE_HUGE) {
+            if ((va & (HUGE_PAGE_SIZE - 1)) == 0 && end - va >= HUGE_PAGE_SIZE) {
+                pt_release_defer(&release, *pde, true);
+                *pde = 0;
+                flux_tlb_batch_add(&release.tlb, va, HUGE_PAGE_SIZE);
+                va += HUGE_PAGE_SIZE;
+                continue;
+            }
+            // Partial unmap of a 2MB page
+            if (!split_huge_pde(pde, va, &release.tlb)) {
+                break;
+            }
+        }
+        
+        uint64_t* pt = (uint64_t*)(*pde & PTE_ADDR_MASK);
+        uint64_t* pte = &pt[(va >> 12) & 0x1FF];
+        if (*pte & PAGE_PRESENT) {
+            flux_tlb_batch_add(&release.tlb, va, PAGE_SIZE);
+        }
+        pt_release_defer(&release, *pte, false);
+        *pte = 0;
+        va += PAGE_SIZE;
+    }
+    
+    pt_release_flush(&release);
+    region_clear_range(domain, start, end);
+    
+    spinlock_release(&domain->lock);
+    
+    // A region fault already past its lookup may still be using the ops'
+    // state; once it's done it finds the region gone and maps nothing
+    while (__atomic_load_n(&domain->region_faults, __ATOMIC_ACQUIRE) != 0) {
+        quantum_context_t* current = temporal_get_current();
+        if (current) {
+            temporal_yield(current);
+        } else {
+            __asm__ __volatile__("pause");
+        }
+    }
+}
+
+void flux_protect_region(memory_domain_t* domain, uint64_t vaddr, 
+                        size_t size, uint32_t protection) {
+    if (!domain || !size) {
+        return;
+    }
+    
+    uint64_t start = vaddr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = (vaddr + size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t prot = flux_map_flags_to_pte(protection) & PTE_PROT_FLAGS;
+    
+    spinlock_acquire(&domain->lock);
+    
+    flux_tlb_batch_t batch;
+    flux_tlb_batch_init(&batch, domain);
+    
+    uint64_t va = start;
+    while (va < end) {
+        uint64_t* pde = flux_walk_level(domain, va, 21, false);
+        if (!pde || !(*pde & PAGE_PRESENT)) {
+            va = (va | (HUGE_PAGE_SIZE - 1)) + 1;
+            continue;
+        }
+        
+        uint64_t* entry;
+        uint64_t step;
+        if ((*pde & PAGE_HUGE) &&
+            (va & (HUGE_PAGE_SIZE - 1)) == 0 && end - va >= HUGE_PAGE_SIZE) {
+            entry = pde;
+            step = HUGE_PAGE_SIZE;
+        } else {
+            // Partial protect of a 2MB page
+            if ((*pde & PAGE_HUGE) && !split_huge_pde(pde, va, &batch)) {
+                break;
+            }
+            entry = &((uint64_t*)(*pde & PTE_ADDR_MASK))[(va >> 12) & 0x1FF];
+            step = PAGE_SIZE;
+        }
+        
+        // Compressed entries keep the same protection bits, so update them too
+        if ((*entry & PAGE_PRESENT) || zpte_is_compressed(*entry)) {
+            uint64_t updated = (*entry & ~PTE_PROT_FLAGS) | prot;
+            if (updated & PAGE_COW) {
+                updated &= ~PAGE_WRITABLE;  // Writes still have to fault and copy
+            }
+            if ((*entry & PAGE_PRESENT) && updated != *entry) {
+                flux_tlb_batch_add(&batch, va, step);
+            }
+            *entry = updated;
+        }
+        va += step;
+    }
+    
+    flux_tlb_batch_flush(&batch);
+    
+    // Regions inside the range take the new protection; ones straddling
+    // an edge are split first
+    if (region_split_at(domain, start) == 0 && region_split_at(domain, end) == 0) {
+        for (memory_region_t* region = region_first_overlap(domain, start, end);
+             region != NULL;
+             region = region_first_overlap(domain, region->base_addr + region->size, end)) {
+            uint32_t keep = region->protection & ~(FLUX_MAP_WRITE | FLUX_MAP_EXEC | FLUX_MAP_USER);
+            region->protection = keep | protection;
+            region->flags &= ~(REGION_FLAG_READONLY | REGION_FLAG_EXECUTABLE);
+            if (!(protection & FLUX_MAP_WRITE)) region->flags |= REGION_FLAG_READONLY;
+            if (protection & FLUX_MAP_EXEC) region->flags |= REGION_FLAG_EXECUTABLE;
+        }
+    }
+    
+    spinlock_release(&domain->lock);
+}
+
+// Make present pages read-only without changing the regions' protection,
+// so the next store to each faults again (lazily filled regions use this
+// to notice writes after a writeback)
+void flux_write_protect(memory_domain_t* domain, uint64_t vaddr, size_t size) {
+    if (!domain || !size) {
+        return;
+    }
+    
+    uint64_t start = vaddr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = (vaddr + size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    
+    spinlock_acquire(&domain->lock);
+    
+    flux_tlb_batch_t batch;
+    flux_tlb_batch_init(&batch, domain);
+    
+    uint64_t va = start;
+    while (va < end) {
+        uint64_t* pde = flux_walk_level(domain, va, 21, false);
+        if (!pde || !(*pde & PAGE_PRESENT)) {
+            va = (va | (HUGE_PAGE_SIZE - 1)) + 1;
+            continue;
+        }
+        if ((*pde & PAGE_HUGE) && !split_huge_pde(pde, va, &batch)) {
+            break;
+        }
+        
+        uint64_t* pte = &((uint64_t*)(*pde & PTE_ADDR_MASK))[(va >> 12) & 0x1FF];
+        if ((*pte & PAGE_PRESENT) && (*pte & PAGE_WRITABLE)) {
+            *pte &= ~PAGE_WRITABLE;
+            flux_tlb_batch_add(&batch, va, PAGE_SIZE);
+        }
+        va += PAGE_SIZE;
+    }
+    
+    flux_tlb_batch_flush(&batch);
+    spinlock_release(&domain->lock);
+}
+
+// =============================================================================
+// Huge Page Collapse
+// =============================================================================
+
+// Promote a page table whose 512 entries agree on flags to one 2MB
+// mapping. Physically contiguous, aligned runs are collapsed in place;
+// private pages are copied into a fresh 2MB frame. Caller holds
+// domain->lock.
+static bool collapse_pde_locked(memory_domain_t* domain, uint64_t vaddr, uint64_t* pde) {
+    uint64_t entry = *pde;
+    if (!(entry & PAGE_PRESENT) || (entry & PAGE_HUGE)) {
+        return false;
+    }
+    
+    uint64_t* pt = (uint64_t*)(entry & PTE_ADDR_MASK);
+    uint64_t first = pt[0] & PTE_ADDR_MASK;
+    uint64_t flags = pt[0] & ~PTE_ADDR_MASK & ~(PAGE_ACCESSED | PAGE_DIRTY);
+    if (!(flags & PAGE_PRESENT) || (flags & (PAGE_COW | PAGE_HUGE))) {
+        return false;
+    }
+    
+    bool contiguous = (first & (HUGE_PAGE_SIZE - 1)) == 0;
+    uint64_t usage = 0;
+    for (int i = 0; i < 512; i++) {
+        if ((pt[i] & ~PTE_ADDR_MASK & ~(PAGE_ACCESSED | PAGE_DIRTY)) != flags) {
+            return false;
+        }
+        if ((pt[i] & PTE_ADDR_MASK) != first + (uint64_t)i * PAGE_SIZE) {
+            contiguous = false;
+        }
+        if ((flags & PAGE_PRIVATE) && frame_is_shared(pt[i] & PTE_ADDR_MASK)) {
+            return false;  // A 2MB release would free frames others still map
+        }
+        usage |= pt[i] & (PAGE_ACCESSED | PAGE_DIRTY);
+    }
+    
+    uint64_t base = first;
+    uint64_t huge_base = vaddr & ~(uint64_t)(HUGE_PAGE_SIZE - 1);
+    if (!contiguous) {
+        if (!(flags & PAGE_PRIVATE)) {
+            return false;
+        }
+        base = phys_alloc_huge();
+        if (!base) {
+            return false;
+        }
+        
+        // Unmap first so writers fault and wait on the domain lock
+        // instead of writing to the old frames mid-copy
+        *pde = 0;
+        flux_tlb_shootdown(domain, huge_base, HUGE_PAGE_SIZE);
+        for (int i = 0; i < 512; i++) {
+            memcpy((void*)(base + (uint64_t)i * PAGE_SIZE),
+                   (void*)(pt[i] & PTE_ADDR_MASK), PAGE_SIZE);
+            phys_free_page(pt[i] & PTE_ADDR_MASK);
+        }
+    }
+    
+    // The old page table must be out of every paging-structure cache
+    // before its frame is reused
+    *pde = base | flags | usage | PAGE_HUGE;
+    flux_tlb_shootdown(domain, huge_base, HUGE_PAGE_SIZE);
+    phys_free_page((uint64_t)pt);
+    
+    continuum_counter_inc(COUNTER_HUGE_COLLAPSES);
+    return true;
+}
+
+// Scan up to budget page tables of a domain for collapse candidates,
+// resuming where the previous scan stopped. Returns the number collapsed.
+size_t flux_collapse_scan(memory_domain_t* domain, size_t budget) {
+    if (!domain) {
+        return 0;
+    }
+    
+    size_t collapsed = 0;
+    
+    spinlock_acquire(&domain->lock);
+    
+    uint64_t start = domain->collapse_cursor;
+    uint64_t va = start;
+    bool wrapped = false;
+    
+    while (budget > 0) {
+        uint64_t* pde = pt_next_slot(domain, &va, 21);
+        if (!pde) {
+            if (wrapped) {
+                break;
+            }
+            wrapped = true;
+            va = 0;
+            continue;
+        }
+        if (wrapped && va >= start) {
+            break;
+        }
+        
+        if ((*pde & PAGE_PRESENT) && !(*pde & PAGE_HUGE)) {
+            budget--;
+            if (collapse_pde_locked(domain, va, pde)) {
+                collapsed++;
+            }
+        }
+        va += HUGE_PAGE_SIZE;
+    }
+    
+    domain->collapse_cursor = va;
+    
+    spinlock_release(&domain->lock);
+    return collapsed;
+}
+
+// =============================================================================
+// Copy-on-Write Support
+// =============================================================================
+
+// Make every writable page in the range copy-on-write. Pages stay mapped
+// read-only; the first write copies unless no one else shares the frame.
+void flux_mark_cow(memory_domain_t* domain, uint64_t vaddr, size_t size) {
+    if (!domain || !size) {
+        return;
+    }
+    
+    uint64_t start = vaddr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = (vaddr + size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    
+    spinlock_acquire(&domain->lock);
+    
+    flux_tlb_batch_t batch;
+    flux_tlb_batch_init(&batch, domain);
+    
+    uint64_t va = start;
+    while (va < end) {
+        uint64_t* pde = flux_walk_level(domain, va, 21, false);
+        if (!pde || !(*pde & PAGE_PRESENT)) {
+            va = (va | (HUGE_PAGE_SIZE - 1)) + 1;
+            continue;
+        }
+        
+        // CoW works per 4K page, so huge mappings are split first
+        if ((*pde & PAGE_HUGE) && !split_huge_pde(pde, va, &batch)) {
+            break;
+        }
+        
+        uint64_t* pte = &((uint64_t*)(*pde & PTE_ADDR_MASK))[(va >> 12) & 0x1FF];
+        if ((*pte & PAGE_PRESENT) && (*pte & PAGE_WRITABLE)) {
+            *pte = (*pte & ~PAGE_WRITABLE) | PAGE_COW;
+            flux_tlb_batch_add(&batch, va, PAGE_SIZE);
+        }
+        va += PAGE_SIZE;
+    }
+    
+    flux_tlb_batch_flush(&batch);
+    
+    if (region_split_at(domain, start) == 0 && region_split_at(domain, end) == 0) {
+        for (memory_region_t* region = region_first_overlap(domain, start, end);
+             region != NULL;
+             region = region_first_overlap(domain, region->base_addr + region->size, end)) {
+            region->flags |= REGION_FLAG_COW;
+        }
+    }
+    
+    spinlock_release(&domain->lock);
+}
+
+void flux_handle_cow_fault(memory_domain_t* domain, uint64_t fault_addr) {
+    uint64_t start = trace_begin(TRACE_FLUX_COW_FAULT);
+    spinlock_acquire(&domain->lock);
+    
+    // Only the faulting 4K page of a huge CoW mapping gets copied
+    uint64_t* pde = flux_walk_level(domain, fault_addr, 21, false);
+    flux_tlb_batch_t batch;
+    flux_tlb_batch_init(&batch, domain);
+    if (pde && (*pde & PAGE_HUGE) && (*pde & PAGE_COW)) {
+        split_huge_pde(pde, fault_addr, &batch);
+    }
+    
+    // Get page table entry
+    uint64_t pte = flux_get_pte(domain, fault_addr);
+    
+    uint64_t old_page = pte & PTE_ADDR_MASK;
+    if ((pte & PAGE_COW) && (pte & PAGE_PRIVATE) && !frame_is_shared(old_page)) {
+        // Last mapping of the frame: take it over instead of copying
+        flux_set_pte(domain, fault_addr, (pte & ~PAGE_COW) | PAGE_WRITABLE);
+        flux_tlb_batch_add(&batch, fault_addr, PAGE_SIZE);
+    } else if (pte & PAGE_COW) {
+        // Allocate new page
+        uint64_t new_page = phys_alloc_page();
+        if (new_page) {
+            // Copy contents
+            memcpy((void*)new_page, (void*)old_page, PAGE_SIZE);
+            
+            // Update PTE
+            uint64_t new_pte = new_page | (pte & ~PTE_ADDR_MASK);
+            new_pte &= ~PAGE_COW;
+            new_pte |= PAGE_WRITABLE | PAGE_PRIVATE;  // The copy is ours
+            flux_set_pte(domain, fault_addr, new_pte);
+            
+            // Decrease reference count on old page
+            if (pte & PAGE_PRIVATE) {
+                flux_unref_page(old_page);
+            }
+            
+            flux_tlb_batch_add(&batch, fault_addr, PAGE_SIZE);
+        }
+    }
+    
+    // Other CPUs may still cache the read-only translation
+    flux_tlb_batch_flush(&batch);
+    
+    spinlock_release(&domain->lock);
+    TRACE(TRACE_FLUX_COW_FAULT, domain->owner_qid, fault_addr, trace_elapsed(start));
+}
+
+// =============================================================================
+// Page Compression
+// =============================================================================
+
+static inline uint32_t lz4_read32(const uint8_t* p) {
+    return *(const unaligned_u32_t*)p;
+}
+
+static inline uint32_t lz4_hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+// Emit the 255-continued tail of a literal or match length
+static uint8_t* lz4_put_length(uint8_t* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// Compress len bytes (at most 64KB) into LZ4 block format. Returns the
+// compressed size, or 0 if it would not fit in capacity.
+static size_t lz4_compress(const uint8_t* src, size_t len, uint8_t* dst,
+                           size_t capacity, uint16_t* table) {
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* const end = src + len;
+    const uint8_t* const match_limit = end - LZ4_LAST_LITERALS;
+    const uint8_t* const mflimit = end - LZ4_MFLIMIT;
+    uint8_t* op = dst;
+    uint8_t* const op_end = dst + capacity;
+    
+    memset(table, 0, (1 << LZ4_HASH_BITS) * sizeof(uint16_t));
+    
+    while (len > LZ4_MFLIMIT && ip <= mflimit) {
+        uint32_t sequence = lz4_read32(ip);
+        uint32_t h = lz4_hash(sequence);
+        const uint8_t* ref = src + table[h];
+        table[h] = (uint16_t)(ip - src);
+        
+        if (ref >= ip || lz4_read32(ref) != sequence) {
+            // Step faster through data that isn't matching
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+        
+        // Extend the match backwards into pending literals, then forwards
+        while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+        const uint8_t* mp = ip + LZ4_MIN_MATCH;
+        const uint8_t* rp = ref + LZ4_MIN_MATCH;
+        while (mp < match_limit && *mp == *rp) {
+            mp++;
+            rp++;
+        }
+        
+        size_t literals = ip - anchor;
+        size_t match_len = mp - ip - LZ4_MIN_MATCH;
+        size_t offset = ip - ref;
+        
+        // Token, literal length, literals, offset, match length
+        if (op + 1 + literals / 255 + 1 + literals + 2 + match_len / 255 + 1 > op_end) {
+            return 0;
+        }
+        
+        uint8_t* token = op++;
+        if (literals >= 15) {
+            *token = 15 << 4;
+            op = lz4_put_length(op, literals - 15);
+        } else {
+            *token = (uint8_t)(literals << 4);
+        }
+        memcpy(op, anchor, literals);
+        op += literals;
+        
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        
+        if (match_len >= 15) {
+            *token |= 15;
+            op = lz4_put_length(op, match_len - 15);
+        } else {
+            *token |= (uint8_t)match_len;
+        }
+        
+        ip = mp;
+        anchor = ip;
+        
+        // Seed the table with a position inside the match just emitted
+        if (ip <= mflimit) {
+            table[lz4_hash(lz4_read32(ip - 2))] = (uint16_t)(ip - 2 - src);
+        }
+    }
+    
+    // Trailing literals
+    size_t literals = end - anchor;
+    if (op + 1 + literals / 255 + 1 + literals > op_end) {
+        return 0;
+    }
+    
+    uint8_t* token = op++;
+    if (literals >= 15) {
+        *token = 15 << 4;
+        op = lz4_put_length(op, literals - 15);
+    } else {
+        *token = (uint8_t)(literals << 4);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+    
+    return op - dst;
+}
+
+// Decompress an LZ4 block. Returns the decompressed size, or -1 if the
+// input is malformed or would overrun capacity.
+static int64_t lz4_decompress(const uint8_t* src, size_t len, uint8_t* dst,
+                              size_t capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* const ip_end = src + len;
+    uint8_t* op = dst;
+    uint8_t* const op_end = dst + capacity;
+    
+    while (ip < ip_end) {
+        uint8_t token = *ip++;
+        
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip >= ip_end) {
+                    return -1;
+                }
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if ((size_t)(ip_end - ip) < literals || (size_t)(op_end - op) < literals) {
+            return -1;
+        }
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        
+        // The last sequence carries literals only
+        if (ip == ip_end) {
+            break;
+        }
+        
+        if (ip_end - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+        
+        size_t match_len = token & 15;
+        if (match_len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= ip_end) {
+                    return -1;
+                }
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += LZ4_MIN_MATCH;
+        if ((size_t)(op_end - op) < match_len) {
+            return -1;
+        }
+        
+        const uint8_t* ref = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, ref, match_len);
+            op += match_len;
+        } else {
+            // Overlapping match repeats the last offset bytes
+            for (size_t i = 0; i < match_len; i++) {
+                *op++ = *ref++;
+            }
+        }
+    }
+    
+    return op - dst;
+}
+
+static void zpool_init(void) {
+    for (uint32_t i = 0; i < ZPOOL_CLASS_COUNT; i++) {
+        zpool_class_t* cls = &g_compression.classes[i];
+        cls->size = (i + 1) * ZPOOL_CLASS_STEP;
+        cls->partial = NULL;
+        cls->full = NULL;
+        
+        // Pick the zspage length that wastes the smallest share of its frames
+        uint32_t best_used = 0;
+        for (uint32_t pages = 1; pages <= ZPOOL_MAX_PAGES; pages++) {
+            uint32_t objects = (pages * PAGE_SIZE - ZSPAGE_HEADER) / cls->size;
+            uint32_t used = objects * cls->size * 100 / (pages * PAGE_SIZE);
+            if (used > best_used) {
+                best_used = used;
+                cls->pages = pages;
+                cls->objects = objects;
+            }
+        }
+    }
+}
+
+static void zspage_link(zspage_t** head, zspage_t* zs) {
+    zs->prev = NULL;
+    zs->next = *head;
+    if (*head) {
+        (*head)->prev = zs;
+    }
+    *head = zs;
+}
+
+static void zspage_unlink(zspage_t** head, zspage_t* zs) {
+    if (zs->prev) {
+        zs->prev->next = zs->next;
+    } else {
+        *head = zs->next;
+    }
+    if (zs->next) {
+        zs->next->prev = zs->prev;
+    }
+}
+
+// Allocate a pool object of size bytes. Returns the object and stores its
+// handle (zspage address | slot index). Caller holds g_compression.lock.
+static uint8_t* zpool_alloc(size_t size, uint64_t* handle) {
+    uint32_t class_idx = (size - 1) / ZPOOL_CLASS_STEP;
+    zpool_class_t* cls = &g_compression.classes[class_idx];
+    
+    zspage_t* zs = cls->partial;
+    if (!zs) {
+        zs = (zspage_t*)phys_alloc_pages(cls->pages);
+        if (!zs) {
+            return NULL;
+        }
+        memset(zs, 0, sizeof(zspage_t));
+        zs->magic = ZPOOL_MAGIC;
+        zs->class_idx = class_idx;
+        zspage_link(&cls->partial, zs);
+        g_compression.pool_pages += cls->pages;
+    }
+    
+    uint32_t slot = 0;
+    for (uint32_t w = 0; w < ZPOOL_MAP_WORDS; w++) {
+        if (~zs->used_map[w]) {
+            slot = w * 64 + __builtin_ctzll(~zs->used_map[w]);
+            break;
+        }
+    }
+    zs->used_map[slot / 64] |= 1ULL << (slot % 64);
+    
+    if (++zs->used == cls->objects) {
+        zspage_unlink(&cls->partial, zs);
+        zspage_link(&cls->full, zs);
+    }
+    
+    *handle = (uint64_t)zs | slot;
+    return (uint8_t*)zs + ZSPAGE_HEADER + slot * cls->size;
+}
+
+static uint8_t* zpool_object(uint64_t handle) {
+    zspage_t* zs = (zspage_t*)(handle & ~(uint64_t)(PAGE_SIZE - 1));
+    uint32_t slot = handle & (PAGE_SIZE - 1);
+    return (uint8_t*)zs + ZSPAGE_HEADER + slot * g_compression.classes[zs->class_idx].size;
+}
+
+// Caller holds g_compression.lock
+static void zpool_free(uint64_t handle) {
+    zspage_t* zs = (zspage_t*)(handle & ~(uint64_t)(PAGE_SIZE - 1));
+    uint32_t slot = handle & (PAGE_SIZE - 1);
+    zpool_class_t* cls = &g_compression.classes[zs->class_idx];
+    
+    if (zs->used == cls->objects) {
+        zspage_unlink(&cls->full, zs);
+        zspage_link(&cls->partial, zs);
+    }
+    zs->used_map[slot / 64] &= ~(1ULL << (slot % 64));
+    
+    if (--zs->used == 0) {
+        zspage_unlink(&cls->partial, zs);
+        zs->magic = 0;
+        for (uint32_t i = 0; i < cls->pages; i++) {
+            phys_free_page((uint64_t)zs + i * PAGE_SIZE);
+        }
+        g_compression.pool_pages -= cls->pages;
+    }
+}
+
+static inline uint64_t zpte_encode(uint64_t handle, uint64_t pte) {
+    uint64_t zspage = handle & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t slot = handle & (PAGE_SIZE - 1);
+    return zspage | (slot << ZPTE_INDEX_SHIFT) | PAGE_COMPRESSED |
+           (pte & ZPTE_KEEP_FLAGS);
+}
+
+static inline uint64_t zpte_handle(uint64_t zpte) {
+    return (zpte & PTE_ADDR_MASK) | ((zpte >> ZPTE_INDEX_SHIFT) & ZPTE_INDEX_MASK);
+}
+
+// Caller holds g_compression.lock
+static void compression_update_ratio(void) {
+    g_compression.compression_ratio = g_compression.stored_bytes ?
+        g_compression.compressed_pages * PAGE_SIZE * 100 / g_compression.stored_bytes : 100;
+}
+
+// Compress the page behind slot into the pool and leave a compressed PTE.
+// Caller holds domain->lock.
+static bool compress_pte_eligible(uint64_t pte) {
+    return (pte & (PAGE_PRESENT | PAGE_PRIVATE)) == (PAGE_PRESENT | PAGE_PRIVATE) &&
+           !(pte & PAGE_COW) && !frame_is_shared(pte & PTE_ADDR_MASK);
+}
+
+// Compress the frame behind pte, already unmapped from slot and shot down,
+// into the pool and leave a compressed entry in slot. On failure pte goes
+// back. Caller holds domain->lock.
+static int compress_pte_store(uint64_t* slot, uint64_t pte) {
+    uint64_t frame = pte & PTE_ADDR_MASK;
+    
+    spinlock_acquire(&g_compression.lock);
+    
+    uint16_t* table = (uint16_t*)g_compression.workspace;
+    uint8_t* out = (uint8_t*)g_compression.workspace +
+                   (1 << LZ4_HASH_BITS) * sizeof(uint16_t);
+    size_t len = lz4_compress((const uint8_t*)frame, PAGE_SIZE, out,
+                              ZPOOL_MAX_PAYLOAD, table);
+    
+    uint64_t handle = 0;
+    uint8_t* obj = len ? zpool_alloc(len + sizeof(uint16_t), &handle) : NULL;
+    if (!obj) {
+        g_compression.rejects++;
+        spinlock_release(&g_compression.lock);
+        *slot = pte | PAGE_ACCESSED;  // Put it back; retry after another aging round
+        return len ? -ENOMEM : -ENOSPC;
+    }
+    
+    *(uint16_t*)obj = (uint16_t)len;
+    memcpy(obj + sizeof(uint16_t), out, len);
+    g_compression.compressed_pages++;
+    g_compression.stored_bytes += len;
+    compression_update_ratio();
+    
+    spinlock_release(&g_compression.lock);
+    
+    *slot = zpte_encode(handle, pte);
+    phys_free_page(frame);
+    return 0;
+}
+
+static int compress_pte_locked(memory_domain_t* domain, uint64_t vaddr, uint64_t* slot) {
+    if (!compress_pte_eligible(*slot)) {
+        return -EINVAL;
+    }
+    
+    // Unmap first so a write elsewhere faults and waits on the domain lock
+    // instead of racing the compressor
+    uint64_t pte = __atomic_exchange_n(slot, 0, __ATOMIC_ACQ_REL);
+    flux_tlb_shootdown(domain, vaddr & ~(uint64_t)(PAGE_SIZE - 1), PAGE_SIZE);
+    return compress_pte_store(slot, pte);
+}
+
+// Bring a compressed page back into a fresh frame. Caller holds domain->lock.
+static int decompress_pte_locked(uint64_t* slot) {
+    uint64_t zpte = *slot;
+    if (!zpte_is_compressed(zpte)) {
+        return -EINVAL;
+    }
+    
+    uint64_t start = continuum_get_time();
+    uint64_t frame = phys_alloc_page();
+    if (!frame) {
+        return -ENOMEM;
+    }
+    
+    spinlock_acquire(&g_compression.lock);
+    
+    uint64_t handle = zpte_handle(zpte);
+    uint8_t* obj = zpool_object(handle);
+    uint16_t len = *(uint16_t*)obj;
+    if (lz4_decompress(obj + sizeof(uint16_t), len, (uint8_t*)frame, PAGE_SIZE) != PAGE_SIZE) {
+        // Pool corruption: leave the entry so the fault is reported
+        spinlock_release(&g_compression.lock);
+        phys_free_page(frame);
+        return -EFAULT;
+    }
+    
+    zpool_free(handle);
+    g_compression.compressed_pages--;
+    g_compression.stored_bytes -= len;
+    compression_update_ratio();
+    
+    uint64_t cycles = continuum_get_time() - start;
+    g_compression.decompressions++;
+    g_compression.decompress_cycles += cycles;
+    if (cycles > g_compression.decompress_cycles_max) {
+        g_compression.decompress_cycles_max = cycles;
+    }
+    
+    spinlock_release(&g_compression.lock);
+    
+    // Just faulted in, so start it out hot
+    *slot = frame | PAGE_PRESENT | PAGE_ACCESSED | PAGE_PRIVATE | (zpte & ZPTE_KEEP_FLAGS);
+    return 0;
+}
+
+// Drop the pool object behind a compressed entry that is being torn down
+static void compression_release_pte(uint64_t zpte) {
+    spinlock_acquire(&g_compression.lock);
+    
+    uint64_t handle = zpte_handle(zpte);
+    g_compression.stored_bytes -= *(uint16_t*)zpool_object(handle);
+    g_compression.compressed_pages--;
+    zpool_free(handle);
+    compression_update_ratio();
+    
+    spinlock_release(&g_compression.lock);
+}
+
+int flux_compress_page(memory_domain_t* domain, uint64_t vaddr) {
+    if (!domain) {
+        return -EINVAL;
+    }
+    
+    spinlock_acquire(&domain->lock);
+    
+    uint64_t* slot = flux_walk(domain, vaddr, false);
+    int result = slot ? compress_pte_locked(domain, vaddr, slot) : -EINVAL;
+    
+    spinlock_release(&domain->lock);
+    return result;
+}
+
+int flux_decompress_page(memory_domain_t* domain, uint64_t vaddr) {
+    if (!domain) {
+        return -EINVAL;
+    }
+    
+    spinlock_acquire(&domain->lock);
+    
+    uint64_t* slot = flux_walk(domain, vaddr, false);
+    int result = slot ? decompress_pte_locked(slot) : -EINVAL;
+    
+    spinlock_release(&domain->lock);
+    return result;
+}
+
+bool flux_is_compressed(memory_domain_t* domain, uint64_t vaddr) {
+    if (!domain) {
+        return false;
+    }
+    
+    spinlock_acquire(&domain->lock);
+    uint64_t* slot = flux_walk(domain, vaddr, false);
+    bool compressed = slot && zpte_is_compressed(*slot);
+    spinlock_release(&domain->lock);
+    
+    return compressed;
+}
+
+// =============================================================================
+// Page Transfer
+// =============================================================================
+
+// Collect the frames behind a page-aligned range of private memory for
+// mapping into another domain. With move, the pages leave this domain and
+// their references go with them; otherwise each frame gains a reference
+// and both sides see it copy-on-write. Returns 0 or -EFAULT if a page
+// isn't private memory, leaving the range as it was.
+int flux_grab_pages(memory_domain_t* domain, uint64_t vaddr, size_t size,
+                    uint64_t* frames, bool move) {
+    if (!domain || !frames || !size || (vaddr & (PAGE_SIZE - 1))) {
+        return -EINVAL;
+    }
+    
+    uint64_t end = vaddr + ((size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1));
+    int result = 0;
+    
+    spinlock_acquire(&domain->lock);
+    
+    flux_tlb_batch_t batch;
+    flux_tlb_batch_init(&batch, domain);
+    
+    // Check everything before touching anything: split 2MB pages and
+    // bring back compressed ones
+    for (uint64_t va = vaddr; va < end && result == 0; va += PAGE_SIZE) {
+        uint64_t* pde = flux_walk_level(domain, va, 21, false);
+        if (pde && (*pde & PAGE_PRESENT) && (*pde & PAGE_HUGE) &&
+            !split_huge_pde(pde, va, &batch)) {
+            result = -ENOMEM;
+            break;
+        }
+        
+        uint64_t* pte = flux_walk(domain, va, false);
+        if (pte && zpte_is_compressed(*pte)) {
+            result = decompress_pte_locked(pte);
+        }
+        if (result == 0 &&
+            (!pte || (*pte & (PAGE_PRESENT | PAGE_PRIVATE)) != (PAGE_PRESENT | PAGE_PRIVATE))) {
+            result = -EFAULT;
+        }
+    }
+    
+    if (result == 0) {
+        size_t i = 0;
+        for (uint64_t va = vaddr; va < end; va += PAGE_SIZE, i++) {
+            uint64_t* pte = flux_walk(domain, va, false);
+            frames[i] = *pte & PTE_ADDR_MASK;
+            
+            if (move) {
+                *pte = 0;
+            } else {
+                flux_ref_page(frames[i]);
+                if (*pte & PAGE_WRITABLE) {
+                    *pte = (*pte & ~PAGE_WRITABLE) | PAGE_COW;
+                }
+            }
+            flux_tlb_batch_add(&batch, va, PAGE_SIZE);
+        }
+    }
+    
+    flux_tlb_batch_flush(&batch);
+    if (result == 0 && move) {
+        region_clear_range(domain, vaddr, end);
+    }
+    
+    spinlock_release(&domain->lock);
+    return result;
+}
+
+// Map frames taken with flux_grab_pages at a free address in the share
+// window of domain, which takes over their references. Returns the
+// address, or 0 if no room or memory (the references stay with the
+// caller).
+uint64_t flux_place_pages(memory_domain_t* domain, const uint64_t* frames,
+                          size_t count, uint32_t flags) {
+    if (!domain || !frames || !count) {
+        return 0;
+    }
+    
+    uint64_t len = (uint64_t)count * PAGE_SIZE;
+    uint64_t page_flags = flux_map_flags_to_pte(flags | FLUX_MAP_PRIVATE);
+    if (page_flags & PAGE_COW) {
+        page_flags &= ~PAGE_WRITABLE;  // Writes have to fault and copy
+    }
+    
+    spinlock_acquire(&domain->lock);
+    
+    // First gap in the region tree big enough for the range
+    uint64_t base = FLUX_SHARE_BASE;
+    memory_region_t* region;
+    while ((region = region_first_overlap(domain, base, base + len)) != NULL) {
+        base = (region->base_addr + region->size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    }
+    if (base + len > FLUX_USER_TOP) {
+        spinlock_release(&domain->lock);
+        return 0;
+    }
+    
+    region = region_create(base, len, region_flags_for_map(flags) | REGION_FLAG_SHARED,
+                           flags, frames[0]);
+    if (!region) {
+        spinlock_release(&domain->lock);
+        return 0;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        uint64_t* pte = flux_walk(domain, base + i * PAGE_SIZE, true);
+        if (!pte) {
+            // Out of page table memory: undo without dropping references
+            for (size_t j = 0; j < i; j++) {
+                *flux_walk(domain, base + j * PAGE_SIZE, false) = 0;
+            }
+            region_destroy(region);
+            spinlock_release(&domain->lock);
+            return 0;
+        }
+        *pte = frames[i] | page_flags;
+    }
+    region_insert(domain, region);
+    
+    spinlock_release(&domain->lock);
+    return base;
+}
+
+// Drop references taken with flux_grab_pages that were never placed
+void flux_put_pages(const uint64_t* frames, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        flux_unref_page(frames[i]);
+    }
+}
+
+// =============================================================================
+// Page Fault Handling
+// =============================================================================
+
+// Point the 4K entry for vaddr at paddr. Caller holds domain->lock.
+static int flux_install_page(memory_domain_t* domain, uint64_t vaddr, uint64_t paddr,
+                             uint32_t flags) {
+    flux_tlb_batch_t batch;
+    flux_tlb_batch_init(&batch, domain);
+    
+    uint64_t* pde = flux_walk_level(domain, vaddr, 21, true);
+    if (!pde || ((*pde & PAGE_HUGE) && !split_huge_pde(pde, vaddr, &batch))) {
+        flux_tlb_batch_flush(&batch);
+        return -ENOMEM;
+    }
+    
+    uint64_t* pte = flux_walk(domain, vaddr, true);
+    if (!pte) {
+        flux_tlb_batch_flush(&batch);
+        return -ENOMEM;
+    }
+    if (*pte & PAGE_PRESENT) {
+        flux_tlb_batch_add(&batch, vaddr, PAGE_SIZE);   // Upgraded to writable
+    }
+    *pte = (paddr & PTE_ADDR_MASK) | flux_map_flags_to_pte(flags);
+    
+    flux_tlb_batch_flush(&batch);
+    return 0;
+}
+
+// Let a lazily filled region's ops supply the page. They run unlocked,
+// counted in region_faults so an unmap can wait them out.
+static int flux_region_fault(memory_domain_t* domain, uint64_t fault_addr, bool write) {
+    uint64_t vaddr = fault_addr & ~(uint64_t)(PAGE_SIZE - 1);
+    
+    spinlock_acquire(&domain->lock);
+    memory_region_t* region = region_lookup(domain, vaddr);
+    if (!region || !region->ops || (write && !(region->protection & FLUX_MAP_WRITE))) {
+        spinlock_release(&domain->lock);
+        return -EFAULT;
+    }
+    const flux_region_ops_t* ops = region->ops;
+    void* private_data = region->private_data;
+    __atomic_fetch_add(&domain->region_faults, 1, __ATOMIC_ACQ_REL);
+    spinlock_release(&domain->lock);
+    
+    uint64_t paddr;
+    uint32_t flags;
+    int result = ops->fault(private_data, vaddr, write, &paddr, &flags);
+    if (result == 0) {
+        spinlock_acquire(&domain->lock);
+        region = region_lookup(domain, vaddr);
+        if (region && region->ops == ops && region->private_data == private_data) {
+            result = flux_install_page(domain, vaddr, paddr, flags);
+        } else {
+            result = -EFAULT;   // Unmapped while the page was being read
+        }
+        spinlock_release(&domain->lock);
+    }
+    
+    __atomic_fetch_sub(&domain->region_faults, 1, __ATOMIC_ACQ_REL);
+    return result;
+}
+
+int flux_handle_page_fault(memory_domain_t* domain, uint64_t fault_addr,
+                           uint64_t error_code) {
+    if (!domain) {
+        return -EFAULT;
+    }
+    
+    continuum_counter_inc(COUNTER_PAGE_FAULTS);
+    
+    // Faults outside any region are bad accesses
+    if (!flux_find_region(domain, fault_addr)) {
+        return -EFAULT;
+    }
+    
+    if (!(error_code & PF_PRESENT)) {
+        // Not present: compressed entries are resolved here, lazily filled
+        // regions by their ops, and anything else only if the entry was
+        // being rewritten (compaction, collapse) when we faulted
+        int result = flux_decompress_page(domain, fault_addr);
+        if (result == -EINVAL) {
+            if (pt_leaf_entry(domain, fault_addr) & PAGE_PRESENT) {
+                return 0;
+            }
+            return flux_region_fault(domain, fault_addr, (error_code & PF_WRITE) != 0);
+        }
+        return result;
+    }
+    
+    if ((error_code & PF_WRITE) && (pt_leaf_entry(domain, fault_addr) & PAGE_COW)) {
+        continuum_counter_inc(COUNTER_COW_FAULTS);
+        flux_handle_cow_fault(domain, fault_addr);
+        return 0;
+    }
+    
+    // Lazily filled regions may map pages read-only until first written
+    if (error_code & PF_WRITE) {
+        return flux_region_fault(domain, fault_addr, true);
+    }
+    
+    return -EFAULT;
+}
+
+// =============================================================================
+// Background Compactor
+// =============================================================================
+
+// Shoot down a group of unmapped victims and compress them
+static size_t compactor_store_victims(flux_tlb_batch_t* batch, uint64_t** victims,
+                                      const uint64_t* ptes, uint32_t count) {
+    if (!count) {
+        return 0;
+    }
+    
+    flux_tlb_batch_flush(batch);
+    
+    size_t compressed = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (compress_pte_store(victims[i], ptes[i]) == 0) {
+            compressed++;
+        }
+    }
+    return compressed;
+}
+
+// CLOCK over the domain's private pages: a page whose accessed bit is set
+// gets it cleared and a second chance, a page still clear on the next visit
+// is cold and gets compressed. The accessed bit is cleared without a TLB
+// flush, so a cached translation may hide a later access; the cost of that
+// is an early compression and one decompress fault.
+size_t flux_compactor_scan(memory_domain_t* domain, size_t budget) {
+    if (!domain) {
+        return 0;
+    }
+    
+    size_t compressed = 0;
+    
+    spinlock_acquire(&domain->lock);
+    
+    // Victims are unmapped in groups so one shootdown covers the group
+    flux_tlb_batch_t batch;
+    flux_tlb_batch_init(&batch, domain);
+    uint64_t* victims[COMPACT_BATCH];
+    uint64_t victim_ptes[COMPACT_BATCH];
+    uint32_t victim_count = 0;
+    
+    uint64_t start = domain->compact_cursor;
+    uint64_t va = start;
+    bool wrapped = false;
+    
+    while (budget > 0) {
+        uint64_t* slot = pt_next_slot(domain, &va, 12);
+        if (!slot) {
+            if (wrapped) {
+                break;
+            }
+            wrapped = true;
+            va = 0;
             continue;
         }
+        if (wrapped && va >= start) {
+            break;
+        }
         
-        // Get or create PT
-        if (!(pd[pd_idx] & PAGE_PRESENT)) {
-            uint64_t pt_page = phys_alloc_page();
-            if (!pt_page) {
-                spinlock_release(&domain->lock);
-                return NULL;
+        uint64_t pte = *slot;
+        if ((pte & (PAGE_PRESENT | PAGE_PRIVATE)) == (PAGE_PRESENT | PAGE_PRIVATE)) {
+            budget--;
+            if (pte & PAGE_ACCESSED) {
+                __atomic_fetch_and(slot, ~PAGE_ACCESSED, __ATOMIC_RELAXED);
+            } else if (compress_pte_eligible(pte)) {
+                victims[victim_count] = slot;
+                victim_ptes[victim_count] = __atomic_exchange_n(slot, 0, __ATOMIC_ACQ_REL);
+                victim_count++;
+                flux_tlb_batch_add(&batch, va, PAGE_SIZE);
             }
-            memset((void*)pt_page, 0, PAGE_SIZE);
-            pd[pd_idx] = pt_page | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
         }
-        uint64_t* pt = (uint64_t*)(pd[pd_idx] & ~0xFFF);
+        va += PAGE_SIZE;
         
-        // Map page
-        uint64_t page_flags = PAGE_PRESENT;
-        if (flags & FLUX_MAP_WRITE) page_flags |= PAGE_WRITABLE;
-        if (flags & FLUX_MAP_USER) page_flags |= PAGE_USER;
-        if (!(flags & FLUX_MAP_EXEC)) page_flags |= PAGE_NX;
-        if (flags & FLUX_MAP_COW) page_flags |= PAGE_COW;
-        
-        pt[pt_idx] = pa | page_flags;
+        if (victim_count == COMPACT_BATCH) {
+            compressed += compactor_store_victims(&batch, victims, victim_ptes, victim_count);
+            victim_count = 0;
+        }
     }
     
-    // Flush TLB
-    flux_flush_tlb(vaddr, size);
+    compressed += compactor_store_victims(&batch, victims, victim_ptes, victim_count);
+    
+    domain->compact_cursor = va;
     
     spinlock_release(&domain->lock);
-    return (void*)vaddr;
+    return compressed;
 }
 
-// =============================================================================
-// Copy-on-Write Support
-// =============================================================================
+static void flux_compactor_pass(void) {
+    spinlock_acquire(&g_memory_lock);
+    
+    // Skip the kernel domain: its memory is touched without taking faults
+    for (int i = 1; i < MAX_DOMAINS; i++) {
+        if (g_domains[i]) {
+            g_compactor.compressed += flux_compactor_scan(g_domains[i],
+                                                          COMPACT_SCAN_BUDGET);
+        }
+    }
+    g_compactor.passes++;
+    
+    spinlock_release(&g_memory_lock);
+}
 
-void flux_handle_cow_fault(memory_domain_t* domain, uint64_t fault_addr) {
-    spinlock_acquire(&domain->lock);
+static void flux_collapse_pass(void) {
+    spinlock_acquire(&g_memory_lock);
     
-    // Get page table entry
-    uint64_t pte = flux_get_pte(domain, fault_addr);
+    for (int i = 0; i < MAX_DOMAINS; i++) {
+        if (g_domains[i]) {
+            flux_collapse_scan(g_domains[i], COLLAPSE_SCAN_BUDGET);
+        }
+    }
     
-    if (pte & PAGE_COW) {
-        // Allocate new page
-        uint64_t new_page = phys_alloc_page();
-        if (new_page) {
-            // Copy contents
-            uint64_t old_page = pte & ~0xFFF;
-            memcpy((void*)new_page, (void*)old_page, PAGE_SIZE);
-            
-            // Update PTE
-            uint64_t new_pte = new_page | (pte & 0xFFF);
-            new_pte &= ~PAGE_COW;
-            new_pte |= PAGE_WRITABLE;
-            flux_set_pte(domain, fault_addr, new_pte);
-            
-            // Decrease reference count on old page
-            flux_unref_page(old_page);
+    spinlock_release(&g_memory_lock);
+}
+
+static void flux_compactor_main(void) {
+    while (1) {
+        uint64_t now = continuum_get_time();
+        if (now - g_compactor.last_pass >= COMPACT_INTERVAL) {
+            g_compactor.last_pass = now;
             
-            // Flush TLB for this page
-            flux_flush_tlb(fault_addr, PAGE_SIZE);
+            // When memory is getting short, take clean cache pages back
+            // first and compress cold pages with whatever is still missing;
+            // otherwise spend the pass promoting 4K runs to huge pages
+            if (flux_memory_low()) {
+                flux_reclaim(COMPACT_RECLAIM_PAGES);
+                if (flux_memory_low()) {
+                    flux_compactor_pass();
+                }
+            } else {
+                flux_collapse_pass();
+            }
         }
+        temporal_yield(temporal_get_current());
+    }
+}
+
+void flux_compactor_start(void) {
+    quantum_id_t qid = continuum_create_quantum(ABI_MODE_NATIVE,
+                                                (void*)flux_compactor_main,
+                                                "kcompactd");
+    quantum_context_t* quantum = continuum_get_quantum(qid);
+    if (!quantum) {
+        return;
     }
     
-    spinlock_release(&domain->lock);
+    quantum->scheduling.priority = PRIORITY_LOW;
+    temporal_enqueue(quantum);
 }
 
 // =============================================================================
-// Page Compression
+// Memory Pressure
 // =============================================================================
 
-static size_t compress_page(void* src, void* dst) {
-    // Simple RLE compression for demonstration
-    uint8_t* s = (uint8_t*)src;
-    uint8_t* d = (uint8_t*)dst;
-    size_t src_pos = 0;
-    size_t dst_pos = 0;
+int flux_register_shrinker(flux_shrinker_t shrinker, void* context) {
+    if (!shrinker) {
+        return -EINVAL;
+    }
     
-    while (src_pos < PAGE_SIZE && dst_pos < PAGE_SIZE - 2) {
-        uint8_t byte = s[src_pos];
-        size_t run_length = 1;
-        
-        while (src_pos + run_length < PAGE_SIZE && 
-               s[src_pos + run_length] == byte &&
-               run_length < 255) {
-            run_length++;
-        }
-        
-        if (run_length > 2 || byte == 0xFF) {
-            d[dst_pos++] = 0xFF;  // Escape
-            d[dst_pos++] = run_length;
-            d[dst_pos++] = byte;
-            src_pos += run_length;
-        } else {
-            d[dst_pos++] = byte;
-            src_pos++;
+    spinlock_acquire(&g_shrinker_lock);
+    for (int i = 0; i < FLUX_MAX_SHRINKERS; i++) {
+        if (!g_shrinkers[i].shrinker) {
+            g_shrinkers[i].shrinker = shrinker;
+            g_shrinkers[i].context = context;
+            spinlock_release(&g_shrinker_lock);
+            return 0;
         }
     }
-    
-    return dst_pos;
+    spinlock_release(&g_shrinker_lock);
+    return -ENOSPC;
 }
 
-static void decompress_page(void* src, void* dst, size_t compressed_size) {
-    uint8_t* s = (uint8_t*)src;
-    uint8_t* d = (uint8_t*)dst;
-    size_t src_pos = 0;
-    size_t dst_pos = 0;
-    
-    while (src_pos < compressed_size && dst_pos < PAGE_SIZE) {
-        if (s[src_pos] == 0xFF && src_pos + 2 < compressed_size) {
-            // Compressed run
-            size_t run_length = s[src_pos + 1];
-            uint8_t byte = s[src_pos + 2];
-            for (size_t i = 0; i < run_length && dst_pos < PAGE_SIZE; i++) {
-                d[dst_pos++] = byte;
-            }
-            src_pos += 3;
-        } else {
-            d[dst_pos++] = s[src_pos++];
+void flux_unregister_shrinker(flux_shrinker_t shrinker, void* context) {
+    spinlock_acquire(&g_shrinker_lock);
+    for (int i = 0; i < FLUX_MAX_SHRINKERS; i++) {
+        if (g_shrinkers[i].shrinker == shrinker && g_shrinkers[i].context == context) {
+            g_shrinkers[i].shrinker = NULL;
+            g_shrinkers[i].context = NULL;
         }
     }
-    
-    // Fill rest with zeros if needed
-    while (dst_pos < PAGE_SIZE) {
-        d[dst_pos++] = 0;
-    }
+    spinlock_release(&g_shrinker_lock);
 }
 
-void flux_compress_page(uint64_t paddr) {
-    void* page = (void*)paddr;
-    void* compressed = flux_allocate(NULL, PAGE_SIZE, FLUX_ALLOC_KERNEL);
+// Ask the registered caches for up to pages frames, in registration order.
+// Returns how many they released.
+size_t flux_reclaim(size_t pages) {
+    size_t freed = 0;
     
-    if (compressed) {
-        size_t compressed_size = compress_page(page, compressed);
+    for (int i = 0; i < FLUX_MAX_SHRINKERS && freed < pages; i++) {
+        spinlock_acquire(&g_shrinker_lock);
+        flux_shrinker_t shrinker = g_shrinkers[i].shrinker;
+        void* context = g_shrinkers[i].context;
+        spinlock_release(&g_shrinker_lock);
         
-        if (compressed_size < COMPRESSION_THRESHOLD) {
-            // Worth compressing
-            g_compression.compressed_pages++;
-            g_compression.compression_ratio = 
-                (g_compression.compression_ratio * (g_compression.compressed_pages - 1) +
-                 (PAGE_SIZE * 100 / compressed_size)) / g_compression.compressed_pages;
-            
-            // Store compressed data (simplified)
-            // In reality, would need to update page tables and track compressed pages
+        if (shrinker) {
+            freed += shrinker(pages - freed, context);
         }
-        
-        flux_free(compressed);
     }
+    return freed;
+}
+
+bool flux_memory_low(void) {
+    return g_memory_state.free_memory * 100 <
+           g_memory_state.total_memory * COMPACT_PRESSURE_PCT;
 }
 
 // =============================================================================
@@ -770,10 +3388,31 @@ void flux_init(void* memory_map) {
     g_phys_bitmap = (uint64_t*)0x200000;  // Place at 2MB
     memset(g_phys_bitmap, 0, bitmap_size);
     
-    // Mark kernel and bitmap as used
-    for (uint64_t addr = 0; addr < 0x400000; addr += PAGE_SIZE) {
-        uint64_t page_num = addr / PAGE_SIZE;
-        g_phys_bitmap[page_num / 64] |= (1ULL << (page_num % 64));
+    g_phys_words = (g_phys_pages + 63) / 64;
+    
+    // Summaries live directly after the bitmap, inside the reserved area
+    uint64_t* index_storage = g_phys_bitmap + g_phys_words;
+    phys_index_init(&g_phys_avail, &index_storage);
+    phys_index_init(&g_phys_empty, &index_storage);
+    for (uint64_t i = 0; i < g_phys_words; i++) {
+        phys_index_set(&g_phys_avail, i);
+        phys_index_set(&g_phys_empty, i);
+    }
+    
+    // Mark kernel, bitmap and summaries as used, plus any tail bits beyond
+    // the last real page
+    phys_set_range(0, 0x400000 / PAGE_SIZE, true);
+    if (g_phys_pages % 64) {
+        phys_set_range(g_phys_pages, 64 - g_phys_pages % 64, true);
+    }
+    g_memory_state.used_memory = 0x400000;
+    g_memory_state.free_memory = g_memory_state.total_memory - 0x400000;
+    
+    // Frame reference counts
+    size_t refs_pages = (g_phys_pages * sizeof(uint16_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+    g_frame_refs = (uint16_t*)phys_alloc_pages(refs_pages);
+    if (g_frame_refs) {
+        memset(g_frame_refs, 0, refs_pages * PAGE_SIZE);
     }
     
     // Initialize buddy allocator
@@ -783,17 +3422,19 @@ void flux_init(void* memory_map) {
     
     // Initialize slab caches
     for (int i = 0; i < SLAB_SIZES_COUNT; i++) {
-        slab_init_cache(&g_slab_caches[i], g_slab_sizes[i]);
+        slab_init_cache(&g_slab_caches[i], g_slab_sizes[i], g_slab_cpu_caches[i]);
     }
     
     // Create kernel memory domain
     g_domains[0] = flux_create_domain(0);  // QID 0 for kernel
     
     // Initialize compression
-    g_compression.workspace = NULL;
-    g_compression.workspace_size = 0;
+    g_compression.workspace_size = LZ4_WORKSPACE_PAGES * PAGE_SIZE;
+    g_compression.workspace = (void*)phys_alloc_pages(LZ4_WORKSPACE_PAGES);
     g_compression.compressed_pages = 0;
     g_compression.compression_ratio = 100;
+    spinlock_init(&g_compression.lock);
+    zpool_init();
     
     g_memory_state.initialized = true;
 }
@@ -804,7 +3445,7 @@ void flux_init(void* memory_map) {
 
 uint64_t flux_translate_address(memory_domain_t* domain, uint64_t vaddr) {
     if (!domain) {
-        return 0;
+        return vaddr;   // Kernel memory is identity mapped
     }
     
     uint64_t* pml4 = (uint64_t*)domain->page_table_base;
@@ -816,46 +3457,112 @@ uint64_t flux_translate_address(memory_domain_t* domain, uint64_t vaddr) {
     uint64_t offset = vaddr & 0xFFF;
     
     if (!(pml4[pml4_idx] & PAGE_PRESENT)) return 0;
-    uint64_t* pdpt = (uint64_t*)(pml4[pml4_idx] & ~0xFFF);
+    uint64_t* pdpt = (uint64_t*)(pml4[pml4_idx] & PTE_ADDR_MASK);
     
     if (!(pdpt[pdpt_idx] & PAGE_PRESENT)) return 0;
-    uint64_t* pd = (uint64_t*)(pdpt[pdpt_idx] & ~0xFFF);
+    uint64_t* pd = (uint64_t*)(pdpt[pdpt_idx] & PTE_ADDR_MASK);
     
+    if (!(pd[pd_idx] & PAGE_PRESENT)) return 0;
     if (pd[pd_idx] & PAGE_HUGE) {
         // 2MB huge page
-        return (pd[pd_idx] & ~0x1FFFFF) | (vaddr & 0x1FFFFF);
+        return (pd[pd_idx] & PTE_ADDR_MASK & ~0x1FFFFFULL) | (vaddr & 0x1FFFFF);
     }
-    
-    if (!(pd[pd_idx] & PAGE_PRESENT)) return 0;
-    uint64_t* pt = (uint64_t*)(pd[pd_idx] & ~0xFFF);
+    uint64_t* pt = (uint64_t*)(pd[pd_idx] & PTE_ADDR_MASK);
     
     if (!(pt[pt_idx] & PAGE_PRESENT)) return 0;
     
-    return (pt[pt_idx] & ~0xFFF) | offset;
+    return (pt[pt_idx] & PTE_ADDR_MASK) | offset;
+}
+
+static bool page_writable_locked(memory_domain_t* domain, uint64_t vaddr) {
+    uint64_t* pde = flux_walk_level(domain, vaddr, 21, false);
+    if (pde && (*pde & PAGE_PRESENT) && (*pde & PAGE_HUGE)) {
+        return (*pde & PAGE_WRITABLE) != 0;
+    }
+    
+    uint64_t* pte = flux_walk(domain, vaddr, false);
+    return pte && (*pte & (PAGE_PRESENT | PAGE_WRITABLE)) == (PAGE_PRESENT | PAGE_WRITABLE);
+}
+
+// Copy into another domain's memory through the identity map, for IPC
+// that delivers straight into a blocked receiver's buffer. Every page must
+// already be present and writable (no faults, no copy-on-write); otherwise
+// nothing is copied and -EFAULT comes back.
+int flux_copy_to_domain(memory_domain_t* domain, uint64_t vaddr,
+                        const void* src, size_t size) {
+    if (!domain || !src) {
+        return -EINVAL;
+    }
+    
+    spinlock_acquire(&domain->lock);
+    
+    for (uint64_t va = vaddr & ~(uint64_t)(PAGE_SIZE - 1); va < vaddr + size; va += PAGE_SIZE) {
+        if (!page_writable_locked(domain, va)) {
+            spinlock_release(&domain->lock);
+            return -EFAULT;
+        }
+    }
+    
+    size_t done = 0;
+    while (done < size) {
+        uint64_t va = vaddr + done;
+        size_t chunk = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        memcpy((void*)flux_translate_address(domain, va), (const uint8_t*)src + done, chunk);
+        done += chunk;
+    }
+    
+    spinlock_release(&domain->lock);
+    return 0;
+}
+
+// Bus address for a device transfer touching vaddr's page. The page must
+// be present, and writable when the device writes to it so DMA never lands
+// in a copy-on-write page; otherwise 0 comes back and the caller bounces.
+// Pages aren't pinned: the caller keeps the buffer resident until the
+// transfer finishes.
+uint64_t flux_dma_address(memory_domain_t* domain, uint64_t vaddr, bool device_writes) {
+    if (!domain) {
+        return flux_translate_address(NULL, vaddr);
+    }
+    
+    uint64_t paddr = 0;
+    spinlock_acquire(&domain->lock);
+    if (!device_writes || page_writable_locked(domain, vaddr)) {
+        paddr = flux_translate_address(domain, vaddr);
+    }
+    spinlock_release(&domain->lock);
+    return paddr;
 }
 
+// Flush this CPU's TLB entries for an address range
 void flux_flush_tlb(uint64_t addr, size_t size) {
-    // Flush TLB entries for address range
-    for (uint64_t va = addr; va < addr + size; va += PAGE_SIZE) {
+    if (size > (uint64_t)TLB_FULL_FLUSH_PAGES * PAGE_SIZE) {
+        // Drops every non-global entry of the current PCID
+        write_cr3(read_cr3() & ~CR3_NOFLUSH);
+        continuum_counter_inc(COUNTER_TLB_FULL_FLUSHES);
+        return;
+    }
+    
+    uint64_t end = addr + size;
+    for (uint64_t va = addr & ~(uint64_t)(PAGE_SIZE - 1); va < end; va += PAGE_SIZE) {
         __asm__ __volatile__("invlpg (%0)" : : "r"(va) : "memory");
     }
 }
 
+// PTE accessors; callers hold domain->lock
 uint64_t flux_get_pte(memory_domain_t* domain, uint64_t vaddr) {
-    // Navigate page tables to get PTE
-    // Simplified - similar to translate_address
-    return 0;
+    uint64_t* slot = flux_walk(domain, vaddr, false);
+    return slot ? *slot : 0;
 }
 
 void flux_set_pte(memory_domain_t* domain, uint64_t vaddr, uint64_t pte) {
-    // Navigate page tables and set PTE
-    // Simplified - similar to map_region
-}
-
-void flux_unref_page(uint64_t paddr) {
-    // Decrease reference count on page
-    // If count reaches zero, free the page
-    // Simplified for now
+    uint64_t* slot = flux_walk(domain, vaddr, true);
+    if (slot) {
+        *slot = pte;
+    }
 }
 
 void flux_get_stats(flux_stats_t* stats) {
@@ -870,13 +3577,443 @@ void flux_get_stats(flux_stats_t* stats) {
     stats->domain_count = g_memory_state.domain_count;
     stats->compressed_pages = g_compression.compressed_pages;
     stats->compression_ratio = g_compression.compression_ratio;
+    stats->cow_faults = continuum_counter_read(COUNTER_COW_FAULTS);
+    stats->page_faults = continuum_counter_read(COUNTER_PAGE_FAULTS);
+    
+    spinlock_acquire(&g_compression.lock);
+    stats->compressed_bytes = g_compression.stored_bytes;
+    stats->compression_pool_pages = g_compression.pool_pages;
+    stats->compression_rejects = g_compression.rejects;
+    stats->decompressions = g_compression.decompressions;
+    stats->decompress_cycles_avg = g_compression.decompressions ?
+        g_compression.decompress_cycles / g_compression.decompressions : 0;
+    stats->decompress_cycles_max = g_compression.decompress_cycles_max;
+    spinlock_release(&g_compression.lock);
+    stats->compactor_passes = g_compactor.passes;
+    stats->huge_mappings = continuum_counter_read(COUNTER_HUGE_MAPPINGS);
+    stats->huge_splits = continuum_counter_read(COUNTER_HUGE_SPLITS);
+    stats->huge_collapses = continuum_counter_read(COUNTER_HUGE_COLLAPSES);
+    
+    uint64_t shootdowns = continuum_counter_read(COUNTER_TLB_SHOOTDOWNS);
+    stats->tlb_shootdowns = shootdowns;
+    stats->tlb_ipis = continuum_counter_read(COUNTER_TLB_IPIS);
+    stats->tlb_full_flushes = continuum_counter_read(COUNTER_TLB_FULL_FLUSHES);
+    stats->tlb_pcid_hits = continuum_counter_read(COUNTER_TLB_PCID_HITS);
+    stats->tlb_shootdown_cycles_avg = shootdowns ?
+        continuum_counter_read(COUNTER_TLB_SHOOTDOWN_CYCLES) / shootdowns : 0;
+    stats->tlb_shootdown_cycles_max = g_tlb.cycles_max;
+    
+    // Frames parked in magazines are free even though the bitmap says used
+    stats->frame_magazine_hits = 0;
+    stats->frame_magazine_misses = 0;
+    stats->frame_magazine_refills = 0;
+    stats->frame_magazine_drains = 0;
+    stats->frame_magazine_cached = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPU_CORES; cpu++) {
+        phys_magazine_t* mag = &g_phys_magazines[cpu];
+        stats->frame_magazine_hits += mag->hits;
+        stats->frame_magazine_misses += mag->misses;
+        stats->frame_magazine_refills += mag->refills;
+        stats->frame_magazine_drains += mag->drains;
+        stats->frame_magazine_cached += mag->count;
+    }
+    stats->used_memory -= stats->frame_magazine_cached * PAGE_SIZE;
+    stats->free_memory += stats->frame_magazine_cached * PAGE_SIZE;
+}
+
+// =============================================================================
+// Memory Operations
+// =============================================================================
+
+// Size classes for dispatch
+#define MEMOP_SMALL_MAX         16      // Overlapping scalar loads/stores
+#define MEMOP_WORD_MAX          256     // Unrolled 64-bit word loop
+#define MEMOP_REP_MIN           2048    // ERMS pays off beyond its startup cost
+
+// CR4 bits consulted when picking a SIMD implementation
+#define CR4_OSFXSR              (1ULL << 9)
+#define CR4_OSXSAVE             (1ULL << 18)
+
+typedef void (*memops_copy_fn)(uint8_t* d, const uint8_t* s, size_t len);
+typedef void (*memops_set_fn)(uint8_t* d, uint64_t pattern, size_t len);
+
+static inline uint64_t load64(const uint8_t* p) {
+    return *(const unaligned_u64_t*)p;
+}
+
+static inline void store64(uint8_t* p, uint64_t v) {
+    *(unaligned_u64_t*)p = v;
+}
+
+static inline void memops_copy_small(uint8_t* d, const uint8_t* s, size_t len) {
+    // All loads happen before any store so overlapping moves are safe too
+    if (len >= 8) {
+        uint64_t head = load64(s);
+        uint64_t tail = load64(s + len - 8);
+        store64(d, head);
+        store64(d + len - 8, tail);
+    } else if (len >= 4) {
+        uint32_t head = *(const unaligned_u32_t*)s;
+        uint32_t tail = *(const unaligned_u32_t*)(s + len - 4);
+        *(unaligned_u32_t*)d = head;
+        *(unaligned_u32_t*)(d + len - 4) = tail;
+    } else if (len > 0) {
+        uint8_t first = s[0];
+        uint8_t middle = s[len / 2];
+        uint8_t last = s[len - 1];
+        d[0] = first;
+        d[len / 2] = middle;
+        d[len - 1] = last;
+    }
+}
+
+static inline void memops_set_small(uint8_t* d, uint64_t pattern, size_t len) {
+    if (len >= 8) {
+        store64(d, pattern);
+        store64(d + len - 8, pattern);
+    } else if (len >= 4) {
+        *(unaligned_u32_t*)d = (uint32_t)pattern;
+        *(unaligned_u32_t*)(d + len - 4) = (uint32_t)pattern;
+    } else if (len > 0) {
+        d[0] = (uint8_t)pattern;
+        d[len / 2] = (uint8_t)pattern;
+        d[len - 1] = (uint8_t)pattern;
+    }
+}
+
+// Word copy for len >= 16; the last 16 bytes are loaded up front and
+// stored last, so the loop never needs a byte tail
+static void memops_copy_words(uint8_t* d, const uint8_t* s, size_t len) {
+    uint64_t tail0 = load64(s + len - 16);
+    uint64_t tail1 = load64(s + len - 8);
+    size_t body = len - 16;
+    size_t i = 0;
+    
+    for (; i + 32 <= body; i += 32) {
+        uint64_t a = load64(s + i);
+        uint64_t b = load64(s + i + 8);
+        uint64_t c = load64(s + i + 16);
+        uint64_t e = load64(s + i + 24);
+        store64(d + i, a);
+        store64(d + i + 8, b);
+        store64(d + i + 16, c);
+        store64(d + i + 24, e);
+    }
+    for (; i < body; i += 8) {
+        store64(d + i, load64(s + i));
+    }
+    
+    store64(d + len - 16, tail0);
+    store64(d + len - 8, tail1);
+}
+
+static void memops_set_words(uint8_t* d, uint64_t pattern, size_t len) {
+    size_t body = len - 16;
+    size_t i = 0;
+    
+    for (; i + 32 <= body; i += 32) {
+        store64(d + i, pattern);
+        store64(d + i + 8, pattern);
+        store64(d + i + 16, pattern);
+        store64(d + i + 24, pattern);
+    }
+    for (; i < body; i += 8) {
+        store64(d + i, pattern);
+    }
+    
+    store64(d + len - 16, pattern);
+    store64(d + len - 8, pattern);
+}
+
+// The SIMD loops run in kernel context without an FPU ownership protocol,
+// so they spill and restore the vector registers they borrow. That costs a
+// few dozen cycles and only happens on the bulk path (len > MEMOP_WORD_MAX).
+
+static void memops_copy_sse2(uint8_t* d, const uint8_t* s, size_t len) {
+    uint8_t save[64] __attribute__((aligned(16)));
+    
+    // Align the destination; the overlap with the loop rewrites equal bytes
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    memops_copy_small(d, s, 16);
+    d += head;
+    s += head;
+    len -= head;
+    
+    size_t blocks = len / 64;
+    if (blocks) {
+        __asm__ __volatile__(
+            "movdqa %%xmm0, 0(%[sv])\n"
+            "movdqa %%xmm1, 16(%[sv])\n"
+            "movdqa %%xmm2, 32(%[sv])\n"
+            "movdqa %%xmm3, 48(%[sv])\n"
+            "1:\n"
+            "movdqu 0(%[s]), %%xmm0\n"
+            "movdqu 16(%[s]), %%xmm1\n"
+            "movdqu 32(%[s]), %%xmm2\n"
+            "movdqu 48(%[s]), %%xmm3\n"
+            "movdqa %%xmm0, 0(%[d])\n"
+            "movdqa %%xmm1, 16(%[d])\n"
+            "movdqa %%xmm2, 32(%[d])\n"
+            "movdqa %%xmm3, 48(%[d])\n"
+            "add $64, %[s]\n"
+            "add $64, %[d]\n"
+            "dec %[n]\n"
+            "jnz 1b\n"
+            "movdqa 0(%[sv]), %%xmm0\n"
+            "movdqa 16(%[sv]), %%xmm1\n"
+            "movdqa 32(%[sv]), %%xmm2\n"
+            "movdqa 48(%[sv]), %%xmm3\n"
+            : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks)
+            : [sv] "r"(save)
+            : "memory", "cc"
+        );
+    }
+    
+    len &= 63;
+    if (len > MEMOP_SMALL_MAX) {
+        memops_copy_words(d, s, len);
+    } else {
+        memops_copy_small(d, s, len);
+    }
+}
+
+static void memops_set_sse2(uint8_t* d, uint64_t pattern, size_t len) {
+    uint8_t save[16] __attribute__((aligned(16)));
+    
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    memops_set_small(d, pattern, 16);
+    d += head;
+    len -= head;
+    
+    size_t blocks = len / 64;
+    if (blocks) {
+        __asm__ __volatile__(
+            "movdqa %%xmm0, 0(%[sv])\n"
+            "movq %[p], %%xmm0\n"
+            "punpcklqdq %%xmm0, %%xmm0\n"
+            "1:\n"
+            "movdqa %%xmm0, 0(%[d])\n"
+            "movdqa %%xmm0, 16(%[d])\n"
+            "movdqa %%xmm0, 32(%[d])\n"
+            "movdqa %%xmm0, 48(%[d])\n"
+            "add $64, %[d]\n"
+            "dec %[n]\n"
+            "jnz 1b\n"
+            "movdqa 0(%[sv]), %%xmm0\n"
+            : [d] "+r"(d), [n] "+r"(blocks)
+            : [sv] "r"(save), [p] "r"(pattern)
+            : "memory", "cc"
+        );
+    }
+    
+    len &= 63;
+    if (len > MEMOP_SMALL_MAX) {
+        memops_set_words(d, pattern, len);
+    } else {
+        memops_set_small(d, pattern, len);
+    }
+}
+
+static void memops_copy_avx2(uint8_t* d, const uint8_t* s, size_t len) {
+    uint8_t save[128] __attribute__((aligned(32)));
+    
+    size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+    memops_copy_words(d, s, 32);
+    d += head;
+    s += head;
+    len -= head;
+    
+    size_t blocks = len / 128;
+    if (blocks) {
+        __asm__ __volatile__(
+            "vmovdqa %%ymm0, 0(%[sv])\n"
+            "vmovdqa %%ymm1, 32(%[sv])\n"
+            "vmovdqa %%ymm2, 64(%[sv])\n"
+            "vmovdqa %%ymm3, 96(%[sv])\n"
+            "1:\n"
+            "vmovdqu 0(%[s]), %%ymm0\n"
+            "vmovdqu 32(%[s]), %%ymm1\n"
+            "vmovdqu 64(%[s]), %%ymm2\n"
+            "vmovdqu 96(%[s]), %%ymm3\n"
+            "vmovdqa %%ymm0, 0(%[d])\n"
+            "vmovdqa %%ymm1, 32(%[d])\n"
+            "vmovdqa %%ymm2, 64(%[d])\n"
+            "vmovdqa %%ymm3, 96(%[d])\n"
+            "add $128, %[s]\n"
+            "add $128, %[d]\n"
+            "dec %[n]\n"
+            "jnz 1b\n"
+            "vmovdqa 0(%[sv]), %%ymm0\n"
+            "vmovdqa 32(%[sv]), %%ymm1\n"
+            "vmovdqa 64(%[sv]), %%ymm2\n"
+            "vmovdqa 96(%[sv]), %%ymm3\n"
+            : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks)
+            : [sv] "r"(save)
+            : "memory", "cc"
+        );
+    }
+    
+    len &= 127;
+    if (len > MEMOP_SMALL_MAX) {
+        memops_copy_words(d, s, len);
+    } else {
+        memops_copy_small(d, s, len);
+    }
+}
+
+static void memops_set_avx2(uint8_t* d, uint64_t pattern, size_t len) {
+    uint8_t save[32] __attribute__((aligned(32)));
+    
+    size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+    memops_set_words(d, pattern, 32);
+    d += head;
+    len -= head;
+    
+    size_t blocks = len / 128;
+    if (blocks) {
+        __asm__ __volatile__(
+            "vmovdqa %%ymm0, 0(%[sv])\n"
+            "vmovq %[p], %%xmm0\n"
+            "vpbroadcastq %%xmm0, %%ymm0\n"
+            "1:\n"
+            "vmovdqa %%ymm0, 0(%[d])\n"
+            "vmovdqa %%ymm0, 32(%[d])\n"
+            "vmovdqa %%ymm0, 64(%[d])\n"
+            "vmovdqa %%ymm0, 96(%[d])\n"
+            "add $128, %[d]\n"
+            "dec %[n]\n"
+            "jnz 1b\n"
+            "vmovdqa 0(%[sv]), %%ymm0\n"
+            : [d] "+r"(d), [n] "+r"(blocks)
+            : [sv] "r"(save), [p] "r"(pattern)
+            : "memory", "cc"
+        );
+    }
+    
+    len &= 127;
+    if (len > MEMOP_SMALL_MAX) {
+        memops_set_words(d, pattern, len);
+    } else {
+        memops_set_small(d, pattern, len);
+    }
+}
+
+static void memops_copy_erms(uint8_t* d, const uint8_t* s, size_t len) {
+    __asm__ __volatile__(
+        "rep movsb"
+        : "+D"(d), "+S"(s), "+c"(len)
+        :
+        : "memory"
+    );
+}
+
+static void memops_set_erms(uint8_t* d, uint64_t pattern, size_t len) {
+    __asm__ __volatile__(
+        "rep stosb"
+        : "+D"(d), "+c"(len)
+        : "a"((uint8_t)pattern)
+        : "memory"
+    );
+}
+
+// Active implementation, selected once by flux_memops_init(). Until then
+// the portable word loops are used (early boot runs before CPUID is read).
+static struct {
+    flux_memops_impl_t impl;
+    memops_copy_fn copy_mid;    // MEMOP_WORD_MAX < len < rep_min
+    memops_copy_fn copy_large;  // len >= rep_min
+    memops_set_fn set_mid;
+    memops_set_fn set_large;
+    size_t rep_min;
+} g_memops = {
+    .impl = FLUX_MEMOPS_WORD,
+    .copy_mid = memops_copy_words,
+    .copy_large = memops_copy_words,
+    .set_mid = memops_set_words,
+    .set_large = memops_set_words,
+    .rep_min = MEMOP_REP_MIN
+};
+
+static const char* const g_memops_names[] = {
+    [FLUX_MEMOPS_WORD] = "word",
+    [FLUX_MEMOPS_SSE2] = "sse2",
+    [FLUX_MEMOPS_AVX2] = "avx2",
+    [FLUX_MEMOPS_ERMS] = "erms"
+};
+
+static uint64_t read_cr4(void) {
+    uint64_t cr4;
+    __asm__ __volatile__("movq %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static uint64_t read_xcr0(void) {
+    uint32_t low, high;
+    __asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return ((uint64_t)high << 32) | low;
+}
+
+void flux_memops_init(uint64_t cpu_features) {
+    uint64_t cr4 = read_cr4();
+    
+    // SSE needs CR4.OSFXSR; AVX additionally needs XCR0 to enable YMM state.
+    // The loops borrow registers from whichever quantum owns them, spilling
+    // and reloading only what they touch. With AVX-512 state enabled a VEX
+    // reload of ymm clears the upper half of its zmm, so those CPUs get the
+    // SSE2 loops, whose legacy encoding leaves everything above xmm alone.
+    bool sse2_usable = (cpu_features & CPU_FEATURE_SSE2) && (cr4 & CR4_OSFXSR);
+    bool avx2_usable = sse2_usable &&
+                       (cpu_features & CPU_FEATURE_AVX2) &&
+                       (cpu_features & CPU_FEATURE_OSXSAVE) &&
+                       (cr4 & CR4_OSXSAVE) &&
+                       (read_xcr0() & 0xE6) == 0x6;
+    
+    if (avx2_usable) {
+        g_memops.impl = FLUX_MEMOPS_AVX2;
+        g_memops.copy_mid = memops_copy_avx2;
+        g_memops.set_mid = memops_set_avx2;
+    } else if (sse2_usable) {
+        g_memops.impl = FLUX_MEMOPS_SSE2;
+        g_memops.copy_mid = memops_copy_sse2;
+        g_memops.set_mid = memops_set_sse2;
+    }
+    g_memops.copy_large = g_memops.copy_mid;
+    g_memops.set_large = g_memops.set_mid;
+    
+    if (cpu_features & CPU_FEATURE_ERMS) {
+        // rep movsb/stosb beats explicit loops once past its startup cost;
+        // with fast short rep movsb that cost is gone entirely
+        g_memops.impl = FLUX_MEMOPS_ERMS;
+        g_memops.copy_large = memops_copy_erms;
+        g_memops.set_large = memops_set_erms;
+        g_memops.rep_min = (cpu_features & CPU_FEATURE_FSRM) ?
+                           MEMOP_WORD_MAX + 1 : MEMOP_REP_MIN;
+    }
+}
+
+flux_memops_impl_t flux_memops_get_impl(void) {
+    return g_memops.impl;
+}
+
+const char* flux_memops_impl_name(flux_memops_impl_t impl) {
+    if (impl > FLUX_MEMOPS_ERMS) {
+        return "unknown";
+    }
+    return g_memops_names[impl];
 }
 
-// Simple memory operations
 void* memset(void* dest, int val, size_t len) {
     uint8_t* d = dest;
-    while (len--) {
-        *d++ = (uint8_t)val;
+    uint64_t pattern = (uint8_t)val * 0x0101010101010101ULL;
+    
+    if (len <= MEMOP_SMALL_MAX) {
+        memops_set_small(d, pattern, len);
+    } else if (len <= MEMOP_WORD_MAX) {
+        memops_set_words(d, pattern, len);
+    } else if (len < g_memops.rep_min) {
+        g_memops.set_mid(d, pattern, len);
+    } else {
+        g_memops.set_large(d, pattern, len);
     }
     return dest;
 }
@@ -884,8 +4021,150 @@ void* memset(void* dest, int val, size_t len) {
 void* memcpy(void* dest, const void* src, size_t len) {
     uint8_t* d = dest;
     const uint8_t* s = src;
-    while (len--) {
-        *d++ = *s++;
+    
+    if (len <= MEMOP_SMALL_MAX) {
+        memops_copy_small(d, s, len);
+    } else if (len <= MEMOP_WORD_MAX) {
+        memops_copy_words(d, s, len);
+    } else if (len < g_memops.rep_min) {
+        g_memops.copy_mid(d, s, len);
+    } else {
+        g_memops.copy_large(d, s, len);
+    }
+    return dest;
+}
+
+void* memmove(void* dest, const void* src, size_t len) {
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    
+    if (d == s || len == 0) {
+        return dest;
+    }
+    
+    // Disjoint ranges take the fully dispatched copy
+    if ((uintptr_t)d - (uintptr_t)s >= len &&
+        (uintptr_t)s - (uintptr_t)d >= len) {
+        return memcpy(dest, src, len);
+    }
+    
+    if (len <= MEMOP_SMALL_MAX) {
+        memops_copy_small(d, s, len);
+        return dest;
+    }
+    
+    if (d < s) {
+        // Forward: each word is loaded before the store that could clobber it
+        if (g_memops.impl == FLUX_MEMOPS_ERMS && len >= g_memops.rep_min) {
+            memops_copy_erms(d, s, len);
+            return dest;
+        }
+        size_t i = 0;
+        for (; i + 8 <= len; i += 8) {
+            store64(d + i, load64(s + i));
+        }
+        memops_copy_small(d + i, s + i, len - i);
+    } else {
+        // Backward from the end
+        size_t i = len;
+        for (; i >= 8; i -= 8) {
+            store64(d + i - 8, load64(s + i - 8));
+        }
+        memops_copy_small(d, s, i);
     }
     return dest;
 }
+
+int memcmp(const void* s1, const void* s2, size_t len) {
+    const uint8_t* p1 = s1;
+    const uint8_t* p2 = s2;
+    size_t i = 0;
+    
+    // Skip equal words, then locate the differing byte
+    for (; i + 8 <= len; i += 8) {
+        if (load64(p1 + i) != load64(p2 + i)) {
+            break;
+        }
+    }
+    for (; i < len; i++) {
+        if (p1[i] != p2[i]) {
+            return p1[i] - p2[i];
+        }
+    }
+    return 0;
+}
+
+// =============================================================================
+// Memory Operation Benchmark
+// =============================================================================
+
+#define MEMOPS_BENCH_BYTES      (4 * 1024 * 1024)  // Bytes moved per size class
+#define MEMOPS_BENCH_MIN_ITERS  16
+
+static const size_t g_memops_bench_sizes[] = {
+    8, 64, 256, 1024, 4096, 16384, 65536
+};
+
+static uint32_t memops_gbps_x100(uint64_t bytes, uint64_t cycles, uint64_t tsc_hz) {
+    if (cycles == 0) {
+        return 0;
+    }
+    // bytes * (tsc_hz / 1MHz) * 100 / (cycles * 1000) == GB/s * 100
+    return (uint32_t)((bytes * (tsc_hz / 1000000) * 100) / (cycles * 1000));
+}
+
+size_t flux_memops_benchmark(flux_memops_bench_t* results, size_t max_results,
+                             uint64_t tsc_hz) {
+    size_t class_count = sizeof(g_memops_bench_sizes) / sizeof(g_memops_bench_sizes[0]);
+    size_t max_size = g_memops_bench_sizes[class_count - 1];
+    
+    if (!results || max_results == 0) {
+        return 0;
+    }
+    
+    uint8_t* src = flux_allocate(NULL, max_size, FLUX_ALLOC_KERNEL | FLUX_ALLOC_LARGE);
+    uint8_t* dst = flux_allocate(NULL, max_size, FLUX_ALLOC_KERNEL | FLUX_ALLOC_LARGE);
+    if (!src || !dst) {
+        flux_free(src);
+        flux_free(dst);
+        return 0;
+    }
+    
+    // Touch both buffers so the first class doesn't pay for faults
+    memset(src, 0xA5, max_size);
+    memset(dst, 0, max_size);
+    
+    size_t count = 0;
+    for (size_t c = 0; c < class_count && count < max_results; c++) {
+        size_t size = g_memops_bench_sizes[c];
+        uint64_t iterations = MEMOPS_BENCH_BYTES / size;
+        if (iterations < MEMOPS_BENCH_MIN_ITERS) {
+            iterations = MEMOPS_BENCH_MIN_ITERS;
+        }
+        
+        uint64_t start = continuum_get_time();
+        for (uint64_t i = 0; i < iterations; i++) {
+            memcpy(dst, src, size);
+        }
+        uint64_t copy_cycles = continuum_get_time() - start;
+        
+        start = continuum_get_time();
+        for (uint64_t i = 0; i < iterations; i++) {
+            memset(dst, (int)i, size);
+        }
+        uint64_t set_cycles = continuum_get_time() - start;
+        
+        flux_memops_bench_t* r = &results[count++];
+        r->size = size;
+        r->iterations = iterations;
+        r->copy_cycles = copy_cycles;
+        r->set_cycles = set_cycles;
+        r->copy_gbps_x100 = memops_gbps_x100(size * iterations, copy_cycles, tsc_hz);
+        r->set_gbps_x100 = memops_gbps_x100(size * iterations, set_cycles, tsc_hz);
+        r->impl = g_memops.impl;
+    }
+    
+    flux_free(src);
+    flux_free(dst);
+    return count;
+}
@@ -16,9 +16,11 @@
 // =============================================================================
 
 #define MAX_DOMAINS                 256
-#define MAX_REGIONS_PER_DOMAIN      1024
+#define FLUX_MAX_SHRINKERS          8
 #define FLUX_PAGE_SIZE              4096
 #define FLUX_HUGE_PAGE_SIZE         (2 * 1024 * 1024)
+#define FLUX_CPU_MASK_WORDS         (MAX_CPU_CORES / 64)
+#define FLUX_TLB_SHOOTDOWN_VECTOR   0xFD
 
 // Allocation flags
 #define FLUX_ALLOC_KERNEL           (1 << 0)
@@ -39,6 +41,8 @@
 #define FLUX_MAP_SHARED            (1 << 5)
 #define FLUX_MAP_HUGE              (1 << 6)
 #define FLUX_MAP_NOCACHE           (1 << 7)
+#define FLUX_MAP_PRIVATE           (1 << 8)   // Anonymous memory, may be compressed
+#define FLUX_MAP_NOHUGE            (1 << 9)   // Never use 2MB pages for this range
 
 // Region flags
 #define REGION_FLAG_ALLOCATED       (1 << 0)
@@ -58,15 +62,23 @@
 typedef struct memory_domain memory_domain_t;
 typedef struct memory_region memory_region_t;
 typedef struct slab_cache slab_cache_t;
+typedef struct flux_region_ops flux_region_ops_t;
+struct slab_magazine;
+struct slab_cpu_cache;
 
-// Memory region
+// Memory region (node in the domain's interval tree)
 struct memory_region {
     uint64_t base_addr;
     size_t size;
     uint32_t flags;
     uint32_t protection;
     uint64_t physical_addr;
-    struct memory_region* next;
+    const flux_region_ops_t* ops;   // Filled on demand (flux_map_lazy) when set
+    void* private_data;
+    struct memory_region* left;
+    struct memory_region* right;
+    uint64_t subtree_end;       // Highest base_addr + size in this subtree
+    int32_t height;
 };
 
 // Memory domain
@@ -74,13 +86,25 @@ struct memory_domain {
     uint32_t domain_id;
     quantum_id_t owner_qid;
     uint64_t page_table_base;
-    memory_region_t regions[MAX_REGIONS_PER_DOMAIN];
+    memory_region_t* region_root;
     uint32_t region_count;
     size_t total_size;
     uint32_t flags;
+    uint64_t compact_cursor;    // Where the compactor resumes its scan
+    uint64_t collapse_cursor;   // Where huge page collapse resumes
+    uint64_t tlb_gen;           // Bumped on every shootdown
+    uint64_t tlb_cpus[FLUX_CPU_MASK_WORDS];  // CPUs that may cache translations
+    uint32_t region_faults;     // flux_region_ops_t faults running unlocked
     spinlock_t lock;
 };
 
+// Pending TLB invalidations for one domain, flushed with a single shootdown
+typedef struct {
+    memory_domain_t* domain;
+    uint64_t start;
+    uint64_t end;
+} flux_tlb_batch_t;
+
 // Slab object
 typedef struct slab {
     struct slab* next;
@@ -89,6 +113,7 @@ typedef struct slab {
     void* free_list;
     uint32_t free_count;
     uint32_t color_offset;
+    uint32_t owner_cpu;     // CPU that created the slab
 } slab_t;
 
 // Slab cache
@@ -101,8 +126,28 @@ struct slab_cache {
     uint64_t total_objects;
     uint64_t free_objects;
     spinlock_t lock;
+    
+    // Magazine layer: per-CPU caches plus a shared depot
+    struct slab_cpu_cache* cpu_caches;  // MAX_CPU_CORES entries
+    struct slab_magazine* depot_full;
+    struct slab_magazine* depot_empty;
+    uint32_t depot_full_count;
+    uint32_t depot_empty_count;
+    spinlock_t depot_lock;
 };
 
+// Per-cache statistics (summed over CPUs)
+typedef struct {
+    size_t object_size;
+    uint64_t total_objects;
+    uint64_t free_objects;          // Free inside slabs
+    uint64_t magazine_objects;      // Held in CPU magazines and the depot
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t depot_exchanges;
+    uint64_t remote_frees;          // Freed on a CPU other than the slab's
+} flux_slab_stats_t;
+
 // Memory statistics
 typedef struct {
     uint64_t total_memory;
@@ -114,8 +159,72 @@ typedef struct {
     uint32_t compression_ratio;
     uint64_t cow_faults;
     uint64_t page_faults;
+    
+    // Per-CPU frame magazines (summed over CPUs)
+    uint64_t frame_magazine_hits;
+    uint64_t frame_magazine_misses;
+    uint64_t frame_magazine_refills;
+    uint64_t frame_magazine_drains;
+    uint64_t frame_magazine_cached;
+    
+    // Compressed page tier
+    uint64_t compressed_bytes;          // Payload held in the pool
+    uint64_t compression_pool_pages;    // Frames backing the pool
+    uint64_t compression_rejects;       // Pages that didn't compress or fit
+    uint64_t decompressions;
+    uint64_t decompress_cycles_avg;
+    uint64_t decompress_cycles_max;
+    uint64_t compactor_passes;
+    
+    // Huge pages
+    uint64_t huge_mappings;             // 2MB mappings made by flux_map_region
+    uint64_t huge_splits;
+    uint64_t huge_collapses;
+    
+    // TLB shootdown
+    uint64_t tlb_shootdowns;
+    uint64_t tlb_ipis;
+    uint64_t tlb_full_flushes;          // CR3 reloads instead of invlpg runs
+    uint64_t tlb_pcid_hits;             // Switches that kept a tagged TLB
+    uint64_t tlb_shootdown_cycles_avg;
+    uint64_t tlb_shootdown_cycles_max;
 } flux_stats_t;
 
+// Memory operation implementations (selected once at boot)
+typedef enum {
+    FLUX_MEMOPS_WORD = 0,   // Portable 64-bit word loops
+    FLUX_MEMOPS_SSE2,       // 128-bit bulk loops
+    FLUX_MEMOPS_AVX2,       // 256-bit bulk loops
+    FLUX_MEMOPS_ERMS        // rep movsb/stosb for large sizes
+} flux_memops_impl_t;
+
+// Memory operation benchmark result (one per size class)
+typedef struct {
+    size_t size;
+    uint64_t iterations;
+    uint64_t copy_cycles;
+    uint64_t set_cycles;
+    uint32_t copy_gbps_x100;    // GB/s * 100
+    uint32_t set_gbps_x100;
+    flux_memops_impl_t impl;
+} flux_memops_bench_t;
+
+// A cache outside flux that gives memory back under pressure: free up to
+// pages frames' worth and return how many were released. Called without
+// flux locks held, never from interrupt context.
+typedef size_t (*flux_shrinker_t)(size_t pages, void* context);
+
+// Fills a region mapped with flux_map_lazy as it's touched. fault gets the
+// page-aligned address, and write is set for a store (possibly to a page
+// already mapped read-only); it returns 0 with the frame to map there and
+// the FLUX_MAP_* flags to map it with, or a negative errno. Called without
+// flux locks held, and may sleep. Frames are never freed by flux: they
+// stay the ops' to release after flux_unmap_region.
+struct flux_region_ops {
+    int (*fault)(void* private_data, uint64_t vaddr, bool write, uint64_t* paddr,
+                 uint32_t* flags);
+};
+
 // Global memory state
 typedef struct {
     bool initialized;
@@ -146,18 +255,45 @@ void* flux_reallocate(void* ptr, size_t new_size);
 // Memory mapping
 void* flux_map_region(memory_domain_t* domain, uint64_t vaddr, 
                      uint64_t paddr, size_t size, uint32_t flags);
+void* flux_map_lazy(memory_domain_t* domain, uint64_t vaddr, size_t size, uint32_t flags,
+                    const flux_region_ops_t* ops, void* private_data);
 void flux_unmap_region(memory_domain_t* domain, uint64_t vaddr, size_t size);
+void flux_write_protect(memory_domain_t* domain, uint64_t vaddr, size_t size);
 void flux_protect_region(memory_domain_t* domain, uint64_t vaddr, 
                         size_t size, uint32_t protection);
+memory_region_t* flux_find_region(memory_domain_t* domain, uint64_t addr);
 
 // Copy-on-Write
 void flux_mark_cow(memory_domain_t* domain, uint64_t vaddr, size_t size);
 void flux_handle_cow_fault(memory_domain_t* domain, uint64_t fault_addr);
 
+// Page transfer between domains
+int flux_grab_pages(memory_domain_t* domain, uint64_t vaddr, size_t size,
+                    uint64_t* frames, bool move);
+uint64_t flux_place_pages(memory_domain_t* domain, const uint64_t* frames,
+                          size_t count, uint32_t flags);
+void flux_put_pages(const uint64_t* frames, size_t count);
+void flux_ref_page(uint64_t paddr);
+
 // Page compression
-void flux_compress_page(uint64_t paddr);
-void flux_decompress_page(uint64_t paddr);
-bool flux_is_compressed(uint64_t paddr);
+int flux_compress_page(memory_domain_t* domain, uint64_t vaddr);
+int flux_decompress_page(memory_domain_t* domain, uint64_t vaddr);
+bool flux_is_compressed(memory_domain_t* domain, uint64_t vaddr);
+size_t flux_compactor_scan(memory_domain_t* domain, size_t budget);
+void flux_compactor_start(void);
+
+// Memory pressure
+int flux_register_shrinker(flux_shrinker_t shrinker, void* context);
+void flux_unregister_shrinker(flux_shrinker_t shrinker, void* context);
+size_t flux_reclaim(size_t pages);
+bool flux_memory_low(void);
+
+// Huge pages
+size_t flux_collapse_scan(memory_domain_t* domain, size_t budget);
+
+// Page faults
+int flux_handle_page_fault(memory_domain_t* domain, uint64_t fault_addr,
+                           uint64_t error_code);
 
 // Shared memory
 void* flux_create_shared(size_t size, const char* name);
@@ -166,16 +302,35 @@ void flux_detach_shared(void* addr);
 
 // Statistics
 void flux_get_stats(flux_stats_t* stats);
+size_t flux_get_slab_stats(flux_slab_stats_t* stats, size_t max_caches);
+void flux_slab_reap(void);
 size_t flux_get_domain_usage(memory_domain_t* domain);
 
 // Helper functions
 uint64_t flux_translate_address(memory_domain_t* domain, uint64_t vaddr);
+int flux_copy_to_domain(memory_domain_t* domain, uint64_t vaddr,
+                        const void* src, size_t size);
+uint64_t flux_dma_address(memory_domain_t* domain, uint64_t vaddr, bool device_writes);
 void flux_flush_tlb(uint64_t addr, size_t size);
+
+// TLB maintenance
+void flux_tlb_init(uint64_t cpu_features);
+uint64_t flux_tlb_switch(memory_domain_t* domain, uint64_t cr3);
+void flux_tlb_shootdown(memory_domain_t* domain, uint64_t addr, size_t size);
+void flux_tlb_shootdown_ipi(void);
+void flux_tlb_batch_init(flux_tlb_batch_t* batch, memory_domain_t* domain);
+void flux_tlb_batch_add(flux_tlb_batch_t* batch, uint64_t addr, size_t size);
+void flux_tlb_batch_flush(flux_tlb_batch_t* batch);
 uint64_t flux_get_pte(memory_domain_t* domain, uint64_t vaddr);
 void flux_set_pte(memory_domain_t* domain, uint64_t vaddr, uint64_t pte);
 void flux_unref_page(uint64_t paddr);
 
 // Memory operations
+void flux_memops_init(uint64_t cpu_features);
+flux_memops_impl_t flux_memops_get_impl(void);
+const char* flux_memops_impl_name(flux_memops_impl_t impl);
+size_t flux_memops_benchmark(flux_memops_bench_t* results, size_t max_results,
+                             uint64_t tsc_hz);
 void* memset(void* dest, int val, size_t len);
 void* memcpy(void* dest, const void* src, size_t len);
 void* memmove(void* dest, const void* src, size_t len);
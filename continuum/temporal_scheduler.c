@@ -6,6 +6,7 @@
 #include "temporal_scheduler.h"
 #include "continuum_core.h"
 #include "flux_memory.h"
+#include "continuum_trace.h"
 
 // =============================================================================
 // Global Scheduler State
@@ -13,39 +14,70 @@
 
 static temporal_scheduler_t g_scheduler = {
     .initialized = false,
-    .running = false,
-    .total_quanta = 0,
-    .total_switches = 0,
-    .scheduler_ticks = 0
+    .running = false
 };
 
-static scheduler_queue_t g_ready_queues[PRIORITY_MAX];
 static quantum_context_t* g_idle_quantum;
-static spinlock_t g_scheduler_lock = SPINLOCK_INIT;
 
-// Per-CPU run queues
-static struct {
+// Per-CPU run queues. Each CPU schedules from its own priority queues;
+// only enqueue onto a remote CPU, stealing and balancing touch another
+// CPU's lock.
+typedef struct {
+    spinlock_t lock;
+    scheduler_queue_t queues[PRIORITY_MAX];
+    uint32_t ready_mask;        // Bit per priority with queued quanta
+    uint32_t nr_queued;
     quantum_context_t* current;
     quantum_context_t* next;
     uint64_t last_switch;
     uint32_t load;
-} g_cpu_queues[MAX_CPU_CORES];
+    uint32_t rng;               // Steal victim selection
+    uint64_t balance_time;
+    temporal_timer_t tick_timer;    // Armed only while running a quantum
+    uint64_t slice_end;         // TSC the running quantum's slice ends at
+    uint64_t donated_end;       // Slice end lent by temporal_handoff
+    uint64_t steals;
+    uint64_t migrations;
+    uint64_t tick_stops;
+    uint64_t handoffs;
+    quantum_context_t* fpu_owner;   // Quantum whose vector state is live in the registers
+    bool fpu_ts;                // CR0.TS currently set
+    uint64_t fpu_faults;
+    uint64_t fpu_saves;
+} __attribute__((aligned(64))) cpu_runqueue_t;
+
+static cpu_runqueue_t g_cpu_queues[MAX_CPU_CORES];
+
+// Per-CPU timer heaps, min-ordered on deadline
+typedef struct {
+    spinlock_t lock;
+    temporal_timer_t* heap[TEMPORAL_TIMERS_PER_CPU];
+    uint32_t count;
+    uint64_t programmed;        // Deadline the local APIC is armed for, 0 if none
+    uint64_t interrupts;
+    uint64_t fired;
+} __attribute__((aligned(64))) timer_base_t;
+
+static timer_base_t g_timer_bases[MAX_CPU_CORES];
+
+static void tick_timer_fire(temporal_timer_t* timer, void* arg);
+static void fpu_switch_out(cpu_runqueue_t* rq, quantum_context_t* quantum);
+static void fpu_switch_in(cpu_runqueue_t* rq);
 
 // =============================================================================
 // Queue Management
 // =============================================================================
 
+// Queue helpers; caller holds the owning run queue's lock
+
 static void queue_init(scheduler_queue_t* queue, priority_t priority) {
     queue->head = NULL;
     queue->tail = NULL;
     queue->count = 0;
     queue->priority = priority;
-    spinlock_init(&queue->lock);
 }
 
 static void queue_enqueue(scheduler_queue_t* queue, quantum_context_t* quantum) {
-    spinlock_acquire(&queue->lock);
-    
     quantum->next_ready = NULL;
     quantum->prev_ready = queue->tail;
     
@@ -57,34 +89,9 @@ static void queue_enqueue(scheduler_queue_t* queue, quantum_context_t* quantum)
     
     queue->tail = quantum;
     queue->count++;
-    
-    spinlock_release(&queue->lock);
-}
-
-static quantum_context_t* queue_dequeue(scheduler_queue_t* queue) {
-    spinlock_acquire(&queue->lock);
-    
-    quantum_context_t* quantum = queue->head;
-    if (quantum) {
-        queue->head = quantum->next_ready;
-        if (queue->head) {
-            queue->head->prev_ready = NULL;
-        } else {
-            queue->tail = NULL;
-        }
-        queue->count--;
-        
-        quantum->next_ready = NULL;
-        quantum->prev_ready = NULL;
-    }
-    
-    spinlock_release(&queue->lock);
-    return quantum;
 }
 
 static void queue_remove(scheduler_queue_t* queue, quantum_context_t* quantum) {
-    spinlock_acquire(&queue->lock);
-    
     if (quantum->prev_ready) {
         quantum->prev_ready->next_ready = quantum->next_ready;
     } else {
@@ -100,8 +107,127 @@ static void queue_remove(scheduler_queue_t* queue, quantum_context_t* quantum) {
     quantum->next_ready = NULL;
     quantum->prev_ready = NULL;
     queue->count--;
+}
+
+static quantum_context_t* queue_dequeue(scheduler_queue_t* queue) {
+    quantum_context_t* quantum = queue->head;
+    if (quantum) {
+        queue_remove(queue, quantum);
+    }
+    return quantum;
+}
+
+static priority_t quantum_priority(quantum_context_t* quantum) {
+    priority_t priority = quantum->scheduling.priority;
+    return priority < PRIORITY_MAX ? priority : PRIORITY_NORMAL;
+}
+
+static bool quantum_allowed_on(quantum_context_t* quantum, uint32_t cpu) {
+    if (quantum->scheduling.cpu_affinity == CPU_AFFINITY_ANY) {
+        return true;
+    }
+    return cpu < 64 && (quantum->scheduling.cpu_mask & (1ULL << cpu));
+}
+
+// Run queue operations; caller holds rq->lock
+
+static void rq_add(cpu_runqueue_t* rq, uint32_t cpu, quantum_context_t* quantum) {
+    priority_t priority = quantum_priority(quantum);
+    queue_enqueue(&rq->queues[priority], quantum);
+    rq->ready_mask |= 1U << priority;
+    rq->nr_queued++;
+    quantum->scheduling.rq_cpu = (int32_t)cpu;
+}
+
+static void rq_del(cpu_runqueue_t* rq, quantum_context_t* quantum) {
+    priority_t priority = quantum_priority(quantum);
+    queue_remove(&rq->queues[priority], quantum);
+    if (rq->queues[priority].count == 0) {
+        rq->ready_mask &= ~(1U << priority);
+    }
+    rq->nr_queued--;
+    quantum->scheduling.rq_cpu = -1;
+}
+
+// Highest-priority queued quantum, skipping PRIORITY_IDLE
+static quantum_context_t* rq_pick(cpu_runqueue_t* rq) {
+    uint32_t mask = rq->ready_mask & ~(1U << PRIORITY_IDLE);
+    if (!mask) {
+        return NULL;
+    }
+    
+    quantum_context_t* quantum = rq->queues[31 - __builtin_clz(mask)].head;
+    rq_del(rq, quantum);
+    return quantum;
+}
+
+// Most recently queued quantum allowed on cpu, highest priority first.
+// The tail has waited least on this CPU and is the coldest to move.
+static quantum_context_t* rq_pick_migratable(cpu_runqueue_t* rq, uint32_t cpu) {
+    uint32_t mask = rq->ready_mask & ~(1U << PRIORITY_IDLE);
+    
+    while (mask) {
+        int priority = 31 - __builtin_clz(mask);
+        mask &= ~(1U << priority);
+        
+        for (quantum_context_t* q = rq->queues[priority].tail; q; q = q->prev_ready) {
+            if (quantum_allowed_on(q, cpu)) {
+                rq_del(rq, q);
+                return q;
+            }
+        }
+    }
+    return NULL;
+}
+
+static uint32_t rq_random(cpu_runqueue_t* rq) {
+    // xorshift32
+    uint32_t x = rq->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rq->rng = x;
+    return x;
+}
+
+// Least busy of a few allowed candidates: the CPU the quantum last ran on
+// (cache-warm), the waking CPU and a random one. Pinned quanta only ever
+// land on a CPU in their mask.
+static uint32_t select_cpu(quantum_context_t* quantum) {
+    uint32_t self = temporal_get_current_cpu();
+    uint32_t cores = g_scheduler.num_cores;
+    
+    if (quantum->scheduling.cpu_affinity != CPU_AFFINITY_ANY) {
+        uint64_t mask = quantum->scheduling.cpu_mask;
+        if (cores < 64) {
+            mask &= (1ULL << cores) - 1;
+        }
+        if (!mask) {
+            return self;  // Nothing in the mask is online; don't strand it
+        }
+        uint32_t best = __builtin_ctzll(mask);
+        while (mask) {
+            uint32_t cpu = __builtin_ctzll(mask);
+            mask &= mask - 1;
+            if (g_cpu_queues[cpu].nr_queued < g_cpu_queues[best].nr_queued) {
+                best = cpu;
+            }
+        }
+        return best;
+    }
     
-    spinlock_release(&queue->lock);
+    uint32_t candidates[3] = {
+        quantum->scheduling.last_cpu,
+        self,
+        rq_random(&g_cpu_queues[self]) % cores
+    };
+    uint32_t best = candidates[0] < cores ? candidates[0] : self;
+    for (int i = 1; i < 3; i++) {
+        if (g_cpu_queues[candidates[i]].nr_queued < g_cpu_queues[best].nr_queued) {
+            best = candidates[i];
+        }
+    }
+    return best;
 }
 
 // =============================================================================
@@ -109,17 +235,42 @@ static void queue_remove(scheduler_queue_t* queue, quantum_context_t* quantum) {
 // =============================================================================
 
 void temporal_init(uint32_t num_cores) {
-    // Initialize ready queues
-    for (int i = 0; i < PRIORITY_MAX; i++) {
-        queue_init(&g_ready_queues[i], i);
+    if (num_cores == 0 || num_cores > MAX_CPU_CORES) {
+        num_cores = 1;
     }
     
-    // Initialize per-CPU structures
-    for (uint32_t i = 0; i < num_cores && i < MAX_CPU_CORES; i++) {
-        g_cpu_queues[i].current = NULL;
-        g_cpu_queues[i].next = NULL;
-        g_cpu_queues[i].last_switch = 0;
-        g_cpu_queues[i].load = 0;
+    // Initialize per-CPU run queues
+    for (uint32_t i = 0; i < num_cores; i++) {
+        cpu_runqueue_t* rq = &g_cpu_queues[i];
+        spinlock_init(&rq->lock);
+        for (int p = 0; p < PRIORITY_MAX; p++) {
+            queue_init(&rq->queues[p], p);
+        }
+        rq->ready_mask = 0;
+        rq->nr_queued = 0;
+        rq->current = NULL;
+        rq->next = NULL;
+        rq->last_switch = 0;
+        rq->load = 0;
+        rq->rng = (uint32_t)(continuum_get_time() ^ (i * 0x9E3779B9U)) | 1;
+        rq->balance_time = 0;
+        temporal_timer_init(&rq->tick_timer, tick_timer_fire, NULL);
+        rq->slice_end = 0;
+        rq->donated_end = 0;
+        rq->steals = 0;
+        rq->migrations = 0;
+        rq->tick_stops = 0;
+        rq->handoffs = 0;
+        rq->fpu_owner = NULL;
+        rq->fpu_ts = false;     // Boot runs with TS clear; the first switch sets it
+        rq->fpu_faults = 0;
+        rq->fpu_saves = 0;
+        
+        spinlock_init(&g_timer_bases[i].lock);
+        g_timer_bases[i].count = 0;
+        g_timer_bases[i].programmed = 0;
+        g_timer_bases[i].interrupts = 0;
+        g_timer_bases[i].fired = 0;
     }
     
     // Create idle quantum
@@ -128,6 +279,7 @@ void temporal_init(uint32_t num_cores) {
     g_idle_quantum->qid = IDLE_QUANTUM_ID;
     g_idle_quantum->state = QUANTUM_STATE_READY;
     g_idle_quantum->scheduling.priority = PRIORITY_IDLE;
+    g_idle_quantum->scheduling.rq_cpu = -1;
     strncpy(g_idle_quantum->name, "idle", sizeof(g_idle_quantum->name));
     
     g_scheduler.num_cores = num_cores;
@@ -158,20 +310,27 @@ void temporal_stop(void) {
 // =============================================================================
 
 void temporal_enqueue(quantum_context_t* quantum) {
-    if (!quantum || quantum->state != QUANTUM_STATE_READY) {
+    if (!quantum || quantum->state != QUANTUM_STATE_READY ||
+        quantum == g_idle_quantum || quantum->scheduling.rq_cpu >= 0) {
         return;
     }
     
-    priority_t priority = quantum->scheduling.priority;
-    if (priority >= PRIORITY_MAX) {
-        priority = PRIORITY_NORMAL;
-    }
+    uint32_t cpu = g_scheduler.initialized ? select_cpu(quantum) : 0;
+    cpu_runqueue_t* rq = &g_cpu_queues[cpu];
     
-    queue_enqueue(&g_ready_queues[priority], quantum);
-    g_scheduler.total_quanta++;
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&rq->lock);
+    rq_add(rq, cpu, quantum);
+    bool idle = !rq->current || rq->current == g_idle_quantum;
+    spinlock_release(&rq->lock);
+    cpu_irq_restore(flags);
     
-    // Wake up idle CPUs if needed
-    temporal_wake_idle_cpu();
+    continuum_counter_inc(COUNTER_SCHED_QUANTA);
+    
+    // Kick the target if it has nothing to run
+    if (idle && cpu != temporal_get_current_cpu()) {
+        temporal_wake_cpu(cpu);
+    }
 }
 
 void temporal_remove_quantum(quantum_context_t* quantum) {
@@ -179,14 +338,25 @@ void temporal_remove_quantum(quantum_context_t* quantum) {
         return;
     }
     
-    // Remove from ready queue if present
-    for (int i = 0; i < PRIORITY_MAX; i++) {
-        if (g_ready_queues[i].count > 0) {
-            queue_remove(&g_ready_queues[i], quantum);
+    // The quantum can migrate between reading rq_cpu and taking the lock
+    uint64_t flags = cpu_irq_save();
+    for (;;) {
+        int32_t cpu = __atomic_load_n(&quantum->scheduling.rq_cpu, __ATOMIC_ACQUIRE);
+        if (cpu < 0) {
+            break;
         }
+        cpu_runqueue_t* rq = &g_cpu_queues[cpu];
+        spinlock_acquire(&rq->lock);
+        if (quantum->scheduling.rq_cpu == cpu) {
+            rq_del(rq, quantum);
+            spinlock_release(&rq->lock);
+            break;
+        }
+        spinlock_release(&rq->lock);
     }
+    cpu_irq_restore(flags);
     
-    g_scheduler.total_quanta--;
+    continuum_counter_add(COUNTER_SCHED_QUANTA, (uint64_t)-1);
 }
 
 void temporal_yield(quantum_context_t* quantum) {
@@ -209,9 +379,20 @@ void temporal_block(quantum_context_t* quantum, block_reason_t reason) {
         quantum = temporal_get_current();
     }
     
-    quantum->state = QUANTUM_STATE_BLOCKED;
+    quantum_state_t was = quantum->state;
     quantum->scheduling.block_reason = reason;
     quantum->scheduling.block_time = continuum_get_time();
+    __atomic_store_n(&quantum->state, QUANTUM_STATE_BLOCKED, __ATOMIC_SEQ_CST);
+    
+    // A wakeup that came before the quantum was marked blocked is waiting
+    // for it. Take it back unless the waker has already seen BLOCKED too.
+    quantum_state_t blocked = QUANTUM_STATE_BLOCKED;
+    if (__atomic_exchange_n(&quantum->scheduling.wake_pending, false, __ATOMIC_SEQ_CST) &&
+        __atomic_compare_exchange_n(&quantum->state, &blocked, was, false, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_RELAXED)) {
+        quantum->scheduling.block_reason = BLOCK_NONE;
+        return;
+    }
     
     // Remove from CPU
     uint32_t cpu = temporal_get_current_cpu();
@@ -221,51 +402,202 @@ void temporal_block(quantum_context_t* quantum, block_reason_t reason) {
     }
 }
 
+static void sleep_timer_fire(temporal_timer_t* timer, void* arg) {
+    (void)timer;
+    temporal_unblock((quantum_context_t*)arg);
+}
+
+// Block the current quantum for usec microseconds. The wakeup comes from
+// a one-shot timer at the exact deadline rather than the next tick.
+void temporal_sleep(uint64_t usec) {
+    uint64_t deadline = continuum_get_time() + continuum_usec_to_tsc(usec);
+    quantum_context_t* current = temporal_get_current();
+    
+    if (current && current != g_idle_quantum && g_scheduler.running) {
+        temporal_timer_t timer;
+        temporal_timer_init(&timer, sleep_timer_fire, current);
+        
+        // The timer lives on this CPU, so with interrupts off it can't
+        // fire before the quantum is marked blocked
+        uint64_t flags = cpu_irq_save();
+        bool armed = temporal_timer_start(&timer, deadline) == 0;
+        if (armed) {
+            temporal_block(current, BLOCK_SLEEP);
+        }
+        cpu_irq_restore(flags);
+        
+        temporal_timer_cancel(&timer);  // Woken early by someone else
+        if (armed) {
+            return;
+        }
+    }
+    
+    // No quantum to block, or this CPU's timer heap is full
+    while (continuum_get_time() < deadline) {
+        if (current && current != g_idle_quantum && g_scheduler.running) {
+            temporal_yield(current);
+        } else {
+            __asm__ __volatile__("pause");
+        }
+    }
+}
+
+// Wake quantum. One not blocked yet, whose waker got in between it
+// publishing itself and calling temporal_block, keeps the wakeup pending
+// and its next temporal_block returns at once, so blocking callers must
+// recheck their condition.
 void temporal_unblock(quantum_context_t* quantum) {
-    if (!quantum || quantum->state != QUANTUM_STATE_BLOCKED) {
+    if (!quantum) {
         return;
     }
     
-    quantum->state = QUANTUM_STATE_READY;
+    quantum_state_t blocked = QUANTUM_STATE_BLOCKED;
+    if (!__atomic_compare_exchange_n(&quantum->state, &blocked, QUANTUM_STATE_READY, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        if (blocked == QUANTUM_STATE_TERMINATED) {
+            return;
+        }
+        
+        // Pending first, then recheck: either temporal_block sees the flag
+        // or this sees it blocked
+        __atomic_store_n(&quantum->scheduling.wake_pending, true, __ATOMIC_SEQ_CST);
+        blocked = QUANTUM_STATE_BLOCKED;
+        if (!__atomic_compare_exchange_n(&quantum->state, &blocked, QUANTUM_STATE_READY, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return;
+        }
+        __atomic_store_n(&quantum->scheduling.wake_pending, false, __ATOMIC_RELAXED);
+    }
+    
     quantum->scheduling.block_reason = BLOCK_NONE;
     
     // Add back to ready queue
     temporal_enqueue(quantum);
 }
 
+// Direct switch for synchronous IPC: run target, which the caller has just
+// satisfied, on this CPU for what is left of the current quantum's slice.
+// The current quantum stays runnable and goes back on its queue. Returns
+// false without touching target if it can't run here right now.
+bool temporal_handoff(quantum_context_t* target) {
+    uint32_t cpu = temporal_get_current_cpu();
+    cpu_runqueue_t* rq = &g_cpu_queues[cpu];
+    quantum_context_t* current = rq->current;
+    
+    if (!g_scheduler.running || !target || target == current || !current ||
+        current == g_idle_quantum || !quantum_allowed_on(target, cpu)) {
+        return false;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&rq->lock);
+    
+    // A target still on its way off another CPU gets the normal wakeup
+    bool switched_out = g_cpu_queues[target->scheduling.last_cpu].current != target;
+    quantum_state_t blocked = QUANTUM_STATE_BLOCKED;
+    if (rq->next || !switched_out ||
+        !__atomic_compare_exchange_n(&target->state, &blocked, QUANTUM_STATE_READY,
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        spinlock_release(&rq->lock);
+        cpu_irq_restore(flags);
+        return false;
+    }
+    
+    target->scheduling.block_reason = BLOCK_NONE;
+    rq->next = target;
+    rq->donated_end = rq->slice_end;
+    rq->handoffs++;
+    spinlock_release(&rq->lock);
+    
+    temporal_schedule();
+    cpu_irq_restore(flags);
+    return true;
+}
+
 // =============================================================================
 // Core Scheduling Algorithm
 // =============================================================================
 
+// Randomized work stealing: probe up to TEMPORAL_STEAL_ATTEMPTS victims
+// starting at a random CPU and take one quantum from the first that has
+// work this CPU may run
+static quantum_context_t* steal_quantum(uint32_t cpu_id) {
+    uint32_t cores = g_scheduler.num_cores;
+    if (cores < 2) {
+        return NULL;
+    }
+    
+    cpu_runqueue_t* self = &g_cpu_queues[cpu_id];
+    uint32_t victim = rq_random(self) % cores;
+    uint32_t attempts = cores - 1 < TEMPORAL_STEAL_ATTEMPTS ? cores - 1 : TEMPORAL_STEAL_ATTEMPTS;
+    
+    for (uint32_t i = 0; i < attempts; i++, victim = (victim + 1) % cores) {
+        if (victim == cpu_id) {
+            victim = (victim + 1) % cores;
+        }
+        cpu_runqueue_t* rq = &g_cpu_queues[victim];
+        if (__atomic_load_n(&rq->nr_queued, __ATOMIC_RELAXED) == 0) {
+            continue;  // Peek without the lock; a miss only delays the steal
+        }
+        
+        spinlock_acquire(&rq->lock);
+        quantum_context_t* stolen = rq_pick_migratable(rq, cpu_id);
+        spinlock_release(&rq->lock);
+        
+        if (stolen) {
+            self->steals++;
+            return stolen;
+        }
+    }
+    return NULL;
+}
+
 static quantum_context_t* select_next_quantum(uint32_t cpu_id) {
+    cpu_runqueue_t* rq = &g_cpu_queues[cpu_id];
     quantum_context_t* next = NULL;
     
+    spinlock_acquire(&rq->lock);
+    
     // Check for explicitly scheduled quantum
-    if (g_cpu_queues[cpu_id].next) {
-        next = g_cpu_queues[cpu_id].next;
-        g_cpu_queues[cpu_id].next = NULL;
-        return next;
-    }
-    
-    // Priority-based selection
-    for (int priority = PRIORITY_REALTIME; priority >= PRIORITY_LOW; priority--) {
-        if (g_ready_queues[priority].count > 0) {
-            next = queue_dequeue(&g_ready_queues[priority]);
-            if (next) {
-                // Check CPU affinity
-                if (next->scheduling.cpu_affinity == CPU_AFFINITY_ANY ||
-                    (next->scheduling.cpu_mask & (1ULL << cpu_id))) {
-                    return next;
-                } else {
-                    // Wrong CPU, re-enqueue
-                    queue_enqueue(&g_ready_queues[priority], next);
-                }
-            }
-        }
+    if (rq->next) {
+        next = rq->next;
+        rq->next = NULL;
+    } else {
+        next = rq_pick(rq);
+    }
+    
+    spinlock_release(&rq->lock);
+    
+    if (!next) {
+        next = steal_quantum(cpu_id);
     }
     
     // No ready quantum, return idle
-    return g_idle_quantum;
+    return next ? next : g_idle_quantum;
+}
+
+// Dynamic tick: a CPU running a quantum gets a tick at the end of its
+// slice; an idle CPU gets none and sleeps until its next timer or IPI
+static void tick_update(cpu_runqueue_t* rq, quantum_context_t* next) {
+    if (next == g_idle_quantum) {
+        if (temporal_timer_cancel(&rq->tick_timer)) {
+            rq->tick_stops++;
+        }
+        return;
+    }
+    
+    uint64_t now = continuum_get_time();
+    uint64_t deadline = rq->donated_end;
+    rq->donated_end = 0;
+    if (deadline <= now) {
+        uint64_t slice = continuum_usec_to_tsc(next->scheduling.time_slice);
+        deadline = rq->last_switch + slice;
+        if (deadline <= now) {
+            deadline = now + slice;
+        }
+    }
+    rq->slice_end = deadline;
+    temporal_timer_start(&rq->tick_timer, deadline);
 }
 
 void temporal_schedule(void) {
@@ -273,23 +605,40 @@ void temporal_schedule(void) {
         return;
     }
     
+    uint64_t flags = cpu_irq_save();
+    
     uint32_t cpu_id = temporal_get_current_cpu();
-    quantum_context_t* current = g_cpu_queues[cpu_id].current;
+    cpu_runqueue_t* rq = &g_cpu_queues[cpu_id];
+    quantum_context_t* current = rq->current;
     quantum_context_t* next = select_next_quantum(cpu_id);
     
+    // An idle CPU keeps running a still-runnable current quantum
+    if (next == g_idle_quantum && current && current != g_idle_quantum &&
+        current->state == QUANTUM_STATE_RUNNING) {
+        next = current;
+    }
+    
     if (next == current) {
         // Same quantum continues
+        if (current && current != g_idle_quantum) {
+            current->state = QUANTUM_STATE_RUNNING;
+        }
+        if (current) {
+            tick_update(rq, current);
+        }
+        cpu_irq_restore(flags);
         return;
     }
     
     // Perform context switch
     if (current && current != g_idle_quantum) {
-        // Save current context
+        // Save current context; vector state only if it was loaded this slice
+        fpu_switch_out(rq, current);
         temporal_save_context(current);
         
         // Update statistics
         uint64_t now = continuum_get_time();
-        uint64_t runtime = now - g_cpu_queues[cpu_id].last_switch;
+        uint64_t runtime = now - rq->last_switch;
         current->stats.cpu_time += runtime;
         
         // Re-enqueue if still ready
@@ -299,12 +648,21 @@ void temporal_schedule(void) {
         }
     }
     
+    TRACE(TRACE_SCHED_SWITCH, current ? current->state : QUANTUM_STATE_READY,
+          current && current != g_idle_quantum ? current->qid : 0,
+          next != g_idle_quantum ? next->qid : 0);
+    
     // Switch to next quantum
-    g_cpu_queues[cpu_id].current = next;
-    g_cpu_queues[cpu_id].last_switch = continuum_get_time();
+    rq->current = next;
+    rq->last_switch = continuum_get_time();
     next->state = QUANTUM_STATE_RUNNING;
+    next->scheduling.last_cpu = cpu_id;
     next->stats.context_switches++;
-    g_scheduler.total_switches++;
+    continuum_counter_inc(COUNTER_SCHED_SWITCHES);
+    tick_update(rq, next);
+    fpu_switch_in(rq);
+    
+    cpu_irq_restore(flags);
     
     // Load new context
     temporal_load_context(next);
@@ -315,23 +673,31 @@ void temporal_schedule(void) {
 // =============================================================================
 
 void temporal_tick(void) {
-    g_scheduler.scheduler_ticks++;
+    continuum_counter_inc(COUNTER_SCHED_TICKS);
     
     uint32_t cpu_id = temporal_get_current_cpu();
     quantum_context_t* current = g_cpu_queues[cpu_id].current;
     
+    uint64_t now = continuum_get_time();
+    if (now >= g_cpu_queues[cpu_id].balance_time) {
+        g_cpu_queues[cpu_id].balance_time = now + continuum_usec_to_tsc(TEMPORAL_BALANCE_INTERVAL);
+        temporal_balance_load();
+    }
+    
     if (!current || current == g_idle_quantum) {
         // CPU is idle
         g_cpu_queues[cpu_id].load = 0;
+        if (g_cpu_queues[cpu_id].nr_queued > 0) {
+            temporal_schedule();
+        }
         return;
     }
     
     // Update load tracking
     g_cpu_queues[cpu_id].load = (g_cpu_queues[cpu_id].load * 7 + 100) / 8;
     
-    // Check time slice expiration
-    uint64_t runtime = continuum_get_time() - g_cpu_queues[cpu_id].last_switch;
-    if (runtime >= current->scheduling.time_slice) {
+    // Check time slice expiration (donated slices end early)
+    if (continuum_get_time() >= g_cpu_queues[cpu_id].slice_end) {
         // Time slice expired, reschedule
         temporal_schedule();
     }
@@ -347,6 +713,165 @@ void temporal_tick(void) {
     }
 }
 
+// =============================================================================
+// High-Resolution Timers
+// =============================================================================
+
+static void timer_heap_swap(timer_base_t* base, uint32_t a, uint32_t b) {
+    temporal_timer_t* t = base->heap[a];
+    base->heap[a] = base->heap[b];
+    base->heap[b] = t;
+    base->heap[a]->heap_index = (int32_t)a;
+    base->heap[b]->heap_index = (int32_t)b;
+}
+
+static void timer_heap_up(timer_base_t* base, uint32_t i) {
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (base->heap[parent]->deadline <= base->heap[i]->deadline) {
+            break;
+        }
+        timer_heap_swap(base, i, parent);
+        i = parent;
+    }
+}
+
+static void timer_heap_down(timer_base_t* base, uint32_t i) {
+    for (;;) {
+        uint32_t left = 2 * i + 1;
+        uint32_t smallest = i;
+        if (left < base->count && base->heap[left]->deadline < base->heap[smallest]->deadline) {
+            smallest = left;
+        }
+        if (left + 1 < base->count &&
+            base->heap[left + 1]->deadline < base->heap[smallest]->deadline) {
+            smallest = left + 1;
+        }
+        if (smallest == i) {
+            break;
+        }
+        timer_heap_swap(base, i, smallest);
+        i = smallest;
+    }
+}
+
+// Caller holds base->lock
+static void timer_heap_remove(timer_base_t* base, temporal_timer_t* timer) {
+    uint32_t i = (uint32_t)timer->heap_index;
+    base->count--;
+    if (i != base->count) {
+        base->heap[i] = base->heap[base->count];
+        base->heap[i]->heap_index = (int32_t)i;
+        timer_heap_up(base, i);
+        timer_heap_down(base, (uint32_t)base->heap[i]->heap_index);
+    }
+    timer->heap_index = -1;
+}
+
+// Point the local APIC at the earliest deadline. A cancelled head leaves
+// the old deadline programmed; that interrupt just finds nothing due.
+// Caller holds base->lock, on the CPU that owns base.
+static void timer_program(timer_base_t* base) {
+    uint64_t deadline = base->count ? base->heap[0]->deadline : 0;
+    if (deadline && base->programmed && base->programmed <= deadline) {
+        return;
+    }
+    base->programmed = deadline;
+    continuum_timer_arm(deadline);
+}
+
+void temporal_timer_init(temporal_timer_t* timer, temporal_timer_fn_t fn, void* arg) {
+    timer->deadline = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->heap_index = -1;
+    timer->cpu = 0;
+}
+
+// Arm timer on this CPU for TSC value deadline, moving it if already
+// armed. Returns -ENOSPC if this CPU has TEMPORAL_TIMERS_PER_CPU pending.
+int temporal_timer_start(temporal_timer_t* timer, uint64_t deadline) {
+    temporal_timer_cancel(timer);
+    
+    uint32_t cpu = temporal_get_current_cpu();
+    timer_base_t* base = &g_timer_bases[cpu];
+    int result = 0;
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&base->lock);
+    
+    if (base->count == TEMPORAL_TIMERS_PER_CPU) {
+        result = -ENOSPC;
+    } else {
+        timer->deadline = deadline ? deadline : 1;
+        timer->cpu = cpu;
+        timer->heap_index = (int32_t)base->count;
+        base->heap[base->count++] = timer;
+        timer_heap_up(base, (uint32_t)timer->heap_index);
+        timer_program(base);
+    }
+    
+    spinlock_release(&base->lock);
+    cpu_irq_restore(flags);
+    return result;
+}
+
+// Disarm timer; returns whether it was still pending. May be called from
+// any CPU.
+bool temporal_timer_cancel(temporal_timer_t* timer) {
+    if (__atomic_load_n(&timer->heap_index, __ATOMIC_ACQUIRE) < 0) {
+        return false;
+    }
+    
+    timer_base_t* base = &g_timer_bases[timer->cpu];
+    bool pending = false;
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&base->lock);
+    
+    if (timer->heap_index >= 0) {
+        timer_heap_remove(base, timer);
+        pending = true;
+    }
+    
+    spinlock_release(&base->lock);
+    cpu_irq_restore(flags);
+    return pending;
+}
+
+// TEMPORAL_TIMER_VECTOR handler: run everything that is due, then re-arm
+// for the next deadline
+void temporal_timer_interrupt(void) {
+    uint32_t cpu = temporal_get_current_cpu();
+    timer_base_t* base = &g_timer_bases[cpu];
+    
+    spinlock_acquire(&base->lock);
+    base->interrupts++;
+    base->programmed = 0;
+    
+    while (base->count && base->heap[0]->deadline <= continuum_get_time()) {
+        temporal_timer_t* timer = base->heap[0];
+        timer_heap_remove(base, timer);
+        base->fired++;
+        
+        // Callbacks may re-arm their timer, so run them unlocked
+        spinlock_release(&base->lock);
+        timer->fn(timer, timer->arg);
+        spinlock_acquire(&base->lock);
+    }
+    
+    timer_program(base);
+    spinlock_release(&base->lock);
+    
+    continuum_apic_eoi();
+}
+
+static void tick_timer_fire(temporal_timer_t* timer, void* arg) {
+    (void)timer;
+    (void)arg;
+    temporal_tick();
+}
+
 // =============================================================================
 // AI-Guided Optimization
 // =============================================================================
@@ -388,38 +913,73 @@ void temporal_update_ai_hints(nexus_hint_t* hints, size_t count) {
 // Load Balancing
 // =============================================================================
 
+// Pull-based balancing, run periodically by every CPU from its tick: move
+// half the queue-length difference from the busiest CPU to this one.
+// Between balancing passes, idle CPUs steal instead.
 void temporal_balance_load(void) {
-    // Simple load balancing algorithm
-    uint32_t min_load = UINT32_MAX;
-    uint32_t max_load = 0;
-    uint32_t min_cpu = 0;
-    uint32_t max_cpu = 0;
+    uint32_t self = temporal_get_current_cpu();
+    cpu_runqueue_t* rq = &g_cpu_queues[self];
     
-    // Find most and least loaded CPUs
+    uint32_t busiest = self;
+    uint32_t max_queued = 0;
     for (uint32_t i = 0; i < g_scheduler.num_cores; i++) {
-        uint32_t load = g_cpu_queues[i].load;
-        if (load < min_load) {
-            min_load = load;
-            min_cpu = i;
-        }
-        if (load > max_load) {
-            max_load = load;
-            max_cpu = i;
-        }
-    }
-    
-    // If imbalance is significant, migrate a quantum
-    if (max_load - min_load > 50) {  // 50% difference
-        // Find a quantum to migrate from max_cpu to min_cpu
-        quantum_context_t* current = g_cpu_queues[max_cpu].current;
-        if (current && current != g_idle_quantum &&
-            current->scheduling.cpu_affinity == CPU_AFFINITY_ANY) {
-            // Schedule this quantum on the less loaded CPU
-            g_cpu_queues[min_cpu].next = current;
-            g_cpu_queues[max_cpu].current = NULL;
-            temporal_schedule();
+        uint32_t queued = __atomic_load_n(&g_cpu_queues[i].nr_queued, __ATOMIC_RELAXED);
+        if (i != self && queued > max_queued) {
+            max_queued = queued;
+            busiest = i;
+        }
+    }
+    
+    uint32_t own = __atomic_load_n(&rq->nr_queued, __ATOMIC_RELAXED);
+    
+    // Idle CPUs have no tick to balance from; kick one to come and steal
+    if (own > 1) {
+        for (uint32_t i = 0; i < g_scheduler.num_cores; i++) {
+            quantum_context_t* current = __atomic_load_n(&g_cpu_queues[i].current,
+                                                         __ATOMIC_RELAXED);
+            if (i != self && (!current || current == g_idle_quantum)) {
+                temporal_wake_cpu(i);
+                break;
+            }
+        }
+    }
+    
+    if (busiest == self || max_queued <= own + 1) {
+        return;
+    }
+    
+    uint32_t to_move = (max_queued - own) / 2;
+    if (to_move > TEMPORAL_BALANCE_BATCH) {
+        to_move = TEMPORAL_BALANCE_BATCH;
+    }
+    
+    // Detach under the busiest CPU's lock, attach under ours; never both
+    quantum_context_t* moved[TEMPORAL_BALANCE_BATCH];
+    uint32_t count = 0;
+    
+    uint64_t flags = cpu_irq_save();
+    
+    cpu_runqueue_t* src = &g_cpu_queues[busiest];
+    spinlock_acquire(&src->lock);
+    while (count < to_move) {
+        quantum_context_t* quantum = rq_pick_migratable(src, self);
+        if (!quantum) {
+            break;
+        }
+        moved[count++] = quantum;
+    }
+    spinlock_release(&src->lock);
+    
+    if (count) {
+        spinlock_acquire(&rq->lock);
+        for (uint32_t i = 0; i < count; i++) {
+            rq_add(rq, self, moved[i]);
         }
+        rq->migrations += count;
+        spinlock_release(&rq->lock);
     }
+    
+    cpu_irq_restore(flags);
 }
 
 // =============================================================================
@@ -431,15 +991,34 @@ void temporal_get_stats(temporal_stats_t* stats) {
         return;
     }
     
-    stats->total_quanta = g_scheduler.total_quanta;
-    stats->total_switches = g_scheduler.total_switches;
-    stats->scheduler_ticks = g_scheduler.scheduler_ticks;
+    stats->total_quanta = continuum_counter_read(COUNTER_SCHED_QUANTA);
+    stats->total_switches = continuum_counter_read(COUNTER_SCHED_SWITCHES);
+    stats->scheduler_ticks = continuum_counter_read(COUNTER_SCHED_TICKS);
     stats->uptime = continuum_get_time() - g_scheduler.start_time;
     
     // Calculate ready queue lengths
     stats->ready_count = 0;
-    for (int i = 0; i < PRIORITY_MAX; i++) {
-        stats->ready_count += g_ready_queues[i].count;
+    stats->steals = 0;
+    stats->migrations = 0;
+    for (uint32_t i = 0; i < g_scheduler.num_cores; i++) {
+        stats->ready_count += g_cpu_queues[i].nr_queued;
+        stats->steals += g_cpu_queues[i].steals;
+        stats->migrations += g_cpu_queues[i].migrations;
+    }
+    
+    stats->timer_interrupts = 0;
+    stats->timers_fired = 0;
+    stats->tick_stops = 0;
+    stats->handoffs = 0;
+    stats->fpu_faults = 0;
+    stats->fpu_saves = 0;
+    for (uint32_t i = 0; i < g_scheduler.num_cores; i++) {
+        stats->timer_interrupts += g_timer_bases[i].interrupts;
+        stats->timers_fired += g_timer_bases[i].fired;
+        stats->tick_stops += g_cpu_queues[i].tick_stops;
+        stats->handoffs += g_cpu_queues[i].handoffs;
+        stats->fpu_faults += g_cpu_queues[i].fpu_faults;
+        stats->fpu_saves += g_cpu_queues[i].fpu_saves;
     }
     
     // Calculate CPU utilization
@@ -523,13 +1102,11 @@ void temporal_load_context(quantum_context_t* quantum) {
         return;
     }
     
-    // Load CR3 (switch page tables)
-    __asm__ __volatile__(
-        "movq %0, %%rax\n"
-        "movq %%rax, %%cr3\n"
-        : : "m"(quantum->register_state->cr3)
-        : "rax"
-    );
+    // Load CR3 (switch page tables); Flux picks the PCID and whether the
+    // tagged TLB entries are still good
+    uint64_t cr3 = flux_tlb_switch(quantum->memory_domain,
+                                   quantum->register_state->cr3);
+    __asm__ __volatile__("movq %0, %%cr3" : : "r"(cr3) : "memory");
     
     // Load general purpose registers
     __asm__ __volatile__(
@@ -581,6 +1158,318 @@ void temporal_load_context(quantum_context_t* quantum) {
     );
 }
 
+// =============================================================================
+// Extended State (FPU/SIMD)
+// =============================================================================
+
+// Vector state is switched lazily. Every switch-in sets CR0.TS, so a
+// quantum's first x87/SSE/AVX instruction in a slice raises #NM; the
+// handler clears TS and restores that quantum's area. Only a quantum that
+// took the trap is saved at switch-out, and XSAVEOPT skips components
+// left unmodified since the restore. A quantum that never touches vector
+// registers costs nothing: TS stays set and its area is never read.
+
+#define CR0_MP                  (1ULL << 1)
+#define CR0_EM                  (1ULL << 2)
+#define CR0_TS                  (1ULL << 3)
+#define CR0_NE                  (1ULL << 5)
+#define CR4_OSFXSR              (1ULL << 9)
+#define CR4_OSXMMEXCPT          (1ULL << 10)
+#define CR4_OSXSAVE             (1ULL << 18)
+
+#define XSTATE_X87              (1ULL << 0)
+#define XSTATE_SSE              (1ULL << 1)
+#define XSTATE_AVX              (1ULL << 2)
+#define XSTATE_AVX512           (7ULL << 5)     // Opmask, ZMM_Hi256, Hi16_ZMM
+
+#define FXSAVE_AREA_SIZE        512
+#define FPU_DEFAULT_FCW         0x037F
+#define FPU_DEFAULT_MXCSR       0x1F80
+
+typedef struct {
+    bool xsave;                 // XSAVE/XRSTOR enabled, else FXSAVE/FXRSTOR
+    bool xsaveopt;
+    uint64_t xcr0;              // Components saved and restored
+    uint32_t size;              // Bytes per quantum area
+} fpu_config_t;
+
+static fpu_config_t g_fpu = {
+    .xsave = false,
+    .xsaveopt = false,
+    .xcr0 = XSTATE_X87 | XSTATE_SSE,
+    .size = FXSAVE_AREA_SIZE
+};
+
+static void fpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+    __asm__ __volatile__(
+        "cpuid"
+        : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+        : "a"(leaf), "c"(subleaf)
+    );
+}
+
+static inline uint64_t fpu_read_cr0(void) {
+    uint64_t cr0;
+    __asm__ __volatile__("movq %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void fpu_write_cr0(uint64_t cr0) {
+    __asm__ __volatile__("movq %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+static inline void fpu_set_ts(cpu_runqueue_t* rq) {
+    if (!rq->fpu_ts) {
+        fpu_write_cr0(fpu_read_cr0() | CR0_TS);
+        rq->fpu_ts = true;
+    }
+}
+
+static inline void fpu_clear_ts(cpu_runqueue_t* rq) {
+    __asm__ __volatile__("clts" : : : "memory");
+    rq->fpu_ts = false;
+}
+
+static inline void fpu_save(void* area) {
+    uint32_t low = (uint32_t)g_fpu.xcr0;
+    uint32_t high = (uint32_t)(g_fpu.xcr0 >> 32);
+    
+    if (g_fpu.xsaveopt) {
+        __asm__ __volatile__("xsaveopt64 (%0)" : : "r"(area), "a"(low), "d"(high) : "memory");
+    } else if (g_fpu.xsave) {
+        __asm__ __volatile__("xsave64 (%0)" : : "r"(area), "a"(low), "d"(high) : "memory");
+    } else {
+        __asm__ __volatile__("fxsave64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+static inline void fpu_restore(void* area) {
+    uint32_t low = (uint32_t)g_fpu.xcr0;
+    uint32_t high = (uint32_t)(g_fpu.xcr0 >> 32);
+    
+    if (g_fpu.xsave) {
+        __asm__ __volatile__("xrstor64 (%0)" : : "r"(area), "a"(low), "d"(high) : "memory");
+    } else {
+        __asm__ __volatile__("fxrstor64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+// Sets up this CPU's FPU and, the first time, picks the save format.
+// Runs before flux_memops_init so its SIMD selection sees the enabled state.
+void temporal_fpu_init(void) {
+    uint32_t regs[4];
+    
+    fpu_cpuid(1, 0, regs);
+    bool has_xsave = regs[2] & (1U << 26);
+    bool has_avx = regs[2] & (1U << 28);
+    
+    // Native x87 error reporting, no emulation; TS stays clear until the
+    // scheduler's first switch
+    uint64_t cr0 = fpu_read_cr0();
+    cr0 = (cr0 | CR0_MP | CR0_NE) & ~(CR0_EM | CR0_TS);
+    fpu_write_cr0(cr0);
+    
+    uint64_t cr4;
+    __asm__ __volatile__("movq %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (has_xsave) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    __asm__ __volatile__("movq %0, %%cr4" : : "r"(cr4) : "memory");
+    
+    if (!has_xsave) {
+        return;
+    }
+    
+    // Leaf 0xD lists the components the CPU can manage. AMX tiles (and
+    // anything newer) stay off so an area always fits in a page.
+    fpu_cpuid(0xD, 0, regs);
+    uint64_t supported = ((uint64_t)regs[3] << 32) | regs[0];
+    uint64_t xcr0 = XSTATE_X87 | XSTATE_SSE;
+    if (has_avx && (supported & XSTATE_AVX)) {
+        xcr0 |= XSTATE_AVX;
+        fpu_cpuid(7, 0, regs);
+        if ((regs[1] & (1U << 16)) &&
+            (supported & XSTATE_AVX512) == XSTATE_AVX512) {
+            xcr0 |= XSTATE_AVX512;
+        }
+    }
+    __asm__ __volatile__("xsetbv" : : "c"(0), "a"((uint32_t)xcr0),
+                         "d"((uint32_t)(xcr0 >> 32)));
+    
+    // EBX now reports the area size for the components just enabled; the
+    // standard layout puts the last of them (Hi16_ZMM) below 2.7KB
+    fpu_cpuid(0xD, 0, regs);
+    uint32_t size = regs[1];
+    fpu_cpuid(0xD, 1, regs);
+    
+    g_fpu.xsave = true;
+    g_fpu.xsaveopt = regs[0] & 1;
+    g_fpu.xcr0 = xcr0;
+    g_fpu.size = size;
+}
+
+// A fresh area holds the init state: XSTATE_BV zero makes XRSTOR load
+// defaults, and FXRSTOR gets the default control words
+void* temporal_fpu_alloc(void) {
+    // XSAVE wants 64-byte alignment; a page gives it and fits every
+    // component temporal_fpu_init enables
+    uint8_t* area = flux_allocate(NULL, g_fpu.size,
+                                  FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO | FLUX_ALLOC_LARGE);
+    if (area) {
+        *(uint16_t*)(area + 0) = FPU_DEFAULT_FCW;
+        *(uint32_t*)(area + 24) = FPU_DEFAULT_MXCSR;
+    }
+    return area;
+}
+
+void temporal_fpu_release(quantum_context_t* quantum) {
+    if (!quantum || !quantum->fpu_state) {
+        return;
+    }
+    
+    // Its registers may still be live on the CPU it last ran on; drop the
+    // ownership so that CPU's next switch doesn't save into freed memory
+    uint32_t cpu = quantum->scheduling.last_cpu;
+    if (cpu < MAX_CPU_CORES) {
+        quantum_context_t* expected = quantum;
+        __atomic_compare_exchange_n(&g_cpu_queues[cpu].fpu_owner, &expected, NULL,
+                                    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+    
+    flux_free(quantum->fpu_state);
+    quantum->fpu_state = NULL;
+}
+
+// Caller has interrupts disabled
+static void fpu_switch_out(cpu_runqueue_t* rq, quantum_context_t* quantum) {
+    if (rq->fpu_owner != quantum) {
+        return;
+    }
+    
+    // TS is clear: the owner took #NM this slice
+    fpu_save(quantum->fpu_state);
+    rq->fpu_owner = NULL;
+    rq->fpu_saves++;
+}
+
+static void fpu_switch_in(cpu_runqueue_t* rq) {
+    // Whatever is in the registers belongs to someone else now; the next
+    // vector instruction traps and loads the right state
+    rq->fpu_owner = NULL;
+    fpu_set_ts(rq);
+}
+
+// #NM handler
+void temporal_fpu_fault(void) {
+    cpu_runqueue_t* rq = &g_cpu_queues[temporal_get_current_cpu()];
+    quantum_context_t* quantum = rq->current;
+    
+    fpu_clear_ts(rq);
+    rq->fpu_faults++;
+    
+    if (!quantum || quantum == g_idle_quantum || !quantum->fpu_state) {
+        // Kernel SIMD outside any quantum (memops spill what they borrow);
+        // there's no state to load
+        return;
+    }
+    
+    fpu_restore(quantum->fpu_state);
+    rq->fpu_owner = quantum;
+}
+
+// Context switch benchmark. Two synthetic quanta alternate on this CPU
+// through the same switch hooks temporal_schedule uses, each touching a
+// vector register per slice as its workload asks. The general-purpose
+// register switch is left out: it jumps to the loaded context.
+
+#define SWITCH_BENCH_ITERATIONS 10000
+
+typedef enum {
+    SWITCH_WORK_NONE = 0,
+    SWITCH_WORK_SSE,
+    SWITCH_WORK_AVX
+} switch_work_t;
+
+static const char* const g_switch_work_names[] = {
+    [SWITCH_WORK_NONE] = "none",
+    [SWITCH_WORK_SSE] = "sse",
+    [SWITCH_WORK_AVX] = "avx"
+};
+
+static inline void switch_bench_touch(switch_work_t work) {
+    // Non-zero values so XSAVEOPT can't treat the registers as init state
+    if (work == SWITCH_WORK_SSE) {
+        __asm__ __volatile__("pcmpeqd %%xmm0, %%xmm0" : : : "memory");
+    } else if (work == SWITCH_WORK_AVX) {
+        __asm__ __volatile__("vpcmpeqd %%ymm0, %%ymm0, %%ymm0" : : : "memory");
+    }
+}
+
+size_t temporal_switch_benchmark(temporal_switch_bench_t* results, size_t max_results,
+                                 uint64_t tsc_hz) {
+    if (!results || max_results == 0) {
+        return 0;
+    }
+    
+    quantum_context_t bench[2];
+    memset(bench, 0, sizeof(bench));
+    bench[0].fpu_state = temporal_fpu_alloc();
+    bench[1].fpu_state = temporal_fpu_alloc();
+    if (!bench[0].fpu_state || !bench[1].fpu_state) {
+        flux_free(bench[0].fpu_state);
+        flux_free(bench[1].fpu_state);
+        return 0;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    cpu_runqueue_t* rq = &g_cpu_queues[temporal_get_current_cpu()];
+    quantum_context_t* saved_current = rq->current;
+    
+    // Park the real owner's state first; it reloads on its next use
+    if (rq->fpu_owner) {
+        fpu_switch_out(rq, rq->fpu_owner);
+    }
+    
+    size_t count = 0;
+    for (switch_work_t work = SWITCH_WORK_NONE;
+         work <= SWITCH_WORK_AVX && count < max_results; work++) {
+        if (work == SWITCH_WORK_AVX && !(g_fpu.xcr0 & XSTATE_AVX)) {
+            break;
+        }
+        
+        uint64_t faults = rq->fpu_faults;
+        uint64_t saves = rq->fpu_saves;
+        uint64_t start = continuum_get_time();
+        for (uint32_t i = 0; i < SWITCH_BENCH_ITERATIONS; i++) {
+            quantum_context_t* q = &bench[i & 1];
+            rq->current = q;
+            fpu_switch_in(rq);
+            switch_bench_touch(work);
+            fpu_switch_out(rq, q);
+        }
+        uint64_t cycles = continuum_get_time() - start;
+        
+        temporal_switch_bench_t* r = &results[count++];
+        r->workload = g_switch_work_names[work];
+        r->switches = SWITCH_BENCH_ITERATIONS;
+        r->cycles = cycles;
+        r->cycles_per_switch = cycles / SWITCH_BENCH_ITERATIONS;
+        r->ns_per_switch = tsc_hz >= 1000000 ?
+            (r->cycles_per_switch * 1000) / (tsc_hz / 1000000) : 0;
+        r->fpu_faults = rq->fpu_faults - faults;
+        r->fpu_saves = rq->fpu_saves - saves;
+    }
+    
+    rq->current = saved_current;
+    fpu_switch_in(rq);
+    cpu_irq_restore(flags);
+    
+    flux_free(bench[0].fpu_state);
+    flux_free(bench[1].fpu_state);
+    return count;
+}
+
 // =============================================================================
 // Helper Functions
 // =============================================================================
@@ -596,7 +1485,7 @@ uint32_t temporal_get_current_cpu(void) {
     return 0;
 }
 
-void temporal_wake_idle_cpu(void) {
-    // Send IPI to wake up an idle CPU
-    // Implementation depends on interrupt controller
+void temporal_wake_cpu(uint32_t cpu) {
+    // The vector's handler only needs to call temporal_schedule()
+    continuum_send_ipi(cpu, TEMPORAL_RESCHED_VECTOR);
 }
@@ -20,6 +20,19 @@
 #define MIN_TIME_SLICE         1000   // 1ms
 #define MAX_TIME_SLICE         100000 // 100ms
 
+// Load balancing
+#define TEMPORAL_STEAL_ATTEMPTS 4      // Victims an idle CPU probes
+#define TEMPORAL_BALANCE_INTERVAL 100000  // Microseconds between balancing passes
+#define TEMPORAL_BALANCE_BATCH  8      // Quanta pulled per pass at most
+#define TEMPORAL_RESCHED_VECTOR 0xFC
+
+// High-resolution timers
+#define TEMPORAL_TIMER_VECTOR   0xEF
+#define TEMPORAL_TIMERS_PER_CPU 128    // Pending timers per CPU at most
+
+// Lazy FPU/SIMD state
+#define TEMPORAL_FPU_VECTOR     7      // #NM, raised while CR0.TS is set
+
 // =============================================================================
 // Type Definitions
 // =============================================================================
@@ -38,15 +51,27 @@ typedef enum {
 // Data Structures
 // =============================================================================
 
-// Scheduler queue
+// Scheduler queue (one per priority in each CPU's run queue)
 typedef struct {
     quantum_context_t* head;
     quantum_context_t* tail;
     uint32_t count;
     priority_t priority;
-    spinlock_t lock;
 } scheduler_queue_t;
 
+// High-resolution timer. Armed timers live in the heap of the CPU that
+// started them and run from that CPU's timer interrupt.
+typedef struct temporal_timer temporal_timer_t;
+typedef void (*temporal_timer_fn_t)(temporal_timer_t* timer, void* arg);
+
+struct temporal_timer {
+    uint64_t deadline;          // TSC
+    temporal_timer_fn_t fn;
+    void* arg;
+    int32_t heap_index;         // -1 while not armed
+    uint32_t cpu;
+};
+
 // Nexus AI hint
 typedef struct {
     quantum_id_t qid;
@@ -65,17 +90,33 @@ typedef struct {
     uint32_t ready_count;
     uint32_t blocked_count;
     uint32_t cpu_utilization;
+    uint64_t steals;            // Quanta taken by idle CPUs
+    uint64_t migrations;        // Quanta moved by periodic balancing
+    uint64_t timer_interrupts;
+    uint64_t timers_fired;
+    uint64_t tick_stops;        // Idle entries with the tick switched off
+    uint64_t handoffs;          // Direct IPC switches
+    uint64_t fpu_faults;        // #NM traps taken to load vector state
+    uint64_t fpu_saves;         // Switches that had to save vector state
 } temporal_stats_t;
 
+// Context switch benchmark result (one per vector workload)
+typedef struct {
+    const char* workload;       // "none", "sse" or "avx"
+    uint64_t switches;
+    uint64_t cycles;
+    uint64_t cycles_per_switch;
+    uint64_t ns_per_switch;
+    uint64_t fpu_faults;
+    uint64_t fpu_saves;
+} temporal_switch_bench_t;
+
 // Main scheduler structure
 typedef struct {
     bool initialized;
     bool running;
     uint32_t num_cores;
     uint64_t start_time;
-    uint64_t total_quanta;
-    uint64_t total_switches;
-    uint64_t scheduler_ticks;
     spinlock_t ai_lock;
 } temporal_scheduler_t;
 
@@ -94,6 +135,14 @@ void temporal_remove_quantum(quantum_context_t* quantum);
 void temporal_yield(quantum_context_t* quantum);
 void temporal_block(quantum_context_t* quantum, block_reason_t reason);
 void temporal_unblock(quantum_context_t* quantum);
+void temporal_sleep(uint64_t usec);
+bool temporal_handoff(quantum_context_t* target);
+
+// High-resolution timers
+void temporal_timer_init(temporal_timer_t* timer, temporal_timer_fn_t fn, void* arg);
+int temporal_timer_start(temporal_timer_t* timer, uint64_t deadline);
+bool temporal_timer_cancel(temporal_timer_t* timer);
+void temporal_timer_interrupt(void);
 
 // Scheduling
 void temporal_schedule(void);
@@ -106,7 +155,7 @@ void temporal_update_ai_hints(nexus_hint_t* hints, size_t count);
 
 // Load balancing
 void temporal_balance_load(void);
-void temporal_wake_idle_cpu(void);
+void temporal_wake_cpu(uint32_t cpu);
 
 // Statistics
 void temporal_get_stats(temporal_stats_t* stats);
@@ -115,4 +164,12 @@ void temporal_get_stats(temporal_stats_t* stats);
 void temporal_save_context(quantum_context_t* quantum);
 void temporal_load_context(quantum_context_t* quantum);
 
+// Extended (FPU/SIMD) state
+void temporal_fpu_init(void);
+void* temporal_fpu_alloc(void);
+void temporal_fpu_release(quantum_context_t* quantum);
+void temporal_fpu_fault(void);
+size_t temporal_switch_benchmark(temporal_switch_bench_t* results, size_t max_results,
+                                 uint64_t tsc_hz);
+
 #endif /* TEMPORAL_SCHEDULER_H */
@@ -19,6 +19,309 @@
 static build_context_t* g_current_context;
 static spinlock_t g_forge_lock = SPINLOCK_INIT;
 
+// =============================================================================
+// Build Scheduling
+// =============================================================================
+
+// A target of a parallel build: how many of its dependencies in the build
+// have yet to finish, and the targets waiting on it. Its priority is the
+// longest chain of work from it to the end of the build, itself included,
+// so of the targets ready the one holding the most up goes first.
+#define FORGE_NODE_NONE             0xFFFFFFFF
+#define FORGE_PID_BUCKETS           128     // A power of two, twice FORGE_MAX_JOBS
+
+typedef struct {
+    build_target_t* target;
+    uint32_t unmet;
+    uint32_t first_dependent;       // Into the schedule's dependents
+    uint32_t dependent_count;
+    uint64_t priority;
+} forge_node_t;
+
+typedef struct {
+    forge_node_t* nodes;
+    uint32_t count;
+    uint32_t* dependents;
+    
+    // Nodes by name, open-addressed
+    uint32_t* names;
+    uint32_t name_mask;
+    
+    // Ready nodes, a heap with the highest priority on top
+    uint32_t* heap;
+    uint32_t heap_count;
+    
+    // Running jobs, found by pid from a bucket's chain
+    struct {
+        build_job_t* job;
+        uint32_t node;
+        int32_t next;
+    } running[FORGE_MAX_JOBS];
+    int32_t buckets[FORGE_PID_BUCKETS];
+    int32_t free_slot;
+    uint32_t running_count;
+} forge_schedule_t;
+
+static uint32_t forge_hash_name(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t forge_schedule_find(forge_schedule_t* sched, const char* name) {
+    uint32_t slot = forge_hash_name(name) & sched->name_mask;
+    while (sched->names[slot] != FORGE_NODE_NONE) {
+        if (strcmp(sched->nodes[sched->names[slot]].target->name, name) == 0) {
+            return sched->names[slot];
+        }
+        slot = (slot + 1) & sched->name_mask;
+    }
+    return FORGE_NODE_NONE;
+}
+
+static bool forge_schedule_before(forge_schedule_t* sched, uint32_t a, uint32_t b) {
+    if (sched->nodes[a].priority != sched->nodes[b].priority) {
+        return sched->nodes[a].priority > sched->nodes[b].priority;
+    }
+    return a < b;  // Build order breaks ties
+}
+
+static void forge_schedule_push(forge_schedule_t* sched, uint32_t node) {
+    uint32_t i = sched->heap_count++;
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!forge_schedule_before(sched, node, sched->heap[parent])) {
+            break;
+        }
+        sched->heap[i] = sched->heap[parent];
+        i = parent;
+    }
+    sched->heap[i] = node;
+}
+
+static uint32_t forge_schedule_pop(forge_schedule_t* sched) {
+    uint32_t top = sched->heap[0];
+    uint32_t last = sched->heap[--sched->heap_count];
+    
+    uint32_t i = 0;
+    while (true) {
+        uint32_t child = i * 2 + 1;
+        if (child >= sched->heap_count) {
+            break;
+        }
+        if (child + 1 < sched->heap_count &&
+            forge_schedule_before(sched, sched->heap[child + 1], sched->heap[child])) {
+            child++;
+        }
+        if (!forge_schedule_before(sched, sched->heap[child], last)) {
+            break;
+        }
+        sched->heap[i] = sched->heap[child];
+        i = child;
+    }
+    if (sched->heap_count) {
+        sched->heap[i] = last;
+    }
+    return top;
+}
+
+// A node's done: whatever was waiting on it alone is ready
+static void forge_schedule_release(forge_schedule_t* sched, uint32_t node) {
+    forge_node_t* n = &sched->nodes[node];
+    for (uint32_t i = 0; i < n->dependent_count; i++) {
+        uint32_t dependent = sched->dependents[n->first_dependent + i];
+        if (--sched->nodes[dependent].unmet == 0) {
+            forge_schedule_push(sched, dependent);
+        }
+    }
+}
+
+static void forge_schedule_free(forge_schedule_t* sched) {
+    flux_free(sched->nodes);
+    flux_free(sched->dependents);
+    flux_free(sched->names);
+    flux_free(sched->heap);
+}
+
+// Nodes for the targets and edges for their dependencies on each other;
+// a dependency on a target outside the build counts as met unless it
+// failed, then never. Priorities come from past builds' durations, a
+// second at least for each target, summed back from the end of the build.
+static int forge_schedule_init(forge_schedule_t* sched, build_context_t* ctx,
+                               build_target_t** targets, uint32_t count) {
+    memset(sched, 0, sizeof(*sched));
+    sched->count = count;
+    sched->free_slot = -1;
+    for (uint32_t i = 0; i < FORGE_PID_BUCKETS; i++) {
+        sched->buckets[i] = -1;
+    }
+    for (int32_t i = FORGE_MAX_JOBS - 1; i >= 0; i--) {
+        sched->running[i].next = sched->free_slot;
+        sched->free_slot = i;
+    }
+    
+    uint32_t buckets = 16;
+    while (buckets < count * 2) {
+        buckets *= 2;
+    }
+    sched->name_mask = buckets - 1;
+    
+    sched->nodes = flux_allocate(NULL, (count + 1) * sizeof(forge_node_t),
+                                 FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    sched->names = flux_allocate(NULL, buckets * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+    sched->heap = flux_allocate(NULL, (count + 1) * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+    if (!sched->nodes || !sched->names || !sched->heap) {
+        return -1;
+    }
+    memset(sched->names, 0xFF, buckets * sizeof(uint32_t));
+    
+    for (uint32_t i = 0; i < count; i++) {
+        sched->nodes[i].target = targets[i];
+        if (forge_schedule_find(sched, targets[i]->name) == FORGE_NODE_NONE) {
+            uint32_t slot = forge_hash_name(targets[i]->name) & sched->name_mask;
+            while (sched->names[slot] != FORGE_NODE_NONE) {
+                slot = (slot + 1) & sched->name_mask;
+            }
+            sched->names[slot] = i;
+        }
+    }
+    
+    // Count each node's dependents, then lay them out after one another
+    uint32_t edges = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        for (build_dep_t* dep = targets[i]->dependencies; dep; dep = dep->next) {
+            uint32_t node = forge_schedule_find(sched, dep->name);
+            if (node != FORGE_NODE_NONE) {
+                sched->nodes[node].dependent_count++;
+                sched->nodes[i].unmet++;
+                edges++;
+            } else if (dep->is_target) {
+                build_target_t* dep_target = forge_find_target(ctx, dep->name);
+                if (dep_target && dep_target->state == BUILD_STATE_FAILED) {
+                    sched->nodes[i].unmet++;
+                }
+            }
+        }
+    }
+    
+    sched->dependents = flux_allocate(NULL, (edges + 1) * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+    if (!sched->dependents) {
+        return -1;
+    }
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sched->nodes[i].first_dependent = offset;
+        offset += sched->nodes[i].dependent_count;
+        sched->nodes[i].dependent_count = 0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        for (build_dep_t* dep = targets[i]->dependencies; dep; dep = dep->next) {
+            uint32_t node = forge_schedule_find(sched, dep->name);
+            if (node != FORGE_NODE_NONE) {
+                forge_node_t* n = &sched->nodes[node];
+                sched->dependents[n->first_dependent + n->dependent_count++] = i;
+            }
+        }
+    }
+    
+    // Kahn's order, in the heap's array as scratch, then priorities from
+    // its end back; a cycle leaves nodes out of it
+    uint32_t* order = sched->heap;
+    uint32_t* pending = flux_allocate(NULL, (count + 1) * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+    if (!pending) {
+        return -1;
+    }
+    uint32_t ordered = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t internal = 0;
+        for (build_dep_t* dep = targets[i]->dependencies; dep; dep = dep->next) {
+            if (forge_schedule_find(sched, dep->name) != FORGE_NODE_NONE) {
+                internal++;
+            }
+        }
+        pending[i] = internal;
+        if (internal == 0) {
+            order[ordered++] = i;
+        }
+    }
+    for (uint32_t head = 0; head < ordered; head++) {
+        forge_node_t* n = &sched->nodes[order[head]];
+        for (uint32_t i = 0; i < n->dependent_count; i++) {
+            uint32_t dependent = sched->dependents[n->first_dependent + i];
+            if (--pending[dependent] == 0) {
+                order[ordered++] = dependent;
+            }
+        }
+    }
+    flux_free(pending);
+    if (ordered < count) {
+        forge_error("Circular dependency detected");
+        return -1;
+    }
+    
+    for (uint32_t i = count; i-- > 0;) {
+        forge_node_t* n = &sched->nodes[order[i]];
+        uint64_t longest = 0;
+        for (uint32_t j = 0; j < n->dependent_count; j++) {
+            uint64_t priority = sched->nodes[sched->dependents[n->first_dependent + j]].priority;
+            if (priority > longest) {
+                longest = priority;
+            }
+        }
+        n->priority = n->target->build_duration + 1 + longest;
+    }
+    
+    // What has nothing to wait for is ready now
+    for (uint32_t i = 0; i < count; i++) {
+        if (sched->nodes[i].unmet == 0) {
+            forge_schedule_push(sched, i);
+        }
+    }
+    return 0;
+}
+
+static void forge_schedule_add_job(forge_schedule_t* sched, build_job_t* job, uint32_t node) {
+    int32_t slot = sched->free_slot;
+    sched->free_slot = sched->running[slot].next;
+    
+    uint32_t bucket = (uint32_t)job->pid & (FORGE_PID_BUCKETS - 1);
+    sched->running[slot].job = job;
+    sched->running[slot].node = node;
+    sched->running[slot].next = sched->buckets[bucket];
+    sched->buckets[bucket] = slot;
+    sched->running_count++;
+}
+
+// The running job with pid, taken out of the running set; -1 if none
+static int32_t forge_schedule_take_job(forge_schedule_t* sched, pid_t pid) {
+    int32_t* link = &sched->buckets[(uint32_t)pid & (FORGE_PID_BUCKETS - 1)];
+    while (*link >= 0 && sched->running[*link].job->pid != pid) {
+        link = &sched->running[*link].next;
+    }
+    
+    int32_t slot = *link;
+    if (slot >= 0) {
+        *link = sched->running[slot].next;
+        sched->running[slot].next = sched->free_slot;
+        sched->free_slot = slot;
+        sched->running_count--;
+    }
+    return slot;
+}
+
+static void forge_schedule_cancel(forge_schedule_t* sched) {
+    build_job_t* jobs[FORGE_MAX_JOBS];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < FORGE_PID_BUCKETS; i++) {
+        for (int32_t slot = sched->buckets[i]; slot >= 0; slot = sched->running[slot].next) {
+            jobs[count++] = sched->running[slot].job;
+        }
+    }
+    forge_cancel_all_jobs(jobs, count);
+}
+
 // =============================================================================
 // Build Execution
 // =============================================================================
@@ -30,6 +333,10 @@ int forge_build(build_context_t* ctx, const char* target_name) {
     
     g_current_context = ctx;
     
+    // What was stat'ed or decided for the last build may have changed
+    ctx->build_id++;
+    forge_cache_reset(ctx);
+    
     // Find target
     build_target_t* target = forge_find_target(ctx, target_name);
     if (!target) {
@@ -111,6 +418,13 @@ static int forge_build_sequential(build_context_t* ctx, build_target_t** targets
             continue;
         }
         
+        // An earlier build's output for the same commands and inputs
+        if (forge_cache_restore(ctx, target) == 0) {
+            target->state = BUILD_STATE_CACHED;
+            ctx->targets_cached++;
+            continue;
+        }
+        
         // Execute target
         if (forge_execute_target(ctx, target) != 0) {
             target->state = BUILD_STATE_FAILED;
@@ -122,109 +436,156 @@ static int forge_build_sequential(build_context_t* ctx, build_target_t** targets
         } else {
             target->state = BUILD_STATE_SUCCESS;
             ctx->targets_built++;
+            forge_cache_save(ctx, target);
         }
     }
     
     return (ctx->targets_failed > 0) ? -1 : 0;
 }
 
+// Targets start as the last of their dependencies finish, the ready ones
+// by priority, and the build blocks in wait() until a job ends. What's
+// left waiting on a failure is skipped.
 static int forge_build_parallel(build_context_t* ctx, build_target_t** targets,
                                uint32_t count) {
-    // Initialize job queue
-    build_job_t* job_pool[FORGE_MAX_JOBS];
-    uint32_t job_count = 0;
-    
-    // Build all targets
-    uint32_t completed = 0;
-    uint32_t target_index = 0;
-    
-    while (completed < count) {
-        // Start new jobs up to max_jobs limit
-        while (ctx->active_jobs < ctx->max_jobs && target_index < count) {
-            build_target_t* target = targets[target_index++];
+    forge_schedule_t* sched = flux_allocate(NULL, sizeof(forge_schedule_t), FLUX_ALLOC_KERNEL);
+    if (!sched) {
+        return -1;
+    }
+    if (forge_schedule_init(sched, ctx, targets, count) != 0) {
+        forge_schedule_free(sched);
+        flux_free(sched);
+        return -1;
+    }
+    
+    uint32_t max_jobs = ctx->max_jobs < FORGE_MAX_JOBS ? ctx->max_jobs : FORGE_MAX_JOBS;
+    int result = 0;
+    
+    while (result == 0) {
+        // Start the most pressing ready targets up to max_jobs
+        while (sched->heap_count > 0 && sched->running_count < max_jobs) {
+            uint32_t node = forge_schedule_pop(sched);
+            build_target_t* target = sched->nodes[node].target;
             
+            // Up to date already, or failed before this build
             if (target->state != BUILD_STATE_PENDING) {
-                completed++;
+                if (target->state != BUILD_STATE_FAILED) {
+                    forge_schedule_release(sched, node);
+                }
                 continue;
             }
             
-            // Check if dependencies are ready
-            if (!forge_dependencies_ready(target)) {
+            if (forge_cache_restore(ctx, target) == 0) {
+                target->state = BUILD_STATE_CACHED;
+                ctx->targets_cached++;
+                forge_schedule_release(sched, node);
                 continue;
             }
             
             // Create and start job
             build_job_t* job = forge_create_job(target);
+            if (job && forge_start_job(job, ctx) == 0) {
+                forge_schedule_add_job(sched, job, node);
+                ctx->active_jobs++;
+                target->state = BUILD_STATE_RUNNING;
+                continue;
+            }
+            
             if (job) {
-                if (forge_start_job(job, ctx) == 0) {
-                    job_pool[job_count++] = job;
-                    ctx->active_jobs++;
-                    target->state = BUILD_STATE_RUNNING;
-                } else {
-                    forge_free_job(job);
-                    target->state = BUILD_STATE_FAILED;
-                    ctx->targets_failed++;
-                    
-                    if (!ctx->keep_going) {
-                        forge_cancel_all_jobs(job_pool, job_count);
-                        return -1;
-                    }
-                }
+                forge_free_job(job);
             }
+            target->state = BUILD_STATE_FAILED;
+            ctx->targets_failed++;
+            
+            if (!ctx->keep_going) {
+                result = -1;
+                break;
+            }
+        }
+        
+        if (result != 0 || sched->running_count == 0) {
+            break;
         }
         
         // Wait for job completion
-        if (ctx->active_jobs > 0) {
-            int status;
-            pid_t pid = wait(&status);
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            forge_error("Lost track of running jobs");
+            result = -1;
+            break;
+        }
+        
+        int32_t slot = forge_schedule_take_job(sched, pid);
+        if (slot < 0) {
+            continue;
+        }
+        build_job_t* job = sched->running[slot].job;
+        uint32_t node = sched->running[slot].node;
+        
+        // Process job completion
+        job->exit_code = WEXITSTATUS(status);
+        job->end_time = time(NULL);
+        job->state = (job->exit_code == 0) ? 
+                    BUILD_STATE_SUCCESS : BUILD_STATE_FAILED;
+        
+        // Update target state; its duration weighs it next build
+        job->target->state = job->state;
+        job->target->build_time = job->end_time;
+        job->target->build_duration = job->end_time - job->start_time;
+        forge_cache_invalidate(ctx, job->target->name);
+        if (job->state == BUILD_STATE_SUCCESS) {
+            ctx->targets_built++;
+            forge_cache_save(ctx, job->target);
+            forge_schedule_release(sched, node);
+        } else {
+            ctx->targets_failed++;
             
-            // Find completed job
-            for (uint32_t i = 0; i < job_count; i++) {
-                build_job_t* job = job_pool[i];
-                if (job && job->pid == pid) {
-                    // Process job completion
-                    job->exit_code = WEXITSTATUS(status);
-                    job->end_time = time(NULL);
-                    job->state = (job->exit_code == 0) ? 
-                                BUILD_STATE_SUCCESS : BUILD_STATE_FAILED;
-                    
-                    // Update target state
-                    job->target->state = job->state;
-                    if (job->state == BUILD_STATE_SUCCESS) {
-                        ctx->targets_built++;
-                    } else {
-                        ctx->targets_failed++;
-                        
-                        if (!ctx->keep_going) {
-                            forge_cancel_all_jobs(job_pool, job_count);
-                            return -1;
-                        }
-                    }
-                    
-                    // Print output if verbose
-                    if (ctx->verbose && job->stdout_buffer) {
-                        printf("%s", job->stdout_buffer);
-                    }
-                    if (job->stderr_buffer) {
-                        fprintf(stderr, "%s", job->stderr_buffer);
-                    }
-                    
-                    ctx->active_jobs--;
-                    completed++;
-                    forge_free_job(job);
-                    job_pool[i] = NULL;
-                    break;
-                }
+            if (!ctx->keep_going) {
+                result = -1;
             }
         }
         
-        // Small delay to prevent busy waiting
-        if (ctx->active_jobs >= ctx->max_jobs) {
-            temporal_sleep(1000);  // 1ms
+        // Print output if verbose
+        if (ctx->verbose && job->stdout_buffer) {
+            printf("%s", job->stdout_buffer);
+        }
+        if (job->stderr_buffer) {
+            fprintf(stderr, "%s", job->stderr_buffer);
         }
+        
+        ctx->active_jobs--;
+        forge_free_job(job);
     }
     
-    return (ctx->targets_failed > 0) ? -1 : 0;
+    if (result != 0) {
+        forge_schedule_cancel(sched);
+    }
+    
+    // Whatever a failure kept from becoming ready
+    for (uint32_t i = 0; i < count; i++) {
+        if (targets[i]->state == BUILD_STATE_PENDING) {
+            targets[i]->state = BUILD_STATE_SKIPPED;
+            ctx->targets_skipped++;
+        }
+    }
+    
+    forge_schedule_free(sched);
+    flux_free(sched);
+    return (result != 0 || ctx->targets_failed > 0) ? -1 : 0;
+}
+
+// Whether path exists and its mtime, through the build's stat cache
+static bool forge_path_mtime(build_context_t* ctx, const char* path, time_t* mtime) {
+    forge_stat_t* stat = forge_stat(ctx, path);
+    if (!stat) {
+        bool exists = forge_file_exists(path);
+        *mtime = exists ? forge_get_mtime(path) : 0;
+        return exists;
+    }
+    
+    *mtime = stat->mtime;
+    return stat->exists;
 }
 
 static int forge_execute_target(build_context_t* ctx, build_target_t* target) {
@@ -270,7 +631,8 @@ static int forge_execute_target(build_context_t* ctx, build_target_t* target) {
     
     // Update mtime for file targets
     if (target->type == TARGET_TYPE_FILE) {
-        target->mtime = forge_get_mtime(target->name);
+        forge_cache_invalidate(ctx, target->name);
+        forge_path_mtime(ctx, target->name, &target->mtime);
     }
     
     return 0;
@@ -280,39 +642,31 @@ static int forge_execute_target(build_context_t* ctx, build_target_t* target) {
 // Dependency Analysis
 // =============================================================================
 
-bool forge_target_needs_rebuild(build_target_t* target) {
-    if (!target) {
-        return false;
-    }
-    
+static bool forge_check_rebuild(build_context_t* ctx, build_target_t* target) {
     // Phony targets always need rebuild
     if (target->type == TARGET_TYPE_PHONY) {
         return true;
     }
     
     // Check if target exists
-    if (!forge_file_exists(target->name)) {
+    time_t target_mtime;
+    if (!forge_path_mtime(ctx, target->name, &target_mtime)) {
         return true;
     }
     
-    time_t target_mtime = forge_get_mtime(target->name);
-    
-    // Check dependencies
+    // Check dependencies, a target one by its own and then as a file
     build_dep_t* dep = target->dependencies;
     while (dep) {
         if (dep->is_target) {
-            build_target_t* dep_target = forge_find_target(g_current_context, dep->name);
+            build_target_t* dep_target = forge_find_target(ctx, dep->name);
             if (dep_target && forge_target_needs_rebuild(dep_target)) {
                 return true;
             }
-        } else {
-            // File dependency
-            if (forge_file_exists(dep->name)) {
-                time_t dep_mtime = forge_get_mtime(dep->name);
-                if (dep_mtime > target_mtime) {
-                    return true;
-                }
-            }
+        }
+        
+        time_t dep_mtime;
+        if (forge_path_mtime(ctx, dep->name, &dep_mtime) && dep_mtime > target_mtime) {
+            return true;
         }
         dep = dep->next;
     }
@@ -320,6 +674,26 @@ bool forge_target_needs_rebuild(build_target_t* target) {
     return false;
 }
 
+// Decided once a build. It's provisionally false while its dependencies
+// are checked, so a cycle ends; topological sort reports it.
+bool forge_target_needs_rebuild(build_target_t* target) {
+    if (!target) {
+        return false;
+    }
+    
+    build_context_t* ctx = g_current_context;
+    if (ctx && ctx->build_id != 0 && target->checked_build == ctx->build_id) {
+        return target->needs_rebuild;
+    }
+    if (ctx) {
+        target->checked_build = ctx->build_id;
+        target->needs_rebuild = false;
+    }
+    
+    target->needs_rebuild = forge_check_rebuild(ctx, target);
+    return target->needs_rebuild;
+}
+
 int forge_analyze_dependencies(build_context_t* ctx) {
     // Build dependency graph
     if (forge_build_dependency_graph(ctx) != 0) {
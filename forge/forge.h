@@ -126,6 +126,11 @@ typedef struct build_target {
     time_t build_time;
     bool needs_rebuild;
     bool is_default;
+    uint32_t checked_build;         // The build needs_rebuild was decided for
+    
+    // Action cache: the hash of the commands and inputs, once worked out
+    uint8_t action_key[32];
+    bool action_keyed;
     
     // Parent targets
     struct build_target** parents;
@@ -217,6 +222,19 @@ typedef struct cache_entry {
     struct cache_entry* next;
 } cache_entry_t;
 
+// A path as one build saw it: stat'ed once, hashed once if asked to be
+typedef struct forge_stat {
+    char* path;
+    uint32_t path_hash;
+    bool exists;
+    bool hashed;
+    time_t mtime;
+    uint64_t size;
+    uint8_t hash[32];  // SHA-256 of the contents
+    
+    struct forge_stat* next;
+} forge_stat_t;
+
 // Build graph
 typedef struct {
     build_target_t* targets;
@@ -266,10 +284,17 @@ typedef struct {
     bool use_cache;
     char cache_dir[FORGE_MAX_PATH_LEN];
     
+    // Paths stat'ed this build
+    forge_stat_t** stats;
+    uint32_t stat_bucket_count;     // A power of two
+    uint32_t stat_count;
+    uint32_t build_id;              // Counts builds, dating what's memoized
+    
     // Statistics
     uint32_t targets_built;
     uint32_t targets_failed;
     uint32_t targets_skipped;
+    uint32_t targets_cached;        // Restored from the action cache
     uint64_t total_build_time;
     
     // Include paths
@@ -351,11 +376,27 @@ build_target_t** forge_get_build_order(build_context_t* ctx, uint32_t* count);
 
 // Cache management
 int forge_cache_init(build_context_t* ctx);
+void forge_cache_cleanup(build_context_t* ctx);
 cache_entry_t* forge_cache_lookup(build_context_t* ctx, const char* path);
 int forge_cache_store(build_context_t* ctx, const char* path, const void* data, size_t size);
 int forge_cache_invalidate(build_context_t* ctx, const char* path);
 int forge_cache_clean(build_context_t* ctx);
 
+// Stat cache: each path stat'ed once a build, its contents hashed once
+// if asked for; reset starts the next build, invalidate a path the
+// build has just written
+forge_stat_t* forge_stat(build_context_t* ctx, const char* path);
+bool forge_stat_hash(build_context_t* ctx, forge_stat_t* stat);
+void forge_cache_reset(build_context_t* ctx);
+
+// Action cache, with use_cache: a file target is keyed by its commands
+// and its inputs' contents. Restore puts back the output an earlier build
+// left for the same key, from cache_dir or else through $(CACHE_FETCH);
+// save keeps the output just built, and sends it on through $(CACHE_STORE)
+// if that's set. Both commands see $(CACHE_KEY) and $(CACHE_FILE).
+int forge_cache_restore(build_context_t* ctx, build_target_t* target);
+int forge_cache_save(build_context_t* ctx, build_target_t* target);
+
 // Toolchain detection
 int forge_detect_toolchain(toolchain_t* toolchain);
 int forge_configure_toolchain(toolchain_t* toolchain, const char* prefix);
@@ -16,7 +16,7 @@
 // =============================================================================
 
 #define GENESIS_MAGIC           0x4C314D31544C4535ULL  // "L1M1TLE55"
-#define GENESIS_VERSION         0x01000000              // 1.0.0.0
+#define GENESIS_VERSION         0x01010000              // 1.1.0.0, boot_stages appended
 #define PAGE_SIZE               4096
 #define KERNEL_LOAD_ADDR        0x100000                // 1MB
 #define INITRD_LOAD_ADDR        0x1000000               // 16MB
@@ -26,6 +26,38 @@
 #define MAX_BOOT_MODULES        32
 #define MAX_CMDLINE_LEN         4096
 
+// CPU feature bits reported in cpu_info_t.features (mirrored by the kernel)
+#define CPU_FEATURE_SSE         (1ULL << 0)
+#define CPU_FEATURE_SSE2        (1ULL << 1)
+#define CPU_FEATURE_SSE3        (1ULL << 2)
+#define CPU_FEATURE_SSSE3       (1ULL << 3)
+#define CPU_FEATURE_SSE41       (1ULL << 4)
+#define CPU_FEATURE_SSE42       (1ULL << 5)
+#define CPU_FEATURE_AVX         (1ULL << 6)
+#define CPU_FEATURE_AVX2        (1ULL << 7)
+#define CPU_FEATURE_AVX512      (1ULL << 8)
+#define CPU_FEATURE_ERMS        (1ULL << 9)
+#define CPU_FEATURE_FSRM        (1ULL << 10)
+#define CPU_FEATURE_OSXSAVE     (1ULL << 11)
+#define CPU_FEATURE_PCID        (1ULL << 12)
+#define CPU_FEATURE_INVPCID     (1ULL << 13)
+#define CPU_FEATURE_TSC_DEADLINE (1ULL << 14)
+#define CPU_FEATURE_PDPE1GB     (1ULL << 15)
+
+// Boot stages, each stamped with the TSC in genesis_boot_context_t.boot_stages
+// as it's reached: genesis's, then the kernel's (mirrored by the kernel)
+#define BOOT_STAGE_GENESIS_ENTRY    0
+#define BOOT_STAGE_CPU_DETECTED     1
+#define BOOT_STAGE_MEMORY_MAP       2
+#define BOOT_STAGE_ACPI             3
+#define BOOT_STAGE_KERNEL_LOADED    4
+#define BOOT_STAGE_PAGE_TABLES      5
+#define BOOT_STAGE_KERNEL_ENTRY     6
+#define BOOT_STAGE_KERNEL_CORE      7   // Memory, scheduler and interrupts up
+#define BOOT_STAGE_SCHEDULER        8   // Scheduler started
+#define BOOT_STAGE_DEFERRED_DONE    9   // Deferred subsystems initialized
+#define BOOT_STAGE_COUNT            16
+
 // Memory types
 typedef enum {
     MEMORY_TYPE_USABLE = 1,
@@ -119,6 +151,12 @@ typedef struct {
     bool has_avx;
     bool has_avx2;
     bool has_avx512;
+    bool has_erms;           // Enhanced REP MOVSB/STOSB
+    bool has_fsrm;           // Fast short REP MOVSB
+    bool has_pcid;           // Process-context identifiers
+    bool has_invpcid;
+    bool has_tsc_deadline;   // APIC timer TSC-deadline mode
+    bool has_1gb_pages;      // PDPT entries can map 1GB
 } cpu_info_t;
 
 // ACPI information
@@ -166,6 +204,10 @@ typedef struct {
     // Platform specific data
     void* platform_data;
     uint32_t platform_data_size;
+    
+    // Boot timing, TSC at each BOOT_STAGE_* reached; last, so kernels
+    // that predate it find everything else where it was
+    uint64_t boot_stages[BOOT_STAGE_COUNT];
 } genesis_boot_context_t;
 
 // =============================================================================
@@ -180,24 +222,37 @@ static bool g_debug_mode = false;
 // Utility Functions
 // =============================================================================
 
-// Memory operations
+// Memory operations, as rep string instructions a quadword at a time:
+// the kernel image and its BSS go through these
 static void* memset(void* dest, int val, size_t len) {
-    uint8_t* ptr = dest;
-    while (len--) {
-        *ptr++ = (uint8_t)val;
-    }
+    uint64_t pattern = 0x0101010101010101ULL * (uint8_t)val;
+    void* d = dest;
+    size_t count = len / 8;
+    
+    __asm__ __volatile__("rep stosq" : "+D"(d), "+c"(count) : "a"(pattern) : "memory");
+    count = len % 8;
+    __asm__ __volatile__("rep stosb" : "+D"(d), "+c"(count) : "a"(pattern) : "memory");
     return dest;
 }
 
 static void* memcpy(void* dest, const void* src, size_t len) {
-    uint8_t* d = dest;
-    const uint8_t* s = src;
-    while (len--) {
-        *d++ = *s++;
-    }
+    void* d = dest;
+    const void* s = src;
+    size_t count = len / 8;
+    
+    __asm__ __volatile__("rep movsq" : "+D"(d), "+S"(s), "+c"(count) : : "memory");
+    count = len % 8;
+    __asm__ __volatile__("rep movsb" : "+D"(d), "+S"(s), "+c"(count) : : "memory");
     return dest;
 }
 
+// Eight bytes, unaligned
+static inline void copy8(void* dest, const void* src) {
+    uint64_t value;
+    __builtin_memcpy(&value, src, 8);
+    __builtin_memcpy(dest, &value, 8);
+}
+
 static int memcmp(const void* s1, const void* s2, size_t len) {
     const uint8_t* p1 = s1;
     const uint8_t* p2 = s2;
@@ -239,6 +294,18 @@ static int strcmp(const char* s1, const char* s2) {
     return *(unsigned char*)s1 - *(unsigned char*)s2;
 }
 
+static inline uint64_t read_tsc(void) {
+    uint32_t low, high;
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+static void boot_stage(uint32_t stage) {
+    if (g_boot_context && stage < BOOT_STAGE_COUNT) {
+        g_boot_context->boot_stages[stage] = read_tsc();
+    }
+}
+
 // Simple heap allocator for boot time
 static void* boot_alloc(size_t size) {
     // Align to 16 bytes
@@ -361,6 +428,7 @@ static void detect_cpu_features(cpu_info_t* cpu) {
     cpu->vendor[1] = edx;
     cpu->vendor[2] = ecx;
     cpu->vendor[3] = 0;
+    uint32_t max_leaf = eax;
     
     // Get basic features
     __asm__ __volatile__(
@@ -390,6 +458,43 @@ static void detect_cpu_features(cpu_info_t* cpu) {
     cpu->has_sse41 = (ecx >> 19) & 1;
     cpu->has_sse42 = (ecx >> 20) & 1;
     cpu->has_avx = (ecx >> 28) & 1;
+    cpu->has_pcid = (ecx >> 17) & 1;
+    cpu->has_tsc_deadline = (ecx >> 24) & 1;
+    bool has_osxsave = (ecx >> 27) & 1;
+    
+    // Structured extended features (leaf 7)
+    eax = ebx = ecx = edx = 0;
+    if (max_leaf >= 7) {
+        __asm__ __volatile__(
+            "cpuid"
+            : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+            : "a"(7), "c"(0)
+        );
+    }
+    
+    cpu->has_avx2 = (ebx >> 5) & 1;
+    cpu->has_erms = (ebx >> 9) & 1;
+    cpu->has_avx512 = (ebx >> 16) & 1;
+    cpu->has_fsrm = (edx >> 4) & 1;
+    cpu->has_invpcid = (ebx >> 10) & 1;
+    
+    // Flatten into the feature mask handed to the kernel
+    cpu->features = 0;
+    if (cpu->has_sse) cpu->features |= CPU_FEATURE_SSE;
+    if (cpu->has_sse2) cpu->features |= CPU_FEATURE_SSE2;
+    if (cpu->has_sse3) cpu->features |= CPU_FEATURE_SSE3;
+    if (cpu->has_ssse3) cpu->features |= CPU_FEATURE_SSSE3;
+    if (cpu->has_sse41) cpu->features |= CPU_FEATURE_SSE41;
+    if (cpu->has_sse42) cpu->features |= CPU_FEATURE_SSE42;
+    if (cpu->has_avx) cpu->features |= CPU_FEATURE_AVX;
+    if (cpu->has_avx2) cpu->features |= CPU_FEATURE_AVX2;
+    if (cpu->has_avx512) cpu->features |= CPU_FEATURE_AVX512;
+    if (cpu->has_erms) cpu->features |= CPU_FEATURE_ERMS;
+    if (cpu->has_fsrm) cpu->features |= CPU_FEATURE_FSRM;
+    if (has_osxsave) cpu->features |= CPU_FEATURE_OSXSAVE;
+    if (cpu->has_pcid) cpu->features |= CPU_FEATURE_PCID;
+    if (cpu->has_invpcid) cpu->features |= CPU_FEATURE_INVPCID;
+    if (cpu->has_tsc_deadline) cpu->features |= CPU_FEATURE_TSC_DEADLINE;
     
     // Extended features
     __asm__ __volatile__(
@@ -400,6 +505,8 @@ static void detect_cpu_features(cpu_info_t* cpu) {
     
     cpu->has_64bit = (edx >> 29) & 1;
     cpu->has_nx = (edx >> 20) & 1;
+    cpu->has_1gb_pages = (edx >> 26) & 1;
+    if (cpu->has_1gb_pages) cpu->features |= CPU_FEATURE_PDPE1GB;
     
     // Get processor count (simplified)
     cpu->cores = 1;
@@ -478,6 +585,96 @@ typedef struct {
     uint32_t checksum;
 } continuum_header_t;
 
+// Header flags
+#define CONTINUUM_FLAG_LZ4      0x01    // Image after the header is an LZ4 block
+
+#define LZ4_MIN_MATCH           4
+#define LZ4_LAST_LITERALS       5       // A block ends in at least this many
+// literals, the slack wild copies use
+
+// An LZ4 block length: the token's nibble, then bytes added while 255
+static bool lz4_length(const uint8_t** ip, const uint8_t* iend, size_t* length) {
+    if (*length != 15) {
+        return true;
+    }
+    
+    uint8_t byte;
+    do {
+        if (*ip >= iend) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Decode an LZ4 block (sequences of a token, literals, a 16-bit offset
+// back and a match; the last literals only) straight into dst. Copies go
+// eight bytes at a time, past the sequence's end while both buffers have
+// the room. Returns the bytes written, 0 if src is malformed or too big.
+static size_t lz4_decompress(const uint8_t* src, size_t src_size, uint8_t* dst,
+                             size_t dst_size) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_size;
+    
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        
+        // Literals
+        size_t length = token >> 4;
+        if (!lz4_length(&ip, iend, &length) ||
+            length > (size_t)(iend - ip) || length > (size_t)(oend - op)) {
+            return 0;
+        }
+        if (length + 8 <= (size_t)(iend - ip) && length + 8 <= (size_t)(oend - op)) {
+            for (size_t i = 0; i < length; i += 8) {
+                copy8(op + i, ip + i);
+            }
+        } else {
+            memcpy(op, ip, length);
+        }
+        op += length;
+        ip += length;
+        
+        if (ip == iend) {
+            break;
+        }
+        
+        // Match
+        if (iend - ip < 2) {
+            return 0;
+        }
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        length = token & 0x0F;
+        if (offset == 0 || offset > (size_t)(op - dst) || !lz4_length(&ip, iend, &length)) {
+            return 0;
+        }
+        length += LZ4_MIN_MATCH;
+        if (length > (size_t)(oend - op)) {
+            return 0;
+        }
+        
+        // Eight at a time reads only what's written once offset covers it
+        const uint8_t* match = op - offset;
+        if (offset >= 8 && length + 8 <= (size_t)(oend - op)) {
+            for (size_t i = 0; i < length; i += 8) {
+                copy8(op + i, match + i);
+            }
+        } else {
+            for (size_t i = 0; i < length; i++) {
+                op[i] = match[i];
+            }
+        }
+        op += length;
+    }
+    
+    return op - dst;
+}
+
 static bool validate_kernel(void* kernel_data, size_t kernel_size) {
     if (kernel_size < sizeof(continuum_header_t)) {
         genesis_print("Error: Kernel too small\n");
@@ -514,16 +711,30 @@ static bool load_kernel(void* kernel_data, size_t kernel_size, uint64_t* entry_p
     
     continuum_header_t* header = (continuum_header_t*)kernel_data;
     
-    // Copy kernel to its load address
+    // Copy kernel to its load address, or decompress it there
     uint64_t load_addr = header->load_addr ? header->load_addr : KERNEL_LOAD_ADDR;
     size_t copy_size = header->load_end_addr - header->load_addr;
-    
-    if (copy_size > kernel_size - sizeof(continuum_header_t)) {
-        copy_size = kernel_size - sizeof(continuum_header_t);
+    uint8_t* image = (uint8_t*)kernel_data + sizeof(continuum_header_t);
+    size_t image_size = kernel_size - sizeof(continuum_header_t);
+    
+    if (header->flags & CONTINUUM_FLAG_LZ4) {
+        // Decoded in one pass, so never over its own input
+        if ((uint64_t)(uintptr_t)image < load_addr + copy_size &&
+            load_addr < (uint64_t)(uintptr_t)image + image_size) {
+            genesis_print("Error: Compressed kernel overlaps its load address\n");
+            return false;
+        }
+        if (lz4_decompress(image, image_size, (uint8_t*)load_addr, copy_size) != copy_size) {
+            genesis_print("Error: Corrupt compressed kernel\n");
+            return false;
+        }
+    } else {
+        if (copy_size > image_size) {
+            copy_size = image_size;
+        }
+        memcpy((void*)load_addr, image, copy_size);
     }
     
-    memcpy((void*)load_addr, (uint8_t*)kernel_data + sizeof(continuum_header_t), copy_size);
-    
     // Clear BSS section
     if (header->bss_end_addr > header->load_end_addr) {
         size_t bss_size = header->bss_end_addr - header->load_end_addr;
@@ -551,8 +762,8 @@ static bool load_kernel(void* kernel_data, size_t kernel_size, uint64_t* entry_p
 // Page table structures
 #define PML4_BASE       0x1000
 #define PDPT_BASE       0x2000
-#define PD_BASE         0x3000
-#define PT_BASE         0x4000
+#define PD_BASE         0x3000      // IDENTITY_MAP_GB consecutive PDs
+#define IDENTITY_MAP_GB 4           // Low 4GB: RAM plus 32-bit MMIO (framebuffer)
 
 #define PAGE_PRESENT    (1ULL << 0)
 #define PAGE_WRITABLE   (1ULL << 1)
@@ -568,17 +779,25 @@ static void setup_page_tables(void) {
     // Clear page tables
     memset(pml4, 0, PAGE_SIZE);
     memset(pdpt, 0, PAGE_SIZE);
-    memset(pd, 0, PAGE_SIZE);
     
     // PML4[0] -> PDPT
     pml4[0] = PDPT_BASE | PAGE_PRESENT | PAGE_WRITABLE;
     
-    // PDPT[0] -> PD
-    pdpt[0] = PD_BASE | PAGE_PRESENT | PAGE_WRITABLE;
-    
-    // Identity map first 1GB using 2MB pages
-    for (int i = 0; i < 512; i++) {
-        pd[i] = (i * 0x200000) | PAGE_PRESENT | PAGE_WRITABLE | PAGE_HUGE;
+    // Identity map the low 4GB with large pages so the framebuffer and
+    // device BARs below 4GB need no 4K tables: 1GB pages straight from the
+    // PDPT where the CPU has them, else PDPT[0..3] -> PDs of 2MB pages
+    if (g_boot_context->cpu.has_1gb_pages) {
+        for (uint64_t gb = 0; gb < IDENTITY_MAP_GB; gb++) {
+            pdpt[gb] = (gb << 30) | PAGE_PRESENT | PAGE_WRITABLE | PAGE_HUGE;
+        }
+    } else {
+        memset(pd, 0, IDENTITY_MAP_GB * PAGE_SIZE);
+        for (int gb = 0; gb < IDENTITY_MAP_GB; gb++) {
+            pdpt[gb] = (PD_BASE + gb * PAGE_SIZE) | PAGE_PRESENT | PAGE_WRITABLE;
+        }
+        for (uint64_t i = 0; i < IDENTITY_MAP_GB * 512; i++) {
+            pd[i] = (i * 0x200000) | PAGE_PRESENT | PAGE_WRITABLE | PAGE_HUGE;
+        }
     }
     
     // Map higher half (0xFFFF800000000000)
@@ -669,9 +888,12 @@ static menu_option_t display_boot_menu(void) {
 // =============================================================================
 
 void genesis_boot_main(void* platform_context, boot_mode_t boot_mode) {
+    uint64_t entry_time = read_tsc();
+    
     // Initialize boot context
     g_boot_context = (genesis_boot_context_t*)boot_alloc(sizeof(genesis_boot_context_t));
     memset(g_boot_context, 0, sizeof(genesis_boot_context_t));
+    g_boot_context->boot_stages[BOOT_STAGE_GENESIS_ENTRY] = entry_time;
     
     g_boot_context->magic = GENESIS_MAGIC;
     g_boot_context->version = GENESIS_VERSION;
@@ -695,6 +917,7 @@ void genesis_boot_main(void* platform_context, boot_mode_t boot_mode) {
     // Detect CPU features
     genesis_print("Detecting CPU features...\n");
     detect_cpu_features(&g_boot_context->cpu);
+    boot_stage(BOOT_STAGE_CPU_DETECTED);
     
     if (!g_boot_context->cpu.has_64bit) {
         genesis_print("ERROR: 64-bit CPU required!\n");
@@ -720,6 +943,7 @@ void genesis_boot_main(void* platform_context, boot_mode_t boot_mode) {
     }
     
     process_memory_map(&g_boot_context->memory_map);
+    boot_stage(BOOT_STAGE_MEMORY_MAP);
     
     genesis_print("Total memory: ");
     genesis_print_hex(g_boot_context->memory_map.total_memory / (1024 * 1024));
@@ -728,6 +952,7 @@ void genesis_boot_main(void* platform_context, boot_mode_t boot_mode) {
     // Detect ACPI
     genesis_print("Detecting ACPI...\n");
     detect_acpi(&g_boot_context->acpi);
+    boot_stage(BOOT_STAGE_ACPI);
     
     if (g_boot_context->acpi.rsdp_addr) {
         genesis_print("ACPI RSDP found at: ");
@@ -762,6 +987,7 @@ void genesis_boot_main(void* platform_context, boot_mode_t boot_mode) {
         genesis_print("ERROR: Failed to load kernel!\n");
         while (1) __asm__ __volatile__("hlt");
     }
+    boot_stage(BOOT_STAGE_KERNEL_LOADED);
     
     // Load initrd
     genesis_print("Loading initial ramdisk...\n");
@@ -771,6 +997,7 @@ void genesis_boot_main(void* platform_context, boot_mode_t boot_mode) {
     // Setup page tables for 64-bit mode
     genesis_print("Setting up page tables...\n");
     setup_page_tables();
+    boot_stage(BOOT_STAGE_PAGE_TABLES);
     
     // Final preparations
     genesis_print("Preparing to jump to kernel...\n");
@@ -783,6 +1010,7 @@ void genesis_boot_main(void* platform_context, boot_mode_t boot_mode) {
     kernel_entry_t entry = (kernel_entry_t)kernel_entry;
     
     genesis_print("Jumping to Continuum kernel...\n\n");
+    boot_stage(BOOT_STAGE_KERNEL_ENTRY);
     
     // Call kernel with boot context
     entry(g_boot_context);
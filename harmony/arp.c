@@ -21,6 +21,10 @@ static arp_entry_t* g_arp_cache[ARP_CACHE_SIZE];
 static arp_pending_t* g_pending_requests;
 static spinlock_t g_arp_lock = SPINLOCK_INIT;
 
+// Moves on whenever a resolved MAC changes or goes, so a copy kept
+// elsewhere with the generation it was read in is known to be stale
+static uint32_t g_arp_generation = 1;
+
 // =============================================================================
 // ARP Cache Management
 // =============================================================================
@@ -29,6 +33,15 @@ static uint32_t arp_hash(uint32_t ip_addr) {
     return (ip_addr ^ (ip_addr >> 16)) % ARP_CACHE_SIZE;
 }
 
+// g_arp_lock held
+static inline void arp_invalidate(void) {
+    __atomic_store_n(&g_arp_generation, g_arp_generation + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t arp_generation(void) {
+    return __atomic_load_n(&g_arp_generation, __ATOMIC_ACQUIRE);
+}
+
 int arp_add_entry(uint32_t ip_addr, uint8_t* mac_addr) {
     uint32_t hash = arp_hash(ip_addr);
     
@@ -39,6 +52,9 @@ int arp_add_entry(uint32_t ip_addr, uint8_t* mac_addr) {
     while (entry) {
         if (entry->ip_addr == ip_addr) {
             // Update existing entry
+            if (entry->valid && memcmp(entry->mac_addr, mac_addr, ETH_ALEN) != 0) {
+                arp_invalidate();
+            }
             memcpy(entry->mac_addr, mac_addr, ETH_ALEN);
             entry->timestamp = harmony_get_time();
             entry->valid = true;
@@ -73,7 +89,8 @@ int arp_add_entry(uint32_t ip_addr, uint8_t* mac_addr) {
     return 0;
 }
 
-int arp_resolve(network_interface_t* iface, uint32_t ip_addr, uint8_t* mac_addr) {
+// The cache alone, without asking the network
+int arp_lookup(uint32_t ip_addr, uint8_t* mac_addr) {
     uint32_t hash = arp_hash(ip_addr);
     
     spinlock_acquire(&g_arp_lock);
@@ -90,12 +107,20 @@ int arp_resolve(network_interface_t* iface, uint32_t ip_addr, uint8_t* mac_addr)
             } else {
                 // Entry expired
                 entry->valid = false;
+                arp_invalidate();
             }
         }
         entry = entry->next;
     }
     
     spinlock_release(&g_arp_lock);
+    return -1;
+}
+
+int arp_resolve(network_interface_t* iface, uint32_t ip_addr, uint8_t* mac_addr) {
+    if (arp_lookup(ip_addr, mac_addr) == 0) {
+        return 0;
+    }
     
     // Not in cache - send ARP request
     arp_send_request(iface, ip_addr);
@@ -376,6 +401,9 @@ void arp_timer_tick(void) {
         while (entry) {
             if (now - entry->timestamp > ARP_CACHE_TIMEOUT) {
                 // Remove expired entry
+                if (entry->valid) {
+                    arp_invalidate();
+                }
                 *prev = entry->next;
                 flux_free(entry);
                 entry = *prev;
@@ -433,6 +461,7 @@ void arp_cleanup(void) {
         }
         g_arp_cache[i] = NULL;
     }
+    arp_invalidate();
     
     // Free pending requests
     arp_pending_t* pending = g_pending_requests;
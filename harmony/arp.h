@@ -46,6 +46,8 @@ void arp_init(void);
 void arp_cleanup(void);
 void arp_input(network_interface_t* iface, arp_header_t* arp_hdr, size_t len);
 int arp_resolve(network_interface_t* iface, uint32_t ip_addr, uint8_t* mac_addr);
+int arp_lookup(uint32_t ip_addr, uint8_t* mac_addr);
+uint32_t arp_generation(void);
 int arp_add_entry(uint32_t ip_addr, uint8_t* mac_addr);
 int arp_send_request(network_interface_t* iface, uint32_t target_ip);
 int arp_send_reply(network_interface_t* iface, arp_header_t* request);
@@ -0,0 +1,75 @@
+/*
+ * Internet Checksum
+ * One's complement sums over a 64-bit accumulator, eight bytes a step
+ */
+
+#include "checksum.h"
+#include "../continuum/flux_memory.h"
+
+// =============================================================================
+// Checksum Accumulation
+// =============================================================================
+
+// One's complement addition in 64 bits: the carry out wraps back in
+static inline uint64_t checksum_add(uint64_t sum, uint64_t value) {
+    sum += value;
+    return sum + (sum < value);
+}
+
+// 64 bits down to 32, carries included
+static inline uint32_t checksum_fold64(uint64_t sum) {
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    return (uint32_t)sum;
+}
+
+uint32_t checksum_partial(const void* data, size_t len, uint32_t sum) {
+    const uint8_t* ptr = data;
+    uint64_t acc = sum;
+    uint64_t words[4];
+    
+    // Four words a round keep the loop overhead off most of the bytes
+    while (len >= sizeof(words)) {
+        memcpy(words, ptr, sizeof(words));
+        acc = checksum_add(acc, words[0]);
+        acc = checksum_add(acc, words[1]);
+        acc = checksum_add(acc, words[2]);
+        acc = checksum_add(acc, words[3]);
+        ptr += sizeof(words);
+        len -= sizeof(words);
+    }
+    
+    while (len >= sizeof(uint64_t)) {
+        memcpy(words, ptr, sizeof(uint64_t));
+        acc = checksum_add(acc, words[0]);
+        ptr += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+    
+    // The tail, zero-padded to a whole word
+    if (len > 0) {
+        words[0] = 0;
+        memcpy(words, ptr, len);
+        acc = checksum_add(acc, words[0]);
+    }
+    
+    return checksum_fold64(acc);
+}
+
+uint32_t checksum_pseudo_ipv4(uint32_t src_addr, uint32_t dest_addr, uint8_t protocol,
+                              uint16_t len) {
+    // Zero byte, protocol byte, then the length, as the words lie in memory
+    uint16_t words[2] = { (uint16_t)(protocol << 8), (uint16_t)((len >> 8) | (len << 8)) };
+    
+    uint64_t acc = src_addr;
+    acc += dest_addr;
+    acc += words[0];
+    acc += words[1];
+    return checksum_fold64(acc);
+}
+
+uint16_t checksum_fold(uint32_t sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
@@ -0,0 +1,31 @@
+/*
+ * Internet Checksum
+ * One's complement sums for IP, ICMP, TCP and UDP in Harmony
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// Partial sums: the one's complement sum of len bytes added to sum. The
+// bytes are summed as they lie in memory, so a folded result is already
+// in network order and can be stored into a header as it is. Partial
+// sums of buffers add together as long as every buffer but the last has
+// an even length.
+uint32_t checksum_partial(const void* data, size_t len, uint32_t sum);
+
+// The IPv4 pseudo-header: addresses in network order, len in host order
+uint32_t checksum_pseudo_ipv4(uint32_t src_addr, uint32_t dest_addr, uint8_t protocol,
+                              uint16_t len);
+
+// The checksum to store for sum; summing data that holds a correct
+// checksum folds to 0
+uint16_t checksum_fold(uint32_t sum);
+
+#endif /* CHECKSUM_H */
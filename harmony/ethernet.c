@@ -7,17 +7,26 @@
 #include "ethernet.h"
 #include "arp.h"
 #include "ip.h"
+#include "tcp.h"
+#include "checksum.h"
 #include "../continuum/flux_memory.h"
+#include "../continuum/drivers/network/net_buffer.h"
+#include "../continuum/continuum_trace.h"
 
 // =============================================================================
 // Ethernet Input
 // =============================================================================
 
-void ethernet_input(network_interface_t* iface, void* frame, size_t len) {
+// csum_valid: the NIC already checked the frame's IPv4 and TCP or UDP
+// checksums. buffer: the one frame lies in, NULL for a flat copy; layers
+// above may keep a reference to it instead of copying.
+void ethernet_input(network_interface_t* iface, void* frame, size_t len, bool csum_valid,
+                    net_buffer_t* buffer) {
     if (len < sizeof(eth_header_t)) {
         return;  // Frame too small
     }
     
+    uint64_t start = trace_begin(TRACE_ETH_INPUT);
     eth_header_t* eth_hdr = (eth_header_t*)frame;
     uint16_t ethertype = ntohs(eth_hdr->type);
     
@@ -47,7 +56,7 @@ void ethernet_input(network_interface_t* iface, void* frame, size_t len) {
     
     switch (ethertype) {
         case ETH_P_IP:
-            ip_input(iface, payload, payload_len);
+            ip_input(iface, payload, payload_len, csum_valid, buffer);
             break;
             
         case ETH_P_ARP:
@@ -61,79 +70,297 @@ void ethernet_input(network_interface_t* iface, void* frame, size_t len) {
         default:
             // Unknown ethertype
             iface->rx_errors++;
+            continuum_counter_inc(COUNTER_NET_ERRORS);
             break;
     }
+    
+    TRACE(TRACE_ETH_INPUT, ethertype, len, trace_elapsed(start));
 }
 
 // =============================================================================
 // Ethernet Output
 // =============================================================================
 
-int ethernet_send(network_interface_t* iface, uint32_t dest_ip,
-                 uint16_t ethertype, void* data, size_t len) {
-    if (len > ETH_MTU) {
-        return -1;  // Packet too large
-    }
-    
-    // Allocate frame buffer
-    size_t frame_len = sizeof(eth_header_t) + len;
-    if (frame_len < ETH_MIN_FRAME) {
-        frame_len = ETH_MIN_FRAME;
-    }
+// Fill in a NET_BUFFER_CSUM_PARTIAL checksum in software, for a driver
+// that can't. The frame is in one buffer; padding past the end sums to
+// nothing.
+static void ethernet_checksum_help(net_buffer_t* buffer) {
+    uint8_t* start = buffer->head + buffer->csum_start;
+    uint16_t* field = (uint16_t*)(start + buffer->csum_offset);
+    size_t len = buffer->data + buffer->len - start;
     
-    uint8_t* frame = flux_allocate(NULL, frame_len, FLUX_ALLOC_KERNEL);
-    if (!frame) {
-        return -1;
+    // The field holds the pseudo-header sum, so the sum covers it too
+    *field = checksum_fold(checksum_partial(start, len, 0));
+    buffer->flags &= ~NET_BUFFER_CSUM_PARTIAL;
+}
+
+// Put the Ethernet header in front of buffer's payload, in its own
+// headroom, addressed to mac if the caller already has it. Returns false
+// once buffer is gone instead: released on an error, or its payload
+// queued to wait for ARP, with *result what the caller returns.
+static bool ethernet_frame_buffer(network_interface_t* iface, uint32_t dest_ip,
+                                  const uint8_t* mac, uint16_t ethertype,
+                                  net_buffer_t* buffer, int* result) {
+    if (!buffer->gso_size && buffer->len > ETH_MTU) {
+        net_buffer_put(buffer);
+        *result = -1;
+        return false;  // Packet too large
     }
     
-    eth_header_t* eth_hdr = (eth_header_t*)frame;
-    
-    // Set source MAC
-    memcpy(eth_hdr->src, iface->mac_addr, ETH_ALEN);
-    
     // Determine destination MAC
-    if (dest_ip == 0xFFFFFFFF) {
+    uint8_t dest_mac[ETH_ALEN];
+    if (mac) {
+        memcpy(dest_mac, mac, ETH_ALEN);
+    } else if (dest_ip == 0xFFFFFFFF) {
         // Broadcast
-        memset(eth_hdr->dest, 0xFF, ETH_ALEN);
+        memset(dest_mac, 0xFF, ETH_ALEN);
     } else if ((dest_ip & 0xF0000000) == 0xE0000000) {
         // Multicast - compute MAC from IP
-        eth_hdr->dest[0] = 0x01;
-        eth_hdr->dest[1] = 0x00;
-        eth_hdr->dest[2] = 0x5E;
-        eth_hdr->dest[3] = (dest_ip >> 16) & 0x7F;
-        eth_hdr->dest[4] = (dest_ip >> 8) & 0xFF;
-        eth_hdr->dest[5] = dest_ip & 0xFF;
-    } else {
-        // Unicast - need ARP resolution
-        uint8_t dest_mac[ETH_ALEN];
-        if (arp_resolve(iface, dest_ip, dest_mac) != 0) {
-            // ARP resolution failed - queue packet
-            flux_free(frame);
-            return arp_queue_packet(iface, dest_ip, ethertype, data, len);
+        dest_mac[0] = 0x01;
+        dest_mac[1] = 0x00;
+        dest_mac[2] = 0x5E;
+        dest_mac[3] = (dest_ip >> 16) & 0x7F;
+        dest_mac[4] = (dest_ip >> 8) & 0xFF;
+        dest_mac[5] = dest_ip & 0xFF;
+    } else if (arp_resolve(iface, dest_ip, dest_mac) != 0) {
+        // ARP resolution failed - queue packet, finished as it will be
+        // sent. A TSO frame can't wait whole; TCP retransmits its segments.
+        if (buffer->gso_size) {
+            *result = -1;
+        } else {
+            if (buffer->flags & NET_BUFFER_CSUM_PARTIAL) {
+                ethernet_checksum_help(buffer);
+            }
+            *result = arp_queue_packet(iface, dest_ip, ethertype, buffer->data, buffer->len);
         }
-        memcpy(eth_hdr->dest, dest_mac, ETH_ALEN);
+        net_buffer_put(buffer);
+        return false;
     }
     
-    // Set ethertype
-    eth_hdr->type = htons(ethertype);
+    eth_header_t* eth_hdr = net_buffer_push(buffer, sizeof(eth_header_t));
+    if (!eth_hdr) {
+        net_buffer_put(buffer);
+        *result = -1;
+        return false;
+    }
     
-    // Copy payload
-    memcpy(frame + sizeof(eth_header_t), data, len);
+    memcpy(eth_hdr->dest, dest_mac, ETH_ALEN);
+    memcpy(eth_hdr->src, iface->mac_addr, ETH_ALEN);
+    eth_hdr->type = htons(ethertype);
     
     // Pad if necessary
-    if (frame_len > sizeof(eth_header_t) + len) {
-        memset(frame + sizeof(eth_header_t) + len, 0,
-              frame_len - sizeof(eth_header_t) - len);
+    if (net_buffer_frame_len(buffer) < ETH_MIN_FRAME) {
+        uint32_t pad = ETH_MIN_FRAME - buffer->len;
+        memset(net_buffer_append(buffer, pad), 0, pad);
+    }
+    
+    return true;
+}
+
+// Hand a framed buffer to the driver: added to batch (flushing first if
+// it's full or for another interface) where the driver takes bursts,
+// sent straight away otherwise. A checksum the driver can't fill in is
+// filled in here. Takes the caller's reference either way.
+static int ethernet_transmit(harmony_tx_batch_t* batch, network_interface_t* iface,
+                             net_buffer_t* buffer) {
+    if ((buffer->flags & NET_BUFFER_CSUM_PARTIAL) &&
+        !(iface->offloads & NET_OFFLOAD_TX_CSUM)) {
+        ethernet_checksum_help(buffer);
+    }
+    
+    int result = 0;
+    if (batch && iface->send_buffers) {
+        if (batch->count > 0 && (batch->iface != iface || batch->count == HARMONY_TX_BATCH)) {
+            result = ethernet_flush(batch);
+        }
+        
+        batch->iface = iface;
+        batch->buffers[batch->count] = buffer;
+        batch->lengths[batch->count] = net_buffer_frame_len(buffer);
+        batch->count++;
+        return result;
     }
     
     // Send via driver
-    int result = iface->send_packet(iface->driver_data, frame, frame_len);
+    size_t frame_len = net_buffer_frame_len(buffer);
+    if (iface->send_buffer) {
+        result = iface->send_buffer(iface->driver_data, buffer);
+    } else {
+        result = iface->send_packet(iface->driver_data, buffer->data, buffer->len);
+        net_buffer_put(buffer);
+    }
     
-    flux_free(frame);
+    if (result < 0) {
+        continuum_counter_inc(COUNTER_NET_ERRORS);
+    } else {
+        continuum_counter_inc(COUNTER_NET_TX_PACKETS);
+        continuum_counter_add(COUNTER_NET_TX_BYTES, frame_len);
+    }
     
     return result;
 }
 
+// Cut a framed TSO buffer (Ethernet, IPv4 and TCP headers, the payload
+// running on into its frags) into gso_size segments for a driver that
+// can't, each copied into a buffer of its own with its headers fixed up
+static int ethernet_segment(harmony_tx_batch_t* batch, network_interface_t* iface,
+                            net_buffer_t* buffer) {
+    ipv4_header_t* ip_hdr = (ipv4_header_t*)(buffer->data + sizeof(eth_header_t));
+    uint32_t ip_len = (ip_hdr->version_ihl & 0x0F) * 4;
+    tcp_header_t* tcp_hdr = (tcp_header_t*)((uint8_t*)ip_hdr + ip_len);
+    uint32_t tcp_len = (tcp_hdr->data_offset >> 4) * 4;
+    uint32_t hdr_len = sizeof(eth_header_t) + ip_len + tcp_len;
+    uint32_t frame_len = net_buffer_frame_len(buffer);
+    uint16_t id = ntohs(ip_hdr->id);
+    uint32_t seq = ntohl(tcp_hdr->seq_num);
+    
+    int result = 0;
+    for (uint32_t offset = hdr_len; offset < frame_len; offset += buffer->gso_size) {
+        uint32_t payload = frame_len - offset;
+        if (payload > buffer->gso_size) {
+            payload = buffer->gso_size;
+        }
+        
+        net_buffer_t* segment = net_buffer_alloc();
+        uint8_t* frame = segment ? net_buffer_append(segment, hdr_len + payload) : NULL;
+        if (!frame) {
+            net_buffer_put(segment);
+            continuum_counter_inc(COUNTER_NET_ERRORS);
+            result = -1;
+            break;
+        }
+        net_buffer_copy(buffer, 0, frame, hdr_len);
+        net_buffer_copy(buffer, offset, frame + hdr_len, payload);
+        
+        ipv4_header_t* seg_ip = (ipv4_header_t*)(frame + sizeof(eth_header_t));
+        seg_ip->total_length = htons(ip_len + tcp_len + payload);
+        seg_ip->id = htons(id++);
+        seg_ip->checksum = 0;
+        seg_ip->checksum = ip_checksum(seg_ip, ip_len);
+        
+        // FIN and PSH belong to the last segment only
+        tcp_header_t* seg_tcp = (tcp_header_t*)((uint8_t*)seg_ip + ip_len);
+        seg_tcp->seq_num = htonl(seq + (offset - hdr_len));
+        if (offset + payload < frame_len) {
+            seg_tcp->flags &= ~(TCP_FLAG_FIN | TCP_FLAG_PSH);
+        }
+        
+        uint32_t sum = checksum_pseudo_ipv4(seg_ip->src_addr, seg_ip->dest_addr,
+                                            IPPROTO_TCP, tcp_len + payload);
+        if (iface->offloads & NET_OFFLOAD_TX_CSUM) {
+            seg_tcp->checksum = (uint16_t)~checksum_fold(sum);
+            segment->flags |= NET_BUFFER_CSUM_PARTIAL;
+            segment->csum_start = (uint8_t*)seg_tcp - segment->head;
+            segment->csum_offset = offsetof(tcp_header_t, checksum);
+        } else {
+            seg_tcp->checksum = 0;
+            seg_tcp->checksum = checksum_fold(checksum_partial(seg_tcp, tcp_len + payload,
+                                                               sum));
+        }
+        
+        if (segment->len < ETH_MIN_FRAME) {
+            uint32_t pad = ETH_MIN_FRAME - segment->len;
+            memset(net_buffer_append(segment, pad), 0, pad);
+        }
+        
+        int sent = ethernet_transmit(batch, iface, segment);
+        if (sent < 0) {
+            result = sent;
+        }
+    }
+    
+    net_buffer_put(buffer);
+    return result;
+}
+
+// Frame buffer and send it, handed to the driver as it stands where the
+// driver takes buffers. Takes the caller's reference either way.
+int ethernet_send_buffer(network_interface_t* iface, uint32_t dest_ip,
+                        uint16_t ethertype, net_buffer_t* buffer) {
+    int result = 0;
+    if (!ethernet_frame_buffer(iface, dest_ip, NULL, ethertype, buffer, &result)) {
+        return result;
+    }
+    
+    if (buffer->gso_size && !(iface->offloads & NET_OFFLOAD_TSO4)) {
+        harmony_tx_batch_t batch = { 0 };
+        result = ethernet_segment(&batch, iface, buffer);
+        int flushed = ethernet_flush(&batch);
+        return result < 0 ? result : flushed;
+    }
+    
+    return ethernet_transmit(NULL, iface, buffer);
+}
+
+// Hand batch's frames to the driver in one call. Returns -1 if any of
+// them were dropped.
+int ethernet_flush(harmony_tx_batch_t* batch) {
+    if (batch->count == 0) {
+        return 0;
+    }
+    
+    network_interface_t* iface = batch->iface;
+    uint32_t count = batch->count;
+    int sent = iface->send_buffers(iface->driver_data, batch->buffers, count);
+    batch->count = 0;
+    
+    // Drivers queue a prefix of the batch and drop the rest
+    size_t bytes = 0;
+    for (int i = 0; i < sent; i++) {
+        bytes += batch->lengths[i];
+    }
+    continuum_counter_add(COUNTER_NET_TX_PACKETS, sent);
+    continuum_counter_add(COUNTER_NET_TX_BYTES, bytes);
+    if ((uint32_t)sent < count) {
+        continuum_counter_add(COUNTER_NET_ERRORS, count - sent);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Frame buffer and add it to batch, flushing first if the batch is full
+// or for another interface; a TSO frame the driver can't take goes in as
+// its segments. Interfaces without send_buffers send it straight away.
+// Takes the caller's reference either way.
+int ethernet_queue_buffer(harmony_tx_batch_t* batch, network_interface_t* iface,
+                          uint32_t dest_ip, uint16_t ethertype, net_buffer_t* buffer) {
+    return ethernet_queue_resolved(batch, iface, dest_ip, NULL, ethertype, buffer);
+}
+
+// As ethernet_queue_buffer, to dest_mac when it's given instead of
+// whatever ARP says for dest_ip
+int ethernet_queue_resolved(harmony_tx_batch_t* batch, network_interface_t* iface,
+                            uint32_t dest_ip, const uint8_t* dest_mac, uint16_t ethertype,
+                            net_buffer_t* buffer) {
+    int result = 0;
+    if (!ethernet_frame_buffer(iface, dest_ip, dest_mac, ethertype, buffer, &result)) {
+        return result;
+    }
+    
+    if (buffer->gso_size && !(iface->offloads & NET_OFFLOAD_TSO4)) {
+        return ethernet_segment(batch, iface, buffer);
+    }
+    
+    return ethernet_transmit(batch, iface, buffer);
+}
+    
+int ethernet_send(network_interface_t* iface, uint32_t dest_ip,
+                 uint16_t ethertype, void* data, size_t len) {
+    if (len > ETH_MTU) {
+        return -1;  // Packet too large
+    }
+    
+    net_buffer_t* buffer = net_buffer_alloc();
+    if (!buffer) {
+        continuum_counter_inc(COUNTER_NET_ERRORS);
+        return -1;
+    }
+    
+    memcpy(net_buffer_append(buffer, len), data, len);
+    return ethernet_send_buffer(iface, dest_ip, ethertype, buffer);
+}
+
 // =============================================================================
 // Multicast Management
 // =============================================================================
@@ -10,8 +10,12 @@
 #include "tcp.h"
 #include "udp.h"
 #include "dhcp.h"
+#include "xsk.h"
 #include "../continuum/flux_memory.h"
 #include "../continuum/temporal_scheduler.h"
+#include "../continuum/conduit_ipc.h"
+#include "../continuum/continuum_trace.h"
+#include "../continuum/drivers/network/net_buffer.h"
 
 // =============================================================================
 // Global Networking State
@@ -21,14 +25,376 @@ static bool g_harmony_initialized = false;
 static thread_t* g_network_thread;
 static spinlock_t g_harmony_lock = SPINLOCK_INIT;
 
-// Statistics
-static struct {
-    uint64_t packets_received;
-    uint64_t packets_sent;
-    uint64_t bytes_received;
-    uint64_t bytes_sent;
-    uint64_t errors;
-} g_network_stats;
+// Trace export to a host-side analyzer
+static conduit_t* g_trace_export = NULL;
+static int g_trace_socket = -1;
+static uint32_t g_trace_addr;
+static uint16_t g_trace_port;
+
+static void trace_export_pump(void);
+
+// =============================================================================
+// Receive Polling
+// =============================================================================
+
+// Receive queues with interrupts are drained by a knapid on the CPU that
+// took the interrupt, a budget at a time so one busy queue can't starve
+// the others; those without are polled by the network thread. Interfaces
+// with a single queue spread the work in software instead: each frame is
+// steered to a CPU by its flow and handed to that CPU's backlog.
+typedef struct {
+    network_interface_t* iface;
+    net_buffer_t* buffer;
+} rps_frame_t;
+
+typedef struct {
+    spinlock_t lock;
+    harmony_napi_t* head;
+    harmony_napi_t* tail;
+    rps_frame_t* backlog;       // HARMONY_RPS_BACKLOG of them, a ring
+    uint32_t backlog_head;
+    uint32_t backlog_count;
+    quantum_context_t* knapid;
+} napi_cpu_t;
+
+// On a knapid list; keeps a queue from being linked in twice
+#define NAPI_LISTED (1U << 31)
+
+static napi_cpu_t g_napi_cpus[MAX_CPU_CORES];
+static uint32_t g_napi_count = 0;
+
+static void napi_input(network_interface_t* iface, void* frame, size_t len, bool csum_valid,
+                       net_buffer_t* buffer) {
+    ethernet_input(iface, frame, len, csum_valid, buffer);
+    continuum_counter_inc(COUNTER_NET_RX_PACKETS);
+    continuum_counter_add(COUNTER_NET_RX_BYTES, len);
+}
+
+// Hash an IPv4 frame's addresses, protocol and, for unfragmented TCP and
+// UDP, ports. Anything else isn't steered, so it stays in order with the
+// rest of its kind.
+static bool rps_flow_hash(const uint8_t* frame, uint32_t len, uint32_t* hash) {
+    if (len < ETH_HLEN + sizeof(ipv4_header_t) ||
+        ((const eth_header_t*)frame)->type != htons(ETH_P_IP)) {
+        return false;
+    }
+    
+    const ipv4_header_t* ip = (const ipv4_header_t*)(frame + ETH_HLEN);
+    uint32_t ihl = (ip->version_ihl & 0x0F) * 4;
+    uint32_t h = ip->src_addr * 0x9E3779B1U;
+    h = (h ^ ip->dest_addr) * 0x85EBCA77U;
+    h = (h ^ ip->protocol) * 0xC2B2AE3DU;
+    
+    bool fragment = (ntohs(ip->flags_frag_offset) & 0x3FFF) != 0;
+    if (!fragment && (ip->protocol == IPPROTO_TCP || ip->protocol == IPPROTO_UDP) &&
+        len >= ETH_HLEN + ihl + 4) {
+        uint32_t ports;
+        memcpy(&ports, frame + ETH_HLEN + ihl, sizeof(ports));
+        h = (h ^ ports) * 0x9E3779B1U;
+    }
+    
+    *hash = h ^ (h >> 16);
+    return true;
+}
+
+// Queue a frame on another CPU's backlog, waking its knapid if the
+// backlog was empty; a full backlog drops it
+static void rps_enqueue(network_interface_t* iface, uint32_t cpu, net_buffer_t* buffer) {
+    napi_cpu_t* target = &g_napi_cpus[cpu];
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&target->lock);
+    bool queued = target->backlog_count < HARMONY_RPS_BACKLOG;
+    bool wake = queued && target->backlog_count == 0;
+    if (queued) {
+        uint32_t slot = (target->backlog_head + target->backlog_count) % HARMONY_RPS_BACKLOG;
+        target->backlog[slot].iface = iface;
+        target->backlog[slot].buffer = buffer;
+        target->backlog_count++;
+    }
+    spinlock_release(&target->lock);
+    cpu_irq_restore(flags);
+    
+    if (!queued) {
+        iface->rx_rps_dropped++;
+        net_buffer_put(buffer);
+        return;
+    }
+    
+    iface->rx_rps_steered++;
+    if (wake) {
+        temporal_unblock(target->knapid);
+    }
+}
+
+// Pass a frame up here, or steer it to the CPU its flow belongs to
+static void napi_deliver(network_interface_t* iface, net_buffer_t* buffer, bool steer) {
+    uint32_t hash;
+    if (steer && rps_flow_hash(buffer->data, buffer->len, &hash)) {
+        uint32_t cpu = hash % g_napi_count;
+        if (cpu != temporal_get_current_cpu()) {
+            rps_enqueue(iface, cpu, buffer);
+            return;
+        }
+    }
+    
+    napi_input(iface, buffer->data, buffer->len,
+               (buffer->flags & NET_BUFFER_CSUM_VALID) != 0, buffer);
+    net_buffer_put(buffer);
+}
+
+// Hand up to budget frames from napi's queue to ethernet_input, in the
+// driver's own buffers where it lends them; errored descriptors use up
+// budget too. A ring socket bound to the queue takes its frames first. A
+// single queue with CPUs to spare is steered, copying frames into buffers
+// if the driver has none.
+static int napi_drain(harmony_napi_t* napi, int budget) {
+    network_interface_t* iface = napi->iface;
+    harmony_xsk_t* xsk = __atomic_load_n(&iface->xsk[napi->queue], __ATOMIC_ACQUIRE);
+    bool steer = iface->num_rx_queues == 1 && g_napi_count > 1;
+    int frames = 0;
+    
+    net_buffer_t* (*receive_buffer)(void*, uint32_t) = __atomic_load_n(&iface->receive_buffer,
+                                                            __ATOMIC_ACQUIRE);
+    if (receive_buffer) {
+        net_buffer_t* buffer;
+        while (frames < budget && (buffer = receive_buffer(iface->driver_data, napi->queue))) {
+            frames++;
+            if (xsk && !(buffer = xsk_receive(xsk, buffer))) {
+                continue;
+            }
+            napi_deliver(iface, buffer, steer);
+        }
+        return frames;
+    }
+    
+    uint8_t frame[ETH_FRAME_LEN];
+    while (frames < budget) {
+        int len = iface->receive_packet(iface->driver_data, frame, sizeof(frame));
+        if (len == 0) {
+            break;
+        }
+        frames++;
+        if (len < 0 || (xsk && xsk_receive_frame(xsk, frame, len))) {
+            continue;
+        }
+        
+        net_buffer_t* buffer = steer ? net_buffer_alloc() : NULL;
+        if (buffer) {
+            memcpy(net_buffer_append(buffer, len), frame, len);
+            napi_deliver(iface, buffer, true);
+        } else {
+            napi_input(iface, frame, len, false, NULL);
+        }
+    }
+    
+    return frames;
+}
+
+// Up to budget frames other CPUs steered here
+static int rps_drain(napi_cpu_t* cpu, int budget) {
+    int frames = 0;
+    
+    while (frames < budget) {
+        uint64_t flags = cpu_irq_save();
+        spinlock_acquire(&cpu->lock);
+        rps_frame_t frame = { NULL, NULL };
+        if (cpu->backlog_count > 0) {
+            frame = cpu->backlog[cpu->backlog_head];
+            cpu->backlog_head = (cpu->backlog_head + 1) % HARMONY_RPS_BACKLOG;
+            cpu->backlog_count--;
+        }
+        spinlock_release(&cpu->lock);
+        cpu_irq_restore(flags);
+        
+        if (!frame.buffer) {
+            break;
+        }
+        frames++;
+        napi_input(frame.iface, frame.buffer->data, frame.buffer->len,
+                   (frame.buffer->flags & NET_BUFFER_CSUM_VALID) != 0, frame.buffer);
+        net_buffer_put(frame.buffer);
+    }
+    
+    return frames;
+}
+
+static void napi_queue(harmony_napi_t* napi) {
+    if (__atomic_fetch_or(&napi->state, NAPI_LISTED, __ATOMIC_ACQ_REL) & NAPI_LISTED) {
+        return;
+    }
+    
+    napi_cpu_t* cpu = &g_napi_cpus[napi->cpu];
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&cpu->lock);
+    napi->next = NULL;
+    if (cpu->tail) {
+        cpu->tail->next = napi;
+    } else {
+        cpu->head = napi;
+    }
+    cpu->tail = napi;
+    spinlock_release(&cpu->lock);
+    cpu_irq_restore(flags);
+    
+    temporal_unblock(cpu->knapid);
+}
+
+// Called from the driver's receive interrupt for one queue, that queue's
+// interrupts already masked. context is the queue's harmony_napi_t, so
+// this can be the driver's receive notifier as it stands.
+void harmony_napi_schedule(void* context) {
+    harmony_napi_t* napi = (harmony_napi_t*)context;
+    if (!napi->iface->set_rx_interrupts ||
+        (__atomic_fetch_or(&napi->state, HARMONY_NAPI_SCHED, __ATOMIC_ACQ_REL) &
+         HARMONY_NAPI_SCHED)) {
+        return;
+    }
+    
+    napi->interrupts++;
+    napi->cpu = temporal_get_current_cpu() % g_napi_count;
+    napi_queue(napi);
+}
+
+// The ring came up short: unmask receive interrupts, unless frames came
+// in while they were off, in which case mask them again and keep polling
+static void napi_complete(harmony_napi_t* napi) {
+    network_interface_t* iface = napi->iface;
+    __atomic_and_fetch(&napi->state, ~(HARMONY_NAPI_SCHED | HARMONY_NAPI_POLLING),
+                       __ATOMIC_SEQ_CST);
+    
+    if (iface->set_rx_interrupts(iface->driver_data, napi->queue, true) &&
+        !(__atomic_fetch_or(&napi->state, HARMONY_NAPI_SCHED, __ATOMIC_ACQ_REL) &
+          HARMONY_NAPI_SCHED)) {
+        iface->set_rx_interrupts(iface->driver_data, napi->queue, false);
+        napi_queue(napi);
+    }
+}
+
+// One pass over a scheduled queue. A full budget sends it to the back of
+// the list behind the others; a busy poller holding it requeues it itself
+// when it lets go.
+static void napi_poll(harmony_napi_t* napi) {
+    if (__atomic_fetch_or(&napi->state, HARMONY_NAPI_POLLING, __ATOMIC_ACQ_REL) &
+        HARMONY_NAPI_POLLING) {
+        return;
+    }
+    
+    napi->polls++;
+    if (napi_drain(napi, HARMONY_NAPI_BUDGET) < HARMONY_NAPI_BUDGET) {
+        napi_complete(napi);
+        return;
+    }
+    
+    napi->budget_exhausted++;
+    __atomic_and_fetch(&napi->state, ~HARMONY_NAPI_POLLING, __ATOMIC_SEQ_CST);
+    napi_queue(napi);
+}
+
+// Drain a queue outside knapid, with its interrupts left as they are.
+// Returns false if someone else is draining it.
+static bool napi_try_poll(harmony_napi_t* napi) {
+    if (__atomic_fetch_or(&napi->state, HARMONY_NAPI_POLLING, __ATOMIC_ACQ_REL) &
+        HARMONY_NAPI_POLLING) {
+        return false;
+    }
+    
+    napi_drain(napi, HARMONY_NAPI_BUDGET);
+    
+    uint32_t state = __atomic_and_fetch(&napi->state, ~HARMONY_NAPI_POLLING,
+                                        __ATOMIC_SEQ_CST);
+    if (state & HARMONY_NAPI_SCHED) {
+        napi_queue(napi);
+    }
+    return true;
+}
+
+// knapid: poll the queues its CPU's interrupts scheduled, and take the
+// frames other CPUs steered to it. Both are checked with interrupts off,
+// so a schedule from this CPU can't slip in between the check and the
+// sleep.
+static void napi_knapid_main(void) {
+    napi_cpu_t* cpu = &g_napi_cpus[temporal_get_current_cpu()];
+    
+    while (1) {
+        uint64_t flags = cpu_irq_save();
+        spinlock_acquire(&cpu->lock);
+        harmony_napi_t* napi = cpu->head;
+        if (napi) {
+            cpu->head = napi->next;
+            if (!cpu->head) {
+                cpu->tail = NULL;
+            }
+            napi->next = NULL;
+        }
+        bool backlog = cpu->backlog_count > 0;
+        spinlock_release(&cpu->lock);
+        
+        if (!napi && !backlog) {
+            temporal_sleep(HARMONY_NAPI_IDLE);
+            cpu_irq_restore(flags);
+            continue;
+        }
+        cpu_irq_restore(flags);
+        
+        if (backlog) {
+            rps_drain(cpu, HARMONY_NAPI_BUDGET);
+        }
+        if (napi) {
+            __atomic_and_fetch(&napi->state, ~NAPI_LISTED, __ATOMIC_ACQ_REL);
+            napi_poll(napi);
+        }
+    }
+}
+
+// One knapid per CPU, pinned to it, with a backlog for steered frames
+static void napi_start_daemons(void) {
+    uint32_t cpus = continuum_get_cpu_count();
+    if (cpus == 0 || cpus > MAX_CPU_CORES) {
+        cpus = 1;
+    }
+    
+    for (uint32_t cpu = 0; cpu < MAX_CPU_CORES; cpu++) {
+        spinlock_init(&g_napi_cpus[cpu].lock);
+    }
+    
+    for (uint32_t cpu = 0; cpu < cpus; cpu++) {
+        rps_frame_t* backlog = flux_allocate(NULL, HARMONY_RPS_BACKLOG * sizeof(rps_frame_t),
+                                             FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+        if (!backlog) {
+            break;
+        }
+        
+        quantum_id_t qid = continuum_create_quantum(ABI_MODE_NATIVE, (void*)napi_knapid_main,
+                                                    "knapid");
+        quantum_context_t* quantum = continuum_get_quantum(qid);
+        if (!quantum) {
+            flux_free(backlog);
+            break;
+        }
+        
+        quantum->scheduling.priority = PRIORITY_HIGH;
+        quantum->scheduling.cpu_affinity = CPU_AFFINITY_SINGLE;
+        quantum->scheduling.cpu_mask = 1ULL << cpu;
+        g_napi_cpus[cpu].backlog = backlog;
+        g_napi_cpus[cpu].knapid = quantum;
+        g_napi_count++;
+        temporal_enqueue(quantum);
+    }
+}
+
+// A pass over every queue for a socket spinning in recv
+static void harmony_busy_poll(void) {
+    network_interface_t* iface = ip_get_interface_list();
+    while (iface) {
+        for (uint32_t q = 0; q < iface->num_rx_queues; q++) {
+            if (napi_try_poll(&iface->napi[q])) {
+                iface->napi[q].busy_polls++;
+            }
+        }
+        iface = iface->next;
+    }
+}
 
 // =============================================================================
 // Network Thread
@@ -36,33 +402,25 @@ static struct {
 
 static void harmony_network_thread(void* arg) {
     while (g_harmony_initialized) {
-        // Process incoming packets from all interfaces
+        // Poll the interfaces that can't interrupt
         network_interface_t* iface = ip_get_interface_list();
         while (iface) {
-            // Check for received packets
-            uint8_t buffer[ETH_FRAME_LEN];
-            int len = iface->receive_packet(iface->driver_data, buffer, sizeof(buffer));
-            
-            if (len > 0) {
-                ethernet_input(iface, buffer, len);
-                g_network_stats.packets_received++;
-                g_network_stats.bytes_received += len;
+            for (uint32_t q = 0; q < iface->num_rx_queues && !iface->set_rx_interrupts; q++) {
+                napi_try_poll(&iface->napi[q]);
             }
-            
             iface = iface->next;
         }
         
-        // Process TCP timers
-        tcp_timer_tick();
-        
         // Process ARP cache
         arp_timer_tick();
         
         // Process DHCP renewals
         dhcp_timer_tick();
         
-        // Sleep for 10ms
-        temporal_sleep(10000);
+        // Ship pending trace records
+        trace_export_pump();
+        
+        temporal_sleep(HARMONY_TIMER_PERIOD);
     }
 }
 
@@ -83,6 +441,11 @@ int harmony_init(void) {
     tcp_init();
     udp_init();
     
+    // Receive pollers, then the thread for timers and interrupt-less NICs
+    if (g_napi_count == 0) {
+        napi_start_daemons();
+    }
+    
     // Create network processing thread
     g_network_thread = temporal_create_thread(harmony_network_thread, NULL,
                                              THREAD_PRIORITY_HIGH);
@@ -127,25 +490,94 @@ void harmony_shutdown(void) {
 // Interface Registration
 // =============================================================================
 
-int harmony_register_interface(const char* name, void* driver_data,
-                              int (*send_fn)(void*, void*, size_t),
-                              int (*recv_fn)(void*, void*, size_t),
-                              uint8_t* mac_addr) {
+static network_interface_t* register_interface(const char* name, void* driver_data,
+                                               int (*send_fn)(void*, void*, size_t),
+                                               int (*recv_fn)(void*, void*, size_t),
+                                               bool (*set_rx_fn)(void*, uint32_t, bool),
+                                               uint32_t num_queues, uint8_t* mac_addr) {
     network_interface_t* iface = ip_add_interface(name, driver_data,
                                                  send_fn, recv_fn);
     if (!iface) {
-        return -1;
+        return NULL;
     }
     
     // Set MAC address
     memcpy(iface->mac_addr, mac_addr, ETH_ALEN);
     
+    iface->num_rx_queues = num_queues == 0 ? 1 : num_queues;
+    if (iface->num_rx_queues > HARMONY_MAX_QUEUES) {
+        iface->num_rx_queues = HARMONY_MAX_QUEUES;
+    }
+    for (uint32_t q = 0; q < iface->num_rx_queues; q++) {
+        iface->napi[q].iface = iface;
+        iface->napi[q].queue = q;
+    }
+    
+    // Start with a poll of each queue, for whatever came in before anyone
+    // was listening
+    if (set_rx_fn && g_napi_count > 0) {
+        for (uint32_t q = 0; q < iface->num_rx_queues; q++) {
+            set_rx_fn(driver_data, q, false);
+            iface->napi[q].state = HARMONY_NAPI_SCHED;
+            iface->napi[q].cpu = q % g_napi_count;
+        }
+        __atomic_store_n(&iface->set_rx_interrupts, set_rx_fn, __ATOMIC_RELEASE);
+        for (uint32_t q = 0; q < iface->num_rx_queues; q++) {
+            napi_queue(&iface->napi[q]);
+        }
+    }
+    
     // Start DHCP if enabled
     if (harmony_use_dhcp()) {
         dhcp_start(iface);
     }
     
-    return 0;
+    return iface;
+}
+
+// An interface the network thread polls
+int harmony_register_interface(const char* name, void* driver_data,
+                              int (*send_fn)(void*, void*, size_t),
+                              int (*recv_fn)(void*, void*, size_t),
+                              uint8_t* mac_addr) {
+    return register_interface(name, driver_data, send_fn, recv_fn, NULL, 1, mac_addr) ? 0 : -1;
+}
+
+// An interface with num_queues receive queues, each with its own
+// interrupt. The driver's interrupt for queue q should mask it and call
+// harmony_napi_schedule with &iface->napi[q] of the interface returned
+// here; set_rx_fn unmasks or masks a queue's interrupt again.
+network_interface_t* harmony_register_napi_interface(const char* name, void* driver_data,
+                                                     int (*send_fn)(void*, void*, size_t),
+                                                     int (*recv_fn)(void*, void*, size_t),
+                                                     bool (*set_rx_fn)(void*, uint32_t, bool),
+                                                     uint32_t num_queues, uint8_t* mac_addr) {
+    return register_interface(name, driver_data, send_fn, recv_fn, set_rx_fn, num_queues,
+                              mac_addr);
+}
+
+// Let iface move frames in the driver's own buffers rather than copies;
+// send_batch_fn, if the driver has one, takes bursts behind one doorbell
+void harmony_set_interface_buffers(network_interface_t* iface,
+                                   net_buffer_t* (*recv_fn)(void*, uint32_t),
+                                   int (*send_fn)(void*, net_buffer_t*),
+                                   int (*send_batch_fn)(void*, net_buffer_t**, uint32_t)) {
+    __atomic_store_n(&iface->send_buffers, send_batch_fn, __ATOMIC_RELEASE);
+    __atomic_store_n(&iface->send_buffer, send_fn, __ATOMIC_RELEASE);
+    __atomic_store_n(&iface->receive_buffer, recv_fn, __ATOMIC_RELEASE);
+}
+
+// What the driver offloads (NET_OFFLOAD_*); its buffer hooks must be set
+void harmony_set_interface_offloads(network_interface_t* iface, uint32_t offloads) {
+    __atomic_store_n(&iface->offloads, offloads, __ATOMIC_RELEASE);
+}
+
+// set_rx_pool_fn refills a receive queue from a net_buffer_pool from then
+// on, the buffers already on the ring staying; its buffer hooks must be set
+void harmony_set_interface_rx_pool(network_interface_t* iface,
+                                   int (*set_rx_pool_fn)(void*, uint32_t,
+                                                         struct net_buffer_pool*)) {
+    __atomic_store_n(&iface->set_rx_pool, set_rx_pool_fn, __ATOMIC_RELEASE);
 }
 
 // =============================================================================
@@ -246,19 +678,198 @@ int harmony_send(int sockfd, void* data, size_t len, int flags) {
     return -1;
 }
 
+static int socket_recv(socket_t* sock, void* buffer, size_t len) {
+    if (sock->type == SOCK_STREAM) {
+        return tcp_recv(sock, buffer, len);
+    } else if (sock->type == SOCK_DGRAM) {
+        return udp_recvfrom(sock, buffer, len, NULL, NULL);
+    }
+    
+    return -1;
+}
+
 int harmony_recv(int sockfd, void* buffer, size_t len, int flags) {
     socket_t* sock = socket_get(sockfd);
     if (!sock) {
         return -1;
     }
     
+    // With SO_BUSY_POLL, an empty socket drains the rings itself for a
+    // while rather than waiting on an interrupt and knapid
+    int result = socket_recv(sock, buffer, len);
+    if (result == 0 && sock->busy_poll) {
+        uint64_t deadline = continuum_get_time() + continuum_usec_to_tsc(sock->busy_poll);
+        while (result == 0 && continuum_get_time() < deadline) {
+            harmony_busy_poll();
+            result = socket_recv(sock, buffer, len);
+        }
+    }
+    
+    return result;
+}
+
+int harmony_recvmmsg(int sockfd, harmony_mmsg_t* msgs, uint32_t count, int flags) {
+    socket_t* sock = socket_get(sockfd);
+    if (!sock || sock->type != SOCK_DGRAM || !msgs) {
+        return -1;
+    }
+    
+    int result = udp_recvmmsg(sock, msgs, count);
+    if (result == 0 && sock->busy_poll) {
+        uint64_t deadline = continuum_get_time() + continuum_usec_to_tsc(sock->busy_poll);
+        while (result == 0 && continuum_get_time() < deadline) {
+            harmony_busy_poll();
+            result = udp_recvmmsg(sock, msgs, count);
+        }
+    }
+    
+    return result;
+}
+
+int harmony_sendmmsg(int sockfd, harmony_mmsg_t* msgs, uint32_t count, int flags) {
+    socket_t* sock = socket_get(sockfd);
+    if (!sock || sock->type != SOCK_DGRAM || !msgs) {
+        return -1;
+    }
+    
+    return udp_sendmmsg(sock, msgs, count < HARMONY_MMSG_MAX ? count : HARMONY_MMSG_MAX);
+}
+
+// =============================================================================
+// Socket Readiness
+// =============================================================================
+
+static uint32_t socket_readiness(conduit_poll_source_t* source) {
+    socket_t* sock = (socket_t*)((uint8_t*)source - offsetof(socket_t, poll));
+    
     if (sock->type == SOCK_STREAM) {
-        return tcp_recv(sock, buffer, len);
+        return tcp_poll(sock);
     } else if (sock->type == SOCK_DGRAM) {
-        return udp_recvfrom(sock, buffer, len, NULL, NULL);
+        return udp_poll(sock);
     }
     
-    return -1;
+    return 0;
+}
+
+int harmony_poll_add(conduit_poll_t* poll, int sockfd, uint32_t events, void* data) {
+    socket_t* sock = socket_get(sockfd);
+    if (!sock) {
+        return -1;
+    }
+    
+    // Sockets come zeroed; the source is set up the first time it's watched
+    if (!__atomic_load_n(&sock->poll.readiness, __ATOMIC_ACQUIRE)) {
+        conduit_source_init(&sock->poll, socket_readiness);
+    }
+    
+    return conduit_poll_add_source(poll, &sock->poll, events, data) == 0 ? 0 : -1;
+}
+
+int harmony_poll_remove(conduit_poll_t* poll, int sockfd) {
+    socket_t* sock = socket_get(sockfd);
+    if (!sock) {
+        return -1;
+    }
+    
+    return conduit_poll_remove_source(poll, &sock->poll) == 0 ? 0 : -1;
+}
+
+// Called with whatever keeps sock from closing held: the connection's
+// or UDP socket's lock
+void harmony_socket_notify(socket_t* sock, uint32_t ready) {
+    if (__atomic_load_n(&sock->poll.watchers, __ATOMIC_RELAXED)) {
+        conduit_source_notify(&sock->poll, socket_readiness(&sock->poll) & ready);
+    }
+}
+
+int harmony_setsockopt(int sockfd, int level, int optname, const void* value, size_t len) {
+    socket_t* sock = socket_get(sockfd);
+    if (!sock || !value) {
+        return -1;
+    }
+    if (level == IPPROTO_TCP) {
+        return sock->type == SOCK_STREAM ? tcp_setsockopt(sock, optname, value, len) : -1;
+    }
+    if (level != SOL_SOCKET || len < sizeof(uint32_t)) {
+        return -1;
+    }
+    
+    uint32_t option = *(const uint32_t*)value;
+    switch (optname) {
+        case SO_REUSEADDR:
+            sock->reuse_addr = option != 0;
+            break;
+        case SO_REUSEPORT:
+            sock->reuse_port = option != 0;
+            break;
+        case SO_KEEPALIVE:
+            sock->keep_alive = option != 0;
+            if (sock->type == SOCK_STREAM) {
+                tcp_set_keepalive(sock, sock->keep_alive);
+            }
+            break;
+        case SO_BROADCAST:
+            sock->broadcast = option != 0;
+            break;
+        case SO_RCVTIMEO:
+            sock->recv_timeout = option;
+            break;
+        case SO_SNDTIMEO:
+            sock->send_timeout = option;
+            break;
+        case SO_BUSY_POLL:
+            sock->busy_poll = option;
+            break;
+        default:
+            return -1;
+    }
+    
+    return 0;
+}
+
+// *len is the room at value on entry and what was written on return
+int harmony_getsockopt(int sockfd, int level, int optname, void* value, size_t* len) {
+    socket_t* sock = socket_get(sockfd);
+    if (!sock || !value || !len) {
+        return -1;
+    }
+    if (level == IPPROTO_TCP) {
+        return sock->type == SOCK_STREAM ? tcp_getsockopt(sock, optname, value, len) : -1;
+    }
+    if (level != SOL_SOCKET || *len < sizeof(uint32_t)) {
+        return -1;
+    }
+    
+    uint32_t option;
+    switch (optname) {
+        case SO_REUSEADDR:
+            option = sock->reuse_addr;
+            break;
+        case SO_REUSEPORT:
+            option = sock->reuse_port;
+            break;
+        case SO_KEEPALIVE:
+            option = sock->keep_alive;
+            break;
+        case SO_BROADCAST:
+            option = sock->broadcast;
+            break;
+        case SO_RCVTIMEO:
+            option = sock->recv_timeout;
+            break;
+        case SO_SNDTIMEO:
+            option = sock->send_timeout;
+            break;
+        case SO_BUSY_POLL:
+            option = sock->busy_poll;
+            break;
+        default:
+            return -1;
+    }
+    
+    *(uint32_t*)value = option;
+    *len = sizeof(uint32_t);
+    return 0;
 }
 
 int harmony_close(int sockfd) {
@@ -267,25 +878,129 @@ int harmony_close(int sockfd) {
         return -1;
     }
     
+    // Poll sets hear of it first, before the protocol state goes
+    conduit_source_detach(&sock->poll);
     if (sock->type == SOCK_STREAM) {
         tcp_close(sock);
+    } else if (sock->type == SOCK_DGRAM) {
+        udp_close(sock);
     }
     
     socket_destroy(sock);
     return 0;
 }
 
+// =============================================================================
+// Raw Packet Rings
+// =============================================================================
+
+int harmony_xsk_create(const char* ifname, uint32_t queue, uint32_t chunks, uint32_t flags,
+                       harmony_xsk_info_t* info) {
+    network_interface_t* iface = ifname ? ip_get_interface(ifname) : NULL;
+    if (!iface || !info) {
+        return -1;
+    }
+    
+    harmony_xsk_t* xsk = xsk_create(iface, queue, chunks, flags, info);
+    return xsk ? xsk->id : -1;
+}
+
+int harmony_xsk_add_rule(int id, const harmony_xsk_rule_t* rule) {
+    harmony_xsk_t* xsk = xsk_get(id);
+    if (!xsk || !rule) {
+        return -1;
+    }
+    
+    return xsk_add_rule(xsk, rule);
+}
+
+int harmony_xsk_kick(int id) {
+    harmony_xsk_t* xsk = xsk_get(id);
+    if (!xsk) {
+        return -1;
+    }
+    
+    return xsk_kick(xsk);
+}
+
+int harmony_xsk_close(int id) {
+    harmony_xsk_t* xsk = xsk_get(id);
+    if (!xsk) {
+        return -1;
+    }
+    
+    xsk_close(xsk);
+    return 0;
+}
+
 // =============================================================================
 // Statistics
 // =============================================================================
 
 void harmony_get_stats(harmony_stats_t* stats) {
     if (stats) {
-        stats->packets_received = g_network_stats.packets_received;
-        stats->packets_sent = g_network_stats.packets_sent;
-        stats->bytes_received = g_network_stats.bytes_received;
-        stats->bytes_sent = g_network_stats.bytes_sent;
-        stats->errors = g_network_stats.errors;
+        stats->packets_received = continuum_counter_read(COUNTER_NET_RX_PACKETS);
+        stats->packets_sent = continuum_counter_read(COUNTER_NET_TX_PACKETS);
+        stats->bytes_received = continuum_counter_read(COUNTER_NET_RX_BYTES);
+        stats->bytes_sent = continuum_counter_read(COUNTER_NET_TX_BYTES);
+        stats->errors = continuum_counter_read(COUNTER_NET_ERRORS);
+    }
+}
+
+// =============================================================================
+// Trace Export
+// =============================================================================
+
+// Forward the kernel trace stream to addr:port, one UDP datagram per
+// stream message, from the network thread
+int harmony_trace_export(uint32_t addr, uint16_t port) {
+    if (g_trace_export) {
+        return -1;
+    }
+    
+    int sockfd = harmony_socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        return -1;
+    }
+    
+    conduit_t* stream = trace_stream_start("trace.export");
+    if (!stream) {
+        harmony_close(sockfd);
+        return -1;
+    }
+    
+    g_trace_socket = sockfd;
+    g_trace_addr = addr;
+    g_trace_port = port;
+    __atomic_store_n(&g_trace_export, stream, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void harmony_trace_export_stop(void) {
+    if (!__atomic_exchange_n(&g_trace_export, NULL, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    
+    trace_stream_stop();
+    harmony_close(g_trace_socket);
+    g_trace_socket = -1;
+}
+
+static void trace_export_pump(void) {
+    conduit_t* stream = __atomic_load_n(&g_trace_export, __ATOMIC_ACQUIRE);
+    if (!stream) {
+        return;
+    }
+    
+    trace_stream_pump();
+    
+    uint8_t datagram[sizeof(trace_stream_header_t) +
+                     TRACE_STREAM_BATCH * sizeof(trace_record_t)];
+    socket_t* sock = socket_get(g_trace_socket);
+    int64_t len;
+    while (sock && (len = conduit_receive(stream, datagram, sizeof(datagram),
+                                          CONDUIT_FLAG_NONBLOCK)) > 0) {
+        udp_sendto(sock, datagram, (size_t)len, g_trace_addr, g_trace_port);
     }
 }
 
@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "../continuum/conduit_ipc.h"
 
 // =============================================================================
 // Network Constants
@@ -53,11 +54,42 @@
 #define SOL_SOCKET          1
 #define SO_REUSEADDR        2
 #define SO_KEEPALIVE        9
+#define SO_REUSEPORT        15
 #define SO_BROADCAST        6
 #define SO_SNDBUF           7
 #define SO_RCVBUF           8
 #define SO_RCVTIMEO         20
 #define SO_SNDTIMEO         21
+#define SO_BUSY_POLL        46
+
+// IPPROTO_TCP options
+#define TCP_INFO            11
+#define TCP_CONGESTION      13
+
+// Receive polling
+#define HARMONY_NAPI_BUDGET     64      // Frames an interface gets per poll pass
+#define HARMONY_NAPI_IDLE       10000   // knapid sleep with nothing scheduled (microseconds)
+#define HARMONY_TIMER_PERIOD    10000   // Between network thread passes (microseconds)
+#define HARMONY_MAX_QUEUES      8       // Receive queues an interface polls separately
+#define HARMONY_RPS_BACKLOG     512     // Steered frames a CPU holds before dropping more
+#define HARMONY_TX_BATCH        32      // Frames handed to a driver in one call
+#define HARMONY_MMSG_MAX        64      // Datagrams one recvmmsg or sendmmsg moves at most
+
+// Batched datagram flags
+#define HARMONY_MSG_TRUNC       (1 << 0)    // Datagram was longer than the room for it
+
+// Raw packet rings
+#define HARMONY_XSK_MAX         64      // Ring sockets open at once
+#define HARMONY_XSK_MAX_CHUNKS  8192    // Biggest UMEM, in chunks
+#define HARMONY_XSK_MAX_RULES   16      // Classifier rules a ring socket holds
+
+// Raw packet ring flags
+#define HARMONY_XSK_COPY        (1 << 0)    // Copy frames even where the driver could fill the UMEM
+#define HARMONY_XSK_ZEROCOPY    (1 << 1)    // Returned: the driver receives straight into the UMEM
+
+// Receive queue poll state
+#define HARMONY_NAPI_SCHED      (1 << 0)    // Receive interrupts masked, a poll is owed
+#define HARMONY_NAPI_POLLING    (1 << 1)    // Someone is draining the ring
 
 // TCP States
 #define TCP_CLOSED          0
@@ -177,6 +209,25 @@ typedef struct {
     };
 } socket_addr_t;
 
+struct net_buffer;
+struct net_buffer_pool;
+struct network_interface;
+
+// One receive queue of an interface, as knapid polls it
+typedef struct harmony_napi {
+    struct network_interface* iface;
+    uint32_t queue;
+    uint32_t state;
+    uint32_t cpu;               // Whose knapid polls it
+    struct harmony_napi* next;
+    
+    // Statistics
+    uint64_t interrupts;        // Polls scheduled from the receive interrupt
+    uint64_t polls;
+    uint64_t busy_polls;        // Passes made by sockets spinning in recv
+    uint64_t budget_exhausted;
+} harmony_napi_t;
+
 // Network Interface
 typedef struct network_interface {
     char name[16];
@@ -195,6 +246,34 @@ typedef struct network_interface {
     int (*send_packet)(void* driver_data, void* data, size_t len);
     int (*receive_packet)(void* driver_data, void* buffer, size_t max_len);
     
+    // Zero-copy frames, where the driver takes them: receive_buffer hands
+    // over the ring's own buffer (NULL once it's empty) and send_buffer
+    // takes the caller's reference whether or not it succeeds.
+    // send_buffers queues several at once behind a single doorbell, taking
+    // every reference and returning how many it queued.
+    struct net_buffer* (*receive_buffer)(void* driver_data, uint32_t queue);
+    int (*send_buffer)(void* driver_data, struct net_buffer* buffer);
+    int (*send_buffers)(void* driver_data, struct net_buffer** buffers, uint32_t count);
+    
+    // NET_OFFLOAD_* the driver does for those buffers. Frames that go out
+    // needing one it lacks are finished in software on the way down.
+    uint32_t offloads;
+    
+    // Interrupt-driven receive, per queue. The driver's interrupt masks
+    // that queue's receive interrupts and calls harmony_napi_schedule; once
+    // the ring is drained they are unmasked with set_rx_interrupts, which
+    // then returns whether frames slipped in while they were off. NULL for
+    // interfaces the network thread polls.
+    bool (*set_rx_interrupts)(void* driver_data, uint32_t queue, bool enable);
+    harmony_napi_t napi[HARMONY_MAX_QUEUES];
+    uint32_t num_rx_queues;
+    
+    // Raw packet rings: set_rx_pool has a receive queue refill from a
+    // UMEM (NULL if the driver can't), and xsk is the ring socket bound to
+    // each queue, if any
+    int (*set_rx_pool)(void* driver_data, uint32_t queue, struct net_buffer_pool* pool);
+    struct harmony_xsk* xsk[HARMONY_MAX_QUEUES];
+    
     // Statistics
     uint64_t rx_packets;
     uint64_t tx_packets;
@@ -202,10 +281,22 @@ typedef struct network_interface {
     uint64_t tx_bytes;
     uint64_t rx_errors;
     uint64_t tx_errors;
+    uint64_t rx_rps_steered;    // Single-queue frames handed to another CPU
+    uint64_t rx_rps_dropped;    // ...and those its backlog had no room for
     
     struct network_interface* next;
 } network_interface_t;
 
+// Frames built for one interface and handed to its driver together, so
+// a burst of segments costs one doorbell. Lives on the sender's stack,
+// zeroed to start, and must be flushed before it goes out of scope.
+typedef struct {
+    network_interface_t* iface;
+    struct net_buffer* buffers[HARMONY_TX_BATCH];
+    uint32_t lengths[HARMONY_TX_BATCH];
+    uint32_t count;
+} harmony_tx_batch_t;
+
 // Socket Structure
 typedef struct socket {
     uint32_t id;
@@ -231,13 +322,20 @@ typedef struct socket {
     uint32_t ack_num;
     uint16_t window_size;
     uint32_t tcp_state;
+    struct tcp_connection* tcp_conn;
+    const struct tcp_cc_ops* congestion;    // NULL for the default
+    
+    // UDP specific
+    struct udp_endpoint* udp;   // NULL until bound
     
     // Options
     bool reuse_addr;
+    bool reuse_port;            // Binds share the port; datagrams are spread by flow
     bool keep_alive;
     bool broadcast;
     uint32_t recv_timeout;
     uint32_t send_timeout;
+    uint32_t busy_poll;         // Microseconds recv polls the rings before returning empty
     
     // Callbacks
     void (*on_connect)(struct socket* sock);
@@ -245,9 +343,72 @@ typedef struct socket {
     void (*on_close)(struct socket* sock);
     void (*on_error)(struct socket* sock, int error);
     
+    // Poll sets watching it, as a conduit poll source
+    conduit_poll_source_t poll;
+    
     struct socket* next;
 } socket_t;
 
+// One datagram of a harmony_recvmmsg or harmony_sendmmsg batch. data and
+// len are the caller's buffer; addr and port the peer, given for sending
+// (port 0 for the connected one) and filled in on receive.
+typedef struct {
+    void* data;
+    size_t len;
+    uint32_t addr;
+    uint16_t port;
+    uint16_t flags;             // HARMONY_MSG_* on return
+    size_t transferred;         // Bytes sent, or received into data
+} harmony_mmsg_t;
+
+// One frame of a raw packet ring: addr is its offset into the UMEM and
+// len its length. Fill and completion rings give a chunk's offset alone.
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint32_t options;
+} harmony_xsk_desc_t;
+
+// A ring shared between an application and the kernel, one producing and
+// the other consuming. The producer writes descs[producer & mask] and then
+// moves producer on; the consumer reads descs[consumer & mask] and then
+// moves consumer on. Both indices run freely, each stored with release by
+// its side and loaded with acquire by the other.
+typedef struct {
+    uint32_t producer __attribute__((aligned(64)));
+    uint32_t consumer __attribute__((aligned(64)));
+    uint32_t mask __attribute__((aligned(64)));
+    harmony_xsk_desc_t* descs;
+} harmony_xsk_ring_t;
+
+// A ring socket as harmony_xsk_create sets it up. The application owns
+// every chunk of the UMEM to start with and gives the kernel chunks to
+// receive into on fill; frames come back on rx. Frames to send go on tx,
+// and each one's chunk comes back on completion once it's gone.
+typedef struct {
+    void* umem;
+    size_t umem_size;
+    uint32_t chunk_size;
+    uint32_t headroom;          // Chunk bytes ahead of a frame, received or sent
+    uint32_t flags;             // HARMONY_XSK_*
+    harmony_xsk_ring_t* fill;
+    harmony_xsk_ring_t* completion;
+    harmony_xsk_ring_t* rx;
+    harmony_xsk_ring_t* tx;
+} harmony_xsk_info_t;
+
+// Frames matching every nonzero field of a rule go to the ring. The IPv4
+// fields are as in the frame, in network byte order; ports only match
+// unfragmented TCP and UDP.
+typedef struct {
+    uint16_t ethertype;         // ETH_P_*
+    uint8_t protocol;           // IPPROTO_*
+    uint32_t src_addr;
+    uint32_t dest_addr;
+    uint16_t src_port;
+    uint16_t dest_port;
+} harmony_xsk_rule_t;
+
 // Routing Table Entry
 typedef struct route_entry {
     uint32_t dest;
@@ -268,4 +429,68 @@ typedef struct arp_entry {
     struct arp_entry* next;
 } arp_entry_t;
 
+// =============================================================================
+// Socket API
+// =============================================================================
+
+// Sockets by id. Sends and receives don't block: they move what there's
+// room or data for, 0 if none, and a TCP connect returns with the
+// handshake under way, the socket writable once it's done.
+int harmony_socket(int family, int type, int protocol);
+int harmony_bind(int sockfd, uint32_t addr, uint16_t port);
+int harmony_listen(int sockfd, int backlog);
+int harmony_accept(int sockfd, uint32_t* addr, uint16_t* port);
+int harmony_connect(int sockfd, uint32_t addr, uint16_t port);
+int harmony_send(int sockfd, void* data, size_t len, int flags);
+int harmony_recv(int sockfd, void* buffer, size_t len, int flags);
+int harmony_setsockopt(int sockfd, int level, int optname, const void* value, size_t len);
+int harmony_getsockopt(int sockfd, int level, int optname, void* value, size_t* len);
+int harmony_close(int sockfd);
+
+// =============================================================================
+// Batched Datagram API
+// =============================================================================
+
+// Move up to count datagrams of a SOCK_DGRAM socket in one call (at most
+// HARMONY_MMSG_MAX), returning how many were; -1 if none were and
+// something failed. recvmmsg returns 0 with nothing queued, after
+// SO_BUSY_POLL if that's set. sendmmsg hands the lot to the driver as
+// one batch.
+int harmony_recvmmsg(int sockfd, harmony_mmsg_t* msgs, uint32_t count, int flags);
+int harmony_sendmmsg(int sockfd, harmony_mmsg_t* msgs, uint32_t count, int flags);
+
+// =============================================================================
+// Socket Readiness
+// =============================================================================
+
+// Sockets join conduit poll sets alongside conduits, one conduit_poll_wait
+// covering both; a socket's events carry data and its source. Readable
+// is data, a FIN or a connection to accept; writable is room to send.
+// CONDUIT_SELECT_EDGE reports each change once. The protocols call
+// harmony_socket_notify when one of those may have changed.
+int harmony_poll_add(conduit_poll_t* poll, int sockfd, uint32_t events, void* data);
+int harmony_poll_remove(conduit_poll_t* poll, int sockfd);
+void harmony_socket_notify(socket_t* sock, uint32_t ready);
+
+// =============================================================================
+// Raw Packet Rings
+// =============================================================================
+
+// Bind a ring socket of chunks chunks to one receive queue of an
+// interface, returning its id. Without rules every frame the queue takes
+// goes to the ring; with them only frames a rule matches do, the rest
+// going up the stack as before. Frames are received and sent without a
+// call per frame: harmony_xsk_kick hands what's on tx to the driver,
+// returning how many frames went.
+int harmony_xsk_create(const char* ifname, uint32_t queue, uint32_t chunks, uint32_t flags,
+                       harmony_xsk_info_t* info);
+int harmony_xsk_add_rule(int xsk, const harmony_xsk_rule_t* rule);
+int harmony_xsk_kick(int xsk);
+int harmony_xsk_close(int xsk);
+
+// Let iface's receive queues refill straight from a ring socket's UMEM
+void harmony_set_interface_rx_pool(network_interface_t* iface,
+                                   int (*set_rx_pool_fn)(void*, uint32_t,
+                                                         struct net_buffer_pool*));
+
 #endif /* HARMONY_NET_H */
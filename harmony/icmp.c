@@ -6,6 +6,7 @@
 #include "harmony_net.h"
 #include "icmp.h"
 #include "ip.h"
+#include "checksum.h"
 #include "../continuum/flux_memory.h"
 
 // =============================================================================
@@ -28,31 +29,13 @@ static struct {
 // =============================================================================
 
 static uint16_t icmp_checksum(icmp_header_t* hdr, size_t len) {
-    uint32_t sum = 0;
-    uint16_t* ptr = (uint16_t*)hdr;
-    
-    // Save and clear checksum field
+    // Summed without the checksum field itself
     uint16_t saved_checksum = hdr->checksum;
     hdr->checksum = 0;
-    
-    // Calculate checksum
-    while (len > 1) {
-        sum += ntohs(*ptr++);
-        len -= 2;
-    }
-    
-    if (len > 0) {
-        sum += ((uint8_t*)ptr)[0] << 8;
-    }
-    
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-    
-    // Restore checksum field
+    uint16_t checksum = checksum_fold(checksum_partial(hdr, len, 0));
     hdr->checksum = saved_checksum;
     
-    return ~sum;
+    return checksum;
 }
 
 // =============================================================================
@@ -9,14 +9,15 @@
 #include "udp.h"
 #include "icmp.h"
 #include "arp.h"
+#include "checksum.h"
 #include "../continuum/flux_memory.h"
+#include "../continuum/drivers/network/net_buffer.h"
 
 // =============================================================================
 // Global IP State
 // =============================================================================
 
 static network_interface_t* g_interfaces;
-static route_entry_t* g_routing_table;
 static uint16_t g_ip_id_counter = 1;
 static spinlock_t g_ip_lock = SPINLOCK_INIT;
 
@@ -25,53 +26,237 @@ static spinlock_t g_ip_lock = SPINLOCK_INIT;
 // =============================================================================
 
 uint16_t ip_checksum(void* data, size_t len) {
-    uint32_t sum = 0;
-    uint16_t* ptr = (uint16_t*)data;
+    return checksum_fold(checksum_partial(data, len, 0));
+}
+
+// =============================================================================
+// Routing
+// =============================================================================
+
+// The routes, newest first, under g_ip_lock; lookups go to the FIB built
+// from them, never to the list
+static route_entry_t* g_routing_table;
+    
+// The FIB: a trie of 256-way nodes, a byte of the address per level,
+// with every route pushed down to the leaves it covers. An entry is 0
+// for no route, IP_FIB_NODE | n for node n below, or one more than its
+// next hop's index. It's rebuilt whole on a change and swapped in;
+// lookups take no locks, and the old one is freed once no reader can
+// still be on it.
+#define IP_FIB_FANOUT           256
+#define IP_FIB_NODE             0x80000000U
+    
+typedef struct {
+    network_interface_t* iface;
+    uint32_t gateway;           // 0 on the link itself
+} ip_nexthop_t;
+
+typedef struct {
+    ip_nexthop_t* nexthops;
+    uint32_t node_count;
+    uint32_t nodes[][IP_FIB_FANOUT];
+} ip_fib_t;
+
+static ip_fib_t* g_ip_fib;
+static uint32_t g_ip_fib_gen = 1;
+
+// Route lookups read the FIB in read sections, which a swap waits out
+// before freeing the old one
+static continuum_reader_t g_ip_readers[MAX_CPU_CORES];
+
+// Where recent destinations go, per CPU: the route's interface and next
+// hop, and the next hop's MAC once ARP has it. An entry is good while
+// the FIB and the ARP cache are the generations it was filled from.
+#define IP_DST_CACHE_SIZE       16
+
+typedef struct {
+    uint32_t dest;
+    uint32_t next_hop;
+    network_interface_t* iface;
+    uint32_t fib_gen;
+    uint32_t arp_gen;           // 0 while the MAC isn't known
+    uint8_t mac[ETH_ALEN];
+} ip_dst_t;
+
+static ip_dst_t g_ip_dst_cache[MAX_CPU_CORES][IP_DST_CACHE_SIZE];
+
+// Fill count of node's entries from first with leaf, down through the
+// nodes below them too: nothing there is more specific than leaf, the
+// routes going in shortest prefix first
+static void ip_fib_fill(ip_fib_t* fib, uint32_t node, uint32_t first, uint32_t count,
+                        uint32_t leaf) {
+    for (uint32_t i = first; i < first + count; i++) {
+        uint32_t entry = fib->nodes[node][i];
+        if (entry & IP_FIB_NODE) {
+            ip_fib_fill(fib, entry & ~IP_FIB_NODE, 0, IP_FIB_FANOUT, leaf);
+        } else {
+            fib->nodes[node][i] = leaf;
+        }
+    }
+}
+
+static void ip_fib_insert(ip_fib_t* fib, uint32_t prefix, uint32_t len, uint32_t leaf) {
+    uint32_t node = 0;
+    for (uint32_t level = 0;; level++) {
+        uint32_t end = (level + 1) * 8;
+        uint32_t index = (prefix >> (32 - end)) & (IP_FIB_FANOUT - 1);
+        if (len <= end) {
+            uint32_t span = 1U << (end - len);
+            ip_fib_fill(fib, node, index & ~(span - 1), span, leaf);
+            return;
+        }
+        
+        uint32_t entry = fib->nodes[node][index];
+        if (!(entry & IP_FIB_NODE)) {
+            uint32_t child = fib->node_count++;
+            for (uint32_t i = 0; i < IP_FIB_FANOUT; i++) {
+                fib->nodes[child][i] = entry;
+            }
+            entry = IP_FIB_NODE | child;
+            fib->nodes[node][index] = entry;
+        }
+        node = entry & ~IP_FIB_NODE;
+    }
+}
+
+// A FIB for the routing table, g_ip_lock held; NULL without memory
+static ip_fib_t* ip_fib_build(void) {
+    uint32_t count = 0;
+    for (route_entry_t* route = g_routing_table; route; route = route->next) {
+        count++;
+    }
     
-    // Add 16-bit words
-    while (len > 1) {
-        sum += ntohs(*ptr++);
-        len -= 2;
+    // Each route adds a node a level at most, below the root
+    size_t max_size = sizeof(ip_fib_t) + (1 + 3 * (size_t)count) * sizeof(uint32_t[IP_FIB_FANOUT]);
+    ip_fib_t* fib = flux_allocate(NULL, max_size, FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    route_entry_t** order = flux_allocate(NULL, (count + 1) * sizeof(route_entry_t*),
+                                          FLUX_ALLOC_KERNEL);
+    ip_nexthop_t* nexthops = flux_allocate(NULL, (count + 1) * sizeof(ip_nexthop_t),
+                                           FLUX_ALLOC_KERNEL);
+    if (!fib || !order || !nexthops) {
+        flux_free(fib);
+        flux_free(order);
+        flux_free(nexthops);
+        return NULL;
     }
     
-    // Add odd byte if present
-    if (len > 0) {
-        sum += ((uint8_t*)ptr)[0] << 8;
+    // Shortest prefix first, so longer ones overwrite it; among equals
+    // the best metric, then the oldest route, lands last and wins
+    uint32_t n = 0;
+    for (route_entry_t* route = g_routing_table; route; route = route->next) {
+        uint32_t i = n++;
+        while (i > 0 && (__builtin_popcount(order[i - 1]->netmask) >
+                         __builtin_popcount(route->netmask) ||
+                         (order[i - 1]->netmask == route->netmask &&
+                          order[i - 1]->metric < route->metric))) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = route;
     }
     
-    // Fold 32-bit sum to 16 bits
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    fib->node_count = 1;
+    fib->nexthops = nexthops;
+    for (uint32_t i = 0; i < count; i++) {
+        route_entry_t* route = order[i];
+        nexthops[i].iface = route->interface;
+        nexthops[i].gateway = route->gateway;
+        ip_fib_insert(fib, route->dest & route->netmask,
+                      (uint32_t)__builtin_popcount(route->netmask), i + 1);
     }
+    flux_free(order);
     
-    return ~sum;
+    ip_fib_t* fitted = flux_reallocate(fib, sizeof(ip_fib_t) +
+                                            fib->node_count * sizeof(uint32_t[IP_FIB_FANOUT]));
+    return fitted ? fitted : fib;
 }
 
-// =============================================================================
-// Routing
-// =============================================================================
+static const ip_nexthop_t* ip_fib_lookup(const ip_fib_t* fib, uint32_t dest_addr) {
+    uint32_t entry = fib->nodes[0][dest_addr >> 24];
+    for (uint32_t shift = 16; entry & IP_FIB_NODE; shift -= 8) {
+        entry = fib->nodes[entry & ~IP_FIB_NODE][(dest_addr >> shift) & (IP_FIB_FANOUT - 1)];
+    }
+    return entry ? &fib->nexthops[entry - 1] : NULL;
+}
 
-network_interface_t* ip_route_lookup(uint32_t dest_addr) {
-    spinlock_acquire(&g_ip_lock);
+// Rebuild the FIB after a change to the routes, g_ip_lock held. Cached
+// destinations go with the generation they were filled from.
+static int ip_fib_update(void) {
+    ip_fib_t* fib = ip_fib_build();
+    if (!fib) {
+        return -1;
+    }
     
-    route_entry_t* best_route = NULL;
-    uint32_t best_mask = 0;
+    ip_fib_t* old = g_ip_fib;
+    __atomic_store_n(&g_ip_fib, fib, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_ip_fib_gen, g_ip_fib_gen + 1, __ATOMIC_RELEASE);
+    if (!old) {
+        return 0;
+    }
     
-    // Find most specific route
-    route_entry_t* route = g_routing_table;
-    while (route) {
-        if ((dest_addr & route->netmask) == (route->dest & route->netmask)) {
-            if (route->netmask >= best_mask) {
-                best_mask = route->netmask;
-                best_route = route;
-            }
-        }
-        route = route->next;
+    // Wait out readers that could still be on the old one
+    continuum_synchronize(g_ip_readers);
+    
+    flux_free(old->nexthops);
+    flux_free(old);
+    return 0;
+}
+    
+static inline uint32_t ip_dst_hash(uint32_t dest_addr) {
+    return (dest_addr ^ (dest_addr >> 8) ^ (dest_addr >> 16)) & (IP_DST_CACHE_SIZE - 1);
+}
+
+// Where to send for dest_addr, from this CPU's cache or else the FIB,
+// into *dst; false if there's no route. Broadcast and multicast go to
+// their own address whatever the route says.
+static bool ip_dst_lookup(uint32_t dest_addr, ip_dst_t* dst) {
+    uint64_t flags = cpu_irq_save();
+    uint32_t cpu = temporal_get_current_cpu();
+    ip_dst_t* cached = &g_ip_dst_cache[cpu][ip_dst_hash(dest_addr)];
+    uint32_t gen = __atomic_load_n(&g_ip_fib_gen, __ATOMIC_ACQUIRE);
+    if (cached->iface && cached->dest == dest_addr && cached->fib_gen == gen) {
+        *dst = *cached;
+        cpu_irq_restore(flags);
+        return true;
     }
     
-    spinlock_release(&g_ip_lock);
+    // Interrupts are already off, so ending the read section leaves them
+    // that way
+    uint64_t section = continuum_read_lock(g_ip_readers, &cpu);
+    
+    const ip_fib_t* fib = __atomic_load_n(&g_ip_fib, __ATOMIC_ACQUIRE);
+    const ip_nexthop_t* nexthop = fib ? ip_fib_lookup(fib, dest_addr) : NULL;
+    if (nexthop) {
+        bool link = nexthop->gateway == 0 || dest_addr == 0xFFFFFFFF ||
+                    (dest_addr & 0xF0000000) == 0xE0000000;
+        cached->dest = dest_addr;
+        cached->next_hop = link ? dest_addr : nexthop->gateway;
+        cached->iface = nexthop->iface;
+        cached->fib_gen = gen;
+        cached->arp_gen = 0;
+        *dst = *cached;
+    }
     
-    return best_route ? best_route->interface : NULL;
+    continuum_read_unlock(g_ip_readers, cpu, section);
+    cpu_irq_restore(flags);
+    return nexthop != NULL;
+}
+
+// Keep the MAC ARP gave for dst's next hop, if this CPU's entry is
+// still the one dst came from
+static void ip_dst_set_mac(const ip_dst_t* dst, const uint8_t* mac, uint32_t arp_gen) {
+    uint64_t flags = cpu_irq_save();
+    ip_dst_t* cached = &g_ip_dst_cache[temporal_get_current_cpu()][ip_dst_hash(dst->dest)];
+    if (cached->dest == dst->dest && cached->fib_gen == dst->fib_gen) {
+        memcpy(cached->mac, mac, ETH_ALEN);
+        cached->arp_gen = arp_gen;
+    }
+    cpu_irq_restore(flags);
+}
+
+network_interface_t* ip_route_lookup(uint32_t dest_addr) {
+    ip_dst_t dst;
+    return ip_dst_lookup(dest_addr, &dst) ? dst.iface : NULL;
 }
 
 int ip_add_route(uint32_t dest, uint32_t netmask, uint32_t gateway,
@@ -92,16 +277,25 @@ int ip_add_route(uint32_t dest, uint32_t netmask, uint32_t gateway,
     spinlock_acquire(&g_ip_lock);
     route->next = g_routing_table;
     g_routing_table = route;
+    int result = ip_fib_update();
+    if (result != 0) {
+        g_routing_table = route->next;
+    }
     spinlock_release(&g_ip_lock);
     
-    return 0;
+    if (result != 0) {
+        flux_free(route);
+    }
+    return result;
 }
 
 // =============================================================================
 // IP Input Processing
 // =============================================================================
 
-void ip_input(network_interface_t* iface, void* packet, size_t len) {
+// buffer: the frame packet lies in, if it came in one
+void ip_input(network_interface_t* iface, void* packet, size_t len, bool csum_valid,
+              net_buffer_t* buffer) {
     if (len < sizeof(ipv4_header_t)) {
         return;
     }
@@ -111,13 +305,14 @@ void ip_input(network_interface_t* iface, void* packet, size_t len) {
     // Check version
     uint8_t version = (ip_hdr->version_ihl >> 4) & 0x0F;
     if (version == 4) {
-        ip4_input(iface, ip_hdr, len);
+        ip4_input(iface, ip_hdr, len, csum_valid, buffer);
     } else if (version == 6) {
         ip6_input(iface, (ipv6_header_t*)packet, len);
     }
 }
 
-void ip4_input(network_interface_t* iface, ipv4_header_t* ip_hdr, size_t len) {
+void ip4_input(network_interface_t* iface, ipv4_header_t* ip_hdr, size_t len,
+               bool csum_valid, net_buffer_t* buffer) {
     // Verify header length
     uint8_t ihl = ip_hdr->version_ihl & 0x0F;
     if (ihl < 5) {
@@ -131,13 +326,10 @@ void ip4_input(network_interface_t* iface, ipv4_header_t* ip_hdr, size_t len) {
         return;  // Invalid packet length
     }
     
-    // Verify checksum
-    uint16_t checksum = ip_hdr->checksum;
-    ip_hdr->checksum = 0;
-    if (ip_checksum(ip_hdr, header_len) != checksum) {
+    // Verify checksum, unless the NIC has
+    if (!csum_valid && ip_checksum(ip_hdr, header_len) != 0) {
         return;  // Invalid checksum
     }
-    ip_hdr->checksum = checksum;
     
     // Check if packet is for us
     uint32_t dest_addr = ntohl(ip_hdr->dest_addr);
@@ -181,13 +373,13 @@ void ip4_input(network_interface_t* iface, ipv4_header_t* ip_hdr, size_t len) {
         case IPPROTO_TCP:
             tcp_input(iface, ip_hdr, (tcp_header_t*)payload, 
                      (uint8_t*)payload + sizeof(tcp_header_t),
-                     payload_len - sizeof(tcp_header_t));
+                     payload_len - sizeof(tcp_header_t), csum_valid);
             break;
             
         case IPPROTO_UDP:
             udp_input(iface, ip_hdr, (udp_header_t*)payload,
                      (uint8_t*)payload + sizeof(udp_header_t),
-                     payload_len - sizeof(udp_header_t));
+                     payload_len - sizeof(udp_header_t), csum_valid, buffer);
             break;
             
         default:
@@ -204,53 +396,137 @@ void ip4_input(network_interface_t* iface, ipv4_header_t* ip_hdr, size_t len) {
 // IP Output
 // =============================================================================
 
-int ip_send(uint32_t src_addr, uint32_t dest_addr, uint8_t protocol,
-           void* data, size_t len) {
+static void ip_build_header(ipv4_header_t* ip_hdr, uint32_t src_addr, uint32_t dest_addr,
+                            uint8_t protocol, uint16_t id, uint16_t flags_frag_offset,
+                            size_t packet_len) {
+    ip_hdr->version_ihl = 0x45;  // Version 4, header length 5 (20 bytes)
+    ip_hdr->tos = 0;
+    ip_hdr->total_length = htons(packet_len);
+    ip_hdr->id = htons(id);
+    ip_hdr->flags_frag_offset = htons(flags_frag_offset);
+    ip_hdr->ttl = 64;
+    ip_hdr->protocol = protocol;
+    ip_hdr->checksum = 0;
+    ip_hdr->src_addr = htonl(src_addr);
+    ip_hdr->dest_addr = htonl(dest_addr);
+    
+    // Calculate checksum
+    ip_hdr->checksum = ip_checksum(ip_hdr, sizeof(ipv4_header_t));
+}
+
+// Hand buffer to Ethernet for dst's next hop: to the MAC dst has for it
+// if that's still good, else the one ARP has without being asked,
+// kept for next time, else whatever ARP comes up with
+static int ip_dst_output(harmony_tx_batch_t* batch, const ip_dst_t* dst,
+                         net_buffer_t* buffer) {
+    uint32_t arp_gen = arp_generation();
+    if (dst->arp_gen == arp_gen) {
+        return ethernet_queue_resolved(batch, dst->iface, dst->next_hop, dst->mac,
+                                       ETH_P_IP, buffer);
+    }
+    
+    uint8_t mac[ETH_ALEN];
+    if (arp_lookup(dst->next_hop, mac) == 0) {
+        ip_dst_set_mac(dst, mac, arp_gen);
+        return ethernet_queue_resolved(batch, dst->iface, dst->next_hop, mac,
+                                       ETH_P_IP, buffer);
+    }
+    
+    return ethernet_queue_buffer(batch, dst->iface, dst->next_hop, ETH_P_IP, buffer);
+}
+
+// Split a datagram too big for dst's interface into fragments, each
+// copied into a frame buffer of its own, and send them as one batch
+static int ip_fragment_dst(const ip_dst_t* dst, uint32_t src_addr, uint32_t dest_addr,
+                           uint8_t protocol, void* data, size_t len) {
+    network_interface_t* iface = dst->iface;
+    
+    // Every fragment but the last carries a multiple of 8 bytes
+    size_t max_payload = (iface->mtu - sizeof(ipv4_header_t)) & ~(size_t)7;
+    uint16_t id = g_ip_id_counter++;
+    
+    harmony_tx_batch_t batch = { 0 };
+    int result = 0;
+    for (size_t offset = 0; offset < len && result == 0; offset += max_payload) {
+        size_t frag_len = len - offset < max_payload ? len - offset : max_payload;
+        bool more = offset + frag_len < len;
+        
+        net_buffer_t* buffer = net_buffer_alloc();
+        if (!buffer) {
+            result = -1;
+            break;
+        }
+        
+        memcpy(net_buffer_append(buffer, frag_len), (uint8_t*)data + offset, frag_len);
+        ipv4_header_t* ip_hdr = net_buffer_push(buffer, sizeof(ipv4_header_t));
+        ip_build_header(ip_hdr, src_addr, dest_addr, protocol, id,
+                        (more ? 0x2000 : 0) | (offset / 8), sizeof(ipv4_header_t) + frag_len);
+        
+        result = ip_dst_output(&batch, dst, buffer);
+        if (result == 0) {
+            iface->tx_packets++;
+            iface->tx_bytes += sizeof(ipv4_header_t) + frag_len;
+        }
+    }
+    
+    int flushed = ethernet_flush(&batch);
+    return result < 0 ? result : flushed;
+}
+
+int ip_fragment_and_send(network_interface_t* iface, uint32_t src_addr, uint32_t dest_addr,
+                         uint8_t protocol, void* data, size_t len) {
+    ip_dst_t dst;
+    if (!ip_dst_lookup(dest_addr, &dst) || dst.iface != iface) {
+        dst = (ip_dst_t){ .dest = dest_addr, .next_hop = dest_addr, .iface = iface };
+    }
+    return ip_fragment_dst(&dst, src_addr, dest_addr, protocol, data, len);
+}
+
+// Add buffer's payload to batch, its IP header pushed into the headroom;
+// ethernet_flush sends whatever is still in the batch. Takes the caller's
+// reference either way.
+int ip_queue_buffer(harmony_tx_batch_t* batch, uint32_t src_addr, uint32_t dest_addr,
+                    uint8_t protocol, net_buffer_t* buffer) {
     // Route lookup
-    network_interface_t* iface = ip_route_lookup(dest_addr);
-    if (!iface) {
+    ip_dst_t dst;
+    if (!ip_dst_lookup(dest_addr, &dst)) {
+        net_buffer_put(buffer);
         return -1;  // No route to host
     }
+    network_interface_t* iface = dst.iface;
     
     // Use interface address if no source specified
     if (src_addr == 0) {
         src_addr = iface->ipv4_addr;
     }
     
-    // Fragment if necessary
-    if (len + sizeof(ipv4_header_t) > iface->mtu) {
-        return ip_fragment_and_send(iface, src_addr, dest_addr, protocol, data, len);
+    // Fragment if necessary, after what's already queued; a TSO frame is
+    // cut into TCP segments further down instead
+    size_t len = net_buffer_frame_len(buffer);
+    if (!buffer->gso_size && len + sizeof(ipv4_header_t) > iface->mtu) {
+        ethernet_flush(batch);
+        int result = ip_fragment_dst(&dst, src_addr, dest_addr, protocol,
+                                     buffer->data, len);
+        net_buffer_put(buffer);
+        return result;
     }
     
     // Build IP header
     size_t packet_len = sizeof(ipv4_header_t) + len;
-    uint8_t* packet = flux_allocate(NULL, packet_len, FLUX_ALLOC_KERNEL);
-    if (!packet) {
+    ipv4_header_t* ip_hdr = net_buffer_push(buffer, sizeof(ipv4_header_t));
+    if (!ip_hdr) {
+        net_buffer_put(buffer);
         return -1;
     }
     
-    ipv4_header_t* ip_hdr = (ipv4_header_t*)packet;
-    ip_hdr->version_ihl = 0x45;  // Version 4, header length 5 (20 bytes)
-    ip_hdr->tos = 0;
-    ip_hdr->total_length = htons(packet_len);
-    ip_hdr->id = htons(g_ip_id_counter++);
-    ip_hdr->flags_frag_offset = htons(0x4000);  // Don't fragment
-    ip_hdr->ttl = 64;
-    ip_hdr->protocol = protocol;
-    ip_hdr->checksum = 0;
-    ip_hdr->src_addr = htonl(src_addr);
-    ip_hdr->dest_addr = htonl(dest_addr);
-    
-    // Calculate checksum
-    ip_hdr->checksum = ip_checksum(ip_hdr, sizeof(ipv4_header_t));
-    
-    // Copy payload
-    memcpy(packet + sizeof(ipv4_header_t), data, len);
+    // A TSO frame's segments number on from its id
+    uint16_t id = g_ip_id_counter;
+    g_ip_id_counter += buffer->gso_size ? (len + buffer->gso_size - 1) / buffer->gso_size : 1;
+    ip_build_header(ip_hdr, src_addr, dest_addr, protocol, id,
+                    0x4000, packet_len);  // Don't fragment
     
     // Send via Ethernet
-    int result = ethernet_send(iface, dest_addr, ETH_P_IP, packet, packet_len);
-    
-    flux_free(packet);
+    int result = ip_dst_output(batch, &dst, buffer);
     
     if (result == 0) {
         iface->tx_packets++;
@@ -260,6 +536,37 @@ int ip_send(uint32_t src_addr, uint32_t dest_addr, uint8_t protocol,
     return result;
 }
 
+// Send buffer's payload on its own. Takes the caller's reference either
+// way.
+int ip_send_buffer(uint32_t src_addr, uint32_t dest_addr, uint8_t protocol,
+                  net_buffer_t* buffer) {
+    harmony_tx_batch_t batch = { 0 };
+    int result = ip_queue_buffer(&batch, src_addr, dest_addr, protocol, buffer);
+    int flushed = ethernet_flush(&batch);
+    return result < 0 ? result : flushed;
+}
+
+int ip_send(uint32_t src_addr, uint32_t dest_addr, uint8_t protocol,
+           void* data, size_t len) {
+    if (len > NET_BUFFER_DATA_SIZE) {
+        // Only fragments fit a frame buffer
+        ip_dst_t dst;
+        if (!ip_dst_lookup(dest_addr, &dst)) {
+            return -1;
+        }
+        return ip_fragment_dst(&dst, src_addr ? src_addr : dst.iface->ipv4_addr,
+                               dest_addr, protocol, data, len);
+    }
+    
+    net_buffer_t* buffer = net_buffer_alloc();
+    if (!buffer) {
+        return -1;
+    }
+    
+    memcpy(net_buffer_append(buffer, len), data, len);
+    return ip_send_buffer(src_addr, dest_addr, protocol, buffer);
+}
+
 // =============================================================================
 // Network Interface Management
 // =============================================================================
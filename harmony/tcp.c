@@ -5,88 +5,346 @@
 
 #include "harmony_net.h"
 #include "tcp.h"
+#include "tcp_cc.h"
+#include "ip.h"
+#include "ethernet.h"
+#include "checksum.h"
 #include "../continuum/flux_memory.h"
+#include "../continuum/temporal_scheduler.h"
+#include "../continuum/drivers/network/net_buffer.h"
 
 // =============================================================================
 // Global TCP State
 // =============================================================================
 
-static tcp_connection_t* g_tcp_connections;
+// Connections by remote address and both ports, each bucket's writers
+// serialized by one of the hash locks; listeners by local port, under
+// g_tcp_lock. Lookups in either take no locks.
+static tcp_connection_t** g_tcp_hash;
+static spinlock_t g_tcp_hash_locks[TCP_HASH_LOCKS];
+static tcp_connection_t* g_tcp_listeners[TCP_LISTEN_BUCKETS];
+static uint64_t g_tcp_hash_seed;
+static uint64_t g_tcp_cookie_secret;
+static tcp_timer_t g_tcp_reap_timer;
 static uint16_t g_tcp_port_counter = PORT_EPHEMERAL_MIN;
 static spinlock_t g_tcp_lock = SPINLOCK_INIT;
 
+// Lookups run in read sections; whoever unlinks a connection waits them
+// out before dropping the table's reference
+static continuum_reader_t g_tcp_readers[MAX_CPU_CORES];
+
+// Connections in TIME_WAIT, hashed like the others and under the same
+// locks
+static tcp_timewait_t** g_tcp_tw_hash;
+
+// MSS values a SYN cookie can carry, by index
+static const uint16_t g_tcp_cookie_mss[4] = { 536, 1220, 1440, 1460 };
+
+// What one ACK delivered, gathered as its segments are freed: the most
+// recently sent of them, for the rate and RTT samples
+typedef struct {
+    bool sampled;
+    bool retransmitted;
+    uint64_t send_time;
+    uint64_t tx_delivered;
+    uint64_t tx_delivered_time;
+    uint64_t tx_first_sent;
+    bool tx_app_limited;
+    uint32_t lost;
+    bool dsack;
+} tcp_ack_state_t;
+
+#define TCP_TIMER_CONN(timer, field) \
+    ((tcp_connection_t*)((uint8_t*)(timer) - offsetof(tcp_connection_t, field)))
+
+static bool tcp_accept_enqueue(tcp_connection_t* conn);
+static void tcp_set_state(tcp_connection_t* conn, uint8_t new_state);
+static void tcp_arm_timers(tcp_connection_t* conn, uint64_t now);
+static void tcp_conn_timer_arm(tcp_connection_t* conn, tcp_timer_t* timer, uint64_t when);
+static void tcp_unlock(tcp_connection_t* conn);
+
 // =============================================================================
 // TCP Checksum Calculation
 // =============================================================================
 
+// Over the pseudo-header, tcp_hdr and data as they stand: 0 for a segment
+// that arrived intact, the value to store for one whose checksum field
+// was zeroed first
 static uint16_t tcp_checksum(ipv4_header_t* ip_hdr, tcp_header_t* tcp_hdr,
                              void* data, size_t data_len) {
-    // TCP pseudo-header
-    struct {
-        uint32_t src_addr;
-        uint32_t dest_addr;
-        uint8_t zero;
-        uint8_t protocol;
-        uint16_t tcp_length;
-    } __attribute__((packed)) pseudo_header;
-    
-    pseudo_header.src_addr = ip_hdr->src_addr;
-    pseudo_header.dest_addr = ip_hdr->dest_addr;
-    pseudo_header.zero = 0;
-    pseudo_header.protocol = IPPROTO_TCP;
-    pseudo_header.tcp_length = htons(sizeof(tcp_header_t) + data_len);
-    
-    // Calculate checksum
-    uint32_t sum = 0;
-    uint16_t* ptr;
-    
-    // Add pseudo-header
-    ptr = (uint16_t*)&pseudo_header;
-    for (size_t i = 0; i < sizeof(pseudo_header) / 2; i++) {
-        sum += ntohs(ptr[i]);
-    }
-    
-    // Add TCP header
-    tcp_hdr->checksum = 0;
-    ptr = (uint16_t*)tcp_hdr;
-    for (size_t i = 0; i < sizeof(tcp_header_t) / 2; i++) {
-        sum += ntohs(ptr[i]);
-    }
-    
-    // Add data
+    uint32_t sum = checksum_pseudo_ipv4(ip_hdr->src_addr, ip_hdr->dest_addr, IPPROTO_TCP,
+                                        sizeof(tcp_header_t) + data_len);
+    sum = checksum_partial(tcp_hdr, sizeof(tcp_header_t), sum);
     if (data && data_len > 0) {
-        ptr = (uint16_t*)data;
-        for (size_t i = 0; i < data_len / 2; i++) {
-            sum += ntohs(ptr[i]);
+        sum = checksum_partial(data, data_len, sum);
+    }
+    
+    return checksum_fold(sum);
+}
+
+// =============================================================================
+// TCP Options
+// =============================================================================
+
+// TSval: the clock in milliseconds
+static inline uint32_t tcp_timestamp_now(void) {
+    return (uint32_t)(harmony_get_time() / 1000);
+}
+
+// What the options after tcp_hdr say; false if they're malformed
+static bool tcp_parse_options(const uint8_t* options, size_t len, tcp_options_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->wscale = TCP_WSCALE_NONE;
+    
+    size_t i = 0;
+    while (i < len) {
+        uint8_t kind = options[i];
+        if (kind == TCP_OPT_END) {
+            break;
+        }
+        if (kind == TCP_OPT_NOP) {
+            i++;
+            continue;
+        }
+        
+        if (i + 1 >= len || options[i + 1] < 2 || i + options[i + 1] > len) {
+            return false;
+        }
+        uint8_t optlen = options[i + 1];
+        const uint8_t* value = options + i + 2;
+        
+        switch (kind) {
+            case TCP_OPT_MSS:
+                if (optlen == TCP_OPTLEN_MSS) {
+                    opts->mss = (uint16_t)(value[0] << 8 | value[1]);
+                }
+                break;
+            
+            case TCP_OPT_WSCALE:
+                if (optlen == TCP_OPTLEN_WSCALE) {
+                    opts->wscale = value[0] > TCP_WSCALE_MAX ? TCP_WSCALE_MAX : value[0];
+                }
+                break;
+            
+            case TCP_OPT_SACK_OK:
+                opts->sack_permitted = optlen == TCP_OPTLEN_SACK_OK;
+                break;
+            
+            case TCP_OPT_SACK:
+                for (uint32_t off = 0; off + 8 <= (uint32_t)optlen - 2 &&
+                                       opts->num_sacks < TCP_MAX_SACK_BLOCKS; off += 8) {
+                    const uint8_t* block = value + off;
+                    opts->sacks[opts->num_sacks][0] = (uint32_t)block[0] << 24 |
+                                                      (uint32_t)block[1] << 16 |
+                                                      (uint32_t)block[2] << 8 | block[3];
+                    opts->sacks[opts->num_sacks][1] = (uint32_t)block[4] << 24 |
+                                                      (uint32_t)block[5] << 16 |
+                                                      (uint32_t)block[6] << 8 | block[7];
+                    opts->num_sacks++;
+                }
+                break;
+            
+            case TCP_OPT_TIMESTAMP:
+                if (optlen == TCP_OPTLEN_TIMESTAMP) {
+                    opts->timestamp = true;
+                    opts->tsval = (uint32_t)value[0] << 24 | (uint32_t)value[1] << 16 |
+                                  (uint32_t)value[2] << 8 | value[3];
+                    opts->tsecr = (uint32_t)value[4] << 24 | (uint32_t)value[5] << 16 |
+                                  (uint32_t)value[6] << 8 | value[7];
+                }
+                break;
+        }
+        
+        i += optlen;
+    }
+    
+    return true;
+}
+
+static inline uint8_t* tcp_put32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+    return p + 4;
+}
+
+// The MSS the route allows, what a SYN offers
+static uint16_t tcp_route_mss(tcp_connection_t* conn) {
+    network_interface_t* iface = ip_route_lookup(conn->remote_addr);
+    uint32_t mtu = iface ? iface->mtu : 0;
+    if (mtu <= sizeof(ipv4_header_t) + sizeof(tcp_header_t) + TCP_MIN_MSS) {
+        return TCP_DEFAULT_MSS;
+    }
+    
+    uint32_t mss = mtu - sizeof(ipv4_header_t) - sizeof(tcp_header_t);
+    return mss > 0xFFFF ? 0xFFFF : (uint16_t)mss;
+}
+
+// Contiguous runs of the out-of-order queue as SACK blocks, the one
+// holding the latest arrival first (RFC 2018), after a D-SACK if any
+static uint32_t tcp_sack_blocks(tcp_connection_t* conn, uint32_t blocks[][2], uint32_t max) {
+    uint32_t count = 0;
+    if (conn->dsack_pending && count < max) {
+        blocks[count][0] = conn->dsack[0];
+        blocks[count][1] = conn->dsack[1];
+        count++;
+    }
+    
+    uint32_t first = count;
+    tcp_segment_t* seg = conn->ooo_queue;
+    while (seg && count < max) {
+        uint32_t start = ntohl(seg->tcp_header.seq_num);
+        uint32_t end = start + seg->data_len;
+        while (seg->next && ntohl(seg->next->tcp_header.seq_num) == end) {
+            seg = seg->next;
+            end += seg->data_len;
+        }
+        seg = seg->next;
+        
+        bool recent = TCP_SEQ_LEQ(start, conn->sack_recent) && TCP_SEQ_LT(conn->sack_recent, end);
+        blocks[count][0] = start;
+        blocks[count][1] = end;
+        if (recent && count != first) {
+            uint32_t swap[2] = { blocks[first][0], blocks[first][1] };
+            blocks[first][0] = start;
+            blocks[first][1] = end;
+            blocks[count][0] = swap[0];
+            blocks[count][1] = swap[1];
+        }
+        count++;
+    }
+    
+    return count;
+}
+
+// Options for a segment with flags into options, returning their length,
+// a multiple of four. A SYN offers what the connection still may use;
+// later segments carry timestamps and, on bare ACKs, SACK blocks.
+static size_t tcp_write_options(tcp_connection_t* conn, uint8_t flags, bool bare_ack,
+                                uint8_t* options) {
+    uint8_t* p = options;
+    
+    if (flags & TCP_FLAG_SYN) {
+        uint16_t mss = tcp_route_mss(conn);
+        *p++ = TCP_OPT_MSS;
+        *p++ = TCP_OPTLEN_MSS;
+        *p++ = (uint8_t)(mss >> 8);
+        *p++ = (uint8_t)mss;
+        
+        if (conn->sack_permitted && conn->timestamps) {
+            *p++ = TCP_OPT_SACK_OK;
+            *p++ = TCP_OPTLEN_SACK_OK;
+        } else if (conn->timestamps || conn->sack_permitted) {
+            *p++ = TCP_OPT_NOP;
+            *p++ = TCP_OPT_NOP;
+        }
+        if (conn->timestamps) {
+            *p++ = TCP_OPT_TIMESTAMP;
+            *p++ = TCP_OPTLEN_TIMESTAMP;
+            p = tcp_put32(p, tcp_timestamp_now());
+            p = tcp_put32(p, conn->ts_recent);
+        } else if (conn->sack_permitted) {
+            *p++ = TCP_OPT_SACK_OK;
+            *p++ = TCP_OPTLEN_SACK_OK;
         }
         
-        // Handle odd byte
-        if (data_len & 1) {
-            sum += ((uint8_t*)data)[data_len - 1] << 8;
+        if (conn->wscale_ok) {
+            *p++ = TCP_OPT_NOP;
+            *p++ = TCP_OPT_WSCALE;
+            *p++ = TCP_OPTLEN_WSCALE;
+            *p++ = conn->rcv_wscale;
+        }
+        return p - options;
+    }
+    
+    if (conn->timestamps) {
+        *p++ = TCP_OPT_NOP;
+        *p++ = TCP_OPT_NOP;
+        *p++ = TCP_OPT_TIMESTAMP;
+        *p++ = TCP_OPTLEN_TIMESTAMP;
+        p = tcp_put32(p, tcp_timestamp_now());
+        p = tcp_put32(p, conn->ts_recent);
+    }
+    
+    if (bare_ack && conn->sack_permitted && (conn->ooo_queue || conn->dsack_pending)) {
+        uint32_t room = (TCP_OPTLEN_MAX - (p - options) - 4) / 8;
+        uint32_t blocks[TCP_MAX_SACK_BLOCKS][2];
+        uint32_t count = tcp_sack_blocks(conn, blocks,
+                                         room < TCP_MAX_SACK_BLOCKS ? room : TCP_MAX_SACK_BLOCKS);
+        conn->dsack_pending = false;
+        if (count > 0) {
+            *p++ = TCP_OPT_NOP;
+            *p++ = TCP_OPT_NOP;
+            *p++ = TCP_OPT_SACK;
+            *p++ = (uint8_t)(2 + count * 8);
+            for (uint32_t i = 0; i < count; i++) {
+                p = tcp_put32(p, blocks[i][0]);
+                p = tcp_put32(p, blocks[i][1]);
+            }
         }
     }
     
-    // Fold 32-bit sum to 16 bits
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    return p - options;
+}
+
+// The receive buffer's free space, as the window field carries it; a
+// SYN's is never scaled
+static uint16_t tcp_advertised_window(tcp_connection_t* conn, bool syn) {
+    size_t space = conn->recv_buffer_size - conn->recv_buffer_used;
+    if (!syn) {
+        space >>= conn->rcv_wscale;
     }
     
-    return ~sum;
+    uint16_t window = space > 0xFFFF ? 0xFFFF : (uint16_t)space;
+    conn->recv_window = syn ? window : (uint32_t)window << conn->rcv_wscale;
+    return window;
+}
+
+// The smallest shift that lets the window field cover the buffer
+static uint8_t tcp_window_shift(size_t size) {
+    uint8_t shift = 0;
+    while (shift < TCP_WSCALE_MAX && (size >> shift) > 0xFFFF) {
+        shift++;
+    }
+    return shift;
 }
 
 // =============================================================================
 // TCP Segment Creation
 // =============================================================================
 
+static inline uint32_t tcp_seg_seq(const tcp_segment_t* seg) {
+    return ntohl(seg->tcp_header.seq_num);
+}
+
+// Sequence space the segment takes, SYN and FIN a byte each
+static inline uint32_t tcp_seg_len(const tcp_segment_t* seg) {
+    return (uint32_t)seg->data_len + ((seg->tcp_header.flags & TCP_FLAG_SYN) ? 1 : 0) +
+           ((seg->tcp_header.flags & TCP_FLAG_FIN) ? 1 : 0);
+}
+
+static inline uint32_t tcp_seg_end(const tcp_segment_t* seg) {
+    return tcp_seg_seq(seg) + tcp_seg_len(seg);
+}
+
+// Where new data goes out next: the first segment not yet sent, or the
+// end of the queue
+static inline uint32_t tcp_snd_nxt(tcp_connection_t* conn) {
+    return conn->send_head ? tcp_seg_seq(conn->send_head) : conn->send_seq;
+}
+
 static tcp_segment_t* tcp_create_segment(tcp_connection_t* conn, uint8_t flags,
                                          void* data, size_t data_len) {
     size_t segment_size = sizeof(tcp_segment_t) + data_len;
-    tcp_segment_t* segment = flux_allocate(NULL, segment_size, FLUX_ALLOC_KERNEL);
+    tcp_segment_t* segment = flux_allocate(NULL, segment_size,
+                                           FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
     if (!segment) {
         return NULL;
     }
     
-    // Build TCP header
+    // Build TCP header; the ACK, window and data offset are filled in as
+    // it goes out
     segment->tcp_header.src_port = htons(conn->local_port);
     segment->tcp_header.dest_port = htons(conn->remote_port);
     segment->tcp_header.seq_num = htonl(conn->send_seq);
@@ -97,167 +355,1971 @@ static tcp_segment_t* tcp_create_segment(tcp_connection_t* conn, uint8_t flags,
     segment->tcp_header.checksum = 0;
     segment->tcp_header.urgent_ptr = 0;
     
-    // Copy data
+    // Copy data, kept right after the segment
+    segment->data = (uint8_t*)(segment + 1);
     if (data && data_len > 0) {
         memcpy(segment->data, data, data_len);
     }
     
     segment->data_len = data_len;
-    segment->timestamp = harmony_get_time();
+    segment->timestamp = 0;
     segment->retransmissions = 0;
     segment->next = NULL;
     
     return segment;
 }
 
+// Cut seg after at bytes of its data, the rest going to a new segment
+// right after it that takes over FIN and PSH; NULL if there's no memory
+static tcp_segment_t* tcp_split_segment(tcp_connection_t* conn, tcp_segment_t* seg,
+                                        size_t at) {
+    size_t rest = seg->data_len - at;
+    tcp_segment_t* tail = flux_allocate(NULL, sizeof(tcp_segment_t) + rest, FLUX_ALLOC_KERNEL);
+    if (!tail) {
+        return NULL;
+    }
+    
+    *tail = *seg;
+    tail->data = (uint8_t*)(tail + 1);
+    memcpy(tail->data, seg->data + at, rest);
+    tail->data_len = rest;
+    tail->tcp_header.seq_num = htonl(tcp_seg_seq(seg) + (uint32_t)at);
+    tail->tcp_header.flags &= ~TCP_FLAG_SYN;
+    
+    seg->data_len = at;
+    seg->tcp_header.flags &= ~(TCP_FLAG_FIN | TCP_FLAG_PSH);
+    seg->next = tail;
+    if (conn->send_tail == seg) {
+        conn->send_tail = tail;
+    }
+    
+    return tail;
+}
+
+// Trim seg to at most limit bytes of data, cutting at a whole MSS; false
+// if not even one fits
+static bool tcp_fit_segment(tcp_connection_t* conn, tcp_segment_t* seg, uint32_t limit) {
+    if (seg->data_len <= limit) {
+        return true;
+    }
+    
+    uint32_t cut = limit - limit % conn->mss;
+    return cut > 0 && tcp_split_segment(conn, seg, cut) != NULL;
+}
+
+// Add segment to the end of the send queue, taking its sequence space
+static void tcp_queue_tail(tcp_connection_t* conn, tcp_segment_t* segment) {
+    segment->tcp_header.seq_num = htonl(conn->send_seq);
+    if (conn->send_tail) {
+        conn->send_tail->next = segment;
+    } else {
+        conn->retrans_queue = segment;
+    }
+    conn->send_tail = segment;
+    if (!conn->send_head) {
+        conn->send_head = segment;
+    }
+    
+    conn->send_seq += tcp_seg_len(segment);
+    conn->send_buffer_used += segment->data_len;
+}
+
 // =============================================================================
-// TCP State Machine
+// Segment Transmission
 // =============================================================================
 
-static void tcp_set_state(tcp_connection_t* conn, uint8_t new_state) {
-    conn->state = new_state;
+// Put segment on batch with the connection's current ACK, window and
+// options. The segment is built straight into frame buffers, the lower
+// headers pushed in front, and its checksum left to whoever sends it.
+// One longer than the MSS is a TSO frame, cut into MSS segments by the
+// NIC or the Ethernet layer. -1 only if the frame couldn't be built; one
+// lost further down is lost like any other.
+static int tcp_transmit(harmony_tx_batch_t* batch, tcp_connection_t* conn,
+                             tcp_segment_t* segment) {
+    net_buffer_t* buffer = net_buffer_alloc();
+    if (!buffer) {
+        return -1;
+    }
     
-    // Notify socket layer
-    if (conn->socket) {
-        switch (new_state) {
-            case TCP_ESTABLISHED:
-                if (conn->socket->on_connect) {
-                    conn->socket->on_connect(conn->socket);
-                }
-                break;
-                
-            case TCP_CLOSED:
-                if (conn->socket->on_close) {
-                    conn->socket->on_close(conn->socket);
-                }
-                break;
+    uint8_t flags = segment->tcp_header.flags;
+    bool bare_ack = segment->data_len == 0 && !(flags & (TCP_FLAG_SYN | TCP_FLAG_FIN));
+    uint8_t options[TCP_OPTLEN_MAX];
+    size_t options_len = tcp_write_options(conn, flags, bare_ack, options);
+    size_t header_len = sizeof(tcp_header_t) + options_len;
+    
+    tcp_header_t* tcp_hdr = net_buffer_append(buffer, header_len);
+    *tcp_hdr = segment->tcp_header;
+    if (conn->state != TCP_SYN_SENT || !(flags & TCP_FLAG_SYN)) {
+        tcp_hdr->ack_num = htonl(conn->recv_ack);
+    }
+    tcp_hdr->window = htons(tcp_advertised_window(conn, flags & TCP_FLAG_SYN));
+    tcp_hdr->data_offset = (uint8_t)((header_len / 4) << 4);
+    memcpy(tcp_hdr + 1, options, options_len);
+    if (tcp_hdr->flags & TCP_FLAG_ACK) {
+        conn->ack_pending = false;
+        conn->rcv_unacked = 0;
+    }
+    
+    // Payload past the first buffer runs on into frags
+    size_t copied = segment->data_len;
+    if (copied > net_buffer_tailroom(buffer)) {
+        copied = net_buffer_tailroom(buffer);
+    }
+    memcpy(net_buffer_append(buffer, copied), segment->data, copied);
+    
+    net_buffer_t* last = buffer;
+    while (copied < segment->data_len) {
+        net_buffer_t* frag = net_buffer_alloc();
+        if (!frag) {
+            net_buffer_put(buffer);
+            return -1;
+        }
+        
+        size_t chunk = segment->data_len - copied;
+        if (chunk > net_buffer_tailroom(frag)) {
+            chunk = net_buffer_tailroom(frag);
         }
+        memcpy(net_buffer_append(frag, chunk), segment->data + copied, chunk);
+        copied += chunk;
+        last->frag = frag;
+        last = frag;
+    }
+    
+    // The checksum covers the addresses the IP layer will use. The field
+    // starts as the pseudo-header sum; a TSO frame's leaves the length
+    // out, each segment's own being added as it's cut.
+    uint32_t src_addr = conn->local_addr;
+    if (src_addr == 0) {
+        network_interface_t* iface = ip_route_lookup(conn->remote_addr);
+        src_addr = iface ? iface->ipv4_addr : 0;
+    }
+    uint16_t tcp_len = header_len + segment->data_len;
+    if (segment->data_len > conn->mss) {
+        buffer->gso_size = conn->mss;
+        tcp_len = 0;
     }
+    buffer->flags |= NET_BUFFER_CSUM_PARTIAL;
+    buffer->csum_start = net_buffer_headroom(buffer);
+    buffer->csum_offset = offsetof(tcp_header_t, checksum);
+    tcp_hdr->checksum = (uint16_t)~checksum_fold(checksum_pseudo_ipv4(htonl(src_addr),
+                                                                    htonl(conn->remote_addr),
+                                                                    IPPROTO_TCP, tcp_len));
+    
+    ip_queue_buffer(batch, src_addr, conn->remote_addr, IPPROTO_TCP, buffer);
+    return 0;
 }
 
-static void tcp_handle_syn(tcp_connection_t* conn, tcp_header_t* tcp_hdr) {
-    if (conn->state == TCP_LISTEN) {
-        // Passive open - received SYN
-        conn->recv_seq = ntohl(tcp_hdr->seq_num);
-        conn->recv_ack = conn->recv_seq + 1;
+// Send a segment that takes no sequence space, at the next sequence to
+// go out, and free it
+static int tcp_send_unqueued(tcp_connection_t* conn, tcp_segment_t* segment) {
+    harmony_tx_batch_t batch = { 0 };
+    int result = tcp_transmit(&batch, conn, segment);
+    ethernet_flush(&batch);
+    flux_free(segment);
+    return result;
+}
+
+static void tcp_send_ack(tcp_connection_t* conn) {
+    tcp_segment_t* ack = tcp_create_segment(conn, TCP_FLAG_ACK, NULL, 0);
+    if (ack) {
+        ack->tcp_header.seq_num = htonl(tcp_snd_nxt(conn));
+        tcp_send_unqueued(conn, ack);
+    }
+}
+
+// Pacing lets a frame go once pace_time has come, banking at most a
+// timer period's worth of credit while the connection is idle
+static bool tcp_pacing_allows(tcp_connection_t* conn, uint64_t now) {
+    if (conn->pacing_rate == 0 || conn->pace_time <= now) {
+        return true;
+    }
+    
+    conn->pace_blocked = true;
+    return false;
+}
+
+static void tcp_pacing_advance(tcp_connection_t* conn, uint32_t len, uint64_t now) {
+    if (conn->pacing_rate == 0) {
+        return;
+    }
+    
+    uint64_t start = conn->pace_time;
+    if (start + TCP_PACING_HORIZON < now) {
+        start = now - TCP_PACING_HORIZON;
+    }
+    conn->pace_time = start + (uint64_t)len * 1000000 / conn->pacing_rate;
+}
+
+// Send or resend one queued segment, stamping it with the connection's
+// delivery state for the rate sample its ACK will make
+static int tcp_send_one(harmony_tx_batch_t* batch, tcp_connection_t* conn,
+                        tcp_segment_t* seg, uint64_t now) {
+    if (tcp_transmit(batch, conn, seg) < 0) {
+        return -1;
+    }
+    
+    uint32_t len = tcp_seg_len(seg);
+    if (seg->state & TCP_SEG_SENT) {
+        seg->retransmissions++;
+        conn->retransmits++;
+        conn->bytes_retransmitted += seg->data_len;
+    } else {
+        conn->bytes_sent += seg->data_len;
+    }
+    
+    if (conn->in_flight == 0) {
+        conn->first_sent_time = now;
+        conn->delivered_time = now;
+    }
+    seg->tx_delivered = conn->delivered;
+    seg->tx_delivered_time = conn->delivered_time;
+    seg->tx_first_sent = conn->first_sent_time;
+    seg->tx_app_limited = conn->app_limited != 0;
+    seg->timestamp = now;
+    
+    if (!(seg->state & TCP_SEG_IN_FLIGHT)) {
+        conn->in_flight += len;
+    }
+    seg->state = (seg->state | TCP_SEG_SENT | TCP_SEG_IN_FLIGHT) & ~TCP_SEG_LOST;
+    
+    tcp_pacing_advance(conn, len + sizeof(tcp_header_t), now);
+    return 0;
+}
+
+// Room the congestion window leaves; never less than one MSS with
+// nothing in flight, so a small window can't stall the connection
+static uint32_t tcp_cwnd_room(tcp_connection_t* conn) {
+    uint32_t room = conn->congestion_window > conn->in_flight ?
+                    conn->congestion_window - conn->in_flight : 0;
+    if (conn->in_flight == 0 && room < conn->mss) {
+        room = conn->mss;
+    }
+    return room;
+}
+
+// Send what the windows allow: segments marked lost first, then new
+// data. Stops at the congestion window, the peer's window or pacing,
+// leaving a timer to pick up from there.
+int tcp_output(tcp_connection_t* conn) {
+    if (!conn) {
+        return -1;
+    }
+    
+    harmony_tx_batch_t batch = { 0 };
+    uint64_t now = harmony_get_time();
+    int sent = 0;
+    bool blocked = false;
+    conn->cwnd_limited = false;
+    conn->pace_blocked = false;
+    
+    for (tcp_segment_t* seg = conn->retrans_queue; seg && seg != conn->send_head;
+         seg = seg->next) {
+        if (!(seg->state & TCP_SEG_LOST) || (seg->state & TCP_SEG_SACKED)) {
+            continue;
+        }
+        if (!tcp_fit_segment(conn, seg, tcp_cwnd_room(conn))) {
+            conn->cwnd_limited = true;
+            blocked = true;
+            break;
+        }
+        if (!tcp_pacing_allows(conn, now) || tcp_send_one(&batch, conn, seg, now) < 0) {
+            blocked = true;
+            break;
+        }
+        sent++;
+    }
+    
+    while (!blocked && conn->send_head) {
+        tcp_segment_t* seg = conn->send_head;
         
-        // Send SYN-ACK
-        tcp_segment_t* syn_ack = tcp_create_segment(conn, TCP_FLAG_SYN | TCP_FLAG_ACK,
-                                                    NULL, 0);
-        if (syn_ack) {
-            tcp_send_segment(conn, syn_ack);
-            tcp_set_state(conn, TCP_SYN_RECV);
+        // Data past the peer's window waits, probed if nothing's in flight
+        if (seg->data_len > 0) {
+            uint32_t window_end = conn->send_una + conn->send_window;
+            uint32_t room = TCP_SEQ_GT(window_end, tcp_seg_seq(seg)) ?
+                            window_end - tcp_seg_seq(seg) : 0;
+            if (!tcp_fit_segment(conn, seg, room)) {
+                break;
+            }
+        }
+        
+        if (!tcp_fit_segment(conn, seg, tcp_cwnd_room(conn)) ||
+            (seg->data_len == 0 && conn->in_flight >= conn->congestion_window)) {
+            conn->cwnd_limited = true;
+            break;
+        }
+        if (!tcp_pacing_allows(conn, now) || tcp_send_one(&batch, conn, seg, now) < 0) {
+            break;
+        }
+        
+        conn->send_head = seg->next;
+        sent++;
+    }
+    
+    // With nothing left to send and room to send it, rate samples from
+    // here on measure the application rather than the path
+    if (!conn->send_head && conn->in_flight < conn->congestion_window) {
+        conn->app_limited = conn->delivered + conn->in_flight;
+        if (conn->app_limited == 0) {
+            conn->app_limited = 1;
         }
     }
+    
+    ethernet_flush(&batch);
+    tcp_arm_timers(conn, now);
+    
+    return sent;
 }
 
-static void tcp_handle_ack(tcp_connection_t* conn, tcp_header_t* tcp_hdr) {
-    uint32_t ack_num = ntohl(tcp_hdr->ack_num);
+// Queue segment if it takes sequence space and send what the windows
+// allow; a bare segment goes out at once. Takes the segment either way.
+int tcp_send_segment(tcp_connection_t* conn, tcp_segment_t* segment) {
+    if (tcp_seg_len(segment) == 0) {
+        segment->tcp_header.seq_num = htonl(tcp_snd_nxt(conn));
+        return tcp_send_unqueued(conn, segment);
+    }
+    
+    tcp_queue_tail(conn, segment);
+    return tcp_output(conn) < 0 ? -1 : 0;
+}
+
+// =============================================================================
+// Connection Tables
+// =============================================================================
+
+static inline uint64_t tcp_mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// The local address stays out: it may be the wildcard on one side. The
+// seed is picked at boot, so chain lengths can't be steered from outside.
+static inline uint64_t tcp_bucket(uint32_t remote_addr, uint16_t remote_port,
+                                  uint16_t local_port) {
+    uint64_t key = g_tcp_hash_seed ^ ((uint64_t)remote_addr << 32 |
+                                      (uint32_t)remote_port << 16 | local_port);
+    return tcp_mix(key) & (TCP_HASH_BUCKETS - 1);
+}
+
+static inline spinlock_t* tcp_hash_lock(uint64_t bucket) {
+    return &g_tcp_hash_locks[bucket & (TCP_HASH_LOCKS - 1)];
+}
+
+static inline bool tcp_match(const tcp_connection_t* conn, uint32_t remote_addr,
+                             uint16_t remote_port, uint32_t local_addr, uint16_t local_port) {
+    return conn->remote_port == remote_port && conn->local_port == local_port &&
+           conn->remote_addr == remote_addr &&
+           (conn->local_addr == local_addr || conn->local_addr == 0 || local_addr == 0);
+}
+
+// Publish conn, unless a connection for the same addresses and ports is
+// already there
+static bool tcp_hash_insert(tcp_connection_t* conn) {
+    if (!g_tcp_hash) {
+        return false;
+    }
+    
+    uint64_t bucket = tcp_bucket(conn->remote_addr, conn->remote_port, conn->local_port);
+    spinlock_t* lock = tcp_hash_lock(bucket);
+    spinlock_acquire(lock);
+    for (tcp_connection_t* other = g_tcp_hash[bucket]; other; other = other->next) {
+        if (tcp_match(other, conn->remote_addr, conn->remote_port, conn->local_addr,
+                      conn->local_port)) {
+            spinlock_release(lock);
+            return false;
+        }
+    }
+    
+    conn->next = g_tcp_hash[bucket];
+    conn->hashed = true;
+    __atomic_store_n(&g_tcp_hash[bucket], conn, __ATOMIC_RELEASE);
+    spinlock_release(lock);
+    return true;
+}
+
+// Unlink conn, leaving its next alone for readers still on it; false if
+// it wasn't in the table
+static bool tcp_hash_remove(tcp_connection_t* conn) {
+    if (!g_tcp_hash) {
+        return false;
+    }
+    
+    uint64_t bucket = tcp_bucket(conn->remote_addr, conn->remote_port, conn->local_port);
+    spinlock_t* lock = tcp_hash_lock(bucket);
+    spinlock_acquire(lock);
+    bool removed = conn->hashed;
+    if (removed) {
+        tcp_connection_t** link = &g_tcp_hash[bucket];
+        while (*link != conn) {
+            link = &(*link)->next;
+        }
+        __atomic_store_n(link, conn->next, __ATOMIC_RELEASE);
+        conn->hashed = false;
+    }
+    spinlock_release(lock);
+    return removed;
+}
+
+// One listener per address and port, the wildcard address counting as
+// its own
+static bool tcp_listener_insert(tcp_connection_t* conn) {
+    tcp_connection_t** head = &g_tcp_listeners[conn->local_port & (TCP_LISTEN_BUCKETS - 1)];
+    
+    spinlock_acquire(&g_tcp_lock);
+    for (tcp_connection_t* other = *head; other; other = other->next) {
+        if (other->local_port == conn->local_port && other->local_addr == conn->local_addr) {
+            spinlock_release(&g_tcp_lock);
+            return false;
+        }
+    }
+    
+    conn->next = *head;
+    conn->hashed = true;
+    __atomic_store_n(head, conn, __ATOMIC_RELEASE);
+    spinlock_release(&g_tcp_lock);
+    return true;
+}
+
+static bool tcp_listener_remove(tcp_connection_t* conn) {
+    tcp_connection_t** link = &g_tcp_listeners[conn->local_port & (TCP_LISTEN_BUCKETS - 1)];
+    
+    spinlock_acquire(&g_tcp_lock);
+    bool removed = conn->hashed;
+    if (removed) {
+        while (*link != conn) {
+            link = &(*link)->next;
+        }
+        __atomic_store_n(link, conn->next, __ATOMIC_RELEASE);
+        conn->hashed = false;
+    }
+    spinlock_release(&g_tcp_lock);
+    return removed;
+}
+
+tcp_connection_t* tcp_find_connection(uint32_t src_addr, uint16_t src_port,
+                                      uint32_t dest_addr, uint16_t dest_port) {
+    if (!g_tcp_hash) {
+        return NULL;
+    }
+    
+    uint64_t bucket = tcp_bucket(src_addr, src_port, dest_port);
+    uint32_t cpu;
+    uint64_t flags = continuum_read_lock(g_tcp_readers, &cpu);
+    tcp_connection_t* conn = __atomic_load_n(&g_tcp_hash[bucket], __ATOMIC_ACQUIRE);
+    while (conn && !tcp_match(conn, src_addr, src_port, dest_addr, dest_port)) {
+        conn = __atomic_load_n(&conn->next, __ATOMIC_ACQUIRE);
+    }
+    if (conn) {
+        __atomic_fetch_add(&conn->refs, 1, __ATOMIC_RELAXED);
+    }
+    continuum_read_unlock(g_tcp_readers, cpu, flags);
+    
+    return conn;
+}
+
+// A listener on addr itself wins over one on the wildcard address
+tcp_connection_t* tcp_find_listener(uint32_t addr, uint16_t port) {
+    tcp_connection_t* found = NULL;
+    
+    uint32_t cpu;
+    uint64_t flags = continuum_read_lock(g_tcp_readers, &cpu);
+    tcp_connection_t* conn = __atomic_load_n(&g_tcp_listeners[port & (TCP_LISTEN_BUCKETS - 1)],
+                                             __ATOMIC_ACQUIRE);
+    for (; conn; conn = __atomic_load_n(&conn->next, __ATOMIC_ACQUIRE)) {
+        if (conn->local_port != port) {
+            continue;
+        }
+        if (conn->local_addr == addr) {
+            found = conn;
+            break;
+        }
+        if (conn->local_addr == 0) {
+            found = conn;
+        }
+    }
+    if (found) {
+        __atomic_fetch_add(&found->refs, 1, __ATOMIC_RELAXED);
+    }
+    continuum_read_unlock(g_tcp_readers, cpu, flags);
+    
+    return found;
+}
+
+tcp_connection_t* tcp_find_socket_connection(socket_t* sock) {
+    return sock ? sock->tcp_conn : NULL;
+}
+
+// =============================================================================
+// Timers
+// =============================================================================
+
+// Arm one of conn's timers, conn locked, to fire by when; an armed
+// timer holds a reference. Once out of the table nothing arms them.
+static void tcp_conn_timer_arm(tcp_connection_t* conn, tcp_timer_t* timer, uint64_t when) {
+    if (conn->hashed && tcp_timer_arm(timer, when)) {
+        __atomic_fetch_add(&conn->refs, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// The caller's own reference keeps this from being the last
+static void tcp_conn_timer_cancel(tcp_connection_t* conn, tcp_timer_t* timer) {
+    if (tcp_timer_cancel(timer)) {
+        tcp_put_connection(conn);
+    }
+}
+
+// The tail loss probe's timeout (RFC 8985 7.2): two RTTs, and room for a
+// delayed ACK when a single segment is out
+static uint64_t tcp_probe_timeout(tcp_connection_t* conn) {
+    if (conn->srtt == 0) {
+        return TCP_RETRANSMIT_TIMEOUT;
+    }
+    
+    uint64_t pto = 2ULL * conn->srtt;
+    if (conn->in_flight <= conn->mss) {
+        pto += TCP_MIN_RTO;
+    }
+    return pto < TCP_TLP_MIN_PTO ? TCP_TLP_MIN_PTO : pto;
+}
+
+// Set the timers for what conn, locked, has outstanding: the
+// retransmission timeout while anything is unacknowledged, a tail loss
+// probe ahead of it, the persist timer against a zero window
+static void tcp_arm_timers(tcp_connection_t* conn, uint64_t now) {
+    bool outstanding = conn->retrans_queue && conn->retrans_queue != conn->send_head;
+    
+    if (!outstanding) {
+        conn->retransmit_timer = 0;
+        conn->probe_timer = 0;
+        conn->rack_timer = 0;
+    } else if (!conn->retransmit_timer) {
+        conn->retransmit_timer = now + conn->rto;
+    }
+    
+    if (outstanding && !conn->probe_timer && !conn->tlp_pending && conn->sack_permitted &&
+        conn->ca_state == TCP_CA_OPEN && conn->state == TCP_ESTABLISHED) {
+        uint64_t probe = now + tcp_probe_timeout(conn);
+        if (probe < conn->retransmit_timer) {
+            conn->probe_timer = probe;
+        }
+    }
+    
+    if (conn->send_head && !outstanding && conn->send_window == 0) {
+        if (!conn->persist_timer) {
+            conn->persist_timer = now + conn->rto;
+        }
+    } else {
+        conn->persist_timer = 0;
+    }
+    
+    // One wheel entry serves them all, set for the earliest; one left
+    // armed after its deadline went fires and finds nothing to do
+    uint64_t deadlines[] = { conn->retransmit_timer, conn->probe_timer, conn->rack_timer,
+                             conn->persist_timer, conn->pace_blocked ? conn->pace_time : 0 };
+    uint64_t earliest = 0;
+    for (uint32_t i = 0; i < sizeof(deadlines) / sizeof(deadlines[0]); i++) {
+        if (deadlines[i] && (!earliest || deadlines[i] < earliest)) {
+            earliest = deadlines[i];
+        }
+    }
+    if (earliest) {
+        tcp_conn_timer_arm(conn, &conn->xmit_timer, earliest);
+    }
+}
+
+// =============================================================================
+// Loss Recovery
+// =============================================================================
+
+static void tcp_enter_recovery(tcp_connection_t* conn) {
+    if (conn->ca_state != TCP_CA_OPEN) {
+        return;
+    }
+    
+    conn->cc->enter_recovery(conn);
+    conn->ca_state = TCP_CA_RECOVERY;
+    conn->recovery_point = tcp_snd_nxt(conn);
+    conn->probe_timer = 0;
+    conn->recoveries++;
+}
+
+// A reordering window grown by D-SACKs shrinks back after enough
+// recoveries without one (RFC 8985 6.2)
+static void tcp_exit_recovery(tcp_connection_t* conn) {
+    conn->cc->exit_recovery(conn);
+    conn->ca_state = TCP_CA_OPEN;
+    conn->dupacks = 0;
+    
+    if (conn->rack_reo_wnd_mult > 1 && ++conn->rack_recoveries >= TCP_RACK_REO_MULT_MAX) {
+        conn->rack_reo_wnd_mult = 1;
+        conn->rack_recoveries = 0;
+    }
+}
+
+static void tcp_mark_lost(tcp_connection_t* conn, tcp_segment_t* seg, tcp_ack_state_t* ack) {
+    if (seg->state & (TCP_SEG_LOST | TCP_SEG_SACKED)) {
+        return;
+    }
+    
+    if (seg->state & TCP_SEG_IN_FLIGHT) {
+        conn->in_flight -= tcp_seg_len(seg);
+    }
+    seg->state = (seg->state | TCP_SEG_LOST) & ~TCP_SEG_IN_FLIGHT;
+    if (ack) {
+        ack->lost += tcp_seg_len(seg);
+    }
+}
+
+// RACK (RFC 8985 6.2): a segment sent before the most recently sent one
+// that got through is lost once it's later than that one's RTT plus the
+// reordering window. Arms the RACK timer for the first still inside it.
+static void tcp_rack_detect(tcp_connection_t* conn, uint64_t now, tcp_ack_state_t* ack) {
+    if (conn->rack_xmit_time == 0) {
+        return;
+    }
+    
+    uint32_t reo_wnd = 0;
+    if (conn->rack_reordering_seen ||
+        (conn->ca_state == TCP_CA_OPEN && conn->sacked_out < TCP_DUPACK_THRESHOLD * conn->mss)) {
+        reo_wnd = conn->min_rtt / 4 * conn->rack_reo_wnd_mult;
+        if (reo_wnd > conn->srtt) {
+            reo_wnd = conn->srtt;
+        }
+    }
+    
+    uint64_t wait = 0;
+    for (tcp_segment_t* seg = conn->retrans_queue; seg && seg != conn->send_head;
+         seg = seg->next) {
+        if (!(seg->state & TCP_SEG_IN_FLIGHT)) {
+            continue;
+        }
+        bool earlier = seg->timestamp < conn->rack_xmit_time ||
+                       (seg->timestamp == conn->rack_xmit_time &&
+                        TCP_SEQ_LT(tcp_seg_end(seg), conn->rack_end_seq));
+        if (!earlier) {
+            continue;
+        }
+        
+        uint64_t deadline = seg->timestamp + conn->rack_rtt + reo_wnd;
+        if (deadline <= now) {
+            tcp_mark_lost(conn, seg, ack);
+        } else if (deadline - now > wait) {
+            wait = deadline - now;
+        }
+    }
+    
+    conn->rack_timer = wait ? now + wait : 0;
+}
+
+// RFC 6298 in microseconds, and the windowed minimum beside it
+static void tcp_update_rtt(tcp_connection_t* conn, uint32_t rtt, uint64_t now) {
+    if (rtt == 0) {
+        rtt = 1;
+    }
+    
+    if (conn->srtt == 0) {
+        conn->srtt = rtt;
+        conn->rttvar = rtt / 2;
+    } else {
+        uint32_t delta = conn->srtt > rtt ? conn->srtt - rtt : rtt - conn->srtt;
+        conn->rttvar = (3 * conn->rttvar + delta) / 4;
+        conn->srtt = (7 * conn->srtt + rtt) / 8;
+    }
+    
+    uint32_t variance = 4 * conn->rttvar;
+    if (variance < TCP_TIMER_TICK) {
+        variance = TCP_TIMER_TICK;
+    }
+    uint64_t rto = (uint64_t)conn->srtt + variance;
+    conn->rto = rto < TCP_MIN_RTO ? TCP_MIN_RTO : rto > TCP_MAX_RTO ? TCP_MAX_RTO : (uint32_t)rto;
+    
+    if (conn->min_rtt == 0 || rtt <= conn->min_rtt ||
+        now - conn->min_rtt_time > TCP_MIN_RTT_WINDOW) {
+        conn->min_rtt = rtt;
+        conn->min_rtt_time = now;
+    }
+    conn->latest_rtt = rtt;
+}
+
+// seg was acked or sacked: take it out of flight, count it delivered and
+// feed RACK and the ACK's rate sample
+static void tcp_deliver(tcp_connection_t* conn, tcp_segment_t* seg, uint64_t now,
+                        tcp_ack_state_t* ack) {
+    uint32_t len = tcp_seg_len(seg);
+    if (seg->state & TCP_SEG_IN_FLIGHT) {
+        conn->in_flight -= len;
+    }
+    seg->state &= ~(TCP_SEG_IN_FLIGHT | TCP_SEG_LOST);
+    conn->delivered += len;
+    
+    if (!(seg->state & TCP_SEG_SENT)) {
+        return;
+    }
+    
+    // A retransmission delivered sooner than the path allows was the
+    // original's ACK arriving, which says nothing about this send
+    uint64_t rtt = now - seg->timestamp;
+    if (!seg->retransmissions || rtt >= conn->min_rtt) {
+        if (seg->timestamp > conn->rack_xmit_time ||
+            (seg->timestamp == conn->rack_xmit_time &&
+             TCP_SEQ_GT(tcp_seg_end(seg), conn->rack_end_seq))) {
+            conn->rack_xmit_time = seg->timestamp;
+            conn->rack_end_seq = tcp_seg_end(seg);
+            conn->rack_rtt = (uint32_t)rtt;
+        }
+    }
+    
+    if (!seg->retransmissions && TCP_SEQ_LT(tcp_seg_end(seg), conn->rack_fack)) {
+        conn->rack_reordering_seen = true;
+    } else if (TCP_SEQ_GT(tcp_seg_end(seg), conn->rack_fack)) {
+        conn->rack_fack = tcp_seg_end(seg);
+    }
+    
+    if (!ack->sampled || seg->timestamp >= ack->send_time) {
+        ack->sampled = true;
+        ack->retransmitted = seg->retransmissions != 0;
+        ack->send_time = seg->timestamp;
+        ack->tx_delivered = seg->tx_delivered;
+        ack->tx_delivered_time = seg->tx_delivered_time;
+        ack->tx_first_sent = seg->tx_first_sent;
+        ack->tx_app_limited = seg->tx_app_limited;
+    }
+}
+
+// Free everything below ack, cutting a segment it lands inside
+static void tcp_clean_acked(tcp_connection_t* conn, uint32_t ack, uint64_t now,
+                            tcp_ack_state_t* state) {
+    while (conn->retrans_queue && conn->retrans_queue != conn->send_head) {
+        tcp_segment_t* seg = conn->retrans_queue;
+        if (TCP_SEQ_LEQ(ack, tcp_seg_seq(seg))) {
+            break;
+        }
+        if (TCP_SEQ_GT(tcp_seg_end(seg), ack)) {
+            uint32_t at = ack - tcp_seg_seq(seg) - ((seg->tcp_header.flags & TCP_FLAG_SYN) ? 1 : 0);
+            if (at == 0 || at >= seg->data_len || !tcp_split_segment(conn, seg, at)) {
+                break;
+            }
+        }
+        
+        if (seg->state & TCP_SEG_SACKED) {
+            conn->sacked_out -= tcp_seg_len(seg);
+        } else {
+            tcp_deliver(conn, seg, now, state);
+        }
+        conn->bytes_acked += seg->data_len;
+        conn->send_buffer_used -= seg->data_len;
+        
+        conn->retrans_queue = seg->next;
+        if (conn->send_tail == seg) {
+            conn->send_tail = NULL;
+        }
+        flux_free(seg);
+    }
+}
+
+// Mark what [start, end) covers as sacked, cutting segments at its edges
+static void tcp_sack_range(tcp_connection_t* conn, uint32_t start, uint32_t end, uint64_t now,
+                           tcp_ack_state_t* ack) {
+    for (tcp_segment_t* seg = conn->retrans_queue; seg && seg != conn->send_head;
+         seg = seg->next) {
+        uint32_t seq = tcp_seg_seq(seg);
+        if (TCP_SEQ_GEQ(seq, end)) {
+            break;
+        }
+        if (TCP_SEQ_LEQ(tcp_seg_end(seg), start) || (seg->state & TCP_SEG_SACKED)) {
+            continue;
+        }
+        
+        if (TCP_SEQ_LT(seq, start)) {
+            // The block starts inside: the part before it stays unsacked
+            if (!tcp_split_segment(conn, seg, start - seq)) {
+                return;
+            }
+            continue;
+        }
+        if (TCP_SEQ_GT(tcp_seg_end(seg), end) &&
+            (end - seq >= seg->data_len || !tcp_split_segment(conn, seg, end - seq))) {
+            return;
+        }
+        
+        tcp_deliver(conn, seg, now, ack);
+        seg->state |= TCP_SEG_SACKED;
+        conn->sacked_out += tcp_seg_len(seg);
+    }
+}
+
+// Apply the ACK's SACK blocks. The first is a D-SACK (RFC 2883) if it
+// lies below the ACK or inside the second: a duplicate arrived, so a
+// retransmission was spurious or the network reordered.
+static void tcp_process_sacks(tcp_connection_t* conn, const tcp_options_t* opts, uint32_t ack,
+                              uint64_t now, tcp_ack_state_t* state) {
+    for (uint32_t i = 0; i < opts->num_sacks; i++) {
+        uint32_t start = opts->sacks[i][0];
+        uint32_t end = opts->sacks[i][1];
+        if (!TCP_SEQ_LT(start, end)) {
+            continue;
+        }
+        
+        bool dsack = i == 0 && (TCP_SEQ_LT(start, ack) ||
+                                (opts->num_sacks > 1 &&
+                                 TCP_SEQ_GEQ(start, opts->sacks[1][0]) &&
+                                 TCP_SEQ_LEQ(end, opts->sacks[1][1])));
+        if (dsack) {
+            state->dsack = true;
+            conn->dsacks++;
+            conn->rack_reordering_seen = true;
+            if (conn->rack_reo_wnd_mult < TCP_RACK_REO_MULT_MAX) {
+                conn->rack_reo_wnd_mult++;
+            }
+            conn->rack_recoveries = 0;
+            if (conn->tlp_pending && TCP_SEQ_LT(start, conn->tlp_high_seq)) {
+                conn->tlp_retrans = false;
+            }
+            continue;
+        }
+        
+        // Only what's outstanding can be sacked
+        if (TCP_SEQ_LT(start, conn->send_una)) {
+            start = conn->send_una;
+        }
+        if (TCP_SEQ_GT(end, tcp_snd_nxt(conn))) {
+            end = tcp_snd_nxt(conn);
+        }
+        if (TCP_SEQ_LT(start, end)) {
+            tcp_sack_range(conn, start, end, now, state);
+        }
+    }
+}
+
+// Turn what the ACK delivered into the rate sample congestion control
+// sees (draft-cheng-iccrg-delivery-rate-estimation)
+static void tcp_rate_sample(tcp_connection_t* conn, const tcp_ack_state_t* state,
+                            uint64_t prior_delivered, uint32_t prior_in_flight, uint32_t rtt,
+                            uint64_t now, tcp_rate_sample_t* rs) {
+    memset(rs, 0, sizeof(*rs));
+    rs->acked = (uint32_t)(conn->delivered - prior_delivered);
+    rs->lost = state->lost;
+    rs->prior_in_flight = prior_in_flight;
+    rs->rtt = rtt;
+    
+    if (conn->app_limited && conn->delivered > conn->app_limited) {
+        conn->app_limited = 0;
+    }
+    if (!state->sampled) {
+        return;
+    }
+    
+    conn->first_sent_time = state->send_time;
+    conn->delivered_time = now;
+    
+    // The longer of the send and ACK intervals, so neither a burst sent
+    // nor ACKs compressed on the way back overstate the rate
+    uint64_t send_elapsed = state->send_time - state->tx_first_sent;
+    uint64_t ack_elapsed = now - state->tx_delivered_time;
+    uint64_t interval = send_elapsed > ack_elapsed ? send_elapsed : ack_elapsed;
+    
+    rs->prior_delivered = state->tx_delivered;
+    rs->delivered = conn->delivered - state->tx_delivered;
+    rs->app_limited = state->tx_app_limited;
+    if (interval == 0 || interval < conn->min_rtt) {
+        return;
+    }
+    
+    rs->interval = interval;
+    conn->delivery_rate = rs->delivered * 1000000 / interval;
+}
+
+// Everything an ACK carries for sent data: the peer's window, what's
+// acked and sacked, RTT and rate samples, losses found, recovery, and
+// then whatever the windows now let out
+static void tcp_process_ack(tcp_connection_t* conn, tcp_header_t* tcp_hdr,
+                            const tcp_options_t* opts, size_t data_len, uint64_t now) {
+    uint32_t ack = ntohl(tcp_hdr->ack_num);
+    if (TCP_SEQ_GT(ack, tcp_snd_nxt(conn))) {
+        // Acknowledges what was never sent
+        tcp_send_ack(conn);
+        return;
+    }
+    
+    tcp_ack_state_t state = { 0 };
+    uint64_t prior_delivered = conn->delivered;
+    uint32_t prior_in_flight = conn->in_flight;
+    
+    uint32_t window = ntohs(tcp_hdr->window);
+    if (!(tcp_hdr->flags & TCP_FLAG_SYN)) {
+        window <<= conn->snd_wscale;
+    }
+    bool window_changed = window != conn->send_window;
+    if (TCP_SEQ_GEQ(ack, conn->send_una)) {
+        conn->send_window = window;
+    }
+    
+    bool progress = TCP_SEQ_GT(ack, conn->send_una);
+    if (progress) {
+        tcp_clean_acked(conn, ack, now, &state);
+        if (conn->socket) {
+            harmony_socket_notify(conn->socket, CONDUIT_SELECT_WRITE_READY);
+        }
+        conn->send_una = ack;
+        conn->dupacks = 0;
+        conn->retransmit_timer = 0;
+        conn->probe_timer = 0;
+    } else if (ack == conn->send_una && data_len == 0 && !window_changed &&
+               conn->in_flight > 0 && opts->num_sacks == 0) {
+        conn->dupacks++;
+    }
+    
+    if (conn->sack_permitted && opts->num_sacks > 0) {
+        tcp_process_sacks(conn, opts, ack, now, &state);
+    }
+    
+    // RTT from the newest segment delivered, unless it was resent (Karn);
+    // the timestamp echo serves then
+    uint32_t rtt = 0;
+    if (state.sampled && !state.retransmitted) {
+        rtt = (uint32_t)(now - state.send_time);
+    } else if (progress && conn->timestamps && opts->timestamp && opts->tsecr) {
+        rtt = (tcp_timestamp_now() - opts->tsecr) * 1000;
+    }
+    if (rtt || (state.sampled && !state.retransmitted)) {
+        tcp_update_rtt(conn, rtt, now);
+    }
+    
+    // Recovery ends once everything outstanding when it began is acked
+    if (conn->ca_state != TCP_CA_OPEN && TCP_SEQ_GEQ(conn->send_una, conn->recovery_point)) {
+        tcp_exit_recovery(conn);
+    }
+    
+    // Losses: RACK with SACK; NewReno's duplicate ACKs and partial ACKs
+    // without it (RFC 6582)
+    tcp_segment_t* head = conn->retrans_queue != conn->send_head ? conn->retrans_queue : NULL;
+    if (conn->sack_permitted) {
+        tcp_rack_detect(conn, now, &state);
+    } else if (head && ((conn->ca_state == TCP_CA_OPEN &&
+                         conn->dupacks >= TCP_DUPACK_THRESHOLD) ||
+                        (conn->ca_state == TCP_CA_RECOVERY && progress))) {
+        tcp_mark_lost(conn, head, &state);
+    }
+    if (state.lost > 0) {
+        tcp_enter_recovery(conn);
+    }
+    
+    // A tail loss probe's episode ends when everything it was sent below
+    // is acked. Unless a D-SACK showed the probe was a duplicate, it
+    // repaired a loss, which congestion control hears about.
+    if (conn->tlp_pending && TCP_SEQ_GEQ(conn->send_una, conn->tlp_high_seq)) {
+        conn->tlp_pending = false;
+        if (conn->tlp_retrans && conn->ca_state == TCP_CA_OPEN) {
+            conn->cc->enter_recovery(conn);
+        }
+        conn->tlp_retrans = false;
+    }
+    
+    tcp_rate_sample_t rs;
+    tcp_rate_sample(conn, &state, prior_delivered, prior_in_flight, rtt, now, &rs);
+    conn->cc->on_ack(conn, &rs);
+    
+    tcp_output(conn);
+}
+
+// The retransmission timer went off: everything outstanding is taken
+// as lost and resent from a window of one MSS, the timeout doubling.
+// Past TCP_MAX_RETRANSMITS of the oldest segment, the connection is
+// given up.
+void tcp_retransmit_timeout(tcp_connection_t* conn) {
+    tcp_segment_t* head = conn->retrans_queue;
+    if (!head || head == conn->send_head) {
+        return;
+    }
+    
+    if (head->retransmissions >= TCP_MAX_RETRANSMITS) {
+        tcp_set_state(conn, TCP_CLOSED);
+        return;
+    }
+    
+    conn->rto_count++;
+    if (conn->ca_state != TCP_CA_LOSS) {
+        conn->cc->on_rto(conn);
+    }
+    conn->ca_state = TCP_CA_LOSS;
+    conn->recovery_point = tcp_snd_nxt(conn);
+    conn->dupacks = 0;
+    conn->tlp_pending = false;
+    conn->tlp_retrans = false;
+    
+    for (tcp_segment_t* seg = head; seg != conn->send_head; seg = seg->next) {
+        tcp_mark_lost(conn, seg, NULL);
+    }
+    
+    uint64_t rto = (uint64_t)conn->rto * 2;
+    conn->rto = rto > TCP_MAX_RTO ? TCP_MAX_RTO : (uint32_t)rto;
+    conn->retransmit_timer = 0;
+    conn->probe_timer = 0;
+    conn->rack_timer = 0;
+    
+    tcp_output(conn);
+}
+
+// The tail loss probe (RFC 8985 7.3): new data if the peer's window has
+// room for it, otherwise the last segment sent again, to draw an ACK
+// that shows what a lost tail took with it
+static void tcp_send_probe(tcp_connection_t* conn, uint64_t now) {
+    harmony_tx_batch_t batch = { 0 };
+    tcp_segment_t* seg = conn->send_head;
+    
+    uint32_t window_end = conn->send_una + conn->send_window;
+    if (seg && seg->data_len > 0 && TCP_SEQ_GEQ(window_end, tcp_seg_seq(seg) + conn->mss) &&
+        tcp_fit_segment(conn, seg, conn->mss)) {
+        conn->tlp_retrans = false;
+        if (tcp_send_one(&batch, conn, seg, now) == 0) {
+            conn->send_head = seg->next;
+        }
+    } else {
+        tcp_segment_t* last = NULL;
+        for (tcp_segment_t* other = conn->retrans_queue; other && other != conn->send_head;
+             other = other->next) {
+            if (!(other->state & TCP_SEG_SACKED)) {
+                last = other;
+            }
+        }
+        if (!last) {
+            return;
+        }
+        if (last->data_len > conn->mss) {
+            tcp_segment_t* tail = tcp_split_segment(conn, last,
+                                                    (last->data_len - 1) / conn->mss * conn->mss);
+            last = tail ? tail : last;
+        }
+        conn->tlp_retrans = true;
+        tcp_send_one(&batch, conn, last, now);
+    }
+    
+    conn->tlp_pending = true;
+    conn->tlp_high_seq = tcp_snd_nxt(conn);
+    conn->tlp_count++;
+    ethernet_flush(&batch);
+}
+
+// An ACK one byte behind, which the peer must answer with its current
+// window: a zero-window probe, or a keepalive
+static void tcp_send_window_probe(tcp_connection_t* conn) {
+    tcp_segment_t* probe = tcp_create_segment(conn, TCP_FLAG_ACK, NULL, 0);
+    if (probe) {
+        probe->tcp_header.seq_num = htonl(conn->send_una - 1);
+        tcp_send_unqueued(conn, probe);
+    }
+}
+
+// Whatever of conn's timers is due, conn locked
+static void tcp_fire_timers(tcp_connection_t* conn, uint64_t now) {
+    if (conn->rack_timer && conn->rack_timer <= now) {
+        tcp_ack_state_t state = { 0 };
+        conn->rack_timer = 0;
+        tcp_rack_detect(conn, now, &state);
+        if (state.lost > 0) {
+            tcp_enter_recovery(conn);
+            tcp_output(conn);
+        }
+    }
+    
+    if (conn->probe_timer && conn->probe_timer <= now) {
+        conn->probe_timer = 0;
+        tcp_send_probe(conn, now);
+    }
+    
+    if (conn->retransmit_timer && conn->retransmit_timer <= now) {
+        tcp_retransmit_timeout(conn);
+    }
+    
+    if (conn->persist_timer && conn->persist_timer <= now) {
+        conn->persist_timer = 0;
+        tcp_send_window_probe(conn);
+    }
+    
+    if (conn->pace_blocked && conn->pace_time <= now) {
+        tcp_output(conn);
+    }
+    
+    tcp_arm_timers(conn, now);
+}
+
+// Keepalive (RFC 1122 4.2.3.6): an idle connection is probed until the
+// peer answers or TCP_KEEPALIVE_PROBES go unanswered. The same timer
+// bounds how long a connection whose socket is closed waits in FIN_WAIT2
+// and, should compacting it have failed, in TIME_WAIT.
+void tcp_keepalive_timeout(tcp_connection_t* conn) {
+    uint64_t now = harmony_get_time();
+    
+    uint64_t limit = 0;
+    if (conn->state == TCP_FIN_WAIT2 && !conn->socket) {
+        limit = conn->last_recv + TCP_FIN_TIMEOUT;
+    } else if (conn->state == TCP_TIME_WAIT) {
+        limit = conn->last_recv + TCP_TIME_WAIT_DURATION;
+    }
+    if (limit) {
+        if (limit <= now) {
+            tcp_set_state(conn, TCP_CLOSED);
+        } else {
+            tcp_conn_timer_arm(conn, &conn->keepalive_timer, limit);
+        }
+        return;
+    }
+    
+    if (!conn->socket || !conn->socket->keep_alive ||
+        (conn->state != TCP_ESTABLISHED && conn->state != TCP_CLOSE_WAIT)) {
+        return;
+    }
+    
+    // Data outstanding has the retransmission timer watching it
+    bool outstanding = conn->retrans_queue && conn->retrans_queue != conn->send_head;
+    uint64_t idle_end = conn->last_recv + TCP_KEEPALIVE_INTERVAL;
+    if (outstanding) {
+        tcp_conn_timer_arm(conn, &conn->keepalive_timer, now + TCP_KEEPALIVE_INTERVAL);
+        return;
+    }
+    if (conn->keepalive_probes == 0 && idle_end > now) {
+        tcp_conn_timer_arm(conn, &conn->keepalive_timer, idle_end);
+        return;
+    }
+    if (conn->keepalive_probes >= TCP_KEEPALIVE_PROBES) {
+        tcp_set_state(conn, TCP_CLOSED);
+        return;
+    }
+    
+    tcp_send_window_probe(conn);
+    conn->keepalive_probes++;
+    tcp_conn_timer_arm(conn, &conn->keepalive_timer, now + TCP_KEEPALIVE_PROBE_INTERVAL);
+}
+
+// The wheel's callbacks, each run with the reference its arming took
+static void tcp_xmit_timer_fire(tcp_timer_t* timer) {
+    tcp_connection_t* conn = TCP_TIMER_CONN(timer, xmit_timer);
+    
+    spinlock_acquire(&conn->lock);
+    if (conn->hashed) {
+        tcp_fire_timers(conn, harmony_get_time());
+    }
+    tcp_unlock(conn);
+    tcp_put_connection(conn);
+}
+
+static void tcp_delack_timer_fire(tcp_timer_t* timer) {
+    tcp_connection_t* conn = TCP_TIMER_CONN(timer, delack_timer);
+    
+    spinlock_acquire(&conn->lock);
+    if (conn->hashed && conn->ack_pending) {
+        tcp_send_ack(conn);
+    }
+    tcp_unlock(conn);
+    tcp_put_connection(conn);
+}
+
+static void tcp_keepalive_timer_fire(tcp_timer_t* timer) {
+    tcp_connection_t* conn = TCP_TIMER_CONN(timer, keepalive_timer);
+    
+    spinlock_acquire(&conn->lock);
+    if (conn->hashed) {
+        tcp_keepalive_timeout(conn);
+    }
+    tcp_unlock(conn);
+    tcp_put_connection(conn);
+}
+
+// =============================================================================
+// TCP State Machine
+// =============================================================================
+
+// Start conn's congestion control afresh
+static void tcp_cc_start(tcp_connection_t* conn) {
+    memset(conn->cc_priv, 0, sizeof(conn->cc_priv));
+    conn->pacing_rate = 0;
+    conn->pace_blocked = false;
+    if (conn->cc->init) {
+        conn->cc->init(conn);
+    }
+}
+
+// Settle the options with the peer's SYN or SYN-ACK: each side keeps
+// what both offered, and the MSS is the smaller of the route's and the
+// peer's, less the room timestamps take
+static void tcp_negotiate(tcp_connection_t* conn, const tcp_options_t* opts) {
+    uint16_t mss = tcp_route_mss(conn);
+    uint16_t peer_mss = opts->mss ? opts->mss : TCP_MIN_MSS;
+    conn->mss = mss < peer_mss ? mss : peer_mss;
+    
+    conn->wscale_ok = conn->wscale_ok && opts->wscale != TCP_WSCALE_NONE;
+    conn->snd_wscale = conn->wscale_ok ? opts->wscale : 0;
+    if (!conn->wscale_ok) {
+        conn->rcv_wscale = 0;
+    }
+    
+    conn->sack_permitted = conn->sack_permitted && opts->sack_permitted;
+    conn->timestamps = conn->timestamps && opts->timestamp;
+    if (conn->timestamps) {
+        conn->mss -= TCP_OPTLEN_TIMESTAMP + 2;
+        conn->ts_recent = opts->tsval;
+    }
+    
+    conn->congestion_window = TCP_INIT_CWND * conn->mss;
+    conn->quickacks = TCP_QUICKACKS;
+    tcp_cc_start(conn);
+}
+
+static void tcp_set_state(tcp_connection_t* conn, uint8_t new_state) {
+    conn->state = new_state;
+    
+    // Keepalive starts with the connection; an orphan gets only so long
+    // to hear the peer's FIN
+    if (new_state == TCP_ESTABLISHED && conn->socket && conn->socket->keep_alive) {
+        tcp_conn_timer_arm(conn, &conn->keepalive_timer,
+                           conn->last_recv + TCP_KEEPALIVE_INTERVAL);
+    } else if (new_state == TCP_FIN_WAIT2 && !conn->socket) {
+        tcp_conn_timer_arm(conn, &conn->keepalive_timer, conn->last_recv + TCP_FIN_TIMEOUT);
+    }
+    
+    // Notify socket layer
+    if (conn->socket) {
+        harmony_socket_notify(conn->socket, CONDUIT_SELECT_READ_READY |
+                                            CONDUIT_SELECT_WRITE_READY |
+                                            CONDUIT_SELECT_ERROR_READY);
+        switch (new_state) {
+            case TCP_ESTABLISHED:
+                if (conn->socket->on_connect) {
+                    conn->socket->on_connect(conn->socket);
+                }
+                break;
+            
+            case TCP_CLOSED:
+                if (conn->socket->on_close) {
+                    conn->socket->on_close(conn->socket);
+                }
+                break;
+        }
+    }
+}
+
+static void tcp_handle_syn(tcp_connection_t* conn, tcp_header_t* tcp_hdr,
+                           const tcp_options_t* opts) {
+    if (conn->state == TCP_LISTEN) {
+        // Passive open - received SYN
+        conn->recv_seq = ntohl(tcp_hdr->seq_num);
+        conn->recv_ack = conn->recv_seq + 1;
+        tcp_negotiate(conn, opts);
+        
+        // Send SYN-ACK, kept for retransmission like any SYN
+        tcp_segment_t* syn_ack = tcp_create_segment(conn, TCP_FLAG_SYN | TCP_FLAG_ACK,
+                                                    NULL, 0);
+        if (syn_ack) {
+            tcp_set_state(conn, TCP_SYN_RECV);
+            tcp_send_segment(conn, syn_ack);
+        }
+    }
+}
+
+static void tcp_handle_ack(tcp_connection_t* conn, tcp_header_t* tcp_hdr,
+                           const tcp_options_t* opts, size_t data_len, uint64_t now) {
+    uint32_t ack_num = ntohl(tcp_hdr->ack_num);
+    
+    switch (conn->state) {
+        case TCP_SYN_SENT:
+            if ((tcp_hdr->flags & TCP_FLAG_SYN) && ack_num == conn->send_seq) {
+                // Received SYN-ACK
+                conn->recv_seq = ntohl(tcp_hdr->seq_num);
+                conn->recv_ack = conn->recv_seq + 1;
+                tcp_negotiate(conn, opts);
+                tcp_process_ack(conn, tcp_hdr, opts, 0, now);
+                
+                tcp_set_state(conn, TCP_ESTABLISHED);
+                tcp_send_ack(conn);
+            }
+            break;
+        
+        case TCP_SYN_RECV:
+            // Received ACK of our SYN. A passive open waits for room on
+            // its listener's accept queue, the peer's next segment
+            // trying again.
+            if (ack_num != conn->send_seq || (conn->parent && !tcp_accept_enqueue(conn))) {
+                break;
+            }
+            tcp_process_ack(conn, tcp_hdr, opts, data_len, now);
+            tcp_set_state(conn, TCP_ESTABLISHED);
+            break;
+        
+        case TCP_ESTABLISHED:
+        case TCP_CLOSE_WAIT:
+            tcp_process_ack(conn, tcp_hdr, opts, data_len, now);
+            break;
+        
+        case TCP_FIN_WAIT1:
+            // Our FIN is acked once everything is
+            tcp_process_ack(conn, tcp_hdr, opts, data_len, now);
+            if (conn->send_una == conn->send_seq) {
+                tcp_set_state(conn, TCP_FIN_WAIT2);
+            }
+            break;
+        
+        case TCP_CLOSING:
+            tcp_process_ack(conn, tcp_hdr, opts, data_len, now);
+            if (conn->send_una == conn->send_seq) {
+                tcp_set_state(conn, TCP_TIME_WAIT);
+            }
+            break;
+        
+        case TCP_LAST_ACK:
+            tcp_process_ack(conn, tcp_hdr, opts, data_len, now);
+            if (conn->send_una == conn->send_seq) {
+                tcp_set_state(conn, TCP_CLOSED);
+            }
+            break;
+    }
+}
+
+// A FIN at fin_seq, the end of its segment's data. Only one in order
+// counts; a repeat of the one already taken means the ACK was lost.
+// Returns whether it wants an ACK.
+static bool tcp_handle_fin(tcp_connection_t* conn, uint32_t fin_seq) {
+    if (fin_seq + 1 == conn->recv_ack &&
+        (conn->state == TCP_CLOSE_WAIT || conn->state == TCP_CLOSING ||
+         conn->state == TCP_LAST_ACK || conn->state == TCP_TIME_WAIT)) {
+        return true;
+    }
+    if (fin_seq != conn->recv_ack) {
+        return false;
+    }
+    
+    switch (conn->state) {
+        case TCP_ESTABLISHED:
+            conn->recv_ack++;
+            tcp_set_state(conn, TCP_CLOSE_WAIT);
+            return true;
+        
+        case TCP_FIN_WAIT1:
+            // Simultaneous close
+            conn->recv_ack++;
+            tcp_set_state(conn, TCP_CLOSING);
+            return true;
+        
+        case TCP_FIN_WAIT2:
+            // Normal close
+            conn->recv_ack++;
+            tcp_set_state(conn, TCP_TIME_WAIT);
+            return true;
+    }
+    
+    return false;
+}
+
+// =============================================================================
+// Receive Path
+// =============================================================================
+
+static tcp_segment_t* tcp_create_held(uint32_t seq, const uint8_t* data, size_t len) {
+    tcp_segment_t* seg = flux_allocate(NULL, sizeof(tcp_segment_t) + len,
+                                       FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!seg) {
+        return NULL;
+    }
+    
+    seg->tcp_header.seq_num = htonl(seq);
+    seg->data = (uint8_t*)(seg + 1);
+    seg->data_len = len;
+    memcpy(seg->data, data, len);
+    return seg;
+}
+
+static void tcp_note_dsack(tcp_connection_t* conn, uint32_t start, uint32_t end) {
+    if (conn->sack_permitted) {
+        conn->dsack[0] = start;
+        conn->dsack[1] = end;
+        conn->dsack_pending = true;
+    }
+}
+
+// Hold [seq, seq + len), past recv_ack, on the sorted out-of-order
+// queue; bytes already held are reported back as a D-SACK
+static void tcp_hold_data(tcp_connection_t* conn, uint32_t seq, const uint8_t* data,
+                          size_t len) {
+    tcp_segment_t** link = &conn->ooo_queue;
+    uint32_t end = seq + (uint32_t)len;
+    conn->sack_recent = seq;
+    
+    while (TCP_SEQ_LT(seq, end)) {
+        tcp_segment_t* next = *link;
+        uint32_t next_seq = next ? ntohl(next->tcp_header.seq_num) : end;
+        uint32_t next_end = next ? next_seq + (uint32_t)next->data_len : end;
+        
+        if (next && TCP_SEQ_LEQ(next_end, seq)) {
+            link = &next->next;
+            continue;
+        }
+        
+        // The gap before the next held segment, or all that's left
+        uint32_t gap_end = next && TCP_SEQ_LT(next_seq, end) ? next_seq : end;
+        if (TCP_SEQ_LT(seq, gap_end)) {
+            tcp_segment_t* held = tcp_create_held(seq, data, gap_end - seq);
+            if (!held) {
+                return;
+            }
+            held->next = next;
+            *link = held;
+            link = &held->next;
+            data += gap_end - seq;
+            seq = gap_end;
+            continue;
+        }
+        if (!next) {
+            break;
+        }
+        
+        // Overlaps the next one: a duplicate
+        uint32_t dup_end = TCP_SEQ_LT(next_end, end) ? next_end : end;
+        tcp_note_dsack(conn, seq, dup_end);
+        data += dup_end - seq;
+        seq = dup_end;
+        link = &next->next;
+    }
+}
+
+// Take a segment's data at seq: in order it joins the receive buffer,
+// pulling in whatever held data it completes; ahead of that it's held.
+// Returns the bytes the buffer gained.
+static size_t tcp_receive_data(tcp_connection_t* conn, uint32_t seq, const uint8_t* data,
+                               size_t len) {
+    uint32_t end = seq + (uint32_t)len;
+    if (TCP_SEQ_LEQ(end, conn->recv_ack)) {
+        tcp_note_dsack(conn, seq, end);
+        return 0;
+    }
+    if (TCP_SEQ_LT(seq, conn->recv_ack)) {
+        tcp_note_dsack(conn, seq, conn->recv_ack);
+        data += conn->recv_ack - seq;
+        len -= conn->recv_ack - seq;
+        seq = conn->recv_ack;
+    }
+    
+    // Nothing past the window
+    uint32_t window_end = conn->recv_ack +
+                          (uint32_t)(conn->recv_buffer_size - conn->recv_buffer_used);
+    if (TCP_SEQ_GEQ(seq, window_end)) {
+        return 0;
+    }
+    if (TCP_SEQ_GT(seq + (uint32_t)len, window_end)) {
+        len = window_end - seq;
+    }
+    
+    if (seq != conn->recv_ack) {
+        tcp_hold_data(conn, seq, data, len);
+        return 0;
+    }
+    
+    size_t before = conn->recv_buffer_used;
+    memcpy(conn->recv_buffer + conn->recv_buffer_used, data, len);
+    conn->recv_buffer_used += len;
+    conn->recv_ack += len;
+    
+    while (conn->ooo_queue) {
+        tcp_segment_t* held = conn->ooo_queue;
+        uint32_t held_seq = ntohl(held->tcp_header.seq_num);
+        uint32_t held_end = held_seq + (uint32_t)held->data_len;
+        if (TCP_SEQ_GT(held_seq, conn->recv_ack)) {
+            break;
+        }
+        
+        if (TCP_SEQ_GT(held_end, conn->recv_ack)) {
+            uint32_t skip = conn->recv_ack - held_seq;
+            uint32_t copy = held_end - conn->recv_ack;
+            memcpy(conn->recv_buffer + conn->recv_buffer_used, held->data + skip, copy);
+            conn->recv_buffer_used += copy;
+            conn->recv_ack += copy;
+        }
+        conn->ooo_queue = held->next;
+        flux_free(held);
+    }
+    
+    conn->bytes_received += conn->recv_buffer_used - before;
+    return conn->recv_buffer_used - before;
+}
+
+// =============================================================================
+// Passive Opens
+// =============================================================================
+
+// A SYN cookie: (slot & 31) << 27 | the MSS's index << 25 | a keyed hash
+// of the connection, the peer's ISN, the MSS and slot in its low bits
+#define TCP_COOKIE_HASH_BITS    25
+#define TCP_COOKIE_MSS_SHIFT    25
+#define TCP_COOKIE_SLOT_SHIFT   27
+
+static inline uint32_t tcp_cookie_slot(void) {
+    return (uint32_t)(harmony_get_time() / TCP_COOKIE_PERIOD);
+}
+
+static uint32_t tcp_cookie(uint32_t remote_addr, uint16_t remote_port, uint32_t local_addr,
+                           uint16_t local_port, uint32_t peer_isn, uint32_t mss_index,
+                           uint32_t slot) {
+    uint64_t key = g_tcp_cookie_secret ^ ((uint64_t)remote_addr << 32 | local_addr);
+    key = tcp_mix(key) ^ ((uint64_t)remote_port << 48 | (uint64_t)local_port << 32 | peer_isn);
+    key = tcp_mix(key ^ ((uint64_t)mss_index << 32 | slot));
+    return (slot & 31) << TCP_COOKIE_SLOT_SHIFT | (mss_index & 3) << TCP_COOKIE_MSS_SHIFT |
+           (uint32_t)(key & ((1U << TCP_COOKIE_HASH_BITS) - 1));
+}
+
+// Answer a SYN keeping nothing: the SYN-ACK's sequence number is a
+// cookie the handshake's last ACK brings back. It offers no options but
+// the MSS, the one thing the cookie remembers.
+static void tcp_send_cookie(tcp_connection_t* listener, uint32_t remote_addr,
+                            uint16_t remote_port, uint32_t local_addr, tcp_header_t* tcp_hdr,
+                            const tcp_options_t* opts) {
+    tcp_connection_t reply = { 0 };
+    uint32_t peer_isn = ntohl(tcp_hdr->seq_num);
+    reply.local_addr = local_addr;
+    reply.local_port = listener->local_port;
+    reply.remote_addr = remote_addr;
+    reply.remote_port = remote_port;
+    reply.recv_ack = peer_isn + 1;
+    reply.recv_buffer_size = TCP_RECV_BUFFER_SIZE;
+    reply.mss = TCP_DEFAULT_MSS;
+    reply.state = TCP_SYN_RECV;
+    
+    uint16_t mss = tcp_route_mss(&reply);
+    if (opts->mss && opts->mss < mss) {
+        mss = opts->mss;
+    }
+    uint32_t mss_index = 0;
+    while (mss_index < 3 && g_tcp_cookie_mss[mss_index + 1] <= mss) {
+        mss_index++;
+    }
+    
+    reply.send_seq = tcp_cookie(remote_addr, remote_port, local_addr, listener->local_port,
+                                peer_isn, mss_index, tcp_cookie_slot());
+    
+    // Nothing is retransmitted; the peer's SYN will be, if this is lost
+    tcp_segment_t* syn_ack = tcp_create_segment(&reply, TCP_FLAG_SYN | TCP_FLAG_ACK, NULL, 0);
+    if (syn_ack) {
+        tcp_send_unqueued(&reply, syn_ack);
+    }
+}
+
+// A connection for a passive open on listener, holding a reference to it
+static tcp_connection_t* tcp_create_child(tcp_connection_t* listener, uint32_t remote_addr,
+                                          uint16_t remote_port, uint32_t local_addr) {
+    tcp_connection_t* conn = tcp_create_connection();
+    if (!conn) {
+        return NULL;
+    }
+    
+    conn->local_addr = local_addr;
+    conn->local_port = listener->local_port;
+    conn->remote_addr = remote_addr;
+    conn->remote_port = remote_port;
+    conn->cc = listener->cc;
+    __atomic_fetch_add(&listener->refs, 1, __ATOMIC_RELAXED);
+    conn->parent = listener;
+    
+    return conn;
+}
+
+// A SYN for listener: a half-open connection on its SYN queue, or past
+// that queue's limit a cookie. While the accept queue is full, nothing.
+static void tcp_listen_syn(tcp_connection_t* listener, uint32_t remote_addr,
+                           uint16_t remote_port, uint32_t local_addr, tcp_header_t* tcp_hdr,
+                           const tcp_options_t* opts) {
+    spinlock_acquire(&listener->lock);
+    bool full = !listener->hashed || listener->accept_queue_len >= listener->backlog;
+    bool room = !full && listener->syn_queue_len < TCP_SYN_BACKLOG;
+    if (room) {
+        listener->syn_queue_len++;
+    }
+    spinlock_release(&listener->lock);
+    
+    if (full) {
+        return;
+    }
+    if (!room) {
+        tcp_send_cookie(listener, remote_addr, remote_port, local_addr, tcp_hdr, opts);
+        return;
+    }
+    
+    tcp_connection_t* child = tcp_create_child(listener, remote_addr, remote_port, local_addr);
+    if (child) {
+        child->state = TCP_LISTEN;
+        spinlock_acquire(&child->lock);
+        if (!tcp_hash_insert(child)) {
+            spinlock_release(&child->lock);
+            tcp_destroy_connection(child);
+            child = NULL;
+        }
+    }
+    
+    // Queued unless the listener closed meanwhile
+    spinlock_acquire(&listener->lock);
+    bool queued = child && listener->hashed;
+    if (queued) {
+        child->syn_time = harmony_get_time();
+        child->syn_next = listener->syn_queue;
+        child->syn_queued = true;
+        listener->syn_queue = child;
+    } else if (listener->hashed) {
+        listener->syn_queue_len--;
+    }
+    spinlock_release(&listener->lock);
+    
+    if (!child) {
+        return;
+    }
+    if (!queued) {
+        spinlock_release(&child->lock);
+        tcp_destroy_connection(child);
+        return;
+    }
+    
+    tcp_handle_syn(child, tcp_hdr, opts);
+    spinlock_release(&child->lock);
+}
+
+// An ACK for listener with no connection behind it, perhaps ending a
+// handshake answered with a cookie. Returns the connection the cookie
+// vouches for, established, queued for accept and with a reference for
+// the caller; NULL if the cookie is bad or stale or there's no room.
+static tcp_connection_t* tcp_cookie_accept(tcp_connection_t* listener, uint32_t remote_addr,
+                                           uint16_t remote_port, uint32_t local_addr,
+                                           tcp_header_t* tcp_hdr) {
+    uint32_t cookie = ntohl(tcp_hdr->ack_num) - 1;
+    uint32_t peer_isn = ntohl(tcp_hdr->seq_num) - 1;
+    uint32_t mss_index = (cookie >> TCP_COOKIE_MSS_SHIFT) & 3;
+    uint32_t slot = tcp_cookie_slot();
+    
+    bool valid = false;
+    for (uint32_t age = 0; age <= TCP_COOKIE_MAX_AGE && !valid; age++) {
+        valid = tcp_cookie(remote_addr, remote_port, local_addr, listener->local_port,
+                           peer_isn, mss_index, slot - age) == cookie;
+    }
+    if (!valid) {
+        return NULL;
+    }
+    
+    tcp_connection_t* conn = tcp_create_child(listener, remote_addr, remote_port, local_addr);
+    if (!conn) {
+        return NULL;
+    }
+    
+    // No socket yet, so nothing to tell of the state change. The SYN-ACK
+    // offered no options, so none are in use.
+    conn->state = TCP_ESTABLISHED;
+    conn->send_seq = cookie + 1;
+    conn->send_una = cookie + 1;
+    conn->recv_seq = peer_isn;
+    conn->recv_ack = peer_isn + 1;
+    conn->send_window = ntohs(tcp_hdr->window);
+    conn->wscale_ok = false;
+    conn->rcv_wscale = 0;
+    conn->sack_permitted = false;
+    conn->timestamps = false;
+    conn->mss = g_tcp_cookie_mss[mss_index];
+    conn->congestion_window = TCP_INIT_CWND * conn->mss;
+    tcp_cc_start(conn);
+    conn->refs++;
+    
+    spinlock_acquire(&conn->lock);
+    bool queued = tcp_hash_insert(conn) && tcp_accept_enqueue(conn);
+    spinlock_release(&conn->lock);
+    if (!queued) {
+        tcp_destroy_connection(conn);
+        tcp_put_connection(conn);
+        return NULL;
+    }
+    
+    return conn;
+}
+
+// Move conn, locked and just established, to the accept queue; false if
+// the queue is full or the listener closed
+static bool tcp_accept_enqueue(tcp_connection_t* conn) {
+    tcp_connection_t* listener = conn->parent;
+    
+    spinlock_acquire(&listener->lock);
+    if (!listener->hashed || listener->accept_queue_len >= listener->backlog) {
+        spinlock_release(&listener->lock);
+        return false;
+    }
+    
+    if (conn->syn_queued) {
+        tcp_connection_t** link = &listener->syn_queue;
+        while (*link != conn) {
+            link = &(*link)->syn_next;
+        }
+        *link = conn->syn_next;
+        conn->syn_queued = false;
+        listener->syn_queue_len--;
+    }
+    
+    __atomic_fetch_add(&conn->refs, 1, __ATOMIC_RELAXED);
+    listener->accept_queue[listener->accept_queue_tail] = conn;
+    listener->accept_queue_tail = (listener->accept_queue_tail + 1) % listener->backlog;
+    listener->accept_queue_len++;
+    if (listener->socket) {
+        harmony_socket_notify(listener->socket, CONDUIT_SELECT_READ_READY);
+    }
+    spinlock_release(&listener->lock);
+    
+    return true;
+}
+
+// Drop what a closed listener still holds, half-open and waiting for
+// accept alike. It's out of the listener table, so nothing more arrives.
+static void tcp_drain_listener(tcp_connection_t* listener) {
+    spinlock_acquire(&listener->lock);
+    tcp_connection_t* half_open = listener->syn_queue;
+    for (tcp_connection_t* child = half_open; child; child = child->syn_next) {
+        child->syn_queued = false;
+    }
+    listener->syn_queue = NULL;
+    listener->syn_queue_len = 0;
+    
+    int head = listener->accept_queue_head;
+    int count = listener->accept_queue_len;
+    listener->accept_queue_head = listener->accept_queue_tail;
+    listener->accept_queue_len = 0;
+    spinlock_release(&listener->lock);
+    
+    while (half_open) {
+        tcp_connection_t* next = half_open->syn_next;
+        tcp_destroy_connection(half_open);
+        half_open = next;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        tcp_connection_t* child = listener->accept_queue[(head + i) % listener->backlog];
+        tcp_destroy_connection(child);
+        tcp_put_connection(child);
+    }
+}
+
+// Half-open connections that timed out or were reset, off every
+// listener's SYN queue
+static void tcp_reap_syn_queues(uint64_t now) {
+    tcp_connection_t* reaped = NULL;
+    
+    spinlock_acquire(&g_tcp_lock);
+    for (uint32_t i = 0; i < TCP_LISTEN_BUCKETS; i++) {
+        for (tcp_connection_t* listener = g_tcp_listeners[i]; listener;
+             listener = listener->next) {
+            spinlock_acquire(&listener->lock);
+            tcp_connection_t** link = &listener->syn_queue;
+            while (*link) {
+                tcp_connection_t* child = *link;
+                if (now - child->syn_time < TCP_SYN_TIMEOUT && child->state != TCP_CLOSED) {
+                    link = &child->syn_next;
+                    continue;
+                }
+                
+                *link = child->syn_next;
+                child->syn_queued = false;
+                listener->syn_queue_len--;
+                child->syn_next = reaped;
+                reaped = child;
+            }
+            spinlock_release(&listener->lock);
+        }
+    }
+    spinlock_release(&g_tcp_lock);
+    
+    while (reaped) {
+        tcp_connection_t* next = reaped->syn_next;
+        tcp_destroy_connection(reaped);
+        reaped = next;
+    }
+}
+
+// =============================================================================
+// TIME_WAIT
+// =============================================================================
+
+static inline uint64_t tcp_tw_bucket(uint32_t remote_addr, uint16_t remote_port,
+                                     uint16_t local_port) {
+    return tcp_bucket(remote_addr, remote_port, local_port) & (TCP_TIMEWAIT_BUCKETS - 1);
+}
+
+static tcp_timewait_t* tcp_timewait_find(uint32_t remote_addr, uint16_t remote_port,
+                                         uint32_t local_addr, uint16_t local_port) {
+    if (!g_tcp_tw_hash) {
+        return NULL;
+    }
+    
+    uint64_t bucket = tcp_tw_bucket(remote_addr, remote_port, local_port);
+    uint32_t cpu;
+    uint64_t flags = continuum_read_lock(g_tcp_readers, &cpu);
+    tcp_timewait_t* tw = __atomic_load_n(&g_tcp_tw_hash[bucket], __ATOMIC_ACQUIRE);
+    while (tw && !(tw->remote_port == remote_port && tw->local_port == local_port &&
+                   tw->remote_addr == remote_addr &&
+                   (tw->local_addr == local_addr || tw->local_addr == 0))) {
+        tw = __atomic_load_n(&tw->next, __ATOMIC_ACQUIRE);
+    }
+    if (tw) {
+        __atomic_fetch_add(&tw->refs, 1, __ATOMIC_RELAXED);
+    }
+    continuum_read_unlock(g_tcp_readers, cpu, flags);
+    
+    return tw;
+}
+
+static void tcp_timewait_put(tcp_timewait_t* tw) {
+    if (__atomic_sub_fetch(&tw->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        flux_free(tw);
+    }
+}
+
+static bool tcp_timewait_insert(tcp_timewait_t* tw) {
+    uint64_t bucket = tcp_tw_bucket(tw->remote_addr, tw->remote_port, tw->local_port);
+    spinlock_t* lock = tcp_hash_lock(bucket);
+    spinlock_acquire(lock);
+    for (tcp_timewait_t* other = g_tcp_tw_hash[bucket]; other; other = other->next) {
+        if (other->remote_port == tw->remote_port && other->local_port == tw->local_port &&
+            other->remote_addr == tw->remote_addr && other->local_addr == tw->local_addr) {
+            spinlock_release(lock);
+            return false;
+        }
+    }
+    
+    tw->next = g_tcp_tw_hash[bucket];
+    tw->hashed = true;
+    __atomic_store_n(&g_tcp_tw_hash[bucket], tw, __ATOMIC_RELEASE);
+    spinlock_release(lock);
+    return true;
+}
+
+static bool tcp_timewait_remove(tcp_timewait_t* tw) {
+    uint64_t bucket = tcp_tw_bucket(tw->remote_addr, tw->remote_port, tw->local_port);
+    spinlock_t* lock = tcp_hash_lock(bucket);
+    spinlock_acquire(lock);
+    bool removed = tw->hashed;
+    if (removed) {
+        tcp_timewait_t** link = &g_tcp_tw_hash[bucket];
+        while (*link != tw) {
+            link = &(*link)->next;
+        }
+        __atomic_store_n(link, tw->next, __ATOMIC_RELEASE);
+        tw->hashed = false;
+    }
+    spinlock_release(lock);
+    return removed;
+}
+
+// End TIME_WAIT early; the caller's reference keeps tw until it's done
+static void tcp_timewait_kill(tcp_timewait_t* tw) {
+    if (tcp_timewait_remove(tw)) {
+        continuum_synchronize(g_tcp_readers);
+        tcp_timewait_put(tw);
+    }
+    if (tcp_timer_cancel(&tw->timer)) {
+        tcp_timewait_put(tw);
+    }
+}
+
+static void tcp_timewait_expire(tcp_timer_t* timer) {
+    tcp_timewait_t* tw = (tcp_timewait_t*)((uint8_t*)timer - offsetof(tcp_timewait_t, timer));
+    
+    if (tcp_timewait_remove(tw)) {
+        continuum_synchronize(g_tcp_readers);
+        tcp_timewait_put(tw);
+    }
+    tcp_timewait_put(tw);
+}
+
+// Trade conn, locked and just in TIME_WAIT, for an entry in the TIME_WAIT
+// table, leaving conn closed. Without memory for one, conn itself waits
+// the time out.
+static void tcp_enter_timewait(tcp_connection_t* conn) {
+    tcp_timewait_t* tw = NULL;
+    if (g_tcp_tw_hash) {
+        tw = flux_allocate(NULL, sizeof(tcp_timewait_t), FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    }
+    if (tw) {
+        tw->local_addr = conn->local_addr;
+        tw->remote_addr = conn->remote_addr;
+        tw->local_port = conn->local_port;
+        tw->remote_port = conn->remote_port;
+        tw->send_seq = conn->send_seq;
+        tw->recv_ack = conn->recv_ack;
+        tw->ts_recent = conn->ts_recent;
+        tw->recv_window = (uint32_t)(conn->recv_buffer_size - conn->recv_buffer_used);
+        tw->rcv_wscale = conn->rcv_wscale;
+        tw->timestamps = conn->timestamps;
+        tw->refs = 2;
+        tcp_timer_init(&tw->timer, tcp_timewait_expire);
+    }
+    
+    if (!tw || !tcp_timewait_insert(tw)) {
+        flux_free(tw);
+        tcp_conn_timer_arm(conn, &conn->keepalive_timer,
+                           conn->last_recv + TCP_TIME_WAIT_DURATION);
+        return;
+    }
+    
+    tcp_timer_arm(&tw->timer, harmony_get_time() + TCP_TIME_WAIT_DURATION);
+    conn->state = TCP_CLOSED;
+}
+
+// A segment for a connection in TIME_WAIT. A SYN that can't be an old
+// duplicate, its timestamp or else its sequence number past what the
+// connection saw (RFC 6191), ends TIME_WAIT and goes on to open a new
+// connection; that returns true. A RST is ignored (RFC 1337); a FIN, SYN
+// or data is answered with an ACK, in case the last was lost.
+static bool tcp_timewait_input(tcp_timewait_t* tw, tcp_header_t* tcp_hdr,
+                               const tcp_options_t* opts, size_t data_len) {
+    uint8_t flags = tcp_hdr->flags;
+    if (flags & TCP_FLAG_RST) {
+        return false;
+    }
+    
+    if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN) {
+        bool newer = tw->timestamps && opts->timestamp ?
+                     TCP_SEQ_GT(opts->tsval, tw->ts_recent) :
+                     TCP_SEQ_GT(ntohl(tcp_hdr->seq_num), tw->recv_ack);
+        if (newer) {
+            tcp_timewait_kill(tw);
+            return true;
+        }
+    }
     
-    switch (conn->state) {
-        case TCP_SYN_SENT:
-            if (tcp_hdr->flags & TCP_FLAG_SYN) {
-                // Received SYN-ACK
-                conn->recv_seq = ntohl(tcp_hdr->seq_num);
-                conn->recv_ack = conn->recv_seq + 1;
-                conn->send_una = ack_num;
-                
-                // Send ACK
-                tcp_segment_t* ack = tcp_create_segment(conn, TCP_FLAG_ACK, NULL, 0);
-                if (ack) {
-                    tcp_send_segment(conn, ack);
-                    tcp_set_state(conn, TCP_ESTABLISHED);
-                }
-            }
-            break;
-            
-        case TCP_SYN_RECV:
-            // Received ACK of our SYN
-            conn->send_una = ack_num;
-            tcp_set_state(conn, TCP_ESTABLISHED);
-            break;
-            
-        case TCP_ESTABLISHED:
-            // Update send unacknowledged
-            if (ack_num > conn->send_una) {
-                conn->send_una = ack_num;
-                
-                // Remove acknowledged segments from retransmission queue
-                tcp_segment_t* prev = NULL;
-                tcp_segment_t* seg = conn->retrans_queue;
-                
-                while (seg) {
-                    if (ntohl(seg->tcp_header.seq_num) < ack_num) {
-                        // Segment acknowledged
-                        tcp_segment_t* next = seg->next;
-                        
-                        if (prev) {
-                            prev->next = next;
-                        } else {
-                            conn->retrans_queue = next;
-                        }
-                        
-                        flux_free(seg);
-                        seg = next;
-                    } else {
-                        prev = seg;
-                        seg = seg->next;
-                    }
-                }
-            }
-            break;
-            
-        case TCP_FIN_WAIT1:
-            conn->send_una = ack_num;
-            tcp_set_state(conn, TCP_FIN_WAIT2);
-            break;
-            
-        case TCP_CLOSING:
-            conn->send_una = ack_num;
-            tcp_set_state(conn, TCP_TIME_WAIT);
-            // Start TIME_WAIT timer
-            conn->time_wait_timer = harmony_get_time() + TCP_TIME_WAIT_DURATION;
-            break;
-            
-        case TCP_LAST_ACK:
-            conn->send_una = ack_num;
-            tcp_set_state(conn, TCP_CLOSED);
-            break;
+    if (!(flags & (TCP_FLAG_SYN | TCP_FLAG_FIN)) && data_len == 0) {
+        return false;
     }
+    
+    // Sent as the connection would have, from what's left of it
+    tcp_connection_t reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.state = TCP_TIME_WAIT;
+    reply.local_addr = tw->local_addr;
+    reply.remote_addr = tw->remote_addr;
+    reply.local_port = tw->local_port;
+    reply.remote_port = tw->remote_port;
+    reply.send_seq = tw->send_seq;
+    reply.recv_ack = tw->recv_ack;
+    reply.ts_recent = tw->ts_recent;
+    reply.timestamps = tw->timestamps;
+    reply.rcv_wscale = tw->rcv_wscale;
+    reply.recv_buffer_size = tw->recv_window;
+    reply.mss = TCP_DEFAULT_MSS;
+    tcp_send_ack(&reply);
+    return false;
 }
 
-static void tcp_handle_fin(tcp_connection_t* conn, tcp_header_t* tcp_hdr) {
-    // Update receive sequence
-    conn->recv_ack = ntohl(tcp_hdr->seq_num) + 1;
+// Release conn's lock, first settling what its state now calls for: a
+// connection in TIME_WAIT goes to the TIME_WAIT table, and one closed
+// leaves the connection table
+static void tcp_unlock(tcp_connection_t* conn) {
+    if (conn->state == TCP_TIME_WAIT && conn->hashed) {
+        tcp_enter_timewait(conn);
+    }
     
-    switch (conn->state) {
-        case TCP_ESTABLISHED:
-            // Send ACK
-            tcp_segment_t* ack = tcp_create_segment(conn, TCP_FLAG_ACK, NULL, 0);
-            if (ack) {
-                tcp_send_segment(conn, ack);
-            }
-            tcp_set_state(conn, TCP_CLOSE_WAIT);
-            break;
-            
-        case TCP_FIN_WAIT1:
-            // Simultaneous close
-            tcp_segment_t* ack2 = tcp_create_segment(conn, TCP_FLAG_ACK, NULL, 0);
-            if (ack2) {
-                tcp_send_segment(conn, ack2);
-            }
-            tcp_set_state(conn, TCP_CLOSING);
-            break;
-            
-        case TCP_FIN_WAIT2:
-            // Normal close
-            tcp_segment_t* ack3 = tcp_create_segment(conn, TCP_FLAG_ACK, NULL, 0);
-            if (ack3) {
-                tcp_send_segment(conn, ack3);
-            }
-            tcp_set_state(conn, TCP_TIME_WAIT);
-            conn->time_wait_timer = harmony_get_time() + TCP_TIME_WAIT_DURATION;
-            break;
+    bool finished = conn->state == TCP_CLOSED && conn->hashed && !conn->syn_queued;
+    spinlock_release(&conn->lock);
+    if (finished) {
+        tcp_destroy_connection(conn);
     }
 }
 
@@ -266,14 +2328,27 @@ static void tcp_handle_fin(tcp_connection_t* conn, tcp_header_t* tcp_hdr) {
 // =============================================================================
 
 void tcp_input(network_interface_t* iface, ipv4_header_t* ip_hdr,
-              tcp_header_t* tcp_hdr, void* data, size_t data_len) {
-    // Verify checksum
-    uint16_t checksum = tcp_checksum(ip_hdr, tcp_hdr, data, data_len);
-    if (checksum != 0) {
+              tcp_header_t* tcp_hdr, void* data, size_t data_len, bool csum_valid) {
+    // Verify checksum, unless the NIC has
+    if (!csum_valid && tcp_checksum(ip_hdr, tcp_hdr, data, data_len) != 0) {
         // Invalid checksum
         return;
     }
     
+    // The options lead data; the payload follows them
+    size_t options_len = (size_t)(tcp_hdr->data_offset >> 4) * 4;
+    if (options_len < sizeof(tcp_header_t) || options_len - sizeof(tcp_header_t) > data_len) {
+        return;
+    }
+    options_len -= sizeof(tcp_header_t);
+    
+    tcp_options_t opts;
+    if (!tcp_parse_options(data, options_len, &opts)) {
+        return;
+    }
+    data = (uint8_t*)data + options_len;
+    data_len -= options_len;
+    
     // Find connection
     uint16_t src_port = ntohs(tcp_hdr->src_port);
     uint16_t dest_port = ntohs(tcp_hdr->dest_port);
@@ -283,21 +2358,32 @@ void tcp_input(network_interface_t* iface, ipv4_header_t* ip_hdr,
     tcp_connection_t* conn = tcp_find_connection(src_addr, src_port,
                                                  dest_addr, dest_port);
     
-    if (!conn && (tcp_hdr->flags & TCP_FLAG_SYN)) {
-        // Check for listening socket
-        conn = tcp_find_listener(dest_port);
-        if (conn) {
-            // Create new connection for incoming SYN
-            tcp_connection_t* new_conn = tcp_create_connection();
-            if (new_conn) {
-                new_conn->local_addr = dest_addr;
-                new_conn->local_port = dest_port;
-                new_conn->remote_addr = src_addr;
-                new_conn->remote_port = src_port;
-                new_conn->state = TCP_LISTEN;
-                new_conn->socket = conn->socket;
-                conn = new_conn;
+    if (!conn) {
+        // TIME_WAIT answers for its addresses, unless it lets a new
+        // connection's SYN through
+        tcp_timewait_t* tw = tcp_timewait_find(src_addr, src_port, dest_addr, dest_port);
+        if (tw) {
+            bool reopen = tcp_timewait_input(tw, tcp_hdr, &opts, data_len);
+            tcp_timewait_put(tw);
+            if (!reopen) {
+                return;
+            }
+        }
+        
+        // Check for listening socket: a SYN starts a passive open, a
+        // bare ACK may finish one answered with a cookie
+        tcp_connection_t* listener = tcp_find_listener(dest_addr, dest_port);
+        if (listener) {
+            uint8_t flags = tcp_hdr->flags & (TCP_FLAG_SYN | TCP_FLAG_ACK | TCP_FLAG_RST);
+            if (flags == TCP_FLAG_SYN) {
+                tcp_listen_syn(listener, src_addr, src_port, dest_addr, tcp_hdr, &opts);
+                tcp_put_connection(listener);
+                return;
             }
+            if (flags == TCP_FLAG_ACK) {
+                conn = tcp_cookie_accept(listener, src_addr, src_port, dest_addr, tcp_hdr);
+            }
+            tcp_put_connection(listener);
         }
     }
     
@@ -310,43 +2396,81 @@ void tcp_input(network_interface_t* iface, ipv4_header_t* ip_hdr,
     }
     
     spinlock_acquire(&conn->lock);
+    uint64_t now = harmony_get_time();
+    uint32_t seq = ntohl(tcp_hdr->seq_num);
+    bool ack_due = false;
+    conn->last_recv = now;
+    conn->keepalive_probes = 0;
     
-    // Process based on flags
+    // Process based on flags: reset, SYN, ACK, data, FIN
     if (tcp_hdr->flags & TCP_FLAG_RST) {
         // Connection reset
         tcp_set_state(conn, TCP_CLOSED);
-    } else if (tcp_hdr->flags & TCP_FLAG_SYN) {
-        tcp_handle_syn(conn, tcp_hdr);
-    } else if (tcp_hdr->flags & TCP_FLAG_FIN) {
-        tcp_handle_fin(conn, tcp_hdr);
+        goto out;
+    }
+    
+    // An older timestamp than the last is an old duplicate (PAWS)
+    if (conn->timestamps && opts.timestamp && conn->state != TCP_SYN_SENT &&
+        TCP_SEQ_LT(opts.tsval, conn->ts_recent)) {
+        tcp_send_ack(conn);
+        goto out;
+    }
+    
+    if (tcp_hdr->flags & TCP_FLAG_SYN) {
+        tcp_handle_syn(conn, tcp_hdr, &opts);
+        seq++;
     }
     
     if (tcp_hdr->flags & TCP_FLAG_ACK) {
-        tcp_handle_ack(conn, tcp_hdr);
+        tcp_handle_ack(conn, tcp_hdr, &opts, data_len, now);
     }
     
-    // Process data
-    if (data_len > 0 && conn->state == TCP_ESTABLISHED) {
-        // Add to receive buffer
-        if (conn->recv_buffer_used + data_len <= conn->recv_buffer_size) {
-            memcpy(conn->recv_buffer + conn->recv_buffer_used, data, data_len);
-            conn->recv_buffer_used += data_len;
-            conn->recv_ack += data_len;
-            
-            // Send ACK
-            tcp_segment_t* ack = tcp_create_segment(conn, TCP_FLAG_ACK, NULL, 0);
-            if (ack) {
-                tcp_send_segment(conn, ack);
-            }
-            
-            // Notify socket
-            if (conn->socket && conn->socket->on_data) {
-                conn->socket->on_data(conn->socket, data, data_len);
+    if (conn->timestamps && opts.timestamp && TCP_SEQ_LEQ(seq, conn->recv_ack) &&
+        TCP_SEQ_GEQ(opts.tsval, conn->ts_recent)) {
+        conn->ts_recent = opts.tsval;
+    }
+    
+    // Process data. In-order data filling no hole may wait for the
+    // delayed ACK (RFC 5681 4.2), until a second full segment's worth is
+    // in or TCP_DELACK_TIMEOUT is up; anything else is answered at once,
+    // as is everything while a new connection's quick ACKs last.
+    if (data_len > 0 && (conn->state == TCP_ESTABLISHED || conn->state == TCP_FIN_WAIT1 ||
+                         conn->state == TCP_FIN_WAIT2)) {
+        size_t before = conn->recv_buffer_used;
+        bool holes = conn->ooo_queue != NULL;
+        size_t added = tcp_receive_data(conn, seq, data, data_len);
+        conn->rcv_unacked += added;
+        if (added == 0 || holes || conn->ooo_queue || conn->dsack_pending ||
+            conn->rcv_unacked >= 2U * conn->mss) {
+            ack_due = true;
+        } else if (conn->quickacks > 0) {
+            conn->quickacks--;
+            ack_due = true;
+        } else {
+            conn->ack_pending = true;
+            tcp_conn_timer_arm(conn, &conn->delack_timer, now + TCP_DELACK_TIMEOUT);
+        }
+        
+        // Notify socket of what just became readable
+        if (added > 0 && conn->socket) {
+            harmony_socket_notify(conn->socket, CONDUIT_SELECT_READ_READY);
+            if (conn->socket->on_data) {
+                conn->socket->on_data(conn->socket, conn->recv_buffer + before, added);
             }
         }
     }
     
-    spinlock_release(&conn->lock);
+    if (tcp_hdr->flags & TCP_FLAG_FIN) {
+        ack_due = tcp_handle_fin(conn, seq + (uint32_t)data_len) || ack_due;
+    }
+    
+    if (ack_due) {
+        tcp_send_ack(conn);
+    }
+    
+out:
+    tcp_unlock(conn);
+    tcp_put_connection(conn);
 }
 
 // =============================================================================
@@ -360,32 +2484,114 @@ tcp_connection_t* tcp_create_connection(void) {
         return NULL;
     }
     
-    // Initialize connection
+    // Initialize connection; it offers every option until the peer's
+    // SYN or SYN-ACK says otherwise
     conn->state = TCP_CLOSED;
     conn->send_seq = harmony_random() & 0x7FFFFFFF;  // Random ISN
+    conn->send_una = conn->send_seq;
     conn->recv_window = TCP_DEFAULT_WINDOW;
     conn->send_window = TCP_DEFAULT_WINDOW;
     conn->mss = TCP_DEFAULT_MSS;
+    conn->wscale_ok = true;
+    conn->sack_permitted = true;
+    conn->timestamps = true;
+    conn->congestion_window = TCP_INIT_CWND * TCP_DEFAULT_MSS;
+    conn->ssthresh = UINT32_MAX;
+    conn->rto = TCP_RETRANSMIT_TIMEOUT;
+    conn->rack_reo_wnd_mult = 1;
+    conn->cc = tcp_cc_default();
+    conn->refs = 1;
     spinlock_init(&conn->lock);
+    tcp_timer_init(&conn->xmit_timer, tcp_xmit_timer_fire);
+    tcp_timer_init(&conn->delack_timer, tcp_delack_timer_fire);
+    tcp_timer_init(&conn->keepalive_timer, tcp_keepalive_timer_fire);
     
-    // Allocate buffers
+    // Allocate buffers; the send queue holds its own data
     conn->recv_buffer_size = TCP_RECV_BUFFER_SIZE;
     conn->recv_buffer = flux_allocate(NULL, conn->recv_buffer_size,
                                      FLUX_ALLOC_KERNEL);
+    conn->rcv_wscale = tcp_window_shift(conn->recv_buffer_size);
     
     conn->send_buffer_size = TCP_SEND_BUFFER_SIZE;
-    conn->send_buffer = flux_allocate(NULL, conn->send_buffer_size,
-                                     FLUX_ALLOC_KERNEL);
-    
-    // Add to connection list
-    spinlock_acquire(&g_tcp_lock);
-    conn->next = g_tcp_connections;
-    g_tcp_connections = conn;
-    spinlock_release(&g_tcp_lock);
     
     return conn;
 }
 
+static void tcp_free_segments(tcp_segment_t* seg) {
+    while (seg) {
+        tcp_segment_t* next = seg->next;
+        flux_free(seg);
+        seg = next;
+    }
+}
+    
+void tcp_put_connection(tcp_connection_t* conn) {
+    if (!conn || __atomic_sub_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    
+    tcp_free_segments(conn->retrans_queue);
+    tcp_free_segments(conn->ooo_queue);
+    
+    tcp_connection_t* parent = conn->parent;
+    flux_free(conn->recv_buffer);
+    flux_free(conn->accept_queue);
+    flux_free(conn);
+    
+    tcp_put_connection(parent);
+}
+
+// Drops the reference tcp_create_connection returned, which a table
+// holds while the connection is in one; only the first call counts
+void tcp_destroy_connection(tcp_connection_t* conn) {
+    if (!conn || __atomic_exchange_n(&conn->destroyed, true, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    
+    bool listener = conn->accept_queue != NULL;
+    if (listener ? tcp_listener_remove(conn) : tcp_hash_remove(conn)) {
+        continuum_synchronize(g_tcp_readers);
+    }
+    if (listener) {
+        tcp_drain_listener(conn);
+    }
+    
+    // Out of the table, so nothing arms its timers again
+    spinlock_acquire(&conn->lock);
+    tcp_conn_timer_cancel(conn, &conn->xmit_timer);
+    tcp_conn_timer_cancel(conn, &conn->delack_timer);
+    tcp_conn_timer_cancel(conn, &conn->keepalive_timer);
+    spinlock_release(&conn->lock);
+    
+    tcp_put_connection(conn);
+}
+
+// Sweep the SYN queues every TCP_REAP_PERIOD
+static void tcp_reap_timer_fire(tcp_timer_t* timer) {
+    uint64_t now = harmony_get_time();
+    tcp_reap_syn_queues(now);
+    tcp_timer_arm(timer, now + TCP_REAP_PERIOD);
+}
+
+void tcp_init(void) {
+    for (uint32_t i = 0; i < TCP_HASH_LOCKS; i++) {
+        spinlock_init(&g_tcp_hash_locks[i]);
+    }
+    
+    g_tcp_hash_seed = (harmony_get_time() * 0x9E3779B97F4A7C15ULL) ^ harmony_random();
+    g_tcp_cookie_secret = tcp_mix(g_tcp_hash_seed ^ ((uint64_t)harmony_random() << 32));
+    g_tcp_hash = flux_allocate(NULL, TCP_HASH_BUCKETS * sizeof(tcp_connection_t*),
+                               FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    g_tcp_tw_hash = flux_allocate(NULL, TCP_TIMEWAIT_BUCKETS * sizeof(tcp_timewait_t*),
+                                  FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    
+    tcp_cc_init();
+    
+    tcp_wheel_init();
+    tcp_timer_init(&g_tcp_reap_timer, tcp_reap_timer_fire);
+    tcp_timer_arm(&g_tcp_reap_timer, harmony_get_time() + TCP_REAP_PERIOD);
+}
+
 // =============================================================================
 // Socket Interface
 // =============================================================================
@@ -396,101 +2602,442 @@ int tcp_connect(socket_t* sock, uint32_t dest_addr, uint16_t dest_port) {
         return -1;
     }
     
+    // The socket's reference, beside the table's
+    conn->refs++;
     conn->socket = sock;
     conn->local_addr = sock->local_addr.ipv4.addr;
     conn->local_port = tcp_allocate_port();
     conn->remote_addr = dest_addr;
     conn->remote_port = dest_port;
+    if (sock->congestion) {
+        conn->cc = sock->congestion;
+    }
+    tcp_cc_start(conn);
     
-    // Send SYN
-    tcp_segment_t* syn = tcp_create_segment(conn, TCP_FLAG_SYN, NULL, 0);
+    // In the table before the SYN goes, so the SYN-ACK finds it
+    spinlock_acquire(&conn->lock);
+    tcp_segment_t* syn = NULL;
+    if (tcp_hash_insert(conn)) {
+        syn = tcp_create_segment(conn, TCP_FLAG_SYN, NULL, 0);
+    }
     if (!syn) {
+        spinlock_release(&conn->lock);
         tcp_destroy_connection(conn);
+        tcp_put_connection(conn);
         return -1;
     }
     
-    tcp_send_segment(conn, syn);
+    // Send SYN
     tcp_set_state(conn, TCP_SYN_SENT);
+    tcp_send_segment(conn, syn);
+    tcp_unlock(conn);
     
+    sock->tcp_conn = conn;
     sock->state = TCP_SYN_SENT;
     
     return 0;
 }
 
 int tcp_listen(socket_t* sock, int backlog) {
+    if (backlog < 1) {
+        backlog = 1;
+    } else if (backlog > TCP_MAX_BACKLOG) {
+        backlog = TCP_MAX_BACKLOG;
+    }
+    
     tcp_connection_t* conn = tcp_create_connection();
     if (!conn) {
         return -1;
     }
+    conn->refs++;
+    
+    conn->accept_queue = flux_allocate(NULL, backlog * sizeof(tcp_connection_t*),
+                                       FLUX_ALLOC_KERNEL);
+    if (!conn->accept_queue) {
+        tcp_destroy_connection(conn);
+        tcp_put_connection(conn);
+        return -1;
+    }
     
     conn->socket = sock;
     conn->local_addr = sock->local_addr.ipv4.addr;
     conn->local_port = sock->local_addr.ipv4.port;
     conn->state = TCP_LISTEN;
     conn->backlog = backlog;
+    if (sock->congestion) {
+        conn->cc = sock->congestion;
+    }
     
+    if (!tcp_listener_insert(conn)) {
+        tcp_destroy_connection(conn);
+        tcp_put_connection(conn);
+        return -1;
+    }
+    
+    sock->tcp_conn = conn;
     sock->state = TCP_LISTEN;
     
     return 0;
 }
 
+// The oldest established connection on sock's accept queue, on a socket
+// of its own; NULL if there's none
+socket_t* tcp_accept(socket_t* sock) {
+    tcp_connection_t* listener = tcp_find_socket_connection(sock);
+    if (!listener || listener->state != TCP_LISTEN) {
+        return NULL;
+    }
+    
+    for (;;) {
+        spinlock_acquire(&listener->lock);
+        if (listener->accept_queue_len == 0) {
+            spinlock_release(&listener->lock);
+            return NULL;
+        }
+        tcp_connection_t* conn = listener->accept_queue[listener->accept_queue_head];
+        listener->accept_queue_head = (listener->accept_queue_head + 1) % listener->backlog;
+        listener->accept_queue_len--;
+        spinlock_release(&listener->lock);
+        
+        // Reset while it waited
+        spinlock_acquire(&conn->lock);
+        if (!conn->hashed || conn->state == TCP_CLOSED) {
+            spinlock_release(&conn->lock);
+            tcp_destroy_connection(conn);
+            tcp_put_connection(conn);
+            continue;
+        }
+        
+        socket_t* new_sock = socket_create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (!new_sock) {
+            spinlock_release(&conn->lock);
+            tcp_destroy_connection(conn);
+            tcp_put_connection(conn);
+            return NULL;
+        }
+        
+        new_sock->local_addr.family = AF_INET;
+        new_sock->local_addr.ipv4.addr = conn->local_addr;
+        new_sock->local_addr.ipv4.port = conn->local_port;
+        new_sock->remote_addr.family = AF_INET;
+        new_sock->remote_addr.ipv4.addr = conn->remote_addr;
+        new_sock->remote_addr.ipv4.port = conn->remote_port;
+        new_sock->state = TCP_ESTABLISHED;
+        new_sock->tcp_conn = conn;
+        new_sock->congestion = conn->cc;
+        new_sock->keep_alive = sock->keep_alive;
+        
+        // The socket owns it now, not the listener, and has the accept
+        // queue's reference
+        tcp_connection_t* parent = conn->parent;
+        conn->socket = new_sock;
+        conn->parent = NULL;
+        if (new_sock->keep_alive) {
+            tcp_conn_timer_arm(conn, &conn->keepalive_timer,
+                               conn->last_recv + TCP_KEEPALIVE_INTERVAL);
+        }
+        spinlock_release(&conn->lock);
+        
+        tcp_put_connection(parent);
+        return new_sock;
+    }
+}
+
+// Queue as much of data as the send buffer has room for, in segments of
+// up to TCP_TSO_SEGMENTS MSS, and send what the windows allow; returns
+// the bytes queued
 int tcp_send(socket_t* sock, void* data, size_t len) {
     tcp_connection_t* conn = tcp_find_socket_connection(sock);
-    if (!conn || conn->state != TCP_ESTABLISHED) {
+    if (!conn) {
+        return -1;
+    }
+    
+    spinlock_acquire(&conn->lock);
+    if (conn->state != TCP_ESTABLISHED && conn->state != TCP_CLOSE_WAIT) {
+        spinlock_release(&conn->lock);
         return -1;
     }
     
-    // Create segments for data
+    size_t room = conn->send_buffer_size - conn->send_buffer_used;
+    if (len > room) {
+        len = room;
+    }
+    
+    size_t max_len = (size_t)conn->mss * TCP_TSO_SEGMENTS;
     size_t sent = 0;
     while (sent < len) {
-        size_t segment_len = (len - sent > conn->mss) ? conn->mss : (len - sent);
+        size_t segment_len = (len - sent > max_len) ? max_len : (len - sent);
         
         tcp_segment_t* segment = tcp_create_segment(conn, TCP_FLAG_ACK | TCP_FLAG_PSH,
                                                    (uint8_t*)data + sent, segment_len);
         if (!segment) {
-            return sent;
+            break;
         }
         
-        tcp_send_segment(conn, segment);
-        
-        conn->send_seq += segment_len;
+        tcp_queue_tail(conn, segment);
         sent += segment_len;
     }
     
+    tcp_output(conn);
+    spinlock_release(&conn->lock);
+    
     return sent;
 }
 
+// Copy out what's been received in order; the window it frees is
+// advertised at once once it's grown by an MSS (RFC 1122's receiver-side
+// silly window avoidance)
+int tcp_recv(socket_t* sock, void* buffer, size_t len) {
+    tcp_connection_t* conn = tcp_find_socket_connection(sock);
+    if (!conn || !buffer) {
+        return -1;
+    }
+    
+    spinlock_acquire(&conn->lock);
+    if (len > conn->recv_buffer_used) {
+        len = conn->recv_buffer_used;
+    }
+    
+    memcpy(buffer, conn->recv_buffer, len);
+    memmove(conn->recv_buffer, conn->recv_buffer + len, conn->recv_buffer_used - len);
+    conn->recv_buffer_used -= len;
+    
+    size_t space = conn->recv_buffer_size - conn->recv_buffer_used;
+    size_t threshold = conn->recv_buffer_size / 2 < conn->mss ? conn->recv_buffer_size / 2 :
+                                                               conn->mss;
+    if (len > 0 && space >= conn->recv_window + threshold &&
+        (conn->state == TCP_ESTABLISHED || conn->state == TCP_FIN_WAIT1 ||
+         conn->state == TCP_FIN_WAIT2)) {
+        tcp_send_ack(conn);
+    }
+    spinlock_release(&conn->lock);
+    
+    return len;
+}
+
 int tcp_close(socket_t* sock) {
     tcp_connection_t* conn = tcp_find_socket_connection(sock);
     if (!conn) {
         return -1;
     }
     
+    sock->tcp_conn = NULL;
+    if (conn->state == TCP_LISTEN) {
+        // Not yet accepted connections go with the listener
+        spinlock_acquire(&conn->lock);
+        conn->socket = NULL;
+        spinlock_release(&conn->lock);
+        tcp_destroy_connection(conn);
+        tcp_put_connection(conn);
+        return 0;
+    }
+    
+    // What's left of the close carries on without the socket
+    spinlock_acquire(&conn->lock);
     switch (conn->state) {
         case TCP_ESTABLISHED:
-            // Send FIN
+            // Send FIN, after whatever is still queued
             tcp_segment_t* fin = tcp_create_segment(conn, TCP_FLAG_FIN | TCP_FLAG_ACK,
                                                    NULL, 0);
             if (fin) {
-                tcp_send_segment(conn, fin);
                 tcp_set_state(conn, TCP_FIN_WAIT1);
+                tcp_send_segment(conn, fin);
             }
             break;
-            
+        
         case TCP_CLOSE_WAIT:
             // Send FIN
             tcp_segment_t* fin2 = tcp_create_segment(conn, TCP_FLAG_FIN | TCP_FLAG_ACK,
                                                     NULL, 0);
             if (fin2) {
-                tcp_send_segment(conn, fin2);
                 tcp_set_state(conn, TCP_LAST_ACK);
+                tcp_send_segment(conn, fin2);
             }
             break;
-            
+        
         default:
             tcp_set_state(conn, TCP_CLOSED);
             break;
     }
+    conn->socket = NULL;
+    tcp_unlock(conn);
+    tcp_put_connection(conn);
+    
+    return 0;
+}
+
+// What the socket would give now, as CONDUIT_SELECT_*_READY bits. Reads
+// the connection without its lock, for poll sets to call under theirs;
+// the socket's reference keeps it there.
+uint32_t tcp_poll(socket_t* sock) {
+    tcp_connection_t* conn = tcp_find_socket_connection(sock);
+    if (!conn) {
+        return 0;
+    }
+    
+    uint8_t state = __atomic_load_n(&conn->state, __ATOMIC_ACQUIRE);
+    if (state == TCP_LISTEN) {
+        return __atomic_load_n(&conn->accept_queue_len, __ATOMIC_RELAXED) > 0 ?
+               CONDUIT_SELECT_READ_READY : 0;
+    }
+    
+    uint32_t ready = 0;
+    if (__atomic_load_n(&conn->recv_buffer_used, __ATOMIC_RELAXED) > 0) {
+        ready |= CONDUIT_SELECT_READ_READY;
+    }
+    
+    // Writable with half the send buffer free, as conduits count it
+    if ((state == TCP_ESTABLISHED || state == TCP_CLOSE_WAIT) &&
+        __atomic_load_n(&conn->send_buffer_used, __ATOMIC_RELAXED) < conn->send_buffer_size / 2) {
+        ready |= CONDUIT_SELECT_WRITE_READY;
+    }
+    
+    // The peer's FIN reads as the end of the stream
+    if (state == TCP_CLOSE_WAIT || state == TCP_CLOSING || state == TCP_LAST_ACK ||
+        state == TCP_TIME_WAIT || state == TCP_CLOSED) {
+        ready |= CONDUIT_SELECT_READ_READY;
+    }
+    if (state == TCP_CLOSED) {
+        ready |= CONDUIT_SELECT_ERROR_READY;
+    }
+    
+    return ready;
+}
+
+void tcp_set_keepalive(socket_t* sock, bool enable) {
+    tcp_connection_t* conn = tcp_find_socket_connection(sock);
+    if (!conn || !enable) {
+        return;
+    }
+    
+    spinlock_acquire(&conn->lock);
+    if (conn->state == TCP_ESTABLISHED || conn->state == TCP_CLOSE_WAIT) {
+        tcp_conn_timer_arm(conn, &conn->keepalive_timer,
+                           conn->last_recv + TCP_KEEPALIVE_INTERVAL);
+    }
+    spinlock_release(&conn->lock);
+}
+
+// =============================================================================
+// Socket Options
+// =============================================================================
+
+int tcp_setsockopt(socket_t* sock, int optname, const void* value, size_t len) {
+    if (!sock || !value) {
+        return -1;
+    }
+    
+    switch (optname) {
+        case TCP_CONGESTION: {
+            const tcp_cc_ops_t* ops = tcp_cc_find(value, len);
+            if (!ops) {
+                return -1;
+            }
+            
+            // A listener passes it on to what it accepts; a connection
+            // switches at once, starting the algorithm afresh
+            sock->congestion = ops;
+            tcp_connection_t* conn = tcp_find_socket_connection(sock);
+            if (conn) {
+                spinlock_acquire(&conn->lock);
+                if (conn->cc != ops) {
+                    conn->cc = ops;
+                    if (conn->state != TCP_LISTEN) {
+                        tcp_cc_start(conn);
+                    }
+                }
+                spinlock_release(&conn->lock);
+            }
+            return 0;
+        }
+        
+        default:
+            return -1;
+    }
+}
+
+int tcp_get_info(socket_t* sock, tcp_info_t* info) {
+    tcp_connection_t* conn = tcp_find_socket_connection(sock);
+    if (!conn || !info) {
+        return -1;
+    }
+    
+    memset(info, 0, sizeof(*info));
+    spinlock_acquire(&conn->lock);
+    info->state = conn->state;
+    info->ca_state = conn->ca_state;
+    info->snd_wscale = conn->snd_wscale;
+    info->rcv_wscale = conn->rcv_wscale;
+    info->sack = conn->sack_permitted;
+    info->timestamps = conn->timestamps;
+    for (uint32_t i = 0; i < TCP_CC_NAME_MAX - 1 && conn->cc->name[i]; i++) {
+        info->congestion[i] = conn->cc->name[i];
+    }
+    
+    info->mss = conn->mss;
+    info->cwnd = conn->congestion_window;
+    info->ssthresh = conn->ssthresh;
+    info->in_flight = conn->in_flight;
+    info->sacked = conn->sacked_out;
+    info->send_window = conn->send_window;
+    info->recv_window = conn->recv_window;
+    
+    info->srtt = conn->srtt;
+    info->rttvar = conn->rttvar;
+    info->min_rtt = conn->min_rtt;
+    info->rto = conn->rto;
+    
+    info->pacing_rate = conn->pacing_rate;
+    info->delivery_rate = conn->delivery_rate;
+    
+    info->bytes_sent = conn->bytes_sent;
+    info->bytes_retransmitted = conn->bytes_retransmitted;
+    info->bytes_acked = conn->bytes_acked;
+    info->bytes_received = conn->bytes_received;
+    info->retransmits = conn->retransmits;
+    info->rto_count = conn->rto_count;
+    info->tlp_count = conn->tlp_count;
+    info->recoveries = conn->recoveries;
+    info->dsacks = conn->dsacks;
+    spinlock_release(&conn->lock);
     
     return 0;
 }
+
+// *len is the room at value on entry and what was written on return
+int tcp_getsockopt(socket_t* sock, int optname, void* value, size_t* len) {
+    if (!sock || !value || !len) {
+        return -1;
+    }
+    
+    switch (optname) {
+        case TCP_INFO:
+            if (*len < sizeof(tcp_info_t) || tcp_get_info(sock, value) < 0) {
+                return -1;
+            }
+            *len = sizeof(tcp_info_t);
+            return 0;
+        
+        case TCP_CONGESTION: {
+            tcp_connection_t* conn = tcp_find_socket_connection(sock);
+            const tcp_cc_ops_t* ops = conn ? conn->cc : sock->congestion;
+            if (!ops) {
+                ops = tcp_cc_default();
+            }
+            
+            size_t name_len = 0;
+            while (ops->name[name_len]) {
+                name_len++;
+            }
+            if (*len <= name_len) {
+                return -1;
+            }
+            memcpy(value, ops->name, name_len + 1);
+            *len = name_len + 1;
+            return 0;
+        }
+        
+        default:
+            return -1;
+    }
+}
@@ -7,6 +7,7 @@
 #define TCP_H
 
 #include "harmony_net.h"
+#include "tcp_timer.h"
 
 // =============================================================================
 // TCP Constants
@@ -31,30 +32,111 @@
 #define TCP_OPT_SACK    5
 #define TCP_OPT_TIMESTAMP 8
 
+// Their lengths
+#define TCP_OPTLEN_MSS          4
+#define TCP_OPTLEN_WSCALE       3
+#define TCP_OPTLEN_SACK_OK      2
+#define TCP_OPTLEN_TIMESTAMP    10
+#define TCP_OPTLEN_MAX          40
+#define TCP_WSCALE_MAX          14
+#define TCP_WSCALE_NONE         0xFF
+#define TCP_MAX_SACK_BLOCKS     4
+
 // TCP Parameters
 #define TCP_DEFAULT_MSS         1460
+#define TCP_MIN_MSS             536        // Assumed when the peer names none
 #define TCP_DEFAULT_WINDOW      65535
 #define TCP_MAX_RETRANSMITS     5
 #define TCP_RETRANSMIT_TIMEOUT  1000000    // 1 second in microseconds
+#define TCP_MIN_RTO             200000
+#define TCP_MAX_RTO             60000000
 #define TCP_TIME_WAIT_DURATION  120000000  // 2 minutes
 #define TCP_KEEPALIVE_INTERVAL  7200000000 // 2 hours
+#define TCP_KEEPALIVE_PROBE_INTERVAL 75000000 // Between unanswered keepalive probes
+#define TCP_KEEPALIVE_PROBES    9          // Unanswered before the connection is dropped
+#define TCP_FIN_TIMEOUT         60000000   // A closed socket's connection waits in FIN_WAIT2
+#define TCP_DELACK_TIMEOUT      40000      // Longest an ACK is held back
+#define TCP_QUICKACKS           16         // ACKs a new connection sends without delay
 #define TCP_RECV_BUFFER_SIZE    65536
-#define TCP_SEND_BUFFER_SIZE    65536
+#define TCP_SEND_BUFFER_SIZE    4194304    // Unacknowledged bytes a connection queues
+#define TCP_TSO_SEGMENTS        16         // MSS-sized segments tcp_send builds as one
+
+// Congestion control and loss recovery
+#define TCP_INIT_CWND           10         // Segments (RFC 6928)
+#define TCP_DUPACK_THRESHOLD    3
+#define TCP_MIN_RTT_WINDOW      300000000  // How long a minimum RTT sample stands
+#define TCP_TLP_MIN_PTO         10000      // Tail loss probe timeout's floor
+#define TCP_RACK_REO_MULT_MAX   16         // Reordering window growth from D-SACKs
+#define TCP_PACING_HORIZON      TCP_TIMER_TICK  // Pacing credit a connection banks
+#define TCP_CC_NAME_MAX         16
+#define TCP_CC_PRIV_WORDS       24
+
+// Congestion states
+#define TCP_CA_OPEN             0
+#define TCP_CA_RECOVERY         1          // Fast recovery, from SACK, RACK or duplicate ACKs
+#define TCP_CA_LOSS             2          // After a retransmission timeout
+
+// Segment states, on the send queue
+#define TCP_SEG_SENT            (1 << 0)
+#define TCP_SEG_IN_FLIGHT       (1 << 1)   // Sent and neither acked, sacked nor lost
+#define TCP_SEG_SACKED          (1 << 2)
+#define TCP_SEG_LOST            (1 << 3)   // To be retransmitted
+
+// Sequence-space comparisons, modulo 2^32
+#define TCP_SEQ_LT(a, b)        ((int32_t)((uint32_t)(a) - (uint32_t)(b)) < 0)
+#define TCP_SEQ_LEQ(a, b)       ((int32_t)((uint32_t)(a) - (uint32_t)(b)) <= 0)
+#define TCP_SEQ_GT(a, b)        TCP_SEQ_LT(b, a)
+#define TCP_SEQ_GEQ(a, b)       TCP_SEQ_LEQ(b, a)
+
+// Demultiplexing tables, powers of two
+#define TCP_HASH_BUCKETS        65536      // Connections, by remote address and ports
+#define TCP_HASH_LOCKS          64         // Writers' locks, each over a share of the buckets
+#define TCP_LISTEN_BUCKETS      256        // Listeners, by local port
+#define TCP_TIMEWAIT_BUCKETS    16384      // Connections in TIME_WAIT, like the others
+
+// Passive opens
+#define TCP_MAX_BACKLOG         4096       // Largest accept queue tcp_listen grants
+#define TCP_SYN_BACKLOG         256        // Half-open connections a listener keeps
+#define TCP_SYN_TIMEOUT         10000000   // Before a half-open connection is dropped
+#define TCP_REAP_PERIOD         1000000    // Between sweeps for them
+#define TCP_COOKIE_PERIOD       64000000   // A SYN cookie's time slot
+#define TCP_COOKIE_MAX_AGE      2          // Slots a cookie stays good for
 
 // =============================================================================
 // TCP Data Structures
 // =============================================================================
 
-// TCP Segment
+// TCP Segment, on the send queue or held out of order; its header's
+// ACK, window and options are filled in each time it goes out
 typedef struct tcp_segment {
     tcp_header_t tcp_header;
     uint8_t* data;
     size_t data_len;
-    uint64_t timestamp;
+    uint64_t timestamp;         // Last sent
     uint32_t retransmissions;
+    uint32_t state;             // TCP_SEG_*
+    
+    // The connection's delivery when this was last sent, for rate samples
+    uint64_t tx_delivered;
+    uint64_t tx_delivered_time;
+    uint64_t tx_first_sent;
+    bool tx_app_limited;
+    
     struct tcp_segment* next;
 } tcp_segment_t;
 
+// What a segment's options said
+typedef struct {
+    uint16_t mss;               // 0 if absent
+    uint8_t wscale;             // TCP_WSCALE_NONE if absent
+    bool sack_permitted;
+    bool timestamp;
+    uint32_t tsval;
+    uint32_t tsecr;
+    uint32_t num_sacks;
+    uint32_t sacks[TCP_MAX_SACK_BLOCKS][2];     // Start and end, host order
+} tcp_options_t;
+
 // TCP Connection
 typedef struct tcp_connection {
     uint32_t local_addr;
@@ -73,64 +155,218 @@ typedef struct tcp_connection {
     uint32_t recv_ack;      // Receive acknowledgment
     uint32_t recv_wnd;      // Receive window
     
-    // Options
-    uint16_t mss;           // Maximum segment size
-    uint8_t window_scale;
+    // Options as negotiated; an active open offers them all until the
+    // SYN-ACK says otherwise
+    uint16_t mss;           // Payload per segment, less the timestamp option's room
+    uint8_t snd_wscale;     // Shift of the peer's window
+    uint8_t rcv_wscale;     // ...and ours as advertised
+    bool wscale_ok;
     bool sack_permitted;
+    bool timestamps;
+    uint32_t ts_recent;     // Peer's last TSval, echoed back
     
     // Buffers
     uint8_t* recv_buffer;
     size_t recv_buffer_size;
     size_t recv_buffer_used;
     
-    uint8_t* send_buffer;
     size_t send_buffer_size;
     size_t send_buffer_used;
     
-    // Retransmission queue
+    // Send queue: everything not yet acknowledged, in sequence order,
+    // from send_head on not yet sent. send_buffer_used counts its data.
     tcp_segment_t* retrans_queue;
+    tcp_segment_t* send_head;
+    tcp_segment_t* send_tail;
     tcp_segment_t* unacked_segments;
     
-    // Timers
+    // Received out of order, sorted and not overlapping; what they and
+    // duplicates tell the peer in SACK and D-SACK blocks
+    tcp_segment_t* ooo_queue;
+    uint32_t sack_recent;   // Start of the latest out-of-order arrival
+    uint32_t dsack[2];
+    bool dsack_pending;
+    
+    // Timers: deadlines the transmit timer serves, 0 when not set, and
+    // the wheel's entries, each holding a reference while armed
     uint64_t retransmit_timer;
-    uint64_t time_wait_timer;
-    uint64_t keepalive_timer;
-    uint64_t persist_timer;
+    uint64_t persist_timer;  // Zero-window probe
+    uint64_t probe_timer;    // Tail loss probe
+    uint64_t rack_timer;     // RACK's reordering window running out
+    tcp_timer_t xmit_timer;  // The earliest of those, or pacing's next frame
+    tcp_timer_t delack_timer;
+    tcp_timer_t keepalive_timer; // Also a closed socket's FIN_WAIT2 limit
+    
+    // Delayed ACK (RFC 1122 4.2.3.2) and keepalive
+    bool ack_pending;
+    uint32_t rcv_unacked;   // Bytes received since the last ACK went out
+    uint8_t quickacks;      // ACKs still sent without delay
+    uint64_t last_recv;
+    uint8_t keepalive_probes;
     
     // Window management
-    uint32_t send_window;
+    uint32_t send_window;   // Peer's, scaled
     uint32_t recv_window;
     uint32_t congestion_window;
     uint32_t ssthresh;
+    uint32_t in_flight;     // Bytes sent and neither acked, sacked nor lost
+    uint32_t sacked_out;    // Bytes sacked above send_una
+    bool cwnd_limited;      // The last output stopped at the window
+    
+    // Congestion control
+    const struct tcp_cc_ops* cc;
+    uint64_t cc_priv[TCP_CC_PRIV_WORDS];
+    uint8_t ca_state;       // TCP_CA_*
+    uint32_t recovery_point; // Recovery ends once this is acknowledged
+    uint32_t dupacks;
+    uint64_t pacing_rate;   // Bytes per second; 0 doesn't pace
+    uint64_t pace_time;     // When pacing lets the next frame go
+    bool pace_blocked;
     
-    // Round-trip time estimation
+    // Round-trip time estimation (microseconds)
     uint32_t srtt;          // Smoothed RTT
     uint32_t rttvar;        // RTT variance
     uint32_t rto;           // Retransmission timeout
+    uint32_t min_rtt;
+    uint64_t min_rtt_time;
+    uint32_t latest_rtt;
+    
+    // RACK (RFC 8985): the most recently sent segment delivered, and
+    // how late others sent before it may still be
+    uint64_t rack_xmit_time;
+    uint32_t rack_end_seq;
+    uint32_t rack_rtt;
+    uint32_t rack_fack;     // Highest sequence delivered
+    uint32_t rack_reo_wnd_mult;
+    uint32_t rack_recoveries; // Since the reordering window last grew
+    bool rack_reordering_seen;
+    
+    // Tail loss probe outstanding: the sequence it went out below, and
+    // whether it resent data rather than sending new
+    bool tlp_pending;
+    uint32_t tlp_high_seq;
+    bool tlp_retrans;
+    
+    // Delivery rate estimation
+    uint64_t delivered;     // Bytes acked or sacked over the connection
+    uint64_t delivered_time;
+    uint64_t first_sent_time;
+    uint64_t app_limited;   // delivered at which an app-limited stretch ends; 0 if none
+    uint64_t delivery_rate; // Bytes per second, latest sample
+    
+    // Statistics
+    uint64_t bytes_sent;
+    uint64_t bytes_retransmitted;
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
+    uint32_t retransmits;
+    uint32_t rto_count;
+    uint32_t tlp_count;
+    uint32_t recoveries;
+    uint32_t dsacks;
     
     // Associated socket
     socket_t* socket;
     
-    // Listen backlog
+    // Listen backlog: connections established and waiting for
+    // tcp_accept, a ring of backlog, and those still half-open
     int backlog;
     struct tcp_connection** accept_queue;
     int accept_queue_head;
     int accept_queue_tail;
+    int accept_queue_len;
+    struct tcp_connection* syn_queue;
+    uint32_t syn_queue_len;
+    
+    // A passive open's listener, and its place on the listener's queue
+    // while it's half-open
+    struct tcp_connection* parent;
+    struct tcp_connection* syn_next;
+    uint64_t syn_time;
+    bool syn_queued;
+    
+    // Demultiplexing: held by the table the connection is in, by its
+    // socket, by armed timers and by lookups still using it
+    uint32_t refs;
+    bool hashed;
+    bool destroyed;
     
     spinlock_t lock;
-    struct tcp_connection* next;
+    struct tcp_connection* next;    // Hash chain
 } tcp_connection_t;
 
+// A connection in TIME_WAIT, cut down to what answering a stray segment
+// takes; the full connection is freed once it's here
+typedef struct tcp_timewait {
+    uint32_t local_addr;
+    uint32_t remote_addr;
+    uint16_t local_port;
+    uint16_t remote_port;
+    uint32_t send_seq;
+    uint32_t recv_ack;
+    uint32_t ts_recent;
+    uint32_t recv_window;
+    uint8_t rcv_wscale;
+    bool timestamps;
+    bool hashed;
+    uint32_t refs;          // The table's, the timer's, and lookups'
+    tcp_timer_t timer;
+    struct tcp_timewait* next;
+} tcp_timewait_t;
+
+// One connection's state as TCP_INFO reports it
+typedef struct {
+    uint8_t state;
+    uint8_t ca_state;
+    uint8_t snd_wscale;
+    uint8_t rcv_wscale;
+    bool sack;
+    bool timestamps;
+    char congestion[TCP_CC_NAME_MAX];
+    
+    uint32_t mss;
+    uint32_t cwnd;              // Bytes
+    uint32_t ssthresh;
+    uint32_t in_flight;
+    uint32_t sacked;
+    uint32_t send_window;
+    uint32_t recv_window;
+    
+    uint32_t srtt;              // Microseconds
+    uint32_t rttvar;
+    uint32_t min_rtt;
+    uint32_t rto;
+    
+    uint64_t pacing_rate;       // Bytes per second
+    uint64_t delivery_rate;
+    
+    uint64_t bytes_sent;
+    uint64_t bytes_retransmitted;
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
+    uint32_t retransmits;       // Segments
+    uint32_t rto_count;
+    uint32_t tlp_count;
+    uint32_t recoveries;
+    uint32_t dsacks;
+} tcp_info_t;
+
 // =============================================================================
 // Function Prototypes
 // =============================================================================
 
-// Connection management
+void tcp_init(void);
+
+// Connection management. The finds take no locks and return the
+// connection with a reference, dropped with tcp_put_connection; destroy
+// takes it out of its table, releasing it once nothing can still be
+// looking at it.
 tcp_connection_t* tcp_create_connection(void);
 void tcp_destroy_connection(tcp_connection_t* conn);
+void tcp_put_connection(tcp_connection_t* conn);
 tcp_connection_t* tcp_find_connection(uint32_t src_addr, uint16_t src_port,
                                       uint32_t dest_addr, uint16_t dest_port);
-tcp_connection_t* tcp_find_listener(uint16_t port);
+tcp_connection_t* tcp_find_listener(uint32_t addr, uint16_t port);
 tcp_connection_t* tcp_find_socket_connection(socket_t* sock);
 
 // Port allocation
@@ -144,7 +380,7 @@ void tcp_send_rst(network_interface_t* iface, ipv4_header_t* ip_hdr,
 
 // Input/Output
 void tcp_input(network_interface_t* iface, ipv4_header_t* ip_hdr,
-              tcp_header_t* tcp_hdr, void* data, size_t data_len);
+              tcp_header_t* tcp_hdr, void* data, size_t data_len, bool csum_valid);
 int tcp_output(tcp_connection_t* conn);
 
 // Socket interface
@@ -154,15 +390,25 @@ socket_t* tcp_accept(socket_t* sock);
 int tcp_send(socket_t* sock, void* data, size_t len);
 int tcp_recv(socket_t* sock, void* buffer, size_t len);
 int tcp_close(socket_t* sock);
+uint32_t tcp_poll(socket_t* sock);
+
+// IPPROTO_TCP options: TCP_CONGESTION takes and gives an algorithm's
+// name, TCP_INFO gives a tcp_info_t
+int tcp_setsockopt(socket_t* sock, int optname, const void* value, size_t len);
+int tcp_getsockopt(socket_t* sock, int optname, void* value, size_t* len);
+int tcp_get_info(socket_t* sock, tcp_info_t* info);
 
-// Timer handling
-void tcp_timer_tick(void);
+// Timer handling; the timeouts run with the connection locked. Keepalive
+// follows the socket's SO_KEEPALIVE, tcp_set_keepalive starting it on a
+// connection already established.
 void tcp_retransmit_timeout(tcp_connection_t* conn);
 void tcp_keepalive_timeout(tcp_connection_t* conn);
+void tcp_set_keepalive(socket_t* sock, bool enable);
 
 // Helper functions
 uint64_t harmony_get_time(void);
 uint32_t harmony_random(void);
+socket_t* socket_create(int family, int type, int protocol);
 uint16_t htons(uint16_t hostshort);
 uint32_t htonl(uint32_t hostlong);
 uint16_t ntohs(uint16_t netshort);
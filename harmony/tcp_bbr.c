@@ -0,0 +1,410 @@
+/*
+ * BBR Congestion Control
+ * BBRv1: paces at the bottleneck bandwidth it measures and keeps about
+ * one bandwidth-delay product in flight, probing now and then for more
+ * bandwidth and for the path's minimum RTT
+ */
+
+#include "tcp_cc.h"
+
+// =============================================================================
+// BBR Constants
+// =============================================================================
+
+// Gains, in 256ths
+#define BBR_UNIT                256
+#define BBR_HIGH_GAIN           739     // 2/ln(2): doubles the rate each round in startup
+#define BBR_DRAIN_GAIN          88      // Its inverse, to drain the queue startup built
+#define BBR_CWND_GAIN           512
+
+#define BBR_BW_ROUNDS           10      // Rounds the bandwidth filter's maximum stands
+#define BBR_MIN_RTT_WINDOW      10000000    // Microseconds the minimum RTT stands
+#define BBR_PROBE_RTT_TIME      200000
+#define BBR_MIN_CWND_SEGMENTS   4
+#define BBR_FULL_BW_GROWTH      320     // 1.25, in 256ths: still growing
+#define BBR_FULL_BW_ROUNDS      3       // Rounds without that much growth end startup
+#define BBR_PACING_MARGIN       99      // Percent of the bandwidth paced at
+#define BBR_CYCLE_LEN           8
+
+// Modes
+#define BBR_STARTUP             0
+#define BBR_DRAIN               1
+#define BBR_PROBE_BW            2
+#define BBR_PROBE_RTT           3
+
+// PROBE_BW's pacing gains: probe for more, drain what that queued, cruise
+static const uint32_t g_bbr_cycle_gain[BBR_CYCLE_LEN] = {
+    320, 192, 256, 256, 256, 256, 256, 256
+};
+
+// A windowed maximum as three samples: the best, and the best of the
+// later parts of the window to fall back on as it slides (Kathleen
+// Nichols' algorithm)
+typedef struct {
+    uint32_t round;
+    uint64_t value;
+} bbr_sample_t;
+
+typedef struct {
+    bbr_sample_t bw[3];         // Bytes per second, by round
+    uint32_t round_count;
+    uint64_t next_round_delivered;
+    bool round_start;
+    
+    uint32_t mode;
+    uint32_t pacing_gain;
+    uint32_t cwnd_gain;
+    uint32_t cycle_index;
+    uint64_t cycle_stamp;
+    
+    uint32_t min_rtt;           // Microseconds; 0 before a sample
+    uint64_t min_rtt_stamp;
+    uint64_t probe_rtt_done;
+    bool probe_rtt_round_done;
+    
+    uint64_t full_bw;
+    uint32_t full_bw_count;
+    bool full_bw_reached;
+    
+    uint32_t prior_cwnd;        // Restored after recovery and PROBE_RTT
+    bool packet_conservation;
+    uint64_t conservation_until;    // delivered at which conservation ends
+} tcp_bbr_t;
+
+_Static_assert(sizeof(tcp_bbr_t) <= TCP_CC_PRIV_WORDS * sizeof(uint64_t),
+               "BBR state must fit in cc_priv");
+
+// =============================================================================
+// Bandwidth Filter
+// =============================================================================
+
+static void bbr_filter_reset(bbr_sample_t* samples, uint32_t round, uint64_t value) {
+    for (uint32_t i = 0; i < 3; i++) {
+        samples[i].round = round;
+        samples[i].value = value;
+    }
+}
+
+static void bbr_filter_update(bbr_sample_t* samples, uint32_t round, uint64_t value) {
+    bbr_sample_t sample = { round, value };
+    
+    if (value >= samples[0].value || round - samples[2].round > BBR_BW_ROUNDS) {
+        bbr_filter_reset(samples, round, value);
+        return;
+    }
+    
+    if (value >= samples[1].value) {
+        samples[1] = samples[2] = sample;
+    } else if (value >= samples[2].value) {
+        samples[2] = sample;
+    }
+    
+    // Age the best out as the window passes it, promoting the others
+    uint32_t age = round - samples[0].round;
+    if (age > BBR_BW_ROUNDS) {
+        samples[0] = samples[1];
+        samples[1] = samples[2];
+        samples[2] = sample;
+        if (round - samples[0].round > BBR_BW_ROUNDS) {
+            samples[0] = samples[1];
+            samples[1] = samples[2];
+        }
+    } else if (samples[1].round == samples[0].round && age > BBR_BW_ROUNDS / 4) {
+        samples[1] = samples[2] = sample;
+    } else if (samples[2].round == samples[1].round && age > BBR_BW_ROUNDS / 2) {
+        samples[2] = sample;
+    }
+}
+
+static inline uint64_t bbr_max_bw(tcp_bbr_t* bbr) {
+    return bbr->bw[0].value;
+}
+
+// =============================================================================
+// Model
+// =============================================================================
+
+// Bytes in flight that fill the path at gain times the bandwidth-delay
+// product
+static uint32_t bbr_inflight(tcp_connection_t* conn, tcp_bbr_t* bbr, uint32_t gain) {
+    if (bbr->min_rtt == 0 || bbr_max_bw(bbr) == 0) {
+        return TCP_INIT_CWND * conn->mss;
+    }
+    
+    uint64_t bdp = bbr_max_bw(bbr) * bbr->min_rtt / 1000000;
+    uint64_t target = bdp * gain / BBR_UNIT + 3ULL * conn->mss;
+    return target > UINT32_MAX ? UINT32_MAX : (uint32_t)target;
+}
+
+static inline uint32_t bbr_min_cwnd(tcp_connection_t* conn) {
+    return BBR_MIN_CWND_SEGMENTS * conn->mss;
+}
+
+static void bbr_enter_probe_bw(tcp_bbr_t* bbr, uint64_t now) {
+    bbr->mode = BBR_PROBE_BW;
+    bbr->cwnd_gain = BBR_CWND_GAIN;
+    
+    // Start anywhere but the drain phase, so flows sharing a path don't
+    // probe in step
+    bbr->cycle_index = (BBR_CYCLE_LEN - 1 - harmony_random() % (BBR_CYCLE_LEN - 1)) %
+                       BBR_CYCLE_LEN;
+    bbr->pacing_gain = g_bbr_cycle_gain[bbr->cycle_index];
+    bbr->cycle_stamp = now;
+}
+
+static void bbr_enter_startup(tcp_bbr_t* bbr) {
+    bbr->mode = BBR_STARTUP;
+    bbr->pacing_gain = BBR_HIGH_GAIN;
+    bbr->cwnd_gain = BBR_HIGH_GAIN;
+}
+
+static void bbr_update_round(tcp_connection_t* conn, tcp_bbr_t* bbr,
+                             const tcp_rate_sample_t* rs) {
+    bbr->round_start = false;
+    if (rs->interval > 0 && rs->prior_delivered >= bbr->next_round_delivered) {
+        bbr->next_round_delivered = conn->delivered;
+        bbr->round_count++;
+        bbr->round_start = true;
+    }
+}
+
+// App-limited samples only count when they show more than the filter
+// already holds: they can underestimate, never overestimate
+static void bbr_update_bw(tcp_bbr_t* bbr, const tcp_rate_sample_t* rs) {
+    if (rs->interval == 0 || rs->delivered == 0) {
+        return;
+    }
+    
+    uint64_t bw = rs->delivered * 1000000 / rs->interval;
+    if (!rs->app_limited || bw >= bbr_max_bw(bbr)) {
+        bbr_filter_update(bbr->bw, bbr->round_count, bw);
+    }
+}
+
+// Startup is over once three rounds in a row fail to grow the bandwidth
+// by a quarter
+static void bbr_check_full_bw(tcp_bbr_t* bbr, const tcp_rate_sample_t* rs) {
+    if (bbr->full_bw_reached || !bbr->round_start || rs->app_limited) {
+        return;
+    }
+    
+    uint64_t threshold = bbr->full_bw * BBR_FULL_BW_GROWTH / BBR_UNIT;
+    if (bbr_max_bw(bbr) >= threshold) {
+        bbr->full_bw = bbr_max_bw(bbr);
+        bbr->full_bw_count = 0;
+        return;
+    }
+    
+    if (++bbr->full_bw_count >= BBR_FULL_BW_ROUNDS) {
+        bbr->full_bw_reached = true;
+    }
+}
+
+static void bbr_check_drain(tcp_connection_t* conn, tcp_bbr_t* bbr, uint64_t now) {
+    if (bbr->mode == BBR_STARTUP && bbr->full_bw_reached) {
+        bbr->mode = BBR_DRAIN;
+        bbr->pacing_gain = BBR_DRAIN_GAIN;
+        bbr->cwnd_gain = BBR_HIGH_GAIN;
+    }
+    
+    if (bbr->mode == BBR_DRAIN && conn->in_flight <= bbr_inflight(conn, bbr, BBR_UNIT)) {
+        bbr_enter_probe_bw(bbr, now);
+    }
+}
+
+// Each phase lasts a minimum RTT. Probing goes on until it has filled
+// the pipe to its gain or seen loss; draining stops as soon as the
+// queue is gone.
+static void bbr_update_cycle(tcp_connection_t* conn, tcp_bbr_t* bbr,
+                             const tcp_rate_sample_t* rs, uint64_t now) {
+    if (bbr->mode != BBR_PROBE_BW) {
+        return;
+    }
+    
+    bool elapsed = now - bbr->cycle_stamp > bbr->min_rtt;
+    bool advance;
+    if (bbr->pacing_gain > BBR_UNIT) {
+        advance = elapsed && (rs->lost > 0 ||
+                              rs->prior_in_flight >= bbr_inflight(conn, bbr, bbr->pacing_gain));
+    } else if (bbr->pacing_gain < BBR_UNIT) {
+        advance = elapsed || rs->prior_in_flight <= bbr_inflight(conn, bbr, BBR_UNIT);
+    } else {
+        advance = elapsed;
+    }
+    
+    if (advance) {
+        bbr->cycle_index = (bbr->cycle_index + 1) % BBR_CYCLE_LEN;
+        bbr->pacing_gain = g_bbr_cycle_gain[bbr->cycle_index];
+        bbr->cycle_stamp = now;
+    }
+}
+
+// A minimum RTT no sample has matched in BBR_MIN_RTT_WINDOW is stale:
+// drain to a few segments in flight for a while to measure it afresh
+static void bbr_update_min_rtt(tcp_connection_t* conn, tcp_bbr_t* bbr,
+                               const tcp_rate_sample_t* rs, uint64_t now) {
+    bool expired = now - bbr->min_rtt_stamp > BBR_MIN_RTT_WINDOW;
+    if (rs->rtt > 0 && (bbr->min_rtt == 0 || rs->rtt <= bbr->min_rtt || expired)) {
+        bbr->min_rtt = rs->rtt;
+        bbr->min_rtt_stamp = now;
+    }
+    
+    if (expired && bbr->mode != BBR_PROBE_RTT && bbr->min_rtt) {
+        bbr->mode = BBR_PROBE_RTT;
+        bbr->pacing_gain = BBR_UNIT;
+        bbr->cwnd_gain = BBR_UNIT;
+        bbr->prior_cwnd = conn->congestion_window;
+        bbr->probe_rtt_done = 0;
+    }
+    
+    if (bbr->mode != BBR_PROBE_RTT) {
+        return;
+    }
+    
+    if (bbr->probe_rtt_done == 0) {
+        if (conn->in_flight <= bbr_min_cwnd(conn)) {
+            bbr->probe_rtt_done = now + BBR_PROBE_RTT_TIME;
+            bbr->probe_rtt_round_done = false;
+            bbr->next_round_delivered = conn->delivered;
+        }
+        return;
+    }
+    
+    if (bbr->round_start) {
+        bbr->probe_rtt_round_done = true;
+    }
+    if (bbr->probe_rtt_round_done && now >= bbr->probe_rtt_done) {
+        bbr->min_rtt_stamp = now;
+        if (conn->congestion_window < bbr->prior_cwnd) {
+            conn->congestion_window = bbr->prior_cwnd;
+        }
+        if (bbr->full_bw_reached) {
+            bbr_enter_probe_bw(bbr, now);
+        } else {
+            bbr_enter_startup(bbr);
+        }
+    }
+}
+
+// Until startup finds the bandwidth the rate only rises
+static void bbr_set_pacing_rate(tcp_connection_t* conn, tcp_bbr_t* bbr) {
+    uint64_t bw = bbr_max_bw(bbr);
+    if (bw == 0) {
+        return;
+    }
+    
+    uint64_t rate = bw * bbr->pacing_gain / BBR_UNIT * BBR_PACING_MARGIN / 100;
+    if (bbr->full_bw_reached || rate > conn->pacing_rate) {
+        conn->pacing_rate = rate;
+    }
+}
+
+static void bbr_set_cwnd(tcp_connection_t* conn, tcp_bbr_t* bbr,
+                         const tcp_rate_sample_t* rs) {
+    uint32_t cwnd = conn->congestion_window;
+    uint32_t target = bbr_inflight(conn, bbr, bbr->cwnd_gain);
+    
+    // Losses come out of the window, then recovery's first round sends
+    // only as much as was delivered
+    if (rs->lost > 0) {
+        cwnd = cwnd > rs->lost + conn->mss ? cwnd - rs->lost : conn->mss;
+    }
+    if (bbr->packet_conservation) {
+        if (conn->delivered >= bbr->conservation_until) {
+            bbr->packet_conservation = false;
+        } else if (cwnd < conn->in_flight + rs->acked) {
+            cwnd = conn->in_flight + rs->acked;
+        }
+    }
+    
+    if (!bbr->packet_conservation) {
+        if (bbr->full_bw_reached) {
+            uint64_t grown = (uint64_t)cwnd + rs->acked;
+            cwnd = grown < target ? (uint32_t)grown : target;
+        } else if (cwnd < target || conn->delivered < TCP_INIT_CWND * conn->mss) {
+            cwnd += rs->acked;
+        }
+    }
+    
+    if (cwnd < bbr_min_cwnd(conn)) {
+        cwnd = bbr_min_cwnd(conn);
+    }
+    if (bbr->mode == BBR_PROBE_RTT && cwnd > bbr_min_cwnd(conn)) {
+        cwnd = bbr_min_cwnd(conn);
+    }
+    conn->congestion_window = cwnd;
+}
+
+// =============================================================================
+// Algorithm Hooks
+// =============================================================================
+
+static void bbr_init(tcp_connection_t* conn) {
+    tcp_bbr_t* bbr = tcp_cc_priv(conn);
+    uint64_t now = harmony_get_time();
+    
+    bbr_enter_startup(bbr);
+    bbr->min_rtt_stamp = now;
+    bbr->next_round_delivered = conn->delivered;
+    bbr_filter_reset(bbr->bw, 0, 0);
+    
+    // Without a measurement yet, the initial window at startup's gain
+    // over the handshake's RTT, or a millisecond
+    uint32_t rtt = conn->srtt ? conn->srtt : 1000;
+    conn->pacing_rate = (uint64_t)conn->congestion_window * 1000000 / rtt *
+                        BBR_HIGH_GAIN / BBR_UNIT;
+    conn->ssthresh = UINT32_MAX;
+}
+
+static void bbr_on_ack(tcp_connection_t* conn, const tcp_rate_sample_t* rs) {
+    tcp_bbr_t* bbr = tcp_cc_priv(conn);
+    uint64_t now = harmony_get_time();
+    
+    bbr_update_round(conn, bbr, rs);
+    bbr_update_bw(bbr, rs);
+    bbr_check_full_bw(bbr, rs);
+    bbr_check_drain(conn, bbr, now);
+    bbr_update_cycle(conn, bbr, rs, now);
+    bbr_update_min_rtt(conn, bbr, rs, now);
+    
+    bbr_set_pacing_rate(conn, bbr);
+    bbr_set_cwnd(conn, bbr, rs);
+}
+
+// Recovery starts with packet conservation for a round: what's still in
+// flight, plus whatever gets delivered
+static void bbr_enter_recovery(tcp_connection_t* conn) {
+    tcp_bbr_t* bbr = tcp_cc_priv(conn);
+    
+    bbr->prior_cwnd = conn->congestion_window;
+    bbr->packet_conservation = true;
+    bbr->conservation_until = conn->delivered + conn->in_flight;
+    conn->congestion_window = conn->in_flight > bbr_min_cwnd(conn) ? conn->in_flight :
+                                                                      bbr_min_cwnd(conn);
+}
+
+static void bbr_exit_recovery(tcp_connection_t* conn) {
+    tcp_bbr_t* bbr = tcp_cc_priv(conn);
+    
+    bbr->packet_conservation = false;
+    if (conn->congestion_window < bbr->prior_cwnd) {
+        conn->congestion_window = bbr->prior_cwnd;
+    }
+}
+
+static void bbr_on_rto(tcp_connection_t* conn) {
+    tcp_bbr_t* bbr = tcp_cc_priv(conn);
+    
+    bbr->prior_cwnd = conn->congestion_window;
+    bbr->packet_conservation = false;
+    conn->congestion_window = conn->mss;
+}
+
+tcp_cc_ops_t tcp_bbr = {
+    .name = "bbr",
+    .init = bbr_init,
+    .on_ack = bbr_on_ack,
+    .enter_recovery = bbr_enter_recovery,
+    .exit_recovery = bbr_exit_recovery,
+    .on_rto = bbr_on_rto,
+};
@@ -0,0 +1,190 @@
+/*
+ * TCP Congestion Control
+ * Algorithm registry, the helpers algorithms share, and NewReno
+ */
+
+#include "tcp_cc.h"
+
+// =============================================================================
+// Global Congestion Control State
+// =============================================================================
+
+static tcp_cc_ops_t* g_tcp_cc_list = NULL;
+static const tcp_cc_ops_t* g_tcp_cc_default = NULL;
+static spinlock_t g_tcp_cc_lock = SPINLOCK_INIT;
+
+// =============================================================================
+// Registry
+// =============================================================================
+
+static bool tcp_cc_name_equal(const char* name, const char* other, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] != other[i] || other[i] == '\0') {
+            return false;
+        }
+    }
+    return other[len] == '\0';
+}
+
+static size_t tcp_cc_name_len(const char* name) {
+    size_t len = 0;
+    while (len < TCP_CC_NAME_MAX && name[len]) {
+        len++;
+    }
+    return len;
+}
+
+// Algorithms register once and stay; connections point at them
+int tcp_cc_register(tcp_cc_ops_t* ops) {
+    if (!ops || !ops->name || !ops->on_ack || !ops->enter_recovery || !ops->exit_recovery ||
+        !ops->on_rto) {
+        return -1;
+    }
+    
+    size_t len = tcp_cc_name_len(ops->name);
+    if (len == 0 || len >= TCP_CC_NAME_MAX) {
+        return -1;
+    }
+    
+    spinlock_acquire(&g_tcp_cc_lock);
+    for (tcp_cc_ops_t* other = g_tcp_cc_list; other; other = other->next) {
+        if (other == ops || tcp_cc_name_equal(ops->name, other->name, len)) {
+            spinlock_release(&g_tcp_cc_lock);
+            return -1;
+        }
+    }
+    
+    ops->next = g_tcp_cc_list;
+    __atomic_store_n(&g_tcp_cc_list, ops, __ATOMIC_RELEASE);
+    spinlock_release(&g_tcp_cc_lock);
+    
+    return 0;
+}
+
+// name needn't be terminated: len characters of it count
+const tcp_cc_ops_t* tcp_cc_find(const char* name, size_t len) {
+    if (!name) {
+        return NULL;
+    }
+    
+    // A trailing terminator is part of no name
+    while (len > 0 && name[len - 1] == '\0') {
+        len--;
+    }
+    
+    for (tcp_cc_ops_t* ops = __atomic_load_n(&g_tcp_cc_list, __ATOMIC_ACQUIRE); ops;
+         ops = ops->next) {
+        if (tcp_cc_name_equal(name, ops->name, len)) {
+            return ops;
+        }
+    }
+    return NULL;
+}
+
+const tcp_cc_ops_t* tcp_cc_default(void) {
+    const tcp_cc_ops_t* ops = __atomic_load_n(&g_tcp_cc_default, __ATOMIC_ACQUIRE);
+    return ops ? ops : &tcp_newreno;
+}
+
+int tcp_cc_set_default(const char* name) {
+    const tcp_cc_ops_t* ops = tcp_cc_find(name, tcp_cc_name_len(name));
+    if (!ops) {
+        return -1;
+    }
+    
+    __atomic_store_n(&g_tcp_cc_default, ops, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void tcp_cc_init(void) {
+    tcp_cc_register(&tcp_newreno);
+    tcp_cc_register(&tcp_cubic);
+    tcp_cc_register(&tcp_bbr);
+    tcp_cc_set_default("cubic");
+}
+
+// =============================================================================
+// Shared Helpers
+// =============================================================================
+
+uint32_t tcp_cc_slow_start(tcp_connection_t* conn, uint32_t acked) {
+    if (conn->congestion_window >= conn->ssthresh) {
+        return acked;
+    }
+    
+    uint32_t room = conn->ssthresh - conn->congestion_window;
+    uint32_t grow = acked < room ? acked : room;
+    conn->congestion_window += grow;
+    return acked - grow;
+}
+
+void tcp_cc_reno_increase(tcp_connection_t* conn, uint32_t* accum, uint32_t acked) {
+    *accum += acked;
+    if (*accum >= conn->congestion_window) {
+        *accum -= conn->congestion_window;
+        conn->congestion_window += conn->mss;
+    }
+}
+
+uint32_t tcp_cc_reno_ssthresh(tcp_connection_t* conn) {
+    uint32_t half = conn->congestion_window / 2;
+    return half > 2U * conn->mss ? half : 2U * conn->mss;
+}
+
+// =============================================================================
+// NewReno (RFC 5681, RFC 6582)
+// =============================================================================
+
+typedef struct {
+    uint32_t accum;             // Bytes acked toward the next MSS of growth
+} tcp_newreno_t;
+
+_Static_assert(sizeof(tcp_newreno_t) <= TCP_CC_PRIV_WORDS * sizeof(uint64_t),
+               "NewReno state must fit in cc_priv");
+
+// Grow only while the window is what holds the sender back, and not
+// during recovery, where the window is already set
+static void tcp_newreno_on_ack(tcp_connection_t* conn, const tcp_rate_sample_t* rs) {
+    tcp_newreno_t* reno = tcp_cc_priv(conn);
+    
+    if (conn->ca_state != TCP_CA_OPEN || !conn->cwnd_limited || rs->acked == 0) {
+        return;
+    }
+    
+    uint32_t acked = tcp_cc_slow_start(conn, rs->acked);
+    if (acked > 0) {
+        tcp_cc_reno_increase(conn, &reno->accum, acked);
+    }
+}
+
+static void tcp_newreno_enter_recovery(tcp_connection_t* conn) {
+    tcp_newreno_t* reno = tcp_cc_priv(conn);
+    
+    conn->ssthresh = tcp_cc_reno_ssthresh(conn);
+    conn->congestion_window = conn->ssthresh;
+    reno->accum = 0;
+}
+
+// After a timeout cwnd has slow-started back on its own; after fast
+// recovery it deflates to ssthresh
+static void tcp_newreno_exit_recovery(tcp_connection_t* conn) {
+    if (conn->ca_state == TCP_CA_RECOVERY) {
+        conn->congestion_window = conn->ssthresh;
+    }
+}
+
+static void tcp_newreno_on_rto(tcp_connection_t* conn) {
+    tcp_newreno_t* reno = tcp_cc_priv(conn);
+    
+    conn->ssthresh = tcp_cc_reno_ssthresh(conn);
+    conn->congestion_window = conn->mss;
+    reno->accum = 0;
+}
+
+tcp_cc_ops_t tcp_newreno = {
+    .name = "newreno",
+    .on_ack = tcp_newreno_on_ack,
+    .enter_recovery = tcp_newreno_enter_recovery,
+    .exit_recovery = tcp_newreno_exit_recovery,
+    .on_rto = tcp_newreno_on_rto,
+};
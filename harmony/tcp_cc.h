@@ -0,0 +1,70 @@
+/*
+ * TCP Congestion Control
+ * Pluggable algorithms setting a connection's congestion window and
+ * pacing rate from what each ACK delivered
+ */
+
+#ifndef TCP_CC_H
+#define TCP_CC_H
+
+#include "tcp.h"
+
+// =============================================================================
+// Congestion Control Structures
+// =============================================================================
+
+// What one ACK told the sender. Rates come from the delivered fields:
+// delivered bytes over interval microseconds is the delivery rate since
+// the newest segment this ACK covered was sent.
+typedef struct {
+    uint32_t acked;             // Bytes newly acked or sacked
+    uint32_t lost;              // Bytes newly marked lost
+    uint32_t prior_in_flight;   // In flight before the ACK
+    uint32_t rtt;               // Microseconds; 0 without a sample
+    uint64_t prior_delivered;   // Connection's delivered when that segment went out
+    uint64_t delivered;         // Delivered since then
+    uint64_t interval;          // Over this long; 0 without a sample
+    bool app_limited;           // The sender had nothing to send, so it's no upper bound
+} tcp_rate_sample_t;
+
+// An algorithm. The hooks run with the connection locked; state of their
+// own goes in conn->cc_priv, zeroed before init. exit_recovery is called
+// before ca_state goes back to TCP_CA_OPEN, and on_rto before it becomes
+// TCP_CA_LOSS.
+typedef struct tcp_cc_ops {
+    const char* name;           // At most TCP_CC_NAME_MAX - 1 characters
+    void (*init)(tcp_connection_t* conn);       // Optional
+    void (*on_ack)(tcp_connection_t* conn, const tcp_rate_sample_t* rs);
+    void (*enter_recovery)(tcp_connection_t* conn);
+    void (*exit_recovery)(tcp_connection_t* conn);
+    void (*on_rto)(tcp_connection_t* conn);
+    struct tcp_cc_ops* next;
+} tcp_cc_ops_t;
+
+extern tcp_cc_ops_t tcp_newreno;
+extern tcp_cc_ops_t tcp_cubic;
+extern tcp_cc_ops_t tcp_bbr;
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// Registry; the built-in algorithms are there after tcp_cc_init
+void tcp_cc_init(void);
+int tcp_cc_register(tcp_cc_ops_t* ops);
+const tcp_cc_ops_t* tcp_cc_find(const char* name, size_t len);
+const tcp_cc_ops_t* tcp_cc_default(void);
+int tcp_cc_set_default(const char* name);
+
+// Helpers the algorithms share. Slow start grows cwnd by what was acked
+// up to ssthresh, returning what's left over for congestion avoidance;
+// reno_increase adds an MSS per window acked, counting in *accum.
+uint32_t tcp_cc_slow_start(tcp_connection_t* conn, uint32_t acked);
+void tcp_cc_reno_increase(tcp_connection_t* conn, uint32_t* accum, uint32_t acked);
+uint32_t tcp_cc_reno_ssthresh(tcp_connection_t* conn);
+
+static inline void* tcp_cc_priv(tcp_connection_t* conn) {
+    return conn->cc_priv;
+}
+
+#endif /* TCP_CC_H */
@@ -0,0 +1,198 @@
+/*
+ * CUBIC Congestion Control
+ * RFC 9438: the window grows along a cubic of the time since the last
+ * reduction, centred on the window the reduction came at
+ */
+
+#include "tcp_cc.h"
+
+// =============================================================================
+// CUBIC Constants
+// =============================================================================
+
+// Integer forms of RFC 9438's constants. Windows are bytes and times
+// milliseconds, so C = 0.4 segments per second cubed becomes an MSS of
+// growth per CUBIC_SCALE ms^3.
+#define CUBIC_BETA              717     // 0.7, in 1024ths
+#define CUBIC_AIMD_ALPHA        542     // 3(1 - beta) / (1 + beta), in 1024ths
+#define CUBIC_SCALE             2500000000ULL
+#define CUBIC_TIME_MAX          65536   // Past this the curve stops climbing any steeper
+#define CUBIC_TARGET_MAX        3       // Target at most this many halves of cwnd
+
+typedef struct {
+    uint32_t w_max;             // cwnd when the window was last reduced
+    uint32_t origin;            // The curve's plateau: w_max, or cwnd if above it
+    uint32_t k;                 // Time from the epoch to the plateau (ms)
+    uint64_t epoch_start;       // Microseconds; 0 until the first ACK after a reduction
+    uint64_t last_ack;
+    uint32_t w_est;             // The Reno-friendly window
+    uint64_t est_accum;
+    uint64_t accum;
+} tcp_cubic_t;
+
+_Static_assert(sizeof(tcp_cubic_t) <= TCP_CC_PRIV_WORDS * sizeof(uint64_t),
+               "CUBIC state must fit in cc_priv");
+
+// =============================================================================
+// Window Calculation
+// =============================================================================
+
+// Integer cube root, bit by bit (Hacker's Delight 11-2)
+static uint32_t cubic_cbrt(uint64_t x) {
+    uint64_t y = 0;
+    for (int shift = 63; shift >= 0; shift -= 3) {
+        y <<= 1;
+        uint64_t b = 3 * y * (y + 1) + 1;
+        uint64_t bs = b << shift;
+        if (x >= bs && b == (bs >> shift)) {
+            x -= bs;
+            y++;
+        }
+    }
+    return (uint32_t)y;
+}
+
+// ms^3 per byte of growth
+static inline uint64_t cubic_unit(tcp_connection_t* conn) {
+    return CUBIC_SCALE / conn->mss;
+}
+
+static void cubic_start_epoch(tcp_connection_t* conn, tcp_cubic_t* cubic, uint64_t now) {
+    cubic->epoch_start = now;
+    cubic->accum = 0;
+    cubic->est_accum = 0;
+    cubic->w_est = conn->congestion_window;
+    
+    if (conn->congestion_window < cubic->w_max) {
+        uint64_t deficit = cubic->w_max - conn->congestion_window;
+        cubic->k = cubic_cbrt(deficit * cubic_unit(conn));
+        cubic->origin = cubic->w_max;
+    } else {
+        cubic->k = 0;
+        cubic->origin = conn->congestion_window;
+    }
+}
+
+// W_cubic(t) = C (t - K)^3 + origin
+static uint32_t cubic_window(tcp_connection_t* conn, tcp_cubic_t* cubic, uint64_t t) {
+    if (t > CUBIC_TIME_MAX) {
+        t = CUBIC_TIME_MAX;
+    }
+    
+    uint64_t offset = t > cubic->k ? t - cubic->k : cubic->k - t;
+    uint64_t delta = offset * offset * offset / cubic_unit(conn);
+    if (t < cubic->k) {
+        return delta < cubic->origin ? cubic->origin - (uint32_t)delta : conn->mss;
+    }
+    
+    uint64_t window = cubic->origin + delta;
+    return window > UINT32_MAX ? UINT32_MAX : (uint32_t)window;
+}
+
+// A reduction: remember where it came, lower with fast convergence if
+// the last one came higher, and start a new epoch on the next ACK
+static void cubic_reduce(tcp_connection_t* conn, tcp_cubic_t* cubic) {
+    uint32_t cwnd = conn->congestion_window;
+    if (cwnd < cubic->w_max) {
+        cubic->w_max = (uint32_t)((uint64_t)cwnd * (1024 + CUBIC_BETA) / 2048);
+    } else {
+        cubic->w_max = cwnd;
+    }
+    
+    uint32_t ssthresh = (uint32_t)((uint64_t)cwnd * CUBIC_BETA / 1024);
+    conn->ssthresh = ssthresh > 2U * conn->mss ? ssthresh : 2U * conn->mss;
+    cubic->epoch_start = 0;
+}
+
+// =============================================================================
+// Algorithm Hooks
+// =============================================================================
+
+static void cubic_init(tcp_connection_t* conn) {
+    tcp_cubic_t* cubic = tcp_cc_priv(conn);
+    cubic->w_max = 0;
+    cubic->epoch_start = 0;
+}
+
+static void cubic_on_ack(tcp_connection_t* conn, const tcp_rate_sample_t* rs) {
+    tcp_cubic_t* cubic = tcp_cc_priv(conn);
+    uint64_t now = harmony_get_time();
+    
+    // Time the application left the window unused doesn't move the
+    // curve along
+    if (!conn->cwnd_limited) {
+        if (cubic->epoch_start) {
+            cubic->epoch_start += now - cubic->last_ack;
+        }
+        cubic->last_ack = now;
+        return;
+    }
+    cubic->last_ack = now;
+    
+    if (conn->ca_state != TCP_CA_OPEN || rs->acked == 0) {
+        return;
+    }
+    
+    uint32_t acked = tcp_cc_slow_start(conn, rs->acked);
+    if (acked == 0) {
+        return;
+    }
+    
+    if (cubic->epoch_start == 0) {
+        cubic_start_epoch(conn, cubic, now);
+    }
+    
+    uint32_t cwnd = conn->congestion_window;
+    
+    // Where the curve is an RTT from now, between cwnd and half again
+    uint64_t t = (now - cubic->epoch_start + conn->srtt) / 1000;
+    uint32_t target = cubic_window(conn, cubic, t);
+    uint64_t target_max = (uint64_t)cwnd * CUBIC_TARGET_MAX / 2;
+    if (target > target_max) {
+        target = (uint32_t)target_max;
+    }
+    
+    // The window standard TCP would have reached, grown by alpha an RTT
+    // below w_max and by an MSS an RTT above it
+    uint32_t alpha = cubic->w_est >= cubic->w_max ? 1024 : CUBIC_AIMD_ALPHA;
+    cubic->est_accum += (uint64_t)acked * conn->mss * alpha / 1024;
+    cubic->w_est += (uint32_t)(cubic->est_accum / cwnd);
+    cubic->est_accum %= cwnd;
+    if (cubic->w_est > target) {
+        target = cubic->w_est;
+    }
+    
+    // (target - cwnd) / cwnd per byte acked
+    if (target > cwnd) {
+        cubic->accum += (uint64_t)(target - cwnd) * acked;
+        conn->congestion_window += (uint32_t)(cubic->accum / cwnd);
+        cubic->accum %= cwnd;
+    }
+}
+
+static void cubic_enter_recovery(tcp_connection_t* conn) {
+    tcp_cubic_t* cubic = tcp_cc_priv(conn);
+    cubic_reduce(conn, cubic);
+    conn->congestion_window = conn->ssthresh;
+}
+
+static void cubic_exit_recovery(tcp_connection_t* conn) {
+    if (conn->ca_state == TCP_CA_RECOVERY) {
+        conn->congestion_window = conn->ssthresh;
+    }
+}
+
+static void cubic_on_rto(tcp_connection_t* conn) {
+    tcp_cubic_t* cubic = tcp_cc_priv(conn);
+    cubic_reduce(conn, cubic);
+    conn->congestion_window = conn->mss;
+}
+
+tcp_cc_ops_t tcp_cubic = {
+    .name = "cubic",
+    .init = cubic_init,
+    .on_ack = cubic_on_ack,
+    .enter_recovery = cubic_enter_recovery,
+    .exit_recovery = cubic_exit_recovery,
+    .on_rto = cubic_on_rto,
+};
@@ -0,0 +1,294 @@
+/*
+ * TCP Timer Wheel
+ * Hierarchical timing wheel (Varghese and Lauck): TCP_WHEEL_LEVELS rings
+ * of TCP_WHEEL_SLOTS, each slot of a level spanning a whole turn of the
+ * one below. A timer goes in the lowest level that reaches it and moves
+ * down as its time comes closer, so arming, cancelling and firing are
+ * all O(1) and nothing is scanned.
+ */
+
+#include "tcp_timer.h"
+#include "tcp.h"
+#include "../continuum/continuum_core.h"
+#include "../continuum/temporal_scheduler.h"
+
+// =============================================================================
+// Global Wheel State
+// =============================================================================
+
+#define TCP_WHEEL_EXPIRED       UINT32_MAX
+
+typedef struct {
+    tcp_timer_t* slots[TCP_WHEEL_LEVELS][TCP_WHEEL_SLOTS];
+    uint64_t occupied[TCP_WHEEL_LEVELS];    // Slots with timers, a bit each
+    tcp_timer_t* expired;       // Due, for the thread to run
+    uint64_t tick;              // Last tick processed
+    uint64_t wake;              // Tick the thread sleeps until; 0 while it runs
+    spinlock_t lock;
+    quantum_context_t* thread;
+} tcp_wheel_t;
+
+static tcp_wheel_t g_tcp_wheel;
+
+// =============================================================================
+// Wheel Operations
+// =============================================================================
+
+static inline uint32_t tcp_wheel_shift(uint32_t level) {
+    return level * TCP_WHEEL_BITS;
+}
+
+static void tcp_wheel_link(tcp_timer_t** head, tcp_timer_t* timer) {
+    timer->next = *head;
+    if (*head) {
+        (*head)->link = &timer->next;
+    }
+    *head = timer;
+    timer->link = head;
+}
+
+// Put timer where its expiry says, relative to the wheel's tick; the
+// lock is held
+static void tcp_wheel_insert(tcp_timer_t* timer) {
+    tcp_wheel_t* wheel = &g_tcp_wheel;
+    if (timer->expires <= wheel->tick) {
+        timer->slot = TCP_WHEEL_EXPIRED;
+        tcp_wheel_link(&wheel->expired, timer);
+        return;
+    }
+    
+    uint64_t reach = 1ULL << tcp_wheel_shift(TCP_WHEEL_LEVELS);
+    if (timer->expires - wheel->tick >= reach) {
+        timer->expires = wheel->tick + reach - 1;
+    }
+    
+    uint64_t delta = timer->expires - wheel->tick;
+    uint32_t level = 0;
+    while (delta >= 1ULL << tcp_wheel_shift(level + 1)) {
+        level++;
+    }
+    
+    uint32_t slot = (timer->expires >> tcp_wheel_shift(level)) & (TCP_WHEEL_SLOTS - 1);
+    timer->slot = level * TCP_WHEEL_SLOTS + slot;
+    tcp_wheel_link(&wheel->slots[level][slot], timer);
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+static void tcp_wheel_remove(tcp_timer_t* timer) {
+    tcp_wheel_t* wheel = &g_tcp_wheel;
+    
+    *timer->link = timer->next;
+    if (timer->next) {
+        timer->next->link = timer->link;
+    }
+    timer->link = NULL;
+    
+    if (timer->slot != TCP_WHEEL_EXPIRED) {
+        uint32_t level = timer->slot / TCP_WHEEL_SLOTS;
+        uint32_t slot = timer->slot % TCP_WHEEL_SLOTS;
+        if (!wheel->slots[level][slot]) {
+            wheel->occupied[level] &= ~(1ULL << slot);
+        }
+    }
+}
+
+// First occupied slot at or after from, going round
+static inline uint32_t tcp_wheel_next_slot(uint64_t occupied, uint32_t from) {
+    uint64_t ahead = occupied & (~0ULL << from);
+    return (uint32_t)__builtin_ctzll(ahead ? ahead : occupied);
+}
+
+// The next tick past the wheel's at which something fires or moves down
+// a level; UINT64_MAX if nothing's armed
+static uint64_t tcp_wheel_next_event(void) {
+    tcp_wheel_t* wheel = &g_tcp_wheel;
+    uint64_t next = UINT64_MAX;
+    
+    for (uint32_t level = 0; level < TCP_WHEEL_LEVELS; level++) {
+        if (!wheel->occupied[level]) {
+            continue;
+        }
+        
+        // A slot's turn at this level comes when the tick, in this
+        // level's units, lands on it
+        uint32_t shift = tcp_wheel_shift(level);
+        uint64_t base = (wheel->tick >> shift) + 1;
+        uint32_t from = base & (TCP_WHEEL_SLOTS - 1);
+        uint32_t slot = tcp_wheel_next_slot(wheel->occupied[level], from);
+        uint64_t when = (base + ((slot - from) & (TCP_WHEEL_SLOTS - 1))) << shift;
+        if (when < next) {
+            next = when;
+        }
+    }
+    
+    return next;
+}
+
+// Process the tick the wheel just reached: slots whose turn it is on the
+// upper levels come down, and what's in the lowest level's falls due
+static void tcp_wheel_run_tick(void) {
+    tcp_wheel_t* wheel = &g_tcp_wheel;
+    uint64_t tick = wheel->tick;
+    
+    for (uint32_t level = TCP_WHEEL_LEVELS - 1; level > 0; level--) {
+        uint32_t shift = tcp_wheel_shift(level);
+        if (tick & ((1ULL << shift) - 1)) {
+            continue;
+        }
+        
+        uint32_t slot = (tick >> shift) & (TCP_WHEEL_SLOTS - 1);
+        tcp_timer_t* timer = wheel->slots[level][slot];
+        wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] &= ~(1ULL << slot);
+        while (timer) {
+            tcp_timer_t* next = timer->next;
+            tcp_wheel_insert(timer);
+            timer = next;
+        }
+    }
+    
+    uint32_t slot = tick & (TCP_WHEEL_SLOTS - 1);
+    tcp_timer_t* timer = wheel->slots[0][slot];
+    wheel->slots[0][slot] = NULL;
+    wheel->occupied[0] &= ~(1ULL << slot);
+    while (timer) {
+        tcp_timer_t* next = timer->next;
+        timer->slot = TCP_WHEEL_EXPIRED;
+        tcp_wheel_link(&wheel->expired, timer);
+        timer = next;
+    }
+}
+
+// Bring the wheel up to target, going only through the ticks where
+// something happens
+static void tcp_wheel_advance(uint64_t target) {
+    tcp_wheel_t* wheel = &g_tcp_wheel;
+    
+    while (wheel->tick < target) {
+        uint64_t next = tcp_wheel_next_event();
+        if (next > target) {
+            wheel->tick = target;
+            break;
+        }
+        
+        wheel->tick = next;
+        tcp_wheel_run_tick();
+    }
+}
+
+// =============================================================================
+// Timer Interface
+// =============================================================================
+
+void tcp_timer_init(tcp_timer_t* timer, tcp_timer_fn_t fn) {
+    timer->next = NULL;
+    timer->link = NULL;
+    timer->expires = 0;
+    timer->slot = 0;
+    timer->fn = fn;
+}
+
+bool tcp_timer_arm(tcp_timer_t* timer, uint64_t when) {
+    tcp_wheel_t* wheel = &g_tcp_wheel;
+    
+    // Rounded up, so it never fires early
+    uint64_t expires = (when + TCP_TIMER_TICK - 1) / TCP_TIMER_TICK;
+    
+    spinlock_acquire(&wheel->lock);
+    bool idle = timer->link == NULL;
+    if (!idle && timer->expires <= expires) {
+        spinlock_release(&wheel->lock);
+        return false;
+    }
+    if (!idle) {
+        tcp_wheel_remove(timer);
+    }
+    
+    timer->expires = expires;
+    tcp_wheel_insert(timer);
+    
+    // Due before the thread means to wake
+    bool wake = wheel->wake != 0 && timer->expires < wheel->wake;
+    if (wake) {
+        wheel->wake = timer->expires;
+    }
+    spinlock_release(&wheel->lock);
+    
+    if (wake && wheel->thread) {
+        temporal_unblock(wheel->thread);
+    }
+    return idle;
+}
+
+bool tcp_timer_cancel(tcp_timer_t* timer) {
+    tcp_wheel_t* wheel = &g_tcp_wheel;
+    if (!__atomic_load_n(&timer->link, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    
+    spinlock_acquire(&wheel->lock);
+    bool pending = timer->link != NULL;
+    if (pending) {
+        tcp_wheel_remove(timer);
+    }
+    spinlock_release(&wheel->lock);
+    
+    return pending;
+}
+
+// =============================================================================
+// Wheel Thread
+// =============================================================================
+
+// Run what's due, then sleep on a high-resolution timer until the next
+// event. Arming anything sooner wakes it; should that race with it
+// going to sleep, TCP_TIMER_IDLE bounds how late that timer runs.
+static void tcp_wheel_main(void) {
+    tcp_wheel_t* wheel = &g_tcp_wheel;
+    
+    while (1) {
+        spinlock_acquire(&wheel->lock);
+        wheel->wake = 0;
+        tcp_wheel_advance(harmony_get_time() / TCP_TIMER_TICK);
+        
+        tcp_timer_t* timer;
+        while ((timer = wheel->expired)) {
+            tcp_wheel_remove(timer);
+            spinlock_release(&wheel->lock);
+            timer->fn(timer);
+            spinlock_acquire(&wheel->lock);
+        }
+        
+        uint64_t limit = wheel->tick + TCP_TIMER_IDLE / TCP_TIMER_TICK;
+        uint64_t next = tcp_wheel_next_event();
+        wheel->wake = next < limit ? next : limit;
+        uint64_t wake = wheel->wake * TCP_TIMER_TICK;
+        spinlock_release(&wheel->lock);
+        
+        uint64_t now = harmony_get_time();
+        if (wake > now) {
+            temporal_sleep(wake - now);
+        }
+    }
+}
+
+void tcp_wheel_init(void) {
+    tcp_wheel_t* wheel = &g_tcp_wheel;
+    if (wheel->thread) {
+        return;
+    }
+    
+    spinlock_init(&wheel->lock);
+    wheel->tick = harmony_get_time() / TCP_TIMER_TICK;
+    
+    quantum_id_t qid = continuum_create_quantum(ABI_MODE_NATIVE, (void*)tcp_wheel_main,
+                                                "ktcptimer");
+    quantum_context_t* quantum = continuum_get_quantum(qid);
+    if (!quantum) {
+        return;
+    }
+    
+    quantum->scheduling.priority = PRIORITY_HIGH;
+    wheel->thread = quantum;
+    temporal_enqueue(quantum);
+}
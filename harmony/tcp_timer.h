@@ -0,0 +1,59 @@
+/*
+ * TCP Timer Wheel
+ * Hierarchical timing wheel for connection timers, run by a thread the
+ * high-resolution timers wake
+ */
+
+#ifndef TCP_TIMER_H
+#define TCP_TIMER_H
+
+#include "harmony_net.h"
+
+// =============================================================================
+// Timer Wheel Constants
+// =============================================================================
+
+#define TCP_TIMER_TICK          1000       // Wheel resolution (microseconds)
+#define TCP_WHEEL_BITS          6
+#define TCP_WHEEL_SLOTS         (1 << TCP_WHEEL_BITS)
+#define TCP_WHEEL_LEVELS        4          // 64^4 ticks, about 4.6 hours, ahead at most
+#define TCP_TIMER_IDLE          100000     // Longest the wheel thread sleeps
+
+// =============================================================================
+// Timer Structures
+// =============================================================================
+
+// A timer on the wheel. A later deadline than the wheel can hold fires
+// at the wheel's reach, so callbacks check what's actually due.
+typedef struct tcp_timer tcp_timer_t;
+typedef void (*tcp_timer_fn_t)(tcp_timer_t* timer);
+
+struct tcp_timer {
+    struct tcp_timer* next;
+    struct tcp_timer** link;    // NULL while not armed
+    uint64_t expires;           // Wheel tick
+    uint32_t slot;              // Level * TCP_WHEEL_SLOTS + slot, or expired
+    tcp_timer_fn_t fn;
+};
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+void tcp_wheel_init(void);
+
+// Arming and cancelling are O(1), from anything but an interrupt
+// handler; a callback may re-arm its own timer. tcp_timer_arm makes timer
+// fire by when (harmony_get_time microseconds), leaving it be if it's
+// already due sooner; it returns whether the timer wasn't armed before.
+// tcp_timer_cancel returns whether it was. Callbacks run on the wheel
+// thread with no locks held.
+void tcp_timer_init(tcp_timer_t* timer, tcp_timer_fn_t fn);
+bool tcp_timer_arm(tcp_timer_t* timer, uint64_t when);
+bool tcp_timer_cancel(tcp_timer_t* timer);
+
+static inline bool tcp_timer_pending(const tcp_timer_t* timer) {
+    return timer->link != NULL;
+}
+
+#endif /* TCP_TIMER_H */
@@ -6,85 +6,270 @@
 #include "harmony_net.h"
 #include "udp.h"
 #include "ip.h"
+#include "ethernet.h"
+#include "checksum.h"
 #include "../continuum/flux_memory.h"
+#include "../continuum/temporal_scheduler.h"
+#include "../continuum/drivers/network/net_buffer.h"
 
 // =============================================================================
 // Global UDP State
 // =============================================================================
 
-static udp_socket_t* g_udp_sockets;
+#define UDP_HASH_BUCKETS    256
+#define UDP_RECV_RING       256     // Datagrams a socket holds before dropping more
+
+// A datagram waiting to be read: its payload, in the frame buffer it
+// arrived in where there was one, else a copy in one of the pool's
+typedef struct {
+    net_buffer_t* buffer;
+    uint8_t* data;
+    uint32_t len;
+    uint32_t src_addr;
+    uint16_t src_port;
+} udp_datagram_t;
+
+// A socket as the demux sees it. recv_queue_count counts the ring; the
+// lists in udp_socket_t go unused.
+typedef struct udp_endpoint {
+    udp_socket_t sock;          // First, so the two convert
+    struct udp_endpoint* hash_next;
+    uint32_t refs;              // The table's, and lookups' in flight
+    bool hashed;
+    bool reuse_port;
+    uint64_t drops;             // Datagrams that found the ring full
+    udp_datagram_t ring[UDP_RECV_RING];
+    uint32_t ring_head;
+} udp_endpoint_t;
+
+// Bound sockets by port, under g_udp_lock for changes. Lookups take no
+// locks, only read sections, and whoever unlinks a socket waits them out
+// before dropping the table's reference.
+static udp_endpoint_t* g_udp_hash[UDP_HASH_BUCKETS];
 static uint16_t g_udp_port_counter = PORT_EPHEMERAL_MIN;
 static spinlock_t g_udp_lock = SPINLOCK_INIT;
 
+static continuum_reader_t g_udp_readers[MAX_CPU_CORES];
+
+static inline udp_endpoint_t* udp_endpoint(udp_socket_t* sock) {
+    return (udp_endpoint_t*)sock;
+}
+
 // =============================================================================
 // UDP Checksum
 // =============================================================================
 
+// Over the pseudo-header, udp_hdr and data as they stand: 0 for a
+// datagram that arrived intact
 static uint16_t udp_checksum(ipv4_header_t* ip_hdr, udp_header_t* udp_hdr,
                              void* data, size_t data_len) {
-    // UDP pseudo-header
-    struct {
-        uint32_t src_addr;
-        uint32_t dest_addr;
-        uint8_t zero;
-        uint8_t protocol;
-        uint16_t udp_length;
-    } __attribute__((packed)) pseudo_header;
-    
-    pseudo_header.src_addr = ip_hdr->src_addr;
-    pseudo_header.dest_addr = ip_hdr->dest_addr;
-    pseudo_header.zero = 0;
-    pseudo_header.protocol = IPPROTO_UDP;
-    pseudo_header.udp_length = udp_hdr->length;
-    
-    // Calculate checksum
-    uint32_t sum = 0;
-    uint16_t* ptr;
-    
-    // Add pseudo-header
-    ptr = (uint16_t*)&pseudo_header;
-    for (size_t i = 0; i < sizeof(pseudo_header) / 2; i++) {
-        sum += ntohs(ptr[i]);
-    }
-    
-    // Add UDP header
-    udp_hdr->checksum = 0;
-    ptr = (uint16_t*)udp_hdr;
-    for (size_t i = 0; i < sizeof(udp_header_t) / 2; i++) {
-        sum += ntohs(ptr[i]);
-    }
-    
-    // Add data
+    uint32_t sum = checksum_pseudo_ipv4(ip_hdr->src_addr, ip_hdr->dest_addr, IPPROTO_UDP,
+                                        ntohs(udp_hdr->length));
+    sum = checksum_partial(udp_hdr, sizeof(udp_header_t), sum);
     if (data && data_len > 0) {
-        ptr = (uint16_t*)data;
-        for (size_t i = 0; i < data_len / 2; i++) {
-            sum += ntohs(ptr[i]);
+        sum = checksum_partial(data, data_len, sum);
+    }
+    
+    return checksum_fold(sum);
+}
+
+// =============================================================================
+// Socket Table
+// =============================================================================
+
+static void udp_put(udp_endpoint_t* ep) {
+    if (__atomic_sub_fetch(&ep->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < ep->sock.recv_queue_count; i++) {
+        net_buffer_put(ep->ring[(ep->ring_head + i) % UDP_RECV_RING].buffer);
+    }
+    flux_free(ep);
+}
+
+static inline udp_endpoint_t** udp_bucket(uint16_t port) {
+    return &g_udp_hash[port & (UDP_HASH_BUCKETS - 1)];
+}
+
+// Whether a socket could take port on addr, g_udp_lock held: sockets
+// whose addresses overlap can share a port only if all of them asked to,
+// on the same address
+static bool udp_port_free(uint32_t addr, uint16_t port, bool reuse_port) {
+    for (udp_endpoint_t* other = *udp_bucket(port); other; other = other->hash_next) {
+        if (other->sock.local_port != port) {
+            continue;
         }
-        
-        // Handle odd byte
-        if (data_len & 1) {
-            sum += ((uint8_t*)data)[data_len - 1] << 8;
+        if (other->sock.local_addr != addr && other->sock.local_addr != 0 && addr != 0) {
+            continue;
+        }
+        if (!reuse_port || !other->reuse_port || other->sock.local_addr != addr) {
+            return false;
         }
     }
     
-    // Fold 32-bit sum to 16 bits
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    return true;
+}
+
+// Bind ep to addr and port, an ephemeral one if port is 0, and publish it
+static int udp_hash_insert(udp_endpoint_t* ep, uint32_t addr, uint16_t port) {
+    spinlock_acquire(&g_udp_lock);
+    if (port == 0) {
+        // Ephemeral ports are never shared
+        uint32_t range = PORT_EPHEMERAL_MAX - PORT_EPHEMERAL_MIN + 1;
+        for (uint32_t tries = 0; tries < range && port == 0; tries++) {
+            uint16_t candidate = g_udp_port_counter++;
+            if (g_udp_port_counter > PORT_EPHEMERAL_MAX || g_udp_port_counter == 0) {
+                g_udp_port_counter = PORT_EPHEMERAL_MIN;
+            }
+            if (udp_port_free(addr, candidate, false)) {
+                port = candidate;
+            }
+        }
+        ep->reuse_port = false;
+    } else if (!udp_port_free(addr, port, ep->reuse_port)) {
+        port = 0;
+    }
+    
+    if (port == 0) {
+        spinlock_release(&g_udp_lock);
+        return -1;  // Port in use
     }
     
-    return ~sum;
+    udp_endpoint_t** head = udp_bucket(port);
+    ep->sock.local_addr = addr;
+    ep->sock.local_port = port;
+    ep->hash_next = *head;
+    ep->hashed = true;
+    __atomic_store_n(head, ep, __ATOMIC_RELEASE);
+    spinlock_release(&g_udp_lock);
+    return 0;
+}
+
+// Unlink ep, leaving its hash_next alone for readers still on it; false
+// if it wasn't in the table
+static bool udp_hash_remove(udp_endpoint_t* ep) {
+    spinlock_acquire(&g_udp_lock);
+    bool removed = ep->hashed;
+    if (removed) {
+        udp_endpoint_t** link = udp_bucket(ep->sock.local_port);
+        while (*link != ep) {
+            link = &(*link)->hash_next;
+        }
+        __atomic_store_n(link, ep->hash_next, __ATOMIC_RELEASE);
+        ep->hashed = false;
+    }
+    spinlock_release(&g_udp_lock);
+    return removed;
+}
+
+static inline uint32_t udp_flow_hash(uint32_t remote_addr, uint16_t remote_port) {
+    uint32_t h = remote_addr * 0x9E3779B1U;
+    h = (h ^ remote_port) * 0x85EBCA77U;
+    return h ^ (h >> 16);
+}
+
+// The socket a datagram for local_addr and local_port goes to, with a
+// reference: one bound to the address itself over one on the wildcard,
+// and among sockets sharing the port, one picked by the sender so each
+// flow stays with the same receiver
+static udp_endpoint_t* udp_lookup(uint32_t local_addr, uint16_t local_port,
+                                  uint32_t remote_addr, uint16_t remote_port) {
+    udp_endpoint_t* head;
+    udp_endpoint_t* ep;
+    udp_endpoint_t* found = NULL;
+    
+    uint32_t cpu;
+    uint64_t flags = continuum_read_lock(g_udp_readers, &cpu);
+    head = __atomic_load_n(udp_bucket(local_port), __ATOMIC_ACQUIRE);
+    
+    uint32_t exact = 0;
+    uint32_t wildcard = 0;
+    for (ep = head; ep; ep = __atomic_load_n(&ep->hash_next, __ATOMIC_ACQUIRE)) {
+        if (ep->sock.local_port == local_port) {
+            exact += ep->sock.local_addr == local_addr;
+            wildcard += ep->sock.local_addr == 0;
+        }
+    }
+    
+    uint32_t count = exact ? exact : wildcard;
+    uint32_t addr = exact ? local_addr : 0;
+    uint32_t pick = count > 1 ? udp_flow_hash(remote_addr, remote_port) % count : 0;
+    for (ep = head; ep; ep = __atomic_load_n(&ep->hash_next, __ATOMIC_ACQUIRE)) {
+        if (ep->sock.local_port == local_port && ep->sock.local_addr == addr) {
+            // The last one, should the group have shrunk meanwhile
+            found = ep;
+            if (pick-- == 0) {
+                break;
+            }
+        }
+    }
+    if (found) {
+        __atomic_fetch_add(&found->refs, 1, __ATOMIC_RELAXED);
+    }
+    continuum_read_unlock(g_udp_readers, cpu, flags);
+    
+    return found;
 }
 
 // =============================================================================
 // UDP Input Processing
 // =============================================================================
 
+// Queue a datagram on ep, holding on to the frame's buffer where it came
+// in one rather than copying the payload out
+static void udp_enqueue(udp_endpoint_t* ep, void* data, size_t data_len,
+                        uint32_t src_addr, uint16_t src_port, net_buffer_t* buffer) {
+    if (buffer) {
+        net_buffer_get(buffer);
+    } else {
+        buffer = data_len <= NET_BUFFER_DATA_SIZE ? net_buffer_alloc() : NULL;
+        if (!buffer) {
+            ep->drops++;
+            return;
+        }
+        data = memcpy(net_buffer_append(buffer, data_len), data, data_len);
+    }
+    
+    spinlock_acquire(&ep->sock.lock);
+    
+    bool queued = ep->sock.recv_queue_count < UDP_RECV_RING;
+    if (queued) {
+        udp_datagram_t* datagram =
+            &ep->ring[(ep->ring_head + ep->sock.recv_queue_count) % UDP_RECV_RING];
+        datagram->buffer = buffer;
+        datagram->data = data;
+        datagram->len = data_len;
+        datagram->src_addr = src_addr;
+        datagram->src_port = src_port;
+        ep->sock.recv_queue_count++;
+        
+        // Notify socket, which can't close while the lock is held
+        if (ep->sock.socket) {
+            harmony_socket_notify(ep->sock.socket, CONDUIT_SELECT_READ_READY);
+            if (ep->sock.socket->on_data) {
+                ep->sock.socket->on_data(ep->sock.socket, data, data_len);
+            }
+        }
+    } else {
+        ep->drops++;
+    }
+    
+    spinlock_release(&ep->sock.lock);
+    
+    if (!queued) {
+        net_buffer_put(buffer);
+    }
+}
+
+// buffer: the frame data lies in, if it came in one, for the socket to
+// keep a reference to
 void udp_input(network_interface_t* iface, ipv4_header_t* ip_hdr,
-              udp_header_t* udp_hdr, void* data, size_t data_len) {
-    // Verify checksum (optional for UDP)
-    if (udp_hdr->checksum != 0) {
-        uint16_t checksum = udp_checksum(ip_hdr, udp_hdr, data, data_len);
-        if (checksum != 0) {
+              udp_header_t* udp_hdr, void* data, size_t data_len, bool csum_valid,
+              net_buffer_t* buffer) {
+    // Verify checksum (optional for UDP), unless the NIC has
+    if (udp_hdr->checksum != 0 && !csum_valid) {
+        if (udp_checksum(ip_hdr, udp_hdr, data, data_len) != 0) {
             // Invalid checksum
             iface->rx_errors++;
             return;
@@ -96,87 +281,80 @@ void udp_input(network_interface_t* iface, ipv4_header_t* ip_hdr,
     uint16_t src_port = ntohs(udp_hdr->src_port);
     
     // Find socket
-    spinlock_acquire(&g_udp_lock);
-    
-    udp_socket_t* sock = g_udp_sockets;
-    while (sock) {
-        if (sock->local_port == dest_port) {
-            if (sock->local_addr == 0 || sock->local_addr == ntohl(ip_hdr->dest_addr)) {
-                // Match found
-                break;
-            }
-        }
-        sock = sock->next;
-    }
-    
-    spinlock_release(&g_udp_lock);
-    
-    if (!sock) {
+    udp_endpoint_t* ep = udp_lookup(ntohl(ip_hdr->dest_addr), dest_port, src_addr, src_port);
+    if (!ep) {
         // No socket listening - send ICMP port unreachable
         icmp_send_port_unreachable(iface, ip_hdr);
         return;
     }
     
-    // Add to socket receive queue
-    spinlock_acquire(&sock->lock);
-    
-    udp_packet_t* packet = flux_allocate(NULL, sizeof(udp_packet_t) + data_len,
-                                        FLUX_ALLOC_KERNEL);
-    if (packet) {
-        packet->src_addr = src_addr;
-        packet->src_port = src_port;
-        packet->data_len = data_len;
-        memcpy(packet->data, data, data_len);
-        packet->next = NULL;
-        
-        // Add to queue
-        if (sock->recv_queue_tail) {
-            sock->recv_queue_tail->next = packet;
-        } else {
-            sock->recv_queue_head = packet;
-        }
-        sock->recv_queue_tail = packet;
-        sock->recv_queue_count++;
-        
-        // Notify socket
-        if (sock->socket && sock->socket->on_data) {
-            sock->socket->on_data(sock->socket, data, data_len);
-        }
-    }
-    
-    spinlock_release(&sock->lock);
+    udp_enqueue(ep, data, data_len, src_addr, src_port, buffer);
+    udp_put(ep);
 }
 
 // =============================================================================
 // UDP Output
 // =============================================================================
 
+// Build a datagram in a frame buffer, the lower headers to be pushed in
+// front of it, and add it to batch
+static int udp_queue(harmony_tx_batch_t* batch, udp_socket_t* sock, uint32_t dest_addr,
+                     uint16_t dest_port, const void* data, size_t data_len) {
+    net_buffer_t* buffer = net_buffer_alloc();
+    if (!buffer) {
+        return -1;
+    }
+    
+    udp_header_t* udp_hdr = net_buffer_append(buffer, sizeof(udp_header_t));
+    udp_hdr->src_port = htons(sock->local_port);
+    udp_hdr->dest_port = htons(dest_port);
+    udp_hdr->length = htons(sizeof(udp_header_t) + data_len);
+    udp_hdr->checksum = 0;  // Optional for IPv4
+    memcpy(net_buffer_append(buffer, data_len), data, data_len);
+    
+    int result = ip_queue_buffer(batch, sock->local_addr, dest_addr, IPPROTO_UDP, buffer);
+    if (result == 0) {
+        sock->packets_sent++;
+        sock->bytes_sent += data_len;
+    }
+    
+    return result;
+}
+
 int udp_output(udp_socket_t* sock, uint32_t dest_addr, uint16_t dest_port,
               void* data, size_t data_len) {
     if (data_len > UDP_MAX_PAYLOAD) {
         return -1;
     }
     
+    // A datagram that fits a frame goes straight into a frame buffer;
+    // larger ones are fragmented from a flat copy
+    size_t packet_len = sizeof(udp_header_t) + data_len;
+    if (packet_len <= NET_BUFFER_DATA_SIZE) {
+        harmony_tx_batch_t batch = { 0 };
+        int result = udp_queue(&batch, sock, dest_addr, dest_port, data, data_len);
+        int flushed = ethernet_flush(&batch);
+        return result < 0 ? result : flushed;
+    }
+    
     // Build UDP header
     udp_header_t udp_hdr;
     udp_hdr.src_port = htons(sock->local_port);
     udp_hdr.dest_port = htons(dest_port);
-    udp_hdr.length = htons(sizeof(udp_header_t) + data_len);
+    udp_hdr.length = htons(packet_len);
     udp_hdr.checksum = 0;  // Optional for IPv4
     
-    // Build complete packet
-    size_t packet_len = sizeof(udp_header_t) + data_len;
     uint8_t* packet = flux_allocate(NULL, packet_len, FLUX_ALLOC_KERNEL);
     if (!packet) {
         return -1;
     }
-    
+        
     memcpy(packet, &udp_hdr, sizeof(udp_header_t));
     memcpy(packet + sizeof(udp_header_t), data, data_len);
-    
+        
     // Send via IP layer
     int result = ip_send(sock->local_addr ? sock->local_addr : 0,
-                        dest_addr, IPPROTO_UDP, packet, packet_len);
+                         dest_addr, IPPROTO_UDP, packet, packet_len);
     
     flux_free(packet);
     
@@ -193,21 +371,16 @@ int udp_output(udp_socket_t* sock, uint32_t dest_addr, uint16_t dest_port,
 // =============================================================================
 
 udp_socket_t* udp_create_socket(void) {
-    udp_socket_t* sock = flux_allocate(NULL, sizeof(udp_socket_t),
-                                      FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
-    if (!sock) {
+    udp_endpoint_t* ep = flux_allocate(NULL, sizeof(udp_endpoint_t),
+                                       FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!ep) {
         return NULL;
     }
     
-    spinlock_init(&sock->lock);
-    
-    // Add to socket list
-    spinlock_acquire(&g_udp_lock);
-    sock->next = g_udp_sockets;
-    g_udp_sockets = sock;
-    spinlock_release(&g_udp_lock);
+    spinlock_init(&ep->sock.lock);
+    ep->refs = 1;
     
-    return sock;
+    return &ep->sock;
 }
 
 void udp_destroy_socket(udp_socket_t* sock) {
@@ -215,29 +388,17 @@ void udp_destroy_socket(udp_socket_t* sock) {
         return;
     }
     
-    // Remove from socket list
-    spinlock_acquire(&g_udp_lock);
-    
-    udp_socket_t** prev = &g_udp_sockets;
-    while (*prev) {
-        if (*prev == sock) {
-            *prev = sock->next;
-            break;
-        }
-        prev = &(*prev)->next;
-    }
-    
-    spinlock_release(&g_udp_lock);
-    
-    // Free receive queue
-    udp_packet_t* packet = sock->recv_queue_head;
-    while (packet) {
-        udp_packet_t* next = packet->next;
-        flux_free(packet);
-        packet = next;
+    // Lookups may still be on it; the last of them frees it
+    udp_endpoint_t* ep = udp_endpoint(sock);
+    if (udp_hash_remove(ep)) {
+        continuum_synchronize(g_udp_readers);
     }
     
-    flux_free(sock);
+    udp_put(ep);
+}
+
+udp_socket_t* udp_find_socket(socket_t* sock) {
+    return sock && sock->udp ? &sock->udp->sock : NULL;
 }
 
 // =============================================================================
@@ -245,60 +406,126 @@ void udp_destroy_socket(udp_socket_t* sock) {
 // =============================================================================
 
 int udp_bind(socket_t* sock, uint32_t addr, uint16_t port) {
+    if (sock->udp) {
+        return -1;  // Already bound
+    }
+    
     udp_socket_t* udp_sock = udp_create_socket();
     if (!udp_sock) {
         return -1;
     }
     
-    // Check if port is already in use
-    spinlock_acquire(&g_udp_lock);
-    
-    if (port != 0) {
-        udp_socket_t* existing = g_udp_sockets;
-        while (existing) {
-            if (existing->local_port == port && 
-                (existing->local_addr == addr || existing->local_addr == 0 || addr == 0)) {
-                spinlock_release(&g_udp_lock);
-                udp_destroy_socket(udp_sock);
-                return -1;  // Port in use
-            }
-            existing = existing->next;
-        }
-    } else {
-        // Allocate ephemeral port
-        port = g_udp_port_counter++;
-        if (g_udp_port_counter > PORT_EPHEMERAL_MAX) {
-            g_udp_port_counter = PORT_EPHEMERAL_MIN;
-        }
-    }
-    
-    spinlock_release(&g_udp_lock);
-    
-    udp_sock->local_addr = addr;
-    udp_sock->local_port = port;
+    udp_endpoint_t* ep = udp_endpoint(udp_sock);
     udp_sock->socket = sock;
+    ep->reuse_port = sock->reuse_port;
+    if (udp_hash_insert(ep, addr, port) != 0) {
+        udp_destroy_socket(udp_sock);
+        return -1;
+    }
     
+    sock->udp = ep;
     sock->local_addr.ipv4.addr = addr;
-    sock->local_addr.ipv4.port = port;
+    sock->local_addr.ipv4.port = udp_sock->local_port;
     
     return 0;
 }
 
+void udp_close(socket_t* sock) {
+    udp_socket_t* udp_sock = udp_find_socket(sock);
+    if (!udp_sock) {
+        return;
+    }
+    
+    sock->udp = NULL;
+    spinlock_acquire(&udp_sock->lock);
+    udp_sock->socket = NULL;
+    spinlock_release(&udp_sock->lock);
+    udp_destroy_socket(udp_sock);
+}
+
+// Readable with datagrams queued; always writable, the first send
+// binding it if need be
+uint32_t udp_poll(socket_t* sock) {
+    udp_socket_t* udp_sock = udp_find_socket(sock);
+    uint32_t ready = CONDUIT_SELECT_WRITE_READY;
+    if (udp_sock && __atomic_load_n(&udp_sock->recv_queue_count, __ATOMIC_RELAXED) > 0) {
+        ready |= CONDUIT_SELECT_READ_READY;
+    }
+    
+    return ready;
+}
+
+// The socket's UDP state, bound to an ephemeral port if it wasn't yet
+static udp_socket_t* udp_bound(socket_t* sock) {
+    udp_socket_t* udp_sock = udp_find_socket(sock);
+    if (!udp_sock && udp_bind(sock, 0, 0) == 0) {
+        udp_sock = udp_find_socket(sock);
+    }
+    
+    return udp_sock;
+}
+
 int udp_sendto(socket_t* sock, void* data, size_t len,
               uint32_t dest_addr, uint16_t dest_port) {
-    udp_socket_t* udp_sock = udp_find_socket(sock);
+    udp_socket_t* udp_sock = udp_bound(sock);
+    if (!udp_sock) {
+        return -1;
+    }
+    
+    return udp_output(udp_sock, dest_addr, dest_port, data, len);
+}
+
+// Send count datagrams, those that fit a frame handed down as one batch;
+// stops at the first that fails
+int udp_sendmmsg(socket_t* sock, harmony_mmsg_t* msgs, uint32_t count) {
+    udp_socket_t* udp_sock = udp_bound(sock);
     if (!udp_sock) {
-        // Socket not bound - auto-bind
-        if (udp_bind(sock, 0, 0) != 0) {
-            return -1;
+        return -1;
+    }
+    
+    harmony_tx_batch_t batch = { 0 };
+    uint32_t sent = 0;
+    int result = 0;
+    for (; sent < count; sent++) {
+        harmony_mmsg_t* msg = &msgs[sent];
+        uint32_t dest_addr = msg->port ? msg->addr : sock->remote_addr.ipv4.addr;
+        uint16_t dest_port = msg->port ? msg->port : sock->remote_addr.ipv4.port;
+        msg->flags = 0;
+        msg->transferred = 0;
+        
+        if (msg->len > UDP_MAX_PAYLOAD || dest_port == 0) {
+            result = -1;
+        } else if (sizeof(udp_header_t) + msg->len <= NET_BUFFER_DATA_SIZE) {
+            result = udp_queue(&batch, udp_sock, dest_addr, dest_port, msg->data, msg->len);
+        } else {
+            // Fragments go after what's already queued
+            ethernet_flush(&batch);
+            result = udp_output(udp_sock, dest_addr, dest_port, msg->data, msg->len);
         }
-        udp_sock = udp_find_socket(sock);
-        if (!udp_sock) {
-            return -1;
+        if (result != 0) {
+            break;
         }
+        msg->transferred = msg->len;
     }
     
-    return udp_output(udp_sock, dest_addr, dest_port, data, len);
+    ethernet_flush(&batch);
+    return sent > 0 || result == 0 ? (int)sent : -1;
+}
+
+// Take up to max datagrams off the socket's ring, in arrival order
+static uint32_t udp_dequeue(udp_socket_t* udp_sock, udp_datagram_t* out, uint32_t max) {
+    udp_endpoint_t* ep = udp_endpoint(udp_sock);
+    
+    spinlock_acquire(&udp_sock->lock);
+    uint32_t count = udp_sock->recv_queue_count < max ? udp_sock->recv_queue_count : max;
+    for (uint32_t i = 0; i < count; i++) {
+        out[i] = ep->ring[ep->ring_head];
+        ep->ring_head = (ep->ring_head + 1) % UDP_RECV_RING;
+    }
+    udp_sock->recv_queue_count -= count;
+    spinlock_release(&udp_sock->lock);
+    
+    return count;
 }
 
 int udp_recvfrom(socket_t* sock, void* buffer, size_t len,
@@ -308,34 +535,49 @@ int udp_recvfrom(socket_t* sock, void* buffer, size_t len,
         return -1;
     }
     
-    spinlock_acquire(&udp_sock->lock);
-    
-    if (udp_sock->recv_queue_head == NULL) {
-        spinlock_release(&udp_sock->lock);
+    udp_datagram_t datagram;
+    if (udp_dequeue(udp_sock, &datagram, 1) == 0) {
         return 0;  // No data available
     }
     
-    udp_packet_t* packet = udp_sock->recv_queue_head;
-    udp_sock->recv_queue_head = packet->next;
-    if (udp_sock->recv_queue_head == NULL) {
-        udp_sock->recv_queue_tail = NULL;
-    }
-    udp_sock->recv_queue_count--;
-    
-    spinlock_release(&udp_sock->lock);
-    
     // Copy data
-    size_t copy_len = (packet->data_len < len) ? packet->data_len : len;
-    memcpy(buffer, packet->data, copy_len);
+    size_t copy_len = (datagram.len < len) ? datagram.len : len;
+    memcpy(buffer, datagram.data, copy_len);
     
     if (src_addr) {
-        *src_addr = packet->src_addr;
+        *src_addr = datagram.src_addr;
     }
     if (src_port) {
-        *src_port = packet->src_port;
+        *src_port = datagram.src_port;
     }
     
-    flux_free(packet);
+    net_buffer_put(datagram.buffer);
     
     return copy_len;
 }
+
+// Up to count datagrams into msgs, taken off the ring together; 0 if
+// there are none
+int udp_recvmmsg(socket_t* sock, harmony_mmsg_t* msgs, uint32_t count) {
+    udp_socket_t* udp_sock = udp_find_socket(sock);
+    if (!udp_sock) {
+        return -1;
+    }
+    
+    udp_datagram_t datagrams[HARMONY_MMSG_MAX];
+    uint32_t received = udp_dequeue(udp_sock, datagrams,
+                                    count < HARMONY_MMSG_MAX ? count : HARMONY_MMSG_MAX);
+    for (uint32_t i = 0; i < received; i++) {
+        harmony_mmsg_t* msg = &msgs[i];
+        udp_datagram_t* datagram = &datagrams[i];
+        
+        msg->transferred = datagram->len < msg->len ? datagram->len : msg->len;
+        msg->flags = datagram->len > msg->len ? HARMONY_MSG_TRUNC : 0;
+        msg->addr = datagram->src_addr;
+        msg->port = datagram->src_port;
+        memcpy(msg->data, datagram->data, msg->transferred);
+        net_buffer_put(datagram->buffer);
+    }
+    
+    return (int)received;
+}
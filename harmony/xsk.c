@@ -0,0 +1,510 @@
+/*
+ * Raw Packet Rings
+ * Ring sockets over a NIC receive queue. Where the driver takes a buffer
+ * pool the queue refills from the UMEM itself, so frames the classifier
+ * steers to the ring are never copied; elsewhere they're copied into a
+ * chunk from fill. Frames it doesn't steer go up the stack in a shared
+ * buffer as ever.
+ */
+
+#include "xsk.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "../continuum/flux_memory.h"
+#include "../continuum/temporal_scheduler.h"
+
+// =============================================================================
+// Global Ring Socket State
+// =============================================================================
+
+static harmony_xsk_t* g_xsk_table[HARMONY_XSK_MAX];
+static spinlock_t g_xsk_lock = SPINLOCK_INIT;
+
+// =============================================================================
+// Rings
+// =============================================================================
+
+// The kernel's end of a ring. Each side of each ring is a single party:
+// the queue's drain produces rx, fill and completion are under the
+// socket's lock and tx under its tx lock.
+static bool xsk_ring_produce(harmony_xsk_ring_t* ring, uint64_t addr, uint32_t len) {
+    uint32_t producer = ring->producer;
+    if (producer - __atomic_load_n(&ring->consumer, __ATOMIC_ACQUIRE) > ring->mask) {
+        return false;
+    }
+    
+    harmony_xsk_desc_t* desc = &ring->descs[producer & ring->mask];
+    desc->addr = addr;
+    desc->len = len;
+    desc->options = 0;
+    __atomic_store_n(&ring->producer, producer + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool xsk_ring_consume(harmony_xsk_ring_t* ring, harmony_xsk_desc_t* desc) {
+    uint32_t consumer = ring->consumer;
+    if (consumer == __atomic_load_n(&ring->producer, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    
+    *desc = ring->descs[consumer & ring->mask];
+    __atomic_store_n(&ring->consumer, consumer + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static harmony_xsk_ring_t* xsk_ring_create(uint32_t size) {
+    harmony_xsk_ring_t* ring = flux_allocate(NULL, sizeof(harmony_xsk_ring_t),
+                                             FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!ring) {
+        return NULL;
+    }
+    
+    ring->descs = flux_allocate(NULL, size * sizeof(harmony_xsk_desc_t),
+                                FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!ring->descs) {
+        flux_free(ring);
+        return NULL;
+    }
+    
+    ring->mask = size - 1;
+    return ring;
+}
+
+static void xsk_ring_destroy(harmony_xsk_ring_t* ring) {
+    if (ring) {
+        flux_free(ring->descs);
+        flux_free(ring);
+    }
+}
+
+// =============================================================================
+// Chunks
+// =============================================================================
+
+static inline uint64_t xsk_chunk_addr(harmony_xsk_t* xsk, net_buffer_t* chunk) {
+    return (uint64_t)(chunk - xsk->chunks) * NET_BUFFER_STRIDE;
+}
+
+static void xsk_free(harmony_xsk_t* xsk) {
+    xsk_ring_destroy(xsk->fill);
+    xsk_ring_destroy(xsk->completion);
+    xsk_ring_destroy(xsk->rx);
+    xsk_ring_destroy(xsk->tx);
+    flux_free(xsk->sending);
+    flux_free(xsk->chunks);
+    if (xsk->umem) {
+        resonance_free_dma(xsk->umem);
+    }
+    flux_free(xsk);
+}
+
+// A chunk for the kernel to fill: a spare one, else the next off fill.
+// The lock is held.
+static net_buffer_t* xsk_take_chunk(harmony_xsk_t* xsk) {
+    net_buffer_t* chunk = xsk->recycled;
+    if (chunk) {
+        xsk->recycled = chunk->next;
+        xsk->held++;
+        return chunk;
+    }
+    
+    harmony_xsk_desc_t desc;
+    while (xsk_ring_consume(xsk->fill, &desc)) {
+        uint64_t index = desc.addr / NET_BUFFER_STRIDE;
+        if (index < xsk->chunk_count) {
+            xsk->held++;
+            return &xsk->chunks[index];
+        }
+    }
+    
+    return NULL;
+}
+
+// The driver's refill, for a queue receiving straight into the UMEM
+static net_buffer_t* xsk_pool_alloc(net_buffer_pool_t* pool) {
+    harmony_xsk_t* xsk = (harmony_xsk_t*)pool;
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&xsk->lock);
+    net_buffer_t* chunk = xsk->closing ? NULL : xsk_take_chunk(xsk);
+    spinlock_release(&xsk->lock);
+    cpu_irq_restore(flags);
+    
+    return chunk;
+}
+
+// A chunk's last reference went: those sent go back on completion, the
+// rest are kept spare
+static void xsk_pool_release(net_buffer_pool_t* pool, net_buffer_t* chunk) {
+    harmony_xsk_t* xsk = (harmony_xsk_t*)pool;
+    size_t index = chunk - xsk->chunks;
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&xsk->lock);
+    bool spare = true;
+    if (xsk->sending[index]) {
+        xsk->sending[index] = false;
+        spare = !xsk_ring_produce(xsk->completion, xsk_chunk_addr(xsk, chunk), 0);
+    }
+    if (spare) {
+        chunk->next = xsk->recycled;
+        xsk->recycled = chunk;
+    }
+    xsk->held--;
+    bool done = xsk->closing && xsk->held == 0;
+    spinlock_release(&xsk->lock);
+    cpu_irq_restore(flags);
+    
+    if (done) {
+        xsk_free(xsk);
+    }
+}
+
+// A chunk the kernel holds goes to the application on rx
+static void xsk_deliver(harmony_xsk_t* xsk, net_buffer_t* chunk, uint32_t len) {
+    uint64_t addr = xsk_chunk_addr(xsk, chunk) + NET_BUFFER_HEADROOM;
+    if (!xsk_ring_produce(xsk->rx, addr, len)) {
+        xsk->rx_dropped++;
+        net_buffer_put(chunk);
+        return;
+    }
+    
+    xsk->rx_frames++;
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&xsk->lock);
+    xsk->held--;
+    spinlock_release(&xsk->lock);
+    cpu_irq_restore(flags);
+}
+
+// =============================================================================
+// Classifier
+// =============================================================================
+
+static bool xsk_rule_match(const harmony_xsk_rule_t* rule, const uint8_t* frame, uint32_t len) {
+    const eth_header_t* eth = (const eth_header_t*)frame;
+    if (rule->ethertype && ntohs(eth->type) != rule->ethertype) {
+        return false;
+    }
+    if (!rule->protocol && !rule->src_addr && !rule->dest_addr &&
+        !rule->src_port && !rule->dest_port) {
+        return true;
+    }
+    
+    if (len < ETH_HLEN + sizeof(ipv4_header_t) || eth->type != htons(ETH_P_IP)) {
+        return false;
+    }
+    
+    const ipv4_header_t* ip = (const ipv4_header_t*)(frame + ETH_HLEN);
+    if ((rule->protocol && ip->protocol != rule->protocol) ||
+        (rule->src_addr && ip->src_addr != rule->src_addr) ||
+        (rule->dest_addr && ip->dest_addr != rule->dest_addr)) {
+        return false;
+    }
+    if (!rule->src_port && !rule->dest_port) {
+        return true;
+    }
+    
+    uint32_t ihl = (ip->version_ihl & 0x0F) * 4;
+    bool fragment = (ntohs(ip->flags_frag_offset) & 0x3FFF) != 0;
+    if (fragment || (ip->protocol != IPPROTO_TCP && ip->protocol != IPPROTO_UDP) ||
+        len < ETH_HLEN + ihl + 4) {
+        return false;
+    }
+    
+    uint16_t ports[2];
+    memcpy(ports, frame + ETH_HLEN + ihl, sizeof(ports));
+    return (!rule->src_port || ports[0] == rule->src_port) &&
+           (!rule->dest_port || ports[1] == rule->dest_port);
+}
+
+// Whether a frame goes to the ring: all of them until there's a rule
+static bool xsk_classify(harmony_xsk_t* xsk, const uint8_t* frame, uint32_t len) {
+    uint32_t count = __atomic_load_n(&xsk->rule_count, __ATOMIC_ACQUIRE);
+    if (count == 0) {
+        return true;
+    }
+    if (len < ETH_HLEN) {
+        return false;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        if (xsk_rule_match(&xsk->rules[i], frame, len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// =============================================================================
+// Receive
+// =============================================================================
+
+bool xsk_receive_frame(harmony_xsk_t* xsk, const void* frame, uint32_t len) {
+    if (!xsk_classify(xsk, frame, len)) {
+        return false;
+    }
+    
+    if (len > NET_BUFFER_DATA_SIZE) {
+        xsk->rx_dropped++;
+        return true;
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&xsk->lock);
+    net_buffer_t* chunk = xsk_take_chunk(xsk);
+    spinlock_release(&xsk->lock);
+    cpu_irq_restore(flags);
+    
+    if (!chunk) {
+        xsk->rx_dropped++;
+        return true;
+    }
+    
+    net_buffer_reset(chunk);
+    memcpy(chunk->data, frame, len);
+    xsk->rx_copied++;
+    xsk_deliver(xsk, chunk, len);
+    return true;
+}
+
+// A frame in one of this socket's chunks is handed over as it is, and one
+// it doesn't want is copied out so the chunk goes straight back to the
+// queue. Anything else, be it a shared buffer or a chunk of a socket
+// closed since, is copied if the ring wants it.
+net_buffer_t* xsk_receive(harmony_xsk_t* xsk, net_buffer_t* buffer) {
+    bool ours = buffer->pool == &xsk->pool;
+    if (!ours) {
+        if (!xsk_receive_frame(xsk, buffer->data, buffer->len)) {
+            return buffer;
+        }
+        net_buffer_put(buffer);
+        return NULL;
+    }
+    
+    if (xsk_classify(xsk, buffer->data, buffer->len)) {
+        xsk_deliver(xsk, buffer, buffer->len);
+        return NULL;
+    }
+    
+    net_buffer_t* copy = net_buffer_alloc();
+    if (copy) {
+        memcpy(net_buffer_append(copy, buffer->len), buffer->data, buffer->len);
+        copy->flags = buffer->flags & NET_BUFFER_CSUM_VALID;
+        xsk->rx_passed++;
+    }
+    net_buffer_put(buffer);
+    return copy;
+}
+
+// =============================================================================
+// Transmit
+// =============================================================================
+
+// Hand what's on tx to the driver a batch at a time, the chunks going out
+// as they are. A descriptor that doesn't leave the chunk headroom, or runs
+// past the chunk's end, is completed without being sent.
+int xsk_kick(harmony_xsk_t* xsk) {
+    network_interface_t* iface = xsk->iface;
+    int (*send_buffers)(void*, net_buffer_t**, uint32_t) =
+        __atomic_load_n(&iface->send_buffers, __ATOMIC_ACQUIRE);
+    int (*send_buffer)(void*, net_buffer_t*) = __atomic_load_n(&iface->send_buffer,
+                                                               __ATOMIC_ACQUIRE);
+    int sent = 0;
+    
+    spinlock_acquire(&xsk->tx_lock);
+    while (1) {
+        net_buffer_t* batch[HARMONY_TX_BATCH];
+        uint32_t count = 0;
+        harmony_xsk_desc_t desc;
+        while (count < HARMONY_TX_BATCH && xsk_ring_consume(xsk->tx, &desc)) {
+            uint64_t index = desc.addr / NET_BUFFER_STRIDE;
+            uint64_t offset = desc.addr % NET_BUFFER_STRIDE;
+            
+            uint64_t flags = cpu_irq_save();
+            spinlock_acquire(&xsk->lock);
+            if (index >= xsk->chunk_count) {
+                xsk->tx_invalid++;
+            } else if (offset < NET_BUFFER_HEADROOM || desc.len == 0 ||
+                       offset + desc.len > NET_BUFFER_STRIDE) {
+                xsk->tx_invalid++;
+                xsk_ring_produce(xsk->completion, index * NET_BUFFER_STRIDE, 0);
+            } else {
+                net_buffer_t* chunk = &xsk->chunks[index];
+                net_buffer_reset(chunk);
+                chunk->data = chunk->head + offset;
+                chunk->len = desc.len;
+                xsk->sending[index] = true;
+                xsk->held++;
+                batch[count++] = chunk;
+            }
+            spinlock_release(&xsk->lock);
+            cpu_irq_restore(flags);
+        }
+        if (count == 0) {
+            break;
+        }
+        
+        // Frames the driver drops come back on completion all the same
+        if (send_buffers) {
+            send_buffers(iface->driver_data, batch, count);
+        } else {
+            for (uint32_t i = 0; i < count; i++) {
+                if (send_buffer) {
+                    send_buffer(iface->driver_data, batch[i]);
+                } else {
+                    iface->send_packet(iface->driver_data, batch[i]->data, batch[i]->len);
+                    net_buffer_put(batch[i]);
+                }
+            }
+        }
+        xsk->tx_frames += count;
+        sent += count;
+    }
+    spinlock_release(&xsk->tx_lock);
+    
+    return sent;
+}
+
+// =============================================================================
+// Ring Sockets
+// =============================================================================
+
+harmony_xsk_t* xsk_get(int id) {
+    if (id < 0 || id >= HARMONY_XSK_MAX) {
+        return NULL;
+    }
+    return __atomic_load_n(&g_xsk_table[id], __ATOMIC_ACQUIRE);
+}
+
+// The rings each hold every chunk, so completion never runs out of room.
+// A queue whose driver takes a pool receives into the UMEM unless the
+// caller asks for copies.
+harmony_xsk_t* xsk_create(network_interface_t* iface, uint32_t queue, uint32_t chunks,
+                          uint32_t flags, harmony_xsk_info_t* info) {
+    if (queue >= iface->num_rx_queues || chunks == 0 || chunks > HARMONY_XSK_MAX_CHUNKS) {
+        return NULL;
+    }
+    
+    uint32_t size = 1;
+    while (size < chunks) {
+        size <<= 1;
+    }
+    
+    harmony_xsk_t* xsk = flux_allocate(NULL, sizeof(harmony_xsk_t),
+                                       FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!xsk) {
+        return NULL;
+    }
+    
+    xsk->pool.alloc = xsk_pool_alloc;
+    xsk->pool.release = xsk_pool_release;
+    xsk->iface = iface;
+    xsk->queue = queue;
+    xsk->chunk_count = chunks;
+    spinlock_init(&xsk->lock);
+    spinlock_init(&xsk->tx_lock);
+    
+    xsk->umem = resonance_alloc_dma((size_t)chunks * NET_BUFFER_STRIDE, DMA_FLAG_COHERENT);
+    xsk->chunks = flux_allocate(NULL, chunks * sizeof(net_buffer_t),
+                                FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    xsk->sending = flux_allocate(NULL, chunks * sizeof(bool), FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    xsk->fill = xsk_ring_create(size);
+    xsk->completion = xsk_ring_create(size);
+    xsk->rx = xsk_ring_create(size);
+    xsk->tx = xsk_ring_create(size);
+    if (!xsk->umem || !xsk->chunks || !xsk->sending || !xsk->fill || !xsk->completion ||
+        !xsk->rx || !xsk->tx) {
+        xsk_free(xsk);
+        return NULL;
+    }
+    
+    for (uint32_t i = 0; i < chunks; i++) {
+        xsk->chunks[i].head = (uint8_t*)xsk->umem->virtual_addr + (size_t)i * NET_BUFFER_STRIDE;
+        xsk->chunks[i].physical_addr = xsk->umem->physical_addr + (uint64_t)i * NET_BUFFER_STRIDE;
+        xsk->chunks[i].pool = &xsk->pool;
+    }
+    
+    // A slot in the table, and the queue to itself
+    spinlock_acquire(&g_xsk_lock);
+    xsk->id = -1;
+    for (int id = 0; id < HARMONY_XSK_MAX; id++) {
+        if (!g_xsk_table[id]) {
+            xsk->id = id;
+            break;
+        }
+    }
+    if (xsk->id < 0 || iface->xsk[queue]) {
+        spinlock_release(&g_xsk_lock);
+        xsk_free(xsk);
+        return NULL;
+    }
+    __atomic_store_n(&g_xsk_table[xsk->id], xsk, __ATOMIC_RELEASE);
+    __atomic_store_n(&iface->xsk[queue], xsk, __ATOMIC_RELEASE);
+    spinlock_release(&g_xsk_lock);
+    
+    int (*set_rx_pool)(void*, uint32_t, net_buffer_pool_t*) =
+        __atomic_load_n(&iface->set_rx_pool, __ATOMIC_ACQUIRE);
+    if (set_rx_pool && !(flags & HARMONY_XSK_COPY) &&
+        set_rx_pool(iface->driver_data, queue, &xsk->pool) == 0) {
+        flags |= HARMONY_XSK_ZEROCOPY;
+    }
+    xsk->flags = flags;
+    
+    info->umem = xsk->umem->virtual_addr;
+    info->umem_size = (size_t)chunks * NET_BUFFER_STRIDE;
+    info->chunk_size = NET_BUFFER_STRIDE;
+    info->headroom = NET_BUFFER_HEADROOM;
+    info->flags = xsk->flags;
+    info->fill = xsk->fill;
+    info->completion = xsk->completion;
+    info->rx = xsk->rx;
+    info->tx = xsk->tx;
+    return xsk;
+}
+
+int xsk_add_rule(harmony_xsk_t* xsk, const harmony_xsk_rule_t* rule) {
+    spinlock_acquire(&xsk->tx_lock);
+    uint32_t count = xsk->rule_count;
+    if (count >= HARMONY_XSK_MAX_RULES) {
+        spinlock_release(&xsk->tx_lock);
+        return -1;
+    }
+    
+    xsk->rules[count] = *rule;
+    __atomic_store_n(&xsk->rule_count, count + 1, __ATOMIC_RELEASE);
+    spinlock_release(&xsk->tx_lock);
+    return 0;
+}
+
+// Unbind from the queue, then wait out a drain that may still have the
+// socket in hand. The UMEM stays until the chunks on the ring, and any the
+// stack took, have come back.
+void xsk_close(harmony_xsk_t* xsk) {
+    network_interface_t* iface = xsk->iface;
+    harmony_napi_t* napi = &iface->napi[xsk->queue];
+    
+    spinlock_acquire(&g_xsk_lock);
+    __atomic_store_n(&g_xsk_table[xsk->id], NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&iface->xsk[xsk->queue], NULL, __ATOMIC_SEQ_CST);
+    spinlock_release(&g_xsk_lock);
+    
+    while (__atomic_load_n(&napi->state, __ATOMIC_SEQ_CST) & HARMONY_NAPI_POLLING) {
+        __asm__ __volatile__("pause");
+    }
+    
+    if (xsk->flags & HARMONY_XSK_ZEROCOPY) {
+        iface->set_rx_pool(iface->driver_data, xsk->queue, NULL);
+    }
+    
+    uint64_t flags = cpu_irq_save();
+    spinlock_acquire(&xsk->lock);
+    xsk->closing = true;
+    bool done = xsk->held == 0;
+    spinlock_release(&xsk->lock);
+    cpu_irq_restore(flags);
+    
+    if (done) {
+        xsk_free(xsk);
+    }
+}
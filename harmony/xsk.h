@@ -0,0 +1,75 @@
+/*
+ * Raw Packet Rings
+ * AF_XDP-style sockets: a UMEM of frame chunks and four rings shared with
+ * an application, bound to one receive queue of an interface
+ */
+
+#ifndef XSK_H
+#define XSK_H
+
+#include "harmony_net.h"
+#include "../continuum/drivers/resonance.h"
+#include "../continuum/drivers/network/net_buffer.h"
+
+// =============================================================================
+// Ring Socket Structures
+// =============================================================================
+
+// Each chunk has a buffer header of its own, so the driver can receive
+// into it and send from it like any other buffer. held counts the chunks
+// out with the driver or the stack; the socket goes once it's closed and
+// they've all come back.
+typedef struct harmony_xsk {
+    net_buffer_pool_t pool;     // First, so a chunk's pool is its socket
+    int id;
+    network_interface_t* iface;
+    uint32_t queue;
+    uint32_t flags;             // HARMONY_XSK_*
+    
+    dma_region_t* umem;
+    net_buffer_t* chunks;
+    bool* sending;              // Chunk came off tx, owed on completion
+    uint32_t chunk_count;
+    
+    harmony_xsk_ring_t* fill;
+    harmony_xsk_ring_t* completion;
+    harmony_xsk_ring_t* rx;
+    harmony_xsk_ring_t* tx;
+    
+    net_buffer_t* recycled;     // Chunks the kernel holds spare
+    uint32_t held;
+    bool closing;
+    spinlock_t lock;            // Fill consumer, completion producer, the above
+    spinlock_t tx_lock;         // Tx consumer, and adding rules
+    
+    harmony_xsk_rule_t rules[HARMONY_XSK_MAX_RULES];
+    uint32_t rule_count;        // Only grows; rules are written before it
+    
+    // Statistics
+    uint64_t rx_frames;
+    uint64_t rx_copied;         // Received into a shared buffer and copied over
+    uint64_t rx_dropped;        // No chunk to hold them, or rx was full
+    uint64_t rx_passed;         // Taken from the UMEM for the stack
+    uint64_t tx_frames;
+    uint64_t tx_invalid;        // Descriptors outside a chunk, completed unsent
+} harmony_xsk_t;
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+harmony_xsk_t* xsk_create(network_interface_t* iface, uint32_t queue, uint32_t chunks,
+                          uint32_t flags, harmony_xsk_info_t* info);
+harmony_xsk_t* xsk_get(int id);
+int xsk_add_rule(harmony_xsk_t* xsk, const harmony_xsk_rule_t* rule);
+int xsk_kick(harmony_xsk_t* xsk);
+void xsk_close(harmony_xsk_t* xsk);
+
+// From the drain of the queue xsk is bound to. receive takes a driver's
+// buffer, returning the frame for the stack or NULL if the ring had it;
+// receive_frame does the same for a frame the driver copied out, returning
+// whether the ring took it.
+net_buffer_t* xsk_receive(harmony_xsk_t* xsk, net_buffer_t* buffer);
+bool xsk_receive_frame(harmony_xsk_t* xsk, const void* frame, uint32_t len);
+
+#endif /* XSK_H */
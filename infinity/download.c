@@ -0,0 +1,898 @@
+/*
+ * Infinity Download Manager
+ * Concurrent downloads over pooled keep-alive connections
+ */
+
+#include "download.h"
+#include "../harmony/harmony_net.h"
+#include "../manifold/manifold.h"
+#include "../continuum/flux_memory.h"
+#include "../continuum/temporal_scheduler.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+// =============================================================================
+// Download State
+// =============================================================================
+
+// A connection to one server, busy with one worker's request or idle in
+// the pool for the next request to the same server
+typedef struct {
+    char host[256];
+    uint16_t port;
+    bool tls;
+    int fd;                         // -1 for a free slot
+    void* session;                  // TLS, over fd
+    bool busy;
+    uint64_t idle_since;
+} download_conn_t;
+
+typedef struct {
+    conduit_poll_t* poll;           // For the socket being waited on
+    uint8_t* buffer;                // INFINITY_DOWNLOAD_CHUNK bytes
+} download_worker_t;
+
+typedef struct {
+    bool tls;
+    char host[256];
+    uint16_t port;
+    const char* path;
+} download_url_t;
+
+typedef struct {
+    int status;
+    int64_t length;                 // -1 for until the server closes
+    bool keep_alive;
+    bool chunked;
+    size_t head_size;
+    size_t received;                // In the buffer: the head and any body after it
+} download_response_t;
+
+static struct {
+    download_job_t* head;           // Queued, oldest first
+    download_job_t* tail;
+    download_conn_t conns[INFINITY_DOWNLOAD_MAX_CONNS];
+    download_worker_t workers[INFINITY_DOWNLOAD_MAX_WORKERS];
+    uint32_t worker_count;
+    uint32_t running;               // Workers not yet exited
+    bool stopping;
+    char cache_dir[256];
+    infinity_download_stats_t stats;
+} g_downloads;
+
+static spinlock_t g_download_lock = SPINLOCK_INIT;
+
+#define DOWNLOAD_STAT(field, n) __atomic_fetch_add(&g_downloads.stats.field, (n), __ATOMIC_RELAXED)
+
+// =============================================================================
+// SHA-256
+// =============================================================================
+
+static const uint32_t g_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROTR(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(infinity_sha256_t* sha, const uint8_t* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    
+    uint32_t a = sha->state[0], b = sha->state[1], c = sha->state[2], d = sha->state[3];
+    uint32_t e = sha->state[4], f = sha->state[5], g = sha->state[6], h = sha->state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25);
+        uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + g_sha256_k[i] + w[i];
+        uint32_t s0 = SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22);
+        uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    
+    sha->state[0] += a;
+    sha->state[1] += b;
+    sha->state[2] += c;
+    sha->state[3] += d;
+    sha->state[4] += e;
+    sha->state[5] += f;
+    sha->state[6] += g;
+    sha->state[7] += h;
+}
+
+void infinity_sha256_init(infinity_sha256_t* sha) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(sha->state, initial, sizeof(sha->state));
+    sha->length = 0;
+    sha->used = 0;
+}
+
+void infinity_sha256_update(infinity_sha256_t* sha, const void* data, size_t size) {
+    const uint8_t* p = data;
+    sha->length += size;
+    
+    if (sha->used) {
+        size_t take = sizeof(sha->block) - sha->used;
+        if (take > size) {
+            take = size;
+        }
+        memcpy(sha->block + sha->used, p, take);
+        sha->used += take;
+        p += take;
+        size -= take;
+        if (sha->used < sizeof(sha->block)) {
+            return;
+        }
+        sha256_block(sha, sha->block);
+        sha->used = 0;
+    }
+    
+    while (size >= sizeof(sha->block)) {
+        sha256_block(sha, p);
+        p += sizeof(sha->block);
+        size -= sizeof(sha->block);
+    }
+    
+    if (size) {
+        memcpy(sha->block, p, size);
+        sha->used = size;
+    }
+}
+
+void infinity_sha256_final(infinity_sha256_t* sha, uint8_t* hash) {
+    uint64_t bits = sha->length * 8;
+    
+    sha->block[sha->used++] = 0x80;
+    if (sha->used > 56) {
+        memset(sha->block + sha->used, 0, sizeof(sha->block) - sha->used);
+        sha256_block(sha, sha->block);
+        sha->used = 0;
+    }
+    memset(sha->block + sha->used, 0, 56 - sha->used);
+    for (int i = 0; i < 8; i++) {
+        sha->block[56 + i] = bits >> (56 - i * 8);
+    }
+    sha256_block(sha, sha->block);
+    
+    for (int i = 0; i < 8; i++) {
+        hash[i * 4] = sha->state[i] >> 24;
+        hash[i * 4 + 1] = sha->state[i] >> 16;
+        hash[i * 4 + 2] = sha->state[i] >> 8;
+        hash[i * 4 + 3] = sha->state[i];
+    }
+}
+
+int infinity_compute_hash(const void* data, size_t size, uint8_t* hash) {
+    if (!data && size) {
+        return -1;
+    }
+    
+    infinity_sha256_t sha;
+    infinity_sha256_init(&sha);
+    infinity_sha256_update(&sha, data, size);
+    infinity_sha256_final(&sha, hash);
+    return 0;
+}
+
+// =============================================================================
+// Connection Pool
+// =============================================================================
+
+static int download_parse_url(const char* url, download_url_t* parsed) {
+    const char* p;
+    if (strncmp(url, "http://", 7) == 0) {
+        parsed->tls = false;
+        parsed->port = 80;
+        p = url + 7;
+    } else if (strncmp(url, "https://", 8) == 0) {
+        parsed->tls = true;
+        parsed->port = 443;
+        p = url + 8;
+    } else {
+        return -1;
+    }
+
+    size_t length = strcspn(p, ":/");
+    if (length == 0 || length >= sizeof(parsed->host)) {
+        return -1;
+    }
+    memcpy(parsed->host, p, length);
+    parsed->host[length] = '\0';
+    p += length;
+
+    if (*p == ':') {
+        char* end;
+        unsigned long port = strtoul(p + 1, &end, 10);
+        if (end == p + 1 || port == 0 || port > 65535 || (*end && *end != '/')) {
+            return -1;
+        }
+        parsed->port = port;
+        p = end;
+    }
+
+    parsed->path = *p ? p : "/";
+    return 0;
+}
+
+static int download_conn_send(download_conn_t* conn, const void* data, size_t len) {
+    if (conn->session) {
+        return infinity_tls_send(conn->session, data, len);
+    }
+    return harmony_send(conn->fd, (void*)data, len, 0);
+}
+
+static int download_conn_recv(download_conn_t* conn, void* buffer, size_t len) {
+    if (conn->session) {
+        return infinity_tls_recv(conn->session, buffer, len);
+    }
+    return harmony_recv(conn->fd, buffer, len, 0);
+}
+
+static void download_conn_close(download_conn_t* conn) {
+    if (conn->session) {
+        infinity_tls_close(conn->session);
+        conn->session = NULL;
+    }
+    if (conn->fd >= 0) {
+        harmony_close(conn->fd);
+        conn->fd = -1;
+    }
+}
+
+// Wait for fd to be ready for any of events, returning which it is; 0 if
+// it timed out or failed
+static uint32_t download_wait(download_worker_t* worker, int fd, uint32_t events) {
+    if (harmony_poll_add(worker->poll, fd, events, NULL) != 0) {
+        return 0;
+    }
+
+    conduit_poll_event_t event;
+    int count = conduit_poll_wait(worker->poll, &event, 1, INFINITY_DOWNLOAD_TIMEOUT);
+    harmony_poll_remove(worker->poll, fd);
+
+    if (count <= 0 || (event.events & CONDUIT_SELECT_ERROR_READY)) {
+        return 0;
+    }
+    return event.events;
+}
+
+// An idle connection to the server, or else a slot for a new one: a free
+// one, or the one idle longest. One idle too long isn't trusted again,
+// the server likely having closed it.
+static download_conn_t* download_pool_take(const download_url_t* url, bool* reused) {
+    uint64_t now = temporal_get_time();
+    download_conn_t* match = NULL;
+    download_conn_t* slot = NULL;
+
+    spinlock_acquire(&g_download_lock);
+    for (uint32_t i = 0; i < INFINITY_DOWNLOAD_MAX_CONNS && !match; i++) {
+        download_conn_t* conn = &g_downloads.conns[i];
+        if (conn->busy) {
+            continue;
+        }
+
+        if (conn->fd >= 0 && now - conn->idle_since < INFINITY_DOWNLOAD_IDLE_TIMEOUT &&
+            conn->port == url->port && conn->tls == url->tls &&
+            strcmp(conn->host, url->host) == 0) {
+            match = conn;
+        } else if (!slot || (slot->fd >= 0 && (conn->fd < 0 ||
+                                                 conn->idle_since < slot->idle_since))) {
+            slot = conn;
+        }
+    }
+
+    download_conn_t* conn = match ? match : slot;
+    if (conn) {
+        conn->busy = true;
+    }
+    spinlock_release(&g_download_lock);
+
+    *reused = match != NULL;
+    return conn;
+}
+
+static void download_pool_put(download_conn_t* conn, bool keep) {
+    if (!keep) {
+        download_conn_close(conn);
+    }
+
+    spinlock_acquire(&g_download_lock);
+    conn->idle_since = temporal_get_time();
+    conn->busy = false;
+    spinlock_release(&g_download_lock);
+}
+
+static int download_open(download_worker_t* worker, download_conn_t* conn,
+                         const download_url_t* url) {
+    download_conn_close(conn);
+    strncpy(conn->host, url->host, sizeof(conn->host) - 1);
+    conn->host[sizeof(conn->host) - 1] = '\0';
+    conn->port = url->port;
+    conn->tls = url->tls;
+
+    uint32_t addr;
+    if (infinity_resolve_host(url->host, &addr) != 0) {
+        return -1;
+    }
+
+    // Writable once established; refused, it reads as closed instead
+    conn->fd = harmony_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (conn->fd < 0 || harmony_connect(conn->fd, addr, url->port) != 0 ||
+        !(download_wait(worker, conn->fd, CONDUIT_SELECT_READ | CONDUIT_SELECT_WRITE) &
+          CONDUIT_SELECT_WRITE_READY)) {
+        return -1;
+    }
+
+    if (url->tls) {
+        conn->session = infinity_tls_connect(conn->fd, url->host);
+        if (!conn->session) {
+            return -1;
+        }
+    }
+
+    DOWNLOAD_STAT(connections, 1);
+    return 0;
+}
+
+// A connection to url's server, kept alive from an earlier request if the
+// pool has one
+static download_conn_t* download_connect(download_worker_t* worker, const download_url_t* url,
+                                         bool* reused) {
+    download_conn_t* conn = download_pool_take(url, reused);
+    if (conn && !*reused && download_open(worker, conn, url) != 0) {
+        download_pool_put(conn, false);
+        return NULL;
+    }
+    return conn;
+}
+
+// =============================================================================
+// HTTP
+// =============================================================================
+
+// Up to len bytes, waiting for some: 0 once the server has closed, -1 if
+// it failed or nothing came in time
+static int download_recv(download_worker_t* worker, download_conn_t* conn, void* buffer,
+                         size_t len) {
+    int result = download_conn_recv(conn, buffer, len);
+    if (result == 0) {
+        if (!download_wait(worker, conn->fd, CONDUIT_SELECT_READ)) {
+            return -1;
+        }
+        result = download_conn_recv(conn, buffer, len);
+    }
+    return result;
+}
+
+static int download_send(download_worker_t* worker, download_conn_t* conn, const char* data,
+                         size_t len) {
+    while (len > 0) {
+        int result = download_conn_send(conn, data, len);
+        if (result < 0) {
+            return -1;
+        }
+        if (result == 0 && !download_wait(worker, conn->fd, CONDUIT_SELECT_WRITE)) {
+            return -1;
+        }
+        data += result;
+        len -= result;
+    }
+    return 0;
+}
+
+// The value of line's header if it's name's, else NULL
+static const char* download_header(const char* line, const char* name) {
+    size_t length = strlen(name);
+    for (size_t i = 0; i < length; i++) {
+        if (tolower((unsigned char)line[i]) != tolower((unsigned char)name[i])) {
+            return NULL;
+        }
+    }
+    if (line[length] != ':') {
+        return NULL;
+    }
+
+    const char* value = line + length + 1;
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    return value;
+}
+
+static bool download_value_is(const char* value, const char* token) {
+    size_t length = strlen(token);
+    for (size_t i = 0; i < length; i++) {
+        if (tolower((unsigned char)value[i]) != token[i]) {
+            return false;
+        }
+    }
+    return value[length] == '\0' || value[length] == ' ' || value[length] == ',';
+}
+
+// Send the request and read the response's head into the worker's buffer
+static int download_request(download_worker_t* worker, download_conn_t* conn,
+                            const download_url_t* url, download_response_t* response) {
+    char* buffer = (char*)worker->buffer;
+    int length = snprintf(buffer, INFINITY_DOWNLOAD_CHUNK,
+                          "GET %s HTTP/1.1\r\n"
+                          "Host: %s\r\n"
+                          "User-Agent: infinity\r\n"
+                          "Connection: keep-alive\r\n"
+                          "\r\n", url->path, url->host);
+    if (length < 0 || length >= INFINITY_DOWNLOAD_CHUNK ||
+        download_send(worker, conn, buffer, length) != 0) {
+        return -1;
+    }
+
+    size_t used = 0;
+    char* end = NULL;
+    while (!end) {
+        if (used == INFINITY_DOWNLOAD_CHUNK - 1) {
+            return -1;
+        }
+        int result = download_recv(worker, conn, buffer + used, INFINITY_DOWNLOAD_CHUNK - 1 - used);
+        if (result <= 0) {
+            return -1;
+        }
+        used += result;
+        buffer[used] = '\0';
+        end = strstr(buffer, "\r\n\r\n");
+    }
+
+    response->head_size = end + 4 - buffer;
+    response->received = used;
+    if (strncmp(buffer, "HTTP/1.", 7) != 0 || !buffer[7] || buffer[8] != ' ') {
+        return -1;
+    }
+    response->status = atoi(buffer + 9);
+    response->keep_alive = buffer[7] != '0';  // HTTP/1.1 keeps alive unless told
+    response->length = -1;
+    response->chunked = false;
+
+    char* line = strstr(buffer, "\r\n") + 2;
+    while (line < end) {
+        char* eol = strstr(line, "\r\n");
+        *eol = '\0';
+
+        const char* value;
+        if ((value = download_header(line, "Content-Length"))) {
+            response->length = strtoll(value, NULL, 10);
+        } else if ((value = download_header(line, "Connection"))) {
+            response->keep_alive = download_value_is(value, "keep-alive");
+        } else if ((value = download_header(line, "Transfer-Encoding"))) {
+            response->chunked = !download_value_is(value, "identity");
+        }
+        line = eol + 2;
+    }
+
+    // A body that runs to the close leaves nothing to reuse
+    if (response->length < 0) {
+        response->keep_alive = false;
+    }
+    return 0;
+}
+
+// Stream the body into fd, hashing it on the way when there's a hash to
+// check it against
+static int download_body(download_worker_t* worker, download_conn_t* conn, download_job_t* job,
+                         const download_response_t* response, int fd, infinity_sha256_t* sha) {
+    const uint8_t* data = worker->buffer + response->head_size;
+    size_t pending = response->received - response->head_size;
+    uint64_t start = temporal_get_time();
+
+    if (response->length >= 0) {
+        job->size = response->length;
+    }
+
+    while (true) {
+        if (pending) {
+            if (response->length >= 0 && job->downloaded + pending > (uint64_t)response->length) {
+                snprintf(job->error, sizeof(job->error), "More data than the server said");
+                return -1;
+            }
+            if (sha) {
+                infinity_sha256_update(sha, data, pending);
+            }
+            if (manifold_write(fd, data, pending) != (ssize_t)pending) {
+                snprintf(job->error, sizeof(job->error), "Failed to write %s", job->dest_path);
+                return -1;
+            }
+            
+            job->downloaded += pending;
+            DOWNLOAD_STAT(bytes, pending);
+            
+            uint64_t elapsed = temporal_get_time() - start;
+            if (elapsed) {
+                job->speed = job->downloaded * 1000000 / elapsed;
+            }
+            if (job->size) {
+                job->progress = (float)job->downloaded * 100 / job->size;
+                job->eta = job->speed ? (job->size - job->downloaded) / job->speed : 0;
+            }
+        }
+
+        if (response->length >= 0 && job->downloaded == (uint64_t)response->length) {
+            return 0;
+        }
+        if (__atomic_load_n(&job->cancelled, __ATOMIC_ACQUIRE)) {
+            snprintf(job->error, sizeof(job->error), "Cancelled");
+            return -1;
+        }
+
+        int result = download_recv(worker, conn, worker->buffer, INFINITY_DOWNLOAD_CHUNK);
+        if (result < 0) {
+            snprintf(job->error, sizeof(job->error), "Timed out");
+            return -1;
+        }
+        if (result == 0) {
+            if (response->length < 0) {
+                return 0;
+            }
+            snprintf(job->error, sizeof(job->error), "Connection closed early");
+            return -1;
+        }
+
+        data = worker->buffer;
+        pending = result;
+    }
+}
+
+// One GET of url into fd. A kept-alive connection the server has closed
+// since gets a fresh one and a second try.
+static int download_fetch(download_worker_t* worker, download_job_t* job,
+                          const download_url_t* url, int fd, infinity_sha256_t* sha) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused;
+        download_conn_t* conn = download_connect(worker, url, &reused);
+        if (!conn) {
+            snprintf(job->error, sizeof(job->error), "Failed to connect to %s", url->host);
+            return -1;
+        }
+
+        download_response_t response;
+        if (download_request(worker, conn, url, &response) != 0) {
+            download_pool_put(conn, false);
+            if (reused) {
+                continue;
+            }
+            snprintf(job->error, sizeof(job->error), "No response from %s", url->host);
+            return -1;
+        }
+        if (reused) {
+            DOWNLOAD_STAT(reused, 1);
+        }
+
+        if (response.status != 200 || response.chunked) {
+            download_pool_put(conn, false);
+            if (response.chunked) {
+                snprintf(job->error, sizeof(job->error), "Chunked response from %s", url->host);
+            } else {
+                snprintf(job->error, sizeof(job->error), "HTTP %d", response.status);
+            }
+            return -1;
+        }
+
+        int result = download_body(worker, conn, job, &response, fd, sha);
+        download_pool_put(conn, result == 0 && response.keep_alive);
+        return result;
+    }
+
+    snprintf(job->error, sizeof(job->error), "No response from %s", url->host);
+    return -1;
+}
+
+// =============================================================================
+// Workers
+// =============================================================================
+
+// Whether path is already there with the given hash
+static bool download_check_file(download_worker_t* worker, const char* path, const uint8_t* hash) {
+    int fd = manifold_open(path, VFS_O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    infinity_sha256_t sha;
+    infinity_sha256_init(&sha);
+    ssize_t result;
+    while ((result = manifold_read(fd, worker->buffer, INFINITY_DOWNLOAD_CHUNK)) > 0) {
+        infinity_sha256_update(&sha, worker->buffer, result);
+    }
+    manifold_close(fd);
+
+    uint8_t actual[32];
+    infinity_sha256_final(&sha, actual);
+    return result == 0 && memcmp(actual, hash, sizeof(actual)) == 0;
+}
+
+// Into dest.part, renamed to dest once it's all there and checks out
+static int download_run(download_worker_t* worker, download_job_t* job) {
+    if (job->verify && download_check_file(worker, job->dest_path, job->expected_hash)) {
+        DOWNLOAD_STAT(cache_hits, 1);
+        job->downloaded = job->size;
+        return 0;
+    }
+
+    download_url_t url;
+    if (download_parse_url(job->url, &url) != 0) {
+        snprintf(job->error, sizeof(job->error), "Unsupported URL");
+        return -1;
+    }
+
+    char partial[sizeof(job->dest_path) + 8];
+    snprintf(partial, sizeof(partial), "%s.part", job->dest_path);
+    int fd = manifold_open(partial, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC, 0644);
+    if (fd < 0) {
+        snprintf(job->error, sizeof(job->error), "Failed to create %s", partial);
+        return -1;
+    }
+
+    infinity_sha256_t sha;
+    infinity_sha256_init(&sha);
+    int result = download_fetch(worker, job, &url, fd, job->verify ? &sha : NULL);
+    manifold_close(fd);
+
+    if (result == 0 && job->verify) {
+        uint8_t hash[32];
+        infinity_sha256_final(&sha, hash);
+        if (memcmp(hash, job->expected_hash, sizeof(hash)) != 0) {
+            snprintf(job->error, sizeof(job->error), "Hash mismatch");
+            DOWNLOAD_STAT(hash_mismatches, 1);
+            result = -1;
+        }
+    }
+
+    if (result == 0 && manifold_rename(partial, job->dest_path) != 0) {
+        snprintf(job->error, sizeof(job->error), "Failed to rename %s", partial);
+        result = -1;
+    }
+    if (result != 0) {
+        manifold_unlink(partial);
+    }
+    return result;
+}
+
+// Last thing done to a job: after it, its submitter may free it
+static void download_finish(download_job_t* job, int result) {
+    job->active = false;
+    DOWNLOAD_STAT(jobs, 1);
+    if (result != 0) {
+        DOWNLOAD_STAT(failures, 1);
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELEASE);
+    } else {
+        job->progress = 100.0f;
+        __atomic_store_n(&job->completed, true, __ATOMIC_RELEASE);
+    }
+}
+
+static void download_worker(void* arg) {
+    download_worker_t* worker = arg;
+
+    while (!__atomic_load_n(&g_downloads.stopping, __ATOMIC_ACQUIRE)) {
+        spinlock_acquire(&g_download_lock);
+        download_job_t* job = g_downloads.head;
+        if (job) {
+            g_downloads.head = job->next;
+            if (!g_downloads.head) {
+                g_downloads.tail = NULL;
+            }
+            job->next = NULL;
+            job->active = true;
+        }
+        spinlock_release(&g_download_lock);
+
+        if (!job) {
+            temporal_sleep(INFINITY_DOWNLOAD_IDLE_POLL);
+            continue;
+        }
+
+        int result = -1;
+        if (__atomic_load_n(&job->cancelled, __ATOMIC_ACQUIRE)) {
+            snprintf(job->error, sizeof(job->error), "Cancelled");
+        } else {
+            result = download_run(worker, job);
+        }
+        download_finish(job, result);
+    }
+
+    __atomic_fetch_sub(&g_downloads.running, 1, __ATOMIC_RELEASE);
+}
+
+// =============================================================================
+// Jobs
+// =============================================================================
+
+download_job_t* infinity_download_submit(const char* url, const char* dest, const uint8_t* hash) {
+    if (!url || !dest || __atomic_load_n(&g_downloads.running, __ATOMIC_ACQUIRE) == 0) {
+        return NULL;
+    }
+
+    download_job_t* job = flux_allocate(NULL, sizeof(download_job_t),
+                                        FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!job) {
+        return NULL;
+    }
+
+    strncpy(job->url, url, sizeof(job->url) - 1);
+    strncpy(job->dest_path, dest, sizeof(job->dest_path) - 1);
+    if (hash) {
+        memcpy(job->expected_hash, hash, sizeof(job->expected_hash));
+        job->verify = true;
+    }
+
+    spinlock_acquire(&g_download_lock);
+    if (g_downloads.tail) {
+        g_downloads.tail->next = job;
+    } else {
+        g_downloads.head = job;
+    }
+    g_downloads.tail = job;
+    spinlock_release(&g_download_lock);
+
+    return job;
+}
+
+bool infinity_download_done(download_job_t* job) {
+    return __atomic_load_n(&job->completed, __ATOMIC_ACQUIRE) ||
+           __atomic_load_n(&job->failed, __ATOMIC_ACQUIRE);
+}
+
+int infinity_download_wait(download_job_t* job) {
+    if (!job) {
+        return -1;
+    }
+
+    while (!infinity_download_done(job)) {
+        temporal_sleep(1000);
+    }
+    return job->completed ? 0 : -1;
+}
+
+void infinity_download_free(download_job_t* job) {
+    if (job) {
+        flux_free(job);
+    }
+}
+
+void infinity_cancel_download(download_job_t* job) {
+    if (job) {
+        __atomic_store_n(&job->cancelled, true, __ATOMIC_RELEASE);
+    }
+}
+
+int infinity_download_file(const char* url, const char* dest) {
+    download_job_t* job = infinity_download_submit(url, dest, NULL);
+    int result = infinity_download_wait(job);
+    infinity_download_free(job);
+    return result;
+}
+
+void infinity_download_cache_path(const package_t* pkg, char* path, size_t size) {
+    const char* name = strrchr(pkg->archive_path, '/');
+    snprintf(path, size, "%s/%s", g_downloads.cache_dir, name ? name + 1 : pkg->archive_path);
+}
+
+// The archive lies under its repository's URL, checked against the hash
+// the index has for it
+download_job_t* infinity_download_package(package_t* pkg) {
+    static const uint8_t unhashed[32];
+    char url[1024];
+    char dest[1024];
+
+    snprintf(url, sizeof(url), "%s/%s", pkg->repo_url, pkg->archive_path);
+    infinity_download_cache_path(pkg, dest, sizeof(dest));
+
+    bool hashed = memcmp(pkg->archive_hash, unhashed, sizeof(unhashed)) != 0;
+    return infinity_download_submit(url, dest, hashed ? pkg->archive_hash : NULL);
+}
+
+void infinity_download_get_stats(infinity_download_stats_t* stats) {
+    if (stats) {
+        memcpy(stats, &g_downloads.stats, sizeof(*stats));
+    }
+}
+
+// =============================================================================
+// Initialization
+// =============================================================================
+
+int infinity_init_downloader(uint32_t workers, const char* cache_dir) {
+    if (workers == 0) {
+        workers = 1;
+    }
+    if (workers > INFINITY_DOWNLOAD_MAX_WORKERS) {
+        workers = INFINITY_DOWNLOAD_MAX_WORKERS;
+    }
+
+    for (uint32_t i = 0; i < INFINITY_DOWNLOAD_MAX_CONNS; i++) {
+        g_downloads.conns[i].fd = -1;
+    }
+    strncpy(g_downloads.cache_dir, cache_dir, sizeof(g_downloads.cache_dir) - 1);
+    g_downloads.stopping = false;
+
+    // Fewer workers than asked for, if that's all there's room for
+    uint32_t started = 0;
+    while (started < workers) {
+        download_worker_t* worker = &g_downloads.workers[started];
+        worker->poll = conduit_poll_create();
+        worker->buffer = flux_allocate(NULL, INFINITY_DOWNLOAD_CHUNK, FLUX_ALLOC_KERNEL);
+
+        __atomic_fetch_add(&g_downloads.running, 1, __ATOMIC_ACQ_REL);
+        if (!worker->poll || !worker->buffer ||
+            !temporal_create_thread(download_worker, worker, PRIORITY_NORMAL)) {
+            __atomic_fetch_sub(&g_downloads.running, 1, __ATOMIC_ACQ_REL);
+            if (worker->poll) {
+                conduit_poll_destroy(worker->poll);
+            }
+            flux_free(worker->buffer);
+            worker->poll = NULL;
+            worker->buffer = NULL;
+            break;
+        }
+        started++;
+    }
+
+    g_downloads.worker_count = started;
+    return started > 0 ? 0 : -1;
+}
+
+// Whatever's still queued fails, what's downloading finishes first
+void infinity_shutdown_downloader(void) {
+    __atomic_store_n(&g_downloads.stopping, true, __ATOMIC_RELEASE);
+
+    spinlock_acquire(&g_download_lock);
+    download_job_t* job = g_downloads.head;
+    g_downloads.head = NULL;
+    g_downloads.tail = NULL;
+    spinlock_release(&g_download_lock);
+
+    while (job) {
+        download_job_t* next = job->next;
+        job->next = NULL;
+        snprintf(job->error, sizeof(job->error), "Downloader stopped");
+        download_finish(job, -1);
+        job = next;
+    }
+
+    while (__atomic_load_n(&g_downloads.running, __ATOMIC_ACQUIRE) > 0) {
+        temporal_sleep(1000);
+    }
+
+    for (uint32_t i = 0; i < g_downloads.worker_count; i++) {
+        conduit_poll_destroy(g_downloads.workers[i].poll);
+        flux_free(g_downloads.workers[i].buffer);
+        g_downloads.workers[i].poll = NULL;
+        g_downloads.workers[i].buffer = NULL;
+    }
+    g_downloads.worker_count = 0;
+
+    for (uint32_t i = 0; i < INFINITY_DOWNLOAD_MAX_CONNS; i++) {
+        download_conn_close(&g_downloads.conns[i]);
+        g_downloads.conns[i].busy = false;
+    }
+}
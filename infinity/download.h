@@ -0,0 +1,79 @@
+/*
+ * Infinity Download Manager
+ * Concurrent downloads over pooled keep-alive connections
+ */
+
+#ifndef DOWNLOAD_H
+#define DOWNLOAD_H
+
+#include "infinity.h"
+
+// =============================================================================
+// Download Constants
+// =============================================================================
+
+#define INFINITY_DOWNLOAD_MAX_WORKERS   16
+#define INFINITY_DOWNLOAD_MAX_CONNS     16          // Pooled across servers, at least one a worker
+#define INFINITY_DOWNLOAD_CHUNK         (64 * 1024) // Read and hashed at a time
+#define INFINITY_DOWNLOAD_TIMEOUT       30000000    // Without progress before failing (microseconds)
+#define INFINITY_DOWNLOAD_IDLE_TIMEOUT  15000000    // A pooled connection is kept idle
+#define INFINITY_DOWNLOAD_IDLE_POLL     2000        // Workers' sleep with nothing queued
+
+// =============================================================================
+// Data Structures
+// =============================================================================
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;                // Bytes so far
+    uint8_t block[64];
+    uint32_t used;                  // Of block
+} infinity_sha256_t;
+
+typedef struct {
+    uint64_t jobs;
+    uint64_t failures;
+    uint64_t bytes;
+    uint64_t cache_hits;            // Already there with the right hash
+    uint64_t hash_mismatches;
+    uint64_t connections;           // Opened
+    uint64_t reused;                // Requests sent on a kept-alive connection
+} infinity_download_stats_t;
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// workers download at once, each on a connection of the pool. Packages
+// are fetched into cache_dir.
+int infinity_init_downloader(uint32_t workers, const char* cache_dir);
+void infinity_shutdown_downloader(void);
+
+// Queue a download of url to dest, checked against hash if not NULL as it
+// arrives; a dest already there with that hash isn't fetched again. The
+// file appears at dest only complete and checked. The caller waits for
+// the job, 0 if it succeeded, and frees it.
+download_job_t* infinity_download_submit(const char* url, const char* dest, const uint8_t* hash);
+bool infinity_download_done(download_job_t* job);
+int infinity_download_wait(download_job_t* job);
+void infinity_download_free(download_job_t* job);
+
+// Where infinity_download_package puts a package's archive
+void infinity_download_cache_path(const package_t* pkg, char* path, size_t size);
+
+void infinity_download_get_stats(infinity_download_stats_t* stats);
+
+// Hashing
+void infinity_sha256_init(infinity_sha256_t* sha);
+void infinity_sha256_update(infinity_sha256_t* sha, const void* data, size_t size);
+void infinity_sha256_final(infinity_sha256_t* sha, uint8_t* hash);
+
+// Transport under the pool: names to addresses, and TLS over a connected
+// socket, returning as the socket calls do
+int infinity_resolve_host(const char* host, uint32_t* addr);
+void* infinity_tls_connect(int fd, const char* host);
+int infinity_tls_send(void* session, const void* data, size_t len);
+int infinity_tls_recv(void* session, void* buffer, size_t len);
+void infinity_tls_close(void* session);
+
+#endif /* DOWNLOAD_H */
@@ -0,0 +1,1275 @@
+/*
+ * Infinity Package Index
+ * Building, mapping and querying the binary package index
+ */
+
+#include "index.h"
+#include "../manifold/manifold.h"
+#include "../continuum/flux_memory.h"
+#include "../continuum/temporal_scheduler.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// =============================================================================
+// Hashing and Tables
+// =============================================================================
+
+// FNV-1a
+static uint32_t index_hash(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Buckets for count entries, a power of two at most half full
+static uint32_t index_table_size(uint32_t count) {
+    uint32_t size = 16;
+    while (size < count * 2) {
+        size *= 2;
+    }
+    return size;
+}
+
+static inline const char* index_string(const infinity_index_t* index, uint32_t offset) {
+    return index->strings + offset;
+}
+
+// =============================================================================
+// Parts
+// =============================================================================
+
+// Make room for needed items of item_size in *items
+static bool part_reserve(infinity_index_part_t* part, void** items, uint32_t* capacity,
+                         uint32_t needed, size_t item_size) {
+    if (needed <= *capacity) {
+        return true;
+    }
+    
+    uint32_t grown = *capacity ? *capacity : 256;
+    while (grown < needed) {
+        grown *= 2;
+    }
+    
+    void* resized = *items ? flux_reallocate(*items, (size_t)grown * item_size)
+                           : flux_allocate(NULL, (size_t)grown * item_size, FLUX_ALLOC_KERNEL);
+    if (!resized) {
+        part->failed = true;
+        return false;
+    }
+    
+    *items = resized;
+    *capacity = grown;
+    return true;
+}
+
+// length bytes of str and a NUL, at the returned offset; 0, the empty
+// string, if there's no room
+static uint32_t part_string(infinity_index_part_t* part, const char* str, size_t length) {
+    size_t needed = part->strings_size + length + 1;
+    if (needed > INFINITY_INDEX_NONE) {
+        part->failed = true;
+        return 0;
+    }
+    
+    if (needed > part->strings_capacity) {
+        size_t grown = part->strings_capacity ? part->strings_capacity : 4096;
+        while (grown < needed) {
+            grown *= 2;
+        }
+        
+        char* resized = part->strings ? flux_reallocate(part->strings, grown)
+                                      : flux_allocate(NULL, grown, FLUX_ALLOC_KERNEL);
+        if (!resized) {
+            part->failed = true;
+            return 0;
+        }
+        part->strings = resized;
+        part->strings_capacity = grown;
+    }
+    
+    uint32_t offset = (uint32_t)part->strings_size;
+    if (length) {
+        memcpy(part->strings + offset, str, length);
+    }
+    part->strings[offset + length] = '\0';
+    part->strings_size = needed;
+    return offset;
+}
+
+// Offset 0 is the empty string, for every field a package lacks
+static void part_init(infinity_index_part_t* part) {
+    memset(part, 0, sizeof(*part));
+    part_string(part, "", 0);
+}
+
+static void part_free(infinity_index_part_t* part) {
+    flux_free(part->packages);
+    flux_free(part->deps);
+    flux_free(part->strings);
+    memset(part, 0, sizeof(*part));
+}
+
+static uint32_t index_package_dep_count(const infinity_index_package_t* pkg) {
+    uint32_t count = 0;
+    for (uint32_t kind = 0; kind < INDEX_DEP_KINDS; kind++) {
+        count += pkg->dep_count[kind];
+    }
+    return count;
+}
+
+// Append src's packages but those with any of skip_flags, rebased onto
+// dest's strings and dependencies
+static void part_append(infinity_index_part_t* dest, const infinity_index_part_t* src,
+                        uint8_t skip_flags) {
+    if (!part_reserve(dest, (void**)&dest->packages, &dest->package_capacity,
+                      dest->package_count + src->package_count, sizeof(infinity_index_package_t)) ||
+        !part_reserve(dest, (void**)&dest->deps, &dest->dep_capacity,
+                      dest->dep_count + src->dep_count, sizeof(infinity_index_dep_t))) {
+        return;
+    }
+    
+    // One copy of all src's strings, the empty one at the start included
+    uint32_t base = part_string(dest, src->strings, src->strings_size - 1);
+    if (dest->failed) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < src->package_count; i++) {
+        const infinity_index_package_t* from = &src->packages[i];
+        if (from->flags & skip_flags) {
+            continue;
+        }
+        
+        infinity_index_package_t* pkg = &dest->packages[dest->package_count++];
+        *pkg = *from;
+        pkg->name += base;
+        pkg->pre_release += base;
+        pkg->description += base;
+        pkg->section += base;
+        pkg->filename += base;
+        pkg->first_dep = dest->dep_count;
+        
+        uint32_t deps = index_package_dep_count(from);
+        for (uint32_t d = 0; d < deps; d++) {
+            infinity_index_dep_t* dep = &dest->deps[dest->dep_count++];
+            *dep = src->deps[from->first_dep + d];
+            dep->name += base;
+            dep->constraint += base;
+        }
+    }
+}
+
+// =============================================================================
+// Package List Parsing
+// =============================================================================
+
+// The control fields the index keeps
+enum {
+    FIELD_PACKAGE,
+    FIELD_VERSION,
+    FIELD_DESCRIPTION,
+    FIELD_SECTION,
+    FIELD_PRIORITY,
+    FIELD_INSTALLED_SIZE,
+    FIELD_SIZE,
+    FIELD_FILENAME,
+    FIELD_SHA256,
+    FIELD_DEPENDS,
+    FIELD_PRE_DEPENDS,
+    FIELD_RECOMMENDS,
+    FIELD_CONFLICTS,
+    FIELD_BREAKS,
+    FIELD_PROVIDES,
+    FIELD_STATUS,
+    FIELD_COUNT
+};
+
+static const char* const g_index_fields[FIELD_COUNT] = {
+    "Package", "Version", "Description", "Section", "Priority", "Installed-Size",
+    "Size", "Filename", "SHA256", "Depends", "Pre-Depends", "Recommends",
+    "Conflicts", "Breaks", "Provides", "Status"
+};
+
+typedef struct {
+    const char* text;
+    size_t length;
+} index_span_t;
+
+static int index_field(const char* name, size_t length) {
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        if (strlen(g_index_fields[i]) == length && memcmp(g_index_fields[i], name, length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void index_span_trim(index_span_t* span) {
+    while (span->length && (span->text[0] == ' ' || span->text[0] == '\t')) {
+        span->text++;
+        span->length--;
+    }
+    while (span->length && (span->text[span->length - 1] == ' ' ||
+                            span->text[span->length - 1] == '\t' ||
+                            span->text[span->length - 1] == '\r')) {
+        span->length--;
+    }
+}
+
+static void index_span_copy(char* dest, size_t size, const index_span_t* span) {
+    size_t length = span->length < size - 1 ? span->length : size - 1;
+    if (length) {
+        memcpy(dest, span->text, length);
+    }
+    dest[length] = '\0';
+}
+
+static uint64_t index_span_number(const index_span_t* span) {
+    char number[32];
+    index_span_copy(number, sizeof(number), span);
+    return strtoull(number, NULL, 10);
+}
+
+static bool index_span_is(const index_span_t* span, const char* str) {
+    return span->length == strlen(str) && memcmp(span->text, str, span->length) == 0;
+}
+
+static uint8_t index_priority(const index_span_t* span) {
+    if (index_span_is(span, "required")) {
+        return PKG_PRIORITY_REQUIRED;
+    }
+    if (index_span_is(span, "important")) {
+        return PKG_PRIORITY_IMPORTANT;
+    }
+    if (index_span_is(span, "standard")) {
+        return PKG_PRIORITY_STANDARD;
+    }
+    if (index_span_is(span, "extra")) {
+        return PKG_PRIORITY_EXTRA;
+    }
+    return PKG_PRIORITY_OPTIONAL;
+}
+
+static void index_parse_hash(uint8_t* hash, const index_span_t* span) {
+    memset(hash, 0, 32);
+    for (size_t i = 0; i + 1 < span->length && i / 2 < 32; i += 2) {
+        char byte[3] = { span->text[i], span->text[i + 1], '\0' };
+        hash[i / 2] = (uint8_t)strtoul(byte, NULL, 16);
+    }
+}
+
+// A "a (>= 1.0), b | c, d:any" list: each entry's first alternative, the
+// only one pkg_dependency_t has room for. Returns the dependencies added.
+static uint16_t part_add_deps(infinity_index_part_t* part, const index_span_t* list,
+                              uint32_t flags) {
+    uint16_t count = 0;
+    const char* p = list->text;
+    const char* end = list->text + list->length;
+    
+    while (p < end && count < UINT16_MAX) {
+        const char* comma = memchr(p, ',', end - p);
+        if (!comma) {
+            comma = end;
+        }
+        const char* alternative = memchr(p, '|', comma - p);
+        if (!alternative) {
+            alternative = comma;
+        }
+        
+        index_span_t name = { p, 0 };
+        while (name.text < alternative && (*name.text == ' ' || *name.text == '\t')) {
+            name.text++;
+        }
+        while (name.text + name.length < alternative &&
+               !strchr(" \t(:", name.text[name.length])) {
+            name.length++;
+        }
+        
+        index_span_t constraint = { NULL, 0 };
+        const char* open = memchr(name.text, '(', alternative - name.text);
+        if (open) {
+            const char* close = memchr(open, ')', alternative - open);
+            constraint = (index_span_t){ open + 1, (close ? close : alternative) - open - 1 };
+            index_span_trim(&constraint);
+        }
+        
+        if (name.length &&
+            part_reserve(part, (void**)&part->deps, &part->dep_capacity, part->dep_count + 1,
+                         sizeof(infinity_index_dep_t))) {
+            infinity_index_dep_t* dep = &part->deps[part->dep_count++];
+            dep->name = part_string(part, name.text, name.length);
+            dep->constraint = constraint.length ? part_string(part, constraint.text,
+                                                              constraint.length) : 0;
+            dep->flags = flags;
+            count++;
+        }
+        
+        p = comma + 1;
+    }
+    
+    return count;
+}
+
+static void part_add_package(infinity_index_part_t* part, const index_span_t* fields) {
+    if (!part_reserve(part, (void**)&part->packages, &part->package_capacity,
+                      part->package_count + 1, sizeof(infinity_index_package_t))) {
+        return;
+    }
+    
+    infinity_index_package_t pkg = { 0 };
+    const index_span_t* name = &fields[FIELD_PACKAGE];
+    pkg.name = part_string(part, name->text, name->length);
+    pkg.name_hash = index_hash(name->text, name->length);
+    pkg.next_version = INFINITY_INDEX_NONE;
+    
+    char version_text[INFINITY_MAX_VERSION_LEN];
+    index_span_copy(version_text, sizeof(version_text), &fields[FIELD_VERSION]);
+    pkg_version_t version = { 0 };
+    infinity_parse_version(version_text, &version);
+    pkg.major = version.major;
+    pkg.minor = version.minor;
+    pkg.patch = version.patch;
+    pkg.pre_release = part_string(part, version.pre_release, strlen(version.pre_release));
+    
+    pkg.description = part_string(part, fields[FIELD_DESCRIPTION].text,
+                                  fields[FIELD_DESCRIPTION].length);
+    pkg.section = part_string(part, fields[FIELD_SECTION].text, fields[FIELD_SECTION].length);
+    pkg.filename = part_string(part, fields[FIELD_FILENAME].text, fields[FIELD_FILENAME].length);
+    pkg.priority = index_priority(&fields[FIELD_PRIORITY]);
+    pkg.installed_size = index_span_number(&fields[FIELD_INSTALLED_SIZE]) * 1024;  // KB
+    pkg.download_size = index_span_number(&fields[FIELD_SIZE]);
+    index_parse_hash(pkg.hash, &fields[FIELD_SHA256]);
+    if (index_span_is(&fields[FIELD_STATUS], "removed")) {
+        pkg.flags |= INDEX_PKG_REMOVED;
+    }
+    
+    pkg.first_dep = part->dep_count;
+    pkg.dep_count[INDEX_DEP_DEPENDS] = part_add_deps(part, &fields[FIELD_PRE_DEPENDS], 0) +
+                                       part_add_deps(part, &fields[FIELD_DEPENDS], 0);
+    pkg.dep_count[INDEX_DEP_RECOMMENDS] = part_add_deps(part, &fields[FIELD_RECOMMENDS],
+                                                        INDEX_DEP_OPTIONAL);
+    pkg.dep_count[INDEX_DEP_CONFLICTS] = part_add_deps(part, &fields[FIELD_CONFLICTS], 0) +
+                                         part_add_deps(part, &fields[FIELD_BREAKS], 0);
+    pkg.dep_count[INDEX_DEP_PROVIDES] = part_add_deps(part, &fields[FIELD_PROVIDES], 0);
+    
+    part->packages[part->package_count++] = pkg;
+}
+
+// Stanzas of "Field: value" lines, blank lines between them
+static int part_parse(infinity_index_part_t* part, const char* text, size_t size) {
+    const char* p = text;
+    const char* end = text + size;
+    
+    while (p < end && !part->failed) {
+        index_span_t fields[FIELD_COUNT] = { 0 };
+        
+        while (p < end && *p != '\n') {
+            const char* line = p;
+            const char* eol = memchr(p, '\n', end - p);
+            if (!eol) {
+                eol = end;
+            }
+            p = eol < end ? eol + 1 : end;
+            
+            // Continuation lines, a long description's, aren't kept
+            if (*line == ' ' || *line == '\t') {
+                continue;
+            }
+            
+            const char* colon = memchr(line, ':', eol - line);
+            if (!colon) {
+                continue;
+            }
+            int field = index_field(line, colon - line);
+            if (field >= 0) {
+                fields[field] = (index_span_t){ colon + 1, eol - colon - 1 };
+                index_span_trim(&fields[field]);
+            }
+        }
+        
+        while (p < end && (*p == '\n' || *p == '\r')) {
+            p++;
+        }
+        
+        if (fields[FIELD_PACKAGE].length) {
+            part_add_package(part, fields);
+        }
+    }
+    
+    return part->failed ? -1 : 0;
+}
+
+typedef struct {
+    infinity_index_part_t part;
+    const char* text;
+    size_t size;
+    int result;
+    uint32_t* done;
+} index_parse_job_t;
+
+static void index_parse_worker(void* arg) {
+    index_parse_job_t* job = arg;
+    job->result = part_parse(&job->part, job->text, job->size);
+    __atomic_fetch_add(job->done, 1, __ATOMIC_RELEASE);
+}
+
+// Where the stanza that pos is in ends
+static const char* index_stanza_end(const char* pos, const char* end) {
+    while (pos + 1 < end && !(pos[0] == '\n' && pos[1] == '\n')) {
+        pos++;
+    }
+    return pos + 1 < end ? pos + 2 : end;
+}
+
+// Parse a whole list into part, cut at stanza boundaries into a chunk for
+// each thread where it's long enough to be worth one. The caller's thread
+// parses a chunk too; the parts join in the list's order.
+static int index_parse_parallel(infinity_index_part_t* part, const char* text, size_t size) {
+    uint32_t threads = continuum_get_cpu_count();
+    if (threads > INFINITY_INDEX_MAX_THREADS) {
+        threads = INFINITY_INDEX_MAX_THREADS;
+    }
+    if (threads > size / INFINITY_INDEX_MIN_CHUNK) {
+        threads = size / INFINITY_INDEX_MIN_CHUNK;
+    }
+    if (threads <= 1) {
+        return part_parse(part, text, size);
+    }
+    
+    index_parse_job_t jobs[INFINITY_INDEX_MAX_THREADS];
+    uint32_t done = 0;
+    const char* start = text;
+    const char* end = text + size;
+    
+    for (uint32_t i = 0; i < threads; i++) {
+        const char* stop = i == threads - 1
+                           ? end : index_stanza_end(text + size * (i + 1) / threads, end);
+        if (stop < start) {
+            stop = start;
+        }
+        
+        part_init(&jobs[i].part);
+        jobs[i].text = start;
+        jobs[i].size = stop - start;
+        jobs[i].result = 0;
+        jobs[i].done = &done;
+        start = stop;
+    }
+    
+    // A thread that can't be had is parsed for here
+    for (uint32_t i = 1; i < threads; i++) {
+        if (!temporal_create_thread(index_parse_worker, &jobs[i], PRIORITY_NORMAL)) {
+            index_parse_worker(&jobs[i]);
+        }
+    }
+    index_parse_worker(&jobs[0]);
+    
+    while (__atomic_load_n(&done, __ATOMIC_ACQUIRE) < threads) {
+        temporal_sleep(1000);
+    }
+    
+    int result = 0;
+    for (uint32_t i = 0; i < threads; i++) {
+        if (jobs[i].result != 0) {
+            result = -1;
+        } else if (result == 0) {
+            part_append(part, &jobs[i].part, 0);
+        }
+        part_free(&jobs[i].part);
+    }
+    
+    return result == 0 && !part->failed ? 0 : -1;
+}
+
+// =============================================================================
+// Mapping
+// =============================================================================
+
+static bool index_section_ok(const infinity_index_t* index, uint64_t offset, uint64_t count,
+                             size_t item_size) {
+    return offset <= index->size && count <= (index->size - offset) / item_size &&
+           offset % 8 == 0;
+}
+
+// Every offset and index in bounds, so lookups needn't check
+static bool index_validate(infinity_index_t* index) {
+    const infinity_index_header_t* header = index->base;
+    
+    if (header->magic != INFINITY_INDEX_MAGIC || header->version != INFINITY_INDEX_VERSION ||
+        header->size != index->size) {
+        return false;
+    }
+    
+    if (!index_section_ok(index, header->repos_offset, header->repo_count,
+                          sizeof(infinity_index_repo_t)) ||
+        !index_section_ok(index, header->packages_offset, header->package_count,
+                          sizeof(infinity_index_package_t)) ||
+        !index_section_ok(index, header->deps_offset, header->dep_count,
+                          sizeof(infinity_index_dep_t)) ||
+        !index_section_ok(index, header->provides_offset, header->provide_count,
+                          sizeof(infinity_index_provide_t)) ||
+        !index_section_ok(index, header->buckets_offset, header->bucket_count,
+                          sizeof(uint32_t)) ||
+        !index_section_ok(index, header->provide_buckets_offset, header->provide_bucket_count,
+                          sizeof(uint32_t)) ||
+        !index_section_ok(index, header->strings_offset, header->strings_size, 1)) {
+        return false;
+    }
+    
+    // Buckets at most half full, so a probe always ends
+    if (header->bucket_count < 2 * header->package_count ||
+        (header->bucket_count & (header->bucket_count - 1)) ||
+        header->provide_bucket_count == 0 ||
+        (header->provide_bucket_count & (header->provide_bucket_count - 1)) ||
+        header->strings_size == 0) {
+        return false;
+    }
+    
+    const uint8_t* base = index->base;
+    index->header = header;
+    index->repos = (const infinity_index_repo_t*)(base + header->repos_offset);
+    index->packages = (const infinity_index_package_t*)(base + header->packages_offset);
+    index->deps = (const infinity_index_dep_t*)(base + header->deps_offset);
+    index->provides = (const infinity_index_provide_t*)(base + header->provides_offset);
+    index->buckets = (const uint32_t*)(base + header->buckets_offset);
+    index->provide_buckets = (const uint32_t*)(base + header->provide_buckets_offset);
+    index->strings = (const char*)(base + header->strings_offset);
+    
+    uint64_t strings = header->strings_size;
+    if (index->strings[strings - 1] != '\0') {
+        return false;
+    }
+    
+    for (uint32_t i = 0; i < header->repo_count; i++) {
+        const infinity_index_repo_t* repo = &index->repos[i];
+        if (repo->name >= strings || repo->first_package > header->package_count ||
+            repo->package_count > header->package_count - repo->first_package) {
+            return false;
+        }
+    }
+    
+    for (uint32_t i = 0; i < header->package_count; i++) {
+        const infinity_index_package_t* pkg = &index->packages[i];
+        if (pkg->name >= strings || pkg->pre_release >= strings ||
+            pkg->description >= strings || pkg->section >= strings ||
+            pkg->filename >= strings || pkg->repo >= header->repo_count ||
+            (pkg->next_version != INFINITY_INDEX_NONE &&
+             pkg->next_version >= header->package_count) ||
+            pkg->first_dep > header->dep_count ||
+            index_package_dep_count(pkg) > header->dep_count - pkg->first_dep) {
+            return false;
+        }
+    }
+    
+    for (uint32_t i = 0; i < header->dep_count; i++) {
+        if (index->deps[i].name >= strings || index->deps[i].constraint >= strings) {
+            return false;
+        }
+    }
+    
+    for (uint32_t i = 0; i < header->provide_count; i++) {
+        const infinity_index_provide_t* provide = &index->provides[i];
+        if (provide->name >= strings || provide->package >= header->package_count ||
+            (provide->next != INFINITY_INDEX_NONE && provide->next >= header->provide_count)) {
+            return false;
+        }
+    }
+    
+    for (uint32_t i = 0; i < header->bucket_count; i++) {
+        if (index->buckets[i] != INFINITY_INDEX_NONE &&
+            index->buckets[i] >= header->package_count) {
+            return false;
+        }
+    }
+    
+    for (uint32_t i = 0; i < header->provide_bucket_count; i++) {
+        if (index->provide_buckets[i] != INFINITY_INDEX_NONE &&
+            index->provide_buckets[i] >= header->provide_count) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+int infinity_index_open(infinity_index_t* index, const char* path) {
+    memset(index, 0, sizeof(*index));
+    
+    int fd = manifold_open(path, VFS_O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    vfs_stat_t stat;
+    if (manifold_fstat(fd, &stat) != 0 || stat.size < sizeof(infinity_index_header_t)) {
+        manifold_close(fd);
+        return -1;
+    }
+    
+    // The mapping outlives the descriptor
+    void* base = mmap(NULL, stat.size, PROT_READ, MAP_SHARED, fd, 0);
+    manifold_close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    
+    index->base = base;
+    index->size = stat.size;
+    if (!index_validate(index)) {
+        infinity_index_close(index);
+        return -1;
+    }
+    
+    if (index->header->package_count > 0) {
+        index->loaded = flux_allocate(NULL, index->header->package_count * sizeof(package_t*),
+                                      FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+        if (!index->loaded) {
+            infinity_index_close(index);
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+// Packages still only available go with the index; installed ones are
+// the installed list's now
+void infinity_index_close(infinity_index_t* index) {
+    if (index->loaded) {
+        for (uint32_t i = 0; i < index->header->package_count; i++) {
+            if (index->loaded[i] && index->loaded[i]->state == PKG_STATE_AVAILABLE) {
+                infinity_free_package(index->loaded[i]);
+            }
+        }
+        flux_free(index->loaded);
+    }
+    
+    if (index->base) {
+        munmap(index->base, index->size);
+    }
+    
+    memset(index, 0, sizeof(*index));
+}
+
+// =============================================================================
+// Queries
+// =============================================================================
+
+const infinity_index_package_t* infinity_index_lookup(const infinity_index_t* index,
+                                                      const char* name) {
+    if (!index->header || !name) {
+        return NULL;
+    }
+    
+    uint32_t hash = index_hash(name, strlen(name));
+    uint32_t mask = index->header->bucket_count - 1;
+    
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        uint32_t slot = index->buckets[i];
+        if (slot == INFINITY_INDEX_NONE) {
+            return NULL;
+        }
+        
+        const infinity_index_package_t* pkg = &index->packages[slot];
+        if (pkg->name_hash == hash && strcmp(index_string(index, pkg->name), name) == 0) {
+            return pkg;
+        }
+    }
+}
+
+const infinity_index_package_t* infinity_index_next_version(const infinity_index_t* index,
+                                                            const infinity_index_package_t* pkg) {
+    return pkg->next_version == INFINITY_INDEX_NONE ? NULL : &index->packages[pkg->next_version];
+}
+
+uint32_t infinity_index_hash(const char* name) {
+    return index_hash(name, strlen(name));
+}
+
+void infinity_index_version(const infinity_index_t* index, const infinity_index_package_t* pkg,
+                            pkg_version_t* version) {
+    memset(version, 0, sizeof(*version));
+    version->major = pkg->major;
+    version->minor = pkg->minor;
+    version->patch = pkg->patch;
+    strncpy(version->pre_release, index_string(index, pkg->pre_release),
+            sizeof(version->pre_release) - 1);
+}
+
+package_t* infinity_index_find(infinity_index_t* index, const char* name,
+                               const char* constraint) {
+    const infinity_index_package_t* pkg = infinity_index_lookup(index, name);
+    
+    for (; pkg; pkg = infinity_index_next_version(index, pkg)) {
+        if (!constraint || !constraint[0]) {
+            return infinity_index_package(index, pkg);
+        }
+        
+        pkg_version_t version;
+        infinity_index_version(index, pkg, &version);
+        if (infinity_version_satisfies(&version, constraint)) {
+            return infinity_index_package(index, pkg);
+        }
+    }
+    
+    return NULL;
+}
+
+// The provides of name from slot on down its bucket's chain
+static const infinity_index_provide_t* index_provide_from(const infinity_index_t* index,
+                                                          uint32_t slot, const char* name,
+                                                          uint32_t hash) {
+    while (slot != INFINITY_INDEX_NONE) {
+        const infinity_index_provide_t* provide = &index->provides[slot];
+        if (provide->name_hash == hash && strcmp(index_string(index, provide->name), name) == 0) {
+            return provide;
+        }
+        slot = provide->next;
+    }
+    return NULL;
+}
+
+const infinity_index_provide_t* infinity_index_first_provide(const infinity_index_t* index,
+                                                             const char* name) {
+    if (!index->header || !name) {
+        return NULL;
+    }
+    
+    uint32_t hash = index_hash(name, strlen(name));
+    uint32_t mask = index->header->provide_bucket_count - 1;
+    return index_provide_from(index, index->provide_buckets[hash & mask], name, hash);
+}
+
+const infinity_index_provide_t* infinity_index_next_provide(const infinity_index_t* index,
+                                                            const infinity_index_provide_t* provide) {
+    return index_provide_from(index, provide->next, index_string(index, provide->name),
+                              provide->name_hash);
+}
+
+package_t* infinity_index_find_provider(infinity_index_t* index, const char* name) {
+    const infinity_index_provide_t* provide = infinity_index_first_provide(index, name);
+    return provide ? infinity_index_package(index, &index->packages[provide->package]) : NULL;
+}
+
+// A kind of pkg's dependencies as pkg_dependency_t
+static void index_load_deps(const infinity_index_t* index, const infinity_index_package_t* pkg,
+                            uint32_t kind, pkg_dependency_t** deps, uint32_t* count) {
+    uint32_t first = pkg->first_dep;
+    for (uint32_t k = 0; k < kind; k++) {
+        first += pkg->dep_count[k];
+    }
+    
+    *deps = NULL;
+    *count = 0;
+    if (pkg->dep_count[kind] == 0) {
+        return;
+    }
+    
+    *deps = flux_allocate(NULL, pkg->dep_count[kind] * sizeof(pkg_dependency_t),
+                          FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!*deps) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < pkg->dep_count[kind]; i++) {
+        const infinity_index_dep_t* dep = &index->deps[first + i];
+        pkg_dependency_t* out = &(*deps)[i];
+        strncpy(out->name, index_string(index, dep->name), sizeof(out->name) - 1);
+        strncpy(out->version_constraint, index_string(index, dep->constraint),
+                sizeof(out->version_constraint) - 1);
+        out->optional = dep->flags & INDEX_DEP_OPTIONAL;
+    }
+    *count = pkg->dep_count[kind];
+}
+
+// The package_t for an index entry, made the first time it's asked for
+package_t* infinity_index_package(infinity_index_t* index, const infinity_index_package_t* pkg) {
+    uint32_t i = (uint32_t)(pkg - index->packages);
+    if (index->loaded[i]) {
+        return index->loaded[i];
+    }
+    
+    package_t* package = flux_allocate(NULL, sizeof(package_t),
+                                       FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!package) {
+        return NULL;
+    }
+    
+    pkg_metadata_t* metadata = &package->metadata;
+    strncpy(metadata->name, index_string(index, pkg->name), sizeof(metadata->name) - 1);
+    infinity_index_version(index, pkg, &metadata->version);
+    strncpy(metadata->description, index_string(index, pkg->description),
+            sizeof(metadata->description) - 1);
+    strncpy(metadata->section, index_string(index, pkg->section), sizeof(metadata->section) - 1);
+    metadata->priority = pkg->priority;
+    metadata->installed_size = pkg->installed_size;
+    metadata->download_size = pkg->download_size;
+    
+    index_load_deps(index, pkg, INDEX_DEP_DEPENDS, &metadata->depends, &metadata->depend_count);
+    index_load_deps(index, pkg, INDEX_DEP_RECOMMENDS, &metadata->recommends,
+                    &metadata->recommend_count);
+    index_load_deps(index, pkg, INDEX_DEP_CONFLICTS, &metadata->conflicts,
+                    &metadata->conflict_count);
+    index_load_deps(index, pkg, INDEX_DEP_PROVIDES, &metadata->provides,
+                    &metadata->provide_count);
+    
+    // The archive's path is under the repository's URL until downloaded
+    package->state = PKG_STATE_AVAILABLE;
+    strncpy(package->archive_path, index_string(index, pkg->filename),
+            sizeof(package->archive_path) - 1);
+    memcpy(package->archive_hash, pkg->hash, sizeof(package->archive_hash));
+    strncpy(package->repo_name, index_string(index, index->repos[pkg->repo].name),
+            sizeof(package->repo_name) - 1);
+    
+    index->loaded[i] = package;
+    return package;
+}
+
+static int index_find_repo(const infinity_index_t* index, const char* repo) {
+    if (!index || !index->header) {
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < index->header->repo_count; i++) {
+        if (strcmp(index_string(index, index->repos[i].name), repo) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 0 if the index has nothing from repo
+uint64_t infinity_index_repo_serial(const infinity_index_t* index, const char* repo) {
+    int i = index_find_repo(index, repo);
+    return i < 0 ? 0 : index->repos[i].serial;
+}
+
+// =============================================================================
+// Updates
+// =============================================================================
+
+// Same name and version
+static bool index_same_package(const char* name_a, const infinity_index_package_t* a,
+                               const char* pre_a, const char* name_b,
+                               const infinity_index_package_t* b, const char* pre_b) {
+    return a->name_hash == b->name_hash && a->major == b->major && a->minor == b->minor &&
+           a->patch == b->patch && strcmp(name_a, name_b) == 0 && strcmp(pre_a, pre_b) == 0;
+}
+
+// Copy repo's packages from the index into part, but those delta has a
+// stanza for
+static void part_from_index(infinity_index_part_t* part, const infinity_index_t* index,
+                            uint32_t repo, const infinity_index_part_t* delta) {
+    // The delta's packages by name, to look up each of the index's
+    uint32_t* slots = NULL;
+    uint32_t mask = 0;
+    if (delta && delta->package_count) {
+        uint32_t size = index_table_size(delta->package_count);
+        slots = flux_allocate(NULL, size * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+        if (!slots) {
+            part->failed = true;
+            return;
+        }
+        memset(slots, 0xFF, size * sizeof(uint32_t));
+        mask = size - 1;
+        
+        for (uint32_t i = 0; i < delta->package_count; i++) {
+            uint32_t s = delta->packages[i].name_hash & mask;
+            while (slots[s] != INFINITY_INDEX_NONE) {
+                s = (s + 1) & mask;
+            }
+            slots[s] = i;
+        }
+    }
+    
+    const infinity_index_repo_t* from = &index->repos[repo];
+    for (uint32_t i = 0; i < from->package_count && !part->failed; i++) {
+        const infinity_index_package_t* pkg = &index->packages[from->first_package + i];
+        const char* name = index_string(index, pkg->name);
+        const char* pre = index_string(index, pkg->pre_release);
+        
+        bool replaced = false;
+        for (uint32_t s = pkg->name_hash & mask; slots && slots[s] != INFINITY_INDEX_NONE;
+             s = (s + 1) & mask) {
+            const infinity_index_package_t* other = &delta->packages[slots[s]];
+            if (index_same_package(name, pkg, pre, delta->strings + other->name, other,
+                                   delta->strings + other->pre_release)) {
+                replaced = true;
+                break;
+            }
+        }
+        if (replaced) {
+            continue;
+        }
+        
+        uint32_t deps = index_package_dep_count(pkg);
+        if (!part_reserve(part, (void**)&part->packages, &part->package_capacity,
+                          part->package_count + 1, sizeof(infinity_index_package_t)) ||
+            !part_reserve(part, (void**)&part->deps, &part->dep_capacity,
+                          part->dep_count + deps, sizeof(infinity_index_dep_t))) {
+            break;
+        }
+        
+        infinity_index_package_t copy = *pkg;
+        copy.name = part_string(part, name, strlen(name));
+        copy.pre_release = part_string(part, pre, strlen(pre));
+        copy.description = part_string(part, index_string(index, pkg->description),
+                                       strlen(index_string(index, pkg->description)));
+        copy.section = part_string(part, index_string(index, pkg->section),
+                                   strlen(index_string(index, pkg->section)));
+        copy.filename = part_string(part, index_string(index, pkg->filename),
+                                    strlen(index_string(index, pkg->filename)));
+        copy.first_dep = part->dep_count;
+        copy.next_version = INFINITY_INDEX_NONE;
+        copy.repo = 0;
+        
+        for (uint32_t d = 0; d < deps; d++) {
+            const infinity_index_dep_t* dep = &index->deps[pkg->first_dep + d];
+            const char* dep_name = index_string(index, dep->name);
+            const char* constraint = index_string(index, dep->constraint);
+            
+            infinity_index_dep_t* out = &part->deps[part->dep_count++];
+            out->name = part_string(part, dep_name, strlen(dep_name));
+            out->constraint = constraint[0] ? part_string(part, constraint, strlen(constraint)) : 0;
+            out->flags = dep->flags;
+        }
+        
+        part->packages[part->package_count++] = copy;
+    }
+    
+    flux_free(slots);
+}
+
+void infinity_index_begin_update(infinity_index_update_t* update, const infinity_index_t* index) {
+    memset(update, 0, sizeof(*update));
+    update->index = index;
+}
+
+// repo's place in the update, emptied
+static infinity_index_part_t* index_update_slot(infinity_index_update_t* update,
+                                                const char* repo, uint32_t priority,
+                                                uint64_t serial) {
+    uint32_t i;
+    for (i = 0; i < update->repo_count; i++) {
+        if (strcmp(update->repos[i].name, repo) == 0) {
+            part_free(&update->repos[i].part);
+            break;
+        }
+    }
+    if (i == update->repo_count) {
+        if (update->repo_count == INFINITY_MAX_REPOS) {
+            return NULL;
+        }
+        update->repo_count++;
+        strncpy(update->repos[i].name, repo, sizeof(update->repos[i].name) - 1);
+    }
+    
+    update->repos[i].priority = priority;
+    update->repos[i].serial = serial;
+    part_init(&update->repos[i].part);
+    return &update->repos[i].part;
+}
+
+int infinity_index_update_full(infinity_index_update_t* update, const repository_t* repo,
+                               uint64_t serial, const char* text, size_t size) {
+    infinity_index_part_t* part = index_update_slot(update, repo->name, repo->priority, serial);
+    if (!part) {
+        return -1;
+    }
+    
+    return index_parse_parallel(part, text, size);
+}
+
+int infinity_index_update_delta(infinity_index_update_t* update, const repository_t* repo,
+                                uint64_t serial, const char* text, size_t size) {
+    int from = index_find_repo(update->index, repo->name);
+    if (from < 0) {
+        return -1;
+    }
+    
+    infinity_index_part_t delta;
+    part_init(&delta);
+    if (part_parse(&delta, text, size) != 0) {
+        part_free(&delta);
+        return -1;
+    }
+    
+    infinity_index_part_t* part = index_update_slot(update, repo->name, repo->priority, serial);
+    if (part) {
+        part_from_index(part, update->index, from, &delta);
+        part_append(part, &delta, INDEX_PKG_REMOVED);
+    }
+    part_free(&delta);
+    
+    return part && !part->failed ? 0 : -1;
+}
+
+int infinity_index_update_keep(infinity_index_update_t* update, const char* repo) {
+    int from = index_find_repo(update->index, repo);
+    if (from < 0) {
+        return -1;
+    }
+    
+    const infinity_index_repo_t* kept = &update->index->repos[from];
+    infinity_index_part_t* part = index_update_slot(update, repo, kept->priority, kept->serial);
+    if (!part) {
+        return -1;
+    }
+    
+    part_from_index(part, update->index, from, NULL);
+    return part->failed ? -1 : 0;
+}
+
+void infinity_index_abort_update(infinity_index_update_t* update) {
+    for (uint32_t i = 0; i < update->repo_count; i++) {
+        part_free(&update->repos[i].part);
+    }
+    update->repo_count = 0;
+}
+
+// Sorting context: updates are committed one at a time
+static const infinity_index_part_t* g_sort_part;
+static const infinity_index_repo_t* g_sort_repos;
+
+static int index_compare_versions(const infinity_index_part_t* part,
+                                  const infinity_index_package_t* a,
+                                  const infinity_index_package_t* b) {
+    if (a->major != b->major) {
+        return a->major < b->major ? -1 : 1;
+    }
+    if (a->minor != b->minor) {
+        return a->minor < b->minor ? -1 : 1;
+    }
+    if (a->patch != b->patch) {
+        return a->patch < b->patch ? -1 : 1;
+    }
+    
+    // A pre-release comes before its release
+    const char* pre_a = part->strings + a->pre_release;
+    const char* pre_b = part->strings + b->pre_release;
+    if (!pre_a[0] || !pre_b[0]) {
+        return !pre_a[0] - !pre_b[0];
+    }
+    return strcmp(pre_a, pre_b);
+}
+
+// Names together, each's best version first, a higher priority
+// repository's first between equal versions
+static int index_compare_packages(const void* x, const void* y) {
+    const infinity_index_package_t* a = &g_sort_part->packages[*(const uint32_t*)x];
+    const infinity_index_package_t* b = &g_sort_part->packages[*(const uint32_t*)y];
+    
+    if (a->name_hash != b->name_hash) {
+        return a->name_hash < b->name_hash ? -1 : 1;
+    }
+    int names = strcmp(g_sort_part->strings + a->name, g_sort_part->strings + b->name);
+    if (names != 0) {
+        return names;
+    }
+    
+    int versions = index_compare_versions(g_sort_part, a, b);
+    if (versions != 0) {
+        return -versions;
+    }
+    
+    uint32_t priority_a = g_sort_repos[a->repo].priority;
+    uint32_t priority_b = g_sort_repos[b->repo].priority;
+    return priority_a == priority_b ? 0 : (priority_a > priority_b ? -1 : 1);
+}
+
+// Write size bytes of data at offset, padding from pos up to it
+static bool index_write_section(int fd, uint64_t* pos, uint64_t offset, const void* data,
+                                size_t size) {
+    static const uint8_t zeros[8];
+    
+    while (*pos < offset) {
+        size_t pad = offset - *pos < sizeof(zeros) ? offset - *pos : sizeof(zeros);
+        if (manifold_write(fd, zeros, pad) != (ssize_t)pad) {
+            return false;
+        }
+        *pos += pad;
+    }
+    
+    if (size && manifold_write(fd, data, size) != (ssize_t)size) {
+        return false;
+    }
+    *pos += size;
+    return true;
+}
+
+static inline uint64_t index_align(uint64_t offset) {
+    return (offset + 7) & ~7ULL;
+}
+
+int infinity_index_commit_update(infinity_index_update_t* update, const char* path) {
+    infinity_index_part_t all;
+    infinity_index_repo_t repos[INFINITY_MAX_REPOS];
+    uint32_t* order = NULL;
+    uint32_t* buckets = NULL;
+    uint32_t* provide_buckets = NULL;
+    infinity_index_provide_t* provides = NULL;
+    int result = -1;
+    
+    // Every repository's packages in one part, each's together
+    part_init(&all);
+    for (uint32_t r = 0; r < update->repo_count; r++) {
+        repos[r].first_package = all.package_count;
+        part_append(&all, &update->repos[r].part, 0);
+        repos[r].package_count = all.package_count - repos[r].first_package;
+        repos[r].name = part_string(&all, update->repos[r].name, strlen(update->repos[r].name));
+        repos[r].priority = update->repos[r].priority;
+        repos[r].serial = update->repos[r].serial;
+        
+        for (uint32_t i = repos[r].first_package; i < all.package_count; i++) {
+            all.packages[i].repo = r;
+        }
+    }
+    if (all.failed) {
+        goto out;
+    }
+    
+    uint32_t count = all.package_count;
+    order = flux_allocate(NULL, (count ? count : 1) * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+    if (!order) {
+        goto out;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    g_sort_part = &all;
+    g_sort_repos = repos;
+    qsort(order, count, sizeof(uint32_t), index_compare_packages);
+    
+    // Chain each name's versions; the first of each goes in a bucket
+    uint32_t bucket_count = index_table_size(count);
+    buckets = flux_allocate(NULL, bucket_count * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+    if (!buckets) {
+        goto out;
+    }
+    memset(buckets, 0xFF, bucket_count * sizeof(uint32_t));
+    
+    uint32_t provide_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        infinity_index_package_t* pkg = &all.packages[order[i]];
+        pkg->next_version = INFINITY_INDEX_NONE;
+        provide_count += pkg->dep_count[INDEX_DEP_PROVIDES];
+        
+        if (i > 0) {
+            infinity_index_package_t* prev = &all.packages[order[i - 1]];
+            if (prev->name_hash == pkg->name_hash &&
+                strcmp(all.strings + prev->name, all.strings + pkg->name) == 0) {
+                prev->next_version = order[i];
+                continue;
+            }
+        }
+        
+        uint32_t s = pkg->name_hash & (bucket_count - 1);
+        while (buckets[s] != INFINITY_INDEX_NONE) {
+            s = (s + 1) & (bucket_count - 1);
+        }
+        buckets[s] = order[i];
+    }
+    
+    // Provides, each bucket's chain best provider first: worst in first
+    uint32_t provide_bucket_count = index_table_size(provide_count);
+    provide_buckets = flux_allocate(NULL, provide_bucket_count * sizeof(uint32_t),
+                                    FLUX_ALLOC_KERNEL);
+    provides = flux_allocate(NULL, (provide_count ? provide_count : 1) *
+                             sizeof(infinity_index_provide_t), FLUX_ALLOC_KERNEL);
+    if (!provide_buckets || !provides) {
+        goto out;
+    }
+    memset(provide_buckets, 0xFF, provide_bucket_count * sizeof(uint32_t));
+    
+    uint32_t provided = 0;
+    for (uint32_t i = count; i-- > 0;) {
+        const infinity_index_package_t* pkg = &all.packages[order[i]];
+        uint32_t first = pkg->first_dep + pkg->dep_count[INDEX_DEP_DEPENDS] +
+                         pkg->dep_count[INDEX_DEP_RECOMMENDS] + pkg->dep_count[INDEX_DEP_CONFLICTS];
+        
+        for (uint32_t d = 0; d < pkg->dep_count[INDEX_DEP_PROVIDES]; d++) {
+            const char* name = all.strings + all.deps[first + d].name;
+            uint32_t hash = index_hash(name, strlen(name));
+            uint32_t bucket = hash & (provide_bucket_count - 1);
+            
+            provides[provided] = (infinity_index_provide_t){
+                all.deps[first + d].name, hash, order[i], provide_buckets[bucket]
+            };
+            provide_buckets[bucket] = provided++;
+        }
+    }
+    
+    // Lay it out
+    infinity_index_header_t header = { 0 };
+    header.magic = INFINITY_INDEX_MAGIC;
+    header.version = INFINITY_INDEX_VERSION;
+    header.repo_count = update->repo_count;
+    header.package_count = count;
+    header.dep_count = all.dep_count;
+    header.provide_count = provide_count;
+    header.bucket_count = bucket_count;
+    header.provide_bucket_count = provide_bucket_count;
+    header.strings_size = all.strings_size;
+    
+    uint64_t offset = index_align(sizeof(header));
+    header.repos_offset = offset;
+    offset = index_align(offset + update->repo_count * sizeof(infinity_index_repo_t));
+    header.packages_offset = offset;
+    offset = index_align(offset + (uint64_t)count * sizeof(infinity_index_package_t));
+    header.deps_offset = offset;
+    offset = index_align(offset + (uint64_t)all.dep_count * sizeof(infinity_index_dep_t));
+    header.provides_offset = offset;
+    offset = index_align(offset + (uint64_t)provide_count * sizeof(infinity_index_provide_t));
+    header.buckets_offset = offset;
+    offset = index_align(offset + bucket_count * sizeof(uint32_t));
+    header.provide_buckets_offset = offset;
+    offset = index_align(offset + provide_bucket_count * sizeof(uint32_t));
+    header.strings_offset = offset;
+    header.size = offset + all.strings_size;
+    
+    // Write it beside the old one, which stays mapped until the caller
+    // reopens
+    char temp[1024];
+    snprintf(temp, sizeof(temp), "%s.new", path);
+    int fd = manifold_open(temp, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC, 0644);
+    if (fd < 0) {
+        goto out;
+    }
+    
+    uint64_t pos = 0;
+    bool written =
+        index_write_section(fd, &pos, 0, &header, sizeof(header)) &&
+        index_write_section(fd, &pos, header.repos_offset, repos,
+                            update->repo_count * sizeof(infinity_index_repo_t)) &&
+        index_write_section(fd, &pos, header.packages_offset, all.packages,
+                            (size_t)count * sizeof(infinity_index_package_t)) &&
+        index_write_section(fd, &pos, header.deps_offset, all.deps,
+                            (size_t)all.dep_count * sizeof(infinity_index_dep_t)) &&
+        index_write_section(fd, &pos, header.provides_offset, provides,
+                            (size_t)provide_count * sizeof(infinity_index_provide_t)) &&
+        index_write_section(fd, &pos, header.buckets_offset, buckets,
+                            bucket_count * sizeof(uint32_t)) &&
+        index_write_section(fd, &pos, header.provide_buckets_offset, provide_buckets,
+                            provide_bucket_count * sizeof(uint32_t)) &&
+        index_write_section(fd, &pos, header.strings_offset, all.strings, all.strings_size);
+    manifold_close(fd);
+    
+    if (!written || manifold_rename(temp, path) != 0) {
+        manifold_unlink(temp);
+        goto out;
+    }
+    result = 0;
+    
+out:
+    flux_free(order);
+    flux_free(buckets);
+    flux_free(provide_buckets);
+    flux_free(provides);
+    part_free(&all);
+    infinity_index_abort_update(update);
+    return result;
+}
@@ -0,0 +1,204 @@
+/*
+ * Infinity Package Index
+ * Binary index of every available package, memory-mapped from disk
+ */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "infinity.h"
+
+// =============================================================================
+// Index Constants
+// =============================================================================
+
+#define INFINITY_INDEX_FILE         "packages.idx"  // In the database directory
+#define INFINITY_INDEX_MAGIC        0x58444E49      // "INDX"
+#define INFINITY_INDEX_VERSION      1
+#define INFINITY_INDEX_NONE         0xFFFFFFFF
+#define INFINITY_INDEX_MAX_THREADS  8
+#define INFINITY_INDEX_MIN_CHUNK    (256 * 1024)    // Package list bytes worth a thread
+
+// Dependency kinds, each package's stored in this order
+#define INDEX_DEP_DEPENDS           0
+#define INDEX_DEP_RECOMMENDS        1
+#define INDEX_DEP_CONFLICTS         2
+#define INDEX_DEP_PROVIDES          3
+#define INDEX_DEP_KINDS             4
+
+// Dependency flags
+#define INDEX_DEP_OPTIONAL          0x01
+
+// Package flags, only while updating
+#define INDEX_PKG_REMOVED           0x01    // A delta's "Status: removed"
+
+// =============================================================================
+// On-Disk Format
+// =============================================================================
+
+// Every offset is from the start of the file, every string an offset
+// into the string table. Packages are grouped by repository, so one
+// repository's can be replaced without touching the rest.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;                  // Of the whole file
+    uint32_t repo_count;
+    uint32_t package_count;
+    uint32_t dep_count;
+    uint32_t provide_count;
+    uint32_t bucket_count;          // Name buckets, a power of two
+    uint32_t provide_bucket_count;  // Likewise
+    uint64_t repos_offset;
+    uint64_t packages_offset;
+    uint64_t deps_offset;
+    uint64_t provides_offset;
+    uint64_t buckets_offset;
+    uint64_t provide_buckets_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+} infinity_index_header_t;
+
+// A repository's packages, and the serial of the list they came from so
+// the next update can ask for the delta since
+typedef struct {
+    uint32_t name;
+    uint32_t first_package;
+    uint32_t package_count;
+    uint32_t priority;
+    uint64_t serial;
+} infinity_index_repo_t;
+
+// One version of a package. A name bucket holds the best version of its
+// name; next_version goes down from there, across repositories.
+typedef struct {
+    uint32_t name;
+    uint32_t name_hash;
+    uint32_t next_version;
+    uint32_t repo;
+    uint32_t major;
+    uint32_t minor;
+    uint32_t patch;
+    uint32_t pre_release;
+    uint32_t description;
+    uint32_t section;
+    uint32_t filename;              // Under the repository's URL
+    uint32_t first_dep;
+    uint16_t dep_count[INDEX_DEP_KINDS];
+    uint8_t priority;
+    uint8_t flags;
+    uint16_t reserved;
+    uint64_t installed_size;
+    uint64_t download_size;
+    uint8_t hash[32];               // SHA-256 of the archive
+} infinity_index_package_t;
+
+typedef struct {
+    uint32_t name;
+    uint32_t constraint;
+    uint32_t flags;
+} infinity_index_dep_t;
+
+// A virtual name and a package providing it, chained from its bucket
+// best provider first
+typedef struct {
+    uint32_t name;
+    uint32_t name_hash;
+    uint32_t package;
+    uint32_t next;
+} infinity_index_provide_t;
+
+// =============================================================================
+// In-Memory Structures
+// =============================================================================
+
+// An open index: the mapping, and its packages as package_t once asked
+// for, so each has one and pointers to it can be compared
+typedef struct {
+    void* base;
+    size_t size;
+    const infinity_index_header_t* header;
+    const infinity_index_repo_t* repos;
+    const infinity_index_package_t* packages;
+    const infinity_index_dep_t* deps;
+    const infinity_index_provide_t* provides;
+    const uint32_t* buckets;
+    const uint32_t* provide_buckets;
+    const char* strings;
+    package_t** loaded;
+} infinity_index_t;
+
+// Packages being gathered for a new index, their strings local to it
+typedef struct {
+    infinity_index_package_t* packages;
+    uint32_t package_count;
+    uint32_t package_capacity;
+    
+    infinity_index_dep_t* deps;
+    uint32_t dep_count;
+    uint32_t dep_capacity;
+    
+    char* strings;
+    size_t strings_size;
+    size_t strings_capacity;
+    
+    bool failed;                    // Ran out of memory along the way
+} infinity_index_part_t;
+
+// An update: the repositories the new index will have, so far
+typedef struct {
+    const infinity_index_t* index;
+    struct {
+        char name[128];
+        uint32_t priority;
+        uint64_t serial;
+        infinity_index_part_t part;
+    } repos[INFINITY_MAX_REPOS];
+    uint32_t repo_count;
+} infinity_index_update_t;
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// Mapping; an index that isn't there or doesn't check out is empty
+int infinity_index_open(infinity_index_t* index, const char* path);
+void infinity_index_close(infinity_index_t* index);
+
+// Queries: the best version of name satisfying constraint (any if NULL),
+// and the best provider of a virtual name
+const infinity_index_package_t* infinity_index_lookup(const infinity_index_t* index,
+                                                      const char* name);
+const infinity_index_package_t* infinity_index_next_version(const infinity_index_t* index,
+                                                            const infinity_index_package_t* pkg);
+package_t* infinity_index_find(infinity_index_t* index, const char* name,
+                               const char* constraint);
+package_t* infinity_index_find_provider(infinity_index_t* index, const char* name);
+package_t* infinity_index_package(infinity_index_t* index, const infinity_index_package_t* pkg);
+
+// Raw access, for the solver: every provide of name, best provider first,
+// and an entry's version
+const infinity_index_provide_t* infinity_index_first_provide(const infinity_index_t* index,
+                                                             const char* name);
+const infinity_index_provide_t* infinity_index_next_provide(const infinity_index_t* index,
+                                                            const infinity_index_provide_t* provide);
+void infinity_index_version(const infinity_index_t* index, const infinity_index_package_t* pkg,
+                            pkg_version_t* version);
+uint32_t infinity_index_hash(const char* name);
+uint64_t infinity_index_repo_serial(const infinity_index_t* index, const char* repo);
+
+// Updates, against index. Each repository to be in the new one comes
+// from a full list, parsed across threads; from a delta, whose stanzas
+// replace or, marked "Status: removed", drop what the index has of the
+// same name and version; or, kept, as the index has it. Commit writes
+// the new index beside the old and renames it over; the caller reopens.
+void infinity_index_begin_update(infinity_index_update_t* update, const infinity_index_t* index);
+int infinity_index_update_full(infinity_index_update_t* update, const repository_t* repo,
+                               uint64_t serial, const char* text, size_t size);
+int infinity_index_update_delta(infinity_index_update_t* update, const repository_t* repo,
+                                uint64_t serial, const char* text, size_t size);
+int infinity_index_update_keep(infinity_index_update_t* update, const char* repo);
+int infinity_index_commit_update(infinity_index_update_t* update, const char* path);
+void infinity_index_abort_update(infinity_index_update_t* update);
+
+#endif /* INDEX_H */
@@ -4,13 +4,17 @@
  */
 
 #include "infinity.h"
+#include "index.h"
 #include "archive.h"
 #include "solver.h"
+#include "download.h"
 #include "../harmony/harmony_net.h"
 #include "../manifold/manifold.h"
 #include "../continuum/flux_memory.h"
+#include "../continuum/temporal_scheduler.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 // =============================================================================
 // Global State
@@ -18,6 +22,10 @@
 
 static infinity_state_t g_infinity;
 static spinlock_t g_infinity_lock = SPINLOCK_INIT;
+static infinity_index_t g_index;
+
+static package_t* infinity_from_index(package_t* pkg);
+static int infinity_do_install(package_t* pkg, const char* extract_dir);
 
 // =============================================================================
 // Package Operations
@@ -52,11 +60,26 @@ int infinity_install_package(const char* name) {
     solver_state_t solver = {0};
     if (infinity_resolve_dependencies(pkg, &solver) != 0) {
         printf("Failed to resolve dependencies for '%s'\n", name);
+        infinity_solver_free_state(&solver);
+        infinity_abort_transaction(trans);
+        return -1;
+    }
+    
+    // An install doesn't take anything away
+    if (solver.remove_count > 0) {
+        for (uint32_t i = 0; i < solver.remove_count; i++) {
+            printf("Installing '%s' would remove '%s'\n", name,
+                   solver.remove_queue[i]->metadata.name);
+        }
+        infinity_solver_free_state(&solver);
         infinity_abort_transaction(trans);
         return -1;
     }
     
     // Add all packages to transaction
+    for (uint32_t i = 0; i < solver.upgrade_count; i++) {
+        infinity_add_to_transaction(trans, solver.upgrade_queue[i], TRANS_UPGRADE);
+    }
     for (uint32_t i = 0; i < solver.install_count; i++) {
         infinity_add_to_transaction(trans, solver.install_queue[i], TRANS_INSTALL);
     }
@@ -66,10 +89,12 @@ int infinity_install_package(const char* name) {
         if (infinity_check_conflicts(solver.install_queue[i]) != 0) {
             printf("Conflicts detected for package '%s'\n", 
                    solver.install_queue[i]->metadata.name);
+            infinity_solver_free_state(&solver);
             infinity_abort_transaction(trans);
             return -1;
         }
     }
+    infinity_solver_free_state(&solver);
     
     // Calculate required space
     uint64_t required_space = 0;
@@ -85,24 +110,8 @@ int infinity_install_package(const char* name) {
         return -1;
     }
     
-    // Download packages
-    printf("Downloading packages...\n");
-    for (uint32_t i = 0; i < trans->operation_count; i++) {
-        package_t* p = trans->operations[i].package;
-        
-        // Check cache first
-        if (!infinity_is_cached(p)) {
-            download_job_t* job = infinity_download_package(p);
-            if (!job || job->failed) {
-                printf("Failed to download package '%s'\n", p->metadata.name);
-                infinity_abort_transaction(trans);
-                return -1;
-            }
-        }
-    }
-    
-    // Commit transaction
-    printf("Installing packages...\n");
+    // Commit transaction, downloading as it goes
+    printf("Downloading and installing packages...\n");
     if (infinity_commit_transaction(trans) != 0) {
         printf("Installation failed\n");
         infinity_rollback_transaction(trans);
@@ -169,6 +178,201 @@ int infinity_remove_package(const char* name, bool purge) {
     return 0;
 }
 
+// =============================================================================
+// Transaction Pipeline
+// =============================================================================
+
+// Each package of a transaction makes its own way through downloading,
+// checked as it arrives, and extraction into a staging directory, the
+// downloads sharing the pool's connections and the extractions as many
+// threads as there are packages ready. Only what touches the system is
+// ordered: the commit takes the operations in turn, dependencies first,
+// each waiting on its own package alone.
+#define INFINITY_STAGE_NONE         0       // Nothing to fetch, as for a removal
+#define INFINITY_STAGE_DOWNLOADING  1
+#define INFINITY_STAGE_EXTRACTING   2
+#define INFINITY_STAGE_READY        3
+#define INFINITY_STAGE_FAILED       4
+
+#define INFINITY_EXTRACT_THREADS    8
+
+typedef struct {
+    package_t* pkg;
+    download_job_t* job;
+    char archive[1024];             // In the cache
+    char staging[1024];             // Extracted into, until the pipeline stops
+    uint32_t state;
+} infinity_stage_t;
+
+typedef struct {
+    infinity_stage_t* stages;       // One for each of the transaction's operations
+    uint32_t count;
+    uint32_t running;               // Extraction threads not yet exited
+    bool stopping;
+} infinity_pipeline_t;
+
+static int infinity_stage_extract(infinity_stage_t* stage) {
+    const char* name = stage->pkg->metadata.name;
+    
+    if (infinity_download_wait(stage->job) != 0) {
+        printf("Failed to download package '%s': %s\n", name, stage->job->error);
+        return -1;
+    }
+    
+    snprintf(stage->staging, sizeof(stage->staging), "%s/staging/%s.XXXXXX",
+             g_infinity.cache_dir, name);
+    if (mkdtemp(stage->staging) == NULL) {
+        stage->staging[0] = '\0';
+        return -1;
+    }
+    
+    if (infinity_extract_package(stage->archive, stage->staging) != 0) {
+        printf("Failed to extract package '%s'\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+// Claim a stage that's done downloading, and extract it
+static bool infinity_stage_claim(infinity_stage_t* stage) {
+    uint32_t expected = INFINITY_STAGE_DOWNLOADING;
+    if (!infinity_download_done(stage->job) ||
+        !__atomic_compare_exchange_n(&stage->state, &expected, INFINITY_STAGE_EXTRACTING, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    
+    uint32_t state = infinity_stage_extract(stage) == 0 ? INFINITY_STAGE_READY
+                                                        : INFINITY_STAGE_FAILED;
+    __atomic_store_n(&stage->state, state, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Extract whatever has downloaded, until nothing's left downloading
+static void infinity_extract_worker(void* arg) {
+    infinity_pipeline_t* pipeline = arg;
+    
+    while (!__atomic_load_n(&pipeline->stopping, __ATOMIC_ACQUIRE)) {
+        bool pending = false;
+        bool claimed = false;
+        for (uint32_t i = 0; i < pipeline->count && !claimed; i++) {
+            infinity_stage_t* stage = &pipeline->stages[i];
+            if (__atomic_load_n(&stage->state, __ATOMIC_ACQUIRE) == INFINITY_STAGE_DOWNLOADING) {
+                pending = true;
+                claimed = infinity_stage_claim(stage);
+            }
+        }
+        
+        if (!pending) {
+            break;
+        }
+        if (!claimed) {
+            temporal_sleep(1000);
+        }
+    }
+    
+    __atomic_fetch_sub(&pipeline->running, 1, __ATOMIC_RELEASE);
+}
+
+// Queue every download at once, in the transaction's order so what's
+// needed first tends to arrive first
+static int infinity_pipeline_start(infinity_pipeline_t* pipeline, transaction_t* trans) {
+    memset(pipeline, 0, sizeof(*pipeline));
+    if (trans->operation_count == 0) {
+        return 0;
+    }
+    
+    pipeline->stages = flux_allocate(NULL, trans->operation_count * sizeof(infinity_stage_t),
+                                     FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!pipeline->stages) {
+        return -1;
+    }
+    pipeline->count = trans->operation_count;
+    
+    char staging[512];
+    snprintf(staging, sizeof(staging), "%s/staging", g_infinity.cache_dir);
+    manifold_mkdir_p(staging, 0700);
+    
+    uint32_t fetching = 0;
+    for (uint32_t i = 0; i < trans->operation_count; i++) {
+        infinity_stage_t* stage = &pipeline->stages[i];
+        uint8_t action = trans->operations[i].action;
+        stage->pkg = trans->operations[i].package;
+        
+        if (action != TRANS_INSTALL && action != TRANS_UPGRADE) {
+            stage->state = INFINITY_STAGE_NONE;
+            continue;
+        }
+        
+        stage->job = infinity_download_package(stage->pkg);
+        if (!stage->job) {
+            printf("Failed to queue download of '%s'\n", stage->pkg->metadata.name);
+            return -1;
+        }
+        infinity_download_cache_path(stage->pkg, stage->archive, sizeof(stage->archive));
+        stage->state = INFINITY_STAGE_DOWNLOADING;
+        fetching++;
+    }
+    
+    // Without threads the commit extracts each package as it gets to it
+    uint32_t threads = continuum_get_cpu_count();
+    if (threads > INFINITY_EXTRACT_THREADS) {
+        threads = INFINITY_EXTRACT_THREADS;
+    }
+    if (threads > fetching) {
+        threads = fetching;
+    }
+    for (uint32_t i = 0; i < threads; i++) {
+        __atomic_fetch_add(&pipeline->running, 1, __ATOMIC_ACQ_REL);
+        if (!temporal_create_thread(infinity_extract_worker, pipeline, PRIORITY_NORMAL)) {
+            __atomic_fetch_sub(&pipeline->running, 1, __ATOMIC_ACQ_REL);
+            break;
+        }
+    }
+    return 0;
+}
+
+// Whether the operation's package is downloaded, checked and extracted
+static bool infinity_pipeline_wait(infinity_pipeline_t* pipeline, infinity_stage_t* stage) {
+    uint32_t state;
+    while ((state = __atomic_load_n(&stage->state, __ATOMIC_ACQUIRE)) ==
+           INFINITY_STAGE_DOWNLOADING || state == INFINITY_STAGE_EXTRACTING) {
+        if (__atomic_load_n(&pipeline->running, __ATOMIC_ACQUIRE) == 0 &&
+            infinity_stage_claim(stage)) {
+            continue;
+        }
+        temporal_sleep(1000);
+    }
+    return state == INFINITY_STAGE_READY;
+}
+
+// Stop what's still going, and clear away whatever was staged
+static void infinity_pipeline_stop(infinity_pipeline_t* pipeline) {
+    __atomic_store_n(&pipeline->stopping, true, __ATOMIC_RELEASE);
+    for (uint32_t i = 0; i < pipeline->count; i++) {
+        infinity_cancel_download(pipeline->stages[i].job);
+    }
+    
+    while (__atomic_load_n(&pipeline->running, __ATOMIC_ACQUIRE) > 0) {
+        temporal_sleep(1000);
+    }
+    
+    for (uint32_t i = 0; i < pipeline->count; i++) {
+        infinity_stage_t* stage = &pipeline->stages[i];
+        if (stage->job) {
+            infinity_download_wait(stage->job);
+            infinity_download_free(stage->job);
+        }
+        if (stage->staging[0]) {
+            infinity_cleanup_temp_dir(stage->staging);
+        }
+    }
+    
+    flux_free(pipeline->stages);
+    pipeline->stages = NULL;
+    pipeline->count = 0;
+}
+
 // =============================================================================
 // Transaction Management
 // =============================================================================
@@ -201,19 +405,32 @@ int infinity_commit_transaction(transaction_t* trans) {
         return -1;
     }
     
+    // Fetch and unpack everything at once, ahead of the operations needing it
+    infinity_pipeline_t pipeline;
+    if (infinity_pipeline_start(&pipeline, trans) != 0) {
+        infinity_pipeline_stop(&pipeline);
+        trans->successful = false;
+        snprintf(trans->error_message, sizeof(trans->error_message),
+                "Failed to queue downloads");
+        return -1;
+    }
+    
     // Execute operations in order
     for (uint32_t i = 0; i < trans->operation_count; i++) {
         package_t* pkg = trans->operations[i].package;
         uint8_t action = trans->operations[i].action;
+        infinity_stage_t* stage = &pipeline.stages[i];
         
         int result = 0;
         switch (action) {
             case TRANS_INSTALL:
-                result = infinity_do_install(pkg);
+                result = infinity_pipeline_wait(&pipeline, stage)
+                         ? infinity_do_install(pkg, stage->staging) : -1;
                 break;
                 
             case TRANS_UPGRADE:
-                result = infinity_do_upgrade(pkg);
+                result = infinity_pipeline_wait(&pipeline, stage)
+                         ? infinity_do_upgrade(pkg, stage->staging) : -1;
                 break;
                 
             case TRANS_REMOVE:
@@ -226,6 +443,7 @@ int infinity_commit_transaction(transaction_t* trans) {
         }
         
         if (result != 0) {
+            infinity_pipeline_stop(&pipeline);
             trans->successful = false;
             snprintf(trans->error_message, sizeof(trans->error_message),
                     "Failed to %s package '%s'",
@@ -235,6 +453,7 @@ int infinity_commit_transaction(transaction_t* trans) {
         
         trans->operations[i].completed = true;
     }
+    infinity_pipeline_stop(&pipeline);
     
     // Update database
     infinity_save_database();
@@ -262,32 +481,19 @@ int infinity_commit_transaction(transaction_t* trans) {
 // Package Installation
 // =============================================================================
 
-static int infinity_do_install(package_t* pkg) {
+// The package comes extracted by the pipeline, which clears the directory
+// away after
+static int infinity_do_install(package_t* pkg, const char* extract_dir) {
     printf("Installing %s (%s)...\n", 
            pkg->metadata.name, 
            infinity_version_to_string(&pkg->metadata.version));
     
-    // Extract package
-    char extract_dir[1024];
-    snprintf(extract_dir, sizeof(extract_dir), "/tmp/infinity.%s.XXXXXX", 
-             pkg->metadata.name);
-    
-    if (mkdtemp(extract_dir) == NULL) {
-        return -1;
-    }
-    
-    if (infinity_extract_package(pkg->archive_path, extract_dir) != 0) {
-        rmdir(extract_dir);
-        return -1;
-    }
-    
     // Run pre-install script
     char preinst[1024];
     snprintf(preinst, sizeof(preinst), "%s/DEBIAN/preinst", extract_dir);
     if (manifold_stat(preinst, NULL) == 0) {
         if (system(preinst) != 0) {
             printf("Pre-installation script failed\n");
-            infinity_cleanup_temp_dir(extract_dir);
             return -1;
         }
     }
@@ -303,7 +509,6 @@ static int infinity_do_install(package_t* pkg) {
         char* parent = infinity_dirname(file->path);
         manifold_mkdir_p(parent, 0755);
         
-        // Copy file
         if (file->is_config) {
             // Handle configuration files specially
             if (manifold_stat(file->path, NULL) == 0) {
@@ -314,9 +519,10 @@ static int infinity_do_install(package_t* pkg) {
             }
         }
         
-        if (infinity_copy_file(src_path, file->path) != 0) {
+        // Move file into place, copying if staging is on another filesystem
+        if (manifold_rename(src_path, file->path) != 0 &&
+            infinity_copy_file(src_path, file->path) != 0) {
             printf("Failed to install file: %s\n", file->path);
-            infinity_cleanup_temp_dir(extract_dir);
             return -1;
         }
         
@@ -346,9 +552,6 @@ static int infinity_do_install(package_t* pkg) {
     g_infinity.total_installed++;
     spinlock_release(&g_infinity_lock);
     
-    // Clean up
-    infinity_cleanup_temp_dir(extract_dir);
-    
     // Trigger post-install hook
     infinity_trigger_hook("post-install", pkg);
     
@@ -364,127 +567,249 @@ int infinity_resolve_dependencies(package_t* pkg, solver_state_t* state) {
         return -1;
     }
     
-    // Add package to install queue
-    infinity_solver_add_install(state, pkg);
+    // The index mustn't be swapped mid-solve
+    solver_job_t job = { .type = SOLVER_JOB_INSTALL, .pkg = pkg };
+    spinlock_acquire(&g_infinity_lock);
+    int result = infinity_solver_solve(&g_index, g_infinity.installed_packages, &job, 1,
+                                       g_infinity.install_recommends, state);
+    spinlock_release(&g_infinity_lock);
     
-    // Process each dependency
-    for (uint32_t i = 0; i < pkg->metadata.depend_count; i++) {
-        pkg_dependency_t* dep = &pkg->metadata.depends[i];
-        
-        // Check if dependency is already satisfied
-        package_t* installed = infinity_find_installed(dep->name);
-        if (installed) {
-            if (infinity_version_satisfies(&installed->metadata.version,
-                                          dep->version_constraint)) {
-                continue;  // Dependency satisfied
-            }
-            
-            // Need to upgrade
-            package_t* newer = infinity_find_available(dep->name,
-                                                      dep->version_constraint);
-            if (!newer) {
-                printf("Cannot satisfy dependency: %s %s\n",
-                       dep->name, dep->version_constraint);
-                return -1;
-            }
-            
-            infinity_solver_add_upgrade(state, newer);
-            
-            // Recursively resolve dependencies
-            if (infinity_resolve_dependencies(newer, state) != 0) {
-                return -1;
-            }
-        } else {
-            // Need to install
-            package_t* available = infinity_find_available(dep->name,
-                                                          dep->version_constraint);
-            if (!available) {
-                if (dep->optional) {
-                    continue;  // Skip optional dependency
-                }
-                
-                // Try to find virtual package provider
-                available = infinity_find_provider(dep->name);
-                if (!available) {
-                    printf("Cannot find package: %s\n", dep->name);
-                    return -1;
-                }
-            }
-            
-            // Check if already in queue
-            bool in_queue = false;
-            for (uint32_t j = 0; j < state->install_count; j++) {
-                if (state->install_queue[j] == available) {
-                    in_queue = true;
-                    break;
-                }
-            }
-            
-            if (!in_queue) {
-                infinity_solver_add_install(state, available);
-                
-                // Recursively resolve dependencies
-                if (infinity_resolve_dependencies(available, state) != 0) {
-                    return -1;
-                }
-            }
-        }
+    for (uint32_t i = 0; i < state->install_count; i++) {
+        infinity_from_index(state->install_queue[i]);
     }
-    
-    // Process recommendations if enabled
-    if (g_infinity.install_recommends) {
-        for (uint32_t i = 0; i < pkg->metadata.recommend_count; i++) {
-            pkg_dependency_t* rec = &pkg->metadata.recommends[i];
-            
-            package_t* available = infinity_find_available(rec->name, NULL);
-            if (available && !infinity_is_package_installed(rec->name)) {
-                infinity_solver_add_install(state, available);
-            }
+    for (uint32_t i = 0; i < state->upgrade_count; i++) {
+        infinity_from_index(state->upgrade_queue[i]);
+    }
+    for (uint32_t i = 0; i < state->conflict_count; i++) {
+        printf("  %s\n", state->conflicts[i].reason);
+    }
+    return result;
+}
+
+// =============================================================================
+// Package Queries
+// =============================================================================
+
+// The package is the index's, the same one each time it's asked for
+static package_t* infinity_from_index(package_t* pkg) {
+    if (pkg && !pkg->repo_url[0]) {
+        repository_t* repo = infinity_find_repository(pkg->repo_name);
+        if (repo) {
+            strncpy(pkg->repo_url, repo->url, sizeof(pkg->repo_url) - 1);
         }
     }
-    
-    return 0;
+    return pkg;
+}
+
+package_t* infinity_find_available(const char* name, const char* version) {
+    spinlock_acquire(&g_infinity_lock);
+    package_t* pkg = infinity_from_index(infinity_index_find(&g_index, name, version));
+    spinlock_release(&g_infinity_lock);
+    return pkg;
+}
+
+package_t* infinity_find_provider(const char* virtual_pkg) {
+    spinlock_acquire(&g_infinity_lock);
+    package_t* pkg = infinity_from_index(infinity_index_find_provider(&g_index, virtual_pkg));
+    spinlock_release(&g_infinity_lock);
+    return pkg;
 }
 
 // =============================================================================
 // Repository Management
 // =============================================================================
 
+// A whole file, NUL-terminated, for the caller to flux_free
+static char* infinity_read_file(const char* path, size_t* size) {
+    int fd = manifold_open(path, VFS_O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    
+    vfs_stat_t stat;
+    char* data = NULL;
+    if (manifold_fstat(fd, &stat) == 0) {
+        data = flux_allocate(NULL, stat.size + 1, FLUX_ALLOC_KERNEL);
+    }
+    if (data && manifold_read(fd, data, stat.size) != (ssize_t)stat.size) {
+        flux_free(data);
+        data = NULL;
+    }
+    manifold_close(fd);
+    
+    if (data) {
+        data[stat.size] = '\0';
+        *size = stat.size;
+    }
+    return data;
+}
+
+// A repository publishes Packages.serial, its list's serial number, and
+// for recent serials Packages.delta.<serial>: the stanzas changed since.
+// Unchanged, the index's copy stands; otherwise the delta, or failing
+// that the whole list.
+#define INFINITY_LIST_KEEP          0
+#define INFINITY_LIST_DELTA         1
+#define INFINITY_LIST_FULL          2
+
+// One repository's lists, downloading alongside every other's
+typedef struct {
+    repository_t* repo;
+    uint64_t indexed;               // The index's serial for it, 0 for none
+    uint64_t serial;                // Published, 0 if unknown
+    uint8_t list;                   // INFINITY_LIST_*, once the serial's in
+    download_job_t* job;
+    char dest[1024];
+} infinity_list_fetch_t;
+
+static download_job_t* infinity_fetch_list(infinity_list_fetch_t* fetch, const char* file,
+                                           const char* suffix) {
+    char url[1024];
+    snprintf(url, sizeof(url), "%s/%s", fetch->repo->url, file);
+    snprintf(fetch->dest, sizeof(fetch->dest), "%s/%s.%s", g_infinity.cache_dir,
+             fetch->repo->name, suffix);
+    return infinity_download_submit(url, fetch->dest, NULL);
+}
+
+// Once the serial's in, queue what the repository's update will need
+static void infinity_fetch_next(infinity_list_fetch_t* fetch) {
+    size_t size;
+    
+    if (infinity_download_wait(fetch->job) == 0) {
+        char* text = infinity_read_file(fetch->dest, &size);
+        if (text) {
+            fetch->serial = strtoull(text, NULL, 10);
+            flux_free(text);
+        }
+    }
+    infinity_download_free(fetch->job);
+    fetch->job = NULL;
+    
+    if (fetch->serial != 0 && fetch->serial == fetch->indexed) {
+        fetch->list = INFINITY_LIST_KEEP;
+    } else if (fetch->serial != 0 && fetch->indexed != 0) {
+        char file[64];
+        snprintf(file, sizeof(file), "Packages.delta.%llu", (unsigned long long)fetch->indexed);
+        fetch->list = INFINITY_LIST_DELTA;
+        fetch->job = infinity_fetch_list(fetch, file, "delta");
+    } else {
+        fetch->list = INFINITY_LIST_FULL;
+        fetch->job = infinity_fetch_list(fetch, "Packages.gz", "packages.gz");
+    }
+}
+
+static int infinity_update_repository(infinity_index_update_t* update,
+                                      infinity_list_fetch_t* fetch) {
+    repository_t* repo = fetch->repo;
+    size_t size;
+    
+    if (fetch->list == INFINITY_LIST_KEEP && infinity_index_update_keep(update, repo->name) == 0) {
+        return 0;
+    }
+    
+    if (fetch->list == INFINITY_LIST_DELTA) {
+        int result = -1;
+        if (infinity_download_wait(fetch->job) == 0) {
+            char* text = infinity_read_file(fetch->dest, &size);
+            result = text ? infinity_index_update_delta(update, repo, fetch->serial, text, size)
+                          : -1;
+            flux_free(text);
+        }
+        infinity_download_free(fetch->job);
+        fetch->job = NULL;
+        if (result == 0) {
+            return 0;
+        }
+    }
+    
+    // The whole list, if it isn't already coming
+    if (fetch->list != INFINITY_LIST_FULL) {
+        fetch->list = INFINITY_LIST_FULL;
+        fetch->job = infinity_fetch_list(fetch, "Packages.gz", "packages.gz");
+    }
+    int fetched = infinity_download_wait(fetch->job);
+    infinity_download_free(fetch->job);
+    fetch->job = NULL;
+    if (fetched != 0) {
+        printf("Failed to download package list for %s\n", repo->name);
+        return -1;
+    }
+    
+    char* text = archive_gunzip_file(fetch->dest, &size);
+    if (!text) {
+        printf("Failed to decompress package list for %s\n", repo->name);
+        return -1;
+    }
+    
+    int result = infinity_index_update_full(update, repo, fetch->serial, text, size);
+    flux_free(text);
+    if (result != 0) {
+        printf("Failed to parse package list for %s\n", repo->name);
+    }
+    return result;
+}
+
+// Every repository's lists download at once, first their serials and then
+// the delta or full list each calls for. The lists are parsed in the
+// repositories' order, each as soon as it's in, while the rest still come.
 int infinity_update_repositories(void) {
     printf("Updating package lists...\n");
     
-    repository_t* repo = g_infinity.repositories;
-    int updated = 0;
+    infinity_index_update_t* update = flux_allocate(NULL, sizeof(infinity_index_update_t),
+                                                    FLUX_ALLOC_KERNEL);
+    infinity_list_fetch_t* fetches = flux_allocate(NULL, INFINITY_MAX_REPOS *
+                                                   sizeof(infinity_list_fetch_t),
+                                                   FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!update || !fetches) {
+        flux_free(update);
+        flux_free(fetches);
+        return -1;
+    }
+    infinity_index_begin_update(update, &g_index);
     
-    while (repo) {
+    uint32_t count = 0;
+    for (repository_t* repo = g_infinity.repositories; repo && count < INFINITY_MAX_REPOS;
+         repo = repo->next) {
         if (repo->enabled) {
-            printf("Updating %s...\n", repo->name);
-            
-            // Download package list
-            char url[1024];
-            char dest[1024];
-            
-            snprintf(url, sizeof(url), "%s/Packages.gz", repo->url);
-            snprintf(dest, sizeof(dest), "%s/%s.packages.gz",
-                    g_infinity.cache_dir, repo->name);
-            
-            if (infinity_download_file(url, dest) == 0) {
-                // Decompress and parse package list
-                if (infinity_parse_package_list(dest, repo) == 0) {
-                    repo->last_update = time(NULL);
-                    updated++;
-                } else {
-                    printf("Failed to parse package list for %s\n", repo->name);
-                }
-            } else {
-                printf("Failed to download package list for %s\n", repo->name);
-            }
+            infinity_list_fetch_t* fetch = &fetches[count++];
+            fetch->repo = repo;
+            fetch->indexed = infinity_index_repo_serial(&g_index, repo->name);
+            fetch->job = infinity_fetch_list(fetch, "Packages.serial", "serial");
         }
-        repo = repo->next;
     }
+    for (uint32_t i = 0; i < count; i++) {
+        infinity_fetch_next(&fetches[i]);
+    }
+    
+    int updated = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        repository_t* repo = fetches[i].repo;
+        printf("Updating %s...\n", repo->name);
     
-    // Rebuild package cache
-    infinity_rebuild_package_cache();
+        if (infinity_update_repository(update, &fetches[i]) == 0) {
+            repo->last_update = time(NULL);
+            updated++;
+        } else {
+            // What the index had of it, if anything, stays
+            infinity_index_update_keep(update, repo->name);
+        }
+    }
+    flux_free(fetches);
+    
+    // Write the new index and swap it in
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", g_infinity.db_dir, INFINITY_INDEX_FILE);
+    if (infinity_index_commit_update(update, path) == 0) {
+        spinlock_acquire(&g_infinity_lock);
+        infinity_index_close(&g_index);
+        infinity_index_open(&g_index, path);
+        infinity_solver_reset();
+        spinlock_release(&g_infinity_lock);
+    } else {
+        printf("Failed to write package index\n");
+        updated = 0;
+    }
+    flux_free(update);
     
     printf("Updated %d repositories\n", updated);
     return (updated > 0) ? 0 : -1;
@@ -523,6 +848,11 @@ int infinity_init(void) {
     // Load database
     infinity_load_database();
     
+    // Map the package index
+    char index_file[512];
+    snprintf(index_file, sizeof(index_file), "%s/%s", g_infinity.db_dir, INFINITY_INDEX_FILE);
+    infinity_index_open(&g_index, index_file);
+    
     // Load repository list
     char sources_file[512];
     snprintf(sources_file, sizeof(sources_file), "%s/sources.list", g_infinity.config_dir);
@@ -536,7 +866,7 @@ int infinity_init(void) {
     }
     
     // Initialize download manager
-    infinity_init_downloader();
+    infinity_init_downloader(g_infinity.max_downloads, g_infinity.cache_dir);
     
     // Initialize package solver
     infinity_init_solver();
@@ -551,6 +881,9 @@ void infinity_shutdown(void) {
     // Stop daemon
     infinity_stop_daemon();
     
+    // Let what's downloading finish
+    infinity_shutdown_downloader();
+    
     // Save database
     infinity_save_database();
     
@@ -584,4 +917,8 @@ void infinity_shutdown(void) {
         infinity_free_transaction(trans);
         trans = next;
     }
+    
+    // Packages only available go with the index
+    infinity_solver_reset();
+    infinity_index_close(&g_index);
 }
@@ -213,6 +213,7 @@ typedef struct download_job {
     uint64_t size;
     uint64_t downloaded;
     uint8_t expected_hash[32];
+    bool verify;  // expected_hash is set
     
     // Progress
     float progress;
@@ -223,6 +224,7 @@ typedef struct download_job {
     bool active;
     bool completed;
     bool failed;
+    bool cancelled;
     char error[256];
     
     // Callbacks
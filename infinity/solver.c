@@ -0,0 +1,1338 @@
+/*
+ * Infinity Dependency Solver
+ * Packages as variables; jobs, dependencies, conflicts and one version
+ * per name as rules; solved by unit propagation and clause learning
+ */
+
+#include "solver.h"
+#include "../continuum/flux_memory.h"
+#include <string.h>
+#include <stdio.h>
+
+#define SOLVER_NONE         0xFFFFFFFF
+
+// Literals: a variable's number times two, plus one when negated
+#define LIT(var, negated)   (((var) << 1) | (negated))
+#define LIT_VAR(lit)        ((lit) >> 1)
+#define LIT_NEGATED(lit)    ((lit) & 1)
+
+// Variable values
+#define VALUE_FALSE         0
+#define VALUE_TRUE          1
+#define VALUE_UNSET         2
+
+// Rule types
+#define RULE_JOB            0
+#define RULE_REQUIRES       1
+#define RULE_RECOMMENDS     2       // Weak: chosen from when it can be, never propagated
+#define RULE_CONFLICTS      3
+#define RULE_ONE_VERSION    4
+#define RULE_LEARNED        5
+
+// Dependency kinds a package has in the pool, in the index's order
+#define SOLVER_DEP_KINDS    3       // INDEX_DEP_DEPENDS to INDEX_DEP_CONFLICTS
+
+// =============================================================================
+// Dependency Pool
+// =============================================================================
+
+// A dependency, interned by name and constraint, and the index packages
+// satisfying it best first: the name's versions, then its providers
+typedef struct {
+    uint32_t name;                  // Into keys
+    uint32_t constraint;            // Into keys; 0, the empty string, for none
+    uint32_t name_hash;
+    uint32_t hash;
+    uint32_t first_candidate;
+    uint32_t candidate_count;
+} solver_dep_t;
+
+// Survives solves, so a dependency is looked up in the index once
+static struct {
+    const infinity_index_t* index;
+    bool bound;
+    
+    solver_dep_t* deps;
+    uint32_t dep_count;
+    uint32_t dep_capacity;
+    uint32_t* dep_buckets;
+    uint32_t bucket_count;
+    
+    uint32_t* candidates;
+    uint32_t candidate_count;
+    uint32_t candidate_capacity;
+    
+    char* keys;
+    uint32_t keys_size;
+    uint32_t keys_capacity;
+    
+    // Each index package's dependencies, recommends and conflicts as
+    // deps, from package_deps[package_first[i]] once expanded
+    uint32_t* package_first;
+    uint32_t* package_deps;
+    uint32_t package_dep_count;
+    uint32_t package_dep_capacity;
+    
+    // Each index package's variable in the solve under way
+    uint32_t* local;
+    
+    bool failed;
+    solver_stats_t stats;
+} g_pool;
+
+static bool solver_reserve(bool* failed, void** items, uint32_t* capacity, uint32_t needed,
+                           size_t item_size) {
+    if (needed <= *capacity) {
+        return true;
+    }
+    
+    uint32_t grown = *capacity ? *capacity : 64;
+    while (grown < needed) {
+        grown *= 2;
+    }
+    
+    void* resized = *items ? flux_reallocate(*items, (size_t)grown * item_size)
+                           : flux_allocate(NULL, (size_t)grown * item_size, FLUX_ALLOC_KERNEL);
+    if (!resized) {
+        *failed = true;
+        return false;
+    }
+    
+    *items = resized;
+    *capacity = grown;
+    return true;
+}
+
+static uint32_t pool_key(const char* str) {
+    uint32_t length = strlen(str);
+    if (length == 0) {
+        return 0;
+    }
+    
+    if (!solver_reserve(&g_pool.failed, (void**)&g_pool.keys, &g_pool.keys_capacity,
+                        g_pool.keys_size + length + 1, 1)) {
+        return 0;
+    }
+    
+    uint32_t offset = g_pool.keys_size;
+    memcpy(g_pool.keys + offset, str, length + 1);
+    g_pool.keys_size += length + 1;
+    return offset;
+}
+
+static void pool_free(void) {
+    flux_free(g_pool.deps);
+    flux_free(g_pool.dep_buckets);
+    flux_free(g_pool.candidates);
+    flux_free(g_pool.keys);
+    flux_free(g_pool.package_first);
+    flux_free(g_pool.package_deps);
+    flux_free(g_pool.local);
+    
+    solver_stats_t stats = g_pool.stats;
+    memset(&g_pool, 0, sizeof(g_pool));
+    g_pool.stats = stats;
+}
+
+// Ready the pool for index: kept from the last solve if it's the same
+static bool pool_bind(const infinity_index_t* index) {
+    if (g_pool.bound && g_pool.index == index) {
+        return true;
+    }
+    
+    pool_free();
+    
+    uint32_t count = index->header ? index->header->package_count : 0;
+    size_t size = (count ? count : 1) * sizeof(uint32_t);
+    g_pool.package_first = flux_allocate(NULL, size, FLUX_ALLOC_KERNEL);
+    g_pool.local = flux_allocate(NULL, size, FLUX_ALLOC_KERNEL);
+    g_pool.bucket_count = 1024;
+    g_pool.dep_buckets = flux_allocate(NULL, g_pool.bucket_count * sizeof(uint32_t),
+                                       FLUX_ALLOC_KERNEL);
+    g_pool.keys = flux_allocate(NULL, 4096, FLUX_ALLOC_KERNEL);
+    if (!g_pool.package_first || !g_pool.local || !g_pool.dep_buckets || !g_pool.keys) {
+        pool_free();
+        return false;
+    }
+    
+    memset(g_pool.package_first, 0xFF, size);
+    memset(g_pool.local, 0xFF, size);
+    memset(g_pool.dep_buckets, 0xFF, g_pool.bucket_count * sizeof(uint32_t));
+    g_pool.keys[0] = '\0';
+    g_pool.keys_size = 1;
+    g_pool.keys_capacity = 4096;
+    
+    g_pool.index = index;
+    g_pool.bound = true;
+    return true;
+}
+
+static inline const char* pool_string(uint32_t key) {
+    return g_pool.keys + key;
+}
+
+static bool pool_grow_buckets(void) {
+    uint32_t count = g_pool.bucket_count * 2;
+    uint32_t* buckets = flux_allocate(NULL, count * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+    if (!buckets) {
+        g_pool.failed = true;
+        return false;
+    }
+    memset(buckets, 0xFF, count * sizeof(uint32_t));
+    
+    for (uint32_t i = 0; i < g_pool.dep_count; i++) {
+        uint32_t slot = g_pool.deps[i].hash & (count - 1);
+        while (buckets[slot] != SOLVER_NONE) {
+            slot = (slot + 1) & (count - 1);
+        }
+        buckets[slot] = i;
+    }
+    
+    flux_free(g_pool.dep_buckets);
+    g_pool.dep_buckets = buckets;
+    g_pool.bucket_count = count;
+    return true;
+}
+
+static void pool_add_candidate(solver_dep_t* dep, uint32_t package) {
+    for (uint32_t i = 0; i < dep->candidate_count; i++) {
+        if (g_pool.candidates[dep->first_candidate + i] == package) {
+            return;
+        }
+    }
+    
+    if (solver_reserve(&g_pool.failed, (void**)&g_pool.candidates, &g_pool.candidate_capacity,
+                       g_pool.candidate_count + 1, sizeof(uint32_t))) {
+        g_pool.candidates[g_pool.candidate_count++] = package;
+        dep->candidate_count++;
+    }
+}
+
+// The dependency on name satisfying constraint, found in the index the
+// first time it's asked for
+static uint32_t pool_dep(const char* name, const char* constraint) {
+    if (!constraint) {
+        constraint = "";
+    }
+    
+    uint32_t name_hash = infinity_index_hash(name);
+    uint32_t hash = (name_hash ^ infinity_index_hash(constraint)) * 16777619u;
+    
+    if (g_pool.dep_count * 2 >= g_pool.bucket_count && !pool_grow_buckets()) {
+        return SOLVER_NONE;
+    }
+    
+    uint32_t mask = g_pool.bucket_count - 1;
+    uint32_t slot = hash & mask;
+    for (; g_pool.dep_buckets[slot] != SOLVER_NONE; slot = (slot + 1) & mask) {
+        solver_dep_t* dep = &g_pool.deps[g_pool.dep_buckets[slot]];
+        if (dep->hash == hash && strcmp(pool_string(dep->name), name) == 0 &&
+            strcmp(pool_string(dep->constraint), constraint) == 0) {
+            g_pool.stats.dep_hits++;
+            return g_pool.dep_buckets[slot];
+        }
+    }
+    
+    if (!solver_reserve(&g_pool.failed, (void**)&g_pool.deps, &g_pool.dep_capacity,
+                        g_pool.dep_count + 1, sizeof(solver_dep_t))) {
+        return SOLVER_NONE;
+    }
+    
+    g_pool.stats.dep_misses++;
+    uint32_t id = g_pool.dep_count++;
+    solver_dep_t* dep = &g_pool.deps[id];
+    dep->name = pool_key(name);
+    dep->constraint = pool_key(constraint);
+    dep->name_hash = name_hash;
+    dep->hash = hash;
+    dep->first_candidate = g_pool.candidate_count;
+    dep->candidate_count = 0;
+    g_pool.dep_buckets[slot] = id;
+    
+    const infinity_index_t* index = g_pool.index;
+    const infinity_index_package_t* pkg = infinity_index_lookup(index, name);
+    for (; pkg; pkg = infinity_index_next_version(index, pkg)) {
+        pkg_version_t version;
+        infinity_index_version(index, pkg, &version);
+        if (!constraint[0] || infinity_version_satisfies(&version, constraint)) {
+            pool_add_candidate(dep, pkg - index->packages);
+        }
+    }
+    
+    // A provide has no version, so only satisfies unversioned dependencies
+    if (!constraint[0]) {
+        const infinity_index_provide_t* provide = infinity_index_first_provide(index, name);
+        for (; provide; provide = infinity_index_next_provide(index, provide)) {
+            pool_add_candidate(dep, provide->package);
+        }
+    }
+    
+    return id;
+}
+
+// An index package's dependencies as deps, all kinds together
+static uint32_t pool_package_deps(uint32_t package) {
+    if (g_pool.package_first[package] != SOLVER_NONE) {
+        return g_pool.package_first[package];
+    }
+    
+    const infinity_index_t* index = g_pool.index;
+    const infinity_index_package_t* pkg = &index->packages[package];
+    uint32_t count = 0;
+    for (uint32_t kind = 0; kind < SOLVER_DEP_KINDS; kind++) {
+        count += pkg->dep_count[kind];
+    }
+    
+    if (!solver_reserve(&g_pool.failed, (void**)&g_pool.package_deps,
+                        &g_pool.package_dep_capacity, g_pool.package_dep_count + count,
+                        sizeof(uint32_t))) {
+        return SOLVER_NONE;
+    }
+    
+    uint32_t first = g_pool.package_dep_count;
+    g_pool.package_dep_count += count;
+    for (uint32_t i = 0; i < count; i++) {
+        const infinity_index_dep_t* dep = &index->deps[pkg->first_dep + i];
+        g_pool.package_deps[first + i] = pool_dep(index->strings + dep->name,
+                                                  index->strings + dep->constraint);
+    }
+    
+    g_pool.package_first[package] = first;
+    return first;
+}
+
+// =============================================================================
+// Problem
+// =============================================================================
+
+typedef struct {
+    uint32_t entry;                 // Index package, or SOLVER_NONE
+    package_t* pkg;                 // Installed or given outright; else the index's, once chosen
+    const char* name;
+    uint32_t name_id;
+    bool installed;
+    uint8_t value;
+    bool seen;
+    uint32_t level;
+    uint32_t reason;                // Rule that implied it, SOLVER_NONE if decided
+    uint32_t same_name;             // Next variable of the same name
+    uint32_t mark;
+} solver_var_t;
+
+typedef struct {
+    uint32_t first;                 // Into lits
+    uint32_t count;
+    uint32_t choice;                // Into choices, best first, for jobs and dependencies
+    uint32_t choice_count;
+    uint32_t watch_next[2];
+    uint32_t var;                   // The package the rule is for, or SOLVER_NONE
+    uint32_t other;                 // Its dependency, or the package it rules out
+    uint8_t type;
+} solver_rule_t;
+
+typedef struct {
+    const char* name;
+    uint32_t hash;
+    uint32_t first_var;
+    uint32_t installed;             // Its installed variable
+} solver_name_t;
+
+// An installed package the index doesn't know, by a name it provides
+typedef struct {
+    uint32_t name_hash;
+    const char* name;
+    uint32_t var;
+} solver_provider_t;
+
+typedef struct {
+    infinity_index_t* index;
+    bool failed;
+    
+    solver_var_t* vars;
+    uint32_t var_count;
+    uint32_t var_capacity;
+    
+    solver_rule_t* rules;
+    uint32_t rule_count;
+    uint32_t rule_capacity;
+    uint32_t problem_rules;         // Rules before this are the problem's, the rest learned
+    
+    uint32_t* lits;
+    uint32_t lit_count;
+    uint32_t lit_capacity;
+    
+    uint32_t* choices;
+    uint32_t choice_count;
+    uint32_t choice_capacity;
+    
+    solver_name_t* names;
+    uint32_t name_count;
+    uint32_t name_capacity;
+    uint32_t* name_buckets;
+    uint32_t name_bucket_count;
+    
+    solver_provider_t* providers;
+    uint32_t provider_count;
+    uint32_t provider_capacity;
+    
+    // Dependencies of packages the index doesn't know, interned
+    uint32_t* deps;
+    uint32_t deps_capacity;
+    
+    uint32_t* scratch;
+    uint32_t scratch_count;
+    uint32_t scratch_capacity;
+    uint32_t mark;
+    
+    // Search
+    uint32_t* watches;              // Per literal, the first rule watching it
+    uint32_t* trail;
+    uint32_t trail_count;
+    uint32_t* level_start;          // Where each decision level starts on the trail
+    uint32_t level;
+    uint32_t propagated;
+    uint32_t rule_cursor;
+    uint32_t var_cursor;
+} solver_t;
+
+static bool solver_grow_names(solver_t* s) {
+    uint32_t count = s->name_bucket_count ? s->name_bucket_count * 2 : 256;
+    uint32_t* buckets = flux_allocate(NULL, count * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+    if (!buckets) {
+        s->failed = true;
+        return false;
+    }
+    memset(buckets, 0xFF, count * sizeof(uint32_t));
+    
+    for (uint32_t i = 0; i < s->name_count; i++) {
+        uint32_t slot = s->names[i].hash & (count - 1);
+        while (buckets[slot] != SOLVER_NONE) {
+            slot = (slot + 1) & (count - 1);
+        }
+        buckets[slot] = i;
+    }
+    
+    flux_free(s->name_buckets);
+    s->name_buckets = buckets;
+    s->name_bucket_count = count;
+    return true;
+}
+
+// A name's entry; added if create, which keeps the table at most half full
+static uint32_t solver_name(solver_t* s, const char* name, uint32_t hash, bool create) {
+    if (create && s->name_count * 2 >= s->name_bucket_count && !solver_grow_names(s)) {
+        return SOLVER_NONE;
+    }
+    if (s->name_bucket_count == 0) {
+        return SOLVER_NONE;
+    }
+    
+    uint32_t mask = s->name_bucket_count - 1;
+    uint32_t slot = hash & mask;
+    for (; s->name_buckets[slot] != SOLVER_NONE; slot = (slot + 1) & mask) {
+        const solver_name_t* entry = &s->names[s->name_buckets[slot]];
+        if (entry->hash == hash && strcmp(entry->name, name) == 0) {
+            return s->name_buckets[slot];
+        }
+    }
+    
+    if (!create || !solver_reserve(&s->failed, (void**)&s->names, &s->name_capacity,
+                                   s->name_count + 1, sizeof(solver_name_t))) {
+        return SOLVER_NONE;
+    }
+    
+    uint32_t id = s->name_count++;
+    s->names[id] = (solver_name_t){ name, hash, SOLVER_NONE, SOLVER_NONE };
+    s->name_buckets[slot] = id;
+    return id;
+}
+
+static uint32_t solver_new_var(solver_t* s, uint32_t entry, package_t* pkg, const char* name,
+                               uint32_t hash) {
+    uint32_t name_id = solver_name(s, name, hash, true);
+    if (name_id == SOLVER_NONE ||
+        !solver_reserve(&s->failed, (void**)&s->vars, &s->var_capacity, s->var_count + 1,
+                        sizeof(solver_var_t))) {
+        return SOLVER_NONE;
+    }
+    
+    uint32_t var = s->var_count++;
+    s->vars[var] = (solver_var_t){
+        .entry = entry, .pkg = pkg, .name = name, .name_id = name_id, .value = VALUE_UNSET,
+        .reason = SOLVER_NONE, .same_name = s->names[name_id].first_var
+    };
+    s->names[name_id].first_var = var;
+    
+    if (entry != SOLVER_NONE) {
+        g_pool.local[entry] = var;
+    }
+    return var;
+}
+
+static uint32_t solver_var_for_entry(solver_t* s, uint32_t entry) {
+    if (g_pool.local[entry] != SOLVER_NONE) {
+        return g_pool.local[entry];
+    }
+    
+    const infinity_index_package_t* pkg = &s->index->packages[entry];
+    return solver_new_var(s, entry, NULL, s->index->strings + pkg->name, pkg->name_hash);
+}
+
+// A package's variable: its index entry's when that is the same version,
+// else one of its own
+static uint32_t solver_var_for_package(solver_t* s, package_t* pkg) {
+    const pkg_version_t* version = &pkg->metadata.version;
+    const infinity_index_package_t* entry = infinity_index_lookup(s->index, pkg->metadata.name);
+    
+    for (; entry; entry = infinity_index_next_version(s->index, entry)) {
+        if (entry->major == version->major && entry->minor == version->minor &&
+            entry->patch == version->patch &&
+            strcmp(s->index->strings + entry->pre_release, version->pre_release) == 0) {
+            uint32_t var = solver_var_for_entry(s, entry - s->index->packages);
+            if (var != SOLVER_NONE) {
+                s->vars[var].pkg = pkg;
+            }
+            return var;
+        }
+    }
+    
+    return solver_new_var(s, SOLVER_NONE, pkg, pkg->metadata.name,
+                          infinity_index_hash(pkg->metadata.name));
+}
+
+static void solver_var_version(solver_t* s, uint32_t var, pkg_version_t* version) {
+    if (s->vars[var].entry != SOLVER_NONE) {
+        infinity_index_version(s->index, &s->index->packages[s->vars[var].entry], version);
+    } else {
+        *version = s->vars[var].pkg->metadata.version;
+    }
+}
+
+static bool solver_var_satisfies(solver_t* s, uint32_t var, const char* constraint) {
+    if (!constraint || !constraint[0]) {
+        return true;
+    }
+    
+    pkg_version_t version;
+    solver_var_version(s, var, &version);
+    return infinity_version_satisfies(&version, constraint);
+}
+
+static package_t* solver_var_package(solver_t* s, uint32_t var) {
+    solver_var_t* v = &s->vars[var];
+    if (!v->pkg && v->entry != SOLVER_NONE) {
+        v->pkg = infinity_index_package(s->index, &s->index->packages[v->entry]);
+    }
+    return v->pkg;
+}
+
+// A variable's dependencies of a kind as pool deps: kept in the pool for
+// index packages, interned afresh for the rest
+static const uint32_t* solver_var_deps(solver_t* s, uint32_t var, uint32_t kind,
+                                       uint32_t* count) {
+    const solver_var_t* v = &s->vars[var];
+    *count = 0;
+    
+    if (v->entry != SOLVER_NONE) {
+        uint32_t first = pool_package_deps(v->entry);
+        if (first == SOLVER_NONE) {
+            s->failed = true;
+            return NULL;
+        }
+        
+        const infinity_index_package_t* pkg = &s->index->packages[v->entry];
+        for (uint32_t k = 0; k < kind; k++) {
+            first += pkg->dep_count[k];
+        }
+        *count = pkg->dep_count[kind];
+        return &g_pool.package_deps[first];
+    }
+    
+    const pkg_metadata_t* metadata = &v->pkg->metadata;
+    const pkg_dependency_t* deps = kind == INDEX_DEP_DEPENDS ? metadata->depends :
+                                   kind == INDEX_DEP_RECOMMENDS ? metadata->recommends :
+                                   metadata->conflicts;
+    uint32_t total = kind == INDEX_DEP_DEPENDS ? metadata->depend_count :
+                     kind == INDEX_DEP_RECOMMENDS ? metadata->recommend_count :
+                     metadata->conflict_count;
+    
+    if (!solver_reserve(&s->failed, (void**)&s->deps, &s->deps_capacity, total,
+                        sizeof(uint32_t))) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < total; i++) {
+        s->deps[i] = pool_dep(deps[i].name, deps[i].version_constraint);
+        if (s->deps[i] == SOLVER_NONE) {
+            s->failed = true;
+            return NULL;
+        }
+    }
+    
+    *count = total;
+    return s->deps;
+}
+
+static uint32_t solver_add_rule(solver_t* s, uint8_t type, uint32_t var, uint32_t other,
+                                const uint32_t* lits, uint32_t count) {
+    if (!solver_reserve(&s->failed, (void**)&s->rules, &s->rule_capacity, s->rule_count + 1,
+                        sizeof(solver_rule_t)) ||
+        !solver_reserve(&s->failed, (void**)&s->lits, &s->lit_capacity, s->lit_count + count,
+                        sizeof(uint32_t))) {
+        return SOLVER_NONE;
+    }
+    
+    uint32_t id = s->rule_count++;
+    s->rules[id] = (solver_rule_t){
+        .first = s->lit_count, .count = count, .watch_next = { SOLVER_NONE, SOLVER_NONE },
+        .var = var, .other = other, .type = type
+    };
+    memcpy(&s->lits[s->lit_count], lits, count * sizeof(uint32_t));
+    s->lit_count += count;
+    return id;
+}
+
+// Append var to choices, once per mark
+static void solver_add_choice(solver_t* s, uint32_t var) {
+    if (var == SOLVER_NONE || s->vars[var].mark == s->mark) {
+        return;
+    }
+    
+    s->vars[var].mark = s->mark;
+    if (solver_reserve(&s->failed, (void**)&s->choices, &s->choice_capacity,
+                       s->choice_count + 1, sizeof(uint32_t))) {
+        s->choices[s->choice_count++] = LIT(var, 0);
+    }
+}
+
+// A rule whose lits are not var, when there is one, or any of choices
+// from choice on; which it's decided from in that order
+static void solver_add_choice_rule(solver_t* s, uint8_t type, uint32_t var, uint32_t other,
+                                   uint32_t choice) {
+    uint32_t count = s->choice_count - choice;
+    if (!solver_reserve(&s->failed, (void**)&s->scratch, &s->scratch_capacity, count + 1,
+                        sizeof(uint32_t))) {
+        return;
+    }
+    
+    uint32_t lits = 0;
+    if (var != SOLVER_NONE && type != RULE_JOB) {
+        s->scratch[lits++] = LIT(var, 1);
+    }
+    memcpy(&s->scratch[lits], &s->choices[choice], count * sizeof(uint32_t));
+    lits += count;
+    
+    uint32_t rule = solver_add_rule(s, type, var, other, s->scratch, lits);
+    if (rule != SOLVER_NONE) {
+        s->rules[rule].choice = choice;
+        s->rules[rule].choice_count = count;
+    }
+}
+
+// What could satisfy dep, best first: what's installed and will do, so
+// nothing is upgraded or replaced that needn't be, then the index's
+// candidates. Installed packages the index doesn't know only count as
+// installed ones.
+static void solver_dep_choices(solver_t* s, uint32_t dep_id) {
+    const solver_dep_t* dep = &g_pool.deps[dep_id];
+    const char* name = pool_string(dep->name);
+    const char* constraint = pool_string(dep->constraint);
+    s->mark++;
+    
+    uint32_t name_id = solver_name(s, name, dep->name_hash, false);
+    if (name_id != SOLVER_NONE && s->names[name_id].installed != SOLVER_NONE &&
+        solver_var_satisfies(s, s->names[name_id].installed, constraint)) {
+        solver_add_choice(s, s->names[name_id].installed);
+    }
+    
+    if (!constraint[0]) {
+        for (uint32_t i = 0; i < s->provider_count; i++) {
+            if (s->providers[i].name_hash == dep->name_hash &&
+                strcmp(s->providers[i].name, name) == 0) {
+                solver_add_choice(s, s->providers[i].var);
+            }
+        }
+    }
+    
+    for (uint32_t i = 0; i < dep->candidate_count; i++) {
+        uint32_t local = g_pool.local[g_pool.candidates[dep->first_candidate + i]];
+        if (local != SOLVER_NONE && s->vars[local].installed) {
+            solver_add_choice(s, local);
+        }
+    }
+    
+    for (uint32_t i = 0; i < dep->candidate_count; i++) {
+        solver_add_choice(s, solver_var_for_entry(s, g_pool.candidates[dep->first_candidate + i]));
+    }
+}
+
+static void solver_add_job(solver_t* s, const solver_job_t* job) {
+    uint32_t choice = s->choice_count;
+    
+    if (job->type == SOLVER_JOB_INSTALL && job->pkg) {
+        s->mark++;
+        uint32_t var = solver_var_for_package(s, job->pkg);
+        solver_add_choice(s, var);
+        if (var != SOLVER_NONE) {
+            solver_add_choice_rule(s, RULE_JOB, var, SOLVER_NONE, choice);
+        }
+        return;
+    }
+    
+    // Removals are rules once every package is known
+    if (!job->name || job->type == SOLVER_JOB_REMOVE) {
+        return;
+    }
+    
+    uint32_t dep = pool_dep(job->name, job->type == SOLVER_JOB_INSTALL ? job->constraint : NULL);
+    if (dep == SOLVER_NONE) {
+        s->failed = true;
+        return;
+    }
+    
+    if (job->type == SOLVER_JOB_INSTALL) {
+        solver_dep_choices(s, dep);
+        solver_add_choice_rule(s, RULE_JOB, SOLVER_NONE, dep, choice);
+        return;
+    }
+    
+    // An upgrade wants a version of name better than the installed one,
+    // when there is one
+    uint32_t name_id = solver_name(s, job->name, g_pool.deps[dep].name_hash, false);
+    uint32_t installed = name_id == SOLVER_NONE ? SOLVER_NONE : s->names[name_id].installed;
+    pkg_version_t current;
+    if (installed != SOLVER_NONE) {
+        solver_var_version(s, installed, &current);
+    }
+    
+    s->mark++;
+    const solver_dep_t* versions = &g_pool.deps[dep];
+    for (uint32_t i = 0; i < versions->candidate_count; i++) {
+        uint32_t var = solver_var_for_entry(s, g_pool.candidates[versions->first_candidate + i]);
+        if (var == SOLVER_NONE || strcmp(s->vars[var].name, job->name) != 0) {
+            continue;
+        }
+        
+        pkg_version_t version;
+        solver_var_version(s, var, &version);
+        if (installed == SOLVER_NONE || infinity_compare_versions(&version, &current) > 0) {
+            solver_add_choice(s, var);
+        }
+    }
+    
+    if (s->choice_count > choice) {
+        solver_add_choice_rule(s, RULE_JOB, SOLVER_NONE, dep, choice);
+    }
+}
+
+// Rules ruling out var alongside what dep names, of what the problem has
+static void solver_add_conflicts(solver_t* s, uint32_t var, uint32_t dep_id) {
+    const solver_dep_t* dep = &g_pool.deps[dep_id];
+    const char* name = pool_string(dep->name);
+    const char* constraint = pool_string(dep->constraint);
+    uint32_t choice = s->choice_count;
+    s->mark++;
+    
+    uint32_t name_id = solver_name(s, name, dep->name_hash, false);
+    uint32_t other = name_id == SOLVER_NONE ? SOLVER_NONE : s->names[name_id].first_var;
+    for (; other != SOLVER_NONE; other = s->vars[other].same_name) {
+        if (solver_var_satisfies(s, other, constraint)) {
+            solver_add_choice(s, other);
+        }
+    }
+    
+    for (uint32_t i = 0; i < dep->candidate_count; i++) {
+        uint32_t local = g_pool.local[g_pool.candidates[dep->first_candidate + i]];
+        if (local != SOLVER_NONE) {
+            solver_add_choice(s, local);
+        }
+    }
+    
+    if (!constraint[0]) {
+        for (uint32_t i = 0; i < s->provider_count; i++) {
+            if (s->providers[i].name_hash == dep->name_hash &&
+                strcmp(s->providers[i].name, name) == 0) {
+                solver_add_choice(s, s->providers[i].var);
+            }
+        }
+    }
+    
+    // A package conflicting with a name it provides or replaces is fine
+    for (uint32_t i = choice; i < s->choice_count; i++) {
+        uint32_t victim = LIT_VAR(s->choices[i]);
+        if (s->vars[victim].name_id != s->vars[var].name_id) {
+            uint32_t lits[2] = { LIT(var, 1), LIT(victim, 1) };
+            solver_add_rule(s, RULE_CONFLICTS, var, victim, lits, 2);
+        }
+    }
+    s->choice_count = choice;
+}
+
+// Every package the installed set or a job could bring in, breadth first
+// from them, with its rules; conflicts once all of them are known
+static void solver_build(solver_t* s, package_t* installed, const solver_job_t* jobs,
+                         uint32_t job_count, bool recommends) {
+    for (package_t* pkg = installed; pkg && !s->failed; pkg = pkg->next) {
+        uint32_t var = solver_var_for_package(s, pkg);
+        if (var == SOLVER_NONE) {
+            break;
+        }
+        s->vars[var].installed = true;
+        s->names[s->vars[var].name_id].installed = var;
+        
+        // The index has its provides if it has it
+        if (s->vars[var].entry != SOLVER_NONE) {
+            continue;
+        }
+        for (uint32_t i = 0; i < pkg->metadata.provide_count; i++) {
+            const char* name = pkg->metadata.provides[i].name;
+            if (solver_reserve(&s->failed, (void**)&s->providers, &s->provider_capacity,
+                               s->provider_count + 1, sizeof(solver_provider_t))) {
+                s->providers[s->provider_count++] = (solver_provider_t){
+                    infinity_index_hash(name), name, var
+                };
+            }
+        }
+    }
+    
+    for (uint32_t i = 0; i < job_count && !s->failed; i++) {
+        solver_add_job(s, &jobs[i]);
+    }
+    
+    // Variables are appended as they're found, so this reaches them all.
+    // Recommends of what's installed already were answered when it was.
+    for (uint32_t var = 0; var < s->var_count && !s->failed; var++) {
+        uint32_t count;
+        const uint32_t* deps = solver_var_deps(s, var, INDEX_DEP_DEPENDS, &count);
+        for (uint32_t i = 0; i < count && !s->failed; i++) {
+            uint32_t choice = s->choice_count;
+            solver_dep_choices(s, deps[i]);
+            solver_add_choice_rule(s, RULE_REQUIRES, var, deps[i], choice);
+        }
+        
+        if (recommends && !s->vars[var].installed) {
+            deps = solver_var_deps(s, var, INDEX_DEP_RECOMMENDS, &count);
+            for (uint32_t i = 0; i < count && !s->failed; i++) {
+                uint32_t choice = s->choice_count;
+                solver_dep_choices(s, deps[i]);
+                solver_add_choice_rule(s, RULE_RECOMMENDS, var, deps[i], choice);
+            }
+        }
+    }
+    
+    for (uint32_t var = 0; var < s->var_count && !s->failed; var++) {
+        uint32_t count;
+        const uint32_t* deps = solver_var_deps(s, var, INDEX_DEP_CONFLICTS, &count);
+        for (uint32_t i = 0; i < count && !s->failed; i++) {
+            solver_add_conflicts(s, var, deps[i]);
+        }
+    }
+    
+    // One version of each name
+    for (uint32_t name = 0; name < s->name_count && !s->failed; name++) {
+        for (uint32_t a = s->names[name].first_var; a != SOLVER_NONE; a = s->vars[a].same_name) {
+            for (uint32_t b = s->vars[a].same_name; b != SOLVER_NONE; b = s->vars[b].same_name) {
+                uint32_t lits[2] = { LIT(a, 1), LIT(b, 1) };
+                solver_add_rule(s, RULE_ONE_VERSION, a, b, lits, 2);
+            }
+        }
+    }
+    
+    for (uint32_t i = 0; i < job_count && !s->failed; i++) {
+        if (jobs[i].type != SOLVER_JOB_REMOVE || !jobs[i].name) {
+            continue;
+        }
+        
+        uint32_t name = solver_name(s, jobs[i].name, infinity_index_hash(jobs[i].name), false);
+        uint32_t var = name == SOLVER_NONE ? SOLVER_NONE : s->names[name].first_var;
+        for (; var != SOLVER_NONE; var = s->vars[var].same_name) {
+            uint32_t lit = LIT(var, 1);
+            solver_add_rule(s, RULE_JOB, var, SOLVER_NONE, &lit, 1);
+        }
+    }
+    
+    s->problem_rules = s->rule_count;
+}
+
+// =============================================================================
+// Search
+// =============================================================================
+
+static inline uint8_t solver_value(const solver_t* s, uint32_t lit) {
+    uint8_t value = s->vars[LIT_VAR(lit)].value;
+    return value == VALUE_UNSET ? VALUE_UNSET : value ^ LIT_NEGATED(lit);
+}
+
+static void solver_assign(solver_t* s, uint32_t lit, uint32_t reason) {
+    solver_var_t* var = &s->vars[LIT_VAR(lit)];
+    var->value = LIT_NEGATED(lit) ? VALUE_FALSE : VALUE_TRUE;
+    var->level = s->level;
+    var->reason = reason;
+    s->trail[s->trail_count++] = lit;
+}
+
+static void solver_watch(solver_t* s, uint32_t rule, uint32_t slot) {
+    uint32_t lit = s->lits[s->rules[rule].first + slot];
+    s->rules[rule].watch_next[slot] = s->watches[lit];
+    s->watches[lit] = (rule << 1) | slot;
+}
+
+// Each rule watches its first two literals, and is only looked at when
+// one of them goes false. Returns a rule left with every literal false,
+// or SOLVER_NONE.
+static uint32_t solver_propagate(solver_t* s) {
+    while (s->propagated < s->trail_count) {
+        uint32_t false_lit = s->trail[s->propagated++] ^ 1;
+        uint32_t* link = &s->watches[false_lit];
+        
+        while (*link != SOLVER_NONE) {
+            uint32_t watch = *link;
+            solver_rule_t* rule = &s->rules[watch >> 1];
+            uint32_t slot = watch & 1;
+            uint32_t* lits = &s->lits[rule->first];
+            uint32_t other = lits[slot ^ 1];
+            
+            if (solver_value(s, other) == VALUE_TRUE) {
+                link = &rule->watch_next[slot];
+                continue;
+            }
+            
+            // Move the watch to a literal that isn't false, if any
+            uint32_t k = 2;
+            while (k < rule->count && solver_value(s, lits[k]) == VALUE_FALSE) {
+                k++;
+            }
+            if (k < rule->count) {
+                lits[slot] = lits[k];
+                lits[k] = false_lit;
+                *link = rule->watch_next[slot];
+                rule->watch_next[slot] = s->watches[lits[slot]];
+                s->watches[lits[slot]] = watch;
+                continue;
+            }
+            
+            if (solver_value(s, other) == VALUE_FALSE) {
+                return watch >> 1;
+            }
+            solver_assign(s, other, watch >> 1);
+            link = &rule->watch_next[slot];
+        }
+    }
+    
+    return SOLVER_NONE;
+}
+
+static void solver_backtrack(solver_t* s, uint32_t level) {
+    if (s->level <= level) {
+        return;
+    }
+    
+    uint32_t start = s->level_start[level + 1];
+    for (uint32_t i = start; i < s->trail_count; i++) {
+        solver_var_t* var = &s->vars[LIT_VAR(s->trail[i])];
+        var->value = VALUE_UNSET;
+        var->reason = SOLVER_NONE;
+    }
+    
+    s->trail_count = start;
+    s->propagated = start;
+    s->level = level;
+    s->rule_cursor = 0;
+    s->var_cursor = 0;
+}
+
+// Resolve the conflict back to the first literal of its level that
+// implies all of it there, learn the rule that leaves, and jump back to
+// the level where the rule asserts that literal's negation
+static bool solver_learn(solver_t* s, uint32_t conflict) {
+    s->scratch_count = 1;
+    uint32_t pending = 0;
+    uint32_t lit = SOLVER_NONE;
+    uint32_t index = s->trail_count;
+    uint32_t rule = conflict;
+    
+    do {
+        const solver_rule_t* r = &s->rules[rule];
+        for (uint32_t i = 0; i < r->count; i++) {
+            uint32_t q = s->lits[r->first + i];
+            solver_var_t* var = &s->vars[LIT_VAR(q)];
+            if ((lit != SOLVER_NONE && LIT_VAR(q) == LIT_VAR(lit)) || var->seen ||
+                var->level == 0) {
+                continue;
+            }
+            
+            var->seen = true;
+            if (var->level == s->level) {
+                pending++;
+            } else if (solver_reserve(&s->failed, (void**)&s->scratch, &s->scratch_capacity,
+                                      s->scratch_count + 1, sizeof(uint32_t))) {
+                s->scratch[s->scratch_count++] = q;
+            } else {
+                return false;
+            }
+        }
+        
+        do {
+            lit = s->trail[--index];
+        } while (!s->vars[LIT_VAR(lit)].seen);
+        s->vars[LIT_VAR(lit)].seen = false;
+        rule = s->vars[LIT_VAR(lit)].reason;
+        pending--;
+    } while (pending > 0);
+    
+    s->scratch[0] = lit ^ 1;
+    
+    // The asserting literal and the latest of the rest are watched
+    uint32_t level = 0;
+    for (uint32_t i = 1; i < s->scratch_count; i++) {
+        s->vars[LIT_VAR(s->scratch[i])].seen = false;
+        if (s->vars[LIT_VAR(s->scratch[i])].level > level) {
+            level = s->vars[LIT_VAR(s->scratch[i])].level;
+            uint32_t swap = s->scratch[1];
+            s->scratch[1] = s->scratch[i];
+            s->scratch[i] = swap;
+        }
+    }
+    
+    uint32_t learned = solver_add_rule(s, RULE_LEARNED, SOLVER_NONE, SOLVER_NONE, s->scratch,
+                                       s->scratch_count);
+    if (learned == SOLVER_NONE) {
+        return false;
+    }
+    g_pool.stats.learned++;
+    
+    solver_backtrack(s, level);
+    if (s->rules[learned].count >= 2) {
+        solver_watch(s, learned, 0);
+        solver_watch(s, learned, 1);
+    }
+    solver_assign(s, s->lits[s->rules[learned].first], learned);
+    return true;
+}
+
+// First a job, or a chosen package's dependency, with nothing chosen for
+// it yet gets its best choice still open, so versions are tried best
+// first. Then every package left stays as it is: installed ones kept,
+// the rest not installed.
+static uint32_t solver_decide(solver_t* s) {
+    for (uint32_t n = 0; n < s->problem_rules; n++) {
+        uint32_t r = (s->rule_cursor + n) % s->problem_rules;
+        const solver_rule_t* rule = &s->rules[r];
+        if (rule->choice_count == 0 ||
+            (rule->type != RULE_JOB && s->vars[rule->var].value != VALUE_TRUE)) {
+            continue;
+        }
+        
+        uint32_t open = SOLVER_NONE;
+        bool satisfied = false;
+        for (uint32_t i = 0; i < rule->choice_count && !satisfied; i++) {
+            uint8_t value = solver_value(s, s->choices[rule->choice + i]);
+            satisfied = value == VALUE_TRUE;
+            if (value == VALUE_UNSET && open == SOLVER_NONE) {
+                open = s->choices[rule->choice + i];
+            }
+        }
+        
+        if (!satisfied && open != SOLVER_NONE) {
+            s->rule_cursor = r;
+            return open;
+        }
+    }
+    
+    for (; s->var_cursor < s->var_count; s->var_cursor++) {
+        if (s->vars[s->var_cursor].value == VALUE_UNSET) {
+            return LIT(s->var_cursor, !s->vars[s->var_cursor].installed);
+        }
+    }
+    
+    return SOLVER_NONE;
+}
+
+// =============================================================================
+// Results
+// =============================================================================
+
+static const char* solver_package_name(solver_t* s, uint32_t var) {
+    return var == SOLVER_NONE ? "" : s->vars[var].name;
+}
+
+// What a problem rule says, for a solve it made fail
+static void solver_explain_rule(solver_t* s, uint32_t rule, solver_state_t* state) {
+    const solver_rule_t* r = &s->rules[rule];
+    if (r->type == RULE_LEARNED || r->type == RULE_RECOMMENDS ||
+        state->conflict_count >= sizeof(state->conflicts) / sizeof(state->conflicts[0])) {
+        return;
+    }
+    
+    bool packages = r->type == RULE_CONFLICTS || r->type == RULE_ONE_VERSION;
+    const solver_dep_t* dep = !packages && r->other != SOLVER_NONE ? &g_pool.deps[r->other]
+                                                                    : NULL;
+    const char* dep_name = dep ? pool_string(dep->name) : "";
+    const char* constraint = dep ? pool_string(dep->constraint) : "";
+    const char* separator = constraint[0] ? " " : "";
+    const char* name = solver_package_name(s, r->var);
+    
+    typeof(state->conflicts[0])* conflict = &state->conflicts[state->conflict_count++];
+    conflict->pkg1 = r->var != SOLVER_NONE ? solver_var_package(s, r->var) : NULL;
+    conflict->pkg2 = packages ? solver_var_package(s, r->other) : NULL;
+    
+    switch (r->type) {
+        case RULE_JOB:
+            if (dep && r->choice_count == 0) {
+                snprintf(conflict->reason, sizeof(conflict->reason), "no package provides %s%s%s",
+                         dep_name, separator, constraint);
+            } else if (dep) {
+                snprintf(conflict->reason, sizeof(conflict->reason), "%s%s%s is to be installed",
+                         dep_name, separator, constraint);
+            } else if (r->count == 1 && LIT_NEGATED(s->lits[r->first])) {
+                snprintf(conflict->reason, sizeof(conflict->reason), "%s is to be removed", name);
+            } else {
+                snprintf(conflict->reason, sizeof(conflict->reason), "%s is to be installed",
+                         name);
+            }
+            break;
+        
+        case RULE_REQUIRES:
+            snprintf(conflict->reason, sizeof(conflict->reason), "%s requires %s%s%s", name,
+                     dep_name, separator, constraint);
+            break;
+        
+        case RULE_CONFLICTS:
+            snprintf(conflict->reason, sizeof(conflict->reason), "%s conflicts with %s", name,
+                     solver_package_name(s, r->other));
+            break;
+        
+        case RULE_ONE_VERSION:
+            snprintf(conflict->reason, sizeof(conflict->reason),
+                     "only one version of %s can be installed", name);
+            break;
+    }
+}
+
+// The problem rules a level 0 conflict follows from: the rule, and the
+// reasons for its literals, back through theirs
+static void solver_explain(solver_t* s, uint32_t conflict, solver_state_t* state) {
+    s->scratch_count = 0;
+    if (!solver_reserve(&s->failed, (void**)&s->scratch, &s->scratch_capacity, 1,
+                        sizeof(uint32_t))) {
+        return;
+    }
+    s->scratch[s->scratch_count++] = conflict;
+    
+    for (uint32_t i = 0; i < s->scratch_count; i++) {
+        uint32_t rule = s->scratch[i];
+        solver_explain_rule(s, rule, state);
+        
+        for (uint32_t l = 0; l < s->rules[rule].count; l++) {
+            solver_var_t* var = &s->vars[LIT_VAR(s->lits[s->rules[rule].first + l])];
+            if (var->seen || var->reason == SOLVER_NONE) {
+                continue;
+            }
+            var->seen = true;
+            if (!solver_reserve(&s->failed, (void**)&s->scratch, &s->scratch_capacity,
+                                s->scratch_count + 1, sizeof(uint32_t))) {
+                return;
+            }
+            s->scratch[s->scratch_count++] = var->reason;
+        }
+    }
+}
+
+// The state's queues from the solution, discovered last first: what a
+// package needs is found after it, so comes before it
+static bool solver_collect(solver_t* s, solver_state_t* state) {
+    size_t size = (s->var_count ? s->var_count : 1) * sizeof(package_t*);
+    state->install_queue = flux_allocate(NULL, size, FLUX_ALLOC_KERNEL);
+    state->upgrade_queue = flux_allocate(NULL, size, FLUX_ALLOC_KERNEL);
+    state->remove_queue = flux_allocate(NULL, size, FLUX_ALLOC_KERNEL);
+    if (!state->install_queue || !state->upgrade_queue || !state->remove_queue) {
+        return false;
+    }
+    
+    for (uint32_t var = s->var_count; var-- > 0;) {
+        const solver_var_t* v = &s->vars[var];
+        uint32_t installed = s->names[v->name_id].installed;
+        
+        if (v->value == VALUE_TRUE && !v->installed) {
+            package_t* pkg = solver_var_package(s, var);
+            if (!pkg) {
+                return false;
+            }
+            
+            if (installed != SOLVER_NONE && s->vars[installed].value == VALUE_FALSE) {
+                state->upgrade_queue[state->upgrade_count++] = pkg;
+            } else {
+                state->install_queue[state->install_count++] = pkg;
+            }
+        } else if (v->value == VALUE_FALSE && v->installed) {
+            // Removed, unless another version replaces it
+            uint32_t other = s->names[v->name_id].first_var;
+            while (other != SOLVER_NONE && s->vars[other].value != VALUE_TRUE) {
+                other = s->vars[other].same_name;
+            }
+            if (other == SOLVER_NONE) {
+                state->remove_queue[state->remove_count++] = v->pkg;
+            }
+        }
+    }
+    
+    return true;
+}
+
+// =============================================================================
+// Solving
+// =============================================================================
+
+static void solver_free(solver_t* s) {
+    // Leave the pool's map of index packages to variables empty
+    for (uint32_t var = 0; var < s->var_count; var++) {
+        if (s->vars[var].entry != SOLVER_NONE) {
+            g_pool.local[s->vars[var].entry] = SOLVER_NONE;
+        }
+    }
+    
+    flux_free(s->vars);
+    flux_free(s->rules);
+    flux_free(s->lits);
+    flux_free(s->choices);
+    flux_free(s->names);
+    flux_free(s->name_buckets);
+    flux_free(s->providers);
+    flux_free(s->deps);
+    flux_free(s->scratch);
+    flux_free(s->watches);
+    flux_free(s->trail);
+    flux_free(s->level_start);
+}
+
+// Unit rules hold from the start; the rest are propagated through watches
+static uint32_t solver_start(solver_t* s) {
+    size_t vars = s->var_count ? s->var_count : 1;
+    s->watches = flux_allocate(NULL, vars * 2 * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+    s->trail = flux_allocate(NULL, vars * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+    s->level_start = flux_allocate(NULL, (vars + 1) * sizeof(uint32_t), FLUX_ALLOC_KERNEL);
+    if (!s->watches || !s->trail || !s->level_start) {
+        s->failed = true;
+        return SOLVER_NONE;
+    }
+    memset(s->watches, 0xFF, vars * 2 * sizeof(uint32_t));
+    
+    for (uint32_t rule = 0; rule < s->problem_rules; rule++) {
+        const solver_rule_t* r = &s->rules[rule];
+        if (r->type == RULE_RECOMMENDS) {
+            continue;
+        }
+        
+        if (r->count >= 2) {
+            solver_watch(s, rule, 0);
+            solver_watch(s, rule, 1);
+        } else if (r->count == 0) {
+            return rule;
+        } else {
+            uint32_t lit = s->lits[r->first];
+            uint8_t value = solver_value(s, lit);
+            if (value == VALUE_FALSE) {
+                return rule;
+            }
+            if (value == VALUE_UNSET) {
+                solver_assign(s, lit, rule);
+            }
+        }
+    }
+    
+    return SOLVER_NONE;
+}
+
+// Propagate, learn from each conflict and jump back, decide again, until
+// every package is decided or a conflict needs no decision to happen
+static int solver_search(solver_t* s, solver_state_t* state) {
+    uint32_t conflict = solver_start(s);
+    
+    for (;;) {
+        if (conflict == SOLVER_NONE && !s->failed) {
+            conflict = solver_propagate(s);
+        }
+        if (s->failed) {
+            return -1;
+        }
+        
+        if (conflict != SOLVER_NONE) {
+            g_pool.stats.conflicts++;
+            if (s->level == 0) {
+                solver_explain(s, conflict, state);
+                return -1;
+            }
+            if (!solver_learn(s, conflict)) {
+                return -1;
+            }
+            conflict = SOLVER_NONE;
+            continue;
+        }
+        
+        uint32_t lit = solver_decide(s);
+        if (lit == SOLVER_NONE) {
+            return 0;
+        }
+        
+        g_pool.stats.decisions++;
+        s->level++;
+        s->level_start[s->level] = s->trail_count;
+        solver_assign(s, lit, SOLVER_NONE);
+    }
+}
+
+int infinity_solver_solve(infinity_index_t* index, package_t* installed,
+                          const solver_job_t* jobs, uint32_t job_count, bool recommends,
+                          solver_state_t* state) {
+    if (!index || !state || !pool_bind(index)) {
+        return -1;
+    }
+    
+    solver_t s = { .index = index };
+    g_pool.stats.solves++;
+    
+    solver_build(&s, installed, jobs, job_count, recommends);
+    int result = s.failed ? -1 : solver_search(&s, state);
+    if (result == 0 && !solver_collect(&s, state)) {
+        result = -1;
+    }
+    if (result != 0) {
+        g_pool.stats.failures++;
+    }
+    
+    // A pool left half-built by running out of memory isn't kept
+    bool failed = s.failed || g_pool.failed;
+    solver_free(&s);
+    if (failed) {
+        pool_free();
+    }
+    
+    return result;
+}
+
+void infinity_solver_free_state(solver_state_t* state) {
+    flux_free(state->install_queue);
+    flux_free(state->upgrade_queue);
+    flux_free(state->remove_queue);
+    state->install_queue = NULL;
+    state->upgrade_queue = NULL;
+    state->remove_queue = NULL;
+    state->install_count = 0;
+    state->upgrade_count = 0;
+    state->remove_count = 0;
+}
+
+void infinity_solver_get_stats(solver_stats_t* stats) {
+    *stats = g_pool.stats;
+}
+
+// =============================================================================
+// Initialization
+// =============================================================================
+
+void infinity_init_solver(void) {
+    memset(&g_pool, 0, sizeof(g_pool));
+}
+
+void infinity_solver_reset(void) {
+    pool_free();
+}
@@ -0,0 +1,62 @@
+/*
+ * Infinity Dependency Solver
+ * Conflict-driven clause learning over the package index
+ */
+
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include "infinity.h"
+#include "index.h"
+
+// =============================================================================
+// Solver Constants
+// =============================================================================
+
+// Job types
+#define SOLVER_JOB_INSTALL          0x01    // pkg, or name's best version satisfying constraint
+#define SOLVER_JOB_REMOVE           0x02    // name, and whatever can't stay without it
+#define SOLVER_JOB_UPGRADE          0x03    // name, to its best version
+
+// =============================================================================
+// Data Structures
+// =============================================================================
+
+typedef struct {
+    uint8_t type;
+    package_t* pkg;
+    const char* name;
+    const char* constraint;         // NULL for any version
+} solver_job_t;
+
+typedef struct {
+    uint64_t solves;
+    uint64_t failures;              // Jobs that couldn't be satisfied
+    uint64_t decisions;
+    uint64_t conflicts;
+    uint64_t learned;               // Rules learned from conflicts
+    uint64_t dep_hits;              // Dependencies already expanded by an earlier solve
+    uint64_t dep_misses;
+} solver_stats_t;
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// The solver keeps each dependency it expands, and each package's
+// dependencies, for every solve after until the index it was expanded
+// against changes; reset when it does. Callers serialise solves.
+void infinity_init_solver(void);
+void infinity_solver_reset(void);
+
+// Solve jobs against the installed packages and the index: on success the
+// state's queues hold what to install, upgrade and remove, dependencies
+// before their dependents; on failure its conflicts say why
+int infinity_solver_solve(infinity_index_t* index, package_t* installed,
+                          const solver_job_t* jobs, uint32_t job_count, bool recommends,
+                          solver_state_t* state);
+void infinity_solver_free_state(solver_state_t* state);
+
+void infinity_solver_get_stats(solver_stats_t* stats);
+
+#endif /* SOLVER_H */
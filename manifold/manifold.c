@@ -16,30 +16,471 @@
 static vfs_state_t g_vfs;
 static spinlock_t g_vfs_lock = SPINLOCK_INIT;
 
+// =============================================================================
+// Dentry Cache
+// =============================================================================
+
+// Walks take no locks: they run in read sections that writers wait out
+// before dropping what they unlinked, and each dentry carries a sequence
+// count so a walk that races with its removal backs off to ref-walk
+static continuum_reader_t g_vfs_readers[MAX_CPU_CORES];
+
+// Dentry bucket b is under shard b & (MANIFOLD_DENTRY_SHARDS - 1)
+typedef struct {
+    spinlock_t lock;
+} __attribute__((aligned(64))) vfs_dentry_shard_t;
+
+static vfs_dentry_shard_t g_dentry_shards[MANIFOLD_DENTRY_SHARDS];
+
+// FNV-1a over a name, run once as a walk scans the component in place
+#define MANIFOLD_HASH_INIT      2166136261U
+
+static inline uint32_t manifold_hash_step(uint32_t hash, char c) {
+    return (hash ^ (uint8_t)c) * 16777619U;
+}
+
+static uint32_t manifold_hash_len(const char* name, size_t len) {
+    uint32_t hash = MANIFOLD_HASH_INIT;
+    for (size_t i = 0; i < len; i++) {
+        hash = manifold_hash_step(hash, name[i]);
+    }
+    return hash;
+}
+
+uint32_t manifold_hash_name(const char* name) {
+    return manifold_hash_len(name, strlen(name));
+}
+
+// Seeded 64-bit mix of a pointer and a value; keys both caches
+static inline uint64_t manifold_mix(const void* object, uint64_t value) {
+    uint64_t key = g_vfs.hash_seed ^ (uint64_t)(uintptr_t)object;
+    key ^= value * 0x9E3779B97F4A7C15ULL;
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static inline spinlock_t* manifold_dentry_shard(uint64_t bucket) {
+    return &g_dentry_shards[bucket & (MANIFOLD_DENTRY_SHARDS - 1)].lock;
+}
+
+static inline bool manifold_dentry_matches(vfs_dentry_t* dentry, vfs_node_t* parent,
+                                           const char* name, size_t len, uint32_t hash) {
+    return dentry->hash == hash && dentry->parent == parent && dentry->len == len &&
+           memcmp(dentry->name, name, len) == 0;
+}
+
+// In a read section. Returns 1 with *node set (NULL for a negative
+// dentry), 0 on a miss, -1 if the dentry was being retired as it was read
+// or the chain ran too long.
+static int manifold_dentry_find(vfs_node_t* parent, const char* name, size_t len,
+                                uint32_t hash, vfs_node_t** node) {
+    uint64_t bucket = manifold_mix(parent, hash) & g_vfs.dentry_mask;
+    vfs_dentry_t* dentry = __atomic_load_n(&g_vfs.dentry_cache[bucket], __ATOMIC_ACQUIRE);
+    
+    for (uint32_t steps = 0; dentry; steps++) {
+        if (steps == MANIFOLD_WALK_STEPS) {
+            return -1;
+        }
+        
+        uint32_t seq = __atomic_load_n(&dentry->seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1) && manifold_dentry_matches(dentry, parent, name, len, hash)) {
+            vfs_node_t* found = dentry->node;
+            uint16_t flags = __atomic_load_n(&dentry->flags, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&dentry->seq, __ATOMIC_RELAXED) != seq) {
+                return -1;
+            }
+            
+            // Only the first hit after the hand passes writes the line
+            if (!(flags & VFS_DENTRY_REFERENCED)) {
+                __atomic_fetch_or(&dentry->flags, VFS_DENTRY_REFERENCED, __ATOMIC_RELAXED);
+            }
+            *node = found;
+            return 1;
+        }
+        dentry = __atomic_load_n(&dentry->hash_next, __ATOMIC_ACQUIRE);
+    }
+    return 0;
+}
+
+// manifold_dentry_find outside a read section, with the node referenced
+static int manifold_dentry_get(vfs_node_t* parent, const char* name, vfs_node_t** node) {
+    size_t len = strlen(name);
+    *node = NULL;
+    if (!parent || len == 0 || len > MANIFOLD_MAX_NAME) {
+        return 0;
+    }
+    
+    uint32_t cpu;
+    uint64_t flags = continuum_read_lock(g_vfs_readers, &cpu);
+    int found = manifold_dentry_find(parent, name, len, manifold_hash_len(name, len), node);
+    
+    // The dentry holds the node until we leave
+    if (found == 1 && *node) {
+        manifold_ref_node(*node);
+    } else if (found != 1) {
+        *node = NULL;
+    }
+    continuum_read_unlock(g_vfs_readers, cpu, flags);
+    return found;
+}
+
+vfs_node_t* manifold_dentry_lookup(vfs_node_t* parent, const char* name) {
+    vfs_node_t* node;
+    manifold_dentry_get(parent, name, &node);
+    return node;
+}
+
+// Unlink a dentry; caller holds its shard lock. Walks already on it see
+// its sequence go odd and back off.
+static void manifold_dentry_unlink(vfs_dentry_t** link, vfs_dentry_t** retired) {
+    vfs_dentry_t* dentry = *link;
+    __atomic_store_n(&dentry->seq, dentry->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(link, dentry->hash_next, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&g_vfs.cached_dentries, 1, __ATOMIC_RELAXED);
+    if (!dentry->node) {
+        __atomic_fetch_sub(&g_vfs.negative_dentries, 1, __ATOMIC_RELAXED);
+    }
+    
+    dentry->retired = *retired;
+    *retired = dentry;
+}
+
+// Free dentries chained through retired, with what they held, once no
+// walk can still be on them; returns how many there were
+static size_t manifold_dentry_free_retired(vfs_dentry_t* retired) {
+    if (!retired) {
+        return 0;
+    }
+    
+    size_t count = 0;
+    continuum_synchronize(g_vfs_readers);
+    while (retired) {
+        vfs_dentry_t* next = retired->retired;
+        manifold_unref_node(retired->node);
+        manifold_unref_node(retired->parent);
+        flux_free(retired);
+        retired = next;
+        count++;
+    }
+    return count;
+}
+
+// Unlink every dentry of bucket that drop picks, under its shard lock,
+// chaining them onto retired
+static void manifold_dentry_sweep(uint64_t bucket, bool (*drop)(vfs_dentry_t*, void*),
+                                  void* context, vfs_dentry_t** retired) {
+    spinlock_t* lock = manifold_dentry_shard(bucket);
+    
+    spinlock_acquire(lock);
+    for (vfs_dentry_t** link = &g_vfs.dentry_cache[bucket]; *link; ) {
+        if (drop(*link, context)) {
+            manifold_dentry_unlink(link, retired);
+        } else {
+            link = &(*link)->hash_next;
+        }
+    }
+    spinlock_release(lock);
+}
+
+// The CLOCK hand: clear referenced bits as it passes, and drop dentries
+// whose bit was already clear
+static bool manifold_dentry_clock_drop(vfs_dentry_t* dentry, void* context) {
+    uint64_t* remaining = context;
+    
+    if (*remaining == 0) {
+        return false;
+    }
+    if (__atomic_load_n(&dentry->flags, __ATOMIC_RELAXED) & VFS_DENTRY_REFERENCED) {
+        __atomic_fetch_and(&dentry->flags, (uint16_t)~VFS_DENTRY_REFERENCED, __ATOMIC_RELAXED);
+        return false;
+    }
+    
+    (*remaining)--;
+    return true;
+}
+
+// Evict up to count dentries, letting go of the nodes they held, which
+// the node cache's hand can then free. Returns how many it evicted.
+size_t manifold_dentry_evict(uint64_t count) {
+    if (!g_vfs.dentry_cache) {
+        return 0;
+    }
+    
+    uint64_t remaining = count;
+    uint64_t buckets = g_vfs.dentry_mask + 1;
+    vfs_dentry_t* retired = NULL;
+    
+    for (uint64_t visited = 0; visited < 2 * buckets && remaining > 0; visited++) {
+        uint64_t bucket = __atomic_fetch_add(&g_vfs.dentry_hand, 1, __ATOMIC_RELAXED) &
+                          g_vfs.dentry_mask;
+        manifold_dentry_sweep(bucket, manifold_dentry_clock_drop, &remaining, &retired);
+    }
+    
+    size_t freed = manifold_dentry_free_retired(retired);
+    __atomic_fetch_add(&g_vfs.dentry_evictions, freed, __ATOMIC_RELAXED);
+    return freed;
+}
+
+// What manifold_dentry_remove looks for
+typedef struct {
+    vfs_node_t* parent;
+    const char* name;
+    size_t len;
+    uint32_t hash;
+} vfs_dentry_match_t;
+
+static bool manifold_dentry_same_name(vfs_dentry_t* dentry, void* context) {
+    vfs_dentry_match_t* match = context;
+    return manifold_dentry_matches(dentry, match->parent, match->name, match->len,
+                                   match->hash);
+}
+
+static void manifold_dentry_insert(vfs_node_t* parent, const char* name, size_t len,
+                                   vfs_node_t* node) {
+    if (!parent || len == 0 || len > MANIFOLD_MAX_NAME || !g_vfs.dentry_cache) {
+        return;
+    }
+    
+    vfs_dentry_t* dentry = flux_allocate(NULL, sizeof(vfs_dentry_t), FLUX_ALLOC_KERNEL);
+    if (!dentry) {
+        return;
+    }
+    memcpy(dentry->name, name, len);
+    dentry->name[len] = '\0';
+    dentry->node = node;
+    dentry->parent = parent;
+    dentry->seq = 0;
+    dentry->hash = manifold_hash_len(name, len);
+    dentry->len = (uint16_t)len;
+    dentry->flags = 0;
+    dentry->timestamp = time(NULL);
+    dentry->retired = NULL;
+    manifold_ref_node(parent);
+    if (node) {
+        manifold_ref_node(node);
+    }
+    
+    uint64_t bucket = manifold_mix(parent, dentry->hash) & g_vfs.dentry_mask;
+    spinlock_t* lock = manifold_dentry_shard(bucket);
+    vfs_dentry_t* retired = NULL;
+    
+    spinlock_acquire(lock);
+    vfs_dentry_t** head = &g_vfs.dentry_cache[bucket];
+    for (vfs_dentry_t** link = head; *link; ) {
+        if (manifold_dentry_matches(*link, parent, name, len, dentry->hash)) {
+            manifold_dentry_unlink(link, &retired);
+        } else {
+            link = &(*link)->hash_next;
+        }
+    }
+    
+    dentry->hash_next = *head;
+    __atomic_store_n(head, dentry, __ATOMIC_RELEASE);
+    uint64_t dentries = __atomic_add_fetch(&g_vfs.cached_dentries, 1, __ATOMIC_RELAXED);
+    if (!node) {
+        __atomic_fetch_add(&g_vfs.negative_dentries, 1, __ATOMIC_RELAXED);
+    }
+    spinlock_release(lock);
+    
+    manifold_dentry_free_retired(retired);
+    
+    // kmanifoldd keeps the cache to size; inserts only step in once it has
+    // fallen a quarter behind
+    if (dentries > g_vfs.max_dentries + g_vfs.max_dentries / 4) {
+        manifold_dentry_evict(dentries - g_vfs.max_dentries);
+    }
+}
+
+void manifold_dentry_add(vfs_node_t* parent, const char* name, vfs_node_t* node) {
+    if (node) {
+        manifold_dentry_insert(parent, name, strlen(name), node);
+    }
+}
+
+// Remember that parent has no name, so lookups of it stop at the cache.
+// Negative dentries only ever take their share of the cache: a scan of
+// names that don't exist mustn't push out the ones that do.
+static void manifold_dentry_add_negative(vfs_node_t* parent, const char* name) {
+    if (__atomic_load_n(&g_vfs.negative_dentries, __ATOMIC_RELAXED) <
+        g_vfs.max_dentries / MANIFOLD_NEGATIVE_SHARE) {
+        manifold_dentry_insert(parent, name, strlen(name), NULL);
+    }
+}
+
+void manifold_dentry_remove(vfs_node_t* parent, const char* name) {
+    if (!parent || !g_vfs.dentry_cache) {
+        return;
+    }
+    
+    size_t len = strlen(name);
+    vfs_dentry_match_t match = {parent, name, len, manifold_hash_len(name, len)};
+    vfs_dentry_t* retired = NULL;
+    manifold_dentry_sweep(manifold_mix(parent, match.hash) & g_vfs.dentry_mask,
+                          manifold_dentry_same_name, &match, &retired);
+    manifold_dentry_free_retired(retired);
+}
+
+static bool manifold_dentry_under(vfs_dentry_t* dentry, void* context) {
+    return dentry->parent == context;
+}
+
+static bool manifold_dentry_on_mount(vfs_dentry_t* dentry, void* context) {
+    return dentry->parent->mount == context;
+}
+
+// Drop every dentry drop picks, in one pass over the table
+static void manifold_dentry_drop_all(bool (*drop)(vfs_dentry_t*, void*), void* context) {
+    if (!g_vfs.dentry_cache) {
+        return;
+    }
+    
+    vfs_dentry_t* retired = NULL;
+    for (uint64_t bucket = 0; bucket <= g_vfs.dentry_mask; bucket++) {
+        manifold_dentry_sweep(bucket, drop, context, &retired);
+    }
+    manifold_dentry_free_retired(retired);
+}
+
+void manifold_dentry_invalidate(vfs_node_t* parent) {
+    if (parent) {
+        manifold_dentry_drop_all(manifold_dentry_under, parent);
+    }
+}
+
 // =============================================================================
 // Path Resolution
 // =============================================================================
 
-vfs_node_t* manifold_lookup(const char* path) {
-    if (!path || path[0] != '/') {
-        return NULL;
+// Follow the filesystems mounted on node to the root of the topmost one.
+// In a read section: unmount waits it out before freeing the mount.
+static inline vfs_node_t* manifold_cross_mounts(vfs_node_t* node) {
+    vfs_mount_t* mount;
+    while ((mount = __atomic_load_n(&node->mounted, __ATOMIC_ACQUIRE)) && mount->root) {
+        node = mount->root;
+    }
+    return node;
+}
+
+// manifold_cross_mounts for a node held outside a read section; the
+// reference moves to the node returned
+static vfs_node_t* manifold_cross_mounts_ref(vfs_node_t* node) {
+    uint32_t cpu;
+    uint64_t flags = continuum_read_lock(g_vfs_readers, &cpu);
+    vfs_node_t* top = manifold_cross_mounts(node);
+    if (top != node) {
+        manifold_ref_node(top);
     }
+    continuum_read_unlock(g_vfs_readers, cpu, flags);
     
-    // Start from root
-    vfs_node_t* current = g_vfs.root_node;
-    if (!current) {
-        return NULL;
+    if (top != node) {
+        manifold_unref_node(node);
+    }
+    return top;
+}
+
+// The directory node was first found in, referenced. A mount's root goes
+// up through the directory it's mounted on, and the root is its own
+// parent.
+vfs_node_t* manifold_get_parent(vfs_node_t* node) {
+    while (node->mount && node->mount->root == node && node->mount->mount_point) {
+        node = node->mount->mount_point;
     }
     
-    manifold_ref_node(current);
+    vfs_node_t* parent = node->parent ? node->parent : node;
+    manifold_ref_node(parent);
+    return parent;
+}
+
+// Remember the directory a directory was found in, for ".."
+static void manifold_set_parent(vfs_node_t* node, vfs_node_t* parent) {
+    if (node->type != VFS_TYPE_DIRECTORY || __atomic_load_n(&node->parent, __ATOMIC_RELAXED)) {
+        return;
+    }
     
-    // Handle root path
-    if (path[1] == '\0') {
-        return current;
+    vfs_node_t* expected = NULL;
+    manifold_ref_node(parent);
+    if (!__atomic_compare_exchange_n(&node->parent, &expected, parent, false,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        manifold_unref_node(parent);
+    }
+}
+
+// The lockless walk: as much of path as the dentry cache holds, with no
+// locks and no references until the end. Returns the bytes of path
+// consumed, with *node the last node reached, referenced, or NULL if a
+// negative dentry says the path doesn't exist. It stops short of "..",
+// symbolic links, and anything the cache doesn't hold or that changed
+// under it, all of which ref-walk takes from there.
+static size_t manifold_walk_cached(const char* path, vfs_node_t** node) {
+    size_t consumed = 0;
+    size_t pos = 0;
+    int found = 1;
+    
+    uint32_t cpu;
+    uint64_t flags = continuum_read_lock(g_vfs_readers, &cpu);
+    vfs_node_t* current = manifold_cross_mounts(g_vfs.root_node);
+    for (;;) {
+        while (path[pos] == '/') {
+            pos++;
+        }
+        if (path[pos] == '\0') {
+            consumed = pos;
+            break;
+        }
+        
+        // Hash the component where it lies
+        size_t start = pos;
+        uint32_t hash = MANIFOLD_HASH_INIT;
+        while (path[pos] != '\0' && path[pos] != '/') {
+            hash = manifold_hash_step(hash, path[pos]);
+            pos++;
+        }
+        size_t len = pos - start;
+        
+        if (len == 1 && path[start] == '.') {
+            consumed = pos;
+            continue;
+        }
+        if (current->type != VFS_TYPE_DIRECTORY || len > MANIFOLD_MAX_NAME ||
+            (len == 2 && path[start] == '.' && path[start + 1] == '.')) {
+            break;
+        }
+        
+        vfs_node_t* next;
+        found = manifold_dentry_find(current, path + start, len, hash, &next);
+        if (found == 1 && !next) {
+            current = NULL;     // Known not to exist
+            break;
+        }
+        if (found != 1 || next->type == VFS_TYPE_SYMLINK) {
+            break;
+        }
+        current = manifold_cross_mounts(next);
+        consumed = pos;
     }
     
+    // Whatever current is, a dentry or a mount holds it until we leave
+    if (current) {
+        manifold_ref_node(current);
+    }
+    continuum_read_unlock(g_vfs_readers, cpu, flags);
+    
+    __atomic_fetch_add(found == 1 ? &g_vfs.cache_hits : &g_vfs.cache_misses, 1,
+                       __ATOMIC_RELAXED);
+    *node = current;
+    return consumed;
+}
+
+// The ref-walk: finish path from p a component at a time, holding a
+// reference on the node it's at (taking over current's) and asking the
+// filesystem for whatever the dentry cache doesn't have
+static vfs_node_t* manifold_walk_ref(const char* p, vfs_node_t* current) {
     char component[MANIFOLD_MAX_NAME + 1];
-    const char* p = path + 1;  // Skip initial '/'
     
     while (*p) {
         // Extract next path component
@@ -70,10 +511,8 @@ vfs_node_t* manifold_lookup(const char* path) {
         } else if (strcmp(component, "..") == 0) {
             // Parent directory
             vfs_node_t* parent = manifold_get_parent(current);
-            if (parent) {
-                manifold_unref_node(current);
-                current = parent;
-            }
+            manifold_unref_node(current);
+            current = manifold_cross_mounts_ref(parent);
         } else {
             // Check if current node is a directory
             if (current->type != VFS_TYPE_DIRECTORY) {
@@ -82,23 +521,21 @@ vfs_node_t* manifold_lookup(const char* path) {
             }
             
             // Check dentry cache first
-            vfs_dentry_t* dentry = manifold_dentry_lookup(current, component);
-            vfs_node_t* next = NULL;
+            vfs_node_t* next;
+            int found = manifold_dentry_get(current, component, &next);
             
-            if (dentry) {
-                next = dentry->node;
-                manifold_ref_node(next);
-                g_vfs.cache_hits++;
-            } else {
+            if (found != 1) {
                 // Call filesystem lookup
                 if (current->ops && current->ops->lookup) {
                     next = current->ops->lookup(current, component);
                     if (next) {
                         // Add to dentry cache
+                        manifold_set_parent(next, current);
                         manifold_dentry_add(current, component, next);
+                    } else {
+                        manifold_dentry_add_negative(current, component);
                     }
                 }
-                g_vfs.cache_misses++;
             }
             
             if (!next) {
@@ -122,7 +559,10 @@ vfs_node_t* manifold_lookup(const char* path) {
             }
             
             manifold_unref_node(current);
-            current = next;
+            if (!next) {
+                return NULL;
+            }
+            current = manifold_cross_mounts_ref(next);
         }
         
         // Move to next component
@@ -133,10 +573,59 @@ vfs_node_t* manifold_lookup(const char* path) {
         }
     }
     
-    g_vfs.lookups++;
     return current;
 }
 
+vfs_node_t* manifold_lookup(const char* path) {
+    if (!path || path[0] != '/' || !g_vfs.root_node) {
+        return NULL;
+    }
+    
+    __atomic_fetch_add(&g_vfs.lookups, 1, __ATOMIC_RELAXED);
+    
+    // Cached paths resolve without a lock; the rest continues by reference
+    // from wherever the lockless walk stopped
+    vfs_node_t* current;
+    size_t consumed = manifold_walk_cached(path, &current);
+    if (!current || path[consumed] == '\0') {
+        return current;
+    }
+    
+    __atomic_fetch_add(&g_vfs.walk_fallbacks, 1, __ATOMIC_RELAXED);
+    return manifold_walk_ref(path + consumed, current);
+}
+
+int manifold_split_path(const char* path, char* parent, char* name) {
+    if (!path || path[0] != '/') {
+        return -1;
+    }
+    
+    // Ignore trailing slashes
+    size_t end = strlen(path);
+    while (end > 1 && path[end - 1] == '/') {
+        end--;
+    }
+    
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') {
+        start--;
+    }
+    
+    size_t len = end - start;
+    if (len == 0 || len > MANIFOLD_MAX_NAME || start >= MANIFOLD_MAX_PATH) {
+        return -1;
+    }
+    
+    memcpy(name, path + start, len);
+    name[len] = '\0';
+    
+    // The parent keeps its leading slash, so "/a" splits into "/" and "a"
+    size_t parent_len = start > 1 ? start - 1 : 1;
+    memcpy(parent, path, parent_len);
+    parent[parent_len] = '\0';
+    return 0;
+}
+
 // =============================================================================
 // File Operations
 // =============================================================================
@@ -168,6 +657,10 @@ int manifold_open(const char* path, uint32_t flags, uint32_t mode) {
             
             if (parent->ops && parent->ops->create) {
                 int result = parent->ops->create(parent, name, mode, &node);
+                if (result == 0) {
+                    // Replaces any negative dentry for the name
+                    manifold_dentry_add(parent, name, node);
+                }
                 manifold_unref_node(parent);
                 if (result != 0) {
                     return result;
@@ -252,21 +745,107 @@ int manifold_open(const char* path, uint32_t flags, uint32_t mode) {
     return fd;
 }
 
+int manifold_create(const char* path, uint32_t mode) {
+    char parent_path[MANIFOLD_MAX_PATH];
+    char name[MANIFOLD_MAX_NAME + 1];
+    
+    if (manifold_split_path(path, parent_path, name) != 0) {
+        return -EINVAL;
+    }
+    
+    vfs_node_t* parent = manifold_lookup(parent_path);
+    if (!parent) {
+        return -ENOENT;
+    }
+    
+    if (parent->type != VFS_TYPE_DIRECTORY) {
+        manifold_unref_node(parent);
+        return -ENOTDIR;
+    }
+    
+    if (!manifold_can_write(parent, temporal_get_current_uid(), temporal_get_current_gid())) {
+        manifold_unref_node(parent);
+        return -EACCES;
+    }
+    
+    int result = -ENOSYS;
+    if (parent->ops && parent->ops->create) {
+        vfs_node_t* node = NULL;
+        result = parent->ops->create(parent, name, mode, &node);
+        if (result == 0) {
+            // Replaces any negative dentry for the name
+            manifold_dentry_add(parent, name, node);
+            manifold_unref_node(node);
+        }
+    }
+    
+    manifold_unref_node(parent);
+    return result;
+}
+
+// Nodes with a page cache mapping read and write through it, at an
+// explicit offset; the filesystem's own read and write only see the rest
+static ssize_t manifold_cached_read(vfs_node_t* node, page_cache_ra_t* ra, void* buffer,
+                                    size_t size, uint64_t offset) {
+    uint64_t file_size = __atomic_load_n(&node->size, __ATOMIC_ACQUIRE);
+    if (offset >= file_size) {
+        return 0;
+    }
+    if (size > file_size - offset) {
+        size = file_size - offset;
+    }
+    
+    if (page_cache_read_ahead(node->mapping, ra, offset, buffer, size) != 0) {
+        return -EIO;
+    }
+    return (ssize_t)size;
+}
+
+// Writes past the end grow the file, and with it what readahead covers
+static void manifold_cached_grow(vfs_node_t* node, uint64_t end) {
+    spinlock_acquire(&node->lock);
+    if (end > node->size) {
+        __atomic_store_n(&node->size, end, __ATOMIC_RELEASE);
+        node->mapping->size = end;
+    }
+    spinlock_release(&node->lock);
+}
+
+// Dirty pages need somewhere to go, so only mappings with write_page take
+// writes
+static inline bool manifold_cache_writable(vfs_node_t* node) {
+    return node->mapping && node->mapping->ops && node->mapping->ops->write_page;
+}
+
+static ssize_t manifold_cached_write(vfs_node_t* node, const void* buffer, size_t size,
+                                     uint64_t offset) {
+    if (page_cache_write(node->mapping, offset, buffer, size) != 0) {
+        return -EIO;
+    }
+    
+    manifold_cached_grow(node, offset + size);
+    return (ssize_t)size;
+}
+
 ssize_t manifold_read(int fd, void* buffer, size_t size) {
     vfs_file_t* file = process_get_file(temporal_get_current_process(), fd);
     if (!file) {
         return -EBADF;
     }
     
-    if (!(file->flags & (VFS_O_RDONLY | VFS_O_RDWR))) {
+    // O_RDONLY is 0: only write-only files can't be read
+    if (file->flags & VFS_O_WRONLY) {
         return -EBADF;
     }
     
-    if (!file->node->ops || !file->node->ops->read) {
+    ssize_t result;
+    if (file->node->mapping) {
+        result = manifold_cached_read(file->node, &file->ra, buffer, size, file->offset);
+    } else if (file->node->ops && file->node->ops->read) {
+        result = file->node->ops->read(file, buffer, size);
+    } else {
         return -ENOSYS;
     }
-    
-    ssize_t result = file->node->ops->read(file, buffer, size);
     if (result > 0) {
         file->offset += result;
         file->node->atime = time(NULL);
@@ -285,7 +864,8 @@ ssize_t manifold_write(int fd, const void* buffer, size_t size) {
         return -EBADF;
     }
     
-    if (!file->node->ops || !file->node->ops->write) {
+    bool cached = manifold_cache_writable(file->node);
+    if (!cached && (!file->node->ops || !file->node->ops->write)) {
         return -ENOSYS;
     }
     
@@ -294,7 +874,12 @@ ssize_t manifold_write(int fd, const void* buffer, size_t size) {
         file->offset = file->node->size;
     }
     
-    ssize_t result = file->node->ops->write(file, buffer, size);
+    ssize_t result;
+    if (cached) {
+        result = manifold_cached_write(file->node, buffer, size, file->offset);
+    } else {
+        result = file->node->ops->write(file, buffer, size);
+    }
     if (result > 0) {
         file->offset += result;
         file->node->mtime = time(NULL);
@@ -304,6 +889,211 @@ ssize_t manifold_write(int fd, const void* buffer, size_t size) {
     return result;
 }
 
+// Positional and vectored I/O work at an explicit offset and leave the
+// file's own alone, so threads sharing a file don't race on it. A
+// filesystem's readv and writev take the whole vector; otherwise the page
+// cache copies it a page at a time, or pread and pwrite take it a segment
+// at a time.
+static ssize_t manifold_file_readv(vfs_file_t* file, const page_cache_iovec_t* iov,
+                                   uint32_t count, off_t offset) {
+    vfs_node_t* node = file->node;
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    
+    if (node->ops && node->ops->readv) {
+        return node->ops->readv(file, iov, count, offset);
+    }
+    
+    if (node->mapping) {
+        page_cache_iter_t iter;
+        uint64_t length = page_cache_iter_init(&iter, iov, count);
+        uint64_t file_size = __atomic_load_n(&node->size, __ATOMIC_ACQUIRE);
+        if ((uint64_t)offset >= file_size) {
+            return 0;
+        }
+        if (length > file_size - offset) {
+            length = file_size - offset;
+        }
+        if (page_cache_readv(node->mapping, &file->ra, offset, &iter, length) != 0) {
+            return -EIO;
+        }
+        return (ssize_t)length;
+    }
+    
+    if (!node->ops || !node->ops->pread) {
+        return -ENOSYS;
+    }
+    
+    ssize_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        ssize_t result = node->ops->pread(file, iov[i].base, iov[i].length, offset + total);
+        if (result < 0) {
+            return total > 0 ? total : result;
+        }
+        total += result;
+        if ((size_t)result < iov[i].length) {
+            break;      // End of file
+        }
+    }
+    return total;
+}
+
+static ssize_t manifold_file_writev(vfs_file_t* file, const page_cache_iovec_t* iov,
+                                    uint32_t count, off_t offset) {
+    vfs_node_t* node = file->node;
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    
+    if (node->ops && node->ops->writev) {
+        return node->ops->writev(file, iov, count, offset);
+    }
+    
+    if (manifold_cache_writable(node)) {
+        page_cache_iter_t iter;
+        size_t length = page_cache_iter_init(&iter, iov, count);
+        if (page_cache_writev(node->mapping, offset, &iter, length) != 0) {
+            return -EIO;
+        }
+        manifold_cached_grow(node, offset + length);
+        return (ssize_t)length;
+    }
+    
+    if (!node->ops || !node->ops->pwrite) {
+        return -ENOSYS;
+    }
+    
+    ssize_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        ssize_t result = node->ops->pwrite(file, iov[i].base, iov[i].length, offset + total);
+        if (result < 0) {
+            return total > 0 ? total : result;
+        }
+        total += result;
+        if ((size_t)result < iov[i].length) {
+            break;
+        }
+    }
+    return total;
+}
+
+static vfs_file_t* manifold_readable_file(int fd) {
+    vfs_file_t* file = process_get_file(temporal_get_current_process(), fd);
+    return file && !(file->flags & VFS_O_WRONLY) ? file : NULL;
+}
+
+static vfs_file_t* manifold_writable_file(int fd) {
+    vfs_file_t* file = process_get_file(temporal_get_current_process(), fd);
+    return file && (file->flags & (VFS_O_WRONLY | VFS_O_RDWR)) ? file : NULL;
+}
+
+ssize_t manifold_pread(int fd, void* buffer, size_t size, off_t offset) {
+    vfs_file_t* file = manifold_readable_file(fd);
+    if (!file) {
+        return -EBADF;
+    }
+    
+    ssize_t result;
+    if (file->node->ops && file->node->ops->pread && offset >= 0) {
+        result = file->node->ops->pread(file, buffer, size, offset);
+    } else {
+        page_cache_iovec_t iov = { buffer, size };
+        result = manifold_file_readv(file, &iov, 1, offset);
+    }
+    
+    if (result > 0) {
+        file->node->atime = time(NULL);
+    }
+    return result;
+}
+
+ssize_t manifold_pwrite(int fd, const void* buffer, size_t size, off_t offset) {
+    vfs_file_t* file = manifold_writable_file(fd);
+    if (!file) {
+        return -EBADF;
+    }
+    
+    ssize_t result;
+    if (file->node->ops && file->node->ops->pwrite && offset >= 0) {
+        result = file->node->ops->pwrite(file, buffer, size, offset);
+    } else {
+        page_cache_iovec_t iov = { (void*)buffer, size };
+        result = manifold_file_writev(file, &iov, 1, offset);
+    }
+    
+    if (result > 0) {
+        file->node->mtime = time(NULL);
+        file->node->ctime = file->node->mtime;
+    }
+    return result;
+}
+
+ssize_t manifold_readv(int fd, const page_cache_iovec_t* iov, uint32_t count, off_t offset) {
+    vfs_file_t* file = manifold_readable_file(fd);
+    if (!file) {
+        return -EBADF;
+    }
+    
+    ssize_t result = manifold_file_readv(file, iov, count, offset);
+    if (result > 0) {
+        file->node->atime = time(NULL);
+    }
+    return result;
+}
+
+ssize_t manifold_writev(int fd, const page_cache_iovec_t* iov, uint32_t count, off_t offset) {
+    vfs_file_t* file = manifold_writable_file(fd);
+    if (!file) {
+        return -EBADF;
+    }
+    
+    ssize_t result = manifold_file_writev(file, iov, count, offset);
+    if (result > 0) {
+        file->node->mtime = time(NULL);
+        file->node->ctime = file->node->mtime;
+    }
+    return result;
+}
+
+// Map a file's cached pages into domain (see page_cache_mmap for flags
+// and alignment). Shared writable mappings need a file open for writing
+// on a writable mount. Unmap before the filesystem is unmounted.
+page_cache_vma_t* manifold_mmap(int fd, struct memory_domain* domain, uint64_t vaddr,
+                                uint64_t offset, size_t length, uint32_t flags) {
+    vfs_file_t* file = manifold_readable_file(fd);
+    if (!file || file->node->type != VFS_TYPE_REGULAR) {
+        return NULL;
+    }
+    
+    vfs_node_t* node = file->node;
+    if ((flags & FLUX_MAP_SHARED) && (flags & FLUX_MAP_WRITE) &&
+        (!(file->flags & (VFS_O_WRONLY | VFS_O_RDWR)) ||
+         (node->mount && (node->mount->flags & VFS_MNT_RDONLY)))) {
+        return NULL;
+    }
+    
+    if (!node->ops || !node->ops->mmap) {
+        return NULL;
+    }
+    return node->ops->mmap(file, domain, vaddr, offset, length, flags);
+}
+
+// The cached pages themselves are mapped; shared writable mappings write
+// back through the mapping's write_page, so it needs one
+page_cache_vma_t* manifold_generic_mmap(vfs_file_t* file, struct memory_domain* domain,
+                                        uint64_t vaddr, uint64_t offset, size_t length,
+                                        uint32_t flags) {
+    vfs_node_t* node = file->node;
+    if (!node->mapping) {
+        return NULL;
+    }
+    if ((flags & FLUX_MAP_SHARED) && (flags & FLUX_MAP_WRITE) && !manifold_cache_writable(node)) {
+        return NULL;
+    }
+    return page_cache_mmap(node->mapping, domain, vaddr, offset, length, flags);
+}
+
 int manifold_close(int fd) {
     vfs_file_t* file = process_remove_file(temporal_get_current_process(), fd);
     if (!file) {
@@ -323,6 +1113,48 @@ int manifold_close(int fd) {
     return 0;
 }
 
+// =============================================================================
+// Filesystem Registration
+// =============================================================================
+
+int manifold_register_filesystem(vfs_filesystem_t* fs) {
+    if (!fs || fs->name[0] == '\0') {
+        return -EINVAL;
+    }
+    
+    spinlock_acquire(&g_vfs_lock);
+    for (vfs_filesystem_t* existing = g_vfs.filesystems; existing; existing = existing->next) {
+        if (strcmp(existing->name, fs->name) == 0) {
+            spinlock_release(&g_vfs_lock);
+            return -EEXIST;
+        }
+    }
+    spinlock_release(&g_vfs_lock);
+    
+    if (fs->init) {
+        int result = fs->init();
+        if (result != 0) {
+            return result;
+        }
+    }
+    
+    spinlock_acquire(&g_vfs_lock);
+    fs->next = g_vfs.filesystems;
+    g_vfs.filesystems = fs;
+    spinlock_release(&g_vfs_lock);
+    return 0;
+}
+
+vfs_filesystem_t* manifold_find_filesystem(const char* name) {
+    spinlock_acquire(&g_vfs_lock);
+    vfs_filesystem_t* fs = g_vfs.filesystems;
+    while (fs && strcmp(fs->name, name) != 0) {
+        fs = fs->next;
+    }
+    spinlock_release(&g_vfs_lock);
+    return fs;
+}
+
 // =============================================================================
 // Mount Operations
 // =============================================================================
@@ -390,6 +1222,11 @@ int manifold_mount(const char* source, const char* target, const char* fstype,
     g_vfs.mounts = mount;
     spinlock_release(&g_vfs_lock);
     
+    // Walks cross into the new root from here on
+    if (mount->root) {
+        __atomic_store_n(&mount_point->mounted, mount, __ATOMIC_RELEASE);
+    }
+    
     return 0;
 }
 
@@ -404,14 +1241,19 @@ int manifold_unmount(const char* target) {
             *prev = mount->next;
             spinlock_release(&g_vfs_lock);
             
+            // Wait out walks that crossed into the mount, then drop what
+            // the caches hold of it
+            __atomic_store_n(&mount->mount_point->mounted, NULL, __ATOMIC_RELEASE);
+            continuum_synchronize(g_vfs_readers);
+            manifold_dentry_drop_all(manifold_dentry_on_mount, mount);
+            manifold_unref_node(mount->root);
+            manifold_cache_purge(mount);
+            
             // Call filesystem unmount
             if (mount->fs->ops && mount->fs->ops->unmount) {
                 mount->fs->ops->unmount(mount);
             }
             
-            // Invalidate dentry cache for this mount
-            manifold_dentry_invalidate(mount->root);
-            
             // Release mount point
             manifold_unref_node(mount->mount_point);
             
@@ -458,8 +1300,9 @@ int manifold_mkdir(const char* path, uint32_t mode) {
     }
     
     // Check if already exists
-    vfs_dentry_t* existing = manifold_dentry_lookup(parent, name);
+    vfs_node_t* existing = manifold_dentry_lookup(parent, name);
     if (existing) {
+        manifold_unref_node(existing);
         manifold_unref_node(parent);
         return -EEXIST;
     }
@@ -468,6 +1311,10 @@ int manifold_mkdir(const char* path, uint32_t mode) {
     int result = -ENOSYS;
     if (parent->ops && parent->ops->mkdir) {
         result = parent->ops->mkdir(parent, name, mode);
+        if (result == 0) {
+            // Drop any negative dentry; the next lookup finds the directory
+            manifold_dentry_remove(parent, name);
+        }
     }
     
     manifold_unref_node(parent);
@@ -526,73 +1373,486 @@ int manifold_rmdir(const char* path) {
     return result;
 }
 
+int manifold_rename(const char* old_path, const char* new_path) {
+    char old_parent_path[MANIFOLD_MAX_PATH];
+    char old_name[MANIFOLD_MAX_NAME + 1];
+    char new_parent_path[MANIFOLD_MAX_PATH];
+    char new_name[MANIFOLD_MAX_NAME + 1];
+    
+    if (manifold_split_path(old_path, old_parent_path, old_name) != 0 ||
+        manifold_split_path(new_path, new_parent_path, new_name) != 0) {
+        return -EINVAL;
+    }
+    
+    vfs_node_t* old_parent = manifold_lookup(old_parent_path);
+    if (!old_parent) {
+        return -ENOENT;
+    }
+    
+    vfs_node_t* new_parent = manifold_lookup(new_parent_path);
+    if (!new_parent) {
+        manifold_unref_node(old_parent);
+        return -ENOENT;
+    }
+    
+    int result = 0;
+    uint32_t uid = temporal_get_current_uid();
+    uint32_t gid = temporal_get_current_gid();
+    
+    if (new_parent->type != VFS_TYPE_DIRECTORY) {
+        result = -ENOTDIR;
+    } else if (old_parent->mount != new_parent->mount) {
+        result = -EXDEV;
+    } else if (!manifold_can_write(old_parent, uid, gid) ||
+               !manifold_can_write(new_parent, uid, gid)) {
+        result = -EACCES;
+    } else if (!old_parent->ops || !old_parent->ops->rename) {
+        result = -ENOSYS;
+    }
+    
+    vfs_node_t* node = NULL;
+    if (result == 0) {
+        node = manifold_dentry_lookup(old_parent, old_name);
+        if (!node && old_parent->ops->lookup) {
+            node = old_parent->ops->lookup(old_parent, old_name);
+        }
+        result = old_parent->ops->rename(old_parent, old_name, new_parent, new_name);
+    }
+    
+    if (result == 0) {
+        // Both names changed: the old one is gone and the new one may have
+        // had a negative dentry or named what the rename replaced
+        manifold_dentry_remove(old_parent, old_name);
+        manifold_dentry_remove(new_parent, new_name);
+        
+        // A directory's ".." follows it
+        if (node && node->type == VFS_TYPE_DIRECTORY) {
+            manifold_ref_node(new_parent);
+            manifold_unref_node(__atomic_exchange_n(&node->parent, new_parent,
+                                                    __ATOMIC_ACQ_REL));
+        }
+    }
+    
+    manifold_unref_node(node);
+    manifold_unref_node(new_parent);
+    manifold_unref_node(old_parent);
+    return result;
+}
+
+// =============================================================================
+// Node Management
+// =============================================================================
+
+vfs_node_t* manifold_alloc_node(void) {
+    vfs_node_t* node = flux_allocate(NULL, sizeof(vfs_node_t),
+                                    FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!node) {
+        return NULL;
+    }
+    
+    node->ref_count = 1;
+    spinlock_init(&node->lock);
+    return node;
+}
+
+void manifold_free_node(vfs_node_t* node) {
+    if (!node) {
+        return;
+    }
+    
+    if (node->ops && node->ops->release) {
+        node->ops->release(node);
+    }
+    manifold_unref_node(node->parent);
+    flux_free(node);
+}
+
+void manifold_ref_node(vfs_node_t* node) {
+    __atomic_fetch_add(&node->ref_count, 1, __ATOMIC_RELAXED);
+}
+
+// A cached node outlives its last reference; the clock hand frees it later
+void manifold_unref_node(vfs_node_t* node) {
+    if (!node) {
+        return;
+    }
+    
+    if (__atomic_sub_fetch(&node->ref_count, 1, __ATOMIC_ACQ_REL) == 0 &&
+        !(__atomic_load_n(&node->cache_flags, __ATOMIC_ACQUIRE) & VFS_NODE_CACHED)) {
+        manifold_free_node(node);
+    }
+}
+
 // =============================================================================
 // Cache Management
 // =============================================================================
 
+typedef struct vfs_node_table {
+    uint64_t mask;
+    vfs_node_t* buckets[];
+} vfs_node_table_t;
+
+// Bucket b of any table is under shard b & (MANIFOLD_NODE_SHARDS - 1):
+// keys sharing a bucket share their low bits, so a resize never moves a
+// node to another shard
+typedef struct {
+    spinlock_t lock;
+} __attribute__((aligned(64))) vfs_node_shard_t;
+
+static vfs_node_shard_t g_node_shards[MANIFOLD_NODE_SHARDS];
+static spinlock_t g_node_resize_lock = SPINLOCK_INIT;  // Taken before any shard
+
+static inline uint64_t manifold_node_key(vfs_mount_t* mount, uint64_t ino) {
+    return manifold_mix(mount, ino);
+}
+
+static inline spinlock_t* manifold_node_shard(uint64_t bucket) {
+    return &g_node_shards[bucket & (MANIFOLD_NODE_SHARDS - 1)].lock;
+}
+
 vfs_node_t* manifold_cache_lookup(vfs_mount_t* mount, uint64_t ino) {
-    uint32_t hash = (uint32_t)(ino ^ (uint64_t)mount) % 1024;
+    if (!g_vfs.node_table) {
+        return NULL;
+    }
     
-    spinlock_acquire(&g_vfs_lock);
+    uint64_t key = manifold_node_key(mount, ino);
+    spinlock_t* lock = manifold_node_shard(key);
     
-    vfs_node_t* node = g_vfs.node_cache[hash];
-    while (node) {
-        if (node->mount == mount && node->ino == ino) {
-            // Move to front of LRU
-            if (node != g_vfs.lru_head) {
-                if (node->lru_prev) {
-                    node->lru_prev->lru_next = node->lru_next;
-                }
-                if (node->lru_next) {
-                    node->lru_next->lru_prev = node->lru_prev;
-                } else {
-                    g_vfs.lru_tail = node->lru_prev;
-                }
-                
-                node->lru_prev = NULL;
-                node->lru_next = g_vfs.lru_head;
-                g_vfs.lru_head->lru_prev = node;
-                g_vfs.lru_head = node;
+    spinlock_acquire(lock);
+    vfs_node_table_t* table = g_vfs.node_table;   // Stable under any shard lock
+    vfs_node_t* node = table->buckets[key & table->mask];
+    while (node && (node->mount != mount || node->ino != ino)) {
+        node = node->hash_next;
+    }
+    
+    if (node) {
+        manifold_ref_node(node);
+        
+        // Only the first hit after the hand passes writes the flags
+        if (!(__atomic_load_n(&node->cache_flags, __ATOMIC_RELAXED) & VFS_NODE_REFERENCED)) {
+            __atomic_fetch_or(&node->cache_flags, VFS_NODE_REFERENCED, __ATOMIC_RELAXED);
+        }
+    }
+    spinlock_release(lock);
+    
+    return node;
+}
+
+// Returns the node cached for node's mount and inode number: node itself,
+// still holding the caller's reference, or one another lookup cached
+// first, referenced, in which case the caller frees node
+vfs_node_t* manifold_cache_insert(vfs_node_t* node) {
+    if (!g_vfs.node_table) {
+        return node;
+    }
+    
+    uint64_t key = manifold_node_key(node->mount, node->ino);
+    spinlock_t* lock = manifold_node_shard(key);
+    
+    spinlock_acquire(lock);
+    vfs_node_table_t* table = g_vfs.node_table;
+    vfs_node_t** head = &table->buckets[key & table->mask];
+    for (vfs_node_t* existing = *head; existing; existing = existing->hash_next) {
+        if (existing->mount == node->mount && existing->ino == node->ino) {
+            manifold_ref_node(existing);
+            spinlock_release(lock);
+            return existing;
+        }
+    }
+    
+    node->hash_next = *head;
+    *head = node;
+    __atomic_fetch_or(&node->cache_flags, VFS_NODE_CACHED | VFS_NODE_REFERENCED,
+                      __ATOMIC_RELEASE);
+    uint64_t nodes = __atomic_add_fetch(&g_vfs.cached_nodes, 1, __ATOMIC_RELAXED);
+    uint64_t buckets = table->mask + 1;
+    spinlock_release(lock);
+    
+    // kmanifoldd grows the table and keeps the cache to size; inserts only
+    // step in once it has fallen a quarter behind
+    if (nodes > buckets * MANIFOLD_NODE_LOAD && buckets < MANIFOLD_NODE_BUCKETS_MAX) {
+        __atomic_store_n(&g_vfs.node_grow_wanted, true, __ATOMIC_RELAXED);
+    }
+    if (nodes > g_vfs.max_nodes + g_vfs.max_nodes / 4) {
+        manifold_cache_evict(nodes - g_vfs.max_nodes);
+    }
+    
+    return node;
+}
+
+// The caller holds a reference, so dropping it frees the node
+void manifold_cache_remove(vfs_node_t* node) {
+    if (!node || !g_vfs.node_table) {
+        return;
+    }
+    
+    uint64_t key = manifold_node_key(node->mount, node->ino);
+    spinlock_t* lock = manifold_node_shard(key);
+    
+    spinlock_acquire(lock);
+    vfs_node_table_t* table = g_vfs.node_table;
+    for (vfs_node_t** link = &table->buckets[key & table->mask]; *link;
+         link = &(*link)->hash_next) {
+        if (*link == node) {
+            *link = node->hash_next;
+            node->hash_next = NULL;
+            __atomic_fetch_and(&node->cache_flags, ~(uint32_t)VFS_NODE_CACHED,
+                               __ATOMIC_RELEASE);
+            __atomic_fetch_sub(&g_vfs.cached_nodes, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    spinlock_release(lock);
+}
+
+// The CLOCK hand's pass over one bucket: unlink nodes nobody holds whose
+// referenced bit is already clear, and clear it on the rest. Nodes are
+// only referenced from outside the cache through pinned paths (the
+// dentries, children, open files), so an unheld node can't be picked up
+// again once its shard lock is taken. Returns the victims chained through
+// hash_next. Given a mount, it takes every unheld node of that mount
+// instead.
+static vfs_node_t* manifold_sweep_bucket(uint64_t bucket, vfs_mount_t* mount,
+                                         uint64_t* remaining) {
+    vfs_node_t* victims = NULL;
+    spinlock_t* lock = manifold_node_shard(bucket);
+    
+    spinlock_acquire(lock);
+    vfs_node_table_t* table = g_vfs.node_table;
+    if (bucket <= table->mask) {
+        for (vfs_node_t** link = &table->buckets[bucket]; *link && *remaining > 0; ) {
+            vfs_node_t* node = *link;
+            if (__atomic_load_n(&node->ref_count, __ATOMIC_ACQUIRE) != 0 ||
+                (mount && node->mount != mount)) {
+                link = &node->hash_next;
+                continue;
+            }
+            if (!mount &&
+                (__atomic_load_n(&node->cache_flags, __ATOMIC_RELAXED) & VFS_NODE_REFERENCED)) {
+                __atomic_fetch_and(&node->cache_flags, ~(uint32_t)VFS_NODE_REFERENCED,
+                                   __ATOMIC_RELAXED);
+                link = &node->hash_next;
+                continue;
             }
             
-            manifold_ref_node(node);
-            spinlock_release(&g_vfs_lock);
-            return node;
+            *link = node->hash_next;
+            node->cache_flags &= ~(uint32_t)VFS_NODE_CACHED;
+            node->hash_next = victims;
+            victims = node;
+            __atomic_fetch_sub(&g_vfs.cached_nodes, 1, __ATOMIC_RELAXED);
+            (*remaining)--;
         }
-        node = node->hash_next;
+    }
+    spinlock_release(lock);
+    return victims;
+}
+
+static size_t manifold_free_victims(vfs_node_t* victims) {
+    size_t freed = 0;
+    while (victims) {
+        vfs_node_t* next = victims->hash_next;
+        manifold_free_node(victims);
+        victims = next;
+        freed++;
+    }
+    return freed;
+}
+
+// Free up to count unused nodes. The hand goes round the table at most
+// twice, the first time only clearing bits if everything had been
+// referenced. Returns how many it freed.
+size_t manifold_cache_evict(uint64_t count) {
+    if (!g_vfs.node_table) {
+        return 0;
     }
     
-    spinlock_release(&g_vfs_lock);
-    return NULL;
+    uint64_t remaining = count;
+    uint64_t buckets = __atomic_load_n(&g_vfs.node_table, __ATOMIC_ACQUIRE)->mask + 1;
+    size_t freed = 0;
+    
+    for (uint64_t visited = 0; visited < 2 * buckets && remaining > 0; visited++) {
+        uint64_t bucket = __atomic_fetch_add(&g_vfs.node_hand, 1, __ATOMIC_RELAXED) &
+                          (buckets - 1);
+        freed += manifold_free_victims(manifold_sweep_bucket(bucket, NULL, &remaining));
+    }
+    
+    __atomic_fetch_add(&g_vfs.node_evictions, freed, __ATOMIC_RELAXED);
+    return freed;
 }
 
-void manifold_cache_insert(vfs_node_t* node) {
-    uint32_t hash = (uint32_t)(node->ino ^ (uint64_t)node->mount) % 1024;
+// Free the unused nodes a mount left cached, before it goes away
+void manifold_cache_purge(vfs_mount_t* mount) {
+    if (!g_vfs.node_table) {
+        return;
+    }
     
-    spinlock_acquire(&g_vfs_lock);
+    spinlock_acquire(&g_node_resize_lock);   // Hold the table size still
+    uint64_t buckets = g_vfs.node_table->mask + 1;
+    for (uint64_t bucket = 0; bucket < buckets; bucket++) {
+        uint64_t remaining = UINT64_MAX;
+        manifold_free_victims(manifold_sweep_bucket(bucket, mount, &remaining));
+    }
+    spinlock_release(&g_node_resize_lock);
+}
+
+// Double the table with every shard locked
+static void manifold_cache_grow(void) {
+    spinlock_acquire(&g_node_resize_lock);
+    vfs_node_table_t* old = g_vfs.node_table;
+    uint64_t buckets = (old->mask + 1) * 2;
+    uint64_t nodes = __atomic_load_n(&g_vfs.cached_nodes, __ATOMIC_RELAXED);
+    if (buckets > MANIFOLD_NODE_BUCKETS_MAX || nodes <= (old->mask + 1) * MANIFOLD_NODE_LOAD) {
+        spinlock_release(&g_node_resize_lock);
+        return;
+    }
     
-    // Add to hash table
-    node->hash_next = g_vfs.node_cache[hash];
-    g_vfs.node_cache[hash] = node;
+    vfs_node_table_t* table = flux_allocate(NULL, sizeof(vfs_node_table_t) +
+                                                  buckets * sizeof(vfs_node_t*),
+                                            FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO |
+                                            FLUX_ALLOC_LARGE);
+    if (!table) {
+        spinlock_release(&g_node_resize_lock);
+        return;
+    }
+    table->mask = buckets - 1;
     
-    // Add to LRU head
-    node->lru_prev = NULL;
-    node->lru_next = g_vfs.lru_head;
-    if (g_vfs.lru_head) {
-        g_vfs.lru_head->lru_prev = node;
-    } else {
-        g_vfs.lru_tail = node;
+    for (uint32_t shard = 0; shard < MANIFOLD_NODE_SHARDS; shard++) {
+        spinlock_acquire(&g_node_shards[shard].lock);
+    }
+    
+    for (uint64_t bucket = 0; bucket <= old->mask; bucket++) {
+        vfs_node_t* node = old->buckets[bucket];
+        while (node) {
+            vfs_node_t* next = node->hash_next;
+            vfs_node_t** head = &table->buckets[manifold_node_key(node->mount, node->ino) &
+                                                table->mask];
+            node->hash_next = *head;
+            *head = node;
+            node = next;
+        }
     }
-    g_vfs.lru_head = node;
     
-    g_vfs.cached_nodes++;
+    __atomic_store_n(&g_vfs.node_table, table, __ATOMIC_RELEASE);
+    g_vfs.node_resizes++;
     
-    // Evict old nodes if cache is full
-    if (g_vfs.cached_nodes > 1000) {
-        manifold_cache_evict(100);
+    for (uint32_t shard = MANIFOLD_NODE_SHARDS; shard-- > 0; ) {
+        spinlock_release(&g_node_shards[shard].lock);
     }
+    spinlock_release(&g_node_resize_lock);
     
-    spinlock_release(&g_vfs_lock);
+    // Every reader of the table holds a shard lock
+    flux_free(old);
+}
+
+// flux shrinker: drop unused nodes when memory runs low
+static size_t manifold_cache_shrink(size_t pages, void* context) {
+    (void)context;
+    
+    uint64_t per_page = FLUX_PAGE_SIZE / sizeof(vfs_node_t);
+    return manifold_cache_evict(pages * per_page) / per_page;
+}
+
+// flux shrinker: drop dentries, and with them what holds unused nodes
+static size_t manifold_dentry_shrink(size_t pages, void* context) {
+    (void)context;
+    
+    uint64_t per_page = FLUX_PAGE_SIZE / sizeof(vfs_dentry_t);
+    return manifold_dentry_evict(pages * per_page) / per_page;
+}
+
+// kmanifoldd: grow the table as it fills, trim both caches back to an eighth under the
+// limit once past it, and give a batch back on each pass while flux is
+// short of memory
+static void manifold_cache_main(void) {
+    uint64_t period = continuum_usec_to_tsc(MANIFOLD_SCAN_PERIOD);
+    uint64_t last_pass = 0;
+    
+    while (1) {
+        if (__atomic_exchange_n(&g_vfs.node_grow_wanted, false, __ATOMIC_RELAXED)) {
+            manifold_cache_grow();
+        }
+        
+        uint64_t now = continuum_get_time();
+        if (now - last_pass >= period) {
+            last_pass = now;
+            
+            // Dentries first: they hold the nodes the node hand would free
+            uint64_t dentries = __atomic_load_n(&g_vfs.cached_dentries, __ATOMIC_RELAXED);
+            if (dentries > g_vfs.max_dentries) {
+                manifold_dentry_evict(dentries - (g_vfs.max_dentries - g_vfs.max_dentries / 8));
+            } else if (dentries > MANIFOLD_DENTRY_MIN_CACHED && flux_memory_low()) {
+                manifold_dentry_evict(MANIFOLD_EVICT_BATCH);
+            }
+            
+            uint64_t nodes = __atomic_load_n(&g_vfs.cached_nodes, __ATOMIC_RELAXED);
+            uint64_t low = g_vfs.max_nodes - g_vfs.max_nodes / 8;
+            if (nodes > g_vfs.max_nodes) {
+                manifold_cache_evict(nodes - low);
+            } else if (nodes > MANIFOLD_NODE_MIN_CACHED && flux_memory_low()) {
+                manifold_cache_evict(MANIFOLD_EVICT_BATCH);
+            }
+        }
+        temporal_yield(temporal_get_current());
+    }
+}
+
+static int manifold_cache_init(void) {
+    flux_stats_t memory;
+    flux_get_stats(&memory);
+    g_vfs.max_nodes = memory.total_memory / 100 * MANIFOLD_NODE_CACHE_PCT / sizeof(vfs_node_t);
+    if (g_vfs.max_nodes < MANIFOLD_NODE_MIN_CACHED) {
+        g_vfs.max_nodes = MANIFOLD_NODE_MIN_CACHED;
+    }
+    g_vfs.max_dentries = memory.total_memory / 100 * MANIFOLD_DENTRY_CACHE_PCT /
+                         sizeof(vfs_dentry_t);
+    if (g_vfs.max_dentries < MANIFOLD_DENTRY_MIN_CACHED) {
+        g_vfs.max_dentries = MANIFOLD_DENTRY_MIN_CACHED;
+    }
+    
+    // Lockless walks can't follow a resize, so the dentry table is sized
+    // for the limit once
+    uint64_t dentry_buckets = 1;
+    while (dentry_buckets * MANIFOLD_DENTRY_LOAD < g_vfs.max_dentries) {
+        dentry_buckets <<= 1;
+    }
+    g_vfs.dentry_cache = flux_allocate(NULL, dentry_buckets * sizeof(vfs_dentry_t*),
+                                       FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO | FLUX_ALLOC_LARGE);
+    if (!g_vfs.dentry_cache) {
+        return -ENOMEM;
+    }
+    g_vfs.dentry_mask = dentry_buckets - 1;
+    
+    vfs_node_table_t* table = flux_allocate(NULL, sizeof(vfs_node_table_t) +
+                                                  MANIFOLD_NODE_BUCKETS_MIN *
+                                                  sizeof(vfs_node_t*),
+                                            FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!table) {
+        flux_free(g_vfs.dentry_cache);
+        g_vfs.dentry_cache = NULL;
+        return -ENOMEM;
+    }
+    table->mask = MANIFOLD_NODE_BUCKETS_MIN - 1;
+    g_vfs.hash_seed = continuum_get_time() * 0x9E3779B97F4A7C15ULL;
+    
+    for (uint32_t shard = 0; shard < MANIFOLD_NODE_SHARDS; shard++) {
+        spinlock_init(&g_node_shards[shard].lock);
+    }
+    for (uint32_t shard = 0; shard < MANIFOLD_DENTRY_SHARDS; shard++) {
+        spinlock_init(&g_dentry_shards[shard].lock);
+    }
+    __atomic_store_n(&g_vfs.node_table, table, __ATOMIC_RELEASE);
+    
+    flux_register_shrinker(manifold_dentry_shrink, NULL);
+    flux_register_shrinker(manifold_cache_shrink, NULL);
+    
+    quantum_id_t qid = continuum_create_quantum(ABI_MODE_NATIVE, (void*)manifold_cache_main,
+                                                "kmanifoldd");
+    quantum_context_t* quantum = continuum_get_quantum(qid);
+    if (quantum) {
+        quantum->scheduling.priority = PRIORITY_LOW;
+        temporal_enqueue(quantum);
+    }
+    return 0;
 }
 
 // =============================================================================
@@ -638,6 +1898,11 @@ bool manifold_can_execute(vfs_node_t* node, uint32_t uid, uint32_t gid) {
 int manifold_init(void) {
     memset(&g_vfs, 0, sizeof(g_vfs));
     
+    int result = manifold_cache_init();
+    if (result != 0) {
+        return result;
+    }
+    
     // Create root node
     g_vfs.root_node = manifold_alloc_node();
     if (!g_vfs.root_node) {
@@ -654,9 +1919,11 @@ int manifold_init(void) {
     manifold_register_devfs();
     manifold_register_procfs();
     manifold_register_sysfs();
+    manifold_register_ext4();
+    manifold_register_fat32();
     
     // Mount root filesystem (tmpfs for now)
-    int result = manifold_mount("none", "/", "tmpfs", 0, NULL);
+    result = manifold_mount("none", "/", "tmpfs", 0, NULL);
     if (result != 0) {
         return result;
     }
@@ -686,6 +1953,7 @@ void manifold_shutdown(void) {
     }
     
     // Free cache
+    manifold_dentry_evict(g_vfs.cached_dentries);
     manifold_cache_evict(g_vfs.cached_nodes);
     
     // Free root node
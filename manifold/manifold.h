@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <time.h>
+#include "../continuum/drivers/storage/page_cache.h"
 
 // =============================================================================
 // VFS Constants
@@ -21,6 +22,33 @@
 #define MANIFOLD_MAX_FILES      65536
 #define MANIFOLD_MAX_SYMLINKS   40
 
+// Node cache: nodes stay cached after their last reference drops, until
+// kmanifoldd's CLOCK hand finds them unused twice over
+#define MANIFOLD_NODE_BUCKETS_MIN   1024        // Power of two, at least MANIFOLD_NODE_SHARDS
+#define MANIFOLD_NODE_BUCKETS_MAX   (1 << 20)
+#define MANIFOLD_NODE_LOAD          2           // Nodes per bucket before the table doubles
+#define MANIFOLD_NODE_SHARDS        64          // Bucket locks, power of two
+#define MANIFOLD_NODE_CACHE_PCT     2           // Share of memory cached nodes may take
+#define MANIFOLD_NODE_MIN_CACHED    1024
+#define MANIFOLD_SCAN_PERIOD        100000      // Between kmanifoldd passes (microseconds)
+#define MANIFOLD_EVICT_BATCH        256         // Nodes dropped per pass under memory pressure
+
+// Dentry cache: path walks read it without locks. The table is sized
+// once from memory and the same hand keeps it within its share.
+#define MANIFOLD_DENTRY_CACHE_PCT   2           // Share of memory dentries may take
+#define MANIFOLD_DENTRY_MIN_CACHED  4096
+#define MANIFOLD_DENTRY_LOAD        2           // Dentries per bucket the table is sized for
+#define MANIFOLD_DENTRY_SHARDS      64          // Bucket locks, power of two
+#define MANIFOLD_WALK_STEPS         64          // Chain steps a walk takes before falling back
+#define MANIFOLD_NEGATIVE_SHARE     4           // At most 1/4 of the limit may be negative
+
+// Node cache flags
+#define VFS_NODE_CACHED         (1 << 0)    // In the node cache, which frees it
+#define VFS_NODE_REFERENCED     (1 << 1)    // Found since the clock hand last passed
+
+// Dentry flags
+#define VFS_DENTRY_REFERENCED   (1 << 0)    // Found since the clock hand last passed
+
 // File types
 #define VFS_TYPE_REGULAR        0x01
 #define VFS_TYPE_DIRECTORY      0x02
@@ -128,15 +156,23 @@ typedef struct {
     int (*link)(vfs_node_t* parent, const char* name, vfs_node_t* target);
     int (*symlink)(vfs_node_t* parent, const char* name, const char* target);
     int (*readlink)(vfs_node_t* node, char* buffer, size_t size);
+    void (*release)(vfs_node_t* node);  // Free fs_data; the node is going
     
     // File operations
     int (*open)(vfs_file_t* file, vfs_node_t* node, uint32_t flags);
     int (*close)(vfs_file_t* file);
     ssize_t (*read)(vfs_file_t* file, void* buffer, size_t size);
     ssize_t (*write)(vfs_file_t* file, const void* buffer, size_t size);
+    ssize_t (*pread)(vfs_file_t* file, void* buffer, size_t size, off_t offset);
+    ssize_t (*pwrite)(vfs_file_t* file, const void* buffer, size_t size, off_t offset);
+    ssize_t (*readv)(vfs_file_t* file, const page_cache_iovec_t* iov, uint32_t count,
+                     off_t offset);
+    ssize_t (*writev)(vfs_file_t* file, const page_cache_iovec_t* iov, uint32_t count,
+                      off_t offset);
     off_t (*lseek)(vfs_file_t* file, off_t offset, int whence);
     int (*ioctl)(vfs_file_t* file, uint32_t cmd, void* arg);
-    int (*mmap)(vfs_file_t* file, void* addr, size_t length, int prot, int flags);
+    page_cache_vma_t* (*mmap)(vfs_file_t* file, struct memory_domain* domain, uint64_t vaddr,
+                              uint64_t offset, size_t length, uint32_t flags);
     
     // Directory operations
     int (*readdir)(vfs_file_t* file, vfs_dirent_t* dirent);
@@ -170,9 +206,12 @@ struct vfs_node {
     time_t ctime;               // Change time
     
     vfs_mount_t* mount;         // Mount point this node belongs to
+    vfs_mount_t* mounted;       // Filesystem mounted on this directory, if any
+    vfs_node_t* parent;         // Directory it was first found in; held
     vfs_operations_t* ops;      // Operations table
     
     void* fs_data;              // Filesystem-specific data
+    page_cache_mapping_t* mapping;  // Cached file data, if the filesystem has any
     
     // Reference counting
     uint32_t ref_count;
@@ -180,24 +219,23 @@ struct vfs_node {
     
     // Cache management
     vfs_node_t* hash_next;      // Hash table chain
-    vfs_node_t* lru_next;       // LRU list
-    vfs_node_t* lru_prev;
-    
-    // Children (for directories)
-    vfs_dentry_t* dentries;
+    uint32_t cache_flags;       // VFS_NODE_*
 };
 
-// Directory entry cache
+// Directory entry cache; a dentry holds its parent and its node
 struct vfs_dentry {
     char name[MANIFOLD_MAX_NAME + 1];
-    vfs_node_t* node;
+    vfs_node_t* node;           // NULL: the name is known not to exist
     vfs_node_t* parent;
     
-    uint32_t hash;
+    uint32_t seq;               // Odd while the dentry is being retired
+    uint32_t hash;              // Of the name alone
+    uint16_t len;
+    uint16_t flags;             // VFS_DENTRY_*
     time_t timestamp;
     
-    vfs_dentry_t* next;
     vfs_dentry_t* hash_next;
+    vfs_dentry_t* retired;
 };
 
 // Open file descriptor
@@ -205,6 +243,7 @@ struct vfs_file {
     vfs_node_t* node;           // Associated inode
     uint32_t flags;             // Open flags
     off_t offset;               // Current position
+    page_cache_ra_t ra;         // Readahead state; each open file streams on its own
     uint32_t ref_count;         // Reference count
     
     void* private_data;         // Filesystem-specific data
@@ -251,6 +290,12 @@ struct vfs_filesystem {
     vfs_filesystem_t* next;
 };
 
+// Mount data for filesystems on a block device
+typedef struct {
+    void* device;               // block_device_t
+    uint64_t partition_start;   // First sector of the partition
+} vfs_block_mount_t;
+
 // Path lookup context
 typedef struct {
     const char* path;
@@ -270,21 +315,31 @@ typedef struct {
     vfs_mount_t* mounts;
     vfs_filesystem_t* filesystems;
     vfs_node_t* root_node;
+    uint64_t hash_seed;         // Keys both caches, picked at boot
     
-    // Node cache
-    vfs_node_t* node_cache[1024];
-    vfs_node_t* lru_head;
-    vfs_node_t* lru_tail;
-    uint32_t cached_nodes;
+    // Node cache; buckets are under sharded locks and the table grows
+    struct vfs_node_table* node_table;
+    uint64_t node_hand;         // Next bucket the clock visits
+    uint64_t cached_nodes;
+    uint64_t max_nodes;
+    bool node_grow_wanted;
     
-    // Dentry cache
-    vfs_dentry_t* dentry_cache[1024];
-    uint32_t cached_dentries;
+    // Dentry cache; walked without locks, changed under sharded locks
+    vfs_dentry_t** dentry_cache;
+    uint64_t dentry_mask;
+    uint64_t dentry_hand;
+    uint64_t cached_dentries;
+    uint64_t negative_dentries;
+    uint64_t max_dentries;
     
     // Statistics
     uint64_t lookups;
     uint64_t cache_hits;
     uint64_t cache_misses;
+    uint64_t walk_fallbacks;    // Lookups the lockless walk left to ref-walk
+    uint64_t dentry_evictions;
+    uint64_t node_evictions;
+    uint64_t node_resizes;
 } vfs_state_t;
 
 // =============================================================================
@@ -299,6 +354,8 @@ void manifold_shutdown(void);
 int manifold_register_filesystem(vfs_filesystem_t* fs);
 int manifold_unregister_filesystem(const char* name);
 vfs_filesystem_t* manifold_find_filesystem(const char* name);
+int manifold_register_ext4(void);
+int manifold_register_fat32(void);
 
 // Mount operations
 int manifold_mount(const char* source, const char* target, const char* fstype,
@@ -310,6 +367,7 @@ vfs_mount_t* manifold_find_mount(const char* path);
 // Path operations
 vfs_node_t* manifold_lookup(const char* path);
 vfs_node_t* manifold_lookup_parent(const char* path, char* basename);
+vfs_node_t* manifold_get_parent(vfs_node_t* node);
 int manifold_resolve_path(const char* path, char* resolved, size_t size);
 
 // File operations
@@ -317,8 +375,19 @@ int manifold_open(const char* path, uint32_t flags, uint32_t mode);
 int manifold_close(int fd);
 ssize_t manifold_read(int fd, void* buffer, size_t size);
 ssize_t manifold_write(int fd, const void* buffer, size_t size);
+ssize_t manifold_pread(int fd, void* buffer, size_t size, off_t offset);
+ssize_t manifold_pwrite(int fd, const void* buffer, size_t size, off_t offset);
+ssize_t manifold_readv(int fd, const page_cache_iovec_t* iov, uint32_t count, off_t offset);
+ssize_t manifold_writev(int fd, const page_cache_iovec_t* iov, uint32_t count, off_t offset);
 off_t manifold_lseek(int fd, off_t offset, int whence);
 int manifold_ioctl(int fd, uint32_t cmd, void* arg);
+page_cache_vma_t* manifold_mmap(int fd, struct memory_domain* domain, uint64_t vaddr,
+                                uint64_t offset, size_t length, uint32_t flags);
+
+// mmap for filesystems whose nodes have a page cache mapping
+page_cache_vma_t* manifold_generic_mmap(vfs_file_t* file, struct memory_domain* domain,
+                                        uint64_t vaddr, uint64_t offset, size_t length,
+                                        uint32_t flags);
 
 // Directory operations
 int manifold_mkdir(const char* path, uint32_t mode);
@@ -357,15 +426,17 @@ void manifold_unref_node(vfs_node_t* node);
 
 // Cache management
 vfs_node_t* manifold_cache_lookup(vfs_mount_t* mount, uint64_t ino);
-void manifold_cache_insert(vfs_node_t* node);
+vfs_node_t* manifold_cache_insert(vfs_node_t* node);
 void manifold_cache_remove(vfs_node_t* node);
-void manifold_cache_evict(uint32_t count);
+size_t manifold_cache_evict(uint64_t count);
+void manifold_cache_purge(vfs_mount_t* mount);
 
-// Dentry cache
-vfs_dentry_t* manifold_dentry_lookup(vfs_node_t* parent, const char* name);
+// Dentry cache; manifold_dentry_lookup returns the node referenced
+vfs_node_t* manifold_dentry_lookup(vfs_node_t* parent, const char* name);
 void manifold_dentry_add(vfs_node_t* parent, const char* name, vfs_node_t* node);
 void manifold_dentry_remove(vfs_node_t* parent, const char* name);
 void manifold_dentry_invalidate(vfs_node_t* parent);
+size_t manifold_dentry_evict(uint64_t count);
 
 // Permission checking
 bool manifold_check_permission(vfs_node_t* node, uint32_t uid, uint32_t gid,
@@ -0,0 +1,186 @@
+/*
+ * Manifold EXT4 Adapter
+ * Presents ext4 filesystems through the VFS, file data through the page cache
+ */
+
+#include "manifold.h"
+#include "../continuum/flux_memory.h"
+#include "../continuum/drivers/filesystem/ext4.h"
+#include "../continuum/drivers/storage/page_cache.h"
+#include <string.h>
+#include <errno.h>
+
+// =============================================================================
+// Node Operations
+// =============================================================================
+
+static vfs_operations_t g_ext4_vfs_ops;
+
+static uint8_t manifold_ext4_type(uint16_t mode) {
+    switch (mode & EXT4_S_IFMT) {
+        case EXT4_S_IFDIR:  return VFS_TYPE_DIRECTORY;
+        case EXT4_S_IFLNK:  return VFS_TYPE_SYMLINK;
+        case EXT4_S_IFCHR:  return VFS_TYPE_DEVICE_CHAR;
+        case EXT4_S_IFBLK:  return VFS_TYPE_DEVICE_BLOCK;
+        case EXT4_S_IFIFO:  return VFS_TYPE_FIFO;
+        case EXT4_S_IFSOCK: return VFS_TYPE_SOCKET;
+        default:            return VFS_TYPE_REGULAR;
+    }
+}
+
+// The node for path, referenced: the cached one if another lookup got
+// there first, otherwise a new one keeping path in fs_data, since the
+// driver looks everything up by path. Regular files get their page cache
+// mapping, which manifold reads them through.
+static vfs_node_t* manifold_ext4_node(vfs_mount_t* mount, const char* path) {
+    ext4_filesystem_t* fs = (ext4_filesystem_t*)mount->fs_data;
+    
+    ext4_inode_t inode;
+    uint32_t ino = ext4_get_file_info(fs, path, &inode);
+    if (ino == 0) {
+        return NULL;
+    }
+    
+    vfs_node_t* node = manifold_cache_lookup(mount, ino);
+    if (node) {
+        return node;
+    }
+    
+    node = manifold_alloc_node();
+    if (!node) {
+        return NULL;
+    }
+    
+    size_t len = strlen(path);
+    char* own_path = flux_allocate(NULL, len + 1, FLUX_ALLOC_KERNEL);
+    if (!own_path) {
+        manifold_free_node(node);
+        return NULL;
+    }
+    memcpy(own_path, path, len + 1);
+    
+    node->ino = ino;
+    node->type = manifold_ext4_type(inode.i_mode);
+    node->mode = inode.i_mode & 07777;
+    node->uid = inode.i_uid;
+    node->gid = inode.i_gid;
+    node->size = ext4_file_size(fs, &inode);
+    node->nlink = inode.i_links_count;
+    node->atime = inode.i_atime;
+    node->mtime = inode.i_mtime;
+    node->ctime = inode.i_ctime;
+    node->mount = mount;
+    node->ops = &g_ext4_vfs_ops;
+    node->fs_data = own_path;
+    
+    if (node->type == VFS_TYPE_REGULAR) {
+        node->mapping = ext4_file_cache(fs, ino, &inode);
+    }
+    
+    // Whichever node the cache ends up with is the one we return
+    vfs_node_t* cached = manifold_cache_insert(node);
+    if (cached != node) {
+        manifold_unref_node(node);
+    }
+    return cached;
+}
+
+static vfs_node_t* manifold_ext4_lookup(vfs_node_t* parent, const char* name) {
+    const char* dir = (const char*)parent->fs_data;
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    
+    // The root is "/"; everything under it gets a separator
+    if (dir_len == 1) {
+        dir_len = 0;
+    }
+    if (dir_len + 1 + name_len >= MANIFOLD_MAX_PATH) {
+        return NULL;
+    }
+    
+    char path[MANIFOLD_MAX_PATH];
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+    
+    return manifold_ext4_node(parent->mount, path);
+}
+
+static void manifold_ext4_release(vfs_node_t* node) {
+    flux_free(node->fs_data);
+}
+
+// =============================================================================
+// File Operations
+// =============================================================================
+
+// Vectored reads go to the driver, which resolves the path once for the
+// whole vector and reads the file's mapping with the file's own readahead
+// state
+static ssize_t manifold_ext4_readv(vfs_file_t* file, const page_cache_iovec_t* iov,
+                                   uint32_t count, off_t offset) {
+    vfs_node_t* node = file->node;
+    int result = ext4_readv((ext4_filesystem_t*)node->mount->fs_data, (const char*)node->fs_data,
+                            iov, count, (size_t)offset, &file->ra);
+    return result < 0 ? -EIO : result;
+}
+
+// =============================================================================
+// Superblock Operations
+// =============================================================================
+
+// data is a vfs_block_mount_t. The driver has no write path yet, so the
+// filesystem always mounts read-only.
+static int manifold_ext4_mount(vfs_mount_t* mount, void* data) {
+    vfs_block_mount_t* args = (vfs_block_mount_t*)data;
+    if (!args || !args->device) {
+        return -EINVAL;
+    }
+    
+    ext4_filesystem_t* fs = ext4_mount((block_device_t*)args->device, args->partition_start,
+                                       true);
+    if (!fs) {
+        return -EIO;
+    }
+    
+    mount->fs_data = fs;
+    mount->device = args->device;
+    mount->flags |= VFS_MNT_RDONLY;
+    
+    mount->root = manifold_ext4_node(mount, "/");
+    if (!mount->root) {
+        ext4_unmount(fs);
+        return -EIO;
+    }
+    return 0;
+}
+
+// manifold has dropped the mount's nodes by now, and with them their
+// mappings' users
+static int manifold_ext4_unmount(vfs_mount_t* mount) {
+    ext4_unmount((ext4_filesystem_t*)mount->fs_data);
+    mount->fs_data = NULL;
+    return 0;
+}
+
+// =============================================================================
+// Registration
+// =============================================================================
+
+static vfs_operations_t g_ext4_vfs_ops = {
+    .mount = manifold_ext4_mount,
+    .unmount = manifold_ext4_unmount,
+    .lookup = manifold_ext4_lookup,
+    .release = manifold_ext4_release,
+    .readv = manifold_ext4_readv,
+    .mmap = manifold_generic_mmap,
+};
+
+static vfs_filesystem_t g_ext4_filesystem = {
+    .name = "ext4",
+    .ops = &g_ext4_vfs_ops,
+};
+
+int manifold_register_ext4(void) {
+    return manifold_register_filesystem(&g_ext4_filesystem);
+}
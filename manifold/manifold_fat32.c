@@ -0,0 +1,164 @@
+/*
+ * Manifold FAT32 Adapter
+ * Presents FAT32 filesystems through the VFS
+ */
+
+#include "manifold.h"
+#include "../continuum/flux_memory.h"
+#include "../continuum/drivers/filesystem/fat32.h"
+#include <string.h>
+#include <errno.h>
+
+// =============================================================================
+// Node Operations
+// =============================================================================
+
+static vfs_operations_t g_fat32_vfs_ops;
+
+// A node for path, referenced, keeping its path in fs_data for the
+// driver. FAT has no inode numbers, so ino is a hash of the path and
+// nodes stay out of the node cache, where two paths sharing a hash would
+// share a node; the dentry cache holds them instead.
+static vfs_node_t* manifold_fat32_node(vfs_mount_t* mount, const char* path, bool directory,
+                                       const fat32_dir_entry_t* entry) {
+    vfs_node_t* node = manifold_alloc_node();
+    if (!node) {
+        return NULL;
+    }
+    
+    size_t len = strlen(path);
+    char* own_path = flux_allocate(NULL, len + 1, FLUX_ALLOC_KERNEL);
+    if (!own_path) {
+        manifold_free_node(node);
+        return NULL;
+    }
+    memcpy(own_path, path, len + 1);
+    
+    bool readonly = entry && (entry->attr & FAT32_ATTR_READ_ONLY);
+    node->ino = manifold_hash_name(path);
+    node->type = directory ? VFS_TYPE_DIRECTORY : VFS_TYPE_REGULAR;
+    node->mode = directory ? 0755 : 0644;
+    if (readonly) {
+        node->mode &= ~0222;
+    }
+    node->size = entry && !directory ? entry->file_size : 0;
+    node->nlink = 1;
+    node->mount = mount;
+    node->ops = &g_fat32_vfs_ops;
+    node->fs_data = own_path;
+    return node;
+}
+
+static vfs_node_t* manifold_fat32_lookup(vfs_node_t* parent, const char* name) {
+    const char* dir = (const char*)parent->fs_data;
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    
+    // The root is "/"; everything under it gets a separator
+    if (dir_len == 1) {
+        dir_len = 0;
+    }
+    if (dir_len + 1 + name_len >= MANIFOLD_MAX_PATH) {
+        return NULL;
+    }
+    
+    char path[MANIFOLD_MAX_PATH];
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+    
+    fat32_dir_entry_t entry;
+    if (fat32_get_file_info((fat32_filesystem_t*)parent->mount->fs_data, path, &entry) != 0 ||
+        (entry.attr & FAT32_ATTR_VOLUME_ID)) {
+        return NULL;
+    }
+    
+    return manifold_fat32_node(parent->mount, path, entry.attr & FAT32_ATTR_DIRECTORY, &entry);
+}
+
+static void manifold_fat32_release(vfs_node_t* node) {
+    flux_free(node->fs_data);
+}
+
+// =============================================================================
+// File Operations
+// =============================================================================
+
+// The driver reads through the device's page cache mapping, a whole
+// vector at a time, with the file's own readahead state
+static ssize_t manifold_fat32_readv(vfs_file_t* file, const page_cache_iovec_t* iov,
+                                    uint32_t count, off_t offset) {
+    vfs_node_t* node = file->node;
+    int result = fat32_readv((fat32_filesystem_t*)node->mount->fs_data,
+                             (const char*)node->fs_data, iov, count, (size_t)offset, &file->ra);
+    return result < 0 ? -EIO : result;
+}
+
+static ssize_t manifold_fat32_pread(vfs_file_t* file, void* buffer, size_t size,
+                                    off_t offset) {
+    page_cache_iovec_t iov = { buffer, size };
+    return manifold_fat32_readv(file, &iov, 1, offset);
+}
+
+static ssize_t manifold_fat32_read(vfs_file_t* file, void* buffer, size_t size) {
+    return manifold_fat32_pread(file, buffer, size, file->offset);
+}
+
+// =============================================================================
+// Superblock Operations
+// =============================================================================
+
+// data is a vfs_block_mount_t. The driver can't write files yet, so the
+// filesystem always mounts read-only.
+static int manifold_fat32_mount(vfs_mount_t* mount, void* data) {
+    vfs_block_mount_t* args = (vfs_block_mount_t*)data;
+    if (!args || !args->device) {
+        return -EINVAL;
+    }
+    
+    fat32_filesystem_t* fs = fat32_mount((block_device_t*)args->device, args->partition_start,
+                                         true);
+    if (!fs) {
+        return -EIO;
+    }
+    
+    mount->fs_data = fs;
+    mount->device = args->device;
+    mount->flags |= VFS_MNT_RDONLY;
+    
+    mount->root = manifold_fat32_node(mount, "/", true, NULL);
+    if (!mount->root) {
+        fat32_unmount(fs);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static int manifold_fat32_unmount(vfs_mount_t* mount) {
+    fat32_unmount((fat32_filesystem_t*)mount->fs_data);
+    mount->fs_data = NULL;
+    return 0;
+}
+
+// =============================================================================
+// Registration
+// =============================================================================
+
+static vfs_operations_t g_fat32_vfs_ops = {
+    .mount = manifold_fat32_mount,
+    .unmount = manifold_fat32_unmount,
+    .lookup = manifold_fat32_lookup,
+    .release = manifold_fat32_release,
+    .read = manifold_fat32_read,
+    .pread = manifold_fat32_pread,
+    .readv = manifold_fat32_readv,
+};
+
+static vfs_filesystem_t g_fat32_filesystem = {
+    .name = "fat32",
+    .ops = &g_fat32_vfs_ops,
+};
+
+int manifold_register_fat32(void) {
+    return manifold_register_filesystem(&g_fat32_filesystem);
+}
@@ -9,6 +9,7 @@
 #include "../continuum/conduit_ipc.h"
 #include <signal.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 // =============================================================================
 // Global State
@@ -18,6 +19,13 @@ static nexus_manager_t g_manager;
 static spinlock_t g_nexus_lock = SPINLOCK_INIT;
 static bool g_nexus_running = false;
 
+// The main loop sleeps in one poll set: the notify conduit, activation
+// conduits and child exits
+static conduit_poll_t* g_nexus_poll = NULL;
+static conduit_t* g_nexus_notify = NULL;
+static conduit_poll_source_t g_child_source;
+static uint32_t g_children_exited = 0;
+
 // =============================================================================
 // Service Lifecycle
 // =============================================================================
@@ -142,7 +150,19 @@ int nexus_spawn_service(nexus_service_t* service) {
     // Parent process
     service->pid = pid;
     service->start_time = temporal_get_time();
-    service->state = SERVICE_STATE_RUNNING;
+    service->ready = false;
+    
+    // Its activation conduit is the service's to read now
+    if (service->activation) {
+        conduit_poll_remove(g_nexus_poll, service->activation);
+    }
+    
+    // A notify service is starting until it says it's ready
+    if (service->type == SERVICE_TYPE_NOTIFY) {
+        service->state = SERVICE_STATE_STARTING;
+    } else {
+        service->state = SERVICE_STATE_RUNNING;
+    }
     
     nexus_log(service, "Started service %s (PID %d)", service->name, pid);
     
@@ -156,6 +176,11 @@ int nexus_spawn_service(nexus_service_t* service) {
     
     g_manager.services_started++;
     
+    // A oneshot is ready once it has exited cleanly
+    if (service->type != SERVICE_TYPE_NOTIFY && service->type != SERVICE_TYPE_ONESHOT) {
+        nexus_mark_ready(service);
+    }
+    
     return 0;
 }
 
@@ -208,10 +233,9 @@ int nexus_terminate_service(nexus_service_t* service) {
     return 0;
 }
 
-void nexus_handle_service_exit(pid_t pid, int exit_code) {
+static nexus_service_t* nexus_find_service_by_pid(pid_t pid) {
     spinlock_acquire(&g_nexus_lock);
     
-    // Find service by PID
     nexus_service_t* service = g_manager.services;
     while (service) {
         if (service->pid == pid) {
@@ -221,7 +245,17 @@ void nexus_handle_service_exit(pid_t pid, int exit_code) {
     }
     
     spinlock_release(&g_nexus_lock);
-    
+    return service;
+}
+
+// Wait for its first message again
+static void nexus_arm_activation(nexus_service_t* service) {
+    conduit_poll_add(g_nexus_poll, service->activation,
+                     CONDUIT_SELECT_READ | CONDUIT_SELECT_EDGE, service);
+}
+
+void nexus_handle_service_exit(pid_t pid, int exit_code) {
+    nexus_service_t* service = nexus_find_service_by_pid(pid);
     if (!service) {
         return;
     }
@@ -231,13 +265,24 @@ void nexus_handle_service_exit(pid_t pid, int exit_code) {
     service->pid = 0;
     service->exit_code = exit_code;
     service->stop_time = temporal_get_time();
+    service->ready = false;
     
     if (service->state == SERVICE_STATE_STOPPING) {
         service->state = SERVICE_STATE_STOPPED;
+        nexus_emit_event(EVENT_SERVICE_STOPPED, service, NULL);
+        
+        if (service->activation) {
+            nexus_arm_activation(service);
+        }
+    } else if (service->type == SERVICE_TYPE_ONESHOT && exit_code == 0) {
+        // Done, and what waited for it may go
+        service->state = SERVICE_STATE_STOPPED;
+        nexus_mark_ready(service);
     } else {
         // Unexpected exit
         service->state = SERVICE_STATE_FAILED;
         g_manager.services_failed++;
+        nexus_emit_event(EVENT_SERVICE_FAILED, service, NULL);
         
         // Call failure callback
         if (service->on_failure) {
@@ -253,12 +298,8 @@ void nexus_handle_service_exit(pid_t pid, int exit_code) {
                 service->restart_count++;
                 g_manager.total_restarts++;
                 
-                // Wait before restart
-                temporal_sleep(service->restart_delay * 1000000);
-                
-                // Reset state and restart
-                service->state = SERVICE_STATE_STOPPED;
-                nexus_start_service(service->name);
+                // The main loop's timers restart it after the delay
+                service->restart_at = temporal_get_time() + service->restart_delay * 1000000;
             } else {
                 nexus_log(service, "Service %s exceeded max restarts", service->name);
                 
@@ -269,6 +310,12 @@ void nexus_handle_service_exit(pid_t pid, int exit_code) {
                 }
             }
         }
+        
+        // Not restarting: the next message activates it again
+        if (service->activation && !service->restart_at) {
+            service->state = SERVICE_STATE_STOPPED;
+            nexus_arm_activation(service);
+        }
     }
 }
 
@@ -276,6 +323,14 @@ void nexus_handle_service_exit(pid_t pid, int exit_code) {
 // Service Control
 // =============================================================================
 
+// Take a waiting service to start it. Whoever sees its last dependency
+// ready first, a starter or the dependency's readiness, gets it.
+static bool nexus_claim_waiting(nexus_service_t* service) {
+    uint8_t waiting = SERVICE_STATE_WAITING;
+    return __atomic_compare_exchange_n(&service->state, &waiting, SERVICE_STATE_STOPPED, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
 int nexus_start_service(const char* name) {
     nexus_service_t* service = nexus_find_service(name);
     if (!service) {
@@ -289,8 +344,13 @@ int nexus_start_service(const char* name) {
     // Check dependencies
     if (!nexus_check_dependencies(service)) {
         nexus_log(service, "Dependencies not satisfied for %s", name);
-        service->state = SERVICE_STATE_WAITING;
-        return -1;
+        __atomic_store_n(&service->state, SERVICE_STATE_WAITING, __ATOMIC_SEQ_CST);
+        
+        // The last of them may have become ready since; otherwise its
+        // readiness starts this
+        if (!nexus_check_dependencies(service) || !nexus_claim_waiting(service)) {
+            return -1;
+        }
     }
     
     return nexus_spawn_service(service);
@@ -377,7 +437,7 @@ bool nexus_check_dependencies(nexus_service_t* service) {
             continue;
         }
         
-        if (dep_service->state != SERVICE_STATE_RUNNING) {
+        if (!__atomic_load_n(&dep_service->ready, __ATOMIC_SEQ_CST)) {
             if (dep->required) {
                 return false;
             }
@@ -387,33 +447,99 @@ bool nexus_check_dependencies(nexus_service_t* service) {
     return true;
 }
 
+// Link each service to the ones waiting for it, and put the list in an
+// order where dependencies come first. A "before" dependency runs the
+// other way: its service comes first. Services in a cycle can never be
+// released; they are left at the end.
 void nexus_build_dependency_graph(void) {
-    // Topological sort of services based on dependencies
+    nexus_service_t* services[NEXUS_MAX_SERVICES];
+    uint32_t waits[NEXUS_MAX_SERVICES];
+    uint32_t count = 0;
+    
+    nexus_service_t* service = g_manager.services;
+    while (service && count < NEXUS_MAX_SERVICES) {
+        service->dependent_count = 0;
+        service->graph_order = count;
+        waits[count] = 0;
+        services[count++] = service;
+        service = service->next;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        service = services[i];
+        for (uint32_t j = 0; j < service->dependency_count; j++) {
+            service_dependency_t* dep = &service->dependencies[j];
+            nexus_service_t* other = nexus_find_service(dep->name);
+            if (!other || other == service) {
+                continue;
+            }
+            
+            nexus_service_t* first = dep->before ? service : other;
+            nexus_service_t* then = dep->before ? other : service;
+            if (first->dependent_count >= NEXUS_MAX_DEPENDENTS) {
+                nexus_log(first, "Too many dependents of %s, ignoring %s",
+                         first->name, then->name);
+                continue;
+            }
+            first->dependents[first->dependent_count++] = then;
+            waits[then->graph_order]++;
+        }
+    }
+    
+    // Kahn's algorithm: take services as the last of what they wait for goes
     nexus_service_t* sorted[NEXUS_MAX_SERVICES];
     uint32_t sorted_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (waits[i] == 0) {
+            sorted[sorted_count++] = services[i];
+        }
+    }
+    for (uint32_t i = 0; i < sorted_count; i++) {
+        service = sorted[i];
+        for (uint32_t j = 0; j < service->dependent_count; j++) {
+            nexus_service_t* then = service->dependents[j];
+            if (--waits[then->graph_order] == 0) {
+                sorted[sorted_count++] = then;
+            }
+        }
+    }
     
-    bool visited[NEXUS_MAX_SERVICES] = {false};
-    bool in_stack[NEXUS_MAX_SERVICES] = {false};
-    
-    nexus_service_t* service = g_manager.services;
-    uint32_t index = 0;
-    while (service) {
-        if (!visited[index]) {
-            nexus_topological_sort_dfs(service, index, visited, in_stack,
-                                      sorted, &sorted_count);
+    if (sorted_count < count) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (waits[i] > 0) {
+                nexus_log(services[i], "Dependency cycle through %s", services[i]->name);
+                sorted[sorted_count++] = services[i];
+            }
         }
-        service = service->next;
-        index++;
     }
     
     // Rebuild service list in dependency order
     g_manager.services = NULL;
     for (int i = sorted_count - 1; i >= 0; i--) {
+        sorted[i]->graph_order = i;
         sorted[i]->next = g_manager.services;
         g_manager.services = sorted[i];
     }
 }
 
+// The service can be depended on now: start every waiting dependent
+// whose last dependency this was. Spawning doesn't wait for the child, so
+// siblings come up in parallel.
+void nexus_mark_ready(nexus_service_t* service) {
+    service->ready_time = temporal_get_time();
+    __atomic_store_n(&service->ready, true, __ATOMIC_SEQ_CST);
+    nexus_emit_event(EVENT_SERVICE_READY, service, NULL);
+    
+    for (uint32_t i = 0; i < service->dependent_count; i++) {
+        nexus_service_t* dependent = service->dependents[i];
+        if (__atomic_load_n(&dependent->state, __ATOMIC_SEQ_CST) == SERVICE_STATE_WAITING &&
+            nexus_check_dependencies(dependent) && nexus_claim_waiting(dependent)) {
+            dependent->released_by = service;
+            nexus_spawn_service(dependent);
+        }
+    }
+}
+
 // =============================================================================
 // Runlevel Management
 // =============================================================================
@@ -469,7 +595,12 @@ int nexus_start_runlevel_services(uint8_t runlevel) {
         if (service->runlevel <= runlevel && 
             service->state == SERVICE_STATE_STOPPED &&
             !(service->state & SERVICE_STATE_DISABLED)) {
-            nexus_start_service(service->name);
+            if ((service->flags & SERVICE_FLAG_ON_DEMAND) && service->activation) {
+                // Deferred until something asks for it
+                nexus_arm_activation(service);
+            } else {
+                nexus_start_service(service->name);
+            }
         }
         service = service->next;
     }
@@ -541,37 +672,213 @@ void nexus_monitor_all_services(void) {
     }
 }
 
+// =============================================================================
+// Notifications and Activation
+// =============================================================================
+
+int nexus_add_activation_conduit(nexus_service_t* service, const char* name) {
+    if (!service || !name || service->activation) {
+        return -1;
+    }
+    
+    service->activation = conduit_create(name, NEXUS_ACTIVATION_BUFFER);
+    if (!service->activation) {
+        return -1;
+    }
+    
+    service->flags |= SERVICE_FLAG_ON_DEMAND;
+    return 0;
+}
+
+// Someone wrote to a stopped service's conduit; the message waits there
+// for it
+static void nexus_activate_service(nexus_service_t* service) {
+    conduit_poll_remove(g_nexus_poll, service->activation);
+    
+    if (service->state == SERVICE_STATE_STOPPED) {
+        nexus_log(service, "Activating service %s on demand", service->name);
+        nexus_start_service(service->name);
+    }
+}
+
+static void nexus_receive_notifications(void) {
+    nexus_notify_t notify;
+    
+    while (conduit_receive(g_nexus_notify, &notify, sizeof(notify),
+                           CONDUIT_FLAG_NONBLOCK) == sizeof(notify)) {
+        nexus_service_t* service = nexus_find_service_by_pid(notify.pid);
+        if (!service) {
+            continue;
+        }
+        
+        switch (notify.type) {
+            case NEXUS_NOTIFY_READY:
+                if (service->state == SERVICE_STATE_STARTING) {
+                    nexus_log(service, "Service %s is ready", service->name);
+                    service->state = SERVICE_STATE_RUNNING;
+                    nexus_mark_ready(service);
+                }
+                break;
+            
+            case NEXUS_NOTIFY_WATCHDOG:
+                // Counts as a passing health check
+                service->healthy = true;
+                service->last_health_check = temporal_get_time();
+                break;
+            
+            case NEXUS_NOTIFY_STOPPING:
+                // Its exit isn't a failure
+                service->state = SERVICE_STATE_STOPPING;
+                break;
+        }
+    }
+}
+
+// For services
+int nexus_notify(uint32_t type) {
+    conduit_t* conduit = conduit_open(NEXUS_NOTIFY_CONDUIT);
+    if (!conduit) {
+        return -1;
+    }
+    
+    nexus_notify_t notify = { .type = type, .pid = getpid() };
+    int64_t result = conduit_send(conduit, &notify, sizeof(notify), CONDUIT_FLAG_NONBLOCK);
+    conduit_close(conduit);
+    
+    return result < 0 ? -1 : 0;
+}
+
+// =============================================================================
+// Child Exits
+// =============================================================================
+
+// SIGCHLD only flags the exit and wakes the main loop, which reaps
+static void nexus_sigchld(int sig) {
+    (void)sig;
+    __atomic_store_n(&g_children_exited, 1, __ATOMIC_RELEASE);
+    conduit_source_notify(&g_child_source, CONDUIT_SELECT_READ_READY);
+}
+
+static uint32_t nexus_child_readiness(conduit_poll_source_t* source) {
+    (void)source;
+    return __atomic_load_n(&g_children_exited, __ATOMIC_ACQUIRE) ? CONDUIT_SELECT_READ_READY : 0;
+}
+
+static void nexus_reap_children(void) {
+    // Cleared first, so an exit while reaping wakes the loop again
+    __atomic_store_n(&g_children_exited, 0, __ATOMIC_RELEASE);
+    
+    pid_t pid;
+    int status;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        nexus_handle_service_exit(pid, WEXITSTATUS(status));
+    }
+}
+
 // =============================================================================
 // Main Service Manager Loop
 // =============================================================================
 
+// Run what's due: health checks, start timeouts and delayed restarts.
+// Returns the microseconds until the next is due, 0 if none is pending.
+static uint64_t nexus_run_timers(void) {
+    nexus_monitor_all_services();
+    
+    uint64_t now = temporal_get_time();
+    uint64_t next = 0;
+    
+    nexus_service_t* service = g_manager.services;
+    while (service) {
+        uint64_t due = 0;
+        
+        if (service->state == SERVICE_STATE_STARTING && service->start_timeout > 0) {
+            due = service->start_time + service->start_timeout * 1000000;
+            if (now >= due) {
+                // Its exit goes the way of any failure
+                nexus_log(service, "Service %s never reported ready", service->name);
+                service->state = SERVICE_STATE_FAILED;
+                kill(service->pid, SIGKILL);
+                due = 0;
+            }
+        } else if (service->restart_at) {
+            due = service->restart_at;
+            if (now >= due) {
+                service->restart_at = 0;
+                service->state = SERVICE_STATE_STOPPED;
+                nexus_start_service(service->name);
+                due = 0;
+            }
+        } else if (service->state == SERVICE_STATE_RUNNING && service->health_check_interval > 0) {
+            due = service->last_health_check + service->health_check_interval * 1000000;
+        }
+        
+        if (due > now && (next == 0 || due < next)) {
+            next = due;
+        }
+        service = service->next;
+    }
+    
+    return next ? next - now : 0;
+}
+
+// Sleeps until a notification, an activation, a child's exit or a timer
 static void nexus_main_loop(void* arg) {
+    conduit_poll_event_t events[NEXUS_POLL_EVENTS];
+    
     while (g_nexus_running) {
         // Process events
         nexus_process_events();
         
-        // Monitor services
-        nexus_monitor_all_services();
+        uint64_t timeout = nexus_run_timers();
+        int count = conduit_poll_wait(g_nexus_poll, events, NEXUS_POLL_EVENTS, timeout);
         
-        // Handle pending starts (waiting for dependencies)
-        nexus_service_t* service = g_manager.services;
-        while (service) {
-            if (service->state == SERVICE_STATE_WAITING) {
-                if (nexus_check_dependencies(service)) {
-                    nexus_spawn_service(service);
-                }
+        for (int i = 0; i < count; i++) {
+            if (events[i].source == &g_child_source) {
+                nexus_reap_children();
+            } else if (events[i].conduit == g_nexus_notify) {
+                nexus_receive_notifications();
+            } else if (events[i].data) {
+                nexus_activate_service(events[i].data);
             }
-            service = service->next;
         }
-        
-        // Reap zombie processes
-        pid_t pid;
-        int status;
-        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-            nexus_handle_service_exit(pid, WEXITSTATUS(status));
+    }
+}
+
+// =============================================================================
+// Boot Timeline
+// =============================================================================
+
+// When each service started and became ready since nexus came up, and
+// the chain of dependencies that held back the last one to be ready
+void nexus_print_boot_timeline(void) {
+    uint64_t boot = g_manager.boot_time;
+    nexus_service_t* last = NULL;
+    
+    nexus_log(NULL, "Boot timeline (ms):");
+    
+    nexus_service_t* service = g_manager.services;
+    while (service) {
+        if (service->start_time) {
+            if (service->ready) {
+                nexus_log(NULL, "  %-20s start %6llu  ready %6llu", service->name,
+                         (unsigned long long)(service->start_time - boot) / 1000,
+                         (unsigned long long)(service->ready_time - boot) / 1000);
+                if (!last || service->ready_time > last->ready_time) {
+                    last = service;
+                }
+            } else {
+                nexus_log(NULL, "  %-20s start %6llu  %s", service->name,
+                         (unsigned long long)(service->start_time - boot) / 1000,
+                         nexus_state_to_string(service->state));
+            }
         }
+        service = service->next;
+    }
         
-        temporal_sleep(100000);  // 100ms
+    nexus_log(NULL, "Critical path:");
+    for (service = last; service; service = service->released_by) {
+        nexus_log(NULL, "  %-20s ready %6llu", service->name,
+                 (unsigned long long)(service->ready_time - boot) / 1000);
     }
 }
 
@@ -584,6 +891,18 @@ int nexus_init(void) {
     
     // Set initial runlevel
     g_manager.current_runlevel = RUNLEVEL_SINGLE;
+    g_manager.boot_time = temporal_get_time();
+    
+    // What the main loop waits on
+    g_nexus_poll = conduit_poll_create();
+    g_nexus_notify = conduit_create_ring(NEXUS_NOTIFY_CONDUIT, 4096, CONDUIT_RING_MPSC);
+    if (!g_nexus_poll || !g_nexus_notify) {
+        return -1;
+    }
+    conduit_source_init(&g_child_source, nexus_child_readiness);
+    conduit_poll_add(g_nexus_poll, g_nexus_notify, CONDUIT_SELECT_READ, NULL);
+    conduit_poll_add_source(g_nexus_poll, &g_child_source, CONDUIT_SELECT_READ, NULL);
+    signal(SIGCHLD, nexus_sigchld);
     
     // Load system services configuration
     nexus_load_config("/etc/nexus/services.conf");
@@ -625,6 +944,10 @@ void nexus_shutdown(void) {
     
     g_nexus_running = false;
     
+    // Wake the manager thread to see it
+    nexus_notify_t wake = { .type = 0, .pid = 0 };
+    conduit_send(g_nexus_notify, &wake, sizeof(wake), CONDUIT_FLAG_NONBLOCK);
+    
     // Wait for manager thread to exit
     temporal_sleep(200000);
 }
@@ -658,5 +981,6 @@ static void nexus_register_essential_services(void) {
     nexus_service_t* pkgd = nexus_create_service("infinityd", "/usr/bin/infinityd");
     pkgd->runlevel = RUNLEVEL_MULTI_USER;
     nexus_add_dependency(pkgd, "netmgr", false, false);
+    nexus_add_activation_conduit(pkgd, "infinity.requests");  // Not needed to boot
     nexus_register_service(pkgd);
 }
@@ -20,6 +20,12 @@
 #define NEXUS_MAX_PATH_LEN      256
 #define NEXUS_MAX_ARGS          32
 #define NEXUS_MAX_ENV_VARS      64
+#define NEXUS_MAX_DEPENDENTS    32
+#define NEXUS_POLL_EVENTS       32
+#define NEXUS_ACTIVATION_BUFFER 65536
+
+// Where services send their nexus_notify_t
+#define NEXUS_NOTIFY_CONDUIT    "nexus.notify"
 
 // Service states
 #define SERVICE_STATE_STOPPED    0x00
@@ -44,6 +50,18 @@
 #define SERVICE_FLAG_NETWORK     0x08
 #define SERVICE_FLAG_FILESYSTEM  0x10
 #define SERVICE_FLAG_GRAPHICS    0x20
+#define SERVICE_FLAG_ON_DEMAND   0x40    // Started by a message on its activation conduit
+
+// Manager events
+#define EVENT_SERVICE_STARTED    0x01
+#define EVENT_SERVICE_READY      0x02    // Dependents may start
+#define EVENT_SERVICE_STOPPED    0x03
+#define EVENT_SERVICE_FAILED     0x04
+
+// Notifications from services
+#define NEXUS_NOTIFY_READY       0x01    // Started up; for SERVICE_TYPE_NOTIFY
+#define NEXUS_NOTIFY_WATCHDOG    0x02    // Still healthy
+#define NEXUS_NOTIFY_STOPPING    0x03    // About to exit on purpose
 
 // Runlevel definitions
 #define RUNLEVEL_HALT           0
@@ -79,6 +97,14 @@ typedef struct {
     uint32_t nice_level;        // Nice level (-20 to 19)
 } resource_limits_t;
 
+// Message on NEXUS_NOTIFY_CONDUIT
+typedef struct {
+    uint32_t type;
+    pid_t pid;                  // The service's
+} nexus_notify_t;
+
+struct conduit;
+
 // Service definition
 typedef struct nexus_service {
     // Identification
@@ -109,6 +135,12 @@ typedef struct nexus_service {
     service_dependency_t dependencies[NEXUS_MAX_DEPENDENCIES];
     uint32_t dependency_count;
     
+    // Dependency graph, from nexus_build_dependency_graph: the services
+    // this one's readiness can let start, and its place in boot order
+    struct nexus_service* dependents[NEXUS_MAX_DEPENDENTS];
+    uint32_t dependent_count;
+    uint32_t graph_order;
+    
     // Resource limits
     resource_limits_t limits;
     
@@ -119,11 +151,18 @@ typedef struct nexus_service {
     uint64_t stop_time;
     uint32_t restart_count;
     int exit_code;
+    bool ready;                 // Dependents may start
+    uint64_t ready_time;
+    uint64_t restart_at;        // Pending delayed restart
+    struct nexus_service* released_by;  // Last dependency it waited for
     
     // Socket activation
     int* listen_fds;
     uint32_t listen_fd_count;
     
+    // Conduit activation: nexus holds the conduit until its first message
+    struct conduit* activation;
+    
     // Health check
     void (*health_check)(struct nexus_service* service);
     uint32_t health_check_interval;
@@ -150,6 +189,7 @@ typedef struct {
     uint8_t current_runlevel;
     uint8_t target_runlevel;
     bool shutdown_requested;
+    uint64_t boot_time;
     
     // Event queue
     struct {
@@ -212,6 +252,7 @@ int nexus_add_dependency(nexus_service_t* service, const char* dependency,
 int nexus_resolve_dependencies(nexus_service_t* service);
 bool nexus_check_dependencies(nexus_service_t* service);
 void nexus_build_dependency_graph(void);
+void nexus_mark_ready(nexus_service_t* service);
 
 // Runlevel management
 int nexus_change_runlevel(uint8_t runlevel);
@@ -228,6 +269,10 @@ int nexus_parse_service_file(const char* file_path, service_config_t* config);
 int nexus_add_socket(nexus_service_t* service, const char* address, uint16_t port);
 int nexus_activate_socket(nexus_service_t* service, int fd);
 void nexus_handle_socket_connection(int fd);
+int nexus_add_activation_conduit(nexus_service_t* service, const char* name);
+
+// For services: tell nexus NEXUS_NOTIFY_*
+int nexus_notify(uint32_t type);
 
 // Health monitoring
 void nexus_check_service_health(nexus_service_t* service);
@@ -246,6 +291,7 @@ void nexus_process_events(void);
 // Statistics
 void nexus_get_statistics(nexus_manager_t* stats);
 void nexus_print_status(void);
+void nexus_print_boot_timeline(void);
 
 // Helper functions
 const char* nexus_state_to_string(uint8_t state);
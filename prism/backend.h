@@ -0,0 +1,72 @@
+/*
+ * Prism Render Backends
+ * What an output draws and presents with. The CPU backend does all of
+ * it; others do what their hardware can and leave the rest to it.
+ */
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "prism.h"
+
+// =============================================================================
+// Backend Interface
+// =============================================================================
+
+// A scaled blit's mapping from an area's top-left into the buffer, and
+// its step a pixel across and a row down, all in 16.16 fixed point
+typedef struct {
+    int64_t fx;
+    int64_t fy;
+    int64_t step_x;
+    int64_t step_y;
+} prism_blit_map_t;
+
+// Rects are output-local and within the output; buffer coordinates off
+// the buffer repeat its edge pixels. Any operation may be NULL, for the
+// CPU backend's to be used instead: drawing then goes into
+// output->framebuffer, which a backend that keeps its own target points
+// at that target.
+typedef struct prism_backend {
+    const char* name;
+    
+    // Take over output, or -1 if the hardware isn't there
+    int (*attach)(prism_output_t* output);
+    void (*detach)(prism_output_t* output);
+    
+    // Drawing
+    void (*fill)(prism_output_t* output, const prism_rect_t* rect, uint32_t color);
+    void (*copy)(prism_output_t* output, const prism_rect_t* area, const prism_buffer_t* buffer,
+                 int64_t sx, int64_t sy);
+    void (*blend)(prism_output_t* output, const prism_rect_t* area,
+                  const prism_buffer_t* buffer, int64_t sx, int64_t sy, uint32_t opacity);
+    void (*blit_scaled)(prism_output_t* output, const prism_rect_t* area,
+                        const prism_buffer_t* buffer, const prism_blit_map_t* map,
+                        bool opaque, uint32_t opacity);
+    prism_blur_t* (*blur)(prism_blur_t* blur, prism_output_t* output, const prism_rect_t* rect);
+    void (*blur_draw)(const prism_blur_t* blur, prism_output_t* output,
+                      const prism_rect_t* clip);
+    
+    // Presentation
+    int (*enable_flip)(prism_output_t* output);
+    void (*present)(prism_output_t* output, const prism_region_t* damage);
+    void (*flip)(prism_output_t* output);
+    bool (*wait_vblank)(prism_output_t* output, uint64_t timeout_usec);
+} prism_backend_t;
+
+extern const prism_backend_t prism_backend_cpu;
+extern const prism_backend_t prism_backend_virtio_gpu;
+
+// output's backend's op, or the CPU backend's where it has none
+#define PRISM_BACKEND_OP(output, op) \
+    ((output)->backend && (output)->backend->op ? (output)->backend->op : prism_backend_cpu.op)
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+// Attach the first backend whose hardware is there, the CPU's if none is
+const prism_backend_t* prism_backend_select(prism_output_t* output);
+void prism_backend_release(prism_output_t* output);
+
+#endif /* BACKEND_H */
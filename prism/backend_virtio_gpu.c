@@ -0,0 +1,119 @@
+/*
+ * Prism VirtIO GPU Backend
+ * Composites into a host resource's guest pixels and presents damage by
+ * having the host copy and show it
+ */
+
+#include "backend.h"
+#include "../continuum/flux_memory.h"
+#include "../continuum/drivers/graphics/virtio_gpu.h"
+
+// =============================================================================
+// Backend State
+// =============================================================================
+
+// The scanout resource and the framebuffer it stands in for
+typedef struct {
+    virtio_gpu_device_t* dev;
+    virtio_gpu_resource_t* resource;
+    uint32_t* framebuffer;
+    uint32_t fb_stride;
+} prism_virtio_gpu_t;
+
+// =============================================================================
+// Attach and Detach
+// =============================================================================
+
+static int prism_virtio_gpu_attach(prism_output_t* output) {
+    virtio_gpu_device_t* dev = virtio_gpu_get_device(0);
+    if (!dev || output->width == 0 || output->height == 0) {
+        return -1;
+    }
+    
+    prism_virtio_gpu_t* gpu = flux_allocate(NULL, sizeof(prism_virtio_gpu_t),
+                                            FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    if (!gpu) {
+        return -1;
+    }
+    
+    gpu->dev = dev;
+    gpu->resource = virtio_gpu_create_resource(dev, output->width, output->height);
+    if (!gpu->resource || virtio_gpu_set_scanout(dev, 0, gpu->resource) != 0) {
+        virtio_gpu_destroy_resource(dev, gpu->resource);
+        flux_free(gpu);
+        return -1;
+    }
+    
+    // Everything's drawn straight into what the host copies from
+    gpu->framebuffer = output->framebuffer;
+    gpu->fb_stride = output->fb_stride;
+    output->framebuffer = gpu->resource->pixels;
+    output->fb_stride = output->width;
+    output->backend_data = gpu;
+    return 0;
+}
+
+static void prism_virtio_gpu_detach(prism_output_t* output) {
+    prism_virtio_gpu_t* gpu = output->backend_data;
+    if (!gpu) {
+        return;
+    }
+    
+    output->framebuffer = gpu->framebuffer;
+    output->fb_stride = gpu->fb_stride;
+    output->backend_data = NULL;
+    
+    virtio_gpu_set_scanout(gpu->dev, 0, NULL);
+    virtio_gpu_destroy_resource(gpu->dev, gpu->resource);
+    flux_free(gpu);
+}
+
+// =============================================================================
+// Presentation
+// =============================================================================
+
+// The host shows one resource; there are no pages to flip
+static int prism_virtio_gpu_enable_flip(prism_output_t* output) {
+    (void)output;
+    return -1;
+}
+
+static void prism_virtio_gpu_present(prism_output_t* output, const prism_region_t* damage) {
+    prism_virtio_gpu_t* gpu = output->backend_data;
+    if (!gpu || damage->count == 0) {
+        return;
+    }
+    
+    // Damage is output-local and within the output
+    virtio_gpu_rect_t rects[PRISM_MAX_DAMAGE];
+    for (uint32_t i = 0; i < damage->count; i++) {
+        const prism_rect_t* rect = &damage->rects[i];
+        rects[i] = (virtio_gpu_rect_t){
+            (uint32_t)rect->x, (uint32_t)rect->y, rect->width, rect->height
+        };
+    }
+    virtio_gpu_present(gpu->dev, gpu->resource, rects, damage->count);
+}
+
+static void prism_virtio_gpu_flip(prism_output_t* output) {
+    (void)output;
+}
+
+// The host paces its own display and reports no retrace; frames go by the
+// predicted deadline
+static bool prism_virtio_gpu_wait_vblank(prism_output_t* output, uint64_t timeout_usec) {
+    (void)output;
+    (void)timeout_usec;
+    return false;
+}
+
+// Drawing is the CPU backend's, into the resource's pixels
+const prism_backend_t prism_backend_virtio_gpu = {
+    .name = "virtio-gpu",
+    .attach = prism_virtio_gpu_attach,
+    .detach = prism_virtio_gpu_detach,
+    .enable_flip = prism_virtio_gpu_enable_flip,
+    .present = prism_virtio_gpu_present,
+    .flip = prism_virtio_gpu_flip,
+    .wait_vblank = prism_virtio_gpu_wait_vblank
+};
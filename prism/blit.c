@@ -0,0 +1,175 @@
+/*
+ * Prism Blit Kernels
+ * Copy and blend rows of premultiplied ARGB pixels. SSE2 is part of x86-64 and always
+ * there; AVX2 is used where the CPU has it and the kernel enabled its state.
+ */
+
+#include "blit.h"
+#include "../continuum/continuum_core.h"
+#include "../continuum/flux_memory.h"
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+// =============================================================================
+// Blend Kernels
+// =============================================================================
+
+typedef void (*prism_blend_fn)(uint32_t* dst, const uint32_t* src, uint32_t count,
+                               uint32_t opacity);
+
+static void blend_row_scalar(uint32_t* dst, const uint32_t* src, uint32_t count,
+                             uint32_t opacity) {
+    for (uint32_t i = 0; i < count; i++) {
+        dst[i] = prism_blit_pixel(dst[i], src[i], opacity);
+    }
+}
+
+// Two pixels, unpacked to 16 bits a channel, as prism_blit_pixel: src
+// scaled by opacity, plus dst times 255 less that alpha, over 255.
+// Nothing overflows 16 bits on the way.
+static inline __m128i blend_pixels_sse2(__m128i s, __m128i d, __m128i opacity) {
+    const __m128i bias = _mm_set1_epi16(128);
+    s = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(s, opacity), bias), 8);
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), a);
+    
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(d, inv), bias);
+    t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    return _mm_add_epi16(s, t);
+}
+
+static void blend_row_sse2(uint32_t* dst, const uint32_t* src, uint32_t count,
+                           uint32_t opacity) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i op = _mm_set1_epi16((short)opacity);
+    
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i lo = blend_pixels_sse2(_mm_unpacklo_epi8(s, zero),
+                                       _mm_unpacklo_epi8(d, zero), op);
+        __m128i hi = blend_pixels_sse2(_mm_unpackhi_epi8(s, zero),
+                                       _mm_unpackhi_epi8(d, zero), op);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    
+    blend_row_scalar(dst + i, src + i, count - i, opacity);
+}
+
+// As SSE2, a 128-bit lane at a time; unpacking and packing both stay
+// within lanes, so pixels come back where they were
+__attribute__((target("avx2")))
+static inline __m256i blend_pixels_avx2(__m256i s, __m256i d, __m256i opacity) {
+    const __m256i bias = _mm256_set1_epi16(128);
+    s = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(s, opacity), bias), 8);
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xFF), 0xFF);
+    __m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+    
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(d, inv), bias);
+    t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+    return _mm256_add_epi16(s, t);
+}
+
+__attribute__((target("avx2")))
+static void blend_row_avx2(uint32_t* dst, const uint32_t* src, uint32_t count,
+                           uint32_t opacity) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i op = _mm256_set1_epi16((short)opacity);
+    
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i lo = blend_pixels_avx2(_mm256_unpacklo_epi8(s, zero),
+                                       _mm256_unpacklo_epi8(d, zero), op);
+        __m256i hi = blend_pixels_avx2(_mm256_unpackhi_epi8(s, zero),
+                                       _mm256_unpackhi_epi8(d, zero), op);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    _mm256_zeroupper();
+    
+    blend_row_sse2(dst + i, src + i, count - i, opacity);
+}
+
+// =============================================================================
+// Kernel Selection
+// =============================================================================
+
+static struct {
+    prism_blit_impl_t impl;
+    prism_blend_fn blend;
+    bool avx2_usable;
+} g_blit = {
+    .impl = PRISM_BLIT_SSE2,
+    .blend = blend_row_sse2,
+    .avx2_usable = false
+};
+
+static const char* const g_blit_names[] = {
+    [PRISM_BLIT_SCALAR] = "scalar",
+    [PRISM_BLIT_SSE2] = "sse2",
+    [PRISM_BLIT_AVX2] = "avx2"
+};
+
+static uint64_t read_xcr0(void) {
+    uint32_t low, high;
+    __asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return ((uint64_t)high << 32) | low;
+}
+
+void prism_blit_init(uint64_t cpu_features) {
+    // AVX needs XCR0 to enable YMM state; OSXSAVE says xgetbv is there to ask
+    g_blit.avx2_usable = (cpu_features & CPU_FEATURE_AVX2) &&
+                         (cpu_features & CPU_FEATURE_OSXSAVE) &&
+                         (read_xcr0() & 0x6) == 0x6;
+    
+    prism_blit_set_impl(g_blit.avx2_usable ? PRISM_BLIT_AVX2 : PRISM_BLIT_SSE2);
+}
+
+int prism_blit_set_impl(prism_blit_impl_t impl) {
+    switch (impl) {
+        case PRISM_BLIT_SCALAR:
+            g_blit.blend = blend_row_scalar;
+            break;
+        case PRISM_BLIT_SSE2:
+            g_blit.blend = blend_row_sse2;
+            break;
+        case PRISM_BLIT_AVX2:
+            if (!g_blit.avx2_usable) {
+                return -1;
+            }
+            g_blit.blend = blend_row_avx2;
+            break;
+        default:
+            return -1;
+    }
+    
+    g_blit.impl = impl;
+    return 0;
+}
+
+prism_blit_impl_t prism_blit_get_impl(void) {
+    return g_blit.impl;
+}
+
+const char* prism_blit_impl_name(prism_blit_impl_t impl) {
+    if (impl > PRISM_BLIT_AVX2) {
+        return "unknown";
+    }
+    return g_blit_names[impl];
+}
+
+// =============================================================================
+// Row Operations
+// =============================================================================
+
+void prism_blit_copy_row(uint32_t* dst, const uint32_t* src, uint32_t count) {
+    memcpy(dst, src, (size_t)count * sizeof(uint32_t));
+}
+
+void prism_blit_blend_row(uint32_t* dst, const uint32_t* src, uint32_t count,
+                          uint32_t opacity) {
+    g_blit.blend(dst, src, count, opacity);
+}
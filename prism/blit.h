@@ -0,0 +1,83 @@
+/*
+ * Prism Blit Kernels
+ * Row kernels for compositing surfaces into an output, picked once at
+ * init for what the CPU has
+ */
+
+#ifndef BLIT_H
+#define BLIT_H
+
+#include "prism.h"
+
+// =============================================================================
+// Blit Constants
+// =============================================================================
+
+// Opacity as a multiplier of a pixel's alpha, 0 to PRISM_OPACITY_ONE
+#define PRISM_OPACITY_ONE       256
+
+// Blend implementations (selected once at init)
+typedef enum {
+    PRISM_BLIT_SCALAR = 0,      // One pixel at a time
+    PRISM_BLIT_SSE2,            // Four pixels at a time
+    PRISM_BLIT_AVX2             // Eight pixels at a time
+} prism_blit_impl_t;
+
+// =============================================================================
+// Blit Kernels
+// =============================================================================
+
+// Pixels are premultiplied ARGB (buffers are converted when attached), so
+// "over" is src + dst * (255 - src alpha) / 255: a multiply, adds and
+// shifts a channel, two channels at a time, with no division.
+
+// Round x / 255, for x up to 255 * 255
+static inline uint32_t prism_div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Every channel of pixel times scale / 256, rounded
+static inline uint32_t prism_pixel_scale(uint32_t pixel, uint32_t scale) {
+    uint32_t rb = (((pixel & 0x00FF00FF) * scale + 0x00800080) >> 8) & 0x00FF00FF;
+    uint32_t ag = (((pixel >> 8) & 0x00FF00FF) * scale + 0x00800080) & 0xFF00FF00;
+    return rb | ag;
+}
+
+// Every channel of pixel times scale / 255, rounded as prism_div255
+static inline uint32_t prism_pixel_mul(uint32_t pixel, uint32_t scale) {
+    uint32_t rb = (pixel & 0x00FF00FF) * scale + 0x00800080;
+    uint32_t ag = ((pixel >> 8) & 0x00FF00FF) * scale + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+    return rb | ag;
+}
+
+static inline uint32_t prism_pixel_over(uint32_t dst, uint32_t src) {
+    return src + prism_pixel_mul(dst, 255 - (src >> 24));
+}
+
+// src over dst, src scaled by opacity first
+static inline uint32_t prism_blit_pixel(uint32_t dst, uint32_t src, uint32_t opacity) {
+    if (opacity < PRISM_OPACITY_ONE) {
+        src = prism_pixel_scale(src, opacity);
+    }
+    return prism_pixel_over(dst, src);
+}
+
+// =============================================================================
+// Function Prototypes
+// =============================================================================
+
+void prism_blit_init(uint64_t cpu_features);
+int prism_blit_set_impl(prism_blit_impl_t impl);
+prism_blit_impl_t prism_blit_get_impl(void);
+const char* prism_blit_impl_name(prism_blit_impl_t impl);
+
+// count pixels of src onto dst: copy_row for what's opaque, blend_row for
+// anything with alpha or below full opacity
+void prism_blit_copy_row(uint32_t* dst, const uint32_t* src, uint32_t count);
+void prism_blit_blend_row(uint32_t* dst, const uint32_t* src, uint32_t count,
+                          uint32_t opacity);
+
+#endif /* BLIT_H */
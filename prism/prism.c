@@ -5,10 +5,15 @@
 
 #include "prism.h"
 #include "renderer.h"
+#include "blit.h"
+#include "backend.h"
 #include "wayland_protocol.h"
 #include "../continuum/flux_memory.h"
 #include "../continuum/temporal_scheduler.h"
 #include "../continuum/conduit_ipc.h"
+#include "../continuum/continuum_core.h"
+#include "../continuum/continuum_trace.h"
+#include "../continuum/drivers/input/input_event.h"
 
 // =============================================================================
 // Global Compositor State
@@ -16,8 +21,69 @@
 
 static prism_compositor_t g_compositor;
 static spinlock_t g_compositor_lock = SPINLOCK_INIT;
+static spinlock_t g_blur_lock = SPINLOCK_INIT;
 static bool g_running = false;
 
+// =============================================================================
+// Damage Tracking
+// =============================================================================
+
+// What a surface draws over, in global coordinates: its geometry, and for
+// windows the shadow around it
+static prism_rect_t prism_surface_bounds(prism_surface_t* surface) {
+    prism_rect_t bounds = surface->geometry;
+    if (g_compositor.enable_shadows && surface->type == SURFACE_TYPE_WINDOW) {
+        bounds.x -= PRISM_SHADOW_RADIUS;
+        bounds.y += PRISM_SHADOW_OFFSET_Y - PRISM_SHADOW_RADIUS;
+        bounds.width += PRISM_SHADOW_RADIUS * 2;
+        bounds.height += PRISM_SHADOW_RADIUS * 2;
+    }
+    return bounds;
+}
+
+// Translucent windows above source see what it draws through their
+// blurred backgrounds; drop those where rect meets them. source is NULL
+// when any window might see it. The compositor lock is held.
+static void prism_blur_invalidate(const prism_rect_t* rect, prism_surface_t* source) {
+    prism_surface_t* surface = g_compositor.surface_stack_top;
+    while (surface && surface != source) {
+        prism_rect_t overlap;
+        if (surface->blur_valid && prism_rect_intersect(&surface->geometry, rect, &overlap)) {
+            surface->blur_valid = false;
+        }
+        surface = surface->next_sibling;
+    }
+}
+
+// Add a global rect, drawn by source, to the damage of every output it
+// falls on; the compositor lock is held
+static void prism_damage_area(const prism_rect_t* rect, prism_surface_t* source) {
+    if (g_compositor.enable_blur) {
+        prism_blur_invalidate(rect, source);
+    }
+    
+    prism_output_t* output = g_compositor.outputs;
+    while (output) {
+        prism_rect_t area = { output->x, output->y, output->width, output->height };
+        prism_rect_t damage;
+        if (prism_rect_intersect(rect, &area, &damage)) {
+            damage.x -= output->x;
+            damage.y -= output->y;
+            prism_region_add(&output->damage, &damage);
+            output->needs_repaint = true;
+        }
+        output = output->next;
+    }
+}
+
+// All of a mapped surface, where it is now; the compositor lock is held
+static void prism_damage_surface(prism_surface_t* surface) {
+    if (surface->state & SURFACE_STATE_MAPPED) {
+        prism_rect_t bounds = prism_surface_bounds(surface);
+        prism_damage_area(&bounds, surface);
+    }
+}
+
 // =============================================================================
 // Surface Management
 // =============================================================================
@@ -65,6 +131,9 @@ void prism_destroy_surface(prism_surface_t* surface) {
     
     spinlock_acquire(&g_compositor_lock);
     
+    // Uncover what was under it
+    prism_damage_surface(surface);
+    
     // Remove from surface stack
     prism_surface_t** stack = &g_compositor.surface_stack_top;
     while (*stack) {
@@ -88,6 +157,12 @@ void prism_destroy_surface(prism_surface_t* surface) {
         }
     }
     
+    for (prism_seat_t* seat = g_compositor.seats; seat; seat = seat->next) {
+        if (seat->cursor == surface) {
+            seat->cursor = NULL;
+        }
+    }
+    
     // Remove from global surface list
     prism_surface_t** global = &g_compositor.surfaces;
     while (*global) {
@@ -107,6 +182,7 @@ void prism_destroy_surface(prism_surface_t* surface) {
     if (surface->pending_buffer) {
         prism_buffer_release(surface->pending_buffer);
     }
+    prism_blur_destroy(surface->blur_cache);
     
     flux_free(surface);
 }
@@ -121,9 +197,10 @@ void prism_surface_attach_buffer(prism_surface_t* surface, prism_buffer_t* buffe
         prism_buffer_release(surface->pending_buffer);
     }
     
-    // Reference new buffer
+    // Reference new buffer, premultiplied from here on
     if (buffer) {
         buffer->ref_count++;
+        prism_buffer_premultiply(buffer);
     }
     
     surface->pending_buffer = buffer;
@@ -136,6 +213,9 @@ void prism_surface_commit(prism_surface_t* surface) {
     
     spinlock_acquire(&g_compositor_lock);
     
+    prism_rect_t old_bounds = prism_surface_bounds(surface);
+    bool first = !surface->buffer;
+    
     // Swap buffers
     if (surface->pending_buffer) {
         if (surface->buffer) {
@@ -146,17 +226,32 @@ void prism_surface_commit(prism_surface_t* surface) {
     }
     
     // Apply pending geometry
+    bool moved = false;
     if (surface->pending_geometry.width != 0) {
+        moved = memcmp(&surface->geometry, &surface->pending_geometry, sizeof(prism_rect_t)) != 0;
         surface->geometry = surface->pending_geometry;
         memset(&surface->pending_geometry, 0, sizeof(prism_rect_t));
     }
     
-    // Mark outputs for repaint
-    prism_output_t* output = g_compositor.outputs;
-    while (output) {
-        output->needs_repaint = true;
-        output = output->next;
+    // Damage the outputs: where the surface was and is if it moved or has
+    // just got content, else only what the client damaged
+    if (moved || first) {
+        if (surface->state & SURFACE_STATE_MAPPED) {
+            prism_damage_area(&old_bounds, surface);
+        }
+        prism_damage_surface(surface);
+    } else if (surface->state & SURFACE_STATE_MAPPED) {
+        prism_rect_t extent = { 0, 0, surface->geometry.width, surface->geometry.height };
+        for (uint32_t i = 0; i < surface->pending_damage.count; i++) {
+            prism_rect_t rect;
+            if (prism_rect_intersect(&surface->pending_damage.rects[i], &extent, &rect)) {
+                rect.x += surface->geometry.x;
+                rect.y += surface->geometry.y;
+                prism_damage_area(&rect, surface);
+            }
+        }
     }
+    surface->pending_damage.count = 0;
     
     spinlock_release(&g_compositor_lock);
     
@@ -167,6 +262,39 @@ void prism_surface_commit(prism_surface_t* surface) {
     }
 }
 
+// Surface-local, for the next commit
+void prism_surface_damage(prism_surface_t* surface, prism_rect_t* rect) {
+    if (!surface || !rect) {
+        return;
+    }
+    
+    spinlock_acquire(&g_compositor_lock);
+    prism_region_add(&surface->pending_damage, rect);
+    spinlock_release(&g_compositor_lock);
+}
+
+void prism_surface_damage_all(prism_surface_t* surface) {
+    // The commit clips it to the surface
+    prism_rect_t all = { 0, 0, INT32_MAX, INT32_MAX };
+    prism_surface_damage(surface, &all);
+}
+
+// Surface-local; NULL for none. Only surfaces at full opacity with an
+// untransformed buffer hide what's below them.
+void prism_surface_set_opaque_region(prism_surface_t* surface, prism_rect_t* rect) {
+    if (!surface) {
+        return;
+    }
+    
+    spinlock_acquire(&g_compositor_lock);
+    if (rect) {
+        surface->opaque_region = *rect;
+    } else {
+        memset(&surface->opaque_region, 0, sizeof(prism_rect_t));
+    }
+    spinlock_release(&g_compositor_lock);
+}
+
 void prism_map_surface(prism_surface_t* surface) {
     if (!surface || (surface->state & SURFACE_STATE_MAPPED)) {
         return;
@@ -183,6 +311,8 @@ void prism_map_surface(prism_surface_t* surface) {
     }
     *stack = surface;
     
+    prism_damage_surface(surface);
+    
     spinlock_release(&g_compositor_lock);
 }
 
@@ -207,57 +337,496 @@ void prism_raise_surface(prism_surface_t* surface) {
     surface->next_sibling = g_compositor.surface_stack_top;
     g_compositor.surface_stack_top = surface;
     
+    // What was above it is below it now, so its blur and theirs both change
+    if (surface->state & SURFACE_STATE_MAPPED) {
+        prism_rect_t bounds = prism_surface_bounds(surface);
+        surface->blur_valid = false;
+        prism_damage_area(&bounds, NULL);
+    }
+    
     spinlock_release(&g_compositor_lock);
 }
 
+// =============================================================================
+// Frame Scheduling
+// =============================================================================
+
+// Composition is timed to finish just before the display's next vblank:
+// predicted from the refresh rate, and put right by the vblanks the
+// display reports where it does
+
+#define PRISM_DEFAULT_REFRESH   60      // Hz, where the mode doesn't say
+#define PRISM_FRAME_MARGIN      1000    // usec to spare besides the estimate
+#define PRISM_VBLANK_SLACK      2000    // usec a vblank may be later than predicted
+
+// Aim output at the first vblank after now it can still be composed for
+static void prism_frame_next(prism_output_t* output, uint64_t now) {
+    uint32_t hz = output->refresh_rate ? output->refresh_rate : PRISM_DEFAULT_REFRESH;
+    output->refresh_interval = 1000000 / hz;
+    
+    if (output->next_vblank <= now) {
+        uint64_t behind = now - output->next_vblank;
+        output->next_vblank += (behind / output->refresh_interval + 1) * output->refresh_interval;
+    }
+    if (output->next_vblank - now < output->composite_estimate + PRISM_FRAME_MARGIN) {
+        output->next_vblank += output->refresh_interval;
+    }
+}
+
+// When to start composing output's next frame
+static uint64_t prism_frame_start(prism_output_t* output) {
+    uint64_t lead = output->composite_estimate + PRISM_FRAME_MARGIN;
+    return output->next_vblank > lead ? output->next_vblank - lead : 0;
+}
+
+// Present a frame composed from started at the vblank it was for: into
+// the hidden page and flipped to at the vblank, or copied at the vblank
+static void prism_frame_present(prism_output_t* output, const prism_region_t* damage,
+                                uint64_t started) {
+    uint64_t composed = temporal_get_time();
+    uint64_t frame_time = composed - started;
+    bool missed = composed > output->next_vblank;
+    
+    if (output->flip_pages) {
+        prism_present_damage(output, damage);
+    }
+    
+    uint64_t now = temporal_get_time();
+    if (!missed && output->next_vblank > now) {
+        uint64_t remaining = output->next_vblank - now;
+        if (prism_output_wait_vblank(output, remaining + PRISM_VBLANK_SLACK)) {
+            output->next_vblank = temporal_get_time();
+        } else {
+            temporal_sleep(remaining);
+        }
+    }
+    
+    if (output->flip_pages) {
+        prism_present_flip(output);
+    } else {
+        prism_present_damage(output, damage);
+        frame_time += temporal_get_time() - now;
+    }
+    
+    // The estimate rises to a slow frame at once and falls back gradually
+    if (frame_time > output->composite_estimate) {
+        output->composite_estimate = frame_time;
+    } else {
+        output->composite_estimate -= (output->composite_estimate - frame_time) / 8;
+    }
+    
+    prism_frame_stats_t* stats = &output->stats;
+    stats->frames++;
+    if (missed) {
+        stats->missed++;
+    }
+    stats->frame_time = frame_time;
+    stats->frame_time_avg = stats->frames == 1 ? frame_time :
+                            stats->frame_time_avg - stats->frame_time_avg / 16 + frame_time / 16;
+    if (frame_time > stats->frame_time_max) {
+        stats->frame_time_max = frame_time;
+    }
+    
+    prism_frame_next(output, temporal_get_time());
+}
+
+// =============================================================================
+// Tiled Rendering
+// =============================================================================
+
+// A repaint's damage is cut into tiles on a grid, one per cell it meets,
+// so no two overlap and any CPU can draw any of them. Workers take tiles
+// by index; the output's own thread draws them too and waits for the last
+// before presenting. A worker that misses a wakeup costs only help.
+
+#define PRISM_TILE_SIZE         128     // Pixels a side, at least
+#define PRISM_MAX_TILES         512
+#define PRISM_TILE_MIN_AREA     (256 * 256)  // Damage drawn on the output's thread alone
+#define PRISM_MAX_WORKERS       15
+
+typedef struct {
+    prism_output_t* output;
+    prism_surface_t* const* surfaces;
+    int surface_count;
+    prism_rect_t tiles[PRISM_MAX_TILES];
+    uint32_t tile_count;
+    uint32_t next;              // Next tile to take
+    uint32_t done;              // Tiles drawn
+    uint32_t users;             // Workers inside it
+    bool active;
+} prism_tile_job_t;
+
+static struct {
+    spinlock_t lock;            // Jobs' active and users
+    prism_tile_job_t jobs[PRISM_MAX_OUTPUTS];
+    quantum_context_t* workers[PRISM_MAX_WORKERS];
+    uint32_t worker_count;
+    uint32_t generation;        // Bumped as each job is posted
+} g_tiles = { .lock = SPINLOCK_INIT };
+
+static void prism_draw_tile(prism_output_t* output, prism_surface_t* const* surfaces,
+                            int surface_count, const prism_rect_t* rect);
+
+// Cut damage, within the output, into tiles on a grid coarse enough that
+// there are no more cells than tiles. Returns the tiles made.
+static uint32_t prism_tile_damage(const prism_region_t* damage, prism_rect_t* tiles) {
+    if (damage->count == 0) {
+        return 0;
+    }
+    
+    prism_rect_t bounds = damage->rects[0];
+    for (uint32_t r = 1; r < damage->count; r++) {
+        bounds = prism_rect_union(&bounds, &damage->rects[r]);
+    }
+    
+    uint32_t size = PRISM_TILE_SIZE;
+    int32_t x0, y0, x1, y1;
+    for (;;) {
+        x0 = bounds.x / (int32_t)size;
+        y0 = bounds.y / (int32_t)size;
+        x1 = (bounds.x + (int32_t)bounds.width - 1) / (int32_t)size;
+        y1 = (bounds.y + (int32_t)bounds.height - 1) / (int32_t)size;
+        if ((uint32_t)((x1 - x0 + 1) * (y1 - y0 + 1)) <= PRISM_MAX_TILES) {
+            break;
+        }
+        size *= 2;
+    }
+    
+    // Each cell's tile bounds what of the damage falls in it
+    uint32_t count = 0;
+    for (int32_t cy = y0; cy <= y1; cy++) {
+        for (int32_t cx = x0; cx <= x1; cx++) {
+            prism_rect_t cell = { cx * (int32_t)size, cy * (int32_t)size, size, size };
+            prism_rect_t tile = { 0 };
+            for (uint32_t r = 0; r < damage->count; r++) {
+                prism_rect_t part;
+                if (prism_rect_intersect(&damage->rects[r], &cell, &part)) {
+                    tile = tile.width ? prism_rect_union(&tile, &part) : part;
+                }
+            }
+            if (tile.width) {
+                tiles[count++] = tile;
+            }
+        }
+    }
+    return count;
+}
+
+// Draw tiles of job until there are none left to take
+static void prism_tile_job_run(prism_tile_job_t* job) {
+    uint32_t i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_ACQ_REL)) <
+           __atomic_load_n(&job->tile_count, __ATOMIC_ACQUIRE)) {
+        prism_draw_tile(job->output, job->surfaces, job->surface_count, &job->tiles[i]);
+        __atomic_fetch_add(&job->done, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Help with whichever job has tiles left; false if none has
+static bool prism_tile_help(void) {
+    prism_tile_job_t* job = NULL;
+    
+    spinlock_acquire(&g_tiles.lock);
+    for (uint32_t i = 0; i < PRISM_MAX_OUTPUTS && !job; i++) {
+        prism_tile_job_t* candidate = &g_tiles.jobs[i];
+        if (candidate->active && __atomic_load_n(&candidate->next, __ATOMIC_ACQUIRE) <
+                                 __atomic_load_n(&candidate->tile_count, __ATOMIC_ACQUIRE)) {
+            job = candidate;
+            job->users++;
+        }
+    }
+    spinlock_release(&g_tiles.lock);
+    
+    if (!job) {
+        return false;
+    }
+    
+    prism_tile_job_run(job);
+    
+    spinlock_acquire(&g_tiles.lock);
+    job->users--;
+    spinlock_release(&g_tiles.lock);
+    return true;
+}
+
+static void prism_tile_worker(void* arg) {
+    (void)arg;
+    quantum_context_t* self = temporal_get_current();
+    
+    spinlock_acquire(&g_tiles.lock);
+    if (g_tiles.worker_count < PRISM_MAX_WORKERS) {
+        g_tiles.workers[g_tiles.worker_count++] = self;
+    }
+    spinlock_release(&g_tiles.lock);
+    
+    while (g_running) {
+        uint32_t generation = __atomic_load_n(&g_tiles.generation, __ATOMIC_ACQUIRE);
+        if (prism_tile_help()) {
+            continue;
+        }
+        
+        // Sleep until a job is posted, unless one was while looking
+        if (__atomic_load_n(&g_tiles.generation, __ATOMIC_ACQUIRE) == generation) {
+            temporal_block(self, BLOCK_WAIT);
+        }
+    }
+}
+
+static void prism_tile_wake_workers(void) {
+    __atomic_fetch_add(&g_tiles.generation, 1, __ATOMIC_ACQ_REL);
+    for (uint32_t i = 0; i < __atomic_load_n(&g_tiles.worker_count, __ATOMIC_ACQUIRE); i++) {
+        temporal_unblock(g_tiles.workers[i]);
+    }
+}
+
+// Draw damage, all of it within the output, spread across the workers
+// where there's enough of it to be worth it
+static void prism_draw_damage(prism_output_t* output, prism_surface_t* const* surfaces,
+                              int surface_count, const prism_region_t* damage) {
+    uint64_t area = 0;
+    for (uint32_t r = 0; r < damage->count; r++) {
+        area += (uint64_t)damage->rects[r].width * damage->rects[r].height;
+    }
+    
+    prism_tile_job_t* job = NULL;
+    if (g_tiles.worker_count && area >= PRISM_TILE_MIN_AREA) {
+        spinlock_acquire(&g_tiles.lock);
+        for (uint32_t i = 0; i < PRISM_MAX_OUTPUTS && !job; i++) {
+            if (!g_tiles.jobs[i].active && g_tiles.jobs[i].users == 0) {
+                job = &g_tiles.jobs[i];
+                job->tile_count = 0;
+                job->active = true;
+            }
+        }
+        spinlock_release(&g_tiles.lock);
+    }
+    
+    if (!job) {
+        for (uint32_t r = 0; r < damage->count; r++) {
+            prism_draw_tile(output, surfaces, surface_count, &damage->rects[r]);
+        }
+        return;
+    }
+    
+    // Workers look at it as soon as it's active, but take nothing until
+    // there are tiles
+    job->output = output;
+    job->surfaces = surfaces;
+    job->surface_count = surface_count;
+    job->next = 0;
+    job->done = 0;
+    uint32_t tile_count = prism_tile_damage(damage, job->tiles);
+    __atomic_store_n(&job->tile_count, tile_count, __ATOMIC_RELEASE);
+    prism_tile_wake_workers();
+    
+    // Draw alongside them, then wait for the tiles they took
+    prism_tile_job_run(job);
+    while (__atomic_load_n(&job->done, __ATOMIC_ACQUIRE) < job->tile_count) {
+        __asm__ __volatile__("pause");
+    }
+    
+    // No new workers come in once it's inactive; those in it leave
+    // having found no tiles
+    spinlock_acquire(&g_tiles.lock);
+    job->active = false;
+    spinlock_release(&g_tiles.lock);
+}
+
+// Workers for all but one CPU, the one the output's thread runs on
+static void prism_tile_start_workers(void) {
+    uint32_t cpus = continuum_get_cpu_count();
+    uint32_t workers = cpus > 1 ? cpus - 1 : 0;
+    if (workers > PRISM_MAX_WORKERS) {
+        workers = PRISM_MAX_WORKERS;
+    }
+    
+    for (uint32_t i = 0; i < workers; i++) {
+        if (!temporal_create_thread(prism_tile_worker, NULL, PRIORITY_HIGH)) {
+            break;
+        }
+    }
+}
+
 // =============================================================================
 // Rendering Pipeline
 // =============================================================================
 
+static void prism_render_surface_clipped(prism_surface_t* surface, prism_output_t* output,
+                                         const prism_rect_t* clip);
+static void prism_blit_surface(prism_output_t* output, prism_surface_t* surface,
+                              prism_rect_t* dst_rect, const prism_rect_t* clip);
+
+static bool prism_matrix_is_identity(const prism_matrix_t* matrix) {
+    static const prism_matrix_t identity = { { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f } };
+    return memcmp(matrix, &identity, sizeof(identity)) == 0;
+}
+
+// Whether surface is opaque over all of rect, an output-local rect, so
+// that nothing below it there need be drawn
+static bool prism_surface_covers(prism_surface_t* surface, prism_output_t* output,
+                                 const prism_rect_t* rect) {
+    if (!surface->buffer || surface->opacity < 1.0f ||
+        !prism_matrix_is_identity(&surface->transform)) {
+        return false;
+    }
+    
+    prism_rect_t extent = { 0, 0, surface->geometry.width, surface->geometry.height };
+    prism_rect_t opaque;
+    if (!prism_rect_intersect(&surface->opaque_region, &extent, &opaque)) {
+        return false;
+    }
+    
+    opaque.x += surface->geometry.x - output->x;
+    opaque.y += surface->geometry.y - output->y;
+    return prism_rect_covers(&opaque, rect);
+}
+
+// Windows that show what's behind them blur it, where blur is on
+static bool prism_surface_blurs(prism_surface_t* surface) {
+    if (!g_compositor.enable_blur || surface->type != SURFACE_TYPE_WINDOW || !surface->buffer) {
+        return false;
+    }
+    
+    prism_rect_t extent = { 0, 0, surface->geometry.width, surface->geometry.height };
+    return surface->opacity < 1.0f || !prism_rect_covers(&surface->opaque_region, &extent);
+}
+
+// The output-local part of output the window's blurred background covers
+static bool prism_surface_blur_area(prism_surface_t* surface, prism_output_t* output,
+                                    prism_rect_t* area) {
+    prism_rect_t geometry = surface->geometry;
+    geometry.x -= output->x;
+    geometry.y -= output->y;
+    prism_rect_t all = { 0, 0, output->width, output->height };
+    return prism_rect_intersect(&geometry, &all, area);
+}
+
+// Retake the blurred backgrounds that are stale, bottom up so each can
+// draw those below it. A background is taken from what's below its window
+// alone, drawn into the framebuffer there, so all of it is redrawn after.
+static void prism_update_blur(prism_output_t* output, prism_surface_t** surfaces,
+                              const bool* stale, int surface_count, prism_region_t* damage) {
+    for (int i = surface_count - 1; i >= 0; i--) {
+        prism_surface_t* surface = surfaces[i];
+        prism_rect_t area;
+        if (!prism_surface_blurs(surface) || !prism_surface_blur_area(surface, output, &area)) {
+            continue;
+        }
+        if (!stale[i] && prism_blur_matches(surface->blur_cache, output, &area)) {
+            continue;
+        }
+        
+        prism_clear_rect(output, &area);
+        for (int j = surface_count - 1; j > i; j--) {
+            prism_render_surface_clipped(surfaces[j], output, &area);
+        }
+        surface->blur_cache = prism_blur_update(surface->blur_cache, output, &area);
+        prism_region_add(damage, &area);
+    }
+}
+
+// Draw rect, an output-local rect within the output, from the topmost
+// surface opaque over all of it, or from a cleared background where
+// there's none
+static void prism_draw_tile(prism_output_t* output, prism_surface_t* const* surfaces,
+                            int surface_count, const prism_rect_t* rect) {
+    int first = surface_count - 1;
+    bool covered = false;
+    for (int i = 0; i < surface_count && !covered; i++) {
+        if (prism_surface_covers(surfaces[i], output, rect)) {
+            first = i;
+            covered = true;
+        }
+    }
+    
+    if (!covered) {
+        prism_clear_rect(output, rect);
+    }
+    for (int i = first; i >= 0; i--) {
+        prism_render_surface_clipped(surfaces[i], output, rect);
+    }
+}
+
+// Redraw only the output's damage, tile by tile across the CPUs, and
+// present only the damage
 void prism_repaint(prism_output_t* output) {
     if (!output || !output->needs_repaint) {
         return;
     }
     
-    // Clear framebuffer
-    prism_clear_output(output);
+    uint64_t start = trace_begin(TRACE_PRISM_REPAINT);
+    uint64_t started = temporal_get_time();
     
     // Render surfaces from bottom to top
     prism_surface_t* surfaces[PRISM_MAX_SURFACES];
+    bool blur_stale[PRISM_MAX_SURFACES];
     int surface_count = 0;
     
     spinlock_acquire(&g_compositor_lock);
     
-    // Build surface list in reverse order
-    prism_surface_t* surface = g_compositor.surface_stack_top;
-    while (surface && surface_count < PRISM_MAX_SURFACES) {
-        if (surface->state & SURFACE_STATE_MAPPED) {
-            surfaces[surface_count++] = surface;
+    // Build surface list in reverse order, cursors over everything else
+    for (int pass = 0; pass < 2; pass++) {
+        prism_surface_t* surface = g_compositor.surface_stack_top;
+        while (surface && surface_count < PRISM_MAX_SURFACES) {
+            if ((surface->state & SURFACE_STATE_MAPPED) &&
+                (surface->type == SURFACE_TYPE_CURSOR) == (pass == 0)) {
+                blur_stale[surface_count] = !surface->blur_valid;
+                surface->blur_valid = true;
+                surfaces[surface_count++] = surface;
+            }
+            surface = surface->next_sibling;
         }
-        surface = surface->next_sibling;
     }
     
+    // Damage from here on is the next frame's
+    prism_region_t damage = output->damage;
+    output->damage.count = 0;
+    output->needs_repaint = false;
+    
     spinlock_release(&g_compositor_lock);
     
-    // Render surfaces
-    for (int i = surface_count - 1; i >= 0; i--) {
-        prism_render_surface(surfaces[i], output);
+    prism_rect_t all = { 0, 0, output->width, output->height };
+    if (damage.count == 0) {
+        damage.rects[0] = all;
+        damage.count = 1;
     }
     
-    // Apply post-processing effects
-    if (g_compositor.enable_blur) {
-        prism_apply_blur_pass(output);
+    // Outputs share the surfaces' blurred backgrounds, so with blur on
+    // they compose one at a time, each still across all the workers
+    bool blur = g_compositor.enable_blur;
+    if (blur) {
+        spinlock_acquire(&g_blur_lock);
+        prism_update_blur(output, surfaces, blur_stale, surface_count, &damage);
     }
     
-    // Present to display
-    prism_present(output);
+    uint32_t kept = 0;
+    for (uint32_t r = 0; r < damage.count; r++) {
+        prism_rect_t rect;
+        if (prism_rect_intersect(&damage.rects[r], &all, &rect)) {
+            damage.rects[kept++] = rect;
+        }
+    }
+    damage.count = kept;
+    
+    prism_draw_damage(output, surfaces, surface_count, &damage);
+    
+    if (blur) {
+        spinlock_release(&g_blur_lock);
+    }
+    
+    // Present to display, at the vblank this frame was for
+    prism_frame_present(output, &damage, started);
     
-    output->needs_repaint = false;
     output->last_frame_time = temporal_get_time();
+    
+    TRACE(TRACE_PRISM_REPAINT, output->id, surface_count, trace_elapsed(start));
 }
 
-void prism_render_surface(prism_surface_t* surface, prism_output_t* output) {
-    if (!surface || !surface->buffer || !output) {
+// Draw what of surface falls within clip, an output-local rect within
+// the output
+static void prism_render_surface_clipped(prism_surface_t* surface, prism_output_t* output,
+                                         const prism_rect_t* clip) {
+    if (!surface->buffer) {
         return;
     }
     
@@ -269,80 +838,127 @@ void prism_render_surface(prism_surface_t* surface, prism_output_t* output) {
         .height = surface->geometry.height
     };
     
-    // Clip to output bounds
-    if (dst_rect.x >= (int32_t)output->width || 
-        dst_rect.y >= (int32_t)output->height ||
-        dst_rect.x + (int32_t)dst_rect.width <= 0 ||
-        dst_rect.y + (int32_t)dst_rect.height <= 0) {
+    // Clip to the damage, shadow included
+    prism_rect_t bounds = prism_surface_bounds(surface);
+    bounds.x -= output->x;
+    bounds.y -= output->y;
+    prism_rect_t visible;
+    if (!prism_rect_intersect(&bounds, clip, &visible)) {
         return;
     }
     
     // Apply shadow if enabled
     if (g_compositor.enable_shadows && surface->type == SURFACE_TYPE_WINDOW) {
-        prism_render_shadow(output, &dst_rect);
+        prism_render_shadow(output, &dst_rect, clip);
+    }
+    
+    // Blurred background, where it was taken for the window as it is
+    prism_rect_t blur_area;
+    if (prism_surface_blurs(surface) && prism_surface_blur_area(surface, output, &blur_area) &&
+        prism_blur_matches(surface->blur_cache, output, &blur_area)) {
+        prism_blur_draw(surface->blur_cache, output, clip);
     }
     
     // Render surface content
-    prism_blit_surface(output, surface, &dst_rect);
+    prism_blit_surface(output, surface, &dst_rect, clip);
     
     // Render subsurfaces
     prism_surface_t* child = surface->children;
     while (child) {
-        prism_render_surface(child, output);
+        prism_render_surface_clipped(child, output, clip);
         child = child->next_sibling;
     }
 }
 
+void prism_render_surface(prism_surface_t* surface, prism_output_t* output) {
+    if (!surface || !output) {
+        return;
+    }
+    
+    prism_rect_t all = { 0, 0, output->width, output->height };
+    prism_render_surface_clipped(surface, output, &all);
+}
+
+// Draw a surface's buffer into dst_rect, within clip, with the output's
+// backend. The operation depends on the transform: an integer translation
+// (identity included) copies or blends whole rows, an axis-aligned scale
+// steps through the buffer in fixed point, and only rotation or shear
+// maps each pixel with floats, always on the CPU.
 static void prism_blit_surface(prism_output_t* output, prism_surface_t* surface,
-                              prism_rect_t* dst_rect) {
+                              prism_rect_t* dst_rect, const prism_rect_t* clip) {
     prism_buffer_t* buffer = surface->buffer;
-    uint32_t* src = (uint32_t*)buffer->data;
-    uint32_t* dst = output->framebuffer;
+    if (!buffer->data || buffer->width == 0 || buffer->height == 0) {
+        return;
+    }
     
     // Calculate actual blit region
-    int32_t src_x = 0, src_y = 0;
-    int32_t dst_x = dst_rect->x;
-    int32_t dst_y = dst_rect->y;
-    uint32_t width = dst_rect->width;
-    uint32_t height = dst_rect->height;
-    
-    // Clip source rectangle
-    if (dst_x < 0) {
-        src_x = -dst_x;
-        width += dst_x;
-        dst_x = 0;
+    prism_rect_t area;
+    if (!prism_rect_intersect(dst_rect, clip, &area)) {
+        return;
     }
-    if (dst_y < 0) {
-        src_y = -dst_y;
-        height += dst_y;
-        dst_y = 0;
+    
+    uint32_t opacity = PRISM_OPACITY_ONE;
+    if (surface->opacity < 1.0f) {
+        opacity = surface->opacity > 0.0f ?
+                  (uint32_t)(surface->opacity * PRISM_OPACITY_ONE + 0.5f) : 0;
+        if (opacity == 0) {
+            return;
+        }
     }
-    if (dst_x + width > output->width) {
-        width = output->width - dst_x;
+    
+    // Where the client says there's no alpha, at full opacity, rows are
+    // copied rather than blended
+    prism_rect_t local = {
+        .x = area.x - dst_rect->x,
+        .y = area.y - dst_rect->y,
+        .width = area.width,
+        .height = area.height
+    };
+    bool opaque = opacity == PRISM_OPACITY_ONE &&
+                  prism_rect_covers(&surface->opaque_region, &local);
+    
+    const float* m = surface->transform.m;
+    bool axis_aligned = m[1] == 0.0f && m[3] == 0.0f &&
+                        m[6] == 0.0f && m[7] == 0.0f && m[8] == 1.0f;
+    
+    if (axis_aligned && m[0] == 1.0f && m[4] == 1.0f &&
+        m[2] == (float)(int32_t)m[2] && m[5] == (float)(int32_t)m[5]) {
+        int64_t sx = local.x + (int32_t)m[2];
+        int64_t sy = local.y + (int32_t)m[5];
+        if (opaque) {
+            PRISM_BACKEND_OP(output, copy)(output, &area, buffer, sx, sy);
+        } else {
+            PRISM_BACKEND_OP(output, blend)(output, &area, buffer, sx, sy, opacity);
+        }
+        return;
     }
-    if (dst_y + height > output->height) {
-        height = output->height - dst_y;
+    
+    if (axis_aligned) {
+        prism_blit_map_t map = {
+            .fx = (int64_t)(((double)m[0] * local.x + m[2]) * 65536.0),
+            .fy = (int64_t)(((double)m[4] * local.y + m[5]) * 65536.0),
+            .step_x = (int64_t)((double)m[0] * 65536.0),
+            .step_y = (int64_t)((double)m[4] * 65536.0)
+        };
+        PRISM_BACKEND_OP(output, blit_scaled)(output, &area, buffer, &map, opaque, opacity);
+        return;
     }
     
-    // Apply transform matrix
-    for (uint32_t y = 0; y < height; y++) {
-        for (uint32_t x = 0; x < width; x++) {
+    // Rotation or shear: map each pixel back into the buffer, on the CPU
+    if (!output->framebuffer) {
+        return;
+    }
+    uint32_t* dst = output->framebuffer + (size_t)area.y * output->fb_stride + area.x;
+    for (uint32_t y = 0; y < area.height; y++, dst += output->fb_stride) {
+        for (uint32_t x = 0; x < area.width; x++) {
             // Transform coordinates
             float tx, ty;
             prism_matrix_transform_point(&surface->transform,
-                                        src_x + x, src_y + y, &tx, &ty);
+                                        local.x + x, local.y + y, &tx, &ty);
             
             // Sample source pixel (with bilinear filtering if needed)
             uint32_t pixel = prism_sample_pixel(buffer, tx, ty);
-            
-            // Apply opacity
-            if (surface->opacity < 1.0f) {
-                pixel = prism_blend_alpha(pixel, surface->opacity);
-            }
-            
-            // Blend with destination
-            uint32_t dst_offset = (dst_y + y) * output->fb_stride + (dst_x + x);
-            dst[dst_offset] = prism_alpha_blend(dst[dst_offset], pixel);
+            dst[x] = prism_blit_pixel(dst[x], pixel, opacity);
         }
     }
 }
@@ -351,6 +967,52 @@ static void prism_blit_surface(prism_output_t* output, prism_surface_t* surface,
 // Input Handling
 // =============================================================================
 
+// The cursor follows the pointer by moving its surface: only where it
+// was and where it is now are redrawn, in each output's next frame
+static void prism_cursor_move(prism_seat_t* seat) {
+    spinlock_acquire(&g_compositor_lock);
+    
+    prism_surface_t* cursor = seat->cursor;
+    int32_t x = seat->pointer_pos.x - seat->cursor_hotspot.x;
+    int32_t y = seat->pointer_pos.y - seat->cursor_hotspot.y;
+    if (cursor && (cursor->geometry.x != x || cursor->geometry.y != y)) {
+        prism_damage_surface(cursor);
+        cursor->geometry.x = x;
+        cursor->geometry.y = y;
+        prism_damage_surface(cursor);
+    }
+    
+    spinlock_release(&g_compositor_lock);
+}
+
+// Show surface as the pointer, or nothing for NULL
+void prism_set_cursor(prism_seat_t* seat, prism_surface_t* surface, int32_t hotspot_x,
+                      int32_t hotspot_y) {
+    if (!seat) {
+        return;
+    }
+    
+    spinlock_acquire(&g_compositor_lock);
+    
+    if (seat->cursor && seat->cursor != surface) {
+        prism_damage_surface(seat->cursor);
+        seat->cursor->state &= ~SURFACE_STATE_MAPPED;
+    }
+    if (surface) {
+        surface->type = SURFACE_TYPE_CURSOR;
+        surface->accepts_input = false;
+        surface->state |= SURFACE_STATE_MAPPED;
+        prism_damage_surface(surface);
+    }
+    seat->cursor = surface;
+    seat->cursor_hotspot.x = hotspot_x;
+    seat->cursor_hotspot.y = hotspot_y;
+    
+    spinlock_release(&g_compositor_lock);
+    
+    prism_cursor_move(seat);
+}
+
 void prism_handle_motion(prism_seat_t* seat, int32_t x, int32_t y) {
     if (!seat) {
         return;
@@ -358,6 +1020,7 @@ void prism_handle_motion(prism_seat_t* seat, int32_t x, int32_t y) {
     
     seat->pointer_pos.x = x;
     seat->pointer_pos.y = y;
+    prism_cursor_move(seat);
     
     // Find surface under pointer
     prism_point_t point = {x, y};
@@ -415,12 +1078,19 @@ void prism_handle_key(prism_seat_t* seat, uint32_t key, bool pressed) {
     
     // Update pressed keys
     if (pressed) {
-        // Add to pressed keys
+        // Add to pressed keys, once however often it repeats
+        uint32_t free = seat->key_count;
         for (uint32_t i = 0; i < seat->key_count; i++) {
-            if (seat->pressed_keys[i] == 0) {
-                seat->pressed_keys[i] = key;
+            if (seat->pressed_keys[i] == key) {
+                free = seat->key_count;
                 break;
             }
+            if (seat->pressed_keys[i] == 0 && free == seat->key_count) {
+                free = i;
+            }
+        }
+        if (free < seat->key_count) {
+            seat->pressed_keys[free] = key;
         }
     } else {
         // Remove from pressed keys
@@ -457,6 +1127,107 @@ prism_surface_t* prism_surface_at(prism_point_t* point) {
     return found;
 }
 
+// =============================================================================
+// Input Pipeline
+// =============================================================================
+
+#define PRISM_INPUT_BATCH       64      // Events taken from the queue at once
+#define PRISM_INPUT_WAIT        10000   // usec between looks at the queue, at most
+
+// Relative motion from the queue, gathered across reports and applied as
+// one move: before anything else the queue has, or once it's drained
+typedef struct {
+    int32_t dx;
+    int32_t dy;
+    bool pending;
+} prism_motion_t;
+
+static void prism_input_flush_motion(prism_seat_t* seat, prism_motion_t* motion) {
+    if (!motion->pending) {
+        return;
+    }
+    motion->pending = false;
+    
+    // Kept within the outputs
+    int32_t x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+    for (prism_output_t* output = g_compositor.outputs; output; output = output->next) {
+        x0 = output->x < x0 ? output->x : x0;
+        y0 = output->y < y0 ? output->y : y0;
+        x1 = output->x + (int32_t)output->width > x1 ? output->x + (int32_t)output->width : x1;
+        y1 = output->y + (int32_t)output->height > y1 ? output->y + (int32_t)output->height : y1;
+    }
+    
+    int32_t x = seat->pointer_pos.x + motion->dx;
+    int32_t y = seat->pointer_pos.y + motion->dy;
+    motion->dx = 0;
+    motion->dy = 0;
+    if (x1 > x0) {
+        x = x < x0 ? x0 : x >= x1 ? x1 - 1 : x;
+        y = y < y0 ? y0 : y >= y1 ? y1 - 1 : y;
+    }
+    prism_handle_motion(seat, x, y);
+}
+
+static void prism_input_event(prism_seat_t* seat, prism_motion_t* motion,
+                              const input_event_t* event) {
+    switch (event->type) {
+        case INPUT_EV_REL:
+            if (event->code == INPUT_REL_X) {
+                motion->dx += event->value;
+                motion->pending = true;
+            } else if (event->code == INPUT_REL_Y) {
+                motion->dy += event->value;
+                motion->pending = true;
+            } else if (event->code == INPUT_REL_WHEEL || event->code == INPUT_REL_HWHEEL) {
+                prism_input_flush_motion(seat, motion);
+                bool vertical = event->code == INPUT_REL_WHEEL;
+                prism_handle_scroll(seat, vertical ? 0 : event->value,
+                                    vertical ? -event->value : 0);
+            }
+            break;
+        
+        case INPUT_EV_KEY:
+            prism_input_flush_motion(seat, motion);
+            if (event->code >= INPUT_BTN_LEFT && event->code <= INPUT_BTN_EXTRA) {
+                // Buttons from 1, left first
+                prism_handle_button(seat, event->code - INPUT_BTN_LEFT + 1, event->value != 0);
+            } else {
+                prism_handle_key(seat, event->code, event->value != 0);
+            }
+            break;
+        
+        default:
+            // Reports are applied as they come; SYN only ends one
+            break;
+    }
+}
+
+// Input goes from the drivers' interrupts straight to here, not waiting
+// on the compositor loop; what it changes on screen makes each output's
+// next frame
+static void prism_input_thread(void* arg) {
+    (void)arg;
+    input_event_t events[PRISM_INPUT_BATCH];
+    prism_motion_t motion = {0};
+    
+    while (g_running) {
+        if (!input_event_wait(PRISM_INPUT_WAIT)) {
+            continue;
+        }
+        
+        prism_seat_t* seat = g_compositor.seats;
+        uint32_t count;
+        while ((count = input_event_read(events, PRISM_INPUT_BATCH)) > 0) {
+            for (uint32_t i = 0; seat && i < count; i++) {
+                prism_input_event(seat, &motion, &events[i]);
+            }
+        }
+        if (seat) {
+            prism_input_flush_motion(seat, &motion);
+        }
+    }
+}
+
 // =============================================================================
 // Animation System
 // =============================================================================
@@ -492,12 +1263,17 @@ void prism_animate_surface(prism_surface_t* surface, prism_rect_t* from,
     anim->animating_opacity = false;
 }
 
+// Each step damages where the surface was and where it's got to
 static void prism_update_animations(void) {
     uint64_t now = temporal_get_time();
     
+    spinlock_acquire(&g_compositor_lock);
+    
     for (uint32_t i = 0; i < g_animation_count; i++) {
         prism_animation_t* anim = &g_animations[i];
         uint64_t elapsed = now - anim->start_time;
+        prism_surface_t* surface = anim->surface;
+        prism_damage_surface(surface);
         
         if (elapsed >= anim->duration) {
             // Animation complete
@@ -535,39 +1311,217 @@ static void prism_update_animations(void) {
                                                    anim->to_opacity, t);
             }
         }
+        
+        prism_damage_surface(surface);
     }
+    
+    spinlock_release(&g_compositor_lock);
 }
 
 // =============================================================================
 // Main Compositor Loop
 // =============================================================================
 
+#define PRISM_DISPATCH_LEAD     1000    // usec client messages are taken ahead of a frame
+
+// Animations and client messages, just ahead of whichever output starts
+// its next frame soonest
 static void prism_compositor_thread(void* arg) {
     while (g_running) {
-        // Update animations
-        if (g_compositor.enable_animations) {
-            prism_update_animations();
-        }
-        
-        // Repaint outputs that need it
+        uint64_t now = temporal_get_time();
+        uint64_t wake = now + 1000000 / PRISM_DEFAULT_REFRESH;
         prism_output_t* output = g_compositor.outputs;
         while (output) {
-            if (output->needs_repaint || g_animation_count > 0) {
-                prism_repaint(output);
+            uint64_t frame_start = prism_frame_start(output);
+            if (output->refresh_interval && frame_start > now && frame_start < wake) {
+                wake = frame_start;
             }
             output = output->next;
         }
         
-        // Process client messages
+        // Those composing now have what they'll get; poll until they're done
+        wake = wake > now + PRISM_DISPATCH_LEAD ? wake - PRISM_DISPATCH_LEAD :
+                                                  now + PRISM_DISPATCH_LEAD;
+        temporal_sleep(wake - now);
+        
+        // Update animations
+        if (g_compositor.enable_animations) {
+            prism_update_animations();
+        }
+        
+        // Process client messages, so what they committed makes the frame
         prism_client_t* client = g_compositor.clients;
         while (client) {
             prism_dispatch_client(client);
             client = client->next;
         }
+    }
+}
+        
+// Each output composes on its own thread, at its own refresh; outputs
+// with nothing to redraw skip the frame
+static void prism_output_thread(void* arg) {
+    prism_output_t* output = arg;
+    prism_frame_next(output, temporal_get_time());
+    
+    while (g_running) {
+        uint64_t now = temporal_get_time();
+        uint64_t frame_start = prism_frame_start(output);
+        if (frame_start > now) {
+            temporal_sleep(frame_start - now);
+        }
         
-        // Sleep until next frame (60 FPS)
-        temporal_sleep(16666);  // ~16.67ms
+        if (output->needs_repaint) {
+            prism_repaint(output);
+        } else {
+            prism_frame_next(output, output->next_vblank);
+        }
+    }
+}
+
+// =============================================================================
+// Benchmark
+// =============================================================================
+
+#define PRISM_BENCH_WIDTH       1920
+#define PRISM_BENCH_HEIGHT      1080
+#define PRISM_BENCH_WINDOW_W    800
+#define PRISM_BENCH_WINDOW_H    600
+
+// Fill a benchmark buffer: a gradient, with alpha falling off towards the
+// bottom if it's to be translucent
+static void prism_bench_fill(prism_buffer_t* buffer, bool translucent) {
+    uint32_t* pixels = buffer->data;
+    for (uint32_t y = 0; y < buffer->height; y++) {
+        uint32_t alpha = translucent ? 255 - y * 192 / buffer->height : 255;
+        for (uint32_t x = 0; x < buffer->width; x++) {
+            uint32_t r = x * 255 / buffer->width;
+            uint32_t g = y * 255 / buffer->height;
+            pixels[y * buffer->width + x] = (alpha << 24) | (r << 16) | (g << 8) | 0x80;
+        }
+    }
+}
+
+// Composite frames of windows overlapping windows on an off-screen output,
+// each frame drawn whole, once for each blit implementation the CPU has.
+// The windows cycle through opaque, translucent, faded and scaled, so each
+// kernel gets its share. Returns how many results were filled in.
+size_t prism_benchmark(prism_bench_t* results, size_t max_results, uint32_t windows,
+                       uint32_t frames) {
+    if (!results || max_results == 0 || windows == 0 || frames == 0) {
+        return 0;
+    }
+    
+    size_t buffer_size = PRISM_BENCH_WINDOW_W * PRISM_BENCH_WINDOW_H * 4;
+    prism_output_t output = {
+        .width = PRISM_BENCH_WIDTH,
+        .height = PRISM_BENCH_HEIGHT,
+        .fb_width = PRISM_BENCH_WIDTH,
+        .fb_height = PRISM_BENCH_HEIGHT,
+        .fb_stride = PRISM_BENCH_WIDTH
+    };
+    output.framebuffer = flux_allocate(NULL, PRISM_BENCH_WIDTH * PRISM_BENCH_HEIGHT * 4,
+                                       FLUX_ALLOC_KERNEL | FLUX_ALLOC_LARGE);
+    prism_surface_t* surfaces = flux_allocate(NULL, windows * sizeof(prism_surface_t),
+                                              FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+    prism_buffer_t opaque = {
+        .width = PRISM_BENCH_WINDOW_W,
+        .height = PRISM_BENCH_WINDOW_H,
+        .stride = PRISM_BENCH_WINDOW_W * 4,
+        .format = PIXEL_FORMAT_ARGB8888
+    };
+    prism_buffer_t translucent = opaque;
+    opaque.data = flux_allocate(NULL, buffer_size, FLUX_ALLOC_KERNEL | FLUX_ALLOC_LARGE);
+    translucent.data = flux_allocate(NULL, buffer_size, FLUX_ALLOC_KERNEL | FLUX_ALLOC_LARGE);
+    if (!output.framebuffer || !surfaces || !opaque.data || !translucent.data) {
+        flux_free(output.framebuffer);
+        flux_free(surfaces);
+        flux_free(opaque.data);
+        flux_free(translucent.data);
+        return 0;
+    }
+    
+    prism_bench_fill(&opaque, false);
+    prism_bench_fill(&translucent, true);
+    prism_buffer_premultiply(&opaque);
+    prism_buffer_premultiply(&translucent);
+    
+    // Cascaded across the output, each overlapping the last
+    for (uint32_t i = 0; i < windows; i++) {
+        prism_surface_t* surface = &surfaces[i];
+        surface->type = SURFACE_TYPE_WINDOW;
+        surface->buffer = &opaque;
+        surface->opacity = 1.0f;
+        surface->opaque_region = (prism_rect_t){ 0, 0, PRISM_BENCH_WINDOW_W,
+                                                 PRISM_BENCH_WINDOW_H };
+        surface->geometry = (prism_rect_t){
+            .x = (i * 97) % (PRISM_BENCH_WIDTH - PRISM_BENCH_WINDOW_W),
+            .y = (i * 61) % (PRISM_BENCH_HEIGHT - PRISM_BENCH_WINDOW_H),
+            .width = PRISM_BENCH_WINDOW_W,
+            .height = PRISM_BENCH_WINDOW_H
+        };
+        prism_matrix_identity(&surface->transform);
+        
+        switch (i % 4) {
+            case 1:
+                surface->buffer = &translucent;
+                surface->opaque_region = (prism_rect_t){ 0 };
+                break;
+            case 2:
+                surface->opacity = 0.75f;
+                break;
+            case 3:
+                // Shown at 4/5 size
+                surface->geometry.width = PRISM_BENCH_WINDOW_W * 4 / 5;
+                surface->geometry.height = PRISM_BENCH_WINDOW_H * 4 / 5;
+                prism_matrix_scale(&surface->transform, 1.25f, 1.25f);
+                break;
+        }
+    }
+    
+    prism_blit_impl_t saved = prism_blit_get_impl();
+    uint64_t tsc_khz = continuum_get_tsc_khz();
+    prism_rect_t all = { 0, 0, output.width, output.height };
+    size_t count = 0;
+    
+    for (uint32_t impl = PRISM_BLIT_SCALAR; impl <= PRISM_BLIT_AVX2 && count < max_results;
+         impl++) {
+        if (prism_blit_set_impl(impl) != 0) {
+            continue;
+        }
+        
+        uint64_t total = 0;
+        uint64_t worst = 0;
+        for (uint32_t f = 0; f < frames; f++) {
+            uint64_t start = continuum_get_time();
+            prism_clear_rect(&output, &all);
+            for (uint32_t i = 0; i < windows; i++) {
+                prism_render_surface_clipped(&surfaces[i], &output, &all);
+            }
+            uint64_t cycles = continuum_get_time() - start;
+            
+            total += cycles;
+            if (cycles > worst) {
+                worst = cycles;
+            }
+        }
+        
+        prism_bench_t* r = &results[count++];
+        r->windows = windows;
+        r->frames = frames;
+        r->frame_cycles = total / frames;
+        r->frame_cycles_max = worst;
+        r->frame_usec = tsc_khz ? r->frame_cycles * 1000 / tsc_khz : 0;
+        r->impl = impl;
     }
+    
+    prism_blit_set_impl(saved);
+    
+    flux_free(output.framebuffer);
+    flux_free(surfaces);
+    flux_free(opaque.data);
+    flux_free(translucent.data);
+    return count;
 }
 
 // =============================================================================
@@ -583,6 +1537,9 @@ int prism_init(void) {
     g_compositor.enable_blur = false;  // Performance intensive
     g_compositor.animation_duration = 200;  // 200ms default
     
+    // Pick the blit kernels for this CPU
+    prism_blit_init(continuum_get_cpu_features());
+    
     // Initialize renderer
     g_compositor.renderer = prism_renderer_create();
     if (!g_compositor.renderer) {
@@ -596,6 +1553,11 @@ int prism_init(void) {
         return -1;
     }
     
+    // Draw and present with what the hardware offers, and flip pages
+    // rather than copy to the display where it can
+    prism_backend_select(primary);
+    prism_output_enable_flip(primary);
+    
     // Create default seat (primary input)
     prism_seat_t* seat = prism_create_seat("seat0");
     if (!seat) {
@@ -613,11 +1575,24 @@ int prism_init(void) {
         return -1;
     }
     
+    for (prism_output_t* output = g_compositor.outputs; output; output = output->next) {
+        if (!temporal_create_thread(prism_output_thread, output, THREAD_PRIORITY_HIGH)) {
+            g_running = false;
+            return -1;
+        }
+    }
+    if (!temporal_create_thread(prism_input_thread, NULL, THREAD_PRIORITY_HIGH)) {
+        g_running = false;
+        return -1;
+    }
+    prism_tile_start_workers();
+    
     return 0;
 }
 
 void prism_shutdown(void) {
     g_running = false;
+    prism_tile_wake_workers();
     
     // Wait for compositor thread to finish
     temporal_sleep(100000);
@@ -634,6 +1609,7 @@ void prism_shutdown(void) {
     
     // Clean up outputs
     while (g_compositor.outputs) {
+        prism_backend_release(g_compositor.outputs);
         prism_destroy_output(g_compositor.outputs);
     }
     
@@ -18,6 +18,18 @@
 #define PRISM_MAX_SURFACES      1024
 #define PRISM_MAX_OUTPUTS       8
 #define PRISM_MAX_SEATS         4
+#define PRISM_MAX_DAMAGE        16      // Rects a region keeps before merging them
+#define PRISM_MAX_FLIP_PAGES    3       // Pages an output flips between, at most
+
+// Window shadows, drawn around and below a window's geometry
+#define PRISM_SHADOW_RADIUS     20
+#define PRISM_SHADOW_OFFSET_Y   5
+
+// Buffer pixel formats, 32 bits a pixel. Buffers are premultiplied
+// when attached, and composited only in that form.
+#define PIXEL_FORMAT_ARGB8888   0       // Straight alpha
+#define PIXEL_FORMAT_XRGB8888   1       // No alpha; the top byte is ignored
+#define PIXEL_FORMAT_ARGB8888_PREMULTIPLIED 2
 
 // Surface types
 #define SURFACE_TYPE_WINDOW     0x01
@@ -54,6 +66,7 @@ typedef struct prism_client prism_client_t;
 typedef struct prism_surface prism_surface_t;
 typedef struct prism_output prism_output_t;
 typedef struct prism_seat prism_seat_t;
+typedef struct prism_blur prism_blur_t;
 
 // Rectangle
 typedef struct {
@@ -63,6 +76,13 @@ typedef struct {
     uint32_t height;
 } prism_rect_t;
 
+// Region: a set of rects, possibly overlapping. Past PRISM_MAX_DAMAGE
+// they're merged, so a region may grow a little to stay small.
+typedef struct {
+    prism_rect_t rects[PRISM_MAX_DAMAGE];
+    uint32_t count;
+} prism_region_t;
+
 // Point
 typedef struct {
     int32_t x;
@@ -89,7 +109,7 @@ typedef struct {
     uint32_t width;
     uint32_t height;
     uint32_t stride;
-    uint32_t format;
+    uint32_t format;            // PIXEL_FORMAT_*
     bool y_inverted;
     
     // Damage tracking
@@ -128,6 +148,19 @@ struct prism_surface {
     bool accepts_input;
     prism_rect_t input_region;
     
+    // Damage since the last commit, surface-local; the commit passes it on
+    // to the outputs the surface is on
+    prism_region_t pending_damage;
+    
+    // Surface-local part that has no alpha, as the client says; it hides
+    // whatever is below it from repaints
+    prism_rect_t opaque_region;
+    
+    // What's behind a translucent window, blurred, while blur is on. It's
+    // kept until something below changes there, or the window moves.
+    prism_blur_t* blur_cache;
+    bool blur_valid;
+    
     // Frame callbacks
     void (*frame_callback)(prism_surface_t* surface, uint32_t time);
     
@@ -135,6 +168,16 @@ struct prism_surface {
     void* user_data;
 };
 
+// Frame statistics, times in microseconds. A frame's time runs from the
+// start of its composition to its being presented, less any wait for vblank.
+typedef struct {
+    uint64_t frames;
+    uint64_t missed;            // Composed too late for the vblank they were for
+    uint64_t frame_time;
+    uint64_t frame_time_avg;
+    uint64_t frame_time_max;
+} prism_frame_stats_t;
+
 // Output (display)
 struct prism_output {
     uint32_t id;
@@ -157,7 +200,8 @@ struct prism_output {
     uint32_t transform;  // 0, 90, 180, 270 degrees
     float scale;
     
-    // Backend specific data
+    // What it draws and presents with (backend.h), and that backend's data
+    const struct prism_backend* backend;
     void* backend_data;
     
     // Framebuffer
@@ -166,10 +210,26 @@ struct prism_output {
     uint32_t fb_height;
     uint32_t fb_stride;
     
-    // Rendering
+    // Rendering. damage is output-local, what the next repaint redraws;
+    // needs_repaint with no damage redraws the lot.
     bool needs_repaint;
+    prism_region_t damage;
     uint64_t last_frame_time;
     
+    // Frame scheduling, in microseconds: composition starts
+    // composite_estimate ahead of next_vblank, to finish just before it
+    uint64_t refresh_interval;
+    uint64_t next_vblank;
+    uint64_t composite_estimate;
+    
+    // Page flipping: flip_pages the display cycles through (0 to copy to
+    // it instead), and the damage of the frames presented since the page
+    // drawn into was last shown, newest first
+    uint32_t flip_pages;
+    prism_region_t present_history[PRISM_MAX_FLIP_PAGES - 1];
+    
+    prism_frame_stats_t stats;
+    
     prism_output_t* next;
 };
 
@@ -188,6 +248,11 @@ struct prism_seat {
     uint32_t button_state;
     prism_surface_t* pointer_focus;
     
+    // Cursor: a surface kept over everything, at the pointer less the
+    // hotspot
+    prism_surface_t* cursor;
+    prism_point_t cursor_hotspot;
+    
     // Keyboard state
     uint32_t* pressed_keys;
     uint32_t key_count;
@@ -262,6 +327,16 @@ typedef struct {
     uint32_t animation_duration;
 } prism_compositor_t;
 
+// Compositor benchmark result (one per blit implementation)
+typedef struct {
+    uint32_t windows;
+    uint32_t frames;
+    uint64_t frame_cycles;      // Mean
+    uint64_t frame_cycles_max;
+    uint64_t frame_usec;        // Mean, from the calibrated TSC
+    uint32_t impl;              // prism_blit_impl_t
+} prism_bench_t;
+
 // =============================================================================
 // Function Prototypes
 // =============================================================================
@@ -285,8 +360,11 @@ void prism_lower_surface(prism_surface_t* surface);
 
 // Surface operations
 void prism_surface_attach_buffer(prism_surface_t* surface, prism_buffer_t* buffer);
+void prism_buffer_premultiply(prism_buffer_t* buffer);
 void prism_surface_commit(prism_surface_t* surface);
 void prism_surface_damage(prism_surface_t* surface, prism_rect_t* rect);
+void prism_surface_damage_all(prism_surface_t* surface);
+void prism_surface_set_opaque_region(prism_surface_t* surface, prism_rect_t* rect);
 void prism_surface_set_geometry(prism_surface_t* surface, prism_rect_t* geometry);
 void prism_surface_set_opacity(prism_surface_t* surface, float opacity);
 
@@ -303,6 +381,12 @@ void prism_repaint(prism_output_t* output);
 void prism_render_surface(prism_surface_t* surface, prism_output_t* output);
 void prism_composite(prism_output_t* output);
 void prism_present(prism_output_t* output);
+void prism_present_damage(prism_output_t* output, const prism_region_t* damage);
+void prism_present_flip(prism_output_t* output);
+int prism_output_enable_flip(prism_output_t* output);
+bool prism_output_wait_vblank(prism_output_t* output, uint64_t timeout_usec);
+size_t prism_benchmark(prism_bench_t* results, size_t max_results, uint32_t windows,
+                       uint32_t frames);
 
 // Input handling
 void prism_handle_key(prism_seat_t* seat, uint32_t key, bool pressed);
@@ -315,6 +399,8 @@ void prism_handle_touch(prism_seat_t* seat, int32_t id, int32_t x, int32_t y,
 // Focus management
 void prism_set_keyboard_focus(prism_seat_t* seat, prism_surface_t* surface);
 void prism_set_pointer_focus(prism_seat_t* seat, prism_surface_t* surface);
+void prism_set_cursor(prism_seat_t* seat, prism_surface_t* surface, int32_t hotspot_x,
+                      int32_t hotspot_y);
 
 // Animation
 void prism_animate_surface(prism_surface_t* surface, prism_rect_t* from,
@@ -324,12 +410,23 @@ void prism_animate_opacity(prism_surface_t* surface, float from, float to,
 
 // Effects
 void prism_apply_blur(prism_surface_t* surface, float radius);
+void prism_apply_blur_pass(prism_output_t* output);
+prism_blur_t* prism_blur_update(prism_blur_t* blur, prism_output_t* output,
+                                const prism_rect_t* rect);
+bool prism_blur_matches(const prism_blur_t* blur, prism_output_t* output,
+                        const prism_rect_t* rect);
+void prism_blur_draw(const prism_blur_t* blur, prism_output_t* output, const prism_rect_t* clip);
+void prism_blur_destroy(prism_blur_t* blur);
 void prism_apply_shadow(prism_surface_t* surface, float radius, prism_color_t* color);
 
 // Helper functions
 prism_surface_t* prism_surface_at(prism_point_t* point);
 bool prism_rect_contains_point(prism_rect_t* rect, prism_point_t* point);
 bool prism_rect_intersects(prism_rect_t* a, prism_rect_t* b);
+bool prism_rect_intersect(const prism_rect_t* a, const prism_rect_t* b, prism_rect_t* result);
+bool prism_rect_covers(const prism_rect_t* outer, const prism_rect_t* inner);
+prism_rect_t prism_rect_union(const prism_rect_t* a, const prism_rect_t* b);
+void prism_region_add(prism_region_t* region, const prism_rect_t* rect);
 void prism_matrix_multiply(prism_matrix_t* result, prism_matrix_t* a, prism_matrix_t* b);
 void prism_matrix_translate(prism_matrix_t* matrix, float x, float y);
 void prism_matrix_scale(prism_matrix_t* matrix, float x, float y);
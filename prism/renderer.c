@@ -5,9 +5,18 @@
 
 #include "renderer.h"
 #include "prism.h"
+#include "blit.h"
+#include "backend.h"
 #include "../continuum/flux_memory.h"
 #include "../continuum/drivers/graphics/vesa.h"
 
+#include <emmintrin.h>
+
+// Blur: a Gaussian of PRISM_BLUR_RADIUS at full resolution, stood in for
+// by PRISM_BLUR_PASSES box blurs at a half or a quarter of it
+#define PRISM_BLUR_RADIUS       10
+#define PRISM_BLUR_PASSES       3
+
 // =============================================================================
 // Renderer State
 // =============================================================================
@@ -35,9 +44,13 @@ typedef struct {
     } texture_cache[256];
     uint32_t texture_count;
     
-    // Blur buffers
-    uint32_t* blur_buffer_h;
-    uint32_t* blur_buffer_v;
+    // Blur: downsampling and box radii, fixed at create, and a scratch
+    // plane for the passes grown as needed
+    uint32_t blur_shift;        // Downsampled by 1 << blur_shift
+    uint32_t blur_box[PRISM_BLUR_PASSES];
+    uint32_t* blur_scratch;
+    size_t blur_scratch_size;   // Pixels
+    prism_blur_t* output_blur;  // prism_apply_blur_pass's
     
     // Shadow cache
     uint32_t* shadow_texture;
@@ -50,38 +63,46 @@ static prism_renderer_t* g_renderer;
 // Pixel Operations
 // =============================================================================
 
+// Porter-Duff "over" on premultiplied pixels
 uint32_t prism_alpha_blend(uint32_t dst, uint32_t src) {
-    uint8_t src_a = (src >> 24) & 0xFF;
+    return prism_pixel_over(dst, src);
+}
     
-    if (src_a == 0) {
-        return dst;
-    }
-    if (src_a == 255) {
-        return src;
+// Scale a premultiplied pixel by opacity, 0 to PRISM_OPACITY_ONE
+uint32_t prism_blend_alpha(uint32_t pixel, uint32_t opacity) {
+    return prism_pixel_scale(pixel, opacity);
+}
+
+// Bring a buffer to premultiplied ARGB in place: straight alpha has its
+// colour multiplied through, and XRGB is given an opaque alpha. Done once,
+// when it's attached; the buffer is tagged premultiplied afterwards.
+void prism_buffer_premultiply(prism_buffer_t* buffer) {
+    if (!buffer || !buffer->data ||
+        buffer->format == PIXEL_FORMAT_ARGB8888_PREMULTIPLIED) {
+        return;
     }
     
-    uint8_t dst_r = (dst >> 16) & 0xFF;
-    uint8_t dst_g = (dst >> 8) & 0xFF;
-    uint8_t dst_b = dst & 0xFF;
-    uint8_t dst_a = (dst >> 24) & 0xFF;
-    
-    uint8_t src_r = (src >> 16) & 0xFF;
-    uint8_t src_g = (src >> 8) & 0xFF;
-    uint8_t src_b = src & 0xFF;
+    for (uint32_t y = 0; y < buffer->height; y++) {
+        uint32_t* row = (uint32_t*)((uint8_t*)buffer->data + (size_t)y * buffer->stride);
+        for (uint32_t x = 0; x < buffer->width; x++) {
+            uint32_t pixel = row[x];
+            if (buffer->format == PIXEL_FORMAT_XRGB8888) {
+                row[x] = pixel | 0xFF000000;
+                continue;
+            }
     
-    // Porter-Duff "over" operator
-    uint8_t out_a = src_a + (dst_a * (255 - src_a)) / 255;
-    uint8_t out_r = (src_r * src_a + dst_r * dst_a * (255 - src_a) / 255) / out_a;
-    uint8_t out_g = (src_g * src_a + dst_g * dst_a * (255 - src_a) / 255) / out_a;
-    uint8_t out_b = (src_b * src_a + dst_b * dst_a * (255 - src_a) / 255) / out_a;
+            uint32_t a = pixel >> 24;
+            if (a == 255) {
+                continue;
+            }
+            uint32_t r = prism_div255(((pixel >> 16) & 0xFF) * a);
+            uint32_t g = prism_div255(((pixel >> 8) & 0xFF) * a);
+            uint32_t b = prism_div255((pixel & 0xFF) * a);
+            row[x] = (a << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
     
-    return (out_a << 24) | (out_r << 16) | (out_g << 8) | out_b;
-}
-
-uint32_t prism_blend_alpha(uint32_t pixel, float alpha) {
-    uint8_t a = (pixel >> 24) & 0xFF;
-    a = (uint8_t)(a * alpha);
-    return (pixel & 0x00FFFFFF) | (a << 24);
+    buffer->format = PIXEL_FORMAT_ARGB8888_PREMULTIPLIED;
 }
 
 uint32_t prism_sample_pixel(prism_buffer_t* buffer, float x, float y) {
@@ -108,44 +129,53 @@ uint32_t prism_sample_pixel(prism_buffer_t* buffer, float x, float y) {
 // Clear and Fill
 // =============================================================================
 
-void prism_clear_output(prism_output_t* output) {
-    if (!output || !output->framebuffer) {
+// rect is output-local and within the output
+void prism_clear_rect(prism_output_t* output, const prism_rect_t* rect) {
+    if (!output) {
         return;
     }
     
     // Clear to desktop background color
     uint32_t bg_color = 0xFF1E1E2E;  // Dark background
-    
-    for (uint32_t y = 0; y < output->height; y++) {
-        for (uint32_t x = 0; x < output->width; x++) {
-            output->framebuffer[y * output->fb_stride + x] = bg_color;
-        }
+    PRISM_BACKEND_OP(output, fill)(output, rect, bg_color);
+}
+
+void prism_clear_output(prism_output_t* output) {
+    if (!output) {
+        return;
     }
+    
+    prism_rect_t all = { 0, 0, output->width, output->height };
+    prism_clear_rect(output, &all);
 }
 
 // =============================================================================
 // Shadow Rendering
 // =============================================================================
 
-void prism_render_shadow(prism_output_t* output, prism_rect_t* rect) {
-    const int shadow_radius = 20;
+// Only the part of the shadow within clip, an output-local rect within
+// the output, is drawn
+void prism_render_shadow(prism_output_t* output, prism_rect_t* rect, const prism_rect_t* clip) {
+    const int shadow_radius = PRISM_SHADOW_RADIUS;
     const int shadow_offset_x = 0;
-    const int shadow_offset_y = 5;
+    const int shadow_offset_y = PRISM_SHADOW_OFFSET_Y;
     const uint8_t shadow_alpha = 64;
     
     // Calculate shadow bounds
-    int32_t shadow_x = rect->x + shadow_offset_x - shadow_radius;
-    int32_t shadow_y = rect->y + shadow_offset_y - shadow_radius;
-    uint32_t shadow_w = rect->width + shadow_radius * 2;
-    uint32_t shadow_h = rect->height + shadow_radius * 2;
+    prism_rect_t bounds = {
+        .x = rect->x + shadow_offset_x - shadow_radius,
+        .y = rect->y + shadow_offset_y - shadow_radius,
+        .width = rect->width + shadow_radius * 2,
+        .height = rect->height + shadow_radius * 2
+    };
+    prism_rect_t area;
+    if (!prism_rect_intersect(&bounds, clip, &area)) {
+        return;
+    }
     
     // Render gaussian blur shadow
-    for (int32_t y = shadow_y; y < shadow_y + shadow_h; y++) {
-        for (int32_t x = shadow_x; x < shadow_x + shadow_w; x++) {
-            if (x < 0 || y < 0 || x >= output->width || y >= output->height) {
-                continue;
-            }
-            
+    for (int32_t y = area.y; y < area.y + (int32_t)area.height; y++) {
+        for (int32_t x = area.x; x < area.x + (int32_t)area.width; x++) {
             // Calculate distance from shadow rect
             int32_t dx = 0, dy = 0;
             if (x < rect->x + shadow_offset_x) {
@@ -176,78 +206,497 @@ void prism_render_shadow(prism_output_t* output, prism_rect_t* rect) {
 // Blur Effect
 // =============================================================================
 
-void prism_apply_blur_pass(prism_output_t* output) {
-    if (!g_renderer || !g_renderer->blur_buffer_h || !g_renderer->blur_buffer_v) {
-        return;
+// A blurred copy of part of an output, at the downsampled scale
+struct prism_blur {
+    uint32_t output_id;
+    prism_rect_t rect;          // Output-local area it was taken from
+    uint32_t width;             // Downsampled
+    uint32_t height;
+    size_t capacity;            // Pixels allocated
+    uint32_t* pixels;
+};
+
+// Channels to 16 bits a lane, and back
+static inline __m128i blur_unpack(uint32_t pixel) {
+    return _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)pixel), _mm_setzero_si128());
+}
+
+static inline uint32_t blur_pack(__m128i v) {
+    return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+}
+
+// Box radii for PRISM_BLUR_PASSES boxes whose sum is the Gaussian, at the
+// downsampled scale: boxes of two widths, as many of each as matches sigma
+static void prism_blur_precompute(void) {
+    float sigma = PRISM_BLUR_RADIUS / 3.0f;
+    g_renderer->blur_shift = PRISM_BLUR_RADIUS >= 16 ? 2 : 1;
+    sigma /= (float)(1 << g_renderer->blur_shift);
+    
+    const int n = PRISM_BLUR_PASSES;
+    int lower = (int)sqrtf(12.0f * sigma * sigma / n + 1.0f);
+    if (lower % 2 == 0) {
+        lower--;
     }
+    float ideal = (12.0f * sigma * sigma - n * lower * lower - 4 * n * lower - 3 * n) /
+                  (-4.0f * lower - 4.0f);
+    int smaller = (int)(ideal + 0.5f);
     
-    const int blur_radius = 10;
-    const float sigma = blur_radius / 3.0f;
+    for (int i = 0; i < n; i++) {
+        int width = i < smaller ? lower : lower + 2;
+        g_renderer->blur_box[i] = width > 1 ? (uint32_t)(width - 1) / 2 : 1;
+    }
+}
+
+// One line of a box blur, count pixels stride apart, from src into dst.
+// A running sum, so the cost doesn't grow with the radius; the edge
+// pixels repeat past the ends.
+static void blur_box_line(uint32_t* dst, const uint32_t* src, uint32_t count, size_t stride,
+                          uint32_t radius) {
+    const __m128i recip = _mm_set1_epi16((short)(65536 / (2 * radius + 1)));
+    const __m128i round = _mm_set1_epi16((short)radius);
+    uint32_t last = count - 1;
+    
+    __m128i sum = _mm_mullo_epi16(blur_unpack(src[0]), _mm_set1_epi16((short)(radius + 1)));
+    for (uint32_t i = 1; i <= radius; i++) {
+        sum = _mm_add_epi16(sum, blur_unpack(src[(i < last ? i : last) * stride]));
+    }
     
-    // Generate gaussian kernel
-    float kernel[blur_radius * 2 + 1];
-    float kernel_sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        dst[i * stride] = blur_pack(_mm_mulhi_epu16(_mm_add_epi16(sum, round), recip));
+        
+        uint32_t in = i + radius + 1 < last ? i + radius + 1 : last;
+        uint32_t out = i > radius ? i - radius : 0;
+        sum = _mm_add_epi16(sum, blur_unpack(src[in * stride]));
+        sum = _mm_sub_epi16(sum, blur_unpack(src[out * stride]));
+    }
+}
+
+// Average each block of the output into one pixel of the cache
+static void blur_downsample(prism_blur_t* blur, prism_output_t* output) {
+    uint32_t shift = g_renderer->blur_shift;
+    uint32_t block = 1 << shift;
+    const __m128i round = _mm_set1_epi16((short)(block * block / 2));
+    int32_t right = blur->rect.x + blur->rect.width - 1;
+    int32_t bottom = blur->rect.y + blur->rect.height - 1;
+    
+    for (uint32_t dy = 0; dy < blur->height; dy++) {
+        for (uint32_t dx = 0; dx < blur->width; dx++) {
+            __m128i acc = _mm_setzero_si128();
+            for (uint32_t j = 0; j < block; j++) {
+                int32_t sy = blur->rect.y + (int32_t)((dy << shift) + j);
+                const uint32_t* row = &output->framebuffer[(sy < bottom ? sy : bottom) *
+                                                           output->fb_stride];
+                for (uint32_t i = 0; i < block; i++) {
+                    int32_t sx = blur->rect.x + (int32_t)((dx << shift) + i);
+                    acc = _mm_add_epi16(acc, blur_unpack(row[sx < right ? sx : right]));
+                }
+            }
+            acc = _mm_srli_epi16(_mm_add_epi16(acc, round), 2 * shift);
+            blur->pixels[dy * blur->width + dx] = blur_pack(acc);
+        }
+    }
+}
+
+// Whether blur was taken from rect of output, and so can be drawn again
+bool prism_blur_matches(const prism_blur_t* blur, prism_output_t* output,
+                        const prism_rect_t* rect) {
+    return blur && blur->output_id == output->id &&
+           memcmp(&blur->rect, rect, sizeof(prism_rect_t)) == 0;
+}
+
+// Take a blurred copy of rect, an output-local rect within the output,
+// from what the framebuffer has there now. blur is reused if it's big
+// enough; returns the copy (which may not be blur), or NULL if there's
+// no memory for it.
+prism_blur_t* prism_blur_update(prism_blur_t* blur, prism_output_t* output,
+                                const prism_rect_t* rect) {
+    return PRISM_BACKEND_OP(output, blur)(blur, output, rect);
+}
+
+// Draw what of blur falls within clip, an output-local rect, scaled back
+// up from however the backend that took it keeps it
+void prism_blur_draw(const prism_blur_t* blur, prism_output_t* output, const prism_rect_t* clip) {
+    PRISM_BACKEND_OP(output, blur_draw)(blur, output, clip);
+}
+
+static prism_blur_t* prism_cpu_blur(prism_blur_t* blur, prism_output_t* output,
+                                    const prism_rect_t* rect) {
+    if (!g_renderer || !output->framebuffer || rect->width == 0 || rect->height == 0) {
+        return blur;
+    }
     
-    for (int i = -blur_radius; i <= blur_radius; i++) {
-        float val = expf(-(i * i) / (2 * sigma * sigma));
-        kernel[i + blur_radius] = val;
-        kernel_sum += val;
+    uint32_t shift = g_renderer->blur_shift;
+    uint32_t width = (rect->width + (1 << shift) - 1) >> shift;
+    uint32_t height = (rect->height + (1 << shift) - 1) >> shift;
+    size_t pixels = (size_t)width * height;
+    
+    if (!blur) {
+        blur = flux_allocate(NULL, sizeof(prism_blur_t), FLUX_ALLOC_KERNEL | FLUX_ALLOC_ZERO);
+        if (!blur) {
+            return NULL;
+        }
+    }
+    if (blur->capacity < pixels) {
+        flux_free(blur->pixels);
+        blur->pixels = flux_allocate(NULL, pixels * 4, FLUX_ALLOC_KERNEL);
+        blur->capacity = blur->pixels ? pixels : 0;
+    }
+    if (g_renderer->blur_scratch_size < pixels) {
+        flux_free(g_renderer->blur_scratch);
+        g_renderer->blur_scratch = flux_allocate(NULL, pixels * 4, FLUX_ALLOC_KERNEL);
+        g_renderer->blur_scratch_size = g_renderer->blur_scratch ? pixels : 0;
+    }
+    if (!blur->pixels || !g_renderer->blur_scratch) {
+        prism_blur_destroy(blur);
+        return NULL;
     }
     
-    // Normalize kernel
-    for (int i = 0; i < blur_radius * 2 + 1; i++) {
-        kernel[i] /= kernel_sum;
+    blur->output_id = output->id;
+    blur->rect = *rect;
+    blur->width = width;
+    blur->height = height;
+    blur_downsample(blur, output);
+    
+    // Boxes are separable: across into the scratch plane, then down back
+    uint32_t* scratch = g_renderer->blur_scratch;
+    for (int pass = 0; pass < PRISM_BLUR_PASSES; pass++) {
+        uint32_t radius = g_renderer->blur_box[pass];
+        for (uint32_t y = 0; y < height; y++) {
+            blur_box_line(&scratch[y * width], &blur->pixels[y * width], width, 1, radius);
+        }
+        for (uint32_t x = 0; x < width; x++) {
+            blur_box_line(&blur->pixels[x], &scratch[x], height, width, radius);
+        }
     }
     
-    // Horizontal pass
-    for (uint32_t y = 0; y < output->height; y++) {
-        for (uint32_t x = 0; x < output->width; x++) {
-            float r = 0, g = 0, b = 0, a = 0;
-            
-            for (int i = -blur_radius; i <= blur_radius; i++) {
-                int32_t sx = x + i;
-                if (sx < 0) sx = 0;
-                if (sx >= output->width) sx = output->width - 1;
-                
-                uint32_t pixel = output->framebuffer[y * output->fb_stride + sx];
-                float weight = kernel[i + blur_radius];
-                
-                a += ((pixel >> 24) & 0xFF) * weight;
-                r += ((pixel >> 16) & 0xFF) * weight;
-                g += ((pixel >> 8) & 0xFF) * weight;
-                b += (pixel & 0xFF) * weight;
+    return blur;
+}
+
+// Scaled back up bilinearly
+static void prism_cpu_blur_draw(const prism_blur_t* blur, prism_output_t* output,
+                                const prism_rect_t* clip) {
+    prism_rect_t area;
+    if (!blur || !output->framebuffer || !prism_rect_intersect(&blur->rect, clip, &area)) {
+        return;
+    }
+    
+    uint32_t shift = g_renderer->blur_shift;
+    
+    for (uint32_t y = 0; y < area.height; y++) {
+        // Pixel centres in the cache, in 1/256ths
+        int32_t v = ((((int32_t)(area.y - blur->rect.y + y) << 8) + 128) >> shift) - 128;
+        if (v < 0) {
+            v = 0;
+        }
+        uint32_t y0 = v >> 8;
+        uint32_t y1 = y0 + 1 < blur->height ? y0 + 1 : y0;
+        __m128i wy = _mm_set1_epi16((short)(v & 0xFF));
+        __m128i iwy = _mm_set1_epi16((short)(256 - (v & 0xFF)));
+        const uint32_t* top = &blur->pixels[y0 * blur->width];
+        const uint32_t* bottom = &blur->pixels[y1 * blur->width];
+        uint32_t* dst = &output->framebuffer[(area.y + y) * output->fb_stride + area.x];
+    
+        for (uint32_t x = 0; x < area.width; x++) {
+            int32_t u = ((((int32_t)(area.x - blur->rect.x + x) << 8) + 128) >> shift) - 128;
+            if (u < 0) {
+                u = 0;
             }
+            uint32_t x0 = u >> 8;
+            uint32_t x1 = x0 + 1 < blur->width ? x0 + 1 : x0;
+            __m128i wx = _mm_set1_epi16((short)(u & 0xFF));
+            __m128i iwx = _mm_set1_epi16((short)(256 - (u & 0xFF)));
             
-            g_renderer->blur_buffer_h[y * output->width + x] = 
-                ((uint8_t)a << 24) | ((uint8_t)r << 16) | ((uint8_t)g << 8) | (uint8_t)b;
+            __m128i t = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(blur_unpack(top[x0]), iwx),
+                                                     _mm_mullo_epi16(blur_unpack(top[x1]), wx)), 8);
+            __m128i b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(blur_unpack(bottom[x0]), iwx),
+                                                     _mm_mullo_epi16(blur_unpack(bottom[x1]), wx)), 8);
+            dst[x] = blur_pack(_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(t, iwy),
+                                                            _mm_mullo_epi16(b, wy)), 8));
         }
     }
+}
+
+void prism_blur_destroy(prism_blur_t* blur) {
+    if (blur) {
+        flux_free(blur->pixels);
+        flux_free(blur);
+    }
+}
+
+// Blur the whole output in place. The compositor itself blurs only what's
+// behind translucent windows; this is for effects that want all of it.
+void prism_apply_blur_pass(prism_output_t* output) {
+    if (!g_renderer || !output) {
+        return;
+    }
     
-    // Vertical pass
-    for (uint32_t y = 0; y < output->height; y++) {
-        for (uint32_t x = 0; x < output->width; x++) {
-            float r = 0, g = 0, b = 0, a = 0;
-            
-            for (int i = -blur_radius; i <= blur_radius; i++) {
-                int32_t sy = y + i;
-                if (sy < 0) sy = 0;
-                if (sy >= output->height) sy = output->height - 1;
-                
-                uint32_t pixel = g_renderer->blur_buffer_h[sy * output->width + x];
-                float weight = kernel[i + blur_radius];
-                
-                a += ((pixel >> 24) & 0xFF) * weight;
-                r += ((pixel >> 16) & 0xFF) * weight;
-                g += ((pixel >> 8) & 0xFF) * weight;
-                b += (pixel & 0xFF) * weight;
+    prism_rect_t all = { 0, 0, output->width, output->height };
+    g_renderer->output_blur = prism_blur_update(g_renderer->output_blur, output, &all);
+    prism_blur_draw(g_renderer->output_blur, output, &all);
+}
+
+// =============================================================================
+// Presentation
+// =============================================================================
+
+// Flip between pages of video memory where the display can, rather than
+// copying to the screen. Returns the pages flipped between, or -1.
+static int prism_cpu_enable_flip(prism_output_t* output) {
+    int pages = vesa_enable_page_flip();
+    if (pages < 2) {
+        return -1;
+    }
+    if (pages > PRISM_MAX_FLIP_PAGES) {
+        pages = PRISM_MAX_FLIP_PAGES;
+    }
+    
+    // Nothing's been drawn into any page yet
+    prism_rect_t all = { 0, 0, output->width, output->height };
+    for (int i = 0; i < pages - 1; i++) {
+        output->present_history[i].rects[0] = all;
+        output->present_history[i].count = 1;
+    }
+    output->flip_pages = (uint32_t)pages;
+    return pages;
+}
+
+// Only damage goes to the display. Flipping, it goes to the page to be
+// shown next with the damage of the frames since that page was last
+// shown, and prism_present_flip shows it; copying, it goes to the screen
+// through the back buffer if there is one.
+static void prism_cpu_present(prism_output_t* output, const prism_region_t* damage) {
+    if (!output->framebuffer) {
+        return;
+    }
+    
+    prism_region_t region = *damage;
+    if (output->flip_pages > 1) {
+        uint32_t ages = output->flip_pages - 1;
+        for (uint32_t i = 0; i < ages; i++) {
+            const prism_region_t* past = &output->present_history[i];
+            for (uint32_t r = 0; r < past->count; r++) {
+                prism_region_add(&region, &past->rects[r]);
             }
-            
-            output->framebuffer[y * output->fb_stride + x] = 
-                ((uint8_t)a << 24) | ((uint8_t)r << 16) | ((uint8_t)g << 8) | (uint8_t)b;
+        }
+        for (uint32_t i = ages - 1; i > 0; i--) {
+            output->present_history[i] = output->present_history[i - 1];
+        }
+        output->present_history[0] = *damage;
+    }
+    
+    for (uint32_t i = 0; i < region.count; i++) {
+        const prism_rect_t* rect = &region.rects[i];
+        vesa_blit(rect->x, rect->y, rect->width, rect->height,
+                  &output->framebuffer[rect->y * output->fb_stride + rect->x], output->fb_stride);
+        if (!output->flip_pages) {
+            vesa_swap_rect(rect->x, rect->y, rect->width, rect->height);
         }
     }
 }
 
+static void prism_cpu_flip(prism_output_t* output) {
+    if (output->flip_pages) {
+        vesa_flip();
+    }
+}
+
+static bool prism_cpu_wait_vblank(prism_output_t* output, uint64_t timeout_usec) {
+    (void)output;
+    if (!vesa_has_vblank()) {
+        return false;
+    }
+    return vesa_wait_vblank(timeout_usec);
+}
+
+int prism_output_enable_flip(prism_output_t* output) {
+    if (!output) {
+        return -1;
+    }
+    return PRISM_BACKEND_OP(output, enable_flip)(output);
+}
+
+void prism_present_damage(prism_output_t* output, const prism_region_t* damage) {
+    if (output) {
+        PRISM_BACKEND_OP(output, present)(output, damage);
+    }
+}
+
+void prism_present_flip(prism_output_t* output) {
+    if (output) {
+        PRISM_BACKEND_OP(output, flip)(output);
+    }
+}
+
+// Wait for the display's next vertical retrace. False if it didn't come
+// within the timeout or the display doesn't report one.
+bool prism_output_wait_vblank(prism_output_t* output, uint64_t timeout_usec) {
+    if (!output) {
+        return false;
+    }
+    return PRISM_BACKEND_OP(output, wait_vblank)(output, timeout_usec);
+}
+
+// =============================================================================
+// CPU Backend
+// =============================================================================
+
+// Drawing on the CPU, with the blit kernels, into output->framebuffer, and
+// presenting it by copying or flipping through VESA
+
+static void prism_cpu_fill(prism_output_t* output, const prism_rect_t* rect, uint32_t color) {
+    if (!output->framebuffer) {
+        return;
+    }
+    
+    for (uint32_t y = rect->y; y < rect->y + rect->height; y++) {
+        uint32_t* dst = &output->framebuffer[(size_t)y * output->fb_stride + rect->x];
+        for (uint32_t x = 0; x < rect->width; x++) {
+            dst[x] = color;
+        }
+    }
+}
+
+static inline uint32_t prism_buffer_clamp(int64_t v, uint32_t size) {
+    if (v < 0) {
+        return 0;
+    }
+    return v >= size ? size - 1 : (uint32_t)v;
+}
+
+// One row of an unscaled blit: count pixels from buffer column sx, which
+// may start or run off either edge of the buffer. Off the edges the edge
+// pixel repeats; within them it's a copy or a blend of the whole span.
+static void prism_blit_span(uint32_t* dst, const uint32_t* row, int64_t sx, uint32_t count,
+                            uint32_t width, bool opaque, uint32_t opacity) {
+    int64_t first = sx < 0 ? -sx : 0;
+    int64_t last = (int64_t)width - sx;
+    if (first > count) {
+        first = count;
+    }
+    if (last > count) {
+        last = count;
+    }
+    if (last < first) {
+        last = first;
+    }
+    
+    for (int64_t i = 0; i < first; i++) {
+        dst[i] = opaque ? row[0] : prism_blit_pixel(dst[i], row[0], opacity);
+    }
+    
+    if (opaque) {
+        prism_blit_copy_row(dst + first, row + sx + first, last - first);
+    } else {
+        prism_blit_blend_row(dst + first, row + sx + first, last - first, opacity);
+    }
+    
+    for (int64_t i = last; i < count; i++) {
+        dst[i] = opaque ? row[width - 1] : prism_blit_pixel(dst[i], row[width - 1], opacity);
+    }
+}
+
+static void prism_cpu_blit(prism_output_t* output, const prism_rect_t* area,
+                           const prism_buffer_t* buffer, int64_t sx, int64_t sy,
+                           bool opaque, uint32_t opacity) {
+    if (!output->framebuffer) {
+        return;
+    }
+    
+    const uint32_t* src = (const uint32_t*)buffer->data;
+    uint32_t src_stride = buffer->stride / 4;
+    uint32_t* dst = output->framebuffer + (size_t)area->y * output->fb_stride + area->x;
+    
+    for (uint32_t y = 0; y < area->height; y++, dst += output->fb_stride) {
+        uint32_t row = prism_buffer_clamp(sy + y, buffer->height);
+        prism_blit_span(dst, src + (size_t)row * src_stride, sx, area->width,
+                        buffer->width, opaque, opacity);
+    }
+}
+
+static void prism_cpu_copy(prism_output_t* output, const prism_rect_t* area,
+                           const prism_buffer_t* buffer, int64_t sx, int64_t sy) {
+    prism_cpu_blit(output, area, buffer, sx, sy, true, PRISM_OPACITY_ONE);
+}
+
+static void prism_cpu_blend(prism_output_t* output, const prism_rect_t* area,
+                            const prism_buffer_t* buffer, int64_t sx, int64_t sy,
+                            uint32_t opacity) {
+    prism_cpu_blit(output, area, buffer, sx, sy, false, opacity);
+}
+
+// Nearest pixel, stepping through the buffer in fixed point
+static void prism_cpu_blit_scaled(prism_output_t* output, const prism_rect_t* area,
+                                  const prism_buffer_t* buffer, const prism_blit_map_t* map,
+                                  bool opaque, uint32_t opacity) {
+    if (!output->framebuffer) {
+        return;
+    }
+    
+    const uint32_t* src = (const uint32_t*)buffer->data;
+    uint32_t src_stride = buffer->stride / 4;
+    uint32_t* dst = output->framebuffer + (size_t)area->y * output->fb_stride + area->x;
+    int64_t fy = map->fy;
+    
+    for (uint32_t y = 0; y < area->height; y++, dst += output->fb_stride, fy += map->step_y) {
+        const uint32_t* row = src + (size_t)prism_buffer_clamp(fy >> 16, buffer->height) *
+                                    src_stride;
+        int64_t fx = map->fx;
+        for (uint32_t x = 0; x < area->width; x++, fx += map->step_x) {
+            uint32_t pixel = row[prism_buffer_clamp(fx >> 16, buffer->width)];
+            dst[x] = opaque ? pixel : prism_blit_pixel(dst[x], pixel, opacity);
+        }
+    }
+}
+
+const prism_backend_t prism_backend_cpu = {
+    .name = "cpu",
+    .fill = prism_cpu_fill,
+    .copy = prism_cpu_copy,
+    .blend = prism_cpu_blend,
+    .blit_scaled = prism_cpu_blit_scaled,
+    .blur = prism_cpu_blur,
+    .blur_draw = prism_cpu_blur_draw,
+    .enable_flip = prism_cpu_enable_flip,
+    .present = prism_cpu_present,
+    .flip = prism_cpu_flip,
+    .wait_vblank = prism_cpu_wait_vblank
+};
+
+// =============================================================================
+// Backend Selection
+// =============================================================================
+
+// Tried in order; the CPU backend, which needs no attaching, comes last
+static const prism_backend_t* const g_backends[] = {
+    &prism_backend_virtio_gpu
+};
+
+const prism_backend_t* prism_backend_select(prism_output_t* output) {
+    if (!output) {
+        return NULL;
+    }
+    
+    output->backend = &prism_backend_cpu;
+    for (size_t i = 0; i < sizeof(g_backends) / sizeof(g_backends[0]); i++) {
+        if (g_backends[i]->attach && g_backends[i]->attach(output) == 0) {
+            output->backend = g_backends[i];
+            break;
+        }
+    }
+    return output->backend;
+}
+
+void prism_backend_release(prism_output_t* output) {
+    if (!output || !output->backend) {
+        return;
+    }
+    
+    if (output->backend->detach) {
+        output->backend->detach(output);
+    }
+    output->backend = NULL;
+}
+
 // =============================================================================
 // Matrix Operations
 // =============================================================================
@@ -325,11 +774,8 @@ void* prism_renderer_create(void) {
         return NULL;
     }
     
-    // Allocate blur buffers (for 4K support)
-    g_renderer->blur_buffer_h = flux_allocate(NULL, 3840 * 2160 * 4,
-                                             FLUX_ALLOC_KERNEL);
-    g_renderer->blur_buffer_v = flux_allocate(NULL, 3840 * 2160 * 4,
-                                             FLUX_ALLOC_KERNEL);
+    // Blur boxes; the planes come with the first blur
+    prism_blur_precompute();
     
     // Initialize shadow texture
     g_renderer->shadow_size = 256;
@@ -344,12 +790,10 @@ void* prism_renderer_create(void) {
 
 void prism_renderer_destroy(void* renderer) {
     if (g_renderer) {
-        if (g_renderer->blur_buffer_h) {
-            flux_free(g_renderer->blur_buffer_h);
-        }
-        if (g_renderer->blur_buffer_v) {
-            flux_free(g_renderer->blur_buffer_v);
+        if (g_renderer->blur_scratch) {
+            flux_free(g_renderer->blur_scratch);
         }
+        prism_blur_destroy(g_renderer->output_blur);
         if (g_renderer->shadow_texture) {
             flux_free(g_renderer->shadow_texture);
         }
@@ -388,3 +832,82 @@ bool prism_rect_intersects(prism_rect_t* a, prism_rect_t* b) {
             a->y + a->height <= b->y ||
             b->y + b->height <= a->y);
 }
+
+// The overlap of a and b in result; false, result untouched, if none
+bool prism_rect_intersect(const prism_rect_t* a, const prism_rect_t* b, prism_rect_t* result) {
+    int64_t x0 = a->x > b->x ? a->x : b->x;
+    int64_t y0 = a->y > b->y ? a->y : b->y;
+    int64_t ax1 = (int64_t)a->x + a->width, bx1 = (int64_t)b->x + b->width;
+    int64_t ay1 = (int64_t)a->y + a->height, by1 = (int64_t)b->y + b->height;
+    int64_t x1 = ax1 < bx1 ? ax1 : bx1;
+    int64_t y1 = ay1 < by1 ? ay1 : by1;
+    if (x1 <= x0 || y1 <= y0) {
+        return false;
+    }
+    
+    result->x = (int32_t)x0;
+    result->y = (int32_t)y0;
+    result->width = (uint32_t)(x1 - x0);
+    result->height = (uint32_t)(y1 - y0);
+    return true;
+}
+
+bool prism_rect_covers(const prism_rect_t* outer, const prism_rect_t* inner) {
+    return inner->x >= outer->x && inner->y >= outer->y &&
+           (int64_t)inner->x + inner->width <= (int64_t)outer->x + outer->width &&
+           (int64_t)inner->y + inner->height <= (int64_t)outer->y + outer->height;
+}
+
+prism_rect_t prism_rect_union(const prism_rect_t* a, const prism_rect_t* b) {
+    int64_t x0 = a->x < b->x ? a->x : b->x;
+    int64_t y0 = a->y < b->y ? a->y : b->y;
+    int64_t ax1 = (int64_t)a->x + a->width, bx1 = (int64_t)b->x + b->width;
+    int64_t ay1 = (int64_t)a->y + a->height, by1 = (int64_t)b->y + b->height;
+    prism_rect_t result = {
+        .x = (int32_t)x0,
+        .y = (int32_t)y0,
+        .width = (uint32_t)((ax1 > bx1 ? ax1 : bx1) - x0),
+        .height = (uint32_t)((ay1 > by1 ? ay1 : by1) - y0)
+    };
+    return result;
+}
+
+static inline uint64_t prism_rect_area(const prism_rect_t* rect) {
+    return (uint64_t)rect->width * rect->height;
+}
+
+// Add rect to region, dropping rects it covers. A full region folds it
+// into whichever rect grows least for it.
+void prism_region_add(prism_region_t* region, const prism_rect_t* rect) {
+    if (rect->width == 0 || rect->height == 0) {
+        return;
+    }
+    
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < region->count; i++) {
+        if (prism_rect_covers(&region->rects[i], rect)) {
+            return;
+        }
+        if (!prism_rect_covers(rect, &region->rects[i])) {
+            region->rects[kept++] = region->rects[i];
+        }
+    }
+    region->count = kept;
+    
+    if (region->count < PRISM_MAX_DAMAGE) {
+        region->rects[region->count++] = *rect;
+        return;
+    }
+    
+    uint32_t best = 0;
+    uint64_t best_growth = UINT64_MAX;
+    for (uint32_t i = 0; i < region->count; i++) {
+        prism_rect_t merged = prism_rect_union(&region->rects[i], rect);
+        uint64_t growth = prism_rect_area(&merged) - prism_rect_area(&region->rects[i]);
+        if (growth < best_growth) {
+            best = i;
+            best_growth = growth;
+        }
+    }
+    region->rects[best] = prism_rect_union(&region->rects[best], rect);
+}